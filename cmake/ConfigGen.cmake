@@ -81,6 +81,30 @@ function(caffe_generate_export_configs)
     list(APPEND Caffe_DEFINITIONS -DUSE_NCCL)
   endif()
 
+  if(NVJPEG_FOUND)
+    list(APPEND Caffe_DEFINITIONS -DUSE_NVJPEG)
+  endif()
+
+  if(NVDEC_FOUND AND FFMPEG_FOUND)
+    list(APPEND Caffe_DEFINITIONS -DUSE_NVDEC)
+  endif()
+
+  if(CUFILE_FOUND)
+    list(APPEND Caffe_DEFINITIONS -DUSE_CUFILE)
+  endif()
+
+  if(NVTX_FOUND)
+    list(APPEND Caffe_DEFINITIONS -DUSE_NVTX)
+  endif()
+
+  if(TensorRT_FOUND)
+    list(APPEND Caffe_DEFINITIONS -DUSE_TENSORRT)
+  endif()
+
+  if(DNNL_FOUND)
+    list(APPEND Caffe_DEFINITIONS -DUSE_ONEDNN)
+  endif()
+
   if(TEST_FP16)
     list(APPEND Caffe_DEFINITIONS -DTEST_FP16=1)
   endif()
@@ -227,6 +227,11 @@ message(STATUS "CUDA detected: " ${CUDA_VERSION})
 include_directories(SYSTEM ${CUDA_INCLUDE_DIRS})
 list(APPEND Caffe_LINKER_LIBS ${CUDA_CUDART_LIBRARY}
                               ${CUDA_curand_LIBRARY} ${CUDA_CUBLAS_LIBRARIES})
+# cuBLASLt runs the CUBLASLT engine of InnerProduct layers
+if(NOT CUDA_VERSION VERSION_LESS 11.0)
+  find_cuda_helper_libs(cublasLt)
+  list(APPEND Caffe_LINKER_LIBS ${CUDA_cublasLt_LIBRARY})
+endif()
 
 # cudnn detection
 if(USE_CUDNN)
@@ -9,6 +9,10 @@ list(APPEND Caffe_LINKER_LIBS ${Boost_LIBRARIES})
 # ---[ Threads
 find_package(Threads REQUIRED)
 list(APPEND Caffe_LINKER_LIBS ${CMAKE_THREAD_LIBS_INIT})
+if(UNIX AND NOT APPLE)
+  # shm_open
+  list(APPEND Caffe_LINKER_LIBS rt)
+endif()
 
 # ---[ Google-glog
 include("cmake/External/glog.cmake")
@@ -108,6 +112,14 @@ elseif(APPLE)
   list(APPEND Caffe_LINKER_LIBS ${vecLib_LINKER_LIBS})
 endif()
 
+# ---[ oneDNN
+if(USE_ONEDNN)
+  find_package(DNNL REQUIRED)
+  add_definitions(-DUSE_ONEDNN)
+  include_directories(SYSTEM ${DNNL_INCLUDE_DIR})
+  list(APPEND Caffe_LINKER_LIBS ${DNNL_LIBRARY})
+endif()
+
 # ---[ Python
 if(BUILD_python)
   if(NOT "${python_version}" VERSION_LESS "3.0.0")
@@ -191,6 +203,47 @@ if(NCCL_FOUND)
   list(APPEND Caffe_LINKER_LIBS ${NCCL_LIBRARY})
 endif()
 
+# ---[ nvJPEG
+if(USE_NVJPEG AND NOT CPU_ONLY)
+  find_package(NVJPEG REQUIRED)
+  add_definitions(-DUSE_NVJPEG)
+  include_directories(SYSTEM ${NVJPEG_INCLUDE_DIR})
+  list(APPEND Caffe_LINKER_LIBS ${NVJPEG_LIBRARY})
+endif()
+
+# ---[ NVDEC, with FFmpeg demuxing
+if(USE_NVDEC AND NOT CPU_ONLY)
+  find_package(NVDEC REQUIRED)
+  find_package(FFmpeg REQUIRED)
+  add_definitions(-DUSE_NVDEC)
+  include_directories(SYSTEM ${NVDEC_INCLUDE_DIR} ${FFMPEG_INCLUDE_DIR})
+  list(APPEND Caffe_LINKER_LIBS ${NVDEC_LIBRARY} ${CUDA_CUDA_LIBRARY} ${FFMPEG_LIBRARIES})
+endif()
+
+# ---[ cuFile, GPUDirect Storage
+if(USE_CUFILE AND NOT CPU_ONLY)
+  find_package(CuFile REQUIRED)
+  add_definitions(-DUSE_CUFILE)
+  include_directories(SYSTEM ${CUFILE_INCLUDE_DIR})
+  list(APPEND Caffe_LINKER_LIBS ${CUFILE_LIBRARY})
+endif()
+
+# ---[ NVTX
+if(USE_NVTX AND NOT CPU_ONLY)
+  find_package(NVTX REQUIRED)
+  add_definitions(-DUSE_NVTX)
+  include_directories(SYSTEM ${NVTX_INCLUDE_DIR})
+  list(APPEND Caffe_LINKER_LIBS ${NVTX_LIBRARY})
+endif()
+
+# ---[ TensorRT
+if(USE_TENSORRT AND NOT CPU_ONLY)
+  find_package(TensorRT REQUIRED)
+  add_definitions(-DUSE_TENSORRT)
+  include_directories(SYSTEM ${TensorRT_INCLUDE_DIR})
+  list(APPEND Caffe_LINKER_LIBS ${TensorRT_LIBRARY})
+endif()
+
 # ---[ NVML
 if(NOT CPU_ONLY AND NOT NO_NVML)
   find_package(NVML)
@@ -0,0 +1,24 @@
+# Find the cuFile library of GPUDirect Storage
+#
+# The following variables are optionally searched for defaults
+#  CUFILE_ROOT_DIR:    Base directory where all cuFile components are found
+#
+# The following are set after configuration is done:
+#  CUFILE_FOUND
+#  CUFILE_INCLUDE_DIR
+#  CUFILE_LIBRARY
+
+find_path(CUFILE_INCLUDE_DIR NAMES cufile.h
+    PATHS ${CUFILE_ROOT_DIR}/include ${CUDA_TOOLKIT_INCLUDE}
+    )
+
+find_library(CUFILE_LIBRARY NAMES cufile
+    PATHS ${CUFILE_ROOT_DIR}/lib ${CUFILE_ROOT_DIR}/lib64 ${CUDA_TOOLKIT_ROOT_DIR}/lib64)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(CuFile DEFAULT_MSG CUFILE_INCLUDE_DIR CUFILE_LIBRARY)
+
+if(CUFILE_FOUND)
+  message(STATUS "Found cuFile (include: ${CUFILE_INCLUDE_DIR}, library: ${CUFILE_LIBRARY})")
+  mark_as_advanced(CUFILE_INCLUDE_DIR CUFILE_LIBRARY)
+endif()
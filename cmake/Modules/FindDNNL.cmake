@@ -0,0 +1,24 @@
+# Find the oneDNN (formerly MKL-DNN) library
+#
+# The following variables are optionally searched for defaults
+#  DNNL_ROOT_DIR:  Base directory where all oneDNN components are found
+#
+# The following are set after configuration is done:
+#  DNNL_FOUND
+#  DNNL_INCLUDE_DIR
+#  DNNL_LIBRARY
+
+find_path(DNNL_INCLUDE_DIR NAMES dnnl.hpp
+    PATHS ${DNNL_ROOT_DIR}/include $ENV{DNNLROOT}/include
+    )
+
+find_library(DNNL_LIBRARY NAMES dnnl
+    PATHS ${DNNL_ROOT_DIR}/lib ${DNNL_ROOT_DIR}/lib64 $ENV{DNNLROOT}/lib $ENV{DNNLROOT}/lib64)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(DNNL DEFAULT_MSG DNNL_INCLUDE_DIR DNNL_LIBRARY)
+
+if(DNNL_FOUND)
+  message(STATUS "Found oneDNN (include: ${DNNL_INCLUDE_DIR}, library: ${DNNL_LIBRARY})")
+  mark_as_advanced(DNNL_INCLUDE_DIR DNNL_LIBRARY)
+endif()
@@ -0,0 +1,33 @@
+# Find the FFmpeg libraries demuxing video files
+#
+# The following variables are optionally searched for defaults
+#  FFMPEG_ROOT_DIR:    Base directory where all FFmpeg components are found
+#
+# The following are set after configuration is done:
+#  FFMPEG_FOUND
+#  FFMPEG_INCLUDE_DIR
+#  FFMPEG_LIBRARIES
+
+find_path(FFMPEG_INCLUDE_DIR NAMES libavformat/avformat.h
+    PATHS ${FFMPEG_ROOT_DIR}/include
+    PATH_SUFFIXES ffmpeg
+    )
+
+find_library(FFMPEG_AVFORMAT_LIBRARY NAMES avformat
+    PATHS ${FFMPEG_ROOT_DIR}/lib ${FFMPEG_ROOT_DIR}/lib64)
+find_library(FFMPEG_AVCODEC_LIBRARY NAMES avcodec
+    PATHS ${FFMPEG_ROOT_DIR}/lib ${FFMPEG_ROOT_DIR}/lib64)
+find_library(FFMPEG_AVUTIL_LIBRARY NAMES avutil
+    PATHS ${FFMPEG_ROOT_DIR}/lib ${FFMPEG_ROOT_DIR}/lib64)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(FFmpeg DEFAULT_MSG FFMPEG_INCLUDE_DIR
+    FFMPEG_AVFORMAT_LIBRARY FFMPEG_AVCODEC_LIBRARY FFMPEG_AVUTIL_LIBRARY)
+
+if(FFMPEG_FOUND)
+  set(FFMPEG_LIBRARIES ${FFMPEG_AVFORMAT_LIBRARY} ${FFMPEG_AVCODEC_LIBRARY}
+      ${FFMPEG_AVUTIL_LIBRARY})
+  message(STATUS "Found FFmpeg (include: ${FFMPEG_INCLUDE_DIR}, libraries: ${FFMPEG_LIBRARIES})")
+  mark_as_advanced(FFMPEG_INCLUDE_DIR FFMPEG_AVFORMAT_LIBRARY FFMPEG_AVCODEC_LIBRARY
+      FFMPEG_AVUTIL_LIBRARY)
+endif()
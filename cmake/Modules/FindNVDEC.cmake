@@ -0,0 +1,25 @@
+# Find the NVDEC video decoder library of the NVIDIA driver and Video Codec SDK headers
+#
+# The following variables are optionally searched for defaults
+#  NVDEC_ROOT_DIR:     Base directory of the Video Codec SDK
+#
+# The following are set after configuration is done:
+#  NVDEC_FOUND
+#  NVDEC_INCLUDE_DIR
+#  NVDEC_LIBRARY
+
+find_path(NVDEC_INCLUDE_DIR NAMES nvcuvid.h
+    PATHS ${NVDEC_ROOT_DIR}/Interface ${NVDEC_ROOT_DIR}/include ${CUDA_TOOLKIT_INCLUDE}
+    )
+
+find_library(NVDEC_LIBRARY NAMES nvcuvid
+    PATHS ${NVDEC_ROOT_DIR}/Lib/linux/stubs/x86_64 ${NVDEC_ROOT_DIR}/lib
+    ${NVDEC_ROOT_DIR}/lib64 ${CUDA_TOOLKIT_ROOT_DIR}/lib64)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(NVDEC DEFAULT_MSG NVDEC_INCLUDE_DIR NVDEC_LIBRARY)
+
+if(NVDEC_FOUND)
+  message(STATUS "Found NVDEC (include: ${NVDEC_INCLUDE_DIR}, library: ${NVDEC_LIBRARY})")
+  mark_as_advanced(NVDEC_INCLUDE_DIR NVDEC_LIBRARY)
+endif()
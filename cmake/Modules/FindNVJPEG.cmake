@@ -0,0 +1,24 @@
+# Find the nvJPEG libraries
+#
+# The following variables are optionally searched for defaults
+#  NVJPEG_ROOT_DIR:    Base directory where all nvJPEG components are found
+#
+# The following are set after configuration is done:
+#  NVJPEG_FOUND
+#  NVJPEG_INCLUDE_DIR
+#  NVJPEG_LIBRARY
+
+find_path(NVJPEG_INCLUDE_DIR NAMES nvjpeg.h
+    PATHS ${NVJPEG_ROOT_DIR}/include ${CUDA_TOOLKIT_INCLUDE}
+    )
+
+find_library(NVJPEG_LIBRARY NAMES nvjpeg
+    PATHS ${NVJPEG_ROOT_DIR}/lib ${NVJPEG_ROOT_DIR}/lib64 ${CUDA_TOOLKIT_ROOT_DIR}/lib64)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(NVJPEG DEFAULT_MSG NVJPEG_INCLUDE_DIR NVJPEG_LIBRARY)
+
+if(NVJPEG_FOUND)
+  message(STATUS "Found nvJPEG (include: ${NVJPEG_INCLUDE_DIR}, library: ${NVJPEG_LIBRARY})")
+  mark_as_advanced(NVJPEG_INCLUDE_DIR NVJPEG_LIBRARY)
+endif()
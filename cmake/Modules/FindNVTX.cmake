@@ -0,0 +1,24 @@
+# Find the NVTX library
+#
+# The following variables are optionally searched for defaults
+#  NVTX_ROOT_DIR:    Base directory where all NVTX components are found
+#
+# The following are set after configuration is done:
+#  NVTX_FOUND
+#  NVTX_INCLUDE_DIR
+#  NVTX_LIBRARY
+
+find_path(NVTX_INCLUDE_DIR NAMES nvToolsExt.h
+    PATHS ${NVTX_ROOT_DIR}/include ${CUDA_TOOLKIT_INCLUDE}
+    )
+
+find_library(NVTX_LIBRARY NAMES nvToolsExt
+    PATHS ${NVTX_ROOT_DIR}/lib ${NVTX_ROOT_DIR}/lib64 ${CUDA_TOOLKIT_ROOT_DIR}/lib64)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(NVTX DEFAULT_MSG NVTX_INCLUDE_DIR NVTX_LIBRARY)
+
+if(NVTX_FOUND)
+  message(STATUS "Found NVTX (include: ${NVTX_INCLUDE_DIR}, library: ${NVTX_LIBRARY})")
+  mark_as_advanced(NVTX_INCLUDE_DIR NVTX_LIBRARY)
+endif()
@@ -0,0 +1,24 @@
+# Find the TensorRT libraries
+#
+# The following variables are optionally searched for defaults
+#  TensorRT_ROOT_DIR:  Base directory where all TensorRT components are found
+#
+# The following are set after configuration is done:
+#  TensorRT_FOUND
+#  TensorRT_INCLUDE_DIR
+#  TensorRT_LIBRARY
+
+find_path(TensorRT_INCLUDE_DIR NAMES NvInfer.h
+    PATHS ${TensorRT_ROOT_DIR}/include ${CUDA_TOOLKIT_INCLUDE}
+    )
+
+find_library(TensorRT_LIBRARY NAMES nvinfer
+    PATHS ${TensorRT_ROOT_DIR}/lib ${TensorRT_ROOT_DIR}/lib64 ${CUDA_TOOLKIT_ROOT_DIR}/lib64)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(TensorRT DEFAULT_MSG TensorRT_INCLUDE_DIR TensorRT_LIBRARY)
+
+if(TensorRT_FOUND)
+  message(STATUS "Found TensorRT (include: ${TensorRT_INCLUDE_DIR}, library: ${TensorRT_LIBRARY})")
+  mark_as_advanced(TensorRT_INCLUDE_DIR TensorRT_LIBRARY)
+endif()
@@ -134,6 +134,11 @@ function(caffe_print_configuration_summary)
   endif()
   caffe_status("  OpenCV            :   Yes (ver. ${OpenCV_VERSION})")
   caffe_status("  JPEGTurbo         : " JPEGTurbo_FOUND THEN "Yes" ELSE "No" )
+  if(USE_ONEDNN)
+    caffe_status("  oneDNN            : " DNNL_FOUND THEN "Yes" ELSE "Not found")
+  else()
+    caffe_status("  oneDNN            :   Disabled")
+  endif()
   caffe_status("  CUDA              : " HAVE_CUDA THEN "Yes (ver. ${CUDA_VERSION})" ELSE "No" )
   caffe_status("")
   if(HAVE_CUDA)
@@ -153,6 +158,31 @@ function(caffe_print_configuration_summary)
     else()
       caffe_status("  NCCL              :   Disabled")
     endif()
+    if(USE_NVJPEG)
+      caffe_status("  nvJPEG            : " NVJPEG_FOUND THEN "Yes" ELSE "Not found")
+    else()
+      caffe_status("  nvJPEG            :   Disabled")
+    endif()
+    if(USE_NVDEC)
+      caffe_status("  NVDEC             : " NVDEC_FOUND AND FFMPEG_FOUND THEN "Yes" ELSE "Not found")
+    else()
+      caffe_status("  NVDEC             :   Disabled")
+    endif()
+    if(USE_CUFILE)
+      caffe_status("  cuFile            : " CUFILE_FOUND THEN "Yes" ELSE "Not found")
+    else()
+      caffe_status("  cuFile            :   Disabled")
+    endif()
+    if(USE_NVTX)
+      caffe_status("  NVTX              : " NVTX_FOUND THEN "Yes" ELSE "Not found")
+    else()
+      caffe_status("  NVTX              :   Disabled")
+    endif()
+    if(USE_TENSORRT)
+      caffe_status("  TensorRT          : " TensorRT_FOUND THEN "Yes" ELSE "Not found")
+    else()
+      caffe_status("  TensorRT          :   Disabled")
+    endif()
 
     if(NVML_FOUND)
       caffe_status("  NVML              :   ${NVML_LIBRARY} ")
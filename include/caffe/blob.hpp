@@ -7,6 +7,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -48,7 +49,7 @@ class Blob {
   Blob(Type data_type, Type diff_type)
       : data_tensor_(make_shared<Tensor>(data_type)),
         diff_tensor_(make_shared<Tensor>(diff_type)),
-        count_(0), safe_reshape_mode_(false) {}
+        count_(0), safe_reshape_mode_(false), packing_(NCHW) {}
   explicit Blob(Type dtype)
       : Blob(dtype, dtype) {}
 
@@ -167,6 +168,20 @@ class Blob {
     CopyFrom(source, true, reshape, pk_from, pk_to);
   }
 
+  /**
+   * @brief Memory order of a 4D blob's data and diff. Shapes are always given as
+   *        (num, channels, height, width), NHWC blobs keep channels innermost.
+   *        Net::Init tags the blobs, see NetParameter::layout. Swap and Reshape
+   *        keep the tag.
+   */
+  Packing packing() const {
+    return packing_;
+  }
+
+  void set_packing(Packing packing) {
+    packing_ = packing;
+  }
+
   bool is_data_empty() const {
     return data_tensor_->is_empty();
   }
@@ -322,6 +337,15 @@ class Blob {
     return offset;
   }
 
+  // Elements between consecutive indices of every axis
+  vector<int> strides() const {
+    vector<int> strides(num_axes(), 1);
+    for (int i = num_axes() - 2; i >= 0; --i) {
+      strides[i] = strides[i + 1] * shape(i + 1);
+    }
+    return strides;
+  }
+
   template<typename Dtype>
   void set_cpu_data(Dtype* data) {
     CHECK_NOTNULL(data);
@@ -441,6 +465,15 @@ class Blob {
    */
   void ShareData(const Blob& other);
 
+  bool shares_data_with(const Blob& other) const {
+    return data_tensor_ == other.data_tensor_;
+  }
+
+  // Gives data memory back keeping the shape. Blobs sharing data lose it too.
+  void release_data() {
+    data_tensor_->release();
+  }
+
   /**
    * @brief Set the diff_ shared_ptr to point to the SyncedMemory holding the
    *        diff_ of Blob other -- useful in Layer%s which simply perform a copy
@@ -451,6 +484,15 @@ class Blob {
    */
   void ShareDiff(const Blob& other);
 
+  bool shares_diff_with(const Blob& other) const {
+    return diff_tensor_ == other.diff_tensor_;
+  }
+
+  // Gives diff memory back keeping the shape. Blobs sharing diff lose it too.
+  void release_diff() {
+    diff_tensor_->release();
+  }
+
   void ToProto(BlobProto* proto, bool store_in_old_format, bool write_diff = false) const;
   void ToProtoBVLC(BlobProto* proto, bool write_diff = false) const;
 
@@ -475,9 +517,33 @@ class Blob {
     return diff_tensor_->current_memory(is_gpu);
   }
 
+  // Bytes of the current type's memory, which host and device syncs copy
+  size_t current_data_memory_size() const {
+    return data_tensor_->synced_mem()->size();
+  }
+
+  size_t current_diff_memory_size() const {
+    return diff_tensor_->synced_mem()->size();
+  }
+
+  // Memory owned elsewhere made the latest of the current type, on host or device
+  void set_current_data_memory(void* ptr, bool is_gpu) {
+    shared_ptr<SyncedMemory>& mem = data_tensor_->mutable_synced_mem();
+    is_gpu ? mem->set_gpu_data(ptr) : mem->set_cpu_data(ptr);
+  }
+
+  void set_current_diff_memory(void* ptr, bool is_gpu) {
+    shared_ptr<SyncedMemory>& mem = diff_tensor_->mutable_synced_mem();
+    is_gpu ? mem->set_gpu_data(ptr) : mem->set_cpu_data(ptr);
+  }
+
 #ifndef CPU_ONLY
   size_t gpu_memory_data_use(bool own_only = false) const;
   size_t gpu_memory_diff_use(bool own_only = false) const;
+  // Defragmentation: moves device memory of data and diff, every type, see
+  // GPUMemory::BeginDefragment. Tensors in visited are skipped, the ones processed are
+  // added: blobs sharing data are moved once. Returns the number of bytes moved.
+  size_t relocate_gpu(std::unordered_set<const Tensor*>* visited);
 
   void set_gpu_data(void* data) {
     CHECK_NOTNULL(data);
@@ -527,9 +593,39 @@ class Blob {
     data_tensor_->mutable_synced_mem()->async_gpu_push();
   }
 
+  bool async_cpu_pull(cudaStream_t stream) {
+    return data_tensor_->mutable_synced_mem()->async_cpu_pull(stream);
+  }
+
+  void release_gpu_data() {
+    data_tensor_->mutable_synced_mem()->release_gpu();
+  }
+
+  // Managed memory hints for data and, if asked, diff
+  void advise_on_device(bool with_diff) {
+    if (data_tensor_->is_current_valid()) {
+      data_tensor_->synced_mem()->advise_on_device();
+    }
+    if (with_diff && diff_tensor_->is_current_valid()) {
+      diff_tensor_->synced_mem()->advise_on_device();
+    }
+  }
+
+  void prefetch_gpu(bool with_diff, cudaStream_t stream) {
+    if (data_tensor_->is_current_valid()) {
+      data_tensor_->synced_mem()->prefetch_gpu(stream);
+    }
+    if (with_diff && diff_tensor_->is_current_valid()) {
+      diff_tensor_->synced_mem()->prefetch_gpu(stream);
+    }
+  }
+
   const int* gpu_shape() const;
 #endif
 
+  // Converts data of every blob to new_data_type, batching GPU conversion kernels
+  static void convert_data_batch(const vector<Blob*>& blobs, Type new_data_type);
+
 #ifdef DEBUG
   void freeze_data() {
     data_tensor_->frozen_ = true;
@@ -548,6 +644,7 @@ class Blob {
   vector<int> shape_;
   int count_;
   bool safe_reshape_mode_;  // if true, reshape never shrinks
+  Packing packing_;
 
   bool is_current_data_valid() const {
     return data_tensor_->is_current_valid();
@@ -581,23 +678,28 @@ class Blob {
   }
 
  private:
-  // Element-wise mutator. Might be slow due to syncing from GPU to CPU.
+  // Raw bytes of raw_type to the current data or diff type, and the current type's
+  // bytes to raw, see FromProto and ToProto
+  void FromRaw(bool is_data, const std::string& raw, Type raw_type);
+  void ToRaw(bool is_data, std::string* raw) const;
+
+  // Converts count_ values to the current data or diff type on host, in one pass.
   // Currently it's used in copying from proto only.
   template<typename Dtype>
-  void set_value_at(bool set_data, int idx, Dtype val) {
+  void set_values(bool set_data, const Dtype* vals) {
     void* ptr = set_data ? current_mutable_data_memory(false) : current_mutable_diff_memory(false);
     CHECK_NOTNULL(ptr);
     Type dtype = set_data ? data_type() : diff_type();
     if (is_type<float>(dtype)) {
-      static_cast<float*>(ptr)[idx] = val;
+      caffe_cpu_convert(count_, vals, static_cast<float*>(ptr));
     }
 #ifndef CPU_ONLY
     else if (is_type<float16>(dtype)) {
-      static_cast<float16*>(ptr)[idx] = val;
+      caffe_cpu_convert(count_, vals, static_cast<float16*>(ptr));
     }
 #endif
     else if (is_type<double>(dtype)) {
-      static_cast<double*>(ptr)[idx] = val;
+      caffe_cpu_convert(count_, vals, static_cast<double*>(ptr));
     } else {
       LOG(FATAL) << "Unknown data or diff: " << Type_Name(dtype);
     }
@@ -303,6 +303,42 @@ struct CuDNNHandle {
   DISABLE_COPY_MOVE_AND_ASSIGN(CuDNNHandle);
 };
 #endif
+
+// Stream with cuBLAS and cuDNN handles bound to it, created on a given device
+struct GPUContext {
+  explicit GPUContext(int device);
+
+  const int device;
+  shared_ptr<CudaStream> stream;
+  shared_ptr<CuBLASHandle> cublas;
+#ifdef USE_CUDNN
+  shared_ptr<CuDNNHandle> cudnn;
+#endif
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(GPUContext);
+};
+
+// Per-device pool of contexts created up front by GPUMemory::Init. Threads lease them
+// on their first stream or handle request (see Caffe::pstream) and return them on exit,
+// so the first layer call on a new thread doesn't create streams and handles.
+// CAFFE_GPU_CONTEXTS is the number made per device, 4 by default. Leasing from an
+// empty pool creates a new context.
+class GPUContextPool {
+ public:
+  static void Prewarm(int device);
+  static shared_ptr<GPUContext> Lease(int device);
+  static void Return(shared_ptr<GPUContext> context);
+  static size_t available(int device);
+
+ private:
+  struct Pool {
+    std::mutex mutex;
+    vector<vector<shared_ptr<GPUContext>>> free;
+    vector<bool> prewarmed;
+  };
+  static Pool& pool();
+  static int prewarm_count();
+};
 #endif
 
 // A global initialization function that you should call in your main function.
@@ -398,6 +434,9 @@ class Caffe {
   // For correct determinism user should set a seed for a root solver
   // Note: it invokes set_random_seed internally
   static void set_root_seed(uint64_t random_seed);
+  static bool root_seed_set() {
+    return root_seed_.load() != SEED_NOT_SET;
+  }
   // Sets the root device. Function name remains the same for backward compatibility.
   static void SetDevice(const int device_id);
   static int root_device() {
@@ -417,6 +456,17 @@ class Caffe {
   static void set_root_solver(bool val) { Get().root_solver_ = val; }
   static int restored_iter() { return restored_iter_; }
   static void set_restored_iter(int val);
+  // SolverParameter/NetParameter::deterministic, process-wide: bit for bit reproducible
+  // runs (deterministic cuDNN algorithms, fixed reduction order, seeded randomness)
+  static bool deterministic() { return deterministic_; }
+  static void set_deterministic(bool val) { deterministic_ = val; }
+  // Multi-node training info, shared by all threads of the process.
+  // Global solver rank is node_rank * solvers per node + local rank.
+  static int node_count() { return node_count_; }
+  static int node_rank() { return node_rank_; }
+  static bool root_node() { return node_rank_ == 0; }
+  static int solver_rank_offset() { return solver_rank_offset_; }
+  static void set_nodes(int count, int rank, int solvers_per_node);
 
   static void set_gpus(const std::vector<int>& gpus) {
     props().gpus_ = gpus;
@@ -455,6 +505,12 @@ class Caffe {
   static int device_capability(int device) {
     return props().device_capability(device);
   }
+  static const std::string& device_name(int device) {
+    return props().device_name(device);
+  }
+  static int multiprocessor_count(int device) {
+    return props().multiprocessor_count(device);
+  }
 
   static int current_device() {
 #ifndef CPU_ONLY
@@ -479,20 +535,23 @@ class Caffe {
   }
 
   static constexpr int STREAM_ID_ASYNC_PUSH = 0;
+  static constexpr int STREAM_ID_ASYNC_PULL = 1;
   static constexpr uint64_t SEED_NOT_SET = static_cast<uint64_t>(-1);
+  // Root seed of deterministic runs not given one
+  static constexpr uint64_t DETERMINISTIC_SEED = 1701ULL;
 
  protected:
 #ifndef CPU_ONLY
-  vector<shared_ptr<CudaStream>> streams_;
-  vector<shared_ptr<CudaStream>> streams_aux_;
+  // Leased from GPUContextPool, returned by the destructor
+  vector<shared_ptr<GPUContext>> contexts_;
+  vector<shared_ptr<GPUContext>> contexts_aux_;
+  GPUContext& context(int group);
   shared_ptr<CudaStream> pstream(int group = 0);
   shared_ptr<CudaStream> pstream_aux(int id);
-  vector<shared_ptr<CuBLASHandle>> cublas_handles_;
   shared_ptr<CuBLASHandle> th_cublas_handle(int group = 0);
   curandGenerator_t curand_generator_;
 
 #ifdef USE_CUDNN
-  vector<shared_ptr<CuDNNHandle>> cudnn_handles_;
   cudnnHandle_t th_cudnn_handle(int group = 0);
 #endif
 #endif
@@ -507,8 +566,10 @@ class Caffe {
   static int root_device_;
   static int thread_count_;
   static int restored_iter_;
+  static std::atomic<bool> deterministic_;
+  static int node_count_, node_rank_, solver_rank_offset_;
   static std::atomic<uint64_t> root_seed_;
-  static std::mutex caffe_mutex_, pstream_mutex_, cublas_mutex_, cudnn_mutex_, seed_mutex_;
+  static std::mutex caffe_mutex_, seed_mutex_;
   shared_ptr<CudaStream> curand_stream_;
 
  private:
@@ -549,6 +610,12 @@ class Caffe {
     int device_capability(int device) const {
       return compute_capabilities_[device];
     }
+    const std::string& device_name(int device) const {
+      return device_names_[device];
+    }
+    int multiprocessor_count(int device) const {
+      return multiprocessor_counts_[device];
+    }
 
    private:
     std::vector<int> gpus_;
@@ -560,6 +627,8 @@ class Caffe {
     std::string cuda_version_;
     std::string cuda_driver_version_;
     std::vector<int> compute_capabilities_;
+    std::vector<std::string> device_names_;
+    std::vector<int> multiprocessor_counts_;
 
     Properties();
     DISABLE_COPY_MOVE_AND_ASSIGN(Properties);
@@ -5,6 +5,7 @@
 #include <cstdlib>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -13,6 +14,8 @@
 #include "caffe/internal_thread.hpp"
 #include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
+#include "caffe/util/rng.hpp"
+#include "caffe/util/shm_arena.hpp"
 #include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
@@ -25,6 +28,31 @@ namespace caffe {
  */
 class DataReader : public InternalThread {
  private:
+  // Keys of the records of a DB in order, one instance per source. Cursors seek to the
+  // records of their thread through it rather than step over those of the others.
+  class RecordIndex {
+   public:
+    static shared_ptr<const RecordIndex> get(const string& source, db::DB* db);
+
+    size_t size() const {
+      return offsets_.size() - 1UL;
+    }
+    string key(size_t i) const {
+      return keys_.substr(offsets_[i], offsets_[i + 1UL] - offsets_[i]);
+    }
+
+   private:
+    explicit RecordIndex(db::DB* db);
+
+    string keys_;  // back to back
+    vector<size_t> offsets_;
+
+    static std::mutex instances_mutex_;
+    static std::map<string, std::weak_ptr<const RecordIndex>> instances_;
+
+    DISABLE_COPY_MOVE_AND_ASSIGN(RecordIndex);
+  };
+
   class CursorManager {
     shared_ptr<db::DB> db_;
     unique_ptr<db::Cursor> cursor_;
@@ -32,17 +60,39 @@ class DataReader : public InternalThread {
     const size_t solver_count_, solver_rank_, batch_size_;
     const size_t parser_threads_, parser_thread_id_;
     const size_t rank_cycle_, full_cycle_;
+    // The cursor reads only records of this thread, see DataReader::rank_shards_
+    const bool local_;
     size_t rec_id_, rec_end_;
     bool cache_, shuffle_;
     bool cached_all_;
+    // Reused for every Caffe2 record parsed, its buffers are swapped with Datum's
+    C2TensorProtos c2_protos_;
+    // Read-ahead: the second cursor walks read_ahead_ records of this thread ahead
+    unique_ptr<db::Cursor> ahead_cursor_;
+    const size_t read_ahead_;
+    size_t ahead_rec_id_, ahead_rec_end_;
+    // Number of records in DB, known after the first wrap around
+    size_t db_size_;
+    // DataParameter::record_index, null if off or useless
+    shared_ptr<const RecordIndex> index_;
+
+    // Moves record id to the next one of this thread, returns cursor steps to make
+    size_t advance(size_t* rec_id, size_t* rec_end) const;
+    // Rewinds the cursor and moves it 'steps' records forward wrapping around the end
+    void seek(db::Cursor* cursor, size_t steps);
+    // Moves the cursor from record id 'rec_id - steps' to rec_id, true if it wrapped
+    // around the end
+    bool step(db::Cursor* cursor, size_t rec_id, size_t steps);
+    void ahead_next();
 
    public:
     CursorManager(shared_ptr<db::DB> db, DataReader* reader, size_t solver_count,
         size_t solver_rank, size_t parser_threads, size_t parser_thread_id, size_t batch_size_,
-        bool cache, bool shuffle);
+        bool cache, bool shuffle, bool local = false);
     ~CursorManager();
     void next(shared_ptr<Datum>& datum);
     void fetch(Datum* datum);
+    void fetch_view(const shared_ptr<Datum>& datum);
     void rewind();
 
     size_t full_cycle() const {
@@ -54,27 +104,23 @@ class DataReader : public InternalThread {
 
   class DataCache {
    public:
-    static DataCache* data_cache_inst(size_t threads, bool shuffle) {
-      if (!data_cache_inst_) {
-        std::lock_guard<std::mutex> lock(cache_mutex_);
-        if (!data_cache_inst_) {
-          data_cache_inst_.reset(new DataCache(threads, shuffle));
-        }
-      }
-      return data_cache_inst_.get();
-    }
+    // One instance per source and phase
+    static DataCache* data_cache_inst(const LayerParameter& param, size_t threads,
+        bool shuffle);
+    ~DataCache();
 
     shared_ptr<Datum>& next_new();
-    shared_ptr<Datum>& next_cached();
+    void next_cached(shared_ptr<Datum>& datum);
     bool check_memory();
-    void check_db(const std::string& db_source) {
-      std::lock_guard<std::mutex> lock(cache_mutex_);
-      if (db_source_.empty()) {
-        db_source_ = db_source;
-      } else {
-        CHECK_EQ(db_source_, db_source) << "Caching of two DB sources is not supported";
-      }
+    // DataParameter::cache_decoded_mb: replaces encoded content by raw pixels
+    // while the budget lasts
+    void decode(Datum* datum);
+    // DataParameter::cache_compress: the cache keeps compressed copies of datums,
+    // next_cached decompresses them to the datum given
+    bool packed() const {
+      return compress_;
     }
+    void pack(const Datum& datum);
 
     void just_cached();
     void register_new_thread() {
@@ -82,25 +128,83 @@ class DataReader : public InternalThread {
       cached_flags_.emplace(std::this_thread::get_id(), make_shared<Flag>());
     }
 
+    bool shared() const {
+      return (bool) arena_;
+    }
+    // Shared mode only. Returns true when the arena is complete.
+    // Sets *cache to false if shared memory can't be used anymore.
+    bool check_shared(bool* cache);
+
    private:
-    DataCache(size_t threads, bool shuffle)
-        : cache_idx_(0UL),
-          cache_bar_(threads),
-          shuffle_(shuffle),
-          just_cached_(false) {}
+    size_t count() const {
+      return compress_ ? packed_buffer_.size() : cache_buffer_.size();
+    }
+    // Index of the record to read at the position given
+    size_t cached_index(size_t pos, size_t count) const {
+      const size_t epoch = pos / count;
+      return shuffle_ ? permuted_index(pos % count, count, perm_seed_ + epoch) : pos % count;
+    }
+
+    DataCache(const LayerParameter& param, size_t threads, bool shuffle);
+    void fill_shared(const string& source, DataParameter_DB backend);
 
-    std::string db_source_;
     vector<shared_ptr<Datum>> cache_buffer_;
-    size_t cache_idx_;
+    // Read position over all epochs. Shuffled epochs read records through
+    // per-epoch index permutation, thus no thread has to wait for reshuffling.
+    std::atomic<size_t> cache_pos_;
+    const uint64_t perm_seed_;
     boost::barrier cache_bar_;
     bool shuffle_;
     std::atomic_bool just_cached_;
     std::unordered_map<std::thread::id, shared_ptr<Flag>> cached_flags_;
+    // Decoded tier
+    const size_t decoded_budget_;
+    std::atomic<size_t> decoded_bytes_;
+    const int color_mode_;
+    // Compressed mode: Snappy compressed serialized Datums instead of cache_buffer_
+    const bool compress_;
+    vector<string> packed_buffer_;
+    size_t raw_bytes_, packed_bytes_;
+
+    // Shared mode: serialized Datums in a flat shared memory arena
+    unique_ptr<ShmArena> arena_;
+    unique_ptr<boost::thread> filler_;
+    size_t shared_count_;
+    std::atomic_bool shared_ready_;
+    std::mutex shared_mutex_;
+
     static std::mutex cache_mutex_;
-    static unique_ptr<DataCache> data_cache_inst_;
+    static std::map<string, unique_ptr<DataCache>> data_cache_inst_;
+
+    DISABLE_COPY_MOVE_AND_ASSIGN(DataCache);
   };
 
  public:
+  /**
+   * @brief Zero-copy mode: encoded image bytes of the LMDB record a Datum was parsed from.
+   * The view is attached to Datum's shared pointer (as its deleter), Datum::data
+   * stays empty. It's valid while the reader's read transaction lasts.
+   */
+  struct DatumView {
+    DatumView() : data(nullptr), size(0UL) {}
+    void operator()(Datum* datum) const {
+      delete datum;
+    }
+    const char* data;
+    size_t size;
+  };
+
+  // Encoded content of the datum: either attached view or Datum::data
+  static const char* datum_data(const shared_ptr<Datum>& datum, size_t* size) {
+    const DatumView* view = boost::get_deleter<DatumView>(datum);
+    if (view != nullptr && view->data != nullptr) {
+      *size = view->size;
+      return view->data;
+    }
+    *size = datum->data().size();
+    return datum->data().data();
+  }
+
   DataReader(const LayerParameter& param,
       size_t solver_count,
       size_t solver_rank,
@@ -110,9 +214,16 @@ class DataReader : public InternalThread {
       bool sample_only,
       bool skip_one_batch,
       bool cache,
-      bool shuffle);
+      bool shuffle,
+      size_t start_record = 0UL,
+      size_t ranks = 1UL);
   virtual ~DataReader();
 
+  // DataParameter::node_reader: the reader of this source and phase shared by the local
+  // solvers of the process. Solver of local rank r uses queues [r, r + 1) * queues_num().
+  static shared_ptr<DataReader> node_reader(const LayerParameter& param,
+      size_t parser_threads_num, size_t transf_threads_num);
+
   void start_reading() {
     start_reading_flag_.set();
   }
@@ -143,33 +254,118 @@ class DataReader : public InternalThread {
     return full_[queue_id]->pop(log_on_wait);
   }
 
+  bool full_try_pop(size_t queue_id, shared_ptr<Datum>* datum) {
+    return full_[queue_id]->try_pop(datum);
+  }
+
   shared_ptr<Datum>& next_new() {
     return data_cache_->next_new();
   }
 
-  shared_ptr<Datum>& next_cached() {
-    return data_cache_->next_cached();
+  void next_cached(shared_ptr<Datum>& datum) {
+    data_cache_->next_cached(datum);
+  }
+
+  bool shared_cache() const {
+    return data_cache_->shared();
+  }
+
+  bool check_shared_cache(bool* cache) {
+    return data_cache_->check_shared(cache);
   }
 
   bool check_memory() {
     return data_cache_->check_memory();
   }
 
+  void decode_cached(Datum* datum) {
+    data_cache_->decode(datum);
+  }
+
+  bool packed_cache() const {
+    return data_cache_->packed();
+  }
+
+  void pack_cached(const Datum& datum) {
+    data_cache_->pack(datum);
+  }
+
   void just_cached() {
     data_cache_->just_cached();
   }
 
+  bool zero_copy() const {
+    return zero_copy_;
+  }
+
+  // Datums circulating between free and full queues are recycled. Their data buffers
+  // are grown to the largest record seen so far, thus steady state allocates nothing.
+  // Must be called before the record is parsed to the datum.
+  void pool_reserve(Datum* datum) const {
+    const size_t largest = pool_largest_.load(std::memory_order_relaxed);
+    if (datum->data().capacity() < largest) {
+      datum->mutable_data()->reserve(largest);
+      pool_grows_.fetch_add(1UL, std::memory_order_relaxed);
+    }
+  }
+  // Accounts the record just parsed, 'capacity' is the one before parsing
+  void pool_account(const Datum& datum, size_t capacity);
+
+  // Total time parser threads spent reading and parsing records
+  uint64_t parser_busy_us() const {
+    return parser_busy_us_.load(std::memory_order_relaxed);
+  }
+  // Parts of it: moving cursors through the DB, and parsing records into datums
+  uint64_t read_us() const {
+    return read_us_.load(std::memory_order_relaxed);
+  }
+  // With 'cache': records taken from the cache, and read from the DB instead
+  uint64_t cache_hits() const {
+    return cache_hits_.load(std::memory_order_relaxed);
+  }
+  uint64_t cache_misses() const {
+    return cache_misses_.load(std::memory_order_relaxed);
+  }
+  uint64_t parse_us() const {
+    return parse_us_.load(std::memory_order_relaxed);
+  }
+  // Parsed datums waiting for transformers, out of queues_num x queue_depth
+  size_t full_queued() const;
+  size_t full_capacity() const {
+    return full_.size() * queue_depth_;
+  }
+  // Queues of one solver
+  size_t queues_num() const {
+    return queues_num_;
+  }
+  size_t parser_threads_num() const {
+    return parser_threads_num_;
+  }
+
  protected:
   void InternalThreadEntry() override;
   void InternalThreadEntryN(size_t thread_id) override;
+  std::string thread_name() const override {
+    return "reader " + db_source_;
+  }
+  shared_ptr<Datum> new_datum() const;
 
   const size_t parser_threads_num_, transf_threads_num_;
   const size_t queues_num_, queue_depth_;
   string db_source_;
   const size_t solver_count_, solver_rank_;
+  // Solvers fed, more than 1 for node_reader. Their batches of every parser thread are
+  // read as one of ranks_ times the size, solver_count_ and solver_rank_ count nodes.
+  const size_t ranks_;
   size_t batch_size_;
   const bool skip_one_batch_;
+  // DB position of record 0
+  const size_t start_record_;
   DataParameter_DB backend_;
+  DataParameter data_param_;
+  // Rank shards of the source (see db::RankShardsDB), 0 if it's not split. When they
+  // split evenly between parser threads of all solvers, every thread opens its own.
+  size_t rank_shards_;
 
   shared_ptr<BlockingQueue<shared_ptr<Datum>>> init_;
   vector<shared_ptr<BlockingQueue<shared_ptr<Datum>>>> free_;
@@ -181,9 +377,21 @@ class DataReader : public InternalThread {
   Flag start_reading_flag_;
   bool sample_only_;
   const bool cache_, shuffle_;
+  const bool zero_copy_;
+
+  // Datum pool statistics
+  std::atomic<size_t> pool_records_;
+  mutable std::atomic<size_t> pool_grows_;
+  std::atomic<size_t> pool_largest_;
+  std::atomic<uint64_t> parser_busy_us_;
+  std::atomic<uint64_t> read_us_, parse_us_;
+  std::atomic<uint64_t> cache_hits_, cache_misses_;
 
   DataCache* data_cache_;
 
+  static std::mutex node_readers_mutex_;
+  static std::map<string, std::weak_ptr<DataReader>> node_readers_;
+
   DISABLE_COPY_MOVE_AND_ASSIGN(DataReader);
 };
 
@@ -0,0 +1,78 @@
+#ifndef CAFFE_DATA_SERVICE_HPP_
+#define CAFFE_DATA_SERVICE_HPP_
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace boost { class thread_group; }
+
+namespace caffe {
+
+/**
+ * @brief Data service: data layers run by worker processes on other hosts.
+ *
+ * A RemoteData layer connects to a worker (caffe dataserve) and sends its own
+ * LayerParameter turned into a Data layer's, with its solver rank and the number
+ * of solvers. The worker sets that layer up on CPU for the rank, so its DataReader
+ * gives it the same share of the records in the same order as on the training node,
+ * and streams every batch it produces till the client disconnects. A batch on the
+ * wire is the number of tops, then for every top its type, shape and raw data.
+ * TCP flow control keeps the worker at most the socket buffers and the client's
+ * queue ahead of the net.
+ */
+class DataServiceWorker {
+ public:
+  // Listens on all interfaces
+  explicit DataServiceWorker(int port);
+  ~DataServiceWorker();
+
+  // Serves every connection in its own thread till Stop
+  void Serve();
+  void Stop() {
+    stop_ = true;
+  }
+  int port() const {
+    return port_;
+  }
+
+ private:
+  static void Stream(int fd);
+
+  int port_;
+  int listen_fd_;
+  std::atomic<bool> stop_;
+  unique_ptr<boost::thread_group> streams_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(DataServiceWorker);
+};
+
+class DataServiceClient {
+ public:
+  // server is "host:port", retried till timeout_sec
+  DataServiceClient(const string& server, int timeout_sec);
+  ~DataServiceClient();
+
+  // Asks for the batches of a Data layer of the given rank. Types of param's tops are
+  // its forward type.
+  void Request(const LayerParameter& param, int rank, int ranks);
+  // Next batch into tops, reshaped. Types must be those requested.
+  // False when the worker is gone.
+  bool Receive(const vector<shared_ptr<Blob>>& tops);
+  // Unblocks a Receive in progress, which then returns false
+  void Shutdown();
+
+ private:
+  const string server_;
+  int fd_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(DataServiceClient);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_DATA_SERVICE_HPP_
@@ -2,6 +2,8 @@
 #define CAFFE_DATA_TRANSFORMER_HPP
 
 #include <opencv2/core/core.hpp>
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <vector>
 
@@ -10,9 +12,22 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/nvtx.hpp"
+#include "caffe/util/simd_transform.hpp"
+#include "caffe/util/thread_profile.hpp"
 
 namespace caffe {
 
+// Where a GPU augmented sample comes from and how its colors change, see AugmentGPU
+struct AugmentSample {
+  size_t image_offset;  // of the decoded image (8 bits), in bytes from the first of the batch
+  int image_rows, image_cols;
+  int planar;  // CHW as raw Datum data, HWC as decoded images otherwise
+  float y0, x0, dy, dx;  // output pixel (h, w) is sampled at (y0 + h * dy, x0 + w * dx)
+  int mirror;
+  float twist[12];  // color twist of 0..255 values: 3x3 matrix, then offsets
+};
+
 /**
  * @brief Applies common transformations to the input data, such as
  * scaling, mirroring, substracting the image mean...
@@ -28,12 +43,50 @@ class DataTransformer {
    */
   void InitRand();
 
+  /**
+   * @brief Makes the following transforms draw their random numbers from a Philox stream
+   * keyed by (sample seed, record_id, pass) rather than from this transformer's generator,
+   * so that a record gets the same resize, crop, mirror and jitter whichever thread
+   * transforms it, and the same crop and mirror on the CPU and GPU paths. pass tells
+   * echoed transforms of a record apart.
+   */
+  void set_sample(uint64_t record_id, unsigned int pass) const;
+  // Seed of set_sample streams, the same for every transformer of a layer
+  void set_sample_seed(uint64_t seed) {
+    sample_seed_ = seed;
+  }
+
 #ifndef CPU_ONLY
   template<typename Dtype>
   void TransformGPU(int N, int C, int H, int W, size_t sizeof_element,
-      const void* in, Dtype* out, const unsigned int* rands, bool signed_data);
+      const void* in, Dtype* out, const unsigned int* rands, bool signed_data,
+      Packing out_packing = NCHW);
+
+  /**
+   * @brief Resizes, crops, mirrors, color jitters, subtracts mean_value and scales the 8-bit
+   * images of a batch in one launch, every sample as SampleAugment drew it. Output is N x C
+   * x H x W in out_packing. Samples and images are on the device.
+   */
+  template<typename Dtype>
+  void AugmentGPU(int N, int C, int H, int W, const AugmentSample* samples,
+      const uint8_t* images, Dtype* out, Packing out_packing);
 #endif
 
+  // Random resize or color jitter set, Data layers augment on the GPU then
+  bool gpu_augment_enabled() const {
+    return image_random_resize_enabled() || color_jitter_enabled();
+  }
+  bool color_jitter_enabled() const {
+    return param_.brightness() > 0.F || param_.contrast() > 0.F ||
+        param_.saturation() > 0.F || param_.hue() > 0.F;
+  }
+  /**
+   * @brief Draws resize, crop, mirror and color twist of an image for AugmentGPU, with the
+   * same random resize and crop as the CPU transform. image_offset and planar are the
+   * caller's. Returns the output shape, C x H x W.
+   */
+  vector<int> SampleAugment(int rows, int cols, int channels, AugmentSample* sample);
+
   /**
    * @brief Applies transformations defined in the data layer's
    * transform_param block to the data.
@@ -50,15 +103,46 @@ class DataTransformer {
   template<typename Dtype>
   vector<int> Transform(const Datum* datum, Dtype* buf, size_t buf_len,
       Packing& out_packing, bool repack = true) {
+    return Transform(datum, datum->data().data(), datum->data().size(), buf, buf_len,
+        out_packing, repack);
+  }
+
+  /**
+   * @brief Same as above but encoded image content is taken from the buffer given
+   * instead of datum->data() (used by zero-copy data readers).
+   */
+  template<typename Dtype>
+  vector<int> Transform(const Datum* datum, const char* content, size_t content_size,
+      Dtype* buf, size_t buf_len, Packing& out_packing, bool repack = true) {
     vector<int> shape;
     const bool shape_only = buf == nullptr;
+    NVTX_RANGE(NVTX_DATA, shape_only ? "DataTransformer shape" : "DataTransformer transform");
     CHECK(!(param_.force_color() && param_.force_gray()))
         << "cannot set both force_color and force_gray";
     const int color_mode = param_.force_color() ? 1 : (param_.force_gray() ? -1 : 0);
     cv::Mat img;
     bool v1_path = false;
     if (datum->encoded()) {
-      shape = DecodeDatumToCVMat(*datum, color_mode, img, shape_only, false);
+      bool fused;
+      {
+        ThreadProfile::Scope decode(ThreadProfile::DECODE);
+        const auto start = std::chrono::steady_clock::now();
+        fused = !shape_only && param_.fused_jpeg_decode() &&
+            image_fused_decode(content, content_size, color_mode, img);
+        if (!fused) {
+          shape = DecodeImageToCVMat(content, content_size, color_mode, img, shape_only, false);
+        }
+        if (!shape_only) {
+          add_decode_us(std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - start).count());
+        }
+      }
+      if (fused) {
+        // Already resized and cropped
+        apply_mean_scale_mirror(img, buf, buf_len, repack);
+        out_packing = NHWC;
+        return vector<int>{1, img.channels(), img.rows, img.cols};
+      }
     } else {
       if (image_random_resize_enabled() || buf == nullptr || buf_len == 0UL) {
         shape = DatumToCVMat(*datum, img, shape_only);
@@ -105,8 +189,12 @@ class DataTransformer {
     } else if (image_center_crop_enabled()) {
       image_center_crop(param_.crop_size(), param_.crop_size(), tmp);
     }
-    apply_mean_scale_mirror(tmp, dst);
-    FloatCVMatToBuf<Dtype>(dst, buf_len, buf, repack);
+    if (tmp.depth() == CV_8U) {
+      apply_mean_scale_mirror(tmp, buf, buf_len, repack);
+    } else {
+      apply_mean_scale_mirror(tmp, dst);
+      FloatCVMatToBuf<Dtype>(dst, buf_len, buf, repack);
+    }
   }
 
   /**
@@ -196,6 +284,22 @@ class DataTransformer {
   void VariableSizedTransforms(Datum* datum);
   void Fill3Randoms(unsigned int *rand) const;
 
+  // Time spent decoding encoded images by Transform, and by callers decoding for it
+  uint64_t decode_us() const {
+    return decode_us_.load(std::memory_order_relaxed);
+  }
+  void add_decode_us(uint64_t us) {
+    decode_us_.fetch_add(us, std::memory_order_relaxed);
+  }
+
+  // SolverParameter::input_shape_schedule, set by the thread using the transformer
+  unsigned int crop_size() const {
+    return param_.crop_size();
+  }
+  void set_crop_size(unsigned int crop_size) {
+    param_.set_crop_size(crop_size);
+  }
+
  protected:
   bool image_random_resize_enabled() const;
   bool image_random_crop_enabled() const;
@@ -203,6 +307,64 @@ class DataTransformer {
 
   void apply_mean_scale_mirror(const cv::Mat& src, cv::Mat& dst);
   void image_random_crop(int crop_w, int crop_h, cv::Mat& img);
+  // Sets mean_mat_ (already scaled) for the image size given. Returns false if there is no mean.
+  bool prepare_mean(const cv::Mat& src);
+
+  /**
+   * @brief Same as apply_mean_scale_mirror followed by FloatCVMatToBuf,
+   * but done in one pass over 8-bit image (which might be a region of another one).
+   */
+  template<typename Dtype>
+  void apply_mean_scale_mirror(const cv::Mat& src, Dtype* buf, size_t buf_len, bool repack) {
+    CHECK_EQ(src.depth(), CV_8U);
+    const int ch = src.channels();
+    const int height = src.rows;
+    const int width = src.cols;
+    CHECK_LE(static_cast<size_t>(ch) * height * width, buf_len);
+    const float scale = param_.scale();
+    const bool do_mirror = param_.mirror() && SlotRand(MIRROR_SLOT) % 2;
+    if (repack && ch == 3 && !param_.has_mean_file()) {
+      // The most common case: vectorized unless this CPU or Dtype has no kernel
+      float mean[3] = {0.F, 0.F, 0.F};
+      if (!mean_values_.empty()) {
+        CHECK(mean_values_.size() == 1 || mean_values_.size() == ch)
+            << "Specify either 1 mean_value or as many as channels: " << ch;
+        for (int c = 0; c < ch; ++c) {
+          mean[c] = scale * mean_values_[mean_values_.size() == 1 ? 0 : c];
+        }
+      }
+      if (simd_hwc3_to_chw(src.ptr<unsigned char>(), src.step, height, width, scale, mean,
+          do_mirror, buf)) {
+        return;
+      }
+    }
+    const bool has_mean = prepare_mean(src);
+    const size_t plane = static_cast<size_t>(height) * width;
+    for (int h = 0; h < height; ++h) {
+      const unsigned char* src_row = src.ptr<unsigned char>(h);
+      const float* mean_row = has_mean ? mean_mat_.ptr<float>(h) : nullptr;
+      for (int w = 0; w < width; ++w) {
+        const int sw = (do_mirror ? width - 1 - w : w) * ch;
+        const size_t hw = static_cast<size_t>(h) * width + w;
+        for (int c = 0; c < ch; ++c) {
+          float v = static_cast<float>(src_row[sw + c]) * scale;
+          if (has_mean) {
+            v -= mean_row[sw + c];
+          }
+          buf[repack ? c * plane + hw : hw * ch + c] = static_cast<Dtype>(v);
+        }
+      }
+    }
+  }
+
+  // Draws random resize target size for the image size given
+  void image_random_resize_size(int img_width, int img_height, int* new_width, int* new_height);
+  /**
+   * @brief Decodes, randomly resizes and crops JPEG image (see fused_jpeg_decode).
+   * @return false if the content is not JPEG, nothing is done then.
+   */
+  bool image_fused_decode(const char* content, size_t content_size, int color_mode,
+      cv::Mat& img);
 
   template<typename Dtype>
   void TransformV1(const Datum& datum, Dtype* buf, size_t buf_len) {
@@ -213,7 +375,7 @@ class DataTransformer {
 
     const int crop_size = param_.crop_size();
     const float scale = param_.scale();
-    const bool do_mirror = param_.mirror() && (Rand() % 2);
+    const bool do_mirror = param_.mirror() && (SlotRand(MIRROR_SLOT) % 2);
     const bool has_mean_file = param_.has_mean_file();
     const bool has_uint8 = data.size() > 0;
     const bool has_mean_values = mean_values_.size() > 0;
@@ -250,8 +412,8 @@ class DataTransformer {
       width = crop_size;
       // We only do random crop when we do training.
       if (phase_ == TRAIN) {
-        h_off = Rand() % (datum_height - crop_size + 1);
-        w_off = Rand() % (datum_width - crop_size + 1);
+        h_off = SlotRand(CROP_Y_SLOT) % (datum_height - crop_size + 1);
+        w_off = SlotRand(CROP_X_SLOT) % (datum_width - crop_size + 1);
       } else {
         h_off = (datum_height - crop_size) / 2;
         w_off = (datum_width - crop_size) / 2;
@@ -359,9 +521,19 @@ class DataTransformer {
   unsigned int Rand() const;
   float Rand(float lo, float up) const;
 
+  // Numbers of set_sample streams that every path draws alike; Rand() draws the rest in turn
+  enum RandSlot { MIRROR_SLOT, CROP_Y_SLOT, CROP_X_SLOT, FIRST_FREE_SLOT };
+  // The slot's number of a set_sample stream, Rand() otherwise
+  unsigned int SlotRand(RandSlot slot) const;
+
   // Tranformation parameters
   TransformationParameter param_;
   shared_ptr<Caffe::RNG> rng_;
+  // set_sample stream, numbers are drawn by (pass << 16 | slot)
+  uint64_t sample_seed_;
+  mutable bool keyed_;
+  mutable uint64_t sample_record_;
+  mutable uint32_t sample_pass_, sample_draw_;
   Phase phase_;
   TBlob<float> data_mean_;
   vector<float> mean_values_;
@@ -376,8 +548,11 @@ class DataTransformer {
   const bool allow_upscale_;
 
 #ifndef CPU_ONLY
+  // mean_values_ on the device, one per channel
+  const float* mean_values_gpu(int channels);
   GPUMemory::Workspace mean_values_gpu_;
 #endif
+  std::atomic<uint64_t> decode_us_;
   static constexpr double UM = static_cast<double>(UINT_MAX);
 };
 
@@ -1,6 +1,7 @@
 // Fillers are random number generators that fills a blob using the specified
 // algorithm. The expectation is that they are only going to be used during
-// initialization time and will not involve any GPUs.
+// initialization time. In GPU mode the non-static fillers draw their values
+// on the device, thus large models never go through host memory.
 
 #ifndef CAFFE_FILLER_HPP
 #define CAFFE_FILLER_HPP
@@ -24,6 +25,29 @@ class Filler {
   virtual ~Filler() {}
   virtual void Fill(Blob* blob) = 0;
  protected:
+  // On the GPU the values come from a generator seeded with Caffe::next_seed()
+  static void FillUniform(Blob* blob, float a, float b) {
+#ifndef CPU_ONLY
+    if (Caffe::mode() == Caffe::GPU) {
+      caffe_gpu_rng_uniform<Dtype>(blob->count(), Dtype(a), Dtype(b),
+          blob->mutable_gpu_data<Dtype>(), Caffe::next_seed());
+      return;
+    }
+#endif
+    caffe_rng_uniform<Dtype>(blob->count(), a, b, blob->mutable_cpu_data<Dtype>());
+  }
+
+  static void FillGaussian(Blob* blob, float mean, float std) {
+#ifndef CPU_ONLY
+    if (Caffe::mode() == Caffe::GPU) {
+      caffe_gpu_rng_gaussian<Dtype>(blob->count(), Dtype(mean), Dtype(std),
+          blob->mutable_gpu_data<Dtype>(), Caffe::next_seed());
+      return;
+    }
+#endif
+    caffe_rng_gaussian<Dtype>(blob->count(), mean, std, blob->mutable_cpu_data<Dtype>());
+  }
+
   FillerParameter filler_param_;
 };  // class Filler
 
@@ -35,15 +59,21 @@ class ConstantFiller : public Filler<Dtype> {
   explicit ConstantFiller(const FillerParameter& param)
       : Filler<Dtype>(param) {}
   virtual void Fill(Blob* blob) {
-    Dtype* data = blob->mutable_cpu_data<Dtype>();
     const int count = blob->count();
     const Dtype value = this->filler_param_.value();
     CHECK(count);
+    CHECK_EQ(this->filler_param_.sparse(), -1)
+         << "Sparsity not supported by this Filler.";
+#ifndef CPU_ONLY
+    if (Caffe::mode() == Caffe::GPU) {
+      caffe_gpu_set(count, value, blob->mutable_gpu_data<Dtype>());
+      return;
+    }
+#endif
+    Dtype* data = blob->mutable_cpu_data<Dtype>();
     for (int i = 0; i < count; ++i) {
       data[i] = value;
     }
-    CHECK_EQ(this->filler_param_.sparse(), -1)
-         << "Sparsity not supported by this Filler.";
   }
 };
 
@@ -55,8 +85,7 @@ class UniformFiller : public Filler<Dtype> {
       : Filler<Dtype>(param) {}
   virtual void Fill(Blob* blob) {
     CHECK(blob->count());
-    caffe_rng_uniform<Dtype>(blob->count(), this->filler_param_.min(),
-        this->filler_param_.max(), blob->mutable_cpu_data<Dtype>());
+    this->FillUniform(blob, this->filler_param_.min(), this->filler_param_.max());
     CHECK_EQ(this->filler_param_.sparse(), -1)
          << "Sparsity not supported by this Filler.";
   }
@@ -102,26 +131,29 @@ class GaussianFiller : public Filler<Dtype> {
   explicit GaussianFiller(const FillerParameter& param)
       : Filler<Dtype>(param) {}
   virtual void Fill(Blob* blob) {
-    Dtype* data = blob->mutable_cpu_data<Dtype>();
     CHECK(blob->count());
-    caffe_rng_gaussian<Dtype>(blob->count(), this->filler_param_.mean(),
-        this->filler_param_.std(), blob->mutable_cpu_data<Dtype>());
     int sparse = this->filler_param_.sparse();
     CHECK_GE(sparse, -1);
-    if (sparse >= 0) {
-      // Sparse initialization is implemented for "weight" blobs; i.e. matrices.
-      // These have num == channels == 1; width is number of inputs; height is
-      // number of outputs.  The 'sparse' variable specifies the mean number
-      // of non-zero input weights for a given output.
-      CHECK_GE(blob->num_axes(), 1);
-      const int num_outputs = blob->shape(0);
-      Dtype non_zero_probability = Dtype(sparse) / Dtype(num_outputs);
-      rand_vec_.reset(new SyncedMemory(even(blob->count()) * sizeof(int)));
-      int* mask = reinterpret_cast<int*>(rand_vec_->mutable_cpu_data());
-      caffe_rng_bernoulli(blob->count(), non_zero_probability, mask);
-      for (int i = 0; i < blob->count(); ++i) {
-        data[i] *= mask[i];
-      }
+    if (sparse < 0) {
+      this->FillGaussian(blob, this->filler_param_.mean(), this->filler_param_.std());
+      return;
+    }
+    // Masked on the host
+    Dtype* data = blob->mutable_cpu_data<Dtype>();
+    caffe_rng_gaussian<Dtype>(blob->count(), this->filler_param_.mean(),
+        this->filler_param_.std(), data);
+    // Sparse initialization is implemented for "weight" blobs; i.e. matrices.
+    // These have num == channels == 1; width is number of inputs; height is
+    // number of outputs.  The 'sparse' variable specifies the mean number
+    // of non-zero input weights for a given output.
+    CHECK_GE(blob->num_axes(), 1);
+    const int num_outputs = blob->shape(0);
+    Dtype non_zero_probability = Dtype(sparse) / Dtype(num_outputs);
+    rand_vec_.reset(new SyncedMemory(even(blob->count()) * sizeof(int)));
+    int* mask = reinterpret_cast<int*>(rand_vec_->mutable_cpu_data());
+    caffe_rng_bernoulli(blob->count(), non_zero_probability, mask);
+    for (int i = 0; i < blob->count(); ++i) {
+      data[i] *= mask[i];
     }
   }
 
@@ -292,8 +324,7 @@ class XavierFiller : public Filler<Dtype> {
       n = fan_out;
     }
     const float scale = std::sqrt(3.F / n);
-    caffe_rng_uniform<Dtype>(blob->count(), -scale, scale,
-        blob->mutable_cpu_data<Dtype>());
+    this->FillUniform(blob, -scale, scale);
     CHECK_EQ(this->filler_param_.sparse(), -1)
          << "Sparsity not supported by this Filler.";
   }
@@ -393,8 +424,7 @@ class MSRAFiller : public Filler<Dtype> {
       n = fan_out;
     }
     float std = std::sqrt(2.F / n);
-    caffe_rng_gaussian<Dtype>(blob->count(), 0.F, std,
-        blob->mutable_cpu_data<Dtype>());
+    this->FillGaussian(blob, 0.F, std);
     CHECK_EQ(this->filler_param_.sparse(), -1) << "Sparsity not supported by this Filler.";
   }
 };
@@ -0,0 +1,139 @@
+#ifndef CAFFE_INFERENCE_ENGINE_HPP_
+#define CAFFE_INFERENCE_ENGINE_HPP_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#ifndef CPU_ONLY
+#include "caffe/util/gpu_memory.hpp"
+#endif
+
+namespace caffe {
+
+class WeightDeduplicator;
+
+/**
+ * @brief What engines of a ModelRepository share, null or empty members are not shared.
+ */
+struct EngineSharing {
+  struct Slot {
+    std::mutex mutex;
+#ifndef CPU_ONLY
+    shared_ptr<GPUMemory::Workspace> workspace;
+#endif
+  };
+  // Weights loaded by the first context, equal ones share memory
+  WeightDeduplicator* weights = nullptr;
+  // Context i runs in slots[i % size] holding its mutex, with its convolution workspace
+  vector<shared_ptr<Slot>> slots;
+};
+
+/**
+ * @brief Serves concurrent inference requests from several execution contexts
+ *        sharing one copy of the weights.
+ *
+ * Every context is a TEST phase Net owned by its own worker thread, thus with its own
+ * stream, cuBLAS and cuDNN handles and convolution workspace. The first context loads
+ * the weights, the others share them by Net::ShareTrainedLayersWith. In GPU mode
+ * activations are planned (see NetParameter::plan_activation_memory), so every
+ * context adds only its activation arena. Nets with Python layers aren't supported.
+ *
+ * With batch_sizes given, every batch size gets its own contexts with Input layers shaped
+ * for it, and requests of a listed batch size never reshape a net.
+ */
+class InferenceEngine {
+ public:
+  /**
+   * @param param net definition, phase is forced to TEST
+   * @param weights_file trained weights, as for Net::CopyTrainedLayersFrom, an IpcWeights
+   *        handle to run on weights another process holds
+   * @param contexts number of execution contexts, per batch size if given
+   * @param device GPU to run on, current one if negative, ignored in CPU mode
+   * @param batch_sizes contexts are created for each of these, any batch size if empty
+   * @param sharing resources shared with other engines, see ModelRepository
+   */
+  InferenceEngine(const NetParameter& param, const string& weights_file, int contexts,
+      int device = -1, const vector<int>& batch_sizes = vector<int>(),
+      const EngineSharing& sharing = EngineSharing());
+  ~InferenceEngine();
+
+  /**
+   * @brief Runs a forward pass on the first idle context. Thread safe.
+   * @param inputs in input_names() order, the net gets reshaped if their shapes differ
+   * @param outputs in output_names() order, reshaped and filled with the results
+   */
+  void Infer(const vector<Blob*>& inputs, const vector<Blob*>& outputs);
+  /**
+   * @brief Same as Infer but returns right away, done is called by the context when
+   *        outputs are filled. Blobs must be kept alive till then.
+   */
+  void InferAsync(const vector<Blob*>& inputs, const vector<Blob*>& outputs,
+      const std::function<void()>& done);
+
+  // Of the contexts, -1 in CPU mode
+  int device() const {
+    return device_;
+  }
+  // Of all batch sizes
+  int contexts() const {
+    return workers_.size();
+  }
+  // Sorted, empty if contexts take any batch size
+  const vector<int>& batch_sizes() const {
+    return batch_sizes_;
+  }
+  const vector<string>& input_names() const {
+    return input_names_;
+  }
+  const vector<string>& output_names() const {
+    return output_names_;
+  }
+  // Net of the given context, only to be inspected
+  const Net& net(int context) const {
+    return *nets_[context];
+  }
+  // Learnable params, shared by all contexts
+  const vector<shared_ptr<Blob>>& weights() const {
+    return nets_[0]->learnable_params();
+  }
+
+ private:
+  struct Request {
+    vector<Blob*> inputs;
+    vector<Blob*> outputs;
+    std::function<void()> done;
+  };
+
+  void WorkerEntry(int context, int group, const NetParameter& param,
+      const string& weights_file, std::promise<void>* ready);
+  void Run(Net* net, const Request& request) const;
+
+  const Caffe::Brew mode_;
+  int device_;
+  const EngineSharing sharing_;
+  vector<int> batch_sizes_;
+  vector<shared_ptr<Net>> nets_;
+  vector<string> input_names_, output_names_;
+  vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // One queue per batch size
+  vector<std::deque<Request*>> requests_;
+  bool stop_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(InferenceEngine);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_INFERENCE_ENGINE_HPP_
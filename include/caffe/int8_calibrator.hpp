@@ -0,0 +1,60 @@
+#ifndef CAFFE_INT8_CALIBRATOR_HPP_
+#define CAFFE_INT8_CALIBRATOR_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Finds the input scales of a net's Convolution and InnerProduct layers
+ *        for INT8 inference (see NetParameter::int8_calibration).
+ *
+ * The net is run layer by layer over calibration batches twice: first to find every
+ * layer's largest input magnitude, then to histogram input magnitudes up to it in BINS
+ * bins. The saturation threshold of a histogram is chosen by method:
+ *  - "kl": minimizes the KL divergence between inputs and their quantization;
+ *  - "percentile": keeps the given fraction of inputs unsaturated.
+ */
+class Int8Calibrator {
+ public:
+  /**
+   * @param net TEST phase, with trained weights
+   */
+  explicit Int8Calibrator(Net* net, const string& method = "kl",
+      double percentile = 0.9999);
+
+  /// @brief Runs 2 x iterations forward passes and fills table().
+  void Calibrate(int iterations);
+
+  const QuantizationTable& table() const {
+    return table_;
+  }
+
+  static constexpr int BINS = 2048;
+
+ private:
+  // Forward passes observing inputs, histograms are filled if max_abs_ is known
+  void Observe(int iterations, bool histogram);
+
+  Net* net_;
+  const string method_;
+  const double percentile_;
+  // Indices of quantizable layers
+  vector<int> layers_;
+  vector<float> max_abs_;
+  vector<vector<double>> hist_;
+  TBlob<float> input_;
+  QuantizationTable table_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(Int8Calibrator);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_INT8_CALIBRATOR_HPP_
@@ -1,6 +1,8 @@
 #ifndef CAFFE_INTERNAL_THREAD_HPP_
 #define CAFFE_INTERNAL_THREAD_HPP_
 
+#include <string>
+
 #include "caffe/common.hpp"
 
 /**
@@ -69,6 +71,11 @@ class InternalThread {
 
   virtual void InternalThreadEntryN(size_t id) {}
 
+  // Threads are profiled as "<thread_name()> #<id>", see ThreadProfile
+  virtual std::string thread_name() const {
+    return "thread";
+  }
+
   /* Should be tested when running loops to exit when requested. */
   bool must_stop(int id) {
     return threads_[id].interruption_requested();
@@ -11,6 +11,8 @@
 #include "caffe/layer_factory.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/device_alternate.hpp"
+#include "caffe/util/layer_cost.hpp"
+#include "caffe/util/nvtx.hpp"
 
 #if defined(USE_CUDNN)
 
@@ -30,6 +32,20 @@ class Solver;
 class Net;
 class Flag;
 
+// Input pipeline counters of a prefetching data layer, busy times are summed over
+// the threads of each stage (see caffe datapipe)
+struct DataPipeStats {
+  uint64_t read_us, parse_us;  // parser threads
+  uint64_t decode_us, transform_us;  // transformer threads, excluding waits for datums
+  uint64_t batches, samples;  // prefetched so far
+  uint64_t unique_samples;  // of them, those not echoed, see DataParameter::echo_factor
+  size_t parser_threads, transformer_threads;
+  size_t datums_queued, datums_capacity;  // parsed, waiting for transformers
+  size_t batches_queued, batches_capacity;  // prefetched, waiting for the net
+  size_t batch_bytes;
+  uint64_t cache_hits, cache_misses;  // records, DataParameter::cache only
+};
+
 /**
  * @brief An interface for the units of computation which can be composed into a
  *        Net.
@@ -56,6 +72,7 @@ class LayerBase {
         parent_net_(nullptr),
         net_inititialized_flag_(nullptr),
         net_iteration0_flag_(nullptr),
+        overwrite_param_diffs_(false),
         is_shared_(false) {
     InitMutex();
   }
@@ -76,7 +93,8 @@ class LayerBase {
   void SetUp(const vector<Blob*>& bottom, const vector<Blob*>& top) {
     CheckBlobCounts(bottom, top);
     LayerSetUp(bottom, top);
-    Reshape(bottom, top);
+    reshaped_blobs_.clear();
+    ReshapeIfChanged(bottom, top);
     SetLossWeights(top);
   }
 
@@ -94,6 +112,19 @@ class LayerBase {
    */
   virtual void Reshape(const vector<Blob*>& bottom, const vector<Blob*>& top) = 0;
 
+  /**
+   * @brief Whether Reshape only depends on the shapes of bottom blobs and on layer
+   *        parameters. Such layers aren't reshaped again while their bottom and top
+   *        shapes stay the same, so a shape change only costs the layers downstream.
+   */
+  virtual bool reshape_invariant() const { return false; }
+
+  /**
+   * @brief Calls Reshape unless the layer is reshape_invariant and gets the blobs of
+   *        the previous call with unchanged shapes.
+   */
+  void ReshapeIfChanged(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
   /**
    * @brief Whether a layer should be shared by multiple nets during data
    *        parallelism. By default, all layers except for data layers should
@@ -102,6 +133,43 @@ class LayerBase {
    */
   virtual inline bool ShareInParallel() const { return false; }
 
+  /**
+   * @brief Whether Forward_gpu only enqueues work on Caffe::thread_stream(), using the
+   *        same buffers and arguments every time once shapes are set. Such layers can
+   *        be captured into a CUDA graph and replayed (see NetParameter::cuda_graph).
+   *        Layers touching host memory, other streams or random numbers can't.
+   */
+  virtual bool is_capturable() const { return false; }
+
+  /**
+   * @brief Whether Backward honors set_overwrite_param_diffs in the current mode.
+   */
+  virtual bool can_overwrite_param_diffs() const { return false; }
+
+  /**
+   * @brief Makes the next passes of a layer that can_overwrite_param_diffs write the
+   *        gradients of its blobs (beta 0 in cuBLAS and cuDNN) instead of adding to them.
+   *        Net sets it for the first micro-batch of an iteration, see
+   *        Net::ForwardBackward.
+   */
+  void set_overwrite_param_diffs(bool overwrite) {
+    overwrite_param_diffs_ = overwrite;
+  }
+
+  /**
+   * @brief Device scratch bytes the layer's passes need at its current shapes, on top
+   *        of its blobs. It is taken from the shared GPUMemory workspace (see caffe time).
+   */
+  virtual size_t workspace_bytes() const { return 0UL; }
+
+  /**
+   * @brief Refines the work of the layer's passes at its current shapes, see layer_cost.
+   *        cost comes with the defaults filled in: one operation per output (forward)
+   *        or input (backward) element and every blob moved once.
+   */
+  virtual void Cost(const vector<Blob*>& bottom, const vector<Blob*>& top,
+      LayerCost* cost) const {}
+
   /** @brief Return whether this layer is actually shared by other nets.
    *         If ShareInParallel() is true and using more than one GPU and the
    *         net has TRAIN phase, then this function is expected return true.
@@ -265,6 +333,9 @@ class LayerBase {
    * @param top
    *     the preshaped output blobs, whose data fields will store this layers'
    *     outputs
+   * @param device_loss
+   *     GPU mode: if set, device memory the loss is added to on the layer's
+   *     stream, nothing waits for it and 0 is returned
    * \return The total loss from the layer.
    *
    * The Forward wrapper calls the relevant device wrapper function
@@ -274,7 +345,8 @@ class LayerBase {
    *
    * Your layer should implement Forward_cpu and (optionally) Forward_gpu.
    */
-  virtual float Forward(const vector<Blob*>& bottom, const vector<Blob*>& top) = 0;
+  virtual float Forward(const vector<Blob*>& bottom, const vector<Blob*>& top,
+      float* device_loss = nullptr) = 0;
 
   /**
    * @brief Given the top blob error gradients, compute the bottom blob error
@@ -378,6 +450,50 @@ class LayerBase {
     return false;
   }
 
+  /**
+   * @brief Rows (indices along the first axis) of blob blob_id with gradients since
+   *        the solver last cleared them, sorted, or nullptr if all rows have them.
+   */
+  virtual vector<int>* sparse_rows(int blob_id) {
+    return nullptr;
+  }
+
+  /**
+   * @brief Microseconds spent so far waiting for prefetched batches
+   */
+  virtual uint64_t prefetch_wait_us() const {
+    return 0UL;
+  }
+
+  /**
+   * @brief Fills the input pipeline counters of prefetching data layers,
+   *        returns false for other layers.
+   */
+  virtual bool data_pipe_stats(DataPipeStats* stats) const {
+    return false;
+  }
+
+  /**
+   * @brief Makes data layers produce batches of batch_size samples cropped to crop_size
+   *        from now on, -1 meaning the value of the layer's parameter. Returns false for
+   *        other layers. See SolverParameter::input_shape_schedule.
+   */
+  virtual bool set_input_shape(int batch_size, int crop_size) {
+    return false;
+  }
+
+  /**
+   * @brief Layers tuned for their shapes tune again on the next Reshape changing them,
+   *        see Net::SetInputShape.
+   */
+  virtual void retune_for_shapes() {}
+
+  /**
+   * @brief Layers keeping copies of their weights in another layout drop them, the
+   *        weights having been changed from outside. See Net::WeightsChanged.
+   */
+  virtual void WeightsChanged() {}
+
   /**
    * @brief Writes the layer parameter to a protocol buffer
    */
@@ -453,6 +569,9 @@ class LayerBase {
   /** Gets set when Net::Init is over */
   Flag* net_iteration0_flag_;
 
+  /** See set_overwrite_param_diffs */
+  bool overwrite_param_diffs_;
+
  private:
   /** Whether this layer is actually shared by other nets*/
   bool is_shared_;
@@ -460,6 +579,10 @@ class LayerBase {
   /** The mutex for sequential forward if this layer is shared */
   shared_ptr<std::mutex> forward_mutex_;
 
+  /** Bottom then top blobs and their shapes after the last Reshape, see ReshapeIfChanged */
+  vector<const Blob*> reshaped_blobs_;
+  vector<vector<int>> reshaped_shapes_;
+
   /** Initialize forward_mutex_ */
   void InitMutex();
 
@@ -474,7 +597,8 @@ class Layer : public LayerBase {
  public:
   explicit Layer(const LayerParameter& param);
 
-  virtual float Forward(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual float Forward(const vector<Blob*>& bottom, const vector<Blob*>& top,
+      float* device_loss = nullptr);
 
   virtual void Backward(const vector<Blob*>& top, const vector<bool>& propagate_down,
       const vector<Blob*>& bottom);
@@ -552,11 +676,13 @@ class Layer : public LayerBase {
 // gpu specific implementations instead, and should not change these
 // functions.
 template<typename Ftype, typename Btype>
-inline float Layer<Ftype, Btype>::Forward(const vector<Blob*>& bottom, const vector<Blob*>& top) {
+inline float Layer<Ftype, Btype>::Forward(const vector<Blob*>& bottom, const vector<Blob*>& top,
+    float* device_loss) {
   // Lock during forward to ensure sequential forward
   Lock();
+  NVTX_RANGE(NVTX_FORWARD, layer_param_.name());
   float loss = 0;
-  Reshape(bottom, top);
+  ReshapeIfChanged(bottom, top);
   switch (Caffe::mode()) {
     case Caffe::CPU:
       Forward_cpu(bottom, top);
@@ -574,7 +700,10 @@ inline float Layer<Ftype, Btype>::Forward(const vector<Blob*>& bottom, const vec
       for (int top_id = 0; top_id < top.size(); ++top_id) {
         if (this->loss(top_id) == 0.F) { continue; }
         const int count = top[top_id]->count();
-        if (count < 16 && is_precise<Ftype>()) {
+        if (device_loss != nullptr) {
+          caffe_gpu_dot_add(tp<Ftype>(), count, top[top_id]->gpu_data<Ftype>(),
+              top[top_id]->gpu_diff<Ftype>(), device_loss, Caffe::thread_stream());
+        } else if (count < 16 && is_precise<Ftype>()) {
           loss += caffe_cpu_dot(count, top[top_id]->cpu_data<Ftype>(),
               top[top_id]->cpu_diff<Ftype>());
         } else {
@@ -598,6 +727,7 @@ template<typename Ftype, typename Btype>
 inline void
 Layer<Ftype, Btype>::Backward(const vector<Blob*>& top, const vector<bool>& propagate_down,
     const vector<Blob*>& bottom) {
+  NVTX_RANGE(NVTX_BACKWARD, layer_param_.name());
   switch (Caffe::mode()) {
     case Caffe::CPU:
       Backward_cpu(top, propagate_down, bottom);
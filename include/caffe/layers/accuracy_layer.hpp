@@ -68,6 +68,10 @@ class AccuracyLayer : public Layer<Ftype, Btype> {
    */
   virtual void Forward_cpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
+  /// @brief Top-k selection and per-class counts in one kernel, the reductions stay
+  ///        on the device.
+  virtual void Forward_gpu(const vector<Blob*>& bottom,
+      const vector<Blob*>& top);
 
   /// @brief Not implemented -- AccuracyLayer cannot be used as a loss.
   virtual void Backward_cpu(const vector<Blob*>& top,
@@ -85,6 +89,10 @@ class AccuracyLayer : public Layer<Ftype, Btype> {
   int ignore_label_;
   /// Keeps counts of the number of samples per class.
   TBlob<float> nums_buffer_;
+  /// Per-class counts of correct predictions (GPU).
+  TBlob<float> class_acc_buffer_;
+  /// Whether each prediction is correct (data) and counted (diff) (GPU).
+  TBlob<float> acc_buffer_;
 };
 
 }  // namespace caffe
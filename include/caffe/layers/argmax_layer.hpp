@@ -43,6 +43,7 @@ class ArgMaxLayer : public Layer<Ftype, Btype> {
       const vector<Blob*>& top);
 
   virtual inline const char* type() const { return "ArgMax"; }
+  virtual bool is_capturable() const { return true; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -61,6 +62,8 @@ class ArgMaxLayer : public Layer<Ftype, Btype> {
    */
   virtual void Forward_cpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
+  virtual void Forward_gpu(const vector<Blob*>& bottom,
+      const vector<Blob*>& top);
   /// @brief Not implemented (non-differentiable function)
   virtual void Backward_cpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
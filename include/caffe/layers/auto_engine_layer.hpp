@@ -0,0 +1,83 @@
+#ifndef CAFFE_AUTO_ENGINE_LAYER_HPP_
+#define CAFFE_AUTO_ENGINE_LAYER_HPP_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+#ifdef USE_CUDNN
+/**
+ * @brief Layer of engine AUTO (Convolution, Deconvolution, Pooling and LRN): holds a CAFFE
+ *        and a CUDNN layer sharing the learnable blobs and keeps the faster one.
+ *
+ * The first passes alternate between the two, timed by events on the thread stream.
+ * The first pass of each one is a warm-up (cuDNN seekers run there). After
+ * kTrialPasses more passes each, the one with the lower forward plus backward time
+ * wins, the other is released. The pick is looked up in and appended to
+ * LayerParameter::engine_cache_file, keyed by GPU, cuDNN version, types and geometry,
+ * so later runs skip the trials.
+ */
+template <typename Ftype, typename Btype>
+class AutoEngineLayer : public Layer<Ftype, Btype> {
+ public:
+  static constexpr int kTrialPasses = 3;
+  enum Candidate { CAFFE_ENGINE, CUDNN_ENGINE, CANDIDATES };
+
+  explicit AutoEngineLayer(const LayerParameter& param)
+      : Layer<Ftype, Btype>(param), winner_(-1), pass_(0), last_(0) {}
+  virtual ~AutoEngineLayer();
+
+  void LayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top) override;
+  void Reshape(const vector<Blob*>& bottom, const vector<Blob*>& top) override;
+  bool reshape_invariant() const override { return true; }
+
+  const char* type() const override { return this->layer_param_.type().c_str(); }
+  bool is_capturable() const override {
+    return winner_ >= 0 && candidates_[winner_]->is_capturable();
+  }
+  bool can_overwrite_param_diffs() const override;
+  size_t workspace_bytes() const override;
+  void retune_for_shapes() override;
+  void Cost(const vector<Blob*>& bottom, const vector<Blob*>& top,
+      LayerCost* cost) const override;
+
+  // CAFFE_ENGINE or CUDNN_ENGINE once picked, -1 while the trials run
+  int winner() const { return winner_; }
+
+ protected:
+  void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top) override;
+  void Forward_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top) override;
+  void Backward_cpu(const vector<Blob*>& top, const vector<bool>& propagate_down,
+      const vector<Blob*>& bottom) override;
+  void Backward_gpu(const vector<Blob*>& top, const vector<bool>& propagate_down,
+      const vector<Blob*>& bottom) override;
+
+  // Candidate running the next forward pass
+  int next() const { return winner_ >= 0 ? winner_ : pass_ % CANDIDATES; }
+  // Candidate layer of the given engine with the same parameters otherwise
+  shared_ptr<LayerBase> CreateCandidate(int candidate) const;
+  std::string CacheKey(const vector<Blob*>& bottom) const;
+  std::string CacheFile() const;
+  void Run(int candidate, bool timed, const std::function<void()>& pass);
+  void Pick(int winner);
+  void Decide();
+
+  shared_ptr<LayerBase> candidates_[CANDIDATES];
+  // Event pairs around timed passes of each candidate, read once by Decide
+  vector<cudaEvent_t> events_[CANDIDATES];
+  std::string cache_key_;
+  int winner_;
+  int pass_;
+  int last_;  // candidate of the last forward pass, runs the backward one
+};
+#endif
+
+}  // namespace caffe
+
+#endif  // CAFFE_AUTO_ENGINE_LAYER_HPP_
@@ -6,7 +6,10 @@
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/gpu_memory.hpp"
 #include "caffe/util/im2col.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/quantization.hpp"
 
 namespace caffe {
 
@@ -18,11 +21,15 @@ template <typename Ftype, typename Btype>
 class BaseConvolutionLayer : public Layer<Ftype, Btype> {
  public:
   explicit BaseConvolutionLayer(const LayerParameter& param)
-      : Layer<Ftype, Btype>(param) {}
+      : Layer<Ftype, Btype>(param), gemm_batch_(0), gemm_workspace_bytes_(0UL) {}
   virtual void LayerSetUp(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
   virtual void Reshape(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
+  virtual bool reshape_invariant() const { return true; }
+  virtual void Cost(const vector<Blob*>& bottom, const vector<Blob*>& top,
+      LayerCost* cost) const;
+  virtual size_t workspace_bytes() const { return gemm_workspace_bytes_; }
 
   virtual inline int MinBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
@@ -92,6 +99,22 @@ class BaseConvolutionLayer : public Layer<Ftype, Btype> {
     }
   }
 
+  // INT8 forward of one image with the bias fused, see Int8Gemm
+  void forward_cpu_int8(const Ftype* input, Ftype* output) {
+    const Ftype* col_buff = input;
+    if (!is_1x1_) {
+      conv_im2col_cpu<Ftype>(input, col_buffer_.template mutable_cpu_data<Ftype>());
+      col_buff = col_buffer_.template cpu_data<Ftype>();
+    }
+    const Ftype* bias = bias_term_ ? this->blobs_[1]->template cpu_data<Ftype>() : nullptr;
+    const int group_channels = conv_out_channels_ / group_;
+    for (int g = 0; g < group_; ++g) {
+      int8_gemm(g).Forward_cpu(conv_out_spatial_dim_, col_buff + col_offset_ * g, true,
+          bias == nullptr ? nullptr : bias + group_channels * g, output + output_offset_ * g,
+          true);
+    }
+  }
+
   template <typename Dtype>
   void backward_cpu_bias(Dtype* bias, const Dtype* input) {
     caffe_cpu_gemv(CblasNoTrans, num_output_, out_spatial_dim_, (Dtype)1.,
@@ -160,12 +183,106 @@ class BaseConvolutionLayer : public Layer<Ftype, Btype> {
     }
   }
 
+  void forward_gpu_int8(const Ftype* input, Ftype* output) {
+    const Ftype* col_buff = input;
+    if (!is_1x1_) {
+      conv_im2col_gpu<Ftype>(input, col_buffer_.template mutable_gpu_data<Ftype>());
+      col_buff = col_buffer_.template gpu_data<Ftype>();
+    }
+    const Ftype* bias = bias_term_ ? this->blobs_[1]->template gpu_data<Ftype>() : nullptr;
+    const int group_channels = conv_out_channels_ / group_;
+    for (int g = 0; g < group_; ++g) {
+      int8_gemm(g).Forward_gpu(conv_out_spatial_dim_, col_buff + col_offset_ * g, true,
+          bias == nullptr ? nullptr : bias + group_channels * g, output + output_offset_ * g,
+          true);
+    }
+  }
+
   template <typename Dtype>
   void backward_gpu_bias(Dtype* bias, const Dtype* input) {
     caffe_gpu_gemv(CblasNoTrans, num_output_, out_spatial_dim_, (Dtype)1.,
         input, bias_multiplier_.template gpu_data<Dtype>(), (Dtype)1., bias);
   }
 
+  // Batched versions of the helpers above for gemm_batch_ images or less, see
+  // ConvolutionParameter::gemm_batch_mb. Image j's input and output start at
+  // j * in_dim and j * out_dim. ws is gemm_workspace(), holding the columns of all
+  // the images, their weight gradients and a vector of ones.
+  template <typename Dtype>
+  void forward_gpu_gemm_batched(const Dtype* input, int in_dim, const Dtype* weights,
+      Dtype* output, int out_dim, int images, Dtype* ws, bool skip_im2col = false) {
+    const Dtype* col_buff = input;
+    int col_dim = in_dim;
+    if (!is_1x1_) {
+      for (int j = 0; !skip_im2col && j < images; ++j) {
+        conv_im2col_gpu<Dtype>(input + j * in_dim, ws + j * col_count_);
+      }
+      col_buff = ws;
+      col_dim = col_count_;
+    }
+    gemm_batched(CblasNoTrans, CblasNoTrans, conv_out_channels_ / group_,
+        conv_out_spatial_dim_, kernel_dim_, weights, 0, weight_offset_,
+        col_buff, col_dim, col_offset_, (Dtype)0., output, out_dim, output_offset_, images);
+  }
+
+  // Adds the bias to all num_ outputs at once
+  template <typename Dtype>
+  void forward_gpu_bias_batched(Dtype* output, const Dtype* bias) {
+    caffe_gpu_gemm_strided_batched<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
+        out_spatial_dim_, 1, (Dtype)1., bias, 0, bias_multiplier_.template gpu_data<Dtype>(),
+        0, (Dtype)1., output, top_dim_, num_);
+  }
+
+  template <typename Dtype>
+  void backward_gpu_gemm_batched(const Dtype* output, int out_dim, const Dtype* weights,
+      Dtype* input, int in_dim, int images, Dtype* ws) {
+    Dtype* col_buff = is_1x1_ ? input : ws;
+    const int col_dim = is_1x1_ ? in_dim : col_count_;
+    gemm_batched(CblasTrans, CblasNoTrans, kernel_dim_, conv_out_spatial_dim_,
+        conv_out_channels_ / group_, weights, 0, weight_offset_, output, out_dim,
+        output_offset_, (Dtype)0., col_buff, col_dim, col_offset_, images);
+    for (int j = 0; !is_1x1_ && j < images; ++j) {
+      conv_col2im_gpu(ws + j * col_count_, input + j * in_dim);
+    }
+  }
+
+  // Gradients of every image go to the workspace, one gemv adds them up
+  template <typename Dtype>
+  void weight_gpu_gemm_batched(const Dtype* input, int in_dim, const Dtype* output,
+      int out_dim, Dtype* weights, int images, Dtype* ws) {
+    const Dtype* col_buff = input;
+    int col_dim = in_dim;
+    if (!is_1x1_) {
+      for (int j = 0; j < images; ++j) {
+        conv_im2col_gpu<Dtype>(input + j * in_dim, ws + j * col_count_);
+      }
+      col_buff = ws;
+      col_dim = col_count_;
+    }
+    const int weight_count = weight_offset_ * group_;
+    Dtype* partial = ws + (is_1x1_ ? 0 : gemm_batch_ * col_count_);
+    Dtype* ones = partial + gemm_batch_ * weight_count;
+    gemm_batched(CblasNoTrans, CblasTrans, conv_out_channels_ / group_, kernel_dim_,
+        conv_out_spatial_dim_, output, out_dim, output_offset_, col_buff, col_dim,
+        col_offset_, (Dtype)0., partial, weight_count, weight_offset_, images);
+    caffe_gpu_set(images, (Dtype)1., ones);
+    caffe_gpu_gemv(CblasTrans, images, weight_count, (Dtype)1., partial, ones, (Dtype)1.,
+        weights);
+  }
+
+  // Workspace of the batched helpers, nullptr when they are off or it can't be had
+  template <typename Dtype>
+  Dtype* gemm_workspace() {
+    if (gemm_batch_ == 0) {
+      return nullptr;
+    }
+    shared_ptr<GPUMemory::Workspace> ws = GPUMemory::thread_workspace(Caffe::current_device());
+    if (!ws->try_reserve(gemm_workspace_bytes_)) {
+      return nullptr;
+    }
+    return static_cast<Dtype*>(ws->data());
+  }
+
 #endif
 
   /// @brief The spatial dimensions of the input.
@@ -208,8 +325,15 @@ class BaseConvolutionLayer : public Layer<Ftype, Btype> {
   bool bias_term_;
   bool is_1x1_;
   bool force_nd_im2col_;
+  bool quantized_;
+  // Images per batched gemm of the GPU passes, 0 runs one image at a time
+  int gemm_batch_;
+  size_t gemm_workspace_bytes_;
 
  private:
+  // Of group g, weights are quantized on the first call
+  Int8Gemm& int8_gemm(int g);
+
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
   template <typename Dtype>
   inline void conv_im2col_cpu(const Dtype* data, Dtype* col_buff) {
@@ -242,6 +366,28 @@ class BaseConvolutionLayer : public Layer<Ftype, Btype> {
     }
   }
 #ifndef CPU_ONLY
+  // Strided batched gemms of several images: one per group, or one per image over
+  // the groups when there are more groups than images. Image j and group g of A, B
+  // and C start at j * x_dim + g * x_group.
+  template <typename Dtype>
+  void gemm_batched(CBLAS_TRANSPOSE trans_a, CBLAS_TRANSPOSE trans_b, int m, int n, int k,
+      const Dtype* a, int a_dim, int a_group, const Dtype* b, int b_dim, int b_group,
+      Dtype beta, Dtype* c, int c_dim, int c_group, int images) {
+    if (images >= group_) {
+      for (int g = 0; g < group_; ++g) {
+        caffe_gpu_gemm_strided_batched<Dtype>(trans_a, trans_b, m, n, k, (Dtype)1.,
+            a + a_group * g, a_dim, b + b_group * g, b_dim, beta, c + c_group * g, c_dim,
+            images);
+      }
+    } else {
+      for (int j = 0; j < images; ++j) {
+        caffe_gpu_gemm_strided_batched<Dtype>(trans_a, trans_b, m, n, k, (Dtype)1.,
+            a + a_dim * j, a_group, b + b_dim * j, b_group, beta, c + c_dim * j, c_group,
+            group_);
+      }
+    }
+  }
+
   template <typename Dtype>
   inline void conv_im2col_gpu(const Dtype* data, Dtype* col_buff) {
     if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
@@ -283,9 +429,11 @@ class BaseConvolutionLayer : public Layer<Ftype, Btype> {
   int conv_out_spatial_dim_;
   int kernel_dim_;
   int col_offset_;
+  int col_count_;  // columns of one image, all groups
   int output_offset_;
 
   TBlob<Ftype> col_buffer_;
+  vector<shared_ptr<Int8Gemm>> int8_gemm_;
   TBlob<Ftype> bias_multiplier_;
 };
 
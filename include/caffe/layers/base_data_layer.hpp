@@ -1,6 +1,7 @@
 #ifndef CAFFE_DATA_LAYERS_HPP_
 #define CAFFE_DATA_LAYERS_HPP_
 
+#include <atomic>
 #include <vector>
 #include <mutex>
 
@@ -53,10 +54,21 @@ class Batch {
   shared_ptr<Blob> data_;
   shared_ptr<Blob> label_;
 
-  Batch(Type data_type, Type diff_type)
-      : data_(Blob::create(data_type, diff_type)), label_(Blob::create(data_type, diff_type)),
-        id_((size_t) -1), data_packing_(NCHW) {
+  // Labels of their own type, see DataParameter::label_type
+  Batch(Type data_type, Type diff_type, Type label_type)
+      : data_(Blob::create(data_type, diff_type)), label_(Blob::create(label_type, label_type)),
+        id_((size_t) -1), data_packing_(NCHW), echo_(false) {
     data_->safe_reshape_mode(true);
+#ifndef CPU_ONLY
+    pushed_ = nullptr;
+#endif
+  }
+  ~Batch() {
+#ifndef CPU_ONLY
+    if (pushed_ != nullptr) {
+      cudaEventDestroy(pushed_);
+    }
+#endif
   }
 
   size_t id() const {
@@ -74,11 +86,37 @@ class Batch {
   void set_data_packing(Packing packing) {
     data_packing_ = packing;
   }
+  // Made of records already delivered, see DataParameter::echo_factor
+  bool echo() const {
+    return echo_;
+  }
+  void set_echo(bool echo) {
+    echo_ = echo;
+  }
+#ifndef CPU_ONLY
+  // Marks the end of asynchronous host to device copies issued to the stream so far.
+  // Transformer threads don't wait for them, the consumer does before using the batch.
+  void record_pushed(cudaStream_t stream) {
+    if (pushed_ == nullptr) {
+      CUDA_CHECK(cudaEventCreateWithFlags(&pushed_, cudaEventDisableTiming));
+    }
+    CUDA_CHECK(cudaEventRecord(pushed_, stream));
+  }
+  void wait_pushed() const {
+    if (pushed_ != nullptr) {
+      CUDA_CHECK(cudaEventSynchronize(pushed_));
+    }
+  }
+#endif
 
   DISABLE_COPY_MOVE_AND_ASSIGN(Batch);
  private:
   size_t id_;
   Packing data_packing_;
+  bool echo_;
+#ifndef CPU_ONLY
+  cudaEvent_t pushed_;
+#endif
 };
 
 template<typename Ftype, typename Btype>
@@ -112,9 +150,17 @@ class BasePrefetchingDataLayer : public BaseDataLayer<Ftype, Btype>, public Inte
     return use_gpu && Caffe::mode() == Caffe::GPU && !use_rand_resize;
   }
 
+  uint64_t prefetch_wait_us() const override {
+    return total_wait_us_;
+  }
+  bool data_pipe_stats(DataPipeStats* stats) const override;
+
  protected:
   void InternalThreadEntry() override;
   void InternalThreadEntryN(size_t thread_id) override;
+  std::string thread_name() const override {
+    return this->name();
+  }
   void AllocatePrefetch();
 
   virtual void ResizeQueues();
@@ -127,6 +173,13 @@ class BasePrefetchingDataLayer : public BaseDataLayer<Ftype, Btype>, public Inte
   virtual bool auto_mode() const {
     return auto_mode_;
   }
+  // Runtime tuning of thread counts, see DataParameter::auto_tune.
+  // Called by the solver thread between two batches.
+  virtual void tune_threads() {}
+  // Pops the next prefetched batch accounting the time spent waiting for it
+  shared_ptr<Batch> pop_batch();
+  // Pops a free batch for a transformer thread, profiled as blocked
+  shared_ptr<Batch> pop_free(size_t qid);
 
   size_t batch_id(int thread_id) {
     size_t id = batch_ids_[thread_id];
@@ -145,19 +198,32 @@ class BasePrefetchingDataLayer : public BaseDataLayer<Ftype, Btype>, public Inte
   static size_t threads(const LayerParameter& param);
   static size_t parser_threads(const LayerParameter& param);
   static bool auto_mode(const LayerParameter& param);
+  static Type label_type(const LayerParameter& param);
 
   std::vector<size_t> batch_ids_;
   std::vector<shared_ptr<Batch>> prefetch_;
   const bool auto_mode_;
+  // INT or Ftype, see DataParameter::label_type
+  const Type label_type_;
   size_t parsers_num_, transf_num_, queues_num_;
   std::vector<shared_ptr<BlockingQueue<shared_ptr<Batch>>>> prefetches_full_;
   std::vector<shared_ptr<BlockingQueue<shared_ptr<Batch>>>> prefetches_free_;
   size_t next_batch_queue_;
+  // Tuning statistics: transformers' busy time, net's waiting time and batches consumed
+  std::atomic<uint64_t> transf_busy_us_;
+  uint64_t wait_us_;
+  size_t batches_popped_, echoes_popped_;
+  // Waiting time never reset by tuning, read by solver metrics
+  std::atomic<uint64_t> total_wait_us_;
+  // Never reset either, see data_pipe_stats
+  std::atomic<uint64_t> total_transf_us_, batches_loaded_, samples_loaded_;
   // These two are for delayed init only
   std::vector<Blob*> bottom_init_;
   std::vector<Blob*> top_init_;
 
   vector<shared_ptr<DataTransformer>> data_transformers_;
+  // DataTransformer::set_sample_seed of all transformers
+  uint64_t sample_seed_;
 };
 
 }  // namespace caffe
@@ -36,9 +36,29 @@ namespace caffe {
  * This produces a channel-specific value that can be added or multiplied by
  * the BatchNorm layer's output.
  *
+ * With fused_relu a leaky ReLU follows, and the layer may run in place. Backward
+ * then inverts the activation and the scale and shift to get the normalized input
+ * back from the output as in [2], so neither it nor temporaries of the input's
+ * size are kept.
+ *
+ * With virtual_batch set the solver's iter_size micro-batches form one virtual batch.
+ * Every micro-batch is normalized with the statistics of the virtual batch so far,
+ * merged with those before it as in [3], so later micro-batches see nearly those of
+ * the whole batch. Global statistics are updated once per virtual batch.
+ *
+ * With sync_stats the statistics, and the means backward needs, are those of the
+ * batches of every solver, summed across GPUs. Forward sums the batch mean and mean
+ * square shifted by the global mean, which every solver has, so that they don't
+ * cancel out.
+ *
  * [1] S. Ioffe and C. Szegedy, "Batch Normalization: Accelerating Deep Network
  *     Training by Reducing Internal Covariate Shift." arXiv preprint
  *     arXiv:1502.03167 (2015).
+ * [2] S. Rota Bulo, L. Porzi and P. Kontschieder, "In-Place Activated BatchNorm
+ *     for Memory-Optimized Training of DNNs." arXiv preprint arXiv:1712.02616 (2017).
+ * [3] T. F. Chan, G. H. Golub and R. J. LeVeque, "Updating Formulae and a Pairwise
+ *     Algorithm for Computing Sample Variances." Technical Report STAN-CS-79-773,
+ *     Stanford University (1979).
  *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
  */
@@ -51,6 +71,11 @@ class BatchNormLayer : public Layer<Ftype, Btype> {
   virtual void Reshape(const vector<Blob*>& bottom, const vector<Blob*>& top);
 
   virtual inline const char* type() const { return "BatchNorm"; }
+  // Running statistics are only updated while training
+  virtual bool is_capturable() const { return this->phase_ == TEST; }
+  virtual bool reshape_invariant() const { return true; }
+  virtual void Cost(const vector<Blob*>& bottom, const vector<Blob*>& top,
+      LayerCost* cost) const;
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -65,6 +90,31 @@ class BatchNormLayer : public Layer<Ftype, Btype> {
     return tp<Ftype>();
   }
 
+  // BatchNormParameter::fused_relu
+  void ForwardFused_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  void BackwardFused_cpu(const vector<Blob*>& top, const vector<Blob*>& bottom);
+  void ForwardFused_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  void BackwardFused_gpu(const vector<Blob*>& top, const vector<Blob*>& bottom);
+  // Global statistics accumulate mean_ and var_
+  void UpdateGlobalStats_cpu();
+  void UpdateGlobalStats_gpu();
+  // Merges mean_ and var_ of M values into those of the virtual batch so far, puts the
+  // merged ones in mean_ and var_ and their shift from the old mean_ in temp_C_.
+  // True at the last micro-batch.
+  bool MergeVirtualBatch_cpu(int M);
+  bool MergeVirtualBatch_gpu(int M);
+  // BatchNormParameter::virtual_batch resolved, 1 if off
+  int micro_batches() const;
+  // BatchNormParameter::sync_stats: solvers to sum over, 1 if off
+  int sync_solvers() const;
+#ifndef CPU_ONLY
+  // Makes mean_ and var_ those over every solver, their shift from the old mean_ in
+  // temp_C_. Batches of every solver have the same size (P2PSync::divide_batch_size).
+  void SyncStats_gpu();
+  // Sums count values at x of every solver in place
+  void AllreduceStats_gpu(int count, void* x, Type type);
+#endif
+
   //  multicast x[c] into y[.,c,...]
   template <typename Dtype>
   void multicast_cpu(int N, int C, int S, const Dtype *x, Dtype *y ) {
@@ -126,8 +176,16 @@ class BatchNormLayer : public Layer<Ftype, Btype> {
 
   double moving_average_fraction_, eps_;
   int channels_, iter_;
-  bool use_global_stats_, clip_variance_, scale_bias_;
+  bool use_global_stats_, clip_variance_, scale_bias_, fused_relu_, sync_stats_;
+  float relu_slope_;
   shared_ptr<Blob> mean_, var_, inv_var_, x_norm_;
+  // Virtual batch: micro-batch to come, values seen so far and their statistics,
+  // share of the last micro-batch in them
+  int micro_batch_;
+  double seen_, batch_fraction_;
+  shared_ptr<Blob> vb_mean_, vb_var_;
+  // Sums of sync_stats: 2 per channel forward (data) and backward (diff)
+  shared_ptr<Blob> stats_;
   // auxiliary arrays used for sums and broadcast
   shared_ptr<Blob> ones_N_, ones_HW_, ones_C_, temp_C_, temp_NC_, temp_NCHW_;
 };
@@ -1,7 +1,6 @@
 #ifndef CAFFE_BATCHREINDEX_LAYER_HPP_
 #define CAFFE_BATCHREINDEX_LAYER_HPP_
 
-#include <utility>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -28,6 +27,8 @@ class BatchReindexLayer : public Layer<Ftype, Btype> {
   virtual inline const char* type() const { return "BatchReindex"; }
   virtual inline int ExactNumBottomBlobs() const { return 2; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  // Indices are read on device only
+  bool is_capturable() const override { return true; }
 
  protected:
   /**
@@ -68,13 +69,6 @@ class BatchReindexLayer : public Layer<Ftype, Btype> {
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
 
  private:
-  struct pair_sort_first {
-    bool operator()(const std::pair<int, int> &left,
-                    const std::pair<int, int> &right) {
-      return left.first < right.first;
-    }
-  };
-
   template<typename Dtype>
   void check_batch_reindex(int initial_num, int final_num,
                            const Dtype* ridx_data) {
@@ -85,6 +79,10 @@ class BatchReindexLayer : public Layer<Ftype, Btype> {
           << "Index specified for reindex layer was greater than batch size.";
     }
   }
+
+  // Backward_gpu: begins and counts of the top items of every bottom item, then the
+  // top items
+  TBlob<int> buckets_;
 };
 
 }  // namespace caffe
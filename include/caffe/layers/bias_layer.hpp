@@ -29,6 +29,8 @@ class BiasLayer : public Layer<Ftype, Btype> {
       const vector<Blob*>& top);
 
   virtual inline const char* type() const { return "Bias"; }
+  virtual bool is_capturable() const { return true; }
+  virtual bool reshape_invariant() const { return true; }
   virtual inline int MinBottomBlobs() const { return 1; }
   virtual inline int MaxBottomBlobs() const { return 2; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
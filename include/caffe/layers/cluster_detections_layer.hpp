@@ -0,0 +1,77 @@
+#ifndef CAFFE_CLUSTER_DETECTIONS_LAYER_HPP_
+#define CAFFE_CLUSTER_DETECTIONS_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Turns DetectNet's coverage and bbox grids into a list of boxes per class,
+ *        the native replacement of the ClusterDetections and ClusterGroundtruth
+ *        Python layers.
+ *
+ * Gridboxes whose coverage passes the threshold propose the box regressed at them,
+ * offset by the gridbox position. Proposals are clustered as OpenCV's
+ * groupRectangles does: connected components of proposals whose edges are within
+ * rect_eps times their size, averaged; clusters of rect_threshold proposals or fewer,
+ * lower than min_height or nested in a larger cluster are dropped. The confidence of
+ * a cluster is the log of its size. With groundtruth set every covered gridbox
+ * proposes and the distinct proposals are listed as they are.
+ *
+ * On the GPU a block clusters an image, all of them at once; only the lists leave
+ * the device. Boxes are listed in the order of their first gridbox, so CPU and GPU
+ * agree.
+ */
+template <typename Ftype, typename Btype>
+class ClusterDetectionsLayer : public Layer<Ftype, Btype> {
+ public:
+  /**
+   * @param param provides ClusterDetectionsParameter cluster_detections_param.
+   */
+  explicit ClusterDetectionsLayer(const LayerParameter& param)
+      : Layer<Ftype, Btype>(param) {}
+  virtual void LayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Reshape(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+  virtual inline const char* type() const { return "ClusterDetections"; }
+  virtual inline int ExactNumBottomBlobs() const { return 2; }
+  // A top per class
+  virtual inline int MinTopBlobs() const { return 1; }
+
+ protected:
+  /**
+   * @param bottom input Blob vector (length 2)
+   *   -# @f$ (N \times C \times H \times W) @f$
+   *      the coverage of each of the @f$ C @f$ classes
+   *   -# @f$ (N \times 4 \times H \times W) @f$
+   *      the boxes (xl, yt, xr, yb) relative to their gridbox
+   * @param top output Blob vector (length C)
+   *   -# @f$ (N \times max\_boxes \times 5) @f$
+   *      the boxes (xl, yt, xr, yb, confidence) of the class, zero padded
+   */
+  virtual void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Forward_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Backward_cpu(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+    for (int i = 0; i < propagate_down.size(); ++i) {
+      if (propagate_down[i]) { NOT_IMPLEMENTED; }
+    }
+  }
+
+  // Gridbox size in pixels and number of gridboxes covered by the bottoms
+  int cell_width_, cell_height_;
+  int grid_width_, grid_height_;
+  int max_boxes_;
+  /// Proposals (data) and clusters (diff) of each image (GPU).
+  TBlob<float> boxes_;
+  /// Cluster labels (data) and sizes (diff) of each image's proposals (GPU).
+  TBlob<int> labels_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_CLUSTER_DETECTIONS_LAYER_HPP_
@@ -17,13 +17,17 @@ template <typename Ftype, typename Btype>
 class ConcatLayer : public Layer<Ftype, Btype> {
  public:
   explicit ConcatLayer(const LayerParameter& param)
-      : Layer<Ftype, Btype>(param) {}
+      : Layer<Ftype, Btype>(param),
+        share_storage_(param.concat_param().share_storage()),
+        data_views_(false), diff_views_(false) {}
   virtual void LayerSetUp(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
   virtual void Reshape(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
 
   virtual inline const char* type() const { return "Concat"; }
+  virtual bool is_capturable() const { return !share_storage_; }
+  virtual bool reshape_invariant() const { return true; }
   virtual inline int MinBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -76,10 +80,19 @@ class ConcatLayer : public Layer<Ftype, Btype> {
   virtual void Backward_gpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
 
+  // ConcatParameter::share_storage: whether bottoms are regions of the top already
+  // (their producers wrote it), else they're made so after copying. Data, then diff.
+  bool ForwardViews(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  bool BackwardViews(const vector<Blob*>& top, const vector<bool>& propagate_down,
+      const vector<Blob*>& bottom);
+  void BindViews(const vector<Blob*>& bottom, const vector<Blob*>& top, bool data);
+
   int count_;
   int num_concats_;
   int concat_input_size_;
   int concat_axis_;
+  const bool share_storage_;
+  bool data_views_, diff_views_;
 };
 
 }  // namespace caffe
@@ -90,10 +90,8 @@ class ContrastiveLossLayer : public LossLayer<Ftype, Btype> {
   virtual void Backward_gpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
 
-  TBlob<Ftype> diff_;  // cached for backward pass
-  TBlob<Ftype> dist_sq_;  // cached for backward pass
-  TBlob<Ftype> diff_sq_;  // tmp storage for gpu forward pass
-  TBlob<Ftype> summer_vec_;  // tmp storage for gpu forward pass
+  TBlob<Ftype> diff_;  // cached for cpu backward pass
+  TBlob<float> dist_sq_;  // cached for backward pass
 };
 
 }  // namespace caffe
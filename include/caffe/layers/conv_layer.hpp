@@ -65,6 +65,7 @@ class ConvolutionLayer : public BaseConvolutionLayer<Ftype, Btype> {
       : BaseConvolutionLayer<Ftype, Btype>(param) {}
 
   virtual inline const char* type() const { return "Convolution"; }
+  virtual bool is_capturable() const { return true; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob*>& bottom,
@@ -0,0 +1,62 @@
+#ifndef CAFFE_CPU_CONV_LAYER_HPP_
+#define CAFFE_CPU_CONV_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/conv_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Convolution with CPU kernels that don't expand images into col_buffer_
+ *        (engine: CPU).
+ *
+ *  - Winograd F(m x m, 3 x 3), m = 2 or 4 (see ConvolutionParameter::winograd_tile),
+ *    for ungrouped stride 1 3x3 convolutions: images and filters are transformed into
+ *    (m + 2)^2 matrices, multiplied by as many GEMMs and transformed back.
+ *  - A direct kernel for depthwise convolutions (one input channel per group and
+ *    output), which im2col turns into a GEMM per channel.
+ *
+ * Other convolutions, float16, INT8, backward and GPU mode are ConvolutionLayer's.
+ */
+template <typename Ftype, typename Btype>
+class CPUConvolutionLayer : public ConvolutionLayer<Ftype, Btype> {
+ public:
+  enum Algo { IM2COL, WINOGRAD, DEPTHWISE };
+
+  explicit CPUConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Ftype, Btype>(param), algo_(IM2COL), tile_(0) {}
+  virtual void Reshape(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+  Algo algo() const {
+    return algo_;
+  }
+  /// @brief m of F(m x m, 3 x 3) if algo() is WINOGRAD.
+  int winograd_tile() const {
+    return tile_;
+  }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+  // U = G g G^T of every filter g, from the current weights
+  void TransformWeights();
+  void ForwardWinograd(const Ftype* input, Ftype* output, const Ftype* bias);
+  void ForwardDepthwise(const Ftype* input, Ftype* output, const Ftype* bias);
+
+  Algo algo_;
+  int tile_;
+  int tiles_h_, tiles_w_;
+  // Transform matrices of F(tile_ x tile_, 3 x 3): B^T, B, G, G^T, A^T and A
+  vector<Ftype> bt_, b_, g_, gt_, at_, a_;
+  // (tile_ + 2)^2 matrices: filters (K x C), image (C x tiles) and their products
+  TBlob<Ftype> u_, v_, m_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_CPU_CONV_LAYER_HPP_
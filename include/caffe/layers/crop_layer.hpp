@@ -54,24 +54,6 @@ class CropLayer : public Layer<Ftype, Btype> {
                const Dtype* src_data,
                Dtype* dest_data,
                bool is_forward);
-
-  // Recursive copy function: this is similar to crop_copy() but loops over all
-  // but the last two dimensions to allow for ND cropping while still relying on
-  // a CUDA kernel for the innermost two dimensions for performance reasons.  An
-  // alterantive implementation could rely on the kernel more by passing
-  // offsets, but this is problematic because of its variable length.
-  // Since in the standard (N,C,W,H) case N,C are usually not cropped a speedup
-  // could be achieved by not looping the application of the copy_kernel around
-  // these dimensions.
-  template <typename Dtype>
-  void crop_copy_gpu(const vector<Blob*>& bottom,
-                const vector<Blob*>& top,
-                const vector<int>& offsets,
-                vector<int> indices,
-                int cur_dim,
-                const Dtype* src_data,
-                Dtype* dest_data,
-                bool is_forward);
 };
 }  // namespace caffe
 
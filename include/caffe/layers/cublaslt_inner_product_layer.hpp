@@ -0,0 +1,77 @@
+#ifndef CAFFE_CUBLASLT_INNER_PRODUCT_LAYER_HPP_
+#define CAFFE_CUBLASLT_INNER_PRODUCT_LAYER_HPP_
+
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layers/inner_product_layer.hpp"
+
+#if !defined(CPU_ONLY) && CUDA_VERSION >= 11000
+  #define CAFFE_CUBLASLT
+  #include <cublasLt.h>
+#endif
+
+namespace caffe {
+
+#ifdef CAFFE_CUBLASLT
+/**
+ * @brief cuBLASLt implementation of InnerProductLayer (engine CUBLASLT).
+ *        Fallback to InnerProductLayer for CPU mode.
+ *
+ * The forward matmul adds the bias and applies the activation in its epilogue (GELU
+ * keeps its input in the auxiliary output). When the gradients are overwritten the
+ * weight gradient matmul reduces the bias gradient in its epilogue too. FLOAT16 runs
+ * on tensor ops accumulating in FLOAT. Descriptors and the heuristic's algorithm are
+ * kept per pass, batch size and epilogue; matmuls cuBLASLt has no algorithm for take
+ * the InnerProductLayer path.
+ */
+template <typename Ftype, typename Btype>
+class CuBLASLtInnerProductLayer : public InnerProductLayer<Ftype, Btype> {
+  // Workspace the heuristic may pick algorithms for
+  static constexpr size_t WORKSPACE_SIZE = 4 * 1024 * 1024;
+
+ public:
+  explicit CuBLASLtInnerProductLayer(const LayerParameter& param)
+      : InnerProductLayer<Ftype, Btype>(param) {}
+  virtual ~CuBLASLtInnerProductLayer();
+
+  // Once the first passes made their plans and reserved the workspace
+  virtual bool is_capturable() const { return !plans_.empty(); }
+  virtual size_t workspace_bytes() const { return WORKSPACE_SIZE; }
+
+ protected:
+  virtual void Forward_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Backward_gpu(const vector<Blob*>& top, const vector<bool>& propagate_down,
+      const vector<Blob*>& bottom);
+
+ private:
+  enum Pass { FORWARD, WEIGHT_GRADIENT };
+
+  // D = op(A) op(B), all column major
+  struct Plan {
+    cublasLtMatmulDesc_t desc;
+    cublasLtMatrixLayout_t a, b, d;
+    cublasLtMatmulAlgo_t algo;
+    size_t workspace;
+    bool supported;
+  };
+
+  // Matmul of the pass at batch size M_ with the epilogue, built on first use
+  template <typename Dtype>
+  const Plan& GetPlan(Pass pass, cublasLtEpilogue_t epilogue);
+  // Runs it with the epilogue's bias (or bias gradient) and auxiliary pointers
+  template <typename Dtype>
+  void Matmul(const Plan& plan, const Dtype* a, const Dtype* b, Dtype* d, float beta,
+      const void* bias, void* aux);
+  cublasLtEpilogue_t ForwardEpilogue() const;
+
+  std::map<std::tuple<int, int, int>, Plan> plans_;  // by pass, M and epilogue
+};
+#endif
+
+}  // namespace caffe
+
+#endif  // CAFFE_CUBLASLT_INNER_PRODUCT_LAYER_HPP_
@@ -1,6 +1,8 @@
 #ifndef CAFFE_CUDNN_CONV_LAYER_HPP_
 #define CAFFE_CUDNN_CONV_LAYER_HPP_
 
+#include <functional>
+#include <string>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -14,6 +16,9 @@
 
 #endif
 
+#include "caffe/util/cudnn_workspace_arbiter.hpp"
+#include "caffe/util/grouped_conv.hpp"
+
 namespace caffe {
 
 #ifdef USE_CUDNN
@@ -54,14 +59,20 @@ class CuDNNConvolutionLayer : public ConvolutionLayer<Ftype, Btype> {
   static ThreadSafeMap<std::unordered_map<int, size_t>> test_mem_req_all_grps_;
   static ThreadSafeMap<std::unordered_map<int, size_t>> train_tmp_weights_mem_;
   static ThreadSafeMap<std::unordered_map<int, bool>> ws_released_;
+  // Workspace arbitration: requirements of layers not taking part and the solution's
+  static ThreadSafeMap<std::unordered_map<int, size_t>> train_fixed_mem_req_;
+  static ThreadSafeMap<std::unordered_map<int, size_t>> arbitrated_mem_req_;
 
  public:
   explicit CuDNNConvolutionLayer(const LayerParameter& param)
       : ConvolutionLayer<Ftype, Btype>(param), handles_setup_(false),
         use_algo_seeker_(true), use_reshape_(true), initialized_cached_descs_(false),
-        fwd_count_(0UL), bwd_count_(0UL),
+        arbitrate_(false), submitted_(false), fwd_count_(0UL), bwd_count_(0UL),
         forward_math_(tpmax<Ftype, float>()), backward_data_math_(tpmax<Btype, float>()),
-        backward_filter_math_(tpmax<Btype, float>()) {
+        backward_filter_math_(tpmax<Btype, float>()), fwd_path_(CUDNN_PATH),
+        bwd_data_path_(CUDNN_PATH), bwd_filter_path_(CUDNN_PATH), fwd_path_tuned_(false),
+        bwd_path_tuned_(false), grouped_shape_(), packing_(NCHW), padded_channels_(0),
+        padded_outputs_(0), padding_reported_(false), retune_shapes_(false) {
 #if CUDNN_VERSION_MIN(7, 0, 0)
     cudnn_math_override_ = -1;
 #endif
@@ -70,6 +81,31 @@ class CuDNNConvolutionLayer : public ConvolutionLayer<Ftype, Btype> {
   virtual void LayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top);
   virtual void Reshape(const vector<Blob*>& bottom, const vector<Blob*>& top);
   virtual ~CuDNNConvolutionLayer();
+  // Once algorithms are settled, and with all groups on one stream
+  virtual bool is_capturable() const {
+    if (padded_) {
+      return padded_->is_capturable();
+    }
+    return !use_algo_seeker_ && fwd_count_ > 2UL && !grouped_tuning() &&
+        (ws_groups() == 1 || (fwd_path_ != CUDNN_PATH && bwd_data_path_ != CUDNN_PATH &&
+        bwd_filter_path_ != CUDNN_PATH));
+  }
+  // Backward_cpu is ConvolutionLayer's
+  virtual bool can_overwrite_param_diffs() const {
+    return Caffe::mode() == Caffe::GPU;
+  }
+  // Reshape seeks algorithms and releases workspace over the first iterations, it
+  // keeps its own descriptor and algorithm caches
+  virtual bool reshape_invariant() const { return false; }
+  // Largest algorithm workspace of all groups and passes, plus grouped gemm columns
+  virtual size_t workspace_bytes() const;
+  // Algorithms are sought again (or restored from the cache) on the next shape change
+  virtual void retune_for_shapes() {
+    if (padded_) {
+      padded_->retune_for_shapes();
+    }
+    retune_shapes_ = true;
+  }
 
  protected:
   virtual void Forward_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
@@ -106,6 +142,8 @@ class CuDNNConvolutionLayer : public ConvolutionLayer<Ftype, Btype> {
 
   bool use_reshape_;
   bool initialized_cached_descs_;
+  // See ConvolutionParameter::cudnn_workspace_arbitration
+  bool arbitrate_, submitted_;
   size_t fwd_count_, bwd_count_;
 
   vector<int> user_algos_override_;
@@ -124,6 +162,18 @@ class CuDNNConvolutionLayer : public ConvolutionLayer<Ftype, Btype> {
 
   void AllocateFindExWorkspace();
   size_t AllocateWorkspace(size_t bottom_size);
+  // Sets algorithms picked by CuDNNWorkspaceArbiter, slot 3*i+{0,1,2} is bottom i's
+  // forward, backward data and backward filter
+  void ApplyArbitration(const vector<Blob*>& bottom);
+
+  // Persistent algorithm cache, see ConvolutionParameter::cudnn_algo_cache_file
+  std::string AlgoCacheKey(const vector<Blob*>& bottom, int i, const std::string& seeker,
+      size_t workspace_limit);
+  bool RestoreConvAlgosFromCache(const vector<Blob*>& bottom, const std::string& seeker,
+      size_t workspace_limit);
+  void StoreConvAlgosToCache(const vector<Blob*>& bottom, const std::string& seeker,
+      size_t workspace_limit);
+  std::string algo_cache_file_;
 
   vector<cudnnTensorDescriptor_t> fwd_cached_bottom_descs_, bwd_cached_bottom_descs_;
   vector<cudnnConvolutionDescriptor_t> fwd_cached_conv_descs_,
@@ -150,7 +200,7 @@ class CuDNNConvolutionLayer : public ConvolutionLayer<Ftype, Btype> {
     return this->group_;
   }
 
-  int ws_groups() {
+  int ws_groups() const {
     return use_v7grouping() ? 1 : std::min(this->group_, MAX_PARALLEL_GROUPS);
   }
 
@@ -160,8 +210,69 @@ class CuDNNConvolutionLayer : public ConvolutionLayer<Ftype, Btype> {
 
   Type forward_math_, backward_data_math_, backward_filter_math_;
   vector<bool> propagate_down_;
+
+  // Grouped convolutions, see ConvolutionParameter::grouped_algo
+  enum GroupedPath { CUDNN_PATH, DIRECT_PATH, GEMM_PATH };
+  GroupedPath fwd_path_, bwd_data_path_, bwd_filter_path_;
+  bool fwd_path_tuned_, bwd_path_tuned_;
+  GroupedConvShape grouped_shape_;
+  // One image's columns for GEMM_PATH
+  GPUMemory::Workspace col_space_;
+  // Direct and gemm paths' weight gradient while they're timed
+  TBlob<Btype> filter_scratch_;
+
+  // Memory order of the bottoms and tops, the grouped kernels are NCHW only
+  Packing packing_;
+
+  bool direct_ok() const {
+    return this->group_ > 1 && this->channels_ / this->group_ <= GROUPED_CONV_DIRECT_MAX_CHANNELS
+        && packing_ == NCHW;
+  }
+  bool gemm_ok() const {
+    return this->group_ > 1 && !use_v7grouping() && packing_ == NCHW;
+  }
+  bool grouped_tuning() const {
+    return this->layer_param_.convolution_param().grouped_algo() ==
+        ConvolutionParameter_GroupedAlgo_GROUPED_AUTO && (direct_ok() || gemm_ok()) &&
+        (!fwd_path_tuned_ || (this->phase_ == TRAIN && !bwd_path_tuned_));
+  }
+  vector<GroupedPath> grouped_candidates() const;
+  void* col_space(bool reserve);
+  // Runs every candidate and returns the fastest, run() ends synchronized
+  GroupedPath FastestPath(const char* pass, const std::function<void(GroupedPath)>& run);
+
+  void ForwardPath(GroupedPath path, const vector<Blob*>& bottom, const vector<Blob*>& top);
+  void BackwardBias(const vector<Blob*>& top);
+  // Adds the gradients to weight_diff, or writes them if overwrite
+  void BackwardFilterPath(GroupedPath path, const vector<Blob*>& top,
+      const vector<Blob*>& bottom, Btype* weight_diff, bool overwrite);
+  void BackwardDataPath(GroupedPath path, const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+
+  // ConvolutionParameter::pad_channels: the layer padded_ runs on copies of the bottom,
+  // top and blobs with channels and outputs rounded up
+  shared_ptr<CuDNNConvolutionLayer<Ftype, Btype>> padded_;
+  shared_ptr<Blob> padded_bottom_, padded_top_;
+  vector<Blob*> padded_bottom_vec_, padded_top_vec_;
+  int padded_channels_, padded_outputs_;
+  bool padding_reported_;
+  // See retune_for_shapes
+  bool retune_shapes_;
+  bool SetUpPadded(const vector<Blob*>& bottom);
+  void ReshapePadded(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  void ForwardPadded(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  void BackwardPadded(const vector<Blob*>& top, const vector<bool>& propagate_down,
+      const vector<Blob*>& bottom);
+  // Logs best forward times of the original and padded geometry found by cuDNN
+  void ReportPadding(const vector<Blob*>& bottom);
 };
 
+// Copies an N x C x S tensor into one with dst_n x dst_c channels, zeros beyond the
+// source, or adds it to one if accumulate. Strips padding when dst is the smaller.
+template <typename Dtype>
+void resize_channels_gpu(int src_n, int src_c, int dst_n, int dst_c, int spatial,
+    Packing packing, const Dtype* src, Dtype* dst, bool accumulate = false);
+
 template<typename Ftype, typename Btype>
 constexpr size_t CuDNNConvolutionLayer<Ftype, Btype>::PAGE_SIZE;
 template<typename Ftype, typename Btype>
@@ -193,6 +304,14 @@ template<typename Ftype, typename Btype>
 ThreadSafeMap<std::unordered_map<int, size_t>>
 CuDNNConvolutionLayer<Ftype, Btype>::train_tmp_weights_mem_(
     CuDNNConvolutionLayer<Ftype, Btype>::m_);
+template<typename Ftype, typename Btype>
+ThreadSafeMap<std::unordered_map<int, size_t>>
+CuDNNConvolutionLayer<Ftype, Btype>::train_fixed_mem_req_(
+    CuDNNConvolutionLayer<Ftype, Btype>::m_);
+template<typename Ftype, typename Btype>
+ThreadSafeMap<std::unordered_map<int, size_t>>
+CuDNNConvolutionLayer<Ftype, Btype>::arbitrated_mem_req_(
+    CuDNNConvolutionLayer<Ftype, Btype>::m_);
 
 #endif
 
@@ -0,0 +1,68 @@
+#ifndef CAFFE_CUDNN_DECONV_LAYER_HPP_
+#define CAFFE_CUDNN_DECONV_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+
+#include "caffe/layers/cudnn_conv_layer.hpp"
+#include "caffe/layers/deconv_layer.hpp"
+
+namespace caffe {
+
+#ifdef USE_CUDNN
+/*
+ * @brief cuDNN implementation of DeconvolutionLayer.
+ *        Fallback to DeconvolutionLayer for CPU mode.
+ *
+ * Deconvolution is convolution with the passes swapped: the forward pass is the
+ * backward-data pass of the convolution taking the deconvolution's top to its bottom,
+ * with the very same filters. That convolution is a CuDNNConvolutionLayer, transposed_,
+ * so algorithm seeking, workspace arbitration and the persistent algorithm cache are
+ * shared with convolutions. It runs on proxy blobs pointed at our buffers:
+ *
+ *   Forward:  bottom data -> its top diff,  its bottom diff -> top data
+ *   Backward: top diff -> its bottom data,  its top data -> bottom diff (its Forward)
+ *             top diff, bottom data -> filter gradient (its Backward)
+ *
+ * Forward and backward types have to match, the transposed layer computes our forward
+ * pass in its backward type.
+ */
+template<typename Ftype, typename Btype>
+class CuDNNDeconvolutionLayer : public DeconvolutionLayer<Ftype, Btype> {
+ public:
+  explicit CuDNNDeconvolutionLayer(const LayerParameter& param)
+      : DeconvolutionLayer<Ftype, Btype>(param) {}
+
+  virtual void LayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Reshape(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual bool is_capturable() const {
+    return transposed_->is_capturable();
+  }
+  virtual bool can_overwrite_param_diffs() const {
+    return Caffe::mode() == Caffe::GPU;
+  }
+  // The transposed layer seeks algorithms in its Reshape
+  virtual bool reshape_invariant() const { return false; }
+  virtual size_t workspace_bytes() const {
+    return transposed_->workspace_bytes();
+  }
+
+ protected:
+  virtual void Forward_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Backward_gpu(const vector<Blob*>& top, const vector<bool>& propagate_down,
+      const vector<Blob*>& bottom);
+
+  shared_ptr<CuDNNConvolutionLayer<Ftype, Btype>> transposed_;
+  // Its bottoms are shaped like our tops, its tops like our bottoms
+  vector<shared_ptr<Blob>> proxy_bottoms_, proxy_tops_;
+  vector<Blob*> proxy_bottom_vec_, proxy_top_vec_;
+  // Output of its Forward for bottoms not propagating down
+  TBlob<Btype> scratch_;
+};
+#endif
+
+}  // namespace caffe
+
+#endif  // CAFFE_CUDNN_DECONV_LAYER_HPP_
@@ -0,0 +1,88 @@
+#ifndef CAFFE_CUDNN_RNN_LAYER_HPP_
+#define CAFFE_CUDNN_RNN_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/cudnn.hpp"
+#include "caffe/util/gpu_memory.hpp"
+
+namespace caffe {
+
+#ifdef USE_CUDNN
+/**
+ * @brief Multi-layer LSTM, GRU or plain RNN over a whole sequence in one cuDNN call,
+ *        see RNNParameter.
+ *
+ * All weights and biases are in one flat blob laid out by cuDNN. Forward math is
+ * LayerParameter::forward_math, backward reuses it since cuDNN computes gradients
+ * from the forward reserve space, so Ftype and Btype must match. GPU only.
+ */
+template <typename Ftype, typename Btype>
+class CuDNNRNNLayer : public Layer<Ftype, Btype> {
+ public:
+  explicit CuDNNRNNLayer(const LayerParameter& param)
+      : Layer<Ftype, Btype>(param), handles_setup_(false), rnn_desc_(nullptr),
+        dropout_desc_(nullptr), w_desc_(nullptr), dw_desc_(nullptr), hx_desc_(nullptr),
+        cx_desc_(nullptr), plan_(nullptr), seq_length_(0), batch_(0),
+        workspace_size_(0), reserve_size_(0), states_size_(0) {}
+  virtual ~CuDNNRNNLayer();
+
+  virtual void LayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Reshape(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+  virtual inline const char* type() const { return "RNN"; }
+  virtual inline int MinBottomBlobs() const { return 1; }
+  virtual inline int MaxBottomBlobs() const { return 3; }
+  virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline int MaxTopBlobs() const { return 3; }
+  virtual size_t workspace_bytes() const { return workspace_size_; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top) {
+    LOG(FATAL) << "RNN layer " << this->name() << " runs on the GPU only";
+  }
+  virtual void Backward_cpu(const vector<Blob*>& top, const vector<bool>& propagate_down,
+      const vector<Blob*>& bottom) {
+    LOG(FATAL) << "RNN layer " << this->name() << " runs on the GPU only";
+  }
+  virtual void Forward_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Backward_gpu(const vector<Blob*>& top, const vector<bool>& propagate_down,
+      const vector<Blob*>& bottom);
+
+  // Sets rnn_desc_ up for algo_, with a persistent plan for batch_ if it's dynamic
+  void SetRNNDesc();
+  // Weights and biases are filled separately, cuDNN knows where the biases are
+  void FillWeights();
+  // Forward, falling back to the standard algo if cuDNN can't persist these sizes
+  void ForwardCall(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+  bool handles_setup_;
+  cudnnRNNDescriptor_t rnn_desc_;
+  cudnnDropoutDescriptor_t dropout_desc_;
+  cudnnFilterDescriptor_t w_desc_, dw_desc_;
+  // One per time step, cuDNN wants arrays
+  vector<cudnnTensorDescriptor_t> x_descs_, y_descs_;
+  // hx, cx, hy and cy (and their diffs) share the shape
+  cudnnTensorDescriptor_t hx_desc_, cx_desc_;
+  cudnnPersistentRNNPlan_t plan_;
+
+  cudnnRNNMode_t mode_;
+  cudnnDirectionMode_t direction_;
+  cudnnRNNAlgo_t algo_;
+  cudnnDataType_t data_type_, math_type_;
+  bool algo_by_user_;
+  int input_size_, hidden_size_, num_layers_, directions_;
+  int seq_length_, batch_;
+  size_t workspace_size_, reserve_size_, states_size_;
+  GPUMemory::Workspace reserve_space_, states_;
+  // dx when the bottom doesn't need it, cuDNN computes it anyway
+  TBlob<Btype> dx_scratch_;
+};
+#endif  // USE_CUDNN
+
+}  // namespace caffe
+
+#endif  // CAFFE_CUDNN_RNN_LAYER_HPP_
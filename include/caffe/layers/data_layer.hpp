@@ -4,6 +4,8 @@
 #include <map>
 #include <vector>
 #include <atomic>
+#include <chrono>
+#include <deque>
 
 #include "caffe/blob.hpp"
 #include "caffe/data_reader.hpp"
@@ -13,6 +15,7 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/nvjpeg_decoder.hpp"
 #include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
@@ -42,22 +45,63 @@ class DataLayer : public BasePrefetchingDataLayer<Ftype, Btype> {
   Flag* layer_inititialized_flag() override {
     return this->phase_ == TRAIN ? &layer_inititialized_flag_ : nullptr;
   }
+  bool data_pipe_stats(DataPipeStats* stats) const override;
+  // Random resize is done on the GPU too, see DataTransformer::gpu_augment_enabled
+  bool is_gpu_transform() const override {
+    return this->transform_param_.use_gpu_transform() && Caffe::mode() == Caffe::GPU;
+  }
+  // Train nets only. Threads restart with the reader at the first record not consumed yet,
+  // prefetched batches of the old shapes are dropped. Deferred till the layer is initialized.
+  bool set_input_shape(int batch_size, int crop_size) override;
 
  protected:
   void ResizeQueues() override;
   void InitializePrefetch() override;
   void load_batch(Batch* batch, int thread_id, size_t queue_id = 0UL) override;
+  // DataParameter::bucket_by_shape mode
+  void load_bucketed_batch(Batch* batch, int thread_id, size_t queue_id);
   size_t queue_id(size_t thread_id) const override;
+  // Accounts the time transformers wait for parsed datums
+  shared_ptr<Datum> pop_datum(DataReader* reader, size_t queue_id);
+  // Reshapes the batch labels for count records and returns their host memory, of
+  // label_type_, see DataParameter::label_type and max_labels
+  void* label_buffer(Batch* batch, int count) const;
+  // Labels of the datum to record item_id of the buffer
+  void set_labels(void* labels, size_t item_id, const Datum& datum) const;
 
   void init_offsets();
   void start_reading() override {
     reader_->start_reading();
   }
+  void tune_threads() override;
+  // Restarts parser and transformer threads with new counts, and batch_size samples per
+  // batch if > 0. The new reader begins with the first record not consumed by the net yet.
+  void retune(size_t parsers_num, size_t transf_num, int batch_size = 0);
+  // Adapts the data echoing factor, see DataParameter::echo_auto
+  void tune_echo();
+  // Copy of a datum kept for echoing, owning its content, decoded if asked to
+  shared_ptr<Datum> echo_copy(const shared_ptr<Datum>& datum, bool decode) const;
 
   shared_ptr<DataReader> sample_reader_, reader_;
 
 #ifndef CPU_ONLY
+  // Decodes the datum for GPU augmentation into augment_[thread_id], returns C x H x W of
+  // its output
+  vector<int> add_augmented(const Datum& datum, const char* content, size_t content_size,
+      int color_mode, int thread_id, size_t item_id);
+
   vector<shared_ptr<GPUMemory::Workspace>> tmp_holder_;
+  // Images of a batch of any sizes and their samples, see DataTransformer::AugmentGPU
+  struct AugmentBuffers {
+    vector<uint8_t> images;
+    vector<AugmentSample> samples;
+    GPUMemory::Workspace images_gpu, samples_gpu;
+  };
+  vector<shared_ptr<AugmentBuffers>> augment_;
+#ifdef USE_NVJPEG
+  // Created on first use by transformer threads
+  vector<shared_ptr<NvJpegDecoder>> nvjpeg_decoders_;
+#endif
 #endif
 
   // stored random numbers for this batch
@@ -68,6 +112,42 @@ class DataLayer : public BasePrefetchingDataLayer<Ftype, Btype> {
   mutable std::mutex mutex_setup_, mutex_prefetch_;
   const bool cache_, shuffle_;
   bool datum_encoded_;
+  // Shape buckets of every transformer thread
+  bool bucketing_;
+  vector<std::map<vector<int>, std::deque<shared_ptr<Datum>>>> buckets_;
+
+  // Runtime tuning, see DataParameter::auto_tune
+  bool tune_;
+  size_t tune_budget_;
+  size_t tune_mark_;  // batches popped when the current window began
+  std::chrono::steady_clock::time_point tune_start_;
+  uint64_t parser_busy_mark_;
+  size_t tune_hint_parsers_, tune_hint_transf_;  // multi-solver recommendation
+  // DB position of the current reader's first record and new (not echoed) batches
+  // popped before it began
+  size_t reader_start_, reader_batches_;
+  // DataParameter::node_reader: first reader queue of this solver
+  size_t queue_offset_;
+  std::atomic<uint64_t> datum_wait_us_;
+
+  // Data echoing, see DataParameter::echo_factor
+  unsigned echo_max_;
+  bool echo_auto_;
+  std::atomic<unsigned> echo_factor_;
+  // Records of the last new batch of every transformer thread, batches left to echo them
+  // and the echo being made, 0 for new batches (DataTransformer::set_sample pass)
+  vector<vector<shared_ptr<Datum>>> echo_datums_;
+  vector<unsigned> echo_left_, echo_pass_;
+  std::atomic<uint64_t> echoed_samples_;
+  size_t echo_mark_, echo_windows_;
+  std::chrono::steady_clock::time_point echo_start_;
+  uint64_t echo_wait_mark_, echo_busy_mark_, echo_samples_mark_, echoed_mark_;
+
+  // SolverParameter::input_shape_schedule: values of the layer parameter, crop of the
+  // batches transformed from now on and batch size the layer restarts with once initialized
+  const int param_batch_size_, param_crop_size_;
+  std::atomic<int> crop_size_;
+  int pending_batch_size_;
 };
 
 }  // namespace caffe
@@ -102,6 +102,8 @@ class DetectNetTransformationLayer : public Layer<Dtype, Dtype> {
   // Label transformations
   void transform_label_cpu(vector<BboxLabel>, Dtype*,
       const AugmentSelection&, const cv::Size&);
+  vector<BboxLabel> transform_bboxes_cpu(vector<BboxLabel>,
+      const AugmentSelection&, const cv::Size&);
   vector<BboxLabel> flip_label_cpu(const vector<BboxLabel>&,
       const cv::Size&);
   vector<BboxLabel> scale_label_cpu(const vector<BboxLabel>&,
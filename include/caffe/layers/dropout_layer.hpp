@@ -8,6 +8,7 @@
 #include "caffe/proto/caffe.pb.h"
 
 #include "caffe/layers/neuron_layer.hpp"
+#include "caffe/util/philox.hpp"
 
 namespace caffe {
 
@@ -30,15 +31,26 @@ class DropoutLayer : public NeuronLayer<Ftype, Btype> {
    *     with DropoutLayer options:
    *   - dropout_ratio (\b optional, default 0.5).
    *     Sets the probability @f$ p @f$ that any given unit is dropped.
+   *   - random_seed (\b optional, default -1).
+   *     If set, the masks of successive iterations are drawn under this seed.
+   *   - regenerate_mask (\b optional, default false).
+   *     If set, backward draws the mask again instead of keeping it.
+   *
+   * The mask is drawn with philox_uint, one number per element of a stream keyed by
+   * the seed and offset of the iteration, in the same kernel that applies it. It is kept
+   * as one bit per element.
    */
   explicit DropoutLayer(const LayerParameter& param)
-      : NeuronLayer<Ftype, Btype>(param) {}
+      : NeuronLayer<Ftype, Btype>(param), mask_seed_(0ULL), mask_offset_(0ULL),
+        forward_count_(0ULL) {}
   virtual void LayerSetUp(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
   virtual void Reshape(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
 
   virtual inline const char* type() const { return "Dropout"; }
+  // Masks are random while training
+  virtual bool is_capturable() const { return this->phase_ == TEST; }
 
  protected:
   /**
@@ -66,8 +78,31 @@ class DropoutLayer : public NeuronLayer<Ftype, Btype> {
   virtual void Backward_gpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
 
-  /// when divided by UINT_MAX, the randomly generated values @f$u\sim U(0,1)@f$
-  TBlob<unsigned int> rand_vec_;
+  /// Draws the key of this iteration's mask
+  void NextMask() {
+    const int64_t random_seed = this->layer_param_.dropout_param().random_seed();
+    if (random_seed >= 0) {
+      mask_seed_ = static_cast<uint64_t>(random_seed);
+      mask_offset_ = forward_count_++;
+    } else {
+      mask_seed_ = Caffe::next_seed();
+      mask_offset_ = 0ULL;
+    }
+  }
+  /// Whether element i is kept by the current mask
+  bool keep(int i) const {
+    return philox_uint(mask_seed_, mask_offset_, i) > uint_thres_;
+  }
+  /// Mask words of count elements
+  static int mask_words(int count) {
+    return (count + 31) / 32;
+  }
+
+  /// bit i % 32 of word i / 32 is set when element i is kept, empty if regenerate_mask_
+  TBlob<unsigned int> mask_;
+  bool regenerate_mask_;
+  uint64_t mask_seed_, mask_offset_;
+  uint64_t forward_count_;
   /// the probability @f$ p @f$ of dropping any input
   float threshold_;
   /// the scale for undropped inputs at train time @f$ 1 / (1 - p) @f$
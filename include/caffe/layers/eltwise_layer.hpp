@@ -26,6 +26,10 @@ class EltwiseLayer : public Layer<Ftype, Btype> {
       const vector<Blob*>& top);
 
   virtual inline const char* type() const { return "Eltwise"; }
+  virtual bool is_capturable() const { return true; }
+  virtual bool reshape_invariant() const { return true; }
+  virtual void Cost(const vector<Blob*>& bottom, const vector<Blob*>& top,
+      LayerCost* cost) const;
   virtual inline int MinBottomBlobs() const { return 2; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -29,6 +29,9 @@ class EmbedLayer : public Layer<Ftype, Btype> {
   virtual inline const char* type() const { return "Embed"; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  vector<int>* sparse_rows(int blob_id) override {
+    return sparse_gradient_ && blob_id == 0 ? &sparse_rows_ : nullptr;
+  }
 
  protected:
   virtual void Forward_cpu(const vector<Blob*>& bottom,
@@ -39,12 +42,17 @@ class EmbedLayer : public Layer<Ftype, Btype> {
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
   virtual void Backward_gpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+  // Merges the indices of bottom into sparse_rows_
+  void AddSparseRows(const Blob& bottom);
 
   int M_;
   int K_;
   int N_;
   bool bias_term_;
   TBlob<Ftype> bias_multiplier_;
+  // EmbedParameter::sparse_gradient
+  bool sparse_gradient_;
+  vector<int> sparse_rows_;
 };
 
 }  // namespace caffe
@@ -99,7 +99,7 @@ class EuclideanLossLayer : public LossLayer<Ftype, Btype> {
   virtual void Backward_gpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
 
-  TBlob<Ftype> diff_;  // Conversions if Ftype!=Btype
+  TBlob<Ftype> diff_;  // CPU only, the GPU kernels are fused
 };
 
 }  // namespace caffe
@@ -9,6 +9,11 @@
 
 namespace caffe {
 
+// Scan of the selector on device: indices gets the items passing in order, passed
+// their number
+template <typename Dtype>
+void filter_select_gpu(int num, const Dtype* selector, int* indices, int* passed);
+
 /**
  * @brief Takes two+ Blobs, interprets last Blob as a selector and
  *  filter remaining Blobs accordingly with selector data (0 means that
@@ -68,8 +73,15 @@ class FilterLayer : public Layer<Ftype, Btype> {
   virtual void Backward_gpu(const vector<Blob*>& top,
     const vector<bool>& propagate_down, const vector<Blob*>& bottom);
 
+  // Fills gpu_indices_ and passed_, returns the number of items passing
+  int SelectGPU(const Blob* selector);
+
   bool first_reshape_;
   vector<int> indices_to_forward_;
+  // GPU mode: bottom items passing the selector in order, found on device by Reshape
+  TBlob<int> gpu_indices_;
+  // Number of items passing, the only value Reshape reads back
+  TBlob<int> passed_;
 };
 
 }  // namespace caffe
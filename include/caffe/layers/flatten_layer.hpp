@@ -28,6 +28,7 @@ class FlattenLayer : public Layer<Ftype, Btype> {
       const vector<Blob*>& top);
 
   virtual inline const char* type() const { return "Flatten"; }
+  virtual bool is_capturable() const { return true; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -0,0 +1,50 @@
+#ifndef CAFFE_HALO_LAYER_HPP_
+#define CAFFE_HALO_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/gpu_memory.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Adds spatial_param.halo rows of the neighbouring stripes above and below this
+ *        solver's stripe of a 4D NCHW bottom, zeros past the edges of the sample, see
+ *        NetParameter::spatial_stripes. Backward sends the gradients of those rows back
+ *        to their stripes. Net::Init inserts these layers in front of windowed layers
+ *        reading stripes, their padding along axis 2 taken over by the halo. GPU mode
+ *        only.
+ */
+template <typename Ftype, typename Btype>
+class HaloLayer : public Layer<Ftype, Btype> {
+ public:
+  explicit HaloLayer(const LayerParameter& param)
+      : Layer<Ftype, Btype>(param), stripes_(1), halo_(0) {}
+  virtual void LayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Reshape(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+  virtual inline const char* type() const { return "Halo"; }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Forward_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Backward_cpu(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+  virtual void Backward_gpu(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+
+  int stripes_, halo_;
+#ifndef CPU_ONLY
+  // Rows sent up and down, then received from above and below, in this order
+  GPUMemory::Workspace buffers_;
+#endif
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_HALO_LAYER_HPP_
@@ -3,12 +3,15 @@
 
 #include "hdf5.h"
 
+#include <atomic>
 #include <string>
 #include <vector>
 
 #include "caffe/blob.hpp"
+#include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
 
 #include "caffe/layers/base_data_layer.hpp"
 
@@ -17,18 +20,22 @@ namespace caffe {
 /**
  * @brief Provides data to the Net from HDF5 files.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * A background thread reads the files listed in source chunk by chunk (hyperslabs of
+ * HDF5DataParameter::chunk_rows rows). It fills a bounded queue of chunks that Forward
+ * copies rows from. See HDF5DataParameter for shuffling and multi-GPU sharding.
  */
 template <typename Ftype, typename Btype>
-class HDF5DataLayer : public Layer<Ftype, Btype> {
+class HDF5DataLayer : public Layer<Ftype, Btype>, public InternalThread {
  public:
   explicit HDF5DataLayer(const LayerParameter& param)
-      : Layer<Ftype, Btype>(param) {}
+      : Layer<Ftype, Btype>(param),
+        InternalThread(Caffe::current_device(), this->solver_rank_, 1U, false),
+        total_wait_us_(0UL) {}
   virtual ~HDF5DataLayer();
   virtual void LayerSetUp(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
-  // Data layers should be shared by multiple solvers in parallel
-  virtual inline bool ShareInParallel() const { return true; }
+  // Every solver reads its own shard
+  virtual inline bool ShareInParallel() const { return false; }
   // Data layers have no bottoms, so reshaping is trivial.
   virtual void Reshape(const vector<Blob*>& bottom,
       const vector<Blob*>& top) {}
@@ -37,6 +44,10 @@ class HDF5DataLayer : public Layer<Ftype, Btype> {
   virtual inline int ExactNumBottomBlobs() const { return 0; }
   virtual inline int MinTopBlobs() const { return 1; }
 
+  uint64_t prefetch_wait_us() const override {
+    return total_wait_us_;
+  }
+
  protected:
   virtual void Forward_cpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
@@ -46,15 +57,33 @@ class HDF5DataLayer : public Layer<Ftype, Btype> {
       const vector<bool>& propagate_down, const vector<Blob*>& bottom) {}
   virtual void Backward_gpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom) {}
-  virtual void LoadHDF5FileData(const char* filename);
+
+  void InternalThreadEntry() override;
+  std::string thread_name() const override {
+    return this->name();
+  }
+  // Copies the next batch_size rows into the tops' host or device data
+  void FillTops(const vector<Blob*>& top, bool gpu);
+  // Copies row src_row of every top's blob in src to row dst_row of dst
+  void CopyRow(const vector<shared_ptr<TBlob<Ftype>>>& src, int src_row,
+      const vector<shared_ptr<TBlob<Ftype>>>& dst, int dst_row) const;
+  // Loader thread: adds a row to the chunk being filled, pushed when complete
+  void Emit(const vector<shared_ptr<TBlob<Ftype>>>& src, int row);
 
   std::vector<std::string> hdf_filenames_;
-  unsigned int num_files_;
-  unsigned int current_file_;
-  hsize_t current_row_;
-  std::vector<shared_ptr<TBlob<Ftype> > > hdf_blobs_;
-  std::vector<unsigned int> data_permutation_;
-  std::vector<unsigned int> file_permutation_;
+  // Per top, count of a row and shape of a row
+  std::vector<int> row_dims_;
+  std::vector<std::vector<hsize_t>> row_shapes_;
+  int chunk_rows_;
+  size_t shard_count_, shard_id_;
+  // Chunks of chunk_rows_ rows of every top, passed by id from the loader to Forward
+  std::vector<std::vector<shared_ptr<TBlob<Ftype>>>> chunks_;
+  shared_ptr<BlockingQueue<int>> free_chunks_, full_chunks_;
+  // Chunk and row Forward reads next, -1 if none popped
+  int current_chunk_, current_row_;
+  // Chunk the loader fills and its rows so far
+  int fill_chunk_, fill_row_;
+  std::atomic<uint64_t> total_wait_us_;
 };
 
 }  // namespace caffe
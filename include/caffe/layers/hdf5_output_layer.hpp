@@ -4,11 +4,13 @@
 #include "hdf5.h"
 
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
 
 namespace caffe {
 
@@ -18,13 +20,17 @@ namespace caffe {
 /**
  * @brief Write blobs to disk as HDF5 files.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * By default the bottoms of a forward are written synchronously as the "data" and
+ * "label" datasets. With HDF5OutputParameter::async every forward instead copies them
+ * to a free host buffer and returns, writer threads (one per output file) append the
+ * buffers as rows to chunked extensible datasets and hand them back.
  */
 template <typename Ftype, typename Btype>
 class HDF5OutputLayer : public Layer<Ftype, Btype> {
  public:
   explicit HDF5OutputLayer(const LayerParameter& param)
-      : Layer<Ftype, Btype>(param), file_opened_(false) {}
+      : Layer<Ftype, Btype>(param), file_opened_(false), batches_(0),
+        device_(-1) {}
   virtual ~HDF5OutputLayer();
   virtual void LayerSetUp(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
@@ -52,11 +58,33 @@ class HDF5OutputLayer : public Layer<Ftype, Btype> {
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
   virtual void SaveBlobs();
 
+  // Asynchronous mode
+  void SetUpAsync();
+  // Takes a free buffer and reshapes it like the bottoms
+  int AcquireBuffer(const vector<Blob*>& bottom);
+  // Queues the (being) filled buffer to the next file
+  void QueueBuffer(int buffer);
+  void WriteEntry(int file);
+  // file_name with _file before the extension when more than one
+  std::string async_file_name(int file) const;
+
   bool file_opened_;
   std::string file_name_;
   hid_t file_id_;
   TBlob<Ftype> data_blob_;
   TBlob<Ftype> label_blob_;
+
+  vector<shared_ptr<TBlob<Ftype>>> buffer_data_, buffer_label_;
+#ifndef CPU_ONLY
+  vector<cudaEvent_t> buffer_copied_;  // recorded after device to host copies
+  vector<int> buffer_on_device_;
+#endif
+  BlockingQueue<int> free_buffers_;
+  vector<shared_ptr<BlockingQueue<int>>> file_buffers_;  // -1 stops the writer
+  vector<hid_t> file_ids_;
+  vector<std::thread> writers_;
+  size_t batches_;
+  int device_;  // the writers' one, -1 in CPU mode
 };
 
 }  // namespace caffe
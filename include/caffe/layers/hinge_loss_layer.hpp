@@ -61,11 +61,14 @@ class HingeLossLayer : public LossLayer<Ftype, Btype> {
       : LossLayer<Ftype, Btype>(param) {}
 
   virtual inline const char* type() const { return "HingeLoss"; }
+  virtual bool is_capturable() const { return true; }
 
  protected:
   /// @copydoc HingeLossLayer
   virtual void Forward_cpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
+  virtual void Forward_gpu(const vector<Blob*>& bottom,
+      const vector<Blob*>& top);
 
   /**
    * @brief Computes the hinge loss error gradient w.r.t. the predictions.
@@ -96,6 +99,11 @@ class HingeLossLayer : public LossLayer<Ftype, Btype> {
    */
   virtual void Backward_cpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+  virtual void Backward_gpu(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+
+  /// GPU forward: the loss terms summed into top[0] on the device
+  TBlob<float> loss_terms_;
 };
 
 
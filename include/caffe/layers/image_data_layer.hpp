@@ -11,13 +11,16 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
 /**
  * @brief Provides data to the Net from image files.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * Images of a batch are read and decoded by up to read_threads TaskScheduler tasks at
+ * a time while the prefetch thread transforms those already read. See
+ * ImageDataParameter::cache_images for keeping them in memory.
  */
 template <typename Ftype, typename Btype>
 class ImageDataLayer : public BasePrefetchingDataLayer<Ftype, Btype> {
@@ -33,6 +36,8 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Ftype, Btype> {
 
  protected:
   void ShuffleImages();
+  // Called on reading threads, from the cache if enabled
+  cv::Mat ReadImage(const std::string& filename) const;
   void load_batch(Batch* batch, int thread_id, size_t queue_id = 0UL) override;
   void start_reading() override {}
   void InitializePrefetch() override;
@@ -47,6 +52,7 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Ftype, Btype> {
   shared_ptr<Caffe::RNG> prefetch_rng_;
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
+  unique_ptr<ThreadPool> read_pool_;
   Flag layer_inititialized_flag_;
 };
 
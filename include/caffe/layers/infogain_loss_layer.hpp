@@ -61,11 +61,14 @@ class InfogainLossLayer : public LossLayer<Ftype, Btype> {
   virtual inline int MaxBottomBlobs() const { return 3; }
 
   virtual inline const char* type() const { return "InfogainLoss"; }
+  virtual bool is_capturable() const { return true; }
 
  protected:
   /// @copydoc InfogainLossLayer
   virtual void Forward_cpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
+  virtual void Forward_gpu(const vector<Blob*>& bottom,
+      const vector<Blob*>& top);
 
   /**
    * @brief Computes the infogain loss error gradient w.r.t. the predictions.
@@ -101,6 +104,11 @@ class InfogainLossLayer : public LossLayer<Ftype, Btype> {
    */
   virtual void Backward_cpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+  virtual void Backward_gpu(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+
+  /// GPU forward: the loss terms summed into top[0] on the device
+  TBlob<float> loss_terms_;
 
   TBlob<Ftype> infogain_;
 };
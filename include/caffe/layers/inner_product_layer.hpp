@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/quantization.hpp"
 
 namespace caffe {
 
@@ -14,18 +15,28 @@ namespace caffe {
  *        with a set of learned weights, and (optionally) adds biases.
  *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
+ *
+ * With quantization_param set (TEST phase only) the product runs in INT8, see Int8Gemm.
+ * Weights are quantized on the first forward pass.
+ *
+ * InnerProductParameter::activation is applied to the output after the bias.
  */
 template <typename Ftype, typename Btype>
 class InnerProductLayer : public Layer<Ftype, Btype> {
  public:
   explicit InnerProductLayer(const LayerParameter& param)
-      : Layer<Ftype, Btype>(param) {}
+      : Layer<Ftype, Btype>(param), activation_(InnerProductParameter_Activation_NONE) {}
   virtual void LayerSetUp(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
   virtual void Reshape(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
 
   virtual inline const char* type() const { return "InnerProduct"; }
+  virtual bool is_capturable() const { return true; }
+  virtual bool reshape_invariant() const { return true; }
+  virtual bool can_overwrite_param_diffs() const { return true; }
+  virtual void Cost(const vector<Blob*>& bottom, const vector<Blob*>& top,
+      LayerCost* cost) const;
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -39,12 +50,24 @@ class InnerProductLayer : public Layer<Ftype, Btype> {
   virtual void Backward_gpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
 
+  // Applies activation_ to the product plus bias in place, keeping the GELU input
+  void ActivationForward_cpu(Ftype* top_data);
+  void ActivationForward_gpu(Ftype* top_data);
+  // dE/d(product plus bias): the top diff without activation
+  const Btype* ActivationBackward_cpu(Blob* top);
+  const Btype* ActivationBackward_gpu(Blob* top);
+
   int M_;
   int K_;
   int N_;
   bool bias_term_;
   shared_ptr<Blob> bias_multiplier_;
   bool transpose_;  ///< if true, assume transposed weights
+  bool quantized_;
+  Int8Gemm int8_gemm_;
+  InnerProductParameter_Activation activation_;
+  shared_ptr<Blob> pre_activation_;  // GELU input
+  shared_ptr<Blob> activation_diff_;
 };
 
 }  // namespace caffe
@@ -39,6 +39,7 @@ class L1LossLayer : public LossLayer<Ftype, Btype> {
   void Backward_gpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom) override;
 
+  // CPU only, the GPU kernels are fused
   TBlob<Ftype> diff_;
   TBlob<Ftype> sign_;
 };
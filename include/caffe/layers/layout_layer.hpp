@@ -0,0 +1,41 @@
+#ifndef CAFFE_LAYOUT_LAYER_HPP_
+#define CAFFE_LAYOUT_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Copies a 4D blob into the memory order given by layout_param.packing,
+ *        NCHW or NHWC, reading the bottom in the order it is tagged with (see
+ *        Blob::packing). Net::Init inserts these layers in front of layers reading
+ *        NHWC blobs they can't handle, see NetParameter::layout.
+ */
+template <typename Ftype, typename Btype>
+class LayoutLayer : public Layer<Ftype, Btype> {
+ public:
+  explicit LayoutLayer(const LayerParameter& param)
+      : Layer<Ftype, Btype>(param) {}
+  virtual void Reshape(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+  virtual inline const char* type() const { return "Layout"; }
+  virtual bool is_capturable() const { return true; }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Forward_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Backward_cpu(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+  virtual void Backward_gpu(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_LAYOUT_LAYER_HPP_
@@ -10,6 +10,28 @@
 namespace caffe {
 
 const float kLOG_THRESHOLD = 1e-20;
+// Blocks of the fused GPU loss kernels, each leaves one partial sum, see LossLayer
+const int kLOSS_BLOCKS = 256;
+
+/**
+ * @brief Host label values of a bottom: INT labels (see DataParameter::label_type)
+ *        are read as they are, others as Dtype.
+ */
+template <typename Dtype>
+class LabelReader {
+ public:
+  explicit LabelReader(const Blob& labels)
+      : ints_(labels.data_type() == INT ? labels.cpu_data<int>() : nullptr),
+        values_(ints_ == nullptr ? labels.cpu_data<Dtype>() : nullptr) {}
+
+  int operator[](int i) const {
+    return ints_ != nullptr ? ints_[i] : static_cast<int>(values_[i]);
+  }
+
+ private:
+  const int* ints_;
+  const Dtype* values_;
+};
 
 /**
  * @brief An interface for Layer%s that take two Blob%s as input -- usually
@@ -46,6 +68,26 @@ class LossLayer : public Layer<Ftype, Btype> {
   virtual inline bool AllowForceBackward(const int bottom_index) const {
     return bottom_index != 1;
   }
+
+ protected:
+#ifndef CPU_ONLY
+  // Device memory for the partial sums of a fused loss kernel of blocks blocks
+  float* loss_partials(int blocks) {
+    loss_partials_.Reshape(vector<int>(1, blocks));
+    return loss_partials_.mutable_gpu_data();
+  }
+#endif
+  // Their total, read back once the kernel is done
+  float loss_partials_sum() const {
+    const float* partials = loss_partials_.cpu_data();
+    float sum = 0.F;
+    for (int i = 0; i < loss_partials_.count(); ++i) {
+      sum += partials[i];
+    }
+    return sum;
+  }
+
+  TBlob<float> loss_partials_;
 };
 
 }  // namespace caffe
@@ -30,6 +30,17 @@ class LRNLayer : public Layer<Ftype, Btype> {
       const vector<Blob*>& top);
 
   virtual inline const char* type() const { return "LRN"; }
+  // WITHIN_CHANNEL runs internal layers
+  virtual bool is_capturable() const {
+    return this->layer_param_.lrn_param().norm_region() ==
+        LRNParameter_NormRegion_ACROSS_CHANNELS;
+  }
+  virtual bool reshape_invariant() const {
+    return this->layer_param_.lrn_param().norm_region() ==
+        LRNParameter_NormRegion_ACROSS_CHANNELS;
+  }
+  virtual void Cost(const vector<Blob*>& bottom, const vector<Blob*>& top,
+      LayerCost* cost) const;
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -0,0 +1,70 @@
+#ifndef CAFFE_MEAN_AP_LAYER_HPP_
+#define CAFFE_MEAN_AP_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Scores a class's detections against its ground truth boxes, the native
+ *        replacement of the ScoreDetections and mAP Python layers.
+ *
+ * Each ground truth box, in order, matches the first unmatched detection overlapping
+ * it by iou_threshold. Matched detections are true positives, the others false
+ * positives, and unmatched ground truth boxes are missed. Precision and recall (in
+ * percent) and their product (mAP, as DetectNet defines it) are over the batch.
+ * All-zero rows are padding. On the GPU a thread scores an image; only the three
+ * scalars leave the device.
+ */
+template <typename Ftype, typename Btype>
+class MeanAPLayer : public Layer<Ftype, Btype> {
+ public:
+  /**
+   * @param param provides MeanAPParameter mean_ap_param.
+   */
+  explicit MeanAPLayer(const LayerParameter& param)
+      : Layer<Ftype, Btype>(param) {}
+  virtual void Reshape(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+  virtual inline const char* type() const { return "MeanAP"; }
+  virtual inline int ExactNumBottomBlobs() const { return 2; }
+  virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline int MaxTopBlobs() const { return 3; }
+
+ protected:
+  /**
+   * @param bottom input Blob vector (length 2)
+   *   -# @f$ (N \times B \times 5) @f$
+   *      the ground truth boxes (xl, yt, xr, yb, -) of ClusterDetectionsLayer
+   *   -# @f$ (N \times B' \times 5) @f$
+   *      the detections (xl, yt, xr, yb, confidence) of ClusterDetectionsLayer
+   * @param top output Blob vector (length 1 to 3)
+   *   -# mAP, precision times recall over 100
+   *   -# precision
+   *   -# recall
+   */
+  virtual void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Forward_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Backward_cpu(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+    for (int i = 0; i < propagate_down.size(); ++i) {
+      if (propagate_down[i]) { NOT_IMPLEMENTED; }
+    }
+  }
+
+  void SetTops(int true_positives, int false_positives, int missed,
+      const vector<Blob*>& top);
+
+  /// Matched detections of each image (GPU).
+  TBlob<int> matched_;
+  /// True positives, false positives and missed boxes of each image (GPU).
+  TBlob<int> counts_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_MEAN_AP_LAYER_HPP_
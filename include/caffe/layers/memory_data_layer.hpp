@@ -20,9 +20,13 @@ template <typename Ftype, typename Btype>
 class MemoryDataLayer : public BaseDataLayer<Ftype, Btype> {
  public:
   explicit MemoryDataLayer(const LayerParameter& param)
-      : BaseDataLayer<Ftype, Btype>(param, 1), has_new_data_(false) {
+      : BaseDataLayer<Ftype, Btype>(param, 1), has_new_data_(false), gpu_input_(false) {
     dt_ = make_shared<DataTransformer>(this->transform_param_, this->phase_);
+#ifndef CPU_ONLY
+    ready_ = nullptr;
+#endif
   }
+  virtual ~MemoryDataLayer();
   virtual void DataLayerSetUp(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
 
@@ -37,6 +41,11 @@ class MemoryDataLayer : public BaseDataLayer<Ftype, Btype> {
   // Reset should accept const pointers, but can't, because the memory
   //  will be given to TBlob, which is mutable
   void Reset(Ftype* data, Ftype* label, int n);
+#ifndef CPU_ONLY
+  // Device memory variant of Reset: tops wrap the arrays given without copying them.
+  // The net waits for work already queued to the producer's stream before reading them.
+  void ResetGpu(Ftype* data, Ftype* label, int n, cudaStream_t stream);
+#endif
   void set_batch_size(int new_size);
 
   int batch_size() { return batch_size_; }
@@ -46,9 +55,7 @@ class MemoryDataLayer : public BaseDataLayer<Ftype, Btype> {
 
  protected:
   void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top) override;
-  void Forward_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top) override {
-    Forward_cpu(bottom, top);
-  }
+  void Forward_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top) override;
 
   int batch_size_, channels_, height_, width_, size_;
   Ftype* data_;
@@ -59,6 +66,11 @@ class MemoryDataLayer : public BaseDataLayer<Ftype, Btype> {
   TBlob<Ftype> added_label_;
   bool has_new_data_;
   shared_ptr<DataTransformer> dt_;
+  // data_ and labels_ reside in device memory
+  bool gpu_input_;
+#ifndef CPU_ONLY
+  cudaEvent_t ready_;
+#endif
 };
 
 }  // namespace caffe
@@ -49,11 +49,14 @@ class MultinomialLogisticLossLayer : public LossLayer<Ftype, Btype> {
       const vector<Blob*>& top);
 
   virtual inline const char* type() const { return "MultinomialLogisticLoss"; }
+  virtual bool is_capturable() const { return true; }
 
  protected:
   /// @copydoc MultinomialLogisticLossLayer
   virtual void Forward_cpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
+  virtual void Forward_gpu(const vector<Blob*>& bottom,
+      const vector<Blob*>& top);
 
   /**
    * @brief Computes the multinomial logistic loss error gradient w.r.t. the
@@ -85,6 +88,11 @@ class MultinomialLogisticLossLayer : public LossLayer<Ftype, Btype> {
    */
   virtual void Backward_cpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+  virtual void Backward_gpu(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+
+  /// GPU forward: the loss terms summed into top[0] on the device
+  TBlob<float> loss_terms_;
 };
 
 }  // namespace caffe
@@ -22,6 +22,7 @@ class NeuronLayer : public Layer<Ftype, Btype> {
      : Layer<Ftype, Btype>(param) {}
   virtual void Reshape(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
+  virtual bool reshape_invariant() const { return true; }
 
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
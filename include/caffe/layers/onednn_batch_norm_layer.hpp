@@ -0,0 +1,41 @@
+#ifndef CAFFE_ONEDNN_BATCH_NORM_LAYER_HPP_
+#define CAFFE_ONEDNN_BATCH_NORM_LAYER_HPP_
+
+#ifdef USE_ONEDNN
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layers/batch_norm_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/onednn.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Batch normalization of TEST nets with the global statistics, and scale and
+ *        bias if any, as a oneDNN primitive (engine: ONEDNN) reading and writing NCHW
+ *        or NHWC blobs (see NetParameter::layout). Training, other than 4D blobs and
+ *        forward types other than float are BatchNormLayer's.
+ */
+template <typename Ftype, typename Btype>
+class OneDNNBatchNormLayer : public BatchNormLayer<Ftype, Btype> {
+ public:
+  explicit OneDNNBatchNormLayer(const LayerParameter& param)
+      : BatchNormLayer<Ftype, Btype>(param), use_onednn_(false) {}
+  virtual void LayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+  bool use_onednn_;
+  string shapes_;
+  dnnl::batch_normalization_forward::primitive_desc pd_;
+  dnnl::batch_normalization_forward bn_;
+};
+
+}  // namespace caffe
+
+#endif  // USE_ONEDNN
+#endif  // CAFFE_ONEDNN_BATCH_NORM_LAYER_HPP_
@@ -0,0 +1,62 @@
+#ifndef CAFFE_ONEDNN_CONV_LAYER_HPP_
+#define CAFFE_ONEDNN_CONV_LAYER_HPP_
+
+#ifdef USE_ONEDNN
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/util/onednn.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Convolution forward passes as oneDNN primitives (engine: ONEDNN).
+ *
+ * Weights are reordered into the layout oneDNN picks for the CPU, once in TEST phase.
+ * Bottoms and tops are read and written in their packing, NCHW or NHWC (see
+ * NetParameter::layout), so that a convolution may write NHWC from an NCHW bottom.
+ * With quantization_param the bottom is quantized with the calibrated input_scale
+ * and the weights with a scale per output channel, as by the CAFFE engine, and the
+ * INT8 products are scaled back to float with the bias added by the primitive.
+ *
+ * Convolutions other than 2D, forward types other than float and backward passes
+ * are ConvolutionLayer's.
+ */
+template <typename Ftype, typename Btype>
+class OneDNNConvolutionLayer : public ConvolutionLayer<Ftype, Btype> {
+ public:
+  explicit OneDNNConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Ftype, Btype>(param), use_onednn_(false), input_scale_(1.F) {}
+  virtual void LayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void WeightsChanged() {
+    weights_.Reset();
+    quantized_weights_.clear();
+  }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+  // Primitive for the shapes and packings of bottom and top
+  void Init(const Blob& bottom, const Blob& top);
+
+  bool use_onednn_;
+  string shapes_;
+  dnnl::convolution_forward::primitive_desc pd_;
+  dnnl::convolution_forward conv_;
+  dnnl::memory::desc weights_desc_, src_desc_;
+  onednn::Weights weights_;
+  // INT8: quantized bottom and weights, scales of both
+  vector<int8_t> quantized_src_, quantized_weights_;
+  float input_scale_;
+  vector<float> weight_scales_;
+};
+
+}  // namespace caffe
+
+#endif  // USE_ONEDNN
+#endif  // CAFFE_ONEDNN_CONV_LAYER_HPP_
@@ -0,0 +1,52 @@
+#ifndef CAFFE_ONEDNN_INNER_PRODUCT_LAYER_HPP_
+#define CAFFE_ONEDNN_INNER_PRODUCT_LAYER_HPP_
+
+#ifdef USE_ONEDNN
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layers/inner_product_layer.hpp"
+#include "caffe/util/onednn.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Inner product forward passes as oneDNN primitives (engine: ONEDNN), see
+ *        OneDNNConvolutionLayer. The bias and a RELU activation are applied by the
+ *        primitive, GELU by InnerProductLayer after it. Forward types other than
+ *        float and backward passes are InnerProductLayer's.
+ */
+template <typename Ftype, typename Btype>
+class OneDNNInnerProductLayer : public InnerProductLayer<Ftype, Btype> {
+ public:
+  explicit OneDNNInnerProductLayer(const LayerParameter& param)
+      : InnerProductLayer<Ftype, Btype>(param), rows_(0), input_scale_(1.F) {}
+  virtual void LayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void WeightsChanged() {
+    weights_.Reset();
+    quantized_weights_.clear();
+  }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+  // Primitive for M_ rows
+  void Init();
+
+  int rows_;
+  dnnl::inner_product_forward::primitive_desc pd_;
+  dnnl::inner_product_forward product_;
+  dnnl::memory::desc weights_desc_, src_desc_;
+  onednn::Weights weights_;
+  // INT8: quantized bottom and weights, scales of both
+  vector<int8_t> quantized_src_, quantized_weights_;
+  float input_scale_;
+  vector<float> weight_scales_;
+};
+
+}  // namespace caffe
+
+#endif  // USE_ONEDNN
+#endif  // CAFFE_ONEDNN_INNER_PRODUCT_LAYER_HPP_
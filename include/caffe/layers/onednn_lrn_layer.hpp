@@ -0,0 +1,41 @@
+#ifndef CAFFE_ONEDNN_LRN_LAYER_HPP_
+#define CAFFE_ONEDNN_LRN_LAYER_HPP_
+
+#ifdef USE_ONEDNN
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layers/lrn_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/onednn.hpp"
+
+namespace caffe {
+
+/**
+ * @brief ACROSS_CHANNELS normalization of TEST nets as a oneDNN primitive (engine:
+ *        ONEDNN) reading and writing NCHW or NHWC blobs (see NetParameter::layout).
+ *        WITHIN_CHANNEL, training and forward types other than float are LRNLayer's.
+ */
+template <typename Ftype, typename Btype>
+class OneDNNLRNLayer : public LRNLayer<Ftype, Btype> {
+ public:
+  explicit OneDNNLRNLayer(const LayerParameter& param)
+      : LRNLayer<Ftype, Btype>(param), use_onednn_(false) {}
+  virtual void LayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+ protected:
+  virtual void CrossChannelForward_cpu(const vector<Blob*>& bottom,
+      const vector<Blob*>& top);
+
+  bool use_onednn_;
+  string shapes_;
+  dnnl::lrn_forward::primitive_desc pd_;
+  dnnl::lrn_forward lrn_;
+};
+
+}  // namespace caffe
+
+#endif  // USE_ONEDNN
+#endif  // CAFFE_ONEDNN_LRN_LAYER_HPP_
@@ -0,0 +1,48 @@
+#ifndef CAFFE_ONEDNN_POOLING_LAYER_HPP_
+#define CAFFE_ONEDNN_POOLING_LAYER_HPP_
+
+#ifdef USE_ONEDNN
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layers/pooling_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/onednn.hpp"
+
+namespace caffe {
+
+/**
+ * @brief MAX and AVE pooling forward passes of TEST nets as oneDNN primitives (engine:
+ *        ONEDNN), reading and writing NCHW or NHWC blobs (see NetParameter::layout).
+ *
+ * Averages divide by the window clipped to the padded image as PoolingLayer does,
+ * which oneDNN does too without padding or when the last window fits in it. Other
+ * averages, training, mask tops and forward types other than float are PoolingLayer's.
+ */
+template <typename Ftype, typename Btype>
+class OneDNNPoolingLayer : public PoolingLayer<Ftype, Btype> {
+ public:
+  explicit OneDNNPoolingLayer(const LayerParameter& param)
+      : PoolingLayer<Ftype, Btype>(param), use_onednn_(false), fits_(false) {}
+  virtual void LayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+  // Primitive for the shapes and packings of bottom and top, false if oneDNN doesn't
+  // average like PoolingLayer there
+  bool Init(const Blob& bottom, const Blob& top);
+
+  bool use_onednn_;
+  bool fits_;  // whether the primitive is made for shapes_
+  string shapes_;
+  dnnl::pooling_forward::primitive_desc pd_;
+  dnnl::pooling_forward pooling_;
+};
+
+}  // namespace caffe
+
+#endif  // USE_ONEDNN
+#endif  // CAFFE_ONEDNN_POOLING_LAYER_HPP_
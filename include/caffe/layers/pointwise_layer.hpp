@@ -0,0 +1,258 @@
+#ifndef CAFFE_POINTWISE_LAYER_HPP_
+#define CAFFE_POINTWISE_LAYER_HPP_
+
+#include <cmath>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#ifdef __CUDACC__
+#define POINTWISE_HD __host__ __device__
+#else
+#define POINTWISE_HD
+#endif
+
+namespace caffe {
+
+// Ops one Pointwise layer evaluates at most, a SCALE with bias term counting twice
+constexpr int kMaxPointwiseOps = 16;
+
+// PointwiseParameter::Op as the element loops see it, pointers typed by the pass
+struct PointwiseOp {
+  int type;
+  float coeff, operand_coeff, alpha, power, scale, shift;
+  int operand_first;
+  int dim, inner;  // SCALE and BIAS: blob element (i / inner) % dim
+  const void* operand;  // SUM, PROD and MAX bottom
+  void* operand_diff;  // its diff when propagated down, nullptr otherwise
+  const void* blob;  // SCALE and BIAS learned blob
+  void* blob_diff;  // GPU backward: per element blob gradient, reduced afterwards
+};
+
+struct PointwiseProgram {
+  int num_ops;
+  PointwiseOp op[kMaxPointwiseOps];
+};
+
+// Math type of Dtype data: float but for double
+template <typename Dtype>
+struct PointwiseMath {
+  typedef float type;
+};
+
+template <>
+struct PointwiseMath<double> {
+  typedef double type;
+};
+
+// Result of the ops on x, element i. The input of op k is kept in inputs[k].
+// load(pointer, index) gives an operand or blob value as M.
+template <typename M, typename Load>
+POINTWISE_HD inline M pointwise_forward(const PointwiseProgram& prog, int i, M x,
+    M* inputs, const Load& load) {
+  for (int k = 0; k < prog.num_ops; ++k) {
+    const PointwiseOp& op = prog.op[k];
+    inputs[k] = x;
+    switch (op.type) {
+      case PointwiseParameter_Op::SCALE:
+        x *= load(op.blob, (i / op.inner) % op.dim);
+        break;
+      case PointwiseParameter_Op::BIAS:
+        x += load(op.blob, (i / op.inner) % op.dim);
+        break;
+      case PointwiseParameter_Op::SUM:
+        x = op.coeff * x + op.operand_coeff * load(op.operand, i);
+        break;
+      case PointwiseParameter_Op::PROD:
+        x *= load(op.operand, i);
+        break;
+      case PointwiseParameter_Op::MAX: {
+        const M z = load(op.operand, i);
+        x = (op.operand_first ? z >= x : z > x) ? z : x;
+        break;
+      }
+      case PointwiseParameter_Op::RELU:
+        x = x > M(0) ? x : x * op.alpha;
+        break;
+      case PointwiseParameter_Op::ELU:
+        x = x > M(0) ? x : op.alpha * (exp(x) - M(1));
+        break;
+      case PointwiseParameter_Op::SIGMOID:
+        x = M(1) / (M(1) + exp(-x));
+        break;
+      case PointwiseParameter_Op::TANH:
+        x = tanh(x);
+        break;
+      case PointwiseParameter_Op::POWER:
+        x = op.shift + op.scale * x;
+        if (op.power != 1.F) {
+          x = pow(x, static_cast<M>(op.power));
+        }
+        break;
+    }
+  }
+  return x;
+}
+
+// Diff of x, element i, for the top diff g. The ops are recomputed, then walked back:
+// grads[k] gets the diff of op k's operand, or its blob's share from this element.
+template <typename M, typename Load>
+POINTWISE_HD inline M pointwise_backward(const PointwiseProgram& prog, int i, M x, M g,
+    M* grads, const Load& load) {
+  M inputs[kMaxPointwiseOps + 1];
+  inputs[prog.num_ops] = pointwise_forward(prog, i, x, inputs, load);
+  for (int k = prog.num_ops - 1; k >= 0; --k) {
+    const PointwiseOp& op = prog.op[k];
+    const M in = inputs[k], out = inputs[k + 1];
+    M d = M(0);
+    switch (op.type) {
+      case PointwiseParameter_Op::SCALE:
+        d = g * in;
+        g *= load(op.blob, (i / op.inner) % op.dim);
+        break;
+      case PointwiseParameter_Op::BIAS:
+        d = g;
+        break;
+      case PointwiseParameter_Op::SUM:
+        d = g * op.operand_coeff;
+        g *= op.coeff;
+        break;
+      case PointwiseParameter_Op::PROD:
+        d = g * in;
+        g *= load(op.operand, i);
+        break;
+      case PointwiseParameter_Op::MAX: {
+        const M z = load(op.operand, i);
+        if (op.operand_first ? z >= in : z > in) {
+          d = g;
+          g = M(0);
+        }
+        break;
+      }
+      case PointwiseParameter_Op::RELU:
+        g = in > M(0) ? g : g * op.alpha;
+        break;
+      case PointwiseParameter_Op::ELU:
+        g = in > M(0) ? g : g * (out + op.alpha);
+        break;
+      case PointwiseParameter_Op::SIGMOID:
+        g *= out * (M(1) - out);
+        break;
+      case PointwiseParameter_Op::TANH:
+        g *= M(1) - out * out;
+        break;
+      case PointwiseParameter_Op::POWER:
+        if (op.power == 0.F) {
+          g = M(0);
+        } else if (op.power == 1.F) {
+          g *= op.scale;
+        } else {
+          g *= op.power * op.scale *
+              pow(op.shift + op.scale * in, static_cast<M>(op.power - 1.F));
+        }
+        break;
+    }
+    grads[k] = d;
+  }
+  return g;
+}
+
+/**
+ * @brief Evaluates a chain of pointwise operations (Scale, Bias, Eltwise, ReLU, ELU,
+ *        Sigmoid, TanH and Power) in one pass over the data, see PointwiseParameter.
+ *        Net::Init makes these of adjacent layers when NetParameter::fuse_pointwise
+ *        is set.
+ *
+ * bottom[0] is the chain's input, further bottoms are the Eltwise operands. Learned
+ * Scale and Bias blobs are the layer's blobs in op order. Backward recomputes the
+ * chain per element instead of keeping the intermediate values, in place layers
+ * keep a copy of their input for it outside the TEST phase.
+ */
+template <typename Ftype, typename Btype>
+class PointwiseLayer : public Layer<Ftype, Btype> {
+ public:
+  explicit PointwiseLayer(const LayerParameter& param)
+      : Layer<Ftype, Btype>(param) {}
+  virtual void LayerSetUp(const vector<Blob*>& bottom,
+      const vector<Blob*>& top);
+  virtual void Reshape(const vector<Blob*>& bottom,
+      const vector<Blob*>& top);
+
+  virtual inline const char* type() const { return "Pointwise"; }
+  virtual bool is_capturable() const { return true; }
+  virtual inline int MinBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob*>& bottom,
+      const vector<Blob*>& top);
+  virtual void Forward_gpu(const vector<Blob*>& bottom,
+      const vector<Blob*>& top);
+  virtual void Backward_cpu(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+  virtual void Backward_gpu(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+
+  // The program with pointers to Dtype data of the given side, operand diffs set for
+  // backward
+  template <typename Dtype>
+  PointwiseProgram Program(const vector<Blob*>& bottom, bool gpu,
+      const vector<bool>* propagate_down) {
+    PointwiseProgram prog = program_;
+    for (int k = 0; k < prog.num_ops; ++k) {
+      PointwiseOp& op = prog.op[k];
+      if (op_operand_[k] > 0) {
+        Blob* operand = bottom[op_operand_[k]];
+        op.operand = data<Dtype>(operand, gpu);
+        if (propagate_down != nullptr && (*propagate_down)[op_operand_[k]]) {
+          op.operand_diff = mutable_diff<Dtype>(operand, gpu);
+        }
+      }
+      if (op_blob_[k] >= 0) {
+        op.blob = data<Dtype>(this->blobs_[op_blob_[k]].get(), gpu);
+      }
+    }
+    return prog;
+  }
+
+  template <typename Dtype>
+  static const void* data(Blob* blob, bool gpu) {
+#ifndef CPU_ONLY
+    if (gpu) {
+      return blob->gpu_data<Dtype>();
+    }
+#endif
+    return blob->cpu_data<Dtype>();
+  }
+
+  template <typename Dtype>
+  static void* mutable_diff(Blob* blob, bool gpu) {
+#ifndef CPU_ONLY
+    if (gpu) {
+      return blob->mutable_gpu_diff<Dtype>();
+    }
+#endif
+    return blob->mutable_cpu_diff<Dtype>();
+  }
+
+  // Whether the input has to be kept for backward
+  bool keeps_input(const vector<Blob*>& bottom, const vector<Blob*>& top) const {
+    return bottom[0] == top[0] && this->phase_ != TEST;
+  }
+
+  PointwiseProgram program_;  // pointers unset
+  vector<int> op_operand_;  // bottom of the op, 0 if none
+  vector<int> op_blob_;  // blob of the op, -1 if none
+  vector<int> op_param_;  // PointwiseParameter::Op the op comes from
+  TBlob<Ftype> input_;  // see keeps_input
+  // GPU backward: per element blob gradients and their reduction
+  vector<shared_ptr<TBlob<Btype>>> blob_grads_;
+  TBlob<Btype> sum_multiplier_;
+  TBlob<Btype> sum_result_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_POINTWISE_LAYER_HPP_
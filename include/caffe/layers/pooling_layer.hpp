@@ -25,6 +25,10 @@ class PoolingLayer : public Layer<Ftype, Btype> {
       const vector<Blob*>& top);
 
   virtual inline const char* type() const { return "Pooling"; }
+  virtual bool is_capturable() const { return true; }
+  virtual bool reshape_invariant() const { return true; }
+  virtual void Cost(const vector<Blob*>& bottom, const vector<Blob*>& top,
+      LayerCost* cost) const;
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
   // MAX POOL layers can output an extra top blob for the mask;
@@ -54,6 +58,15 @@ class PoolingLayer : public Layer<Ftype, Btype> {
   bool is_max_pooling_;
   TBlob<float> rand_idx_;
   TBlob<int> max_idx_;
+#ifndef CPU_ONLY
+  // MAX argmax of Forward_gpu without a top mask: offset within the window, 1 byte up
+  // to 16x16 windows and 2 up to 256x256, else the index into the bottom plane
+  GPUMemory::Workspace max_idx_gpu_;
+  int max_idx_gpu_bytes() const {
+    const int window = kernel_h_ * kernel_w_;
+    return window <= 256 ? 1 : window <= 65536 ? 2 : sizeof(int);
+  }
+#endif
 };
 
 }  // namespace caffe
@@ -2,6 +2,11 @@
 #define CAFFE_PYTHON_LAYER_HPP_
 
 #include <boost/python.hpp>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
 #include <vector>
 
 #include "caffe/layer.hpp"
@@ -39,7 +44,39 @@ inline void PyErrFatal() {
   std::cerr << std::endl;
   LOG(FATAL) << "Python error";
 }
+// Fetches and clears the pending Python error, formatted with its traceback
+std::string PyErrFetchString();
 void PyErrReportAndForward();
+// Raises error as a Python RuntimeError, error being PyErrFetchString() of another thread
+void PyErrForward(const std::string& error);
+
+/**
+ * @brief PythonParameter::executor: the thread making every call of layers using it.
+ * It takes the GIL when calls are queued and keeps it until the queue is empty.
+ */
+class PythonExecutor {
+ public:
+  static PythonExecutor& Get();
+
+  // Returns once call returned, error set to what it raised if anything
+  void Run(const std::function<void()>& call, std::string* error);
+
+ private:
+  PythonExecutor();
+  void Loop();
+
+  struct Task {
+    const std::function<void()>* call;
+    std::string* error;
+    bool done;
+  };
+
+  std::mutex mutex_;
+  std::condition_variable queued_, done_;
+  std::deque<Task*> queue_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(PythonExecutor);
+};
 
 #define PYTHON_CALL_BEGIN  \
 {                          \
@@ -59,31 +96,17 @@ class PythonLayer : public Layer<Ftype, Btype> {
       : Layer<Ftype, Btype>(param), self_(bp::handle<>(bp::borrowed(self))) {}
 
   void LayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top) override {
-    try {
-      std::lock_guard<std::mutex> lock(mutex());
-      PYTHON_CALL_BEGIN
+    Call([&]() {
       self_.attr("param_str") = bp::str(this->layer_param_.python_param().param_str());
       self_.attr("phase") = static_cast<int>(this->phase_);
       self_.attr("setup")(bottom, top);
-      PYTHON_CALL_END
-    } catch (const bp::error_already_set&) {
-      PyErrReportAndForward();
-    } catch (...) {
-      PyErrFatal();
-    }
+    });
   }
 
   void Reshape(const vector<Blob*>& bottom, const vector<Blob*>& top) override {
-    try {
-      std::lock_guard<std::mutex> lock(mutex());
-      PYTHON_CALL_BEGIN
+    Call([&]() {
       self_.attr("reshape")(bottom, top);
-      PYTHON_CALL_END
-    } catch (const bp::error_already_set&) {
-      PyErrReportAndForward();
-    } catch (...) {
-      PyErrFatal();
-    }
+    });
   }
 
   inline bool ShareInParallel() const override {
@@ -98,24 +121,33 @@ class PythonLayer : public Layer<Ftype, Btype> {
 
  protected:
   void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top) override {
-    try {
-      std::lock_guard<std::mutex> lock(mutex());
-      PYTHON_CALL_BEGIN
+    Call([&]() {
       self_.attr("forward")(bottom, top);
-      PYTHON_CALL_END
-    } catch (const bp::error_already_set&) {
-      PyErrReportAndForward();
-    } catch (...) {
-      PyErrFatal();
-    }
+    });
   }
 
   void Backward_cpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom) override {
+    Call([&]() {
+      self_.attr("backward")(top, propagate_down, bottom);
+    });
+  }
+
+ private:
+  // Makes the call with the GIL, on the executor if the layer uses it
+  void Call(const std::function<void()>& call) {
+    if (this->layer_param_.python_param().executor()) {
+      std::string error;
+      PythonExecutor::Get().Run(call, &error);
+      if (!error.empty()) {
+        PyErrForward(error);
+      }
+      return;
+    }
     try {
       std::lock_guard<std::mutex> lock(mutex());
       PYTHON_CALL_BEGIN
-      self_.attr("backward")(top, propagate_down, bottom);
+      call();
       PYTHON_CALL_END
     } catch (const bp::error_already_set&) {
       PyErrReportAndForward();
@@ -124,7 +156,6 @@ class PythonLayer : public Layer<Ftype, Btype> {
     }
   }
 
- private:
   bp::object self_;
   static std::mutex mutex_;
 };
@@ -28,6 +28,7 @@ class ReLULayer : public NeuronLayer<Ftype, Btype> {
       : NeuronLayer<Ftype, Btype>(param) {}
 
   virtual inline const char* type() const { return "ReLU"; }
+  virtual bool is_capturable() const { return true; }
 
  protected:
   /**
@@ -0,0 +1,67 @@
+#ifndef CAFFE_REMOTE_DATA_LAYER_HPP_
+#define CAFFE_REMOTE_DATA_LAYER_HPP_
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/data_service.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layers/base_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Data layer whose batches are read and transformed by a data service worker
+ *        on another host, see DataServiceWorker and RemoteDataParameter.
+ *
+ * Takes the data_param and transform_param of a Data layer. Batches are received by
+ * an internal thread into remote_data_param().queue_depth() buffers, that queue
+ * being all the data pipeline left on the training node.
+ */
+template<typename Ftype, typename Btype>
+class RemoteDataLayer : public BaseDataLayer<Ftype, Btype>, public InternalThread {
+ public:
+  explicit RemoteDataLayer(const LayerParameter& param);
+  virtual ~RemoteDataLayer();
+  void DataLayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top) override;
+  // Every rank streams its own share of the data
+  bool ShareInParallel() const override {
+    return false;
+  }
+  const char* type() const override {
+    return "RemoteData";
+  }
+  int ExactNumBottomBlobs() const override {
+    return 0;
+  }
+  int MinTopBlobs() const override {
+    return 1;
+  }
+  int MaxTopBlobs() const override {
+    return 2;
+  }
+
+ protected:
+  void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top) override;
+  void InternalThreadEntry() override;
+  std::string thread_name() const override {
+    return this->name();
+  }
+
+  struct Tops {
+    vector<shared_ptr<Blob>> blobs;
+  };
+
+  unique_ptr<DataServiceClient> client_;
+  BlockingQueue<shared_ptr<Tops>> full_, free_;
+  std::atomic<bool> stopping_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_REMOTE_DATA_LAYER_HPP_
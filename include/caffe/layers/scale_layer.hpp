@@ -31,6 +31,8 @@ class ScaleLayer: public Layer<Ftype, Btype> {
       const vector<Blob*>& top);
 
   virtual inline const char* type() const { return "Scale"; }
+  virtual bool is_capturable() const { return true; }
+  virtual bool reshape_invariant() const { return true; }
   // Scale
   virtual inline int MinBottomBlobs() const { return 1; }
   virtual inline int MaxBottomBlobs() const { return 2; }
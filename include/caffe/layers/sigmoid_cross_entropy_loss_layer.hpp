@@ -59,6 +59,9 @@ class SigmoidCrossEntropyLossLayer : public LossLayer<Ftype, Btype> {
   /// @copydoc SigmoidCrossEntropyLossLayer
   virtual void Forward_cpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
+  // Loss straight from the scores, the sigmoid outputs are only made on CPU
+  virtual void Forward_gpu(const vector<Blob*>& bottom,
+      const vector<Blob*>& top);
 
   /**
    * @brief Computes the sigmoid cross-entropy loss error gradient w.r.t. the
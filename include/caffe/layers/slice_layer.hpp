@@ -19,7 +19,9 @@ template <typename Ftype, typename Btype>
 class SliceLayer : public Layer<Ftype, Btype> {
  public:
   explicit SliceLayer(const LayerParameter& param)
-      : Layer<Ftype, Btype>(param) {}
+      : Layer<Ftype, Btype>(param),
+        share_storage_(param.slice_param().share_storage()),
+        data_views_(false), diff_views_(false) {}
   virtual void LayerSetUp(const vector<Blob*>& bottom,
       const vector<Blob*>& top);
   virtual void Reshape(const vector<Blob*>& bottom,
@@ -39,11 +41,21 @@ class SliceLayer : public Layer<Ftype, Btype> {
   virtual void Backward_gpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
 
+  // SliceParameter::share_storage: whether tops are regions of the bottom already,
+  // else they're made so after copying. Data, then diff.
+  bool ForwardViews(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  bool BackwardViews(const vector<Blob*>& top, const vector<Blob*>& bottom);
+  void BindViews(const vector<Blob*>& bottom, const vector<Blob*>& top, bool data);
+
   int count_;
   int num_slices_;
   int slice_size_;
   int slice_axis_;
   vector<int> slice_point_;
+  const bool share_storage_;
+  bool data_views_, diff_views_;
+  // Bottom shape when views were made
+  vector<int> views_shape_;
 };
 
 }  // namespace caffe
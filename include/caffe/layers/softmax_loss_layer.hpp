@@ -102,6 +102,10 @@ class SoftmaxWithLossLayer : public LossLayer<Ftype, Btype> {
   virtual void Backward_gpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
 
+  // Single kernel passes without the probability blob, if top.size() == 1
+  void ForwardFused_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  void BackwardFused_gpu(const vector<Blob*>& top, const vector<Blob*>& bottom);
+
   /// Read the normalization mode parameter and compute the normalizer based
   /// on the blob size.  If normalization_mode is VALID, the count of valid
   /// outputs will be read from valid_count, unless it is -1 in which case
@@ -125,6 +129,9 @@ class SoftmaxWithLossLayer : public LossLayer<Ftype, Btype> {
   LossParameter_NormalizationMode normalization_;
 
   int softmax_axis_, outer_num_, inner_num_;
+  /// Fused GPU path, taken if there's no probability top: log-sum-exp (data) and
+  /// loss (diff) of every softmax row, and whether its label counts.
+  TBlob<float> row_buffer_, row_counts_;
 };
 
 }  // namespace caffe
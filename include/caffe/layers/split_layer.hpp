@@ -23,6 +23,7 @@ class SplitLayer : public Layer<Ftype, Btype> {
   void Reshape(const vector<Blob*>& bottom, const vector<Blob*>& top) override;
 
   const char* type() const override { return "Split"; }
+  bool is_capturable() const override { return true; }
   int ExactNumBottomBlobs() const override { return 1; }
   int MinTopBlobs() const override { return 1; }
 
@@ -26,6 +26,10 @@ class SPPLayer : public Layer<Ftype, Btype> {
       const vector<Blob*>& top);
 
   virtual inline const char* type() const { return "SPP"; }
+  // Capturable when the internal layers are, the Concat one being the only one that may not
+  virtual bool is_capturable() const {
+    return pyramid_height_ == 1 || concat_layer_->is_capturable();
+  }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -34,6 +38,16 @@ class SPPLayer : public Layer<Ftype, Btype> {
       const vector<Blob*>& top);
   virtual void Backward_cpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom);
+  // The internal layers dispatch on Caffe::mode() themselves, so they run on the GPU from
+  // the same code
+  virtual void Forward_gpu(const vector<Blob*>& bottom,
+      const vector<Blob*>& top) {
+    Forward_cpu(bottom, top);
+  }
+  virtual void Backward_gpu(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+    Backward_cpu(top, propagate_down, bottom);
+  }
   // calculates the kernel and stride dimensions for the pooling layer,
   // returns a correctly configured LayerParameter for a PoolingLayer
   virtual LayerParameter GetPoolingParam(const int pyramid_level,
@@ -0,0 +1,47 @@
+#ifndef CAFFE_STRIPE_LAYER_HPP_
+#define CAFFE_STRIPE_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Keeps this solver's horizontal stripe of a batch shared by a group of
+ *        spatial_param.stripes solvers, see NetParameter::spatial_stripes. The first
+ *        solver of the group sends its bottom to the others, then the top takes rows
+ *        [index * H / stripes, (index + 1) * H / stripes) of axis 2. Bottoms of fewer
+ *        than 3 axes or rows than stripes (labels) are passed whole. Net::Init inserts
+ *        these layers after the data layers. GPU mode only, nothing to backpropagate.
+ */
+template <typename Ftype, typename Btype>
+class StripeLayer : public Layer<Ftype, Btype> {
+ public:
+  explicit StripeLayer(const LayerParameter& param)
+      : Layer<Ftype, Btype>(param), stripes_(1), rows_(0) {}
+  virtual void LayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Reshape(const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+  virtual inline const char* type() const { return "Stripe"; }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Forward_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top);
+  virtual void Backward_cpu(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom) {}
+  virtual void Backward_gpu(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom) {}
+
+  int stripes_;
+  // Rows of the stripe, 0 for bottoms passed whole
+  int rows_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_STRIPE_LAYER_HPP_
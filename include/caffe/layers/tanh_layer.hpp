@@ -26,6 +26,7 @@ class TanHLayer : public NeuronLayer<Ftype, Btype> {
       : NeuronLayer<Ftype, Btype>(param) {}
 
   virtual inline const char* type() const { return "TanH"; }
+  virtual bool is_capturable() const { return true; }
 
  protected:
   /**
@@ -0,0 +1,68 @@
+#ifndef CAFFE_TENSOR_DATA_LAYER_HPP_
+#define CAFFE_TENSOR_DATA_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layers/base_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/tensor_file.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Provides records of a tensor file to the Net as they are, no Datum and no
+ *        transformation.
+ *
+ * A batch is one read of TensorDataParameter::batch_size consecutive records. With
+ * GPUDirect Storage they go from the file to device memory by cuFile, converted there
+ * when the file's type isn't the forward type; otherwise they are read to host memory and
+ * pushed like batches of other data layers. Tops are N x record shape data and, when
+ * asked for, N labels.
+ */
+template <typename Ftype, typename Btype>
+class TensorDataLayer : public BasePrefetchingDataLayer<Ftype, Btype> {
+ public:
+  explicit TensorDataLayer(const LayerParameter& param)
+      : BasePrefetchingDataLayer<Ftype, Btype>(param), direct_(false) {}
+  virtual ~TensorDataLayer();
+  void DataLayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top) override;
+
+  const char* type() const override { return "TensorData"; }
+  int ExactNumBottomBlobs() const override { return 0; }
+  int MinTopBlobs() const override { return 1; }
+  int MaxTopBlobs() const override { return 2; }
+  bool is_gpu_transform() const override { return direct_; }
+
+ protected:
+  // First record of the batch: batches of this rank are dealt as DataReader deals them,
+  // threads_num() consecutive ones per rank in turn
+  uint64_t first_record(size_t batch_id) const;
+  void load_batch(Batch* batch, int thread_id, size_t queue_id = 0UL) override;
+  void start_reading() override {}
+  void InitializePrefetch() override {}
+  bool auto_mode() const override {
+    return false;
+  }
+
+  Flag* layer_inititialized_flag() override {
+    return this->phase_ == TRAIN ? &layer_inititialized_flag_ : nullptr;
+  }
+
+  unique_ptr<TensorFile> file_;
+  vector<int> top_shape_;
+  // Whether batches are read by cuFile to device memory
+  bool direct_;
+  // Per transformer thread: records of the file's type before conversion
+  vector<vector<char>> host_;
+#ifndef CPU_ONLY
+  vector<shared_ptr<GPUMemory::Workspace>> staging_;
+#endif
+  Flag layer_inititialized_flag_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_TENSOR_DATA_LAYER_HPP_
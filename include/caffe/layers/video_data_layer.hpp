@@ -0,0 +1,76 @@
+#ifndef CAFFE_VIDEO_DATA_LAYER_HPP_
+#define CAFFE_VIDEO_DATA_LAYER_HPP_
+
+#if defined(USE_NVDEC) && !defined(CPU_ONLY)
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layers/base_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/gpu_memory.hpp"
+#include "caffe/util/nvdec_decoder.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Provides clips of video files to the Net, decoded on the GPU.
+ *
+ * Every clip of a batch is a range of VideoDataParameter::frames frames read by
+ * NvDecVideoReader into device memory, then resized, cropped, mirrored, jittered and
+ * normalized by DataTransformer::AugmentGPU with one draw for all of its frames. Tops are
+ * N x T x C x H x W data, NCHW frames, and N labels. GPU mode only.
+ */
+template <typename Ftype, typename Btype>
+class VideoDataLayer : public BasePrefetchingDataLayer<Ftype, Btype> {
+ public:
+  explicit VideoDataLayer(const LayerParameter& param)
+      : BasePrefetchingDataLayer<Ftype, Btype>(param), lines_id_(0UL), clips_read_(0UL) {}
+  virtual ~VideoDataLayer();
+  void DataLayerSetUp(const vector<Blob*>& bottom, const vector<Blob*>& top) override;
+
+  const char* type() const override { return "VideoData"; }
+  int ExactNumBottomBlobs() const override { return 0; }
+  int ExactNumTopBlobs() const override { return 2; }
+  bool is_gpu_transform() const override { return true; }
+
+ protected:
+  void ShuffleClips();
+  // Next clip of the list and its record id, counting clips read across epochs
+  std::pair<std::string, int> next_clip(uint64_t* record_id);
+  void load_batch(Batch* batch, int thread_id, size_t queue_id = 0UL) override;
+  void start_reading() override {}
+  void InitializePrefetch() override {}
+  bool auto_mode() const override {
+    return false;
+  }
+
+  Flag* layer_inititialized_flag() override {
+    return this->phase_ == TRAIN ? &layer_inititialized_flag_ : nullptr;
+  }
+
+  // Per transformer thread: reader created on first use, frames of a clip and their samples
+  struct ClipBuffers {
+    unique_ptr<NvDecVideoReader> reader;
+    GPUMemory::Workspace frames, samples_gpu;
+    vector<AugmentSample> samples;
+  };
+  vector<shared_ptr<ClipBuffers>> clips_;
+
+  shared_ptr<Caffe::RNG> prefetch_rng_;
+  vector<std::pair<std::string, int>> lines_;
+  size_t lines_id_;
+  uint64_t clips_read_;
+  std::mutex lines_mutex_;
+  Flag layer_inititialized_flag_;
+};
+
+}  // namespace caffe
+
+#endif  // USE_NVDEC && !CPU_ONLY
+#endif  // CAFFE_VIDEO_DATA_LAYER_HPP_
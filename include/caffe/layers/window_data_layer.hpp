@@ -11,14 +11,39 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
+// Where a warped window comes from and goes to, in pixels
+struct WindowWarp {
+  size_t image_offset;  // of the decoded image, in bytes from the first of the batch
+  int image_cols;
+  int roi_x, roi_y, roi_w, roi_h;  // clipped region of the image
+  int pad_w, pad_h;  // position of the warped region in the crop
+  int out_w, out_h;  // size of the warped region
+  int mirror;
+};
+
+#ifndef CPU_ONLY
+// Warps the windows of the images (HWC, 8 bits) with bilinear interpolation as
+// cv::resize does, mirrors, subtracts the mean and scales into out (NCHW).
+// The mean is either mean_file sized data or mean_values, at most one non-null.
+template <typename Dtype>
+void window_warp_gpu(int num, int channels, int crop_size, const WindowWarp* warps,
+    const uint8_t* images, const float* mean, int mean_height, int mean_width, int mean_off,
+    const float* mean_values, float scale, Dtype* out);
+#endif
+
 /**
  * @brief Provides data to the Net from windows of images files, specified
  *        by a window data file.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * Windows of a batch are sampled from a generator seeded by the batch id, thus
+ * batches are the same whatever thread prepares them. Images are decoded once
+ * per batch by read_threads threads, see WindowDataParameter::cache_images for
+ * keeping them across batches. Windows are warped on the GPU with a GPU transform,
+ * by the same threads otherwise.
  */
 template <typename Ftype, typename Btype>
 class WindowDataLayer : public BasePrefetchingDataLayer<Ftype, Btype> {
@@ -33,22 +58,33 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Ftype, Btype> {
   int ExactNumTopBlobs() const override { return 2; }
 
  protected:
-  unsigned int PrefetchRand();
   void load_batch(Batch* batch, int thread_id, size_t queue_id = 0UL) override;
   void start_reading() override {}
 
-  shared_ptr<Caffe::RNG> prefetch_rng_;
+  // Decoded color image of image_database_[index], cached if enabled
+  cv::Mat ReadImage(int index) const;
+  // Region of the window in the image and in the crop after context padding
+  WindowWarp GetWarp(const vector<float>& window, const cv::Mat& image, bool mirror) const;
+  // Warps on the calling thread, CPU transform
+  void WarpCPU(const cv::Mat& image, const WindowWarp& warp, Ftype* out) const;
+
+  uint64_t sample_seed_;
   vector<std::pair<std::string, vector<int> > > image_database_;
   enum WindowField { IMAGE_INDEX, LABEL, OVERLAP, X1, Y1, X2, Y2, NUM };
   vector<vector<float> > fg_windows_;
   vector<vector<float> > bg_windows_;
-  TBlob<Ftype> data_mean_;
-  vector<Ftype> mean_values_;
+  TBlob<float> data_mean_;
+  vector<float> mean_values_;
+  TBlob<float> mean_values_blob_;
   bool has_mean_file_;
   bool has_mean_values_;
   bool cache_images_;
-  vector<std::pair<std::string, Datum > > image_database_cache_;
   vector<int> data_shape_, label_shape_;
+  unique_ptr<ThreadPool> read_pool_;
+#ifndef CPU_ONLY
+  // Per prefetch thread, images and warps of a batch on the device
+  vector<shared_ptr<GPUMemory::Workspace>> images_gpu_, warps_gpu_;
+#endif
 };
 
 }  // namespace caffe
@@ -0,0 +1,125 @@
+#ifndef CAFFE_MODEL_REPOSITORY_HPP_
+#define CAFFE_MODEL_REPOSITORY_HPP_
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/inference_engine.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Makes learnable params of nets share the memory of equal ones seen before:
+ *        same type, shape and values, found by checksum and compared. Thread safe.
+ *        Params are held weakly, memory stays as long as a net uses it.
+ */
+class WeightDeduplicator {
+ public:
+  WeightDeduplicator() : shared_bytes_(0UL) {}
+
+  // Returns the bytes saved on the net
+  size_t Deduplicate(const Net& net);
+  // Saved so far
+  size_t shared_bytes() const {
+    return shared_bytes_;
+  }
+
+ private:
+  static uint32_t Checksum(const Blob& blob);
+  static bool Equal(const Blob& a, const Blob& b);
+
+  std::mutex mutex_;
+  std::unordered_multimap<uint32_t, weak_ptr<Blob>> blobs_;
+  size_t shared_bytes_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(WeightDeduplicator);
+};
+
+/**
+ * @brief Serves many models from one process and device.
+ *
+ * Every model is an InferenceEngine. Their memory comes from the process wide
+ * GPUMemory pool, so no model keeps a cache of its own. Besides:
+ * - weights equal across models, e.g. of layers a new version did not retrain, are
+ *   stored once (see WeightDeduplicator);
+ * - context i of every model runs in workspace slot i, so the device holds as many
+ *   convolution workspaces as the most contexts of a model, used one request at a time;
+ * - with a weight budget, weights of the least recently used idle models are dropped
+ *   from the device till the ones of the requested model fit. Their host copies stay
+ *   and get uploaded back before the model runs again. Weights shared with a resident
+ *   model stay on the device.
+ */
+class ModelRepository {
+ public:
+  /**
+   * @param device GPU to serve on, current one if negative, ignored in CPU mode
+   * @param weight_budget bytes of weights kept on the device, no limit if 0
+   */
+  explicit ModelRepository(int device = -1, size_t weight_budget = 0UL);
+  ~ModelRepository();
+
+  /**
+   * @brief Adds a model, replacing the one of the same name. Arguments are as for
+   *        InferenceEngine. Its weights are uploaded on first request.
+   */
+  void Load(const string& name, const NetParameter& param, const string& weights_file,
+      int contexts, const vector<int>& batch_sizes = vector<int>());
+  // Waits for requests of the model to finish
+  void Unload(const string& name);
+
+  // As InferenceEngine::Infer of the model. Thread safe.
+  void Infer(const string& name, const vector<Blob*>& inputs, const vector<Blob*>& outputs);
+  // As InferenceEngine::InferAsync of the model. Thread safe.
+  void InferAsync(const string& name, const vector<Blob*>& inputs,
+      const vector<Blob*>& outputs, const std::function<void()>& done);
+
+  vector<string> models() const;
+  const InferenceEngine& engine(const string& name) const;
+  // Whether the model's weights are on the device
+  bool resident(const string& name) const;
+  // Of weights on the device, shared ones counted once
+  size_t resident_bytes() const;
+  size_t shared_bytes() const {
+    return weights_.shared_bytes();
+  }
+
+ private:
+  struct Model {
+    shared_ptr<InferenceEngine> engine;
+    bool resident;
+    int in_flight;
+    uint64_t last_use;
+  };
+
+  // Both with mutex_ held
+  void MakeResident(const string& name, Model* model);
+  void Evict(const string& name, Model* model);
+  // Bytes of resident models' weights by their host copy, which identifies the memory
+  std::map<const void*, size_t> ResidentWeights() const;
+
+  const Caffe::Brew mode_;
+  int device_;
+  const size_t weight_budget_;
+  WeightDeduplicator weights_;
+  EngineSharing sharing_;
+  mutable std::mutex mutex_;
+  std::condition_variable idle_;
+  std::map<string, Model> models_;
+  uint64_t uses_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(ModelRepository);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_MODEL_REPOSITORY_HPP_
@@ -2,7 +2,10 @@
 #define CAFFE_NET_HPP_
 
 #include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <map>
+#include <mutex>
 #include <set>
 #include <string>
 #include <unordered_map>
@@ -14,10 +17,18 @@
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/dag_executor.hpp"
+#include "caffe/util/device_worker.hpp"
+#include "caffe/util/gpu_memory.hpp"
 #include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
+class BlobMonitor;
+class BucketTuner;
+class IpcWeights;
+class TensorRTSegment;
+class WeightFile;
 class Solver;
 
 /**
@@ -28,11 +39,15 @@ class Solver;
  */
 class Net {
  public:
+  /// trained_net: net whose layers this one shares from the start, see
+  /// ShareTrainedLayersWith. Layers named like its ones get its param blobs before
+  /// their set up, so they never allocate and initialize weights of their own.
   explicit Net(const NetParameter& param,
       size_t solver_rank = 0U,
       Flag* solver_init_flag = nullptr,
       Flag* solver_iter0_flag = nullptr,
-      const Net* root_net = nullptr);
+      const Net* root_net = nullptr,
+      const Net* trained_net = nullptr);
   Net(const string& param_file,
       Phase phase,
       size_t solver_rank = 0U,
@@ -90,9 +105,58 @@ class Net {
    * a forward pass, e.g. to compute output feature size.
    */
   void Reshape();
+  /**
+   * @brief Switches the data layers to batches of batch_size samples cropped to
+   *        crop_size (-1 for their parameter's), the other layers follow when the
+   *        first such batch reshapes them. False if no layer takes input shapes.
+   */
+  bool SetInputShape(int batch_size, int crop_size);
   void ReduceAndUpdate(int type_id);
 
-  float ForwardBackward(bool apply_update = true);
+  /**
+   * @brief Forward and backward of one micro-batch. With first_micro_batch, layers
+   *        that can_overwrite_param_diffs write their param gradients instead of
+   *        adding them to what the solver left there (see overwrite_layers_).
+   */
+  float ForwardBackward(bool apply_update = true, bool first_micro_batch = false);
+  /**
+   * @brief SolverParameter::overlap_next_forward: forward of the next iteration's first
+   *        micro-batch while the reduction threads still update this one's params. Every
+   *        layer waits for the updates of its own params only. ForwardBackward then
+   *        starts at backward.
+   */
+  void ForwardAhead();
+  /// @brief Whether ForwardAhead is enabled and supported by this net.
+  bool forward_ahead() const;
+  /**
+   * @brief SolverParameter::device_loss: GPU mode, loss layers add their losses to
+   *        this device float on their streams instead of reading them back, forward
+   *        passes return 0. nullptr restores host sums. Not for pipeline stages.
+   */
+  void set_loss_slot(float* slot) {
+    CHECK(slot == nullptr || (Caffe::mode() == Caffe::GPU && stage_of_.empty()));
+    loss_slot_ = slot;
+  }
+  /// @brief Whether the first micro-batch writes the gradients of all learnable params,
+  /// so that nothing has to clear them before an iteration.
+  bool all_param_diffs_overwritten() const {
+    return all_param_diffs_overwritten_;
+  }
+  /**
+   * @brief NetParameter::pipeline_device: forward and backward of micro_batches
+   *        batches with stages working on different ones at the same time,
+   *        gradients accumulate and are applied at the end.
+   * @return sum of the micro-batches' losses
+   */
+  float ForwardBackwardPipelined(int micro_batches);
+  /// @brief Number of pipeline stages, 1 if the net isn't split.
+  int pipeline_stages() const {
+    return stage_first_.empty() ? 1 : stage_first_.size();
+  }
+  /// @brief Pipeline stage of the layer.
+  int pipeline_stage(int layer_id) const {
+    return stage_of_.empty() ? 0 : stage_of_[layer_id];
+  }
 
   /// @brief Updates the network weights based on the diff values computed.
   void Update();
@@ -107,8 +171,25 @@ class Net {
   /**
    * @brief For an already initialized net, implicitly copies (i.e., using no
    *        additional memory) the pre-trained layers from another Net.
+   *        With copy, their current weights are copied instead, those of
+   *        learnable params from learnable (indexed as other's) if given.
+   */
+  void ShareTrainedLayersWith(const Net* other, bool copy = false,
+      const vector<Blob*>* learnable = nullptr);
+  /**
+   * @brief Layers and TensorRT engines drop what they derived from the weights (see
+   *        LayerBase::WeightsChanged). Called when weights are copied in, and by
+   *        Solver::Test for test nets sharing the trained layers.
    */
-  void ShareTrainedLayersWith(const Net* other);
+  void WeightsChanged();
+  /// @brief Whether weights of other fit this net, i.e. both fold and fuse the same layers.
+  bool FoldsLike(const Net& other) const;
+  /**
+   * @brief Nets never running at the same time, like the test nets of a solver, put their
+   *        planned activations (see NetParameter::plan_activation_memory) to one arena
+   *        as big as the largest plan instead of one each.
+   */
+  static void ShareActivationArena(const vector<shared_ptr<Net>>& nets);
   // For an already initialized net, CopyTrainedLayersFrom() copies the already
   // trained layers from another net parameter instance.
   /**
@@ -119,10 +200,26 @@ class Net {
   void CopyTrainedLayersFrom(const string trained_filename);
   void CopyTrainedLayersFromBinaryProto(const string trained_filename);
   void CopyTrainedLayersFromHDF5(const string trained_filename);
+  /// @brief Copies weights from a memory mapped weight file (see WeightFile) in parallel.
+  void CopyTrainedLayersFromWeightFile(const string trained_filename);
+#ifndef CPU_ONLY
+  /// @brief Points params at weights another process exports (see ToIpcWeights), read only.
+  void CopyTrainedLayersFromIpc(const string& handle_file);
+#endif
   /// @brief Writes the net to a proto.
   void ToProto(NetParameter* param, bool write_diff = false) const;
   /// @brief Writes the net to an HDF5 file.
   void ToHDF5(const string& filename, bool write_diff = false) const;
+  /// @brief Same with params taken from copies, in params() order (see SnapshotWriter).
+  void ToHDF5(const string& filename, bool write_diff,
+      const vector<shared_ptr<Blob>>& params) const;
+  /// @brief Writes the weights to a weight file, CopyTrainedLayersFrom reads it.
+  void ToWeightFile(const string& filename) const;
+#ifndef CPU_ONLY
+  /// @brief Exports the weights to other processes on this GPU through CUDA IPC,
+  ///        the result is kept while they run. CopyTrainedLayersFrom attaches them.
+  shared_ptr<IpcWeights> ToIpcWeights(const string& handle_file) const;
+#endif
 
   /// @brief returns the network name.
   const string& name() const { return name_; }
@@ -182,6 +279,11 @@ class Net {
   const vector<shared_ptr<Blob>>& learnable_params() const {
     return learnable_params_;
   }
+  /// @brief Rows of learnable param param_id with gradients, nullptr if all have them
+  ///        (see LayerBase::sparse_rows). Params shared between layers have them all.
+  vector<int>* sparse_rows(int param_id) const {
+    return sparse_rows_[param_id];
+  }
   const vector<shared_ptr<Blob>>& learnable_params_mapped() const {
     return learnable_params_mapped_;
   }
@@ -200,6 +302,8 @@ class Net {
   /// @brief returns the learnable parameter learning rate multipliers
   const vector<float>& params_lr() const { return params_lr_; }
   const vector<bool>& has_params_lr() const { return has_params_lr_; }
+  /// @brief returns the learnable parameter lr_group names, empty if not set
+  const vector<string>& params_lr_group() const { return params_lr_group_; }
   /// @brief returns the learnable parameter decay multipliers
   const vector<float>& params_weight_decay() const {
     return params_weight_decay_;
@@ -207,6 +311,10 @@ class Net {
   const vector<bool>& has_params_decay() const {
     return has_params_decay_;
   }
+  /// @brief returns whether the learnable parameters are pruned to 2:4 sparsity
+  const vector<bool>& params_sparse_2_4() const {
+    return params_sparse_2_4_;
+  }
   const map<string, int>& param_names_index() const {
     return param_names_index_;
   }
@@ -240,6 +348,10 @@ class Net {
   const shared_ptr<LayerBase> layer_by_name(const string& layer_name) const;
 
   void set_debug_info(const bool value) { debug_info_ = value; }
+#ifndef CPU_ONLY
+  /// @brief NetParameter::blob_monitor, nullptr if not enabled.
+  BlobMonitor* blob_monitor() { return blob_monitor_.get(); }
+#endif
 
   // Helpers for Init.
   /**
@@ -248,6 +360,28 @@ class Net {
    */
   static void FilterNet(const NetParameter& param,
       NetParameter* param_filtered);
+  /**
+   * @brief NetParameter::fold_batch_norm: removes BatchNorm and Scale layers which can be
+   *        folded into the Convolution or InnerProduct layer they follow.
+   */
+  void FoldBatchNorm(NetParameter* param);
+  /// @brief NetParameter::fuse_inner_product_activation: removes ReLU layers which become
+  ///        the activation of the InnerProduct layer they follow.
+  void FuseInnerProductActivation(NetParameter* param) const;
+  /// @brief NetParameter::fuse_pointwise: merges runs of pointwise layers into
+  ///        Pointwise layers.
+  void FusePointwise(NetParameter* param);
+  /// @brief NetParameter::int8_calibration: sets calibrated layers' quantization_param.
+  void ApplyInt8Calibration(NetParameter* param) const;
+  /// @brief NetParameter::layout: marks layers writing NHWC tops and inserts Layout
+  ///        layers in front of the ones that can't read them.
+  void ApplyLayout(NetParameter* param) const;
+  /// @brief NetParameter::spatial_stripes: inserts Stripe layers after the data layers
+  ///        and Halo layers in front of the windowed layers reading stripes.
+  void PartitionSpatially(NetParameter* param) const;
+  /// @brief NetParameter::concat_views: sets share_storage of Concat and Slice layers
+  ///        whose bottoms and tops nothing else rewrites. Needs splits inserted.
+  void MarkStorageViews(NetParameter* param) const;
   /// @brief return whether NetState state meets NetStateRule rule
   static bool StateMeetsRule(const NetState& state, const NetStateRule& rule,
       const string& layer_name);
@@ -269,6 +403,13 @@ class Net {
 
 #ifndef CPU_ONLY
   void InitializeLearnableDiffSpace(int type_id);
+  // The larger learnable diff space, null if none. Until the first backward it may serve
+  // as scratch memory given it's zeroed after, see P2PSync::on_start.
+  void* largest_learnable_space(size_t* size) {
+    const int t = learnable_space_[1].size() > learnable_space_[0].size() ? 1 : 0;
+    *size = learnable_space_[t].size();
+    return learnable_space_[t].empty() ? nullptr : learnable_space_[t].data();
+  }
 #endif
 
   void wait_layers_init() {
@@ -280,11 +421,44 @@ class Net {
   float global_grad_scale() {
     return global_grad_scale_;
   }
+  // SolverParameter::dynamic_loss_scale, between iterations only
+  void set_global_grad_scale(float scale) {
+    global_grad_scale_ = scale;
+  }
 
   size_t infer_count() const {
     return infer_count_;
   }
 
+  /// @brief Host wall times and reduced bytes so far, see SolverParameter::metrics_interval
+  struct Timing {
+    uint64_t forward_us, backward_us, reduce_us, reduce_bytes, data_wait_us;
+  };
+  Timing timing() const;
+
+  /// @brief Work of all layers at their current shapes, activations summed, see layer_cost
+  LayerCost cost() const;
+
+  /// @brief Device memory of a blob, or of a layer's workspace when blob is empty.
+  /// Bytes cover every type the blob is converted to.
+  struct MemoryUse {
+    string layer, blob, kind;  // kind: "top", "param" or "workspace"
+    Type data_type, diff_type;
+    size_t data_bytes, diff_bytes;
+  };
+  /// @brief Device memory by layer: its tops not reported before (in-place ones go to the
+  /// layer producing them), its params and its workspace. Empty in CPU_ONLY builds.
+  vector<MemoryUse> MemoryReport() const;
+  /// @brief MemoryReport as a table with totals and the allocator's usage. Logged on
+  /// allocation failures, see GPUMemory::LogOOMReports.
+  string MemoryReportString() const;
+#ifndef CPU_ONLY
+  /// @brief Defragmentation, see GPUMemory::BeginDefragment: moves device memory of the
+  /// params, then of the other blobs, skipping tensors in visited. Captured CUDA graphs
+  /// are released if anything moved. Returns the number of bytes moved.
+  size_t RelocateBlobs(std::unordered_set<const Tensor*>* visited);
+#endif
+
   std::string print_current_device() const {
 #ifndef CPU_ONLY
     std::ostringstream os;
@@ -311,6 +485,95 @@ class Net {
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
 
+  /// @brief Buffers (groups of blobs sharing data), layer ranges using them and
+  /// buffers which must keep their content.
+  void ActivationLifetimes(vector<int>* group, vector<int>* first, vector<int>* last,
+      vector<bool>* pinned) const;
+  /// @brief Splits layers to segments, see NetParameter::recompute_activations.
+  void InitRecomputation(const NetParameter& param);
+  void ReleaseSegment(int segment);
+  void RecomputeSegment(int segment);
+  /// @brief Forward of the layers again, keeping their non-learnable blobs.
+  void Reforward(const vector<int>& layer_ids);
+  /// @brief Finds the lowest layer needing backward and frees diffs no backward
+  /// pass reads or writes.
+  void PruneBackward();
+  /// @brief Finds layers writing param gradients on the first micro-batch.
+  void InitOverwriteParamDiffs();
+  /// @brief Converts learnable weights updated in another type to forward types
+  /// of their layers, one batch of conversions per type instead of one per blob.
+  void ConvertLearnableParams();
+  /// @brief Gives the layer the param blobs of its trained_net_ namesake, if alike.
+  void TakeTrainedBlobs(int layer_id);
+#ifndef CPU_ONLY
+  /// @brief Schedules host offload, see NetParameter::offload_activations.
+  void InitOffload(const NetParameter& param);
+  /// @brief Starts offload of buffers last used by the layer, releases copied ones.
+  void OffloadAfter(int layer_id);
+  void ReleaseOffloaded(bool wait);
+  /// @brief Starts prefetch scheduled at the layer, makes its backward wait for its inputs.
+  void PrefetchBefore(int layer_id);
+  /// @brief NetParameter::stream_weights: checks it applies, the ring is made by
+  /// PrepareStreamedWeights on first forward when weights are loaded and converted.
+  void InitStreamWeights(const NetParameter& param);
+  void PrepareStreamedWeights();
+  /// @brief Copies the j-th streamed layer's weights to its ring buffer on the push stream.
+  void StreamWeights(int j);
+  /// @brief Points the layer's weights at its ring buffer once copied, back to host after.
+  void StreamWeightsBefore(int layer_id);
+  void StreamWeightsAfter(int layer_id, int end);
+  /// @brief Managed memory engine: migrates the layer's blobs to device ahead of use.
+  void PrefetchManaged(int layer_id, bool with_diff);
+  /// @brief Places activations with disjoint lifetimes to one arena,
+  /// see NetParameter::plan_activation_memory.
+  void PlanActivationMemory();
+  /// @brief Points planned activations to their offsets in the arena given.
+  void BindActivations(const shared_ptr<GPUMemory::Workspace>& arena);
+  /// @brief NetParameter::cuda_graph: full forward pass replaying captured layers.
+  void InitCudaGraph(const NetParameter& param);
+  float ForwardGraphed();
+  bool SelectGraphLayers();
+  bool ReplayGraph();
+  void ReleaseGraphs();
+  /// @brief NetParameter::setup_threads: runs setup_layer for every layer once the
+  /// layers producing its bottoms are done, on up to threads threads.
+  void SetUpLayersConcurrently(unsigned int threads, const vector<bool>& share_from_root,
+      const std::function<void(int)>& setup_layer);
+  /// @brief NetParameter::branch_streams: full passes running independent layers
+  /// concurrently.
+  void InitBranches(const NetParameter& param);
+  bool branches_ready() const;
+  DagExecutor* branch_executor();
+  /// @brief NetParameter::tensorrt: full forward pass running the converted segments,
+  /// whose engines are dropped when new weights are copied in.
+  void InitTensorRT(const NetParameter& param);
+  float ForwardTensorRT();
+  void ResetTensorRT();
+  float ForwardBranches();
+  void BackwardBranches(bool apply_update);
+  /// @brief NetParameter::blob_monitor: watches tops and learnable params.
+  void InitBlobMonitor(const NetParameter& param);
+  /// @brief NetParameter::pipeline_device: stage of every layer and their workers.
+  void InitPipeline(const NetParameter& param);
+  /// @brief Partitions layers to stages of balanced LayerProfile time.
+  vector<int> BalanceStages(const NetParameter& param, const LayerProfile& profile) const;
+  /// @brief Makes layer's bottoms produced by another stage read a local copy.
+  void ConnectStage(int layer_id, vector<Blob*>* holder, vector<int>* holder_stage);
+  /// @brief Stage inputs and params once all layers are set up.
+  void FinishPipeline(const vector<Blob*>& holder);
+  /// @brief Runs f on the stage's device, returns when it's done.
+  void RunOnStage(int stage, const std::function<void()>& f);
+  /// @brief Copies activations coming to the stage from earlier ones.
+  void PullActivations(int stage);
+  /// @brief Copies gradients of the stage's outputs from later stages.
+  void PullGradients(int stage);
+  float ForwardStages(int start, int end);
+  void BackwardStages(int start, int end, bool apply_update);
+  /// @brief Every stage updates its own parameters.
+  void ApplyStageUpdates();
+#endif
+  /// @brief Records that the layer's gradients are ready and wakes up the reduction.
+  void GradientsReady(int layer_id);
   /// @brief Helper for displaying debug info in Forward.
   void ForwardDebugInfo(const int layer_id);
   /// @brief Helper for displaying debug info in Backward.
@@ -319,10 +582,52 @@ class Net {
   void UpdateDebugInfo(const int param_id);
   /// @brief Multi-GPU reduction for a particular parameter.
 #ifndef CPU_ONLY
-  void Reduce(int type_id, int param_id);
+  /// Both start once the ready event has been reached on the backward stream.
+  void Reduce(int type_id, int param_id, cudaEvent_t ready);
+  /// Of the sparse_rows of a param, which become the rows of every solver.
+  void ReduceRows(int type_id, int param_id, cudaEvent_t ready);
   /// @brief Multi-GPU reduction for a particular bucket of parameters.
-  void ReduceBucket(int type_id, size_t count, Type bucket_type, void* bucket);
-  size_t received_contiguous_count(int type_id, const std::set<int>& au_ids, int& from);
+  void ReduceBucket(int type_id, size_t count, Type bucket_type, void* bucket,
+      cudaEvent_t ready);
+  // SolverParameter::shard_solver_state: reduces a bucket to the owners of its params,
+  // updates the owned ones and broadcasts them
+  void ShardedUpdate(int type_id, const vector<int>& param_ids, size_t count,
+      cudaEvent_t ready, bool clear_grads);
+  // SolverParameter::local_sgd_iters: averages parameters (and history) of a type
+  // across all solvers
+  void AverageParams(int type_id);
+  // NetParameter::reduce_buckets_tune_iters, called at the end of every iteration
+  void TuneBuckets(int type_id, int iterations_seen, unique_ptr<BucketTuner>& tuner,
+      size_t& bucket_size);
+  bool compressed_reduce(Type bucket_type) const;
+  void* fp16_bucket(int type_id, Type bucket_type, void* bucket) const;
+  // Returns the scale applied to the FLOAT16 copy of the bucket
+  float CompressBucket(int type_id, size_t count, Type bucket_type, void* bucket);
+  void DecompressBucket(int type_id, size_t count, Type bucket_type, void* bucket, float alpha);
+  // SolverParameter::fp32_grad_accumulation: adds the FLOAT16 param gradients of the layer
+  // to their FLOAT sums and zeroes them for the next micro-batch
+  void AccumulateGradients(int layer_id);
+  // Writes count FLOAT sums, times alpha, back to their FLOAT16 gradients
+  void StoreGradients(int type_id, const void* sum, size_t count, float alpha);
+  // Space gradients of the type are reduced in, FLOAT sums or the learnable space, and
+  // the FLOAT sum of a FLOAT16 gradient
+  void* reduce_space(int type_id) const;
+  size_t reduce_space_size(int type_id) const;
+  Type reduce_type(int type_id) const;
+  void* grad_sum(int type_id, void* diff) const;
+  // SolverParameter::overlap_next_forward, see GradLayer::updated. Called by the reduction
+  // thread of type_id with params whose updates were issued, all of them at the end of
+  // the iteration or on exit.
+  void UpdatesIssued(int type_id, const vector<int>& param_ids);
+  void AllUpdatesIssued(int type_id, int iter);
+  void WaitUpdated(int layer_id);
+  void BuildForwardGates();
+  // SolverParameter::comm_delay_probe_interval: true if reductions of iteration iter wait
+  // for the end of its backward
+  bool comm_probe_iter(int iter) const;
+  // Adds up the GPU time of the last timed backward, logs it against the overlapped ones
+  // after a probe
+  void ReadBackwardTime();
 #endif
 
   size_t lp_aligned_count(int id) const {
@@ -342,6 +647,8 @@ class Net {
   vector<string> layer_names_;
   map<string, int> layer_names_index_;
   vector<bool> layer_need_backward_;
+  /// @brief Backward passes stop at this layer, the ones below it are frozen
+  int backward_end_;
   /// @brief the blobs storing intermediate results between the layer.
   vector<shared_ptr<Blob> > blobs_;
   vector<string> blob_names_;
@@ -375,18 +682,61 @@ class Net {
   vector<shared_ptr<Blob>> params_;
   vector<shared_ptr<Blob>> learnable_params_;
   vector<shared_ptr<Blob>> learnable_params_mapped_;
+  vector<vector<int>*> sparse_rows_;
   vector<shared_ptr<TBlob<float>>> lars_learnable_params_;
   bool trained_layers_shared_;
+  /// Layers removed by FoldBatchNorm, by the name of the layer they were folded into
+  struct FoldedBN {
+    string bn, scale;
+    float eps;
+    bool scale_bias;
+    // The layer had no bias before folding
+    bool bias_added;
+  };
+  map<string, FoldedBN> folded_bn_;
+  void FoldBatchNormWeights(const NetParameter& param);
+  /// Pointwise layers made by FusePointwise, their blobs are copied from the layers
+  /// they were merged from
+  vector<string> fused_pointwise_;
+  void FusePointwiseWeights(const NetParameter& param);
 
   vector<int> learnable_types_;
   vector<void*> learnable_params_ptrs_[2];
 #ifndef CPU_ONLY
   GPUMemory::Workspace learnable_space_[2];
+  // SolverParameter::reduce_compression: FLOAT16 copies of buckets and error
+  // feedback residuals, both laid out like learnable_space_
+  GPUMemory::Workspace reduce_fp16_space_[2], reduce_residual_space_[2];
+  // SolverParameter::fp32_grad_accumulation: FLOAT sums of FLOAT16 gradients laid out like
+  // learnable_space_ (twice its size), empty when off
+  GPUMemory::Workspace grad_accum_space_[2];
+  // Sums start over with it
+  bool first_micro_batch_ = true;
 #endif
   size_t learnable_space_size_[2];
-  /// layer_id->{paramss}
-  std::map<size_t, std::set<int>> ltop_[2];
+  // Layers owning learnable params of a type, in learnable space order. Params of a
+  // layer are contiguous there. The reduction queue carries indices into this list,
+  // pushed once Backward of the layer has been issued.
+  struct GradLayer {
+    int layer_id;
+    vector<int> param_ids;  // ascending, the first one starts the layer's space
+    size_t count;  // aligned elements of all params
+#ifndef CPU_ONLY
+    cudaEvent_t ready;  // recorded on the backward stream
+#endif
+    double ready_us;  // reduce_buckets_tune_iters only
+#ifndef CPU_ONLY
+    // SolverParameter::overlap_next_forward: recorded on the reduction stream once the
+    // updates of all param_ids are issued, in iteration updated_iter - 1
+    cudaEvent_t updated;
+    int updated_iter;  // guarded by updated_mutex_
+    size_t pending;  // params left this iteration, reduction thread only
+#endif
+  };
+  vector<GradLayer> grad_layers_[2];
+  vector<int> grad_layer_slot_[2];  // layer_id -> index in grad_layers_, -1 if none
   size_t reduce_buckets_;
+  int reduce_buckets_tune_iters_;
 
   /**
    * The mapping from params_ -> learnable_params_: we have
@@ -399,9 +749,13 @@ class Net {
   /// the learning rate multipliers for learnable_params_
   vector<float> params_lr_;
   vector<bool> has_params_lr_;
+  /// ParamSpec::lr_group of learnable_params_
+  vector<string> params_lr_group_;
   /// the weight decay multipliers for learnable_params_
   vector<float> params_weight_decay_;
   vector<bool> has_params_decay_;
+  /// ParamSpec::sparse_2_4 of learnable_params_, set if any sharer sets it
+  vector<bool> params_sparse_2_4_;
   /// The bytes of memory __planned_to_be_used__ by this net
 #ifndef CPU_ONLY
   size_t gpu_top_memory_data_use_, gpu_top_memory_diff_use_;
@@ -409,12 +763,104 @@ class Net {
   size_t gpu_shr_memory_data_use_, gpu_shr_memory_diff_use_;
   size_t gpu_prm_memory_data_use_, gpu_prm_memory_diff_use_;
   size_t gpu_shp_memory_data_use_, gpu_shp_memory_diff_use_;
+  /// Planned activations, their offsets by blob id and the bytes they need
+  shared_ptr<GPUMemory::Workspace> activations_;
+  vector<pair<int, size_t>> activation_offsets_;
+  size_t activation_bytes_;
+  /// Host offload: buffers to pull after and to push before a layer, buffers
+  /// a layer's backward waits for, state and event of every buffer
+  enum OffloadState { OFFLOAD_RESIDENT, OFFLOAD_PULLING, OFFLOAD_ON_HOST, OFFLOAD_PUSHING };
+  bool offload_;
+  vector<vector<int>> offload_after_, prefetch_at_, wait_at_;
+  vector<OffloadState> offload_state_;
+  vector<cudaEvent_t> offload_events_;
+  vector<int> offload_pending_;
+  /// NetParameter::stream_weights: streamed layers in forward order, their index by layer
+  /// (-1 if not streamed), the ring of their buffers with events of copies done and of
+  /// layers done with a buffer, pinned host copies, weight file mapped instead of copied
+  struct StreamedLayer {
+    int layer_id;
+    vector<Blob*> blobs;
+    vector<void*> host;
+    vector<size_t> offsets, bytes;
+  };
+  bool stream_weights_;
+  bool stream_ready_;
+  int stream_buffers_;
+  vector<StreamedLayer> streamed_;
+  vector<int> streamed_index_;
+  shared_ptr<GPUMemory::Workspace> stream_ring_;
+  size_t stream_slot_bytes_;
+  vector<cudaEvent_t> stream_loaded_, stream_freed_;
+  void* stream_host_;
+  shared_ptr<WeightFile> stream_file_;
+  std::set<const Blob*> stream_mapped_;
+  /// NetParameter::cuda_graph: captured layers [graph_first_, graph_last_], blobs they
+  /// read but don't produce and their shapes at capture, blobs they produce,
+  /// one graph per distinct set of input buffers
+  struct ForwardGraph {
+    vector<const void*> inputs;
+#if CUDART_VERSION >= 10000
+    cudaGraphExec_t exec;
+#endif
+  };
+  bool cuda_graph_;
+  unsigned int graph_warmup_iters_;
+  size_t graph_warmup_until_;
+  int graph_first_, graph_last_;
+  vector<int> graph_inputs_, graph_outputs_;
+  vector<vector<int>> graph_input_shapes_;
+  vector<ForwardGraph> graphs_;
+  /// NetParameter::branch_streams: layers every layer waits for in forward and in
+  /// backward, layers staying on the calling thread
+  unsigned int branch_streams_;
+  bool branch_backward_;
+  vector<vector<int>> forward_deps_, backward_deps_;
+  vector<bool> branch_caller_only_;
+  shared_ptr<DagExecutor> branch_executor_;
+  /// NetParameter::tensorrt: segments of layers run as engines, the segment starting
+  /// at every layer (-1 if none)
+  vector<shared_ptr<TensorRTSegment>> trt_segments_;
+  vector<int> trt_segment_at_;
+  /// NetParameter::blob_monitor, sampled once per iteration
+  shared_ptr<BlobMonitor> blob_monitor_;
+  /// Weights attached through CUDA IPC, kept while params point at them
+  shared_ptr<IpcWeights> ipc_weights_;
+  /// NetParameter::pipeline_device: copies of blobs read by a later stage than their
+  /// writer's, stage inputs (copies and tops of layers without bottoms) and their
+  /// per micro-batch saves, learnable params of every stage
+  struct StageBoundary {
+    int blob_id;
+    Blob* src;
+    shared_ptr<Blob> dst;
+    int src_stage, dst_stage;
+  };
+  vector<StageBoundary> boundaries_;
+  vector<vector<Blob*>> stage_inputs_;
+  vector<vector<vector<shared_ptr<Blob>>>> stage_saved_;
+  vector<vector<int>> stage_params_;
+  vector<int> pipeline_devices_;
+  // Stages past the first, the first one runs on the calling thread
+  vector<shared_ptr<DeviceWorker>> stage_workers_;
 #endif
+  vector<int> stage_of_, stage_first_, stage_last_;
   unsigned int batch_per_solver_;
+  /// Activation recomputation: segment of every layer, segments' layer ranges,
+  /// buffers released after forward and layers producing them
+  bool recompute_;
+  vector<int> segment_of_, segment_first_, segment_last_;
+  vector<vector<int>> segment_blobs_, segment_layers_;
+  vector<bool> segment_released_;
+  /// Layers that can_overwrite_param_diffs, run backward and are the only users of
+  /// their blobs (shared ones add gradients of several layers)
+  vector<int> overwrite_layers_;
+  bool all_param_diffs_overwritten_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
   /// The root net that actually holds the shared layers in data parallelism
   const Net* const root_net_;
+  /// The net whose param blobs layers get before set up, if any
+  const Net* const trained_net_;
   /// Pointer to the solver being used with this net
   Solver* solver_;
   size_t solver_rank_;
@@ -426,9 +872,35 @@ class Net {
 
   size_t infer_count_;
   float global_grad_scale_;
+  // Timing counters, reductions add theirs from the reduction threads
+  std::atomic<uint64_t> forward_us_{0UL}, backward_us_{0UL};
+  std::atomic<uint64_t> reduce_us_{0UL}, reduce_bytes_{0UL};
+  // SolverParameter::overlap_next_forward: loss of the forward run ahead, if any
+  bool forward_gated_ = false, forward_done_ahead_ = false;
+  float ahead_loss_ = 0.F;
+  // SolverParameter::device_loss: device memory losses are added to, see set_loss_slot
+  float* loss_slot_ = nullptr;
+#ifndef CPU_ONLY
+  // layer_id -> {type_id, slot} of the GradLayers owning params it uses
+  vector<vector<std::pair<int, int>>> forward_gates_;
+  vector<int> param_slot_[2];  // learnable param_id -> slot in grad_layers_, -1 if none
+  std::mutex updated_mutex_;
+  std::condition_variable updated_cv_;
+  // SolverParameter::comm_delay_probe_interval: events around the last timed backward,
+  // pending if 0 (overlapped) or 1 (probe), and overlapped ones since the last probe
+  cudaEvent_t backward_events_[2] = {nullptr, nullptr};
+  int backward_timed_ = -1;
+  double overlapped_backward_ms_ = 0.;
+  int overlapped_backwards_ = 0;
+#endif
 
   static constexpr int END_OF_ITERATION = -1;
   static constexpr int END_OF_TRAIN = -2;
+  static constexpr int MAX_TUNED_BUCKETS = 32;
+  // Input buffer sets captured per net, data layers cycle through their prefetch queue
+  static constexpr int MAX_FORWARD_GRAPHS = 8;
+  // Serial passes letting cuDNN settle its algorithms and workspace
+  static constexpr size_t BRANCH_WARMUP_ITERS = 4UL;
 
   DISABLE_COPY_MOVE_AND_ASSIGN(Net);
 };
@@ -4,6 +4,7 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/thread.hpp>
 
+#include <chrono>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -14,6 +15,8 @@
 #include "caffe/solver.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/rendezvous.hpp"
+#include "caffe/util/spin_barrier.hpp"
 
 #ifdef USE_NCCL
 #include "caffe/util/nccl.hpp"
@@ -21,73 +24,77 @@
 
 namespace caffe {
 
-// Scores Holder
-template<typename Dtype>
-struct SharedScores {
-  explicit SharedScores(size_t nranks) : memory_(nranks) {
-    for (size_t i = 0; i < nranks; ++i) {
-      memory_[i].resize(MAX_SCORES);
-    }
-  }
-  vector<Dtype>& rank_scores(size_t rank) {
-    CHECK_LT(rank, memory_.size());
-    return memory_[rank];
-  }
-
- private:
-  vector<vector<Dtype>> memory_;
-  static constexpr size_t MAX_SCORES = 1000;
-};
-
-template<typename Dtype>
-constexpr size_t SharedScores<Dtype>::MAX_SCORES;
-
 class P2PSync;
 
 class P2PManager {
+  friend class P2PSync;
  public:
-  P2PManager(shared_ptr<Solver> root_solver, int nranks, const SolverParameter& param);
+  // nranks is the number of local GPUs. In multi-node mode (Caffe::node_count() > 1)
+  // master is the "host:port" of node 0 used for rendezvous.
+  P2PManager(shared_ptr<Solver> root_solver, int nranks, const SolverParameter& param,
+      const std::string& master = std::string());
 
   void Run(const vector<int>& gpus);
   void EarlyCancel(P2PSync* killed);
 
-  static void dl_bar_wait() {
+  // nullptr unless running on multiple nodes
+  Rendezvous* rendezvous() const {
+    return rendezvous_.get();
+  }
+
+  // rank is for the barrier statistics only, see SpinBarrier
+  static void dl_bar_wait(int rank = -1) {
     CHECK(dl_bar);
-    dl_bar->wait();
+    dl_bar->wait(rank);
   }
-  static void bar_wait() {
+  static void bar_wait(int rank = -1) {
     CHECK(bar);
-    bar->wait();
+    bar->wait(rank);
   }
-  static void rbar_wait(int type_id) {
+  static void rbar_wait(int type_id, int rank = -1) {
     if (type_id == 0) {
       CHECK(rbar0);
-      rbar0->wait();
+      rbar0->wait(rank);
     } else {
       CHECK(rbar1);
-      rbar1->wait();
+      rbar1->wait(rank);
     }
   }
+  // Logs wait times of the barriers above
+  static void report_barriers();
+  // Seconds since Run started
+  double elapsed_s() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+  }
+  // Logs when each rank had its solver and its NCCL communicators ready
+  void report_startup() const;
 
  protected:
   const size_t nranks_;
   vector<unique_ptr<P2PSync>> syncs_;
-  shared_ptr<SharedScores<float>> shared_;
   shared_ptr<Solver> root_solver_;
+  unique_ptr<Rendezvous> rendezvous_;
+  std::chrono::steady_clock::time_point start_;
 
-  static unique_ptr<boost::barrier> dl_bar;  // DataLayer sync helper
-  static unique_ptr<boost::barrier> bar;
-  static unique_ptr<boost::barrier> rbar0;
-  static unique_ptr<boost::barrier> rbar1;
+  static unique_ptr<SpinBarrier> dl_bar;  // DataLayer sync helper
+  static unique_ptr<SpinBarrier> bar;
+  static unique_ptr<SpinBarrier> rbar0;
+  static unique_ptr<SpinBarrier> rbar1;
 
 #ifndef CPU_ONLY
 #ifdef USE_NCCL
   ncclUniqueId nccl_id_[2];
+  // Hierarchical allreduce: local GPUs of this node, and [type_id * nranks_ + local rank]
+  // for the GPUs of the same local rank on every node
+  ncclUniqueId nccl_local_id_[2];
+  vector<ncclUniqueId> nccl_node_ids_;
+  // P2PSync::allreduce_stats
+  ncclUniqueId nccl_stats_id_;
 #endif
 #endif
 };
 
-// Synchronous data parallelism using map-reduce between local GPUs.
+// Synchronous data parallelism using map-reduce between GPUs of one or more nodes.
 class P2PSync : public Solver::Callback, public InternalThread {
   friend class P2PManager;
  public:
@@ -100,15 +107,31 @@ class P2PSync : public Solver::Callback, public InternalThread {
 
   void allreduce(int type_id, int param_id) override;
   void allreduce_bucket(int type_id, size_t count, void* bucket, Type type) override;
+  void allreduce_rows(int type_id, int param_id, vector<int>* rows) override;
+  void reduce_to_owners(int type_id, const vector<int>& param_ids) override;
+  void broadcast_from_owners(int type_id, const vector<int>& param_ids) override;
   void soft_barrier() override;
   void reduce_barrier(int type_id) override;
-  void saveTestResults(float loss, const vector<float>& scores) override;
-  void aggregateTestResults(float* loss, vector<float>* scores) override;
+  float allreduce_max(int type_id, float value) override;
+  bool any_node_stop(bool local_stop) override;
+  int stripe_index(int stripes) const override {
+    return global_rank_ % stripes;
+  }
 
 #ifndef CPU_ONLY
   cublasHandle_t cublas_handle() const override {
     return cublas_handle_->get();
   }
+  cudaStream_t comm_stream(int type_id) const override {
+    return (urgent_[type_id] ? comm_stream_ : normal_stream_)[type_id]->get();
+  }
+  void set_comm_urgent(int type_id, bool urgent) override {
+    urgent_[type_id] = urgent || hierarchical_;
+  }
+  void allreduce_stats(void* x, size_t count, Type type, cudaStream_t stream) override;
+  void stripe_broadcast(void* x, size_t bytes, int stripes, cudaStream_t stream) override;
+  void halo_exchange(const void* up, const void* down, void* from_up, void* from_down,
+      size_t bytes, int stripes, cudaStream_t stream) override;
 #endif
 
  protected:
@@ -116,23 +139,43 @@ class P2PSync : public Solver::Callback, public InternalThread {
 #ifndef CPU_ONLY
 #ifdef USE_NCCL
   ncclComm_t nccl_comm_[2];
+  ncclComm_t local_comm_[2], node_comm_[2];
+  // allreduce_stats and the spatial_stripes exchanges, issued by the solver thread
+  // while reductions use nccl_comm_. Created at the first call.
+  ncclComm_t stats_comm_;
+  bool stats_comm_init_;
+  ncclComm_t stats_comm();
+  // Reduce-scatter done and inter-node allreduce done, one pair per piece
+  vector<cudaEvent_t> scattered_[2], reduced_[2];
+
+  void hierarchical_allreduce(int type_id, size_t count, void* bucket, Type type);
 #endif
 #endif
   void InternalThreadEntry() override;
+  std::string thread_name() const override {
+    return "solver";
+  }
 
   P2PManager* mgr_;
-  const int rank_;
+  const int rank_;  // local to this node
   const size_t nranks_;
+  const int global_rank_;
+  // SolverParameter::hierarchical_allreduce on multiple nodes
+  const bool hierarchical_;
 #ifndef CPU_ONLY
-  shared_ptr<CudaStream> comm_stream_[2], stream_;
+  shared_ptr<CudaStream> comm_stream_[2], node_stream_[2], stream_;
+  // SolverParameter::comm_priority_fraction: normal priority streams of later buckets
+  shared_ptr<CudaStream> normal_stream_[2];
+  bool urgent_[2];
+  GPUMemory::Workspace scalar_[2];  // allreduce_max
+  GPUMemory::Workspace rows_[2], packed_rows_[2];  // allreduce_rows
   shared_ptr<CuBLASHandle> cublas_handle_;
 #endif
   const int initial_iter_;
   shared_ptr<Solver> solver_, root_solver_;
   SolverParameter solver_param_;
-
-  // memory shared between threads
-  shared_ptr<SharedScores<float>> shared_;
+  // P2PManager::elapsed_s when the solver was created, when the communicators were
+  double solver_ready_s_, comms_ready_s_;
 };
 
 }  // namespace caffe
@@ -0,0 +1,94 @@
+#ifndef CAFFE_REQUEST_BATCHER_HPP_
+#define CAFFE_REQUEST_BATCHER_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/inference_engine.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Coalesces single sample requests into batches run by an InferenceEngine.
+ *
+ * A batch is dispatched once it holds max_batch requests or its oldest request waited
+ * for max_latency_us. It runs at the smallest of the engine's batch sizes fitting it,
+ * padded with zeros, so contexts created for that size take it without reshaping.
+ * Outputs are scattered back to the requests they belong to.
+ */
+class RequestBatcher {
+ public:
+  struct Stats {
+    size_t requests;
+    size_t batches;
+    // Since construction
+    double requests_per_second;
+    double mean_batch;
+    // Over the last LATENCY_WINDOW requests, from Infer call to its return
+    double p50_latency_us;
+    double p99_latency_us;
+  };
+
+  RequestBatcher(InferenceEngine* engine, int max_batch, int max_latency_us);
+  ~RequestBatcher();
+
+  /**
+   * @brief Thread safe, returns when outputs are filled.
+   * @param inputs in engine's input_names() order, each of batch size 1
+   * @param outputs in engine's output_names() order, reshaped to batch size 1
+   */
+  void Infer(const vector<Blob*>& inputs, const vector<Blob*>& outputs);
+
+  Stats stats() const;
+
+  static constexpr size_t LATENCY_WINDOW = 10000UL;
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Request {
+    const vector<Blob*>* inputs;
+    const vector<Blob*>* outputs;
+    Clock::time_point arrival;
+    std::promise<void> done;
+  };
+  // Kept for reuse, so blobs of a batch size are allocated once
+  struct Batch {
+    vector<Request*> requests;
+    vector<shared_ptr<TBlob<float>>> inputs, outputs;
+  };
+
+  void BatcherEntry();
+  void Dispatch(vector<Request*>* requests);
+  void Scatter(Batch* batch);
+  int batch_size(int requests) const;
+
+  InferenceEngine* engine_;
+  const size_t max_batch_;
+  const std::chrono::microseconds max_latency_;
+  std::thread batcher_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_, idle_cv_;
+  std::deque<Request*> pending_;
+  vector<Batch*> free_batches_;
+  int in_flight_;
+  bool stop_;
+  // Counters, guarded by mutex_
+  const Clock::time_point start_;
+  size_t requests_, batches_;
+  vector<float> latencies_us_;
+  size_t next_latency_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(RequestBatcher);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_REQUEST_BATCHER_HPP_
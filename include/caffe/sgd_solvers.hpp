@@ -1,11 +1,56 @@
 #ifndef CAFFE_SGD_SOLVERS_HPP_
 #define CAFFE_SGD_SOLVERS_HPP_
 
+#include <boost/thread/barrier.hpp>
+
 #include "caffe/common.hpp"
 #include "caffe/solver.hpp"
 
 namespace caffe {
 
+#ifndef CPU_ONLY
+// Sizes, gradients and weights of parameters given to multi-tensor update kernels.
+// SolverParameter::master_weights: params having a master copy are updated there and
+// their FLOAT16 data goes to model, nullptr for the others. Nothing is converted.
+template<typename Gtype, typename Wtype>
+void multi_tensor_params(const vector<shared_ptr<Blob>>& params, const vector<int>& param_ids,
+    vector<int>* n, vector<Gtype*>* g, vector<Wtype*>* w,
+    const vector<Wtype*>* master = nullptr, vector<float16*>* model = nullptr) {
+  for (int param_id : param_ids) {
+    n->push_back(params[param_id]->count());
+    g->push_back(params[param_id]->template mutable_gpu_diff<Gtype>());
+    Wtype* master_w = master != nullptr ? master->at(param_id) : nullptr;
+    if (master_w != nullptr) {
+      w->push_back(master_w);
+      model->push_back(params[param_id]->template mutable_gpu_data<float16>());
+    } else {
+      w->push_back(params[param_id]->template mutable_gpu_data<Wtype>());
+      if (model != nullptr) {
+        model->push_back(nullptr);
+      }
+    }
+  }
+}
+
+// Their history, offset selects the slot of solvers keeping several of them
+template<typename Htype>
+void multi_tensor_history(const vector<shared_ptr<TBlob<Htype>>>& history,
+    const vector<int>& param_ids, size_t offset, vector<Htype*>* h) {
+  for (int param_id : param_ids) {
+    h->push_back(history[param_id + offset]->mutable_gpu_data());
+  }
+}
+
+// Same for history kept in Htype by untyped blobs (history_data_type)
+template<typename Htype>
+void multi_tensor_history(const vector<shared_ptr<Blob>>& history,
+    const vector<int>& param_ids, size_t offset, vector<Htype*>* h) {
+  for (int param_id : param_ids) {
+    h->push_back(history[param_id + offset]->template mutable_gpu_data<Htype>());
+  }
+}
+#endif
+
 /**
  * @brief Optimizes the parameters of a Net using
  *        stochastic gradient descent (SGD) with momentum.
@@ -23,36 +68,140 @@ class SGDSolver : public Solver {
       : Solver(param_file, rank) {
     PreSolve();
   }
-  ~SGDSolver() {}
+  ~SGDSolver();
 
   const char* type() const override { return "SGD"; }
   const vector<shared_ptr<TBlob<Dtype> > >& history() { return history_; }
+  vector<Blob*> history_blobs(int param_id) override;
+  vector<Blob*> weights_ema() override;
   void PrintRate(float rate = 0) override;
+  float learning_rate() override {
+    return GetLearningRate();
+  }
+  void PublishMasterWeights() override;
 
  protected:
   void PreSolve();
+  void UpdateSchedule() override;
+  // Rate and momentum of the current iteration, see UpdateSchedule
   float GetLearningRate();
   float GetMomentum();
+  // Rate of param_id before its lr_mult: the one of its lr_group, rate if none
+  float GroupRate(int param_id, float rate) const {
+    const int g = param_groups_[param_id];
+    return g < 0 ? rate : group_rates_[g];
+  }
   float GetLocalRate(int param_id) const;
   float local_decay(int param_id) const;
 
   void ApplyUpdate(int param_id, void* handle, bool clear_grads) override;
+  void ApplyUpdates(const vector<int>& param_ids, void* handle, bool clear_grads,
+      float grad_scale) override;
+  // Fused update of several parameters by one kernel launch per type,
+  // returns false if the solver doesn't implement it. Gradients are also multiplied
+  // by *clip_scale (device memory) unless it's nullptr.
+  virtual bool MultiTensorUpdate(const vector<int>& param_ids, void* handle, float rate,
+      float grad_scale, const float* clip_scale, bool clear_grads);
+  // Lazy update of the given rows of a param (see EmbedParameter::sparse_gradient),
+  // clearing them. Returns false if the solver doesn't implement it.
+  virtual bool SparseUpdate(int param_id, vector<int>* rows, void* handle, float rate,
+      float grad_scale, bool clear_grads);
   virtual void Normalize(int param_id, void* handle);
   virtual void Regularize(int param_id, void* handle);
   virtual void ComputeUpdateValue(int param_id, void* handle, float rate, bool clear_grads);
-  virtual void ClipGradients(void* handle = nullptr);
+  // GPU: sum of squares of the gradients of one learnable type into the device buffer
+  // returned, the sums of all types are there once it returns (see types_barrier_)
+  float* GradientsSumsq(const vector<int>& param_ids, void* handle, int* type_id);
+  // SolverParameter::dynamic_loss_scale: whether these gradients have inf or NaN
+  bool GradientsOverflow(const vector<int>& param_ids, const float* sumsq, void* handle);
+  // SolverParameter::clip_gradients: one L2 norm over the gradients of all learnable
+  // params (grad_scale applied) per iteration. On GPU returns the device side factor
+  // to scale them by, made from the GradientsSumsq sums, nothing is read back.
+  // On CPU scales them and returns nullptr.
+  const float* ClipGradients(const vector<int>& param_ids, float grad_scale, float* sumsq,
+      int type_id, void* handle);
   virtual void SnapshotSolverState(const string& model_filename);
   virtual void SnapshotSolverStateToBinaryProto(const string& model_filename);
   virtual void SnapshotSolverStateToHDF5(const string& model_filename);
   virtual void RestoreSolverStateFromHDF5(const string& state_file);
   virtual void RestoreSolverStateFromBinaryProto(const string& state_file);
+  // SolverParameter::SHARDED, see SnapshotManifest
+  void SnapshotSolverStateSharded();
+  virtual void RestoreSolverStateFromShards(const string& dir);
+  // Shard keeping the weights and history of the param in SHARDED snapshots
+  int snapshot_shard(int param_id) const;
   void PrintParams(int param_id);
+  // shard_solver_state: history of other solvers' params is never allocated
+  bool owns_history(int history_id) const;
+  // SolverParameter::master_weights: copies current weights of these params into their
+  // master slots unless done since PreSolve or the last restore
+  void InitMasterWeights(const vector<int>& param_ids);
+  // Master copy per param for multi_tensor_params, nullptr without master_weights
+  const vector<Dtype*>* master_weights() const {
+    return master_.empty() ? nullptr : &master_;
+  }
+  // SolverParameter::weights_ema_decay: blends the updated weights of these params into
+  // their averages, or starts them
+  void UpdateWeightsEma(const vector<int>& param_ids, void* handle);
+  // ParamSpec::sparse_2_4: chooses the masks of these params when due and zeroes the
+  // weights they drop, called after the update
+  void Prune(const vector<int>& param_ids, void* handle);
+  // SolverParameter::history_data_type FLOAT16: moves the history to history_half_.
+  // Called by the solvers supporting it once all their entries are in history_.
+  void HalfHistoryPreSolve();
+  bool half_history() const {
+    return !history_half_.empty();
+  }
+  // Entry i of whichever of history_ and history_half_ is used
+  size_t history_size() const {
+    return half_history() ? history_half_.size() : history_.size();
+  }
+  Blob* history_blob(size_t i) const {
+    return half_history() ? history_half_[i].get() : history_[i].get();
+  }
 
   // history maintains the historical momentum data.
   // update maintains update related data and is not needed in snapshots.
   // temp maintains other information that might be needed in computation
   //   of gradients/updates and is not needed in snapshots
   vector<shared_ptr<TBlob<Dtype> > > history_, update_, temp_;
+  // history_data_type FLOAT16: same entries as FLOAT16 blobs, history_ is left empty then
+  vector<shared_ptr<Blob>> history_half_;
+  // Rows given to SparseUpdate on the GPU, nullptr for params without sparse_rows
+  vector<shared_ptr<TBlob<int>>> sparse_rows_;
+  // GradientsSumsq: sums of squares then clipping factors, one per learnable type, in
+  // two halves used by alternate iterations. With two types both reduction threads meet
+  // at types_barrier_ to combine their sums.
+  vector<int> sumsq_types_;
+  shared_ptr<TBlob<float>> grad_sumsq_;
+  // local_lr_auto: norms and local rates of a MultiTensorUpdate type group each
+  vector<shared_ptr<TBlob<float>>> lars_;
+  unique_ptr<boost::barrier> types_barrier_;
+#ifndef CPU_ONLY
+  cudaEvent_t sumsq_ready_[2];
+#endif
+  // SolverParameter::master_weights: Dtype copies of FLOAT16 weights, contiguous in
+  // master_data_, nullptr for params updated in place. Reduction threads init disjoint
+  // params, hence char flags.
+  shared_ptr<TBlob<Dtype>> master_data_;
+  vector<Dtype*> master_;
+  vector<char> master_ready_;
+  // SolverParameter::weights_ema_decay, root solvers only. Flags as for master_ready_.
+  vector<shared_ptr<TBlob<Dtype>>> ema_;
+  vector<char> ema_ready_;
+  // ParamSpec::sparse_2_4 masks by learnable param, nullptr for those not pruned, and the
+  // iteration each was chosen at, -1 if not yet. Set by the reduction threads as above.
+  vector<shared_ptr<TBlob<unsigned int>>> sparse_masks_;
+  vector<int> sparse_mask_iter_;
+  // UpdateSchedule results and their iteration, -1 if none
+  int schedule_iter_;
+  float rate_, momentum_;
+  // SolverParameter::lr_group schedules, their steps and rates, group by learnable
+  // param (-1 for the solver's schedule)
+  vector<SolverParameter> groups_;
+  vector<int> group_steps_;
+  vector<float> group_rates_;
+  vector<int> param_groups_;
 
   DISABLE_COPY_MOVE_AND_ASSIGN(SGDSolver);
 };
@@ -70,6 +219,11 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   void ComputeUpdateValue(int param_id, void* handle, float rate, bool clear_grads) override;
+  bool MultiTensorUpdate(const vector<int>& param_ids, void* handle, float rate,
+      float grad_scale, const float* clip_scale, bool clear_grads) override;
+  bool SparseUpdate(int, vector<int>*, void*, float, float, bool) override {
+    return false;
+  }
 
   DISABLE_COPY_MOVE_AND_ASSIGN(NesterovSolver);
 };
@@ -89,6 +243,12 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   void ComputeUpdateValue(int param_id, void* handle, float rate, bool clear_grads) override;
+  bool MultiTensorUpdate(const vector<int>&, void*, float, float, const float*, bool) override {
+    return false;
+  }
+  bool SparseUpdate(int, vector<int>*, void*, float, float, bool) override {
+    return false;
+  }
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
@@ -103,16 +263,26 @@ class RMSPropSolver : public SGDSolver<Dtype> {
  public:
   explicit RMSPropSolver(const SolverParameter& param,
       size_t rank = 0U, Solver *root_solver = NULL)
-      : SGDSolver<Dtype>(param, rank, root_solver)
-        { constructor_sanity_check(); }
+      : SGDSolver<Dtype>(param, rank, root_solver) {
+    constructor_sanity_check();
+    this->HalfHistoryPreSolve();
+  }
   explicit RMSPropSolver(const string& param_file,
       size_t rank = 0U, Solver *root_solver = NULL)
-      : SGDSolver<Dtype>(param_file, rank, root_solver)
-        { constructor_sanity_check(); }
+      : SGDSolver<Dtype>(param_file, rank, root_solver) {
+    constructor_sanity_check();
+    this->HalfHistoryPreSolve();
+  }
   virtual inline const char* type() const { return "RMSProp"; }
 
  protected:
   void ComputeUpdateValue(int param_id, void* handle, float rate, bool clear_grads) override;
+  bool MultiTensorUpdate(const vector<int>&, void*, float, float, const float*, bool) override {
+    return false;
+  }
+  bool SparseUpdate(int, vector<int>*, void*, float, float, bool) override {
+    return false;
+  }
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with RMSProp.";
@@ -139,6 +309,12 @@ class AdaDeltaSolver : public SGDSolver<Dtype> {
  protected:
   void AdaDeltaPreSolve();
   void ComputeUpdateValue(int param_id, void* handle, float rate, bool clear_grads) override;
+  bool MultiTensorUpdate(const vector<int>&, void*, float, float, const float*, bool) override {
+    return false;
+  }
+  bool SparseUpdate(int, vector<int>*, void*, float, float, bool) override {
+    return false;
+  }
 
   DISABLE_COPY_MOVE_AND_ASSIGN(AdaDeltaSolver);
 };
@@ -165,6 +341,11 @@ class AdamSolver : public SGDSolver<Dtype> {
  protected:
   void AdamPreSolve();
   void ComputeUpdateValue(int param_id, void* handle, float rate, bool clear_grads) override;
+  bool MultiTensorUpdate(const vector<int>& param_ids, void* handle, float rate,
+      float grad_scale, const float* clip_scale, bool clear_grads) override;
+  bool SparseUpdate(int, vector<int>*, void*, float, float, bool) override {
+    return false;
+  }
 
   DISABLE_COPY_MOVE_AND_ASSIGN(AdamSolver);
 };
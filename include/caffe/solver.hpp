@@ -9,6 +9,8 @@
 #include "caffe/net.hpp"
 #include "caffe/solver_factory.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/metrics_exporter.hpp"
+#include "caffe/util/snapshot_writer.hpp"
 
 namespace caffe {
 
@@ -75,6 +77,21 @@ class Solver {
   int relative_iter() const { return iter_ - iterations_restored_; }
   float total_lapse() const { return total_lapse_; }
   bool is_root() const { return rank_ == 0; }
+  // Rank across all nodes, used for data sharding
+  size_t global_rank() const { return Caffe::solver_rank_offset() + rank_; }
+  // SolverParameter::shard_solver_state: every learnable param has one owning solver
+  // keeping its history and updating it
+  bool sharded() const { return !shard_owners_.empty(); }
+  int shard_owner(int param_id) const { return shard_owners_[param_id]; }
+  bool owns_param(int param_id) const {
+    return shard_owners_.empty() || shard_owners_[param_id] == global_rank();
+  }
+  // SolverParameter::SHARDED: every solver snapshots its part
+  bool snapshot_sharded() const;
+  // Whether path is the directory of a SHARDED snapshot
+  static bool IsShardedSnapshot(const string& path);
+  // Solver state file passed to Restore, empty if none
+  const string& restored_state_file() const { return restored_state_file_; }
   float perf_report(std::ostream& os, int device, int align = 0) const;
 
   // Invoked at specific points during an iteration
@@ -82,13 +99,46 @@ class Solver {
    public:
     virtual void allreduce(int type_id, int param_id) = 0;
     virtual void allreduce_bucket(int type_id, size_t count, void* bucket, Type type) = 0;
+    // Sums the given rows of a param's gradient, sorted, which become the union of
+    // every solver's rows
+    virtual void allreduce_rows(int type_id, int param_id, vector<int>* rows) = 0;
+    // shard_solver_state: gradients are summed on the owner only, which then sends
+    // the updated weights to everyone
+    virtual void reduce_to_owners(int type_id, const vector<int>& param_ids) = 0;
+    virtual void broadcast_from_owners(int type_id, const vector<int>& param_ids) = 0;
     virtual void soft_barrier() = 0;
     virtual void reduce_barrier(int type_id) = 0;
-    virtual void saveTestResults(float loss, const vector<float>& scores) = 0;
-    virtual void aggregateTestResults(float* loss, vector<float>* scores) = 0;
+    // Largest of the values passed by every solver
+    virtual float allreduce_max(int type_id, float value) {
+      return value;
+    }
+    // Multi-node: true if a stop was requested on any node
+    virtual bool any_node_stop(bool local_stop) {
+      return local_stop;
+    }
+    // NetParameter::spatial_stripes: position of this solver in its group of stripes
+    virtual int stripe_index(int stripes) const {
+      return 0;
+    }
 
 #ifndef CPU_ONLY
     virtual cublasHandle_t cublas_handle() const = 0;
+    // Stream allreduce/allreduce_bucket run on
+    virtual cudaStream_t comm_stream(int type_id) const = 0;
+    // Selects the high (urgent) or normal priority comm_stream for what follows,
+    // see SolverParameter::comm_priority_fraction
+    virtual void set_comm_urgent(int type_id, bool urgent) {}
+    // Sums count values at x of every solver in place, queued on stream without waiting
+    // for them. Every solver makes the same calls in the same order (BatchNorm sync_stats,
+    // test scores at the end of Solver::Test).
+    virtual void allreduce_stats(void* x, size_t count, Type type, cudaStream_t stream) {}
+    // NetParameter::spatial_stripes, queued on stream as allreduce_stats. Copies the
+    // bytes at x of the first solver of the group to the others.
+    virtual void stripe_broadcast(void* x, size_t bytes, int stripes, cudaStream_t stream) {}
+    // Sends the bytes at up to the solver of the stripe above and at down to the one
+    // below, receiving theirs at from_up and from_down. Nothing past the ends of the group.
+    virtual void halo_exchange(const void* up, const void* down, void* from_up,
+        void* from_down, size_t bytes, int stripes, cudaStream_t stream) {}
 #endif
 
    protected:
@@ -102,9 +152,6 @@ class Solver {
   void set_callback(Callback* value) {
     callback_ = value;
   }
-  void root_add_callback(Callback* value) {
-    root_callbacks_.push_back(value);
-  }
 
   Flag iter_flag_[2];
 
@@ -144,19 +191,78 @@ class Solver {
    */
   virtual const char* type() const { return ""; }
   virtual void PrintRate(float rate = 0) {}
+  // Evaluates the learning rate schedule of the current iteration
+  virtual void UpdateSchedule() {}
   virtual void ApplyUpdate(int param_id, void* handle, bool clear_grads) = 0;
+  // Updates a group of parameters (see SolverParameter::multi_tensor_update),
+  // their gradients are scaled by grad_scale first
+  virtual void ApplyUpdates(const vector<int>& param_ids, void* handle, bool clear_grads,
+      float grad_scale);
+  // Solver state kept per parameter (momentum etc.), see local_sgd_average_history
+  virtual vector<Blob*> history_blobs(int param_id) {
+    return vector<Blob*>();
+  }
+  // Learning rate of the current iteration
+  virtual float learning_rate() {
+    return 0.F;
+  }
+  // SolverParameter::master_weights: writes the master copies into the net's params,
+  // e.g. before they are saved. They're converted back on the next forward pass.
+  virtual void PublishMasterWeights() {}
+  // SolverParameter::weights_ema_decay: the averaged weights by learnable param, the
+  // param itself where not started yet. Empty without.
+  virtual vector<Blob*> weights_ema() {
+    return vector<Blob*>();
+  }
+  // Latest SolverParameter::metrics_interval sample of the root solver
+  const MetricsSample& last_metrics() const {
+    return last_metrics_;
+  }
 
  protected:
   string SnapshotFilename(const string extension);
-  string SnapshotToBinaryProto();
-  string SnapshotToHDF5();
+  // Sharded solver state: solvers other than global rank 0 add ".shard<rank>"
+  string ShardFilename(const string& filename) const;
+  void InitShards();
+  // tag goes before the extension, e.g. ".ema"
+  string SnapshotToBinaryProto(const string& tag = string());
+  string SnapshotToHDF5(const string& tag = string());
+  // Model snapshot with the averaged weights in place of the net's, put back after
+  void SnapshotWeightsEma(const vector<Blob*>& ema);
   // The test routine
   bool TestAll(const int iters = 0, bool use_multi_gpu = false);
   bool Test(const int test_net_id = 0, const int iters = 0, bool use_multi_gpu = false);
+  // Copies current weights to the test nets and tests them on another thread
+  void TestAllAsync();
+  void WaitAsyncTest();
+  void AsyncTestEntry(int device, Caffe::Brew mode);
   virtual void SnapshotSolverState(const string& model_filename) = 0;
   virtual void RestoreSolverStateFromHDF5(const string& state_file) = 0;
   virtual void RestoreSolverStateFromBinaryProto(const string& state_file) = 0;
+  // Run by every solver, the root one restoring the weights
+  virtual void RestoreSolverStateFromShards(const string& dir) = 0;
   void UpdateSmoothedLoss(float loss, int start_iter, int average_loss);
+  // SolverParameter::device_loss: whether the train net's losses stay on the device, the
+  // slot iter's losses are added to, and losses_ and smoothed_loss_ read up to last_iter
+  bool device_loss() const;
+  void SelectLossSlot(int start_iter, int iter);
+  void ReadLosses(int start_iter, int last_iter);
+  // SolverParameter::dynamic_loss_scale, between iterations
+  void UpdateLossScale();
+  // SolverParameter::input_shape_schedule: index of the step iter is in, -1 before the
+  // first one, and the train net's Data layers switched to it
+  int input_shape_step(int iter) const;
+  void UpdateInputShape();
+  void SetInputShape(int step);
+#ifndef CPU_ONLY
+  // SolverParameter::gpu_mem_defrag_interval
+  void Defragment();
+#endif
+  // SolverParameter::input_shape_pretune
+  void PretuneInputShapes();
+  // SolverParameter::metrics_interval
+  void ResetMetricsWindow();
+  void RecordMetrics();
   void Reduce(Callback* callback, int device, Caffe::Brew mode, uint64_t rand_seed,
       int solver_count, bool root_solver, int type_id);
 
@@ -175,9 +281,14 @@ class Solver {
   shared_ptr<Net> net_;
   vector<shared_ptr<Net>> test_nets_;
   Callback* callback_;
-  vector<Callback*> root_callbacks_;
   vector<float> losses_;
   float smoothed_loss_;
+#ifndef CPU_ONLY
+  // SolverParameter::device_loss: sums of the last average_loss + 1 iterations by
+  // (iter - start_iter) % (average_loss + 1), and the iteration selected in the net
+  GPUMemory::Workspace loss_ring_;
+  int loss_slot_iter_;
+#endif
   unique_ptr<boost::thread> reduce_thread0_;
   unique_ptr<boost::thread> reduce_thread1_;
 
@@ -185,6 +296,8 @@ class Solver {
   // in data parallelism
   const Solver* const root_solver_;
   const size_t rank_;
+  vector<int> shard_owners_;
+  string restored_state_file_;
 
   // A function that can be set by a client of the Solver to provide indication
   // that it wants a snapshot saved and/or to exit early.
@@ -202,6 +315,31 @@ class Solver {
   int iterations_last_;
   int iterations_restored_;
 
+  // SolverParameter::async_test: the test pass running alongside training and the
+  // iteration its weights were copied at (-1 for synchronous tests)
+  unique_ptr<boost::thread> test_thread_;
+  int async_test_iter_;
+
+  // SolverParameter::input_shape_schedule: step the train net is at
+  int input_shape_step_;
+
+  // SolverParameter::metrics_interval: the exporter (root solver only, when a file or
+  // port is set), the latest sample and counters at the beginning of the current window
+  bool sample_metrics_;
+  unique_ptr<MetricsExporter> metrics_;
+  MetricsSample last_metrics_;
+  Net::Timing metrics_timing_;
+  int metrics_iter_;
+  CPUTimer metrics_timer_;
+
+  // SolverParameter::snapshot_async and snapshot_keep
+  unique_ptr<SnapshotWriter> snapshot_writer_;
+
+  // SolverParameter::dynamic_loss_scale: set by reduction threads when the update of
+  // the current iteration was skipped, and clean iterations since the last change
+  std::atomic<bool> grads_overflow_;
+  int loss_scale_clean_iters_;
+
   DISABLE_COPY_MOVE_AND_ASSIGN(Solver);
 };
 
@@ -1,6 +1,7 @@
 #ifndef CAFFE_SYNCEDMEM_HPP_
 #define CAFFE_SYNCEDMEM_HPP_
 
+#include <atomic>
 #include <cstdlib>
 #include <boost/thread.hpp>
 
@@ -21,7 +22,7 @@ class SyncedMemory {
   explicit SyncedMemory(size_t size = 0UL)
       : cpu_ptr_(nullptr), gpu_ptr_(nullptr), size_(size), head_(UNINITIALIZED),
         own_cpu_data_(false), cpu_malloc_use_cuda_(false), own_gpu_data_(false),
-        device_(-1), valid_(true) {}
+        device_(-1), valid_(true), pushed_async_(false) {}
   ~SyncedMemory();
   const void* cpu_data();
   const void* gpu_data();
@@ -41,6 +42,19 @@ class SyncedMemory {
   size_t gpu_memory_use(bool own_only = false) const {
     return own_only ? (own_gpu_data_ ? size_ : 0UL) : size_;
   }
+  size_t host_memory_use() const {
+    return own_cpu_data_ && cpu_ptr_ != nullptr ? size_ : 0UL;
+  }
+  // Host mirrors of all SyncedMemory instances in the process
+  static size_t total_host_memory_use() {
+    return host_memory_use_.load();
+  }
+  // When set, mutable_gpu_data() gives the owned host mirror back, it's allocated
+  // again on next CPU access. Off unless CAFFE_RELEASE_HOST_MIRRORS is defined since
+  // raw host pointers handed out before (like numpy views in pycaffe) would dangle.
+  static void set_release_host_mirrors(bool release) {
+    release_host_mirrors_ = release;
+  }
   bool is_valid() const {
     return valid_;
   }
@@ -53,13 +67,25 @@ class SyncedMemory {
 
 #ifndef CPU_ONLY
   void async_gpu_push();
+  // Copies device data to (pinned) host memory on the given stream. The caller
+  // synchronizes on the stream before release_gpu() or host use.
+  // Returns false when the head is not on device, nothing is copied then.
+  bool async_cpu_pull(cudaStream_t stream);
+  // Gives device memory back, the host copy becomes the head
+  void release_gpu();
+  // Moves owned device memory during defragmentation, see GPUMemory::BeginDefragment.
+  // Pointers handed out before are stale then. Returns false when nothing moved.
+  bool relocate_gpu();
+  // Managed memory hints (see GPUMemory::managed), no-ops without device data
+  void advise_on_device();
+  void prefetch_gpu(cudaStream_t stream);
 #endif
 
   std::string to_string(int indent, Type type);  // debug helper
 
  protected:
   void MallocHost(void** ptr, size_t size, bool* use_cuda);
-  void FreeHost(void* ptr, bool use_cuda);
+  void FreeHost(void* ptr, size_t size, bool use_cuda);
 
  private:
   void to_cpu(bool copy_from_gpu = true);
@@ -74,8 +100,12 @@ class SyncedMemory {
   bool own_gpu_data_;
   int  device_;
   bool valid_;
+  bool pushed_async_;  // an async copy may still read the host mirror
   shared_ptr<CudaStream> pstream_;
 
+  static std::atomic<size_t> host_memory_use_;
+  static bool release_host_mirrors_;
+
   DISABLE_COPY_MOVE_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
 
@@ -2,6 +2,7 @@
 #define INCLUDE_CAFFE_TENSOR_HPP_
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <string>
 #include <utility>
@@ -33,6 +34,10 @@ class Tensor {
 #endif
   static void cpu_scal(int count, Type dtype, void* data, float scal);
 
+  // Conversions done by convert() and convert_batch() since the last reset, per type pair
+  static std::string conversion_report();
+  static void reset_conversion_stats();
+
 #ifdef DEBUG
   bool frozen_;
 #endif
@@ -50,7 +55,11 @@ class Tensor {
   void scale(float new_scale, void* handle = nullptr);
   void invalidate_others();
   void convert(Type new_type);
+  // Same as convert() for every tensor, GPU conversions are launched in batches
+  static void convert_batch(const vector<Tensor*>& tensors, Type new_type);
   void Reshape(int count, bool safe_reshape = false);
+  // Frees memory of every type keeping the count, the content is lost
+  void release();
   float asum() const;
   const shared_ptr<SyncedMemory>& synced_mem() const;
   shared_ptr<SyncedMemory>& mutable_synced_mem(bool flush = true);
@@ -77,6 +86,8 @@ class Tensor {
 
 #ifndef CPU_ONLY
   size_t gpu_memory_use(bool own_only = false) const;
+  // Bytes moved by SyncedMemory::relocate_gpu of every type
+  size_t relocate_gpu() const;
 #endif
 
   // numerical type stored here at a moment (might change due to conversion)
@@ -88,6 +99,12 @@ class Tensor {
   // number of entries allocated (useful when avoiding deallocations is needed)
   int alloc_count_;
 
+  static void count_conversion(Type src_type, Type dst_type, int count, bool batched);
+  static std::atomic<uint64_t> conversions_[Type_ARRAYSIZE][Type_ARRAYSIZE];
+  static std::atomic<uint64_t> conversion_bytes_[Type_ARRAYSIZE][Type_ARRAYSIZE];
+  static std::atomic<uint64_t> batched_conversions_;
+  static std::atomic<uint64_t> batch_launches_;
+
   DISABLE_COPY_MOVE_AND_ASSIGN(Tensor);
 };  // class Tensor
 
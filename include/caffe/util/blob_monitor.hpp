@@ -0,0 +1,106 @@
+#ifndef CAFFE_UTIL_BLOB_MONITOR_HPP_
+#define CAFFE_UTIL_BLOB_MONITOR_HPP_
+
+#ifndef CPU_ONLY
+
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/gpu_memory.hpp"
+
+namespace caffe {
+
+// One watched tensor as the reduction kernel reads it
+struct BlobMonitorTensor {
+  const void* ptr;
+  int count;
+  int type;  // Type
+};
+
+// Per tensor results of the kernel: sum of the finite absolute values, bits of their
+// max (non-negative floats order as unsigned ints do) and count of NaNs and Infs
+struct BlobMonitorSlot {
+  float sum_abs;
+  unsigned int max_abs_bits;
+  unsigned int nonfinite;
+  unsigned int pad;
+};
+
+struct BlobStats {
+  float abs_mean;
+  float max_abs;
+  unsigned int nonfinite;
+};
+
+/**
+ * @brief NetParameter::blob_monitor: statistics of many blobs computed by one kernel
+ * launch and read back without blocking, see BlobMonitorParameter.
+ */
+class BlobMonitor {
+ public:
+  explicit BlobMonitor(const BlobMonitorParameter& param);
+  ~BlobMonitor();
+
+  // Watches the blob's data, or its diff
+  void Add(const std::string& name, const Blob* blob, bool diff);
+  /**
+   * @brief Called once per iteration on the thread computing the blobs. Every
+   * interval-th call enqueues the reduction and its readback on the stream. A sample
+   * is checked by the first call finding its readback done: the caller only waits
+   * when the next sample is due before the previous one came back.
+   */
+  void Tick(cudaStream_t stream);
+  // Waits for the pending sample, if any, and checks it
+  void Flush();
+
+  int size() const {
+    return entries_.size();
+  }
+  const std::string& name(int i) const {
+    return entries_[i].name;
+  }
+  // Of the latest checked sample
+  const BlobStats& stats(int i) const {
+    return stats_[i];
+  }
+  int samples() const {
+    return samples_;
+  }
+  int alerts() const {
+    return alerts_;
+  }
+
+ private:
+  void Launch(cudaStream_t stream);
+  void Check();
+
+  struct Entry {
+    std::string name;
+    const Blob* blob;
+    bool diff;
+  };
+
+  const BlobMonitorParameter param_;
+  std::vector<Entry> entries_;
+  std::vector<BlobStats> stats_;
+  // Tensors then slots, on the device and in pinned host memory
+  GPUMemory::Workspace buffer_;
+  void* host_buffer_;
+  size_t host_buffer_size_;
+  cudaEvent_t done_;
+  bool pending_;
+  int device_;
+  unsigned int ticks_, pending_tick_;
+  int samples_, alerts_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(BlobMonitor);
+};
+
+}  // namespace caffe
+
+#endif  // CPU_ONLY
+
+#endif  // CAFFE_UTIL_BLOB_MONITOR_HPP_
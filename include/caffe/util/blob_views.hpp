@@ -0,0 +1,36 @@
+#ifndef CAFFE_UTIL_BLOB_VIEWS_HPP_
+#define CAFFE_UTIL_BLOB_VIEWS_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Storage sharing of Concat and Slice layers (ConcatParameter::share_storage):
+ *        parts become consecutive regions, in order, of whole's data or diff memory on
+ *        the host or the device (is_gpu). No kernel runs while they stay so.
+ */
+
+/// @brief Whether parts are regions of whole, syncing whole's and then parts' memory.
+bool views_bound(Blob* whole, const vector<Blob*>& parts, bool data, bool is_gpu);
+
+/**
+ * @brief Makes parts regions of whole, which must hold their values already. Returns
+ *        false, changing nothing, on type or count mismatches and if parts have more
+ *        memory than their count needs (host and device syncs would overrun regions).
+ */
+bool bind_views(Blob* whole, const vector<Blob*>& parts, bool data, bool is_gpu);
+
+/**
+ * @brief Gives parts memory of their own again. If keep, only parts still in whole's
+ *        memory are given it, with their values. Otherwise whole's memory may be gone
+ *        already and all parts lose their values.
+ */
+void unbind_views(Blob* whole, const vector<Blob*>& parts, bool data, bool keep,
+    bool is_gpu);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BLOB_VIEWS_HPP_
@@ -1,17 +1,30 @@
 #ifndef CAFFE_UTIL_BLOCKING_QUEUE_HPP_
 #define CAFFE_UTIL_BLOCKING_QUEUE_HPP_
 
+#include <atomic>
+#include <memory>
 #include <queue>
 #include <string>
 #include <vector>
 #include <functional>
 
+#include "caffe/util/lock_free_ring.hpp"
+
 namespace caffe {
 
+/**
+ * @brief Queue blocking consumers while it's empty.
+ *
+ * By default it's unbounded std::queue guarded by mutex. When ring_capacity is
+ * set, elements are kept in preallocated LockFreeRing instead: waiting threads
+ * spin for a while and then park on the condition variable, producers touch the
+ * mutex only when somebody is parked. Pushing to full ring waits the same way.
+ * peek operations are only allowed to the single consumer in this mode.
+ */
 template<typename T>
 class BlockingQueue {
  public:
-  BlockingQueue();
+  explicit BlockingQueue(size_t ring_capacity = 0UL);
   ~BlockingQueue();
 
   void push(const T& t);
@@ -29,10 +42,23 @@ class BlockingQueue {
   size_t size() const;
   bool nonblocking_size(size_t* size) const;
 
+  bool lock_free() const {
+    return static_cast<bool>(ring_);
+  }
+
  protected:
+  // Lock-free mode: spins till the condition is met, then parks
+  template<typename Pred>
+  void ring_wait(const Pred& pred, const char* log_on_wait);
+  void ring_notify();
+
   std::queue<T> queue_;
   mutable boost::mutex mutex_;
   boost::condition_variable condition_;
+  std::unique_ptr<LockFreeRing<T>> ring_;
+  std::atomic<int> parked_;
+
+  static constexpr int SPIN_COUNT = 256;
 
   DISABLE_COPY_MOVE_AND_ASSIGN(BlockingQueue);
 };
@@ -0,0 +1,58 @@
+#ifndef CAFFE_UTIL_BUCKET_TUNER_HPP_
+#define CAFFE_UTIL_BUCKET_TUNER_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Picks the number of gradient reduction buckets from measurements.
+ *
+ * Records when every learnable parameter's gradient becomes ready (relative to
+ * the first one of the iteration) and how long bucket reductions take. Reduction
+ * time is fitted as latency + bytes / bandwidth. Candidate bucket counts are then
+ * simulated: a bucket is reduced once enough bytes arrived and the previous
+ * reduction is done. The count finishing the last reduction earliest wins.
+ */
+class BucketTuner {
+ public:
+  BucketTuner(size_t space_size, int max_buckets);
+
+  // In order of arrival
+  void param_ready(size_t bytes, double time_us);
+  void bucket_reduced(size_t bytes, double time_us);
+  void end_iteration();
+
+  int iterations() const {
+    return iterations_;
+  }
+  // Bucket size used by Net for a given count
+  size_t bucket_size(int buckets) const;
+  // Simulated time from the first gradient to the end of the last reduction
+  double simulate(int buckets) const;
+  int best_buckets() const;
+  std::string plan(int buckets) const;
+
+ private:
+  void fit(double* latency_us, double* us_per_byte) const;
+
+  const size_t space_size_;
+  const int max_buckets_;
+  int iterations_;
+  // Current iteration
+  double start_us_;
+  vector<size_t> bytes_;
+  vector<double> ready_us_;
+  // Per arrival position: bytes, and ready times summed over measured iterations
+  vector<size_t> arrival_bytes_;
+  vector<double> sum_ready_us_;
+  vector<size_t> reduced_bytes_;
+  vector<double> reduced_us_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BUCKET_TUNER_HPP_
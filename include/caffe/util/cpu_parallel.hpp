@@ -0,0 +1,66 @@
+#ifndef CAFFE_UTIL_CPU_PARALLEL_HPP_
+#define CAFFE_UTIL_CPU_PARALLEL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Process-wide pool running the per-sample and per-channel loops of CPU layers.
+ *
+ * One loop runs at a time: loops started by other threads while the pool is busy, or
+ * from inside a loop, run serially on the calling thread. Idle workers block, so BLAS
+ * calls between loops get the cores. The thread count is CAFFE_CPU_THREADS, or the
+ * number of cores, unless set_num_threads is called; 1 disables the pool.
+ */
+class CpuParallel {
+ public:
+  /// @brief Runs f(begin, end) over ranges splitting [0, n), each at least grain long.
+  static void For(int n, int grain, const std::function<void(int, int)>& f);
+
+  static int num_threads();
+  static void set_num_threads(int threads);
+
+  // Elements per range of elementwise loops, smaller ones aren't worth waking workers
+  static constexpr int GRAIN = 1 << 14;
+
+ private:
+  CpuParallel();
+  ~CpuParallel();
+  static CpuParallel& instance();
+
+  void Run(int n, int chunks, const std::function<void(int, int)>& f);
+  void Resize(int workers);
+  void Work();
+  // seen is the generation of the last loop before the worker started
+  void WorkerEntry(uint64_t seen);
+
+  // Held by the thread whose loop is running
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable cv_, done_cv_;
+  std::vector<std::thread> workers_;
+  bool stop_;
+  // Incremented per loop, workers wait for a change
+  uint64_t generation_;
+  int pending_;
+  const std::function<void(int, int)>* task_;
+  int n_, chunks_;
+  std::atomic<int> next_;
+
+  static std::atomic<int> threads_;
+  static thread_local bool in_loop_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(CpuParallel);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_CPU_PARALLEL_HPP_
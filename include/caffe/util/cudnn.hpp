@@ -156,6 +156,17 @@ inline void setTensor4dDesc(cudnnTensorDescriptor_t *desc,
       stride_n, stride_c, stride_h, stride_w);
 }
 
+// Dense n x c x h x w tensor laid out in memory as packing says
+template<typename Dtype>
+inline void setTensor4dDesc(cudnnTensorDescriptor_t *desc,
+    int n, int c, int h, int w, Packing packing) {
+  if (packing == NHWC) {
+    setTensor4dDesc<Dtype>(desc, n, c, h, w, h * w * c, 1, w * c, c);
+  } else {
+    setTensor4dDesc<Dtype>(desc, n, c, h, w);
+  }
+}
+
 inline void setTensor4dDesc(cudnnTensorDescriptor_t *desc, cudnnDataType_t type,
     Packing packing, const vector<int> &shape) {
   int stride_w = 0, stride_h = 0, stride_c = 0, stride_n = 0;
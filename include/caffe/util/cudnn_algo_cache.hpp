@@ -0,0 +1,61 @@
+#ifndef CAFFE_UTIL_CUDNN_ALGO_CACHE_HPP_
+#define CAFFE_UTIL_CUDNN_ALGO_CACHE_HPP_
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Persistent cache of convolution algorithms chosen by cuDNN seekers.
+ *
+ * Every cache file is loaded once per process on first use. New entries are
+ * appended to the file right after they are found, so that concurrently running
+ * solvers (and processes) never lose each other's results. When the same key
+ * shows up more than once the latest entry wins.
+ * File format is plain text, one "key<TAB>values" entry per line.
+ */
+class CuDNNAlgoCache {
+ public:
+  struct Entry {
+    Entry() : fwd_algo(-1), bwd_data_algo(-1), bwd_filter_algo(-1),
+              fwd_cudnn_math(0), bwd_data_cudnn_math(0), bwd_filter_cudnn_math(0),
+              forward_math(FLOAT), backward_data_math(FLOAT), backward_filter_math(FLOAT),
+              fwd_ws_size(0UL), bwd_data_ws_size(0UL), bwd_filter_ws_size(0UL) {}
+
+    int fwd_algo, bwd_data_algo, bwd_filter_algo;
+    // cudnnMathType_t values
+    int fwd_cudnn_math, bwd_data_cudnn_math, bwd_filter_cudnn_math;
+    // Type::FLOAT here means "pseudo fp32" for FLOAT16 layers
+    Type forward_math, backward_data_math, backward_filter_math;
+    size_t fwd_ws_size, bwd_data_ws_size, bwd_filter_ws_size;
+
+    std::string to_string() const;
+    bool from_string(const std::string& str);
+  };
+
+  // Returns false if there is no entry for the key given
+  static bool Lookup(const std::string& file, const std::string& key, Entry* entry);
+  // Stores the entry in memory and appends it to the file
+  static void Insert(const std::string& file, const std::string& key, const Entry& entry);
+  // Drops in-memory copy of the file (it will be re-read on next access)
+  static void Reset(const std::string& file);
+
+ private:
+  typedef std::map<std::string, Entry> Cache;
+
+  static Cache& cache(const std::string& file);  // mutex_ must be locked
+
+  static std::mutex mutex_;
+  static std::map<std::string, Cache> caches_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(CuDNNAlgoCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_CUDNN_ALGO_CACHE_HPP_
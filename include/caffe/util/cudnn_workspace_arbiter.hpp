@@ -0,0 +1,65 @@
+#ifndef CAFFE_UTIL_CUDNN_WORKSPACE_ARBITER_HPP_
+#define CAFFE_UTIL_CUDNN_WORKSPACE_ARBITER_HPP_
+
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Picks convolution algorithms of all layers of a device at once.
+ *
+ * Every layer submits FindEx results of its algorithm slots (forward, backward data
+ * and backward filter of every bottom). All layers run one after another in the same
+ * workspace, thus its size is the largest requirement of the algorithms chosen.
+ * The arbiter finds the smallest workspace fitting the budget such that the total
+ * time of all slots is within TIME_TOLERANCE of the best time possible in the budget.
+ * Every slot then takes its fastest algorithm fitting that workspace.
+ */
+class CuDNNWorkspaceArbiter {
+ public:
+  struct Candidate {
+    int algo;
+    int cudnn_math;  // cudnnMathType_t value
+    float time;      // per pass, all calls included
+    size_t memory;   // workspace required, all groups included
+  };
+
+  // Replaces what the owner submitted for the slot before
+  static void Submit(int device, const void* owner, int slot, const vector<Candidate>& cands);
+  // Drops everything submitted by the owner
+  static void Withdraw(int device, const void* owner);
+  // Solves the device's problem on first call after submissions changed. Returns false
+  // if the slot has not been submitted. Sets the workspace size of the solution if asked.
+  static bool Decision(int device, const void* owner, int slot, size_t budget,
+      Candidate* choice, size_t* workspace = nullptr);
+
+  // Sets index of the candidate chosen for every slot, returns the workspace size
+  static size_t Solve(const vector<vector<Candidate>>& slots, size_t budget,
+      vector<int>* choices);
+
+  static constexpr float TIME_TOLERANCE = 0.02F;
+
+ private:
+  typedef std::pair<const void*, int> Key;
+  struct Problem {
+    Problem() : solved_(false), workspace_(0UL) {}
+    std::map<Key, vector<Candidate>> slots_;
+    std::map<Key, int> choices_;
+    bool solved_;
+    size_t workspace_;
+  };
+
+  static std::mutex mutex_;
+  static std::map<int, Problem> problems_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(CuDNNWorkspaceArbiter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_CUDNN_WORKSPACE_ARBITER_HPP_
@@ -0,0 +1,62 @@
+#ifndef CAFFE_UTIL_DAG_EXECUTOR_HPP_
+#define CAFFE_UTIL_DAG_EXECUTOR_HPP_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Runs the nodes of a dependency graph on the calling thread and helper threads.
+ *
+ * A node starts once all the nodes it depends on are done. Among ready nodes the lowest
+ * one goes first, so a chain runs in order. Helper threads live as long as the executor
+ * and call thread_init once before taking any node.
+ */
+class DagExecutor {
+ public:
+  DagExecutor(int helpers, const std::function<void()>& thread_init);
+  ~DagExecutor();
+
+  /**
+   * @brief Calls run(i) once for every node i, returns when all are done.
+   * @param deps nodes every node depends on
+   * @param caller_only nodes to run on the calling thread, may be empty
+   */
+  void Run(const vector<vector<int>>& deps, const vector<bool>& caller_only,
+      const std::function<void(int)>& run);
+
+  int helpers() const {
+    return helpers_.size();
+  }
+
+ private:
+  void HelperEntry(std::function<void()> thread_init);
+  // Both called with mutex_ held
+  int Take(bool caller);
+  void Finish(int node);
+
+  vector<std::thread> helpers_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_;
+  // Current run
+  const std::function<void(int)>* run_;
+  const vector<bool>* caller_only_;
+  vector<vector<int>> successors_;
+  vector<int> pending_;
+  std::set<int> ready_;
+  int remaining_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(DagExecutor);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DAG_EXECUTOR_HPP_
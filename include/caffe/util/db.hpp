@@ -23,6 +23,10 @@ class Cursor {
   virtual bool parse(Datum* datum) const = 0;
   virtual bool parse(C2TensorProtos* c2p) const = 0;
   virtual bool valid() const = 0;
+  // Asks the storage to bring current value in asynchronously, never blocks
+  virtual void prefetch() const { }
+  // Moves to the record of the key given, false if not found or not supported
+  virtual bool SeekToKey(const string& key) { return false; }
 
   DISABLE_COPY_MOVE_AND_ASSIGN(Cursor);
 };
@@ -41,6 +45,8 @@ class DB {
  public:
   DB() { }
   virtual ~DB() { }
+  // Backend specific reading settings, called before Open
+  virtual void Configure(const DataParameter& param) { }
   virtual void Open(const string& source, Mode mode) = 0;
   virtual void Close() = 0;
   virtual Cursor* NewCursor() = 0;
@@ -2,8 +2,10 @@
 #ifndef CAFFE_UTIL_DB_LEVELDB_HPP
 #define CAFFE_UTIL_DB_LEVELDB_HPP
 
+#include <memory>
 #include <string>
 
+#include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
 
@@ -11,13 +13,38 @@
 
 namespace caffe { namespace db {
 
+// Opened read only, shared by all readers of the source in the process: LevelDB locks
+// its directory, one handle serves any number of threads
+struct LevelDBHandle {
+  LevelDBHandle() : db(nullptr), cache(nullptr) {}
+  ~LevelDBHandle() {
+    delete db;
+    delete cache;
+  }
+  leveldb::DB* db;
+  leveldb::Cache* cache;
+};
+
 class LevelDBCursor : public Cursor {
  public:
+  // Iterates the snapshot given, if any, releasing it when done
+  LevelDBCursor(leveldb::Iterator* iter, const std::shared_ptr<LevelDBHandle>& handle,
+      const leveldb::Snapshot* snapshot)
+    : iter_(iter), handle_(handle), snapshot_(snapshot) { SeekToFirst(); }
   explicit LevelDBCursor(leveldb::Iterator* iter)
-    : iter_(iter) { SeekToFirst(); }
-  ~LevelDBCursor() { delete iter_; }
+    : LevelDBCursor(iter, std::shared_ptr<LevelDBHandle>(), nullptr) {}
+  ~LevelDBCursor() {
+    delete iter_;
+    if (snapshot_ != nullptr) {
+      handle_->db->ReleaseSnapshot(snapshot_);
+    }
+  }
   void SeekToFirst() override { iter_->SeekToFirst(); }
   void Next() override { iter_->Next(); }
+  bool SeekToKey(const string& key) override {
+    iter_->Seek(key);
+    return iter_->Valid() && iter_->key() == key;
+  }
   string key() const override { return iter_->key().ToString(); }
   string value() const override { return iter_->value().ToString(); }
   bool parse(Datum* datum) const override {
@@ -36,6 +63,8 @@ class LevelDBCursor : public Cursor {
 
  private:
   leveldb::Iterator* iter_;
+  std::shared_ptr<LevelDBHandle> handle_;
+  const leveldb::Snapshot* snapshot_;
 };
 
 class LevelDBTransaction : public Transaction {
@@ -59,24 +88,31 @@ class LevelDBTransaction : public Transaction {
 
 class LevelDB : public DB {
  public:
-  LevelDB() : db_(NULL) { }
+  LevelDB() : db_(NULL), cache_mb_(0U), fill_cache_(true), snapshots_(true) { }
   virtual ~LevelDB() { Close(); }
+  // Block cache size, fill_cache and snapshots of cursors (see DataParameter::leveldb_*)
+  void Configure(const DataParameter& param) override;
   virtual void Open(const string& source, Mode mode);
   virtual void Close() {
-    if (db_ != NULL) {
+    if (handle_) {
+      handle_.reset();
+    } else if (db_ != NULL) {
       delete db_;
-      db_ = NULL;
     }
+    db_ = NULL;
   }
-  virtual LevelDBCursor* NewCursor() {
-    return new LevelDBCursor(db_->NewIterator(leveldb::ReadOptions()));
-  }
+  virtual LevelDBCursor* NewCursor();
   virtual LevelDBTransaction* NewTransaction() {
+    CHECK(!handle_) << "LevelDB opened for reading";
     return new LevelDBTransaction(db_);
   }
 
  private:
   leveldb::DB* db_;
+  std::shared_ptr<LevelDBHandle> handle_;
+  unsigned int cache_mb_;
+  bool fill_cache_;
+  bool snapshots_;
 };
 
 
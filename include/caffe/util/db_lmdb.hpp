@@ -28,6 +28,12 @@ class LMDBCursor : public Cursor {
   }
   void SeekToFirst() override { Seek(MDB_FIRST); }
   void Next() override { Seek(MDB_NEXT); }
+  bool SeekToKey(const string& key) override {
+    mdb_key_.mv_size = key.size();
+    mdb_key_.mv_data = const_cast<char*>(key.data());
+    Seek(MDB_SET_KEY);
+    return valid_;
+  }
   string key() const override {
     return string(static_cast<const char*>(mdb_key_.mv_data), mdb_key_.mv_size);
   }
@@ -49,6 +55,8 @@ class LMDBCursor : public Cursor {
   }
 
   bool valid() const override { return valid_; }
+  // Value pages of the memory map are read ahead by the kernel
+  void prefetch() const override;
 
  private:
   void Seek(MDB_cursor_op op) {
@@ -97,6 +105,9 @@ class LMDB : public DB {
   }
   virtual LMDBCursor* NewCursor();
   virtual LMDBTransaction* NewTransaction();
+  // Writing: grows the memory map to hold at least this many bytes, so that
+  // transactions don't have to double it. Must be called between transactions.
+  void reserve_map(size_t bytes);
 
  private:
   MDB_env* mdb_env_;
@@ -0,0 +1,126 @@
+#ifndef CAFFE_UTIL_DB_RANK_SHARDS_HPP
+#define CAFFE_UTIL_DB_RANK_SHARDS_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "caffe/util/db.hpp"
+
+namespace caffe { namespace db {
+
+/**
+ * @brief Reads records of several cursors in turn: first of every cursor, then second
+ *        of every cursor and so on. Ends with the first cursor having no record left,
+ *        thus cursors are expected to be ordered by size, as rank shards are.
+ */
+class InterleavedCursor : public Cursor {
+ public:
+  explicit InterleavedCursor(vector<unique_ptr<Cursor>>&& cursors);
+  void SeekToFirst() override;
+  void Next() override;
+  string key() const override {
+    return current()->key();
+  }
+  string value() const override {
+    return current()->value();
+  }
+  const void* data() const override {
+    return current()->data();
+  }
+  size_t size() const override {
+    return current()->size();
+  }
+  bool parse(Datum* datum) const override {
+    return current()->parse(datum);
+  }
+  bool parse(C2TensorProtos* c2p) const override {
+    return current()->parse(c2p);
+  }
+  bool valid() const override {
+    return current()->valid();
+  }
+  void prefetch() const override {
+    current()->prefetch();
+  }
+
+ private:
+  Cursor* current() const {
+    return cursors_[current_].get();
+  }
+
+  vector<unique_ptr<Cursor>> cursors_;
+  size_t current_;
+};
+
+/**
+ * @brief LMDB or LevelDB source split in rank shards by convert_imageset --rank_shards.
+ *
+ * Source is a directory of N databases rank-NNNNN of the backend given, and a RANK_SHARDS
+ * file holding N. Record i of the list goes to shard i % N, so shard s holds records
+ * s, s + N, s + 2N... in their order. Read as a whole, shards are interleaved back to
+ * the list order. DataReader gives a cursor only the shards it needs (see select),
+ * so it reads them sequentially instead of skipping records of other cursors.
+ */
+class RankShardsDB : public DB {
+ public:
+  explicit RankShardsDB(DataParameter_DB backend);
+  virtual ~RankShardsDB() { Close(); }
+  void Configure(const DataParameter& param) override;
+  void Open(const string& source, Mode mode) override;
+  void Close() override;
+  Cursor* NewCursor() override;
+  Transaction* NewTransaction() override;
+
+  // Writing: shards to create, set before Open
+  void set_shards(size_t shards) {
+    shards_ = shards;
+  }
+  // Reading: shards to open, all if empty, set before Open
+  void select(const vector<size_t>& shards) {
+    selected_ = shards;
+  }
+  size_t shards() const {
+    return shards_;
+  }
+  // Of shard i in the order opened
+  DB* shard(size_t i) const {
+    return dbs_[i].get();
+  }
+
+  // Number of rank shards of the source, 0 if it's not split
+  static size_t Count(const string& source);
+  static string shard_path(const string& source, size_t shard_id);
+
+ private:
+  friend class RankShardsTransaction;
+
+  const DataParameter_DB backend_;
+  DataParameter param_;
+  size_t shards_;
+  vector<size_t> selected_;
+  vector<unique_ptr<DB>> dbs_;
+  // Writing: records put so far
+  size_t puts_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(RankShardsDB);
+};
+
+class RankShardsTransaction : public Transaction {
+ public:
+  explicit RankShardsTransaction(RankShardsDB* db);
+  // Deals the record to the next shard in turn
+  void Put(const string& key, const string& value) override;
+  void Commit() override;
+
+ private:
+  RankShardsDB* db_;
+  vector<unique_ptr<Transaction>> txns_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(RankShardsTransaction);
+};
+
+}  // namespace db
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DB_RANK_SHARDS_HPP
@@ -0,0 +1,156 @@
+#ifndef CAFFE_UTIL_DB_SHARDS_HPP
+#define CAFFE_UTIL_DB_SHARDS_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "caffe/util/db.hpp"
+
+namespace caffe { namespace db {
+
+/**
+ * @brief Append-only sharded record files made for sequential reading.
+ *
+ * Source is a directory of shard-NNNNN.rec files. Each shard starts with 8 byte magic
+ * followed by records: uint32 key size, uint32 value size, key, value (host byte order).
+ * Companion shard-NNNNN.idx keeps uint64 offsets of the shard's records.
+ * Cursors read shards in large windows hinting the kernel to read ahead the next one.
+ * Instead of random access, shard order may be shuffled every epoch and records passed
+ * through in-memory shuffle buffer. Shuffling is seeded by the source name and epoch,
+ * thus every cursor of the same source yields the same sequence (parser threads
+ * rely on this to split records).
+ */
+class ShardsCursor : public Cursor {
+ public:
+  ShardsCursor(const vector<string>& shards, size_t window, bool shuffle,
+      size_t shuffle_buffer, uint64_t seed);
+  ~ShardsCursor();
+  void SeekToFirst() override;
+  void Next() override;
+  string key() const override {
+    return string(key_, key_size_);
+  }
+  string value() const override {
+    return string(value_, value_size_);
+  }
+  bool parse(Datum* datum) const override {
+    return datum->ParseFromArray(value_, value_size_);
+  }
+  bool parse(C2TensorProtos* c2p) const override {
+    return c2p->ParseFromArray(value_, value_size_);
+  }
+  const void* data() const override {
+    return value_;
+  }
+  size_t size() const override {
+    return value_size_;
+  }
+  bool valid() const override {
+    return valid_;
+  }
+
+ private:
+  struct Record {
+    string key, value;
+  };
+
+  // Next record in shard order, pointers are valid till the next call
+  bool read_next(const char** key, uint32_t* key_size, const char** value,
+      uint32_t* value_size);
+  bool read_next(Record* record);
+  bool open_next_shard();
+  void close_shard();
+  // Makes sure at least 'bytes' are available in the window past pos_
+  bool fill(size_t bytes);
+  void point_to(const Record& r);
+
+  const vector<string> shards_;
+  const size_t window_;
+  const bool shuffle_;
+  const uint64_t seed_;
+  vector<size_t> order_;
+  size_t shard_idx_;
+  size_t epoch_;
+  std::mt19937_64 rng_;
+
+  int fd_;
+  vector<char> buf_;
+  size_t pos_, end_;
+  uint64_t file_offset_;  // of buf_[end_]
+
+  // Shuffle buffer: 'filled_' leading slots hold records not yet emitted but current_
+  vector<Record> pool_;
+  size_t filled_;
+  size_t current_;
+
+  const char* key_;
+  uint32_t key_size_;
+  const char* value_;
+  uint32_t value_size_;
+  bool valid_;
+};
+
+class ShardsTransaction;
+
+class ShardsDB : public DB {
+ public:
+  static constexpr const char* MAGIC = "CAFFESH1";
+  static constexpr size_t MAGIC_SIZE = 8UL;
+
+  ShardsDB();
+  virtual ~ShardsDB() { Close(); }
+  void Configure(const DataParameter& param) override;
+  void Open(const string& source, Mode mode) override;
+  void Close() override;
+  ShardsCursor* NewCursor() override;
+  Transaction* NewTransaction() override;
+
+  // Writing: new shard is started once the current one exceeds this size
+  void set_shard_size(size_t bytes) {
+    shard_size_ = bytes;
+  }
+  static string shard_path(const string& source, size_t shard_id, bool index);
+
+ private:
+  friend class ShardsTransaction;
+  void Append(const string& key, const string& value);
+  void Flush();
+  void start_shard();
+
+  string source_;
+  vector<string> shards_;
+  size_t window_;
+  bool shuffle_;
+  size_t shuffle_buffer_;
+  size_t shard_size_;
+  // Writing
+  FILE* rec_;
+  FILE* idx_;
+  uint64_t rec_offset_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(ShardsDB);
+};
+
+class ShardsTransaction : public Transaction {
+ public:
+  explicit ShardsTransaction(ShardsDB* db) : db_(db) { CHECK_NOTNULL(db_); }
+  void Put(const string& key, const string& value) override {
+    keys_.push_back(key);
+    values_.push_back(value);
+  }
+  void Commit() override;
+
+ private:
+  ShardsDB* db_;
+  vector<string> keys_, values_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(ShardsTransaction);
+};
+
+}  // namespace db
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DB_SHARDS_HPP
@@ -11,6 +11,9 @@
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
+#ifndef CPU_ONLY
+#include "caffe/util/gpu_memory.hpp"
+#endif
 
 namespace caffe {
 
@@ -49,6 +52,21 @@ struct BboxLabel_ {
   Point3v location;
 };
 
+// A pruned bounding box with what its gridbox labels take from it, the compact
+//  form generate_gpu uploads.
+template <typename Dtype>
+struct CoverageBox_ {
+  // bounding box corners:
+  Dtype x0, y0, x1, y1;
+  // coverage region corners:
+  Dtype cvg_x0, cvg_y0, cvg_x1, cvg_y1;
+  // gridboxes overlapping the coverage region, [g_x0, g_x1) x [g_y0, g_y1):
+  int g_x0, g_y0, g_x1, g_y1;
+  // coverage class:
+  int label;
+  Dtype obj_norm;
+};
+
 template <typename Dtype>
 class TransformedLabel_ {
  public:
@@ -105,6 +123,7 @@ class CoverageGenerator {
   typedef BboxLabel_<Dtype> BboxLabel;
   typedef TransformedLabel_<Dtype> TransformedLabel;
   typedef CoverageRegion_<Dtype> CoverageRegion;
+  typedef CoverageBox_<Dtype> CoverageBox;
   typedef typename vector<reference_wrapper_dtype>::const_iterator
       coverage_iterator;
   typedef map<size_t, size_t> LabelMap;
@@ -121,6 +140,18 @@ class CoverageGenerator {
       Dtype* transformedLabels,
       const vector <BboxLabel>& bboxlist) const;
 
+#ifndef CPU_ONLY
+  /**
+   * @brief computes the gridbox labels of a batch of bounding box lists on the
+   * GPU, in the thread stream. Only the pruned lists are uploaded; a thread per
+   * gridbox takes the last box covering it, as generate() leaves it. Coverage
+   * regions are taken to be rectangular.
+   */
+  void generate_gpu(
+      Dtype* transformedLabels,
+      const vector<vector<BboxLabel> >& bboxLists);
+#endif
+
   inline Vec3i dimensions() const {
     return Vec3i(
         label_size_,
@@ -196,6 +227,14 @@ class CoverageGenerator {
 
   vector<BboxLabel> pruneBboxes(const vector<BboxLabel>& labels) const;
 
+  /**
+   * @brief appends the pruned bounding boxes of a list, as generate() labels
+   * them, in compact form.
+   */
+  void coverageBoxes(
+      const vector<BboxLabel>& bboxList,
+      vector<CoverageBox>* boxes) const;
+
   const DetectNetGroundTruthParameter param_;
   const Rectv imageROI_;
   const Rect gridROI_;
@@ -204,6 +243,13 @@ class CoverageGenerator {
   const LabelMap labels_;
   const size_t label_size_;
 
+#ifndef CPU_ONLY
+  // the batch's box offsets and boxes, and their device copy:
+  vector<int> box_offsets_;
+  vector<CoverageBox> boxes_;
+  GPUMemory::Workspace gpu_boxes_;
+#endif
+
   friend class TransformedLabel_<Dtype>;
 };
 
@@ -122,6 +122,19 @@ inline int CAFFE_GET_BLOCKS_HALF(const int N) {
       CAFFE_CUDA_NUM_THREADS_HALF;
 }
 
+// CUDA: waits for the stream unless its work is being captured into a CUDA graph
+// (see NetParameter::cuda_graph). Captured work is replayed in stream order anyway.
+inline cudaError_t caffe_gpu_sync(cudaStream_t stream) {
+#if CUDART_VERSION >= 10000
+  cudaStreamCaptureStatus status;
+  cudaError_t error = cudaStreamIsCapturing(stream, &status);
+  if (error != cudaSuccess || status != cudaStreamCaptureStatusNone) {
+    return error;
+  }
+#endif
+  return cudaStreamSynchronize(stream);
+}
+
 
 #ifndef NO_NVML
 namespace nvml {
@@ -134,6 +147,7 @@ struct NVMLInit {
   NVMLInit();
   ~NVMLInit();
   nvmlDevice_t device_;
+  int numa_node_;
   static std::mutex m_;
 };
 
@@ -0,0 +1,48 @@
+#ifndef CAFFE_UTIL_DEVICE_WORKER_HPP_
+#define CAFFE_UTIL_DEVICE_WORKER_HPP_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A thread running the tasks it's given in order, with the Caffe context
+ *        (device, stream and handles) set up by thread_init.
+ */
+class DeviceWorker {
+ public:
+  explicit DeviceWorker(const std::function<void()>& thread_init);
+  ~DeviceWorker();
+
+  /// @brief Queues task and returns at once.
+  void Post(const std::function<void()>& task);
+  /// @brief Returns when all posted tasks are done.
+  void Wait();
+  /// @brief Runs task and returns when it's done.
+  void Run(const std::function<void()>& task) {
+    Post(task);
+    Wait();
+  }
+
+ private:
+  void WorkerEntry(std::function<void()> thread_init);
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_, idle_cv_;
+  std::deque<std::function<void()>> tasks_;
+  bool busy_;
+  bool stop_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(DeviceWorker);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DEVICE_WORKER_HPP_
@@ -0,0 +1,193 @@
+#ifndef INCLUDE_CAFFE_UTIL_ELEMENTWISE_CUH_
+#define INCLUDE_CAFFE_UTIL_ELEMENTWISE_CUH_
+
+#include <algorithm>
+#include <cstdint>
+
+#include "caffe/common.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
+
+namespace caffe {
+
+// Resident blocks of CAFFE_CUDA_NUM_THREADS per multiprocessor the grid is sized for
+#define ELEMENTWISE_BLOCKS_PER_SM 4
+
+// Bytes moved by one vectorized load or store
+#define ELEMENTWISE_VEC_BYTES 16
+
+// VEC elements loaded or stored by one 128-bit access
+template<typename T, int VEC>
+struct alignas(sizeof(T) * VEC) ElementwisePack {
+  T v[VEC];
+};
+
+template<typename A, int VEC, typename Op, typename Y, typename... X>
+__device__ __forceinline__ void elementwise_pack(const Op& op, ElementwisePack<Y, VEC>* y,
+    const ElementwisePack<X, VEC>&... x) {
+#pragma unroll
+  for (int k = 0; k < VEC; ++k) {
+    y->v[k] = mt_store<Y>(op(mt_load<A>(x.v[k])...));
+  }
+}
+
+// Grid-stride: the unaligned head and the tail one element at a time, the aligned body
+// VEC elements at a time. head is 0 and VEC 1 when the pointers can't be aligned together.
+template<int VEC, typename A, typename Op, typename Y, typename... X>
+__global__ void ElementwiseKernel(const int n, const int head, const Op op, Y* y,
+    const X*... x) {
+  const int tid = blockIdx.x * blockDim.x + threadIdx.x;
+  const int stride = blockDim.x * gridDim.x;
+  const int body = (n - head) / VEC;
+  const int tail = head + body * VEC;
+  for (int i = tid; i < head + n - tail; i += stride) {
+    const int j = i < head ? i : tail + i - head;
+    y[j] = mt_store<Y>(op(mt_load<A>(x[j])...));
+  }
+  ElementwisePack<Y, VEC>* yv = reinterpret_cast<ElementwisePack<Y, VEC>*>(y + head);
+  for (int i = tid; i < body; i += stride) {
+    ElementwisePack<Y, VEC> out;
+    elementwise_pack<A>(op,
+        &out, reinterpret_cast<const ElementwisePack<X, VEC>*>(x + head)[i]...);
+    yv[i] = out;
+  }
+}
+
+inline bool elementwise_aligned(int, int) {
+  return true;
+}
+
+template<typename X, typename... Xs>
+bool elementwise_aligned(int vec, int head, const X* x, const Xs*... xs) {
+  return reinterpret_cast<std::uintptr_t>(x + head) % (vec * sizeof(X)) == 0 &&
+      elementwise_aligned(vec, head, xs...);
+}
+
+/**
+ * @brief y[i] = op(x0[i], x1[i], ...) for i < n, any number of inputs, y may be one of
+ * them. Pointers are host types (float16 included). Op is called with values converted
+ * to float, or double if y is double, and returns one, see AddOp etc. below.
+ * Loads and stores are 128 bits wide when y and every x share their alignment, and the
+ * grid strides over a few blocks per multiprocessor. Doesn't synchronize.
+ */
+template<typename Op, typename Y, typename... X>
+void caffe_gpu_elementwise(const int n, const Op& op, cudaStream_t stream, Y* y,
+    const X*... x) {
+  typedef typename MultiTensorType<Y>::type D;
+  typedef typename MultiTensorAcc<Y>::type A;
+  constexpr int VEC = ELEMENTWISE_VEC_BYTES / sizeof(Y) > 0 ?
+      ELEMENTWISE_VEC_BYTES / sizeof(Y) : 1;
+  if (n <= 0) {
+    return;
+  }
+  // Elements before y is 128-bit aligned
+  const std::uintptr_t misalign = reinterpret_cast<std::uintptr_t>(y) % ELEMENTWISE_VEC_BYTES;
+  const int head = misalign % sizeof(Y) != 0 ? n :
+      static_cast<int>((ELEMENTWISE_VEC_BYTES - misalign) % ELEMENTWISE_VEC_BYTES / sizeof(Y));
+  const bool vectorized = head < n && elementwise_aligned(VEC, head, x...);
+  const int device = Caffe::current_device();
+  const int max_blocks = Caffe::multiprocessor_count(device) * ELEMENTWISE_BLOCKS_PER_SM;
+  if (vectorized) {
+    const int blocks = std::min(max_blocks, CAFFE_GET_BLOCKS(std::max(head + VEC,
+        (n - head) / VEC)));
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    ElementwiseKernel<VEC, A><<<blocks, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n, head, op,
+        reinterpret_cast<D*>(y),
+        reinterpret_cast<const typename MultiTensorType<X>::type*>(x)...);
+  } else {
+    const int blocks = std::min(max_blocks, CAFFE_GET_BLOCKS(n));
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    ElementwiseKernel<1, A><<<blocks, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n, 0, op,
+        reinterpret_cast<D*>(y),
+        reinterpret_cast<const typename MultiTensorType<X>::type*>(x)...);
+  }
+  CUDA_POST_KERNEL_CHECK;
+}
+
+// Ops: A is float or double, scalars are kept in the type they are computed in.
+
+struct AddOp {
+  template<typename A>
+  __device__ __forceinline__ A operator()(A a, A b) const {
+    return a + b;
+  }
+};
+
+struct SubOp {
+  template<typename A>
+  __device__ __forceinline__ A operator()(A a, A b) const {
+    return a - b;
+  }
+};
+
+struct MulOp {
+  template<typename A>
+  __device__ __forceinline__ A operator()(A a, A b) const {
+    return a * b;
+  }
+};
+
+struct DivOp {
+  template<typename A>
+  __device__ __forceinline__ A operator()(A a, A b) const {
+    return a / b;
+  }
+};
+
+struct SquareOp {
+  template<typename A>
+  __device__ __forceinline__ A operator()(A a) const {
+    return a * a;
+  }
+};
+
+template<typename S>
+struct ScaleOp {
+  explicit ScaleOp(S alpha) : alpha(alpha) {}
+  template<typename A>
+  __device__ __forceinline__ A operator()(A a) const {
+    return alpha * a;
+  }
+  S alpha;
+};
+
+template<typename S>
+struct AddScalarOp {
+  explicit AddScalarOp(S alpha) : alpha(alpha) {}
+  template<typename A>
+  __device__ __forceinline__ A operator()(A a) const {
+    return a + alpha;
+  }
+  S alpha;
+};
+
+// alpha * a + beta * b
+template<typename S>
+struct AxpbyOp {
+  AxpbyOp(S alpha, S beta) : alpha(alpha), beta(beta) {}
+  template<typename A>
+  __device__ __forceinline__ A operator()(A a, A b) const {
+    return alpha * a + beta * b;
+  }
+  S alpha, beta;
+};
+
+// f(g(x...)): fused ops are one pass over memory
+template<typename F, typename G>
+struct ComposeOp {
+  ComposeOp(const F& f, const G& g) : f(f), g(g) {}
+  template<typename A, typename... As>
+  __device__ __forceinline__ A operator()(A a, As... as) const {
+    return f(g(a, as...));
+  }
+  F f;
+  G g;
+};
+
+template<typename F, typename G>
+ComposeOp<F, G> compose(const F& f, const G& g) {
+  return ComposeOp<F, G>(f, g);
+}
+
+}  // namespace caffe
+
+#endif  // INCLUDE_CAFFE_UTIL_ELEMENTWISE_CUH_
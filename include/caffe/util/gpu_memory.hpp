@@ -1,6 +1,9 @@
 #ifndef CAFFE_UTIL_GPU_MEMORY_HPP_
 #define CAFFE_UTIL_GPU_MEMORY_HPP_
 
+#include <functional>
+#include <map>
+#include <string>
 #include <thread>
 #include <unordered_map>
 #include <vector>
@@ -15,11 +18,31 @@ namespace cub {
 
 namespace caffe {
 
+class SlabAllocator;
+
 struct GPUMemory {
   static void GetInfo(size_t* free_mem, size_t* used_mem, bool with_update = false) {
     return mgr_.GetInfo(free_mem, used_mem, with_update);
   }
 
+  // Bytes handed out on the device and their high-water mark
+  static void GetUsage(size_t* in_use, size_t* peak, int device = current_device()) {
+    mgr_.GetUsage(in_use, peak, device);
+  }
+
+  // Bytes the allocator keeps cached on the device without handing them out
+  static size_t cached_free_bytes(int device = current_device()) {
+    return mgr_.cached_free_bytes(device);
+  }
+
+  // Reports logged when an allocation on the device fails for good, e.g. the memory
+  // breakdown of every Net (see Net::MemoryReportString). Owners remove theirs first
+  // thing on destruction.
+  static void AddOOMReport(const void* owner, int device,
+      const std::function<std::string()>& report);
+  static void RemoveOOMReport(const void* owner);
+  static void LogOOMReports(int device);
+
   static int current_device() {
     int device;
     CUDA_CHECK(cudaGetDevice(&device));
@@ -36,6 +59,7 @@ struct GPUMemory {
   static void allocate(Any** ptr, shared_ptr<CudaStream>& pstream,
       size_t size, int device = current_device(), int group = 0) {
     if (!try_allocate(reinterpret_cast<void**>(ptr), pstream, size, device, group)) {
+      LogOOMReports(device);
       LOG(FATAL) << "Failed to allocate " << size << " bytes on device " << device
           << ". " << mgr_.report_dev_info(device);
     }
@@ -50,16 +74,71 @@ struct GPUMemory {
     return mgr_.try_allocate(ptr, pstream, size, device, group);
   }
 
-  static shared_mutex& read_write_mutex() {
-    return mutex_;
+  // Defragmentation at a safe point, when no kernel uses the device memory and nobody
+  // keeps raw pointers into it across the call. BeginDefragment waits for the device and
+  // merges free neighbours, relocate moves an allocation to the lowest free space ahead
+  // of it (slab engine only, the others never move anything) and EndDefragment gives
+  // memory nobody uses back to the driver, returning the number of bytes released.
+  static void BeginDefragment(int device = current_device()) {
+    mgr_.begin_defragment(device);
+  }
+  static bool relocate(void** ptr, shared_ptr<CudaStream>& pstream,
+      int device = current_device()) {
+    return mgr_.relocate(ptr, pstream, device);
+  }
+  static size_t EndDefragment(int device = current_device()) {
+    return mgr_.end_defragment(device);
+  }
+
+  // NCCL collectives and device synchronizing driver calls (cudaMalloc, cudaFree and
+  // their pinned host counterparts) must not overlap: the call may wait for a collective
+  // kernel whose peer is blocked behind the call. The root solver holds CollectiveScope
+  // around collectives, which thus run together and alongside allocations served by
+  // pools. Only the driver calls, rare once pools are warm, hold DriverCallScope.
+  // Neither is reentrant: nothing is allocated inside CollectiveScope.
+  class CollectiveScope {
+   public:
+    CollectiveScope() : lock_(mutex_) {}
+   private:
+    shared_lock<shared_mutex> lock_;
+    DISABLE_COPY_MOVE_AND_ASSIGN(CollectiveScope);
+  };
+  class DriverCallScope {
+   public:
+    DriverCallScope() : lock_(mutex_) {}
+   private:
+    unique_lock<shared_mutex> lock_;
+    DISABLE_COPY_MOVE_AND_ASSIGN(DriverCallScope);
+  };
+
+  // "managed" engine: allocations come from cudaMallocManaged and may exceed device memory
+  static bool managed() {
+    return mgr_.managed_;
+  }
+
+  // Managed memory hints, no-ops for other engines
+  static void advise_on_device(const void* ptr, size_t size, int device = current_device()) {
+    if (managed() && ptr != nullptr) {
+      CUDA_CHECK(cudaMemAdvise(ptr, size, cudaMemAdviseSetPreferredLocation, device));
+      CUDA_CHECK(cudaMemAdvise(ptr, size, cudaMemAdviseSetAccessedBy, device));
+    }
+  }
+
+  static void prefetch(const void* ptr, size_t size, cudaStream_t stream,
+      int device = current_device()) {
+    if (managed() && ptr != nullptr) {
+      CUDA_CHECK(cudaMemPrefetchAsync(ptr, size, device, stream));
+    }
   }
 
   // Scope initializes global Memory Manager for a given scope.
   // It's instantiated in test(), train() and time() Caffe brewing functions
   // as well as in unit tests main().
+  // Allocator engine is "cub" (default), "slab" (see SlabAllocator) or "managed".
+  // Empty engine means CAFFE_GPU_MEM_ENGINE environment variable or default.
   struct Scope {
-    Scope(const std::vector<int>& gpus, bool debug = false) {
-      mgr_.init(gpus, debug);
+    Scope(const std::vector<int>& gpus, bool debug = false, const std::string& engine = "") {
+      mgr_.init(gpus, debug, engine);
     }
     ~Scope() {
     }
@@ -94,6 +173,7 @@ struct GPUMemory {
 
     void reserve(size_t size, int device = current_device()) {
       if (!try_reserve(size, device)) {
+        LogOOMReports(device);
         LOG(FATAL) << "Out of memory: failed to allocate " << size
             << " bytes on device " << device;
       }
@@ -128,15 +208,21 @@ struct GPUMemory {
     ~Manager();
     void lazy_init(int device);
     void GetInfo(size_t* free_mem, size_t* used_mem, bool with_update);
+    void GetUsage(size_t* in_use, size_t* peak, int device);
+    size_t cached_free_bytes(int device);
     void deallocate(void* ptr, int device);
     bool try_allocate(void** ptr, shared_ptr<CudaStream>& pstream,
         size_t size, int device, int group = 0);
-    void init(const std::vector<int>&, bool);
+    void init(const std::vector<int>&, bool, const std::string&);
+    void begin_defragment(int device);
+    bool relocate(void** ptr, shared_ptr<CudaStream>& pstream, int device);
+    size_t end_defragment(int device);
     void reset();
     void* pinned_buffer(size_t size, int device, int group);
     std::string report_dev_info(int device);
 
     bool debug_;
+    bool managed_;
 
    private:
     struct DevInfo {
@@ -154,10 +240,18 @@ struct GPUMemory {
     vector<DevInfo> dev_info_;
     bool initialized_;
     std::unique_ptr<cub::CachingDeviceAllocator> cub_allocator_;
+    std::unique_ptr<SlabAllocator> slab_allocator_;  // replaces CUB when set
     vector<vector<void*>> pinned_host_buffers_;
     vector<vector<void*>> pinned_device_buffers_;
     vector<vector<size_t>> pinned_buffer_sizes_;
     vector<size_t> update_thresholds_;
+    // managed_ engine: sizes of live allocations and their total per device
+    std::mutex managed_mutex_;
+    std::unordered_map<void*, size_t> managed_sizes_;
+    vector<size_t> managed_bytes_;
+    // High-water marks of managed_bytes_ or CUB live bytes, the slab allocator keeps its own
+    std::mutex peak_mutex_;
+    vector<size_t> peak_bytes_;
 
     static const unsigned int BIN_GROWTH;  ///< Geometric growth factor
     static const unsigned int MIN_BIN;  ///< Minimum bin
@@ -165,10 +259,13 @@ struct GPUMemory {
     static const size_t MAX_CACHED_BYTES;  ///< Maximum aggregate cached bytes
     static const size_t MAX_CACHED_SIZE;  ///< 2^MAX_BIN
     static const size_t INITIAL_PINNED_BYTES;
+    static const size_t DEFAULT_ARENA_MB;
   };
 
   static shared_mutex mutex_;
   static mutex ws_mutex_init_;
+  static mutex oom_mutex_;
+  static std::map<const void*, std::pair<int, std::function<std::string()>>> oom_reports_;
   static Manager mgr_;
   static const int INVALID_DEVICE;  ///< Default is invalid: CUB takes care
 
@@ -180,6 +277,16 @@ struct GPUMemory {
   // This one is for TRAIN only:
   static vector<shared_ptr<Workspace>> weights_workspace_;
 
+  // Workspace of the calling thread: workspace_ of the device unless the thread has its
+  // own. Threads running layers concurrently with the solver thread on the same device
+  // need one (see NetParameter::branch_streams and SolverParameter::async_test).
+  static shared_ptr<Workspace> thread_workspace(int device);
+  // Gives the calling thread its own workspace, as large as the device one
+  static void own_thread_workspace();
+  // Makes the calling thread work in the given one, its users take turns (see ModelRepository)
+  static void set_thread_workspace(const shared_ptr<Workspace>& workspace);
+
+  // Workspaces of the current device, makes its GPUContextPool contexts too
   static void Init();
   static void Finalize();
 };
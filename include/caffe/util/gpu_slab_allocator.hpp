@@ -0,0 +1,121 @@
+#ifndef CAFFE_UTIL_GPU_SLAB_ALLOCATOR_HPP_
+#define CAFFE_UTIL_GPU_SLAB_ALLOCATOR_HPP_
+
+#ifndef CPU_ONLY
+
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Device memory allocator carving blocks out of large arenas reserved up front.
+ *
+ * Requests are rounded up to size classes, four classes per power of two. A freed block
+ * remembers the stream it was used on: the same stream reuses it with no synchronization,
+ * other streams wait (on device) for the event recorded when it was freed.
+ * Adjacent free blocks of the same stream are coalesced. Arenas are returned to the
+ * device only when the device runs out of memory.
+ */
+class SlabAllocator {
+ public:
+  SlabAllocator(size_t arena_bytes, bool debug);
+  ~SlabAllocator();
+
+  // Reserves one more arena of at least this size
+  cudaError_t Reserve(int device, size_t bytes);
+  // size_allocated is set to the amount of device memory newly reserved by this call
+  cudaError_t DeviceAllocate(int device, void** ptr, size_t size, cudaStream_t stream,
+      size_t& size_allocated);
+  // size_deallocated is always 0 since blocks go back to their arenas
+  cudaError_t DeviceFree(int device, void* ptr, size_t& size_deallocated);
+  // Returns completely free arenas to the device
+  size_t ReleaseFreeArenas(int device);
+
+  // Defragmentation, only while the device is idle. Coalesce merges all adjacent free
+  // blocks whatever stream freed them and returns the number of blocks merged away.
+  size_t Coalesce(int device);
+  // Moves the block at ptr to the lowest free space fitting it, in an earlier arena or
+  // lower in its own, and queues the copy on stream. Returns the new address, or ptr when
+  // nothing ahead fits.
+  void* Relocate(int device, void* ptr, cudaStream_t stream);
+
+  // Bytes reserved in arenas and not handed out
+  size_t free_bytes(int device);
+  // Bytes handed out and their high-water mark
+  void usage(int device, size_t* in_use, size_t* peak);
+  // Reserved, in use, high-water mark and fragmentation statistics
+  std::string report(int device);
+
+  static size_t size_class(size_t size);
+
+ private:
+  struct Event {
+    Event();
+    ~Event();
+    cudaEvent_t event_;
+    DISABLE_COPY_MOVE_AND_ASSIGN(Event);
+  };
+
+  struct Block {
+    char* ptr_;
+    size_t size_;
+    cudaStream_t stream_;
+    shared_ptr<Event> freed_;  // recorded on stream_ when the block was freed
+    bool free_;
+    Block* prev_;  // neighbours in the arena
+    Block* next_;
+  };
+
+  struct BySize {
+    bool operator()(const Block* a, const Block* b) const {
+      return a->size_ != b->size_ ? a->size_ < b->size_ : a->ptr_ < b->ptr_;
+    }
+  };
+
+  struct Arena {
+    char* base_;
+    size_t size_;
+  };
+
+  struct Pool {
+    Pool() : reserved_(0UL), in_use_(0UL), peak_in_use_(0UL), allocs_(0UL),
+        arena_mallocs_(0UL) {}
+    std::vector<Arena> arenas_;
+    std::set<Block*, BySize> free_blocks_;
+    std::unordered_map<void*, Block*> used_blocks_;
+    size_t reserved_, in_use_, peak_in_use_;
+    size_t allocs_, arena_mallocs_;
+  };
+
+  Pool& pool(int device);
+  cudaError_t reserve(int device, size_t bytes);
+  size_t release_free_arenas(int device);
+  // Hands out bytes of the free block at it, splitting off the rest
+  Block* take(Pool& p, std::set<Block*, BySize>::iterator it, size_t bytes,
+      cudaStream_t stream);
+  // Frees a used block already removed from used_blocks_
+  void give_back(Pool& p, Block* block);
+  static size_t arena_index(const Pool& p, const char* ptr);
+
+  const size_t arena_bytes_;
+  const bool debug_;
+  std::vector<Pool> pools_;
+  std::mutex mutex_;
+
+  static constexpr size_t MIN_CLASS = 512UL;
+  static constexpr size_t ARENA_ALIGN = 2UL * 1024UL * 1024UL;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(SlabAllocator);
+};
+
+}  // namespace caffe
+
+#endif  // CPU_ONLY
+
+#endif  // CAFFE_UTIL_GPU_SLAB_ALLOCATOR_HPP_
@@ -0,0 +1,32 @@
+#ifndef CAFFE_UTIL_GPU_TOPOLOGY_HPP_
+#define CAFFE_UTIL_GPU_TOPOLOGY_HPP_
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Order of devices around a communication ring.
+ *
+ * cost[i][j] rates the link between devices i and j, lower is faster. The ring
+ * returned minimizes its slowest link first, then the sum of its link costs.
+ * Device 0 stays first (it's the root solver's one). Up to 9 devices are solved
+ * exactly, larger sets greedily by nearest neighbour.
+ */
+vector<int> ring_order(const vector<vector<int>>& cost);
+
+#ifndef CPU_ONLY
+// Link cost of every pair of devices: NVML common ancestor level (same board,
+// PCIe switch, host bridge, CPU socket...), links without peer access cost most
+vector<vector<int>> gpu_link_costs(const vector<int>& gpus);
+
+// Reorders gpus into the best ring, logs its links and their measured copy bandwidth,
+// warns about links without peer access
+vector<int> order_gpu_ring(const vector<int>& gpus);
+#endif
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_GPU_TOPOLOGY_HPP_
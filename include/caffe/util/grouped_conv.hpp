@@ -0,0 +1,52 @@
+#ifndef CAFFE_UTIL_GROUPED_CONV_HPP_
+#define CAFFE_UTIL_GROUPED_CONV_HPP_
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Sizes of a 2D NCHW convolution with groups
+struct GroupedConvShape {
+  int num, channels, height, width;
+  int num_output, height_out, width_out;
+  int group;
+  int kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w;
+
+  int channels_per_group() const { return channels / group; }
+  int outputs_per_group() const { return num_output / group; }
+};
+
+// Largest channels per group the direct kernels are meant for, depthwise being 1
+constexpr int GROUPED_CONV_DIRECT_MAX_CHANNELS = 4;
+
+#ifndef CPU_ONLY
+// Direct kernels on the thread stream, weights are num_output x channels/group x kh x kw.
+// bias may be nullptr.
+template <typename Dtype>
+void grouped_conv_forward_gpu(const GroupedConvShape& s, const Dtype* input,
+    const Dtype* weight, const Dtype* bias, Dtype* output);
+// Overwrites input_diff
+template <typename Dtype>
+void grouped_conv_backward_data_gpu(const GroupedConvShape& s, const Dtype* output_diff,
+    const Dtype* weight, Dtype* input_diff);
+// Accumulates into weight_diff
+template <typename Dtype>
+void grouped_conv_backward_filter_gpu(const GroupedConvShape& s, const Dtype* input,
+    const Dtype* output_diff, Dtype* weight_diff);
+
+// im2col per image and one batched gemm over groups. col holds one image's
+// channels x kh x kw x height_out x width_out columns.
+template <typename Dtype>
+void grouped_gemm_conv_forward_gpu(const GroupedConvShape& s, const Dtype* input,
+    const Dtype* weight, const Dtype* bias, Dtype* output, Dtype* col);
+template <typename Dtype>
+void grouped_gemm_conv_backward_data_gpu(const GroupedConvShape& s, const Dtype* output_diff,
+    const Dtype* weight, Dtype* input_diff, Dtype* col);
+template <typename Dtype>
+void grouped_gemm_conv_backward_filter_gpu(const GroupedConvShape& s, const Dtype* input,
+    const Dtype* output_diff, Dtype* weight_diff, Dtype* col);
+#endif
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_GROUPED_CONV_HPP_
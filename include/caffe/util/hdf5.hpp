@@ -1,7 +1,9 @@
 #ifndef CAFFE_UTIL_HDF5_H_
 #define CAFFE_UTIL_HDF5_H_
 
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "hdf5.h"
 #include "hdf5_hl.h"
@@ -18,10 +20,31 @@ void hdf5_load_nd_dataset(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
     Blob* blob);
 
+// Dimensions of the dataset, checked as by hdf5_load_nd_dataset
+std::vector<hsize_t> hdf5_get_nd_dataset_dims(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim);
+
+// Reads rows [first, first + rows) along the first axis of the dataset by a
+// hyperslab, the blob is reshaped to rows x the remaining dimensions
+void hdf5_load_nd_dataset_rows(
+    hid_t file_id, const char* dataset_name_, hsize_t first, hsize_t rows,
+    Blob* blob);
+
 void hdf5_save_nd_dataset(
     const hid_t file_id, const string& dataset_name, const Blob& blob,
     bool write_diff = false);
 
+// Appends the rows of the blob along the first axis of the dataset. On first use it is
+// created extensible, chunked by chunk_rows and gzip compressed at the given level
+// (0 for none). Float16 is stored as float like by hdf5_save_nd_dataset.
+void hdf5_append_nd_dataset(
+    hid_t file_id, const string& dataset_name, const Blob& blob,
+    hsize_t chunk_rows, int compression = 0);
+
+// Unless built thread safe, the HDF5 library must not be entered by two threads at
+// once: every call made off the main thread holds this
+std::mutex& hdf5_mutex();
+
 int hdf5_load_int(hid_t loc_id, const string& dataset_name);
 void hdf5_save_int(hid_t loc_id, const string& dataset_name, int i);
 string hdf5_load_string(hid_t loc_id, const string& dataset_name);
@@ -0,0 +1,71 @@
+#ifndef CAFFE_UTIL_HOST_MEMORY_POOL_HPP_
+#define CAFFE_UTIL_HOST_MEMORY_POOL_HPP_
+
+#ifndef CPU_ONLY
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Process-wide cache of pinned host buffers backing SyncedMemory mirrors (Batch
+ * buffers of data layers including) and staging copies.
+ *
+ * Requests are rounded up to size classes, four classes per power of two, so that
+ * mirrors released and allocated again over and over don't hit cudaMallocHost.
+ * Free buffers are kept by the NUMA node of the thread that allocated them, threads
+ * bound to a device's CPUs (see nvml::setCpuAffinity) get buffers of that node back.
+ * Up to CAFFE_HOST_POOL_MB (default 1024) megabytes of free buffers are kept.
+ */
+class HostMemoryPool {
+ public:
+  struct Stats {
+    size_t hits;
+    size_t misses;  // cudaMallocHost calls
+    size_t used_bytes;
+    size_t peak_used_bytes;
+    size_t cached_bytes;
+  };
+
+  static void* Allocate(size_t size);
+  static void Free(void* ptr, size_t size);
+  // Gives cached buffers back to the system
+  static void Trim();
+  static size_t cached_bytes();
+  static Stats stats();
+  static std::string stats_string();
+
+  static size_t size_class(size_t size);
+
+ private:
+  static size_t limit();
+  // NUMA node of the calling thread's CPU
+  static int current_node();
+  // Books a buffer handed out, under mutex_
+  static void Use(void* ptr, int node, size_t bytes);
+
+  static std::mutex mutex_;
+  // Free buffers by node and size class
+  static std::map<std::pair<int, size_t>, std::vector<void*>> free_;
+  // Buffers handed out and their nodes
+  static std::unordered_map<void*, int> used_;
+  static Stats stats_;
+
+  static constexpr size_t MIN_CLASS = 4096UL;
+  static constexpr size_t DEFAULT_LIMIT_MB = 1024UL;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(HostMemoryPool);
+};
+
+}  // namespace caffe
+
+#endif  // CPU_ONLY
+
+#endif  // CAFFE_UTIL_HOST_MEMORY_POOL_HPP_
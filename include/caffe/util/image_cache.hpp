@@ -0,0 +1,57 @@
+#ifndef CAFFE_UTIL_IMAGE_CACHE_HPP_
+#define CAFFE_UTIL_IMAGE_CACHE_HPP_
+
+#include <opencv2/core/core.hpp>
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Least recently used images bounded by a memory budget, see
+ * ImageDataParameter::cache_images.
+ *
+ * One cache is shared by every layer of the process, thus by all solver ranks.
+ * Values are either file contents (one row of bytes) or decoded images, cached
+ * Mats share their data with those returned and must not be written to.
+ */
+class ImageCache {
+ public:
+  static ImageCache& instance();
+
+  // The budget only grows, the largest any layer asks for applies
+  void reserve(size_t budget_bytes);
+  bool get(const std::string& key, cv::Mat* mat);
+  void put(const std::string& key, const cv::Mat& mat);
+
+  size_t bytes() const;
+  size_t budget() const;
+  // Empties the cache and drops its budget
+  void clear();
+
+  // Bytes a cached Mat holds
+  static size_t mat_bytes(const cv::Mat& mat) {
+    return mat.total() * mat.elemSize();
+  }
+
+ private:
+  ImageCache() : budget_(0UL), bytes_(0UL) {}
+
+  typedef std::list<std::pair<std::string, cv::Mat>> Entries;
+  mutable std::mutex mutex_;
+  Entries entries_;  // most recently used first
+  std::unordered_map<std::string, Entries::iterator> index_;
+  size_t budget_, bytes_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(ImageCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_IMAGE_CACHE_HPP_
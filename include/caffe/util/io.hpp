@@ -181,6 +181,11 @@ cv::Mat ReadImageToCVMat(const string& filename,
 
 cv::Mat ReadImageToCVMat(const string& filename);
 
+// File content as one row of bytes
+bool ReadFileToCVMat(const string& filename, cv::Mat* content);
+// Same as ReadImageToCVMat but for content read by ReadFileToCVMat
+cv::Mat DecodeFileToCVMat(const cv::Mat& content, int height, int width, bool is_color);
+
 cv::Mat DecodeDatumToCVMatNative(const Datum& datum);
 cv::Mat DecodeDatumToCVMat(const Datum& datum, bool is_color);
 bool DecodeDatumNative(Datum* datum);
@@ -191,6 +196,11 @@ vector<int> DecodeDatumToCVMat(const Datum& datum, int color_mode, cv::Mat& cv_i
     bool shape_only, bool accurate_jpeg = true);
 void DecodeDatumToSignedBuf(const Datum& datum, int color_mode,
     char* buf, size_t buf_len, bool accurate_jpeg);
+// Same as above but taking encoded image content directly, i.e. without Datum
+vector<int> DecodeImageToCVMat(const char* content, size_t content_size, int color_mode,
+    cv::Mat& cv_img, bool shape_only, bool accurate_jpeg = true);
+void DecodeImageToSignedBuf(const char* content, size_t content_size, int color_mode,
+    char* buf, size_t buf_len, bool accurate_jpeg);
 
 template<typename Dtype>
 void TBlobDataToCVMat(const TBlob<Dtype>& blob, cv::Mat& img) {
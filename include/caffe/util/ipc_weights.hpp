@@ -0,0 +1,71 @@
+#ifndef CAFFE_UTIL_IPC_WEIGHTS_HPP_
+#define CAFFE_UTIL_IPC_WEIGHTS_HPP_
+
+#ifndef CPU_ONLY
+
+#include <string>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Weights in device memory shared by processes on the same GPU through CUDA IPC.
+ *
+ * The loader process exports: it copies the layers' blobs to one cudaMalloc allocation
+ * (IPC handles cover whole allocations, not pieces of the GPUMemory pool) and writes
+ * its IpcWeightsHandle to a file ending with SUFFIX. Workers attach: they open the
+ * handle and point their params at the allocation, read only, so a worker adds only
+ * its activations. See Net::ToIpcWeights and Net::CopyTrainedLayersFrom.
+ * The loader keeps its IpcWeights as long as workers run, workers as long as their nets.
+ */
+class IpcWeights {
+ public:
+  // Exports an allocation of the given bytes on the current device
+  explicit IpcWeights(size_t bytes);
+  // Attaches to the one of the handle file
+  explicit IpcWeights(const string& handle_file);
+  ~IpcWeights();
+
+  /// @brief Exporter only, copies blob's data in its data type at the next offset.
+  void Add(const string& layer, int blob_id, const Blob& blob);
+  /// @brief Exporter only, writes the handle for workers to attach.
+  void Publish(const string& handle_file);
+
+  const WeightIndex& index() const {
+    return handle_.index();
+  }
+  void* data(const WeightIndex::Tensor& tensor) const {
+    return static_cast<char*>(ptr_) + tensor.offset();
+  }
+  bool exporter() const {
+    return exporter_;
+  }
+  int device() const {
+    return device_;
+  }
+
+  static bool IsHandle(const string& filename);
+  // Bytes a blob takes in the allocation
+  static size_t AlignedBytes(const Blob& blob);
+
+  static constexpr const char* SUFFIX = ".cudaipc";
+  static constexpr int ALIGNMENT_POWER = 8;
+
+ private:
+  const bool exporter_;
+  int device_;
+  void* ptr_;
+  size_t offset_;
+  IpcWeightsHandle handle_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(IpcWeights);
+};
+
+}  // namespace caffe
+
+#endif  // CPU_ONLY
+
+#endif  // CAFFE_UTIL_IPC_WEIGHTS_HPP_
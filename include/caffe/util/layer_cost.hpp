@@ -0,0 +1,35 @@
+#ifndef CAFFE_UTIL_LAYER_COST_HPP_
+#define CAFFE_UTIL_LAYER_COST_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+class LayerBase;
+
+/**
+ * @brief Work of one layer pass at its current shapes, used by caffe time to report
+ * achieved TFLOPS and GB/s.
+ *
+ * By default a layer costs one operation per output (forward) or input (backward)
+ * element and its passes read and write every blob data and diff once, in their own
+ * types. Layers knowing better override LayerBase::Cost: Convolution, Deconvolution
+ * and InnerProduct count multiply-adds times 2, backward computing both data and weight
+ * gradients; BatchNorm, Pooling, LRN and Eltwise count their per element work and
+ * extra passes.
+ */
+struct LayerCost {
+  double forward_flops, backward_flops;
+  double forward_bytes, backward_bytes;
+  // Memory of the layer's outputs, data only
+  size_t activation_bytes;
+};
+
+LayerCost layer_cost(LayerBase* layer, const vector<Blob*>& bottom, const vector<Blob*>& top);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_LAYER_COST_HPP_
@@ -0,0 +1,123 @@
+#ifndef CAFFE_UTIL_LOCK_FREE_RING_HPP_
+#define CAFFE_UTIL_LOCK_FREE_RING_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Bounded preallocated lock-free MPMC ring buffer (D. Vyukov's algorithm).
+ *
+ * Every cell carries a sequence number telling producers and consumers whether
+ * it's their turn, so the only contended operations are CAS on head/tail.
+ * Capacity is rounded up to power of 2. Nothing here blocks: see BlockingQueue
+ * for spin-then-park waiting on top of it.
+ */
+template<typename T>
+class LockFreeRing {
+  struct Cell {
+    std::atomic<size_t> seq;
+    T data;
+  };
+
+ public:
+  explicit LockFreeRing(size_t capacity)
+      : mask_(round_up_pow2(capacity) - 1UL), cells_(mask_ + 1UL), enq_(0UL), deq_(0UL) {
+    for (size_t i = 0; i < cells_.size(); ++i) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  size_t capacity() const {
+    return mask_ + 1UL;
+  }
+
+  bool try_push(const T& t) {
+    Cell* cell;
+    size_t pos = enq_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      const size_t seq = cell->seq.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enq_.compare_exchange_weak(pos, pos + 1UL, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;  // full
+      } else {
+        pos = enq_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data = t;
+    cell->seq.store(pos + 1UL, std::memory_order_release);
+    return true;
+  }
+
+  bool try_pop(T* t) {
+    Cell* cell;
+    size_t pos = deq_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      const size_t seq = cell->seq.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1UL);
+      if (diff == 0) {
+        if (deq_.compare_exchange_weak(pos, pos + 1UL, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;  // empty
+      } else {
+        pos = deq_.load(std::memory_order_relaxed);
+      }
+    }
+    *t = cell->data;
+    cell->data = T();  // don't hold references to popped objects
+    cell->seq.store(pos + mask_ + 1UL, std::memory_order_release);
+    return true;
+  }
+
+  // Only valid when there is a single consumer: nobody else may pop the head meanwhile
+  bool try_peek(T* t) const {
+    const size_t pos = deq_.load(std::memory_order_relaxed);
+    const Cell& cell = cells_[pos & mask_];
+    if (cell.seq.load(std::memory_order_acquire) != pos + 1UL) {
+      return false;
+    }
+    *t = cell.data;
+    return true;
+  }
+
+  // Approximate when accessed concurrently
+  size_t size() const {
+    const size_t deq = deq_.load(std::memory_order_acquire);
+    const size_t enq = enq_.load(std::memory_order_acquire);
+    return enq > deq ? enq - deq : 0UL;
+  }
+
+ private:
+  static size_t round_up_pow2(size_t n) {
+    size_t p = 1UL;
+    while (p < n) {
+      p <<= 1;
+    }
+    return p;
+  }
+
+  const size_t mask_;
+  std::vector<Cell> cells_;
+  // Producers and consumers shouldn't share cache line
+  alignas(64) std::atomic<size_t> enq_;
+  alignas(64) std::atomic<size_t> deq_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(LockFreeRing);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_LOCK_FREE_RING_HPP_
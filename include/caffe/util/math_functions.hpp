@@ -25,7 +25,7 @@ bool is_pow2(unsigned int x) {
 template <typename T>
 void clean_last_element(T* x, cudaStream_t stream) {
   CUDA_CHECK(cudaMemsetAsync(x, 0, sizeof(T), stream));
-//  CUDA_CHECK(cudaStreamSynchronize(stream));
+//  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 #endif
 
@@ -63,6 +63,9 @@ void caffe_cpu_eltwise_min(const int N, const Dtype alpha, const Dtype* X,
 template <typename Dtype>
 void caffe_copy(const int N, const Dtype *X, Dtype *Y);
 
+// Host memcpy of N bytes, split among CpuParallel threads when large
+void caffe_parallel_memcpy(const size_t N, const void* X, void* Y);
+
 template <typename Dtype>
 void caffe_set(const int N, const Dtype alpha, Dtype *X);
 
@@ -188,6 +191,13 @@ void caffe_gpu_gemm(const CBLAS_TRANSPOSE TransA,
     const Dtype alpha, const Dtype* A, const Dtype* B, const Dtype beta,
     Dtype* C);
 
+// batch independent gemms, matrix i of A, B and C starting at i * stride_a, b and c
+template <typename Dtype>
+void caffe_gpu_gemm_strided_batched(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const Dtype alpha, const Dtype* A, long long stride_a, const Dtype* B,
+    long long stride_b, const Dtype beta, Dtype* C, long long stride_c, int batch);
+
 template <typename Dtype>
 void caffe_gpu_gemv(const CBLAS_TRANSPOSE TransA, const int M, const int N,
     const Dtype alpha, const Dtype* A, const Dtype* x, const Dtype beta,
@@ -203,6 +213,32 @@ void caffe_gpu_axpby(const int N, const Dtype alpha, const Dtype* X,
 
 void caffe_gpu_memcpy(const size_t N, const void *X, void *Y);
 
+// Pageable host memory to or from the device through two pinned chunks, one filled
+// while the other is copied. Synchronized on return.
+void caffe_gpu_upload(const size_t N, const void* X, void* Y);
+void caffe_gpu_download(const size_t N, const void* X, void* Y);
+
+// Rows of width elements of the given type: Y packs rows[0..n) of X, or unpacks
+// X into those rows of Y
+void caffe_gpu_gather_rows(Type type, int n, int width, const int* rows, const void* X,
+    void* Y, cudaStream_t stream);
+void caffe_gpu_scatter_rows(Type type, int n, int width, const int* rows, const void* X,
+    void* Y, cudaStream_t stream);
+
+// One launch for any rank: for every index i of shape,
+//   Y[sum_k i_k * y_strides[k]] = X[sum_k i_k * x_strides[k]]
+// A stride of 0 broadcasts. If gather isn't nullptr, X's index along gather_axis
+// is gather[i_gather_axis] (device memory). Queued on stream, nothing waits for it.
+void caffe_gpu_strided_copy(Type type, const vector<int>& shape, const void* X,
+    const vector<int>& x_strides, void* Y, const vector<int>& y_strides,
+    cudaStream_t stream, const int* gather = nullptr, int gather_axis = 0);
+
+// Queued on stream, nothing waits for them: *out += dot(x, y) and y += x over n
+// elements of the given type, accumulated in fp32
+void caffe_gpu_dot_add(Type type, const int n, const void* x, const void* y, float* out,
+    cudaStream_t stream);
+void caffe_gpu_add_to(Type type, const int n, const void* x, float* y, cudaStream_t stream);
+
 template <typename Dtype>
 void caffe_gpu_set(const size_t N, const Dtype alpha, Dtype *X);
 
@@ -210,7 +246,7 @@ inline void caffe_gpu_memset(const size_t N, const int alpha, void* X) {
   cudaStream_t stream = Caffe::thread_stream();
   CUDA_CHECK_ARG2(cudaMemsetAsync(X, alpha, N, stream),
       stream, Caffe::current_device());  // NOLINT(caffe/alt_fn)
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template <typename Dtype>
@@ -268,6 +304,16 @@ template <typename Dtype>
 void caffe_gpu_rng_gaussian(const int n, const Dtype mu, const Dtype sigma,
                             Dtype* r);
 
+// Same as above but drawn on the thread stream from a generator seeded with seed,
+// thus reproducible whatever was drawn before, e.g. by fillers with Caffe::next_seed().
+template <typename Dtype>
+void caffe_gpu_rng_uniform(const int n, const Dtype a, const Dtype b, Dtype* r,
+                           uint64_t seed);
+
+template <typename Dtype>
+void caffe_gpu_rng_gaussian(const int n, const Dtype mu, const Dtype sigma,
+                            Dtype* r, uint64_t seed);
+
 template <typename Dtype>
 void caffe_gpu_rng_bernoulli(const int n, const Dtype p, int* r);
 
@@ -284,6 +330,10 @@ void caffe_gpu_asum(const int n, const Dtype* x, Mtype* y);
 template <typename Dtype>
 void caffe_gpu_amax(const int n, const Dtype* x, float* y);
 
+// y[0] = alpha * sum of x, summed and stored on the device without reading anything back
+template <typename Dtype>
+void caffe_gpu_scaled_sum(const int n, const float* x, const float alpha, Dtype* y);
+
 template<typename Dtype>
 void caffe_gpu_sign(const int n, const Dtype* x, Dtype* y, void* handle = nullptr);
 
@@ -299,6 +349,25 @@ void caffe_gpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 template <typename T_IN, typename T_OUT>
 void caffe_gpu_convert(const unsigned int n, const T_IN* in, T_OUT* out);
 
+// Up to CAFFE_CONVERT_BATCH arrays converted by one launch and one synchronization
+#define CAFFE_CONVERT_BATCH 64
+template <typename T_IN, typename T_OUT>
+void caffe_gpu_convert_batch(const int num, const T_IN* const* in, T_OUT* const* out,
+    const unsigned int* counts);
+
+// out[i] = fp16(scale * (g[i] + residual[i])), the rounding error is left in residual.
+// residual may be nullptr.
+template <typename Dtype>
+void caffe_gpu_compress_fp16(const int n, const Dtype* g, Dtype* residual, float16* out,
+    float scale);
+
+// g[i] = alpha * in[i]
+template <typename Dtype>
+void caffe_gpu_decompress_fp16(const int n, const float16* in, Dtype* g, float alpha);
+
+// acc[i] = g[i] if overwrite, acc[i] + g[i] otherwise, in float; g[i] is zeroed
+void caffe_gpu_accumulate_fp16(const int n, float16* g, float* acc, bool overwrite);
+
 template <typename Dtype>
 float caffe_gpu_max_norm1(const int n, const int m, const Dtype* x);
 
@@ -326,21 +395,21 @@ void caffe_gpu_##name<float>(const int n, const float* x, float* y) { \
   cudaStream_t stream = Caffe::thread_stream(); \
   /* NOLINT_NEXT_LINE(whitespace/operators) */ \
   name##_kernel<float><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n, x, y); \
-  CUDA_CHECK(cudaStreamSynchronize(stream)); \
+  CUDA_CHECK(caffe_gpu_sync(stream)); \
 } \
 template <> \
 void caffe_gpu_##name<double>(const int n, const double* x, double* y) { \
   cudaStream_t stream = Caffe::thread_stream(); \
   /* NOLINT_NEXT_LINE(whitespace/operators) */ \
   name##_kernel<double><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n, x, y); \
-  CUDA_CHECK(cudaStreamSynchronize(stream)); \
+  CUDA_CHECK(caffe_gpu_sync(stream)); \
 } \
 template <> \
 void caffe_gpu_##name<float16>(const int n, const float16* x, float16* y) { \
   cudaStream_t stream = Caffe::thread_stream(); \
   /* NOLINT_NEXT_LINE(whitespace/operators) */ \
   name##_kernel<float16><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n, x, y); \
-  CUDA_CHECK(cudaStreamSynchronize(stream)); \
+  CUDA_CHECK(caffe_gpu_sync(stream)); \
 }
 
 
@@ -359,7 +428,7 @@ void caffe_gpu_##name<float>(const int n, const float* x, float* y, void* handle
   CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream)); \
   /* NOLINT_NEXT_LINE(whitespace/operators) */ \
   name##_kernel<float><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n, x, y); \
-  CUDA_CHECK(cudaStreamSynchronize(stream)); \
+  CUDA_CHECK(caffe_gpu_sync(stream)); \
 } \
 template <> \
 void caffe_gpu_##name<double>(const int n, const double* x, double* y, void* handle) { \
@@ -369,7 +438,7 @@ void caffe_gpu_##name<double>(const int n, const double* x, double* y, void* han
   CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream)); \
   /* NOLINT_NEXT_LINE(whitespace/operators) */ \
   name##_kernel<double><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n, x, y); \
-  CUDA_CHECK(cudaStreamSynchronize(stream)); \
+  CUDA_CHECK(caffe_gpu_sync(stream)); \
 } \
 template <> \
 void caffe_gpu_##name<float16>(const int n, const float16* x, float16* y, void* handle) { \
@@ -379,7 +448,7 @@ void caffe_gpu_##name<float16>(const int n, const float16* x, float16* y, void*
   CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream)); \
   /* NOLINT_NEXT_LINE(whitespace/operators) */ \
   name##_kernel<float16><<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n, x, y); \
-  CUDA_CHECK(cudaStreamSynchronize(stream)); \
+  CUDA_CHECK(caffe_gpu_sync(stream)); \
 }
 #endif  // !CPU_ONLY
 
@@ -391,6 +460,18 @@ inline void caffe_cpu_convert(const int n, const T_IN *in, T_OUT *out) {
   }
 }
 
+#ifndef CPU_ONLY
+// AVX-512, F16C or NEON as the CPU has them, on CpuParallel threads for large n
+template <>
+void caffe_cpu_convert<float16, float>(const int n, const float16 *in, float *out);
+template <>
+void caffe_cpu_convert<float, float16>(const int n, const float *in, float16 *out);
+template <>
+void caffe_cpu_convert<float16, double>(const int n, const float16 *in, double *out);
+template <>
+void caffe_cpu_convert<double, float16>(const int n, const double *in, float16 *out);
+#endif
+
 template <typename T_IN, typename T_OUT>
 inline void caffe_convert(bool use_gpu, const int n, const T_IN* in, T_OUT* out) {
   if (use_gpu) {
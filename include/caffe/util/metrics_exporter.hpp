@@ -0,0 +1,57 @@
+#ifndef CAFFE_UTIL_METRICS_EXPORTER_HPP_
+#define CAFFE_UTIL_METRICS_EXPORTER_HPP_
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Training telemetry, per iteration values are averages since the previous sample
+struct MetricsSample {
+  int iter;
+  int device;
+  double iteration_s, forward_s, backward_s, reduce_s, data_wait_s;
+  double allreduce_bytes, allreduce_bytes_per_s;
+  // Net FLOPs at current shapes over pass times, see layer_cost
+  double forward_tflops, backward_tflops;
+  size_t gpu_mem_in_use, gpu_mem_peak;
+  float learning_rate;
+  float loss;
+};
+
+/**
+ * @brief Exports samples as JSON lines appended to a file and/or as Prometheus text
+ * served by HTTP on a port, see SolverParameter::metrics_interval.
+ */
+class MetricsExporter {
+ public:
+  // Empty file or port 0 disables that output
+  MetricsExporter(const std::string& file, int port);
+  ~MetricsExporter();
+
+  void Record(const MetricsSample& sample);
+
+  static std::string JsonLine(const MetricsSample& sample);
+  static std::string PrometheusText(const MetricsSample& sample);
+
+ private:
+  void Serve();
+
+  std::ofstream file_;
+  int listen_fd_;
+  std::atomic<bool> stop_;
+  std::mutex mutex_;
+  std::string text_;  // served to scrapers, guarded by mutex_
+  std::thread server_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(MetricsExporter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_METRICS_EXPORTER_HPP_
@@ -0,0 +1,243 @@
+#ifndef INCLUDE_CAFFE_UTIL_MULTI_TENSOR_APPLY_CUH_
+#define INCLUDE_CAFFE_UTIL_MULTI_TENSOR_APPLY_CUH_
+
+#include <algorithm>
+
+#include "caffe/common.hpp"
+#include "caffe/util/gpu_math_functions.cuh"
+
+namespace caffe {
+
+// Tensors processed by one launch of multi_tensor_apply
+#define MULTI_TENSOR_MAX 32
+
+// Device side types: float16 is processed as half
+template<typename T>
+struct MultiTensorType {
+  typedef T type;
+};
+template<>
+struct MultiTensorType<float16> {
+  typedef half type;
+};
+
+// Arithmetic is done in float unless weights are double
+template<typename Wtype>
+struct MultiTensorAcc {
+  typedef float type;
+};
+template<>
+struct MultiTensorAcc<double> {
+  typedef double type;
+};
+
+template<typename A, typename T>
+__device__ __forceinline__ A mt_load(const T& x) {
+  return A(x);
+}
+template<>
+__device__ __forceinline__ float mt_load<float, half>(const half& x) {
+  return __half2float(x);
+}
+template<>
+__device__ __forceinline__ double mt_load<double, half>(const half& x) {
+  return __half2float(x);
+}
+
+template<typename T, typename A>
+__device__ __forceinline__ T mt_store(A x) {
+  return T(x);
+}
+template<>
+__device__ __forceinline__ half mt_store<half, float>(float x) {
+  return float2half_clip(x);
+}
+template<>
+__device__ __forceinline__ half mt_store<half, double>(double x) {
+  return float2half_clip(static_cast<float>(x));
+}
+
+// Passed by value: no device side pointer tables to allocate and copy.
+// h2 is the second history slot (Adam), equal to h if unused.
+template<typename Gtype, typename Wtype, typename Htype>
+struct MultiTensorArgs {
+  Gtype* g[MULTI_TENSOR_MAX];
+  Wtype* w[MULTI_TENSOR_MAX];
+  Htype* h[MULTI_TENSOR_MAX];
+  Htype* h2[MULTI_TENSOR_MAX];
+  int n[MULTI_TENSOR_MAX];
+  float local_rate[MULTI_TENSOR_MAX];
+  float local_decay[MULTI_TENSOR_MAX];
+  // Rates computed on the device replace local_rate unless nullptr
+  const float* local_rate_gpu;
+  // SolverParameter::master_weights: FLOAT16 model copy of w written after op, or nullptr
+  half* model[MULTI_TENSOR_MAX];
+};
+
+// One row of blocks per tensor, Op is called for every element
+template<typename Gtype, typename Wtype, typename Htype, typename Op>
+__global__ void MultiTensorApplyKernel(const MultiTensorArgs<Gtype, Wtype, Htype> args,
+    const Op op) {
+  const int t = blockIdx.y;
+  Gtype* g = args.g[t];
+  Wtype* w = args.w[t];
+  Htype* h = args.h[t];
+  Htype* h2 = args.h2[t];
+  half* model = args.model[t];
+  const float local_rate =
+      args.local_rate_gpu != nullptr ? args.local_rate_gpu[t] : args.local_rate[t];
+  for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < args.n[t];
+       i += blockDim.x * gridDim.x) {
+    op(g[i], w[i], h[i], h2[i], local_rate, args.local_decay[t]);
+    if (model != nullptr) {
+      model[i] = mt_store<half>(mt_load<float>(w[i]));
+    }
+  }
+}
+
+/**
+ * @brief Applies an element-wise update functor to many tensors with few launches.
+ * Pointers are host types (float16 included), h2 may be nullptr.
+ * local_rates_gpu, if given, is a device array of num rates used instead of local_rates.
+ * model, if given, holds FLOAT16 copies of w updated in the same pass (nullptr entries
+ * are skipped). Synchronizes the stream once at the end.
+ */
+template<typename Gtype, typename Wtype, typename Htype, typename Op>
+void multi_tensor_apply(int num, const int* n, Gtype* const* g, Wtype* const* w,
+    Htype* const* h, Htype* const* h2, const float* local_rates, const float* local_decays,
+    const Op& op, cudaStream_t stream, const float* local_rates_gpu = nullptr,
+    float16* const* model = nullptr) {
+  typedef typename MultiTensorType<Gtype>::type G;
+  typedef typename MultiTensorType<Wtype>::type W;
+  typedef typename MultiTensorType<Htype>::type H;
+  for (int begin = 0; begin < num; begin += MULTI_TENSOR_MAX) {
+    const int end = std::min(num, begin + MULTI_TENSOR_MAX);
+    MultiTensorArgs<G, W, H> args;
+    int max_n = 0;
+    for (int i = begin; i < end; ++i) {
+      const int k = i - begin;
+      args.g[k] = reinterpret_cast<G*>(g[i]);
+      args.w[k] = reinterpret_cast<W*>(w[i]);
+      args.h[k] = reinterpret_cast<H*>(h[i]);
+      args.h2[k] = reinterpret_cast<H*>(h2 != nullptr ? h2[i] : h[i]);
+      args.n[k] = n[i];
+      args.local_rate[k] = local_rates[i];
+      args.local_decay[k] = local_decays[i];
+      args.model[k] = model != nullptr ? reinterpret_cast<half*>(model[i]) : nullptr;
+      max_n = std::max(max_n, n[i]);
+    }
+    args.local_rate_gpu = local_rates_gpu != nullptr ? local_rates_gpu + begin : nullptr;
+    if (max_n == 0) {
+      continue;
+    }
+    const dim3 grid(CAFFE_GET_BLOCKS(max_n), end - begin);
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    MultiTensorApplyKernel<<<grid, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(args, op);
+    CUDA_POST_KERNEL_CHECK;
+  }
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+}
+
+// Per-tensor blocks of multi_tensor_sumsq, each adds its partial sum once
+#define MULTI_TENSOR_SUMSQ_BLOCKS 64
+
+template<typename T>
+struct MultiTensorListArgs {
+  T* x[MULTI_TENSOR_MAX];
+  int n[MULTI_TENSOR_MAX];
+};
+
+template<typename T>
+__global__ void MultiTensorSumsqKernel(const MultiTensorListArgs<const T> args, float* sumsq,
+    bool per_tensor) {
+  __shared__ float partial[CAFFE_CUDA_NUM_THREADS];
+  const int t = blockIdx.y;
+  const T* x = args.x[t];
+  float s = 0.F;
+  for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < args.n[t];
+       i += blockDim.x * gridDim.x) {
+    const float v = mt_load<float>(x[i]);
+    s += v * v;
+  }
+  partial[threadIdx.x] = s;
+  __syncthreads();
+  for (int k = blockDim.x / 2; k > 0; k >>= 1) {
+    if (threadIdx.x < k) {
+      partial[threadIdx.x] += partial[threadIdx.x + k];
+    }
+    __syncthreads();
+  }
+  if (threadIdx.x == 0) {
+    atomicAdd(per_tensor ? sumsq + t : sumsq, partial[0]);
+  }
+}
+
+template<typename T>
+__global__ void MultiTensorScaleKernel(const MultiTensorListArgs<T> args, const float* scale) {
+  const int t = blockIdx.y;
+  T* x = args.x[t];
+  const float s = *scale;
+  for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < args.n[t];
+       i += blockDim.x * gridDim.x) {
+    x[i] = mt_store<T>(mt_load<float>(x[i]) * s);
+  }
+}
+
+/**
+ * @brief Adds the sum of squares of many tensors to *sumsq (device memory), or that
+ * of tensor i to sumsq[i] if per_tensor, with one segmented reduction per
+ * MULTI_TENSOR_MAX tensors. Doesn't synchronize.
+ */
+template<typename T>
+void multi_tensor_sumsq(int num, const int* n, const T* const* x, float* sumsq,
+    cudaStream_t stream, bool per_tensor = false) {
+  typedef typename MultiTensorType<T>::type D;
+  for (int begin = 0; begin < num; begin += MULTI_TENSOR_MAX) {
+    const int end = std::min(num, begin + MULTI_TENSOR_MAX);
+    MultiTensorListArgs<const D> args;
+    int max_n = 0;
+    for (int i = begin; i < end; ++i) {
+      args.x[i - begin] = reinterpret_cast<const D*>(x[i]);
+      args.n[i - begin] = n[i];
+      max_n = std::max(max_n, n[i]);
+    }
+    if (max_n == 0) {
+      continue;
+    }
+    const dim3 grid(std::min(CAFFE_GET_BLOCKS(max_n), MULTI_TENSOR_SUMSQ_BLOCKS), end - begin);
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    MultiTensorSumsqKernel<<<grid, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(args,
+        per_tensor ? sumsq + begin : sumsq, per_tensor);
+    CUDA_POST_KERNEL_CHECK;
+  }
+}
+
+/**
+ * @brief Multiplies many tensors by *scale (device memory). Doesn't synchronize.
+ */
+template<typename T>
+void multi_tensor_scale(int num, const int* n, T* const* x, const float* scale,
+    cudaStream_t stream) {
+  typedef typename MultiTensorType<T>::type D;
+  for (int begin = 0; begin < num; begin += MULTI_TENSOR_MAX) {
+    const int end = std::min(num, begin + MULTI_TENSOR_MAX);
+    MultiTensorListArgs<D> args;
+    int max_n = 0;
+    for (int i = begin; i < end; ++i) {
+      args.x[i - begin] = reinterpret_cast<D*>(x[i]);
+      args.n[i - begin] = n[i];
+      max_n = std::max(max_n, n[i]);
+    }
+    if (max_n == 0) {
+      continue;
+    }
+    const dim3 grid(CAFFE_GET_BLOCKS(max_n), end - begin);
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    MultiTensorScaleKernel<<<grid, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(args, scale);
+    CUDA_POST_KERNEL_CHECK;
+  }
+}
+
+}  // namespace caffe
+
+#endif  // INCLUDE_CAFFE_UTIL_MULTI_TENSOR_APPLY_CUH_
@@ -0,0 +1,100 @@
+#ifndef CAFFE_UTIL_NVDEC_DECODER_HPP_
+#define CAFFE_UTIL_NVDEC_DECODER_HPP_
+
+#if defined(USE_NVDEC) && !defined(CPU_ONLY)
+
+#include <cuda.h>
+#include <nvcuvid.h>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+extern "C" {
+struct AVBSFContext;
+struct AVFormatContext;
+struct AVPacket;
+}
+
+#define CU_CHECK(condition) \
+  do { \
+    CUresult result = condition; \
+    CHECK_EQ(result, CUDA_SUCCESS) << " CUDA driver error " << result \
+      << ", device " << Caffe::current_device(); \
+  } while (0)
+
+namespace caffe {
+
+/**
+ * @brief Reads frames of H.264 and HEVC video files decoded by NVDEC.
+ *
+ * Files are demuxed by libavformat, their frames decoded and resized by the GPU's video
+ * decoder and converted to device memory, HWC packed BGR, i.e. in the layout CPU image
+ * decoders produce. Only the frames asked for are converted: reading seeks to the key
+ * frame before the first of them. The decoder is kept from one file to the next while
+ * the stream format stays the same.
+ * One instance per transformer thread: it's not thread safe.
+ */
+class NvDecVideoReader {
+ public:
+  // Frames are resized to new_height x new_width unless both are 0
+  NvDecVideoReader(int new_height, int new_width);
+  ~NvDecVideoReader();
+
+  // Opens a file and returns its number of frames, estimated from the duration when the
+  // container doesn't tell
+  int Open(const std::string& path);
+  // Frame size after resize, known once opened
+  int rows() const {
+    return rows_;
+  }
+  int cols() const {
+    return cols_;
+  }
+  // Decodes frames first + i * stride, i < count, of the open file to dst (device memory,
+  // count x rows x cols x 3 bytes) on the stream given and synchronizes the stream.
+  // Frames past the end of the file repeat the last one.
+  void Read(int first, int count, int stride, uint8_t* dst, cudaStream_t stream);
+
+ private:
+  void Close();
+  // Feeds the parser one packet, the end of stream when pkt is null
+  void Parse(const AVPacket* pkt);
+  // Parser callbacks
+  static int CUDAAPI HandleSequence(void* reader, CUVIDEOFORMAT* format);
+  static int CUDAAPI HandleDecode(void* reader, CUVIDPICPARAMS* pic);
+  static int CUDAAPI HandleDisplay(void* reader, CUVIDPARSERDISPINFO* disp);
+  int Sequence(const CUVIDEOFORMAT& format);
+  void Display(const CUVIDPARSERDISPINFO& disp);
+
+  const int new_height_, new_width_;
+  CUdevice device_;
+  CUcontext context_;
+  CUvideoctxlock lock_;
+  // Decoder for the stream format and output size it was created with
+  CUvideodecoder decoder_;
+  CUVIDEOFORMAT decoder_format_;
+  int target_rows_, target_cols_;
+  CUvideoparser parser_;
+  AVFormatContext* format_;
+  AVBSFContext* bsf_;
+  int stream_, rows_, cols_, frames_;
+  double fps_, time_base_;
+  int64_t start_pts_;
+  // Frames being read: index of the first and stride, converted ones and destination
+  int first_, stride_;
+  vector<bool> done_;
+  uint8_t* dst_;
+  cudaStream_t cuda_stream_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(NvDecVideoReader);
+};
+
+// NV12 surface of a decoded frame to HWC BGR bytes, BT.709 or BT.601 colors
+void nv12_to_bgr_gpu(const uint8_t* nv12, size_t pitch, int rows, int cols, bool bt709,
+    uint8_t* bgr, cudaStream_t stream);
+
+}  // namespace caffe
+
+#endif  // USE_NVDEC && !CPU_ONLY
+#endif  // CAFFE_UTIL_NVDEC_DECODER_HPP_
@@ -0,0 +1,70 @@
+#ifndef CAFFE_UTIL_NVJPEG_DECODER_HPP_
+#define CAFFE_UTIL_NVJPEG_DECODER_HPP_
+
+#if defined(USE_NVJPEG) && !defined(CPU_ONLY)
+
+#include <nvjpeg.h>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+#define NVJPEG_CHECK(condition) \
+  do { \
+    nvjpegStatus_t status = condition; \
+    CHECK_EQ(status, NVJPEG_STATUS_SUCCESS) << " nvJPEG status " << status \
+      << ", device " << Caffe::current_device(); \
+  } while (0)
+
+namespace caffe {
+
+/**
+ * @brief Batched JPEG decoder running on GPU.
+ *
+ * Images of one batch are queued one by one and then decoded by a single
+ * nvjpegDecodeBatched call straight to device memory, HWC packed (BGR or gray),
+ * i.e. in the same layout CPU decoders produce.
+ * One instance per transformer thread: it's not thread safe.
+ */
+class NvJpegDecoder {
+ public:
+  NvJpegDecoder();
+  ~NvJpegDecoder();
+
+  static bool is_jpeg(const char* content, size_t size) {
+    return size > 1UL
+        && static_cast<unsigned char>(content[0]) == 255
+        && static_cast<unsigned char>(content[1]) == 216;
+  }
+
+  // Queues JPEG image to be decoded to 'dst' (device memory).
+  // Content is copied unless 'persistent' is set, i.e. it stays valid till Decode call.
+  void Add(const char* content, size_t size, bool persistent, void* dst);
+  // Decodes all queued images of height x width x channels (1 or 3) on the stream given
+  // and synchronizes the stream.
+  void Decode(int height, int width, int channels, cudaStream_t stream);
+
+  size_t queued() const {
+    return lengths_.size();
+  }
+
+ private:
+  void Init(int batch_size, nvjpegOutputFormat_t format);
+
+  nvjpegHandle_t handle_;
+  nvjpegJpegState_t state_;
+  int batch_size_;
+  nvjpegOutputFormat_t format_;
+  // Copies of non-persistent contents
+  vector<char> staging_;
+  vector<size_t> offsets_;
+  vector<const unsigned char*> data_;
+  vector<size_t> lengths_;
+  vector<unsigned char*> dst_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(NvJpegDecoder);
+};
+
+}  // namespace caffe
+
+#endif  // USE_NVJPEG && !CPU_ONLY
+#endif  // CAFFE_UTIL_NVJPEG_DECODER_HPP_
@@ -0,0 +1,62 @@
+#ifndef CAFFE_UTIL_NVTX_HPP_
+#define CAFFE_UTIL_NVTX_HPP_
+
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// NVTX range colors (ARGB), one per subsystem
+enum NvtxColor : unsigned int {
+  NVTX_FORWARD = 0xFF76B900U,
+  NVTX_BACKWARD = 0xFF3C8C00U,
+  NVTX_REDUCE = 0xFFE53935U,
+  NVTX_SOLVER = 0xFF1E88E5U,
+  NVTX_DATA = 0xFFFFB300U,
+  NVTX_WAIT = 0xFF9E9E9EU
+};
+
+#ifdef USE_NVTX
+// Range shown by Nsight Systems until the end of the scope. Built with USE_NVTX,
+// pushed only when the CAFFE_NVTX environment variable is set.
+class NvtxRange {
+ public:
+  NvtxRange() : pushed_(false) {}
+  ~NvtxRange() {
+    if (pushed_) {
+      Pop();
+    }
+  }
+
+  void Push(NvtxColor color, const char* name);
+  void Push(NvtxColor color, const std::string& name) {
+    Push(color, name.c_str());
+  }
+
+  static bool enabled() {
+    return enabled_;
+  }
+
+ private:
+  static void Pop();
+
+  static const bool enabled_;
+  bool pushed_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(NvtxRange);
+};
+
+#define NVTX_CONCAT_(a, b) a##b
+#define NVTX_CONCAT(a, b) NVTX_CONCAT_(a, b)
+// The name is evaluated only when ranges are recorded
+#define NVTX_RANGE(color, name) \
+  caffe::NvtxRange NVTX_CONCAT(nvtx_range_, __LINE__); \
+  if (caffe::NvtxRange::enabled()) NVTX_CONCAT(nvtx_range_, __LINE__).Push(color, name)
+#else
+#define NVTX_RANGE(color, name)
+#endif
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_NVTX_HPP_
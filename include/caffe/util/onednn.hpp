@@ -0,0 +1,83 @@
+#ifndef CAFFE_UTIL_ONEDNN_HPP_
+#define CAFFE_UTIL_ONEDNN_HPP_
+
+#ifdef USE_ONEDNN
+
+#include <dnnl.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+namespace onednn {
+
+typedef std::unordered_map<int, dnnl::memory> Args;
+
+// CPU engine of the process
+dnnl::engine& engine();
+// In-order stream of the calling thread
+dnnl::stream& stream();
+
+dnnl::memory::dims dims(const vector<int>& shape);
+// Float data of a blob in its packing (see Blob::packing): nchw or nhwc for 4D blobs,
+// nc for 2D ones
+dnnl::memory::desc desc(const Blob& blob);
+dnnl::memory::desc desc(const vector<int>& shape, dnnl::memory::data_type type,
+    dnnl::memory::format_tag tag);
+// Shapes and packings of the blobs, primitives are made again when it changes
+string shapes(const vector<Blob*>& blobs);
+
+// Attributes of convolutions and inner products: forward_math FLOAT16 multiplies
+// in bfloat16 on CPUs having it (AVX512_BF16, AMX), in float elsewhere
+dnnl::primitive_attr math_attr(const LayerParameter& param);
+
+// Runs the primitive on stream() and waits
+void Execute(const dnnl::primitive& primitive, const Args& args);
+void Reorder(const dnnl::memory& src, const dnnl::memory& dst);
+
+/**
+ * @brief Symmetric INT8 quantization as Int8Gemm's, so that INT8 layers give the
+ *        CAFFE engine's results: q = round(x / scale) clipped to [-127, 127].
+ */
+void Quantize(int count, const float* x, float scale, int8_t* q);
+/**
+ * @brief Weights quantized with a scale per row (output channel), max|w| / 127.
+ * @param transposed w is cols x rows, q is written rows x cols nevertheless
+ */
+void QuantizeRows(int rows, int cols, const float* w, bool transposed, int8_t* q,
+    float* scales);
+
+/**
+ * @brief Weights in the layout a primitive picked for the CPU, reordered from the
+ *        plain one of their blob on first use and kept till Reset (see
+ *        LayerBase::WeightsChanged). While training they are reordered on every pass.
+ */
+class Weights {
+ public:
+  Weights() : ready_(false) {}
+
+  // plain describes data, picked the layout wanted
+  const dnnl::memory& Get(const dnnl::memory::desc& plain, const void* data,
+      const dnnl::memory::desc& picked, bool keep);
+  void Reset() {
+    ready_ = false;
+  }
+
+ private:
+  dnnl::memory memory_;
+  bool ready_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(Weights);
+};
+
+}  // namespace onednn
+
+}  // namespace caffe
+
+#endif  // USE_ONEDNN
+#endif  // CAFFE_UTIL_ONEDNN_HPP_
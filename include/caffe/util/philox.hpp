@@ -0,0 +1,52 @@
+#ifndef CAFFE_UTIL_PHILOX_HPP_
+#define CAFFE_UTIL_PHILOX_HPP_
+
+#include <cstdint>
+
+#ifdef __CUDACC__
+#define PHILOX_HD __host__ __device__
+#else
+#define PHILOX_HD
+#endif
+
+namespace caffe {
+
+/**
+ * @brief Philox4x32-10 counter based generator (Salmon et al., "Parallel Random Numbers:
+ *        As Easy as 1, 2, 3"). Stateless: the same key and counter give the same four
+ *        numbers on the host and on the device, so any element can draw its own in any
+ *        order, and draw it again later.
+ */
+struct Philox4x32 {
+  uint32_t v[4];
+};
+
+PHILOX_HD inline Philox4x32 philox4x32(Philox4x32 ctr, uint32_t key0, uint32_t key1) {
+  for (int round = 0; round < 10; ++round) {
+    const uint64_t p0 = static_cast<uint64_t>(0xD2511F53U) * ctr.v[0];
+    const uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57U) * ctr.v[2];
+    const uint32_t hi0 = static_cast<uint32_t>(p0 >> 32), lo0 = static_cast<uint32_t>(p0);
+    const uint32_t hi1 = static_cast<uint32_t>(p1 >> 32), lo1 = static_cast<uint32_t>(p1);
+    ctr.v[0] = hi1 ^ ctr.v[1] ^ key0;
+    ctr.v[1] = lo1;
+    ctr.v[2] = hi0 ^ ctr.v[3] ^ key1;
+    ctr.v[3] = lo0;
+    key0 += 0x9E3779B9U;
+    key1 += 0xBB67AE85U;
+  }
+  return ctr;
+}
+
+// Draw number index of stream offset under seed, uniform over 32 bits
+PHILOX_HD inline uint32_t philox_uint(uint64_t seed, uint64_t offset, uint32_t index) {
+  Philox4x32 ctr;
+  ctr.v[0] = index;
+  ctr.v[1] = static_cast<uint32_t>(offset);
+  ctr.v[2] = static_cast<uint32_t>(offset >> 32);
+  ctr.v[3] = 0U;
+  return philox4x32(ctr, static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)).v[0];
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PHILOX_HPP_
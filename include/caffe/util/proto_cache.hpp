@@ -0,0 +1,50 @@
+#ifndef CAFFE_UTIL_PROTO_CACHE_HPP_
+#define CAFFE_UTIL_PROTO_CACHE_HPP_
+
+#include <functional>
+#include <string>
+
+#include "google/protobuf/message.h"
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Process-wide cache of parsed and normalized protos, shared by all solvers
+ * (ranks) of the process.
+ *
+ * A text file is parsed and normalized (e.g. upgraded) once per process, later reads of
+ * the same contents copy that result. With CAFFE_PROTO_CACHE_DIR set the normalized
+ * message is also kept there in binary form, named after a hash of the contents, so the
+ * next runs skip text parsing and upgrades as well. Transform does the same in memory
+ * for passes like Net::FilterNet and InsertSplits.
+ */
+class ProtoCache {
+ public:
+  typedef ::google::protobuf::Message Message;
+  typedef std::function<void(Message*)> Normalization;
+  typedef std::function<void(const Message&, Message*)> Transformation;
+
+  // False if the file doesn't parse
+  static bool ReadTextFile(const string& filename, Message* proto,
+      const Normalization& normalize);
+
+  // Sets out to transform(in), run once per distinct in and name
+  template <typename Proto>
+  static void Transform(const string& name, const Proto& in, Proto* out,
+      void (*transform)(const Proto&, Proto*)) {
+    Transform(name, in, out, Transformation([transform](const Message& i, Message* o) {
+      transform(static_cast<const Proto&>(i), static_cast<Proto*>(o));
+    }));
+  }
+  static void Transform(const string& name, const Message& in, Message* out,
+      const Transformation& transform);
+
+  // Drops the copies kept in memory
+  static void Clear();
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PROTO_CACHE_HPP_
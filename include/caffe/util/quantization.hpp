@@ -0,0 +1,78 @@
+#ifndef CAFFE_UTIL_QUANTIZATION_HPP_
+#define CAFFE_UTIL_QUANTIZATION_HPP_
+
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/syncedmem.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Saturation threshold minimizing the KL divergence between a histogram
+ *        of absolute values and its quantization to 128 levels.
+ * @param hist counts of |x| in bins of bin_width starting at 0
+ * @return threshold, hist.size() * bin_width when nothing saturates
+ */
+float kl_divergence_threshold(const vector<double>& hist, float bin_width);
+
+/**
+ * @brief Smallest threshold keeping the given fraction of |x| unsaturated.
+ */
+float percentile_threshold(const vector<double>& hist, float bin_width, double fraction);
+
+/**
+ * @brief Symmetric INT8 matrix product Y = dequantize(Q(X) * Q(W)^T) + bias.
+ *
+ * W is N x K, quantized once by SetWeights with a scale per row (output channel).
+ * X is M x K, quantized on every call with the calibrated input scale. Products are
+ * accumulated in INT32, then scaled back and biased in the forward type. Rows are
+ * padded to a multiple of 4 so the GPU path can use cublasGemmEx and __dp4a.
+ */
+class Int8Gemm {
+ public:
+  Int8Gemm();
+
+  /**
+   * @param w N x K, or K x N if transposed
+   * @param input_scale X is quantized as round(x / input_scale)
+   */
+  template <typename Dtype>
+  void SetWeights(int N, int K, const Dtype* w, bool transposed, float input_scale);
+
+  bool initialized() const {
+    return static_cast<bool>(weights_);
+  }
+
+  /**
+   * @param x M x K, or K x M if x_transposed
+   * @param bias N values, may be nullptr
+   * @param y M x N, or N x M if y_transposed
+   */
+  template <typename Dtype>
+  void Forward_cpu(int M, const Dtype* x, bool x_transposed, const Dtype* bias, Dtype* y,
+      bool y_transposed);
+#ifndef CPU_ONLY
+  template <typename Dtype>
+  void Forward_gpu(int M, const Dtype* x, bool x_transposed, const Dtype* bias, Dtype* y,
+      bool y_transposed);
+#endif
+
+  static constexpr int LEVELS = 127;
+
+ private:
+  void Reserve(int M);
+
+  int N_, K_, Kp_, M_;
+  float input_scale_;
+  // N x Kp int8 weights, N float scales of the products
+  shared_ptr<SyncedMemory> weights_, out_scales_;
+  // M x Kp int8 inputs, M x N int32 products
+  shared_ptr<SyncedMemory> x_, acc_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(Int8Gemm);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_QUANTIZATION_HPP_
@@ -0,0 +1,57 @@
+#ifndef CAFFE_UTIL_RENDEZVOUS_HPP_
+#define CAFFE_UTIL_RENDEZVOUS_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief TCP rendezvous of processes (nodes) taking part in one training job.
+ *
+ * Node 0 listens on the master endpoint given as "host:port", every other
+ * node connects to it and introduces itself by its node rank. The resulting
+ * star is used for bootstrap (NCCL unique ids) and for the few small
+ * collectives done on host: test scores and the early exit flag.
+ * All nodes must make the same calls in the same order.
+ */
+class Rendezvous {
+ public:
+  // Blocks until all nodes are connected or timeout_sec expires
+  Rendezvous(int nodes, int node_rank, const std::string& master, int timeout_sec = 300);
+  ~Rendezvous();
+
+  int nodes() const {
+    return nodes_;
+  }
+  int node_rank() const {
+    return node_rank_;
+  }
+
+  // Node 0 sends its data to every other node
+  void Broadcast(void* data, size_t size);
+  // Element-wise sum across nodes, the result is delivered to every node
+  void AllReduceSum(float* data, size_t count);
+  // True on every node if it's true on any of them
+  bool AnyTrue(bool value);
+  void Barrier();
+
+ private:
+  void listen_and_accept(const std::string& host, int port, int timeout_sec);
+  void connect_to_master(const std::string& host, int port, int timeout_sec);
+  static void send_all(int fd, const void* data, size_t size);
+  static void recv_all(int fd, void* data, size_t size);
+
+  const int nodes_;
+  const int node_rank_;
+  // Node 0: sockets of nodes 1..N-1 indexed by node rank - 1. Others: one master socket.
+  std::vector<int> peers_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(Rendezvous);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_RENDEZVOUS_HPP_
@@ -38,6 +38,34 @@ template <class RandomAccessIterator>
 inline void shuffle(RandomAccessIterator begin, RandomAccessIterator end) {
   shuffle(begin, end, caffe_rng());
 }
+
+// i-th element of pseudo-random permutation of [0, n) defined by the key.
+// Computed on the fly by Feistel network with cycle walking: nothing is stored
+// or reordered, every key gives another permutation.
+inline size_t permuted_index(size_t i, size_t n, uint64_t key) {
+  CHECK_LT(i, n);
+  int half_bits = 1;
+  while ((1ULL << (2 * half_bits)) < n) {
+    ++half_bits;
+  }
+  const uint64_t mask = (1ULL << half_bits) - 1ULL;
+  uint64_t x = i;
+  do {
+    uint64_t l = x >> half_bits, r = x & mask;
+    for (uint64_t round = 0ULL; round < 4ULL; ++round) {
+      // splitmix64 finalizer as round function
+      uint64_t f = r + key + round * 0x9E3779B97F4A7C15ULL;
+      f = (f ^ (f >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      f = (f ^ (f >> 27)) * 0x94D049BB133111EBULL;
+      f ^= f >> 31;
+      const uint64_t t = r;
+      r = (l ^ f) & mask;
+      l = t;
+    }
+    x = (l << half_bits) | r;
+  } while (x >= n);
+  return static_cast<size_t>(x);
+}
 }  // namespace caffe
 
 #endif  // CAFFE_RNG_HPP_
@@ -0,0 +1,97 @@
+#ifndef CAFFE_UTIL_SHM_ARENA_HPP_
+#define CAFFE_UTIL_SHM_ARENA_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Append-only arena of variable size records placed in a named POSIX
+ * shared memory segment.
+ *
+ * The first process to create the segment becomes its owner: it appends
+ * records and seals the arena when done. Every other process attaching to
+ * the same name waits for the seal and then reads records in place. Stale
+ * segments left by crashed owners are detected and re-created.
+ * Records are 8-byte aligned and prefixed by their size, the offset index is
+ * rebuilt locally by every process on first access after the seal.
+ */
+class ShmArena {
+ public:
+  enum State {
+    BUILDING = 0,
+    READY = 1,
+    FAILED = 2
+  };
+
+  // Creates the segment or attaches to existing one.
+  // Capacity is data bytes reserved by owner, ignored when attaching.
+  ShmArena(const std::string& name, size_t capacity);
+  ~ShmArena();
+
+  bool owner() const {
+    return owner_;
+  }
+  const std::string& name() const {
+    return name_;
+  }
+  State state() const;
+
+  // Owner only. Returns false and fails the arena if it's out of capacity.
+  bool append(const void* data, size_t size);
+  void seal();
+  void fail();
+
+  // Blocks until owner seals or fails the arena. Returns true if sealed.
+  // Not thread safe: builds the index on first successful call.
+  bool wait_ready();
+
+  // Valid only after successful wait_ready() call
+  size_t count() const {
+    return index_.size();
+  }
+  const char* record(size_t i, size_t* size) const;
+
+  // Segment name for a given source: stable across processes while the source is unchanged
+  static std::string segment_name(const std::string& source);
+  // Size of a file, or total size of regular files in a directory (like LMDB)
+  static size_t path_bytes(const std::string& source);
+
+  static constexpr uint64_t MAGIC = 0xCAFFEA7E5A7E0001ULL;
+
+ private:
+  struct Header {
+    std::atomic<uint64_t> magic;
+    std::atomic<uint32_t> state;
+    int32_t owner_pid;
+    uint64_t capacity;
+    uint64_t used;
+    uint64_t count;
+  };
+
+  bool create(size_t capacity);
+  bool attach();
+  bool stale() const;
+  void build_index();
+  char* data() const {
+    return reinterpret_cast<char*>(header_) + align_up<6>(sizeof(Header));
+  }
+
+  const std::string name_;
+  bool owner_;
+  int fd_;
+  size_t mapped_size_;
+  Header* header_;
+  vector<size_t> index_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(ShmArena);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SHM_ARENA_HPP_
@@ -0,0 +1,38 @@
+#ifndef CAFFE_UTIL_SIMD_TRANSFORM_HPP_
+#define CAFFE_UTIL_SIMD_TRANSFORM_HPP_
+
+#include <cstddef>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Vectorized conversion of 8-bit HWC 3-channel image rows to CHW planes:
+ *
+ *   dst[c][h][w] = src[h][w'][c] * scale - mean[c],  w' = mirror ? width - 1 - w : w
+ *
+ * The mean is expected to be already scaled. The kernel (AVX-512, AVX2 or NEON)
+ * is selected at runtime on first call.
+ * @return false if there is no kernel for this CPU or output type,
+ * nothing is done then.
+ */
+bool simd_hwc3_to_chw(const unsigned char* src, size_t src_step, int height, int width,
+    float scale, const float* mean, bool mirror, float* dst);
+#ifndef CPU_ONLY
+bool simd_hwc3_to_chw(const unsigned char* src, size_t src_step, int height, int width,
+    float scale, const float* mean, bool mirror, float16* dst);
+#endif
+
+template<typename Dtype>
+bool simd_hwc3_to_chw(const unsigned char* src, size_t src_step, int height, int width,
+    float scale, const float* mean, bool mirror, Dtype* dst) {
+  return false;
+}
+
+// Name of the kernel set selected: "avx512", "avx2", "neon" or "none"
+const char* simd_transform_isa();
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SIMD_TRANSFORM_HPP_
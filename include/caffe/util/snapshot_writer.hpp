@@ -0,0 +1,63 @@
+#ifndef CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
+#define CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/task_scheduler.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Writes snapshot files, when asynchronous by low priority TaskScheduler tasks
+ * run one at a time in order, see SolverParameter::snapshot_async and snapshot_keep.
+ *
+ * Every file is written under a temporary name and renamed once complete, thus a
+ * snapshot file present is a whole one. Files written since the previous Commit make
+ * one snapshot, with keep > 0 the files of older snapshots are removed once a newer
+ * one is complete.
+ */
+class SnapshotWriter {
+ public:
+  // Writes the file of the given path
+  typedef std::function<void(const std::string& path)> WriteFunction;
+
+  SnapshotWriter(bool async, int keep);
+  // Waits for pending writes
+  ~SnapshotWriter();
+
+  // Asynchronous writes must not refer to anything training changes, see HostCopy
+  void Write(const std::string& filename, const WriteFunction& write);
+  // Directory of the files written so far, removed after them if it's empty then
+  void AddDirectory(const std::string& dir);
+  void Commit();
+  // Returns once everything queued is written
+  void Wait();
+
+  bool async() const {
+    return async_;
+  }
+
+  // Host copy of the blob taken at the call, with its diff if with_diff
+  static shared_ptr<Blob> HostCopy(const Blob& blob, bool with_diff);
+
+ private:
+  void Run(const std::function<void()>& job);
+
+  const bool async_;
+  const int keep_;
+  std::vector<std::string> written_;  // since the last Commit
+  std::deque<std::vector<std::string>> kept_;  // by the jobs only
+  std::unique_ptr<TaskGroup> jobs_;  // if async
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(SnapshotWriter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SNAPSHOT_WRITER_HPP_
@@ -0,0 +1,85 @@
+#ifndef CAFFE_UTIL_SPARSE_2_4_HPP_
+#define CAFFE_UTIL_SPARSE_2_4_HPP_
+
+#include <cmath>
+#include <vector>
+
+#ifdef __CUDACC__
+#define SPARSE24_HD __host__ __device__
+#else
+#define SPARSE24_HD
+#endif
+
+namespace caffe {
+
+/**
+ * @brief 2:4 structured sparsity (ParamSpec::sparse_2_4): of every group of 4
+ *        consecutive values at most 2 are non-zero, which sparse tensor cores exploit.
+ *        Groups lie along the rows of weights, count(1) values of their first axis.
+ *        Masks keep 4 bits per group, bit i set if value i is kept, 8 groups per word.
+ */
+inline bool sparse_2_4_shape(const std::vector<int>& shape) {
+  if (shape.size() < 2) {
+    return false;
+  }
+  int row = 1;
+  for (size_t i = 1; i < shape.size(); ++i) {
+    row *= shape[i];
+  }
+  return row > 0 && row % 4 == 0;
+}
+
+inline int sparse_2_4_mask_words(int count) {
+  return (count / 4 + 7) / 8;
+}
+
+// Keeps the 2 largest magnitudes, the first of equal ones
+SPARSE24_HD inline unsigned int sparse_2_4_group_mask(const float (&a)[4]) {
+  unsigned int mask = 0U;
+  for (int i = 0; i < 4; ++i) {
+    int rank = 0;
+    for (int j = 0; j < 4; ++j) {
+      rank += a[j] > a[i] || (a[j] == a[i] && j < i);
+    }
+    if (rank < 2) {
+      mask |= 1U << i;
+    }
+  }
+  return mask;
+}
+
+template<typename Dtype>
+void sparse_2_4_mask_cpu(int count, const Dtype* w, unsigned int* mask) {
+  const int groups = count / 4;
+  for (int k = 0; k < sparse_2_4_mask_words(count); ++k) {
+    unsigned int word = 0U;
+    for (int g = k * 8; g < groups && g < k * 8 + 8; ++g) {
+      const float a[4] = {std::fabs(static_cast<float>(w[4 * g])),
+          std::fabs(static_cast<float>(w[4 * g + 1])),
+          std::fabs(static_cast<float>(w[4 * g + 2])),
+          std::fabs(static_cast<float>(w[4 * g + 3]))};
+      word |= sparse_2_4_group_mask(a) << (4 * (g - k * 8));
+    }
+    mask[k] = word;
+  }
+}
+
+template<typename Dtype>
+void sparse_2_4_apply_cpu(int count, const unsigned int* mask, Dtype* w) {
+  for (int i = 0; i < count; ++i) {
+    if (((mask[i / 32] >> (i % 32)) & 1U) == 0U) {
+      w[i] = Dtype(0);
+    }
+  }
+}
+
+#ifndef CPU_ONLY
+template<typename Dtype>
+void sparse_2_4_mask_gpu(int count, const Dtype* w, unsigned int* mask, void* handle);
+template<typename Dtype>
+void sparse_2_4_apply_gpu(int count, const unsigned int* mask, Dtype* w, void* handle);
+#endif
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SPARSE_2_4_HPP_
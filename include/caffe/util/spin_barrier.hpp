@@ -0,0 +1,77 @@
+#ifndef CAFFE_UTIL_SPIN_BARRIER_HPP_
+#define CAFFE_UTIL_SPIN_BARRIER_HPP_
+
+#include <boost/thread.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Sense-reversing barrier of a fixed number of threads.
+ *
+ * The last thread to arrive flips the generation, the others spin on it for a
+ * while and then park on the condition variable, the same way BlockingQueue waits
+ * on its ring. In the common case of ranks arriving within microseconds of each
+ * other nobody goes through the kernel. Parking keeps boost interruption points,
+ * so stopping a thread waiting here works as it did with boost::barrier.
+ *
+ * Every wait is timed into a log2 histogram of microseconds. Callers passing their
+ * rank also get counted when they arrive last: that's the straggler everyone else
+ * waits for.
+ */
+class SpinBarrier {
+ public:
+  explicit SpinBarrier(unsigned int count);
+
+  // rank is used for statistics only, -1 to skip
+  void wait(int rank = -1);
+
+  unsigned int count() const {
+    return count_;
+  }
+  // Waits of [2^(i-1), 2^i) microseconds, bucket 0 is under 1 us, last one is open
+  uint64_t histogram(size_t bucket) const {
+    return histogram_[bucket].load(std::memory_order_relaxed);
+  }
+  // Times the rank arrived last
+  uint64_t last_arrivals(int rank) const {
+    return last_arrivals_[rank].load(std::memory_order_relaxed);
+  }
+  // Times the waiting thread had to park
+  uint64_t parks() const {
+    return parks_.load(std::memory_order_relaxed);
+  }
+  // One line summary of the above, empty if nobody waited yet
+  string report() const;
+
+  static constexpr size_t BUCKETS = 24UL;
+
+ private:
+  void record(int rank, uint64_t wait_us, bool last);
+
+  const unsigned int count_;
+  std::atomic<unsigned int> arrived_;
+  std::atomic<unsigned int> generation_;
+  std::atomic<int> parked_;
+  boost::mutex mutex_;
+  boost::condition_variable condition_;
+
+  std::array<std::atomic<uint64_t>, BUCKETS> histogram_;
+  std::unique_ptr<std::atomic<uint64_t>[]> last_arrivals_;
+  std::atomic<uint64_t> parks_;
+
+  static constexpr int SPIN_COUNT = 256;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(SpinBarrier);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SPIN_BARRIER_HPP_
@@ -0,0 +1,105 @@
+#ifndef CAFFE_UTIL_TASK_SCHEDULER_HPP_
+#define CAFFE_UTIL_TASK_SCHEDULER_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// NUMA node of a CPU, 0 if unknown
+int cpu_numa_node(int cpu);
+
+/**
+ * @brief Process-wide work-stealing scheduler of short CPU tasks: image reads of data
+ * layers (ThreadPool), snapshot writes and weight file copies, see TaskGroup.
+ *
+ * Every worker owns a deque per priority. Tasks submitted by a worker go to its own
+ * deques, others are spread round robin. A worker runs its newest task first and steals
+ * the oldest ones of others, those of workers on its NUMA node first. Higher priority
+ * tasks of any worker run before lower ones. Workers are spread over the NUMA nodes of
+ * the CPUs the process may use, each one kept on its node. The thread count is
+ * CAFFE_TASK_THREADS, or the number of cores.
+ */
+class TaskScheduler {
+ public:
+  enum Priority {
+    HIGH,    // on the critical path of training, e.g. reads of the next batch
+    NORMAL,
+    LOW,     // background work, e.g. snapshot writes
+    PRIORITIES
+  };
+  typedef std::function<void()> Task;
+
+  static void Submit(Task task, Priority priority = NORMAL);
+  // Runs one queued task on the calling worker thread, false if none or not a worker
+  static bool RunOne();
+  static bool on_worker() {
+    return worker_id_ >= 0;
+  }
+  static int num_threads();
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks[PRIORITIES];
+    // Workers to steal from, same NUMA node first
+    std::vector<int> victims;
+  };
+
+  TaskScheduler();
+  static TaskScheduler& instance();
+
+  bool Take(int worker_id, Task* task);
+  void WorkerEntry(int worker_id, const std::vector<int>& cpus);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::mutex idle_mutex_;
+  std::condition_variable idle_cv_;
+  std::atomic<int> queued_;
+  std::atomic<unsigned int> next_;
+
+  static thread_local int worker_id_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(TaskScheduler);
+};
+
+/**
+ * @brief Tasks of one subsystem run by the TaskScheduler, at most limit at a time.
+ *
+ * Tasks over the limit wait here in submission order, so a limit of 1 runs them one
+ * after another in that order. Wait returns once everything submitted has run, on a
+ * worker thread it runs other tasks meanwhile. The destructor waits.
+ */
+class TaskGroup {
+ public:
+  TaskGroup(int limit, TaskScheduler::Priority priority);
+  ~TaskGroup();
+
+  void Submit(TaskScheduler::Task task);
+  void Wait();
+
+ private:
+  void Launch(TaskScheduler::Task task);
+  void Done();
+
+  const int limit_;
+  const TaskScheduler::Priority priority_;
+  std::mutex mutex_;
+  std::condition_variable done_cv_;
+  std::deque<TaskScheduler::Task> waiting_;
+  int running_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(TaskGroup);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_TASK_SCHEDULER_HPP_
@@ -0,0 +1,125 @@
+#ifndef CAFFE_UTIL_TENSOR_FILE_HPP_
+#define CAFFE_UTIL_TENSOR_FILE_HPP_
+
+#include <cstdint>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#if defined(USE_CUFILE) && !defined(CPU_ONLY)
+#include <cufile.h>
+#endif
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#ifndef CPU_ONLY
+#include "caffe/util/gpu_memory.hpp"
+#endif
+
+namespace caffe {
+
+/**
+ * @brief Tensor file layout: a header page, then fixed size records of preprocessed
+ *        values packed one after another, then one int32 label per record.
+ *        Consecutive records are one contiguous range of the file, read by one call.
+ */
+struct TensorFileHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t type;  // Type of the values
+  uint64_t records;
+  uint64_t record_bytes;
+  uint64_t data_offset;
+  uint64_t labels_offset;
+  uint32_t num_axes;
+  int32_t shape[8];  // of a record
+};
+
+class TensorFileWriter {
+ public:
+  TensorFileWriter(const string& filename, Type type, const vector<int>& record_shape);
+  ~TensorFileWriter();
+
+  /// @brief Appends a record, count(record_shape) values of the file's type, and its label.
+  void Add(const void* record, int label);
+  /// @brief Writes the labels and the header, called by the destructor if needed.
+  void Close();
+
+ private:
+  const string filename_;
+  const Type type_;
+  const vector<int> shape_;
+  uint64_t record_bytes_;
+  std::ofstream out_;
+  vector<int32_t> labels_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(TensorFileWriter);
+};
+
+/**
+ * @brief Reads ranges of records of a tensor file. With USE_CUFILE they go from the
+ *        file to device memory by GPUDirect Storage, neither the CPU nor host memory
+ *        touches them. Reads of several threads at a time are fine.
+ */
+class TensorFile {
+ public:
+  explicit TensorFile(const string& filename);
+  ~TensorFile();
+
+  Type type() const {
+    return type_;
+  }
+  uint64_t records() const {
+    return records_;
+  }
+  const vector<int>& record_shape() const {
+    return shape_;
+  }
+  size_t record_bytes() const {
+    return record_bytes_;
+  }
+  int label(uint64_t record) const {
+    return labels_[record];
+  }
+
+  /// @brief Reads records [first, first + count) to host memory.
+  void Read(uint64_t first, size_t count, void* dst) const;
+  /// @brief Whether ReadDevice is available: built with USE_CUFILE and the file system
+  /// takes O_DIRECT reads registered with the cuFile driver.
+  bool direct() const;
+#if defined(USE_CUFILE) && !defined(CPU_ONLY)
+  /// @brief Reads records [first, first + count) to device memory by cuFile. The read is
+  /// widened to page boundaries: records land in dst when their range is page aligned
+  /// and dst isn't null, in staging otherwise. Returns where they are.
+  const void* ReadDevice(uint64_t first, size_t count, void* dst,
+      GPUMemory::Workspace* staging) const;
+#endif
+
+  /// @brief Whether the file starts with the tensor file magic.
+  static bool Is(const string& filename);
+
+  static constexpr uint64_t MAGIC = 0xCAFFE7E4507F11E5ULL;
+  static constexpr uint32_t VERSION = 1U;
+  // Page size, and what O_DIRECT reads need
+  static constexpr int ALIGNMENT_POWER = 12;
+
+ private:
+  const string filename_;
+  int fd_;
+  Type type_;
+  vector<int> shape_;
+  uint64_t records_;
+  size_t record_bytes_;
+  uint64_t data_offset_;
+  vector<int32_t> labels_;
+#if defined(USE_CUFILE) && !defined(CPU_ONLY)
+  int direct_fd_;
+  CUfileHandle_t handle_;
+#endif
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(TensorFile);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_TENSOR_FILE_HPP_
@@ -0,0 +1,86 @@
+#ifndef CAFFE_UTIL_TENSORRT_ENGINE_HPP_
+#define CAFFE_UTIL_TENSORRT_ENGINE_HPP_
+
+#if defined(USE_TENSORRT) && !defined(CPU_ONLY)
+
+#include <NvInfer.h>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+class Net;
+
+/**
+ * @brief Layers [first, last] of a TEST net run as TensorRT engines,
+ * see NetParameter::tensorrt.
+ *
+ * The layers are converted into a TensorRT network reading the segment's inputs
+ * (blobs written before it) and writing its outputs (blobs read after it), both in the
+ * blobs' own types. One engine is built per distinct set of input shapes, on first use,
+ * or deserialized from TensorRTParameter::cache_dir. Needs TensorRT 8.5 or later.
+ */
+class TensorRTSegment {
+ public:
+  TensorRTSegment(const Net& net, int first, int last, const vector<Blob*>& inputs,
+      const vector<Blob*>& outputs, const TensorRTParameter& param);
+  ~TensorRTSegment();
+
+  // Whether the layer's type and parameter have a TensorRT counterpart. Shapes are
+  // checked when the network is defined, a segment failing there runs natively.
+  static bool Supported(LayerBase* layer);
+
+  // Runs the layers on Caffe::thread_stream(). False if no engine can be made for the
+  // current input shapes: the caller runs the layers natively then.
+  bool Forward();
+  // Drops the engines, e.g. after new weights are copied in
+  void Reset();
+
+  int first() const {
+    return first_;
+  }
+  int last() const {
+    return last_;
+  }
+
+ private:
+  struct Engine {
+    nvinfer1::ICudaEngine* engine;
+    nvinfer1::IExecutionContext* context;
+  };
+
+  bool Build(const string& shapes, Engine* engine);
+  // Adds the layers to network, false if one can't be expressed
+  bool Define(nvinfer1::INetworkDefinition* network);
+  bool AddLayer(nvinfer1::INetworkDefinition* network, int layer_id,
+      const vector<nvinfer1::ITensor*>& in, vector<nvinfer1::ITensor*>* out);
+  // Float copy of the blob's data kept till the engine is built
+  nvinfer1::Weights weights(const Blob& blob);
+  nvinfer1::Weights weights(vector<float>&& values);
+  // Layers, their weights and the settings, hashed into cache file names
+  string Fingerprint() const;
+
+  const Net& net_;
+  const int first_, last_;
+  const vector<Blob*> inputs_, outputs_;
+  const TensorRTParameter param_;
+  nvinfer1::IRuntime* runtime_;
+  // By input shapes, failed ones as null engines
+  std::map<string, Engine> engines_;
+  std::list<vector<float>> weights_;
+  string last_shapes_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(TensorRTSegment);
+};
+
+}  // namespace caffe
+
+#endif  // USE_TENSORRT && !CPU_ONLY
+#endif  // CAFFE_UTIL_TENSORRT_ENGINE_HPP_
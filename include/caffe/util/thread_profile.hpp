@@ -0,0 +1,80 @@
+#ifndef CAFFE_UTIL_THREAD_PROFILE_HPP_
+#define CAFFE_UTIL_THREAD_PROFILE_HPP_
+
+#include <atomic>
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Always on profile of a worker thread: cumulative time in each pipeline state.
+ *
+ * InternalThread attaches one to every thread it runs, code down the call chain marks
+ * what it is doing with Scope. A state change costs two time stamp counter reads and
+ * a relaxed atomic add, only the owning thread writes. Summary reports every thread
+ * and every state since the previous summary, see SolverParameter::thread_profile_interval.
+ */
+class ThreadProfile {
+ public:
+  enum State {
+    IDLE,
+    READ,       // database cursor and I/O
+    PARSE,      // datum deserialization
+    DECODE,     // image decoding
+    TRANSFORM,  // batch assembly and transformation
+    REDUCE,     // gradient reduction
+    UPDATE,     // solver updates
+    BLOCKED,    // waiting on a queue or a peer
+    STATES
+  };
+
+  explicit ThreadProfile(const std::string& name);
+  ~ThreadProfile();
+
+  // Makes this the calling thread's profile, starting in IDLE
+  void attach();
+  // Returns the previous state
+  State enter(State state);
+
+  // Profile of the calling thread, nullptr if none was attached
+  static ThreadProfile* current();
+  static const char* state_name(State state);
+  // One line per thread and a total per state since the previous call
+  static std::string Summary();
+
+  // Sets the state of the calling thread until the end of the scope
+  class Scope {
+   public:
+    explicit Scope(State state)
+        : profile_(current()), prev_(profile_ == nullptr ? IDLE : profile_->enter(state)) {}
+    ~Scope() {
+      if (profile_ != nullptr) {
+        profile_->enter(prev_);
+      }
+    }
+
+   private:
+    ThreadProfile* const profile_;
+    const State prev_;
+
+    DISABLE_COPY_MOVE_AND_ASSIGN(Scope);
+  };
+
+ private:
+  // Ticks including the open interval of the current state
+  void read(uint64_t* ticks) const;
+
+  const std::string name_;
+  std::atomic<uint64_t> ticks_[STATES];
+  std::atomic<int> state_;
+  std::atomic<uint64_t> since_;
+  uint64_t reported_[STATES];  // guarded by the registry mutex
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(ThreadProfile);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_PROFILE_HPP_
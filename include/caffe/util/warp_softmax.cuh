@@ -0,0 +1,229 @@
+#ifndef INCLUDE_CAFFE_UTIL_WARP_SOFTMAX_CUH_
+#define INCLUDE_CAFFE_UTIL_WARP_SOFTMAX_CUH_
+
+#include <cfloat>
+#include <type_traits>
+
+#include "caffe/common.hpp"
+#include "caffe/util/gpu_math_functions.cuh"
+#include "caffe/util/multi_tensor_apply.cuh"
+
+namespace caffe {
+
+// Longest contiguous row, in values of PACK, handled by the warp kernels: 32 lanes of
+// 32 registers
+#define WARP_SOFTMAX_MAX_COLS 1024
+#define WARP_SOFTMAX_THREADS 128
+
+// Reduction over the WIDTH lanes of a group, every lane gets the result
+template <typename A, int WIDTH>
+__device__ __forceinline__ A warp_group_max(A v) {
+  for (int offset = WIDTH / 2; offset > 0; offset /= 2) {
+    v = max(v, __shfl_xor_sync(0xffffffff, v, offset, WIDTH));
+  }
+  return v;
+}
+
+template <typename A, int WIDTH>
+__device__ __forceinline__ A warp_group_sum(A v) {
+  for (int offset = WIDTH / 2; offset > 0; offset /= 2) {
+    v += __shfl_xor_sync(0xffffffff, v, offset, WIDTH);
+  }
+  return v;
+}
+
+// PACK values at p, two halves in one half2 load
+template <typename T, typename A, int PACK>
+struct WarpSoftmaxIO {
+  static __device__ __forceinline__ void load(const T* p, A* v) {
+#pragma unroll
+    for (int i = 0; i < PACK; ++i) {
+      v[i] = mt_load<A, T>(p[i]);
+    }
+  }
+  static __device__ __forceinline__ void store(T* p, const A* v) {
+#pragma unroll
+    for (int i = 0; i < PACK; ++i) {
+      p[i] = mt_store<T, A>(v[i]);
+    }
+  }
+};
+
+template <>
+struct WarpSoftmaxIO<half, float, 2> {
+  static __device__ __forceinline__ void load(const half* p, float* v) {
+    const float2 f = __half22float2(*reinterpret_cast<const half2*>(p));
+    v[0] = f.x;
+    v[1] = f.y;
+  }
+  static __device__ __forceinline__ void store(half* p, const float* v) {
+    *reinterpret_cast<half2*>(p) = float22half2_clip(make_float2(v[0], v[1]));
+  }
+};
+
+// One row of channels contiguous values per group of WIDTH lanes, held in ELEMS * PACK
+// registers per lane: y = exp(x - max) / sum. Lanes of rows past the end take part in
+// the shuffles. y may be x.
+template <typename T, typename A, int WIDTH, int ELEMS, int PACK>
+__global__ void WarpSoftmaxForwardGPU(const int rows, const int channels, const T* x, T* y) {
+  const int row = (blockIdx.x * blockDim.x + threadIdx.x) / WIDTH;
+  const int lane = threadIdx.x % WIDTH;
+  const size_t offset = static_cast<size_t>(row) * channels;
+  A v[ELEMS][PACK];
+  A m = -FLT_MAX;
+#pragma unroll
+  for (int k = 0; k < ELEMS; ++k) {
+    const int col = (k * WIDTH + lane) * PACK;
+    if (row < rows && col < channels) {
+      WarpSoftmaxIO<T, A, PACK>::load(x + offset + col, v[k]);
+#pragma unroll
+      for (int p = 0; p < PACK; ++p) {
+        m = max(m, v[k][p]);
+      }
+    }
+  }
+  m = warp_group_max<A, WIDTH>(m);
+  A sum = A(0);
+#pragma unroll
+  for (int k = 0; k < ELEMS; ++k) {
+    const int col = (k * WIDTH + lane) * PACK;
+    if (row < rows && col < channels) {
+#pragma unroll
+      for (int p = 0; p < PACK; ++p) {
+        v[k][p] = exp(v[k][p] - m);
+        sum += v[k][p];
+      }
+    }
+  }
+  sum = warp_group_sum<A, WIDTH>(sum);
+  const A k_sum = A(1) / sum;
+#pragma unroll
+  for (int k = 0; k < ELEMS; ++k) {
+    const int col = (k * WIDTH + lane) * PACK;
+    if (row < rows && col < channels) {
+#pragma unroll
+      for (int p = 0; p < PACK; ++p) {
+        v[k][p] *= k_sum;
+      }
+      WarpSoftmaxIO<T, A, PACK>::store(y + offset + col, v[k]);
+    }
+  }
+}
+
+// dx = y * (dy - dot(dy, y)) per row, as the forward kernel. dx may be dy.
+template <typename T, typename A, int WIDTH, int ELEMS, int PACK>
+__global__ void WarpSoftmaxBackwardGPU(const int rows, const int channels, const T* y,
+    const T* dy, T* dx) {
+  const int row = (blockIdx.x * blockDim.x + threadIdx.x) / WIDTH;
+  const int lane = threadIdx.x % WIDTH;
+  const size_t offset = static_cast<size_t>(row) * channels;
+  A yv[ELEMS][PACK], dv[ELEMS][PACK];
+  A dot = A(0);
+#pragma unroll
+  for (int k = 0; k < ELEMS; ++k) {
+    const int col = (k * WIDTH + lane) * PACK;
+    if (row < rows && col < channels) {
+      WarpSoftmaxIO<T, A, PACK>::load(y + offset + col, yv[k]);
+      WarpSoftmaxIO<T, A, PACK>::load(dy + offset + col, dv[k]);
+#pragma unroll
+      for (int p = 0; p < PACK; ++p) {
+        dot += yv[k][p] * dv[k][p];
+      }
+    }
+  }
+  dot = warp_group_sum<A, WIDTH>(dot);
+#pragma unroll
+  for (int k = 0; k < ELEMS; ++k) {
+    const int col = (k * WIDTH + lane) * PACK;
+    if (row < rows && col < channels) {
+#pragma unroll
+      for (int p = 0; p < PACK; ++p) {
+        dv[k][p] = yv[k][p] * (dv[k][p] - dot);
+      }
+      WarpSoftmaxIO<T, A, PACK>::store(dx + offset + col, dv[k]);
+    }
+  }
+}
+
+// Launches the kernel fitting rows of cols packs: groups as narrow as the row allows,
+// then more registers per lane
+template <typename T, typename A, int PACK, bool FORWARD>
+void warp_softmax_launch(const int rows, const int channels, const int cols, const T* a,
+    const T* b, T* out, cudaStream_t stream) {
+  int width = 1;
+  while (width < cols && width < 32) {
+    width *= 2;
+  }
+  int elems = 1;
+  while (elems * width < cols) {
+    elems *= 2;
+  }
+  const int groups_per_block = WARP_SOFTMAX_THREADS / width;
+  const int blocks = (rows + groups_per_block - 1) / groups_per_block;
+#define WARP_SOFTMAX_CASE(W, E) \
+  if (width == W && elems == E) { \
+    if (FORWARD) { \
+      WarpSoftmaxForwardGPU<T, A, W, E, PACK> \
+          <<<blocks, WARP_SOFTMAX_THREADS, 0, stream>>>(rows, channels, a, out); \
+    } else { \
+      WarpSoftmaxBackwardGPU<T, A, W, E, PACK> \
+          <<<blocks, WARP_SOFTMAX_THREADS, 0, stream>>>(rows, channels, a, b, out); \
+    } \
+    CUDA_POST_KERNEL_CHECK; \
+    return; \
+  }
+  WARP_SOFTMAX_CASE(1, 1)
+  WARP_SOFTMAX_CASE(2, 1)
+  WARP_SOFTMAX_CASE(4, 1)
+  WARP_SOFTMAX_CASE(8, 1)
+  WARP_SOFTMAX_CASE(16, 1)
+  WARP_SOFTMAX_CASE(32, 1)
+  WARP_SOFTMAX_CASE(32, 2)
+  WARP_SOFTMAX_CASE(32, 4)
+  WARP_SOFTMAX_CASE(32, 8)
+  WARP_SOFTMAX_CASE(32, 16)
+  WARP_SOFTMAX_CASE(32, 32)
+#undef WARP_SOFTMAX_CASE
+  LOG(FATAL) << "No warp softmax kernel for rows of " << channels;
+}
+
+template <typename T, typename A, bool FORWARD>
+bool warp_softmax(const int rows, const int channels, const T* a, const T* b, T* out) {
+  // Two halves per load when every row starts at an even value
+  const int pack = std::is_same<T, half>::value && channels % 2 == 0 ? 2 : 1;
+  const int cols = (channels + pack - 1) / pack;
+  if (rows <= 0 || cols > WARP_SOFTMAX_MAX_COLS) {
+    return false;
+  }
+  cudaStream_t stream = Caffe::thread_stream();
+  if (pack == 2) {
+    warp_softmax_launch<T, A, 2, FORWARD>(rows, channels, cols, a, b, out, stream);
+  } else {
+    warp_softmax_launch<T, A, 1, FORWARD>(rows, channels, cols, a, b, out, stream);
+  }
+  CUDA_CHECK(caffe_gpu_sync(stream));
+  return true;
+}
+
+/**
+ * @brief Softmax of rows contiguous rows of channels values (inner dimension 1), one
+ * row per warp or group of lanes of a warp, entirely in registers, accumulated in A.
+ * Returns false, doing nothing, for rows longer than the kernels take.
+ */
+template <typename T, typename A>
+bool warp_softmax_forward(const int rows, const int channels, const T* x, T* y) {
+  return warp_softmax<T, A, true>(rows, channels, x, nullptr, y);
+}
+
+/**
+ * @brief Softmax gradient dx of the rows, given their softmax y and its gradient dy.
+ */
+template <typename T, typename A>
+bool warp_softmax_backward(const int rows, const int channels, const T* y, const T* dy,
+    T* dx) {
+  return warp_softmax<T, A, false>(rows, channels, y, dy, dx);
+}
+
+}  // namespace caffe
+
+#endif  // INCLUDE_CAFFE_UTIL_WARP_SOFTMAX_CUH_
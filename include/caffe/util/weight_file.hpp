@@ -0,0 +1,94 @@
+#ifndef CAFFE_UTIL_WEIGHT_FILE_HPP_
+#define CAFFE_UTIL_WEIGHT_FILE_HPP_
+
+#include <cstdint>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Weight file layout: a header page, tensors at page aligned offsets and
+ *        a WeightIndex after them. Unlike a caffemodel it isn't parsed as one message,
+ *        so it has no 2GB limit and tensors are read in place from a memory mapping.
+ */
+struct WeightFileHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t index_offset;
+  uint64_t index_bytes;
+};
+
+class WeightFileWriter {
+ public:
+  // With checksums every tensor gets its WeightIndex::Tensor::crc32
+  explicit WeightFileWriter(const string& filename, bool checksums = false);
+  ~WeightFileWriter();
+
+  /// @brief Appends blob's data in its data type, compressed if 2:4 sparse.
+  void Add(const string& layer, int blob_id, const Blob& blob);
+  /// @brief Writes the index and the header, called by the destructor if needed.
+  void Close();
+
+ private:
+  void Pad();
+
+  const string filename_;
+  const bool checksums_;
+  std::ofstream out_;
+  WeightIndex index_;
+  uint64_t offset_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(WeightFileWriter);
+};
+
+/// @brief Read only memory mapping of a weight file.
+class WeightFile {
+ public:
+  explicit WeightFile(const string& filename);
+  ~WeightFile();
+
+  const WeightIndex& index() const {
+    return index_;
+  }
+  const void* data(const WeightIndex::Tensor& tensor) const {
+    return mapped_ + tensor.offset();
+  }
+  size_t size() const {
+    return size_;
+  }
+
+  /// @brief Whether the tensor's bytes match its crc32, true if it has none.
+  bool Verify(const WeightIndex::Tensor& tensor) const;
+  /// @brief Copies the tensor's values to host memory of count * tsize(type) bytes.
+  void Read(const WeightIndex::Tensor& tensor, void* dst) const;
+  /// @brief Bytes a tensor of count values takes in the file.
+  static uint64_t StoredBytes(uint64_t count, Type type, bool sparse_2_4);
+
+  /// @brief Whether the file starts with the weight file magic.
+  static bool Is(const string& filename);
+  /// @brief CRC-32 (IEEE) of the bytes, continuing crc.
+  static uint32_t Checksum(const void* data, size_t bytes, uint32_t crc = 0U);
+
+  static constexpr uint64_t MAGIC = 0xCAFFE3E16470F11EULL;
+  static constexpr uint32_t VERSION = 1U;
+  // Page size, and what O_DIRECT reads need
+  static constexpr int ALIGNMENT_POWER = 12;
+
+ private:
+  const string filename_;
+  const char* mapped_;
+  size_t size_;
+  WeightIndex index_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(WeightFile);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WEIGHT_FILE_HPP_
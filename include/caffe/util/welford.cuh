@@ -0,0 +1,92 @@
+#ifndef INCLUDE_CAFFE_UTIL_WELFORD_CUH_
+#define INCLUDE_CAFFE_UTIL_WELFORD_CUH_
+
+#include "caffe/common.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
+
+namespace caffe {
+
+// Count, mean and sum of squared deviations of the values added so far, in the
+// accumulation type A (float for FLOAT16 data). Mean and variance come out of one read
+// of the data, without the cancellation of E(X^2) - (EX)^2.
+template<typename A>
+struct Welford {
+  A n, mean, m2;
+
+  __device__ __forceinline__ Welford() : n(A(0)), mean(A(0)), m2(A(0)) {}
+
+  __device__ __forceinline__ void add(A x) {
+    n += A(1);
+    const A d = x - mean;
+    mean += d / n;
+    m2 += d * (x - mean);
+  }
+
+  // Chan et al.'s formula for the union of both sets
+  __device__ __forceinline__ void merge(A n_b, A mean_b, A m2_b) {
+    if (n_b == A(0)) {
+      return;
+    }
+    const A n_ab = n + n_b;
+    const A d = mean_b - mean;
+    mean += d * n_b / n_ab;
+    m2 += m2_b + d * d * n * n_b / n_ab;
+    n = n_ab;
+  }
+
+  // Population variance
+  __device__ __forceinline__ A var() const {
+    return n > A(0) ? m2 / n : A(0);
+  }
+};
+
+// Merges the accumulators of a block of THREADS threads, a power of 2; every thread gets
+// the result
+template<typename A, int THREADS>
+__device__ Welford<A> welford_block_reduce(Welford<A> w) {
+  __shared__ A n[THREADS], mean[THREADS], m2[THREADS];
+  n[threadIdx.x] = w.n;
+  mean[threadIdx.x] = w.mean;
+  m2[threadIdx.x] = w.m2;
+  __syncthreads();
+  for (int stride = THREADS / 2; stride > 0; stride /= 2) {
+    if (threadIdx.x < stride) {
+      Welford<A> a;
+      a.n = n[threadIdx.x];
+      a.mean = mean[threadIdx.x];
+      a.m2 = m2[threadIdx.x];
+      a.merge(n[threadIdx.x + stride], mean[threadIdx.x + stride], m2[threadIdx.x + stride]);
+      n[threadIdx.x] = a.n;
+      mean[threadIdx.x] = a.mean;
+      m2[threadIdx.x] = a.m2;
+    }
+    __syncthreads();
+  }
+  Welford<A> result;
+  result.n = n[0];
+  result.mean = mean[0];
+  result.m2 = m2[0];
+  __syncthreads();
+  return result;
+}
+
+// Sum over a block of THREADS threads, a power of 2, in every thread
+template<typename A, int THREADS>
+__device__ A block_sum(A value) {
+  __shared__ A buf[THREADS];
+  buf[threadIdx.x] = value;
+  __syncthreads();
+  for (int stride = THREADS / 2; stride > 0; stride /= 2) {
+    if (threadIdx.x < stride) {
+      buf[threadIdx.x] += buf[threadIdx.x + stride];
+    }
+    __syncthreads();
+  }
+  const A sum = buf[0];
+  __syncthreads();
+  return sum;
+}
+
+}  // namespace caffe
+
+#endif  // INCLUDE_CAFFE_UTIL_WELFORD_CUH_
@@ -1,7 +1,7 @@
 from .pycaffe import Net, SGDSolver, NesterovSolver, AdaGradSolver, RMSPropSolver, \
     AdaDeltaSolver, AdamSolver
 from ._caffe import set_mode_cpu, set_mode_gpu, set_device, set_devices, Layer, get_solver, \
-    layer_type_list
+    layer_type_list, InferenceEngine
 from ._caffe import CAFFE_VERSION as __version__
 from .proto.caffe_pb2 import TRAIN, TEST
 from .classifier import Classifier
@@ -10,11 +10,17 @@
 #include <numpy/arrayobject.h>
 
 // these need to be included after boost on OS X
+#include <chrono>  // NOLINT(build/include_order)
+#include <condition_variable>  // NOLINT(build/include_order)
+#include <cstdint>  // NOLINT(build/include_order)
+#include <cstring>  // NOLINT(build/include_order)
+#include <mutex>  // NOLINT(build/include_order)
 #include <string>  // NOLINT(build/include_order)
 #include <vector>  // NOLINT(build/include_order)
 #include <fstream>  // NOLINT
 
 #include "caffe/caffe.hpp"
+#include "caffe/inference_engine.hpp"
 #include "caffe/layers/memory_data_layer.hpp"
 #include "caffe/layers/python_layer.hpp"
 #include "caffe/sgd_solvers.hpp"
@@ -178,6 +184,23 @@ void Net_Save(const Net& net, string filename) {
   WriteProtoToBinaryFile(net_param, filename.c_str());
 }
 
+// Net::MemoryReport as a list of dicts
+bp::list Net_MemoryReport(const Net& net) {
+  bp::list rows;
+  for (const Net::MemoryUse& use : net.MemoryReport()) {
+    bp::dict row;
+    row["layer"] = use.layer;
+    row["blob"] = use.blob;
+    row["kind"] = use.kind;
+    row["data_type"] = Type_Name(use.data_type);
+    row["diff_type"] = Type_Name(use.diff_type);
+    row["data_bytes"] = use.data_bytes;
+    row["diff_bytes"] = use.diff_bytes;
+    rows.append(row);
+  }
+  return rows;
+}
+
 void Net_SetInputArrays(Net* net, bp::object data_obj,
     bp::object labels_obj) {
   // check that this network has an input MemoryDataLayer
@@ -210,6 +233,450 @@ void Net_SetInputArrays(Net* net, bp::object data_obj,
       PyArray_DIMS(data_arr)[0]);
 }
 
+// Device memory input: pointers and stream are passed as integers, e.g. taken from
+// other frameworks' tensors that already reside on the net's device
+void Net_SetInputGpuArrays(Net* net, size_t data_ptr, size_t labels_ptr, int num,
+    size_t stream) {
+  shared_ptr<MemoryDataLayer<Dtype, Dtype> > md_layer =
+    boost::dynamic_pointer_cast<MemoryDataLayer<Dtype, Dtype> >(net->layers()[0]);
+  if (!md_layer) {
+    throw std::runtime_error("set_input_gpu_arrays may only be called if the"
+        " first layer is a MemoryDataLayer");
+  }
+  if (num % md_layer->batch_size() != 0) {
+    throw std::runtime_error("number of inputs must be a multiple of batch size");
+  }
+#ifndef CPU_ONLY
+  md_layer->ResetGpu(reinterpret_cast<Dtype*>(data_ptr),
+      reinterpret_cast<Dtype*>(labels_ptr), num, reinterpret_cast<cudaStream_t>(stream));
+#else
+  throw std::runtime_error("set_input_gpu_arrays needs GPU build");
+#endif
+}
+
+// InferenceEngine constructor taking the net definition file
+shared_ptr<InferenceEngine> InferenceEngine_Init(string param_file,
+    string pretrained_param_file, int contexts, int device) {
+  CheckFile(param_file);
+  CheckFile(pretrained_param_file);
+  NetParameter param;
+  ReadNetParamsFromTextFileOrDie(param_file, &param);
+  return boost::make_shared<InferenceEngine>(param, pretrained_param_file, contexts, device);
+}
+
+// DLPack ABI (dlpack.h v0.5+), declared here to spare the header dependency
+struct DLDevice {
+  int32_t device_type;
+  int32_t device_id;
+};
+struct DLDataType {
+  uint8_t code;
+  uint8_t bits;
+  uint16_t lanes;
+};
+struct DLTensor {
+  void* data;
+  DLDevice device;
+  int32_t ndim;
+  DLDataType dtype;
+  int64_t* shape;
+  int64_t* strides;
+  uint64_t byte_offset;
+};
+struct DLManagedTensor {
+  DLTensor dl_tensor;
+  void* manager_ctx;
+  void (*deleter)(DLManagedTensor* self);
+};
+enum { kDLCPU = 1, kDLCUDA = 2, kDLCUDAHost = 3 };
+enum { kDLFloat = 2 };
+
+static bool is_c_contiguous(const vector<int>& shape, const vector<int64_t>& strides) {
+  int64_t expected = 1;
+  for (int i = static_cast<int>(shape.size()) - 1; i >= 0; --i) {
+    if (shape[i] > 1 && strides[i] != expected) {
+      return false;
+    }
+    expected *= shape[i];
+  }
+  return true;
+}
+
+// Float32 tensor of another framework (numpy array, __cuda_array_interface__ or
+// __dlpack__ exporter) seen as a blob without copying. Destroyed with the GIL held.
+class ExternalTensor {
+ public:
+  explicit ExternalTensor(bp::object obj)
+      : owner_(obj), managed_(nullptr), on_gpu_(false), device_(-1), stream_(0) {
+    void* data = nullptr;
+    vector<int> shape;
+    if (PyArray_Check(obj.ptr())) {
+      PyArrayObject* arr = reinterpret_cast<PyArrayObject*>(obj.ptr());
+      if (!(PyArray_FLAGS(arr) & NPY_ARRAY_C_CONTIGUOUS) || PyArray_TYPE(arr) != NPY_FLOAT32) {
+        throw std::runtime_error("arrays must be C contiguous float32");
+      }
+      shape.assign(PyArray_DIMS(arr), PyArray_DIMS(arr) + PyArray_NDIM(arr));
+      data = PyArray_DATA(arr);
+    } else if (PyObject_HasAttrString(obj.ptr(), "__cuda_array_interface__")) {
+      bp::dict cai = bp::extract<bp::dict>(obj.attr("__cuda_array_interface__"));
+      if (bp::extract<string>(cai["typestr"])() != "<f4") {
+        throw std::runtime_error("CUDA arrays must be float32");
+      }
+      bp::tuple dims = bp::extract<bp::tuple>(cai["shape"]);
+      for (int i = 0; i < bp::len(dims); ++i) {
+        shape.push_back(bp::extract<int>(dims[i]));
+      }
+      bp::object strides = cai.get("strides");
+      if (!strides.is_none()) {
+        vector<int64_t> elements;
+        for (int i = 0; i < bp::len(strides); ++i) {
+          elements.push_back(bp::extract<int64_t>(strides[i])() / sizeof(Dtype));
+        }
+        if (!is_c_contiguous(shape, elements)) {
+          throw std::runtime_error("CUDA arrays must be C contiguous");
+        }
+      }
+      data = reinterpret_cast<void*>(bp::extract<size_t>(cai["data"][0])());
+      bp::object stream = cai.get("stream");
+      stream_ = stream.is_none() ? 0 : bp::extract<int64_t>(stream)();
+      on_gpu_ = true;
+    } else if (PyObject_HasAttrString(obj.ptr(), "__dlpack__")) {
+      bp::dict kwargs;
+      bp::tuple device = bp::extract<bp::tuple>(obj.attr("__dlpack_device__")());
+      if (bp::extract<int>(device[0])() == kDLCUDA) {
+        // The exporter orders its work before the legacy default stream
+        kwargs["stream"] = 1;
+        stream_ = 1;
+      }
+      bp::object capsule = obj.attr("__dlpack__")(*bp::tuple(), **kwargs);
+      managed_ = static_cast<DLManagedTensor*>(PyCapsule_GetPointer(capsule.ptr(), "dltensor"));
+      if (managed_ == nullptr) {
+        bp::throw_error_already_set();
+      }
+      // Consumed: the deleter is ours to call
+      PyCapsule_SetName(capsule.ptr(), "used_dltensor");
+      const DLTensor& t = managed_->dl_tensor;
+      if (t.dtype.code != kDLFloat || t.dtype.bits != 32 || t.dtype.lanes != 1) {
+        throw std::runtime_error("DLPack tensors must be float32");
+      }
+      shape.assign(t.shape, t.shape + t.ndim);
+      if (t.strides != nullptr &&
+          !is_c_contiguous(shape, vector<int64_t>(t.strides, t.strides + t.ndim))) {
+        throw std::runtime_error("DLPack tensors must be C contiguous");
+      }
+      if (t.device.device_type == kDLCUDA) {
+        on_gpu_ = true;
+        device_ = t.device.device_id;
+      } else if (t.device.device_type != kDLCPU && t.device.device_type != kDLCUDAHost) {
+        throw std::runtime_error("DLPack tensors must reside on the host or a CUDA device");
+      }
+      data = static_cast<char*>(t.data) + t.byte_offset;
+    } else {
+      throw std::runtime_error("expected a numpy array or an object exporting "
+          "__cuda_array_interface__ or __dlpack__");
+    }
+    blob_.Reshape(shape);
+    if (blob_.count() == 0) {
+      return;
+    }
+    if (on_gpu_) {
+#ifndef CPU_ONLY
+      if (device_ < 0) {
+        cudaPointerAttributes attr;
+        CUDA_CHECK(cudaPointerGetAttributes(&attr, data));
+        device_ = attr.device;
+      }
+      blob_.set_gpu_data(data);
+#else
+      throw std::runtime_error("device tensors need GPU build");
+#endif
+    } else {
+      blob_.set_cpu_data(static_cast<Dtype*>(data));
+    }
+  }
+
+  ~ExternalTensor() {
+    if (managed_ != nullptr && managed_->deleter != nullptr) {
+      managed_->deleter(managed_);
+    }
+  }
+
+  // Waits for the producer's stream, to be called without the GIL
+  void Sync() const {
+#ifndef CPU_ONLY
+    if (on_gpu_ && stream_ != 0) {
+      cudaStream_t stream = stream_ == 1 ? cudaStreamLegacy : stream_ == 2 ?
+          cudaStreamPerThread : reinterpret_cast<cudaStream_t>(stream_);
+      CUDA_CHECK(cudaStreamSynchronize(stream));
+    }
+#endif
+  }
+
+  Blob* blob() {
+    return &blob_;
+  }
+  bool on_gpu() const {
+    return on_gpu_;
+  }
+  int device() const {
+    return device_;
+  }
+
+ private:
+  bp::object owner_;
+  DLManagedTensor* managed_;
+  TBlob<Dtype> blob_;
+  bool on_gpu_;
+  int device_;
+  int64_t stream_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(ExternalTensor);
+};
+
+// Numpy view of a blob's host data, keeping the blob alive
+static bp::object Blob_HostArray(const shared_ptr<Blob>& blob) {
+  bp::object pyblob(blob);
+  vector<npy_intp> dims(blob->shape().begin(), blob->shape().end());
+  PyObject* arr = PyArray_SimpleNewFromData(dims.size(), dims.data(), NPY_FLOAT32,
+      blob->mutable_cpu_data<Dtype>());
+  Py_INCREF(pyblob.ptr());
+  PyArray_SetBaseObject(reinterpret_cast<PyArrayObject*>(arr), pyblob.ptr());
+  return bp::object(bp::handle<>(arr));
+}
+
+// Request of InferenceEngine::InferAsync and what it needs to outlive it
+class InferRequest {
+ public:
+  InferRequest(InferenceEngine* engine, bp::list arrays, bp::object as_blobs)
+      : state_(make_shared<State>()) {
+    const int num_inputs = bp::len(arrays);
+    if (num_inputs != engine->input_names().size()) {
+      throw std::runtime_error("infer takes one array per input");
+    }
+    bool on_gpu = false;
+    for (int i = 0; i < num_inputs; ++i) {
+      inputs_.emplace_back(make_shared<ExternalTensor>(bp::object(arrays[i])));
+      const ExternalTensor& input = *inputs_.back();
+      on_gpu = on_gpu || input.on_gpu();
+      if (input.on_gpu() && (Caffe::mode() != Caffe::GPU || input.device() != engine->device())) {
+        throw std::runtime_error(engine->input_names()[i] +
+            " resides on another device than the engine");
+      }
+    }
+    as_blobs_ = as_blobs.is_none() ? on_gpu : bp::extract<bool>(as_blobs)();
+    vector<Blob*> input_ptrs, output_ptrs;
+    for (const shared_ptr<ExternalTensor>& input : inputs_) {
+      input_ptrs.push_back(input->blob());
+    }
+    for (int i = 0; i < engine->output_names().size(); ++i) {
+      outputs_.emplace_back(make_shared<TBlob<Dtype>>());
+      output_ptrs.push_back(outputs_.back().get());
+    }
+    shared_ptr<State> state = state_;
+    Py_BEGIN_ALLOW_THREADS
+    for (const shared_ptr<ExternalTensor>& input : inputs_) {
+      input->Sync();
+    }
+    engine->InferAsync(input_ptrs, output_ptrs, [state]() {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->done = true;
+      state->cv.notify_all();
+    });
+    Py_END_ALLOW_THREADS
+  }
+
+  // Inputs and outputs are in use till the request is served
+  ~InferRequest() {
+    wait(-1.);
+  }
+
+  bool done() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->done;
+  }
+
+  // Other Python threads run meanwhile, negative timeout waits for good
+  bool wait(double timeout) const {
+    bool done;
+    Py_BEGIN_ALLOW_THREADS
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    auto is_done = [this] { return state_->done; };
+    if (timeout < 0.) {
+      state_->cv.wait(lock, is_done);
+      done = true;
+    } else {
+      done = state_->cv.wait_for(lock, std::chrono::duration<double>(timeout), is_done);
+    }
+    Py_END_ALLOW_THREADS
+    return done;
+  }
+
+  // Blobs or numpy arrays in output_names order
+  bp::list result(double timeout) const {
+    if (!wait(timeout)) {
+      PyErr_SetString(PyExc_RuntimeError, "inference request timed out");
+      bp::throw_error_already_set();
+    }
+    bp::list results;
+    for (const shared_ptr<TBlob<Dtype>>& output : outputs_) {
+      const shared_ptr<Blob> blob(output);
+      results.append(as_blobs_ ? bp::object(blob) : Blob_HostArray(blob));
+    }
+    return results;
+  }
+
+ private:
+  struct State {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+  };
+
+  shared_ptr<State> state_;
+  vector<shared_ptr<ExternalTensor>> inputs_;
+  vector<shared_ptr<TBlob<Dtype>>> outputs_;
+  bool as_blobs_;
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(InferRequest);
+};
+
+// Takes a list of float32 numpy arrays or device tensors in input_names order, returns
+// a list in output_names order: Blobs (as_blobs, default when an input was on the device)
+// or numpy arrays. Other Python threads run while the request is served.
+bp::list InferenceEngine_Infer(InferenceEngine* engine, bp::list arrays, bp::object as_blobs) {
+  InferRequest request(engine, arrays, as_blobs);
+  return request.result(-1.);
+}
+
+shared_ptr<InferRequest> InferenceEngine_InferAsync(InferenceEngine* engine, bp::list arrays,
+    bp::object as_blobs) {
+  return make_shared<InferRequest>(engine, arrays, as_blobs);
+}
+
+bp::list InferRequest_Result(const InferRequest& request, bp::object timeout) {
+  return request.result(timeout.is_none() ? -1. : bp::extract<double>(timeout)());
+}
+
+bool InferRequest_Wait(const InferRequest& request, bp::object timeout) {
+  return request.wait(timeout.is_none() ? -1. : bp::extract<double>(timeout)());
+}
+
+// Other Python threads run during the pass unless it calls back into Python layers
+float Net_ForwardFromTo(Net* net, int start, int end) {
+  for (const shared_ptr<LayerBase>& layer : net->layers()) {
+    if (strcmp(layer->type(), "Python") == 0) {
+      return net->ForwardFromTo(start, end);
+    }
+  }
+  float loss;
+  Py_BEGIN_ALLOW_THREADS
+  loss = net->ForwardFromTo(start, end);
+  Py_END_ALLOW_THREADS
+  return loss;
+}
+
+// Copies a device tensor (or numpy array) of the blob's shape into its data
+void Blob_CopyFrom(Blob* blob, bp::object tensor) {
+  ExternalTensor source(tensor);
+  if (source.blob()->shape() != blob->shape()) {
+    throw std::runtime_error("tensor shape " + source.blob()->shape_string() +
+        " differs from blob shape " + blob->shape_string());
+  }
+  Py_BEGIN_ALLOW_THREADS
+  source.Sync();
+  blob->CopyDataFrom(*source.blob());
+  Py_END_ALLOW_THREADS
+}
+
+// CUDA array interface v2 of the blob's device data, for CuPy, PyTorch, Numba...
+bp::dict Blob_CudaArrayInterface(Blob* blob) {
+  bp::dict cai;
+#ifndef CPU_ONLY
+  if (Caffe::mode() == Caffe::GPU) {
+    bp::list shape;
+    for (int dim : blob->shape()) {
+      shape.append(dim);
+    }
+    cai["shape"] = bp::tuple(shape);
+    cai["typestr"] = "<f4";
+    cai["data"] = bp::make_tuple(reinterpret_cast<size_t>(blob->mutable_gpu_data<Dtype>()),
+        false);
+    cai["strides"] = bp::object();
+    cai["version"] = 2;
+    return cai;
+  }
+#endif
+  // hasattr is false then
+  PyErr_SetString(PyExc_AttributeError, "blob data is on the device in GPU mode only");
+  bp::throw_error_already_set();
+  return cai;
+}
+
+struct DLPackExport {
+  DLManagedTensor tensor;
+  vector<int64_t> shape;
+  PyObject* owner;
+};
+
+static void DLPackExport_Delete(DLManagedTensor* tensor) {
+  DLPackExport* ex = static_cast<DLPackExport*>(tensor->manager_ctx);
+  PyGILAquire gil;
+  Py_DECREF(ex->owner);
+  delete ex;
+}
+
+static void DLPackCapsule_Delete(PyObject* capsule) {
+  // Not consumed
+  if (PyCapsule_IsValid(capsule, "dltensor")) {
+    DLManagedTensor* tensor =
+        static_cast<DLManagedTensor*>(PyCapsule_GetPointer(capsule, "dltensor"));
+    tensor->deleter(tensor);
+  }
+}
+
+bp::tuple Blob_DLPackDevice(Blob* blob) {
+  int device = 0;
+#ifndef CPU_ONLY
+  if (Caffe::mode() == Caffe::GPU) {
+    cudaPointerAttributes attr;
+    CUDA_CHECK(cudaPointerGetAttributes(&attr, blob->gpu_data<Dtype>()));
+    return bp::make_tuple(static_cast<int>(kDLCUDA), attr.device);
+  }
+#endif
+  return bp::make_tuple(static_cast<int>(kDLCPU), device);
+}
+
+// Blob data in GPU mode, host data otherwise. Ready when exported, stream is ignored.
+bp::object Blob_DLPack(bp::tuple args, bp::dict kwargs) {
+  bp::object pyblob = args[0];
+  Blob* blob = bp::extract<Blob*>(pyblob);
+  bp::tuple device = Blob_DLPackDevice(blob);
+  DLPackExport* ex = new DLPackExport;
+  ex->shape.assign(blob->shape().begin(), blob->shape().end());
+  ex->owner = pyblob.ptr();
+  Py_INCREF(ex->owner);
+  DLTensor& t = ex->tensor.dl_tensor;
+  t.device.device_type = bp::extract<int>(device[0]);
+  t.device.device_id = bp::extract<int>(device[1]);
+#ifndef CPU_ONLY
+  t.data = t.device.device_type == kDLCUDA ? blob->mutable_gpu_data<Dtype>() :
+      blob->mutable_cpu_data<Dtype>();
+#else
+  t.data = blob->mutable_cpu_data<Dtype>();
+#endif
+  t.ndim = ex->shape.size();
+  t.dtype.code = kDLFloat;
+  t.dtype.bits = 32;
+  t.dtype.lanes = 1;
+  t.shape = ex->shape.data();
+  t.strides = nullptr;
+  t.byte_offset = 0;
+  ex->tensor.manager_ctx = ex;
+  ex->tensor.deleter = &DLPackExport_Delete;
+  return bp::object(bp::handle<>(PyCapsule_New(&ex->tensor, "dltensor",
+      &DLPackCapsule_Delete)));
+}
+
 Solver* GetSolverFromFile(const string& filename) {
   SolverParameter param = ReadSolverParamsFromTextFileOrDie(filename);
   return SolverRegistry::CreateSolver(param);
@@ -304,7 +771,7 @@ BOOST_PYTHON_MODULE(_caffe) {
     bp::no_init)
     .def("__init__", bp::make_constructor(&Net_Init))
     .def("__init__", bp::make_constructor(&Net_Init_Load))
-    .def("_forward", &Net::ForwardFromTo)
+    .def("_forward", &Net_ForwardFromTo)
     .def("_backward", &Net::BackwardFromTo)
     .def("reshape", &Net::Reshape)
     // The cast is to select a particular overload.
@@ -332,9 +799,33 @@ BOOST_PYTHON_MODULE(_caffe) {
         bp::return_value_policy<bp::copy_const_reference>()))
     .def("_set_input_arrays", &Net_SetInputArrays,
         bp::with_custodian_and_ward<1, 2, bp::with_custodian_and_ward<1, 3> >())
-    .def("save", &Net_Save);
+    .def("_set_input_gpu_arrays", &Net_SetInputGpuArrays)
+    .def("save", &Net_Save)
+    .def("memory_report", &Net_MemoryReport)
+    .def("memory_report_string", &Net::MemoryReportString);
   BP_REGISTER_SHARED_PTR_TO_PYTHON(Net);
 
+  bp::class_<InferenceEngine, shared_ptr<InferenceEngine>, boost::noncopyable>(
+    "InferenceEngine", bp::no_init)
+    .def("__init__", bp::make_constructor(&InferenceEngine_Init))
+    .def("infer", &InferenceEngine_Infer,
+        (bp::arg("arrays"), bp::arg("as_blobs") = bp::object()))
+    .def("infer_async", &InferenceEngine_InferAsync,
+        (bp::arg("arrays"), bp::arg("as_blobs") = bp::object()))
+    .add_property("contexts", &InferenceEngine::contexts)
+    .add_property("inputs", bp::make_function(&InferenceEngine::input_names,
+        bp::return_value_policy<bp::copy_const_reference>()))
+    .add_property("outputs", bp::make_function(&InferenceEngine::output_names,
+        bp::return_value_policy<bp::copy_const_reference>()));
+  BP_REGISTER_SHARED_PTR_TO_PYTHON(InferenceEngine);
+
+  bp::class_<InferRequest, shared_ptr<InferRequest>, boost::noncopyable>(
+    "InferRequest", bp::no_init)
+    .def("done", &InferRequest::done)
+    .def("wait", &InferRequest_Wait, (bp::arg("timeout") = bp::object()))
+    .def("result", &InferRequest_Result, (bp::arg("timeout") = bp::object()));
+  BP_REGISTER_SHARED_PTR_TO_PYTHON(InferRequest);
+
 
   bp::class_<Blob, shared_ptr<TBlob<Dtype> >, boost::noncopyable>(
     "Blob", bp::no_init)
@@ -353,7 +844,11 @@ BOOST_PYTHON_MODULE(_caffe) {
         .add_property("data",     bp::make_function(&Blob::mutable_cpu_data<Dtype>,
               NdarrayCallPolicies()))
         .add_property("diff",     bp::make_function(&Blob::mutable_cpu_diff<Dtype>,
-              NdarrayCallPolicies()));
+              NdarrayCallPolicies()))
+        .def("copy_from",         &Blob_CopyFrom)
+        .add_property("__cuda_array_interface__", &Blob_CudaArrayInterface)
+        .def("__dlpack__",        bp::raw_function(&Blob_DLPack))
+        .def("__dlpack_device__", &Blob_DLPackDevice);
 
   BP_REGISTER_SHARED_PTR_TO_PYTHON(Blob);
 
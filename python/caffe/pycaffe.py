@@ -75,6 +75,16 @@ def _Net_outputs(self):
     return self._output_list
 
 
+def _is_device_tensor(x):
+    """
+    True for tensors of other frameworks (CuPy, PyTorch...) exporting
+    __cuda_array_interface__ or __dlpack__, which Blob.copy_from takes
+    without a round trip through numpy.
+    """
+    return not isinstance(x, np.ndarray) and (
+        hasattr(x, '__cuda_array_interface__') or hasattr(x, '__dlpack__'))
+
+
 def _Net_forward(self, blobs=None, start=None, end=None, **kwargs):
     """
     Forward pass: prepare inputs and run the net forward.
@@ -82,7 +92,8 @@ def _Net_forward(self, blobs=None, start=None, end=None, **kwargs):
     Parameters
     ----------
     blobs : list of blobs to return in addition to output blobs.
-    kwargs : Keys are input blob names and values are blob ndarrays.
+    kwargs : Keys are input blob names and values are blob ndarrays
+             or device tensors (see _is_device_tensor).
              For formatting inputs for Caffe, see Net.preprocess().
              If None, input is taken from data layers.
     start : optional name of layer at which to begin the forward pass
@@ -116,7 +127,10 @@ def _Net_forward(self, blobs=None, start=None, end=None, **kwargs):
         for in_, blob in six.iteritems(kwargs):
             if blob.shape[0] != self.blobs[in_].shape[0]:
                 raise Exception('Input is not batch sized')
-            self.blobs[in_].data[...] = blob
+            if _is_device_tensor(blob):
+                self.blobs[in_].copy_from(blob)
+            else:
+                self.blobs[in_].data[...] = blob
 
     self._forward(start_ind, end_ind)
 
@@ -259,6 +273,16 @@ def _Net_set_input_arrays(self, data, labels):
     return self._set_input_arrays(data, labels)
 
 
+def _Net_set_input_gpu_arrays(self, data_ptr, labels_ptr, num, stream=0):
+    """
+    Set device memory input of the in-memory MemoryDataLayer without copying it.
+    data_ptr and labels_ptr are raw device addresses of contiguous float32 arrays
+    of num items residing on the net's device, stream is the CUDA stream producing
+    them (0 for the default one). They must stay alive while the net reads them.
+    """
+    return self._set_input_gpu_arrays(data_ptr, labels_ptr, num, stream)
+
+
 def _Net_batch(self, blobs):
     """
     Batch blob lists according to net's batch size.
@@ -317,6 +341,7 @@ Net.backward = _Net_backward
 Net.forward_all = _Net_forward_all
 Net.forward_backward_all = _Net_forward_backward_all
 Net.set_input_arrays = _Net_set_input_arrays
+Net.set_input_gpu_arrays = _Net_set_input_gpu_arrays
 Net._batch = _Net_batch
 Net.inputs = _Net_inputs
 Net.outputs = _Net_outputs
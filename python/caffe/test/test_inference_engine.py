@@ -0,0 +1,66 @@
+import unittest
+import tempfile
+import os
+import numpy as np
+
+import caffe
+
+
+def inference_net_file():
+    f = tempfile.NamedTemporaryFile(mode='w+', delete=False)
+    f.write("""name: 'inferencenet'
+    layer { type: 'Input' name: 'data' top: 'data'
+      input_param { shape { dim: 4 dim: 3 dim: 2 dim: 2 } } }
+    layer { type: 'InnerProduct' name: 'ip' bottom: 'data' top: 'ip'
+      inner_product_param { num_output: 5
+        weight_filler { type: 'gaussian' std: 1 }
+        bias_filler { type: 'constant' value: 1 } } }""")
+    f.close()
+    return f.name
+
+
+class TestInferenceEngine(unittest.TestCase):
+    def setUp(self):
+        self.net_file = inference_net_file()
+        net = caffe.Net(self.net_file, caffe.TEST)
+        f = tempfile.NamedTemporaryFile(mode='w+', delete=False)
+        f.close()
+        self.weights_file = f.name
+        net.save(self.weights_file)
+        self.engine = caffe.InferenceEngine(self.net_file, self.weights_file, 2, -1)
+        self.data = np.random.randn(4, 3, 2, 2).astype(np.float32)
+        net.blobs['data'].data[...] = self.data
+        self.expected = net.forward()['ip'].copy()
+
+    def tearDown(self):
+        os.remove(self.net_file)
+        os.remove(self.weights_file)
+
+    def test_infer(self):
+        out, = self.engine.infer([self.data])
+        self.assertIsInstance(out, np.ndarray)
+        np.testing.assert_allclose(out, self.expected, rtol=1e-5)
+
+    def test_infer_async(self):
+        requests = [self.engine.infer_async([self.data]) for _ in range(4)]
+        for request in requests:
+            out, = request.result()
+            self.assertTrue(request.done())
+            np.testing.assert_allclose(out, self.expected, rtol=1e-5)
+
+    def test_infer_as_blobs(self):
+        out, = self.engine.infer([self.data], as_blobs=True)
+        self.assertEqual(list(out.shape), [4, 5])
+        np.testing.assert_allclose(out.data, self.expected, rtol=1e-5)
+
+    def test_dlpack(self):
+        if not hasattr(np, 'from_dlpack'):
+            return
+        out, = self.engine.infer([self.data], as_blobs=True)
+        view = np.from_dlpack(out)
+        np.testing.assert_allclose(view, self.expected, rtol=1e-5)
+        # Blobs are tensors themselves, here through the host DLPack path
+        blob = caffe.Net(self.net_file, self.weights_file, caffe.TEST).blobs['data']
+        blob.data[...] = self.data
+        out, = self.engine.infer([blob])
+        np.testing.assert_allclose(out, self.expected, rtol=1e-5)
@@ -56,16 +56,32 @@ class PhaseLayer(caffe.Layer):
     def forward(self, bottom, top):
         top[0].data[()] = self.phase
 
-def python_net_file():
+def python_net_file(executor=False):
+    param = "module: 'test_python_layer' layer: 'SimpleLayer'"
+    if executor:
+        param += " executor: true"
     with tempfile.NamedTemporaryFile(mode='w+', delete=False) as f:
         f.write("""name: 'pythonnet' force_backward: true
         input: 'data' input_shape { dim: 10 dim: 9 dim: 8 }
         layer { type: 'Python' name: 'one' bottom: 'data' top: 'one'
-          python_param { module: 'test_python_layer' layer: 'SimpleLayer' } }
+          python_param { %s } }
         layer { type: 'Python' name: 'two' bottom: 'one' top: 'two'
-          python_param { module: 'test_python_layer' layer: 'SimpleLayer' } }
+          python_param { %s } }
         layer { type: 'Python' name: 'three' bottom: 'two' top: 'three'
-          python_param { module: 'test_python_layer' layer: 'SimpleLayer' } }""")
+          python_param { %s } }""" % (param, param, param))
+        return f.name
+
+
+def executor_net_file():
+    with tempfile.NamedTemporaryFile(mode='w+', delete=False) as f:
+        f.write("""name: 'pythonnet' force_backward: true
+        input: 'data' input_shape { dim: 10 dim: 9 dim: 8 }
+        layer { type: 'Python' name: 'one' bottom: 'data' top: 'one'
+          python_param { module: 'test_python_layer' layer: 'SimpleLayer'
+                         executor: true } }
+        layer { type: 'Python' name: 'two' bottom: 'one' top: 'two'
+          python_param { module: 'test_python_layer' layer: 'ExceptionLayer'
+                         executor: true } }""")
         return f.name
 
 
@@ -142,6 +158,24 @@ class TestPythonLayer(unittest.TestCase):
         self.assertRaises(RuntimeError, caffe.Net, net_file, caffe.TEST)
         os.remove(net_file)
 
+    def test_executor(self):
+        net_file = python_net_file(executor=True)
+        net = caffe.Net(net_file, caffe.TRAIN)
+        os.remove(net_file)
+        x = 8
+        net.blobs['data'].data[...] = x
+        net.forward()
+        for y in net.blobs['three'].data.flat:
+            self.assertEqual(y, 10**3 * x)
+        net.blobs['three'].diff[...] = x
+        net.backward()
+        for y in net.blobs['data'].diff.flat:
+            self.assertEqual(y, 10**3 * x)
+        # Errors raised on the executor reach the caller
+        net_file = executor_net_file()
+        self.assertRaises(RuntimeError, caffe.Net, net_file, caffe.TEST)
+        os.remove(net_file)
+
     def test_parameter(self):
         net_file = parameter_net_file()
         net = caffe.Net(net_file, caffe.TRAIN)
@@ -3,6 +3,7 @@
 #include <caffe/util/cudnn.hpp>
 
 #include "caffe/blob.hpp"
+#include "caffe/util/gpu_memory.hpp"
 
 namespace caffe {
 
@@ -13,6 +14,16 @@ size_t Blob::gpu_memory_data_use(bool own_only) const {
 size_t Blob::gpu_memory_diff_use(bool own_only) const {
   return diff_tensor_->gpu_memory_use(own_only);
 }
+
+size_t Blob::relocate_gpu(std::unordered_set<const Tensor*>* visited) {
+  size_t moved = 0UL;
+  for (const Tensor* tensor : {data_tensor_.get(), diff_tensor_.get()}) {
+    if (tensor != nullptr && visited->insert(tensor).second) {
+      moved += tensor->relocate_gpu();
+    }
+  }
+  return moved;
+}
 #endif
 
 void Blob::Reshape(const int num, const int channels, const int height,
@@ -73,6 +84,15 @@ const int* Blob::gpu_shape() const {
 
 #endif
 
+void Blob::convert_data_batch(const vector<Blob*>& blobs, Type new_data_type) {
+  vector<Tensor*> tensors;
+  tensors.reserve(blobs.size());
+  for (Blob* blob : blobs) {
+    tensors.push_back(blob->data_tensor_.get());
+  }
+  Tensor::convert_batch(tensors, new_data_type);
+}
+
 void Blob::ShareData(const Blob& other) {
   CHECK_NE(this, &other);
   if (data_tensor_.get() == other.data_tensor_.get()) {
@@ -310,7 +330,7 @@ void Blob::CopyFrom(const Blob& source, bool copy_diff, bool reshape,
     CUDNN_CHECK(cudnnTransformTensor(handle,
         cudnn::one(src_type), src_desc, src->gpu_data(),
         cudnn::zero(dst_type), dst_desc, dst->mutable_gpu_data(false)));
-    CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+    CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
     CUDNN_CHECK(cudnnDestroyTensorDescriptor(src_desc));
     CUDNN_CHECK(cudnnDestroyTensorDescriptor(dst_desc));
   }
@@ -342,83 +362,80 @@ void Blob::FromProto(const BlobProto& proto, bool reshape) {
   // copy data
   if (proto.double_data_size() > 0) {
     CHECK_EQ(count_, proto.double_data_size());
-    for (int i = 0; i < count_; ++i) {
-      set_value_at(true, i, proto.double_data(i));
-    }
+    set_values(true, proto.double_data().data());
     data_tensor_->invalidate_others();
   } else if (proto.data_size() > 0) {
     CHECK_EQ(count_, proto.data_size());
-    for (int i = 0; i < count_; ++i) {
-      set_value_at(true, i, proto.data(i));
-    }
+    set_values(true, proto.data().data());
     data_tensor_->invalidate_others();
   } else if (proto.has_raw_data()) {
     CHECK(proto.has_raw_data_type()) << "Missing raw data type";
-    Type raw_type = proto.raw_data_type();
-    Type dt = data_tensor_->type();
-    const ::std::string& hd = proto.raw_data();
-    CHECK_EQ(count_ * tsize(raw_type), hd.size());
-    switch (raw_type) {
-      case FLOAT:
-        caffe_copy<float>(count_, reinterpret_cast<const float*>(&hd.front()),
-            mutable_cpu_data<float>());
-        break;
-#ifndef CPU_ONLY
-      case FLOAT16:
-        caffe_copy<float16>(count_, reinterpret_cast<const float16*>(&hd.front()),
-            mutable_cpu_data<float16>());
-        break;
-#endif
-      case DOUBLE:
-        caffe_copy<double>(count_, reinterpret_cast<const double*>(&hd.front()),
-            mutable_cpu_data<double>());
-        break;
-      default:
-        LOG(FATAL) << "Unsupported raw type " << Type_Name(raw_type);
-    }
-    data_tensor_->convert(dt);  // we have to restore its original type
-    data_tensor_->invalidate_others();
+    FromRaw(true, proto.raw_data(), proto.raw_data_type());
   }
   // copy diff
   if (proto.double_diff_size() > 0) {
     CHECK_EQ(count_, proto.double_diff_size());
-    for (int i = 0; i < count_; ++i) {
-      set_value_at(false, i, proto.double_diff(i));
-    }
+    set_values(false, proto.double_diff().data());
     diff_tensor_->invalidate_others();
   } else if (proto.diff_size() > 0) {
     CHECK_EQ(count_, proto.diff_size());
-    for (int i = 0; i < count_; ++i) {
-      set_value_at(false, i, proto.diff(i));
-    }
+    set_values(false, proto.diff().data());
     diff_tensor_->invalidate_others();
   } else if (proto.has_raw_diff()) {
     CHECK(proto.has_raw_diff_type()) << "Missing raw diff type";
-    Type raw_type = proto.raw_diff_type();
-    Type dt = diff_tensor_->type();
-    const ::std::string& hd = proto.raw_diff();
-    CHECK_EQ(count_ * tsize(raw_type), hd.size());
-    switch (raw_type) {
-      case FLOAT:
-        caffe_copy<float>(count_, reinterpret_cast<const float*>(&hd.front()),
-            mutable_cpu_diff<float>());
-        break;
+    FromRaw(false, proto.raw_diff(), proto.raw_diff_type());
+  }
+}
+
+// The previous content is neither read nor converted. In GPU mode the bytes are uploaded
+// through pinned chunks and converted on the device.
+void Blob::FromRaw(bool is_data, const std::string& raw, Type raw_type) {
+  const shared_ptr<Tensor>& tensor = is_data ? data_tensor_ : diff_tensor_;
+  const Type dt = tensor->type();
+  CHECK_EQ(count_ * tsize(raw_type), raw.size());
+  if (count_ == 0) {
+    return;
+  }
+  shared_ptr<SyncedMemory>& mem = tensor->mutable_synced_mem();
 #ifndef CPU_ONLY
-      case FLOAT16:
-        caffe_copy<float16>(count_, reinterpret_cast<const float16*>(&hd.front()),
-            mutable_cpu_diff<float16>());
-        break;
-#endif
-      case DOUBLE:
-        caffe_copy<double>(count_, reinterpret_cast<const double*>(&hd.front()),
-            mutable_cpu_diff<double>());
-        break;
-      default:
-        LOG(FATAL) << "Unsupported raw type " << Type_Name(raw_type);
+  if (Caffe::mode() == Caffe::GPU) {
+    void* dst = mem->mutable_gpu_data(false);
+    if (raw_type == dt) {
+      caffe_gpu_upload(raw.size(), &raw.front(), dst);
+    } else {
+      GPUMemory::Workspace staging(raw.size());
+      caffe_gpu_upload(raw.size(), &raw.front(), staging.data());
+      Tensor::copy_helper(true, count_, staging.data(), raw_type, dst, dt);
     }
-    diff_tensor_->convert(dt);  // we have to restore its original type
-    diff_tensor_->invalidate_others();
+    tensor->invalidate_others();
+    return;
+  }
+#endif
+  void* dst = mem->mutable_cpu_data(false);
+  if (raw_type == dt) {
+    caffe_parallel_memcpy(raw.size(), &raw.front(), dst);
+  } else {
+    Tensor::copy_helper(false, count_, &raw.front(), raw_type, dst, dt);
+  }
+  tensor->invalidate_others();
+}
+
+// Device heads are downloaded through pinned chunks, without a host mirror
+void Blob::ToRaw(bool is_data, std::string* raw) const {
+  const shared_ptr<Tensor>& tensor = is_data ? data_tensor_ : diff_tensor_;
+  const size_t bytes = count_ * tsize(tensor->type());
+  raw->resize(bytes);
+  if (bytes == 0UL) {
+    return;
   }
+  const shared_ptr<SyncedMemory>& mem = tensor->synced_mem();
+#ifndef CPU_ONLY
+  if (mem->head() == SyncedMemory::HEAD_AT_GPU) {
+    caffe_gpu_download(bytes, mem->gpu_data(), &raw->front());
+    return;
+  }
+#endif
+  caffe_parallel_memcpy(bytes, mem->cpu_data(), &raw->front());
 }
 
 void Blob::ToProto(BlobProto* proto, bool store_in_old_format, bool write_diff) const {
@@ -433,13 +450,11 @@ void Blob::ToProto(BlobProto* proto, bool store_in_old_format, bool write_diff)
   for (int i = 0; i < shape_.size(); ++i) {
     proto->mutable_shape()->add_dim(shape_[i]);
   }
-  const void* pdata = current_data_memory(false);
   proto->set_raw_data_type(dt);
-  proto->set_raw_data(pdata, count_ * tsize(dt));
+  ToRaw(true, proto->mutable_raw_data());
   if (write_diff) {
-    const void* pdiff = current_diff_memory(false);
-    proto->set_raw_diff_type(dt);
-    proto->set_raw_diff(pdiff, count_ * tsize(dt));
+    proto->set_raw_diff_type(diff_type());
+    ToRaw(false, proto->mutable_raw_diff());
   }
 }
 
@@ -452,17 +467,13 @@ void Blob::ToProtoBVLC(BlobProto* proto, bool write_diff) const {
   }
   const void* pdata = current_data_memory(false);
   if (data_type() == tp<float>()) {
-    proto->clear_data();
-    const float* data_vec = static_cast<const float*>(pdata);
-    for (int i = 0; i < count_; ++i) {
-      proto->add_data(data_vec[i]);
-    }
+    proto->mutable_data()->Resize(count_, 0.F);
+    caffe_parallel_memcpy(count_ * sizeof(float), pdata,
+        proto->mutable_data()->mutable_data());
   } else if (data_type() == tp<double>()) {
-    proto->clear_double_data();
-    const double* data_vec = static_cast<const double*>(pdata);
-    for (int i = 0; i < count_; ++i) {
-      proto->add_double_data(data_vec[i]);
-    }
+    proto->mutable_double_data()->Resize(count_, 0.);
+    caffe_parallel_memcpy(count_ * sizeof(double), pdata,
+        proto->mutable_double_data()->mutable_data());
   } else {
     LOG(FATAL) << "BVLC format doesn't support data type " << Type_Name(data_type());
   }
@@ -473,17 +484,13 @@ void Blob::ToProtoBVLC(BlobProto* proto, bool write_diff) const {
 
   const void* pdiff = current_diff_memory(false);
   if (diff_type() == tp<float>()) {
-    proto->clear_diff();
-    const float* diff_vec = static_cast<const float*>(pdiff);
-    for (int i = 0; i < count_; ++i) {
-      proto->add_diff(diff_vec[i]);
-    }
+    proto->mutable_diff()->Resize(count_, 0.F);
+    caffe_parallel_memcpy(count_ * sizeof(float), pdiff,
+        proto->mutable_diff()->mutable_data());
   } else if (diff_type() == tp<double>()) {
-    proto->clear_double_diff();
-    const double* diff_vec = static_cast<const double*>(pdiff);
-    for (int i = 0; i < count_; ++i) {
-      proto->add_double_diff(diff_vec[i]);
-    }
+    proto->mutable_double_diff()->Resize(count_, 0.);
+    caffe_parallel_memcpy(count_ * sizeof(double), pdiff,
+        proto->mutable_double_diff()->mutable_data());
   } else {
     LOG(FATAL) << "BVLC format doesn't support diff type " << Type_Name(diff_type());
   }
@@ -1,6 +1,13 @@
 #include <glog/logging.h>
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
+#include <cstdlib>
 #include <ctime>
 #include <ios>
 #include <memory>
@@ -19,12 +26,13 @@ namespace caffe {
 int Caffe::root_device_ = -1;
 int Caffe::thread_count_ = 0;
 int Caffe::restored_iter_ = -1;
+std::atomic<bool> Caffe::deterministic_(false);
+int Caffe::node_count_ = 1;
+int Caffe::node_rank_ = 0;
+int Caffe::solver_rank_offset_ = 0;
 std::atomic<uint64_t> Caffe::root_seed_(Caffe::SEED_NOT_SET);
 
 std::mutex Caffe::caffe_mutex_;
-std::mutex Caffe::pstream_mutex_;
-std::mutex Caffe::cublas_mutex_;
-std::mutex Caffe::cudnn_mutex_;
 std::mutex Caffe::seed_mutex_;
 
 Caffe& Caffe::Get() {
@@ -98,6 +106,16 @@ void Caffe::set_restored_iter(int val) {
   restored_iter_ = val;
 }
 
+void Caffe::set_nodes(int count, int rank, int solvers_per_node) {
+  CHECK_GT(count, 0);
+  CHECK_GE(rank, 0);
+  CHECK_LT(rank, count);
+  std::lock_guard<std::mutex> lock(caffe_mutex_);
+  node_count_ = count;
+  node_rank_ = rank;
+  solver_rank_offset_ = rank * solvers_per_node;
+}
+
 void GlobalInit(int* pargc, char*** pargv) {
   // Google flags.
   ::gflags::ParseCommandLineFlags(pargc, pargv, true);
@@ -174,6 +192,13 @@ Caffe::~Caffe() {
   // Preventing crash while Caffe shutting down.
   if (status != cudaErrorCudartUnloading) {
     CURAND_CHECK(curandDestroyGenerator(curand_generator_));
+    curand_stream_.reset();
+    for (shared_ptr<GPUContext>& context : contexts_) {
+      GPUContextPool::Return(std::move(context));
+    }
+    for (shared_ptr<GPUContext>& context : contexts_aux_) {
+      GPUContextPool::Return(std::move(context));
+    }
   }
 }
 
@@ -218,57 +243,127 @@ CudaStream::~CudaStream() {
   }
 }
 
-shared_ptr<CudaStream> Caffe::pstream(int group) {
+GPUContext& Caffe::context(int group) {
   CHECK_GE(group, 0);
-  if (group < streams_.size() && streams_[group]) {
-    return streams_[group];
+  if (group >= contexts_.size()) {
+    contexts_.resize(group + 1UL);
+  }
+  if (!contexts_[group]) {
+    contexts_[group] = GPUContextPool::Lease(current_device());
   }
-  std::lock_guard<std::mutex> lock(pstream_mutex_);
-  streams_.resize(group + 1UL);
-  streams_[group] = CudaStream::create();
-  return streams_[group];
+  return *contexts_[group];
+}
+
+shared_ptr<CudaStream> Caffe::pstream(int group) {
+  return context(group).stream;
 }
 
 shared_ptr<CudaStream> Caffe::pstream_aux(int id) {
   CHECK_GE(id, 0);
-  if (id < streams_aux_.size() && streams_aux_[id]) {
-    return streams_aux_[id];
+  if (id >= contexts_aux_.size()) {
+    contexts_aux_.resize(id + 1UL);
+  }
+  if (!contexts_aux_[id]) {
+    contexts_aux_[id] = GPUContextPool::Lease(current_device());
   }
-  std::lock_guard<std::mutex> lock(pstream_mutex_);
-  streams_aux_.resize(id + 1UL);
-  streams_aux_[id] = CudaStream::create();
-  return streams_aux_[id];
+  return contexts_aux_[id]->stream;
 }
 
 shared_ptr<CuBLASHandle> Caffe::th_cublas_handle(int group) {
-  CHECK_GE(group, 0);
-  if (group < cublas_handles_.size() && cublas_handles_[group]) {
-    return cublas_handles_[group];
-  }
-  std::lock_guard<std::mutex> lock(cublas_mutex_);
-  cublas_handles_.resize(group + 1UL);
-  shared_ptr<CuBLASHandle>& cublas_handle = cublas_handles_[group];
-  if (!cublas_handle) {
-    cublas_handle = make_shared<CuBLASHandle>(pstream(group)->get());
-  }
-  return cublas_handle;
+  return context(group).cublas;
 }
 
 #ifdef USE_CUDNN
 cudnnHandle_t Caffe::th_cudnn_handle(int group) {
-  CHECK_GE(group, 0);
-  if (group < cudnn_handles_.size() && cudnn_handles_[group]) {
-    return cudnn_handles_[group]->get();
+  return context(group).cudnn->get();
+}
+#endif
+
+GPUContext::GPUContext(int device) : device(device) {
+  int initial_device;
+  CUDA_CHECK(cudaGetDevice(&initial_device));
+  CUDA_CHECK(cudaSetDevice(device));
+  stream = CudaStream::create();
+  cublas = make_shared<CuBLASHandle>(stream->get());
+#ifdef USE_CUDNN
+  cudnn = make_shared<CuDNNHandle>(stream->get());
+#endif
+  CUDA_CHECK(cudaSetDevice(initial_device));
+}
+
+GPUContextPool::Pool& GPUContextPool::pool() {
+  // Never destroyed: threads return their contexts at exit
+  static Pool* pool = new Pool;
+  return *pool;
+}
+
+int GPUContextPool::prewarm_count() {
+  static const int count = [] {
+    const char* env = std::getenv("CAFFE_GPU_CONTEXTS");
+    return env != nullptr ? std::max(0, std::atoi(env)) : 4;
+  }();
+  return count;
+}
+
+void GPUContextPool::Prewarm(int device) {
+  Pool& p = pool();
+  int missing = 0;
+  {
+    std::lock_guard<std::mutex> lock(p.mutex);
+    if (device >= p.prewarmed.size()) {
+      p.prewarmed.resize(device + 1UL, false);
+      p.free.resize(device + 1UL);
+    }
+    if (p.prewarmed[device]) {
+      return;
+    }
+    p.prewarmed[device] = true;
+    missing = prewarm_count() - static_cast<int>(p.free[device].size());
   }
-  std::lock_guard<std::mutex> lock(cudnn_mutex_);
-  cudnn_handles_.resize(group + 1UL);
-  shared_ptr<CuDNNHandle>& cudnn_handle = cudnn_handles_[group];
-  if (!cudnn_handle) {
-    cudnn_handle = make_shared<CuDNNHandle>(pstream(group)->get());
+  // Created unlocked so that devices prewarm concurrently
+  vector<shared_ptr<GPUContext>> contexts;
+  for (int i = 0; i < missing; ++i) {
+    contexts.emplace_back(make_shared<GPUContext>(device));
   }
-  return cudnn_handle->get();
+  std::lock_guard<std::mutex> lock(p.mutex);
+  for (shared_ptr<GPUContext>& context : contexts) {
+    p.free[device].emplace_back(std::move(context));
+  }
+  DLOG(INFO) << p.free[device].size() << " GPU contexts ready on device " << device;
+}
+
+shared_ptr<GPUContext> GPUContextPool::Lease(int device) {
+  Pool& p = pool();
+  {
+    std::lock_guard<std::mutex> lock(p.mutex);
+    if (device < p.free.size() && !p.free[device].empty()) {
+      shared_ptr<GPUContext> context = std::move(p.free[device].back());
+      p.free[device].pop_back();
+      return context;
+    }
+  }
+  return make_shared<GPUContext>(device);
+}
+
+void GPUContextPool::Return(shared_ptr<GPUContext> context) {
+  // Someone still holding the stream or a handle might use it from another thread
+  if (!context || context->stream.use_count() > 1L || context->cublas.use_count() > 1L) {
+    return;
+  }
+  Pool& p = pool();
+  std::lock_guard<std::mutex> lock(p.mutex);
+  if (context->device >= p.free.size()) {
+    p.prewarmed.resize(context->device + 1UL, false);
+    p.free.resize(context->device + 1UL);
+  }
+  p.free[context->device].emplace_back(std::move(context));
+}
+
+size_t GPUContextPool::available(int device) {
+  Pool& p = pool();
+  std::lock_guard<std::mutex> lock(p.mutex);
+  return device < p.free.size() ? p.free[device].size() : 0UL;
 }
-#endif
 
 void Caffe::SetDevice(const int device_id) {
   root_device_ = device_id;
@@ -482,10 +577,14 @@ Caffe::Properties::Properties() :
   int count = 0;
   CUDA_CHECK(cudaGetDeviceCount(&count));
   compute_capabilities_.resize(count);
+  device_names_.resize(count);
+  multiprocessor_counts_.resize(count);
   cudaDeviceProp device_prop;
   for (int gpu = 0; gpu < compute_capabilities_.size(); ++gpu) {
     CUDA_CHECK(cudaGetDeviceProperties(&device_prop, gpu));
     compute_capabilities_[gpu] = device_prop.major * 100 + device_prop.minor;
+    device_names_[gpu] = device_prop.name;
+    multiprocessor_counts_[gpu] = device_prop.multiProcessorCount;
     DLOG(INFO) << "GPU " << gpu << " '" << device_prop.name << "' has compute capability "
         << device_prop.major << "." << device_prop.minor;
   }
@@ -537,32 +636,63 @@ namespace nvml {
 
 std::mutex NVMLInit::m_;
 
-NVMLInit::NVMLInit() {
+// NUMA node of PCI device, -1 if unknown
+static int pci_numa_node(std::string bus_id) {
+  std::transform(bus_id.begin(), bus_id.end(), bus_id.begin(), ::tolower);
+  int node = -1;
+  FILE* fp = fopen(("/sys/bus/pci/devices/" + bus_id + "/numa_node").c_str(), "r");
+  if (fp != nullptr) {
+    if (fscanf(fp, "%d", &node) != 1) {
+      node = -1;
+    }
+    fclose(fp);
+  }
+  return node;
+}
+
+// Memory of this thread (pinned buffers including) is taken from the node given when possible
+static bool set_preferred_numa_node(int node) {
+#ifdef __linux__
+  const size_t bits = 8UL * sizeof(unsigned long);  // NOLINT(runtime/int)
+  unsigned long mask[16] = {};  // NOLINT(runtime/int)
+  if (node < 0 || static_cast<size_t>(node) >= bits * 16UL) {
+    return false;
+  }
+  mask[node / bits] |= 1UL << (node % bits);
+  return syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, bits * 16UL) == 0;
+#else
+  return false;
+#endif
+}
+
+NVMLInit::NVMLInit() : device_(nullptr), numa_node_(-1) {
   if (nvmlInit() != NVML_SUCCESS) {
     LOG(ERROR) << "NVML failed to initialize";
     return;
-  } else {
-    LOG(INFO) << "NVML initialized, thread " << std::this_thread::get_id();
   }
-  unsigned int deviceCount = 0U;
-  if (nvmlDeviceGetCount(&deviceCount) == NVML_SUCCESS) {
-    for (unsigned int id = 0; id < deviceCount; ++id) {
-      if (nvmlDeviceGetHandleByIndex(id, &device_) != NVML_SUCCESS ||
-          nvmlDeviceSetCpuAffinity(device_) != NVML_SUCCESS) {
-          LOG(ERROR) << "NVML failed to set CPU affinity on device " << id
-              << ", thread " << std::this_thread::get_id();
-      }
-    }
-  } else {
-    LOG(ERROR) << "nvmlDeviceGetCount failed, thread " << std::this_thread::get_id();
+  // CUDA and NVML might enumerate devices differently, PCI bus id is what they share
+  int device = -1;
+  char bus_id[32];
+  if (cudaGetDevice(&device) != cudaSuccess ||
+      cudaDeviceGetPCIBusId(bus_id, sizeof(bus_id), device) != cudaSuccess ||
+      nvmlDeviceGetHandleByPciBusId(bus_id, &device_) != NVML_SUCCESS ||
+      nvmlDeviceSetCpuAffinity(device_) != NVML_SUCCESS) {
+    LOG(ERROR) << "NVML failed to set CPU affinity on device " << device
+        << ", thread " << std::this_thread::get_id();
+    return;
   }
+  numa_node_ = pci_numa_node(bus_id);
+  const bool mem_bound = set_preferred_numa_node(numa_node_);
+  DLOG(INFO) << "Thread " << std::this_thread::get_id() << " bound to CPU cores of device "
+      << device << (mem_bound ? ", NUMA node " + std::to_string(numa_node_) : std::string());
 }
 
 NVMLInit::~NVMLInit() {
   nvmlShutdown();
 }
 
-// set the CPU affinity for this thread
+// Binds this thread to CPU cores local to the current device,
+// also makes it prefer memory of device's NUMA node
 void setCpuAffinity() {
   std::lock_guard<std::mutex> lock(NVMLInit::m_);
   static thread_local NVMLInit nvml_init_;
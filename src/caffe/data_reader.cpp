@@ -1,15 +1,37 @@
 #include <boost/thread.hpp>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 #include <sys/sysinfo.h>
 
+#include <chrono>
+
+#ifdef USE_LEVELDB
+#include <snappy.h>
+#endif
+
 #include "caffe/util/rng.hpp"
 #include "caffe/common.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/data_reader.hpp"
+#include "caffe/util/db_rank_shards.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/nvtx.hpp"
+#include "caffe/util/thread_profile.hpp"
 
 namespace caffe {
 
 std::mutex DataReader::DataCache::cache_mutex_;
-unique_ptr<DataReader::DataCache> DataReader::DataCache::data_cache_inst_;
+std::map<string, unique_ptr<DataReader::DataCache>> DataReader::DataCache::data_cache_inst_;
+std::mutex DataReader::node_readers_mutex_;
+std::map<string, std::weak_ptr<DataReader>> DataReader::node_readers_;
+std::mutex DataReader::RecordIndex::instances_mutex_;
+std::map<string, std::weak_ptr<const DataReader::RecordIndex>>
+    DataReader::RecordIndex::instances_;
+
+// Parses current cursor record either as Datum or as Caffe2 TensorProtos
+static void parse_record(db::Cursor* cursor, Datum* datum, C2TensorProtos* protos);
+// Parses encoded Datum record leaving its data in place. Returns false for other records.
+static bool parse_view(const db::Cursor* cursor, Datum* datum, DataReader::DatumView* view);
 
 DataReader::DataReader(const LayerParameter& param,
     size_t solver_count,
@@ -20,7 +42,9 @@ DataReader::DataReader(const LayerParameter& param,
     bool sample_only,
     bool skip_one_batch,
     bool cache,
-    bool shuffle)
+    bool shuffle,
+    size_t start_record,
+    size_t ranks)
     : InternalThread(Caffe::current_device(),
           solver_rank, sample_only ? 1U : parser_threads_num, false),
       parser_threads_num_(threads_num()),
@@ -29,42 +53,90 @@ DataReader::DataReader(const LayerParameter& param,
       queue_depth_(queue_depth),
       solver_count_(solver_count),
       solver_rank_(solver_rank),
+      ranks_(ranks),
       skip_one_batch_(skip_one_batch),
+      start_record_(start_record),
       current_rec_(0),
       current_queue_(0),
       sample_only_(sample_only),
       cache_(cache && !sample_only),
-      shuffle_(cache_ && shuffle) {
+      shuffle_(cache_ && shuffle),
+      zero_copy_(param.data_param().zero_copy() && !cache_ && !sample_only
+          && param.data_param().backend() == DataParameter_DB_LMDB),
+      pool_records_(0UL),
+      pool_grows_(0UL),
+      pool_largest_(0UL),
+      parser_busy_us_(0UL),
+      read_us_(0UL),
+      parse_us_(0UL),
+      cache_hits_(0UL),
+      cache_misses_(0UL) {
   CHECK(queues_num_);
   CHECK(queue_depth_);
-  batch_size_ = param.data_param().batch_size();
+  batch_size_ = param.data_param().batch_size() * ranks_;
   backend_ = param.data_param().backend();
-  if (backend_ == DataParameter_DB_LEVELDB) {
-    CHECK_EQ(parser_threads_num_, 1) << "LevelDB doesn't support multiple connections";
-  }
+  CHECK(ranks_ == 1UL || (!cache_ && !sample_only_ && !skip_one_batch_))
+      << "A node reader doesn't cache, sample or skip";
+  LOG_IF(INFO, param.data_param().zero_copy() && !zero_copy_ && !sample_only)
+      << "Zero-copy mode is ignored: it needs LMDB backend and no cache";
   if (cache_) {
-    // This is singleton, we cache TRAIN db only
-    data_cache_ = DataCache::data_cache_inst(parser_threads_num_ * solver_count_, shuffle_);
+    // Shared by all readers of the same source and phase
+    data_cache_ = DataCache::data_cache_inst(param, parser_threads_num_ * solver_count_, shuffle_);
   }
 
-  free_.resize(queues_num_);
-  full_.resize(queues_num_);
-  LOG(INFO) << (sample_only ? "Sample " : "") << "Data Reader threads: "
-      << this->threads_num() << ", out queues: " << queues_num_ << ", depth: " << queue_depth_;
-  for (size_t i = 0; i < queues_num_; ++i) {
-    full_[i] = make_shared<BlockingQueue<shared_ptr<Datum>>>();
-    free_[i] = make_shared<BlockingQueue<shared_ptr<Datum>>>();
+  free_.resize(queues_num_ * ranks_);
+  full_.resize(queues_num_ * ranks_);
+  LOG(INFO) << (sample_only ? "Sample " : (ranks_ > 1UL ? "Node " : "")) << "Data Reader threads: "
+      << this->threads_num() << ", out queues: " << full_.size() << ", depth: " << queue_depth_;
+  LOG_IF(INFO, start_record_ > 0UL) << "Data Reader starts at record " << start_record_;
+  // Sample reader pushes whole batch without taking free datums back
+  const size_t ring_capacity = param.data_param().lock_free_queues() && !sample_only ?
+      queue_depth_ : 0UL;
+  for (size_t i = 0; i < full_.size(); ++i) {
+    // Every queue pair circulates queue_depth_ datums between one parser and one transformer
+    full_[i] = make_shared<BlockingQueue<shared_ptr<Datum>>>(ring_capacity);
+    free_[i] = make_shared<BlockingQueue<shared_ptr<Datum>>>(ring_capacity);
     for (size_t j = 0; j < queue_depth_ - 1U; ++j) {  // +1 in InternalThreadEntryN
-      free_[i]->push(make_shared<Datum>());
+      free_[i]->push(new_datum());
     }
   }
   db_source_ = param.data_param().source();
+  data_param_ = param.data_param();
+  rank_shards_ = db::RankShardsDB::Count(db_source_);
+  LOG_IF(INFO, rank_shards_ > 0UL) << db_source_ << " is split in " << rank_shards_
+      << " rank shards";
   init_ = make_shared<BlockingQueue<shared_ptr<Datum>>>();
-  StartInternalThread(false, Caffe::next_seed());
+  // Parsers run on CPU cores local to the device they feed
+  StartInternalThread(true, Caffe::next_seed());
 }
 
 DataReader::~DataReader() {
   StopInternalThread();
+  LOG_IF(INFO, pool_records_.load() > 0UL && !sample_only_) << "Datum pool: "
+      << full_.size() * queue_depth_ << " datums, " << pool_records_.load()
+      << " records parsed, " << pool_grows_.load() << " buffer reallocations, largest record "
+      << pool_largest_.load() << " bytes";
+}
+
+void DataReader::pool_account(const Datum& datum, size_t capacity) {
+  pool_records_.fetch_add(1UL, std::memory_order_relaxed);
+  if (datum.data().capacity() != capacity) {
+    pool_grows_.fetch_add(1UL, std::memory_order_relaxed);
+  }
+  const size_t size = datum.data().size();
+  size_t largest = pool_largest_.load(std::memory_order_relaxed);
+  while (size > largest &&
+      !pool_largest_.compare_exchange_weak(largest, size, std::memory_order_relaxed)) {}
+}
+
+size_t DataReader::full_queued() const {
+  size_t queued = 0UL, size = 0UL;
+  for (const shared_ptr<BlockingQueue<shared_ptr<Datum>>>& queue : full_) {
+    if (queue->nonblocking_size(&size)) {
+      queued += size;
+    }
+  }
+  return queued;
 }
 
 void DataReader::InternalThreadEntry() {
@@ -73,10 +145,32 @@ void DataReader::InternalThreadEntry() {
 
 void DataReader::InternalThreadEntryN(size_t thread_id) {
   if (cache_) {
-    data_cache_->check_db(db_source_);
     data_cache_->register_new_thread();
   }
-  shared_ptr<db::DB> db(db::GetDB(backend_));
+  shared_ptr<db::DB> db;
+  bool local = false;
+  if (rank_shards_ > 0UL) {
+    db::RankShardsDB* shards = new db::RankShardsDB(backend_);
+    const size_t cursors = solver_count_ * parser_threads_num_;
+    if (rank_shards_ % cursors == 0UL) {
+      // Records i * cursors + this cursor's number, read sequentially from local files
+      vector<size_t> own;
+      for (size_t s = solver_rank_ * parser_threads_num_ + thread_id; s < rank_shards_;
+          s += cursors) {
+        own.push_back(s);
+      }
+      shards->select(own);
+      local = true;
+    } else {
+      LOG_IF(WARNING, solver_rank_ == 0 && thread_id == 0) << rank_shards_
+          << " rank shards of " << db_source_ << " don't split between " << cursors
+          << " parser threads, every one reads them all";
+    }
+    db.reset(shards);
+  } else {
+    db.reset(db::GetDB(backend_));
+  }
+  db->Configure(data_param_);
   db->Open(db_source_, db::READ);
   CursorManager cm(db,
       this,
@@ -86,7 +180,8 @@ void DataReader::InternalThreadEntryN(size_t thread_id) {
       thread_id,
       batch_size_,
       cache_ && !sample_only_,
-      shuffle_ && !sample_only_);
+      shuffle_ && !sample_only_,
+      local);
   shared_ptr<Datum> init_datum = make_shared<Datum>();
   cm.fetch(init_datum.get());
   init_->push(init_datum);
@@ -98,21 +193,32 @@ void DataReader::InternalThreadEntryN(size_t thread_id) {
   size_t skip = skip_one_batch_ ? batch_size_ : 0UL;
 
   size_t queue_id, ranked_rec, batch_on_solver, sample_count = 0UL;
-  shared_ptr<Datum> datum = make_shared<Datum>();
+  shared_ptr<Datum> datum = new_datum();
   try {
     while (!must_stop(thread_id)) {
+      const auto start = std::chrono::steady_clock::now();
       cm.next(datum);
+      parser_busy_us_.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
       // See comment below
       ranked_rec = (size_t) datum->record_id() / cm.full_cycle();
       batch_on_solver = ranked_rec * parser_threads_num_ + thread_id;
       queue_id = batch_on_solver % queues_num_;
+      if (ranks_ > 1UL) {
+        // Every rank_batch records of the batch go to the next solver
+        const size_t rank_batch = batch_size_ / ranks_;
+        queue_id += (datum->record_id() % batch_size_) / rank_batch * queues_num_;
+      }
 
       if (thread_id == 0 && skip > 0U) {
         --skip;
         continue;
       }
 
-      full_push(queue_id, datum);
+      {
+        ThreadProfile::Scope blocked(ThreadProfile::BLOCKED);
+        full_push(queue_id, datum);
+      }
 
       if (sample_only_) {
         ++sample_count;
@@ -121,24 +227,179 @@ void DataReader::InternalThreadEntryN(size_t thread_id) {
           break;
         }
       }
+      ThreadProfile::Scope blocked(ThreadProfile::BLOCKED);
       datum = free_pop(queue_id);
     }
   } catch (boost::thread_interrupted&) {
   }
 }
 
+shared_ptr<DataReader> DataReader::node_reader(const LayerParameter& param,
+    size_t parser_threads_num, size_t transf_threads_num) {
+  const string key = param.data_param().source() + "#" + Phase_Name(param.phase());
+  const size_t ranks = Caffe::solver_count() / Caffe::node_count();
+  std::lock_guard<std::mutex> lock(node_readers_mutex_);
+  shared_ptr<DataReader> reader = node_readers_[key].lock();
+  if (!reader) {
+    // Each parser thread reads batches of every local solver back to back
+    reader = make_shared<DataReader>(param, Caffe::node_count(), Caffe::node_rank(),
+        parser_threads_num, transf_threads_num, param.data_param().batch_size(),
+        false, false, false, false, 0UL, ranks);
+    node_readers_[key] = reader;
+  }
+  CHECK_EQ(reader->queues_num_, parser_threads_num * transf_threads_num)
+      << "Solvers sharing a node reader must use the same threads";
+  return reader;
+}
+
+shared_ptr<Datum> DataReader::new_datum() const {
+  return zero_copy_ ? shared_ptr<Datum>(new Datum(), DatumView()) : make_shared<Datum>();
+}
+
+DataReader::DataCache* DataReader::DataCache::data_cache_inst(const LayerParameter& param,
+    size_t threads, bool shuffle) {
+  const string key = param.data_param().source() + "#" + Phase_Name(param.phase());
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  unique_ptr<DataCache>& inst = data_cache_inst_[key];
+  if (!inst) {
+    inst.reset(new DataCache(param, threads, shuffle));
+  }
+  return inst.get();
+}
+
+DataReader::DataCache::DataCache(const LayerParameter& param, size_t threads, bool shuffle)
+    : cache_pos_(0UL),
+      perm_seed_(Caffe::next_seed()),
+      cache_bar_(threads),
+      shuffle_(shuffle),
+      just_cached_(false),
+      decoded_budget_(param.data_param().shared_cache() ||
+          (param.transform_param().use_gpu_transform() && Caffe::mode() == Caffe::GPU) ?
+          0UL : param.data_param().cache_decoded_mb() * 1024UL * 1024UL),
+      decoded_bytes_(0UL),
+      color_mode_(param.transform_param().force_color() ?
+          1 : (param.transform_param().force_gray() ? -1 : 0)),
+#ifdef USE_LEVELDB
+      compress_(param.data_param().cache_compress() && !param.data_param().shared_cache()),
+#else
+      compress_(false),
+#endif
+      raw_bytes_(0UL),
+      packed_bytes_(0UL),
+      shared_count_(0UL),
+      shared_ready_(false) {
+  const DataParameter& data_param = param.data_param();
+  LOG_IF(INFO, data_param.cache_decoded_mb() > 0U && decoded_budget_ == 0UL)
+      << "Decoded cache tier is ignored: it needs CPU transform and in-process cache";
+  LOG_IF(INFO, decoded_budget_ > 0UL) << "Caching up to " << data_param.cache_decoded_mb()
+      << "MB of decoded images";
+  LOG_IF(WARNING, data_param.cache_compress() && !data_param.shared_cache() && !compress_)
+      << "Compressed cache is ignored: it needs a build with LevelDB, which brings Snappy";
+  LOG_IF(INFO, compress_) << "Caching records Snappy compressed";
+  if (!data_param.shared_cache()) {
+    return;
+  }
+  CHECK_EQ(data_param.backend(), DataParameter_DB_LMDB)
+      << "shared_cache is supported for LMDB backend only";
+  const string& source = data_param.source();
+  // The arena is sparse, thus we may safely over-reserve
+  const size_t capacity = 2UL * ShmArena::path_bytes(source) + 64UL * 1024UL * 1024UL;
+  arena_.reset(new ShmArena(ShmArena::segment_name(source + "#" + Phase_Name(param.phase())),
+      capacity));
+  if (arena_->owner()) {
+    LOG(INFO) << "Caching " << source << " in shared memory segment " << arena_->name();
+    filler_.reset(new boost::thread(&DataCache::fill_shared, this, source, data_param.backend()));
+  } else {
+    LOG(INFO) << "Using " << source << " cached by another process in shared memory segment "
+              << arena_->name();
+  }
+}
+
+DataReader::DataCache::~DataCache() {
+  if (filler_) {
+    filler_->interrupt();
+    filler_->join();
+  }
+}
+
+// Owner reads the whole DB into the arena independently from consumers.
+// Until it's done every reader (in this and other processes) keeps reading its DB cursor.
+void DataReader::DataCache::fill_shared(const string& source, DataParameter_DB backend) {
+  try {
+    shared_ptr<db::DB> db(db::RankShardsDB::Count(source) > 0UL ?
+        new db::RankShardsDB(backend) : db::GetDB(backend));
+    db->Open(source, db::READ);
+    unique_ptr<db::Cursor> cursor(db->NewCursor());
+    Datum datum;
+    C2TensorProtos protos;
+    string buf;
+    for (cursor->SeekToFirst(); cursor->valid(); cursor->Next()) {
+      boost::this_thread::interruption_point();
+      parse_record(cursor.get(), &datum, &protos);
+      datum.SerializeToString(&buf);
+      if (!arena_->append(buf.data(), buf.size())) {
+        break;
+      }
+    }
+    cursor.reset();
+    db->Close();
+    if (arena_->state() == ShmArena::BUILDING) {
+      arena_->seal();
+    }
+  } catch (boost::thread_interrupted&) {
+    arena_->fail();
+  }
+}
+
+bool DataReader::DataCache::check_shared(bool* cache) {
+  if (shared_ready_.load()) {
+    return true;
+  }
+  const ShmArena::State state = arena_->state();
+  if (state == ShmArena::BUILDING) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(shared_mutex_);
+  if (shared_ready_.load()) {
+    return true;
+  }
+  if (state == ShmArena::FAILED || !arena_->wait_ready()) {
+    LOG_FIRST_N(WARNING, 1) << "Shared memory segment " << arena_->name()
+        << " can't be used, cache and shuffling are now disabled";
+    *cache = false;
+    return false;
+  }
+  shared_count_ = arena_->count();
+  LOG(INFO) << "Switched to " << shared_count_ << " records cached in "
+            << arena_->name();
+  shared_ready_.store(true);
+  return true;
+}
+
 shared_ptr<Datum>& DataReader::DataCache::next_new() {
   std::lock_guard<std::mutex> lock(cache_mutex_);
   cache_buffer_.emplace_back(make_shared<Datum>());
   return cache_buffer_.back();
 }
 
-shared_ptr<Datum>& DataReader::DataCache::next_cached() {
+void DataReader::DataCache::next_cached(shared_ptr<Datum>& datum) {
+  if (shared()) {
+    const size_t idx = cached_index(cache_pos_.fetch_add(1UL), shared_count_);
+    // Datums in shared mode are never owned by the cache, thus it's safe to overwrite
+    size_t size;
+    const char* record = arena_->record(idx, &size);
+    CHECK(datum->ParseFromArray(record, size)) << "Corrupted record " << idx
+        << " in shared memory segment " << arena_->name();
+    return;
+  }
   if (just_cached_.load()) {
     cache_bar_.wait();
     just_cached_.store(false);
-    LOG_FIRST_N(INFO, 1) << "Cached " << cache_buffer_.size() << " records by "
+    LOG_FIRST_N(INFO, 1) << "Cached " << count() << " records by "
           << cached_flags_.size() << " threads";
+    LOG_IF(INFO, compress_ && packed_bytes_ > 0UL) << "Cache holds " << (packed_bytes_ >> 20)
+        << " MB compressed from " << (raw_bytes_ >> 20) << " MB, ratio "
+        << static_cast<double>(raw_bytes_) / packed_bytes_;
 #ifdef DEBUG
     {
       std::lock_guard<std::mutex> lock(cache_mutex_);
@@ -155,16 +416,33 @@ shared_ptr<Datum>& DataReader::DataCache::next_cached() {
 #endif
     cache_bar_.wait();
   }
-  std::lock_guard<std::mutex> lock(cache_mutex_);
-  if (shuffle_ && cache_idx_== 0UL) {
-    LOG(INFO) << "Shuffling " << cache_buffer_.size() << " records...";
-    caffe::shuffle(cache_buffer_.begin(), cache_buffer_.end());
-  }
-  shared_ptr<Datum>& datum = cache_buffer_[cache_idx_++];
-  if (cache_idx_ >= cache_buffer_.size()) {
-    cache_idx_= 0UL;
+  // The buffer doesn't change after caching is done: no lock needed
+  LOG_IF(INFO, shuffle_ && cache_pos_.load() == 0UL) << "Shuffling " << count()
+      << " records by per-epoch index permutation";
+  const size_t idx = cached_index(cache_pos_.fetch_add(1UL), count());
+#ifdef USE_LEVELDB
+  if (compress_) {
+    // As in shared mode the datum given is not owned by the cache
+    thread_local string raw;
+    const string& packed = packed_buffer_[idx];
+    CHECK(snappy::Uncompress(packed.data(), packed.size(), &raw) &&
+        datum->ParseFromString(raw)) << "Corrupted cached record " << idx;
+    return;
   }
-  return datum;
+#endif
+  datum = cache_buffer_[idx];
+}
+
+void DataReader::DataCache::pack(const Datum& datum) {
+#ifdef USE_LEVELDB
+  string raw, packed;
+  CHECK(datum.SerializeToString(&raw));
+  snappy::Compress(raw.data(), raw.size(), &packed);
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  raw_bytes_ += raw.size();
+  packed_bytes_ += packed.size();
+  packed_buffer_.emplace_back(std::move(packed));
+#endif
 }
 
 void DataReader::DataCache::just_cached() {
@@ -172,11 +450,29 @@ void DataReader::DataCache::just_cached() {
   cached_flags_[std::this_thread::get_id()]->set();
 }
 
+void DataReader::DataCache::decode(Datum* datum) {
+#ifdef USE_OPENCV
+  if (!datum->encoded() || decoded_bytes_.load(std::memory_order_relaxed) >= decoded_budget_) {
+    return;
+  }
+  cv::Mat img;
+  DecodeDatumToCVMat(*datum, color_mode_, img, false);
+  const size_t bytes = img.total() * img.elemSize();
+  // Concurrent parsers may overshoot the budget by one image each, which is fine
+  if (decoded_bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes > decoded_budget_) {
+    LOG_FIRST_N(INFO, 1) << "Decoded cache tier is full, "
+        << "the rest of records is cached encoded";
+    return;
+  }
+  CVMatToDatum(img, *datum);
+#endif
+}
+
 bool DataReader::DataCache::check_memory() {
 #ifdef __APPLE__
   return true;
 #else
-  if (cache_buffer_.size() == 0UL || cache_buffer_.size() % 1000UL != 0UL) {
+  if (shared() || count() == 0UL || count() % 1000UL != 0UL) {
     return true;
   }
   std::lock_guard<std::mutex> lock(cache_mutex_);
@@ -184,7 +480,7 @@ bool DataReader::DataCache::check_memory() {
   struct sysinfo sinfo;
   sysinfo(&sinfo);
   if (sinfo.totalswap > 0UL && sinfo.freeswap < sinfo.totalswap / 2UL) {
-    LOG_FIRST_N(WARNING, 1) << "Data Reader cached " << cache_buffer_.size()
+    LOG_FIRST_N(WARNING, 1) << "Data Reader cached " << count()
         << " records so far but it can't continue because it used more than half"
         << " of swap buffer. Free swap memory left: " << sinfo.freeswap << " of total "
         << sinfo.totalswap << ". Cache and shuffling are now disabled.";
@@ -224,6 +520,7 @@ bool DataReader::DataCache::check_memory() {
 //  }
   if (!mem_ok) {
     cache_buffer_.clear();
+    packed_buffer_.clear();
     shuffle_ = false;
   }
   return mem_ok;
@@ -232,7 +529,7 @@ bool DataReader::DataCache::check_memory() {
 
 DataReader::CursorManager::CursorManager(shared_ptr<db::DB> db, DataReader* reader,
     size_t solver_count, size_t solver_rank, size_t parser_threads, size_t parser_thread_id,
-    size_t batch_size, bool cache, bool shuffle)
+    size_t batch_size, bool cache, bool shuffle, bool local)
     : db_(db),
       cursor_(db->NewCursor()),
       reader_(reader),
@@ -243,55 +540,161 @@ DataReader::CursorManager::CursorManager(shared_ptr<db::DB> db, DataReader* read
       parser_thread_id_(parser_thread_id),
       rank_cycle_(parser_threads_ * batch_size_),
       full_cycle_(rank_cycle_ * solver_count_),
+      local_(local),
       rec_id_(0UL),
       rec_end_(0UL),
       cache_(cache),
       shuffle_(shuffle),
-      cached_all_(false) {}
+      cached_all_(false),
+      read_ahead_(reader->backend_ == DataParameter_DB_LMDB ||
+          (reader->backend_ == DataParameter_DB_LEVELDB &&
+           reader->data_param_.leveldb_fill_cache()) ?
+          reader->data_param_.read_ahead() : 0U),
+      ahead_rec_id_(0UL),
+      ahead_rec_end_(0UL),
+      db_size_(0UL) {
+  if (read_ahead_ > 0UL) {
+    ahead_cursor_.reset(db->NewCursor());
+  }
+  // Seeks pay off once threads skip records of others. Rank shards can't seek.
+  if (reader->data_param_.record_index() && full_cycle_ > batch_size_ &&
+      reader->rank_shards_ == 0UL &&
+      (reader->backend_ == DataParameter_DB_LMDB ||
+       reader->backend_ == DataParameter_DB_LEVELDB)) {
+    index_ = RecordIndex::get(reader->db_source_, db.get());
+    db_size_ = index_->size();
+  }
+}
+
+shared_ptr<const DataReader::RecordIndex>
+DataReader::RecordIndex::get(const string& source, db::DB* db) {
+  std::lock_guard<std::mutex> lock(instances_mutex_);
+  shared_ptr<const RecordIndex> index = instances_[source].lock();
+  if (!index) {
+    index.reset(new RecordIndex(db));
+    instances_[source] = index;
+  }
+  return index;
+}
+
+DataReader::RecordIndex::RecordIndex(db::DB* db) {
+  const auto start = std::chrono::steady_clock::now();
+  unique_ptr<db::Cursor> cursor(db->NewCursor());
+  offsets_.push_back(0UL);
+  for (cursor->SeekToFirst(); cursor->valid(); cursor->Next()) {
+    keys_ += cursor->key();
+    offsets_.push_back(keys_.size());
+  }
+  CHECK_GT(size(), 0UL) << "Empty data source";
+  LOG(INFO) << "Record index: " << size() << " keys, " << keys_.size() / 1024UL
+      << " KB in " << std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count() << " ms";
+}
 
 DataReader::CursorManager::~CursorManager() {
+  ahead_cursor_.reset();
   cursor_.reset();
   db_->Close();
 }
 
 void DataReader::CursorManager::next(shared_ptr<Datum>& datum) {
+  NVTX_RANGE(NVTX_DATA, "DataReader fetch");
+  ThreadProfile::Scope parse(ThreadProfile::PARSE);
+  const auto start = std::chrono::steady_clock::now();
+  if (cache_ && !cached_all_ && reader_->shared_cache()) {
+    cached_all_ = reader_->check_shared_cache(&cache_);
+    shuffle_ = shuffle_ && cache_;
+  }
   if (cached_all_) {
-    datum = reader_->next_cached();
+    reader_->next_cached(datum);
+    reader_->cache_hits_.fetch_add(1UL, std::memory_order_relaxed);
   } else {
-    while (cache_) {
+    while (cache_ && !reader_->shared_cache()) {
       if (!reader_->check_memory()) {
         cache_ = false;
         shuffle_ = false;
         break;
       }
-      datum = reader_->next_new();
+      if (!reader_->packed_cache()) {
+        datum = reader_->next_new();
+      }
       break;
     }
-    fetch(datum.get());
+    if (reader_->zero_copy_) {
+      fetch_view(datum);
+    } else {
+      fetch(datum.get());
+      if (cache_ && !reader_->shared_cache()) {
+        reader_->decode_cached(datum.get());
+        if (reader_->packed_cache()) {
+          reader_->pack_cached(*datum);
+        }
+      }
+    }
+    if (reader_->cache_) {
+      reader_->cache_misses_.fetch_add(1UL, std::memory_order_relaxed);
+    }
   }
 
   datum->set_record_id(rec_id_);
-  size_t old_id = rec_id_;
-  ++rec_id_;
-  if (rec_id_ == rec_end_) {
-    rec_id_ += full_cycle_ - batch_size_;
-    rec_end_ += full_cycle_;
-  }
+  const auto parsed = std::chrono::steady_clock::now();
+  reader_->parse_us_.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(
+      parsed - start).count(), std::memory_order_relaxed);
+  const size_t steps = advance(&rec_id_, &rec_end_);
   if (cached_all_) {
     return;
   }
-  for (size_t i = old_id; i < rec_id_; ++i) {
-    cursor_->Next();
-    if (!cursor_->valid()) {
-      if (cache_) {
-        cached_all_ = true;
-        reader_->just_cached();
-        break;  // we cache first epoch, then we just read it from cache
-      }
+  ThreadProfile::Scope read(ThreadProfile::READ);
+  if (step(cursor_.get(), rec_id_, local_ ? 1UL : steps)) {
+    if (cache_ && !reader_->shared_cache()) {
+      cached_all_ = true;
+      reader_->just_cached();
+      ahead_cursor_.reset();  // we cache first epoch, then we just read it from cache
+    } else {
       LOG_IF(INFO, solver_rank_ == 0 && parser_thread_id_ == 0) << "Restarting data pre-fetching";
-      cursor_->SeekToFirst();
     }
   }
+  if (ahead_cursor_) {
+    ahead_next();
+  }
+  reader_->read_us_.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - parsed).count(), std::memory_order_relaxed);
+}
+
+size_t DataReader::CursorManager::advance(size_t* rec_id, size_t* rec_end) const {
+  const size_t old_id = *rec_id;
+  ++*rec_id;
+  if (*rec_id == *rec_end) {
+    *rec_id += full_cycle_ - batch_size_;
+    *rec_end += full_cycle_;
+  }
+  return *rec_id - old_id;
+}
+
+// Follows the same record sequence as the main cursor, read_ahead_ records ahead
+void DataReader::CursorManager::ahead_next() {
+  const size_t steps = advance(&ahead_rec_id_, &ahead_rec_end_);
+  step(ahead_cursor_.get(), ahead_rec_id_, local_ ? 1UL : steps);
+  ahead_cursor_->prefetch();
+}
+
+bool DataReader::CursorManager::step(db::Cursor* cursor, size_t rec_id, size_t steps) {
+  if (index_ && steps > 1UL) {
+    const size_t from = reader_->start_record_ + rec_id - steps;
+    const size_t to = reader_->start_record_ + rec_id;
+    CHECK(cursor->SeekToKey(index_->key(to % db_size_))) << "Record " << to % db_size_
+        << " of " << reader_->db_source_ << " not found, was it changed while open?";
+    return to / db_size_ != from / db_size_;
+  }
+  bool wrapped = false;
+  for (size_t i = 0; i < steps; ++i) {
+    cursor->Next();
+    if (!cursor->valid()) {
+      cursor->SeekToFirst();
+      wrapped = true;
+    }
+  }
+  return wrapped;
 }
 
 /*
@@ -321,28 +724,136 @@ void DataReader::CursorManager::rewind() {
   size_t rank_cycle_begin = rank_cycle_ * solver_rank_;
   rec_id_ = rank_cycle_begin + parser_thread_id_ * batch_size_;
   rec_end_ = rec_id_ + batch_size_;
-  cursor_->SeekToFirst();
-  for (size_t i = 0; i < rec_id_; ++i) {
-    cursor_->Next();
-    if (!cursor_->valid()) {
-      cursor_->SeekToFirst();
+  // Local cursor starts at its share of records already read
+  const size_t start = local_ ? reader_->start_record_ / (full_cycle_ / batch_size_) :
+      reader_->start_record_ + rec_id_;
+  seek(cursor_.get(), start);
+  if (ahead_cursor_) {
+    seek(ahead_cursor_.get(), start);
+    ahead_rec_id_ = rec_id_;
+    ahead_rec_end_ = rec_end_;
+    ahead_cursor_->prefetch();
+    for (size_t i = 1; i < read_ahead_; ++i) {
+      ahead_next();
+    }
+  }
+}
+
+void DataReader::CursorManager::seek(db::Cursor* cursor, size_t steps) {
+  if (index_) {
+    CHECK(cursor->SeekToKey(index_->key(steps % db_size_)));
+    return;
+  }
+  cursor->SeekToFirst();
+  if (db_size_ > 0UL) {
+    steps %= db_size_;
+  }
+  for (size_t i = 0; i < steps; ++i) {
+    cursor->Next();
+    if (!cursor->valid()) {
+      cursor->SeekToFirst();
+      if (db_size_ == 0UL) {
+        // Whole passes are skipped once the size is known
+        db_size_ = i + 1UL;
+        steps = i + 1UL + (steps - i - 1UL) % db_size_;
+      }
     }
   }
 }
 
 void DataReader::CursorManager::fetch(Datum* datum) {
-  C2TensorProtos protos;
-  if (cursor_->parse(&protos) && protos.protos_size() >= 2) {
-    C2TensorProto* image_proto = protos.mutable_protos(0);
-    C2TensorProto* label_proto = protos.mutable_protos(1);
+  if (cache_ && !reader_->shared_cache() && !reader_->packed_cache()) {
+    // Datums cached in process are not recycled
+    parse_record(cursor_.get(), datum, &c2_protos_);
+    return;
+  }
+  reader_->pool_reserve(datum);
+  const size_t capacity = datum->data().capacity();
+  parse_record(cursor_.get(), datum, &c2_protos_);
+  reader_->pool_account(*datum, capacity);
+}
+
+void DataReader::CursorManager::fetch_view(const shared_ptr<Datum>& datum) {
+  DatumView* view = boost::get_deleter<DatumView>(datum);
+  if (view == nullptr || !parse_view(cursor_.get(), datum.get(), view)) {
+    if (view != nullptr) {
+      view->data = nullptr;
+      view->size = 0UL;
+    }
+    fetch(datum.get());
+  }
+}
+
+static bool parse_view(const db::Cursor* cursor, Datum* datum, DataReader::DatumView* view) {
+  NVTX_RANGE(NVTX_DATA, "DataReader parse");
+  using google::protobuf::internal::WireFormatLite;
+  const uint8_t* begin = static_cast<const uint8_t*>(cursor->data());
+  const int size = static_cast<int>(cursor->size());
+  google::protobuf::io::CodedInputStream input(begin, size);
+  int data_tag_pos = -1, data_pos = -1;
+  uint32_t data_size = 0U;
+  bool encoded = false;
+  for (int pos = input.CurrentPosition(); ; pos = input.CurrentPosition()) {
+    const uint32_t tag = input.ReadTag();
+    if (tag == 0U) {
+      break;
+    }
+    const int field = WireFormatLite::GetTagFieldNumber(tag);
+    const bool delimited = WireFormatLite::GetTagWireType(tag) ==
+        WireFormatLite::WIRETYPE_LENGTH_DELIMITED;
+    if (field == Datum::kChannelsFieldNumber && delimited) {
+      return false;  // Caffe2 TensorProtos
+    }
+    if (field == Datum::kDataFieldNumber && delimited && data_pos < 0) {
+      data_tag_pos = pos;
+      if (!input.ReadVarint32(&data_size)) {
+        return false;
+      }
+      data_pos = input.CurrentPosition();
+      if (!input.Skip(data_size)) {
+        return false;
+      }
+    } else if (field == Datum::kEncodedFieldNumber && !delimited) {
+      uint32_t value;
+      if (!input.ReadVarint32(&value)) {
+        return false;
+      }
+      encoded = value != 0U;
+    } else if (field == Datum::kDataFieldNumber || !WireFormatLite::SkipField(&input, tag)) {
+      return false;  // repeated data field is legal but not worth the trouble
+    }
+  }
+  if (data_pos < 0 || !encoded) {
+    return false;  // raw pixels are consumed from Datum::data
+  }
+  // Serialized messages are concatenable, thus a Datum is the merge of
+  // everything before and after its data field
+  datum->Clear();
+  google::protobuf::io::CodedInputStream head(begin, data_tag_pos);
+  const int tail_pos = data_pos + static_cast<int>(data_size);
+  google::protobuf::io::CodedInputStream tail(begin + tail_pos, size - tail_pos);
+  if (!datum->MergeFromCodedStream(&head) || !datum->MergeFromCodedStream(&tail)) {
+    return false;
+  }
+  view->data = reinterpret_cast<const char*>(begin + data_pos);
+  view->size = data_size;
+  return true;
+}
+
+static void parse_record(db::Cursor* cursor, Datum* datum, C2TensorProtos* protos) {
+  NVTX_RANGE(NVTX_DATA, "DataReader parse");
+  // Buffers are swapped rather than copied or released: both objects are reused
+  if (cursor->parse(protos) && protos->protos_size() >= 2) {
+    C2TensorProto* image_proto = protos->mutable_protos(0);
+    C2TensorProto* label_proto = protos->mutable_protos(1);
     if (image_proto->data_type() == C2TensorProto::STRING) {
       // encoded image string.
       DCHECK_EQ(image_proto->string_data_size(), 1);
-      datum->mutable_data()->assign(image_proto->string_data(0));
+      datum->mutable_data()->swap(*image_proto->mutable_string_data(0));
       datum->set_encoded(true);
     } else if (image_proto->data_type() == C2TensorProto::BYTE) {
       // raw image content.
-      datum->set_allocated_data(image_proto->release_byte_data());
+      datum->mutable_data()->swap(*image_proto->mutable_byte_data());
       datum->set_encoded(false);
       datum->set_channels(image_proto->dims_size() == 3 ? image_proto->dims(2) : 1);
       datum->set_height(image_proto->dims_size() > 1 ? image_proto->dims(0) : 0);
@@ -356,7 +867,7 @@ void DataReader::CursorManager::fetch(Datum* datum) {
     } else {
       LOG(FATAL) << "Unsupported C2 label data type.";
     }
-  } else if (!cursor_->parse(datum)) {
+  } else if (!cursor->parse(datum)) {
     LOG(ERROR) << "Database cursor failed to parse Datum record";
   }
 }
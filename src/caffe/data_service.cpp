@@ -0,0 +1,249 @@
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <boost/thread.hpp>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "caffe/data_service.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layer_factory.hpp"
+
+namespace caffe {
+
+namespace {
+
+const uint32_t REQUEST_MAGIC = 0x52445343U;  // "CSDR"
+const uint32_t BATCH_MAGIC = 0x42445343U;    // "CSDB"
+
+void set_nodelay(int fd) {
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// False when the peer is gone, the data service outlives its clients
+bool send_all(int fd, const void* data, size_t size) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0UL) {
+    const ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool recv_all(int fd, void* data, size_t size) {
+  char* p = static_cast<char*>(data);
+  while (size > 0UL) {
+    const ssize_t n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+}  // namespace
+
+DataServiceWorker::DataServiceWorker(int port)
+    : port_(port), listen_fd_(-1), stop_(false), streams_(new boost::thread_group) {
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(listen_fd_, 0) << "socket() failed: " << std::strerror(errno);
+  int one = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  CHECK_EQ(bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0)
+      << "Failed to bind data service port " << port << ": " << std::strerror(errno);
+  CHECK_EQ(listen(listen_fd_, 64), 0) << "listen() failed: " << std::strerror(errno);
+  if (port_ == 0) {
+    socklen_t len = sizeof(addr);
+    getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+  }
+  LOG(INFO) << "Data service listening on port " << port_;
+}
+
+DataServiceWorker::~DataServiceWorker() {
+  close(listen_fd_);
+  // Streams blocked in sends to slow clients are left to process exit
+}
+
+void DataServiceWorker::Serve() {
+  while (!stop_) {
+    pollfd pfd{listen_fd_, POLLIN, 0};
+    const int ready = poll(&pfd, 1, 500);
+    if (ready <= 0) {
+      CHECK(ready == 0 || errno == EINTR) << "poll() failed: " << std::strerror(errno);
+      continue;
+    }
+    const int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd >= 0) {
+      set_nodelay(fd);
+      streams_->create_thread([fd]() { Stream(fd); });
+    }
+  }
+}
+
+void DataServiceWorker::Stream(int fd) {
+  uint32_t header[4];  // magic, rank, ranks, request size
+  LayerParameter param;
+  string request;
+  if (!recv_all(fd, header, sizeof(header)) || header[0] != REQUEST_MAGIC) {
+    LOG(WARNING) << "Data service: not a data request, connection closed";
+    close(fd);
+    return;
+  }
+  request.resize(header[3]);
+  if (!recv_all(fd, &request[0], request.size()) || !param.ParseFromString(request)) {
+    LOG(WARNING) << "Data service: malformed data request, connection closed";
+    close(fd);
+    return;
+  }
+  const int rank = header[1], ranks = header[2];
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_solver_count(ranks);
+  Caffe::set_root_solver(rank == 0);
+  LOG(INFO) << "Data service: streaming " << param.name() << " (" << param.data_param().source()
+            << ") to rank " << rank << " of " << ranks;
+  shared_ptr<LayerBase> layer = LayerRegistry::CreateLayer(param);
+  layer->set_solver_rank(rank);
+  vector<shared_ptr<Blob>> tops;
+  vector<Blob*> top_vec;
+  const vector<Blob*> bottom_vec;
+  for (int i = 0; i < param.top_size(); ++i) {
+    tops.push_back(Blob::create(param.forward_type(), param.forward_type()));
+    top_vec.push_back(tops.back().get());
+  }
+  layer->SetUp(bottom_vec, top_vec);
+  size_t batches = 0UL;
+  for (bool connected = true; connected; ++batches) {
+    layer->Forward(bottom_vec, top_vec);
+    const uint32_t head[2] = {BATCH_MAGIC, static_cast<uint32_t>(tops.size())};
+    connected = send_all(fd, head, sizeof(head));
+    for (size_t i = 0; connected && i < tops.size(); ++i) {
+      const Blob& top = *tops[i];
+      vector<int32_t> desc;
+      desc.push_back(top.data_type());
+      desc.push_back(top.num_axes());
+      for (int axis : top.shape()) {
+        desc.push_back(axis);
+      }
+      const uint64_t bytes = top.count() * tsize(top.data_type());
+      connected = send_all(fd, desc.data(), desc.size() * sizeof(int32_t)) &&
+          send_all(fd, &bytes, sizeof(bytes)) &&
+          send_all(fd, top.current_data_memory(false), bytes);
+    }
+  }
+  LOG(INFO) << "Data service: rank " << rank << " disconnected after " << batches
+            << " batches";
+  close(fd);
+}
+
+DataServiceClient::DataServiceClient(const string& server, int timeout_sec)
+    : server_(server), fd_(-1) {
+  const size_t colon = server.rfind(':');
+  CHECK(colon != string::npos && colon + 1 < server.size())
+      << "Data service endpoint must be host:port, got '" << server << "'";
+  const string host = server.substr(0, colon);
+  const string service = server.substr(colon + 1);
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout_sec);
+  while (fd_ < 0) {
+    CHECK(std::chrono::steady_clock::now() < deadline)
+        << "Failed to reach data service " << server;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &res) == 0) {
+      for (addrinfo* ai = res; ai != nullptr && fd_ < 0; ai = ai->ai_next) {
+        fd_ = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd_ >= 0 && connect(fd_, ai->ai_addr, ai->ai_addrlen) != 0) {
+          close(fd_);
+          fd_ = -1;
+        }
+      }
+      freeaddrinfo(res);
+    }
+    if (fd_ < 0) {
+      // Worker may not be listening yet
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+  }
+  set_nodelay(fd_);
+}
+
+DataServiceClient::~DataServiceClient() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+void DataServiceClient::Shutdown() {
+  shutdown(fd_, SHUT_RDWR);
+}
+
+void DataServiceClient::Request(const LayerParameter& param, int rank, int ranks) {
+  string request;
+  CHECK(param.SerializeToString(&request));
+  const uint32_t header[4] = {REQUEST_MAGIC, static_cast<uint32_t>(rank),
+      static_cast<uint32_t>(ranks), static_cast<uint32_t>(request.size())};
+  CHECK(send_all(fd_, header, sizeof(header)) && send_all(fd_, request.data(), request.size()))
+      << "Failed to send data request to " << server_ << ": " << std::strerror(errno);
+}
+
+bool DataServiceClient::Receive(const vector<shared_ptr<Blob>>& tops) {
+  uint32_t head[2];
+  if (!recv_all(fd_, head, sizeof(head))) {
+    return false;
+  }
+  CHECK_EQ(head[0], BATCH_MAGIC) << "Data service " << server_ << " stream is corrupted";
+  CHECK_EQ(head[1], tops.size()) << "Data service " << server_ << " sends "
+      << head[1] << " tops";
+  for (const shared_ptr<Blob>& top : tops) {
+    int32_t desc[2];  // type, axes
+    if (!recv_all(fd_, desc, sizeof(desc))) {
+      return false;
+    }
+    CHECK_EQ(desc[0], top->data_type()) << "Data service " << server_ << " sends "
+        << Type_Name(static_cast<Type>(desc[0])) << " data";
+    vector<int> shape(desc[1]);
+    uint64_t bytes = 0UL;
+    if (!recv_all(fd_, shape.data(), shape.size() * sizeof(int32_t)) ||
+        !recv_all(fd_, &bytes, sizeof(bytes))) {
+      return false;
+    }
+    top->Reshape(shape);
+    CHECK_EQ(bytes, top->count() * tsize(top->data_type()));
+    if (!recv_all(fd_, top->current_mutable_data_memory(false), bytes)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace caffe
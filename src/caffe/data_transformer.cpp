@@ -1,10 +1,15 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <turbojpeg.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <string>
 #include <vector>
 
 #include "caffe/data_transformer.hpp"
+#include "caffe/util/philox.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
@@ -18,14 +23,16 @@ bool DataTransformer::image_center_crop_enabled() const {
 }
 
 DataTransformer::DataTransformer(const TransformationParameter& param, Phase phase)
-    : param_(param), phase_(phase),
+    : param_(param), sample_seed_(0UL), keyed_(false), sample_record_(0UL), sample_pass_(0U),
+      sample_draw_(0U), phase_(phase),
       rand_resize_ratio_lower_(param_.rand_resize_ratio_lower()),
       rand_resize_ratio_upper_(param_.rand_resize_ratio_upper()),
       vertical_stretch_lower_(param_.vertical_stretch_lower()),
       vertical_stretch_upper_(param_.vertical_stretch_upper()),
       horizontal_stretch_lower_(param_.horizontal_stretch_lower()),
       horizontal_stretch_upper_(param_.horizontal_stretch_upper()),
-      allow_upscale_(param_.allow_upscale()){
+      allow_upscale_(param_.allow_upscale()),
+      decode_us_(0UL) {
   // check if we want to use mean_file
   if (param_.has_mean_file()) {
     CHECK_EQ(param_.mean_value_size(), 0)
@@ -56,6 +63,23 @@ void DataTransformer::image_random_resize(const cv::Mat& src, cv::Mat& dst) {
   }
   const int img_height = src.rows;
   const int img_width = src.cols;
+  int new_height, new_width;
+  image_random_resize_size(img_width, img_height, &new_width, &new_height);
+
+  if (new_height == img_height && new_width == img_width) {
+    dst = src;
+  } else {
+    cv::resize(
+        src, dst,
+        cv::Size(new_width, new_height),
+        0., 0.,
+        new_height <= img_height && new_width <= img_width ?
+        (int)param_.interpolation_algo_down() : (int)param_.interpolation_algo_up());
+  }
+}
+
+void DataTransformer::image_random_resize_size(int img_width, int img_height,
+    int* new_width_ptr, int* new_height_ptr) {
   int new_size = std::min(img_height, img_width);
 
   int lower_sz = param_.img_rand_resize_lower();
@@ -101,17 +125,189 @@ void DataTransformer::image_random_resize(const cv::Mat& src, cv::Mat& dst) {
       new_width = img_width;
     }
   }
+  *new_height_ptr = new_height;
+  *new_width_ptr = new_width;
+}
 
-  if (new_height == img_height && new_width == img_width) {
-    dst = src;
-  } else {
-    cv::resize(
-        src, dst,
-        cv::Size(new_width, new_height),
-        0., 0.,
-        new_height <= img_height && new_width <= img_width ?
-        (int)param_.interpolation_algo_down() : (int)param_.interpolation_algo_up());
+// Affine color transform of 0..255 BGR values: 3x3 matrix, then offsets
+typedef std::array<float, 12> ColorTwist;
+
+static ColorTwist twist_diagonal(float factor, float offset) {
+  return {factor, 0.F, 0.F, 0.F, factor, 0.F, 0.F, 0.F, factor, offset, offset, offset};
+}
+
+// a applied after b
+static ColorTwist twist_compose(const ColorTwist& a, const ColorTwist& b) {
+  ColorTwist r;
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      r[i * 3 + j] = a[i * 3] * b[j] + a[i * 3 + 1] * b[3 + j] + a[i * 3 + 2] * b[6 + j];
+    }
+    r[9 + i] = a[i * 3] * b[9] + a[i * 3 + 1] * b[10] + a[i * 3 + 2] * b[11] + a[9 + i];
   }
+  return r;
+}
+
+// Blend with the gray value (Rec. 601 luma) by factor
+static ColorTwist twist_saturation(float factor) {
+  const float gray[3] = {0.114F, 0.587F, 0.299F};
+  ColorTwist r = twist_diagonal(factor, 0.F);
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      r[i * 3 + j] += (1.F - factor) * gray[j];
+    }
+  }
+  return r;
+}
+
+// Rotation of the I and Q chroma by angle in YIQ space
+static ColorTwist twist_hue(float angle) {
+  const float to_yiq[9] = {0.114F, 0.587F, 0.299F,
+                           -0.322F, -0.274F, 0.596F,
+                           0.312F, -0.523F, 0.211F};
+  const float from_yiq[9] = {1.F, -1.106F, 1.703F,
+                             1.F, -0.272F, -0.647F,
+                             1.F, 0.956F, 0.621F};
+  const float c = std::cos(angle), s = std::sin(angle);
+  const ColorTwist rotate = {1.F, 0.F, 0.F, 0.F, c, -s, 0.F, s, c, 0.F, 0.F, 0.F};
+  ColorTwist yiq, rgb;
+  std::copy(to_yiq, to_yiq + 9, yiq.begin());
+  std::copy(from_yiq, from_yiq + 9, rgb.begin());
+  std::fill(yiq.begin() + 9, yiq.end(), 0.F);
+  std::fill(rgb.begin() + 9, rgb.end(), 0.F);
+  return twist_compose(rgb, twist_compose(rotate, yiq));
+}
+
+vector<int> DataTransformer::SampleAugment(int rows, int cols, int channels,
+    AugmentSample* sample) {
+  CHECK(channels == 1 || channels == 3) << "GPU augmentation takes gray or color images";
+  CHECK(!param_.has_mean_file()) << "mean_file doesn't fit randomly resized images, "
+      "use mean_value";
+  int new_width = cols, new_height = rows;
+  if (image_random_resize_enabled()) {
+    image_random_resize_size(cols, rows, &new_width, &new_height);
+  }
+  // Crop region in resized image coordinates, the same random numbers as in image_random_crop
+  const int crop_size = param_.crop_size();
+  int roi_y = 0, roi_x = 0, out_h = new_height, out_w = new_width;
+  if (crop_size > 0) {
+    CHECK_GE(new_width, crop_size) << "crop_size must be at least as large as the image width";
+    CHECK_GE(new_height, crop_size) << "crop_size must be at least as large as the image height";
+    if (image_random_crop_enabled()) {
+      roi_y = new_height == crop_size ? 0 : SlotRand(CROP_Y_SLOT) % (new_height - crop_size + 1);
+      roi_x = new_width == crop_size ? 0 : SlotRand(CROP_X_SLOT) % (new_width - crop_size + 1);
+    } else {
+      roi_y = (new_height - crop_size) / 2;
+      roi_x = (new_width - crop_size) / 2;
+    }
+    out_h = out_w = crop_size;
+  }
+  sample->image_rows = rows;
+  sample->image_cols = cols;
+  // Pixel centers at half integers, as cv::INTER_LINEAR
+  sample->dy = static_cast<float>(rows) / new_height;
+  sample->dx = static_cast<float>(cols) / new_width;
+  sample->y0 = (roi_y + 0.5F) * sample->dy - 0.5F;
+  sample->x0 = (roi_x + 0.5F) * sample->dx - 0.5F;
+  sample->mirror = param_.mirror() && SlotRand(MIRROR_SLOT) % 2;
+
+  ColorTwist twist = twist_diagonal(1.F, 0.F);
+  if (phase_ == TRAIN) {
+    auto factor = [this](float amount) {
+      return Rand(std::max(0.F, 1.F - amount), 1.F + amount);
+    };
+    if (param_.brightness() > 0.F) {
+      twist = twist_compose(twist_diagonal(factor(param_.brightness()), 0.F), twist);
+    }
+    if (param_.contrast() > 0.F) {
+      const float c = factor(param_.contrast());
+      twist = twist_compose(twist_diagonal(c, 128.F * (1.F - c)), twist);
+    }
+    if (channels == 3 && param_.saturation() > 0.F) {
+      twist = twist_compose(twist_saturation(factor(param_.saturation())), twist);
+    }
+    if (channels == 3 && param_.hue() > 0.F) {
+      CHECK_LE(param_.hue(), 0.5F) << "hue is up to half a turn";
+      const float turns = Rand(-param_.hue(), param_.hue());
+      twist = twist_compose(twist_hue(turns * 2.F * static_cast<float>(M_PI)), twist);
+    }
+  }
+  std::copy(twist.begin(), twist.end(), sample->twist);
+  return vector<int>{channels, out_h, out_w};
+}
+
+bool DataTransformer::image_fused_decode(const char* content, size_t content_size,
+    int color_mode, cv::Mat& img) {
+  if (content_size < 2UL
+      || static_cast<unsigned char>(content[0]) != 255
+      || static_cast<unsigned char>(content[1]) != 216) {
+    return false;
+  }
+  auto *content_data = reinterpret_cast<unsigned char*>(const_cast<char*>(content));
+  int img_width, img_height, subsamp;
+  tjhandle jpeg_decoder = tjInitDecompress();
+  CHECK_EQ(0, tjDecompressHeader2(jpeg_decoder, content_data, content_size,
+      &img_width, &img_height, &subsamp)) << tjGetErrorStr();
+  const int ch = color_mode < 0 ? 1 : (color_mode > 0 ? 3 : (subsamp == TJSAMP_GRAY ? 1 : 3));
+
+  // 1. Random resize target, the same random numbers as in image_random_resize
+  int new_width = img_width, new_height = img_height;
+  if (image_random_resize_enabled()) {
+    image_random_resize_size(img_width, img_height, &new_width, &new_height);
+  }
+  // 2. The smallest DCT scaled size still not less than the target
+  int dec_width = img_width, dec_height = img_height;
+  int factors_num = 0;
+  const tjscalingfactor* factors = tjGetScalingFactors(&factors_num);
+  for (int i = 0; i < factors_num; ++i) {
+    if (factors[i].num >= factors[i].denom) {
+      continue;
+    }
+    const int w = TJSCALED(img_width, factors[i]);
+    const int h = TJSCALED(img_height, factors[i]);
+    if (w >= new_width && h >= new_height && w * h < dec_width * dec_height) {
+      dec_width = w;
+      dec_height = h;
+    }
+  }
+  cv::Mat decoded(dec_height, dec_width, ch == 3 ? CV_8UC3 : CV_8UC1);
+  CHECK_EQ(0, tjDecompress2(jpeg_decoder, content_data, content_size,
+      decoded.ptr<unsigned char>(), dec_width, 0, dec_height, ch == 3 ? TJPF_BGR : TJPF_GRAY,
+      TJFLAG_FASTDCT | TJFLAG_NOREALLOC)) << tjGetErrorStr();
+  tjDestroy(jpeg_decoder);
+
+  // 3. Crop region in resized image coordinates, the same random numbers as in image_random_crop
+  const int crop_size = param_.crop_size();
+  cv::Rect roi(0, 0, new_width, new_height);
+  if (crop_size > 0 && (image_random_crop_enabled() || image_center_crop_enabled())) {
+    CHECK_GE(new_width, crop_size) << "crop_size must be at least as large as the image width";
+    CHECK_GE(new_height, crop_size) << "crop_size must be at least as large as the image height";
+    if (image_random_crop_enabled()) {
+      roi.y = new_height == crop_size ? 0 : SlotRand(CROP_Y_SLOT) % (new_height - crop_size + 1);
+      roi.x = new_width == crop_size ? 0 : SlotRand(CROP_X_SLOT) % (new_width - crop_size + 1);
+    } else {
+      roi.y = (new_height - crop_size) / 2;
+      roi.x = (new_width - crop_size) / 2;
+    }
+    roi.width = crop_size;
+    roi.height = crop_size;
+  }
+  if (dec_width == new_width && dec_height == new_height) {
+    img = decoded(roi);
+    return true;
+  }
+  // 4. Resize only the part of decoded image which ends up in the crop
+  const float sx = static_cast<float>(dec_width) / new_width;
+  const float sy = static_cast<float>(dec_height) / new_height;
+  cv::Rect dec_roi(static_cast<int>(roi.x * sx), static_cast<int>(roi.y * sy), 0, 0);
+  dec_roi.width = std::min(dec_width - dec_roi.x,
+      std::max(1, static_cast<int>(std::lround(roi.width * sx))));
+  dec_roi.height = std::min(dec_height - dec_roi.y,
+      std::max(1, static_cast<int>(std::lround(roi.height * sy))));
+  cv::resize(decoded(dec_roi), img, roi.size(), 0., 0.,
+      new_height <= img_height && new_width <= img_width ?
+      (int)param_.interpolation_algo_down() : (int)param_.interpolation_algo_up());
+  return true;
 }
 
 bool DataTransformer::image_random_resize_enabled() const {
@@ -137,8 +333,10 @@ void DataTransformer::image_random_crop(int crop_w, int crop_h, cv::Mat& img) {
   if (img_width == crop_w && img_height == crop_h) {
     return;
   }
-  int crop_offset_h = img_height == crop_h ? 0 : Rand(img_height - crop_h + 1);
-  int crop_offset_w = img_width == crop_w ? 0 : Rand(img_width - crop_w + 1);
+  int crop_offset_h = img_height == crop_h ? 0 :
+      SlotRand(CROP_Y_SLOT) % (img_height - crop_h + 1);
+  int crop_offset_w = img_width == crop_w ? 0 :
+      SlotRand(CROP_X_SLOT) % (img_width - crop_w + 1);
   cv::Rect roi(crop_offset_w, crop_offset_h, crop_w, crop_h);
   img = img(roi).clone();
 }
@@ -159,7 +357,7 @@ void DataTransformer::image_center_crop(int crop_w, int crop_h, cv::Mat& img) {
   img = img(roi).clone();
 }
 
-void DataTransformer::apply_mean_scale_mirror(const cv::Mat& src, cv::Mat& dst) {
+bool DataTransformer::prepare_mean(const cv::Mat& src) {
   const float scale = param_.scale();
   const bool has_mean_file = param_.has_mean_file();
   const bool has_mean_values = !mean_values_.empty();
@@ -188,11 +386,17 @@ void DataTransformer::apply_mean_scale_mirror(const cv::Mat& src, cv::Mat& dst)
       }
     }
   }
+  return has_mean_file || has_mean_values;
+}
 
-  const bool do_mirror = param_.mirror() && Rand(2) > 0;
+void DataTransformer::apply_mean_scale_mirror(const cv::Mat& src, cv::Mat& dst) {
+  const float scale = param_.scale();
+  const int ch = src.channels();
+  const bool has_mean = prepare_mean(src);
+  const bool do_mirror = param_.mirror() && SlotRand(MIRROR_SLOT) % 2;
   src.convertTo(tmp_, CVFC<float>(ch), scale);  // scale & convert
   dst = tmp_;
-  if (has_mean_file || has_mean_values) {
+  if (has_mean) {
     cv::subtract(tmp_, mean_mat_, dst, cv::noArray(), CVFC<float>(ch));  // src-mean -> dst
     if (do_mirror) {
       tmp_ = dst;
@@ -208,9 +412,27 @@ void DataTransformer::InitRand() {
   const uint64_t random_seed = param_.random_seed() >= 0 ?
       static_cast<uint64_t>(param_.random_seed()) : Caffe::next_seed();
   rng_.reset(new Caffe::RNG(random_seed));
+  sample_seed_ = random_seed;
+}
+
+void DataTransformer::set_sample(uint64_t record_id, unsigned int pass) const {
+  keyed_ = true;
+  sample_record_ = record_id;
+  sample_pass_ = pass & 0xFFFFU;
+  sample_draw_ = FIRST_FREE_SLOT;
+}
+
+unsigned int DataTransformer::SlotRand(RandSlot slot) const {
+  if (!keyed_) {
+    return Rand();
+  }
+  return philox_uint(sample_seed_, sample_record_, sample_pass_ << 16 | slot);
 }
 
 unsigned int DataTransformer::Rand() const {
+  if (keyed_) {
+    return philox_uint(sample_seed_, sample_record_, sample_pass_ << 16 | sample_draw_++);
+  }
   CHECK(rng_);
   caffe::rng_t *rng = static_cast<caffe::rng_t*>(rng_->generator());
   // this doesn't actually produce a uniform distribution
@@ -250,12 +472,13 @@ void DataTransformer::VariableSizedTransforms(Datum* datum) {
 
 void DataTransformer::Fill3Randoms(unsigned int *rand) const {
   rand[0] = rand[1] = rand[2] = 0;
+  // transform_kernel takes them modulo, as the CPU transform does
   if (param_.mirror()) {
-    rand[0] = Rand() + 1;
+    rand[0] = SlotRand(MIRROR_SLOT);
   }
   if (phase_ == TRAIN && param_.crop_size()) {
-    rand[1] = Rand() + 1;
-    rand[2] = Rand() + 1;
+    rand[1] = SlotRand(CROP_Y_SLOT);
+    rand[2] = SlotRand(CROP_X_SLOT);
   }
 }
 
@@ -22,7 +22,8 @@ void transform_kernel(int N, int C,
                       int has_mean_values,
                       const float *mean,
                       const unsigned int *random_numbers,
-                      bool signed_data) {
+                      bool signed_data,
+                      bool nhwc) {
   const int c = blockIdx.y;
 
   // loop over images
@@ -62,14 +63,16 @@ void transform_kernel(int N, int C,
       in_ptr += c*H*W;
     }
 
-    Dtype *out_ptr = &out[n*C*Hc*Wc + c*Hc*Wc];
+    // NHWC output interleaves the channels, pixel by pixel
+    Dtype *out_ptr = nhwc ? &out[n*C*Hc*Wc + c] : &out[n*C*Hc*Wc + c*Hc*Wc];
+    const int out_step = nhwc ? C : 1;
     Dtype element;
     // loop over pixels using threads
     for (int h = threadIdx.y; h < Hc; h += blockDim.y) {
       for (int w = threadIdx.x; w < Wc; w += blockDim.x) {
         // get the indices for in, out buffers
         int in_idx  = (h_off + h) * W + w_off + w;
-        int out_idx = mirror ? h * Wc + (Wc - 1 - w) : h * Wc + w;
+        int out_idx = (mirror ? h * Wc + (Wc - 1 - w) : h * Wc + w) * out_step;
 
         if (sizeof_element == sizeof(uint8_t)) {
           element = in_ptri[in_idx];
@@ -114,7 +117,8 @@ void transform_kernel<__half>(int N, int C,
     int has_mean_values,
     const float* mean,
     const unsigned int *random_numbers,
-    bool signed_data) {
+    bool signed_data,
+    bool nhwc) {
   const int c = blockIdx.y;
 
   // loop over images
@@ -154,14 +158,16 @@ void transform_kernel<__half>(int N, int C,
       in_ptr += c*H*W;
     }
 
-    __half* out_ptr = &out[n*C*Hc*Wc + c*Hc*Wc];
+    // NHWC output interleaves the channels, pixel by pixel
+    __half* out_ptr = nhwc ? &out[n*C*Hc*Wc + c] : &out[n*C*Hc*Wc + c*Hc*Wc];
+    const int out_step = nhwc ? C : 1;
     float element;
     // loop over pixels using threads
     for (int h = threadIdx.y; h < Hc; h += blockDim.y) {
       for (int w = threadIdx.x; w < Wc; w += blockDim.x) {
         // get the indices for in, out buffers
         int in_idx  = (h_off + h) * W + w_off + w;
-        int out_idx = mirror ? h * Wc + (Wc - 1 - w) : h * Wc + w;
+        int out_idx = (mirror ? h * Wc + (Wc - 1 - w) : h * Wc + w) * out_step;
 
         if (sizeof_element == sizeof(uint8_t)) {
           element = in_ptri[in_idx];
@@ -189,11 +195,30 @@ void transform_kernel<__half>(int N, int C,
 }
 
 
+const float* DataTransformer::mean_values_gpu(int channels) {
+  if (mean_values_gpu_.empty()) {
+    CHECK(mean_values_.size() == 1 || mean_values_.size() == channels)
+        << "Specify either 1 mean_value or as many as channels: "
+        << channels;
+    if (channels > 1 && mean_values_.size() == 1) {
+      // Replicate the mean_value for simplicity
+      for (int c = 1; c < channels; ++c) {
+        mean_values_.push_back(mean_values_[0]);
+      }
+    }
+    mean_values_gpu_.reserve(sizeof(float) * mean_values_.size());
+    caffe_copy(static_cast<int>(mean_values_.size()), &mean_values_.front(),
+        reinterpret_cast<float*>(mean_values_gpu_.data()));
+  }
+  return reinterpret_cast<const float*>(mean_values_gpu_.data());
+}
+
 template <typename Dtype>
 void DataTransformer::TransformGPU(int N, int C, int H, int W,
     size_t sizeof_element,
     const void *in, Dtype *out,
-    const unsigned int *random_numbers, bool signed_data) {
+    const unsigned int *random_numbers, bool signed_data, Packing out_packing) {
+  NVTX_RANGE(NVTX_DATA, "DataTransformer transform GPU");
   const int datum_channels = C;
   const int datum_height = H;
   const int datum_width = W;
@@ -214,21 +239,7 @@ void DataTransformer::TransformGPU(int N, int C, int H, int W,
     mean = data_mean_.gpu_data();
   }
   else if (has_mean_values) {
-    if (mean_values_gpu_.empty()) {
-      CHECK(mean_values_.size() == 1 || mean_values_.size() == datum_channels)
-          << "Specify either 1 mean_value or as many as channels: "
-          << datum_channels;
-      if (datum_channels > 1 && mean_values_.size() == 1) {
-        // Replicate the mean_value for simplicity
-        for (int c = 1; c < datum_channels; ++c) {
-          mean_values_.push_back(mean_values_[0]);
-        }
-      }
-      mean_values_gpu_.reserve(sizeof(float) * mean_values_.size());
-      caffe_copy(static_cast<int>(mean_values_.size()), &mean_values_.front(),
-          reinterpret_cast<float*>(mean_values_gpu_.data()));
-    }
-    mean = reinterpret_cast<float*>(mean_values_gpu_.data());
+    mean = mean_values_gpu(datum_channels);
   }
 
   int height = datum_height;
@@ -256,7 +267,7 @@ void DataTransformer::TransformGPU(int N, int C, int H, int W,
         scale,
         static_cast<int>(has_mean_file),
         static_cast<int>(has_mean_values),
-        mean, random_numbers, signed_data);
+        mean, random_numbers, signed_data, out_packing == NHWC);
   } else {
     transform_kernel<__half>
         <<< grid, block, 0, stream >>> (N, C, H, W,
@@ -269,17 +280,109 @@ void DataTransformer::TransformGPU(int N, int C, int H, int W,
         scale,
         static_cast<int>(has_mean_file),
         static_cast<int>(has_mean_values),
-        mean, random_numbers, signed_data);
+        mean, random_numbers, signed_data, out_packing == NHWC);
   }
   CUDA_POST_KERNEL_CHECK;
   CUDA_CHECK(cudaStreamSynchronize(stream));
 }
 
+__device__ __inline__ void store_augmented(float v, float* out) {
+  *out = v;
+}
+
+__device__ __inline__ void store_augmented(float v, double* out) {
+  *out = v;
+}
+
+__device__ __inline__ void store_augmented(float v, __half* out) {
+  *out = float2half_clip(v);
+}
+
+// Device type written for Dtype
+template <typename Dtype>
+struct AugmentOut {
+  typedef Dtype type;
+};
+
+template <>
+struct AugmentOut<float16> {
+  typedef __half type;
+};
+
+// One thread per output pixel: bilinear sample of every channel, color twist, then mean
+// and scale
+template <typename T>
+__global__ void augment_kernel(int n, int channels, int height, int width,
+    const AugmentSample* samples, const uint8_t* images, const float* mean_values,
+    float scale, bool nhwc, T* out) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const int w = index % width;
+    const int h = (index / width) % height;
+    const int s = index / (width * height);
+    const AugmentSample& sample = samples[s];
+    const int rows = sample.image_rows;
+    const int cols = sample.image_cols;
+    const int x = sample.mirror ? width - 1 - w : w;
+    const float fy = fminf(fmaxf(sample.y0 + h * sample.dy, 0.F), rows - 1);
+    const float fx = fminf(fmaxf(sample.x0 + x * sample.dx, 0.F), cols - 1);
+    const int y0 = static_cast<int>(fy), x0 = static_cast<int>(fx);
+    const int y1 = min(y0 + 1, rows - 1), x1 = min(x0 + 1, cols - 1);
+    const float ay = fy - y0, ax = fx - x0;
+    const uint8_t* image = images + sample.image_offset;
+    float v[3];
+    for (int c = 0; c < channels; ++c) {
+      // Planar images step by 1 along a row, interleaved ones by channels
+      const uint8_t* plane = sample.planar ? image + c * rows * cols : image + c;
+      const int step = sample.planar ? 1 : channels;
+      const float top = (1.F - ax) * plane[(y0 * cols + x0) * step] +
+          ax * plane[(y0 * cols + x1) * step];
+      const float bottom = (1.F - ax) * plane[(y1 * cols + x0) * step] +
+          ax * plane[(y1 * cols + x1) * step];
+      v[c] = (1.F - ay) * top + ay * bottom;
+    }
+    const float* twist = sample.twist;
+    for (int c = 0; c < channels; ++c) {
+      float t = channels == 3 ? twist[c * 3] * v[0] + twist[c * 3 + 1] * v[1] +
+          twist[c * 3 + 2] * v[2] + twist[9 + c] : twist[0] * v[0] + twist[9];
+      t = fminf(fmaxf(t, 0.F), 255.F);
+      if (mean_values != nullptr) {
+        t -= mean_values[c];
+      }
+      const int o = nhwc ? ((s * height + h) * width + w) * channels + c :
+          ((s * channels + c) * height + h) * width + w;
+      store_augmented(t * scale, out + o);
+    }
+  }
+}
+
+template <typename Dtype>
+void DataTransformer::AugmentGPU(int N, int C, int H, int W, const AugmentSample* samples,
+    const uint8_t* images, Dtype* out, Packing out_packing) {
+  NVTX_RANGE(NVTX_DATA, "DataTransformer augment GPU");
+  CHECK(C == 1 || C == 3) << "GPU augmentation takes gray or color images";
+  const float* mean = mean_values_.empty() ? nullptr : mean_values_gpu(C);
+  const int n = N * H * W;
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  augment_kernel<<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n, C, H, W,
+      samples, images, mean, param_.scale(), out_packing == NHWC,
+      reinterpret_cast<typename AugmentOut<Dtype>::type*>(out));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+}
+
 template void DataTransformer::TransformGPU<float>(int, int, int, int,
-    size_t, const void*, float*, const unsigned int*, bool);
+    size_t, const void*, float*, const unsigned int*, bool, Packing);
 template void DataTransformer::TransformGPU<double>(int, int, int, int,
-    size_t, const void*, double*, const unsigned int*, bool);
+    size_t, const void*, double*, const unsigned int*, bool, Packing);
 template void DataTransformer::TransformGPU<float16>(int, int, int, int,
-    size_t, const void*, float16*, const unsigned int*, bool);
+    size_t, const void*, float16*, const unsigned int*, bool, Packing);
+
+template void DataTransformer::AugmentGPU<float>(int, int, int, int,
+    const AugmentSample*, const uint8_t*, float*, Packing);
+template void DataTransformer::AugmentGPU<double>(int, int, int, int,
+    const AugmentSample*, const uint8_t*, double*, Packing);
+template void DataTransformer::AugmentGPU<float16>(int, int, int, int,
+    const AugmentSample*, const uint8_t*, float16*, Packing);
 
 }  // namespace caffe
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "caffe/inference_engine.hpp"
+#include "caffe/model_repository.hpp"
+
+namespace caffe {
+
+InferenceEngine::InferenceEngine(const NetParameter& param, const string& weights_file,
+    int contexts, int device, const vector<int>& batch_sizes, const EngineSharing& sharing)
+    : mode_(Caffe::mode()), device_(device), sharing_(sharing), batch_sizes_(batch_sizes),
+      stop_(false) {
+  CHECK_GT(contexts, 0) << "InferenceEngine needs at least one context";
+#ifndef CPU_ONLY
+  if (mode_ == Caffe::GPU && device_ < 0) {
+    device_ = Caffe::current_device();
+  }
+#endif
+  NetParameter net_param(param);
+  net_param.mutable_state()->set_phase(TEST);
+  if (mode_ == Caffe::GPU) {
+    net_param.set_plan_activation_memory(true);
+  }
+  for (const LayerParameter& layer : net_param.layer()) {
+    CHECK_NE(layer.type(), "Python")
+        << "InferenceEngine can't run Python layer " << layer.name();
+  }
+  std::sort(batch_sizes_.begin(), batch_sizes_.end());
+  batch_sizes_.erase(std::unique(batch_sizes_.begin(), batch_sizes_.end()),
+      batch_sizes_.end());
+  const int groups = std::max<int>(1, batch_sizes_.size());
+  CHECK(batch_sizes_.empty() || batch_sizes_[0] > 0) << "Batch sizes must be positive";
+  nets_.resize(groups * contexts);
+  requests_.resize(groups);
+  // One after another: the first context loads the weights others share
+  for (int g = 0; g < groups; ++g) {
+    NetParameter group_param(net_param);
+    if (!batch_sizes_.empty()) {
+      for (LayerParameter& layer : *group_param.mutable_layer()) {
+        if (layer.type() != "Input") {
+          continue;
+        }
+        for (BlobShape& shape : *layer.mutable_input_param()->mutable_shape()) {
+          CHECK_GT(shape.dim_size(), 0) << "Input layer " << layer.name() << " has no batch";
+          shape.set_dim(0, batch_sizes_[g]);
+        }
+      }
+    }
+    for (int i = 0; i < contexts; ++i) {
+      std::promise<void> ready;
+      std::future<void> initialized = ready.get_future();
+      workers_.emplace_back(&InferenceEngine::WorkerEntry, this, g * contexts + i, g,
+          std::cref(group_param), std::cref(weights_file), &ready);
+      initialized.wait();
+    }
+  }
+  const Net& net = *nets_[0];
+  for (int blob_id : net.input_blob_indices()) {
+    input_names_.push_back(net.blob_names()[blob_id]);
+  }
+  for (int blob_id : net.output_blob_indices()) {
+    output_names_.push_back(net.blob_names()[blob_id]);
+  }
+  LOG(INFO) << "InferenceEngine: " << contexts << " contexts of " << net.name()
+      << " sharing weights" << (batch_sizes_.empty() ? "" : " for each batch size");
+}
+
+InferenceEngine::~InferenceEngine() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void InferenceEngine::Infer(const vector<Blob*>& inputs, const vector<Blob*>& outputs) {
+  std::promise<void> done;
+  std::future<void> finished = done.get_future();
+  InferAsync(inputs, outputs, [&done]() { done.set_value(); });
+  finished.wait();
+}
+
+void InferenceEngine::InferAsync(const vector<Blob*>& inputs, const vector<Blob*>& outputs,
+    const std::function<void()>& done) {
+  CHECK_EQ(inputs.size(), input_names_.size()) << "Wrong number of inputs";
+  CHECK_EQ(outputs.size(), output_names_.size()) << "Wrong number of outputs";
+  // Unlisted batch sizes reshape contexts of the first one
+  int group = 0;
+  if (!batch_sizes_.empty() && !inputs.empty() && inputs[0]->num_axes() > 0) {
+    auto it = std::find(batch_sizes_.begin(), batch_sizes_.end(), inputs[0]->shape(0));
+    if (it != batch_sizes_.end()) {
+      group = it - batch_sizes_.begin();
+    }
+  }
+  Request* request = new Request{inputs, outputs, done};
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    requests_[group].push_back(request);
+  }
+  cv_.notify_all();
+}
+
+void InferenceEngine::WorkerEntry(int context, int group, const NetParameter& param,
+    const string& weights_file, std::promise<void>* ready) {
+  Caffe::set_mode(mode_);
+  EngineSharing::Slot* slot = sharing_.slots.empty() ? nullptr
+      : sharing_.slots[context % sharing_.slots.size()].get();
+#ifndef CPU_ONLY
+  if (mode_ == Caffe::GPU) {
+    CUDA_CHECK(cudaSetDevice(device_));
+    if (slot != nullptr) {
+      GPUMemory::set_thread_workspace(slot->workspace);
+    } else {
+      GPUMemory::own_thread_workspace();
+    }
+  }
+#endif
+  // Layers reserve the workspace while set up
+  std::unique_lock<std::mutex> slot_lock;
+  if (slot != nullptr) {
+    slot_lock = std::unique_lock<std::mutex>(slot->mutex);
+  }
+  // Logs initialization once
+  Caffe::set_root_solver(context == 0);
+  shared_ptr<Net> net = make_shared<Net>(param);
+  if (context == 0) {
+    net->CopyTrainedLayersFrom(weights_file);
+    if (sharing_.weights != nullptr) {
+      sharing_.weights->Deduplicate(*net);
+    }
+  } else {
+    net->ShareTrainedLayersWith(nets_[0].get());
+  }
+  nets_[context] = net;
+  if (slot_lock.owns_lock()) {
+    slot_lock.unlock();
+  }
+  ready->set_value();
+
+  std::deque<Request*>& requests = requests_[group];
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this, &requests] { return stop_ || !requests.empty(); });
+    if (requests.empty()) {
+      break;
+    }
+    Request* request = requests.front();
+    requests.pop_front();
+    lock.unlock();
+    if (slot != nullptr) {
+      slot_lock = std::unique_lock<std::mutex>(slot->mutex);
+    }
+    Run(net.get(), *request);
+    if (slot_lock.owns_lock()) {
+      slot_lock.unlock();
+    }
+    request->done();
+    delete request;
+    lock.lock();
+  }
+  lock.unlock();
+  // Released by the thread owning its handles, shared weights stay with the others
+  if (slot != nullptr) {
+    slot_lock = std::unique_lock<std::mutex>(slot->mutex);
+  }
+  net.reset();
+  nets_[context].reset();
+}
+
+void InferenceEngine::Run(Net* net, const Request& request) const {
+  bool reshape = false;
+  for (int i = 0; i < request.inputs.size(); ++i) {
+    const Blob& source = *request.inputs[i];
+    Blob* input = net->input_blobs()[i];
+    reshape = reshape || input->shape() != source.shape();
+    input->CopyDataFrom(source, true);
+  }
+  if (reshape) {
+    net->Reshape();
+  }
+  const vector<Blob*>& results = net->Forward();
+  for (int i = 0; i < results.size(); ++i) {
+    request.outputs[i]->CopyDataFrom(*results[i], true);
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "caffe/int8_calibrator.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/quantization.hpp"
+
+namespace caffe {
+
+constexpr int Int8Calibrator::BINS;
+
+Int8Calibrator::Int8Calibrator(Net* net, const string& method, double percentile)
+    : net_(CHECK_NOTNULL(net)), method_(method), percentile_(percentile) {
+  CHECK_EQ(net_->phase(), TEST) << "Calibration needs a TEST phase net";
+  CHECK(method_ == "kl" || method_ == "percentile") << "Unknown calibration method "
+      << method_;
+  CHECK(percentile_ > 0. && percentile_ <= 1.) << "Percentile must be in (0, 1]";
+  for (int i = 0; i < net_->layers().size(); ++i) {
+    const LayerParameter& param = net_->layers()[i]->layer_param();
+    if ((param.type() == "Convolution" || param.type() == "InnerProduct") &&
+        !param.has_quantization_param()) {
+      layers_.push_back(i);
+    }
+  }
+  max_abs_.assign(layers_.size(), 0.F);
+  hist_.assign(layers_.size(), vector<double>(BINS, 0.));
+}
+
+void Int8Calibrator::Observe(int iterations, bool histogram) {
+  const int layer_count = net_->layers().size();
+  for (int it = 0; it < iterations; ++it) {
+    size_t next = 0UL;
+    for (int i = 0; i < layer_count; ++i) {
+      // Inputs are seen before the layer runs, so in place layers after it don't matter
+      if (next < layers_.size() && layers_[next] == i) {
+        input_.CopyDataFrom(*net_->bottom_vecs()[i][0], true);
+        const float* data = input_.cpu_data();
+        const int count = input_.count();
+        if (histogram) {
+          const float bin_width = max_abs_[next] / BINS;
+          vector<double>& hist = hist_[next];
+          if (bin_width > 0.F) {
+            for (int k = 0; k < count; ++k) {
+              const int bin = static_cast<int>(std::fabs(data[k]) / bin_width);
+              hist[std::min(bin, BINS - 1)] += 1.;
+            }
+          }
+        } else {
+          float& max_abs = max_abs_[next];
+          for (int k = 0; k < count; ++k) {
+            max_abs = std::max(max_abs, std::fabs(data[k]));
+          }
+        }
+        ++next;
+      }
+      net_->ForwardFromTo(i, i);
+    }
+  }
+}
+
+void Int8Calibrator::Calibrate(int iterations) {
+  CHECK_GT(iterations, 0);
+  LOG(INFO) << "Calibrating " << layers_.size() << " layers over " << iterations
+      << " iterations";
+  Observe(iterations, false);
+  // A second pass sees new batches, larger inputs saturate into the last bin
+  Observe(iterations, true);
+  table_.Clear();
+  table_.set_method(method_);
+  for (size_t l = 0; l < layers_.size(); ++l) {
+    const float bin_width = max_abs_[l] / BINS;
+    float threshold = max_abs_[l];
+    if (bin_width > 0.F) {
+      threshold = method_ == "kl" ? kl_divergence_threshold(hist_[l], bin_width) :
+          percentile_threshold(hist_[l], bin_width, percentile_);
+    }
+    QuantizationTable::Entry* entry = table_.add_entry();
+    entry->set_layer(net_->layer_names()[layers_[l]]);
+    entry->set_max_abs(max_abs_[l]);
+    entry->set_input_scale(threshold > 0.F ? threshold / Int8Gemm::LEVELS : 1.F);
+    LOG(INFO) << "    " << entry->layer() << ": max " << max_abs_[l]
+        << ", threshold " << threshold;
+  }
+}
+
+}  // namespace caffe
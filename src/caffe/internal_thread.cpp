@@ -4,6 +4,7 @@
 
 #include "caffe/internal_thread.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_profile.hpp"
 
 namespace caffe {
 
@@ -85,6 +86,8 @@ void InternalThread::entry(int thread_id, int device, Caffe::Brew mode, uint64_t
 #endif
   }
 #endif
+  ThreadProfile profile(thread_name() + " #" + std::to_string(thread_id));
+  profile.attach();
   if (threads_.size() == 1) {
     InternalThreadEntry();
   } else {
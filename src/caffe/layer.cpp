@@ -78,6 +78,27 @@ void LayerBase::Unlock() {
   }
 }
 
+void LayerBase::ReshapeIfChanged(const vector<Blob*>& bottom, const vector<Blob*>& top) {
+  const size_t num = bottom.size() + top.size();
+  auto blob = [&](size_t i) { return i < bottom.size() ? bottom[i] : top[i - bottom.size()]; };
+  if (reshape_invariant() && reshaped_blobs_.size() == num) {
+    bool same = true;
+    for (size_t i = 0; same && i < num; ++i) {
+      same = blob(i) == reshaped_blobs_[i] && blob(i)->shape() == reshaped_shapes_[i];
+    }
+    if (same) {
+      return;
+    }
+  }
+  Reshape(bottom, top);
+  reshaped_blobs_.resize(num);
+  reshaped_shapes_.resize(num);
+  for (size_t i = 0; i < num; ++i) {
+    reshaped_blobs_[i] = blob(i);
+    reshaped_shapes_[i] = blob(i)->shape();
+  }
+}
+
 const Solver* LayerBase::parent_solver() const {
   return parent_net_ == nullptr ? nullptr : parent_net_->parent_solver();
 }
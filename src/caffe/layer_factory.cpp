@@ -7,8 +7,13 @@
 
 #include "caffe/layer.hpp"
 #include "caffe/layer_factory.hpp"
+#include "caffe/layers/auto_engine_layer.hpp"
 #include "caffe/layers/batch_norm_layer.hpp"
 #include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/cpu_conv_layer.hpp"
+#include "caffe/layers/cublaslt_inner_product_layer.hpp"
+#include "caffe/layers/deconv_layer.hpp"
+#include "caffe/layers/inner_product_layer.hpp"
 #include "caffe/layers/lrn_layer.hpp"
 #include "caffe/layers/pooling_layer.hpp"
 #include "caffe/layers/relu_layer.hpp"
@@ -25,6 +30,7 @@
 #ifdef USE_CUDNN
 #include "caffe/layers/cudnn_batch_norm_layer.hpp"
 #include "caffe/layers/cudnn_conv_layer.hpp"
+#include "caffe/layers/cudnn_deconv_layer.hpp"
 #include "caffe/layers/cudnn_lcn_layer.hpp"
 #include "caffe/layers/cudnn_lrn_layer.hpp"
 #include "caffe/layers/cudnn_pooling_layer.hpp"
@@ -33,6 +39,15 @@
 #include "caffe/layers/cudnn_softmax_layer.hpp"
 #include "caffe/layers/cudnn_tanh_layer.hpp"
 #include "caffe/layers/cudnn_dropout_layer.hpp"
+#include "caffe/layers/cudnn_rnn_layer.hpp"
+#endif
+
+#ifdef USE_ONEDNN
+#include "caffe/layers/onednn_batch_norm_layer.hpp"
+#include "caffe/layers/onednn_conv_layer.hpp"
+#include "caffe/layers/onednn_inner_product_layer.hpp"
+#include "caffe/layers/onednn_lrn_layer.hpp"
+#include "caffe/layers/onednn_pooling_layer.hpp"
 #endif
 
 #ifdef WITH_PYTHON_LAYER
@@ -51,6 +66,16 @@ __attribute__((destructor))  void unloadso() {
 
 namespace caffe {
 
+// Whether engine ONEDNN, which DEFAULT picks then, runs the layer: float forward passes
+// in CPU mode of USE_ONEDNN builds. CAFFE otherwise.
+static bool use_onednn(Type ftype) {
+#ifdef USE_ONEDNN
+  return Caffe::mode() == Caffe::CPU && ftype == FLOAT;
+#else
+  return false;
+#endif
+}
+
 // Get convolution layer according to engine.
 shared_ptr<LayerBase> GetConvolutionLayer(const LayerParameter& param,
     Type ftype, Type btype) {
@@ -64,6 +89,14 @@ shared_ptr<LayerBase> GetConvolutionLayer(const LayerParameter& param,
     }
   }
 #endif
+  if (engine == ConvolutionParameter_Engine_AUTO) {
+#ifdef USE_CUDNN
+    if (!use_dilation && Caffe::mode() == Caffe::GPU && !param.has_quantization_param()) {
+      return CreateLayerBase<AutoEngineLayer>(param, ftype, btype);
+    }
+#endif
+    engine = ConvolutionParameter_Engine_DEFAULT;
+  }
   if (engine == ConvolutionParameter_Engine_DEFAULT) {
     engine = ConvolutionParameter_Engine_CAFFE;
 #ifdef USE_CUDNN
@@ -71,9 +104,25 @@ shared_ptr<LayerBase> GetConvolutionLayer(const LayerParameter& param,
       engine = ConvolutionParameter_Engine_CUDNN;
     }
 #endif
+    if (use_onednn(ftype)) {
+      engine = ConvolutionParameter_Engine_ONEDNN;
+    }
+  }
+  if (engine == ConvolutionParameter_Engine_ONEDNN && !use_onednn(ftype)) {
+    engine = ConvolutionParameter_Engine_CAFFE;
+  }
+  // INT8 convolutions are im2col + INT8 GEMM, or oneDNN's
+  if (param.has_quantization_param() && engine != ConvolutionParameter_Engine_ONEDNN) {
+    engine = ConvolutionParameter_Engine_CAFFE;
   }
   if (engine == ConvolutionParameter_Engine_CAFFE) {
     return CreateLayerBase<ConvolutionLayer>(param, ftype, btype);
+  } else if (engine == ConvolutionParameter_Engine_CPU) {
+    return CreateLayerBase<CPUConvolutionLayer>(param, ftype, btype);
+#ifdef USE_ONEDNN
+  } else if (engine == ConvolutionParameter_Engine_ONEDNN) {
+    return CreateLayerBase<OneDNNConvolutionLayer>(param, ftype, btype);
+#endif
 #ifdef USE_CUDNN
   } else if (engine == ConvolutionParameter_Engine_CUDNN) {
     if (use_dilation) {
@@ -89,6 +138,91 @@ shared_ptr<LayerBase> GetConvolutionLayer(const LayerParameter& param,
 
 REGISTER_LAYER_CREATOR(Convolution, GetConvolutionLayer);
 
+// Get deconvolution layer according to engine.
+shared_ptr<LayerBase> GetDeconvolutionLayer(const LayerParameter& param,
+    Type ftype, Type btype) {
+  ConvolutionParameter conv_param = param.convolution_param();
+  ConvolutionParameter_Engine engine = conv_param.engine();
+#ifdef USE_CUDNN
+  bool use_dilation = false;
+  for (int i = 0; i < conv_param.dilation_size(); ++i) {
+    if (conv_param.dilation(i) > 1) {
+      use_dilation = true;
+    }
+  }
+  // The transposed convolution runs our forward pass in its backward type
+  const bool cudnn_ok = !use_dilation && ftype == btype && Caffe::mode() == Caffe::GPU &&
+      !param.has_quantization_param();
+#endif
+  if (engine == ConvolutionParameter_Engine_AUTO) {
+#ifdef USE_CUDNN
+    if (cudnn_ok) {
+      return CreateLayerBase<AutoEngineLayer>(param, ftype, btype);
+    }
+#endif
+    engine = ConvolutionParameter_Engine_DEFAULT;
+  }
+  if (engine == ConvolutionParameter_Engine_DEFAULT || engine == ConvolutionParameter_Engine_CPU ||
+      engine == ConvolutionParameter_Engine_ONEDNN) {
+    engine = ConvolutionParameter_Engine_CAFFE;
+  }
+#ifdef USE_CUDNN
+  if (engine == ConvolutionParameter_Engine_CUDNN && !cudnn_ok) {
+    LOG(INFO) << "Layer " << param.name() << ": cuDNN deconvolution needs undilated unquantized "
+              << "filters and equal types in GPU mode. Using Caffe's own.";
+    engine = ConvolutionParameter_Engine_CAFFE;
+  }
+#endif
+  if (engine == ConvolutionParameter_Engine_CAFFE) {
+    return CreateLayerBase<DeconvolutionLayer>(param, ftype, btype);
+#ifdef USE_CUDNN
+  } else if (engine == ConvolutionParameter_Engine_CUDNN) {
+    return CreateLayerBase<CuDNNDeconvolutionLayer>(param, ftype, btype);
+#endif
+  } else {
+    LOG(FATAL) << "Layer " << param.name() << " has unknown engine.";
+  }
+}
+
+REGISTER_LAYER_CREATOR(Deconvolution, GetDeconvolutionLayer);
+
+// Get inner product layer according to engine.
+shared_ptr<LayerBase> GetInnerProductLayer(const LayerParameter& param,
+    Type ftype, Type btype) {
+  InnerProductParameter_Engine engine = param.inner_product_param().engine();
+  if (engine == InnerProductParameter_Engine_DEFAULT ||
+      engine == InnerProductParameter_Engine_ONEDNN) {
+    engine = use_onednn(ftype) ? InnerProductParameter_Engine_ONEDNN :
+        InnerProductParameter_Engine_CAFFE;
+  }
+  if (engine == InnerProductParameter_Engine_CUBLASLT && (param.has_quantization_param() ||
+      Caffe::mode() != Caffe::GPU)) {
+    engine = InnerProductParameter_Engine_CAFFE;
+  }
+#ifndef CAFFE_CUBLASLT
+  if (engine == InnerProductParameter_Engine_CUBLASLT) {
+    LOG(INFO) << "Layer " << param.name() << ": cuBLASLt needs CUDA 11. "
+              << "Using Caffe's own inner product layer.";
+    engine = InnerProductParameter_Engine_CAFFE;
+  }
+#endif
+  if (engine == InnerProductParameter_Engine_CAFFE) {
+    return CreateLayerBase<InnerProductLayer>(param, ftype, btype);
+#ifdef USE_ONEDNN
+  } else if (engine == InnerProductParameter_Engine_ONEDNN) {
+    return CreateLayerBase<OneDNNInnerProductLayer>(param, ftype, btype);
+#endif
+#ifdef CAFFE_CUBLASLT
+  } else if (engine == InnerProductParameter_Engine_CUBLASLT) {
+    return CreateLayerBase<CuBLASLtInnerProductLayer>(param, ftype, btype);
+#endif
+  } else {
+    LOG(FATAL) << "Layer " << param.name() << " has unknown engine.";
+  }
+}
+
+REGISTER_LAYER_CREATOR(InnerProduct, GetInnerProductLayer);
+
 // Get BN layer according to engine.
 shared_ptr<LayerBase> GetBatchNormLayer(const LayerParameter& param,
     Type ftype, Type btype) {
@@ -98,9 +232,21 @@ shared_ptr<LayerBase> GetBatchNormLayer(const LayerParameter& param,
 #ifdef USE_CUDNN
     engine = BatchNormParameter_Engine_CUDNN;
 #endif
+    if (use_onednn(ftype)) {
+      engine = BatchNormParameter_Engine_ONEDNN;
+    }
+  }
+  const BatchNormParameter& bn_param = param.batch_norm_param();
+  if (bn_param.fused_relu() || bn_param.virtual_batch() != 1 || bn_param.sync_stats() ||
+      (engine == BatchNormParameter_Engine_ONEDNN && !use_onednn(ftype))) {
+    engine = BatchNormParameter_Engine_CAFFE;
   }
   if (engine == BatchNormParameter_Engine_CAFFE) {
     return CreateLayerBase<BatchNormLayer>(param, ftype, btype);
+#ifdef USE_ONEDNN
+  } else if (engine == BatchNormParameter_Engine_ONEDNN) {
+    return CreateLayerBase<OneDNNBatchNormLayer>(param, ftype, btype);
+#endif
 #ifdef USE_CUDNN
   } else if (engine == BatchNormParameter_Engine_CUDNN) {
     return CreateLayerBase<CuDNNBatchNormLayer>(param, ftype, btype);
@@ -116,15 +262,33 @@ REGISTER_LAYER_CREATOR(BatchNorm, GetBatchNormLayer);
 shared_ptr<LayerBase> GetPoolingLayer(const LayerParameter& param,
     Type ftype, Type btype) {
   PoolingParameter_Engine engine = param.pooling_param().engine();
+  if (engine == PoolingParameter_Engine_AUTO) {
+#ifdef USE_CUDNN
+    if (Caffe::mode() == Caffe::GPU && param.top_size() == 1) {
+      return CreateLayerBase<AutoEngineLayer>(param, ftype, btype);
+    }
+#endif
+    engine = PoolingParameter_Engine_DEFAULT;
+  }
   if (engine == PoolingParameter_Engine_DEFAULT) {
     engine = PoolingParameter_Engine_CAFFE;
 #ifdef USE_CUDNN
     if (Caffe::mode() == Caffe::GPU)
       engine = PoolingParameter_Engine_CUDNN;
 #endif
+    if (use_onednn(ftype)) {
+      engine = PoolingParameter_Engine_ONEDNN;
+    }
+  }
+  if (engine == PoolingParameter_Engine_ONEDNN && !use_onednn(ftype)) {
+    engine = PoolingParameter_Engine_CAFFE;
   }
   if (engine == PoolingParameter_Engine_CAFFE) {
     return CreateLayerBase<PoolingLayer>(param, ftype, btype);
+#ifdef USE_ONEDNN
+  } else if (engine == PoolingParameter_Engine_ONEDNN) {
+    return CreateLayerBase<OneDNNPoolingLayer>(param, ftype, btype);
+#endif
 #ifdef USE_CUDNN
   } else if (engine == PoolingParameter_Engine_CUDNN) {
     if (param.top_size() > 1) {
@@ -146,16 +310,35 @@ shared_ptr<LayerBase> GetLRNLayer(const LayerParameter& param,
     Type ftype, Type btype) {
   LRNParameter_Engine engine = param.lrn_param().engine();
 
+  if (engine == LRNParameter_Engine_AUTO) {
+#ifdef USE_CUDNN
+    if (Caffe::mode() == Caffe::GPU && (param.lrn_param().local_size() <= CUDNN_LRN_MAX_N ||
+        param.lrn_param().norm_region() == LRNParameter_NormRegion_WITHIN_CHANNEL)) {
+      return CreateLayerBase<AutoEngineLayer>(param, ftype, btype);
+    }
+#endif
+    engine = LRNParameter_Engine_DEFAULT;
+  }
   if (engine == LRNParameter_Engine_DEFAULT) {
     engine = LRNParameter_Engine_CAFFE;
 #ifdef USE_CUDNN
     if (Caffe::mode() == Caffe::GPU)
       engine = LRNParameter_Engine_CUDNN;
 #endif
+    if (use_onednn(ftype)) {
+      engine = LRNParameter_Engine_ONEDNN;
+    }
+  }
+  if (engine == LRNParameter_Engine_ONEDNN && !use_onednn(ftype)) {
+    engine = LRNParameter_Engine_CAFFE;
   }
 
   if (engine == LRNParameter_Engine_CAFFE) {
     return CreateLayerBase<LRNLayer>(param, ftype, btype);
+#ifdef USE_ONEDNN
+  } else if (engine == LRNParameter_Engine_ONEDNN) {
+    return CreateLayerBase<OneDNNLRNLayer>(param, ftype, btype);
+#endif
 #ifdef USE_CUDNN
   } else if (engine == LRNParameter_Engine_CUDNN) {
     LRNParameter lrn_param = param.lrn_param();
@@ -279,12 +462,8 @@ shared_ptr<LayerBase> GetDropoutLayer(const LayerParameter& param,
   Type ftype, Type btype) {
   DropoutParameter_Engine engine = param.dropout_param().engine();
   if (engine == DropoutParameter_Engine_DEFAULT) {
+    // One fused kernel and a bit per element, less than cuDNN's reserve space
     engine = DropoutParameter_Engine_CAFFE;
-#ifdef USE_CUDNN
-    if (Caffe::mode() == Caffe::GPU) {
-      engine = DropoutParameter_Engine_CUDNN;
-    }
-#endif
   }
   if (engine == DropoutParameter_Engine_CAFFE) {
     return CreateLayerBase<DropoutLayer>(param, ftype, btype);
@@ -300,6 +479,16 @@ shared_ptr<LayerBase> GetDropoutLayer(const LayerParameter& param,
 }
 REGISTER_LAYER_CREATOR(Dropout, GetDropoutLayer);
 
+// RNN layer is cuDNN only, backward reuses the forward reserve space and so its type
+shared_ptr<LayerBase> GetRNNLayer(const LayerParameter& param, Type ftype, Type btype) {
+#ifdef USE_CUDNN
+  return CreateLayerBase<CuDNNRNNLayer>(param, ftype, ftype);
+#else
+  LOG(FATAL) << "Layer " << param.name() << " of type RNN needs cuDNN";
+#endif
+}
+REGISTER_LAYER_CREATOR(RNN, GetRNNLayer);
+
 shared_ptr<LayerBase> GetMemoryDataLayer(const LayerParameter& param, Type ftype, Type btype) {
   LayerParameter lparam(param);
   check_precision_support(ftype, btype, lparam);
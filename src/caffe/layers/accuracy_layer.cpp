@@ -38,7 +38,9 @@ void AccuracyLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom, const vec
     top_shape_per_class[0] = bottom[0]->shape(label_axis_);
     top[1]->Reshape(top_shape_per_class);
     nums_buffer_.Reshape(top_shape_per_class);
+    class_acc_buffer_.Reshape(top_shape_per_class);
   }
+  acc_buffer_.Reshape(vector<int>(1, outer_num_ * inner_num_));
 }
 
 template <typename Ftype, typename Btype>
@@ -46,7 +48,7 @@ void AccuracyLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
     const vector<Blob*>& top) {
   float accuracy = 0.F;
   const Ftype* bottom_data = bottom[0]->cpu_data<Ftype>();
-  const Ftype* bottom_label = bottom[1]->cpu_data<Ftype>();
+  const LabelReader<Ftype> bottom_label(*bottom[1]);
   const int dim = bottom[0]->count() / outer_num_;
   const int num_labels = bottom[0]->shape(label_axis_);
   if (top.size() > 1) {
@@ -57,7 +59,7 @@ void AccuracyLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
   int count = 0;
   for (int i = 0; i < outer_num_; ++i) {
     for (int j = 0; j < inner_num_; ++j) {
-      const int label_value = static_cast<int>(bottom_label[i * inner_num_ + j]);
+      const int label_value = bottom_label[i * inner_num_ + j];
       if (has_ignore_label_ && label_value == ignore_label_) {
         continue;
       }
@@ -102,6 +104,9 @@ void AccuracyLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
   // Accuracy layer should not be used as a loss function.
 }
 
+#ifdef CPU_ONLY
+STUB_GPU_FORWARD(AccuracyLayer, Forward);
+#endif
 
 INSTANTIATE_CLASS_FB(AccuracyLayer);
 REGISTER_LAYER_CLASS(Accuracy);
@@ -0,0 +1,134 @@
+#include <vector>
+#include <device_launch_parameters.h>
+
+#include "caffe/layers/accuracy_layer.hpp"
+#include "caffe/util/gpu_math_functions.cuh"
+#include "caffe/util/multi_tensor_apply.cuh"
+
+namespace caffe {
+
+#define ACCURACY_REDUCE_THREADS 256
+
+// One thread per prediction: the label is within top k if fewer than k classes rank
+// above it. Ties rank the larger class first, as the CPU partial sort does. Labels L are
+// of the data type T or INT, see DataParameter::label_type.
+template <typename T, typename L>
+__global__ void AccuracyForwardGPU(const int nthreads, const T* bottom_data, const L* label,
+    const int dim, const int inner_num, const int num_labels, const int top_k,
+    const bool has_ignore_label, const int ignore_label, float* acc, float* counts,
+    float* class_acc, float* class_nums) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int n = index / inner_num;
+    const int s = index % inner_num;
+    const int label_value = static_cast<int>(mt_load<float, L>(label[index]));
+    if (has_ignore_label && label_value == ignore_label) {
+      acc[index] = 0.F;
+      counts[index] = 0.F;
+      continue;
+    }
+    const T* data = bottom_data + n * dim + s;
+    const float label_score = mt_load<float, T>(data[label_value * inner_num]);
+    int above = 0;
+    for (int k = 0; k < num_labels && above < top_k; ++k) {
+      const float score = mt_load<float, T>(data[k * inner_num]);
+      if (score > label_score || (score == label_score && k > label_value)) {
+        ++above;
+      }
+    }
+    const bool correct = above < top_k;
+    acc[index] = correct ? 1.F : 0.F;
+    counts[index] = 1.F;
+    if (class_nums != nullptr) {
+      atomicAdd(class_nums + label_value, 1.F);
+      if (correct) {
+        atomicAdd(class_acc + label_value, 1.F);
+      }
+    }
+  }
+}
+
+// Single block: top[0] = sum(acc) / sum(counts)
+template <typename T>
+__global__ void AccuracyReduceGPU(const int n, const float* acc, const float* counts,
+    T* top) {
+  __shared__ float acc_sum[ACCURACY_REDUCE_THREADS];
+  __shared__ float count_sum[ACCURACY_REDUCE_THREADS];
+  float a = 0.F, c = 0.F;
+  for (int i = threadIdx.x; i < n; i += blockDim.x) {
+    a += acc[i];
+    c += counts[i];
+  }
+  acc_sum[threadIdx.x] = a;
+  count_sum[threadIdx.x] = c;
+  __syncthreads();
+  for (int stride = blockDim.x / 2; stride > 0; stride /= 2) {
+    if (threadIdx.x < stride) {
+      acc_sum[threadIdx.x] += acc_sum[threadIdx.x + stride];
+      count_sum[threadIdx.x] += count_sum[threadIdx.x + stride];
+    }
+    __syncthreads();
+  }
+  if (threadIdx.x == 0) {
+    top[0] = mt_store<T, float>(acc_sum[0] / count_sum[0]);
+  }
+}
+
+template <typename T>
+__global__ void AccuracyPerClassGPU(const int num_labels, const float* class_acc,
+    const float* class_nums, T* top) {
+  CUDA_KERNEL_LOOP(index, num_labels) {
+    const float num = class_nums[index];
+    top[index] = mt_store<T, float>(num == 0.F ? 0.F : class_acc[index] / num);
+  }
+}
+
+template <typename Ftype, typename Btype>
+void AccuracyLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  typedef typename MultiTensorType<Ftype>::type T;
+  const T* bottom_data = reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>());
+  const int dim = bottom[0]->count() / outer_num_;
+  const int num_labels = bottom[0]->shape(label_axis_);
+  const int nthreads = outer_num_ * inner_num_;
+  const bool per_class = top.size() > 1;
+  cudaStream_t stream = Caffe::thread_stream();
+  float* class_acc = nullptr;
+  float* class_nums = nullptr;
+  if (per_class) {
+    class_acc = class_acc_buffer_.mutable_gpu_data();
+    class_nums = nums_buffer_.mutable_gpu_data();
+    CUDA_CHECK(cudaMemsetAsync(class_acc, 0, num_labels * sizeof(float), stream));
+    CUDA_CHECK(cudaMemsetAsync(class_nums, 0, num_labels * sizeof(float), stream));
+  }
+  float* acc = acc_buffer_.mutable_gpu_data();
+  float* counts = acc_buffer_.mutable_gpu_diff();
+  if (bottom[1]->data_type() == INT) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    AccuracyForwardGPU<<<CAFFE_GET_BLOCKS(nthreads), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        nthreads, bottom_data, bottom[1]->gpu_data<int>(), dim, inner_num_, num_labels,
+        top_k_, has_ignore_label_, ignore_label_, acc, counts, class_acc, class_nums);
+  } else {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    AccuracyForwardGPU<<<CAFFE_GET_BLOCKS(nthreads), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        nthreads, bottom_data, reinterpret_cast<const T*>(bottom[1]->gpu_data<Ftype>()), dim,
+        inner_num_, num_labels, top_k_, has_ignore_label_, ignore_label_, acc, counts,
+        class_acc, class_nums);
+  }
+  CUDA_POST_KERNEL_CHECK;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  AccuracyReduceGPU<<<1, ACCURACY_REDUCE_THREADS, 0, stream>>>(nthreads, acc, counts,
+      reinterpret_cast<T*>(top[0]->mutable_gpu_data<Ftype>()));
+  CUDA_POST_KERNEL_CHECK;
+  if (per_class) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    AccuracyPerClassGPU<<<CAFFE_GET_BLOCKS(num_labels), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        num_labels, class_acc, class_nums,
+        reinterpret_cast<T*>(top[1]->mutable_gpu_data<Ftype>()));
+    CUDA_POST_KERNEL_CHECK;
+  }
+  // Accuracy layer should not be used as a loss function.
+}
+
+INSTANTIATE_LAYER_GPU_FORWARD_ONLY_FB(AccuracyLayer);
+
+}  // namespace caffe
@@ -95,6 +95,10 @@ void ArgMaxLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
   }
 }
 
+#ifdef CPU_ONLY
+STUB_GPU_FORWARD(ArgMaxLayer, Forward);
+#endif
+
 INSTANTIATE_CLASS_FB(ArgMaxLayer);
 REGISTER_LAYER_CLASS(ArgMax);
 
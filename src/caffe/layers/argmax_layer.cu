@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <vector>
+
+#include <device_launch_parameters.h>
+
+#include "caffe/layers/argmax_layer.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
+
+namespace caffe {
+
+#define ARGMAX_ROW_THREADS 256
+
+// Order of std::greater on (value, index) pairs, as Forward_cpu sorts: ties go to the
+// larger index
+template <typename A>
+__device__ __forceinline__ bool argmax_before(A v1, int j1, A v2, int j2) {
+  return v1 > v2 || (v1 == v2 && j1 > j2);
+}
+
+template <typename T, typename A>
+__device__ __forceinline__ void argmax_store(int i, int k, A value, int j, int top_k,
+    int axis_dist, bool out_max_val, bool has_axis, T* top) {
+  if (out_max_val && !has_axis) {
+    // Produces max_ind and max_val
+    top[2 * i * top_k + k] = mt_store<T, A>(A(j));
+    top[2 * i * top_k + top_k + k] = mt_store<T, A>(value);
+  } else {
+    // Produces max_val or max_ind per axis
+    top[(i / axis_dist * top_k + k) * axis_dist + i % axis_dist] =
+        mt_store<T, A>(out_max_val ? value : A(j));
+  }
+}
+
+// One thread per row: the k-th pick is the first pair in order after the (k-1)-th
+template <typename T, typename A>
+__global__ void ArgMaxForwardGPU(const int num, const int dim, const int axis_dist,
+    const int top_k, const bool out_max_val, const bool has_axis, const T* bottom, T* top) {
+  CUDA_KERNEL_LOOP(i, num) {
+    const T* x = bottom + i / axis_dist * dim * axis_dist + i % axis_dist;
+    A prev_value = A(0);
+    int prev_j = -1;
+    for (int k = 0; k < top_k; ++k) {
+      A best_value = A(0);
+      int best_j = -1;
+      for (int j = 0; j < dim; ++j) {
+        const A v = mt_load<A, T>(x[j * axis_dist]);
+        if ((prev_j < 0 || argmax_before(prev_value, prev_j, v, j)) &&
+            (best_j < 0 || argmax_before(v, j, best_value, best_j))) {
+          best_value = v;
+          best_j = j;
+        }
+      }
+      argmax_store(i, k, best_value, best_j, top_k, axis_dist, out_max_val, has_axis, top);
+      prev_value = best_value;
+      prev_j = best_j;
+    }
+  }
+}
+
+// One block per row, for long rows
+template <typename T, typename A>
+__global__ void ArgMaxRowForwardGPU(const int num, const int dim, const int axis_dist,
+    const int top_k, const bool out_max_val, const bool has_axis, const T* bottom, T* top) {
+  __shared__ A value_buf[ARGMAX_ROW_THREADS];
+  __shared__ int index_buf[ARGMAX_ROW_THREADS];
+  for (int i = blockIdx.x; i < num; i += gridDim.x) {
+    const T* x = bottom + i / axis_dist * dim * axis_dist + i % axis_dist;
+    A prev_value = A(0);
+    int prev_j = -1;
+    for (int k = 0; k < top_k; ++k) {
+      A best_value = A(0);
+      int best_j = -1;
+      for (int j = threadIdx.x; j < dim; j += blockDim.x) {
+        const A v = mt_load<A, T>(x[j * axis_dist]);
+        if ((prev_j < 0 || argmax_before(prev_value, prev_j, v, j)) &&
+            (best_j < 0 || argmax_before(v, j, best_value, best_j))) {
+          best_value = v;
+          best_j = j;
+        }
+      }
+      value_buf[threadIdx.x] = best_value;
+      index_buf[threadIdx.x] = best_j;
+      __syncthreads();
+      for (int stride = blockDim.x / 2; stride > 0; stride /= 2) {
+        if (threadIdx.x < stride) {
+          const A v = value_buf[threadIdx.x + stride];
+          const int j = index_buf[threadIdx.x + stride];
+          if (j >= 0 && (index_buf[threadIdx.x] < 0 ||
+              argmax_before(v, j, value_buf[threadIdx.x], index_buf[threadIdx.x]))) {
+            value_buf[threadIdx.x] = v;
+            index_buf[threadIdx.x] = j;
+          }
+        }
+        __syncthreads();
+      }
+      prev_value = value_buf[0];
+      prev_j = index_buf[0];
+      if (threadIdx.x == 0) {
+        argmax_store(i, k, prev_value, prev_j, top_k, axis_dist, out_max_val, has_axis, top);
+      }
+      __syncthreads();
+    }
+  }
+}
+
+template <typename Ftype, typename Btype>
+void ArgMaxLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  typedef typename MultiTensorType<Ftype>::type T;
+  typedef typename MultiTensorAcc<Ftype>::type A;
+  int dim, axis_dist;
+  if (has_axis_) {
+    dim = bottom[0]->shape(axis_);
+    // Distance between values of axis in blob
+    axis_dist = bottom[0]->count(axis_) / dim;
+  } else {
+    dim = bottom[0]->count(1);
+    axis_dist = 1;
+  }
+  const int num = bottom[0]->count() / dim;
+  const T* bottom_data = reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>());
+  T* top_data = reinterpret_cast<T*>(top[0]->mutable_gpu_data<Ftype>());
+  cudaStream_t stream = Caffe::thread_stream();
+  // Rows much longer than there are of them don't give a thread per row enough work
+  if (dim >= ARGMAX_ROW_THREADS && num < dim) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    ArgMaxRowForwardGPU<T, A><<<std::min(num, 65535), ARGMAX_ROW_THREADS, 0, stream>>>(
+        num, dim, axis_dist, top_k_, out_max_val_, has_axis_, bottom_data, top_data);
+  } else {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    ArgMaxForwardGPU<T, A><<<CAFFE_GET_BLOCKS(num), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        num, dim, axis_dist, top_k_, out_max_val_, has_axis_, bottom_data, top_data);
+  }
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+INSTANTIATE_LAYER_GPU_FORWARD_ONLY_FB(ArgMaxLayer);
+
+}  // namespace caffe
@@ -0,0 +1,258 @@
+#ifdef USE_CUDNN
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/layer_factory.hpp"
+#include "caffe/layers/auto_engine_layer.hpp"
+#include "caffe/util/cudnn_algo_cache.hpp"
+
+namespace caffe {
+
+static const char* const kEngineNames[] = {"CAFFE", "CUDNN"};
+
+template <typename Ftype, typename Btype>
+AutoEngineLayer<Ftype, Btype>::~AutoEngineLayer() {
+  for (int c = 0; c < CANDIDATES; ++c) {
+    for (cudaEvent_t event : events_[c]) {
+      cudaEventDestroy(event);
+    }
+  }
+}
+
+template <typename Ftype, typename Btype>
+shared_ptr<LayerBase> AutoEngineLayer<Ftype, Btype>::CreateCandidate(int candidate) const {
+  LayerParameter param(this->layer_param_);
+  const std::string& type = param.type();
+  // CAFFE and CUDNN share their values in all Engine enums
+  const int engine = candidate == CAFFE_ENGINE ? 1 : 2;
+  if (type == "Convolution" || type == "Deconvolution") {
+    param.mutable_convolution_param()->set_engine(
+        static_cast<ConvolutionParameter_Engine>(engine));
+  } else if (type == "Pooling") {
+    param.mutable_pooling_param()->set_engine(static_cast<PoolingParameter_Engine>(engine));
+  } else if (type == "LRN") {
+    param.mutable_lrn_param()->set_engine(static_cast<LRNParameter_Engine>(engine));
+  } else {
+    LOG(FATAL) << "Layer '" << this->name() << "': no engine AUTO for type " << type;
+  }
+  shared_ptr<LayerBase> layer = LayerRegistry::Registry()[type](param, tp<Ftype>(), tp<Btype>());
+  layer->fm_by_user(this->is_fm_by_user());
+  layer->bm_by_user(this->is_bm_by_user());
+  layer->set_solver_rank(this->solver_rank_);
+  return layer;
+}
+
+template <typename Ftype, typename Btype>
+std::string AutoEngineLayer<Ftype, Btype>::CacheFile() const {
+  const LayerParameter& param = this->layer_param_;
+  if (param.engine_cache_file().empty() && param.has_convolution_param()) {
+    return param.convolution_param().cudnn_algo_cache_file();
+  }
+  return param.engine_cache_file();
+}
+
+template <typename Ftype, typename Btype>
+std::string AutoEngineLayer<Ftype, Btype>::CacheKey(const vector<Blob*>& bottom) const {
+  // Geometry is what's left of the parameter without names, blobs and fillers
+  LayerParameter geometry(this->layer_param_);
+  geometry.clear_name();
+  geometry.clear_bottom();
+  geometry.clear_top();
+  geometry.clear_blobs();
+  geometry.clear_param();
+  geometry.clear_include();
+  geometry.clear_exclude();
+  geometry.clear_loss_weight();
+  geometry.clear_engine_cache_file();
+  if (geometry.has_convolution_param()) {
+    ConvolutionParameter* conv_param = geometry.mutable_convolution_param();
+    conv_param->clear_weight_filler();
+    conv_param->clear_bias_filler();
+    conv_param->clear_cudnn_algo_cache_file();
+  }
+  std::ostringstream os;
+  os << "engine," << Caffe::device_name(Caffe::current_device())
+     << ",cudnn " << Caffe::cudnn_version()
+     << "," << Type_Name(tp<Ftype>()) << " " << Type_Name(tp<Btype>());
+  for (const Blob* blob : bottom) {
+    os << "," << blob->shape_string();
+  }
+  os << "," << geometry.ShortDebugString();
+  return os.str();
+}
+
+template <typename Ftype, typename Btype>
+void AutoEngineLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  cache_key_ = CacheKey(bottom);
+  const std::string file = CacheFile();
+  CuDNNAlgoCache::Entry entry;  // fwd_algo holds the candidate picked
+  if (!file.empty() && CuDNNAlgoCache::Lookup(file, cache_key_, &entry) &&
+      (entry.fwd_algo == CAFFE_ENGINE || entry.fwd_algo == CUDNN_ENGINE)) {
+    winner_ = entry.fwd_algo;
+    candidates_[winner_] = CreateCandidate(winner_);
+    candidates_[winner_]->SetUp(bottom, top);
+    this->blobs_ = candidates_[winner_]->blobs();
+    LOG(INFO) << this->print_current_device() << " Layer '" << this->name()
+              << "': engine " << kEngineNames[winner_] << " (cached)";
+    return;
+  }
+  for (int c = 0; c < CANDIDATES; ++c) {
+    candidates_[c] = CreateCandidate(c);
+    candidates_[c]->SetUp(bottom, top);
+  }
+  // Both update the same weights
+  vector<shared_ptr<Blob>>& caffe_blobs = candidates_[CAFFE_ENGINE]->blobs();
+  vector<shared_ptr<Blob>>& cudnn_blobs = candidates_[CUDNN_ENGINE]->blobs();
+  CHECK_EQ(caffe_blobs.size(), cudnn_blobs.size()) << "Layer '" << this->name() << "'";
+  for (int i = 0; i < caffe_blobs.size(); ++i) {
+    CHECK(caffe_blobs[i]->shape() == cudnn_blobs[i]->shape())
+        << "Layer '" << this->name() << "': engines disagree on blob " << i;
+    cudnn_blobs[i] = caffe_blobs[i];
+  }
+  this->blobs_ = caffe_blobs;
+}
+
+template <typename Ftype, typename Btype>
+void AutoEngineLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  candidates_[next()]->ReshapeIfChanged(bottom, top);
+}
+
+template <typename Ftype, typename Btype>
+bool AutoEngineLayer<Ftype, Btype>::can_overwrite_param_diffs() const {
+  if (winner_ >= 0) {
+    return candidates_[winner_]->can_overwrite_param_diffs();
+  }
+  return candidates_[CAFFE_ENGINE]->can_overwrite_param_diffs() &&
+      candidates_[CUDNN_ENGINE]->can_overwrite_param_diffs();
+}
+
+template <typename Ftype, typename Btype>
+size_t AutoEngineLayer<Ftype, Btype>::workspace_bytes() const {
+  size_t bytes = 0UL;
+  for (int c = 0; c < CANDIDATES; ++c) {
+    if (candidates_[c]) {
+      bytes = std::max(bytes, candidates_[c]->workspace_bytes());
+    }
+  }
+  return bytes;
+}
+
+template <typename Ftype, typename Btype>
+void AutoEngineLayer<Ftype, Btype>::retune_for_shapes() {
+  for (int c = 0; c < CANDIDATES; ++c) {
+    if (candidates_[c]) {
+      candidates_[c]->retune_for_shapes();
+    }
+  }
+}
+
+template <typename Ftype, typename Btype>
+void AutoEngineLayer<Ftype, Btype>::Cost(const vector<Blob*>& bottom,
+    const vector<Blob*>& top, LayerCost* cost) const {
+  candidates_[next()]->Cost(bottom, top, cost);
+}
+
+template <typename Ftype, typename Btype>
+void AutoEngineLayer<Ftype, Btype>::Run(int candidate, bool timed,
+    const std::function<void()>& pass) {
+  if (!timed) {
+    pass();
+    return;
+  }
+  cudaStream_t stream = Caffe::thread_stream();
+  cudaEvent_t start, stop;
+  CUDA_CHECK(cudaEventCreate(&start));
+  CUDA_CHECK(cudaEventCreate(&stop));
+  CUDA_CHECK(cudaEventRecord(start, stream));
+  pass();
+  CUDA_CHECK(cudaEventRecord(stop, stream));
+  events_[candidate].push_back(start);
+  events_[candidate].push_back(stop);
+}
+
+template <typename Ftype, typename Btype>
+void AutoEngineLayer<Ftype, Btype>::Pick(int winner) {
+  winner_ = winner;
+  candidates_[1 - winner].reset();
+  for (int c = 0; c < CANDIDATES; ++c) {
+    for (cudaEvent_t event : events_[c]) {
+      CUDA_CHECK(cudaEventDestroy(event));
+    }
+    events_[c].clear();
+  }
+}
+
+template <typename Ftype, typename Btype>
+void AutoEngineLayer<Ftype, Btype>::Decide() {
+  float ms[CANDIDATES] = {0.F, 0.F};
+  for (int c = 0; c < CANDIDATES; ++c) {
+    CUDA_CHECK(cudaEventSynchronize(events_[c].back()));
+    for (size_t i = 0; i + 1 < events_[c].size(); i += 2) {
+      float elapsed = 0.F;
+      CUDA_CHECK(cudaEventElapsedTime(&elapsed, events_[c][i], events_[c][i + 1]));
+      ms[c] += elapsed;
+    }
+  }
+  const int winner = ms[CUDNN_ENGINE] <= ms[CAFFE_ENGINE] ? CUDNN_ENGINE : CAFFE_ENGINE;
+  LOG(INFO) << this->print_current_device() << " Layer '" << this->name() << "': engine "
+            << kEngineNames[winner] << " picked (CAFFE " << ms[CAFFE_ENGINE] / kTrialPasses
+            << " ms, CUDNN " << ms[CUDNN_ENGINE] / kTrialPasses << " ms per pass)";
+  Pick(winner);
+  const std::string file = CacheFile();
+  if (!file.empty()) {
+    CuDNNAlgoCache::Entry entry;
+    entry.fwd_algo = winner;
+    CuDNNAlgoCache::Insert(file, cache_key_, entry);
+  }
+}
+
+template <typename Ftype, typename Btype>
+void AutoEngineLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  last_ = next();
+  candidates_[last_]->Forward(bottom, top);
+}
+
+template <typename Ftype, typename Btype>
+void AutoEngineLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  if (winner_ < 0 && pass_ >= CANDIDATES * (kTrialPasses + 1)) {
+    Decide();
+  }
+  last_ = next();
+  LayerBase* layer = candidates_[last_].get();
+  layer->set_parent_net(this->parent_net());
+  // The first pass of each candidate is a warm-up
+  Run(last_, winner_ < 0 && pass_ >= CANDIDATES, [&]() { layer->Forward(bottom, top); });
+  if (winner_ < 0) {
+    ++pass_;
+  }
+}
+
+template <typename Ftype, typename Btype>
+void AutoEngineLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
+    const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  Backward_gpu(top, propagate_down, bottom);  // untimed, candidates check the mode
+}
+
+template <typename Ftype, typename Btype>
+void AutoEngineLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
+    const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  LayerBase* layer = candidates_[last_].get();
+  for (int i = 0; i < this->blobs_.size(); ++i) {
+    layer->set_param_propagate_down(i, this->param_propagate_down(i));
+  }
+  layer->set_overwrite_param_diffs(this->overwrite_param_diffs_);
+  // pass_ already counts the forward pass this one follows
+  Run(last_, winner_ < 0 && pass_ > CANDIDATES,
+      [&]() { layer->Backward(top, propagate_down, bottom); });
+}
+
+INSTANTIATE_CLASS_FB(AutoEngineLayer);
+
+}  // namespace caffe
+#endif
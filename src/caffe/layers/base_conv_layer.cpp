@@ -14,6 +14,11 @@ void BaseConvolutionLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
   // Configure the kernel size, padding, stride, and inputs.
   ConvolutionParameter conv_param = this->layer_param_.convolution_param();
   force_nd_im2col_ = conv_param.force_nd_im2col();
+  quantized_ = this->layer_param_.has_quantization_param() && !reverse_dimensions();
+  if (quantized_) {
+    CHECK_EQ(this->phase_, TEST) << "INT8 Convolution layer " << this->name()
+        << " is inference only";
+  }
   channel_axis_ = bottom[0]->CanonicalAxisIndex(conv_param.axis());
   const int first_spatial_axis = channel_axis_ + 1;
   const int num_axes = bottom[0]->num_axes();
@@ -225,6 +230,7 @@ BaseConvolutionLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom, const v
     }
   }
   col_buffer_.Reshape(col_buffer_shape_);
+  col_count_ = col_buffer_.count();
   bottom_dim_ = bottom[0]->count(channel_axis_);
   top_dim_ = top[0]->count(channel_axis_);
   num_kernels_im2col_ = conv_in_channels_ * conv_out_spatial_dim_;
@@ -236,6 +242,42 @@ BaseConvolutionLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom, const v
     bias_multiplier_.Reshape(bias_multiplier_shape);
     bias_multiplier_.set_data(1.F);
   }
+  // Per image: columns, weight gradient and its one in the vector summing them up
+  const size_t image_bytes = ((is_1x1_ ? 0UL : col_count_) + weight_offset_ * group_ + 1UL) *
+      std::max(sizeof(Ftype), sizeof(Btype));
+  const size_t batch_bytes =
+      static_cast<size_t>(this->layer_param_.convolution_param().gemm_batch_mb()) << 20;
+  gemm_batch_ = 0;
+  if (Caffe::mode() == Caffe::GPU && !quantized_ && num_ > 1) {
+    gemm_batch_ = static_cast<int>(std::min<size_t>(num_, batch_bytes / image_bytes));
+    if (gemm_batch_ < 2) {
+      gemm_batch_ = 0;
+    }
+  }
+  gemm_workspace_bytes_ = gemm_batch_ * image_bytes;
+}
+
+template <typename Ftype, typename Btype>
+Int8Gemm& BaseConvolutionLayer<Ftype, Btype>::int8_gemm(int g) {
+  if (int8_gemm_.empty()) {
+    const Ftype* weights = this->blobs_[0]->template cpu_data<Ftype>();
+    const float input_scale = this->layer_param_.quantization_param().input_scale();
+    for (int i = 0; i < group_; ++i) {
+      int8_gemm_.push_back(make_shared<Int8Gemm>());
+      int8_gemm_.back()->SetWeights(conv_out_channels_ / group_, kernel_dim_,
+          weights + weight_offset_ * i, false, input_scale);
+    }
+  }
+  return *int8_gemm_[g];
+}
+
+// Per image and group a conv_out_channels / group x kernel_dim by conv_out_spatial_dim
+// gemm, deconvolution running convolution's backward data pass
+template <typename Ftype, typename Btype>
+void BaseConvolutionLayer<Ftype, Btype>::Cost(const vector<Blob*>& bottom,
+    const vector<Blob*>& top, LayerCost* cost) const {
+  cost->forward_flops = 2. * num_ * conv_out_channels_ * conv_out_spatial_dim_ * kernel_dim_;
+  cost->backward_flops = 2. * cost->forward_flops;
 }
 
 INSTANTIATE_CLASS_FB(BaseConvolutionLayer);
@@ -1,3 +1,4 @@
+#include <chrono>
 #include <map>
 #include "caffe/proto/caffe.pb.h"
 
@@ -8,6 +9,8 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/parallel.hpp"
+#include "caffe/util/nvtx.hpp"
+#include "caffe/util/thread_profile.hpp"
 
 namespace caffe {
 
@@ -41,6 +44,11 @@ bool BasePrefetchingDataLayer<Ftype, Btype>::auto_mode(const LayerParameter& par
   return auto_mode;
 }
 
+template<typename Ftype, typename Btype>
+Type BasePrefetchingDataLayer<Ftype, Btype>::label_type(const LayerParameter& param) {
+  return param.data_param().label_type() == INT ? INT : tp<Ftype>();
+}
+
 template<typename Ftype, typename Btype>
 BaseDataLayer<Ftype, Btype>::BaseDataLayer(const LayerParameter& param, size_t transf_num)
     : Layer<Ftype, Btype>(param), transform_param_(param.transform_param()) {}
@@ -58,10 +66,20 @@ BasePrefetchingDataLayer<Ftype, Btype>::BasePrefetchingDataLayer(const LayerPara
     : BaseDataLayer<Ftype, Btype>(param, threads(param)),
       InternalThread(Caffe::current_device(), this->solver_rank_, threads(param), false),
       auto_mode_(Caffe::mode() == Caffe::GPU && this->phase_ == TRAIN && auto_mode(param)),
+      label_type_(label_type(param)),
       parsers_num_(parser_threads(param)),
       transf_num_(threads(param)),
       queues_num_(transf_num_ * parsers_num_),
-      next_batch_queue_(0UL) {
+      next_batch_queue_(0UL),
+      transf_busy_us_(0UL),
+      wait_us_(0UL),
+      batches_popped_(0UL),
+      echoes_popped_(0UL),
+      total_wait_us_(0UL),
+      total_transf_us_(0UL),
+      batches_loaded_(0UL),
+      samples_loaded_(0UL),
+      sample_seed_(0UL) {
   CHECK_EQ(transf_num_, threads_num());
   // We begin with minimum required
   ResizeQueues();
@@ -79,14 +97,18 @@ void BasePrefetchingDataLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bot
   top_init_ = top;
   BaseDataLayer<Ftype, Btype>::LayerSetUp(bottom, top);
 
-  for (int i = 0; i < transf_num_; ++i) {
-    data_transformers_.emplace_back(
-        make_shared<DataTransformer>(this->transform_param_, this->phase_));
-  }
   const Solver* psolver = this->parent_solver();
   const uint64_t random_seed = (psolver == nullptr ||
       static_cast<uint64_t>(psolver->param().random_seed()) == Caffe::SEED_NOT_SET) ?
           Caffe::next_seed() : static_cast<uint64_t>(psolver->param().random_seed());
+  // Records are augmented alike by any transformer
+  sample_seed_ = this->transform_param_.random_seed() >= 0 ?
+      static_cast<uint64_t>(this->transform_param_.random_seed()) : random_seed;
+  for (int i = 0; i < transf_num_; ++i) {
+    data_transformers_.emplace_back(
+        make_shared<DataTransformer>(this->transform_param_, this->phase_));
+    data_transformers_.back()->set_sample_seed(sample_seed_);
+  }
   StartInternalThread(true, random_seed);
 }
 
@@ -112,26 +134,44 @@ void BasePrefetchingDataLayer<Ftype, Btype>::InternalThreadEntryN(size_t thread_
     while (!must_stop(thread_id)) {
       const size_t qid = this->queue_id(thread_id);
 #ifndef CPU_ONLY
-      shared_ptr<Batch> batch = prefetches_free_[qid]->pop();
+      shared_ptr<Batch> batch = pop_free(qid);
+      const auto start = std::chrono::steady_clock::now();
 
       CHECK_EQ((size_t) -1, batch->id());
-      load_batch(batch.get(), thread_id, qid);
-      if (Caffe::mode() == Caffe::GPU) {
-        if (!use_gpu_transform) {
-          batch->data_->async_gpu_push();
-        }
-        if (this->output_labels_) {
-          batch->label_->async_gpu_push();
+      {
+        ThreadProfile::Scope transform(ThreadProfile::TRANSFORM);
+        load_batch(batch.get(), thread_id, qid);
+        if (Caffe::mode() == Caffe::GPU) {
+          if (!use_gpu_transform) {
+            batch->data_->async_gpu_push();
+          }
+          if (this->output_labels_) {
+            batch->label_->async_gpu_push();
+          }
+          // Copies overlap with transformation of the next batch
+          batch->record_pushed(Caffe::th_stream_aux(Caffe::STREAM_ID_ASYNC_PUSH));
         }
-        CUDA_CHECK(cudaStreamSynchronize(Caffe::th_stream_aux(Caffe::STREAM_ID_ASYNC_PUSH)));
       }
-
-      prefetches_full_[qid]->push(batch);
 #else
-      shared_ptr<Batch> batch = prefetches_free_[qid]->pop();
-      load_batch(batch.get(), thread_id, qid);
-      prefetches_full_[qid]->push(batch);
+      shared_ptr<Batch> batch = pop_free(qid);
+      const auto start = std::chrono::steady_clock::now();
+      {
+        ThreadProfile::Scope transform(ThreadProfile::TRANSFORM);
+        load_batch(batch.get(), thread_id, qid);
+      }
 #endif
+      const uint64_t busy_us = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start).count();
+      transf_busy_us_.fetch_add(busy_us, std::memory_order_relaxed);
+      total_transf_us_.fetch_add(busy_us, std::memory_order_relaxed);
+      batches_loaded_.fetch_add(1UL, std::memory_order_relaxed);
+      samples_loaded_.fetch_add(batch->data_->num_axes() > 0 ? batch->data_->shape(0) : 0,
+          std::memory_order_relaxed);
+      {
+        // Bounded with lock_free_queues
+        ThreadProfile::Scope blocked(ThreadProfile::BLOCKED);
+        prefetches_full_[qid]->push(batch);
+      }
 
       if (iter0) {
         if (this->net_iteration0_flag_ != nullptr) {
@@ -152,17 +192,25 @@ void BasePrefetchingDataLayer<Ftype, Btype>::InternalThreadEntryN(size_t thread_
   }
 }
 
+template<typename Ftype, typename Btype>
+shared_ptr<Batch> BasePrefetchingDataLayer<Ftype, Btype>::pop_free(size_t qid) {
+  ThreadProfile::Scope blocked(ThreadProfile::BLOCKED);
+  return prefetches_free_[qid]->pop();
+}
+
 template<typename Ftype, typename Btype>
 void BasePrefetchingDataLayer<Ftype, Btype>::ResizeQueues() {
   size_t size = prefetches_free_.size();
   if (queues_num_ > size) {
     prefetches_free_.resize(queues_num_);
     prefetches_full_.resize(queues_num_);
+    // One batch per queue pair
+    const size_t ring_capacity = this->layer_param_.data_param().lock_free_queues() ? 1UL : 0UL;
     for (size_t i = size; i < queues_num_; ++i) {
-      shared_ptr<Batch> batch = make_shared<Batch>(tp<Ftype>(), tp<Ftype>());
+      shared_ptr<Batch> batch = make_shared<Batch>(tp<Ftype>(), tp<Ftype>(), label_type_);
       prefetch_.push_back(batch);
-      prefetches_free_[i] = make_shared<BlockingQueue<shared_ptr<Batch>>>();
-      prefetches_full_[i] = make_shared<BlockingQueue<shared_ptr<Batch>>>();
+      prefetches_free_[i] = make_shared<BlockingQueue<shared_ptr<Batch>>>(ring_capacity);
+      prefetches_full_[i] = make_shared<BlockingQueue<shared_ptr<Batch>>>(ring_capacity);
       prefetches_free_[i]->push(batch);
     }
   }
@@ -178,6 +226,7 @@ void BasePrefetchingDataLayer<Ftype, Btype>::ResizeQueues() {
     for (size_t i = size; i < transf_num_; ++i) {
       this->data_transformers_.emplace_back(
           make_shared<DataTransformer>(this->transform_param_, this->phase_));
+      this->data_transformers_.back()->set_sample_seed(sample_seed_);
     }
   }
 }
@@ -221,12 +270,63 @@ void BasePrefetchingDataLayer<Ftype, Btype>::AllocatePrefetch() {
 #endif
 }
 
+template<typename Ftype, typename Btype>
+shared_ptr<Batch> BasePrefetchingDataLayer<Ftype, Btype>::pop_batch() {
+  tune_threads();
+  shared_ptr<Batch> batch;
+  if (!prefetches_full_[next_batch_queue_]->try_pop(&batch)) {
+    NVTX_RANGE(NVTX_WAIT, "Prefetch wait " + this->name());
+    const auto start = std::chrono::steady_clock::now();
+    batch = prefetches_full_[next_batch_queue_]->pop("Data layer prefetch queue empty");
+    const uint64_t wait_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    wait_us_ += wait_us;
+    total_wait_us_ += wait_us;
+  }
+#ifndef CPU_ONLY
+  if (Caffe::mode() == Caffe::GPU) {
+    // Every buffer swapped into the net has its copy done, thus batch's host buffers
+    // are never rewritten while still being copied
+    NVTX_RANGE(NVTX_WAIT, "Prefetch copy wait");
+    batch->wait_pushed();
+  }
+#endif
+  ++batches_popped_;
+  if (batch->echo()) {
+    ++echoes_popped_;
+  }
+  return batch;
+}
+
+template<typename Ftype, typename Btype>
+bool BasePrefetchingDataLayer<Ftype, Btype>::data_pipe_stats(DataPipeStats* stats) const {
+  *stats = DataPipeStats();
+  for (const shared_ptr<DataTransformer>& dt : data_transformers_) {
+    stats->decode_us += dt->decode_us();
+  }
+  const uint64_t busy_us = total_transf_us_.load();
+  stats->transform_us = busy_us > stats->decode_us ? busy_us - stats->decode_us : 0UL;
+  stats->batches = batches_loaded_.load();
+  stats->samples = samples_loaded_.load();
+  stats->unique_samples = stats->samples;
+  stats->transformer_threads = transf_num_;
+  size_t size = 0UL;
+  for (size_t i = 0; i < queues_num_; ++i) {
+    if (prefetches_full_[i]->nonblocking_size(&size)) {
+      stats->batches_queued += size;
+    }
+  }
+  // One batch per queue pair
+  stats->batches_capacity = queues_num_;
+  stats->batch_bytes = prefetch_.empty() ? 0UL : prefetch_[0]->bytes();
+  return true;
+}
+
 template<typename Ftype, typename Btype>
 void BasePrefetchingDataLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
     const vector<Blob*>& top) {
   // Note: this function runs in one thread per object and one object per one Solver thread
-  shared_ptr<Batch> batch = prefetches_full_[next_batch_queue_]->pop(
-      "Data layer prefetch queue empty");
+  shared_ptr<Batch> batch = pop_batch();
   if (top[0]->data_type() == batch->data_->data_type()
       && top[0]->shape() == batch->data_->shape()) {
     top[0]->Swap(*batch->data_);
@@ -234,7 +334,8 @@ void BasePrefetchingDataLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bo
     top[0]->CopyDataFrom(*batch->data_, true);
   }
   if (this->output_labels_) {
-    if (top[1]->data_type() == batch->label_->data_type()
+    // INT labels are swapped in as they are, see DataParameter::label_type
+    if ((top[1]->data_type() == batch->label_->data_type() || label_type_ == INT)
         && top[1]->shape() == batch->label_->shape()) {
       top[1]->Swap(*batch->label_);
     } else {
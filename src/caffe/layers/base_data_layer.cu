@@ -8,8 +8,7 @@ template<typename Ftype, typename Btype>
 void BasePrefetchingDataLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
     const vector<Blob*>& top) {
   // Note: this function runs in one thread per object and one object per one Solver thread
-  shared_ptr<Batch> batch =
-      prefetches_full_[next_batch_queue_]->pop("Data layer prefetch queue empty");
+  shared_ptr<Batch> batch = pop_batch();
   if (batch->data_packing() == this->transform_param_.forward_packing()) {
     top[0]->Swap(*batch->data_);
   } else {
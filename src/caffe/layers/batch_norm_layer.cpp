@@ -1,8 +1,11 @@
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/filler.hpp"
 #include "caffe/layers/batch_norm_layer.hpp"
+#include "caffe/solver.hpp"
+#include "caffe/util/cpu_parallel.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -28,6 +31,18 @@ BatchNormLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom, const vect
   if (param.has_scale_filler() || param.has_bias_filler()) { // implicit set
     scale_bias_ = true;
   }
+  fused_relu_ = param.fused_relu();
+  relu_slope_ = param.relu_negative_slope();
+  if (fused_relu_) {
+    CHECK_GT(relu_slope_, 0.F) << "fused_relu needs a positive relu_negative_slope";
+  }
+  CHECK(!fused_relu_ || param.virtual_batch() == 1)
+      << "virtual_batch isn't supported with fused_relu";
+  sync_stats_ = param.sync_stats();
+  CHECK(!fused_relu_ || !sync_stats_) << "sync_stats isn't supported with fused_relu";
+  micro_batch_ = 0;
+  seen_ = 0.;
+  batch_fraction_ = 1.;
 
   if (this->blobs_.size() > 0) {
     LOG(INFO) << "Skipping parameter initialization";
@@ -117,6 +132,9 @@ BatchNormLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom, const vect
   mean_ = Blob::create<Ftype>(C);
   var_ = Blob::create<Ftype>(C);
   inv_var_ = Blob::create<Ftype>(C);
+  vb_mean_ = Blob::create<Ftype>(C);
+  vb_var_ = Blob::create<Ftype>(C);
+  stats_ = Blob::create<Ftype, Btype>(2 * C);
 
   ones_C_ = Blob::create<Ftype>(C);
   ones_C_->set_data(1.);
@@ -129,8 +147,9 @@ BatchNormLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom, const vect
   temp_C_->set_data(0.);
   temp_NC_ = Blob::create<Ftype>(N*C);
   temp_NC_->set_data(1.);
-  temp_NCHW_= Blob::create<Ftype>(N, C, H, W);
-  x_norm_ = Blob::create<Ftype>(N, C, H, W);
+  // Fused layers keep nothing of the input's size
+  temp_NCHW_ = fused_relu_ ? Blob::create<Ftype>() : Blob::create<Ftype>(N, C, H, W);
+  x_norm_ = fused_relu_ ? Blob::create<Ftype>() : Blob::create<Ftype>(N, C, H, W);
 }
 
 template<typename Ftype, typename Btype>
@@ -148,6 +167,7 @@ void BatchNormLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom, const ve
   var_->Reshape(C);
   inv_var_->Reshape(C);
   temp_C_->Reshape(C);
+  stats_->Reshape(2 * C);
 
   ones_N_->Reshape(N);
   ones_N_->set_data(1.);
@@ -157,13 +177,216 @@ void BatchNormLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom, const ve
   ones_HW_->set_data(1.);
 
   temp_NC_->Reshape(N*C);
-  temp_NCHW_->ReshapeLike(*bottom[0]);
-  x_norm_->ReshapeLike(*bottom[0]);
+  if (!fused_relu_) {
+    temp_NCHW_->ReshapeLike(*bottom[0]);
+    x_norm_->ReshapeLike(*bottom[0]);
+  }
+}
+
+// Scale of fused_relu, kept away from 0 so that it can be inverted
+template <typename Dtype>
+static double invertible_scale(Dtype scale, double eps) {
+  const double s = static_cast<float>(scale);
+  return s < 0. ? std::min(s, -eps) : std::max(s, eps);
+}
+
+template<typename Ftype, typename Btype>
+void BatchNormLayer<Ftype, Btype>::UpdateGlobalStats_cpu() {
+  const int C = channels_;
+  if (iter_ > 1) {
+    caffe_cpu_axpby<Ftype>(C, Ftype(1. - moving_average_fraction_),
+        mean_->template cpu_data<Ftype>(), Ftype(moving_average_fraction_),
+        this->blobs_[0]->template mutable_cpu_data<Ftype>());
+    caffe_cpu_axpby<Ftype>(C, Ftype(1. - moving_average_fraction_),
+        var_->template cpu_data<Ftype>(), Ftype(moving_average_fraction_),
+        this->blobs_[1]->template mutable_cpu_data<Ftype>());
+  } else {
+    caffe_copy<Ftype>(C, mean_->template cpu_data<Ftype>(),
+        this->blobs_[0]->template mutable_cpu_data<Ftype>());
+    caffe_copy<Ftype>(C, var_->template cpu_data<Ftype>(),
+        this->blobs_[1]->template mutable_cpu_data<Ftype>());
+  }
+  iter_++;
+}
+
+template<typename Ftype, typename Btype>
+int BatchNormLayer<Ftype, Btype>::micro_batches() const {
+  const int virtual_batch = this->layer_param_.batch_norm_param().virtual_batch();
+  if (virtual_batch > 0) {
+    return virtual_batch;
+  }
+  const Solver* psolver = this->parent_solver();
+  return psolver == nullptr ? 1 : std::max(1, psolver->param().iter_size());
+}
+
+template<typename Ftype, typename Btype>
+int BatchNormLayer<Ftype, Btype>::sync_solvers() const {
+  const Solver* psolver = this->parent_solver();
+  return sync_stats_ && psolver != nullptr && psolver->callback() != nullptr ?
+      Caffe::solver_count() : 1;
+}
+
+#ifndef CPU_ONLY
+template<typename Ftype, typename Btype>
+void BatchNormLayer<Ftype, Btype>::AllreduceStats_gpu(int count, void* x, Type type) {
+  this->parent_solver()->callback()->allreduce_stats(x, count, type, Caffe::thread_stream());
+}
+#endif
+
+// With a the share of the values seen before and b = 1 - a that of the new ones:
+//   mean = mean_seen + b * delta, var = a * var_seen + b * var_new + a * b * delta^2
+// where delta = mean_new - mean_seen
+template<typename Ftype, typename Btype>
+bool BatchNormLayer<Ftype, Btype>::MergeVirtualBatch_cpu(int M) {
+  const int C = channels_;
+  const Ftype* mean = mean_->template cpu_data<Ftype>();
+  const Ftype* var = var_->template cpu_data<Ftype>();
+  Ftype* vb_mean = vb_mean_->template mutable_cpu_data<Ftype>();
+  Ftype* vb_var = vb_var_->template mutable_cpu_data<Ftype>();
+  Ftype* delta = temp_C_->template mutable_cpu_data<Ftype>();
+  if (micro_batch_ == 0) {
+    seen_ = 0.;
+  }
+  const double a = seen_ / (seen_ + M), b = 1. - a;
+  if (micro_batch_ == 0) {
+    caffe_copy<Ftype>(C, mean, vb_mean);
+    caffe_copy<Ftype>(C, var, vb_var);
+  } else {
+    caffe_sub<Ftype>(C, mean, vb_mean, delta);
+    caffe_axpy<Ftype>(C, Ftype(b), delta, vb_mean);
+    caffe_sqr<Ftype>(C, delta, delta);
+    caffe_cpu_axpby<Ftype>(C, Ftype(b), var, Ftype(a), vb_var);
+    caffe_axpy<Ftype>(C, Ftype(a * b), delta, vb_var);
+  }
+  caffe_sub<Ftype>(C, vb_mean, mean, delta);
+  caffe_copy<Ftype>(C, vb_mean, mean_->template mutable_cpu_data<Ftype>());
+  caffe_copy<Ftype>(C, vb_var, var_->template mutable_cpu_data<Ftype>());
+  seen_ += M;
+  batch_fraction_ = b;
+  micro_batch_ = (micro_batch_ + 1) % micro_batches();
+  return micro_batch_ == 0;
+}
+
+template<typename Ftype, typename Btype>
+void BatchNormLayer<Ftype, Btype>::ForwardFused_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  const int N = bottom[0]->shape(0);
+  const int C = channels_;
+  const int S = bottom[0]->count(0) / (N * C);
+  const bool batch_stats = this->phase_ != TEST;
+  const Ftype* bottom_data = bottom[0]->cpu_data<Ftype>();
+  Ftype* top_data = top[0]->mutable_cpu_data<Ftype>();
+  const Ftype* global_mean = this->blobs_[0]->template cpu_data<Ftype>();
+  const Ftype* global_var  = this->blobs_[1]->template cpu_data<Ftype>();
+  const Ftype* scale = scale_bias_ ? this->blobs_[3]->template cpu_data<Ftype>() : NULL;
+  const Ftype* shift = scale_bias_ ? this->blobs_[4]->template cpu_data<Ftype>() : NULL;
+  Ftype* mean = mean_->template mutable_cpu_data<Ftype>();
+  Ftype* var = var_->template mutable_cpu_data<Ftype>();
+  Ftype* inv_var = inv_var_->template mutable_cpu_data<Ftype>();
+  // Planes of a channel are read before any is written, so top may be bottom
+  CpuParallel::For(C, 1, [&](int begin, int end) {
+    for (int c = begin; c < end; ++c) {
+      double m = static_cast<float>(global_mean[c]), v = static_cast<float>(global_var[c]);
+      if (batch_stats) {
+        double sum = 0., sum_sq = 0.;
+        for (int n = 0; n < N; ++n) {
+          const Ftype* x = bottom_data + (n * C + c) * S;
+          for (int i = 0; i < S; ++i) {
+            sum += static_cast<float>(x[i]);
+          }
+        }
+        m = sum / (N * S);
+        for (int n = 0; n < N; ++n) {
+          const Ftype* x = bottom_data + (n * C + c) * S;
+          for (int i = 0; i < S; ++i) {
+            const double d = static_cast<float>(x[i]) - m;
+            sum_sq += d * d;
+          }
+        }
+        v = sum_sq / (N * S);
+      }
+      const double inv = 1. / std::sqrt(v + eps_);
+      mean[c] = Ftype(m);
+      var[c] = Ftype(v);
+      inv_var[c] = Ftype(inv);
+      const double k = inv * (scale != NULL ? invertible_scale(scale[c], eps_) : 1.);
+      const double b = shift != NULL ? static_cast<float>(shift[c]) : 0.;
+      for (int n = 0; n < N; ++n) {
+        const Ftype* x = bottom_data + (n * C + c) * S;
+        Ftype* y = top_data + (n * C + c) * S;
+        for (int i = 0; i < S; ++i) {
+          const double z = (static_cast<float>(x[i]) - m) * k + b;
+          y[i] = Ftype(z > 0. ? z : z * relu_slope_);
+        }
+      }
+    }
+  });
+  if (batch_stats) {
+    UpdateGlobalStats_cpu();
+  }
+}
+
+template<typename Ftype, typename Btype>
+void BatchNormLayer<Ftype, Btype>::BackwardFused_cpu(const vector<Blob*>& top,
+    const vector<Blob*>& bottom) {
+  const int N = bottom[0]->shape(0);
+  const int C = channels_;
+  const int S = bottom[0]->count(0) / (N * C);
+  const int M = N * S;
+  const Btype* top_data = top[0]->cpu_data<Btype>();
+  const Btype* top_diff = top[0]->cpu_diff<Btype>();
+  const Btype* inv_var = inv_var_->template cpu_data<Btype>();
+  const Btype* scale = scale_bias_ ? this->blobs_[3]->template cpu_data<Btype>() : NULL;
+  const Btype* shift = scale_bias_ ? this->blobs_[4]->template cpu_data<Btype>() : NULL;
+  Btype* scale_diff = scale_bias_ ? this->blobs_[3]->template mutable_cpu_diff<Btype>() : NULL;
+  Btype* shift_diff = scale_bias_ ? this->blobs_[4]->template mutable_cpu_diff<Btype>() : NULL;
+  Btype* bottom_diff = bottom[0]->mutable_cpu_diff<Btype>();
+  const double slope = relu_slope_;
+  CpuParallel::For(C, 1, [&](int begin, int end) {
+    for (int c = begin; c < end; ++c) {
+      const double g = scale != NULL ? invertible_scale(scale[c], eps_) : 1.;
+      const double b = shift != NULL ? static_cast<float>(shift[c]) : 0.;
+      // Z = X_norm * scale + shift before the ReLU, dE/dZ and X_norm from Y
+      auto unfold = [&](int index, double* dz, double* x_norm) {
+        const double y = static_cast<float>(top_data[index]);
+        const double dy = static_cast<float>(top_diff[index]);
+        *dz = y > 0. ? dy : dy * slope;
+        *x_norm = ((y > 0. ? y : y / slope) - b) / g;
+      };
+      double sum_dz = 0., sum_dz_x_norm = 0.;
+      for (int n = 0; n < N; ++n) {
+        for (int i = (n * C + c) * S, e = i + S; i < e; ++i) {
+          double dz, x_norm;
+          unfold(i, &dz, &x_norm);
+          sum_dz += dz;
+          sum_dz_x_norm += dz * x_norm;
+        }
+      }
+      if (scale_bias_) {
+        scale_diff[c] = Btype(sum_dz_x_norm);
+        shift_diff[c] = Btype(sum_dz);
+      }
+      // dE/dX = scale * (dE/dZ - mean(dE/dZ) - mean(dE/dZ .* X_norm) .* X_norm)
+      //     ./ sqrt(var(X) + eps), in place of dE/dY
+      const double k = g * static_cast<float>(inv_var[c]);
+      for (int n = 0; n < N; ++n) {
+        for (int i = (n * C + c) * S, e = i + S; i < e; ++i) {
+          double dz, x_norm;
+          unfold(i, &dz, &x_norm);
+          bottom_diff[i] = Btype(k * (dz - sum_dz / M - x_norm * sum_dz_x_norm / M));
+        }
+      }
+    }
+  });
 }
 
 template<typename Ftype, typename Btype>
 void
 BatchNormLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom, const vector<Blob*>& top) {
+  if (fused_relu_) {
+    ForwardFused_cpu(bottom, top);
+    return;
+  }
   int N = bottom[0]->shape(0);
   int C = channels_;
   int S = bottom[0]->count(0) / (N * C);
@@ -175,22 +398,27 @@ BatchNormLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom, const vec
   const Ftype* global_var  = this->blobs_[1]->template cpu_data<Ftype>();
 
   if (this->phase_ == TEST) {
-    if (bottom[0] != top[0]) {
-      caffe_copy(top_size, bottom_data, top_data);
-    }
-    //  Y = X- EX
-    multicast_cpu<Ftype>(N, C, S, global_mean, temp_NCHW_->template mutable_cpu_data<Ftype>());
-    caffe_axpy<Ftype>(top_size, Ftype(-1.), temp_NCHW_->template mutable_cpu_data<Ftype>(),
-        top_data);
     //  inv_var = (eps + var)^(-0.5)
     caffe_copy<Ftype>(C, global_var, var_->template mutable_cpu_data<Ftype>());
     caffe_add_scalar<Ftype>(C, Ftype(eps_), var_->template mutable_cpu_data<Ftype>());
     caffe_powx<Ftype>(C, var_->template cpu_data<Ftype>(), Ftype(-0.5),
         inv_var_->template mutable_cpu_data<Ftype>());
-      //  X_norm = (X-EX) * inv_var
-    multicast_cpu<Ftype>(N, C, S, inv_var_->template cpu_data<Ftype>(),
-        temp_NCHW_->template mutable_cpu_data<Ftype>());
-    caffe_mul<Ftype>(top_size, top_data, temp_NCHW_->template cpu_data<Ftype>(), top_data);
+    //  Y = (X - EX) * inv_var [* scale + shift], fused over independent (n, c) planes
+    const Ftype* inv_var = inv_var_->template cpu_data<Ftype>();
+    const Ftype* scale = scale_bias_ ? this->blobs_[3]->template cpu_data<Ftype>() : NULL;
+    const Ftype* shift = scale_bias_ ? this->blobs_[4]->template cpu_data<Ftype>() : NULL;
+    CpuParallel::For(N * C, 1, [&](int begin, int end) {
+      for (int plane = begin; plane < end; ++plane) {
+        const int c = plane % C;
+        const Ftype* x = bottom_data + plane * S;
+        Ftype* y = top_data + plane * S;
+        for (int i = 0; i < S; ++i) {
+          const Ftype x_norm = (x[i] - global_mean[c]) * inv_var[c];
+          y[i] = scale_bias_ ? Ftype(x_norm * scale[c] + shift[c]) : x_norm;
+        }
+      }
+    });
+    return;
   } else {
     compute_mean_per_channel_cpu<Ftype>(N, C, S, bottom_data,
         mean_->template mutable_cpu_data<Ftype>());
@@ -207,6 +435,16 @@ BatchNormLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom, const vec
         temp_NCHW_->template mutable_cpu_data<Ftype>());
     compute_mean_per_channel_cpu<Ftype>(N, C, S, temp_NCHW_->template mutable_cpu_data<Ftype>(),
         var_->template mutable_cpu_data<Ftype>());
+    bool update_stats = true;
+    if (micro_batches() > 1) {
+      // Y = X - EX over the virtual batch so far
+      update_stats = MergeVirtualBatch_cpu(N * S);
+      multicast_cpu<Ftype>(N, C, S, temp_C_->template cpu_data<Ftype>(),
+          temp_NCHW_->template mutable_cpu_data<Ftype>());
+      caffe_axpy<Ftype>(top_size, Ftype(-1.), temp_NCHW_->template cpu_data<Ftype>(), top_data);
+    } else {
+      batch_fraction_ = 1.;
+    }
     //  inv_var= ( eps+ variance)^(-0.5)
     caffe_add_scalar<Ftype>(C, Ftype(eps_), var_->template mutable_cpu_data<Ftype>());
     caffe_powx<Ftype>(C, var_->template cpu_data<Ftype>(), Ftype(-0.5),
@@ -220,20 +458,9 @@ BatchNormLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom, const vec
 
     // clip variance
     //  update global mean and variance
-    if (iter_ > 1) {
-      caffe_cpu_axpby<Ftype>(C, Ftype(1. - moving_average_fraction_),
-          mean_->template cpu_data<Ftype>(), Ftype(moving_average_fraction_),
-          this->blobs_[0]->template mutable_cpu_data<Ftype>());
-      caffe_cpu_axpby<Ftype>(C, Ftype(1. - moving_average_fraction_),
-          var_->template cpu_data<Ftype>(), Ftype(moving_average_fraction_),
-          this->blobs_[1]->template mutable_cpu_data<Ftype>());
-    } else {
-      caffe_copy<Ftype>(C, mean_->template cpu_data<Ftype>(),
-          this->blobs_[0]->template mutable_cpu_data<Ftype>());
-      caffe_copy<Ftype>(C, var_->template cpu_data<Ftype>(),
-          this->blobs_[1]->template mutable_cpu_data<Ftype>());
+    if (update_stats) {
+      UpdateGlobalStats_cpu();
     }
-    iter_++;
   }
 
   // -- STAGE 2:  Y = X_norm * scale[c] + shift[c]  -----------------
@@ -254,6 +481,10 @@ BatchNormLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom, const vec
 template<typename Ftype, typename Btype>
 void BatchNormLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
     const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  if (fused_relu_) {
+    BackwardFused_cpu(top, bottom);
+    return;
+  }
   int N = bottom[0]->shape(0);
   int C = channels_;
   int S = bottom[0]->count(0) / (N * C);
@@ -295,6 +526,10 @@ void BatchNormLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
   caffe_mul<Btype>(top_size, top_diff, top_data, temp_NCHW_->template mutable_cpu_diff<Btype>());
   compute_mean_per_channel_cpu<Btype>(N, C, S, temp_NCHW_->template cpu_diff<Btype>(),
       temp_C_->template mutable_cpu_diff<Btype>());
+  // means over the virtual batch so far, to which others add nothing
+  if (batch_fraction_ != 1.) {
+    caffe_scal<Btype>(C, Btype(batch_fraction_), temp_C_->template mutable_cpu_diff<Btype>());
+  }
   multicast_cpu<Btype>(N, C, S, temp_C_->template cpu_diff<Btype>(),
      temp_NCHW_->template mutable_cpu_diff<Btype>());
   // bottom = mean(dE/dY .* Y) .* Y
@@ -302,6 +537,9 @@ void BatchNormLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
   // temp = mean(dE/dY)
   compute_mean_per_channel_cpu<Btype>(N, C, S, top_diff,
       temp_C_->template mutable_cpu_diff<Btype>());
+  if (batch_fraction_ != 1.) {
+    caffe_scal<Btype>(C, Btype(batch_fraction_), temp_C_->template mutable_cpu_diff<Btype>());
+  }
   multicast_cpu<Btype>(N, C, S, temp_C_->template cpu_diff<Btype>(),
      temp_NCHW_->template mutable_cpu_diff<Btype>());
   // bottom = mean(dE/dY) + mean(dE/dY .* Y) .* Y
@@ -314,6 +552,25 @@ void BatchNormLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
   caffe_mul(top_size, bottom_diff, temp_NCHW_->template cpu_data<Btype>(), bottom_diff);
 }
 
+// Normalizing costs a subtraction and a multiplication per element, scale and bias two
+// more, fused ReLU one. Batch statistics add 4 operations and a second pass over
+// the input forward and over the top diff backward.
+template <typename Ftype, typename Btype>
+void BatchNormLayer<Ftype, Btype>::Cost(const vector<Blob*>& bottom,
+    const vector<Blob*>& top, LayerCost* cost) const {
+  const double count = bottom[0]->count();
+  const double extra = (scale_bias_ ? 2. : 0.) + (fused_relu_ ? 1. : 0.);
+  if (use_global_stats_) {
+    cost->forward_flops = (2. + extra) * count;
+    cost->backward_flops = (1. + extra) * count;
+  } else {
+    cost->forward_flops = (6. + extra) * count;
+    cost->backward_flops = (7. + extra) * count;
+    cost->forward_bytes += count * tsize(bottom[0]->data_type());
+    cost->backward_bytes += count * tsize(top[0]->diff_type());
+  }
+}
+
 #ifdef CPU_ONLY
 STUB_GPU(BatchNormLayer);
 #endif
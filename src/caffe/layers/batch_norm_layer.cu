@@ -3,90 +3,375 @@
 
 #include "caffe/layers/batch_norm_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/welford.cuh"
 
 namespace caffe {
 
+#define BN_FUSED_THREADS 256
+
+// Scale of fused_relu, kept away from 0 so that it can be inverted
+template <typename A>
+__device__ __forceinline__ A bn_invertible_scale(A scale, A eps) {
+  return scale < A(0) ? min(scale, -eps) : max(scale, eps);
+}
+
+// One block per channel: statistics (global ones if given) in one read, then
+// Y = ReLU((X - mean) * inv_var * scale + shift). All of a channel is read before
+// it's written, so y may be x.
+template <typename T, typename A>
+__global__ void BatchNormReluForwardGPU(const int N, const int C, const int S, const T* x,
+    const T* global_mean, const T* global_var, const T* scale, const T* shift,
+    const A eps, const A slope, T* mean, T* var, T* inv_var, T* y) {
+  const int M = N * S;
+  for (int c = blockIdx.x; c < C; c += gridDim.x) {
+    A m, v;
+    if (global_mean != NULL) {
+      m = mt_load<A, T>(global_mean[c]);
+      v = mt_load<A, T>(global_var[c]);
+    } else {
+      Welford<A> w;
+      for (int i = threadIdx.x; i < M; i += blockDim.x) {
+        w.add(mt_load<A, T>(x[(i / S * C + c) * S + i % S]));
+      }
+      w = welford_block_reduce<A, BN_FUSED_THREADS>(w);
+      m = w.mean;
+      v = w.var();
+    }
+    const A inv = A(1) / sqrt(v + eps);
+    if (threadIdx.x == 0) {
+      mean[c] = mt_store<T, A>(m);
+      var[c] = mt_store<T, A>(v);
+      inv_var[c] = mt_store<T, A>(inv);
+    }
+    const A k = scale != NULL ? inv * bn_invertible_scale<A>(mt_load<A, T>(scale[c]), eps) :
+        inv;
+    const A b = shift != NULL ? mt_load<A, T>(shift[c]) : A(0);
+    for (int i = threadIdx.x; i < M; i += blockDim.x) {
+      const int index = (i / S * C + c) * S + i % S;
+      const A z = (mt_load<A, T>(x[index]) - m) * k + b;
+      y[index] = mt_store<T, A>(z > A(0) ? z : z * slope);
+    }
+  }
+}
+
+// One block per channel: with Z = X_norm * scale + shift recovered from Y,
+// dE/dX = scale * (dE/dZ - mean(dE/dZ) - mean(dE/dZ .* X_norm) .* X_norm) .* inv_var.
+// dx may be dy.
+template <typename T, typename A>
+__global__ void BatchNormReluBackwardGPU(const int N, const int C, const int S, const T* y,
+    const T* dy, const T* inv_var, const T* scale, const T* shift, const A eps,
+    const A slope, T* scale_diff, T* shift_diff, T* dx) {
+  const int M = N * S;
+  for (int c = blockIdx.x; c < C; c += gridDim.x) {
+    const A g = scale != NULL ? bn_invertible_scale<A>(mt_load<A, T>(scale[c]), eps) : A(1);
+    const A b = shift != NULL ? mt_load<A, T>(shift[c]) : A(0);
+    A sum_dz = A(0), sum_dz_x_norm = A(0);
+    for (int i = threadIdx.x; i < M; i += blockDim.x) {
+      const int index = (i / S * C + c) * S + i % S;
+      const A yv = mt_load<A, T>(y[index]);
+      const A dz = yv > A(0) ? mt_load<A, T>(dy[index]) : mt_load<A, T>(dy[index]) * slope;
+      sum_dz += dz;
+      sum_dz_x_norm += dz * ((yv > A(0) ? yv : yv / slope) - b) / g;
+    }
+    sum_dz = block_sum<A, BN_FUSED_THREADS>(sum_dz);
+    sum_dz_x_norm = block_sum<A, BN_FUSED_THREADS>(sum_dz_x_norm);
+    if (threadIdx.x == 0 && scale_diff != NULL) {
+      scale_diff[c] = mt_store<T, A>(sum_dz_x_norm);
+      shift_diff[c] = mt_store<T, A>(sum_dz);
+    }
+    const A k = g * mt_load<A, T>(inv_var[c]);
+    for (int i = threadIdx.x; i < M; i += blockDim.x) {
+      const int index = (i / S * C + c) * S + i % S;
+      const A yv = mt_load<A, T>(y[index]);
+      const A dz = yv > A(0) ? mt_load<A, T>(dy[index]) : mt_load<A, T>(dy[index]) * slope;
+      const A x_norm = ((yv > A(0) ? yv : yv / slope) - b) / g;
+      dx[index] = mt_store<T, A>(k * (dz - sum_dz / M - x_norm * sum_dz_x_norm / M));
+    }
+  }
+}
+
+// One block per channel: mean and variance of the batch in one read
+template <typename T, typename A>
+__global__ void BatchNormMomentsGPU(const int N, const int C, const int S, const T* x,
+    T* mean, T* var) {
+  const int M = N * S;
+  for (int c = blockIdx.x; c < C; c += gridDim.x) {
+    Welford<A> w;
+    for (int i = threadIdx.x; i < M; i += blockDim.x) {
+      w.add(mt_load<A, T>(x[(i / S * C + c) * S + i % S]));
+    }
+    w = welford_block_reduce<A, BN_FUSED_THREADS>(w);
+    if (threadIdx.x == 0) {
+      mean[c] = mt_store<T, A>(w.mean);
+      var[c] = mt_store<T, A>(w.var());
+    }
+  }
+}
+
+// X_norm = (X - mean) * inv_var, Y = X_norm * scale + shift. x_norm and scale may be
+// NULL, y may be x.
+template <typename T, typename A>
+__global__ void BatchNormNormalizeGPU(const int count, const int C, const int S, const T* x,
+    const T* mean, const T* inv_var, const T* scale, const T* shift, T* x_norm, T* y) {
+  CUDA_KERNEL_LOOP(i, count) {
+    const int c = (i / S) % C;
+    const A xn = (mt_load<A, T>(x[i]) - mt_load<A, T>(mean[c])) * mt_load<A, T>(inv_var[c]);
+    if (x_norm != NULL) {
+      x_norm[i] = mt_store<T, A>(xn);
+    }
+    y[i] = mt_store<T, A>(scale != NULL ?
+        xn * mt_load<A, T>(scale[c]) + mt_load<A, T>(shift[c]) : xn);
+  }
+}
+
+// One block per channel, in one read of dE/dY and X_norm: sum(dE/dY .* X_norm) and
+// sum(dE/dY) to scale_diff and shift_diff unless NULL, and with dE/dZ = dE/dY * scale
+// mean(dE/dZ .* X_norm) and mean(dE/dZ) to means and means + C
+template <typename T, typename A>
+__global__ void BatchNormGradSumsGPU(const int N, const int C, const int S, const T* dy,
+    const T* x_norm, const T* scale, T* scale_diff, T* shift_diff, T* means) {
+  const int M = N * S;
+  for (int c = blockIdx.x; c < C; c += gridDim.x) {
+    A sum_dy = A(0), sum_dy_x_norm = A(0);
+    for (int i = threadIdx.x; i < M; i += blockDim.x) {
+      const int index = (i / S * C + c) * S + i % S;
+      const A d = mt_load<A, T>(dy[index]);
+      sum_dy += d;
+      sum_dy_x_norm += d * mt_load<A, T>(x_norm[index]);
+    }
+    sum_dy = block_sum<A, BN_FUSED_THREADS>(sum_dy);
+    sum_dy_x_norm = block_sum<A, BN_FUSED_THREADS>(sum_dy_x_norm);
+    if (threadIdx.x == 0) {
+      if (scale_diff != NULL) {
+        scale_diff[c] = mt_store<T, A>(sum_dy_x_norm);
+        shift_diff[c] = mt_store<T, A>(sum_dy);
+      }
+      const A g = scale != NULL ? mt_load<A, T>(scale[c]) : A(1);
+      means[c] = mt_store<T, A>(g * sum_dy_x_norm / M);
+      means[C + c] = mt_store<T, A>(g * sum_dy / M);
+    }
+  }
+}
+
+// dE/dX = (dE/dZ - mean(dE/dZ) - mean(dE/dZ .* X_norm) .* X_norm) .* inv_var
+// with dE/dZ = dE/dY * scale. dx may be dy.
+template <typename T, typename A>
+__global__ void BatchNormBackwardGPU(const int count, const int C, const int S, const T* dy,
+    const T* x_norm, const T* scale, const T* means, const T* inv_var, T* dx) {
+  CUDA_KERNEL_LOOP(i, count) {
+    const int c = (i / S) % C;
+    const A dz = scale != NULL ? mt_load<A, T>(dy[i]) * mt_load<A, T>(scale[c]) :
+        mt_load<A, T>(dy[i]);
+    dx[i] = mt_store<T, A>((dz - mt_load<A, T>(means[C + c]) -
+        mt_load<A, T>(x_norm[i]) * mt_load<A, T>(means[c])) * mt_load<A, T>(inv_var[c]));
+  }
+}
+
+template<typename Ftype, typename Btype>
+void BatchNormLayer<Ftype, Btype>::UpdateGlobalStats_gpu() {
+  const int C = channels_;
+  if (iter_ > 1) {
+    caffe_gpu_axpby<Ftype>(C, Ftype(1. - moving_average_fraction_),
+        mean_->template gpu_data<Ftype>(), Ftype(moving_average_fraction_),
+        this->blobs_[0]->template mutable_gpu_data<Ftype>());
+    caffe_gpu_axpby<Ftype>(C, Ftype((1. - moving_average_fraction_)),
+        var_->template gpu_data<Ftype>(), Ftype(moving_average_fraction_),
+        this->blobs_[1]->template mutable_gpu_data<Ftype>());
+  } else {
+    caffe_copy<Ftype>(C, mean_->template gpu_data<Ftype>(),
+        this->blobs_[0]->template mutable_gpu_data<Ftype>());
+    caffe_copy<Ftype>(C, var_->template gpu_data<Ftype>(),
+        this->blobs_[1]->template mutable_gpu_data<Ftype>());
+  }
+  iter_++;
+}
+
+// With ref the global mean and P solvers, sums
+//   (mean - ref) / P and (var + (mean - ref)^2) / P
+// give the mean over every solver, and its variance as E(X - ref)^2 - (EX - ref)^2.
+template<typename Ftype, typename Btype>
+void BatchNormLayer<Ftype, Btype>::SyncStats_gpu() {
+  const int C = channels_;
+  const Ftype* ref = this->blobs_[0]->template gpu_data<Ftype>();
+  Ftype* mean = mean_->template mutable_gpu_data<Ftype>();
+  Ftype* var = var_->template mutable_gpu_data<Ftype>();
+  Ftype* shift = temp_C_->template mutable_gpu_data<Ftype>();
+  Ftype* sums = stats_->template mutable_gpu_data<Ftype>();
+  caffe_gpu_sub<Ftype>(C, mean, ref, sums);
+  caffe_gpu_square<Ftype>(C, sums, sums + C);
+  caffe_gpu_add<Ftype>(C, var, sums + C, sums + C);
+  caffe_gpu_scal<Ftype>(2 * C, Ftype(1. / sync_solvers()), sums);
+  AllreduceStats_gpu(2 * C, sums, tp<Ftype>());
+  caffe_gpu_add<Ftype>(C, ref, sums, shift);
+  caffe_gpu_sub<Ftype>(C, shift, mean, shift);
+  caffe_gpu_add<Ftype>(C, mean, shift, mean);
+  caffe_gpu_square<Ftype>(C, sums, sums);
+  caffe_gpu_sub<Ftype>(C, sums + C, sums, var);
+}
+
+// See MergeVirtualBatch_cpu
+template<typename Ftype, typename Btype>
+bool BatchNormLayer<Ftype, Btype>::MergeVirtualBatch_gpu(int M) {
+  const int C = channels_;
+  const Ftype* mean = mean_->template gpu_data<Ftype>();
+  const Ftype* var = var_->template gpu_data<Ftype>();
+  Ftype* vb_mean = vb_mean_->template mutable_gpu_data<Ftype>();
+  Ftype* vb_var = vb_var_->template mutable_gpu_data<Ftype>();
+  Ftype* delta = temp_C_->template mutable_gpu_data<Ftype>();
+  if (micro_batch_ == 0) {
+    seen_ = 0.;
+  }
+  const double a = seen_ / (seen_ + M), b = 1. - a;
+  if (micro_batch_ == 0) {
+    caffe_copy<Ftype>(C, mean, vb_mean);
+    caffe_copy<Ftype>(C, var, vb_var);
+  } else {
+    caffe_gpu_sub<Ftype>(C, mean, vb_mean, delta);
+    caffe_gpu_axpy<Ftype>(C, Ftype(b), delta, vb_mean);
+    caffe_gpu_square<Ftype>(C, delta, delta);
+    caffe_gpu_axpby<Ftype>(C, Ftype(b), var, Ftype(a), vb_var);
+    caffe_gpu_axpy<Ftype>(C, Ftype(a * b), delta, vb_var);
+  }
+  caffe_gpu_sub<Ftype>(C, vb_mean, mean, delta);
+  caffe_copy<Ftype>(C, vb_mean, mean_->template mutable_gpu_data<Ftype>());
+  caffe_copy<Ftype>(C, vb_var, var_->template mutable_gpu_data<Ftype>());
+  seen_ += M;
+  batch_fraction_ = b;
+  micro_batch_ = (micro_batch_ + 1) % micro_batches();
+  return micro_batch_ == 0;
+}
+
+template<typename Ftype, typename Btype>
+void BatchNormLayer<Ftype, Btype>::ForwardFused_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  typedef typename MultiTensorType<Ftype>::type T;
+  typedef typename MultiTensorAcc<Ftype>::type A;
+  const int N = bottom[0]->shape(0);
+  const int C = channels_;
+  const int S = bottom[0]->count(0) / (N * C);
+  const bool batch_stats = this->phase_ != TEST;
+  const T* x = reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>());
+  T* y = reinterpret_cast<T*>(top[0]->mutable_gpu_data<Ftype>());
+  const T* global_mean = batch_stats ? NULL :
+      reinterpret_cast<const T*>(this->blobs_[0]->template gpu_data<Ftype>());
+  const T* global_var = batch_stats ? NULL :
+      reinterpret_cast<const T*>(this->blobs_[1]->template gpu_data<Ftype>());
+  const T* scale = scale_bias_ ?
+      reinterpret_cast<const T*>(this->blobs_[3]->template gpu_data<Ftype>()) : NULL;
+  const T* shift = scale_bias_ ?
+      reinterpret_cast<const T*>(this->blobs_[4]->template gpu_data<Ftype>()) : NULL;
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  BatchNormReluForwardGPU<T, A><<<std::min(C, 65535), BN_FUSED_THREADS, 0, stream>>>(
+      N, C, S, x, global_mean, global_var, scale, shift, A(eps_), A(relu_slope_),
+      reinterpret_cast<T*>(mean_->template mutable_gpu_data<Ftype>()),
+      reinterpret_cast<T*>(var_->template mutable_gpu_data<Ftype>()),
+      reinterpret_cast<T*>(inv_var_->template mutable_gpu_data<Ftype>()), y);
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+  if (batch_stats) {
+    UpdateGlobalStats_gpu();
+  }
+}
+
+template<typename Ftype, typename Btype>
+void BatchNormLayer<Ftype, Btype>::BackwardFused_gpu(const vector<Blob*>& top,
+    const vector<Blob*>& bottom) {
+  typedef typename MultiTensorType<Btype>::type T;
+  typedef typename MultiTensorAcc<Btype>::type A;
+  const int N = bottom[0]->shape(0);
+  const int C = channels_;
+  const int S = bottom[0]->count(0) / (N * C);
+  const T* y = reinterpret_cast<const T*>(top[0]->gpu_data<Btype>());
+  const T* dy = reinterpret_cast<const T*>(top[0]->gpu_diff<Btype>());
+  const T* inv_var = reinterpret_cast<const T*>(inv_var_->template gpu_data<Btype>());
+  const T* scale = NULL;
+  const T* shift = NULL;
+  T* scale_diff = NULL;
+  T* shift_diff = NULL;
+  if (scale_bias_) {
+    scale = reinterpret_cast<const T*>(this->blobs_[3]->template gpu_data<Btype>());
+    shift = reinterpret_cast<const T*>(this->blobs_[4]->template gpu_data<Btype>());
+    scale_diff = reinterpret_cast<T*>(this->blobs_[3]->template mutable_gpu_diff<Btype>());
+    shift_diff = reinterpret_cast<T*>(this->blobs_[4]->template mutable_gpu_diff<Btype>());
+  }
+  T* dx = reinterpret_cast<T*>(bottom[0]->mutable_gpu_diff<Btype>());
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  BatchNormReluBackwardGPU<T, A><<<std::min(C, 65535), BN_FUSED_THREADS, 0, stream>>>(
+      N, C, S, y, dy, inv_var, scale, shift, A(eps_), A(relu_slope_), scale_diff,
+      shift_diff, dx);
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
 template<typename Ftype, typename Btype>
 void
 BatchNormLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top) {
+  if (fused_relu_) {
+    ForwardFused_gpu(bottom, top);
+    return;
+  }
+  typedef typename MultiTensorType<Ftype>::type T;
+  typedef typename MultiTensorAcc<Ftype>::type A;
   int N = bottom[0]->shape(0);
   int C = channels_;
   int S = bottom[0]->count(0) / (N * C);
   int top_size = top[0]->count();
+  cudaStream_t stream = Caffe::thread_stream();
 
-  const Ftype* bottom_data = bottom[0]->gpu_data<Ftype>();
-  Ftype* top_data = top[0]->mutable_gpu_data<Ftype>();
-  const Ftype* global_mean = this->blobs_[0]->template gpu_data<Ftype>();
-  const Ftype* global_var  = this->blobs_[1]->template gpu_data<Ftype>();
-
-  if (this->phase_ == TEST) {
-    //  Y = X- EX
-    multicast_gpu<Ftype>(N, C, S, global_mean, temp_NCHW_->template mutable_gpu_data<Ftype>());
-    caffe_gpu_sub<Ftype>(top_size, bottom_data, temp_NCHW_->template gpu_data<Ftype>(), top_data);
-    //  inv_var = (eps + var)^(-0.5)
-    caffe_copy<Ftype>(C, global_var, var_->template mutable_gpu_data<Ftype>());
-    caffe_gpu_add_scalar<Ftype>(C, Ftype(eps_), var_->template mutable_gpu_data<Ftype>());
-    caffe_gpu_powx<Ftype>(C, var_->template gpu_data<Ftype>(), Ftype(-0.5F),
-        inv_var_->template mutable_gpu_data<Ftype>());
-    //  X_norm = (X-EX) * inv_var
-    multicast_gpu<Ftype>(N, C, S, inv_var_->template gpu_data<Ftype>(),
-        temp_NCHW_->template mutable_gpu_data<Ftype>());
-    caffe_gpu_mul<Ftype>(top_size, top_data, temp_NCHW_->template gpu_data<Ftype>(), top_data);
-  } else {  // if (this->phase_ == TRAIN)
-    // temp = EX
-    compute_mean_per_channel_gpu<Ftype>(N, C, S, bottom_data,
-        mean_->template mutable_gpu_data<Ftype>());
-    multicast_gpu<Ftype>(N, C, S, mean_->template gpu_data<Ftype>(),
-        temp_NCHW_->template mutable_gpu_data<Ftype>());
-    // Y = X-EX
-    caffe_gpu_sub<Ftype>(top_size, bottom_data, temp_NCHW_->template gpu_data<Ftype>(), top_data);
-    // temp = (X-EX)^2;
-    caffe_gpu_square<Ftype>(top_size, top[0]->gpu_data<Ftype>(),
-        temp_NCHW_->template mutable_gpu_data<Ftype>());
-    compute_mean_per_channel_gpu<Ftype>(N, C, S, temp_NCHW_->template gpu_data<Ftype>(),
-        var_->template mutable_gpu_data<Ftype>());
-
-    caffe_copy<Ftype>(C, var_->template gpu_data<Ftype>(),
-        temp_C_->template mutable_gpu_data<Ftype>());
-    //  temp= 1/sqrt(e + var(c)
-    caffe_gpu_add_scalar<Ftype>(C, Ftype(eps_), temp_C_->template mutable_gpu_data<Ftype>());
-    caffe_gpu_powx<Ftype>(C, temp_C_->template gpu_data<Ftype>(), Ftype(-0.5F),
-        inv_var_->template mutable_gpu_data<Ftype>());
-    multicast_gpu<Ftype>(N, C, S, inv_var_->template gpu_data<Ftype>(),
-        temp_NCHW_->template mutable_gpu_data<Ftype>());
-    // X_norm = (X-mean(c)) / sqrt(e + var(c))
-    caffe_gpu_mul<Ftype>(top_size, top_data, temp_NCHW_->template gpu_data<Ftype>(), top_data);
-    // copy x_norm for backward
-    caffe_copy<Ftype>(top_size, top_data, x_norm_->template mutable_gpu_data<Ftype>());
-
-    //  update global mean and variance
-    if (iter_ > 1) {
-      caffe_gpu_axpby<Ftype>(C, Ftype(1. - moving_average_fraction_),
-          mean_->template gpu_data<Ftype>(), Ftype(moving_average_fraction_),
-          this->blobs_[0]->template mutable_gpu_data<Ftype>());
-      caffe_gpu_axpby<Ftype>(C, Ftype((1. - moving_average_fraction_)),
-          var_->template gpu_data<Ftype>(), Ftype(moving_average_fraction_),
-          this->blobs_[1]->template mutable_gpu_data<Ftype>());
+  const Ftype* mean = this->blobs_[0]->template gpu_data<Ftype>();
+  const Ftype* var = this->blobs_[1]->template gpu_data<Ftype>();
+  T* x_norm = NULL;
+  bool update_stats = false;
+  if (this->phase_ != TEST) {
+    // mean(c), var(c) of the batch in one read
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    BatchNormMomentsGPU<T, A><<<std::min(C, 65535), BN_FUSED_THREADS, 0, stream>>>(N, C, S,
+        reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>()),
+        reinterpret_cast<T*>(mean_->template mutable_gpu_data<Ftype>()),
+        reinterpret_cast<T*>(var_->template mutable_gpu_data<Ftype>()));
+    CUDA_POST_KERNEL_CHECK;
+    const int solvers = sync_solvers();
+    if (solvers > 1) {
+      // over every solver
+      SyncStats_gpu();
+    }
+    update_stats = true;
+    if (micro_batches() > 1) {
+      // over the virtual batch so far
+      update_stats = MergeVirtualBatch_gpu(N * S * solvers);
     } else {
-      caffe_copy<Ftype>(C, mean_->template gpu_data<Ftype>(),
-          this->blobs_[0]->template mutable_gpu_data<Ftype>());
-      caffe_copy<Ftype>(C, var_->template gpu_data<Ftype>(),
-          this->blobs_[1]->template mutable_gpu_data<Ftype>());
+      batch_fraction_ = 1.;
     }
-    iter_++;
+    mean = mean_->template gpu_data<Ftype>();
+    var = var_->template gpu_data<Ftype>();
+    // copy x_norm for backward
+    x_norm = reinterpret_cast<T*>(x_norm_->template mutable_gpu_data<Ftype>());
   }
+  //  inv_var = (eps + var)^(-0.5)
+  caffe_copy<Ftype>(C, var, temp_C_->template mutable_gpu_data<Ftype>());
+  caffe_gpu_add_scalar<Ftype>(C, Ftype(eps_), temp_C_->template mutable_gpu_data<Ftype>());
+  caffe_gpu_powx<Ftype>(C, temp_C_->template gpu_data<Ftype>(), Ftype(-0.5F),
+      inv_var_->template mutable_gpu_data<Ftype>());
 
-  //  -- STAGE 2:  Y = X_norm * scale[c] + shift[c]  -----------------
-  if (scale_bias_) {
-    //  Y = X_norm * scale[c]
-    multicast_gpu<Ftype>(N, C, S, this->blobs_[3]->template gpu_data<Ftype>(),
-        temp_NCHW_->template mutable_gpu_data<Ftype>());
-    caffe_gpu_mul<Ftype>(top_size, top_data, temp_NCHW_->template gpu_data<Ftype>(), top_data);
-    //  Y = Y + shift[c]
-    multicast_gpu<Ftype>(N, C, S, this->blobs_[4]->template gpu_data<Ftype>(),
-        temp_NCHW_->template mutable_gpu_data<Ftype>());
-    caffe_gpu_add<Ftype>(top_size, top_data, temp_NCHW_->template mutable_gpu_data<Ftype>(),
-        top_data);
+  //  X_norm = (X - mean(c)) * inv_var(c), Y = X_norm * scale[c] + shift[c] in one pass
+  const T* scale = scale_bias_ ?
+      reinterpret_cast<const T*>(this->blobs_[3]->template gpu_data<Ftype>()) : NULL;
+  const T* shift = scale_bias_ ?
+      reinterpret_cast<const T*>(this->blobs_[4]->template gpu_data<Ftype>()) : NULL;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  BatchNormNormalizeGPU<T, A><<<CAFFE_GET_BLOCKS(top_size), CAFFE_CUDA_NUM_THREADS, 0,
+      stream>>>(top_size, C, S, reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>()),
+      reinterpret_cast<const T*>(mean),
+      reinterpret_cast<const T*>(inv_var_->template gpu_data<Ftype>()), scale, shift, x_norm,
+      reinterpret_cast<T*>(top[0]->mutable_gpu_data<Ftype>()));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+
+  //  update global mean and variance
+  if (update_stats) {
+    UpdateGlobalStats_gpu();
   }
 }
 
@@ -94,65 +379,52 @@ BatchNormLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom, const vec
 template<typename Ftype, typename Btype>
 void BatchNormLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  if (fused_relu_) {
+    BackwardFused_gpu(top, bottom);
+    return;
+  }
+  typedef typename MultiTensorType<Btype>::type T;
+  typedef typename MultiTensorAcc<Btype>::type A;
   int N = bottom[0]->shape(0);
   int C = channels_;
   int S = bottom[0]->count(0) / (N * C);
   int top_size = top[0]->count();
+  cudaStream_t stream = Caffe::thread_stream();
 
-  const Btype* top_diff = top[0]->gpu_diff<Btype>();
-  //  --  STAGE 1: compute dE/d(scale) and dE/d(shift) ---------------
+  const T* top_diff = reinterpret_cast<const T*>(top[0]->gpu_diff<Btype>());
+  const T* x_norm = reinterpret_cast<const T*>(x_norm_->template gpu_data<Btype>());
+  const T* scale = NULL;
+  T* scale_diff = NULL;
+  T* shift_diff = NULL;
   if (scale_bias_) {
-    //  scale_diff: dE/d(scale)  =  sum(dE/dY .* X_norm)
-    Btype* scale_diff = this->blobs_[3]->template mutable_gpu_diff<Btype>();
-    caffe_gpu_mul<Btype>(top_size, top_diff, x_norm_->template gpu_data<Btype>(),
-       temp_NCHW_->template mutable_gpu_diff<Btype>());
-    compute_sum_per_channel_gpu(N, C, S, temp_NCHW_->template gpu_diff<Btype>(), scale_diff);
-    //  shift_diff: dE/d(shift) = sum (dE/dY)
-    Btype* shift_diff = this->blobs_[4]->template mutable_gpu_diff<Btype>();
-    compute_sum_per_channel_gpu(N, C, S, top_diff, shift_diff);
-
-    // --  STAGE 2: backprop dE/d(x_norm) = dE/dY .* scale ------------
-    //  dE/d(X_norm) = dE/dY * scale[c]
-    const Btype* scale_data = this->blobs_[3]->template gpu_data<Btype>();
-    multicast_gpu<Btype>(N, C, S, scale_data, temp_NCHW_->template mutable_gpu_data<Btype>());
-    caffe_gpu_mul<Btype>(top_size, top_diff, temp_NCHW_->template gpu_data<Btype>(),
-        x_norm_->template mutable_gpu_diff<Btype>());
-
-    top_diff = x_norm_->template gpu_diff<Btype>();
-  }
-  // --  STAGE 3: backprop dE/dY --> dE/dX --------------------------
-
-  // ATTENTION: from now on we will use notation Y:= X_norm
-  const Btype* top_data = x_norm_->template gpu_data<Btype>();
-  Btype* bottom_diff = bottom[0]->mutable_gpu_diff<Btype>();
-
-  //  temp = mean(dE/dY .* Y)
-  caffe_gpu_mul<Btype>(top_size, top_diff, top_data,
-      temp_NCHW_->template mutable_gpu_diff<Btype>());
-  compute_mean_per_channel_gpu<Btype>(N, C, S, temp_NCHW_->template gpu_diff<Btype>(),
-      temp_C_->template mutable_gpu_diff<Btype>());
-  multicast_gpu<Btype>(N, C, S, temp_C_->template gpu_diff<Btype>(),
-      temp_NCHW_->template mutable_gpu_diff<Btype>());
-
-  // bottom = mean(dE/dY .* Y) .* Y
-  caffe_gpu_mul<Btype>(top_size, temp_NCHW_->template gpu_diff<Btype>(), top_data, bottom_diff);
-
-  // temp = mean(dE/dY)
-  compute_mean_per_channel_gpu<Btype>(N, C, S, top_diff,
-      temp_C_->template mutable_gpu_diff<Btype>());
-  multicast_gpu<Btype>(N, C, S, temp_C_->template gpu_diff<Btype>(),
-      temp_NCHW_->template mutable_gpu_diff<Btype>());
-
-  // bottom = mean(dE/dY) + mean(dE/dY .* Y) .* Y
-  caffe_gpu_add<Btype>(top_size, temp_NCHW_->template gpu_diff<Btype>(), bottom_diff, bottom_diff);
-
-  // bottom = dE/dY - mean(dE/dY)-mean(dE/dY \cdot Y) \cdot Y
-  caffe_gpu_sub<Btype>(top_size, top_diff, bottom_diff, bottom_diff);
-
-  // dE/dX = dE/dX ./ sqrt(var(X) + eps)
-  multicast_gpu<Btype>(N, C, S, inv_var_->template gpu_data<Btype>(),
-     temp_NCHW_->template mutable_gpu_data<Btype>());
-  caffe_gpu_mul<Btype>(top_size, bottom_diff, temp_NCHW_->template gpu_data<Btype>(), bottom_diff);
+    scale = reinterpret_cast<const T*>(this->blobs_[3]->template gpu_data<Btype>());
+    scale_diff = reinterpret_cast<T*>(this->blobs_[3]->template mutable_gpu_diff<Btype>());
+    shift_diff = reinterpret_cast<T*>(this->blobs_[4]->template mutable_gpu_diff<Btype>());
+  }
+  //  scale_diff = sum(dE/dY .* X_norm), shift_diff = sum(dE/dY), and with
+  //  dE/dZ = dE/dY * scale[c] means = mean(dE/dZ .* X_norm), mean(dE/dZ) in one read
+  Btype* means = stats_->template mutable_gpu_diff<Btype>();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  BatchNormGradSumsGPU<T, A><<<std::min(C, 65535), BN_FUSED_THREADS, 0, stream>>>(N, C, S,
+      top_diff, x_norm, scale, scale_diff, shift_diff, reinterpret_cast<T*>(means));
+  CUDA_POST_KERNEL_CHECK;
+  // over the virtual batch so far and every solver, to which others add nothing
+  const int solvers = sync_solvers();
+  if (batch_fraction_ != 1. || solvers > 1) {
+    caffe_gpu_scal<Btype>(2 * C, Btype(batch_fraction_ / solvers), means);
+  }
+  if (solvers > 1) {
+    AllreduceStats_gpu(2 * C, means, tp<Btype>());
+  }
+
+  // dE/dX = (dE/dZ - mean(dE/dZ) - mean(dE/dZ .* X_norm) .* X_norm) ./ sqrt(var(X) + eps)
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  BatchNormBackwardGPU<T, A><<<CAFFE_GET_BLOCKS(top_size), CAFFE_CUDA_NUM_THREADS, 0,
+      stream>>>(top_size, C, S, top_diff, x_norm, scale, reinterpret_cast<const T*>(means),
+      reinterpret_cast<const T*>(inv_var_->template gpu_data<Btype>()),
+      reinterpret_cast<T*>(bottom[0]->mutable_gpu_diff<Btype>()));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 
@@ -1,5 +1,3 @@
-#include <algorithm>
-#include <utility>
 #include <vector>
 
 #include "caffe/layers/batch_reindex_layer.hpp"
@@ -7,47 +5,80 @@
 
 namespace caffe {
 
-template<typename Dtype>
-__global__ void BRForward(const int count, const int inner_dim, const Dtype* in,
-                          const Dtype* permut, Dtype* out) {
+// Indices out of [0, num_in) give zeros: they are only checked on host by Forward_cpu
+template<typename Ftype>
+__global__ void BRForward(const int count, const int inner_dim, const int num_in,
+                          const Ftype* in, const Ftype* permut, Ftype* out) {
   CUDA_KERNEL_LOOP(index, count) {
     int n = index / (inner_dim);
     int in_n = static_cast<int>(permut[n]);
-    out[index] = in[in_n * (inner_dim) + index % (inner_dim)];
+    out[index] = in_n >= 0 && in_n < num_in ?
+        in[in_n * (inner_dim) + index % (inner_dim)] : Ftype(0);
   }
 }
 
 template <typename Ftype, typename Btype>
 void BatchReindexLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
                                            const vector<Blob*>& top) {
-  check_batch_reindex(bottom[0]->shape(0), bottom[1]->count(),
-                      bottom[1]->cpu_data<Ftype>());
   if (top[0]->count() == 0) {
     return;
   }
-  int threads = top[0]->count();
+  const int count = top[0]->count();
   cudaStream_t stream = Caffe::thread_stream();
   // NOLINT_NEXT_LINE(whitespace/operators)
-  BRForward<Ftype><<<CAFFE_GET_BLOCKS(threads), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
-      top[0]->count(), bottom[0]->count() / bottom[0]->shape(0),
+  BRForward<Ftype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      count, bottom[0]->count() / bottom[0]->shape(0), bottom[0]->shape(0),
       bottom[0]->gpu_data<Ftype>(), bottom[1]->gpu_data<Ftype>(),
       top[0]->mutable_gpu_data<Ftype>());
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+// For every bottom item, where its list of top items starts and how long it is
+template<typename Dtype>
+__global__ void BRBuckets(const int num_in, const int num_out, const Dtype* permut,
+                          int* begins, int* counts) {
+  CUDA_KERNEL_LOOP(n, num_in) {
+    int before = 0;
+    int count = 0;
+    for (int i = 0; i < num_out; ++i) {
+      int in_n = static_cast<int>(permut[i]);
+      before += in_n >= 0 && in_n < n;
+      count += in_n == n;
+    }
+    begins[n] = before;
+    counts[n] = count;
+  }
+}
+
+// Top items in their bottom item's list, in increasing order
+template<typename Dtype>
+__global__ void BRTopIndexes(const int num_in, const int num_out, const Dtype* permut,
+                             const int* begins, int* top_indexes) {
+  CUDA_KERNEL_LOOP(i, num_out) {
+    int in_n = static_cast<int>(permut[i]);
+    if (in_n >= 0 && in_n < num_in) {
+      int slot = begins[in_n];
+      for (int j = 0; j < i; ++j) {
+        slot += static_cast<int>(permut[j]) == in_n;
+      }
+      top_indexes[slot] = i;
+    }
+  }
 }
 
 template<typename Dtype>
 __global__ void BRBackward(const int count, const int inner_dim,
-                           const Dtype* in, const Dtype* top_indexes,
-                           const Dtype* begins, const Dtype* counts,
+                           const Dtype* in, const int* top_indexes,
+                           const int* begins, const int* counts,
                            Dtype* out) {
   CUDA_KERNEL_LOOP(index, count) {
     int n = index / (inner_dim);
     out[index] = 0;
-    int lower = static_cast<int>(begins[n]);
-    int upper = lower + static_cast<int>(counts[n]);
+    int lower = begins[n];
+    int upper = lower + counts[n];
     for (int i = lower; i < upper; ++i) {
-      int in_n = static_cast<int>(top_indexes[i]);
+      int in_n = top_indexes[i];
       out[index] += in[in_n * (inner_dim) + index % (inner_dim)];
     }
   }
@@ -62,48 +93,38 @@ void BatchReindexLayer<Ftype, Btype>::Backward_gpu(
     return;
   }
 
-  vector<std::pair<int, int> > mapping;
-  const Btype* perm = bottom[1]->cpu_data<Btype>();
-  for (int i = 0; i < bottom[1]->count(); ++i) {
-    mapping.push_back(pair<int, int>(static_cast<int>(perm[i]), i));
-  }
-  std::sort(mapping.begin(), mapping.end(), pair_sort_first());
-
   // Each element of the bottom diff is potentially the sum of many top diffs.
   // However, we'd like each CUDA thread to handle exactly one output.  Hence,
-  // we first pre-compute a list of lists of indices that need to be summed for
-  // each output. `top_indexes` holds the data of this list of lists.  The
+  // we first compute on device a list of lists of indices that need to be summed
+  // for each output. `top_indexes` holds the data of this list of lists.  The
   // k'th element of `begins` points to the location in `top_indexes` where the
   // list for the k'th example begin, and the k'th element of `counts` is the
-  // length of that list.
-  vector<int> shape;
-  shape.push_back(bottom[1]->count());
-  TBlob<Btype> top_indexes(shape);
-  shape[0] = bottom[0]->shape(0);
-  TBlob<Btype> counts(shape);
-  TBlob<Btype> begins(shape);
-  Btype* t_i_data = top_indexes.mutable_cpu_data();
-  Btype* c_data = counts.mutable_cpu_data();
-  Btype* b_data = begins.mutable_cpu_data();
-  caffe_set(begins.count(), Btype(-1), b_data);
-  caffe_set(counts.count(), Btype(0), c_data);
-  for (int i = 0; i < mapping.size(); ++i) {
-    t_i_data[i] = mapping[i].second;
-    if (b_data[mapping[i].first] == -1) {
-      b_data[mapping[i].first] = i;
-    }
-    c_data[mapping[i].first] += 1;
-  }
+  // length of that list. Batches are small, every thread scans all indices.
+  const int num_in = bottom[0]->shape(0);
+  const int num_out = bottom[1]->count();
+  buckets_.Reshape(vector<int>{2 * num_in + num_out});
+  int* begins = buckets_.mutable_gpu_data();
+  int* counts = begins + num_in;
+  int* top_indexes = counts + num_in;
+  const Btype* permut = bottom[1]->gpu_data<Btype>();
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  BRBuckets<Btype><<<CAFFE_GET_BLOCKS(num_in), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      num_in, num_out, permut, begins, counts);
+  CUDA_POST_KERNEL_CHECK;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  BRTopIndexes<Btype><<<CAFFE_GET_BLOCKS(num_out), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      num_in, num_out, permut, begins, top_indexes);
+  CUDA_POST_KERNEL_CHECK;
 
   int threads = bottom[0]->count();
-  cudaStream_t stream = Caffe::thread_stream();
   // NOLINT_NEXT_LINE(whitespace/operators)
   BRBackward<Btype><<<CAFFE_GET_BLOCKS(threads), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
       bottom[0]->count(), bottom[0]->count() / bottom[0]->shape(0),
-      top[0]->gpu_diff<Btype>(), top_indexes.gpu_data(), begins.gpu_data(),
-      counts.gpu_data(), bottom[0]->mutable_gpu_diff<Btype>());
+      top[0]->gpu_diff<Btype>(), top_indexes, begins, counts,
+      bottom[0]->mutable_gpu_diff<Btype>());
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(BatchReindexLayer);
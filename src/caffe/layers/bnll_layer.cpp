@@ -2,6 +2,7 @@
 #include <vector>
 
 #include "caffe/layers/bnll_layer.hpp"
+#include "caffe/util/cpu_parallel.hpp"
 
 namespace caffe {
 
@@ -13,11 +14,13 @@ void BNLLLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
   const Ftype* bottom_data = bottom[0]->cpu_data<Ftype>();
   Ftype* top_data = top[0]->mutable_cpu_data<Ftype>();
   const int count = bottom[0]->count();
-  for (int i = 0; i < count; ++i) {
-    top_data[i] = bottom_data[i] > 0 ?
-        bottom_data[i] + log(1. + exp(-bottom_data[i])) :
-        log(1. + exp(bottom_data[i]));
-  }
+  CpuParallel::For(count, CpuParallel::GRAIN, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      top_data[i] = bottom_data[i] > 0 ?
+          bottom_data[i] + log(1. + exp(-bottom_data[i])) :
+          log(1. + exp(bottom_data[i]));
+    }
+  });
 }
 
 template <typename Ftype, typename Btype>
@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/layers/cluster_detections_layer.hpp"
+
+namespace caffe {
+
+template <typename Ftype, typename Btype>
+void ClusterDetectionsLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  const ClusterDetectionsParameter& param = this->layer_param_.cluster_detections_param();
+  CHECK_GT(param.stride(), 0) << "Layer " << this->name();
+  CHECK_GE(param.image_size_x(), param.stride()) << "Layer " << this->name();
+  CHECK_GE(param.image_size_y(), param.stride()) << "Layer " << this->name();
+  CHECK_GT(param.max_boxes(), 0) << "Layer " << this->name();
+  const int grid_x = param.image_size_x() / param.stride();
+  const int grid_y = param.image_size_y() / param.stride();
+  cell_width_ = param.image_size_x() / grid_x;
+  cell_height_ = param.image_size_y() / grid_y;
+  max_boxes_ = param.max_boxes();
+}
+
+template <typename Ftype, typename Btype>
+void ClusterDetectionsLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  const ClusterDetectionsParameter& param = this->layer_param_.cluster_detections_param();
+  CHECK_EQ(4, bottom[0]->num_axes()) << "Layer " << this->name()
+      << ": coverage must be N x classes x H x W";
+  CHECK_EQ(4, bottom[1]->num_axes()) << "Layer " << this->name()
+      << ": boxes must be N x 4 x H x W";
+  CHECK_EQ(bottom[0]->num(), bottom[1]->num()) << "Layer " << this->name();
+  CHECK_EQ(4, bottom[1]->channels()) << "Layer " << this->name();
+  CHECK_EQ(bottom[0]->height(), bottom[1]->height()) << "Layer " << this->name();
+  CHECK_EQ(bottom[0]->width(), bottom[1]->width()) << "Layer " << this->name();
+  CHECK_EQ(bottom[0]->channels(), top.size()) << "Layer " << this->name()
+      << ": a top per class is expected";
+  grid_width_ = std::min<int>(param.image_size_x() / param.stride(), bottom[0]->width());
+  grid_height_ = std::min<int>(param.image_size_y() / param.stride(), bottom[0]->height());
+  const int num = bottom[0]->num();
+  for (int c = 0; c < top.size(); ++c) {
+    top[c]->Reshape(vector<int>{num, max_boxes_, 5});
+  }
+  const int cells = grid_width_ * grid_height_;
+  boxes_.Reshape(vector<int>{num, cells, 4});
+  labels_.Reshape(vector<int>{num, cells});
+}
+
+namespace {
+
+// OpenCV's SimilarRects on corners
+bool SimilarBoxes(const float* a, const float* b, float eps) {
+  const float delta = eps * 0.5F *
+      (std::min(a[2] - a[0], b[2] - b[0]) + std::min(a[3] - a[1], b[3] - b[1]));
+  return std::fabs(a[0] - b[0]) <= delta && std::fabs(a[1] - b[1]) <= delta &&
+      std::fabs(a[2] - b[2]) <= delta && std::fabs(a[3] - b[3]) <= delta;
+}
+
+// Whether box a lies within box b grown by eps times its size
+bool NestedBox(const float* a, const float* b, float eps) {
+  const float dx = eps * (b[2] - b[0]);
+  const float dy = eps * (b[3] - b[1]);
+  return a[0] >= b[0] - dx && a[1] >= b[1] - dy && a[2] <= b[2] + dx && a[3] <= b[3] + dy;
+}
+
+}  // namespace
+
+template <typename Ftype, typename Btype>
+void ClusterDetectionsLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  const ClusterDetectionsParameter& param = this->layer_param_.cluster_detections_param();
+  const bool groundtruth = param.groundtruth();
+  const int rect_threshold = param.rect_threshold();
+  const float eps = param.rect_eps();
+  const int height = bottom[0]->height();
+  const int width = bottom[0]->width();
+  const int spatial = height * width;
+  const int num_classes = bottom[0]->channels();
+  const Ftype* coverage = bottom[0]->cpu_data<Ftype>();
+  const Ftype* bbox = bottom[1]->cpu_data<Ftype>();
+  vector<float> proposals, clusters;
+  vector<int> labels, sizes;
+  for (int c = 0; c < num_classes; ++c) {
+    Ftype* top_data = top[c]->mutable_cpu_data<Ftype>();
+    caffe_set(top[c]->count(), Ftype(0), top_data);
+    for (int n = 0; n < bottom[0]->num(); ++n) {
+      const Ftype* cvg = coverage + (n * num_classes + c) * spatial;
+      const Ftype* box = bbox + n * 4 * spatial;
+      proposals.clear();
+      for (int y = 0; y < grid_height_; ++y) {
+        for (int x = 0; x < grid_width_; ++x) {
+          const int s = y * width + x;
+          const float v = static_cast<float>(cvg[s]);
+          if (groundtruth ? v > 0.F : v >= param.coverage_threshold()) {
+            proposals.push_back(static_cast<float>(box[s]) + x * cell_width_);
+            proposals.push_back(static_cast<float>(box[spatial + s]) + y * cell_height_);
+            proposals.push_back(static_cast<float>(box[2 * spatial + s]) + x * cell_width_);
+            proposals.push_back(static_cast<float>(box[3 * spatial + s]) + y * cell_height_);
+          }
+        }
+      }
+      const int count = proposals.size() / 4;
+      vector<bool> keep(count);
+      if (groundtruth) {
+        clusters = proposals;
+        sizes.assign(count, 0);
+        for (int k = 0; k < count; ++k) {
+          const float* p = &proposals[4 * k];
+          keep[k] = true;
+          for (int j = 0; j < k && keep[k]; ++j) {
+            keep[k] = !std::equal(p, p + 4, &proposals[4 * j]);
+          }
+        }
+      } else {
+        // Each proposal is labeled with the first one of its component
+        labels.resize(count);
+        for (int k = 0; k < count; ++k) {
+          labels[k] = k;
+          for (int j = 0; j < k; ++j) {
+            if (labels[j] != labels[k] &&
+                SimilarBoxes(&proposals[4 * k], &proposals[4 * j], eps)) {
+              const int a = std::min(labels[j], labels[k]);
+              const int b = std::max(labels[j], labels[k]);
+              for (int i = 0; i <= k; ++i) {
+                if (labels[i] == b) {
+                  labels[i] = a;
+                }
+              }
+            }
+          }
+        }
+        clusters.assign(4 * count, 0.F);
+        sizes.assign(count, 0);
+        for (int k = 0; k < count; ++k) {
+          ++sizes[labels[k]];
+          for (int i = 0; i < 4; ++i) {
+            clusters[4 * labels[k] + i] += proposals[4 * k + i];
+          }
+        }
+        for (int k = 0; k < count; ++k) {
+          for (int i = 0; sizes[k] > 0 && i < 4; ++i) {
+            clusters[4 * k + i] /= sizes[k];
+          }
+        }
+        for (int k = 0; k < count; ++k) {
+          const int n1 = sizes[k];
+          keep[k] = n1 > rect_threshold;
+          for (int j = 0; j < count && keep[k]; ++j) {
+            const int n2 = sizes[j];
+            keep[k] = j == k || n2 <= rect_threshold ||
+                !NestedBox(&clusters[4 * k], &clusters[4 * j], eps) ||
+                !(n2 > std::max(3, n1) || n1 < 3);
+          }
+          keep[k] = keep[k] && clusters[4 * k + 3] - clusters[4 * k + 1] >= param.min_height();
+        }
+      }
+      Ftype* out = top_data + n * max_boxes_ * 5;
+      for (int k = 0, b = 0; k < count && b < max_boxes_; ++k) {
+        if (keep[k]) {
+          for (int i = 0; i < 4; ++i) {
+            out[5 * b + i] = Ftype(clusters[4 * k + i]);
+          }
+          out[5 * b + 4] = groundtruth ? Ftype(0) :
+              Ftype(std::log(static_cast<float>(sizes[k])));
+          ++b;
+        }
+      }
+    }
+  }
+}
+
+#ifdef CPU_ONLY
+STUB_GPU_FORWARD(ClusterDetectionsLayer, Forward);
+#endif
+
+INSTANTIATE_CLASS_FB(ClusterDetectionsLayer);
+REGISTER_LAYER_CLASS(ClusterDetections);
+
+}  // namespace caffe
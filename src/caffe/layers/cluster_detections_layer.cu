@@ -0,0 +1,212 @@
+#include <vector>
+#include <device_launch_parameters.h>
+
+#include "caffe/layers/cluster_detections_layer.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
+
+namespace caffe {
+
+#define CLUSTER_THREADS 256
+#define CLUSTER_WARPS (CLUSTER_THREADS / 32)
+
+__device__ __forceinline__ bool SimilarBoxes(const float4& a, const float4& b, float eps) {
+  const float delta = eps * 0.5F * (fminf(a.z - a.x, b.z - b.x) + fminf(a.w - a.y, b.w - b.y));
+  return fabsf(a.x - b.x) <= delta && fabsf(a.y - b.y) <= delta &&
+      fabsf(a.z - b.z) <= delta && fabsf(a.w - b.w) <= delta;
+}
+
+__device__ __forceinline__ bool NestedBox(const float4& a, const float4& b, float eps) {
+  const float dx = eps * (b.z - b.x);
+  const float dy = eps * (b.w - b.y);
+  return a.x >= b.x - dx && a.y >= b.y - dy && a.z <= b.z + dx && a.w <= b.w + dy;
+}
+
+// A block per image. Proposals are compacted in gridbox order, labeled with the first
+// proposal of their component by propagating minimum labels until none changes, then
+// the clusters are averaged at their first proposal, filtered, and listed by thread 0.
+template <typename T>
+__global__ void ClusterDetectionsGPU(const T* coverage, const T* bbox, const int num_classes,
+    const int c, const int height, const int width, const int grid_width,
+    const int grid_height, const int cell_width, const int cell_height,
+    const bool groundtruth, const float threshold, const int rect_threshold,
+    const float eps, const float min_height, const int max_boxes, float4* proposals,
+    float4* clusters, volatile int* labels, int* sizes, T* top) {
+  __shared__ int warp_count[CLUSTER_WARPS];
+  __shared__ int count;
+  __shared__ int changed;
+  const int n = blockIdx.x;
+  const int spatial = height * width;
+  const int cells = grid_width * grid_height;
+  const T* cvg = coverage + (n * num_classes + c) * spatial;
+  const T* box = bbox + n * 4 * spatial;
+  proposals += n * cells;
+  clusters += n * cells;
+  labels += n * cells;
+  sizes += n * cells;
+  top += n * max_boxes * 5;
+  const int lane = threadIdx.x & 31;
+  const int warp = threadIdx.x >> 5;
+  if (threadIdx.x == 0) {
+    count = 0;
+  }
+  __syncthreads();
+  for (int base = 0; base < cells; base += blockDim.x) {
+    const int cell = base + threadIdx.x;
+    const int y = cell / grid_width;
+    const int x = cell % grid_width;
+    bool pass = false;
+    if (cell < cells) {
+      const float v = mt_load<float, T>(cvg[y * width + x]);
+      pass = groundtruth ? v > 0.F : v >= threshold;
+    }
+    const unsigned int ballot = __ballot_sync(0xffffffffU, pass);
+    if (lane == 0) {
+      warp_count[warp] = __popc(ballot);
+    }
+    __syncthreads();
+    if (pass) {
+      int k = count + __popc(ballot & ((1U << lane) - 1U));
+      for (int w = 0; w < warp; ++w) {
+        k += warp_count[w];
+      }
+      const int s = y * width + x;
+      proposals[k] = make_float4(
+          mt_load<float, T>(box[s]) + x * cell_width,
+          mt_load<float, T>(box[spatial + s]) + y * cell_height,
+          mt_load<float, T>(box[2 * spatial + s]) + x * cell_width,
+          mt_load<float, T>(box[3 * spatial + s]) + y * cell_height);
+      labels[k] = k;
+    }
+    __syncthreads();
+    if (threadIdx.x == 0) {
+      for (int w = 0; w < CLUSTER_WARPS; ++w) {
+        count += warp_count[w];
+      }
+    }
+    __syncthreads();
+  }
+  const int num = count;
+  if (groundtruth) {
+    // Labels flag the first occurrence of each box
+    for (int k = threadIdx.x; k < num; k += blockDim.x) {
+      const float4 p = proposals[k];
+      bool first = true;
+      for (int j = 0; j < k && first; ++j) {
+        const float4 q = proposals[j];
+        first = p.x != q.x || p.y != q.y || p.z != q.z || p.w != q.w;
+      }
+      clusters[k] = p;
+      sizes[k] = 0;
+      labels[k] = first;
+    }
+  } else {
+    // Labels only decrease, reading a stale one delays convergence by an iteration
+    do {
+      __syncthreads();
+      if (threadIdx.x == 0) {
+        changed = 0;
+      }
+      __syncthreads();
+      for (int k = threadIdx.x; k < num; k += blockDim.x) {
+        const float4 p = proposals[k];
+        const int label = labels[k];
+        int min_label = label;
+        for (int j = 0; j < num; ++j) {
+          const int other = labels[j];
+          if (other < min_label && SimilarBoxes(p, proposals[j], eps)) {
+            min_label = other;
+          }
+        }
+        if (min_label < label) {
+          labels[k] = min_label;
+          changed = 1;
+        }
+      }
+      __syncthreads();
+    } while (changed);
+    for (int k = threadIdx.x; k < num; k += blockDim.x) {
+      int size = 0;
+      float4 sum = make_float4(0.F, 0.F, 0.F, 0.F);
+      if (labels[k] == k) {
+        for (int j = k; j < num; ++j) {
+          if (labels[j] == k) {
+            const float4 p = proposals[j];
+            sum.x += p.x;
+            sum.y += p.y;
+            sum.z += p.z;
+            sum.w += p.w;
+            ++size;
+          }
+        }
+        sum.x /= size;
+        sum.y /= size;
+        sum.z /= size;
+        sum.w /= size;
+      }
+      clusters[k] = sum;
+      sizes[k] = size;
+    }
+    __syncthreads();
+    // Labels are done with, they flag the clusters kept
+    for (int k = threadIdx.x; k < num; k += blockDim.x) {
+      const float4 r = clusters[k];
+      const int n1 = sizes[k];
+      bool keep = n1 > rect_threshold;
+      for (int j = 0; j < num && keep; ++j) {
+        const int n2 = sizes[j];
+        keep = j == k || n2 <= rect_threshold || !NestedBox(r, clusters[j], eps) ||
+            !(n2 > max(3, n1) || n1 < 3);
+      }
+      labels[k] = keep && r.w - r.y >= min_height;
+    }
+  }
+  __syncthreads();
+  if (threadIdx.x == 0) {
+    int b = 0;
+    for (int k = 0; k < num && b < max_boxes; ++k) {
+      if (labels[k]) {
+        const float4 r = clusters[k];
+        top[5 * b] = mt_store<T, float>(r.x);
+        top[5 * b + 1] = mt_store<T, float>(r.y);
+        top[5 * b + 2] = mt_store<T, float>(r.z);
+        top[5 * b + 3] = mt_store<T, float>(r.w);
+        top[5 * b + 4] = mt_store<T, float>(groundtruth ? 0.F : logf(sizes[k]));
+        ++b;
+      }
+    }
+    for (; b < max_boxes; ++b) {
+      for (int i = 0; i < 5; ++i) {
+        top[5 * b + i] = mt_store<T, float>(0.F);
+      }
+    }
+  }
+}
+
+template <typename Ftype, typename Btype>
+void ClusterDetectionsLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  typedef typename MultiTensorType<Ftype>::type T;
+  const ClusterDetectionsParameter& param = this->layer_param_.cluster_detections_param();
+  const T* coverage = reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>());
+  const T* bbox = reinterpret_cast<const T*>(bottom[1]->gpu_data<Ftype>());
+  float4* proposals = reinterpret_cast<float4*>(boxes_.mutable_gpu_data());
+  float4* clusters = reinterpret_cast<float4*>(boxes_.mutable_gpu_diff());
+  int* labels = labels_.mutable_gpu_data();
+  int* sizes = labels_.mutable_gpu_diff();
+  cudaStream_t stream = Caffe::thread_stream();
+  // Classes reuse the scratch one after the other on the stream
+  for (int c = 0; c < top.size(); ++c) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    ClusterDetectionsGPU<<<bottom[0]->num(), CLUSTER_THREADS, 0, stream>>>(
+        coverage, bbox, bottom[0]->channels(), c, bottom[0]->height(), bottom[0]->width(),
+        grid_width_, grid_height_, cell_width_, cell_height_, param.groundtruth(),
+        param.coverage_threshold(), param.rect_threshold(), param.rect_eps(),
+        param.min_height(), max_boxes_, proposals, clusters, labels, sizes,
+        reinterpret_cast<T*>(top[c]->mutable_gpu_data<Ftype>()));
+    CUDA_POST_KERNEL_CHECK;
+  }
+}
+
+INSTANTIATE_LAYER_GPU_FORWARD_ONLY_FB(ClusterDetectionsLayer);
+
+}  // namespace caffe
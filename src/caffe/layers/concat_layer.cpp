@@ -1,6 +1,7 @@
 #include <vector>
 
 #include "caffe/layers/concat_layer.hpp"
+#include "caffe/util/blob_views.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -45,6 +46,17 @@ void ConcatLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
     bottom_count_sum += bottom[i]->count();
     top_shape[concat_axis_] += bottom[i]->shape(concat_axis_);
   }
+  if ((data_views_ || diff_views_) && top_shape != top[0]->shape()) {
+    // The top's memory may move, bottoms keep their data
+    const bool gpu = Caffe::mode() == Caffe::GPU;
+    if (data_views_) {
+      unbind_views(top[0], bottom, true, true, gpu);
+    }
+    if (diff_views_) {
+      unbind_views(top[0], bottom, false, false, gpu);
+    }
+    data_views_ = diff_views_ = false;
+  }
   top[0]->Reshape(top_shape);
   CHECK_EQ(bottom_count_sum, top[0]->count());
   if (bottom.size() == 1) {
@@ -53,10 +65,52 @@ void ConcatLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
   }
 }
 
+template <typename Ftype, typename Btype>
+bool ConcatLayer<Ftype, Btype>::ForwardViews(const vector<Blob*>& bottom,
+      const vector<Blob*>& top) {
+  const bool gpu = Caffe::mode() == Caffe::GPU;
+  if (!data_views_ || !views_bound(top[0], bottom, true, gpu)) {
+    return false;
+  }
+  top[0]->current_mutable_data_memory(gpu);
+  return true;
+}
+
+template <typename Ftype, typename Btype>
+bool ConcatLayer<Ftype, Btype>::BackwardViews(const vector<Blob*>& top,
+      const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  const bool gpu = Caffe::mode() == Caffe::GPU;
+  if (!diff_views_ || !views_bound(top[0], bottom, false, gpu)) {
+    return false;
+  }
+  for (int i = 0; i < bottom.size(); ++i) {
+    if (propagate_down[i]) {
+      bottom[i]->current_mutable_diff_memory(gpu);
+    }
+  }
+  return true;
+}
+
+template <typename Ftype, typename Btype>
+void ConcatLayer<Ftype, Btype>::BindViews(const vector<Blob*>& bottom,
+      const vector<Blob*>& top, bool data) {
+  if (!share_storage_ || num_concats_ != 1) {
+    return;
+  }
+  const bool gpu = Caffe::mode() == Caffe::GPU;
+  bool& views = data ? data_views_ : diff_views_;
+  const bool bound = bind_views(top[0], bottom, data, gpu);
+  if (views && !bound) {
+    // Parts still in the shared memory must not outlive it
+    unbind_views(top[0], bottom, data, true, gpu);
+  }
+  views = bound;
+}
+
 template <typename Ftype, typename Btype>
 void ConcatLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top) {
-  if (bottom.size() == 1) { return; }
+  if (bottom.size() == 1 || ForwardViews(bottom, top)) { return; }
   Ftype* top_data = top[0]->mutable_cpu_data<Ftype>();
   int offset_concat_axis = 0;
   const int top_concat_axis = top[0]->shape(concat_axis_);
@@ -71,12 +125,13 @@ void ConcatLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
     }
     offset_concat_axis += bottom_concat_axis;
   }
+  BindViews(bottom, top, true);
 }
 
 template <typename Ftype, typename Btype>
 void ConcatLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
-  if (bottom.size() == 1) { return; }
+  if (bottom.size() == 1 || BackwardViews(top, propagate_down, bottom)) { return; }
   const Btype* top_diff = top[0]->cpu_diff<Btype>();
   int offset_concat_axis = 0;
   const int top_concat_axis = top[0]->shape(concat_axis_);
@@ -92,6 +147,7 @@ void ConcatLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
     }
     offset_concat_axis += bottom_concat_axis;
   }
+  BindViews(bottom, top, false);
 }
 
 #ifdef CPU_ONLY
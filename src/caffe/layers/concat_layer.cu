@@ -5,75 +5,50 @@
 
 namespace caffe {
 
-template <typename Dtype>
-__global__ void Concat(const int nthreads, const Dtype* in_data,
-    const bool forward, const int num_concats, const int concat_size,
-    const int top_concat_axis, const int bottom_concat_axis,
-    const int offset_concat_axis, Dtype* out_data) {
-  CUDA_KERNEL_LOOP(index, nthreads) {
-    const int total_concat_size = concat_size * bottom_concat_axis;
-    const int concat_num = index / total_concat_size;
-    const int concat_index = index % total_concat_size;
-    const int top_index = concat_index +
-        (concat_num * top_concat_axis + offset_concat_axis) * concat_size;
-    if (forward) {
-      out_data[top_index] = in_data[index];
-    } else {
-      out_data[index] = in_data[top_index];
-    }
-  }
-}
-
 template <typename Ftype, typename Btype>
 void ConcatLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top) {
-  const Ftype* bottom_data = bottom[0]->gpu_data<Ftype>();
-  Ftype* top_data = top[0]->mutable_gpu_data<Ftype>();
-  int offset_concat_axis = 0;
-  const int top_concat_axis = top[0]->shape(concat_axis_);
-  const bool kForward = true;
-
-  if (bottom.size() == 1) {
+  if (bottom.size() == 1 || ForwardViews(bottom, top)) {
     return;
   }
+  Ftype* top_data = top[0]->mutable_gpu_data<Ftype>();
+  int offset_concat_axis = 0;
+  const int top_concat_size = top[0]->shape(concat_axis_) * concat_input_size_;
+  cudaStream_t stream = Caffe::thread_stream();
   for (int i = 0; i < bottom.size(); ++i) {
-    bottom_data = bottom[i]->gpu_data<Ftype>();
     const int bottom_concat_axis = bottom[i]->shape(concat_axis_);
     const int bottom_concat_size = bottom_concat_axis * concat_input_size_;
-    const int nthreads = bottom_concat_size * num_concats_;
-    Concat<Ftype>  // NOLINT_NEXT_LINE(whitespace/operators)
-        <<<CAFFE_GET_BLOCKS(nthreads), CAFFE_CUDA_NUM_THREADS, 0, Caffe::thread_stream()>>>(
-        nthreads, bottom_data, kForward, num_concats_, concat_input_size_,
-        top_concat_axis, bottom_concat_axis, offset_concat_axis, top_data);
+    caffe_gpu_strided_copy(tp<Ftype>(), vector<int>{num_concats_, bottom_concat_size},
+        bottom[i]->gpu_data<Ftype>(), vector<int>{bottom_concat_size, 1},
+        top_data + offset_concat_axis * concat_input_size_, vector<int>{top_concat_size, 1},
+        stream);
     offset_concat_axis += bottom_concat_axis;
   }
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(stream));
+  BindViews(bottom, top, true);
 }
 
 template <typename Ftype, typename Btype>
 void ConcatLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
   const Btype* top_diff = top[0]->gpu_diff<Btype>();
-  Btype* bottom_diff = bottom[0]->mutable_gpu_diff<Btype>();
-  if (bottom.size() == 1) {
+  if (bottom.size() == 1 || BackwardViews(top, propagate_down, bottom)) {
     return;
   }
   int offset_concat_axis = 0;
-  const int top_concat_axis = top[0]->shape(concat_axis_);
-  const bool kForward = false;
+  const int top_concat_size = top[0]->shape(concat_axis_) * concat_input_size_;
+  cudaStream_t stream = Caffe::thread_stream();
   for (int i = 0; i < bottom.size(); ++i) {
     const int bottom_concat_axis = bottom[i]->shape(concat_axis_);
     if (propagate_down[i]) {
-      bottom_diff = bottom[i]->mutable_gpu_diff<Btype>();
       const int bottom_concat_size = bottom_concat_axis * concat_input_size_;
-      const int nthreads = bottom_concat_size * num_concats_;
-      Concat<Btype>  // NOLINT_NEXT_LINE(whitespace/operators)
-          <<<CAFFE_GET_BLOCKS(nthreads), CAFFE_CUDA_NUM_THREADS, 0, Caffe::thread_stream()>>>(
-          nthreads, top_diff, kForward, num_concats_, concat_input_size_,
-          top_concat_axis, bottom_concat_axis, offset_concat_axis, bottom_diff);
+      caffe_gpu_strided_copy(tp<Btype>(), vector<int>{num_concats_, bottom_concat_size},
+          top_diff + offset_concat_axis * concat_input_size_, vector<int>{top_concat_size, 1},
+          bottom[i]->mutable_gpu_diff<Btype>(), vector<int>{bottom_concat_size, 1}, stream);
     }
     offset_concat_axis += bottom_concat_axis;
   }
+  BindViews(bottom, top, false);
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(ConcatLayer);
@@ -3,106 +3,117 @@
 
 #include "caffe/layers/contrastive_loss_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/welford.cuh"
 
 namespace caffe {
 
-template <typename Ftype, typename Btype>
-void ContrastiveLossLayer<Ftype, Btype>::Forward_gpu(
-    const vector<Blob*>& bottom, const vector<Blob*>& top) {
-  const int count = bottom[0]->count();
-  caffe_gpu_sub<Ftype>(
-      count,
-      bottom[0]->gpu_data<Ftype>(),  // a
-      bottom[1]->gpu_data<Ftype>(),  // b
-      diff_.template mutable_gpu_data<Ftype>());  // a_i-b_i
-  caffe_gpu_powx<Ftype>(
-      count,
-      diff_.template mutable_gpu_data<Ftype>(),  // a_i-b_i
-      Ftype(2),
-      diff_sq_.template mutable_gpu_data<Ftype>());  // (a_i-b_i)^2
-  caffe_gpu_gemv<Ftype>(
-      CblasNoTrans,
-      bottom[0]->num(),
-      bottom[0]->channels(),
-      Ftype(1.0),
-      diff_sq_.template gpu_data<Ftype>(),  // (a_i-b_i)^2
-      summer_vec_.template gpu_data<Ftype>(),
-      Ftype(0.0),
-      dist_sq_.template mutable_gpu_data<Ftype>());  // \Sum (a_i-b_i)^2
-  float margin = this->layer_param_.contrastive_loss_param().margin();
-  bool legacy_version =
-      this->layer_param_.contrastive_loss_param().legacy_version();
-  float loss = 0.F;
-  for (int i = 0; i < bottom[0]->num(); ++i) {
-    if (static_cast<int>(bottom[2]->cpu_data<Ftype>()[i])) {  // similar pairs
-      loss += dist_sq_.cpu_data()[i];
-    } else {  // dissimilar pairs
-      if (legacy_version) {
-        loss += std::max<float>(margin - dist_sq_.cpu_data()[i], 0.F);
+#define CONTRASTIVE_LOSS_THREADS 256
+
+// One block per pair: its squared distance, kept for backward, and its loss, both
+// without storing a - b
+template <typename T, typename A>
+__global__ void ContrastiveLossForwardGPU(const int num, const int channels, const T* a,
+    const T* b, const T* y, const float margin, const bool legacy_version, float* dist_sq,
+    float* loss) {
+  for (int n = blockIdx.x; n < num; n += gridDim.x) {
+    const size_t offset = static_cast<size_t>(n) * channels;
+    A sum = A(0);
+    for (int c = threadIdx.x; c < channels; c += blockDim.x) {
+      const A d = mt_load<A, T>(a[offset + c]) - mt_load<A, T>(b[offset + c]);
+      sum += d * d;
+    }
+    sum = block_sum<A, CONTRASTIVE_LOSS_THREADS>(sum);
+    if (threadIdx.x == 0) {
+      const float d2 = static_cast<float>(sum);
+      dist_sq[n] = d2;
+      if (static_cast<int>(mt_load<float, T>(y[n]))) {  // similar pairs
+        loss[n] = d2;
+      } else if (legacy_version) {
+        loss[n] = max(margin - d2, 0.F);
       } else {
-        float dist = std::max<float>(margin - sqrt(dist_sq_.cpu_data()[i]), 0.F);
-        loss += dist*dist;
+        const float mdist = max(margin - sqrt(d2), 0.F);
+        loss[n] = mdist * mdist;
       }
     }
   }
-  loss = loss / bottom[0]->num() / 2.F;
-  top[0]->mutable_cpu_data<Ftype>()[0] = loss;
 }
 
-template <typename Dtype>
-__global__ void CLLBackward(const int count, const int channels,
-    const float margin, const bool legacy_version, const float alpha,
-    const Dtype* y, const Dtype* diff, const Dtype* dist_sq,
-    Dtype *bottom_diff) {
+// da = alpha * g(a - b) and db = -da, either one may be null
+template <typename T, typename A>
+__global__ void ContrastiveLossBackwardGPU(const int count, const int channels,
+    const float margin, const bool legacy_version, const A alpha, const T* a, const T* b,
+    const T* y, const float* dist_sq, T* da, T* db) {
   CUDA_KERNEL_LOOP(i, count) {
-    int n = i / channels;  // the num index, to access y and dist_sq
-    if (static_cast<int>(y[n])) {  // similar pairs
-      bottom_diff[i] = alpha * diff[i];
-    } else {  // dissimilar pairs
-      float mdist(0.0);
-      float beta(0.0);
-      if (legacy_version) {
-        mdist = (margin - dist_sq[n]);
-        beta = -alpha;
-      } else {
-        float dist = sqrt(dist_sq[n]);
-        mdist = (margin - dist);
-        beta = -alpha * mdist / (dist + 1e-4F) * diff[i];
+    const int n = i / channels;  // the num index, to access y and dist_sq
+    const A diff = mt_load<A, T>(a[i]) - mt_load<A, T>(b[i]);
+    A g = A(0);
+    if (static_cast<int>(mt_load<float, T>(y[n]))) {  // similar pairs
+      g = alpha * diff;
+    } else if (legacy_version) {
+      if (margin - dist_sq[n] > 0.F) {
+        g = -alpha * diff;
       }
-      if (mdist > 0.0) {
-        bottom_diff[i] = beta;
-      } else {
-        bottom_diff[i] = 0;
+    } else {
+      const float dist = sqrt(dist_sq[n]);
+      const float mdist = margin - dist;
+      if (mdist > 0.F) {
+        g = -alpha * A(mdist / (dist + 1e-4F)) * diff;
       }
     }
+    if (da != nullptr) {
+      da[i] = mt_store<T, A>(g);
+    }
+    if (db != nullptr) {
+      db[i] = mt_store<T, A>(-g);
+    }
   }
 }
 
+template <typename Ftype, typename Btype>
+void ContrastiveLossLayer<Ftype, Btype>::Forward_gpu(
+    const vector<Blob*>& bottom, const vector<Blob*>& top) {
+  typedef typename MultiTensorType<Ftype>::type T;
+  typedef typename MultiTensorAcc<Ftype>::type A;
+  const int num = bottom[0]->num();
+  const float margin = this->layer_param_.contrastive_loss_param().margin();
+  const bool legacy_version = this->layer_param_.contrastive_loss_param().legacy_version();
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  ContrastiveLossForwardGPU<T, A><<<std::min(num, 65535), CONTRASTIVE_LOSS_THREADS,
+      0, stream>>>(num, bottom[0]->channels(),
+      reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>()),
+      reinterpret_cast<const T*>(bottom[1]->gpu_data<Ftype>()),
+      reinterpret_cast<const T*>(bottom[2]->gpu_data<Ftype>()), margin, legacy_version,
+      dist_sq_.mutable_gpu_data(), this->loss_partials(num));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+  const float loss = this->loss_partials_sum() / num / 2.F;
+  top[0]->mutable_cpu_data<Ftype>()[0] = loss;
+}
+
 template <typename Ftype, typename Btype>
 void ContrastiveLossLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
-  cudaStream_t stream = Caffe::thread_stream();
-  for (int i = 0; i < 2; ++i) {
-    if (propagate_down[i]) {
-      const int count = bottom[0]->count();
-      const int channels = bottom[0]->channels();
-      float margin = this->layer_param_.contrastive_loss_param().margin();
-      const bool legacy_version =
-          this->layer_param_.contrastive_loss_param().legacy_version();
-      const float sign = (i == 0) ? 1 : -1;
-      const float alpha = sign * top[0]->cpu_diff<Btype>()[0] /
-          bottom[0]->num();
-      // NOLINT_NEXT_LINE(whitespace/operators)
-      CLLBackward<Btype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
-          count, channels, margin, legacy_version, alpha,
-          bottom[2]->gpu_data<Btype>(),  // pair similarity 0 or 1
-          diff_.template gpu_data<Btype>(),  // the cached eltwise difference between a and b
-          dist_sq_.template gpu_data<Btype>(),  // the cached square distance between a and b
-          bottom[i]->mutable_gpu_diff<Btype>());
-      CUDA_POST_KERNEL_CHECK;
-      CUDA_CHECK(cudaStreamSynchronize(stream));
-    }
+  if (!propagate_down[0] && !propagate_down[1]) {
+    return;
   }
+  typedef typename MultiTensorType<Btype>::type T;
+  typedef typename MultiTensorAcc<Btype>::type A;
+  const int count = bottom[0]->count();
+  const float margin = this->layer_param_.contrastive_loss_param().margin();
+  const bool legacy_version = this->layer_param_.contrastive_loss_param().legacy_version();
+  const float alpha = static_cast<float>(top[0]->cpu_diff<Btype>()[0]) / bottom[0]->num();
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  ContrastiveLossBackwardGPU<T, A><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS,
+      0, stream>>>(count, bottom[0]->channels(), margin, legacy_version, A(alpha),
+      reinterpret_cast<const T*>(bottom[0]->gpu_data<Btype>()),
+      reinterpret_cast<const T*>(bottom[1]->gpu_data<Btype>()),
+      reinterpret_cast<const T*>(bottom[2]->gpu_data<Btype>()), dist_sq_.gpu_data(),
+      propagate_down[0] ? reinterpret_cast<T*>(bottom[0]->mutable_gpu_diff<Btype>()) : nullptr,
+      propagate_down[1] ? reinterpret_cast<T*>(bottom[1]->mutable_gpu_diff<Btype>()) : nullptr);
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(ContrastiveLossLayer);
@@ -28,6 +28,12 @@ void ConvolutionLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
   for (int i = 0; i < bottom.size(); ++i) {
     const Ftype* bottom_data = bottom[i]->cpu_data<Ftype>();
     Ftype* top_data = top[i]->mutable_cpu_data<Ftype>();
+    if (this->quantized_) {
+      for (int n = 0; n < this->num_; ++n) {
+        this->forward_cpu_int8(bottom_data + n * this->bottom_dim_, top_data + n * this->top_dim_);
+      }
+      continue;
+    }
     for (int n = 0; n < this->num_; ++n) {
       this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
           top_data + n * this->top_dim_);
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layers/conv_layer.hpp"
@@ -11,6 +12,24 @@ void ConvolutionLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
   for (int i = 0; i < bottom.size(); ++i) {
     const Ftype* bottom_data = bottom[i]->gpu_data<Ftype>();
     Ftype* top_data = top[i]->mutable_gpu_data<Ftype>();
+    if (this->quantized_) {
+      for (int n = 0; n < this->num_; ++n) {
+        this->forward_gpu_int8(bottom_data + n * this->bottom_dim_, top_data + n * this->top_dim_);
+      }
+      continue;
+    }
+    Ftype* ws = this->template gemm_workspace<Ftype>();
+    if (ws != nullptr) {
+      for (int n = 0; n < this->num_; n += this->gemm_batch_) {
+        this->forward_gpu_gemm_batched(bottom_data + n * this->bottom_dim_, this->bottom_dim_,
+            weight, top_data + n * this->top_dim_, this->top_dim_,
+            std::min(this->gemm_batch_, this->num_ - n), ws);
+      }
+      if (this->bias_term_) {
+        this->forward_gpu_bias_batched(top_data, this->blobs_[1]->template gpu_data<Ftype>());
+      }
+      continue;
+    }
     for (int n = 0; n < this->num_; ++n) {
       this->forward_gpu_gemm(bottom_data + n * this->bottom_dim_, weight,
           top_data + n * this->top_dim_);
@@ -40,7 +59,20 @@ void ConvolutionLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     if (this->param_propagate_down_[0] || propagate_down[i]) {
       const Btype* bottom_data = bottom[i]->gpu_data<Btype>();
       Btype* bottom_diff = bottom[i]->mutable_gpu_diff<Btype>();
-      for (int n = 0; n < this->num_; ++n) {
+      Btype* ws = this->template gemm_workspace<Btype>();
+      for (int n = 0; ws != nullptr && n < this->num_; n += this->gemm_batch_) {
+        const int images = std::min(this->gemm_batch_, this->num_ - n);
+        if (this->param_propagate_down_[0]) {
+          this->weight_gpu_gemm_batched(bottom_data + n * this->bottom_dim_,
+              this->bottom_dim_, top_diff + n * this->top_dim_, this->top_dim_, weight_diff,
+              images, ws);
+        }
+        if (propagate_down[i]) {
+          this->backward_gpu_gemm_batched(top_diff + n * this->top_dim_, this->top_dim_,
+              weight, bottom_diff + n * this->bottom_dim_, this->bottom_dim_, images, ws);
+        }
+      }
+      for (int n = 0; ws == nullptr && n < this->num_; ++n) {
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
           this->weight_gpu_gemm(bottom_data + n * this->bottom_dim_,
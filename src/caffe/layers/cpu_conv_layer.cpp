@@ -0,0 +1,287 @@
+#include <vector>
+
+#include "caffe/layers/cpu_conv_layer.hpp"
+#include "caffe/util/cpu_parallel.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+namespace {
+
+// Transform matrices of F(2x2, 3x3) and F(4x4, 3x3) (Lavin and Gray), row-major
+const double BT2[] = {
+  1,  0, -1,  0,
+  0,  1,  1,  0,
+  0, -1,  1,  0,
+  0,  1,  0, -1};
+const double G2[] = {
+  1,    0,   0,
+  0.5,  0.5, 0.5,
+  0.5, -0.5, 0.5,
+  0,    0,   1};
+const double AT2[] = {
+  1, 1,  1,  0,
+  0, 1, -1, -1};
+const double BT4[] = {
+  4,  0, -5,  0, 1, 0,
+  0, -4, -4,  1, 1, 0,
+  0,  4, -4, -1, 1, 0,
+  0, -2, -1,  2, 1, 0,
+  0,  2, -1, -2, 1, 0,
+  0,  4,  0, -5, 0, 1};
+const double G4[] = {
+  1. / 4.,   0.,        0.,
+  -1. / 6., -1. / 6.,  -1. / 6.,
+  -1. / 6.,  1. / 6.,  -1. / 6.,
+  1. / 24.,  1. / 12.,  1. / 6.,
+  1. / 24., -1. / 12.,  1. / 6.,
+  0.,        0.,        1.};
+const double AT4[] = {
+  1, 1,  1, 1,  1, 0,
+  0, 1, -1, 2, -2, 0,
+  0, 1,  1, 4,  4, 0,
+  0, 1, -1, 8, -8, 1};
+
+// Largest alpha = m + 2
+constexpr int MAX_ALPHA = 6;
+
+template <typename T>
+vector<T> small_matrix(const double* m, int rows, int cols, bool transpose) {
+  vector<T> out(rows * cols);
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < cols; ++j) {
+      out[transpose ? j * rows + i : i * cols + j] = static_cast<T>(m[i * cols + j]);
+    }
+  }
+  return out;
+}
+
+// out (r x c) = a (r x n) * b (n x c)
+template <typename T>
+inline void small_gemm(int r, int n, int c, const T* a, const T* b, T* out) {
+  for (int i = 0; i < r; ++i) {
+    for (int j = 0; j < c; ++j) {
+      T sum = static_cast<T>(0.F);
+      for (int k = 0; k < n; ++k) {
+        sum += a[i * n + k] * b[k * c + j];
+      }
+      out[i * c + j] = sum;
+    }
+  }
+}
+
+}  // namespace
+
+template <typename Ftype, typename Btype>
+void CPUConvolutionLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  ConvolutionLayer<Ftype, Btype>::Reshape(bottom, top);
+  const Algo previous = algo_;
+  algo_ = IM2COL;
+  if (this->quantized_ || this->num_spatial_axes_ != 2 || this->channel_axis_ != 1 ||
+      tp<Ftype>() == FLOAT16) {
+    return;
+  }
+  const int* kernel = this->kernel_shape_.cpu_data();
+  const int* stride = this->stride_.cpu_data();
+  const int* dilation = this->dilation_.cpu_data();
+  if (this->group_ == this->channels_ && this->num_output_ == this->group_) {
+    algo_ = DEPTHWISE;
+  } else if (this->group_ == 1 && kernel[0] == 3 && kernel[1] == 3 && stride[0] == 1 &&
+      stride[1] == 1 && dilation[0] == 1 && dilation[1] == 1) {
+    const int out_h = this->output_shape_[0];
+    const int out_w = this->output_shape_[1];
+    tile_ = this->layer_param_.convolution_param().winograd_tile();
+    if (tile_ == 0) {
+      tile_ = out_h >= 8 && out_w >= 8 ? 4 : 2;
+    }
+    CHECK(tile_ == 2 || tile_ == 4) << "winograd_tile must be 2 or 4";
+    algo_ = WINOGRAD;
+    const int alpha = tile_ + 2;
+    tiles_h_ = (out_h + tile_ - 1) / tile_;
+    tiles_w_ = (out_w + tile_ - 1) / tile_;
+    bt_ = small_matrix<Ftype>(tile_ == 2 ? BT2 : BT4, alpha, alpha, false);
+    b_ = small_matrix<Ftype>(tile_ == 2 ? BT2 : BT4, alpha, alpha, true);
+    g_ = small_matrix<Ftype>(tile_ == 2 ? G2 : G4, alpha, 3, false);
+    gt_ = small_matrix<Ftype>(tile_ == 2 ? G2 : G4, alpha, 3, true);
+    at_ = small_matrix<Ftype>(tile_ == 2 ? AT2 : AT4, tile_, alpha, false);
+    a_ = small_matrix<Ftype>(tile_ == 2 ? AT2 : AT4, tile_, alpha, true);
+    const int tiles = tiles_h_ * tiles_w_;
+    u_.Reshape(vector<int>{alpha * alpha, this->num_output_, this->channels_});
+    v_.Reshape(vector<int>{alpha * alpha, this->channels_, tiles});
+    m_.Reshape(vector<int>{alpha * alpha, this->num_output_, tiles});
+  }
+  if (algo_ != previous) {
+    LOG(INFO) << "Layer " << this->name() << ": "
+        << (algo_ == WINOGRAD ? (tile_ == 2 ? "Winograd F(2x2, 3x3)" : "Winograd F(4x4, 3x3)")
+        : algo_ == DEPTHWISE ? "direct depthwise" : "im2col") << " CPU convolution";
+  }
+}
+
+template <typename Ftype, typename Btype>
+void CPUConvolutionLayer<Ftype, Btype>::TransformWeights() {
+  const int alpha = tile_ + 2;
+  const int filters = this->num_output_ * this->channels_;
+  const Ftype* weight = this->blobs_[0]->template cpu_data<Ftype>();
+  Ftype* u = u_.mutable_cpu_data();
+  CpuParallel::For(filters, 64, [&](int begin, int end) {
+    Ftype tmp[MAX_ALPHA * 3], out[MAX_ALPHA * MAX_ALPHA];
+    for (int f = begin; f < end; ++f) {
+      small_gemm(alpha, 3, 3, g_.data(), weight + f * 9, tmp);
+      small_gemm(alpha, 3, alpha, tmp, gt_.data(), out);
+      for (int xi = 0; xi < alpha * alpha; ++xi) {
+        u[xi * filters + f] = out[xi];
+      }
+    }
+  });
+}
+
+template <typename Ftype, typename Btype>
+void CPUConvolutionLayer<Ftype, Btype>::ForwardWinograd(const Ftype* input, Ftype* output,
+    const Ftype* bias) {
+  const int m = tile_;
+  const int alpha = m + 2;
+  const int C = this->channels_;
+  const int K = this->num_output_;
+  const int H = this->input_shape(1);
+  const int W = this->input_shape(2);
+  const int pad_h = this->pad_.cpu_data()[0];
+  const int pad_w = this->pad_.cpu_data()[1];
+  const int out_h = this->output_shape_[0];
+  const int out_w = this->output_shape_[1];
+  const int tiles = tiles_h_ * tiles_w_;
+  // V = B^T d B of every input tile d
+  Ftype* v = v_.mutable_cpu_data();
+  CpuParallel::For(C, 1, [&](int begin, int end) {
+    Ftype d[MAX_ALPHA * MAX_ALPHA], tmp[MAX_ALPHA * MAX_ALPHA], out[MAX_ALPHA * MAX_ALPHA];
+    for (int c = begin; c < end; ++c) {
+      const Ftype* in = input + c * H * W;
+      for (int th = 0; th < tiles_h_; ++th) {
+        for (int tw = 0; tw < tiles_w_; ++tw) {
+          const int row0 = th * m - pad_h;
+          const int col0 = tw * m - pad_w;
+          for (int i = 0; i < alpha; ++i) {
+            const int r = row0 + i;
+            for (int j = 0; j < alpha; ++j) {
+              const int q = col0 + j;
+              d[i * alpha + j] = r >= 0 && r < H && q >= 0 && q < W ? in[r * W + q] :
+                  static_cast<Ftype>(0.F);
+            }
+          }
+          small_gemm(alpha, alpha, alpha, bt_.data(), d, tmp);
+          small_gemm(alpha, alpha, alpha, tmp, b_.data(), out);
+          const int p = th * tiles_w_ + tw;
+          for (int xi = 0; xi < alpha * alpha; ++xi) {
+            v[(xi * C + c) * tiles + p] = out[xi];
+          }
+        }
+      }
+    }
+  });
+  // One GEMM per element of a transformed tile
+  const Ftype* u = u_.cpu_data();
+  Ftype* mm = m_.mutable_cpu_data();
+  for (int xi = 0; xi < alpha * alpha; ++xi) {
+    caffe_cpu_gemm<Ftype>(CblasNoTrans, CblasNoTrans, K, tiles, C, Ftype(1.),
+        u + xi * K * C, v + xi * C * tiles, Ftype(0.), mm + xi * K * tiles);
+  }
+  // Y = A^T M A, cropped to the output
+  CpuParallel::For(K, 1, [&](int begin, int end) {
+    Ftype mt[MAX_ALPHA * MAX_ALPHA], tmp[MAX_ALPHA * MAX_ALPHA], y[MAX_ALPHA * MAX_ALPHA];
+    for (int k = begin; k < end; ++k) {
+      const Ftype b = bias != NULL ? bias[k] : static_cast<Ftype>(0.F);
+      Ftype* out = output + k * out_h * out_w;
+      for (int th = 0; th < tiles_h_; ++th) {
+        for (int tw = 0; tw < tiles_w_; ++tw) {
+          const int p = th * tiles_w_ + tw;
+          for (int xi = 0; xi < alpha * alpha; ++xi) {
+            mt[xi] = mm[(xi * K + k) * tiles + p];
+          }
+          small_gemm(m, alpha, alpha, at_.data(), mt, tmp);
+          small_gemm(m, alpha, m, tmp, a_.data(), y);
+          for (int i = 0; i < m && th * m + i < out_h; ++i) {
+            for (int j = 0; j < m && tw * m + j < out_w; ++j) {
+              out[(th * m + i) * out_w + tw * m + j] = y[i * m + j] + b;
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+template <typename Ftype, typename Btype>
+void CPUConvolutionLayer<Ftype, Btype>::ForwardDepthwise(const Ftype* input, Ftype* output,
+    const Ftype* bias) {
+  const int C = this->channels_;
+  const int H = this->input_shape(1);
+  const int W = this->input_shape(2);
+  const int kernel_h = this->kernel_shape_.cpu_data()[0];
+  const int kernel_w = this->kernel_shape_.cpu_data()[1];
+  const int stride_h = this->stride_.cpu_data()[0];
+  const int stride_w = this->stride_.cpu_data()[1];
+  const int pad_h = this->pad_.cpu_data()[0];
+  const int pad_w = this->pad_.cpu_data()[1];
+  const int dilation_h = this->dilation_.cpu_data()[0];
+  const int dilation_w = this->dilation_.cpu_data()[1];
+  const int out_h = this->output_shape_[0];
+  const int out_w = this->output_shape_[1];
+  const Ftype* weight = this->blobs_[0]->template cpu_data<Ftype>();
+  // Every (n, c) plane is convolved with its channel's filter
+  CpuParallel::For(this->num_ * C, 1, [&](int begin, int end) {
+    for (int plane = begin; plane < end; ++plane) {
+      const int c = plane % C;
+      const Ftype* in = input + plane * H * W;
+      const Ftype* w = weight + c * kernel_h * kernel_w;
+      Ftype* out = output + plane * out_h * out_w;
+      const Ftype b = bias != NULL ? bias[c] : static_cast<Ftype>(0.F);
+      for (int oh = 0; oh < out_h; ++oh) {
+        for (int ow = 0; ow < out_w; ++ow) {
+          Ftype sum = static_cast<Ftype>(0.F);
+          for (int i = 0; i < kernel_h; ++i) {
+            const int r = oh * stride_h - pad_h + i * dilation_h;
+            if (r < 0 || r >= H) {
+              continue;
+            }
+            for (int j = 0; j < kernel_w; ++j) {
+              const int q = ow * stride_w - pad_w + j * dilation_w;
+              if (q >= 0 && q < W) {
+                sum += w[i * kernel_w + j] * in[r * W + q];
+              }
+            }
+          }
+          out[oh * out_w + ow] = sum + b;
+        }
+      }
+    }
+  });
+}
+
+template <typename Ftype, typename Btype>
+void CPUConvolutionLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  if (algo_ == IM2COL) {
+    ConvolutionLayer<Ftype, Btype>::Forward_cpu(bottom, top);
+    return;
+  }
+  const Ftype* bias = this->bias_term_ ? this->blobs_[1]->template cpu_data<Ftype>() : NULL;
+  if (algo_ == WINOGRAD) {
+    TransformWeights();
+  }
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Ftype* bottom_data = bottom[i]->cpu_data<Ftype>();
+    Ftype* top_data = top[i]->mutable_cpu_data<Ftype>();
+    if (algo_ == DEPTHWISE) {
+      ForwardDepthwise(bottom_data, top_data, bias);
+      continue;
+    }
+    for (int n = 0; n < this->num_; ++n) {
+      ForwardWinograd(bottom_data + n * this->bottom_dim_, top_data + n * this->top_dim_,
+          bias);
+    }
+  }
+}
+
+INSTANTIATE_CLASS_FB(CPUConvolutionLayer);
+
+}  // namespace caffe
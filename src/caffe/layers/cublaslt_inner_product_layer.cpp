@@ -0,0 +1,40 @@
+#include <vector>
+
+#include "caffe/layers/cublaslt_inner_product_layer.hpp"
+
+namespace caffe {
+
+#ifdef CAFFE_CUBLASLT
+
+template <typename Ftype, typename Btype>
+CuBLASLtInnerProductLayer<Ftype, Btype>::~CuBLASLtInnerProductLayer() {
+  for (auto& entry : plans_) {
+    Plan& plan = entry.second;
+    cublasLtMatrixLayoutDestroy(plan.a);
+    cublasLtMatrixLayoutDestroy(plan.b);
+    cublasLtMatrixLayoutDestroy(plan.d);
+    cublasLtMatmulDescDestroy(plan.desc);
+  }
+}
+
+template <typename Ftype, typename Btype>
+cublasLtEpilogue_t CuBLASLtInnerProductLayer<Ftype, Btype>::ForwardEpilogue() const {
+  const bool bias = this->bias_term_;
+  switch (this->activation_) {
+    case InnerProductParameter_Activation_RELU:
+      return bias ? CUBLASLT_EPILOGUE_RELU_BIAS : CUBLASLT_EPILOGUE_RELU;
+#if CUDA_VERSION >= 11040
+    case InnerProductParameter_Activation_GELU:
+      return bias ? CUBLASLT_EPILOGUE_GELU_AUX_BIAS : CUBLASLT_EPILOGUE_GELU_AUX;
+#endif
+    default:
+      // GELU without its epilogue is applied after the matmul
+      return bias ? CUBLASLT_EPILOGUE_BIAS : CUBLASLT_EPILOGUE_DEFAULT;
+  }
+}
+
+INSTANTIATE_CLASS_FB(CuBLASLtInnerProductLayer);
+
+#endif
+
+}  // namespace caffe
@@ -0,0 +1,193 @@
+#include <vector>
+
+#include "caffe/layers/cublaslt_inner_product_layer.hpp"
+#include "caffe/util/gpu_memory.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+#ifdef CAFFE_CUBLASLT
+
+// A cuBLAS handle is a cuBLASLt one
+static cublasLtHandle_t cublaslt_handle() {
+  return reinterpret_cast<cublasLtHandle_t>(Caffe::cublas_handle());
+}
+
+template <typename Ftype, typename Btype>
+template <typename Dtype>
+const typename CuBLASLtInnerProductLayer<Ftype, Btype>::Plan&
+CuBLASLtInnerProductLayer<Ftype, Btype>::GetPlan(Pass pass, cublasLtEpilogue_t epilogue) {
+  const std::tuple<int, int, int> key(pass, this->M_, epilogue);
+  auto it = plans_.find(key);
+  if (it != plans_.end()) {
+    return it->second;
+  }
+  Plan& plan = plans_[key];
+  const bool dbl = is_type<Dtype>(DOUBLE);
+  const cudaDataType_t type = dbl ? CUDA_R_64F : is_type<Dtype>(FLOAT16) ? CUDA_R_16F : CUDA_R_32F;
+  // FLOAT16 accumulates in FLOAT on tensor ops
+  CUBLAS_CHECK(cublasLtMatmulDescCreate(&plan.desc, dbl ? CUBLAS_COMPUTE_64F : CUBLAS_COMPUTE_32F,
+      dbl ? CUDA_R_64F : CUDA_R_32F));
+  // Caffe's row major matrices are their transposes in column major
+  const int M = this->M_, N = this->N_, K = this->K_;
+  cublasOperation_t trans_a = CUBLAS_OP_N, trans_b = CUBLAS_OP_N;
+  if (pass == FORWARD) {
+    // Y^T (N x M) = W^T X^T
+    trans_a = this->transpose_ ? CUBLAS_OP_N : CUBLAS_OP_T;
+    CUBLAS_CHECK(this->transpose_ ? cublasLtMatrixLayoutCreate(&plan.a, type, N, K, N) :
+        cublasLtMatrixLayoutCreate(&plan.a, type, K, N, K));
+    CUBLAS_CHECK(cublasLtMatrixLayoutCreate(&plan.b, type, K, M, K));
+    CUBLAS_CHECK(cublasLtMatrixLayoutCreate(&plan.d, type, N, M, N));
+  } else if (!this->transpose_) {
+    // dW^T (K x N) = X^T dY
+    trans_b = CUBLAS_OP_T;
+    CUBLAS_CHECK(cublasLtMatrixLayoutCreate(&plan.a, type, K, M, K));
+    CUBLAS_CHECK(cublasLtMatrixLayoutCreate(&plan.b, type, N, M, N));
+    CUBLAS_CHECK(cublasLtMatrixLayoutCreate(&plan.d, type, K, N, K));
+  } else {
+    // dW^T (N x K) = dY^T X
+    trans_b = CUBLAS_OP_T;
+    CUBLAS_CHECK(cublasLtMatrixLayoutCreate(&plan.a, type, N, M, N));
+    CUBLAS_CHECK(cublasLtMatrixLayoutCreate(&plan.b, type, K, M, K));
+    CUBLAS_CHECK(cublasLtMatrixLayoutCreate(&plan.d, type, N, K, N));
+  }
+  CUBLAS_CHECK(cublasLtMatmulDescSetAttribute(plan.desc, CUBLASLT_MATMUL_DESC_TRANSA,
+      &trans_a, sizeof(trans_a)));
+  CUBLAS_CHECK(cublasLtMatmulDescSetAttribute(plan.desc, CUBLASLT_MATMUL_DESC_TRANSB,
+      &trans_b, sizeof(trans_b)));
+  CUBLAS_CHECK(cublasLtMatmulDescSetAttribute(plan.desc, CUBLASLT_MATMUL_DESC_EPILOGUE,
+      &epilogue, sizeof(epilogue)));
+#if CUDA_VERSION >= 11040
+  if (epilogue == CUBLASLT_EPILOGUE_GELU_AUX || epilogue == CUBLASLT_EPILOGUE_GELU_AUX_BIAS) {
+    const int64_t aux_ld = N;  // GELU input is shaped like the output
+    CUBLAS_CHECK(cublasLtMatmulDescSetAttribute(plan.desc,
+        CUBLASLT_MATMUL_DESC_EPILOGUE_AUX_LD, &aux_ld, sizeof(aux_ld)));
+  }
+#endif
+  cublasLtMatmulPreference_t preference;
+  CUBLAS_CHECK(cublasLtMatmulPreferenceCreate(&preference));
+  const size_t max_workspace = WORKSPACE_SIZE;
+  CUBLAS_CHECK(cublasLtMatmulPreferenceSetAttribute(preference,
+      CUBLASLT_MATMUL_PREF_MAX_WORKSPACE_BYTES, &max_workspace, sizeof(max_workspace)));
+  cublasLtMatmulHeuristicResult_t result;
+  int found = 0;
+  const cublasStatus_t status = cublasLtMatmulAlgoGetHeuristic(cublaslt_handle(), plan.desc,
+      plan.a, plan.b, plan.d, plan.d, preference, 1, &result, &found);
+  CUBLAS_CHECK(cublasLtMatmulPreferenceDestroy(preference));
+  plan.supported = status == CUBLAS_STATUS_SUCCESS && found > 0;
+  plan.workspace = plan.supported ? result.workspaceSize : 0UL;
+  if (plan.supported) {
+    plan.algo = result.algo;
+  } else {
+    LOG(INFO) << this->print_current_device() << " Layer '" << this->name() << "': no cuBLASLt "
+              << (pass == FORWARD ? "forward" : "weight gradient") << " algorithm for batch "
+              << M << ", epilogue " << epilogue << ", using InnerProduct's";
+  }
+  return plan;
+}
+
+template <typename Ftype, typename Btype>
+template <typename Dtype>
+void CuBLASLtInnerProductLayer<Ftype, Btype>::Matmul(const Plan& plan, const Dtype* a,
+    const Dtype* b, Dtype* d, float beta, const void* bias, void* aux) {
+  if (bias != nullptr) {
+    CUBLAS_CHECK(cublasLtMatmulDescSetAttribute(plan.desc, CUBLASLT_MATMUL_DESC_BIAS_POINTER,
+        &bias, sizeof(bias)));
+  }
+  if (aux != nullptr) {
+    CUBLAS_CHECK(cublasLtMatmulDescSetAttribute(plan.desc,
+        CUBLASLT_MATMUL_DESC_EPILOGUE_AUX_POINTER, &aux, sizeof(aux)));
+  }
+  void* workspace = nullptr;
+  if (plan.workspace > 0UL) {
+    shared_ptr<GPUMemory::Workspace> ws = GPUMemory::thread_workspace(Caffe::current_device());
+    ws->reserve(plan.workspace);
+    workspace = ws->data();
+  }
+  // Scaling factors are of the compute type
+  const float alpha32 = 1.F, beta32 = beta;
+  const double alpha64 = 1., beta64 = beta;
+  const bool dbl = is_type<Dtype>(DOUBLE);
+  cudaStream_t stream = Caffe::thread_stream();
+  CUBLAS_CHECK(cublasLtMatmul(cublaslt_handle(), plan.desc,
+      dbl ? static_cast<const void*>(&alpha64) : static_cast<const void*>(&alpha32),
+      a, plan.a, b, plan.b,
+      dbl ? static_cast<const void*>(&beta64) : static_cast<const void*>(&beta32),
+      d, plan.d, d, plan.d, &plan.algo, workspace, plan.workspace, stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template <typename Ftype, typename Btype>
+void CuBLASLtInnerProductLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  const cublasLtEpilogue_t epilogue = ForwardEpilogue();
+  const Plan& plan = GetPlan<Ftype>(FORWARD, epilogue);
+  if (!plan.supported) {
+    InnerProductLayer<Ftype, Btype>::Forward_gpu(bottom, top);
+    return;
+  }
+  Ftype* top_data = top[0]->mutable_gpu_data<Ftype>();
+  const bool fused_activation =
+      epilogue != CUBLASLT_EPILOGUE_BIAS && epilogue != CUBLASLT_EPILOGUE_DEFAULT;
+  const bool gelu = fused_activation &&
+      this->activation_ == InnerProductParameter_Activation_GELU;
+  Matmul<Ftype>(plan, this->blobs_[0]->template gpu_data<Ftype>(), bottom[0]->gpu_data<Ftype>(),
+      top_data, 0.F, this->bias_term_ ? this->blobs_[1]->template gpu_data<Ftype>() : nullptr,
+      gelu ? this->pre_activation_->template mutable_gpu_data<Ftype>() : nullptr);
+  if (!fused_activation) {
+    this->ActivationForward_gpu(top_data);
+  }
+}
+
+template <typename Ftype, typename Btype>
+void CuBLASLtInnerProductLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
+    const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  const bool bias_gradient = this->bias_term_ && this->param_propagate_down_[1];
+  cublasLtEpilogue_t epilogue = CUBLASLT_EPILOGUE_DEFAULT;
+#if CUDA_VERSION >= 11040
+  // The bias gradient epilogue writes it, it can't add to it
+  if (bias_gradient && this->overwrite_param_diffs_) {
+    epilogue = this->transpose_ ? CUBLASLT_EPILOGUE_BGRADA : CUBLASLT_EPILOGUE_BGRADB;
+  }
+#endif
+  const Plan* plan = nullptr;
+  if (this->param_propagate_down_[0]) {
+    plan = &GetPlan<Btype>(WEIGHT_GRADIENT, epilogue);
+    if (!plan->supported) {
+      InnerProductLayer<Ftype, Btype>::Backward_gpu(top, propagate_down, bottom);
+      return;
+    }
+  }
+  const Btype beta = this->overwrite_param_diffs_ ? (Btype) 0. : (Btype) 1.;
+  const Btype* top_diff = this->ActivationBackward_gpu(top[0]);
+  const Btype* bottom_data = bottom[0]->gpu_data<Btype>();
+  Btype* bias_diff = bias_gradient ? this->blobs_[1]->template mutable_gpu_diff<Btype>() : nullptr;
+  if (plan != nullptr) {
+    const bool fused_bias = epilogue != CUBLASLT_EPILOGUE_DEFAULT;
+    Matmul<Btype>(*plan, this->transpose_ ? top_diff : bottom_data,
+        this->transpose_ ? bottom_data : top_diff,
+        this->blobs_[0]->template mutable_gpu_diff<Btype>(), beta,
+        fused_bias ? bias_diff : nullptr, nullptr);
+    if (fused_bias) {
+      bias_diff = nullptr;
+    }
+  }
+  if (bias_diff != nullptr) {
+    // dB (c) = sum_N(dY(n, c))
+    caffe_gpu_gemv<Btype>(CblasTrans, this->M_, this->N_, (Btype)1., top_diff,
+        this->bias_multiplier_->template gpu_data<Btype>(), beta, bias_diff);
+  }
+  if (propagate_down[0]) {
+    // dE/dX = dE/dY * W
+    caffe_gpu_gemm<Btype>(CblasNoTrans, this->transpose_ ? CblasTrans : CblasNoTrans,
+        this->M_, this->K_, this->N_, (Btype)1., top_diff,
+        this->blobs_[0]->template gpu_data<Btype>(), (Btype)0.,
+        bottom[0]->mutable_gpu_diff<Btype>());
+  }
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS_FB(CuBLASLtInnerProductLayer);
+
+#endif
+
+}  // namespace caffe
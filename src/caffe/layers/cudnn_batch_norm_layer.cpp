@@ -60,10 +60,10 @@ CuDNNBatchNormLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom, const ve
   int H = bottom[0]->height();
   int W = bottom[0]->width();
   // set up main tensors
-  cudnn::setTensor4dDesc<Ftype>(&fwd_bottom_desc_, N, C, H, W);
-  cudnn::setTensor4dDesc<Ftype>(&fwd_top_desc_, N, C, H, W);
-  cudnn::setTensor4dDesc<Btype>(&bwd_bottom_desc_, N, C, H, W);
-  cudnn::setTensor4dDesc<Btype>(&bwd_top_desc_, N, C, H, W);
+  cudnn::setTensor4dDesc<Ftype>(&fwd_bottom_desc_, N, C, H, W, bottom[0]->packing());
+  cudnn::setTensor4dDesc<Ftype>(&fwd_top_desc_, N, C, H, W, bottom[0]->packing());
+  cudnn::setTensor4dDesc<Btype>(&bwd_bottom_desc_, N, C, H, W, bottom[0]->packing());
+  cudnn::setTensor4dDesc<Btype>(&bwd_top_desc_, N, C, H, W, bottom[0]->packing());
   // aux tensors for caching mean & invVar from fwd to bwd pass
   save_mean_->Reshape(1, C, 1, 1);
   save_inv_var_->Reshape(1, C, 1, 1);
@@ -83,7 +83,7 @@ void CuDNNBatchNormLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
   } else {
     LOG(FATAL) << "Unknown phase";
   }
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 
   if (top[0] == bottom[0]) {
     private_bottom_->CopyDataFrom(*bottom[0]);
@@ -146,7 +146,7 @@ void CuDNNBatchNormLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
       bwd_bottom_desc_, bottom_data, bwd_bottom_desc_, top_diff, bwd_bottom_desc_, bottom_diff,
       bwd_scale_bias_mean_var_desc_, scale_data, scale_diff, bias_diff,
       epsilon, save_mean, save_inv_var));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(CuDNNBatchNormLayer);
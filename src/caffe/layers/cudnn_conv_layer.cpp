@@ -8,6 +8,8 @@
 #include "caffe/filler.hpp"
 #include "caffe/layers/cudnn_conv_layer.hpp"
 #include "caffe/solver.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/cudnn_algo_cache.hpp"
 
 namespace caffe {
 
@@ -27,6 +29,17 @@ void createFilterDesc(cudnnFilterDescriptor_t* desc, int n, int c, int h, int w)
       CUDNN_TENSOR_NCHW, n, c, h, w));
 }
 
+// One group's view of a tensor with total_c channels
+template <typename Dtype>
+void setConvTensorDesc(cudnnTensorDescriptor_t* desc, Packing packing,
+    int n, int c, int h, int w, int total_c) {
+  if (packing == NHWC) {
+    cudnn::setTensor4dDesc<Dtype>(desc, n, c, h, w, total_c * h * w, 1, w * total_c, total_c);
+  } else {
+    cudnn::setTensor4dDesc<Dtype>(desc, n, c, h, w, total_c * h * w, h * w, w, 1);
+  }
+}
+
 void setConvolutionDesc(Type math, cudnnConvolutionDescriptor_t conv,
     int pad_h, int pad_w, int stride_h, int stride_w) {
   int padA[2] = {pad_h, pad_w};
@@ -54,6 +67,45 @@ void setConvolutionDescMath(Type math, cudnnConvolutionDescriptor_t conv) {
       cudnn::cudnn_data_type(math)));
 }
 
+// FindEx results for CuDNNWorkspaceArbiter. Time covers all calls of a pass,
+// memory covers all groups sharing the workspace
+template <typename Perf>
+void collectCandidates(const Perf* results, int count, int math_override, int calls,
+    int ws_groups, vector<CuDNNWorkspaceArbiter::Candidate>* cands) {
+  cands->clear();
+  for (int k = 0; k < count; ++k) {
+    if (results[k].status != CUDNN_STATUS_SUCCESS) {
+      continue;
+    }
+    CuDNNWorkspaceArbiter::Candidate c;
+    c.algo = static_cast<int>(results[k].algo);
+    c.cudnn_math = 0;
+#if CUDNN_VERSION_MIN(7, 0, 0)
+    c.cudnn_math = math_override < 0 ? results[k].mathType :
+        (math_override == 0 ? CUDNN_DEFAULT_MATH : CUDNN_TENSOR_OP_MATH);
+#endif
+    c.time = results[k].time * calls;
+    c.memory = align_up<7>(results[k].memory) * ws_groups;
+    cands->push_back(c);
+  }
+}
+
+// Caffe::deterministic: results of algorithms that may not reproduce bit for bit
+// (atomics in backward) are failed, the fastest deterministic one wins instead
+template <typename Perf>
+void dropNondeterministic(Perf* results, int count) {
+#if CUDNN_VERSION_MIN(7, 0, 0)
+  if (!Caffe::deterministic()) {
+    return;
+  }
+  for (int k = 0; k < count; ++k) {
+    if (results[k].determinism != CUDNN_DETERMINISTIC) {
+      results[k].status = CUDNN_STATUS_NOT_SUPPORTED;
+    }
+  }
+#endif
+}
+
 cudnnDataType_t convolutionDescDataType(cudnnConvolutionDescriptor_t conv) {
   int padA[2];
   int strideA[2];
@@ -77,6 +129,9 @@ void CuDNNConvolutionLayer<Ftype, Btype>::LayerSetUp(
     const vector<Blob*>& bottom, const vector<Blob*>& top) {
   GPUMemory::Init();
   ConvolutionLayer<Ftype, Btype>::LayerSetUp(bottom, top);
+  if (SetUpPadded(bottom)) {
+    return;
+  }
   // Initialize algorithm arrays
   fwd_algo_.resize(bottom.size());
   bwd_filter_algo_.resize(bottom.size());
@@ -112,6 +167,12 @@ void CuDNNConvolutionLayer<Ftype, Btype>::LayerSetUp(
   if (user_algos_override_[2] >= 0) {
     CHECK_LT(user_algos_override_[2], CUDNN_CONVOLUTION_BWD_FILTER_ALGO_COUNT) << param_err;
   }
+  algo_cache_file_ = this->layer_param().convolution_param().cudnn_algo_cache_file();
+  arbitrate_ = this->phase_ == TRAIN &&
+      this->layer_param().convolution_param().cudnn_workspace_arbitration() &&
+      this->layer_param().convolution_param().cudnn_convolution_algo_seeker() ==
+      ConvolutionParameter_CuDNNConvolutionAlgorithmSeeker_FINDEX;
+  submitted_ = false;
 
   // Initializing algorithms and workspaces
   // Do not rely on initialized algorithms (Reshape will set algorithms
@@ -249,7 +310,7 @@ void CuDNNConvolutionLayer<Ftype, Btype>::AllocateFindExWorkspace() {
   if (ws_released_[dev]) {
     return;
   }
-  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::workspace_[dev];
+  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::thread_workspace(dev);
   size_t bytes_available, bytes_total;
   GPUMemory::GetInfo(&bytes_available, &bytes_total, true);
   bytes_available = std::min(bytes_available, bytes_total / 2UL);
@@ -318,12 +379,19 @@ size_t CuDNNConvolutionLayer<Ftype, Btype>::AllocateWorkspace(size_t bottom_size
           align_up<7>(workspace_bwd_filter_sizes_[i]) * ws_groups());
       train_mem_req_all_grps_.insert_max(dev,
           align_up<7>(workspace_fwd_sizes_[i]) * ws_groups());
+      // Layers left out of arbitration (incl. restored from cache) keep their requirements.
+      // Iteration 0 defaults of arbitrated layers don't count.
+      if (!arbitrate_ || (fwd_count_ > 0UL && !submitted_)) {
+        train_fixed_mem_req_.insert_max(dev, std::max(align_up<7>(workspace_fwd_sizes_[i]),
+            std::max(align_up<7>(workspace_bwd_data_sizes_[i]),
+            align_up<7>(workspace_bwd_filter_sizes_[i]))) * ws_groups());
+      }
     } else {
       test_mem_req_all_grps_.insert_max(dev,
           align_up<7>(workspace_fwd_sizes_[i]) * ws_groups());
     }
   }
-  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::workspace_[dev];
+  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::thread_workspace(dev);
   ws->safe_reserve(this->phase_ == TRAIN ?
       train_mem_req_all_grps_[dev] : test_mem_req_all_grps_[dev]);
   return ws->size();
@@ -332,6 +400,10 @@ size_t CuDNNConvolutionLayer<Ftype, Btype>::AllocateWorkspace(size_t bottom_size
 template <typename Ftype, typename Btype>
 void CuDNNConvolutionLayer<Ftype, Btype>::Reshape(
     const vector<Blob*>& bottom, const vector<Blob*>& top) {
+  if (padded_) {
+    ReshapePadded(bottom, top);
+    return;
+  }
   // Check whether cached descriptors have been initialized.
   if (initialized_cached_descs_) {
     // Check whether bottom and conv descriptors have changed,
@@ -362,8 +434,11 @@ void CuDNNConvolutionLayer<Ftype, Btype>::Reshape(
       << "(e.g., height and width). "
       << "Use 'engine: CAFFE' for general ND convolution.";
 
-  bottom_offset_ = this->bottom_dim_ / groups();
-  top_offset_ = this->top_dim_ / groups();
+  // NHWC groups are runs of channels within each pixel
+  packing_ = bottom[0]->packing();
+  top[0]->set_packing(packing_);
+  bottom_offset_ = packing_ == NHWC ? this->channels_ / groups() : this->bottom_dim_ / groups();
+  top_offset_ = packing_ == NHWC ? this->num_output_ / groups() : this->top_dim_ / groups();
 
   const int height = bottom[0]->shape(this->channel_axis_ + 1);
   const int width = bottom[0]->shape(this->channel_axis_ + 2);
@@ -378,30 +453,22 @@ void CuDNNConvolutionLayer<Ftype, Btype>::Reshape(
 
     // Set cuDNN tensor and convolution descriptors
   for (int i = 0; i < bottom.size(); i++) {
-    cudnn::setTensor4dDesc<Ftype>(&fwd_bottom_descs_[i],
+    setConvTensorDesc<Ftype>(&fwd_bottom_descs_[i], packing_,
         this->num_,
         use_v7grouping() ? this->channels_ : this->channels_ / groups(),
-        height, width,
-        this->channels_ * height * width,
-        height * width, width, 1);
-    cudnn::setTensor4dDesc<Btype>(&bwd_bottom_descs_[i],
+        height, width, this->channels_);
+    setConvTensorDesc<Btype>(&bwd_bottom_descs_[i], packing_,
         this->num_,
         use_v7grouping() ? this->channels_ : this->channels_ / groups(),
-        height, width,
-        this->channels_ * height * width,
-        height * width, width, 1);
-    cudnn::setTensor4dDesc<Ftype>(&fwd_top_descs_[i],
+        height, width, this->channels_);
+    setConvTensorDesc<Ftype>(&fwd_top_descs_[i], packing_,
         this->num_,
         use_v7grouping() ? this->num_output_ : this->num_output_ / groups(),
-        height_out, width_out,
-        this->num_output_ * this->out_spatial_dim_,
-        this->out_spatial_dim_, width_out, 1);
-    cudnn::setTensor4dDesc<Btype>(&bwd_top_descs_[i],
+        height_out, width_out, this->num_output_);
+    setConvTensorDesc<Btype>(&bwd_top_descs_[i], packing_,
         this->num_,
         use_v7grouping() ? this->num_output_ : this->num_output_ / groups(),
-        height_out, width_out,
-        this->num_output_ * this->out_spatial_dim_,
-        this->out_spatial_dim_, width_out, 1);
+        height_out, width_out, this->num_output_);
 
     setConvolutionDesc(forward_math_, fwd_conv_descs_[i],
         pad_h, pad_w, stride_h, stride_w);
@@ -417,21 +484,56 @@ void CuDNNConvolutionLayer<Ftype, Btype>::Reshape(
         pad_h, pad_w, stride_h, stride_w);
 
     // Set cached descriptors
-    cudnn::setTensor4dDesc<Ftype>(&fwd_cached_bottom_descs_[i],
+    setConvTensorDesc<Ftype>(&fwd_cached_bottom_descs_[i], packing_,
         this->num_,
         use_v7grouping() ? this->channels_ : this->channels_ / groups(),
-        height, width,
-        this->channels_ * height * width,
-        height * width, width, 1);
-    cudnn::setTensor4dDesc<Btype>(&bwd_cached_bottom_descs_[i],
+        height, width, this->channels_);
+    setConvTensorDesc<Btype>(&bwd_cached_bottom_descs_[i], packing_,
         this->num_,
         use_v7grouping() ? this->channels_ : this->channels_ / groups(),
-        height, width,
-        this->channels_ * height * width,
-        height * width, width, 1);
+        height, width, this->channels_);
   }
   initialized_cached_descs_ = true;
 
+  // Grouped paths are timed again for new sizes
+  const int* kernel_shape = this->kernel_shape_.cpu_data();
+  const int* dilation = this->dilation_.cpu_data();
+  const GroupedConvShape shape{this->num_, this->channels_, height, width,
+      this->num_output_, height_out, width_out, this->group_, kernel_shape[0],
+      kernel_shape[1], pad_h, pad_w, stride_h, stride_w, dilation[0], dilation[1]};
+  if (shape.num != grouped_shape_.num || shape.height != grouped_shape_.height ||
+      shape.width != grouped_shape_.width) {
+    fwd_path_tuned_ = bwd_path_tuned_ = false;
+    if (retune_shapes_) {
+      use_algo_seeker_ = true;
+      retune_shapes_ = false;
+    }
+  }
+  grouped_shape_ = shape;
+  switch (this->layer_param_.convolution_param().grouped_algo()) {
+    case ConvolutionParameter_GroupedAlgo_GROUPED_DIRECT:
+      CHECK(direct_ok()) << "Layer " << this->name() << ": direct kernels need at most "
+          << GROUPED_CONV_DIRECT_MAX_CHANNELS << " channels per group";
+      fwd_path_ = bwd_data_path_ = bwd_filter_path_ = DIRECT_PATH;
+      break;
+    case ConvolutionParameter_GroupedAlgo_GROUPED_GEMM:
+      CHECK(gemm_ok()) << "Layer " << this->name()
+          << ": grouped gemm is for groups cuDNN doesn't run natively";
+      fwd_path_ = bwd_data_path_ = bwd_filter_path_ = GEMM_PATH;
+      break;
+    case ConvolutionParameter_GroupedAlgo_GROUPED_CUDNN:
+      fwd_path_ = bwd_data_path_ = bwd_filter_path_ = CUDNN_PATH;
+      break;
+    default:
+      if (!fwd_path_tuned_) {
+        fwd_path_ = CUDNN_PATH;
+      }
+      if (!bwd_path_tuned_) {
+        bwd_data_path_ = bwd_filter_path_ = CUDNN_PATH;
+      }
+      break;
+  }
+
   // Tensor descriptor for bias.
   if (this->bias_term_) {
     cudnn::setTensor4dDesc<Ftype>(&fwd_bias_desc_, 1,
@@ -458,11 +560,22 @@ void CuDNNConvolutionLayer<Ftype, Btype>::Reshape(
     }
     switch (this->layer_param_.convolution_param().cudnn_convolution_algo_seeker()) {
       case ConvolutionParameter_CuDNNConvolutionAlgorithmSeeker_GET:
-        GetConvAlgo(bottom, top, workspace_bytes, pad_h, pad_w, stride_h, stride_w);
-        AllocateWorkspace(bottom.size());
+        if (!RestoreConvAlgosFromCache(bottom, "GET", workspace_bytes)) {
+          GetConvAlgo(bottom, top, workspace_bytes, pad_h, pad_w, stride_h, stride_w);
+          AllocateWorkspace(bottom.size());
+          StoreConvAlgosToCache(bottom, "GET", workspace_bytes);
+        }
         break;
       case ConvolutionParameter_CuDNNConvolutionAlgorithmSeeker_FINDEX:
         if (!use_modest_workspace()) {
+          // FindEx space is taken from what's left on the device, thus its limit
+          // is keyed by the total amount of device memory.
+          size_t available_memory, total_memory;
+          GPUMemory::GetInfo(&available_memory, &total_memory, true);
+          if (RestoreConvAlgosFromCache(bottom, "FINDEX", total_memory)) {
+            use_algo_seeker_ = false;
+            break;
+          }
           if (this->phase_ == TRAIN) {
             // Now taking the rest for running FindEx calls
             // We'll release what's possible in BW pass
@@ -470,6 +583,7 @@ void CuDNNConvolutionLayer<Ftype, Btype>::Reshape(
           }
           // Also used by Test Net but based on shared space taken by Train:
           FindExConvAlgo(bottom, top);
+          StoreConvAlgosToCache(bottom, "FINDEX", total_memory);
           use_algo_seeker_ = false;
         }
         break;
@@ -480,11 +594,16 @@ void CuDNNConvolutionLayer<Ftype, Btype>::Reshape(
 
   if (ok_to_release() && this->phase_ == TRAIN) {
     const int dev = Caffe::current_device();
-    shared_ptr<GPUMemory::Workspace> ws = GPUMemory::workspace_[dev];
+    shared_ptr<GPUMemory::Workspace> ws = GPUMemory::thread_workspace(dev);
+    if (submitted_) {
+      ApplyArbitration(bottom);
+    }
     if (!ws_released_[dev] && ws_allocated_[dev] > 0UL) {
       // Housekeeping: release excessive amount of device memory after FindEx calls
-      size_t mem_req = align_up<7>(std::max(train_mem_req_all_grps_[dev],
-          test_mem_req_all_grps_[dev]) + PAGE_SIZE);
+      const size_t train_req = arbitrated_mem_req_[dev] > 0UL ?
+          std::max(arbitrated_mem_req_[dev], train_fixed_mem_req_[dev]) :
+          train_mem_req_all_grps_[dev];
+      size_t mem_req = align_up<7>(std::max(train_req, test_mem_req_all_grps_[dev]) + PAGE_SIZE);
       if (mem_req > 0UL && ws->size() > mem_req) {
         // Winner needs half less - release the rest
         LOG(INFO) << this->print_current_device()
@@ -500,6 +619,118 @@ void CuDNNConvolutionLayer<Ftype, Btype>::Reshape(
   }
 }
 
+template <typename Ftype, typename Btype>
+vector<typename CuDNNConvolutionLayer<Ftype, Btype>::GroupedPath>
+CuDNNConvolutionLayer<Ftype, Btype>::grouped_candidates() const {
+  vector<GroupedPath> paths(1, CUDNN_PATH);
+  if (direct_ok()) {
+    paths.push_back(DIRECT_PATH);
+  }
+  if (gemm_ok()) {
+    paths.push_back(GEMM_PATH);
+  }
+  return paths;
+}
+
+template <typename Ftype, typename Btype>
+void* CuDNNConvolutionLayer<Ftype, Btype>::col_space(bool reserve) {
+  if (reserve) {
+    const GroupedConvShape& s = grouped_shape_;
+    col_space_.reserve(static_cast<size_t>(s.channels) * s.kernel_h * s.kernel_w *
+        s.height_out * s.width_out * std::max(sizeof(Ftype), sizeof(Btype)));
+  }
+  return col_space_.data();
+}
+
+template <typename Ftype, typename Btype>
+size_t CuDNNConvolutionLayer<Ftype, Btype>::workspace_bytes() const {
+  if (padded_) {
+    return padded_->workspace_bytes();
+  }
+  size_t bytes = 0UL;
+  for (size_t i = 0; i < workspace_fwd_sizes_.size(); ++i) {
+    bytes = std::max(bytes, workspace_fwd_sizes_[i]);
+  }
+  for (size_t i = 0; i < workspace_bwd_data_sizes_.size(); ++i) {
+    bytes = std::max(bytes, workspace_bwd_data_sizes_[i]);
+  }
+  for (size_t i = 0; i < workspace_bwd_filter_sizes_.size(); ++i) {
+    bytes = std::max(bytes, workspace_bwd_filter_sizes_[i]);
+  }
+  return bytes * ws_groups() + col_space_.size();
+}
+
+template <typename Ftype, typename Btype>
+typename CuDNNConvolutionLayer<Ftype, Btype>::GroupedPath
+CuDNNConvolutionLayer<Ftype, Btype>::FastestPath(const char* pass,
+    const std::function<void(GroupedPath)>& run) {
+  static const char* names[] = {"cuDNN", "direct", "gemm"};
+  GroupedPath best = CUDNN_PATH;
+  float best_time = 0.F;
+  CPUTimer timer;
+  for (GroupedPath path : grouped_candidates()) {
+    // The first run warms the path up
+    run(path);
+    timer.Start();
+    run(path);
+    timer.Stop();
+    const float time = timer.MicroSeconds();
+    if (path == CUDNN_PATH || time < best_time) {
+      best = path;
+      best_time = time;
+    }
+  }
+  LOG(INFO) << this->print_current_device() << " Layer '" << this->name() << "' "
+      << pass << ": " << names[best] << " path, " << best_time << " us";
+  return best;
+}
+
+template <typename Ftype, typename Btype>
+void CuDNNConvolutionLayer<Ftype, Btype>::ApplyArbitration(const vector<Blob*>& bottom) {
+  const int dev = Caffe::current_device();
+  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::thread_workspace(dev);
+  size_t available_memory, total_memory;
+  GPUMemory::GetInfo(&available_memory, &total_memory, true);
+  // What's left after activations and weights, FindEx space goes back to the pool
+  const size_t usable = ws->size() + available_memory;
+  const size_t budget = align_down<7>(usable > 2UL * PAGE_SIZE ? usable - 2UL * PAGE_SIZE : 0UL);
+  CuDNNWorkspaceArbiter::Candidate c;
+  size_t workspace = 0UL;
+  for (int i = 0; i < bottom.size(); ++i) {
+    if (CuDNNWorkspaceArbiter::Decision(dev, this, 3 * i, budget, &c, &workspace)) {
+      fwd_algo_[i] = static_cast<cudnnConvolutionFwdAlgo_t>(c.algo);
+      workspace_fwd_sizes_[i] = c.memory / ws_groups();
+#if CUDNN_VERSION_MIN(7, 0, 0)
+      fwd_cudnn_math_[i] = static_cast<cudnnMathType_t>(c.cudnn_math);
+      CUDNN_CHECK(cudnnSetConvolutionMathType(fwd_conv_descs_[i], fwd_cudnn_math_[i]));
+#endif
+    }
+    if (CuDNNWorkspaceArbiter::Decision(dev, this, 3 * i + 1, budget, &c, &workspace)) {
+      bwd_data_algo_[i] = static_cast<cudnnConvolutionBwdDataAlgo_t>(c.algo);
+      workspace_bwd_data_sizes_[i] = c.memory / ws_groups();
+#if CUDNN_VERSION_MIN(7, 0, 0)
+      bwd_data_cudnn_math_[i] = static_cast<cudnnMathType_t>(c.cudnn_math);
+      CUDNN_CHECK(cudnnSetConvolutionMathType(bwd_conv_data_descs_[i], bwd_data_cudnn_math_[i]));
+#endif
+    }
+    if (CuDNNWorkspaceArbiter::Decision(dev, this, 3 * i + 2, budget, &c, &workspace)) {
+      bwd_filter_algo_[i] = static_cast<cudnnConvolutionBwdFilterAlgo_t>(c.algo);
+      workspace_bwd_filter_sizes_[i] = c.memory / ws_groups();
+#if CUDNN_VERSION_MIN(7, 0, 0)
+      bwd_filter_cudnn_math_[i] = static_cast<cudnnMathType_t>(c.cudnn_math);
+      CUDNN_CHECK(cudnnSetConvolutionMathType(bwd_conv_filter_descs_[i],
+          bwd_filter_cudnn_math_[i]));
+#endif
+    }
+    LOG(INFO) << this->print_current_device() << " Conv Algos (F,BD,BF): '" << this->name()
+        << "' arbitrated " << fwd_algo_[i] << " " << bwd_data_algo_[i] << " "
+        << bwd_filter_algo_[i] << " in shared workspace " << gb_round2(workspace) << "G";
+  }
+  arbitrated_mem_req_.insert_max(dev, workspace);
+  submitted_ = false;
+  StoreConvAlgosToCache(bottom, "FINDEX", total_memory);
+}
+
 template <typename Ftype, typename Btype>
 void CuDNNConvolutionLayer<Ftype, Btype>::GetConvAlgo(const vector<Blob*>& bottom,
     const vector<Blob*>& top, const size_t workspace_bytes, int pad_h, int pad_w,
@@ -528,6 +759,16 @@ void CuDNNConvolutionLayer<Ftype, Btype>::GetConvAlgo(const vector<Blob*>& botto
           align_down<7>(workspace_bytes / ws_groups()), &bwd_filter_algo_[i]));
       CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
     }
+    if (Caffe::deterministic()) {
+      // Get* may pick algorithms accumulating with atomics
+      if (bwd_data_algo_[i] == CUDNN_CONVOLUTION_BWD_DATA_ALGO_0) {
+        bwd_data_algo_[i] = CUDNN_CONVOLUTION_BWD_DATA_ALGO_1;
+      }
+      if (bwd_filter_algo_[i] == CUDNN_CONVOLUTION_BWD_FILTER_ALGO_0 ||
+          bwd_filter_algo_[i] == CUDNN_CONVOLUTION_BWD_FILTER_ALGO_3) {
+        bwd_filter_algo_[i] = CUDNN_CONVOLUTION_BWD_FILTER_ALGO_1;
+      }
+    }
     LOG(INFO) << Phase_Name(this->phase_)
         << " Conv Algos by Get* (F,BD,BF) for layer '" << this->name()
         << "' with space " << workspace_bytes << "/" << ws_groups() <<  " "
@@ -535,15 +776,147 @@ void CuDNNConvolutionLayer<Ftype, Btype>::GetConvAlgo(const vector<Blob*>& botto
   }
 }
 
+// Everything affecting seeker's decision goes here. Bottom index is not a part
+// of the key: all bottoms share the same geometry.
+template <typename Ftype, typename Btype>
+std::string CuDNNConvolutionLayer<Ftype, Btype>::AlgoCacheKey(const vector<Blob*>& bottom,
+    int i, const std::string& seeker, size_t workspace_limit) {
+  const int* kernel_shape_data = this->kernel_shape_.cpu_data();
+  const int* pad_data = this->pad_.cpu_data();
+  const int* stride_data = this->stride_.cpu_data();
+  const bool bwd_data = this->phase_ == TRAIN && i < propagate_down_.size() && propagate_down_[i];
+  std::ostringstream os;
+  os << Caffe::device_name(Caffe::current_device())
+     << ",cudnn " << Caffe::cudnn_version()
+     << "," << seeker << " " << workspace_limit
+     << "," << Phase_Name(this->phase_) << (bwd_data ? " BD" : "")
+     << "," << Type_Name(tp<Ftype>()) << " " << Type_Name(tp<Btype>())
+     << "," << Type_Name(this->layer_param().forward_math()) << (this->is_fm_by_user() ? "u " : " ")
+     << Type_Name(this->layer_param().backward_math()) << (this->is_bm_by_user() ? "u" : "")
+#if CUDNN_VERSION_MIN(7, 0, 0)
+     << "," << cudnn_math_override_
+#endif
+     << "," << bottom[i]->shape_string()
+     << "," << this->num_output_ << " " << kernel_shape_data[0] << "x" << kernel_shape_data[1]
+     << " p" << pad_data[0] << "x" << pad_data[1]
+     << " s" << stride_data[0] << "x" << stride_data[1]
+     << " g" << this->group_ << (use_v7grouping() ? "." : "")
+     << (packing_ == NHWC ? " NHWC" : "")
+     << "," << user_algos_override_[0] << " " << user_algos_override_[1]
+     << " " << user_algos_override_[2]
+     << (Caffe::deterministic() ? ",deterministic" : "");
+  return os.str();
+}
+
+template <typename Ftype, typename Btype>
+bool CuDNNConvolutionLayer<Ftype, Btype>::RestoreConvAlgosFromCache(
+    const vector<Blob*>& bottom, const std::string& seeker, size_t workspace_limit) {
+  if (algo_cache_file_.empty()) {
+    return false;
+  }
+  vector<CuDNNAlgoCache::Entry> entries(bottom.size());
+  size_t ws_req = 0UL;
+  for (int i = 0; i < bottom.size(); ++i) {
+    if (!CuDNNAlgoCache::Lookup(algo_cache_file_,
+        AlgoCacheKey(bottom, i, seeker, workspace_limit), &entries[i])) {
+      return false;
+    }
+    const CuDNNAlgoCache::Entry& e = entries[i];
+    ws_req = std::max(ws_req, align_up<7>(std::max(e.fwd_ws_size,
+        std::max(e.bwd_data_ws_size, e.bwd_filter_ws_size))) * ws_groups());
+  }
+  const int dev = Caffe::current_device();
+  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::thread_workspace(dev);
+  size_t available_memory, total_memory;
+  GPUMemory::GetInfo(&available_memory, &total_memory, true);
+  if (ws_req > ws->size() + align_down<7>(available_memory)) {
+    LOG(INFO) << this->print_current_device() << " Layer '" << this->name()
+              << "': cached algorithms need " << gb_round2(ws_req)
+              << "G of workspace, running the seeker instead";
+    return false;
+  }
+
+  for (int i = 0; i < bottom.size(); ++i) {
+    const CuDNNAlgoCache::Entry& e = entries[i];
+    fwd_algo_[i] = static_cast<cudnnConvolutionFwdAlgo_t>(e.fwd_algo);
+    forward_math_ = e.forward_math;
+    setConvolutionDescMath(forward_math_, fwd_conv_descs_[i]);
+#if CUDNN_VERSION_MIN(7, 0, 0)
+    fwd_cudnn_math_[i] = static_cast<cudnnMathType_t>(e.fwd_cudnn_math);
+    CUDNN_CHECK(cudnnSetConvolutionMathType(fwd_conv_descs_[i], fwd_cudnn_math_[i]));
+#endif
+    if (this->phase_ == TRAIN) {
+      bwd_filter_algo_[i] = static_cast<cudnnConvolutionBwdFilterAlgo_t>(e.bwd_filter_algo);
+      backward_filter_math_ = e.backward_filter_math;
+      setConvolutionDescMath(backward_filter_math_, bwd_conv_filter_descs_[i]);
+      bwd_data_algo_[i] = static_cast<cudnnConvolutionBwdDataAlgo_t>(e.bwd_data_algo);
+      backward_data_math_ = e.backward_data_math;
+      setConvolutionDescMath(backward_data_math_, bwd_conv_data_descs_[i]);
+#if CUDNN_VERSION_MIN(7, 0, 0)
+      bwd_filter_cudnn_math_[i] = static_cast<cudnnMathType_t>(e.bwd_filter_cudnn_math);
+      CUDNN_CHECK(cudnnSetConvolutionMathType(bwd_conv_filter_descs_[i],
+          bwd_filter_cudnn_math_[i]));
+      bwd_data_cudnn_math_[i] = static_cast<cudnnMathType_t>(e.bwd_data_cudnn_math);
+      CUDNN_CHECK(cudnnSetConvolutionMathType(bwd_conv_data_descs_[i],
+          bwd_data_cudnn_math_[i]));
+#endif
+    }
+    LOG(INFO) << this->print_current_device()
+        << (this->phase_ == TRAIN ? " Conv Algos (F,BD,BF): '" : " Conv Algo (F): '")
+        << this->name() << "' restored from " << algo_cache_file_ << " "
+        << fwd_algo_[i] << " " << bwd_data_algo_[i] << " " << bwd_filter_algo_[i];
+  }
+  // Sets workspace sizes and memory requirements
+  AllocateWorkspace(bottom.size());
+  return true;
+}
+
+template <typename Ftype, typename Btype>
+void CuDNNConvolutionLayer<Ftype, Btype>::StoreConvAlgosToCache(
+    const vector<Blob*>& bottom, const std::string& seeker, size_t workspace_limit) {
+  if (algo_cache_file_.empty()) {
+    return;
+  }
+  for (int i = 0; i < bottom.size(); ++i) {
+    CuDNNAlgoCache::Entry e;
+    e.fwd_algo = fwd_algo_[i];
+    e.bwd_data_algo = bwd_data_algo_[i];
+    e.bwd_filter_algo = bwd_filter_algo_[i];
+#if CUDNN_VERSION_MIN(7, 0, 0)
+    e.fwd_cudnn_math = fwd_cudnn_math_[i];
+    e.bwd_data_cudnn_math = bwd_data_cudnn_math_[i];
+    e.bwd_filter_cudnn_math = bwd_filter_cudnn_math_[i];
+#endif
+    e.forward_math = forward_math_;
+    e.backward_data_math = backward_data_math_;
+    e.backward_filter_math = backward_filter_math_;
+    e.fwd_ws_size = workspace_fwd_sizes_[i];
+    e.bwd_data_ws_size = workspace_bwd_data_sizes_[i];
+    e.bwd_filter_ws_size = workspace_bwd_filter_sizes_[i];
+    CuDNNAlgoCache::Insert(algo_cache_file_, AlgoCacheKey(bottom, i, seeker, workspace_limit), e);
+  }
+}
+
 template<typename Ftype, typename Btype>
 void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
     const vector<Blob*>& bottom, const vector<Blob*>& top) {
   int fwd_algo_count = 0;
   int filter_algo_count = 0;
   int data_algo_count = 0;
-  cudnnConvolutionFwdAlgoPerf_t fwd_results[REQUEST_ALGO_COUNT];
-  cudnnConvolutionBwdFilterAlgoPerf_t bwd_filter_results[REQUEST_ALGO_COUNT];
-  cudnnConvolutionBwdDataAlgoPerf_t bwd_data_results[REQUEST_ALGO_COUNT];
+  // Arbitration needs timings of every candidate
+  cudnnConvolutionFwdAlgoPerf_t fwd_results[CUDNN_CONVOLUTION_FWD_ALGO_COUNT];
+  cudnnConvolutionBwdFilterAlgoPerf_t bwd_filter_results[CUDNN_CONVOLUTION_BWD_FILTER_ALGO_COUNT];
+  cudnnConvolutionBwdDataAlgoPerf_t bwd_data_results[CUDNN_CONVOLUTION_BWD_DATA_ALGO_COUNT];
+  const int fwd_request = arbitrate_ ? CUDNN_CONVOLUTION_FWD_ALGO_COUNT : REQUEST_ALGO_COUNT;
+  const int bwd_filter_request =
+      arbitrate_ ? CUDNN_CONVOLUTION_BWD_FILTER_ALGO_COUNT : REQUEST_ALGO_COUNT;
+  const int bwd_data_request =
+      arbitrate_ ? CUDNN_CONVOLUTION_BWD_DATA_ALGO_COUNT : REQUEST_ALGO_COUNT;
+  // Candidates of native and pseudo fp32 runs, and the run whose descriptor is kept
+  vector<CuDNNWorkspaceArbiter::Candidate> cands[2];
+  int kept = 0;
+  const int calls = use_v7grouping() ? 1 : groups();
+  submitted_ = arbitrate_;
   bool fwd_pseudo = false;
   bool bwd_filter_pseudo = false;
   bool bwd_data_pseudo = false;
@@ -562,7 +935,7 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
   cudaStream_t stream = Caffe::thread_stream();
 
   const int dev = Caffe::current_device();
-  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::workspace_[dev];
+  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::thread_workspace(dev);
   const size_t gsize = ws->size() / ws_groups();
   CHECK(is_even(gsize)) << ws->size() << " / " << ws_groups() << " -> " << gsize;
 
@@ -578,6 +951,7 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
     // Find forward algorithm
     if (user_algos_override_[0] < 0) {
       float algo_time = 0.F;
+      kept = 0;
       for (int m = 0; m < 2; ++m) {
         if (m > 0 &&
             // if user wants specific math type, no need to check anything else
@@ -603,7 +977,7 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
               fwd_conv_descs_[i],
               fwd_top_descs_[i],
               top[i]->mutable_gpu_data<Ftype>(),  // overwritten
-              REQUEST_ALGO_COUNT,
+              fwd_request,
               &fwd_algo_count,
               fwd_results,
               ws->data(),
@@ -615,6 +989,9 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
           }
           prev_algo = (int)fwd_results[0].algo;
         }
+        dropNondeterministic(fwd_results, fwd_algo_count);
+        collectCandidates(fwd_results, fwd_algo_count, cudnn_math_override_, calls,
+            ws_groups(), &cands[m]);
 
         for (int k = 0; k < fwd_algo_count; ++k) {
           if (fwd_results[k].status == CUDNN_STATUS_SUCCESS) {
@@ -631,6 +1008,7 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
               forward_math_ = tpm(tp<Ftype>(), FLOAT);
             }
             fwd_algo_[i] = fwd_results[k].algo;
+            kept = m;
 #if CUDNN_VERSION_MIN(7, 0, 0)
             if (cudnn_math_override_ < 0) {
               // Winning Math for either native or pseudo mode:
@@ -653,6 +1031,9 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
           }
         }
       }
+      if (arbitrate_ && !cands[kept].empty()) {
+        CuDNNWorkspaceArbiter::Submit(dev, this, 3 * i, cands[kept]);
+      }
     }
 #if CUDNN_VERSION_MIN(7, 0, 0)
     if (top_device) {
@@ -677,6 +1058,7 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
         shared_ptr<GPUMemory::Workspace> tmp_ws = GPUMemory::weights_workspace_[dev];
         tmp_ws->safe_reserve(tmp_weights_size);
         float algo_time = 0.F;
+        kept = 0;
         for (int m = 0; m < 2; ++m) {
           if (m > 0 &&
               // if user wants specific math type, no need to check anything else
@@ -704,7 +1086,7 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
                 bwd_conv_filter_descs_[i],
                 bwd_filter_desc_,
                 tmp_ws->data(),  // overwritten
-                REQUEST_ALGO_COUNT,
+                bwd_filter_request,
                 &filter_algo_count,
                 bwd_filter_results,
                 ws->data(),
@@ -716,6 +1098,9 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
             }
             prev_algo = (int)bwd_filter_results[0].algo;
           }
+          dropNondeterministic(bwd_filter_results, filter_algo_count);
+          collectCandidates(bwd_filter_results, filter_algo_count, cudnn_math_override_, calls,
+              ws_groups(), &cands[m]);
 
           for (int k = 0; k < filter_algo_count; ++k) {
             if (bwd_filter_results[k].status == CUDNN_STATUS_SUCCESS) {
@@ -732,6 +1117,7 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
                 backward_filter_math_ = tpm(tp<Btype>(), FLOAT);
               }
               bwd_filter_algo_[i] = bwd_filter_results[k].algo;
+              kept = m;
 #if CUDNN_VERSION_MIN(7, 0, 0)
               if (cudnn_math_override_ < 0) {
                 // Winning Math for either native or pseudo mode:
@@ -750,6 +1136,9 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
             }
           }
         }
+        if (arbitrate_ && !cands[kept].empty()) {
+          CuDNNWorkspaceArbiter::Submit(dev, this, 3 * i + 2, cands[kept]);
+        }
       }
 #if CUDNN_VERSION_MIN(7, 0, 0)
       if (top_device && !use_modest_workspace()) {
@@ -770,6 +1159,7 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
 #endif
         if (user_algos_override_[1] < 0) {
           float algo_time = 0.F;
+          kept = 0;
           for (int m = 0; m < 2; ++m) {
             if (m > 0 &&
                 // if user wants specific math type, no need to check anything else
@@ -797,7 +1187,7 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
                   bwd_conv_data_descs_[i],
                   bwd_bottom_descs_[i],
                   bottom[i]->mutable_gpu_diff<Btype>(),  // overwritten
-                  REQUEST_ALGO_COUNT,
+                  bwd_data_request,
                   &data_algo_count,
                   bwd_data_results,
                   ws->data(),
@@ -809,6 +1199,9 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
               }
               prev_algo = (int) bwd_data_results[0].algo;
             }
+            dropNondeterministic(bwd_data_results, data_algo_count);
+            collectCandidates(bwd_data_results, data_algo_count, cudnn_math_override_, calls,
+                ws_groups(), &cands[m]);
 
             for (int k = 0; k < data_algo_count; ++k) {
               if (bwd_data_results[k].status == CUDNN_STATUS_SUCCESS) {
@@ -825,6 +1218,7 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
                   backward_data_math_ = tpm(tp<Btype>(), FLOAT);
                 }
                 bwd_data_algo_[i] = bwd_data_results[k].algo;
+                kept = m;
 #if CUDNN_VERSION_MIN(7, 0, 0)
                 if (cudnn_math_override_ < 0) {
                   // Winning Math for either native or pseudo mode:
@@ -843,6 +1237,9 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
               }
             }
           }
+          if (arbitrate_ && !cands[kept].empty()) {
+            CuDNNWorkspaceArbiter::Submit(dev, this, 3 * i + 1, cands[kept]);
+          }
         }
 #if CUDNN_VERSION_MIN(7, 0, 0)
         if (top_device) {
@@ -855,6 +1252,39 @@ void CuDNNConvolutionLayer<Ftype, Btype>::FindExConvAlgo(
     }
     CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
     AllocateWorkspace(bottom.size());  // if user overrides
+    if (arbitrate_) {
+      // Algorithms set by user take part with what they need
+      CuDNNWorkspaceArbiter::Candidate c;
+      c.cudnn_math = 0;
+      c.time = 0.F;
+      if (user_algos_override_[0] >= 0) {
+        c.algo = fwd_algo_[i];
+#if CUDNN_VERSION_MIN(7, 0, 0)
+        c.cudnn_math = fwd_cudnn_math_[i];
+#endif
+        c.memory = align_up<7>(workspace_fwd_sizes_[i]) * ws_groups();
+        CuDNNWorkspaceArbiter::Submit(dev, this, 3 * i,
+            vector<CuDNNWorkspaceArbiter::Candidate>{c});
+      }
+      if (user_algos_override_[1] >= 0 && propagate_down_[i]) {
+        c.algo = bwd_data_algo_[i];
+#if CUDNN_VERSION_MIN(7, 0, 0)
+        c.cudnn_math = bwd_data_cudnn_math_[i];
+#endif
+        c.memory = align_up<7>(workspace_bwd_data_sizes_[i]) * ws_groups();
+        CuDNNWorkspaceArbiter::Submit(dev, this, 3 * i + 1,
+            vector<CuDNNWorkspaceArbiter::Candidate>{c});
+      }
+      if (user_algos_override_[2] >= 0) {
+        c.algo = bwd_filter_algo_[i];
+#if CUDNN_VERSION_MIN(7, 0, 0)
+        c.cudnn_math = bwd_filter_cudnn_math_[i];
+#endif
+        c.memory = align_up<7>(workspace_bwd_filter_sizes_[i]) * ws_groups();
+        CuDNNWorkspaceArbiter::Submit(dev, this, 3 * i + 2,
+            vector<CuDNNWorkspaceArbiter::Candidate>{c});
+      }
+    }
 
     size_t available_memory, total_memory;
     GPUMemory::GetInfo(&available_memory, &total_memory, true);
@@ -926,7 +1356,8 @@ bool CuDNNConvolutionLayer<Ftype, Btype>::IsBottomDescChanged(
     h = shape[2];
     w = shape[3];
 
-    if ((cached_n != n) || (cached_c != c) || (cached_h != h) || (cached_w != w)) {
+    if ((cached_n != n) || (cached_c != c) || (cached_h != h) || (cached_w != w) ||
+        bottom[i]->packing() != packing_) {
       return true;
     }
   }
@@ -991,6 +1422,8 @@ CuDNNConvolutionLayer<Ftype, Btype>::~CuDNNConvolutionLayer() {
   GPUMemory::Finalize();  // clean workspaces before everything dies
   const int dev = Caffe::current_device();
   ws_released_[dev] = false;  // For next unit test
+  arbitrated_mem_req_[dev] = 0UL;
+  CuDNNWorkspaceArbiter::Withdraw(dev, this);
   // Check that handles have been setup before destroying.
   if (!handles_setup_) { return; }
 
@@ -1016,6 +1449,99 @@ CuDNNConvolutionLayer<Ftype, Btype>::~CuDNNConvolutionLayer() {
   CUDNN_CHECK(cudnnDestroyFilterDescriptor(bwd_filter_desc_));
 }
 
+template <typename Ftype, typename Btype>
+bool CuDNNConvolutionLayer<Ftype, Btype>::SetUpPadded(const vector<Blob*>& bottom) {
+  const int pad = this->layer_param_.convolution_param().pad_channels();
+  if (pad <= 1 || !is_type<Ftype>(FLOAT16) || this->group_ != 1 || bottom.size() != 1 ||
+      this->num_spatial_axes_ != 2 ||
+      (this->channels_ % pad == 0 && this->num_output_ % pad == 0)) {
+    return false;
+  }
+  padded_channels_ = (this->channels_ + pad - 1) / pad * pad;
+  padded_outputs_ = (this->num_output_ + pad - 1) / pad * pad;
+  LayerParameter padded_param(this->layer_param_);
+  padded_param.set_name(this->name() + "_padded");
+  ConvolutionParameter* conv_param = padded_param.mutable_convolution_param();
+  conv_param->set_num_output(padded_outputs_);
+  conv_param->set_pad_channels(0U);
+  conv_param->set_cudnn_workspace_arbitration(false);
+  // Weights are copied in every pass
+  conv_param->mutable_weight_filler()->set_type("constant");
+  conv_param->mutable_bias_filler()->set_type("constant");
+  padded_.reset(new CuDNNConvolutionLayer<Ftype, Btype>(padded_param));
+  padded_bottom_ = Blob::create<Ftype, Btype>();
+  padded_top_ = Blob::create<Ftype, Btype>();
+  padded_bottom_vec_.assign(1, padded_bottom_.get());
+  padded_top_vec_.assign(1, padded_top_.get());
+  vector<int> shape = bottom[0]->shape();
+  shape[this->channel_axis_] = padded_channels_;
+  padded_bottom_->Reshape(shape);
+  padded_bottom_->set_packing(bottom[0]->packing());
+  padded_->SetUp(padded_bottom_vec_, padded_top_vec_);
+  LOG_IF(INFO, Caffe::root_solver()) << "Layer " << this->name() << " pads channels "
+      << this->channels_ << " -> " << padded_channels_ << ", outputs "
+      << this->num_output_ << " -> " << padded_outputs_;
+  return true;
+}
+
+template <typename Ftype, typename Btype>
+void CuDNNConvolutionLayer<Ftype, Btype>::ReshapePadded(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  ConvolutionLayer<Ftype, Btype>::Reshape(bottom, top);
+  vector<int> shape = bottom[0]->shape();
+  shape[this->channel_axis_] = padded_channels_;
+  padded_bottom_->Reshape(shape);
+  padded_bottom_->set_packing(bottom[0]->packing());
+  padded_->Reshape(padded_bottom_vec_, padded_top_vec_);
+  top[0]->set_packing(bottom[0]->packing());
+  if (!padding_reported_) {
+    ReportPadding(bottom);
+    padding_reported_ = true;
+  }
+}
+
+template <typename Ftype, typename Btype>
+void CuDNNConvolutionLayer<Ftype, Btype>::ReportPadding(const vector<Blob*>& bottom) {
+  const int* kernel = this->kernel_shape_.cpu_data();
+  const int* pad = this->pad_.cpu_data();
+  const int* stride = this->stride_.cpu_data();
+  const Packing packing = bottom[0]->packing();
+  float ms[2] = {0.F, 0.F};
+  for (int k = 0; k < 2; ++k) {
+    const int channels = k == 0 ? this->channels_ : padded_channels_;
+    const int outputs = k == 0 ? this->num_output_ : padded_outputs_;
+    cudnnTensorDescriptor_t bottom_desc, top_desc;
+    cudnnFilterDescriptor_t filter_desc;
+    cudnnConvolutionDescriptor_t conv_desc;
+    cudnn::createTensor4dDesc<Ftype>(&bottom_desc);
+    cudnn::createTensor4dDesc<Ftype>(&top_desc);
+    cudnn::setTensor4dDesc<Ftype>(&bottom_desc, this->num_, channels,
+        bottom[0]->height(), bottom[0]->width(), packing);
+    cudnn::setTensor4dDesc<Ftype>(&top_desc, this->num_, outputs,
+        padded_top_->height(), padded_top_->width(), packing);
+    createFilterDesc<Ftype>(&filter_desc, outputs, channels, kernel[0], kernel[1]);
+    CUDNN_CHECK(cudnnCreateConvolutionDescriptor(&conv_desc));
+    setConvolutionDesc(forward_math_, conv_desc, pad[0], pad[1], stride[0], stride[1]);
+#if CUDNN_VERSION_MIN(7, 0, 0)
+    CUDNN_CHECK(cudnnSetConvolutionMathType(conv_desc, CUDNN_TENSOR_OP_MATH));
+#endif
+    cudnnConvolutionFwdAlgoPerf_t perf;
+    int returned = 0;
+    CUDNN_CHECK(cudnnFindConvolutionForwardAlgorithm(Caffe::cudnn_handle(), bottom_desc,
+        filter_desc, conv_desc, top_desc, 1, &returned, &perf));
+    if (returned > 0 && perf.status == CUDNN_STATUS_SUCCESS) {
+      ms[k] = perf.time;
+    }
+    CUDNN_CHECK(cudnnDestroyConvolutionDescriptor(conv_desc));
+    CUDNN_CHECK(cudnnDestroyFilterDescriptor(filter_desc));
+    CUDNN_CHECK(cudnnDestroyTensorDescriptor(top_desc));
+    CUDNN_CHECK(cudnnDestroyTensorDescriptor(bottom_desc));
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << this->print_current_device() << " Layer "
+      << this->name() << " channel padding: forward " << ms[0] << " ms -> " << ms[1]
+      << " ms" << (ms[1] > 0.F ? " (x" + std::to_string(ms[0] / ms[1]) + ")" : "");
+}
+
 INSTANTIATE_CLASS_FB(CuDNNConvolutionLayer);
 
 }   // namespace caffe
@@ -8,11 +8,141 @@
 
 namespace caffe {
 
+template <typename Dtype, bool ACCUMULATE>
+__global__ void ResizeChannelsKernel(const int count, const int src_n, const int src_c,
+    const int dst_c, const int spatial, const bool nhwc, const Dtype* src, Dtype* dst) {
+  CUDA_KERNEL_LOOP(index, count) {
+    const int c = nhwc ? index % dst_c : (index / spatial) % dst_c;
+    const int s = nhwc ? (index / dst_c) % spatial : index % spatial;
+    const int n = index / dst_c / spatial;
+    if (n < src_n && c < src_c) {
+      const Dtype v = src[nhwc ? (n * spatial + s) * src_c + c : (n * src_c + c) * spatial + s];
+      if (ACCUMULATE) {
+        dst[index] += v;
+      } else {
+        dst[index] = v;
+      }
+    } else if (!ACCUMULATE) {
+      dst[index] = 0;
+    }
+  }
+}
+
+template <typename Dtype>
+void resize_channels_gpu(int src_n, int src_c, int dst_n, int dst_c, int spatial,
+    Packing packing, const Dtype* src, Dtype* dst, bool accumulate) {
+  const int count = dst_n * dst_c * spatial;
+  cudaStream_t stream = Caffe::thread_stream();
+  if (accumulate) {
+    ResizeChannelsKernel<Dtype, true>  // NOLINT_NEXT_LINE(whitespace/operators)
+        <<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        count, src_n, src_c, dst_c, spatial, packing == NHWC, src, dst);
+  } else {
+    ResizeChannelsKernel<Dtype, false>  // NOLINT_NEXT_LINE(whitespace/operators)
+        <<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        count, src_n, src_c, dst_c, spatial, packing == NHWC, src, dst);
+  }
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template void resize_channels_gpu<float>(int, int, int, int, int, Packing,
+    const float*, float*, bool);
+template void resize_channels_gpu<double>(int, int, int, int, int, Packing,
+    const double*, double*, bool);
+template void resize_channels_gpu<float16>(int, int, int, int, int, Packing,
+    const float16*, float16*, bool);
+
+template<typename Ftype, typename Btype>
+void CuDNNConvolutionLayer<Ftype, Btype>::ForwardPadded(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  const int spatial = bottom[0]->count(this->channel_axis_ + 1);
+  const int kernel_spatial = this->blobs_[0]->count(2);
+  // Padded filters are zero beyond the real ones, the padded input channels don't count
+  resize_channels_gpu(this->num_output_, this->channels_, padded_outputs_, padded_channels_,
+      kernel_spatial, NCHW, this->blobs_[0]->template gpu_data<Ftype>(),
+      padded_->blobs()[0]->template mutable_gpu_data<Ftype>());
+  if (this->bias_term_) {
+    resize_channels_gpu(1, this->num_output_, 1, padded_outputs_, 1, NCHW,
+        this->blobs_[1]->template gpu_data<Ftype>(),
+        padded_->blobs()[1]->template mutable_gpu_data<Ftype>());
+  }
+  resize_channels_gpu(this->num_, this->channels_, this->num_, padded_channels_, spatial,
+      bottom[0]->packing(), bottom[0]->gpu_data<Ftype>(),
+      padded_bottom_->mutable_gpu_data<Ftype>());
+  padded_->Forward(padded_bottom_vec_, padded_top_vec_);
+  resize_channels_gpu(this->num_, padded_outputs_, this->num_, this->num_output_,
+      top[0]->count(this->channel_axis_ + 1), top[0]->packing(),
+      padded_top_->gpu_data<Ftype>(), top[0]->mutable_gpu_data<Ftype>());
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
+  ++fwd_count_;
+}
+
+template<typename Ftype, typename Btype>
+void CuDNNConvolutionLayer<Ftype, Btype>::BackwardPadded(const vector<Blob*>& top,
+    const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  resize_channels_gpu(this->num_, this->num_output_, this->num_, padded_outputs_,
+      top[0]->count(this->channel_axis_ + 1), top[0]->packing(),
+      top[0]->gpu_diff<Btype>(), padded_top_->mutable_gpu_diff<Btype>());
+  // The padded layer writes its gradients, they're added to ours (or written), stripped
+  for (int i = 0; i < this->blobs_.size(); ++i) {
+    padded_->set_param_propagate_down(i, this->param_propagate_down(i));
+  }
+  padded_->set_overwrite_param_diffs(true);
+  padded_->Backward(padded_top_vec_, propagate_down, padded_bottom_vec_);
+  if (this->param_propagate_down(0)) {
+    resize_channels_gpu(padded_outputs_, padded_channels_, this->num_output_, this->channels_,
+        this->blobs_[0]->count(2), NCHW, padded_->blobs()[0]->template gpu_diff<Btype>(),
+        this->blobs_[0]->template mutable_gpu_diff<Btype>(), !this->overwrite_param_diffs_);
+  }
+  if (this->bias_term_ && this->param_propagate_down(1)) {
+    resize_channels_gpu(1, padded_outputs_, 1, this->num_output_, 1, NCHW,
+        padded_->blobs()[1]->template gpu_diff<Btype>(),
+        this->blobs_[1]->template mutable_gpu_diff<Btype>(), !this->overwrite_param_diffs_);
+  }
+  if (propagate_down[0]) {
+    resize_channels_gpu(this->num_, padded_channels_, this->num_, this->channels_,
+        bottom[0]->count(this->channel_axis_ + 1), bottom[0]->packing(),
+        padded_bottom_->gpu_diff<Btype>(), bottom[0]->mutable_gpu_diff<Btype>());
+  }
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
+  ++bwd_count_;
+}
+
 template<typename Ftype, typename Btype>
 void CuDNNConvolutionLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
     const vector<Blob*>& top) {
+  if (padded_) {
+    ForwardPadded(bottom, top);
+    return;
+  }
+  // Grouped paths are timed once cuDNN algorithms are settled
+  if (fwd_count_ >= 2UL && !fwd_path_tuned_ && grouped_tuning()) {
+    fwd_path_ = FastestPath("forward",
+        [&](GroupedPath path) { ForwardPath(path, bottom, top); });
+    fwd_path_tuned_ = true;
+  }
+  ForwardPath(fwd_path_, bottom, top);
+  ++fwd_count_;
+}
+
+template<typename Ftype, typename Btype>
+void CuDNNConvolutionLayer<Ftype, Btype>::ForwardPath(GroupedPath path,
+    const vector<Blob*>& bottom, const vector<Blob*>& top) {
   const Ftype* weight = this->blobs_[0]->template gpu_data<Ftype>();
-  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::workspace_[Caffe::current_device()];
+  if (path != CUDNN_PATH) {
+    const Ftype* bias = this->bias_term_ ? this->blobs_[1]->template gpu_data<Ftype>() : nullptr;
+    for (int i = 0; i < bottom.size(); ++i) {
+      if (path == DIRECT_PATH) {
+        grouped_conv_forward_gpu(grouped_shape_, bottom[i]->gpu_data<Ftype>(), weight, bias,
+            top[i]->mutable_gpu_data<Ftype>());
+      } else {
+        grouped_gemm_conv_forward_gpu(grouped_shape_, bottom[i]->gpu_data<Ftype>(), weight,
+            bias, top[i]->mutable_gpu_data<Ftype>(), static_cast<Ftype*>(col_space(true)));
+      }
+    }
+    return;
+  }
+  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::thread_workspace(Caffe::current_device());
   if (use_v7grouping()) {
     for (int i = 0; i < bottom.size(); ++i) {
       const Ftype *bottom_data = bottom[i]->gpu_data<Ftype>();
@@ -31,7 +161,7 @@ void CuDNNConvolutionLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& botto
             cudnn::dataType<Ftype>::one,
             fwd_top_descs_[i], top_data));
       }
-      CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+      CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
     }  // end of for i
   } else {
     // "old" path
@@ -52,7 +182,7 @@ void CuDNNConvolutionLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& botto
       }
       // NOLINT_NEXT_LINE(whitespace/operators)
       for (int ig = 0; ig < ws_groups(); ++ig) {
-        CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream(ig)));
+        CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream(ig)));
       }
 
       if (this->bias_term_) {
@@ -67,53 +197,176 @@ void CuDNNConvolutionLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& botto
         // Synchronize the work across groups, each of which went into its own stream
         // NOLINT_NEXT_LINE(whitespace/operators)
         for (int g = 0; g < ws_groups(); ++g) {
-          CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream(g)));
+          CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream(g)));
         }
       }
     }  // end of for i
   }
-
-  ++fwd_count_;
 }
 
 template <typename Ftype, typename Btype>
 void CuDNNConvolutionLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  if (padded_) {
+    BackwardPadded(top, propagate_down, bottom);
+    return;
+  }
   propagate_down_ = propagate_down;
-  const int dev = Caffe::current_device();
-  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::workspace_[Caffe::current_device()];
-  if (use_v7grouping()) {
-    // compute dE/dB = sum_c(dE/dy)
-    if (this->bias_term_ && this->param_propagate_down_[1]) {
-      Btype *bias_diff = this->blobs_[1]->template mutable_gpu_diff<Btype>();
-      for (int i = 0; i < top.size(); ++i) {
-        Btype *top_diff = top[i]->mutable_gpu_diff<Btype>();
-        // in parallel over groups
-        CUDNN_CHECK(cudnnConvolutionBackwardBias(Caffe::cudnn_handle(),
-            cudnn::dataType<Btype>::one, bwd_top_descs_[i], top_diff,
-            cudnn::dataType<Btype>::one, bwd_bias_desc_, bias_diff));
-        CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
-      }  // end of i
-    }  // end of dB
-
-    // compute dE/dW = dY * X
+  // Right after the forward pass which timed its paths
+  if (fwd_count_ > 2UL && !bwd_path_tuned_ && grouped_tuning()) {
     if (this->param_propagate_down_[0]) {
-      Btype *weight_diff = this->blobs_[0]->template mutable_gpu_diff<Btype>();
-      for (int i = 0; i < top.size(); ++i) {
-        Btype *top_diff = top[i]->mutable_gpu_diff<Btype>();
-        const Btype *bottom_data = bottom[i]->gpu_data<Btype>();
-        // Gradient w.r.t. weights.
-        CUDNN_CHECK(cudnnConvolutionBackwardFilter(Caffe::cudnn_handle(),
-            cudnn::dataType<Btype>::one, bwd_bottom_descs_[i], bottom_data,
-            bwd_top_descs_[i], top_diff,
-            bwd_conv_filter_descs_[i], bwd_filter_algo_[i], ws->data(), ws->size(),
-            cudnn::dataType<Btype>::one, bwd_filter_desc_, weight_diff));
-        CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
-      }  // end of i
+      // Not to add the timed runs to the gradient
+      filter_scratch_.ReshapeLike(*this->blobs_[0]);
+      Btype* scratch = filter_scratch_.mutable_gpu_data();
+      bwd_filter_path_ = FastestPath("backward filter",
+          [&](GroupedPath path) { BackwardFilterPath(path, top, bottom, scratch, false); });
+    }
+    if (std::find(propagate_down.begin(), propagate_down.end(), true) !=
+        propagate_down.end()) {
+      bwd_data_path_ = FastestPath("backward data",
+          [&](GroupedPath path) { BackwardDataPath(path, top, propagate_down, bottom); });
+    }
+    bwd_path_tuned_ = true;
+    if (fwd_path_ != GEMM_PATH && bwd_filter_path_ != GEMM_PATH &&
+        bwd_data_path_ != GEMM_PATH) {
+      col_space_.release();
+    }
+  }
+  BackwardBias(top);
+  if (this->param_propagate_down_[0]) {
+    BackwardFilterPath(bwd_filter_path_, top, bottom,
+        this->blobs_[0]->template mutable_gpu_diff<Btype>(), this->overwrite_param_diffs_);
+  }
+  BackwardDataPath(bwd_data_path_, top, propagate_down, bottom);
+  ++bwd_count_;
+}
+
+template <typename Ftype, typename Btype>
+void CuDNNConvolutionLayer<Ftype, Btype>::BackwardBias(const vector<Blob*>& top) {
+  // compute dE/dB = sum_c(dE/dy)
+  if (!this->bias_term_ || !this->param_propagate_down_[1]) {
+    return;
+  }
+  Btype* bias_diff = this->blobs_[1]->template mutable_gpu_diff<Btype>();
+  // The first bottom writes the gradient with overwrite_param_diffs_
+  auto beta = [this](int i) {
+    return i == 0 && this->overwrite_param_diffs_ ? cudnn::dataType<Btype>::zero
+                                                  : cudnn::dataType<Btype>::one;
+  };
+  if (use_v7grouping()) {
+    for (int i = 0; i < top.size(); ++i) {
+      Btype *top_diff = top[i]->mutable_gpu_diff<Btype>();
+      // in parallel over groups
+      CUDNN_CHECK(cudnnConvolutionBackwardBias(Caffe::cudnn_handle(),
+          cudnn::dataType<Btype>::one, bwd_top_descs_[i], top_diff,
+          beta(i), bwd_bias_desc_, bias_diff));
+      CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
+    }  // end of i
+  } else {
+    for (int i = 0; i < top.size(); ++i) {
+      Btype* top_diff = top[i]->mutable_gpu_diff<Btype>();
+      // in parallel over groups
+      for (int g = 0; g < groups(); ++g) {
+        CUDNN_CHECK(cudnnConvolutionBackwardBias(Caffe::cudnn_handle(idxg(g)),
+            cudnn::dataType<Btype>::one, bwd_top_descs_[i], top_diff + top_offset_ * g,
+            beta(i), bwd_bias_desc_, bias_diff + bias_offset_ * g));
+      }  // end of groups
+      // Synchronize the work across groups, each of which went into its own stream
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      for (int g = 0; g < ws_groups(); ++g) {
+        CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream(g)));
+      }
+    }  // end of i
+  }
+}
+
+template <typename Ftype, typename Btype>
+void CuDNNConvolutionLayer<Ftype, Btype>::BackwardFilterPath(GroupedPath path,
+    const vector<Blob*>& top, const vector<Blob*>& bottom, Btype* weight_diff,
+    bool overwrite) {
+  // compute dE/dW = dY * X
+  if (path != CUDNN_PATH) {
+    // These add to it
+    if (overwrite) {
+      caffe_gpu_memset(this->blobs_[0]->count() * sizeof(Btype), 0, weight_diff);
     }
+    for (int i = 0; i < top.size(); ++i) {
+      if (path == DIRECT_PATH) {
+        grouped_conv_backward_filter_gpu(grouped_shape_, bottom[i]->gpu_data<Btype>(),
+            top[i]->gpu_diff<Btype>(), weight_diff);
+      } else {
+        grouped_gemm_conv_backward_filter_gpu(grouped_shape_, bottom[i]->gpu_data<Btype>(),
+            top[i]->gpu_diff<Btype>(), weight_diff, static_cast<Btype*>(col_space(true)));
+      }
+    }
+    return;
+  }
+  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::thread_workspace(Caffe::current_device());
+  auto beta = [overwrite](int i) {
+    return i == 0 && overwrite ? cudnn::dataType<Btype>::zero : cudnn::dataType<Btype>::one;
+  };
+  if (use_v7grouping()) {
+    for (int i = 0; i < top.size(); ++i) {
+      Btype *top_diff = top[i]->mutable_gpu_diff<Btype>();
+      const Btype *bottom_data = bottom[i]->gpu_data<Btype>();
+      // Gradient w.r.t. weights.
+      CUDNN_CHECK(cudnnConvolutionBackwardFilter(Caffe::cudnn_handle(),
+          cudnn::dataType<Btype>::one, bwd_bottom_descs_[i], bottom_data,
+          bwd_top_descs_[i], top_diff,
+          bwd_conv_filter_descs_[i], bwd_filter_algo_[i], ws->data(), ws->size(),
+          beta(i), bwd_filter_desc_, weight_diff));
+      CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
+    }  // end of i
+  } else {
+    // "old" path
+    const size_t gsize = ws->size() / ws_groups();
+    for (int i = 0; i < top.size(); ++i) {
+      Btype* top_diff = top[i]->mutable_gpu_diff<Btype>();
+      const Btype* bottom_data = bottom[i]->gpu_data<Btype>();
+      // Backward through cuDNN in parallel over groups and gradients.
+      for (int g = 0; g < groups(); ++g) {
+        unsigned char* pspace = static_cast<unsigned char*>(ws->data()) + gsize * idxg(g);
+        // Gradient w.r.t. weights.
+        CUDNN_CHECK(cudnnConvolutionBackwardFilter(Caffe::cudnn_handle(idxg(g)),
+            cudnn::dataType<Btype>::one,
+            bwd_bottom_descs_[i], bottom_data + bottom_offset_ * g,
+            bwd_top_descs_[i], top_diff + top_offset_ * g,
+            bwd_conv_filter_descs_[i], bwd_filter_algo_[i], pspace, gsize,
+            beta(i),
+            bwd_filter_desc_, weight_diff + this->weight_offset_ * g));
+      }  // end of groups
+      // Synchronize the work across groups, each of which went into its own stream
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      for (int g = 0; g < ws_groups(); ++g) {
+        CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream(g)));
+      }
+    }  // end of i
+  }
+}
 
-    // Backward propagate grad wrt bottom data dE/dX= dE/dY * W
-    const Btype *weight = this->blobs_[0]->template gpu_data<Btype>();
+template <typename Ftype, typename Btype>
+void CuDNNConvolutionLayer<Ftype, Btype>::BackwardDataPath(GroupedPath path,
+    const vector<Blob*>& top, const vector<bool>& propagate_down,
+    const vector<Blob*>& bottom) {
+  // Backward propagate grad wrt bottom data dE/dX= dE/dY * W
+  const Btype* weight = this->blobs_[0]->template gpu_data<Btype>();
+  if (path != CUDNN_PATH) {
+    for (int i = 0; i < top.size(); ++i) {
+      if (!propagate_down[i]) {
+        continue;
+      }
+      if (path == DIRECT_PATH) {
+        grouped_conv_backward_data_gpu(grouped_shape_, top[i]->gpu_diff<Btype>(), weight,
+            bottom[i]->mutable_gpu_diff<Btype>());
+      } else {
+        grouped_gemm_conv_backward_data_gpu(grouped_shape_, top[i]->gpu_diff<Btype>(), weight,
+            bottom[i]->mutable_gpu_diff<Btype>(), static_cast<Btype*>(col_space(true)));
+      }
+    }
+    return;
+  }
+  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::thread_workspace(Caffe::current_device());
+  if (use_v7grouping()) {
     for (int i = 0; i < top.size(); ++i) {
       if (propagate_down[i]) {
         Btype *top_diff = top[i]->mutable_gpu_diff<Btype>();
@@ -124,59 +377,12 @@ void CuDNNConvolutionLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
             bwd_conv_data_descs_[i],
             bwd_data_algo_[i], ws->data(), ws->size(),
             cudnn::dataType<Btype>::zero, bwd_bottom_descs_[i], bottom_diff));
-        CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+        CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
       }  // end if propagate down
     }  // end for i
   } else {
     // "old" path
     const size_t gsize = ws->size() / ws_groups();
-    // compute dE/dB = sum_c(dE/dy)
-    if (this->bias_term_ && this->param_propagate_down_[1]) {
-      Btype* bias_diff = this->blobs_[1]->template mutable_gpu_diff<Btype>();
-      for (int i = 0; i < top.size(); ++i) {
-        Btype* top_diff = top[i]->mutable_gpu_diff<Btype>();
-        // in parallel over groups
-        for (int g = 0; g < groups(); ++g) {
-          CUDNN_CHECK(cudnnConvolutionBackwardBias(Caffe::cudnn_handle(idxg(g)),
-              cudnn::dataType<Btype>::one, bwd_top_descs_[i], top_diff + top_offset_ * g,
-              cudnn::dataType<Btype>::one, bwd_bias_desc_, bias_diff + bias_offset_ * g));
-        }  // end of groups
-        // Synchronize the work across groups, each of which went into its own stream
-        // NOLINT_NEXT_LINE(whitespace/operators)
-        for (int g = 0; g < ws_groups(); ++g) {
-          CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream(g)));
-        }
-      }  // end of i
-    }  // end of dB
-
-    // compute dE/dW = dY * X
-    if (this->param_propagate_down_[0]) {
-      Btype* weight_diff = this->blobs_[0]->template mutable_gpu_diff<Btype>();
-      for (int i = 0; i < top.size(); ++i) {
-        Btype* top_diff = top[i]->mutable_gpu_diff<Btype>();
-        const Btype* bottom_data = bottom[i]->gpu_data<Btype>();
-        // Backward through cuDNN in parallel over groups and gradients.
-        for (int g = 0; g < groups(); ++g) {
-          unsigned char* pspace = static_cast<unsigned char*>(ws->data()) + gsize * idxg(g);
-          // Gradient w.r.t. weights.
-          CUDNN_CHECK(cudnnConvolutionBackwardFilter(Caffe::cudnn_handle(idxg(g)),
-              cudnn::dataType<Btype>::one,
-              bwd_bottom_descs_[i], bottom_data + bottom_offset_ * g,
-              bwd_top_descs_[i], top_diff + top_offset_ * g,
-              bwd_conv_filter_descs_[i], bwd_filter_algo_[i], pspace, gsize,
-              cudnn::dataType<Btype>::one,
-              bwd_filter_desc_, weight_diff + this->weight_offset_ * g));
-        }  // end of groups
-        // Synchronize the work across groups, each of which went into its own stream
-        // NOLINT_NEXT_LINE(whitespace/operators)
-        for (int g = 0; g < ws_groups(); ++g) {
-          CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream(g)));
-        }
-      }  // end of i
-    }
-
-    // Backward propagate grad wrt bottom data dE/dX= dE/dY * W
-    const Btype* weight = this->blobs_[0]->template gpu_data<Btype>();
     for (int i = 0; i < top.size(); ++i) {
       if (propagate_down[i]) {
         // Backward in parallel over groups
@@ -196,13 +402,11 @@ void CuDNNConvolutionLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
         // Synchronize the work across groups.
         // NOLINT_NEXT_LINE(whitespace/operators)
         for (int g = 0; g < ws_groups(); ++g) {
-          CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream(g)));
+          CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream(g)));
         }
       }  // end if propagate down
     }  // end for i
   }
-
-  ++bwd_count_;
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(CuDNNConvolutionLayer);
@@ -0,0 +1,73 @@
+#ifdef USE_CUDNN
+#include <vector>
+
+#include "caffe/layers/cudnn_deconv_layer.hpp"
+
+namespace caffe {
+
+template <typename Ftype, typename Btype>
+void CuDNNDeconvolutionLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  DeconvolutionLayer<Ftype, Btype>::LayerSetUp(bottom, top);
+  CHECK_EQ(tp<Ftype>(), tp<Btype>()) << "Layer " << this->name()
+      << ": CuDNNDeconvolution needs equal forward and backward types";
+  LayerParameter transposed_param(this->layer_param_);
+  transposed_param.set_name(this->name() + "_transposed");
+  transposed_param.set_type("Convolution");
+  transposed_param.clear_blobs();
+  // Its backward-data pass is our forward one, it needs backward algorithms in any phase
+  transposed_param.set_phase(TRAIN);
+  ConvolutionParameter* conv_param = transposed_param.mutable_convolution_param();
+  conv_param->set_num_output(this->channels_);
+  conv_param->set_bias_term(false);
+  conv_param->set_engine(ConvolutionParameter_Engine_CUDNN);
+  conv_param->clear_bias_filler();
+  // Filters are ours
+  conv_param->mutable_weight_filler()->set_type("constant");
+  transposed_.reset(new CuDNNConvolutionLayer<Ftype, Btype>(transposed_param));
+  proxy_bottoms_.resize(bottom.size());
+  proxy_tops_.resize(bottom.size());
+  proxy_bottom_vec_.resize(bottom.size());
+  proxy_top_vec_.resize(bottom.size());
+  DeconvolutionLayer<Ftype, Btype>::Reshape(bottom, top);
+  for (int i = 0; i < bottom.size(); ++i) {
+    proxy_bottoms_[i] = Blob::create<Ftype, Btype>();
+    proxy_tops_[i] = Blob::create<Ftype, Btype>();
+    proxy_bottom_vec_[i] = proxy_bottoms_[i].get();
+    proxy_top_vec_[i] = proxy_tops_[i].get();
+    proxy_bottoms_[i]->ReshapeLike(*top[i]);
+    proxy_bottoms_[i]->set_packing(bottom[i]->packing());
+  }
+  transposed_->SetUp(proxy_bottom_vec_, proxy_top_vec_);
+  // Convolution filters (outputs, inputs / group, h, w) are our (inputs, outputs / group,
+  // h, w) ones
+  vector<shared_ptr<Blob>>& filters = transposed_->blobs();
+  CHECK(filters[0]->shape() == this->blobs_[0]->shape()) << "Layer " << this->name();
+  filters[0] = this->blobs_[0];
+}
+
+template <typename Ftype, typename Btype>
+void CuDNNDeconvolutionLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  DeconvolutionLayer<Ftype, Btype>::Reshape(bottom, top);
+  CHECK_EQ(2, this->num_spatial_axes_)
+      << "CuDNNDeconvolution input must have 2 spatial axes "
+      << "(e.g., height and width). "
+      << "Use 'engine: CAFFE' for general ND deconvolution.";
+  for (int i = 0; i < bottom.size(); ++i) {
+    top[i]->set_packing(bottom[i]->packing());
+    proxy_bottoms_[i]->ReshapeLike(*top[i]);
+    proxy_bottoms_[i]->set_packing(bottom[i]->packing());
+  }
+  transposed_->Reshape(proxy_bottom_vec_, proxy_top_vec_);
+  for (int i = 0; i < bottom.size(); ++i) {
+    CHECK(proxy_tops_[i]->shape() == bottom[i]->shape()) << "Layer " << this->name()
+        << ": output shape " << top[i]->shape_string() << " doesn't convolve back to "
+        << bottom[i]->shape_string();
+  }
+}
+
+INSTANTIATE_CLASS_FB(CuDNNDeconvolutionLayer);
+
+}  // namespace caffe
+#endif
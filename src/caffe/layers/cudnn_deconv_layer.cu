@@ -0,0 +1,74 @@
+#ifdef USE_CUDNN
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/cudnn_deconv_layer.hpp"
+
+namespace caffe {
+
+template <typename Ftype, typename Btype>
+void CuDNNDeconvolutionLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  // dE/dx of the transposed convolution with dE/dy = bottom is top
+  for (int i = 0; i < bottom.size(); ++i) {
+    proxy_tops_[i]->set_gpu_diff(const_cast<Ftype*>(bottom[i]->gpu_data<Ftype>()));
+    proxy_bottoms_[i]->set_gpu_diff(top[i]->mutable_gpu_data<Ftype>());
+  }
+  transposed_->set_param_propagate_down(0, false);
+  transposed_->Backward(proxy_top_vec_, vector<bool>(bottom.size(), true), proxy_bottom_vec_);
+  if (this->bias_term_) {
+    const Ftype* bias = this->blobs_[1]->template gpu_data<Ftype>();
+    for (int i = 0; i < top.size(); ++i) {
+      this->forward_gpu_bias_batched(top[i]->mutable_gpu_data<Ftype>(), bias);
+    }
+  }
+}
+
+template <typename Ftype, typename Btype>
+void CuDNNDeconvolutionLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
+    const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  if (this->bias_term_ && this->param_propagate_down_[1]) {
+    Btype* bias_diff = this->blobs_[1]->template mutable_gpu_diff<Btype>();
+    if (this->overwrite_param_diffs_) {
+      caffe_gpu_set(this->blobs_[1]->count(), Btype(0), bias_diff);
+    }
+    for (int i = 0; i < top.size(); ++i) {
+      const Btype* top_diff = top[i]->gpu_diff<Btype>();
+      for (int n = 0; n < this->num_; ++n) {
+        this->backward_gpu_bias(bias_diff, top_diff + n * this->top_dim_);
+      }
+    }
+  }
+  for (int i = 0; i < top.size(); ++i) {
+    proxy_bottoms_[i]->set_gpu_data(const_cast<Btype*>(top[i]->gpu_diff<Btype>()));
+  }
+  if (this->param_propagate_down_[0]) {
+    // dE/dW of the transposed convolution with x = top diff and dE/dy = bottom
+    for (int i = 0; i < top.size(); ++i) {
+      proxy_tops_[i]->set_gpu_diff(const_cast<Btype*>(bottom[i]->gpu_data<Btype>()));
+    }
+    transposed_->set_param_propagate_down(0, true);
+    transposed_->set_overwrite_param_diffs(this->overwrite_param_diffs_);
+    // Its Backward runs twice per iteration, its Reshape follows the passes to settle
+    // algorithms and workspace
+    transposed_->Reshape(proxy_bottom_vec_, proxy_top_vec_);
+    transposed_->Backward(proxy_top_vec_, vector<bool>(top.size(), false), proxy_bottom_vec_);
+  }
+  if (std::find(propagate_down.begin(), propagate_down.end(), true) != propagate_down.end()) {
+    // Its forward pass on the top diff is the bottom diff
+    for (int i = 0; i < top.size(); ++i) {
+      if (propagate_down[i]) {
+        proxy_tops_[i]->set_gpu_data(bottom[i]->mutable_gpu_diff<Btype>());
+      } else {
+        scratch_.ReshapeLike(*bottom[i]);
+        proxy_tops_[i]->set_gpu_data(scratch_.mutable_gpu_data());
+      }
+    }
+    transposed_->Forward(proxy_bottom_vec_, proxy_top_vec_);
+  }
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS_FB(CuDNNDeconvolutionLayer);
+
+}  // namespace caffe
+#endif
@@ -17,7 +17,7 @@ void CuDNNDropoutLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
         this->bottom_desc_, bottom_data,
         this->top_desc_, top_data,
         reserve_space_.data(), reserve_space_size_));
-    CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+    CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
   } else {
     caffe_copy<Ftype>(bottom[0]->count(), bottom_data, top_data);
   }
@@ -36,7 +36,7 @@ void CuDNNDropoutLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
           this->top_desc_, top_diff,
           this->bottom_desc_, bottom_diff,
           reserve_space_.data(), reserve_space_size_));
-      CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+      CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
     } else {
       caffe_copy(top[0]->count(), top_diff, bottom_diff);
     }
@@ -22,7 +22,7 @@ void CuDNNLCNLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
         temp1_.data(), temp2_.data(),
         cudnn::dataType<Ftype>::zero,
         fwd_top_desc_, top_data) );
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 
   temp1_.release();
   temp2_.release();
@@ -49,7 +49,7 @@ void CuDNNLCNLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
         cudnn::dataType<Btype>::zero,
         bwd_bottom_desc_, bottom_diff,
         NULL) );
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 
   temp1_.release();
   temp2_.release();
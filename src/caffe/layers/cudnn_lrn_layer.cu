@@ -15,7 +15,7 @@ void CuDNNLRNLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
       fwd_bottom_desc_, bottom[0]->gpu_data<Ftype>(),
       cudnn::dataType<Ftype>::zero,
       fwd_top_desc_, top[0]->mutable_gpu_data<Ftype>()));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template <typename Ftype, typename Btype>
@@ -30,7 +30,7 @@ void CuDNNLRNLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
       bwd_bottom_desc_, bottom[0]->gpu_data<Btype>(),
       cudnn::dataType<Btype>::zero,
       bwd_bottom_desc_, bottom[0]->mutable_gpu_diff<Btype>()));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(CuDNNLRNLayer);
@@ -52,14 +52,18 @@ template <typename Ftype, typename Btype>
 void CuDNNPoolingLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
     const vector<Blob*>& top) {
   PoolingLayer<Ftype, Btype>::Reshape(bottom, top);
+  const Packing packing = bottom[0]->packing();
   cudnn::setTensor4dDesc<Ftype>(&fwd_bottom_desc_, bottom[0]->num(),
-      this->channels_, this->height_, this->width_);
+      this->channels_, this->height_, this->width_, packing);
   cudnn::setTensor4dDesc<Ftype>(&fwd_top_desc_, bottom[0]->num(),
-      this->channels_, this->pooled_height_, this->pooled_width_);
+      this->channels_, this->pooled_height_, this->pooled_width_, packing);
   cudnn::setTensor4dDesc<Btype>(&bwd_bottom_desc_, bottom[0]->num(),
-      this->channels_, this->height_, this->width_);
+      this->channels_, this->height_, this->width_, packing);
   cudnn::setTensor4dDesc<Btype>(&bwd_top_desc_, bottom[0]->num(),
-      this->channels_, this->pooled_height_, this->pooled_width_);
+      this->channels_, this->pooled_height_, this->pooled_width_, packing);
+  for (Blob* blob : top) {
+    blob->set_packing(packing);
+  }
 
   if (this->is_max_pooling_) {
     private_top_.resize(top.size());
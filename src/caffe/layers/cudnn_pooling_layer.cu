@@ -14,7 +14,7 @@ void CuDNNPoolingLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
   CUDNN_CHECK(cudnnPoolingForward(Caffe::cudnn_handle(), pooling_desc_,
       cudnn::dataType<Ftype>::one, fwd_bottom_desc_, bottom_data,
       cudnn::dataType<Ftype>::zero, fwd_top_desc_, top_data));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 
   if (this->is_max_pooling_) {
     for (int i = 0; i < top.size(); ++i) {
@@ -39,7 +39,7 @@ void CuDNNPoolingLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
   CUDNN_CHECK(cudnnPoolingBackward(Caffe::cudnn_handle(),  pooling_desc_,
       cudnn::dataType<Btype>::one, bwd_top_desc_, top_data, bwd_top_desc_, top_diff,
       bwd_bottom_desc_, bottom_data, cudnn::dataType<Btype>::zero, bwd_bottom_desc_, bottom_diff));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(CuDNNPoolingLayer);
@@ -19,7 +19,7 @@ void CuDNNReLULayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
         fwd_bottom_desc_, bottom_data,
         cudnn::dataType<Ftype>::zero,
         fwd_top_desc_, top[0]->mutable_gpu_data<Ftype>()));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template <typename Ftype, typename Btype>
@@ -44,7 +44,7 @@ void CuDNNReLULayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
         bwd_bottom_desc_, bottom_data,
         cudnn::dataType<Btype>::zero,
         bwd_bottom_desc_, bottom_diff));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(CuDNNReLULayer);
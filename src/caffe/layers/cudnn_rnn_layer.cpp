@@ -0,0 +1,252 @@
+#ifdef USE_CUDNN
+
+#include <cmath>
+#include <vector>
+
+#include "caffe/filler.hpp"
+#include "caffe/layers/cudnn_rnn_layer.hpp"
+
+namespace caffe {
+
+template <typename Ftype, typename Btype>
+void CuDNNRNNLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  CHECK_EQ(tp<Ftype>(), tp<Btype>()) << "RNN layer " << this->name()
+      << " needs the same forward and backward types";
+  const RNNParameter& rnn_param = this->layer_param_.rnn_param();
+  switch (rnn_param.mode()) {
+    case RNNParameter_Mode_LSTM:
+      mode_ = CUDNN_LSTM;
+      break;
+    case RNNParameter_Mode_GRU:
+      mode_ = CUDNN_GRU;
+      break;
+    case RNNParameter_Mode_RELU:
+      mode_ = CUDNN_RNN_RELU;
+      break;
+    default:
+      mode_ = CUDNN_RNN_TANH;
+      break;
+  }
+  CHECK(mode_ == CUDNN_LSTM || (bottom.size() < 3 && top.size() < 3))
+      << "Only LSTM has a cell state";
+  hidden_size_ = rnn_param.num_output();
+  CHECK_GT(hidden_size_, 0) << "RNN num_output must be positive";
+  num_layers_ = rnn_param.num_layers();
+  CHECK_GT(num_layers_, 0);
+  directions_ = rnn_param.bidirectional() ? 2 : 1;
+  direction_ = rnn_param.bidirectional() ? CUDNN_BIDIRECTIONAL : CUDNN_UNIDIRECTIONAL;
+  CHECK_EQ(bottom[0]->num_axes(), 3) << "RNN input must be T x N x input";
+  input_size_ = bottom[0]->shape(2);
+  algo_by_user_ = rnn_param.algo() != RNNParameter_Algo_DEFAULT;
+  algo_ = rnn_param.algo() == RNNParameter_Algo_PERSIST_STATIC ? CUDNN_RNN_ALGO_PERSIST_STATIC :
+      rnn_param.algo() == RNNParameter_Algo_PERSIST_DYNAMIC ? CUDNN_RNN_ALGO_PERSIST_DYNAMIC :
+      CUDNN_RNN_ALGO_STANDARD;
+
+  data_type_ = cudnn::dataType<Ftype>::type;
+  // Half data may be computed in either precision, others only in their own
+  math_type_ = is_type<float16>(tp<Ftype>()) ?
+      cudnn::cudnn_data_type(this->layer_param_.forward_math()) : data_type_;
+
+  CUDNN_CHECK(cudnnCreateRNNDescriptor(&rnn_desc_));
+  CUDNN_CHECK(cudnnCreateDropoutDescriptor(&dropout_desc_));
+  CUDNN_CHECK(cudnnCreateFilterDescriptor(&w_desc_));
+  CUDNN_CHECK(cudnnCreateFilterDescriptor(&dw_desc_));
+  CUDNN_CHECK(cudnnCreateTensorDescriptor(&hx_desc_));
+  CUDNN_CHECK(cudnnCreateTensorDescriptor(&cx_desc_));
+  handles_setup_ = true;
+
+  const float dropout = this->phase_ == TRAIN ? rnn_param.dropout_ratio() : 0.F;
+  if (dropout > 0.F) {
+    CUDNN_CHECK(cudnnDropoutGetStatesSize(Caffe::cudnn_handle(), &states_size_));
+    states_.reserve(states_size_);
+  }
+  const uint64_t seed = rnn_param.random_seed() >= 0 ?
+      static_cast<uint64_t>(rnn_param.random_seed()) : Caffe::next_seed();
+  CUDNN_CHECK(cudnnSetDropoutDescriptor(dropout_desc_, Caffe::cudnn_handle(), dropout,
+      dropout > 0.F ? states_.data() : nullptr, states_size_, seed));
+  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  SetRNNDesc();
+
+  // The flat weight size only depends on the input size
+  cudnnTensorDescriptor_t x_desc;
+  CUDNN_CHECK(cudnnCreateTensorDescriptor(&x_desc));
+  const int x_dims[3] = {1, input_size_, 1};
+  const int x_strides[3] = {input_size_, 1, 1};
+  CUDNN_CHECK(cudnnSetTensorNdDescriptor(x_desc, data_type_, 3, x_dims, x_strides));
+  size_t weights_size = 0UL;
+  CUDNN_CHECK(cudnnGetRNNParamsSize(Caffe::cudnn_handle(), rnn_desc_, x_desc, &weights_size,
+      data_type_));
+  CUDNN_CHECK(cudnnDestroyTensorDescriptor(x_desc));
+  const int weights_count = weights_size / sizeof(Ftype);
+  const int w_dims[3] = {weights_count, 1, 1};
+  CUDNN_CHECK(cudnnSetFilterNdDescriptor(w_desc_, data_type_, CUDNN_TENSOR_NCHW, 3, w_dims));
+  CUDNN_CHECK(cudnnSetFilterNdDescriptor(dw_desc_, data_type_, CUDNN_TENSOR_NCHW, 3, w_dims));
+
+  if (this->blobs_.size() > 0) {
+    LOG(INFO) << "Skipping parameter initialization";
+    CHECK_EQ(weights_count, this->blobs_[0]->count()) << "RNN weights don't match "
+        << this->name() << "'s sizes";
+  } else {
+    this->blobs_.resize(1);
+    this->blobs_[0] = Blob::create<Ftype, Btype>(vector<int>(1, weights_count));
+    FillWeights();
+  }
+  this->param_propagate_down_.resize(this->blobs_.size(), true);
+}
+
+template <typename Ftype, typename Btype>
+void CuDNNRNNLayer<Ftype, Btype>::SetRNNDesc() {
+  CUDNN_CHECK(cudnnSetRNNDescriptor_v6(Caffe::cudnn_handle(), rnn_desc_, hidden_size_,
+      num_layers_, dropout_desc_, CUDNN_LINEAR_INPUT, direction_, mode_, algo_, math_type_));
+#if CUDNN_VERSION_MIN(7, 0, 0)
+  const int math_override = this->layer_param_.cudnn_math_override();
+  const bool tensor_ops = math_override < 0 ? is_type<float16>(tp<Ftype>()) : math_override > 0;
+  CUDNN_CHECK(cudnnSetRNNMatrixMathType(rnn_desc_,
+      tensor_ops ? CUDNN_TENSOR_OP_MATH : CUDNN_DEFAULT_MATH));
+#endif
+  if (plan_ != nullptr) {
+    CUDNN_CHECK(cudnnDestroyPersistentRNNPlan(plan_));
+    plan_ = nullptr;
+  }
+  if (algo_ == CUDNN_RNN_ALGO_PERSIST_DYNAMIC && batch_ > 0) {
+    CUDNN_CHECK(cudnnCreatePersistentRNNPlan(rnn_desc_, batch_, math_type_, &plan_));
+    CUDNN_CHECK(cudnnSetPersistentRNNPlan(rnn_desc_, plan_));
+  }
+}
+
+template <typename Ftype, typename Btype>
+void CuDNNRNNLayer<Ftype, Btype>::FillWeights() {
+  const RNNParameter& rnn_param = this->layer_param_.rnn_param();
+  Blob* weights = this->blobs_[0].get();
+  FillerParameter weight_filler_param = rnn_param.weight_filler();
+  if (!rnn_param.has_weight_filler()) {
+    const float bound = 1.F / std::sqrt(static_cast<float>(hidden_size_));
+    weight_filler_param.set_type("uniform");
+    weight_filler_param.set_min(-bound);
+    weight_filler_param.set_max(bound);
+  }
+  shared_ptr<Filler<Ftype>> weight_filler(GetFiller<Ftype>(weight_filler_param));
+  weight_filler->Fill(weights);
+  shared_ptr<Filler<Ftype>> bias_filler(GetFiller<Ftype>(rnn_param.bias_filler()));
+
+  // Bias locations are offsets from the weights on the device
+  const char* w = static_cast<const char*>(weights->gpu_data<Ftype>());
+  Ftype* w_cpu = weights->mutable_cpu_data<Ftype>();
+  cudnnTensorDescriptor_t x_desc;
+  cudnnFilterDescriptor_t bias_desc;
+  CUDNN_CHECK(cudnnCreateTensorDescriptor(&x_desc));
+  CUDNN_CHECK(cudnnCreateFilterDescriptor(&bias_desc));
+  const int x_dims[3] = {1, input_size_, 1};
+  const int x_strides[3] = {input_size_, 1, 1};
+  CUDNN_CHECK(cudnnSetTensorNdDescriptor(x_desc, data_type_, 3, x_dims, x_strides));
+  // Input and recurrent matrices each per gate
+  const int lin_layers = mode_ == CUDNN_LSTM ? 8 : mode_ == CUDNN_GRU ? 6 : 2;
+  TBlob<Ftype> bias;
+  for (int layer = 0; layer < num_layers_ * directions_; ++layer) {
+    for (int lin = 0; lin < lin_layers; ++lin) {
+      void* b = nullptr;
+      CUDNN_CHECK(cudnnGetRNNLinLayerBiasParams(Caffe::cudnn_handle(), rnn_desc_, layer,
+          x_desc, w_desc_, w, lin, bias_desc, &b));
+      cudnnDataType_t type;
+      cudnnTensorFormat_t format;
+      int nb_dims = 0;
+      int dims[3];
+      CUDNN_CHECK(cudnnGetFilterNdDescriptor(bias_desc, 3, &type, &format, &nb_dims, dims));
+      bias.Reshape(vector<int>(1, dims[0] * dims[1] * dims[2]));
+      bias_filler->Fill(&bias);
+      const size_t offset = (static_cast<const char*>(b) - w) / sizeof(Ftype);
+      caffe_copy(bias.count(), bias.cpu_data(), w_cpu + offset);
+    }
+  }
+  CUDNN_CHECK(cudnnDestroyFilterDescriptor(bias_desc));
+  CUDNN_CHECK(cudnnDestroyTensorDescriptor(x_desc));
+}
+
+template <typename Ftype, typename Btype>
+void CuDNNRNNLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  CHECK_EQ(bottom[0]->num_axes(), 3) << "RNN input must be T x N x input";
+  CHECK_EQ(input_size_, bottom[0]->shape(2)) << "RNN input size can't change";
+  const int seq_length = bottom[0]->shape(0);
+  const int batch = bottom[0]->shape(1);
+  const vector<int> state_shape{num_layers_ * directions_, batch, hidden_size_};
+  for (int i = 1; i < bottom.size(); ++i) {
+    CHECK(bottom[i]->shape() == state_shape) << "RNN initial states must be "
+        << num_layers_ * directions_ << " x " << batch << " x " << hidden_size_;
+  }
+  top[0]->Reshape(vector<int>{seq_length, batch, hidden_size_ * directions_});
+  for (int i = 1; i < top.size(); ++i) {
+    top[i]->Reshape(state_shape);
+  }
+  if (seq_length == seq_length_ && batch == batch_) {
+    return;
+  }
+  if (batch != batch_) {
+    batch_ = batch;
+    if (!algo_by_user_) {
+      algo_ = batch_ <= 32 && !is_type<double>(tp<Ftype>()) &&
+          Caffe::device_capability(Caffe::current_device()) >= 600 ?
+          CUDNN_RNN_ALGO_PERSIST_STATIC : CUDNN_RNN_ALGO_STANDARD;
+    }
+    SetRNNDesc();
+  }
+  seq_length_ = seq_length;
+  for (cudnnTensorDescriptor_t desc : x_descs_) {
+    CUDNN_CHECK(cudnnDestroyTensorDescriptor(desc));
+  }
+  for (cudnnTensorDescriptor_t desc : y_descs_) {
+    CUDNN_CHECK(cudnnDestroyTensorDescriptor(desc));
+  }
+  x_descs_.assign(seq_length_, nullptr);
+  y_descs_.assign(seq_length_, nullptr);
+  const int x_dims[3] = {batch_, input_size_, 1};
+  const int x_strides[3] = {input_size_, 1, 1};
+  const int y_dims[3] = {batch_, hidden_size_ * directions_, 1};
+  const int y_strides[3] = {hidden_size_ * directions_, 1, 1};
+  for (int t = 0; t < seq_length_; ++t) {
+    CUDNN_CHECK(cudnnCreateTensorDescriptor(&x_descs_[t]));
+    CUDNN_CHECK(cudnnCreateTensorDescriptor(&y_descs_[t]));
+    CUDNN_CHECK(cudnnSetTensorNdDescriptor(x_descs_[t], data_type_, 3, x_dims, x_strides));
+    CUDNN_CHECK(cudnnSetTensorNdDescriptor(y_descs_[t], data_type_, 3, y_dims, y_strides));
+  }
+  const int h_dims[3] = {num_layers_ * directions_, batch_, hidden_size_};
+  const int h_strides[3] = {batch_ * hidden_size_, hidden_size_, 1};
+  CUDNN_CHECK(cudnnSetTensorNdDescriptor(hx_desc_, data_type_, 3, h_dims, h_strides));
+  CUDNN_CHECK(cudnnSetTensorNdDescriptor(cx_desc_, data_type_, 3, h_dims, h_strides));
+
+  CUDNN_CHECK(cudnnGetRNNWorkspaceSize(Caffe::cudnn_handle(), rnn_desc_, seq_length_,
+      x_descs_.data(), &workspace_size_));
+  if (this->phase_ == TRAIN) {
+    CUDNN_CHECK(cudnnGetRNNTrainingReserveSize(Caffe::cudnn_handle(), rnn_desc_, seq_length_,
+        x_descs_.data(), &reserve_size_));
+    reserve_space_.reserve(reserve_size_);
+  }
+}
+
+template <typename Ftype, typename Btype>
+CuDNNRNNLayer<Ftype, Btype>::~CuDNNRNNLayer() {
+  reserve_space_.release();
+  states_.release();
+  if (!handles_setup_) { return; }
+  for (cudnnTensorDescriptor_t desc : x_descs_) {
+    cudnnDestroyTensorDescriptor(desc);
+  }
+  for (cudnnTensorDescriptor_t desc : y_descs_) {
+    cudnnDestroyTensorDescriptor(desc);
+  }
+  cudnnDestroyTensorDescriptor(hx_desc_);
+  cudnnDestroyTensorDescriptor(cx_desc_);
+  cudnnDestroyFilterDescriptor(w_desc_);
+  cudnnDestroyFilterDescriptor(dw_desc_);
+  if (plan_ != nullptr) {
+    cudnnDestroyPersistentRNNPlan(plan_);
+  }
+  cudnnDestroyRNNDescriptor(rnn_desc_);
+  cudnnDestroyDropoutDescriptor(dropout_desc_);
+}
+
+INSTANTIATE_CLASS_FB(CuDNNRNNLayer);
+
+}  // namespace caffe
+#endif
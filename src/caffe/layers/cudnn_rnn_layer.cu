@@ -0,0 +1,101 @@
+#ifdef USE_CUDNN
+
+#include <vector>
+
+#include "caffe/layers/cudnn_rnn_layer.hpp"
+
+namespace caffe {
+
+template <typename Ftype, typename Btype>
+void CuDNNRNNLayer<Ftype, Btype>::ForwardCall(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  const Ftype* x = bottom[0]->gpu_data<Ftype>();
+  const Ftype* hx = bottom.size() > 1 ? bottom[1]->gpu_data<Ftype>() : nullptr;
+  const Ftype* cx = bottom.size() > 2 ? bottom[2]->gpu_data<Ftype>() : nullptr;
+  const Ftype* w = this->blobs_[0]->template gpu_data<Ftype>();
+  Ftype* y = top[0]->mutable_gpu_data<Ftype>();
+  Ftype* hy = top.size() > 1 ? top[1]->mutable_gpu_data<Ftype>() : nullptr;
+  Ftype* cy = top.size() > 2 ? top[2]->mutable_gpu_data<Ftype>() : nullptr;
+  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::thread_workspace(Caffe::current_device());
+  ws->reserve(workspace_size_);
+  cudnnStatus_t status;
+  if (this->phase_ == TRAIN) {
+    status = cudnnRNNForwardTraining(Caffe::cudnn_handle(), rnn_desc_, seq_length_,
+        x_descs_.data(), x, hx_desc_, hx, cx_desc_, cx, w_desc_, w,
+        y_descs_.data(), y, hx_desc_, hy, cx_desc_, cy,
+        ws->data(), workspace_size_, reserve_space_.data(), reserve_size_);
+  } else {
+    status = cudnnRNNForwardInference(Caffe::cudnn_handle(), rnn_desc_, seq_length_,
+        x_descs_.data(), x, hx_desc_, hx, cx_desc_, cx, w_desc_, w,
+        y_descs_.data(), y, hx_desc_, hy, cx_desc_, cy,
+        ws->data(), workspace_size_);
+  }
+  if (status == CUDNN_STATUS_NOT_SUPPORTED && !algo_by_user_ &&
+      algo_ != CUDNN_RNN_ALGO_STANDARD) {
+    LOG(INFO) << "Persistent RNN kernels don't support " << this->name()
+        << "'s sizes, using the standard ones";
+    algo_ = CUDNN_RNN_ALGO_STANDARD;
+    SetRNNDesc();
+    // Sizes depend on the algo
+    seq_length_ = 0;
+    Reshape(bottom, top);
+    ForwardCall(bottom, top);
+    return;
+  }
+  CUDNN_CHECK(status);
+}
+
+template <typename Ftype, typename Btype>
+void CuDNNRNNLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  ForwardCall(bottom, top);
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
+}
+
+template <typename Ftype, typename Btype>
+void CuDNNRNNLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
+    const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  CHECK_EQ(this->phase_, TRAIN) << "RNN layer " << this->name()
+      << " needs the TRAIN phase reserve space for backward";
+  const Btype* x = bottom[0]->gpu_data<Btype>();
+  const Btype* hx = bottom.size() > 1 ? bottom[1]->gpu_data<Btype>() : nullptr;
+  const Btype* cx = bottom.size() > 2 ? bottom[2]->gpu_data<Btype>() : nullptr;
+  const Btype* w = this->blobs_[0]->template gpu_data<Btype>();
+  const Btype* y = top[0]->gpu_data<Btype>();
+  const Btype* dy = top[0]->gpu_diff<Btype>();
+  const Btype* dhy = top.size() > 1 ? top[1]->gpu_diff<Btype>() : nullptr;
+  const Btype* dcy = top.size() > 2 ? top[2]->gpu_diff<Btype>() : nullptr;
+  Btype* dx;
+  if (propagate_down[0]) {
+    dx = bottom[0]->mutable_gpu_diff<Btype>();
+  } else {
+    dx_scratch_.ReshapeLike(*bottom[0]);
+    dx = dx_scratch_.mutable_gpu_data();
+  }
+  Btype* dhx = bottom.size() > 1 && propagate_down[1] ?
+      bottom[1]->mutable_gpu_diff<Btype>() : nullptr;
+  Btype* dcx = bottom.size() > 2 && propagate_down[2] ?
+      bottom[2]->mutable_gpu_diff<Btype>() : nullptr;
+  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::thread_workspace(Caffe::current_device());
+  ws->reserve(workspace_size_);
+  // Data first, it computes what weights need
+  CUDNN_CHECK(cudnnRNNBackwardData(Caffe::cudnn_handle(), rnn_desc_, seq_length_,
+      y_descs_.data(), y, y_descs_.data(), dy, hx_desc_, dhy, cx_desc_, dcy,
+      w_desc_, w, hx_desc_, hx, cx_desc_, cx,
+      x_descs_.data(), dx, hx_desc_, dhx, cx_desc_, dcx,
+      ws->data(), workspace_size_, reserve_space_.data(), reserve_size_));
+  if (this->param_propagate_down_[0]) {
+    // Accumulated into dw
+    CUDNN_CHECK(cudnnRNNBackwardWeights(Caffe::cudnn_handle(), rnn_desc_, seq_length_,
+        x_descs_.data(), x, hx_desc_, hx, y_descs_.data(), y,
+        ws->data(), workspace_size_, dw_desc_,
+        this->blobs_[0]->template mutable_gpu_diff<Btype>(),
+        reserve_space_.data(), reserve_size_));
+  }
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS_FB(CuDNNRNNLayer);
+
+}  // namespace caffe
+#endif
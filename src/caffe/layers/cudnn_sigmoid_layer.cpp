@@ -28,10 +28,10 @@ void CuDNNSigmoidLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
   const int K = bottom[0]->channels();
   const int H = bottom[0]->height();
   const int W = bottom[0]->width();
-  cudnn::setTensor4dDesc<Ftype>(&fwd_bottom_desc_, N, K, H, W);
-  cudnn::setTensor4dDesc<Ftype>(&fwd_top_desc_, N, K, H, W);
-  cudnn::setTensor4dDesc<Btype>(&bwd_bottom_desc_, N, K, H, W);
-  cudnn::setTensor4dDesc<Btype>(&bwd_top_desc_, N, K, H, W);
+  cudnn::setTensor4dDesc<Ftype>(&fwd_bottom_desc_, N, K, H, W, bottom[0]->packing());
+  cudnn::setTensor4dDesc<Ftype>(&fwd_top_desc_, N, K, H, W, bottom[0]->packing());
+  cudnn::setTensor4dDesc<Btype>(&bwd_bottom_desc_, N, K, H, W, bottom[0]->packing());
+  cudnn::setTensor4dDesc<Btype>(&bwd_top_desc_, N, K, H, W, bottom[0]->packing());
 }
 
 template <typename Ftype, typename Btype>
@@ -16,7 +16,7 @@ void CuDNNSigmoidLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
         this->fwd_bottom_desc_, bottom_data,
         cudnn::dataType<Ftype>::zero,
         this->fwd_top_desc_, top_data));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template <typename Ftype, typename Btype>
@@ -37,7 +37,7 @@ void CuDNNSigmoidLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
         bwd_bottom_desc_, bottom_data,
         cudnn::dataType<Btype>::zero,
         bwd_bottom_desc_, bottom_diff));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(CuDNNSigmoidLayer);
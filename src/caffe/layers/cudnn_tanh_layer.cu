@@ -16,7 +16,7 @@ void CuDNNTanHLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
         fwd_bottom_desc_, bottom_data,
         cudnn::dataType<Ftype>::zero,
         fwd_top_desc_, top_data));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template <typename Ftype, typename Btype>
@@ -39,7 +39,7 @@ void CuDNNTanHLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
         bwd_bottom_desc_, bottom_data,
         cudnn::dataType<Btype>::zero,
         bwd_bottom_desc_, bottom_diff));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(CuDNNTanHLayer);
@@ -1,8 +1,12 @@
+#include <algorithm>
+#include <thread>
+
 #include "caffe/data_transformer.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/layers/data_layer.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/parallel.hpp"
+#include "caffe/util/thread_profile.hpp"
 
 namespace caffe {
 
@@ -10,10 +14,52 @@ template<typename Ftype, typename Btype>
 DataLayer<Ftype, Btype>::DataLayer(const LayerParameter& param)
   : BasePrefetchingDataLayer<Ftype, Btype>(param),
     cache_(param.data_param().cache()),
-    shuffle_(param.data_param().shuffle()) {
+    shuffle_(param.data_param().shuffle()),
+    tune_(param.data_param().auto_tune() && this->phase_ == TRAIN && !Caffe::deterministic()),
+    tune_budget_(0UL),
+    tune_mark_(0UL),
+    parser_busy_mark_(0UL),
+    tune_hint_parsers_(0UL),
+    tune_hint_transf_(0UL),
+    reader_start_(0UL),
+    reader_batches_(0UL),
+    queue_offset_(0UL),
+    datum_wait_us_(0UL),
+    echo_max_(std::max(1U, param.data_param().echo_factor())),
+    echo_auto_(param.data_param().echo_auto() && !Caffe::deterministic()),
+    echo_factor_(1U),
+    echoed_samples_(0UL),
+    echo_mark_(0UL),
+    echo_windows_(0UL),
+    echo_wait_mark_(0UL),
+    echo_busy_mark_(0UL),
+    echo_samples_mark_(0UL),
+    echoed_mark_(0UL),
+    param_batch_size_(param.data_param().batch_size()),
+    param_crop_size_(param.transform_param().crop_size()),
+    crop_size_(param_crop_size_),
+    pending_batch_size_(0) {
   sample_only_.store(this->auto_mode_ && this->phase_ == TRAIN);
   init_offsets();
   datum_encoded_ = false;
+  bucketing_ = param.data_param().bucket_by_shape();
+  if (bucketing_) {
+    CHECK(!this->auto_mode_) << "bucket_by_shape requires threads and parser_threads set";
+    LOG_IF(WARNING, this->is_gpu_transform()) << "bucket_by_shape is ignored: it needs"
+        << " CPU transform";
+    bucketing_ = !this->is_gpu_transform();
+  }
+  if (tune_ && (cache_ || bucketing_)) {
+    LOG(INFO) << "Thread count auto-tuning is ignored: "
+        << (cache_ ? "cached data is shared by readers" : "buckets don't keep record order");
+    tune_ = false;
+  }
+  if (echo_max_ > 1U && (this->phase_ != TRAIN || bucketing_)) {
+    LOG(INFO) << "Data echoing is ignored: "
+        << (bucketing_ ? "buckets don't keep batches" : "it's for train nets only");
+    echo_max_ = 1U;
+  }
+  echo_factor_.store(echo_auto_ ? 1U : echo_max_);
 }
 
 template<typename Ftype, typename Btype>
@@ -45,7 +91,22 @@ DataLayer<Ftype, Btype>::ResizeQueues() {
       tmp_holder_[i] = make_shared<GPUMemory::Workspace>();
     }
   }
+  augment_.resize(this->transf_num_);
+  for (size_t i = 0; i < this->transf_num_; ++i) {
+    if (!augment_[i]) {
+      augment_[i] = make_shared<AugmentBuffers>();
+    }
+  }
+#ifdef USE_NVJPEG
+  nvjpeg_decoders_.resize(this->transf_num_);
+#endif
 #endif
+  if (bucketing_) {
+    buckets_.resize(this->transf_num_);
+  }
+  echo_datums_.resize(this->transf_num_);
+  echo_left_.resize(this->transf_num_, 0U);
+  echo_pass_.resize(this->transf_num_, 0U);
 }
 
 template<typename Ftype, typename Btype>
@@ -64,7 +125,7 @@ DataLayer<Ftype, Btype>::InitializePrefetch() {
   }
   if (this->auto_mode()) {
     this->AllocatePrefetch();
-    P2PManager::dl_bar_wait();
+    P2PManager::dl_bar_wait(static_cast<int>(this->solver_rank_));
     // Here we try to optimize memory split between prefetching and convolution.
     // All data and parameter blobs are allocated at this moment.
     // Now let's find out what's left...
@@ -104,7 +165,7 @@ DataLayer<Ftype, Btype>::InitializePrefetch() {
       current_parsers_num = 1;
       current_transf_num = max_transf_num;
     }
-    this->RestartAllThreads(current_transf_num, true, false, Caffe::next_seed());
+    this->RestartAllThreads(current_transf_num, true, true, Caffe::next_seed());
     this->transf_num_ = this->threads_num();
     this->parsers_num_ = current_parsers_num;
     this->queues_num_ = this->transf_num_ * this->parsers_num_;
@@ -126,6 +187,240 @@ DataLayer<Ftype, Btype>::InitializePrefetch() {
   layer_inititialized_flag_.set();
 }
 
+template<typename Ftype, typename Btype>
+void DataLayer<Ftype, Btype>::tune_threads() {
+  // Share of iteration time the net may wait for data before another thread is added
+  static constexpr double STARVING = 0.02;
+  // Threads are retired when the net never waits and the rest would be loaded less than this
+  static constexpr double FED = 0.002, RETIRE_LOAD = 0.7;
+  if (pending_batch_size_ > 0 && layer_inititialized_flag_.is_set() && !sample_only_.load()) {
+    retune(this->parsers_num_, this->transf_num_, pending_batch_size_);
+    pending_batch_size_ = 0;
+  }
+  tune_echo();
+  if (!tune_ || !layer_inititialized_flag_.is_set() || sample_only_.load()) {
+    return;
+  }
+  const DataParameter& dparam = this->layer_param_.data_param();
+  const auto now = std::chrono::steady_clock::now();
+  if (tune_budget_ == 0UL) {
+    tune_budget_ = dparam.auto_tune_cpu_budget();
+    if (tune_budget_ == 0UL) {
+      tune_budget_ = std::thread::hardware_concurrency() /
+          std::max(1, Caffe::solver_count() / Caffe::node_count());
+    }
+    tune_budget_ = std::max(tune_budget_, this->parsers_num_ + this->transf_num_);
+    LOG(INFO) << this->print_current_device() << " Thread count auto-tuning, CPU budget: "
+              << tune_budget_ << " threads";
+  } else if (this->batches_popped_ - tune_mark_ < std::max(1U, dparam.auto_tune_interval())) {
+    return;
+  } else {
+    const double window_us = std::max(1., static_cast<double>(
+        std::chrono::duration_cast<std::chrono::microseconds>(now - tune_start_).count()));
+    const uint64_t parser_busy_us = reader_->parser_busy_us();
+    const double wait = this->wait_us_ / window_us;
+    const double transf_load = this->transf_busy_us_.load() / (window_us * this->transf_num_);
+    const double parser_load = (parser_busy_us - parser_busy_mark_) /
+        (window_us * this->parsers_num_);
+    size_t parsers = this->parsers_num_, transf = this->transf_num_;
+    if (wait > STARVING) {
+      // The busier stage gets one more thread
+      if (parsers + transf >= tune_budget_) {
+        LOG_FIRST_N(INFO, 1) << this->print_current_device()
+            << " Data pipeline can't keep up, CPU budget of " << tune_budget_ << " reached";
+      } else if (parser_load > transf_load) {
+        ++parsers;
+      } else {
+        ++transf;
+      }
+    } else if (wait < FED) {
+      // Retire a thread when the rest would still keep up
+      if (transf > 1UL && transf_load * transf / (transf - 1UL) < RETIRE_LOAD) {
+        --transf;
+      } else if (parsers > 1UL && parser_load * parsers / (parsers - 1UL) < RETIRE_LOAD) {
+        --parsers;
+      }
+    }
+    if (parsers != this->parsers_num_ || transf != this->transf_num_) {
+      const bool apply = Caffe::solver_count() == 1;
+      if (apply || parsers != tune_hint_parsers_ || transf != tune_hint_transf_) {
+        LOG(INFO) << this->print_current_device() << " Waited for data "
+                  << std::lround(wait * 100.) << "% of " << std::lround(window_us / 1000.)
+                  << " ms, transformer load " << std::lround(transf_load * 100.)
+                  << "%, parser load " << std::lround(parser_load * 100.) << "%: "
+                  << (apply ? "switching to" : "recommended (not applied to multiple solvers)")
+                  << " threads: " << transf << " parser_threads: " << parsers;
+      }
+      tune_hint_parsers_ = parsers;
+      tune_hint_transf_ = transf;
+      if (apply) {
+        retune(parsers, transf);
+      }
+    }
+  }
+  // New window
+  tune_mark_ = this->batches_popped_;
+  tune_start_ = std::chrono::steady_clock::now();
+  this->wait_us_ = 0UL;
+  this->transf_busy_us_.store(0UL);
+  parser_busy_mark_ = reader_->parser_busy_us();
+}
+
+template<typename Ftype, typename Btype>
+void DataLayer<Ftype, Btype>::tune_echo() {
+  // Same thresholds as thread tuning: echo more when the net waits, less when
+  // transformers would keep up with more new records
+  static constexpr double STARVING = 0.02, FED = 0.002, SPARE_LOAD = 0.7;
+  // Windows between two reports of unchanged factor
+  static constexpr size_t REPORT_WINDOWS = 10UL;
+  if (echo_max_ <= 1U || !echo_auto_ || !layer_inititialized_flag_.is_set() ||
+      sample_only_.load()) {
+    return;
+  }
+  const DataParameter& dparam = this->layer_param_.data_param();
+  const auto now = std::chrono::steady_clock::now();
+  if (echo_start_ != std::chrono::steady_clock::time_point() &&
+      this->batches_popped_ - echo_mark_ < std::max(1U, dparam.auto_tune_interval())) {
+    return;
+  }
+  if (echo_start_ != std::chrono::steady_clock::time_point()) {
+    const double window_us = std::max(1., static_cast<double>(
+        std::chrono::duration_cast<std::chrono::microseconds>(now - echo_start_).count()));
+    const double wait = (this->total_wait_us_.load() - echo_wait_mark_) / window_us;
+    // Time transformers didn't spend waiting for free batches
+    const double transf_load = (this->total_transf_us_.load() - echo_busy_mark_) /
+        (window_us * this->transf_num_);
+    const uint64_t samples = this->samples_loaded_.load() - echo_samples_mark_;
+    const uint64_t unique = samples - (echoed_samples_.load() - echoed_mark_);
+    // More threads come first while the budget allows them
+    const bool threads_first = tune_ && Caffe::solver_count() == 1 &&
+        this->parsers_num_ + this->transf_num_ < tune_budget_;
+    const unsigned factor = echo_factor_.load();
+    unsigned k = factor;
+    if (wait > STARVING && !threads_first && k < echo_max_) {
+      ++k;
+    } else if (wait < FED && k > 1U && transf_load < SPARE_LOAD) {
+      --k;
+    }
+    ++echo_windows_;
+    if (k != factor || (k > 1U && echo_windows_ % REPORT_WINDOWS == 0UL)) {
+      LOG(INFO) << this->print_current_device() << " Waited for data "
+                << std::lround(wait * 100.) << "% of " << std::lround(window_us / 1000.)
+                << " ms, transformer load " << std::lround(transf_load * 100.)
+                << "%, unique samples " << std::lround(unique * 1.e6 / window_us) << "/s ("
+                << std::lround(100. * unique / std::max<uint64_t>(1UL, samples))
+                << "% of samples): data echoing factor " << k;
+    }
+    echo_factor_.store(k);
+  }
+  // New window
+  echo_mark_ = this->batches_popped_;
+  echo_start_ = now;
+  echo_wait_mark_ = this->total_wait_us_.load();
+  echo_busy_mark_ = this->total_transf_us_.load();
+  echo_samples_mark_ = this->samples_loaded_.load();
+  echoed_mark_ = echoed_samples_.load();
+}
+
+template<typename Ftype, typename Btype>
+void DataLayer<Ftype, Btype>::retune(size_t parsers_num, size_t transf_num, int new_batch_size) {
+  std::lock_guard<std::mutex> lock(mutex_prefetch_);
+  const LayerParameter& param = this->layer_param();
+  const size_t batch_size = param.data_param().batch_size();
+  this->StopInternalThread();
+  // Batches prefetched but not consumed yet will be read again by the new reader,
+  // echoed ones had no records of their own. Solvers consume theirs in lock step.
+  const size_t fresh_popped = this->batches_popped_ - this->echoes_popped_;
+  reader_start_ += (fresh_popped - reader_batches_) * batch_size * Caffe::solver_count();
+  reader_batches_ = fresh_popped;
+  reader_.reset();
+  if (new_batch_size > 0 && new_batch_size != static_cast<int>(batch_size)) {
+    LOG(INFO) << this->print_current_device() << " " << this->name() << ": batch size "
+              << batch_size << " -> " << new_batch_size;
+    this->layer_param_.mutable_data_param()->set_batch_size(new_batch_size);
+  }
+  for (size_t i = 0; i < echo_datums_.size(); ++i) {
+    echo_datums_[i].clear();
+    echo_left_[i] = 0U;
+    echo_pass_[i] = 0U;
+  }
+  // Every queue pair owns one batch, stopped transformers might have kept some of them
+  for (size_t i = 0; i < this->prefetch_.size(); ++i) {
+    shared_ptr<Batch> batch;
+    while (this->prefetches_full_[i]->try_pop(&batch)) {}
+    while (this->prefetches_free_[i]->try_pop(&batch)) {}
+#ifndef CPU_ONLY
+    this->prefetch_[i]->wait_pushed();
+#endif
+    this->prefetch_[i]->set_id((size_t) -1);
+    this->prefetches_free_[i]->push(this->prefetch_[i]);
+  }
+#if !defined(CPU_ONLY) && defined(USE_NVJPEG)
+  // Might keep images of interrupted batches
+  for (shared_ptr<NvJpegDecoder>& decoder : nvjpeg_decoders_) {
+    decoder.reset();
+  }
+#endif
+  this->RestartAllThreads(transf_num, true, true, Caffe::next_seed());
+  this->transf_num_ = this->threads_num();
+  this->parsers_num_ = parsers_num;
+  this->queues_num_ = this->transf_num_ * this->parsers_num_;
+  this->next_batch_queue_ = 0UL;
+  for (size_t i = 0; i < this->batch_ids_.size(); ++i) {
+    this->batch_ids_[i] = i;
+  }
+  parser_offsets_.clear();
+  queue_ids_.clear();
+  ResizeQueues();
+  init_offsets();
+  // Auto-tuning is off for cached data, new batch sizes fill the cache again
+  reader_ = make_shared<DataReader>(param,
+      Caffe::solver_count(),
+      this->solver_rank_,
+      this->parsers_num_,
+      this->threads_num(),
+      param.data_param().batch_size(),
+      false,
+      false,
+      cache_,
+      cache_ && shuffle_,
+      reader_start_);
+  start_reading();
+  this->go();
+}
+
+template<typename Ftype, typename Btype>
+bool DataLayer<Ftype, Btype>::set_input_shape(int batch_size, int crop_size) {
+  if (this->phase_ != TRAIN) {
+    return false;
+  }
+  const int crop = crop_size >= 0 ? crop_size : param_crop_size_;
+  const int batch = batch_size > 0 ? batch_size : param_batch_size_;
+  const bool new_crop = crop != crop_size_.load();
+  const bool new_batch = batch != static_cast<int>(this->layer_param_.data_param().batch_size());
+  pending_batch_size_ = 0;
+  if (!new_crop && !new_batch) {
+    return true;
+  }
+  const DataParameter& dparam = this->layer_param_.data_param();
+  CHECK(!new_batch || !(bucketing_ || (dparam.node_reader() && !cache_ &&
+      Caffe::solver_count() / Caffe::node_count() > 1))) << this->name()
+      << ": batch size can't change with " << (bucketing_ ? "bucket_by_shape" : "node_reader");
+  if (new_crop) {
+    LOG(INFO) << this->print_current_device() << " " << this->name() << ": crop size "
+              << crop_size_.load() << " -> " << crop;
+    crop_size_.store(crop);
+  }
+  if (layer_inititialized_flag_.is_set() && !sample_only_.load()) {
+    // Batches prefetched with the old shapes are dropped
+    retune(this->parsers_num_, this->transf_num_, batch);
+  } else {
+    // The first batches are those of the parameter
+    pending_batch_size_ = batch;
+  }
+  return true;
+}
+
 template<typename Ftype, typename Btype>
 size_t DataLayer<Ftype, Btype>::queue_id(size_t thread_id) const {
   const size_t qid = queue_ids_[thread_id] + parser_offsets_[thread_id];
@@ -144,7 +439,7 @@ DataLayer<Ftype, Btype>::DataLayerSetUp(const vector<Blob*>& bottom, const vecto
   const LayerParameter& param = this->layer_param();
   const int batch_size = param.data_param().batch_size();
   const bool use_gpu_transform = this->is_gpu_transform();
-  const bool cache = cache_ && this->phase_ == TRAIN;
+  const bool cache = cache_ && (this->phase_ == TRAIN || param.data_param().shared_cache());
   const bool shuffle = cache && shuffle_ && this->phase_ == TRAIN;
 
   if (this->auto_mode_) {
@@ -172,16 +467,25 @@ DataLayer<Ftype, Btype>::DataLayerSetUp(const vector<Blob*>& bottom, const vecto
           shuffle);
     }
   } else if (!reader_) {
-    reader_ = make_shared<DataReader>(param,
-        Caffe::solver_count(),
-        this->solver_rank_,
-        this->parsers_num_,
-        this->threads_num(),
-        batch_size,
-        false,
-        false,
-        cache,
-        shuffle);
+    // Solvers of a node go in lock step while training only
+    const size_t ranks = this->phase_ == TRAIN ? Caffe::solver_count() / Caffe::node_count() : 1UL;
+    if (param.data_param().node_reader() && ranks > 1UL && !cache) {
+      reader_ = DataReader::node_reader(param, this->parsers_num_, this->threads_num());
+      queue_offset_ = (this->solver_rank_ % ranks) * reader_->queues_num();
+    } else {
+      LOG_IF(INFO, param.data_param().node_reader() && ranks > 1UL)
+          << "Node reader is ignored: it doesn't cache";
+      reader_ = make_shared<DataReader>(param,
+          Caffe::solver_count(),
+          this->solver_rank_,
+          this->parsers_num_,
+          this->threads_num(),
+          batch_size,
+          false,
+          false,
+          cache,
+          shuffle);
+    }
     start_reading();
   }
   // Read a data point, and use it to initialize the top blob.
@@ -208,13 +512,33 @@ DataLayer<Ftype, Btype>::DataLayerSetUp(const vector<Blob*>& bottom, const vecto
   for (int i = 0; i < this->prefetch_.size(); ++i) {
     this->prefetch_[i]->data_->Reshape(top_shape);
   }
+  const bool augment = use_gpu_transform && this->dt(0)->gpu_augment_enabled();
   if (use_gpu_transform) {
-    LOG(INFO) << this->print_current_device() << " Transform on GPU enabled";
+    LOG(INFO) << this->print_current_device() << " Transform on GPU enabled"
+        << (augment ? ", random resize and color jitter included" : "");
+  }
+  LOG_IF(WARNING, !use_gpu_transform && this->dt(0)->color_jitter_enabled())
+      << this->print_current_device() << " Color jitter requires use_gpu_transform, ignored";
+  if (this->transform_param_.decode_engine() == TransformationParameter_DecodeEngine_NVJPEG) {
+#if defined(USE_NVJPEG) && !defined(CPU_ONLY)
+    LOG_IF(WARNING, !use_gpu_transform) << this->print_current_device()
+        << " NVJPEG decode engine requires use_gpu_transform, falling back to CPU decoding";
+    LOG_IF(INFO, use_gpu_transform && !augment && datum_encoded_)
+        << this->print_current_device() << " JPEG decoding on GPU enabled";
+    LOG_IF(INFO, augment && datum_encoded_) << this->print_current_device()
+        << " JPEG decoding stays on CPU: GPU augmentation takes images of any size";
+#else
+    LOG(WARNING) << this->print_current_device() << " Caffe is built without nvJPEG support,"
+        << " falling back to CPU decoding";
+#endif
   }
   // label
-  vector<int> label_shape(1, batch_size);
   if (this->output_labels_) {
     vector<int> label_shape(1, batch_size);
+    const int max_labels = this->layer_param_.data_param().max_labels();
+    if (max_labels > 0) {
+      label_shape.push_back(max_labels);
+    }
     top[1]->Reshape(label_shape);
     for (int i = 0; i < this->prefetch_.size(); ++i) {
       this->prefetch_[i]->label_->Reshape(label_shape);
@@ -227,22 +551,128 @@ DataLayer<Ftype, Btype>::DataLayerSetUp(const vector<Blob*>& bottom, const vecto
       << top[0]->width();
 }
 
+template<typename Ftype, typename Btype>
+shared_ptr<Datum> DataLayer<Ftype, Btype>::pop_datum(DataReader* reader, size_t queue_id) {
+  shared_ptr<Datum> datum;
+  if (!reader->full_try_pop(queue_id, &datum)) {
+    ThreadProfile::Scope blocked(ThreadProfile::BLOCKED);
+    const auto start = std::chrono::steady_clock::now();
+    datum = reader->full_pop(queue_id, "Waiting for datum");
+    datum_wait_us_.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+  }
+  return datum;
+}
+
+template<typename Ftype, typename Btype>
+void* DataLayer<Ftype, Btype>::label_buffer(Batch* batch, int count) const {
+  vector<int> label_shape(1, count);
+  const int max_labels = this->layer_param_.data_param().max_labels();
+  if (max_labels > 0) {
+    label_shape.push_back(max_labels);
+  }
+  batch->label_->Reshape(label_shape);
+  if (this->label_type_ == INT) {
+    return batch->label_->template mutable_cpu_data_c<int>(false);
+  }
+  return batch->label_->template mutable_cpu_data_c<Ftype>(false);
+}
+
+// Row of width labels: the record's list or its single label, padded with -1
+template<typename L>
+static void fill_labels(L* row, int width, const Datum& datum) {
+  const int n = datum.labels_size();
+  CHECK_LE(n, width) << "Record " << datum.record_id() << " has " << n
+      << " labels, more than max_labels";
+  for (int i = 0; i < width; ++i) {
+    const int label = i < n ? datum.labels(i) : (i == 0 ? datum.label() : -1);
+    row[i] = static_cast<L>(label);
+  }
+}
+
+template<typename Ftype, typename Btype>
+void DataLayer<Ftype, Btype>::set_labels(void* labels, size_t item_id,
+    const Datum& datum) const {
+  const int max_labels = this->layer_param_.data_param().max_labels();
+  if (max_labels == 0) {
+    if (this->label_type_ == INT) {
+      static_cast<int*>(labels)[item_id] = datum.label();
+    } else {
+      static_cast<Ftype*>(labels)[item_id] = datum.label();
+    }
+  } else if (this->label_type_ == INT) {
+    fill_labels(static_cast<int*>(labels) + item_id * max_labels, max_labels, datum);
+  } else {
+    fill_labels(static_cast<Ftype*>(labels) + item_id * max_labels, max_labels, datum);
+  }
+}
+
+template<typename Ftype, typename Btype>
+bool DataLayer<Ftype, Btype>::data_pipe_stats(DataPipeStats* stats) const {
+  BasePrefetchingDataLayer<Ftype, Btype>::data_pipe_stats(stats);
+  const uint64_t wait_us = datum_wait_us_.load();
+  stats->transform_us = stats->transform_us > wait_us ? stats->transform_us - wait_us : 0UL;
+  shared_ptr<DataReader> reader = reader_;
+  if (reader) {
+    stats->read_us = reader->read_us();
+    stats->parse_us = reader->parse_us();
+    stats->parser_threads = reader->parser_threads_num();
+    stats->datums_queued = reader->full_queued();
+    stats->datums_capacity = reader->full_capacity();
+    stats->cache_hits = reader->cache_hits();
+    stats->cache_misses = reader->cache_misses();
+  }
+  const uint64_t echoed = echoed_samples_.load();
+  stats->unique_samples = stats->samples > echoed ? stats->samples - echoed : 0UL;
+  return true;
+}
+
 template<typename Ftype, typename Btype>
 void DataLayer<Ftype, Btype>::load_batch(Batch* batch, int thread_id, size_t queue_id) {
+  // SolverParameter::input_shape_schedule
+  const unsigned int crop_size = crop_size_.load();
+  if (this->dt(thread_id)->crop_size() != crop_size) {
+    this->dt(thread_id)->set_crop_size(crop_size);
+  }
+  if (bucketing_) {
+    load_bucketed_batch(batch, thread_id, queue_id + queue_offset_);
+    return;
+  }
   const bool sample_only = sample_only_.load();
   // Reshape according to the first datum of each batch
   // on single input batches allows for inputs of varying dimension.
   const int batch_size = this->layer_param_.data_param().batch_size();
 
-  const size_t qid = sample_only ? 0UL : queue_id;
+  const size_t qid = sample_only ? 0UL : queue_id + queue_offset_;
   DataReader* reader = sample_only ? sample_reader_.get() : reader_.get();
-  shared_ptr<Datum> init_datum = reader->full_peek(qid);
+  // Data echoing: records of the last new batch are transformed again
+  vector<shared_ptr<Datum>>& kept = echo_datums_[thread_id];
+  const bool echo = echo_max_ > 1U && !sample_only;
+  const bool echoing = echo && echo_left_[thread_id] > 0U &&
+      kept.size() == static_cast<size_t>(batch_size);
+  if (echoing) {
+    --echo_left_[thread_id];
+    ++echo_pass_[thread_id];
+  } else if (echo) {
+    kept.clear();
+    echo_left_[thread_id] = echo_factor_.load() - 1U;
+    echo_pass_[thread_id] = 0U;
+  }
+  // Random numbers of a record depend on the record and the echo only, not on the thread
+  const unsigned int pass = echo_pass_[thread_id];
+  shared_ptr<Datum> init_datum = echoing ? kept.front() : reader->full_peek(qid);
   CHECK(init_datum);
+  this->dt(thread_id)->set_sample(init_datum->record_id(), pass);
+  // Encoded content might reside in reader's memory map (zero-copy mode)
+  size_t content_size = 0UL;
+  const char* content = DataReader::datum_data(init_datum, &content_size);
   const bool use_gpu_transform = this->is_gpu_transform();
+  // Images of any size, resized and jittered with the rest of the transform on the GPU
+  const bool augment = use_gpu_transform && this->dt(thread_id)->gpu_augment_enabled();
   Packing packing = NHWC;  // OpenCV
   // Use data_transformer to infer the expected blob shape from datum.
-  vector<int> top_shape =
-      this->dt(thread_id)->template Transform<Btype>(init_datum.get(), nullptr, 0, packing);
+  vector<int> top_shape = this->dt(thread_id)->template Transform<Btype>(init_datum.get(),
+      content, content_size, nullptr, 0, packing);
   // Reshape batch according to the batch_size.
   top_shape[0] = batch_size;
   if (top_shape != batch->data_->shape()) {
@@ -251,6 +681,7 @@ void DataLayer<Ftype, Btype>::load_batch(Batch* batch, int thread_id, size_t que
 #ifndef CPU_ONLY
   int init_datum_height = init_datum->height();
   int init_datum_width = init_datum->width();
+  int init_datum_channels = init_datum->channels();
   const int color_mode = this->transform_param_.force_color() ?
                          1 : (this->transform_param_.force_gray() ? -1 : 0);
   size_t datum_sizeof_element = 0UL;
@@ -264,13 +695,18 @@ void DataLayer<Ftype, Btype>::load_batch(Batch* batch, int thread_id, size_t que
   size_t src_buf_size = 0UL;
   vector<char> src_buf;
   cv::Mat img;
-  if (use_gpu_transform) {
+  vector<int> augment_shape;
+  if (augment) {
+    augment_[thread_id]->images.clear();
+    augment_[thread_id]->samples.resize(batch_size);
+  } else if (use_gpu_transform) {
     if (init_datum->encoded()) {
-      DecodeDatumToCVMat(*init_datum, color_mode, img, false, false);
+      DecodeImageToCVMat(content, content_size, color_mode, img, false, false);
       datum_len = img.channels() * img.rows * img.cols;
       datum_sizeof_element = sizeof(char);
       init_datum_height = img.rows;
       init_datum_width = img.cols;
+      init_datum_channels = img.channels();
       needs_repack = true;
     } else {
       datum_len = init_datum->channels() * init_datum->height() * init_datum->width();
@@ -303,52 +739,100 @@ void DataLayer<Ftype, Btype>::load_batch(Batch* batch, int thread_id, size_t que
     }
   }
   size_t last_item_id = 0UL;
+  // Whole batch of JPEGs is decoded on GPU at once, others are decoded one by one on CPU
+  bool use_nvjpeg = false;
+#ifdef USE_NVJPEG
+  use_nvjpeg = use_gpu_transform && !augment && init_datum->encoded() &&
+      this->transform_param_.decode_engine() == TransformationParameter_DecodeEngine_NVJPEG;
+  if (use_nvjpeg && !nvjpeg_decoders_[thread_id]) {
+    nvjpeg_decoders_[thread_id] = make_shared<NvJpegDecoder>();
+  }
+#endif
+#endif
+  // Kept records are decoded once unless nvJPEG decodes them faster
+  bool echo_decode = true;
+#ifndef CPU_ONLY
+  echo_decode = !use_nvjpeg;
 #endif
 
   Btype* top_data = use_gpu_transform ?
                     nullptr : batch->data_->template mutable_cpu_data_c<Btype>(false);
-  Ftype* top_label = nullptr;
-  if (this->output_labels_) {
-    batch->label_->Reshape(vector<int>(1, batch_size));
-    top_label = batch->label_->template mutable_cpu_data_c<Ftype>(false);
-  }
+  void* top_label = this->output_labels_ ? label_buffer(batch, batch_size) : nullptr;
   size_t current_batch_id = 0UL;
   const size_t buf_len = batch->data_->offset(1);
   for (size_t entry = 0; entry < batch_size; ++entry) {
-    shared_ptr<Datum> datum = reader->full_pop(qid, "Waiting for datum");
+    shared_ptr<Datum> datum = echoing ? kept[entry] : pop_datum(reader, qid);
+    content = DataReader::datum_data(datum, &content_size);
     size_t item_id = datum->record_id() % batch_size;
     if (item_id == 0UL) {
       current_batch_id = datum->record_id() / batch_size;
     }
+    this->dt(thread_id)->set_sample(datum->record_id(), pass);
     // Copy label.
     if (top_label != nullptr) {
-      top_label[item_id] = datum->label();
+      set_labels(top_label, item_id, *datum);
     }
 
     if (use_gpu_transform) {
 #ifndef CPU_ONLY
-      if (datum->encoded()) {
-        DecodeDatumToSignedBuf(*datum, color_mode,
-            &src_buf[src_buf_pos * datum_size], datum_size, false);
+      if (augment) {
+        const vector<int> shape = add_augmented(*datum, content, content_size, color_mode,
+            thread_id, item_id);
+        if (augment_shape.empty()) {
+          augment_shape = shape;
+        }
+        CHECK(shape == augment_shape) << "Images can't vary in channels or in size after "
+            "resize and crop in the same batch";
+      } else if (use_nvjpeg) {
+        char* dst = static_cast<char*>(dst_gptr) + item_id * datum_size;
+        CHECK(datum->encoded()) << "Datum encoding can't vary in the same batch";
+#ifdef USE_NVJPEG
+        if (NvJpegDecoder::is_jpeg(content, content_size)) {
+          // Empty Datum::data means the content resides in reader's memory map
+          nvjpeg_decoders_[thread_id]->Add(content, content_size, datum->data().empty(), dst);
+        } else
+#endif
+        {
+          ThreadProfile::Scope decode(ThreadProfile::DECODE);
+          const auto start = std::chrono::steady_clock::now();
+          DecodeImageToSignedBuf(content, content_size, color_mode,
+              src_buf.data(), datum_size, false);
+          this->dt(thread_id)->add_decode_us(std::chrono::duration_cast<
+              std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+          CUDA_CHECK(cudaMemcpyAsync(dst, src_buf.data(), datum_size,
+              cudaMemcpyHostToDevice, stream));
+          CUDA_CHECK(cudaStreamSynchronize(stream));
+        }
       } else {
-        CHECK_EQ(datum_len, datum->channels() * datum->height() * datum->width())
-          << "Datum size can't vary in the same batch";
-        src_ptr = datum->data().size() > 0 ?
-                  &datum->data().front() :
-                  reinterpret_cast<const char*>(&datum->float_data().Get(0));
-        std::memcpy(src_buf.data() + src_buf_pos * datum_size, src_ptr, datum_size);
+        if (datum->encoded()) {
+          ThreadProfile::Scope decode(ThreadProfile::DECODE);
+          const auto start = std::chrono::steady_clock::now();
+          DecodeImageToSignedBuf(content, content_size, color_mode,
+              &src_buf[src_buf_pos * datum_size], datum_size, false);
+          this->dt(thread_id)->add_decode_us(std::chrono::duration_cast<
+              std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+        } else {
+          CHECK_EQ(datum_len, datum->channels() * datum->height() * datum->width())
+            << "Datum size can't vary in the same batch";
+          src_ptr = datum->data().size() > 0 ?
+                    &datum->data().front() :
+                    reinterpret_cast<const char*>(&datum->float_data().Get(0));
+          std::memcpy(src_buf.data() + src_buf_pos * datum_size, src_ptr, datum_size);
+        }
+        ++src_buf_pos;
+        if (src_buf_pos == src_buf_items) {
+          src_buf_pos = 0;
+          CUDA_CHECK(cudaMemcpyAsync(
+              static_cast<char*>(dst_gptr) + last_item_id * datum_size,
+              src_buf.data(), src_buf_size, cudaMemcpyHostToDevice, stream));
+          CUDA_CHECK(cudaStreamSynchronize(stream));
+          last_item_id = item_id + 1;
+        }
       }
-      ++src_buf_pos;
-      if (src_buf_pos == src_buf_items) {
-        src_buf_pos = 0;
-        CUDA_CHECK(cudaMemcpyAsync(
-            static_cast<char*>(dst_gptr) + last_item_id * datum_size,
-            src_buf.data(), src_buf_size, cudaMemcpyHostToDevice, stream));
-        CUDA_CHECK(cudaStreamSynchronize(stream));
-        last_item_id = item_id + 1;
+      if (!augment) {
+        this->dt(thread_id)->Fill3Randoms(&random_vectors_[thread_id]->
+            mutable_cpu_data()[item_id * 3]);
       }
-      this->dt(thread_id)->Fill3Randoms(&random_vectors_[thread_id]->
-          mutable_cpu_data()[item_id * 3]);
 #else
       NO_GPU;
 #endif
@@ -357,15 +841,42 @@ void DataLayer<Ftype, Btype>::load_batch(Batch* batch, int thread_id, size_t que
       const size_t offset = batch->data_->offset(item_id);
       CHECK_EQ(0, offset % buf_len);
       Btype *ptr = top_data + offset;
-      vector<int> shape = this->dt(thread_id)->Transform(datum.get(), ptr, buf_len, packing, false);
+      vector<int> shape = this->dt(thread_id)->Transform(datum.get(), content, content_size,
+          ptr, buf_len, packing, false);
       CHECK_EQ(top_shape[1], shape[1]) << "Number of channels can't vary in the same batch";
       CHECK_EQ(top_shape[2], shape[2]) << "Image height can't vary in the same batch";
       CHECK_EQ(top_shape[3], shape[3]) << "Image width can't vary in the same batch";
     }
-    reader->free_push(qid, datum);
+    if (!echoing) {
+      // Reader's datums are few and recycled, echoed records are copied
+      if (echo_left_[thread_id] > 0U) {
+        kept.push_back(echo_copy(datum, echo_decode));
+      }
+      reader->free_push(qid, datum);
+    }
   }
 
-  if (use_gpu_transform) {
+  if (augment) {
+#ifndef CPU_ONLY
+    AugmentBuffers& buffers = *augment_[thread_id];
+    buffers.images_gpu.safe_reserve(buffers.images.size());
+    buffers.samples_gpu.safe_reserve(batch_size * sizeof(AugmentSample));
+    CUDA_CHECK(cudaMemcpyAsync(buffers.images_gpu.data(), buffers.images.data(),
+        buffers.images.size(), cudaMemcpyHostToDevice, stream));
+    CUDA_CHECK(cudaMemcpyAsync(buffers.samples_gpu.data(), buffers.samples.data(),
+        batch_size * sizeof(AugmentSample), cudaMemcpyHostToDevice, stream));
+    top_shape = {batch_size, augment_shape[0], augment_shape[1], augment_shape[2]};
+    batch->data_->Reshape(top_shape);
+    this->dt(thread_id)->AugmentGPU(top_shape[0], top_shape[1], top_shape[2], top_shape[3],
+        static_cast<const AugmentSample*>(buffers.samples_gpu.data()),
+        static_cast<const uint8_t*>(buffers.images_gpu.data()),
+        batch->data_->template mutable_gpu_data_c<Ftype>(false),
+        this->transform_param_.forward_packing());
+    packing = this->transform_param_.forward_packing();
+#else
+    NO_GPU;
+#endif
+  } else if (use_gpu_transform) {
 #ifndef CPU_ONLY
     if (src_buf_pos > 0) {
       CUDA_CHECK(cudaMemcpyAsync(
@@ -373,6 +884,12 @@ void DataLayer<Ftype, Btype>::load_batch(Batch* batch, int thread_id, size_t que
           src_buf.data(), src_buf_pos * datum_size, cudaMemcpyHostToDevice, stream));
       CUDA_CHECK(cudaStreamSynchronize(stream));
     }
+#ifdef USE_NVJPEG
+    if (use_nvjpeg) {
+      nvjpeg_decoders_[thread_id]->Decode(init_datum_height, init_datum_width,
+          init_datum_channels, stream);
+    }
+#endif
 
     if (needs_repack) {
       cudnnHandle_t handle = Caffe::cudnn_handle();
@@ -400,9 +917,10 @@ void DataLayer<Ftype, Btype>::load_batch(Batch* batch, int thread_id, size_t que
         datum_sizeof_element,
         dst_gptr,
         batch->data_->template mutable_gpu_data_c<Ftype>(false),
-        random_vectors_[thread_id]->gpu_data(), needs_repack);
+        random_vectors_[thread_id]->gpu_data(), needs_repack,
+        this->transform_param_.forward_packing());
     CUDA_CHECK(cudaStreamSynchronize(stream));
-    packing = NCHW;
+    packing = this->transform_param_.forward_packing();
 #else
     NO_GPU;
 #endif
@@ -410,9 +928,141 @@ void DataLayer<Ftype, Btype>::load_batch(Batch* batch, int thread_id, size_t que
 
   batch->set_data_packing(packing);
   batch->set_id(current_batch_id);
+  batch->set_echo(echoing);
+  if (echoing) {
+    echoed_samples_.fetch_add(batch_size, std::memory_order_relaxed);
+  }
   sample_only_.store(false);
 }
 
+#ifndef CPU_ONLY
+template<typename Ftype, typename Btype>
+vector<int> DataLayer<Ftype, Btype>::add_augmented(const Datum& datum, const char* content,
+    size_t content_size, int color_mode, int thread_id, size_t item_id) {
+  AugmentBuffers& buffers = *augment_[thread_id];
+  AugmentSample& sample = buffers.samples[item_id];
+  sample.image_offset = buffers.images.size();
+  int rows, cols, channels;
+  if (datum.encoded()) {
+    ThreadProfile::Scope decode(ThreadProfile::DECODE);
+    const auto start = std::chrono::steady_clock::now();
+    cv::Mat img;
+    DecodeImageToCVMat(content, content_size, color_mode, img, false, false);
+    this->dt(thread_id)->add_decode_us(std::chrono::duration_cast<
+        std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    CHECK(img.isContinuous());
+    rows = img.rows;
+    cols = img.cols;
+    channels = img.channels();
+    sample.planar = 0;
+    buffers.images.insert(buffers.images.end(), img.data,
+        img.data + img.total() * img.elemSize());
+  } else {
+    rows = datum.height();
+    cols = datum.width();
+    channels = datum.channels();
+    CHECK_EQ(content_size, static_cast<size_t>(channels) * rows * cols)
+        << "GPU augmentation takes 8-bit images, not float data";
+    sample.planar = 1;
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(content);
+    buffers.images.insert(buffers.images.end(), data, data + content_size);
+  }
+  return this->dt(thread_id)->SampleAugment(rows, cols, channels, &sample);
+}
+#endif
+
+template<typename Ftype, typename Btype>
+shared_ptr<Datum> DataLayer<Ftype, Btype>::echo_copy(const shared_ptr<Datum>& datum,
+    bool decode) const {
+  shared_ptr<Datum> copy = make_shared<Datum>(*datum);
+  size_t content_size = 0UL;
+  const char* content = DataReader::datum_data(datum, &content_size);
+  if (datum->data().empty() && content_size > 0UL) {
+    // Zero-copy view into reader's memory map
+    copy->set_data(content, content_size);
+  }
+  if (decode && copy->encoded()) {
+    ThreadProfile::Scope scope(ThreadProfile::DECODE);
+    const int color_mode = this->transform_param_.force_color() ?
+                           1 : (this->transform_param_.force_gray() ? -1 : 0);
+    cv::Mat img;
+    DecodeDatumToCVMat(*copy, color_mode, img, false);
+    CVMatToDatum(img, *copy);
+  }
+  return copy;
+}
+
+template<typename Ftype, typename Btype>
+void DataLayer<Ftype, Btype>::load_bucketed_batch(Batch* batch, int thread_id, size_t queue_id) {
+  const DataParameter& dparam = this->layer_param_.data_param();
+  const size_t batch_size = dparam.batch_size();
+  const size_t capacity = dparam.bucket_capacity() > 0U ?
+      std::max<size_t>(dparam.bucket_capacity(), batch_size) : 4UL * batch_size;
+  std::map<vector<int>, std::deque<shared_ptr<Datum>>>& buckets = buckets_[thread_id];
+  size_t held = 0UL;
+  for (const auto& bucket : buckets) {
+    held += bucket.second.size();
+  }
+  Packing packing = NHWC;
+  auto bucket = buckets.end();
+  for (;;) {
+    // A full bucket makes the batch, the fullest one does when too many records are held
+    bucket = std::max_element(buckets.begin(), buckets.end(),
+        [](const std::pair<const vector<int>, std::deque<shared_ptr<Datum>>>& a,
+           const std::pair<const vector<int>, std::deque<shared_ptr<Datum>>>& b) {
+          return a.second.size() < b.second.size();
+        });
+    if (bucket != buckets.end() && (bucket->second.size() >= batch_size || held >= capacity)) {
+      break;
+    }
+    // Datums return to the reader right away, buckets keep their content
+    shared_ptr<Datum> datum = pop_datum(reader_.get(), queue_id);
+    size_t content_size = 0UL;
+    const char* content = DataReader::datum_data(datum, &content_size);
+    this->dt(thread_id)->set_sample(datum->record_id(), 0U);
+    vector<int> shape = this->dt(thread_id)->template Transform<Btype>(datum.get(),
+        content, content_size, nullptr, 0, packing);
+    shared_ptr<Datum> kept = make_shared<Datum>();
+    kept->Swap(datum.get());
+    if (kept->data().empty() && content_size > 0UL) {
+      kept->set_data(content, content_size);  // zero-copy view
+    }
+    reader_->free_push(queue_id, datum);
+    shape[0] = 1;
+    buckets[shape].push_back(kept);
+    ++held;
+  }
+  const size_t count = std::min(batch_size, bucket->second.size());
+  LOG_IF(INFO, count < batch_size) << this->print_current_device() << " Bucket capacity "
+      << capacity << " exceeded, emitting batch of " << count;
+  vector<int> top_shape = bucket->first;
+  top_shape[0] = count;
+  if (top_shape != batch->data_->shape()) {
+    batch->data_->Reshape(top_shape);
+  }
+  Btype* top_data = batch->data_->template mutable_cpu_data_c<Btype>(false);
+  void* top_label = this->output_labels_ ? label_buffer(batch, count) : nullptr;
+  const size_t buf_len = batch->data_->offset(1);
+  batch->set_id(bucket->second.front()->record_id() / batch_size);
+  for (size_t item_id = 0; item_id < count; ++item_id) {
+    const shared_ptr<Datum>& datum = bucket->second.front();
+    if (top_label != nullptr) {
+      set_labels(top_label, item_id, *datum);
+    }
+    this->dt(thread_id)->set_sample(datum->record_id(), 0U);
+    vector<int> shape = this->dt(thread_id)->Transform(datum.get(),
+        top_data + batch->data_->offset(item_id), buf_len, packing, false);
+    CHECK_EQ(top_shape[1], shape[1]) << "Number of channels can't vary in the same batch";
+    CHECK_EQ(top_shape[2], shape[2]) << "Image height can't vary in the same batch";
+    CHECK_EQ(top_shape[3], shape[3]) << "Image width can't vary in the same batch";
+    bucket->second.pop_front();
+  }
+  if (bucket->second.empty()) {
+    buckets.erase(bucket);
+  }
+  batch->set_data_packing(packing);
+}
+
 INSTANTIATE_CLASS_FB(DataLayer);
 REGISTER_LAYER_CLASS(Data);
 
@@ -448,6 +448,17 @@ template<typename Dtype>
 void DetectNetTransformationLayer<Dtype>::transform_label_cpu(
     vector<BboxLabel> bboxes, Dtype* transformed_label,
     const AugmentSelection& as, const cv::Size& orig_size
+) {
+  coverage_->generate(transformed_label,
+      transform_bboxes_cpu(bboxes, as, orig_size));
+}
+
+
+template<typename Dtype>
+vector<typename DetectNetTransformationLayer<Dtype>::BboxLabel>
+DetectNetTransformationLayer<Dtype>::transform_bboxes_cpu(
+    vector<BboxLabel> bboxes,
+    const AugmentSelection& as, const cv::Size& orig_size
 ) {
   if (as.flip) {
     bboxes = flip_label_cpu(bboxes, orig_size);
@@ -458,9 +469,7 @@ void DetectNetTransformationLayer<Dtype>::transform_label_cpu(
   if (as.doRotation()) {
     bboxes = rotate_label_cpu(bboxes, as.scale, as.rotation);
   }
-  bboxes = crop_label_cpu(bboxes, as.crop_offset);
-
-  coverage_->generate(transformed_label, bboxes);
+  return crop_label_cpu(bboxes, as.crop_offset);
 }
 
 
@@ -49,7 +49,7 @@ __device__ void convert_rgb_to_hsv(
   }
 
   *h *= 60;
-  if (h < 0) {
+  if (*h < 0) {
     *h += 360;
   }
   *s = delta / max_v;
@@ -372,6 +372,8 @@ void DetectNetTransformationLayer<Dtype>::Forward_gpu(
 
   // Get current stream
   cudaStream_t stream = Caffe::thread_stream();
+  // Host side of labels is synced before the stream gets busy
+  const vector<vector<BboxLabel> > list_list_bboxes = blobToLabels(*bottom[1]);
 
   // Make augmentation selections for each image
   vector<AugmentSelection> augmentations;
@@ -388,7 +390,6 @@ void DetectNetTransformationLayer<Dtype>::Forward_gpu(
   // NOLINT_NEXT_LINE(whitespace/operators)
   color_transformations<<<CAFFE_GET_BLOCKS(bottom_pixels),
     CAFFE_CUDA_NUM_THREADS, 0, stream>>>(bottom_data, tmp_data, bottom_shape, aug_data);
-  CUDA_CHECK(cudaStreamSynchronize(stream));
 
   // Mean subtraction
   if (t_param_.has_mean_file()) {
@@ -411,18 +412,17 @@ void DetectNetTransformationLayer<Dtype>::Forward_gpu(
   spatial_transformations<<<CAFFE_GET_BLOCKS(top_pixels),
     CAFFE_CUDA_NUM_THREADS, 0, stream>>>(tmp_data, bottom_shape, aug_data,
         top_data, top_shape);
-  CUDA_CHECK(cudaStreamSynchronize(stream));
 
-  // Use CPU to transform labels
-  const vector<vector<BboxLabel> > list_list_bboxes = blobToLabels(*bottom[1]);
+  // Bounding boxes are transformed on CPU while the kernels above run, the
+  //  gridbox labels are rasterized on GPU from the short lists
+  vector<vector<BboxLabel> > transformed_bboxes(bottom[1]->num());
   for (size_t i = 0; i < bottom[1]->num(); i++) {
-    const vector<BboxLabel>& list_bboxes = list_list_bboxes[i];
-    Dtype* output_label = &top[1]->mutable_cpu_data<Dtype>()[
-      top[1]->offset(i, 0, 0, 0)
-      ];
-    transform_label_cpu(list_bboxes, output_label, augmentations[i],
-        cv::Size(bottom_shape.x, bottom_shape.y));
+    transformed_bboxes[i] = transform_bboxes_cpu(list_list_bboxes[i],
+        augmentations[i], cv::Size(bottom_shape.x, bottom_shape.y));
   }
+  coverage_->generate_gpu(top[1]->mutable_gpu_data<Dtype>(), transformed_bboxes);
+  // Augmentation selections and box lists are uploaded from host memory
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 
@@ -15,15 +15,14 @@ void DropoutLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
   DCHECK(threshold_ < 1.);
   scale_ = 1. / (1. - threshold_);
   uint_thres_ = static_cast<unsigned int>(UINT_MAX * threshold_);
+  regenerate_mask_ = this->layer_param_.dropout_param().regenerate_mask();
 }
 
 template <typename Ftype, typename Btype>
 void DropoutLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
       const vector<Blob*>& top) {
   NeuronLayer<Ftype, Btype>::Reshape(bottom, top);
-  // Set up the cache for random number generation
-  // ReshapeLike does not work because rand_vec_ is of Dtype uint
-  rand_vec_.Reshape(bottom[0]->shape());
+  // The mask is sized by forward, CuDNNDropoutLayer has none
 }
 
 template <typename Ftype, typename Btype>
@@ -31,13 +30,28 @@ void DropoutLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
     const vector<Blob*>& top) {
   const Ftype* bottom_data = bottom[0]->cpu_data<Ftype>();
   Ftype* top_data = top[0]->mutable_cpu_data<Ftype>();
-  unsigned int* mask = rand_vec_.mutable_cpu_data();
   const int count = bottom[0]->count();
   if (this->phase_ == TRAIN) {
-    // Create random numbers
-    caffe_rng_bernoulli<float>(count, 1. - threshold_, mask);
-    for (int i = 0; i < count; ++i) {
-      top_data[i] = bottom_data[i] * mask[i] * scale_;
+    NextMask();
+    unsigned int* mask = nullptr;
+    if (!regenerate_mask_) {
+      mask_.Reshape(vector<int>(1, mask_words(count)));
+      mask = mask_.mutable_cpu_data();
+    }
+    for (int w = 0; w < mask_words(count); ++w) {
+      unsigned int bits = 0U;
+      for (int b = 0; b < 32 && w * 32 + b < count; ++b) {
+        const int i = w * 32 + b;
+        if (keep(i)) {
+          top_data[i] = static_cast<Ftype>(static_cast<float>(bottom_data[i]) * scale_);
+          bits |= 1U << b;
+        } else {
+          top_data[i] = Ftype(0);
+        }
+      }
+      if (mask != nullptr) {
+        mask[w] = bits;
+      }
     }
   } else {
     caffe_copy(bottom[0]->count(), bottom_data, top_data);
@@ -52,10 +66,12 @@ void DropoutLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
     const Btype* top_diff = top[0]->cpu_diff<Btype>();
     Btype* bottom_diff = bottom[0]->mutable_cpu_diff<Btype>();
     if (this->phase_ == TRAIN) {
-      const unsigned int* mask = rand_vec_.cpu_data();
+      const unsigned int* mask = regenerate_mask_ ? nullptr : mask_.cpu_data();
       const int count = bottom[0]->count();
       for (int i = 0; i < count; ++i) {
-        bottom_diff[i] = top_diff[i] * mask[i] * scale_;
+        const bool kept = mask != nullptr ? (mask[i / 32] >> (i % 32)) & 1U : keep(i);
+        bottom_diff[i] = kept ?
+            static_cast<Btype>(static_cast<float>(top_diff[i]) * scale_) : Btype(0);
       }
     } else {
       caffe_copy(top[0]->count(), top_diff, bottom_diff);
@@ -63,7 +79,6 @@ void DropoutLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
   }
 }
 
-
 #ifdef CPU_ONLY
 STUB_GPU(DropoutLayer);
 #endif
@@ -3,19 +3,44 @@
 
 #include "caffe/layers/dropout_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
 
 namespace caffe {
 
-template<typename Dtype>
-__global__ void
-DropoutForward(const int n, const Dtype* in, const unsigned int* mask, const unsigned int threshold,
-    const float scale, Dtype* out) {
+// Draws, applies and packs the mask in one pass. Whole warps run the loop, so that every
+// lane takes part in the ballot making a mask word, blockDim being a multiple of 32.
+template<typename T, typename A>
+__global__ void DropoutForward(const int n, const T* in, const uint64_t seed,
+    const uint64_t offset, const unsigned int threshold, const A scale, T* out,
+    unsigned int* mask) {
+  const int n32 = (n + 31) / 32 * 32;
+  for (int index = blockIdx.x * blockDim.x + threadIdx.x; index < n32;
+       index += blockDim.x * gridDim.x) {
+    const bool keep = index < n && philox_uint(seed, offset, index) > threshold;
+    if (index < n) {
+      out[index] = keep ? mt_store<T, A>(mt_load<A, T>(in[index]) * scale) : mt_store<T, A>(0);
+    }
+#if CUDA_VERSION >= 9000
+    const unsigned int bits = __ballot_sync(0xffffffffU, keep);
+#else
+    const unsigned int bits = __ballot(keep);
+#endif
+    if (mask != nullptr && index % 32 == 0) {
+      mask[index / 32] = bits;
+    }
+  }
+}
+
+// Reads the packed mask, or draws it again when there is none
+template<typename T, typename A>
+__global__ void DropoutBackward(const int n, const T* in_diff, const unsigned int* mask,
+    const uint64_t seed, const uint64_t offset, const unsigned int threshold, const A scale,
+    T* out_diff) {
   CUDA_KERNEL_LOOP(index, n) {
-    //    out[index] = in[index] * (mask[index] > threshold) * scale;
-    if (mask[index] > threshold)
-      out[index] = Dtype(static_cast<float>(in[index]) * scale);
-    else
-      out[index] = 0.;
+    const bool keep = mask != nullptr ? (mask[index / 32] >> (index % 32)) & 1U :
+        philox_uint(seed, offset, index) > threshold;
+    out_diff[index] = keep ?
+        mt_store<T, A>(mt_load<A, T>(in_diff[index]) * scale) : mt_store<T, A>(0);
   }
 }
 
@@ -26,32 +51,26 @@ DropoutLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom, const vecto
   Ftype* top_data = top[0]->mutable_gpu_data<Ftype>();
   const int count = bottom[0]->count();
   if (this->phase_ == TRAIN) {
+    typedef typename MultiTensorType<Ftype>::type T;
+    typedef typename MultiTensorAcc<Ftype>::type A;
+    NextMask();
+    unsigned int* mask = nullptr;
+    if (!regenerate_mask_) {
+      mask_.Reshape(vector<int>(1, mask_words(count)));
+      mask = mask_.mutable_gpu_data();
+    }
     cudaStream_t stream = Caffe::thread_stream();
-    unsigned int* mask = static_cast<unsigned int*>(rand_vec_.mutable_gpu_data());
-    caffe_gpu_rng_uniform(count, mask);
-    // set thresholds
     // NOLINT_NEXT_LINE(whitespace/operators)
-    DropoutForward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>
-        (count, bottom_data, mask, uint_thres_, scale_, top_data);
+    DropoutForward<T, A><<<CAFFE_GET_BLOCKS(mask_words(count) * 32), CAFFE_CUDA_NUM_THREADS,
+        0, stream>>>(count, reinterpret_cast<const T*>(bottom_data), mask_seed_, mask_offset_,
+        uint_thres_, A(scale_), reinterpret_cast<T*>(top_data), mask);
     CUDA_POST_KERNEL_CHECK;
-    CUDA_CHECK(cudaStreamSynchronize(stream));
+    CUDA_CHECK(caffe_gpu_sync(stream));
   } else {
     caffe_copy<Ftype>(count, bottom_data, top_data);
   }
 }
 
-template<typename Dtype>
-__global__ void DropoutBackward(const int n, const Dtype* in_diff, const unsigned int* mask,
-    const unsigned int threshold, const float scale, Dtype* out_diff) {
-  CUDA_KERNEL_LOOP(index, n) {
-    //    out_diff[index] = in_diff[index] * (mask[index] > threshold) * scale;
-    if (mask[index] > threshold)
-      out_diff[index] = Dtype(static_cast<float>(in_diff[index]) * scale);
-    else
-      out_diff[index] = 0.;
-  }
-}
-
 template<typename Ftype, typename Btype>
 void DropoutLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
@@ -60,14 +79,17 @@ void DropoutLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
 
   if (propagate_down[0]) {
     if (this->phase_ == TRAIN) {  // Needed for TEST
+      typedef typename MultiTensorType<Btype>::type T;
+      typedef typename MultiTensorAcc<Btype>::type A;
       cudaStream_t stream = Caffe::thread_stream();
-      const unsigned int* mask = static_cast<const unsigned int*>(rand_vec_.gpu_data());
+      const unsigned int* mask = regenerate_mask_ ? nullptr : mask_.gpu_data();
       const int count = bottom[0]->count();
       // NOLINT_NEXT_LINE(whitespace/operators)
-      DropoutBackward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>
-          (count, top_diff, mask, uint_thres_, scale_, bottom_diff);
+      DropoutBackward<T, A><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>
+          (count, reinterpret_cast<const T*>(top_diff), mask, mask_seed_, mask_offset_,
+          uint_thres_, A(scale_), reinterpret_cast<T*>(bottom_diff));
       CUDA_POST_KERNEL_CHECK;
-      CUDA_CHECK(cudaStreamSynchronize(stream));
+      CUDA_CHECK(caffe_gpu_sync(stream));
     } else {
       caffe_copy(top[0]->count(), top_diff, bottom_diff);
     }
@@ -159,6 +159,35 @@ void EltwiseLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
   }
 }
 
+// n inputs take n - 1 operations per output, coefficients one multiplication each.
+// Backward of SUM is a copy or a scale, MAX routes each diff by the saved index.
+template <typename Ftype, typename Btype>
+void EltwiseLayer<Ftype, Btype>::Cost(const vector<Blob*>& bottom,
+    const vector<Blob*>& top, LayerCost* cost) const {
+  const double n = bottom.size();
+  const double count = top[0]->count();
+  cost->forward_flops = (n - 1.) * count;
+  switch (op_) {
+  case EltwiseParameter_EltwiseOp_PROD:
+    cost->backward_flops = (stable_prod_grad_ ? n - 1. : 2.) * n * count;
+    cost->backward_bytes += count * tsize(top[0]->data_type());
+    break;
+  case EltwiseParameter_EltwiseOp_SUM:
+    if (!no_coeffs_) {
+      cost->forward_flops += n * count;
+    }
+    cost->backward_flops = no_coeffs_ ? 0. : n * count;
+    break;
+  case EltwiseParameter_EltwiseOp_MAX:
+    cost->backward_flops = n * count;
+    cost->forward_bytes += count * sizeof(int);
+    cost->backward_bytes += n * count * sizeof(int);
+    break;
+  default:
+    LOG(FATAL) << "Unknown elementwise operation.";
+  }
+}
+
 #ifdef CPU_ONLY
 STUB_GPU(EltwiseLayer);
 #endif
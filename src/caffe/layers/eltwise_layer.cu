@@ -75,7 +75,7 @@ void EltwiseLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
         MaxForward <<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
             count, top_data, bottom[i]->gpu_data<Ftype>(), i - 1, top_data, mask);
       }
-      CUDA_CHECK(cudaStreamSynchronize(stream));
+      CUDA_CHECK(caffe_gpu_sync(stream));
     }
     break;
   default:
@@ -140,7 +140,7 @@ void EltwiseLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
         MaxBackward<Btype>  // NOLINT_NEXT_LINE(whitespace/operators)
             <<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, Caffe::thread_stream()>>>(
             count, top_diff, i, mask, bottom[i]->mutable_gpu_diff<Btype>());
-        CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+        CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
         break;
       default:
         LOG(FATAL) << "Unknown elementwise operation.";
@@ -2,6 +2,7 @@
 #include <vector>
 
 #include "caffe/layers/elu_layer.hpp"
+#include "caffe/util/cpu_parallel.hpp"
 
 namespace caffe {
 
@@ -13,10 +14,12 @@ void ELULayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
   const int count = bottom[0]->count();
   float alpha = this->layer_param_.elu_param().alpha();
   float lambda = this->layer_param_.elu_param().lambda();
-  for (int i = 0; i < count; ++i) {
-    top_data[i] = lambda * std::max(bottom_data[i], Ftype(0.))
-        + alpha * (exp(std::min(bottom_data[i], Ftype(0.))) - 1.F);
-  }
+  CpuParallel::For(count, CpuParallel::GRAIN, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      top_data[i] = lambda * std::max(bottom_data[i], Ftype(0.))
+          + alpha * (exp(std::min(bottom_data[i], Ftype(0.))) - 1.F);
+    }
+  });
 }
 
 template <typename Ftype, typename Btype>
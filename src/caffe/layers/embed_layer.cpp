@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/filler.hpp"
@@ -13,6 +14,7 @@ void EmbedLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
   K_ = this->layer_param_.embed_param().input_dim();
   CHECK_GT(K_, 0) << "EmbedLayer input_dim must be positive.";
   bias_term_ = this->layer_param_.embed_param().bias_term();
+  sparse_gradient_ = this->layer_param_.embed_param().sparse_gradient();
   // Check if we need to set up the weights
   if (this->blobs_.size() > 0) {
     LOG(INFO) << "Skipping parameter initialization";
@@ -60,6 +62,20 @@ void EmbedLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
   }
 }
 
+template <typename Ftype, typename Btype>
+void EmbedLayer<Ftype, Btype>::AddSparseRows(const Blob& bottom) {
+  const Ftype* bottom_data = bottom.cpu_data<Ftype>();
+  const size_t old_size = sparse_rows_.size();
+  for (int n = 0; n < M_; ++n) {
+    sparse_rows_.push_back(static_cast<int>(bottom_data[n]));
+  }
+  std::sort(sparse_rows_.begin() + old_size, sparse_rows_.end());
+  std::inplace_merge(sparse_rows_.begin(), sparse_rows_.begin() + old_size,
+      sparse_rows_.end());
+  sparse_rows_.erase(std::unique(sparse_rows_.begin(), sparse_rows_.end()),
+      sparse_rows_.end());
+}
+
 template <typename Ftype, typename Btype>
 void EmbedLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
     const vector<Blob*>& top) {
@@ -99,6 +115,9 @@ void EmbedLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
           << "non-integer input";
       caffe_axpy(N_, Btype(1), top_diff + n * N_, weight_diff + index * N_);
     }
+    if (sparse_gradient_) {
+      AddSparseRows(*bottom[0]);
+    }
   }
   if (bias_term_ && this->param_propagate_down_[1]) {
     const Btype* top_diff = top[0]->cpu_diff<Btype>();
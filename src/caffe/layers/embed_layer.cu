@@ -53,7 +53,7 @@ void EmbedLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
         bias_multiplier_.template gpu_data<Ftype>(),
         this->blobs_[1]->template gpu_data<Ftype>(), Ftype(1), top_data);
   }
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template <typename Ftype, typename Btype>
@@ -68,7 +68,10 @@ void EmbedLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     EmbedBackward  // NOLINT_NEXT_LINE(whitespace/operators)
         <<<CAFFE_GET_BLOCKS(top_count), CAFFE_CUDA_NUM_THREADS, 0, Caffe::thread_stream()>>>(
         top_count, bottom_data, top_diff, M_, N_, K_, weight_diff);
-    CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+    CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
+    if (sparse_gradient_) {
+      AddSparseRows(*bottom[0]);
+    }
   }
   if (bias_term_ && this->param_propagate_down_[1]) {
     const Btype* top_diff = top[0]->gpu_diff<Btype>();
@@ -27,25 +27,32 @@ void FilterLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
         "Each bottom should have the same 0th dimension as the selector blob";
   }
 
-  const Ftype* bottom_data_selector = bottom[selector_index]->cpu_data<Ftype>();
-  indices_to_forward_.clear();
-
-  // look for non-zero elements in bottom[0]. Items of each bottom that
-  // have the same index as the items in bottom[0] with value == non-zero
-  // will be forwarded
-  for (int item_id = 0; item_id < bottom[selector_index]->shape(0); ++item_id) {
-    // we don't need an offset because item size == 1
-    const Ftype* tmp_data_selector = bottom_data_selector + item_id;
-    if (*tmp_data_selector) {
-      indices_to_forward_.push_back(item_id);
-    }
-  }
-  // only filtered items will be forwarded
-  int new_tops_num = indices_to_forward_.size();
+  int new_tops_num = 0;
   // init
   if (first_reshape_) {
     new_tops_num = bottom[0]->shape(0);
     first_reshape_ = false;
+#ifndef CPU_ONLY
+  } else if (Caffe::mode() == Caffe::GPU) {
+    // Gather indices are scanned on device, only their number comes back
+    new_tops_num = SelectGPU(bottom[selector_index]);
+#endif
+  } else {
+    const Ftype* bottom_data_selector = bottom[selector_index]->cpu_data<Ftype>();
+    indices_to_forward_.clear();
+
+    // look for non-zero elements in bottom[0]. Items of each bottom that
+    // have the same index as the items in bottom[0] with value == non-zero
+    // will be forwarded
+    for (int item_id = 0; item_id < bottom[selector_index]->shape(0); ++item_id) {
+      // we don't need an offset because item size == 1
+      const Ftype* tmp_data_selector = bottom_data_selector + item_id;
+      if (*tmp_data_selector) {
+        indices_to_forward_.push_back(item_id);
+      }
+    }
+    // only filtered items will be forwarded
+    new_tops_num = indices_to_forward_.size();
   }
   for (int t = 0; t < top.size(); ++t) {
     int num_axes = bottom[t]->num_axes();
@@ -57,6 +64,19 @@ void FilterLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
   }
 }
 
+#ifndef CPU_ONLY
+template <typename Ftype, typename Btype>
+int FilterLayer<Ftype, Btype>::SelectGPU(const Blob* selector) {
+  const int num = selector->shape(0);
+  gpu_indices_.Reshape(vector<int>{num});
+  passed_.Reshape(vector<int>{1});
+  filter_select_gpu(num, selector->gpu_data<Ftype>(), gpu_indices_.mutable_gpu_data(),
+      passed_.mutable_gpu_data());
+  // Tops can't be shaped without it
+  return passed_.cpu_data()[0];
+}
+#endif
+
 template <typename Ftype, typename Btype>
 void FilterLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top) {
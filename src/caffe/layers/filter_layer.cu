@@ -5,22 +5,63 @@
 
 namespace caffe {
 
+// One block: an exclusive scan of the selector gives the top item of every bottom item
+// passing, chunk after chunk of CAFFE_CUDA_NUM_THREADS items
+template <typename Dtype>
+__global__ void FilterSelect(const int num, const Dtype* selector, int* indices,
+    int* passed) {
+  __shared__ int scan[CAFFE_CUDA_NUM_THREADS];
+  int carry = 0;
+  for (int base = 0; base < num; base += CAFFE_CUDA_NUM_THREADS) {
+    const int n = base + threadIdx.x;
+    const int keep = n < num && static_cast<float>(selector[n]) != 0.F;
+    scan[threadIdx.x] = keep;
+    __syncthreads();
+    for (int offset = 1; offset < CAFFE_CUDA_NUM_THREADS; offset <<= 1) {
+      const int add = threadIdx.x >= offset ? scan[threadIdx.x - offset] : 0;
+      __syncthreads();
+      scan[threadIdx.x] += add;
+      __syncthreads();
+    }
+    if (keep) {
+      // inclusive sum minus its own item
+      indices[carry + scan[threadIdx.x] - 1] = n;
+    }
+    carry += scan[CAFFE_CUDA_NUM_THREADS - 1];
+    __syncthreads();
+  }
+  if (threadIdx.x == 0) {
+    *passed = carry;
+  }
+}
+
+template <typename Dtype>
+void filter_select_gpu(int num, const Dtype* selector, int* indices, int* passed) {
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  FilterSelect<Dtype><<<1, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(num, selector, indices,
+      passed);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template void filter_select_gpu<float>(int, const float*, int*, int*);
+template void filter_select_gpu<double>(int, const double*, int*, int*);
+template void filter_select_gpu<float16>(int, const float16*, int*, int*);
+
 template <typename Ftype, typename Btype>
 void FilterLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top) {
-  int new_tops_num = indices_to_forward_.size();
+  cudaStream_t stream = Caffe::thread_stream();
   // forward all filtered items for all bottoms but the Selector (bottom[last])
   for (int t = 0; t < top.size(); ++t) {
-    const Ftype* bottom_data = bottom[t]->gpu_data<Ftype>();
-    Ftype* top_data = top[t]->mutable_gpu_data<Ftype>();
-    int dim = bottom[t]->count() / bottom[t]->shape(0);
-    for (int n = 0; n < new_tops_num; ++n) {
-      int data_offset_top = n * dim;
-      int data_offset_bottom = indices_to_forward_[n] * dim;
-      caffe_copy(dim, bottom_data + data_offset_bottom,
-          top_data + data_offset_top);
+    if (top[t]->count() == 0) {
+      continue;
     }
+    caffe_gpu_gather_rows(tp<Ftype>(), top[t]->shape(0), bottom[t]->count(1),
+        gpu_indices_.gpu_data(), bottom[t]->gpu_data<Ftype>(),
+        top[t]->mutable_gpu_data<Ftype>(), stream);
   }
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template <typename Ftype, typename Btype>
@@ -30,38 +71,22 @@ void FilterLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     LOG(FATAL) << this->type()
                << "Layer cannot backpropagate to filter index inputs";
   }
+  cudaStream_t stream = Caffe::thread_stream();
   for (int i = 0; i < top.size(); ++i) {
     // bottom[last] is the selector and never needs backpropagation
     // so we can iterate over top vector because top.size() == bottom.size() -1
     if (propagate_down[i]) {
-      const int dim = top[i]->count() / top[i]->shape(0);
-      int next_to_backward_offset = 0;
-      int batch_offset = 0;
-      int data_offset_bottom = 0;
-      int data_offset_top = 0;
-      for (int n = 0; n < bottom[i]->shape(0); ++n) {
-        if (next_to_backward_offset >= indices_to_forward_.size()) {
-          // we already visited all items that were been forwarded, so
-          // just set to zero remaining ones
-          data_offset_bottom = n * dim;
-          caffe_gpu_set(dim, Btype(0),
-              bottom[i]->mutable_gpu_diff<Btype>() + data_offset_bottom);
-        } else {
-          batch_offset = indices_to_forward_[next_to_backward_offset];
-          data_offset_bottom = n * dim;
-          if (n != batch_offset) {  // this data was not been forwarded
-            caffe_gpu_set(dim, Btype(0),
-                bottom[i]->mutable_gpu_diff<Btype>() + data_offset_bottom);
-          } else {  // this data was been forwarded
-            data_offset_top = next_to_backward_offset * dim;
-            ++next_to_backward_offset;  // point to next forwarded item index
-            caffe_copy(dim, top[i]->mutable_gpu_diff<Btype>() + data_offset_top,
-                bottom[i]->mutable_gpu_diff<Btype>() + data_offset_bottom);
-          }
-        }
+      // items not forwarded get zeros, the others their top diff
+      caffe_gpu_set(bottom[i]->count(), Btype(0), bottom[i]->mutable_gpu_diff<Btype>());
+      if (top[i]->count() == 0) {
+        continue;
       }
+      caffe_gpu_scatter_rows(tp<Btype>(), top[i]->shape(0), top[i]->count(1),
+          gpu_indices_.gpu_data(), top[i]->gpu_diff<Btype>(),
+          bottom[i]->mutable_gpu_diff<Btype>(), stream);
     }
   }
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(FilterLayer);
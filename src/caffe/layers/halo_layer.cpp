@@ -0,0 +1,49 @@
+#include <vector>
+
+#include "caffe/layers/halo_layer.hpp"
+
+namespace caffe {
+
+template <typename Ftype, typename Btype>
+void HaloLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  const SpatialParameter& param = this->layer_param_.spatial_param();
+  stripes_ = param.stripes();
+  halo_ = param.halo();
+  CHECK_GE(stripes_, 1);
+}
+
+template <typename Ftype, typename Btype>
+void HaloLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  CHECK_NE(top[0], bottom[0]) << this->type() << " Layer does not "
+      "allow in-place computation.";
+  CHECK_EQ(4, bottom[0]->num_axes()) << this->name() << ": halos are rows of 4D blobs";
+  CHECK_EQ(NCHW, bottom[0]->packing()) << this->name() << ": halos are rows of NCHW";
+  CHECK_GE(bottom[0]->height(), halo_) << this->name() << ": stripes of "
+      << bottom[0]->height() << " rows can't hold halos of " << halo_;
+  vector<int> shape = bottom[0]->shape();
+  shape[2] += 2 * halo_;
+  top[0]->Reshape(shape);
+}
+
+template <typename Ftype, typename Btype>
+void HaloLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  LOG(FATAL) << this->name() << ": spatial stripes need GPU mode";
+}
+
+template <typename Ftype, typename Btype>
+void HaloLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
+    const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  LOG(FATAL) << this->name() << ": spatial stripes need GPU mode";
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(HaloLayer);
+#endif
+
+INSTANTIATE_CLASS_FB(HaloLayer);
+REGISTER_LAYER_CLASS(Halo);
+
+}  // namespace caffe
@@ -0,0 +1,124 @@
+#include <vector>
+
+#include "caffe/layers/halo_layer.hpp"
+#include "caffe/solver.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
+
+namespace caffe {
+
+// Adds count values at in, edge per plane, to the rows of out starting every plane
+template <typename T, typename A>
+__global__ void HaloAddGPU(const int count, const int edge, const int plane, const T* in,
+    T* out) {
+  CUDA_KERNEL_LOOP(i, count) {
+    T* o = out + static_cast<size_t>(i / edge) * plane + i % edge;
+    *o = mt_store<T, A>(mt_load<A, T>(*o) + mt_load<A, T>(in[i]));
+  }
+}
+
+template <typename Ftype, typename Btype>
+void HaloLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  const Solver* psolver = this->parent_solver();
+  CHECK(psolver != nullptr && psolver->callback() != nullptr) << this->name()
+      << ": spatial stripes need a multi-GPU run";
+  Solver::Callback* callback = psolver->callback();
+  cudaStream_t stream = Caffe::thread_stream();
+  const char* bottom_data = reinterpret_cast<const char*>(bottom[0]->gpu_data<Ftype>());
+  char* top_data = reinterpret_cast<char*>(top[0]->mutable_gpu_data<Ftype>());
+  const int planes = bottom[0]->count(0, 2);
+  const int rows = bottom[0]->height();
+  const size_t row = bottom[0]->width() * sizeof(Ftype);
+  const size_t edge = halo_ * row;
+  const size_t bottom_pitch = rows * row, top_pitch = (rows + 2 * halo_) * row;
+  CUDA_CHECK(cudaMemcpy2DAsync(top_data + edge, top_pitch, bottom_data, bottom_pitch,
+      bottom_pitch, planes, cudaMemcpyDeviceToDevice, stream));
+  if (halo_ > 0) {
+    const size_t bytes = planes * edge;
+    buffers_.reserve(4 * bytes);
+    char* up = static_cast<char*>(buffers_.data());
+    char* down = up + bytes;
+    char* from_up = down + bytes;
+    char* from_down = from_up + bytes;
+    CUDA_CHECK(cudaMemcpy2DAsync(up, edge, bottom_data, bottom_pitch, edge, planes,
+        cudaMemcpyDeviceToDevice, stream));
+    CUDA_CHECK(cudaMemcpy2DAsync(down, edge, bottom_data + bottom_pitch - edge,
+        bottom_pitch, edge, planes, cudaMemcpyDeviceToDevice, stream));
+    callback->halo_exchange(up, down, from_up, from_down, bytes, stripes_, stream);
+    // Zeros past the edges of the sample, as the padding they replace
+    const int index = callback->stripe_index(stripes_);
+    if (index > 0) {
+      CUDA_CHECK(cudaMemcpy2DAsync(top_data, top_pitch, from_up, edge, edge, planes,
+          cudaMemcpyDeviceToDevice, stream));
+    } else {
+      CUDA_CHECK(cudaMemset2DAsync(top_data, top_pitch, 0, edge, planes, stream));
+    }
+    char* below = top_data + top_pitch - edge;
+    if (index + 1 < stripes_) {
+      CUDA_CHECK(cudaMemcpy2DAsync(below, top_pitch, from_down, edge, edge, planes,
+          cudaMemcpyDeviceToDevice, stream));
+    } else {
+      CUDA_CHECK(cudaMemset2DAsync(below, top_pitch, 0, edge, planes, stream));
+    }
+  }
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template <typename Ftype, typename Btype>
+void HaloLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
+    const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  if (!propagate_down[0]) {
+    return;
+  }
+  typedef typename MultiTensorType<Btype>::type T;
+  typedef typename MultiTensorAcc<Btype>::type A;
+  Solver::Callback* callback = this->parent_solver()->callback();
+  cudaStream_t stream = Caffe::thread_stream();
+  const char* top_diff = reinterpret_cast<const char*>(top[0]->gpu_diff<Btype>());
+  char* bottom_diff = reinterpret_cast<char*>(bottom[0]->mutable_gpu_diff<Btype>());
+  const int planes = bottom[0]->count(0, 2);
+  const int rows = bottom[0]->height();
+  const size_t row = bottom[0]->width() * sizeof(Btype);
+  const size_t edge = halo_ * row;
+  const size_t bottom_pitch = rows * row, top_pitch = (rows + 2 * halo_) * row;
+  CUDA_CHECK(cudaMemcpy2DAsync(bottom_diff, bottom_pitch, top_diff + edge, top_pitch,
+      bottom_pitch, planes, cudaMemcpyDeviceToDevice, stream));
+  if (halo_ > 0) {
+    // Gradients of the halo rows go back to the stripes they came from, which add them
+    // to those of their edge rows
+    const size_t bytes = planes * edge;
+    buffers_.reserve(4 * bytes);
+    char* up = static_cast<char*>(buffers_.data());
+    char* down = up + bytes;
+    char* from_up = down + bytes;
+    char* from_down = from_up + bytes;
+    CUDA_CHECK(cudaMemcpy2DAsync(up, edge, top_diff, top_pitch, edge, planes,
+        cudaMemcpyDeviceToDevice, stream));
+    CUDA_CHECK(cudaMemcpy2DAsync(down, edge, top_diff + top_pitch - edge, top_pitch, edge,
+        planes, cudaMemcpyDeviceToDevice, stream));
+    callback->halo_exchange(up, down, from_up, from_down, bytes, stripes_, stream);
+    const int index = callback->stripe_index(stripes_);
+    const int count = planes * halo_ * bottom[0]->width();
+    const int edge_count = halo_ * bottom[0]->width();
+    const int plane_count = bottom[0]->count(2);
+    if (index > 0) {
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      HaloAddGPU<T, A><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+          count, edge_count, plane_count, reinterpret_cast<const T*>(from_up),
+          reinterpret_cast<T*>(bottom_diff));
+      CUDA_POST_KERNEL_CHECK;
+    }
+    if (index + 1 < stripes_) {
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      HaloAddGPU<T, A><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+          count, edge_count, plane_count, reinterpret_cast<const T*>(from_down),
+          reinterpret_cast<T*>(bottom_diff + bottom_pitch - edge));
+      CUDA_POST_KERNEL_CHECK;
+    }
+  }
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS_FB(HaloLayer);
+
+}  // namespace caffe
@@ -1,12 +1,12 @@
-/*
-TODO:
-- load file in a separate thread ("prefetch")
-- can be smarter about the memcpy call instead of doing it row-by-row
-  :: use util functions caffe_copy, and TBlob->offset()
-  :: don't forget to update hdf5_daa_layer.cu accordingly
-- add ability to shuffle filenames if flag is set
-*/
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
 #include <fstream>  // NOLINT(readability/streams)
+#include <mutex>
+#include <numeric>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -17,56 +17,34 @@ TODO:
 #include "caffe/util/rng.hpp"
 #include "caffe/layers/hdf5_data_layer.hpp"
 #include "caffe/util/hdf5.hpp"
+#include "caffe/util/nvtx.hpp"
+#include "caffe/util/thread_profile.hpp"
 
 namespace caffe {
 
-template <typename Ftype, typename Btype>
-HDF5DataLayer<Ftype, Btype>::~HDF5DataLayer<Ftype, Btype>() { }
+namespace {
 
-// Load data and label from HDF5 filename into the class property blobs.
-template <typename Ftype, typename Btype>
-void HDF5DataLayer<Ftype, Btype>::LoadHDF5FileData(const char* filename) {
-  DLOG(INFO) << "Loading HDF5 file: " << filename;
-  hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-  if (file_id < 0) {
-    LOG(FATAL) << "Failed opening HDF5 file: " << filename;
+// Closes the file however reading it ends, interrupted included
+struct HDF5File {
+  explicit HDF5File(const std::string& filename) : filename_(filename) {
+    std::lock_guard<std::mutex> lock(hdf5_mutex());
+    id_ = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    CHECK_GE(id_, 0) << "Failed opening HDF5 file: " << filename;
   }
-
-  int top_size = this->layer_param_.top_size();
-  hdf_blobs_.resize(top_size);
-
-  const int MIN_DATA_DIM = 1;
-  const int MAX_DATA_DIM = INT_MAX;
-
-  for (int i = 0; i < top_size; ++i) {
-    hdf_blobs_[i].reset(new TBlob<Ftype>());
-    hdf5_load_nd_dataset(file_id, this->layer_param_.top(i).c_str(),
-        MIN_DATA_DIM, MAX_DATA_DIM, hdf_blobs_[i].get());
+  ~HDF5File() {
+    std::lock_guard<std::mutex> lock(hdf5_mutex());
+    herr_t status = H5Fclose(id_);
+    CHECK_GE(status, 0) << "Failed to close HDF5 file: " << filename_;
   }
+  const std::string filename_;
+  hid_t id_;
+};
 
-  herr_t status = H5Fclose(file_id);
-  CHECK_GE(status, 0) << "Failed to close HDF5 file: " << filename;
+}  // namespace
 
-  // MinTopBlobs==1 guarantees at least one top blob
-  CHECK_GE(hdf_blobs_[0]->num_axes(), 1) << "Input must have at least 1 axis.";
-  const int num = hdf_blobs_[0]->shape(0);
-  for (int i = 1; i < top_size; ++i) {
-    CHECK_EQ(hdf_blobs_[i]->shape(0), num);
-  }
-  // Default to identity permutation.
-  data_permutation_.clear();
-  data_permutation_.resize(hdf_blobs_[0]->shape(0));
-  for (int i = 0; i < hdf_blobs_[0]->shape(0); i++)
-    data_permutation_[i] = i;
-
-  // Shuffle if needed.
-  if (this->layer_param_.hdf5_data_param().shuffle()) {
-    caffe::shuffle(data_permutation_.begin(), data_permutation_.end());
-    DLOG(INFO) << "Successully loaded " << hdf_blobs_[0]->shape(0)
-               << " rows (shuffled)";
-  } else {
-    DLOG(INFO) << "Successully loaded " << hdf_blobs_[0]->shape(0) << " rows";
-  }
+template <typename Ftype, typename Btype>
+HDF5DataLayer<Ftype, Btype>::~HDF5DataLayer<Ftype, Btype>() {
+  StopInternalThread();
 }
 
 template <typename Ftype, typename Btype>
@@ -75,8 +53,11 @@ void HDF5DataLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
   // Refuse transformation parameters since HDF5 is totally generic.
   CHECK(!this->layer_param_.has_transform_param()) <<
       this->type() << " does not transform data.";
+  // Set up again, e.g. on reshaping, the loader starts over
+  StopInternalThread();
+  const HDF5DataParameter& param = this->layer_param_.hdf5_data_param();
   // Read the source to parse the filenames.
-  const string& source = this->layer_param_.hdf5_data_param().source();
+  const string& source = param.source();
   LOG(INFO) << "Loading list of HDF5 filenames from: " << source;
   hdf_filenames_.clear();
   std::ifstream source_file(source.c_str());
@@ -89,73 +70,217 @@ void HDF5DataLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
     LOG(FATAL) << "Failed to open source file: " << source;
   }
   source_file.close();
-  num_files_ = hdf_filenames_.size();
-  current_file_ = 0;
-  LOG(INFO) << "Number of HDF5 files: " << num_files_;
-  CHECK_GE(num_files_, 1) << "Must have at least 1 HDF5 filename listed in "
+  LOG(INFO) << "Number of HDF5 files: " << hdf_filenames_.size();
+  CHECK_GE(hdf_filenames_.size(), 1UL) << "Must have at least 1 HDF5 filename listed in "
     << source;
 
-  file_permutation_.clear();
-  file_permutation_.resize(num_files_);
-  // Default to identity permutation.
-  for (int i = 0; i < num_files_; i++) {
-    file_permutation_[i] = i;
-  }
+  const int batch_size = param.batch_size();
+  CHECK_GT(batch_size, 0) << "Positive batch size required";
+  chunk_rows_ = param.chunk_rows() > 0 ? param.chunk_rows() : batch_size;
+  CHECK_GT(param.prefetch_chunks(), 0) << "At least one chunk must be prefetched";
+  shard_count_ = std::max(1, Caffe::solver_count());
+  shard_id_ = this->solver_rank_;
+  CHECK_LT(shard_id_, shard_count_);
 
-  // Shuffle if needed.
-  if (this->layer_param_.hdf5_data_param().shuffle()) {
-    caffe::shuffle(file_permutation_.begin(), file_permutation_.end());
+  // Row shapes come from the first file, the others must match them.
+  const int top_size = this->layer_param_.top_size();
+  row_shapes_.resize(top_size);
+  row_dims_.resize(top_size);
+  {
+    HDF5File file(hdf_filenames_[0]);
+    std::lock_guard<std::mutex> lock(hdf5_mutex());
+    for (int i = 0; i < top_size; ++i) {
+      std::vector<hsize_t> dims = hdf5_get_nd_dataset_dims(file.id_,
+          this->layer_param_.top(i).c_str(), 1, INT_MAX);
+      row_shapes_[i].assign(dims.begin() + 1, dims.end());
+    }
+  }
+  vector<int> top_shape;
+  for (int i = 0; i < top_size; ++i) {
+    top_shape.assign(1, batch_size);
+    top_shape.insert(top_shape.end(), row_shapes_[i].begin(), row_shapes_[i].end());
+    top[i]->Reshape(top_shape);
+    row_dims_[i] = top[i]->count(1);
   }
 
-  // Load the first HDF5 file and initialize the line counter.
-  LoadHDF5FileData(hdf_filenames_[file_permutation_[current_file_]].c_str());
+  chunks_.resize(param.prefetch_chunks());
+  free_chunks_ = make_shared<BlockingQueue<int>>();
+  full_chunks_ = make_shared<BlockingQueue<int>>();
+  for (int c = 0; c < chunks_.size(); ++c) {
+    chunks_[c].resize(top_size);
+    for (int i = 0; i < top_size; ++i) {
+      top_shape.assign(1, chunk_rows_);
+      top_shape.insert(top_shape.end(), row_shapes_[i].begin(), row_shapes_[i].end());
+      chunks_[c][i].reset(new TBlob<Ftype>(top_shape));
+      // Allocated here, thus the loader and Forward never do it concurrently
+      chunks_[c][i]->mutable_cpu_data();
+    }
+    free_chunks_->push(c);
+  }
+  current_chunk_ = -1;
   current_row_ = 0;
+  fill_chunk_ = -1;
+  fill_row_ = 0;
+  LOG(INFO) << this->print_current_device() << " HDF5 chunks of " << chunk_rows_
+            << " rows, " << chunks_.size() << " prefetched, shard " << shard_id_
+            << " of " << shard_count_;
+  StartInternalThread(false, Caffe::next_seed());
+}
 
-  // Reshape blobs.
-  const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
+template <typename Ftype, typename Btype>
+void HDF5DataLayer<Ftype, Btype>::CopyRow(const vector<shared_ptr<TBlob<Ftype>>>& src,
+    int src_row, const vector<shared_ptr<TBlob<Ftype>>>& dst, int dst_row) const {
+  for (int i = 0; i < src.size(); ++i) {
+    const int dim = row_dims_[i];
+    std::memcpy(dst[i]->mutable_cpu_data() + dst_row * dim,
+        src[i]->cpu_data() + src_row * dim, dim * sizeof(Ftype));
+  }
+}
+
+template <typename Ftype, typename Btype>
+void HDF5DataLayer<Ftype, Btype>::Emit(const vector<shared_ptr<TBlob<Ftype>>>& src, int row) {
+  if (fill_chunk_ < 0) {
+    ThreadProfile::Scope blocked(ThreadProfile::BLOCKED);
+    fill_chunk_ = free_chunks_->pop();
+    fill_row_ = 0;
+  }
+  CopyRow(src, row, chunks_[fill_chunk_], fill_row_);
+  if (++fill_row_ == chunk_rows_) {
+    full_chunks_->push(fill_chunk_);
+    fill_chunk_ = -1;
+  }
+}
+
+template <typename Ftype, typename Btype>
+void HDF5DataLayer<Ftype, Btype>::InternalThreadEntry() {
+  const HDF5DataParameter& param = this->layer_param_.hdf5_data_param();
+  const bool shuffle = param.shuffle();
+  const int shuffle_rows = shuffle ? param.shuffle_buffer() : 0;
   const int top_size = this->layer_param_.top_size();
-  vector<int> top_shape;
+  vector<shared_ptr<TBlob<Ftype>>> rows(top_size), reservoir(top_size);
   for (int i = 0; i < top_size; ++i) {
-    top_shape.resize(hdf_blobs_[i]->num_axes());
-    top_shape[0] = batch_size;
-    for (int j = 1; j < top_shape.size(); ++j) {
-      top_shape[j] = hdf_blobs_[i]->shape(j);
+    rows[i].reset(new TBlob<Ftype>());
+    if (shuffle_rows > 0) {
+      vector<int> shape(1, shuffle_rows);
+      shape.insert(shape.end(), row_shapes_[i].begin(), row_shapes_[i].end());
+      reservoir[i].reset(new TBlob<Ftype>(shape));
     }
-    top[i]->Reshape(top_shape);
+  }
+  int reservoir_rows = 0;
+  std::vector<int> file_order(hdf_filenames_.size());
+  std::vector<int> row_order;
+  // Counted across files and epochs, shard shard_id_ takes every shard_count_-th chunk
+  size_t chunk_index = 0UL;
+  try {
+    for (unsigned int epoch = 0U; !must_stop(0); ++epoch) {
+      std::iota(file_order.begin(), file_order.end(), 0);
+      if (shuffle) {
+        // Seeded alike on every rank so that shards never overlap
+        std::mt19937 file_rng(epoch);
+        std::shuffle(file_order.begin(), file_order.end(), file_rng);
+      }
+      for (int f : file_order) {
+        HDF5File file(hdf_filenames_[f]);
+        hsize_t file_rows = 0;
+        {
+          std::lock_guard<std::mutex> lock(hdf5_mutex());
+          for (int i = 0; i < top_size; ++i) {
+            std::vector<hsize_t> dims = hdf5_get_nd_dataset_dims(file.id_,
+                this->layer_param_.top(i).c_str(), 1, INT_MAX);
+            CHECK(dims.size() == row_shapes_[i].size() + 1 &&
+                std::equal(dims.begin() + 1, dims.end(), row_shapes_[i].begin()))
+                << "Shape of " << this->layer_param_.top(i) << " in " << file.filename_
+                << " differs from " << hdf_filenames_[0];
+            if (i == 0) {
+              file_rows = dims[0];
+            }
+            CHECK_EQ(dims[0], file_rows) << "Row counts differ in " << file.filename_;
+          }
+        }
+        for (hsize_t first = 0; first < file_rows; first += chunk_rows_) {
+          if (must_stop(0)) {
+            return;
+          }
+          if (chunk_index++ % shard_count_ != shard_id_) {
+            continue;
+          }
+          const int n = std::min<hsize_t>(chunk_rows_, file_rows - first);
+          {
+            ThreadProfile::Scope read(ThreadProfile::READ);
+            std::lock_guard<std::mutex> lock(hdf5_mutex());
+            for (int i = 0; i < top_size; ++i) {
+              hdf5_load_nd_dataset_rows(file.id_, this->layer_param_.top(i).c_str(),
+                  first, n, rows[i].get());
+            }
+          }
+          row_order.resize(n);
+          std::iota(row_order.begin(), row_order.end(), 0);
+          if (shuffle) {
+            caffe::shuffle(row_order.begin(), row_order.end());
+          }
+          for (int r : row_order) {
+            if (shuffle_rows == 0) {
+              Emit(rows, r);
+            } else if (reservoir_rows < shuffle_rows) {
+              CopyRow(rows, r, reservoir, reservoir_rows++);
+            } else {
+              // Emits a random row of the buffer, the new one takes its place
+              const int k = caffe_rng_rand() % shuffle_rows;
+              Emit(reservoir, k);
+              CopyRow(rows, r, reservoir, k);
+            }
+          }
+        }
+      }
+      DLOG(INFO) << "Looping around to first file.";
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
   }
 }
 
 template <typename Ftype, typename Btype>
-void HDF5DataLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
-      const vector<Blob*>& top) {
+void HDF5DataLayer<Ftype, Btype>::FillTops(const vector<Blob*>& top, bool gpu) {
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  for (int i = 0; i < batch_size; ++i, ++current_row_) {
-    if (current_row_ == hdf_blobs_[0]->shape(0)) {
-      if (num_files_ > 1) {
-        ++current_file_;
-        if (current_file_ == num_files_) {
-          current_file_ = 0;
-          if (this->layer_param_.hdf5_data_param().shuffle()) {
-            caffe::shuffle(file_permutation_.begin(), file_permutation_.end());
-          }
-          DLOG(INFO) << "Looping around to first file.";
-        }
-        LoadHDF5FileData(
-            hdf_filenames_[file_permutation_[current_file_]].c_str());
+  const int top_size = this->layer_param_.top_size();
+  for (int i = 0; i < batch_size;) {
+    if (current_chunk_ < 0) {
+      if (!full_chunks_->try_pop(&current_chunk_)) {
+        NVTX_RANGE(NVTX_WAIT, "HDF5 chunk wait " + this->name());
+        const auto start = std::chrono::steady_clock::now();
+        current_chunk_ = full_chunks_->pop("HDF5 data layer chunk queue empty");
+        total_wait_us_ += std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
       }
       current_row_ = 0;
-      if (this->layer_param_.hdf5_data_param().shuffle())
-        caffe::shuffle(data_permutation_.begin(), data_permutation_.end());
     }
-    for (int j = 0; j < this->layer_param_.top_size(); ++j) {
-      int data_dim = top[j]->count() / top[j]->shape(0);
-      caffe_copy(data_dim,
-          &hdf_blobs_[j]->cpu_data()[data_permutation_[current_row_]
-            * data_dim], &top[j]->mutable_cpu_data<Ftype>()[i * data_dim]);
+    // Rows of a chunk are contiguous, thus copied at once
+    const int n = std::min(batch_size - i, chunk_rows_ - current_row_);
+    const vector<shared_ptr<TBlob<Ftype>>>& chunk = chunks_[current_chunk_];
+    for (int j = 0; j < top_size; ++j) {
+      const int dim = row_dims_[j];
+#ifndef CPU_ONLY
+      Ftype* dst = gpu ? top[j]->mutable_gpu_data<Ftype>() : top[j]->mutable_cpu_data<Ftype>();
+#else
+      Ftype* dst = top[j]->mutable_cpu_data<Ftype>();
+#endif
+      caffe_copy(n * dim, chunk[j]->cpu_data() + current_row_ * dim, dst + i * dim);
+    }
+    i += n;
+    current_row_ += n;
+    if (current_row_ == chunk_rows_) {
+      free_chunks_->push(current_chunk_);
+      current_chunk_ = -1;
     }
   }
 }
 
+template <typename Ftype, typename Btype>
+void HDF5DataLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
+      const vector<Blob*>& top) {
+  FillTops(top, false);
+}
+
 #ifdef CPU_ONLY
 STUB_GPU_FORWARD(HDF5DataLayer, Forward);
 #endif
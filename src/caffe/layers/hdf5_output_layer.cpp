@@ -1,3 +1,4 @@
+#include <string>
 #include <vector>
 
 #include "hdf5.h"
@@ -5,6 +6,7 @@
 
 #include "caffe/layers/hdf5_output_layer.hpp"
 #include "caffe/util/hdf5.hpp"
+#include "caffe/util/nvtx.hpp"
 
 namespace caffe {
 
@@ -12,18 +14,144 @@ template <typename Ftype, typename Btype>
 void HDF5OutputLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
     const vector<Blob*>& top) {
   file_name_ = this->layer_param_.hdf5_output_param().file_name();
+  if (this->layer_param_.hdf5_output_param().async()) {
+    SetUpAsync();
+    return;
+  }
   file_id_ = H5Fcreate(file_name_.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
                        H5P_DEFAULT);
   CHECK_GE(file_id_, 0) << "Failed to open HDF5 file" << file_name_;
   file_opened_ = true;
 }
 
+template <typename Ftype, typename Btype>
+void HDF5OutputLayer<Ftype, Btype>::SetUpAsync() {
+  const HDF5OutputParameter& param = this->layer_param_.hdf5_output_param();
+  CHECK_GT(param.async_buffers(), 0);
+  CHECK_GT(param.chunk_rows(), 0);
+  CHECK_LE(param.compression(), 9);
+  CHECK_GT(param.file_count(), 0);
+#ifndef CPU_ONLY
+  const bool gpu = Caffe::mode() == Caffe::GPU;
+  if (gpu) {
+    device_ = Caffe::current_device();
+  }
+#endif
+  for (int i = 0; i < param.async_buffers(); ++i) {
+    buffer_data_.emplace_back(make_shared<TBlob<Ftype>>());
+    buffer_label_.emplace_back(make_shared<TBlob<Ftype>>());
+#ifndef CPU_ONLY
+    if (gpu) {
+      cudaEvent_t event;
+      CUDA_CHECK(cudaEventCreateWithFlags(&event, cudaEventDisableTiming));
+      buffer_copied_.push_back(event);
+    }
+    buffer_on_device_.push_back(0);
+#endif
+    free_buffers_.push(i);
+  }
+  {
+    std::lock_guard<std::mutex> lock(hdf5_mutex());
+    for (int k = 0; k < param.file_count(); ++k) {
+      const std::string name = async_file_name(k);
+      hid_t file_id = H5Fcreate(name.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+      CHECK_GE(file_id, 0) << "Failed to open HDF5 file" << name;
+      file_ids_.push_back(file_id);
+      file_buffers_.emplace_back(make_shared<BlockingQueue<int>>());
+    }
+  }
+  for (int k = 0; k < param.file_count(); ++k) {
+    writers_.emplace_back(&HDF5OutputLayer::WriteEntry, this, k);
+  }
+  LOG(INFO) << "Writing HDF5 output to " << param.file_count() << " file(s) by "
+            << param.async_buffers() << " buffers, " << param.chunk_rows()
+            << " rows per chunk, compression " << param.compression();
+}
+
+template <typename Ftype, typename Btype>
+std::string HDF5OutputLayer<Ftype, Btype>::async_file_name(int file) const {
+  if (this->layer_param_.hdf5_output_param().file_count() <= 1) {
+    return file_name_;
+  }
+  const size_t slash = file_name_.rfind('/');
+  size_t dot = file_name_.rfind('.');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    dot = file_name_.size();
+  }
+  return file_name_.substr(0, dot) + "_" + std::to_string(file) + file_name_.substr(dot);
+}
+
 template <typename Ftype, typename Btype>
 HDF5OutputLayer<Ftype, Btype>::~HDF5OutputLayer<Ftype, Btype>() {
   if (file_opened_) {
     herr_t status = H5Fclose(file_id_);
     CHECK_GE(status, 0) << "Failed to close HDF5 file " << file_name_;
   }
+  // Writers finish what is queued first
+  for (shared_ptr<BlockingQueue<int>>& buffers : file_buffers_) {
+    buffers->push(-1);
+  }
+  for (std::thread& writer : writers_) {
+    writer.join();
+  }
+  for (int k = 0; k < file_ids_.size(); ++k) {
+    std::lock_guard<std::mutex> lock(hdf5_mutex());
+    herr_t status = H5Fclose(file_ids_[k]);
+    CHECK_GE(status, 0) << "Failed to close HDF5 file " << async_file_name(k);
+  }
+#ifndef CPU_ONLY
+  for (cudaEvent_t event : buffer_copied_) {
+    CUDA_CHECK(cudaEventDestroy(event));
+  }
+#endif
+}
+
+template <typename Ftype, typename Btype>
+int HDF5OutputLayer<Ftype, Btype>::AcquireBuffer(const vector<Blob*>& bottom) {
+  CHECK_GE(bottom.size(), 2);
+  CHECK_EQ(bottom[0]->num(), bottom[1]->num());
+  int buffer;
+  if (!free_buffers_.try_pop(&buffer)) {
+    NVTX_RANGE(NVTX_WAIT, "HDF5 output wait " + this->name());
+    buffer = free_buffers_.pop("Waiting for a free HDF5 output buffer");
+  }
+  buffer_data_[buffer]->Reshape(bottom[0]->shape());
+  buffer_label_[buffer]->Reshape(bottom[1]->shape());
+  return buffer;
+}
+
+template <typename Ftype, typename Btype>
+void HDF5OutputLayer<Ftype, Btype>::QueueBuffer(int buffer) {
+  file_buffers_[batches_++ % file_buffers_.size()]->push(buffer);
+}
+
+template <typename Ftype, typename Btype>
+void HDF5OutputLayer<Ftype, Btype>::WriteEntry(int file) {
+#ifndef CPU_ONLY
+  if (device_ >= 0) {
+    CUDA_CHECK(cudaSetDevice(device_));
+  }
+#endif
+  const HDF5OutputParameter& param = this->layer_param_.hdf5_output_param();
+  while (true) {
+    const int buffer = file_buffers_[file]->pop();
+    if (buffer < 0) {
+      break;
+    }
+#ifndef CPU_ONLY
+    if (buffer_on_device_[buffer]) {
+      CUDA_CHECK(cudaEventSynchronize(buffer_copied_[buffer]));
+    }
+#endif
+    {
+      std::lock_guard<std::mutex> lock(hdf5_mutex());
+      hdf5_append_nd_dataset(file_ids_[file], HDF5_DATA_DATASET_NAME,
+          *buffer_data_[buffer], param.chunk_rows(), param.compression());
+      hdf5_append_nd_dataset(file_ids_[file], HDF5_DATA_LABEL_NAME,
+          *buffer_label_[buffer], param.chunk_rows(), param.compression());
+    }
+    free_buffers_.push(buffer);
+  }
 }
 
 template <typename Ftype, typename Btype>
@@ -32,6 +160,7 @@ void HDF5OutputLayer<Ftype, Btype>::SaveBlobs() {
   LOG(INFO) << "Saving HDF5 file " << file_name_;
   CHECK_EQ(data_blob_.num(), label_blob_.num()) <<
       "data blob and label blob must have the same batch size";
+  std::lock_guard<std::mutex> lock(hdf5_mutex());
   hdf5_save_nd_dataset(file_id_, HDF5_DATA_DATASET_NAME, data_blob_);
   hdf5_save_nd_dataset(file_id_, HDF5_DATA_LABEL_NAME, label_blob_);
   LOG(INFO) << "Successfully saved " << data_blob_.num() << " rows";
@@ -40,6 +169,18 @@ void HDF5OutputLayer<Ftype, Btype>::SaveBlobs() {
 template <typename Ftype, typename Btype>
 void HDF5OutputLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top) {
+  if (this->layer_param_.hdf5_output_param().async()) {
+    const int buffer = AcquireBuffer(bottom);
+    caffe_copy(bottom[0]->count(), bottom[0]->cpu_data<Ftype>(),
+        buffer_data_[buffer]->mutable_cpu_data(false));
+    caffe_copy(bottom[1]->count(), bottom[1]->cpu_data<Ftype>(),
+        buffer_label_[buffer]->mutable_cpu_data(false));
+#ifndef CPU_ONLY
+    buffer_on_device_[buffer] = 0;
+#endif
+    QueueBuffer(buffer);
+    return;
+  }
   CHECK_GE(bottom.size(), 2);
   CHECK_EQ(bottom[0]->num(), bottom[1]->num());
   data_blob_.Reshape(bottom[0]->num(), bottom[0]->channels(),
@@ -10,6 +10,21 @@ namespace caffe {
 template <typename Ftype, typename Btype>
 void HDF5OutputLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top) {
+  if (this->layer_param_.hdf5_output_param().async()) {
+    // The writer waits for the copies, the forward doesn't
+    const int buffer = this->AcquireBuffer(bottom);
+    cudaStream_t stream = Caffe::thread_stream();
+    CUDA_CHECK(cudaMemcpyAsync(buffer_data_[buffer]->mutable_cpu_data(false),
+        bottom[0]->gpu_data<Ftype>(), bottom[0]->count() * sizeof(Ftype),
+        cudaMemcpyDeviceToHost, stream));
+    CUDA_CHECK(cudaMemcpyAsync(buffer_label_[buffer]->mutable_cpu_data(false),
+        bottom[1]->gpu_data<Ftype>(), bottom[1]->count() * sizeof(Ftype),
+        cudaMemcpyDeviceToHost, stream));
+    CUDA_CHECK(cudaEventRecord(buffer_copied_[buffer], stream));
+    buffer_on_device_[buffer] = 1;
+    this->QueueBuffer(buffer);
+    return;
+  }
   CHECK_GE(bottom.size(), 2);
   CHECK_EQ(bottom[0]->num(), bottom[1]->num());
   data_blob_.Reshape(bottom[0]->num(), bottom[0]->channels(),
@@ -72,6 +72,10 @@ void HingeLossLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
   }
 }
 
+#ifdef CPU_ONLY
+STUB_GPU(HingeLossLayer);
+#endif
+
 INSTANTIATE_CLASS_FB(HingeLossLayer);
 REGISTER_LAYER_CLASS(HingeLoss);
 
@@ -0,0 +1,96 @@
+#include <vector>
+
+#include <device_launch_parameters.h>
+
+#include "caffe/layers/hinge_loss_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
+
+namespace caffe {
+
+// diff = max(0, 1 + t), t negated at the label, and its L1 or L2 loss term
+template <typename T, typename A>
+__global__ void HingeLossForwardGPU(const int count, const int dim, const T* data,
+    const T* label, const bool l2, T* diff, float* loss_terms) {
+  CUDA_KERNEL_LOOP(index, count) {
+    A t = mt_load<A, T>(data[index]);
+    if (index % dim == static_cast<int>(mt_load<float, T>(label[index / dim]))) {
+      t = -t;
+    }
+    const A margin = max(A(0), A(1) + t);
+    diff[index] = mt_store<T, A>(margin);
+    loss_terms[index] = static_cast<float>(l2 ? margin * margin : margin);
+  }
+}
+
+// top_diff[0] is the loss weight, read here so that nothing is copied to the host
+template <typename T, typename A>
+__global__ void HingeLossBackwardGPU(const int count, const int dim, const T* label,
+    const T* top_diff, const A inv_num, const bool l2, T* diff) {
+  const A loss_weight = mt_load<A, T>(top_diff[0]);
+  CUDA_KERNEL_LOOP(index, count) {
+    A d = mt_load<A, T>(diff[index]);
+    if (index % dim == static_cast<int>(mt_load<float, T>(label[index / dim]))) {
+      d = -d;
+    }
+    if (l2) {
+      d *= A(2) * loss_weight * inv_num;
+    } else {
+      d = (d > A(0) ? A(1) : (d < A(0) ? A(-1) : A(0))) * loss_weight * inv_num;
+    }
+    diff[index] = mt_store<T, A>(d);
+  }
+}
+
+template <typename Ftype, typename Btype>
+void HingeLossLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  typedef typename MultiTensorType<Ftype>::type T;
+  typedef typename MultiTensorAcc<Ftype>::type A;
+  const HingeLossParameter_Norm norm = this->layer_param_.hinge_loss_param().norm();
+  CHECK(norm == HingeLossParameter_Norm_L1 || norm == HingeLossParameter_Norm_L2)
+      << "Unknown Norm";
+  const int num = bottom[0]->num();
+  const int count = bottom[0]->count();
+  loss_terms_.Reshape(vector<int>(1, count));
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  HingeLossForwardGPU<T, A><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      count, count / num, reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>()),
+      reinterpret_cast<const T*>(bottom[1]->gpu_data<Ftype>()),
+      norm == HingeLossParameter_Norm_L2,
+      reinterpret_cast<T*>(bottom[0]->mutable_gpu_diff<Ftype>()),
+      loss_terms_.mutable_gpu_data());
+  CUDA_POST_KERNEL_CHECK;
+  caffe_gpu_scaled_sum(count, loss_terms_.gpu_data(), 1.F / num,
+      top[0]->mutable_gpu_data<Ftype>());
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template <typename Ftype, typename Btype>
+void HingeLossLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
+    const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  if (propagate_down[1]) {
+    LOG(FATAL) << this->type()
+               << " Layer cannot backpropagate to label inputs.";
+  }
+  if (propagate_down[0]) {
+    typedef typename MultiTensorType<Btype>::type T;
+    typedef typename MultiTensorAcc<Btype>::type A;
+    const int num = bottom[0]->num();
+    const int count = bottom[0]->count();
+    cudaStream_t stream = Caffe::thread_stream();
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    HingeLossBackwardGPU<T, A><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        count, count / num, reinterpret_cast<const T*>(bottom[1]->gpu_data<Btype>()),
+        reinterpret_cast<const T*>(top[0]->gpu_diff<Btype>()), A(1) / A(num),
+        this->layer_param_.hinge_loss_param().norm() == HingeLossParameter_Norm_L2,
+        reinterpret_cast<T*>(bottom[0]->mutable_gpu_diff<Btype>()));
+    CUDA_POST_KERNEL_CHECK;
+    CUDA_CHECK(caffe_gpu_sync(stream));
+  }
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS_FB(HingeLossLayer);
+
+}  // namespace caffe
@@ -1,7 +1,9 @@
 #include <opencv2/core/core.hpp>
 
 #include <fstream>  // NOLINT(readability/streams)
+#include <future>
 #include <iostream>  // NOLINT(readability/streams)
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -10,9 +12,11 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/layers/image_data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/image_cache.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_profile.hpp"
 
 namespace caffe {
 
@@ -28,8 +32,8 @@ void ImageDataLayer<Ftype, Btype>::DataLayerSetUp(const vector<Blob*>& bottom,
       const vector<Blob*>& top) {
   const int new_height = this->layer_param_.image_data_param().new_height();
   const int new_width  = this->layer_param_.image_data_param().new_width();
-  const bool is_color  = this->layer_param_.image_data_param().is_color();
   string root_folder = this->layer_param_.image_data_param().root_folder();
+  const ImageDataParameter& image_data_param = this->layer_param_.image_data_param();
 
   CHECK((new_height == 0 && new_width == 0) ||
       (new_height > 0 && new_width > 0)) << "Current implementation requires "
@@ -61,9 +65,14 @@ void ImageDataLayer<Ftype, Btype>::DataLayerSetUp(const vector<Blob*>& bottom,
     CHECK_GT(lines_.size(), skip) << "Not enough points to skip";
     lines_id_ = skip;
   }
+  if (image_data_param.cache_images()) {
+    ImageCache::instance().reserve(static_cast<size_t>(image_data_param.cache_mb()) << 20);
+  }
+  if (image_data_param.read_threads() > 0) {
+    read_pool_.reset(new ThreadPool(image_data_param.read_threads()));
+  }
   // Read an image, and use it to initialize the top blob.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-      new_height, new_width, is_color);
+  cv::Mat cv_img = ReadImage(root_folder + lines_[lines_id_].first);
   CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
   // Reshape prefetch_data and top[0] according to the batch_size.
   const int batch_size = this->layer_param_.image_data_param().batch_size();
@@ -93,6 +102,39 @@ void ImageDataLayer<Ftype, Btype>::ShuffleImages() {
   shuffle(lines_.begin(), lines_.end(), prefetch_rng);
 }
 
+template <typename Ftype, typename Btype>
+cv::Mat ImageDataLayer<Ftype, Btype>::ReadImage(const std::string& filename) const {
+  const ImageDataParameter& image_data_param = this->layer_param_.image_data_param();
+  const int new_height = image_data_param.new_height();
+  const int new_width = image_data_param.new_width();
+  const bool is_color = image_data_param.is_color();
+  if (!image_data_param.cache_images()) {
+    return ReadImageToCVMat(filename, new_height, new_width, is_color);
+  }
+  ImageCache& cache = ImageCache::instance();
+  cv::Mat cv_img;
+  if (image_data_param.cache_decoded()) {
+    const std::string key = filename + ":" + std::to_string(new_height) + "x" +
+        std::to_string(new_width) + (is_color ? "c" : "g");
+    if (!cache.get(key, &cv_img)) {
+      cv_img = ReadImageToCVMat(filename, new_height, new_width, is_color);
+      if (cv_img.data) {
+        cache.put(key, cv_img);
+      }
+    }
+    return cv_img;
+  }
+  cv::Mat content;
+  if (!cache.get(filename, &content)) {
+    if (!ReadFileToCVMat(filename, &content)) {
+      LOG(ERROR) << "Could not open or find file " << filename;
+      return cv_img;
+    }
+    cache.put(filename, content);
+  }
+  return DecodeFileToCVMat(content, new_height, new_width, is_color);
+}
+
 template<typename Ftype, typename Btype>
 void ImageDataLayer<Ftype, Btype>::InitializePrefetch() {}
 
@@ -105,37 +147,63 @@ void ImageDataLayer<Ftype, Btype>::load_batch(Batch* batch, int thread_id, size_
   double trans_time = 0;
   CPUTimer timer;
   CHECK(batch->data_->count());
-  ImageDataParameter image_data_param = this->layer_param_.image_data_param();
+  const ImageDataParameter& image_data_param = this->layer_param_.image_data_param();
   const int batch_size = image_data_param.batch_size();
-  const int new_height = image_data_param.new_height();
-  const int new_width = image_data_param.new_width();
-  const bool is_color = image_data_param.is_color();
   string root_folder = image_data_param.root_folder();
 
-  // Reshape according to the first image of each batch
-  // on single input batches allows for inputs of varying dimension.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-      new_height, new_width, is_color);
-  CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
-  // Infer the expected blob shape from a cv_img.
-  vector<int> top_shape { batch_size, cv_img.channels(), cv_img.rows, cv_img.cols };
-  batch->data_->Reshape(top_shape);
-  vector<int> label_shape(1, batch_size);
-  batch->label_->Reshape(label_shape);
-
-  Ftype* prefetch_data = batch->data_->mutable_cpu_data<Ftype>();
-  Ftype* prefetch_label = batch->label_->mutable_cpu_data<Ftype>();
-
-  // datum scales
+  // Reads of the whole batch are outstanding at once, each one transformed once done
   const int lines_size = lines_.size();
-  const size_t buf_len = batch->data_->offset(1);
+  vector<std::pair<std::string, int>> items(batch_size);
+  vector<std::future<cv::Mat>> images(batch_size);
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    CHECK_GT(lines_size, lines_id_);
+    items[item_id] = lines_[lines_id_];
+    const std::string filename = root_folder + items[item_id].first;
+    if (read_pool_) {
+      auto read = std::make_shared<std::packaged_task<cv::Mat()>>(
+          [this, filename]() { return ReadImage(filename); });
+      images[item_id] = read->get_future();
+      read_pool_->runTask([read]() { (*read)(); });
+    } else {
+      images[item_id] = std::async(std::launch::deferred,
+          [this, filename]() { return ReadImage(filename); });
+    }
+    // go to the next iter
+    lines_id_++;
+    if (lines_id_ >= lines_size) {
+      // We have reached the end. Restart from the first.
+      DLOG(INFO) << this->print_current_device() << "Restarting data prefetching from start.";
+      lines_id_ = 0;
+      if (image_data_param.shuffle()) {
+        ShuffleImages();
+      }
+    }
+  }
+
+  vector<int> top_shape;
+  Ftype* prefetch_data = nullptr;
+  Ftype* prefetch_label = nullptr;
+  size_t buf_len = 0UL;
   for (int item_id = 0; item_id < batch_size; ++item_id) {
     // get a blob
     timer.Start();
-    CHECK_GT(lines_size, lines_id_);
-    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-        new_height, new_width, is_color);
-    CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
+    cv::Mat cv_img;
+    {
+      ThreadProfile::Scope read(ThreadProfile::READ);
+      cv_img = images[item_id].get();
+    }
+    CHECK(cv_img.data) << "Could not load " << items[item_id].first;
+    if (item_id == 0) {
+      // Reshape according to the first image of each batch
+      // on single input batches allows for inputs of varying dimension.
+      top_shape = { batch_size, cv_img.channels(), cv_img.rows, cv_img.cols };
+      batch->data_->Reshape(top_shape);
+      vector<int> label_shape(1, batch_size);
+      batch->label_->Reshape(label_shape);
+      prefetch_data = batch->data_->mutable_cpu_data<Ftype>();
+      prefetch_label = batch->label_->mutable_cpu_data<Ftype>();
+      buf_len = batch->data_->offset(1);
+    }
     CHECK_EQ(cv_img.rows, top_shape[2]) << "Can't mix different image sizes in one batch";
     CHECK_EQ(cv_img.cols, top_shape[3]) << "Can't mix different image sizes in one batch";
     read_time += timer.MicroSeconds();
@@ -145,17 +213,7 @@ void ImageDataLayer<Ftype, Btype>::load_batch(Batch* batch, int thread_id, size_
     this->dt(0)->Transform(cv_img, prefetch_data + offset, buf_len);
     trans_time += timer.MicroSeconds();
 
-    prefetch_label[item_id] = lines_[lines_id_].second;
-    // go to the next iter
-    lines_id_++;
-    if (lines_id_ >= lines_size) {
-      // We have reached the end. Restart from the first.
-      DLOG(INFO) << this->print_current_device() << "Restarting data prefetching from start.";
-      lines_id_ = 0;
-      if (this->layer_param_.image_data_param().shuffle()) {
-        ShuffleImages();
-      }
-    }
+    prefetch_label[item_id] = items[item_id].second;
   }
   batch_timer.Stop();
   DLOG(INFO) << this->print_current_device()
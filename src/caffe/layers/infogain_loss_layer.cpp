@@ -104,6 +104,10 @@ void InfogainLossLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
   }
 }
 
+#ifdef CPU_ONLY
+STUB_GPU(InfogainLossLayer);
+#endif
+
 INSTANTIATE_CLASS_FB(InfogainLossLayer);
 REGISTER_LAYER_CLASS(InfogainLoss);
 }  // namespace caffe
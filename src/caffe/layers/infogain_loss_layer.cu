@@ -0,0 +1,92 @@
+#include <vector>
+
+#include <device_launch_parameters.h>
+
+#include "caffe/layers/infogain_loss_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
+
+namespace caffe {
+
+// -H(label, j) * log(p_j), p clipped at min_prob, per element
+template <typename T>
+__global__ void InfogainLossForwardGPU(const int count, const int dim, const T* data,
+    const T* label, const T* infogain, const float min_prob, float* loss_terms) {
+  CUDA_KERNEL_LOOP(index, count) {
+    const int label_value = static_cast<int>(mt_load<float, T>(label[index / dim]));
+    const float h = mt_load<float, T>(infogain[label_value * dim + index % dim]);
+    loss_terms[index] = -h * log(max(mt_load<float, T>(data[index]), min_prob));
+  }
+}
+
+// -loss_weight * H(label, j) / (num * p_j), loss_weight read from top_diff[0]
+template <typename T, typename A>
+__global__ void InfogainLossBackwardGPU(const int count, const int dim, const T* data,
+    const T* label, const T* infogain, const T* top_diff, const A inv_num,
+    const A min_prob, T* diff) {
+  const A scale = -mt_load<A, T>(top_diff[0]) * inv_num;
+  CUDA_KERNEL_LOOP(index, count) {
+    const int label_value = static_cast<int>(mt_load<float, T>(label[index / dim]));
+    const A h = mt_load<A, T>(infogain[label_value * dim + index % dim]);
+    diff[index] = mt_store<T, A>(scale * h / max(mt_load<A, T>(data[index]), min_prob));
+  }
+}
+
+template <typename Ftype, typename Btype>
+void InfogainLossLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  typedef typename MultiTensorType<Ftype>::type T;
+  const Ftype* infogain_mat = bottom.size() < 3 ?
+      infogain_.template gpu_data<Ftype>() : bottom[2]->gpu_data<Ftype>();
+  const int num = bottom[0]->num();
+  const int count = bottom[0]->count();
+  loss_terms_.Reshape(vector<int>(1, count));
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  InfogainLossForwardGPU<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      count, count / num, reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>()),
+      reinterpret_cast<const T*>(bottom[1]->gpu_data<Ftype>()),
+      reinterpret_cast<const T*>(infogain_mat),
+      static_cast<float>(tol<Ftype>(kLOG_THRESHOLD, min_dtype<Ftype>())),
+      loss_terms_.mutable_gpu_data());
+  CUDA_POST_KERNEL_CHECK;
+  caffe_gpu_scaled_sum(count, loss_terms_.gpu_data(), 1.F / num,
+      top[0]->mutable_gpu_data<Ftype>());
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template <typename Ftype, typename Btype>
+void InfogainLossLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
+    const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  if (propagate_down[1]) {
+    LOG(FATAL) << this->type()
+               << " Layer cannot backpropagate to label inputs.";
+  }
+  if (propagate_down.size() > 2 && propagate_down[2]) {
+    LOG(FATAL) << this->type()
+               << " Layer cannot backpropagate to infogain inputs.";
+  }
+  if (propagate_down[0]) {
+    typedef typename MultiTensorType<Btype>::type T;
+    typedef typename MultiTensorAcc<Btype>::type A;
+    const Btype* infogain_mat = bottom.size() < 3 ?
+        infogain_.template gpu_data<Btype>() : bottom[2]->gpu_data<Btype>();
+    const int num = bottom[0]->num();
+    const int count = bottom[0]->count();
+    cudaStream_t stream = Caffe::thread_stream();
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    InfogainLossBackwardGPU<T, A><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0,
+        stream>>>(count, count / num, reinterpret_cast<const T*>(bottom[0]->gpu_data<Btype>()),
+        reinterpret_cast<const T*>(bottom[1]->gpu_data<Btype>()),
+        reinterpret_cast<const T*>(infogain_mat),
+        reinterpret_cast<const T*>(top[0]->gpu_diff<Btype>()), A(1) / A(num),
+        A(static_cast<float>(tol<Btype>(kLOG_THRESHOLD, min_dtype<Btype>()))),
+        reinterpret_cast<T*>(bottom[0]->mutable_gpu_diff<Btype>()));
+    CUDA_POST_KERNEL_CHECK;
+    CUDA_CHECK(caffe_gpu_sync(stream));
+  }
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS_FB(InfogainLossLayer);
+
+}  // namespace caffe
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <vector>
 
 #include "caffe/filler.hpp"
@@ -12,6 +13,18 @@ InnerProductLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom, const v
   const int num_output = this->layer_param_.inner_product_param().num_output();
   bias_term_ = this->layer_param_.inner_product_param().bias_term();
   transpose_ = this->layer_param_.inner_product_param().transpose();
+  quantized_ = this->layer_param_.has_quantization_param();
+  activation_ = this->layer_param_.inner_product_param().activation();
+  if (activation_ != InnerProductParameter_Activation_NONE) {
+    activation_diff_ = Blob::create<Btype>();
+  }
+  if (activation_ == InnerProductParameter_Activation_GELU) {
+    pre_activation_ = Blob::create<Ftype, Btype>();
+  }
+  if (quantized_) {
+    CHECK_EQ(this->phase_, TEST) << "INT8 InnerProduct layer " << this->name()
+        << " is inference only";
+  }
   N_ = num_output;
   const int axis = bottom[0]->CanonicalAxisIndex(this->layer_param_.inner_product_param().axis());
   // Dimensions starting from "axis" are "flattened" into a single
@@ -77,6 +90,58 @@ InnerProductLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom, const vect
     bias_multiplier_->Reshape(bias_shape);
     bias_multiplier_->set_data(1.F);
   }
+  if (activation_diff_) {
+    activation_diff_->ReshapeLike(*top[0]);
+  }
+  if (pre_activation_) {
+    pre_activation_->ReshapeLike(*top[0]);
+  }
+}
+
+// GELU, tanh approximation: x/2 (1 + tanh(sqrt(2/pi) (x + 0.044715 x^3)))
+static const float kGeluScale = 0.7978845608F;
+static const float kGeluCube = 0.044715F;
+
+template<typename Ftype, typename Btype>
+void InnerProductLayer<Ftype, Btype>::ActivationForward_cpu(Ftype* top_data) {
+  const int count = M_ * N_;
+  if (activation_ == InnerProductParameter_Activation_RELU) {
+    for (int i = 0; i < count; ++i) {
+      top_data[i] = top_data[i] > Ftype(0) ? top_data[i] : Ftype(0);
+    }
+  } else if (activation_ == InnerProductParameter_Activation_GELU) {
+    Ftype* pre = pre_activation_->mutable_cpu_data<Ftype>();
+    for (int i = 0; i < count; ++i) {
+      const float x = top_data[i];
+      pre[i] = top_data[i];
+      top_data[i] = 0.5F * x * (1.F + std::tanh(kGeluScale * (x + kGeluCube * x * x * x)));
+    }
+  }
+}
+
+template<typename Ftype, typename Btype>
+const Btype* InnerProductLayer<Ftype, Btype>::ActivationBackward_cpu(Blob* top) {
+  const Btype* top_diff = top->cpu_diff<Btype>();
+  if (activation_ == InnerProductParameter_Activation_NONE) {
+    return top_diff;
+  }
+  const int count = M_ * N_;
+  Btype* diff = activation_diff_->mutable_cpu_data<Btype>();
+  if (activation_ == InnerProductParameter_Activation_RELU) {
+    const Btype* top_data = top->cpu_data<Btype>();
+    for (int i = 0; i < count; ++i) {
+      diff[i] = top_data[i] > Btype(0) ? top_diff[i] : Btype(0);
+    }
+  } else {
+    const Btype* pre = pre_activation_->cpu_data<Btype>();
+    for (int i = 0; i < count; ++i) {
+      const float x = pre[i];
+      const float t = std::tanh(kGeluScale * (x + kGeluCube * x * x * x));
+      diff[i] = top_diff[i] * (0.5F * (1.F + t) +
+          0.5F * x * (1.F - t * t) * kGeluScale * (1.F + 3.F * kGeluCube * x * x));
+    }
+  }
+  return diff;
 }
 
 template<typename Ftype, typename Btype>
@@ -85,6 +150,16 @@ void InnerProductLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
   const Ftype* bottom_data = bottom[0]->cpu_data<Ftype>();
   Ftype* top_data = top[0]->mutable_cpu_data<Ftype>();
   const Ftype* weight = this->blobs_[0]->template cpu_data<Ftype>();
+  if (quantized_) {
+    if (!int8_gemm_.initialized()) {
+      int8_gemm_.SetWeights(N_, K_, weight, transpose_,
+          this->layer_param_.quantization_param().input_scale());
+    }
+    int8_gemm_.Forward_cpu(M_, bottom_data, false,
+        bias_term_ ? this->blobs_[1]->template cpu_data<Ftype>() : nullptr, top_data, false);
+    ActivationForward_cpu(top_data);
+    return;
+  }
   caffe_cpu_gemm(CblasNoTrans, transpose_ ? CblasNoTrans : CblasTrans, M_, N_, K_, (Ftype) 1.,
       bottom_data, weight, (Ftype) 0., top_data);
   if (bias_term_) {
@@ -92,32 +167,32 @@ void InnerProductLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
         bias_multiplier_->template cpu_data<Ftype>(), this->blobs_[1]->template cpu_data<Ftype>(),
         (Ftype) 1., top_data);
   }
+  ActivationForward_cpu(top_data);
 }
 
 template<typename Ftype, typename Btype>
 void InnerProductLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
     const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  const Btype beta = this->overwrite_param_diffs_ ? (Btype) 0. : (Btype) 1.;
+  const Btype* top_diff = ActivationBackward_cpu(top[0]);
   if (this->param_propagate_down_[0]) {
-    const Btype* top_diff = top[0]->cpu_diff<Btype>();
     const Btype* bottom_data = bottom[0]->cpu_data<Btype>();
     // Gradient with respect to weight
     if (transpose_) {
       caffe_cpu_gemm<Btype>(CblasTrans, CblasNoTrans, K_, N_, M_, (Btype) 1., bottom_data, top_diff,
-          (Btype) 1., this->blobs_[0]->template mutable_cpu_diff<Btype>());
+          beta, this->blobs_[0]->template mutable_cpu_diff<Btype>());
     } else {
       caffe_cpu_gemm<Btype>(CblasTrans, CblasNoTrans, N_, K_, M_, (Btype) 1., top_diff, bottom_data,
-          (Btype) 1., this->blobs_[0]->template mutable_cpu_diff<Btype>());
+          beta, this->blobs_[0]->template mutable_cpu_diff<Btype>());
     }
   }
   if (bias_term_ && this->param_propagate_down_[1]) {
-    const Btype* top_diff = top[0]->cpu_diff<Btype>();
     // Gradient with respect to bias
     caffe_cpu_gemv<Btype>(CblasTrans, M_, N_, (Btype) 1., top_diff,
-        bias_multiplier_->template cpu_data<Btype>(), (Btype) 1.,
+        bias_multiplier_->template cpu_data<Btype>(), beta,
         this->blobs_[1]->template mutable_cpu_diff<Btype>());
   }
   if (propagate_down[0]) {
-    const Btype* top_diff = top[0]->cpu_diff<Btype>();
     // Gradient with respect to bottom data
     if (transpose_) {
       caffe_cpu_gemm<Btype>(CblasNoTrans, CblasTrans, M_, K_, N_, (Btype) 1., top_diff,
@@ -131,12 +206,17 @@ void InnerProductLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
   }
 }
 
+template <typename Ftype, typename Btype>
+void InnerProductLayer<Ftype, Btype>::Cost(const vector<Blob*>& bottom,
+    const vector<Blob*>& top, LayerCost* cost) const {
+  cost->forward_flops = 2. * M_ * N_ * K_;
+  cost->backward_flops = 2. * cost->forward_flops;
+}
+
 #ifdef CPU_ONLY
 STUB_GPU(InnerProductLayer);
 #endif
 
 INSTANTIATE_CLASS_FB(InnerProductLayer);
 
-REGISTER_LAYER_CLASS(InnerProduct);
-
 }  // namespace caffe
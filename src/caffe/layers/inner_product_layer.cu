@@ -8,12 +8,104 @@
 
 namespace caffe {
 
+// GELU, tanh approximation: x/2 (1 + tanh(sqrt(2/pi) (x + 0.044715 x^3)))
+#define GELU_SCALE 0.7978845608F
+#define GELU_CUBE 0.044715F
+
+template <typename Dtype>
+__global__ void IPReLUForward(const int n, Dtype* data) {
+  CUDA_KERNEL_LOOP(index, n) {
+    data[index] = data[index] > Dtype(0) ? data[index] : Dtype(0);
+  }
+}
+
+template <typename Dtype>
+__global__ void IPGeluForward(const int n, Dtype* data, Dtype* pre) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const float x = data[index];
+    pre[index] = data[index];
+    data[index] = 0.5F * x * (1.F + tanhf(GELU_SCALE * (x + GELU_CUBE * x * x * x)));
+  }
+}
+
+template <typename Dtype>
+__global__ void IPReLUBackward(const int n, const Dtype* top_diff, const Dtype* top_data,
+    Dtype* diff) {
+  CUDA_KERNEL_LOOP(index, n) {
+    diff[index] = top_data[index] > Dtype(0) ? top_diff[index] : Dtype(0);
+  }
+}
+
+template <typename Dtype>
+__global__ void IPGeluBackward(const int n, const Dtype* top_diff, const Dtype* pre,
+    Dtype* diff) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const float x = pre[index];
+    const float t = tanhf(GELU_SCALE * (x + GELU_CUBE * x * x * x));
+    const float dy = top_diff[index];
+    diff[index] = dy * (0.5F * (1.F + t) +
+        0.5F * x * (1.F - t * t) * GELU_SCALE * (1.F + 3.F * GELU_CUBE * x * x));
+  }
+}
+
+template <typename Ftype, typename Btype>
+void InnerProductLayer<Ftype, Btype>::ActivationForward_gpu(Ftype* top_data) {
+  const int count = M_ * N_;
+  cudaStream_t stream = Caffe::thread_stream();
+  if (activation_ == InnerProductParameter_Activation_RELU) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    IPReLUForward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        count, top_data);
+  } else if (activation_ == InnerProductParameter_Activation_GELU) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    IPGeluForward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        count, top_data, pre_activation_->mutable_gpu_data<Ftype>());
+  } else {
+    return;
+  }
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template <typename Ftype, typename Btype>
+const Btype* InnerProductLayer<Ftype, Btype>::ActivationBackward_gpu(Blob* top) {
+  const Btype* top_diff = top->gpu_diff<Btype>();
+  if (activation_ == InnerProductParameter_Activation_NONE) {
+    return top_diff;
+  }
+  const int count = M_ * N_;
+  cudaStream_t stream = Caffe::thread_stream();
+  Btype* diff = activation_diff_->mutable_gpu_data<Btype>();
+  if (activation_ == InnerProductParameter_Activation_RELU) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    IPReLUBackward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        count, top_diff, top->gpu_data<Btype>(), diff);
+  } else {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    IPGeluBackward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        count, top_diff, pre_activation_->gpu_data<Btype>(), diff);
+  }
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+  return diff;
+}
+
 template <typename Ftype, typename Btype>
 void InnerProductLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
     const vector<Blob*>& top) {
   const Ftype* bottom_data = bottom[0]->gpu_data<Ftype>();
   Ftype* top_data = top[0]->mutable_gpu_data<Ftype>();
   const Ftype* weight = this->blobs_[0]->template gpu_data<Ftype>();
+  if (quantized_) {
+    if (!int8_gemm_.initialized()) {
+      int8_gemm_.SetWeights(N_, K_, this->blobs_[0]->template cpu_data<Ftype>(), transpose_,
+          this->layer_param_.quantization_param().input_scale());
+    }
+    int8_gemm_.Forward_gpu(M_, bottom_data, false,
+        bias_term_ ? this->blobs_[1]->template gpu_data<Ftype>() : nullptr, top_data, false);
+    ActivationForward_gpu(top_data);
+    return;
+  }
   // Y = X * W
   if (M_ == 1) {
     caffe_gpu_gemv<Ftype>(CblasNoTrans, N_, K_, (Ftype)1., weight, bottom_data,
@@ -32,37 +124,37 @@ void InnerProductLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
           bias_multiplier_->template gpu_data<Ftype>(), bias, (Ftype)1., top_data);
     }
   }
+  ActivationForward_gpu(top_data);
 }
 
 template <typename Ftype, typename Btype>
 void InnerProductLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
-  // dE/dW and dE/dB
+  // dE/dW and dE/dB, added to unless overwrite_param_diffs_
+  const Btype beta = this->overwrite_param_diffs_ ? (Btype) 0. : (Btype) 1.;
+  const Btype* top_diff = ActivationBackward_gpu(top[0]);
   // dE/dW: Gradient with respect to weight
   if (this->param_propagate_down_[0]) {
-    const Btype* top_diff = top[0]->gpu_diff<Btype>();
     Btype* weight_diff = this->blobs_[0]->template mutable_gpu_diff<Btype>();
     // dW = dY * X
     const Btype* bottom_data = bottom[0]->gpu_data<Btype>();
     if (transpose_) {
       caffe_gpu_gemm<Btype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-          (Btype)1., bottom_data, top_diff, (Btype)1., weight_diff);
+          (Btype)1., bottom_data, top_diff, beta, weight_diff);
     } else {
       caffe_gpu_gemm<Btype>(CblasTrans, CblasNoTrans, N_, K_, M_,
-          (Btype)1., top_diff, bottom_data, (Btype)1., weight_diff);
+          (Btype)1., top_diff, bottom_data, beta, weight_diff);
     }
   }
   // dB: Gradient with respect to bias
   if (this->bias_term_ && this->param_propagate_down_[1]) {
     Btype* bias_diff = this->blobs_[1]->template mutable_gpu_diff<Btype>();
-    const Btype* top_diff = top[0]->gpu_diff<Btype>();
     // dB (c) = sum_N(dY(n, c))
     caffe_gpu_gemv<Btype>(CblasTrans, M_, N_, (Btype)1., top_diff,
-        bias_multiplier_->template gpu_data<Btype>(), (Btype)1., bias_diff);
+        bias_multiplier_->template gpu_data<Btype>(), beta, bias_diff);
   }
   // Backward propagate dE/dX= dE/dY * W
   if (propagate_down[0]) {
-    const Btype* top_diff = top[0]->gpu_diff<Btype>();
     const Btype* weight = this->blobs_[0]->template gpu_data<Btype>();
     // regular backward
     if (transpose_) {
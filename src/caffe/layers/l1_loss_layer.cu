@@ -1,45 +1,80 @@
 #include "caffe/layers/l1_loss_layer.hpp"
 
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layer.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/welford.cuh"
 
 namespace caffe {
 
+// Partial sums of |a - b|, one per block, without storing a - b or its sign
+template <typename T, typename A>
+__global__ void L1LossForwardGPU(const int count, const T* a, const T* b, float* partials) {
+  A sum = A(0);
+  for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < count; i += blockDim.x * gridDim.x) {
+    sum += abs(mt_load<A, T>(a[i]) - mt_load<A, T>(b[i]));
+  }
+  sum = block_sum<A, CAFFE_CUDA_NUM_THREADS>(sum);
+  if (threadIdx.x == 0) {
+    partials[blockIdx.x] = static_cast<float>(sum);
+  }
+}
+
+// da = alpha * sign(a - b) and db = -da, either one may be null
+template <typename T, typename A>
+__global__ void L1LossBackwardGPU(const int count, const T* a, const T* b, const A alpha,
+    T* da, T* db) {
+  CUDA_KERNEL_LOOP(i, count) {
+    const A d = mt_load<A, T>(a[i]) - mt_load<A, T>(b[i]);
+    const A g = d > A(0) ? alpha : (d < A(0) ? -alpha : A(0));
+    if (da != nullptr) {
+      da[i] = mt_store<T, A>(g);
+    }
+    if (db != nullptr) {
+      db[i] = mt_store<T, A>(-g);
+    }
+  }
+}
+
 template <typename Ftype, typename Btype>
 void L1LossLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
     const vector<Blob*>& top) {
-  int count = bottom[0]->count();
-  caffe_gpu_sub<Ftype>(
-      count,
-      bottom[0]->gpu_data<Ftype>(),
-      bottom[1]->gpu_data<Ftype>(),
-      diff_.template mutable_gpu_data<Ftype>());
-  caffe_gpu_sign<Ftype>(count, diff_.template gpu_data<Ftype>(),
-      sign_.template mutable_gpu_data<Ftype>());
-  Ftype abs_sum;
-  caffe_gpu_asum(count, diff_.template gpu_data<Ftype>(), &abs_sum);
-  Ftype loss = abs_sum / bottom[0]->num();
-  top[0]->mutable_cpu_data<Ftype>()[0] = loss;
+  typedef typename MultiTensorType<Ftype>::type T;
+  typedef typename MultiTensorAcc<Ftype>::type A;
+  const int count = bottom[0]->count();
+  const int blocks = std::min(CAFFE_GET_BLOCKS(count), kLOSS_BLOCKS);
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  L1LossForwardGPU<T, A><<<blocks, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(count,
+      reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>()),
+      reinterpret_cast<const T*>(bottom[1]->gpu_data<Ftype>()), this->loss_partials(blocks));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+  top[0]->mutable_cpu_data<Ftype>()[0] = this->loss_partials_sum() / bottom[0]->num();
 }
 
 template <typename Ftype, typename Btype>
 void L1LossLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
-  for (int i = 0; i < 2; ++i) {
-    if (propagate_down[i]) {
-      const Btype sign = (i == 0) ? 1 : -1;
-      const Btype alpha = sign * top[0]->cpu_diff<Btype>()[0] / bottom[i]->num();
-      caffe_gpu_axpby<Btype>(
-          bottom[i]->count(),                     // count
-          alpha,                                  // alpha
-          sign_.template gpu_data<Btype>(),       // a
-          Btype(0),                               // beta
-          bottom[i]->mutable_gpu_diff<Btype>());  // b
-    }
+  if (!propagate_down[0] && !propagate_down[1]) {
+    return;
   }
+  typedef typename MultiTensorType<Btype>::type T;
+  typedef typename MultiTensorAcc<Btype>::type A;
+  const int count = bottom[0]->count();
+  const float alpha = static_cast<float>(top[0]->cpu_diff<Btype>()[0]) / bottom[0]->num();
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  L1LossBackwardGPU<T, A><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      count, reinterpret_cast<const T*>(bottom[0]->gpu_data<Btype>()),
+      reinterpret_cast<const T*>(bottom[1]->gpu_data<Btype>()), A(alpha),
+      propagate_down[0] ? reinterpret_cast<T*>(bottom[0]->mutable_gpu_diff<Btype>()) : nullptr,
+      propagate_down[1] ? reinterpret_cast<T*>(bottom[1]->mutable_gpu_diff<Btype>()) : nullptr);
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(L1LossLayer);
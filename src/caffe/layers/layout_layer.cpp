@@ -0,0 +1,67 @@
+#include <vector>
+
+#include "caffe/layers/layout_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void repack_cpu(int N, int C, int H, int W, Packing from, Packing to,
+    const Dtype* in, Dtype* out) {
+  if (from == to) {
+    caffe_copy(N * C * H * W, in, out);
+    return;
+  }
+  const int S = H * W;
+  for (int n = 0; n < N; ++n) {
+    for (int c = 0; c < C; ++c) {
+      for (int s = 0; s < S; ++s) {
+        const int nchw = (n * C + c) * S + s;
+        const int nhwc = (n * S + s) * C + c;
+        if (to == NHWC) {
+          out[nhwc] = in[nchw];
+        } else {
+          out[nchw] = in[nhwc];
+        }
+      }
+    }
+  }
+}
+
+template <typename Ftype, typename Btype>
+void LayoutLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  CHECK_NE(top[0], bottom[0]) << this->type() << " Layer does not "
+      "allow in-place computation.";
+  CHECK_EQ(4, bottom[0]->num_axes()) << "Layout layers convert 4D blobs";
+  top[0]->ReshapeLike(*bottom[0]);
+  top[0]->set_packing(this->layer_param_.layout_param().packing());
+}
+
+template <typename Ftype, typename Btype>
+void LayoutLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  repack_cpu(bottom[0]->num(), bottom[0]->channels(), bottom[0]->height(),
+      bottom[0]->width(), bottom[0]->packing(), top[0]->packing(),
+      bottom[0]->cpu_data<Ftype>(), top[0]->mutable_cpu_data<Ftype>());
+}
+
+template <typename Ftype, typename Btype>
+void LayoutLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
+    const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  if (!propagate_down[0]) {
+    return;
+  }
+  repack_cpu(bottom[0]->num(), bottom[0]->channels(), bottom[0]->height(),
+      bottom[0]->width(), top[0]->packing(), bottom[0]->packing(),
+      top[0]->cpu_diff<Btype>(), bottom[0]->mutable_cpu_diff<Btype>());
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(LayoutLayer);
+#endif
+
+INSTANTIATE_CLASS_FB(LayoutLayer);
+REGISTER_LAYER_CLASS(Layout);
+
+}  // namespace caffe
@@ -0,0 +1,64 @@
+#include <vector>
+
+#include "caffe/layers/layout_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// One thread per output element, reads are strided on one side either way
+template <typename Dtype>
+__global__ void RepackKernel(const int nthreads, const int C, const int S,
+    const bool to_nhwc, const Dtype* in, Dtype* out) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    if (to_nhwc) {
+      const int c = index % C;
+      const int s = (index / C) % S;
+      const int n = index / C / S;
+      out[index] = in[(n * C + c) * S + s];
+    } else {
+      const int s = index % S;
+      const int c = (index / S) % C;
+      const int n = index / S / C;
+      out[index] = in[(n * S + s) * C + c];
+    }
+  }
+}
+
+template <typename Dtype>
+void repack_gpu(int N, int C, int H, int W, Packing from, Packing to,
+    const Dtype* in, Dtype* out) {
+  const int count = N * C * H * W;
+  cudaStream_t stream = Caffe::thread_stream();
+  if (from == to) {
+    CUDA_CHECK(cudaMemcpyAsync(out, in, count * sizeof(Dtype), cudaMemcpyDeviceToDevice,
+        stream));
+    return;
+  }
+  RepackKernel  // NOLINT_NEXT_LINE(whitespace/operators)
+      <<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      count, C, H * W, to == NHWC, in, out);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template <typename Ftype, typename Btype>
+void LayoutLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  repack_gpu(bottom[0]->num(), bottom[0]->channels(), bottom[0]->height(),
+      bottom[0]->width(), bottom[0]->packing(), top[0]->packing(),
+      bottom[0]->gpu_data<Ftype>(), top[0]->mutable_gpu_data<Ftype>());
+}
+
+template <typename Ftype, typename Btype>
+void LayoutLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
+    const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  if (!propagate_down[0]) {
+    return;
+  }
+  repack_gpu(bottom[0]->num(), bottom[0]->channels(), bottom[0]->height(),
+      bottom[0]->width(), top[0]->packing(), bottom[0]->packing(),
+      top[0]->gpu_diff<Btype>(), bottom[0]->mutable_gpu_diff<Btype>());
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS_FB(LayoutLayer);
+
+}  // namespace caffe
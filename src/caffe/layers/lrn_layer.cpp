@@ -1,6 +1,8 @@
+#include <cmath>
 #include <vector>
 
 #include "caffe/layers/lrn_layer.hpp"
+#include "caffe/util/cpu_parallel.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -130,45 +132,49 @@ void LRNLayer<Ftype, Btype>::CrossChannelForward_cpu(
   const Ftype* bottom_data = bottom[0]->cpu_data<Ftype>();
   Ftype* top_data = top[0]->mutable_cpu_data<Ftype>();
   Ftype* scale_data = scale_.template mutable_cpu_data<Ftype>();
-  // start with the constant value
-  for (int i = 0; i < scale_.count(); ++i) {
-    scale_data[i] = k_;
-  }
-  TBlob<Ftype> padded_square(1, channels_ + size_ - 1, height_, width_);
-  Ftype* padded_square_data = padded_square.mutable_cpu_data();
-  caffe_set(padded_square.count(), Ftype(0), padded_square_data);
-  Ftype alpha_over_size = alpha_ / size_;
-  // go through the images
-  for (int n = 0; n < num_; ++n) {
-    // compute the padded square
-    caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
-        padded_square_data + padded_square.offset(0, pre_pad_));
-    // Create the first channel scale
-    for (int c = 0; c < size_; ++c) {
-      caffe_axpy(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c),
-          scale_data + scale_.offset(n, 0));
+  const Ftype alpha_over_size = alpha_ / size_;
+  const Ftype k = k_;
+  const Ftype neg_beta = -beta_;
+  const int plane = height_ * width_;
+  // Images are independent, each range of them has its own padded squares. Plain loops
+  // rather than BLAS calls so that BLAS threads don't run inside the pool's.
+  CpuParallel::For(num_, 1, [&](int begin, int end) {
+    vector<Ftype> padded_square((channels_ + size_ - 1) * plane, Ftype(0));
+    Ftype* square = padded_square.data() + pre_pad_ * plane;
+    for (int n = begin; n < end; ++n) {
+      const Ftype* bottom_n = bottom_data + bottom[0]->offset(n);
+      Ftype* scale_n = scale_data + scale_.offset(n);
+      Ftype* top_n = top_data + top[0]->offset(n);
+      // compute the padded square
+      for (int i = 0; i < channels_ * plane; ++i) {
+        square[i] = bottom_n[i] * bottom_n[i];
+      }
+      // Create the first channel scale, starting with the constant value
+      for (int i = 0; i < plane; ++i) {
+        scale_n[i] = k;
+      }
+      for (int c = 0; c < size_; ++c) {
+        const Ftype* head = padded_square.data() + c * plane;
+        for (int i = 0; i < plane; ++i) {
+          scale_n[i] += alpha_over_size * head[i];
+        }
+      }
+      for (int c = 1; c < channels_; ++c) {
+        // previous scale, add head, subtract tail
+        const Ftype* prev = scale_n + (c - 1) * plane;
+        const Ftype* head = padded_square.data() + (c + size_ - 1) * plane;
+        const Ftype* tail = padded_square.data() + (c - 1) * plane;
+        Ftype* cur = scale_n + c * plane;
+        for (int i = 0; i < plane; ++i) {
+          cur[i] = prev[i] + alpha_over_size * head[i] - alpha_over_size * tail[i];
+        }
+      }
+      // In the end, compute output
+      for (int i = 0; i < channels_ * plane; ++i) {
+        top_n[i] = bottom_n[i] * static_cast<Ftype>(std::pow(scale_n[i], neg_beta));
+      }
     }
-    for (int c = 1; c < channels_; ++c) {
-      // copy previous scale
-      caffe_copy(height_ * width_,
-          scale_data + scale_.offset(n, c - 1),
-          scale_data + scale_.offset(n, c));
-      // add head
-      caffe_axpy(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
-          scale_data + scale_.offset(n, c));
-      // subtract tail
-      caffe_axpy(height_ * width_, -alpha_over_size,
-          padded_square_data + padded_square.offset(0, c - 1),
-          scale_data + scale_.offset(n, c));
-    }
-  }
-
-  // In the end, compute output
-  caffe_powx(scale_.count(), scale_data, Ftype(-beta_), top_data);
-  caffe_mul(scale_.count(), top_data, bottom_data, top_data);
+  });
 }
 
 template <typename Ftype, typename Btype>
@@ -266,6 +272,22 @@ void LRNLayer<Ftype, Btype>::WithinChannelBackward(
   }
 }
 
+// Sum of squares over the window, then scale, power and product. Backward is about
+// twice that and reads the saved scale and the top data.
+template <typename Ftype, typename Btype>
+void LRNLayer<Ftype, Btype>::Cost(const vector<Blob*>& bottom,
+    const vector<Blob*>& top, LayerCost* cost) const {
+  const bool across = this->layer_param_.lrn_param().norm_region() ==
+      LRNParameter_NormRegion_ACROSS_CHANNELS;
+  const double window = across ? size_ : size_ * size_;
+  const double count = bottom[0]->count();
+  cost->forward_flops = (2. * window + 4.) * count;
+  cost->backward_flops = 2. * cost->forward_flops;
+  const double scale = count * sizeof(Ftype);
+  cost->forward_bytes += scale;
+  cost->backward_bytes += scale + count * tsize(top[0]->data_type());
+}
+
 #ifdef CPU_ONLY
 STUB_GPU(LRNLayer);
 STUB_GPU_FORWARD(LRNLayer, CrossChannelForward);
@@ -96,7 +96,7 @@ void LRNLayer<Ftype, Btype>::CrossChannelForward_gpu(
   LRNComputeOutput<Ftype><<<CAFFE_GET_BLOCKS(n_threads), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
       n_threads, bottom_data, scale_data, -beta_, top[0]->mutable_gpu_data<Ftype>());
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template <typename Ftype, typename Btype>
@@ -186,7 +186,7 @@ void LRNLayer<Ftype, Btype>::CrossChannelBackward_gpu(
       size_, -beta_, 2. * alpha_ * beta_ / size_,
       bottom[0]->mutable_gpu_diff<Btype>());
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 INSTANTIATE_LAYER_GPU_FW_MEMBER_FB(LRNLayer, CrossChannelForward_gpu);
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/mean_ap_layer.hpp"
+
+namespace caffe {
+
+template <typename Ftype, typename Btype>
+void MeanAPLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  CHECK_EQ(3, bottom[0]->num_axes()) << "Layer " << this->name();
+  CHECK_EQ(3, bottom[1]->num_axes()) << "Layer " << this->name();
+  CHECK_EQ(bottom[0]->shape(0), bottom[1]->shape(0)) << "Layer " << this->name()
+      << ": # of images not matching";
+  CHECK_GE(bottom[0]->shape(2), 4) << "Layer " << this->name();
+  CHECK_GE(bottom[1]->shape(2), 4) << "Layer " << this->name();
+  vector<int> top_shape(0);  // Scalars; 0 axes.
+  for (int i = 0; i < top.size(); ++i) {
+    top[i]->Reshape(top_shape);
+  }
+  matched_.Reshape(vector<int>{bottom[1]->shape(0), bottom[1]->shape(1)});
+  counts_.Reshape(vector<int>{bottom[1]->shape(0), 3});
+}
+
+template <typename Ftype, typename Btype>
+void MeanAPLayer<Ftype, Btype>::SetTops(int true_positives, int false_positives,
+    int missed, const vector<Blob*>& top) {
+  const int detections = true_positives + false_positives;
+  const int boxes = true_positives + missed;
+  const float precision = detections == 0 ? 0.F : 100.F * true_positives / detections;
+  const float recall = boxes == 0 ? 0.F : 100.F * true_positives / boxes;
+  top[0]->mutable_cpu_data<Ftype>()[0] = Ftype(precision * recall / 100.F);
+  if (top.size() > 1) {
+    top[1]->mutable_cpu_data<Ftype>()[0] = Ftype(precision);
+  }
+  if (top.size() > 2) {
+    top[2]->mutable_cpu_data<Ftype>()[0] = Ftype(recall);
+  }
+}
+
+namespace {
+
+template <typename Dtype>
+bool IsBox(const Dtype* b) {
+  return b[0] != Dtype(0) || b[1] != Dtype(0) || b[2] != Dtype(0) || b[3] != Dtype(0);
+}
+
+template <typename Dtype>
+float IoU(const Dtype* a, const Dtype* b) {
+  const float ax0 = a[0], ay0 = a[1], ax1 = a[2], ay1 = a[3];
+  const float bx0 = b[0], by0 = b[1], bx1 = b[2], by1 = b[3];
+  const float overlap = std::max(0.F, std::min(ax1, bx1) - std::max(ax0, bx0)) *
+      std::max(0.F, std::min(ay1, by1) - std::max(ay0, by0));
+  if (overlap == 0.F) {
+    return 0.F;
+  }
+  return overlap / ((ax1 - ax0) * (ay1 - ay0) + (bx1 - bx0) * (by1 - by0) - overlap);
+}
+
+}  // namespace
+
+template <typename Ftype, typename Btype>
+void MeanAPLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  const float threshold = this->layer_param_.mean_ap_param().iou_threshold();
+  const int num_truths = bottom[0]->shape(1);
+  const int num_detections = bottom[1]->shape(1);
+  const int truth_dim = bottom[0]->shape(2);
+  const int detection_dim = bottom[1]->shape(2);
+  int true_positives = 0, detections = 0, missed = 0;
+  vector<bool> matched(num_detections);
+  for (int n = 0; n < bottom[0]->shape(0); ++n) {
+    const Ftype* truth = bottom[0]->cpu_data<Ftype>() + n * num_truths * truth_dim;
+    const Ftype* det = bottom[1]->cpu_data<Ftype>() + n * num_detections * detection_dim;
+    std::fill(matched.begin(), matched.end(), false);
+    for (int j = 0; j < num_detections; ++j) {
+      detections += IsBox(det + j * detection_dim);
+    }
+    for (int i = 0; i < num_truths; ++i) {
+      const Ftype* t = truth + i * truth_dim;
+      if (!IsBox(t)) {
+        continue;
+      }
+      bool found = false;
+      for (int j = 0; j < num_detections && !found; ++j) {
+        const Ftype* d = det + j * detection_dim;
+        found = !matched[j] && IsBox(d) && IoU(d, t) >= threshold;
+        matched[j] = matched[j] || found;
+      }
+      true_positives += found;
+      missed += !found;
+    }
+  }
+  SetTops(true_positives, detections - true_positives, missed, top);
+}
+
+#ifdef CPU_ONLY
+STUB_GPU_FORWARD(MeanAPLayer, Forward);
+#endif
+
+INSTANTIATE_CLASS_FB(MeanAPLayer);
+REGISTER_LAYER_CLASS(MeanAP);
+
+}  // namespace caffe
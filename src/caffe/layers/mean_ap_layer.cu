@@ -0,0 +1,132 @@
+#include <vector>
+#include <device_launch_parameters.h>
+
+#include "caffe/layers/mean_ap_layer.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
+
+namespace caffe {
+
+#define MEAN_AP_REDUCE_THREADS 256
+
+template <typename T>
+__device__ __forceinline__ bool IsBoxGPU(const T* b) {
+  return mt_load<float, T>(b[0]) != 0.F || mt_load<float, T>(b[1]) != 0.F ||
+      mt_load<float, T>(b[2]) != 0.F || mt_load<float, T>(b[3]) != 0.F;
+}
+
+template <typename T>
+__device__ __forceinline__ float IoUGPU(const T* a, const T* b) {
+  const float ax0 = mt_load<float, T>(a[0]), ay0 = mt_load<float, T>(a[1]);
+  const float ax1 = mt_load<float, T>(a[2]), ay1 = mt_load<float, T>(a[3]);
+  const float bx0 = mt_load<float, T>(b[0]), by0 = mt_load<float, T>(b[1]);
+  const float bx1 = mt_load<float, T>(b[2]), by1 = mt_load<float, T>(b[3]);
+  const float overlap = fmaxf(0.F, fminf(ax1, bx1) - fmaxf(ax0, bx0)) *
+      fmaxf(0.F, fminf(ay1, by1) - fmaxf(ay0, by0));
+  if (overlap == 0.F) {
+    return 0.F;
+  }
+  return overlap / ((ax1 - ax0) * (ay1 - ay0) + (bx1 - bx0) * (by1 - by0) - overlap);
+}
+
+// One thread per image: greedy matching in ground truth order
+template <typename T>
+__global__ void MeanAPScoreGPU(const int num, const T* truths, const int num_truths,
+    const int truth_dim, const T* detections, const int num_detections,
+    const int detection_dim, const float threshold, int* matched, int* counts) {
+  CUDA_KERNEL_LOOP(n, num) {
+    const T* truth = truths + n * num_truths * truth_dim;
+    const T* det = detections + n * num_detections * detection_dim;
+    int* match = matched + n * num_detections;
+    int boxes = 0;
+    for (int j = 0; j < num_detections; ++j) {
+      match[j] = 0;
+      boxes += IsBoxGPU(det + j * detection_dim);
+    }
+    int true_positives = 0, missed = 0;
+    for (int i = 0; i < num_truths; ++i) {
+      const T* t = truth + i * truth_dim;
+      if (!IsBoxGPU(t)) {
+        continue;
+      }
+      bool found = false;
+      for (int j = 0; j < num_detections && !found; ++j) {
+        const T* d = det + j * detection_dim;
+        found = !match[j] && IsBoxGPU(d) && IoUGPU(d, t) >= threshold;
+        match[j] = match[j] || found;
+      }
+      true_positives += found;
+      missed += !found;
+    }
+    counts[3 * n] = true_positives;
+    counts[3 * n + 1] = boxes - true_positives;
+    counts[3 * n + 2] = missed;
+  }
+}
+
+// Single block: sums the counts and writes the tops present
+template <typename T>
+__global__ void MeanAPReduceGPU(const int num, const int* counts, T* map, T* precision,
+    T* recall) {
+  __shared__ int sums[3][MEAN_AP_REDUCE_THREADS];
+  int tp = 0, fp = 0, fn = 0;
+  for (int n = threadIdx.x; n < num; n += blockDim.x) {
+    tp += counts[3 * n];
+    fp += counts[3 * n + 1];
+    fn += counts[3 * n + 2];
+  }
+  sums[0][threadIdx.x] = tp;
+  sums[1][threadIdx.x] = fp;
+  sums[2][threadIdx.x] = fn;
+  __syncthreads();
+  for (int stride = blockDim.x / 2; stride > 0; stride /= 2) {
+    if (threadIdx.x < stride) {
+      for (int i = 0; i < 3; ++i) {
+        sums[i][threadIdx.x] += sums[i][threadIdx.x + stride];
+      }
+    }
+    __syncthreads();
+  }
+  if (threadIdx.x == 0) {
+    tp = sums[0][0];
+    const int detections = tp + sums[1][0];
+    const int boxes = tp + sums[2][0];
+    const float p = detections == 0 ? 0.F : 100.F * tp / detections;
+    const float r = boxes == 0 ? 0.F : 100.F * tp / boxes;
+    map[0] = mt_store<T, float>(p * r / 100.F);
+    if (precision != nullptr) {
+      precision[0] = mt_store<T, float>(p);
+    }
+    if (recall != nullptr) {
+      recall[0] = mt_store<T, float>(r);
+    }
+  }
+}
+
+template <typename Ftype, typename Btype>
+void MeanAPLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  typedef typename MultiTensorType<Ftype>::type T;
+  const int num = bottom[0]->shape(0);
+  int* counts = counts_.mutable_gpu_data();
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  MeanAPScoreGPU<<<CAFFE_GET_BLOCKS(num), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(num,
+      reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>()), bottom[0]->shape(1),
+      bottom[0]->shape(2), reinterpret_cast<const T*>(bottom[1]->gpu_data<Ftype>()),
+      bottom[1]->shape(1), bottom[1]->shape(2),
+      this->layer_param_.mean_ap_param().iou_threshold(), matched_.mutable_gpu_data(),
+      counts);
+  CUDA_POST_KERNEL_CHECK;
+  T* tops[3] = {nullptr, nullptr, nullptr};
+  for (int i = 0; i < top.size(); ++i) {
+    tops[i] = reinterpret_cast<T*>(top[i]->mutable_gpu_data<Ftype>());
+  }
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  MeanAPReduceGPU<<<1, MEAN_AP_REDUCE_THREADS, 0, stream>>>(num, counts,
+      tops[0], tops[1], tops[2]);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+INSTANTIATE_LAYER_GPU_FORWARD_ONLY_FB(MeanAPLayer);
+
+}  // namespace caffe
@@ -5,6 +5,15 @@
 
 namespace caffe {
 
+template <typename Ftype, typename Btype>
+MemoryDataLayer<Ftype, Btype>::~MemoryDataLayer() {
+#ifndef CPU_ONLY
+  if (ready_ != nullptr) {
+    cudaEventDestroy(ready_);
+  }
+#endif
+}
+
 template <typename Ftype, typename Btype>
 void MemoryDataLayer<Ftype, Btype>::DataLayerSetUp(const vector<Blob*>& bottom,
      const vector<Blob*>& top) {
@@ -88,8 +97,28 @@ void MemoryDataLayer<Ftype, Btype>::Reset(Ftype* data, Ftype* labels, int n) {
   labels_ = labels;
   n_ = n;
   pos_ = 0;
+  gpu_input_ = false;
 }
 
+#ifndef CPU_ONLY
+template <typename Ftype, typename Btype>
+void MemoryDataLayer<Ftype, Btype>::ResetGpu(Ftype* data, Ftype* labels, int n,
+    cudaStream_t stream) {
+  CHECK(data);
+  CHECK(labels);
+  CHECK_EQ(n % batch_size_, 0) << "n must be a multiple of batch size";
+  if (ready_ == nullptr) {
+    CUDA_CHECK(cudaEventCreateWithFlags(&ready_, cudaEventDisableTiming));
+  }
+  CUDA_CHECK(cudaEventRecord(ready_, stream));
+  data_ = data;
+  labels_ = labels;
+  n_ = n;
+  pos_ = 0;
+  gpu_input_ = true;
+}
+#endif
+
 template <typename Ftype, typename Btype>
 void MemoryDataLayer<Ftype, Btype>::set_batch_size(int new_size) {
   CHECK(!has_new_data_) <<
@@ -103,6 +132,7 @@ template <typename Ftype, typename Btype>
 void MemoryDataLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top) {
   CHECK(data_) << "MemoryDataLayer needs to be initalized by calling Reset";
+  CHECK(!gpu_input_) << "Device memory set by ResetGpu can't be used in CPU mode";
   top[0]->Reshape(batch_size_, channels_, height_, width_);
   top[1]->Reshape(batch_size_, 1, 1, 1);
   top[0]->set_cpu_data(data_ + pos_ * size_);
@@ -112,6 +142,28 @@ void MemoryDataLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
     has_new_data_ = false;
 }
 
+template <typename Ftype, typename Btype>
+void MemoryDataLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+      const vector<Blob*>& top) {
+#ifndef CPU_ONLY
+  if (!gpu_input_) {
+    Forward_cpu(bottom, top);
+    return;
+  }
+  top[0]->Reshape(batch_size_, channels_, height_, width_);
+  top[1]->Reshape(batch_size_, 1, 1, 1);
+  // Stream ordered: no host synchronization with the producer
+  CUDA_CHECK(cudaStreamWaitEvent(Caffe::thread_stream(), ready_, 0));
+  top[0]->set_gpu_data(data_ + pos_ * size_);
+  top[1]->set_gpu_data(labels_ + pos_);
+  pos_ = (pos_ + batch_size_) % n_;
+  if (pos_ == 0)
+    has_new_data_ = false;
+#else
+  NO_GPU;
+#endif
+}
+
 INSTANTIATE_CLASS_CPU_FB(MemoryDataLayer);
 
 }  // namespace caffe
@@ -60,6 +60,10 @@ void MultinomialLogisticLossLayer<Ftype, Btype>::Backward_cpu(
   }
 }
 
+#ifdef CPU_ONLY
+STUB_GPU(MultinomialLogisticLossLayer);
+#endif
+
 INSTANTIATE_CLASS_FB(MultinomialLogisticLossLayer);
 REGISTER_LAYER_CLASS(MultinomialLogisticLoss);
 
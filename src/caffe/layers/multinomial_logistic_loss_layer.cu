@@ -0,0 +1,85 @@
+#include <vector>
+
+#include <device_launch_parameters.h>
+
+#include "caffe/layers/multinomial_logistic_loss_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
+
+namespace caffe {
+
+// -log of the label's probability, clipped at min_prob, per sample
+template <typename T>
+__global__ void MultinomialLogisticLossForwardGPU(const int num, const int dim,
+    const T* data, const T* label, const float min_prob, float* loss_terms) {
+  CUDA_KERNEL_LOOP(i, num) {
+    const int label_value = static_cast<int>(mt_load<float, T>(label[i]));
+    loss_terms[i] = -log(max(mt_load<float, T>(data[i * dim + label_value]), min_prob));
+  }
+}
+
+// -loss_weight / (num * p) at the label, 0 elsewhere, loss_weight read from top_diff[0]
+template <typename T, typename A>
+__global__ void MultinomialLogisticLossBackwardGPU(const int count, const int dim,
+    const T* data, const T* label, const T* top_diff, const A inv_num, const A min_prob,
+    T* diff) {
+  const A scale = -mt_load<A, T>(top_diff[0]) * inv_num;
+  CUDA_KERNEL_LOOP(index, count) {
+    A d = A(0);
+    if (index % dim == static_cast<int>(mt_load<float, T>(label[index / dim]))) {
+      d = scale / max(mt_load<A, T>(data[index]), min_prob);
+    }
+    diff[index] = mt_store<T, A>(d);
+  }
+}
+
+template <typename Ftype, typename Btype>
+void MultinomialLogisticLossLayer<Ftype, Btype>::Forward_gpu(
+    const vector<Blob*>& bottom, const vector<Blob*>& top) {
+  typedef typename MultiTensorType<Ftype>::type T;
+  const int num = bottom[0]->num();
+  const int dim = bottom[0]->count() / num;
+  loss_terms_.Reshape(vector<int>(1, num));
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  MultinomialLogisticLossForwardGPU<<<CAFFE_GET_BLOCKS(num), CAFFE_CUDA_NUM_THREADS, 0,
+      stream>>>(num, dim, reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>()),
+      reinterpret_cast<const T*>(bottom[1]->gpu_data<Ftype>()),
+      static_cast<float>(tol<Ftype>(kLOG_THRESHOLD, min_dtype<Ftype>())),
+      loss_terms_.mutable_gpu_data());
+  CUDA_POST_KERNEL_CHECK;
+  caffe_gpu_scaled_sum(num, loss_terms_.gpu_data(), 1.F / num,
+      top[0]->mutable_gpu_data<Ftype>());
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template <typename Ftype, typename Btype>
+void MultinomialLogisticLossLayer<Ftype, Btype>::Backward_gpu(
+    const vector<Blob*>& top, const vector<bool>& propagate_down,
+    const vector<Blob*>& bottom) {
+  if (propagate_down[1]) {
+    LOG(FATAL) << this->type()
+               << " Layer cannot backpropagate to label inputs.";
+  }
+  if (propagate_down[0]) {
+    typedef typename MultiTensorType<Btype>::type T;
+    typedef typename MultiTensorAcc<Btype>::type A;
+    const int num = bottom[0]->num();
+    const int count = bottom[0]->count();
+    cudaStream_t stream = Caffe::thread_stream();
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    MultinomialLogisticLossBackwardGPU<T, A><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS, 0, stream>>>(count, count / num,
+        reinterpret_cast<const T*>(bottom[0]->gpu_data<Btype>()),
+        reinterpret_cast<const T*>(bottom[1]->gpu_data<Btype>()),
+        reinterpret_cast<const T*>(top[0]->gpu_diff<Btype>()), A(1) / A(num),
+        A(static_cast<float>(tol<Btype>(kLOG_THRESHOLD, min_dtype<Btype>()))),
+        reinterpret_cast<T*>(bottom[0]->mutable_gpu_diff<Btype>()));
+    CUDA_POST_KERNEL_CHECK;
+    CUDA_CHECK(caffe_gpu_sync(stream));
+  }
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS_FB(MultinomialLogisticLossLayer);
+
+}  // namespace caffe
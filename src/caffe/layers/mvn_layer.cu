@@ -1,14 +1,71 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layers/mvn_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/welford.cuh"
 
 namespace caffe {
 
+#define MVN_THREADS 256
+
+// One block per row of dim values: mean and variance in one read of the row, then
+// Y = (X - mean) / (sqrt(variance) + eps), or X - mean unless normalize. All of a row
+// is read before it's written, so y may be x.
+template <typename T, typename A>
+__global__ void MVNForwardGPU(const int num, const int dim, const T* x, const A eps,
+    const bool normalize, T* mean, T* std_eps, T* y) {
+  for (int row = blockIdx.x; row < num; row += gridDim.x) {
+    const size_t offset = static_cast<size_t>(row) * dim;
+    Welford<A> w;
+    for (int i = threadIdx.x; i < dim; i += blockDim.x) {
+      w.add(mt_load<A, T>(x[offset + i]));
+    }
+    w = welford_block_reduce<A, MVN_THREADS>(w);
+    const A s = normalize ? sqrt(w.var()) + eps : A(1);
+    if (threadIdx.x == 0) {
+      mean[row] = mt_store<T, A>(w.mean);
+      if (normalize) {
+        std_eps[row] = mt_store<T, A>(s);
+      }
+    }
+    const A k = A(1) / s;
+    for (int i = threadIdx.x; i < dim; i += blockDim.x) {
+      y[offset + i] = mt_store<T, A>((mt_load<A, T>(x[offset + i]) - w.mean) * k);
+    }
+  }
+}
+
+// One block per row: dE/dX = (dE/dY - mean(dE/dY) - mean(dE/dY .* Y) .* Y) / std_eps,
+// or dE/dY - mean(dE/dY) unless normalize. dx may be dy.
+template <typename T, typename A>
+__global__ void MVNBackwardGPU(const int num, const int dim, const T* y, const T* dy,
+    const T* std_eps, const bool normalize, T* dx) {
+  for (int row = blockIdx.x; row < num; row += gridDim.x) {
+    const size_t offset = static_cast<size_t>(row) * dim;
+    A sum_dy = A(0), sum_dy_y = A(0);
+    for (int i = threadIdx.x; i < dim; i += blockDim.x) {
+      const A d = mt_load<A, T>(dy[offset + i]);
+      sum_dy += d;
+      if (normalize) {
+        sum_dy_y += d * mt_load<A, T>(y[offset + i]);
+      }
+    }
+    const A mean_dy = block_sum<A, MVN_THREADS>(sum_dy) / dim;
+    const A mean_dy_y = normalize ? block_sum<A, MVN_THREADS>(sum_dy_y) / dim : A(0);
+    const A k = normalize ? A(1) / mt_load<A, T>(std_eps[row]) : A(1);
+    for (int i = threadIdx.x; i < dim; i += blockDim.x) {
+      const A yv = normalize ? mt_load<A, T>(y[offset + i]) : A(0);
+      dx[offset + i] = mt_store<T, A>((mt_load<A, T>(dy[offset + i]) - mean_dy -
+          mean_dy_y * yv) * k);
+    }
+  }
+}
+
 template<typename Ftype, typename Btype>
 void MVNLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom, const vector<Blob*>& top) {
-  const Ftype* bottom_data = bottom[0]->gpu_data<Ftype>();
-  Ftype* top_data = top[0]->mutable_gpu_data<Ftype>();
+  typedef typename MultiTensorType<Ftype>::type T;
+  typedef typename MultiTensorAcc<Ftype>::type A;
   int num;
   if (this->layer_param_.mvn_param().across_channels())
     num = bottom[0]->num();
@@ -16,49 +73,24 @@ void MVNLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom, const vect
     num = bottom[0]->num() * bottom[0]->channels();
 
   int dim = bottom[0]->count() / num;
-
-  // subtract mean
-  caffe_gpu_gemv<Ftype>(CblasNoTrans, num, dim, Ftype(1. / dim), bottom_data,
-      sum_multiplier_.template gpu_data<Ftype>(), Ftype(0.),
-      mean_.template mutable_gpu_data<Ftype>());  // EX
-  caffe_gpu_gemm<Ftype>(CblasNoTrans, CblasNoTrans, num, dim, 1, Ftype(-1.),
-      mean_.template gpu_data<Ftype>(), sum_multiplier_.template gpu_data<Ftype>(), Ftype(0.),
-      temp_.template mutable_gpu_data<Ftype>());
-  caffe_gpu_add<Ftype>(temp_.count(), bottom_data, temp_.template gpu_data<Ftype>(),
-      top_data);  // X-EX
-
-  if (this->layer_param_.mvn_param().normalize_variance()) {
-    // compute variance using var(X) = E((X-EX)^2)
-    caffe_gpu_powx<Ftype>(bottom[0]->count(), top_data, Ftype(2),
-        temp_.template mutable_gpu_data<Ftype>());  // (X-EX)^2
-    caffe_gpu_gemv<Ftype>(CblasNoTrans, num, dim, Ftype(1. / dim), temp_.template gpu_data<Ftype>(),
-        sum_multiplier_.template gpu_data<Ftype>(), Ftype(0.),
-        variance_.template mutable_gpu_data<Ftype>());  // E((X-EX)^2)
-
-    // normalize variance
-    caffe_gpu_powx<Ftype>(variance_.count(), variance_.template gpu_data<Ftype>(), Ftype(0.5),
-        variance_.template mutable_gpu_data<Ftype>());
-
-    caffe_gpu_add_scalar<Ftype>(variance_.count(), Ftype(eps_),
-        variance_.template mutable_gpu_data<Ftype>());
-
-    caffe_gpu_gemm<Ftype>(CblasNoTrans, CblasNoTrans, num, dim, 1, Ftype(1.),
-        variance_.template gpu_data<Ftype>(), sum_multiplier_.template gpu_data<Ftype>(), Ftype(0.),
-        temp_.template mutable_gpu_data<Ftype>());
-
-    caffe_gpu_div<Ftype>(temp_.count(), top_data, temp_.template gpu_data<Ftype>(), top_data);
-  }
+  const bool normalize = this->layer_param_.mvn_param().normalize_variance();
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  MVNForwardGPU<T, A><<<std::min(num, 65535), MVN_THREADS, 0, stream>>>(num, dim,
+      reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>()), A(eps_), normalize,
+      reinterpret_cast<T*>(mean_.template mutable_gpu_data<Ftype>()),
+      reinterpret_cast<T*>(variance_.template mutable_gpu_data<Ftype>()),
+      reinterpret_cast<T*>(top[0]->mutable_gpu_data<Ftype>()));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<typename Ftype, typename Btype>
 void
 MVNLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top, const vector<bool>& propagate_down,
     const vector<Blob*>& bottom) {
-  const Btype* top_diff = top[0]->gpu_diff<Btype>();
-  const Btype* top_data = top[0]->gpu_data<Btype>();
-  const Btype* bottom_data = bottom[0]->gpu_data<Btype>();
-  Btype* bottom_diff = bottom[0]->mutable_gpu_diff<Btype>();
-
+  typedef typename MultiTensorType<Btype>::type T;
+  typedef typename MultiTensorAcc<Btype>::type A;
   int num;
   if (this->layer_param_.mvn_param().across_channels())
     num = bottom[0]->num();
@@ -66,44 +98,16 @@ MVNLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top, const vector<bool
     num = bottom[0]->num() * bottom[0]->channels();
 
   int dim = bottom[0]->count() / num;
-
-  if (this->layer_param_.mvn_param().normalize_variance()) {
-    caffe_gpu_mul<Btype>(temp_.count(), top_data, top_diff, bottom_diff);
-    caffe_gpu_gemv<Btype>(CblasNoTrans, num, dim, Btype(1.), bottom_diff,
-        sum_multiplier_.template gpu_data<Btype>(), Btype(0.),
-        mean_.template mutable_gpu_data<Btype>());
-    caffe_gpu_gemm<Btype>(CblasNoTrans, CblasNoTrans, num, dim, 1, Btype(1.),
-        mean_.template gpu_data<Btype>(), sum_multiplier_.template gpu_data<Btype>(), Btype(0.),
-        bottom_diff);
-    caffe_gpu_mul<Btype>(temp_.count(), top_data, bottom_diff, bottom_diff);
-
-    caffe_gpu_gemv<Btype>(CblasNoTrans, num, dim, Btype(1.), top_diff,
-        sum_multiplier_.template gpu_data<Btype>(), Btype(0.),
-        mean_.template mutable_gpu_data<Btype>());
-    caffe_gpu_gemm<Btype>(CblasNoTrans, CblasNoTrans, num, dim, 1, Btype(1.),
-        mean_.template gpu_data<Btype>(), sum_multiplier_.template gpu_data<Btype>(), Btype(1.),
-        bottom_diff);
-
-    caffe_gpu_axpby<Btype>(temp_.count(), Btype(1), top_diff, Btype(-1. / dim), bottom_diff);
-
-    // put the squares of bottom into temp_
-    caffe_gpu_powx<Btype>(temp_.count(), bottom_data, Btype(2),
-        temp_.template mutable_gpu_data<Btype>());
-
-    caffe_gpu_gemm<Btype>(CblasNoTrans, CblasNoTrans, num, dim, 1, Btype(1.),
-        variance_.template gpu_data<Btype>(), sum_multiplier_.template gpu_data<Btype>(), Btype(0.),
-        temp_.template mutable_gpu_data<Btype>());
-
-    caffe_gpu_div<Btype>(temp_.count(), bottom_diff, temp_.template gpu_data<Btype>(), bottom_diff);
-  } else {
-    caffe_gpu_gemv<Btype>(CblasNoTrans, num, dim, Btype(1. / dim), top_diff,
-        sum_multiplier_.template gpu_data<Btype>(), Btype(0.),
-        mean_.template mutable_gpu_data<Btype>());
-    caffe_gpu_gemm<Btype>(CblasNoTrans, CblasNoTrans, num, dim, 1, Btype(-1.),
-        mean_.template gpu_data<Btype>(), sum_multiplier_.template gpu_data<Btype>(), Btype(0.),
-        temp_.template mutable_gpu_data<Btype>());
-    caffe_gpu_add<Btype>(temp_.count(), top_diff, temp_.template gpu_data<Btype>(), bottom_diff);
-  }
+  const bool normalize = this->layer_param_.mvn_param().normalize_variance();
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  MVNBackwardGPU<T, A><<<std::min(num, 65535), MVN_THREADS, 0, stream>>>(num, dim,
+      reinterpret_cast<const T*>(top[0]->gpu_data<Btype>()),
+      reinterpret_cast<const T*>(top[0]->gpu_diff<Btype>()),
+      reinterpret_cast<const T*>(variance_.template gpu_data<Btype>()), normalize,
+      reinterpret_cast<T*>(bottom[0]->mutable_gpu_diff<Btype>()));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 
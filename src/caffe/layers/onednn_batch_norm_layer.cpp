@@ -0,0 +1,59 @@
+#ifdef USE_ONEDNN
+#include <vector>
+
+#include "caffe/layers/onednn_batch_norm_layer.hpp"
+
+namespace caffe {
+
+template <typename Ftype, typename Btype>
+void OneDNNBatchNormLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  BatchNormLayer<Ftype, Btype>::LayerSetUp(bottom, top);
+  use_onednn_ = tp<Ftype>() == FLOAT && this->phase_ == TEST && bottom[0]->num_axes() == 4;
+}
+
+template <typename Ftype, typename Btype>
+void OneDNNBatchNormLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  if (!use_onednn_) {
+    BatchNormLayer<Ftype, Btype>::Forward_cpu(bottom, top);
+    return;
+  }
+  const string shapes = onednn::shapes(bottom) + onednn::shapes(top);
+  if (shapes != shapes_) {
+    dnnl::normalization_flags flags = dnnl::normalization_flags::use_global_stats;
+    if (this->scale_bias_) {
+      flags = flags | dnnl::normalization_flags::use_scale |
+          dnnl::normalization_flags::use_shift;
+    }
+    pd_ = dnnl::batch_normalization_forward::primitive_desc(onednn::engine(),
+        dnnl::prop_kind::forward_inference, onednn::desc(*bottom[0]), onednn::desc(*top[0]),
+        static_cast<float>(this->eps_), flags);
+    bn_ = dnnl::batch_normalization_forward(pd_);
+    shapes_ = shapes;
+  }
+  const dnnl::memory::desc channels = onednn::desc(vector<int>{this->channels_},
+      dnnl::memory::data_type::f32, dnnl::memory::format_tag::x);
+  auto blob_memory = [&](int i) {
+    return dnnl::memory(channels, onednn::engine(),
+        const_cast<float*>(this->blobs_[i]->template cpu_data<float>()));
+  };
+  onednn::Args args = {
+      {DNNL_ARG_SRC, dnnl::memory(pd_.src_desc(), onednn::engine(),
+          const_cast<float*>(bottom[0]->cpu_data<float>()))},
+      {DNNL_ARG_MEAN, blob_memory(0)},
+      {DNNL_ARG_VARIANCE, blob_memory(1)}};
+  if (this->scale_bias_) {
+    args[DNNL_ARG_SCALE] = blob_memory(3);
+    args[DNNL_ARG_SHIFT] = blob_memory(4);
+  }
+  // In place when bottom and top are one blob
+  args[DNNL_ARG_DST] = dnnl::memory(pd_.dst_desc(), onednn::engine(),
+      top[0]->mutable_cpu_data<float>());
+  onednn::Execute(bn_, args);
+}
+
+INSTANTIATE_CLASS_FB(OneDNNBatchNormLayer);
+
+}  // namespace caffe
+#endif  // USE_ONEDNN
@@ -0,0 +1,135 @@
+#ifdef USE_ONEDNN
+#include <vector>
+
+#include "caffe/layers/onednn_conv_layer.hpp"
+
+namespace caffe {
+
+using tag = dnnl::memory::format_tag;
+using dt = dnnl::memory::data_type;
+
+template <typename Ftype, typename Btype>
+void OneDNNConvolutionLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  ConvolutionLayer<Ftype, Btype>::LayerSetUp(bottom, top);
+  use_onednn_ = tp<Ftype>() == FLOAT && this->num_spatial_axes_ == 2 &&
+      this->channel_axis_ == 1;
+  if (!use_onednn_) {
+    LOG(INFO) << "Layer " << this->name() << ": oneDNN takes 2D float convolutions, "
+              << "using Caffe's own";
+  }
+  if (this->quantized_) {
+    input_scale_ = this->layer_param_.quantization_param().input_scale();
+    CHECK_GT(input_scale_, 0.F) << "Quantized layer is not calibrated";
+  }
+}
+
+template <typename Ftype, typename Btype>
+void OneDNNConvolutionLayer<Ftype, Btype>::Init(const Blob& bottom, const Blob& top) {
+  const int* kernel = this->kernel_shape_.cpu_data();
+  const int* stride = this->stride_.cpu_data();
+  const int* pad = this->pad_.cpu_data();
+  const int* dilation = this->dilation_.cpu_data();
+  const int groups = this->group_;
+  const int out = this->num_output_;
+  const vector<int> weights_shape = groups == 1 ?
+      vector<int>{out, this->channels_, kernel[0], kernel[1]} :
+      vector<int>{groups, out / groups, this->channels_ / groups, kernel[0], kernel[1]};
+  const dt type = this->quantized_ ? dt::s8 : dt::f32;
+  weights_desc_ = onednn::desc(weights_shape, type, groups == 1 ? tag::oihw : tag::goihw);
+  const dnnl::memory::desc picked_weights = onednn::desc(weights_shape, type, tag::any);
+  src_desc_ = onednn::desc(bottom.shape(), type, bottom.packing() == NHWC ? tag::nhwc :
+      tag::nchw);
+  const dnnl::memory::desc dst_desc = onednn::desc(top);
+  dnnl::memory::dims strides, dilates, padding_l, padding_r;
+  // Both round output sizes down
+  for (int i = 0; i < 2; ++i) {
+    strides.push_back(stride[i]);
+    dilates.push_back(dilation[i] - 1);
+    padding_l.push_back(pad[i]);
+    padding_r.push_back(pad[i]);
+  }
+  dnnl::primitive_attr attr = onednn::math_attr(this->layer_param_);
+  if (this->quantized_) {
+    attr.set_scales_mask(DNNL_ARG_SRC, 0);
+    // A scale per output channel: dimension 0, or 0 and 1 of grouped weights
+    attr.set_scales_mask(DNNL_ARG_WEIGHTS, groups == 1 ? 1 : 3);
+  }
+  const dnnl::prop_kind prop = this->phase_ == TEST ? dnnl::prop_kind::forward_inference :
+      dnnl::prop_kind::forward_training;
+  if (this->bias_term_) {
+    pd_ = dnnl::convolution_forward::primitive_desc(onednn::engine(), prop,
+        dnnl::algorithm::convolution_direct, src_desc_, picked_weights,
+        onednn::desc(vector<int>{out}, dt::f32, tag::x), dst_desc, strides, dilates,
+        padding_l, padding_r, attr);
+  } else {
+    pd_ = dnnl::convolution_forward::primitive_desc(onednn::engine(), prop,
+        dnnl::algorithm::convolution_direct, src_desc_, picked_weights, dst_desc, strides,
+        dilates, padding_l, padding_r, attr);
+  }
+  conv_ = dnnl::convolution_forward(pd_);
+  weights_.Reset();
+  LOG(INFO) << "Layer " << this->name() << ": oneDNN " << pd_.impl_info_str()
+            << " convolution of " << bottom.shape_string();
+}
+
+template <typename Ftype, typename Btype>
+void OneDNNConvolutionLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  if (!use_onednn_) {
+    ConvolutionLayer<Ftype, Btype>::Forward_cpu(bottom, top);
+    return;
+  }
+  const string shapes = onednn::shapes(bottom) + onednn::shapes(top);
+  if (shapes != shapes_) {
+    Init(*bottom[0], *top[0]);
+    shapes_ = shapes;
+  }
+  onednn::Args args;
+  dnnl::memory src_scale, weight_scales;
+  if (this->quantized_) {
+    // Quantized once, as by Int8Gemm
+    if (quantized_weights_.empty()) {
+      quantized_weights_.resize(this->blobs_[0]->count());
+      weight_scales_.resize(this->num_output_);
+      onednn::QuantizeRows(this->num_output_, this->blobs_[0]->count(1),
+          this->blobs_[0]->template cpu_data<float>(), false, quantized_weights_.data(),
+          weight_scales_.data());
+    }
+    args[DNNL_ARG_WEIGHTS] = weights_.Get(weights_desc_, quantized_weights_.data(),
+        pd_.weights_desc(), true);
+    src_scale = dnnl::memory(onednn::desc(vector<int>{1}, dt::f32, tag::x),
+        onednn::engine(), &input_scale_);
+    weight_scales = dnnl::memory(onednn::desc(vector<int>{this->num_output_}, dt::f32,
+        tag::x), onednn::engine(), weight_scales_.data());
+    args[DNNL_ARG_ATTR_SCALES | DNNL_ARG_SRC] = src_scale;
+    args[DNNL_ARG_ATTR_SCALES | DNNL_ARG_WEIGHTS] = weight_scales;
+  } else {
+    args[DNNL_ARG_WEIGHTS] = weights_.Get(weights_desc_,
+        this->blobs_[0]->template cpu_data<float>(), pd_.weights_desc(),
+        this->phase_ == TEST);
+  }
+  if (this->bias_term_) {
+    args[DNNL_ARG_BIAS] = dnnl::memory(pd_.bias_desc(), onednn::engine(),
+        const_cast<float*>(this->blobs_[1]->template cpu_data<float>()));
+  }
+  for (int i = 0; i < bottom.size(); ++i) {
+    const float* bottom_data = bottom[i]->cpu_data<float>();
+    if (this->quantized_) {
+      quantized_src_.resize(bottom[i]->count());
+      onednn::Quantize(bottom[i]->count(), bottom_data, input_scale_, quantized_src_.data());
+      args[DNNL_ARG_SRC] = dnnl::memory(src_desc_, onednn::engine(), quantized_src_.data());
+    } else {
+      args[DNNL_ARG_SRC] = dnnl::memory(src_desc_, onednn::engine(),
+          const_cast<float*>(bottom_data));
+    }
+    args[DNNL_ARG_DST] = dnnl::memory(pd_.dst_desc(), onednn::engine(),
+        top[i]->mutable_cpu_data<float>());
+    onednn::Execute(conv_, args);
+  }
+}
+
+INSTANTIATE_CLASS_FB(OneDNNConvolutionLayer);
+
+}  // namespace caffe
+#endif  // USE_ONEDNN
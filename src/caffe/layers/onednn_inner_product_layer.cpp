@@ -0,0 +1,106 @@
+#ifdef USE_ONEDNN
+#include <vector>
+
+#include "caffe/layers/onednn_inner_product_layer.hpp"
+
+namespace caffe {
+
+using tag = dnnl::memory::format_tag;
+using dt = dnnl::memory::data_type;
+
+template <typename Ftype, typename Btype>
+void OneDNNInnerProductLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  InnerProductLayer<Ftype, Btype>::LayerSetUp(bottom, top);
+  if (this->quantized_) {
+    input_scale_ = this->layer_param_.quantization_param().input_scale();
+    CHECK_GT(input_scale_, 0.F) << "Quantized layer is not calibrated";
+  }
+}
+
+template <typename Ftype, typename Btype>
+void OneDNNInnerProductLayer<Ftype, Btype>::Init() {
+  const int M = this->M_, N = this->N_, K = this->K_;
+  const dt type = this->quantized_ ? dt::s8 : dt::f32;
+  // Quantized weights are written N x K whether transposed or not
+  weights_desc_ = onednn::desc(vector<int>{N, K}, type,
+      this->transpose_ && !this->quantized_ ? tag::io : tag::oi);
+  src_desc_ = onednn::desc(vector<int>{M, K}, type, tag::nc);
+  const dnnl::memory::desc dst_desc = onednn::desc(vector<int>{M, N}, dt::f32, tag::nc);
+  const dnnl::memory::desc picked_weights = onednn::desc(vector<int>{N, K}, type, tag::any);
+  dnnl::primitive_attr attr = onednn::math_attr(this->layer_param_);
+  if (this->quantized_) {
+    attr.set_scales_mask(DNNL_ARG_SRC, 0);
+    attr.set_scales_mask(DNNL_ARG_WEIGHTS, 1);
+  }
+  if (this->activation_ == InnerProductParameter_Activation_RELU) {
+    dnnl::post_ops ops;
+    ops.append_eltwise(dnnl::algorithm::eltwise_relu, 0.F, 0.F);
+    attr.set_post_ops(ops);
+  }
+  const dnnl::prop_kind prop = this->phase_ == TEST ? dnnl::prop_kind::forward_inference :
+      dnnl::prop_kind::forward_training;
+  if (this->bias_term_) {
+    pd_ = dnnl::inner_product_forward::primitive_desc(onednn::engine(), prop, src_desc_,
+        picked_weights, onednn::desc(vector<int>{N}, dt::f32, tag::x), dst_desc, attr);
+  } else {
+    pd_ = dnnl::inner_product_forward::primitive_desc(onednn::engine(), prop, src_desc_,
+        picked_weights, dst_desc, attr);
+  }
+  product_ = dnnl::inner_product_forward(pd_);
+  weights_.Reset();
+  rows_ = M;
+}
+
+template <typename Ftype, typename Btype>
+void OneDNNInnerProductLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  if (tp<Ftype>() != FLOAT) {
+    InnerProductLayer<Ftype, Btype>::Forward_cpu(bottom, top);
+    return;
+  }
+  if (rows_ != this->M_) {
+    Init();
+  }
+  onednn::Args args;
+  const float* bottom_data = bottom[0]->cpu_data<float>();
+  float* top_data = top[0]->mutable_cpu_data<float>();
+  if (this->quantized_) {
+    if (quantized_weights_.empty()) {
+      quantized_weights_.resize(this->blobs_[0]->count());
+      weight_scales_.resize(this->N_);
+      onednn::QuantizeRows(this->N_, this->K_, this->blobs_[0]->template cpu_data<float>(),
+          this->transpose_, quantized_weights_.data(), weight_scales_.data());
+    }
+    args[DNNL_ARG_WEIGHTS] = weights_.Get(weights_desc_, quantized_weights_.data(),
+        pd_.weights_desc(), true);
+    args[DNNL_ARG_ATTR_SCALES | DNNL_ARG_SRC] = dnnl::memory(onednn::desc(vector<int>{1},
+        dt::f32, tag::x), onednn::engine(), &input_scale_);
+    args[DNNL_ARG_ATTR_SCALES | DNNL_ARG_WEIGHTS] = dnnl::memory(
+        onednn::desc(vector<int>{this->N_}, dt::f32, tag::x), onednn::engine(),
+        weight_scales_.data());
+    quantized_src_.resize(bottom[0]->count());
+    onednn::Quantize(bottom[0]->count(), bottom_data, input_scale_, quantized_src_.data());
+    args[DNNL_ARG_SRC] = dnnl::memory(src_desc_, onednn::engine(), quantized_src_.data());
+  } else {
+    args[DNNL_ARG_WEIGHTS] = weights_.Get(weights_desc_,
+        this->blobs_[0]->template cpu_data<float>(), pd_.weights_desc(),
+        this->phase_ == TEST);
+    args[DNNL_ARG_SRC] = dnnl::memory(src_desc_, onednn::engine(),
+        const_cast<float*>(bottom_data));
+  }
+  if (this->bias_term_) {
+    args[DNNL_ARG_BIAS] = dnnl::memory(pd_.bias_desc(), onednn::engine(),
+        const_cast<float*>(this->blobs_[1]->template cpu_data<float>()));
+  }
+  args[DNNL_ARG_DST] = dnnl::memory(pd_.dst_desc(), onednn::engine(), top_data);
+  onednn::Execute(product_, args);
+  if (this->activation_ == InnerProductParameter_Activation_GELU) {
+    this->ActivationForward_cpu(top[0]->mutable_cpu_data<Ftype>());
+  }
+}
+
+INSTANTIATE_CLASS_FB(OneDNNInnerProductLayer);
+
+}  // namespace caffe
+#endif  // USE_ONEDNN
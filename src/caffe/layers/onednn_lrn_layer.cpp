@@ -0,0 +1,42 @@
+#ifdef USE_ONEDNN
+#include <vector>
+
+#include "caffe/layers/onednn_lrn_layer.hpp"
+
+namespace caffe {
+
+template <typename Ftype, typename Btype>
+void OneDNNLRNLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  LRNLayer<Ftype, Btype>::LayerSetUp(bottom, top);
+  use_onednn_ = tp<Ftype>() == FLOAT && this->phase_ == TEST;
+}
+
+template <typename Ftype, typename Btype>
+void OneDNNLRNLayer<Ftype, Btype>::CrossChannelForward_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  if (!use_onednn_) {
+    LRNLayer<Ftype, Btype>::CrossChannelForward_cpu(bottom, top);
+    return;
+  }
+  const string shapes = onednn::shapes(bottom) + onednn::shapes(top);
+  if (shapes != shapes_) {
+    // Both scale alpha by the window size
+    pd_ = dnnl::lrn_forward::primitive_desc(onednn::engine(),
+        dnnl::prop_kind::forward_inference, dnnl::algorithm::lrn_across_channels,
+        onednn::desc(*bottom[0]), onednn::desc(*top[0]), this->size_, this->alpha_,
+        this->beta_, this->k_);
+    lrn_ = dnnl::lrn_forward(pd_);
+    shapes_ = shapes;
+  }
+  onednn::Execute(lrn_, {
+      {DNNL_ARG_SRC, dnnl::memory(pd_.src_desc(), onednn::engine(),
+          const_cast<float*>(bottom[0]->cpu_data<float>()))},
+      {DNNL_ARG_DST, dnnl::memory(pd_.dst_desc(), onednn::engine(),
+          top[0]->mutable_cpu_data<float>())}});
+}
+
+INSTANTIATE_CLASS_FB(OneDNNLRNLayer);
+
+}  // namespace caffe
+#endif  // USE_ONEDNN
@@ -0,0 +1,79 @@
+#ifdef USE_ONEDNN
+#include <vector>
+
+#include "caffe/layers/onednn_pooling_layer.hpp"
+
+namespace caffe {
+
+template <typename Ftype, typename Btype>
+void OneDNNPoolingLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  PoolingLayer<Ftype, Btype>::LayerSetUp(bottom, top);
+  const PoolingParameter_PoolMethod pool = this->layer_param_.pooling_param().pool();
+  use_onednn_ = tp<Ftype>() == FLOAT && this->phase_ == TEST && top.size() == 1 &&
+      (pool == PoolingParameter_PoolMethod_MAX || pool == PoolingParameter_PoolMethod_AVE);
+  fits_ = false;
+}
+
+template <typename Ftype, typename Btype>
+bool OneDNNPoolingLayer<Ftype, Btype>::Init(const Blob& bottom, const Blob& top) {
+  const int kernel[2] = {this->kernel_h_, this->kernel_w_};
+  const int stride[2] = {this->stride_h_, this->stride_w_};
+  const int pad[2] = {this->pad_h_, this->pad_w_};
+  dnnl::memory::dims kernels, strides, dilates, padding_l, padding_r;
+  bool pad_fits = true;
+  for (int i = 0; i < 2; ++i) {
+    kernels.push_back(kernel[i]);
+    strides.push_back(stride[i]);
+    dilates.push_back(0);
+    padding_l.push_back(pad[i]);
+    // Output sizes are rounded up, the last window may run past the padding
+    padding_r.push_back((top.shape(2 + i) - 1) * stride[i] + kernel[i] - bottom.shape(2 + i) -
+        pad[i]);
+    pad_fits = pad_fits && padding_r.back() == pad[i];
+  }
+  dnnl::algorithm algorithm = dnnl::algorithm::pooling_max;
+  if (this->layer_param_.pooling_param().pool() == PoolingParameter_PoolMethod_AVE) {
+    // PoolingLayer counts the padding, not what runs past it
+    if (this->pad_h_ == 0 && this->pad_w_ == 0) {
+      algorithm = dnnl::algorithm::pooling_avg_exclude_padding;
+    } else if (pad_fits) {
+      algorithm = dnnl::algorithm::pooling_avg_include_padding;
+    } else {
+      return false;
+    }
+  }
+  pd_ = dnnl::pooling_forward::primitive_desc(onednn::engine(),
+      dnnl::prop_kind::forward_inference, algorithm, onednn::desc(bottom),
+      onednn::desc(top), strides, kernels, dilates, padding_l, padding_r);
+  pooling_ = dnnl::pooling_forward(pd_);
+  return true;
+}
+
+template <typename Ftype, typename Btype>
+void OneDNNPoolingLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  if (use_onednn_) {
+    const string shapes = onednn::shapes(bottom) + onednn::shapes(top);
+    if (shapes != shapes_) {
+      fits_ = Init(*bottom[0], *top[0]);
+      shapes_ = shapes;
+    }
+  }
+  if (!use_onednn_ || !fits_) {
+    CHECK_EQ(bottom[0]->packing(), NCHW) << "Layer " << this->name()
+        << " can't pool NHWC blobs with oneDNN";
+    PoolingLayer<Ftype, Btype>::Forward_cpu(bottom, top);
+    return;
+  }
+  onednn::Execute(pooling_, {
+      {DNNL_ARG_SRC, dnnl::memory(pd_.src_desc(), onednn::engine(),
+          const_cast<float*>(bottom[0]->cpu_data<float>()))},
+      {DNNL_ARG_DST, dnnl::memory(pd_.dst_desc(), onednn::engine(),
+          top[0]->mutable_cpu_data<float>())}});
+}
+
+INSTANTIATE_CLASS_FB(OneDNNPoolingLayer);
+
+}  // namespace caffe
+#endif  // USE_ONEDNN
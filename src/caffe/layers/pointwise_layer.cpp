@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/filler.hpp"
+#include "caffe/layers/pointwise_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Ftype, typename Btype>
+void PointwiseLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
+      const vector<Blob*>& top) {
+  const PointwiseParameter& param = this->layer_param_.pointwise_param();
+  CHECK_GT(param.op_size(), 0) << "Pointwise layer " << this->name() << " has no ops";
+  const bool init_blobs = this->blobs_.empty();
+  int blob_count = 0;
+  program_.num_ops = 0;
+  op_operand_.clear();
+  op_blob_.clear();
+  op_param_.clear();
+  for (int i = 0; i < param.op_size(); ++i) {
+    const PointwiseParameter::Op& p = param.op(i);
+    const bool scale = p.type() == PointwiseParameter::Op::SCALE;
+    const int ops = scale && p.bias_term() ? 2 : 1;
+    CHECK_LE(program_.num_ops + ops, kMaxPointwiseOps)
+        << "Pointwise layer " << this->name() << " has more than " << kMaxPointwiseOps
+        << " ops";
+    for (int j = 0; j < ops; ++j) {
+      PointwiseOp& op = program_.op[program_.num_ops++];
+      op.type = j == 0 ? p.type() : PointwiseParameter::Op::BIAS;
+      op.coeff = p.coeff();
+      op.operand_coeff = p.operand_coeff();
+      op.alpha = p.alpha();
+      op.power = p.power();
+      op.scale = p.scale();
+      op.shift = p.shift();
+      op.operand_first = p.operand_first();
+      op.dim = op.inner = 1;
+      op.operand = op.blob = nullptr;
+      op.operand_diff = op.blob_diff = nullptr;
+      op_operand_.push_back(0);
+      op_blob_.push_back(-1);
+      op_param_.push_back(i);
+    }
+    switch (p.type()) {
+      case PointwiseParameter::Op::SUM:
+      case PointwiseParameter::Op::PROD:
+      case PointwiseParameter::Op::MAX:
+        CHECK_GT(p.operand(), 0) << "bottom[0] is the chain, not an operand";
+        CHECK_LT(p.operand(), bottom.size()) << "Missing operand of " << p.layer();
+        op_operand_.back() = p.operand();
+        break;
+      case PointwiseParameter::Op::SCALE:
+      case PointwiseParameter::Op::BIAS: {
+        const int axis = bottom[0]->CanonicalAxisIndex(p.axis());
+        CHECK_GE(p.num_axes(), -1) << "num_axes must be non-negative, "
+            << "or -1 to extend to the end of bottom[0]";
+        if (p.num_axes() >= 0) {
+          CHECK_GE(bottom[0]->num_axes(), axis + p.num_axes())
+              << "blob's shape extends past bottom[0]'s shape when applied "
+              << "starting with bottom[0] axis = " << axis;
+        }
+        const vector<int>::const_iterator& shape_start = bottom[0]->shape().begin() + axis;
+        const vector<int>::const_iterator& shape_end = p.num_axes() == -1 ?
+            bottom[0]->shape().end() : (shape_start + p.num_axes());
+        const vector<int> blob_shape(shape_start, shape_end);
+        for (int j = 0; j < ops; ++j) {
+          op_blob_[op_blob_.size() - ops + j] = blob_count++;
+          if (!init_blobs) {
+            continue;
+          }
+          FillerParameter filler_param;
+          if (j == 0 && scale) {
+            filler_param.CopyFrom(p.filler());
+            if (!p.has_filler()) {
+              // Default to unit (1) filler for identity operation.
+              filler_param.set_type("constant");
+              filler_param.set_value(1);
+            }
+          } else {
+            filler_param.CopyFrom(scale ? p.bias_filler() : p.filler());
+          }
+          this->blobs_.push_back(Blob::create<Ftype>(blob_shape));
+          shared_ptr<Filler<Ftype>> filler(GetFiller<Ftype>(filler_param));
+          filler->Fill(this->blobs_.back().get());
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+  if (!init_blobs) {
+    LOG(INFO) << "Skipping parameter initialization";
+  }
+  CHECK_EQ(this->blobs_.size(), blob_count) << "Incorrect number of weight blobs";
+  this->param_propagate_down_.resize(this->blobs_.size(), true);
+}
+
+template <typename Ftype, typename Btype>
+void PointwiseLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
+      const vector<Blob*>& top) {
+  for (int i = 1; i < bottom.size(); ++i) {
+    CHECK(bottom[i]->shape() == bottom[0]->shape())
+        << "Pointwise layer " << this->name() << ": bottom[" << i << "] shape "
+        << bottom[i]->shape_string() << " differs from " << bottom[0]->shape_string();
+  }
+  top[0]->ReshapeLike(*bottom[0]);
+  for (int k = 0; k < program_.num_ops; ++k) {
+    if (op_blob_[k] < 0) {
+      continue;
+    }
+    PointwiseOp& op = program_.op[k];
+    const Blob* blob = this->blobs_[op_blob_[k]].get();
+    // Scalars apply to all, see ScaleLayer::Reshape
+    const int axis = blob->num_axes() == 0 ? 0 : bottom[0]->CanonicalAxisIndex(
+        this->layer_param_.pointwise_param().op(op_param_[k]).axis());
+    CHECK_GE(bottom[0]->num_axes(), axis + blob->num_axes())
+        << "blob " << op_blob_[k] << " extends past bottom[0]'s shape";
+    for (int a = 0; a < blob->num_axes(); ++a) {
+      CHECK_EQ(bottom[0]->shape(axis + a), blob->shape(a))
+          << "dimension mismatch between bottom[0]->shape(" << axis + a
+          << ") and blob " << op_blob_[k] << " shape(" << a << ")";
+    }
+    op.dim = blob->count();
+    op.inner = bottom[0]->count(axis + blob->num_axes());
+  }
+  if (keeps_input(bottom, top)) {
+    input_.ReshapeLike(*bottom[0]);
+  }
+}
+
+template <typename Ftype, typename Btype>
+void PointwiseLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  typedef typename PointwiseMath<Ftype>::type M;
+  const int count = bottom[0]->count();
+  const Ftype* bottom_data = bottom[0]->cpu_data<Ftype>();
+  if (keeps_input(bottom, top)) {
+    caffe_copy(count, bottom_data, input_.mutable_cpu_data());
+  }
+  const PointwiseProgram prog = Program<Ftype>(bottom, false, nullptr);
+  auto load = [](const void* data, int i) {
+    return static_cast<M>(static_cast<const Ftype*>(data)[i]);
+  };
+  Ftype* top_data = top[0]->mutable_cpu_data<Ftype>();
+  M inputs[kMaxPointwiseOps];
+  for (int i = 0; i < count; ++i) {
+    top_data[i] = static_cast<Ftype>(
+        pointwise_forward(prog, i, static_cast<M>(bottom_data[i]), inputs, load));
+  }
+}
+
+template <typename Ftype, typename Btype>
+void PointwiseLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
+    const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  typedef typename PointwiseMath<Btype>::type M;
+  const int count = bottom[0]->count();
+  const Btype* bottom_data = keeps_input(bottom, top) ?
+      input_.template cpu_data<Btype>() : bottom[0]->cpu_data<Btype>();
+  const Btype* top_diff = top[0]->cpu_diff<Btype>();
+  const PointwiseProgram prog = Program<Btype>(bottom, false, &propagate_down);
+  auto load = [](const void* data, int i) {
+    return static_cast<M>(static_cast<const Btype*>(data)[i]);
+  };
+  // Blob diffs accumulate
+  vector<Btype*> blob_diff(prog.num_ops, nullptr);
+  for (int k = 0; k < prog.num_ops; ++k) {
+    if (op_blob_[k] >= 0 && this->param_propagate_down_[op_blob_[k]]) {
+      blob_diff[k] = this->blobs_[op_blob_[k]]->template mutable_cpu_diff<Btype>();
+    }
+  }
+  Btype* bottom_diff = propagate_down[0] ? bottom[0]->mutable_cpu_diff<Btype>() : nullptr;
+  M grads[kMaxPointwiseOps];
+  for (int i = 0; i < count; ++i) {
+    const M g = pointwise_backward(prog, i, static_cast<M>(bottom_data[i]),
+        static_cast<M>(top_diff[i]), grads, load);
+    for (int k = 0; k < prog.num_ops; ++k) {
+      const PointwiseOp& op = prog.op[k];
+      if (op.operand_diff != nullptr) {
+        static_cast<Btype*>(op.operand_diff)[i] = static_cast<Btype>(grads[k]);
+      } else if (blob_diff[k] != nullptr) {
+        Btype& d = blob_diff[k][(i / op.inner) % op.dim];
+        d = static_cast<Btype>(static_cast<M>(d) + grads[k]);
+      }
+    }
+    if (bottom_diff != nullptr) {
+      bottom_diff[i] = static_cast<Btype>(g);
+    }
+  }
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(PointwiseLayer);
+#endif
+
+INSTANTIATE_CLASS_FB(PointwiseLayer);
+REGISTER_LAYER_CLASS(Pointwise);
+
+}  // namespace caffe
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <device_launch_parameters.h>
+
+#include "caffe/layers/pointwise_layer.hpp"
+#include "caffe/util/gpu_math_functions.cuh"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Type the kernels see for Dtype
+template <typename Dtype>
+struct PointwiseDevice {
+  typedef Dtype type;
+};
+
+template <>
+struct PointwiseDevice<float16> {
+  typedef half type;
+};
+
+template <typename T>
+struct PointwiseLoad {
+  __device__ T operator()(const void* data, int i) const {
+    return static_cast<const T*>(data)[i];
+  }
+};
+
+template <>
+struct PointwiseLoad<half> {
+  __device__ float operator()(const void* data, int i) const {
+    return __half2float(static_cast<const half*>(data)[i]);
+  }
+};
+
+__device__ __inline__ void pointwise_store(float v, float* out) {
+  *out = v;
+}
+
+__device__ __inline__ void pointwise_store(double v, double* out) {
+  *out = v;
+}
+
+__device__ __inline__ void pointwise_store(float v, half* out) {
+  *out = float2half_clip(v);
+}
+
+template <typename T>
+__global__ void PointwiseForward(const int start, const int n, const PointwiseProgram prog,
+    const T* in, T* out) {
+  typedef typename PointwiseMath<T>::type M;
+  const PointwiseLoad<T> load;
+  M inputs[kMaxPointwiseOps];
+  CUDA_KERNEL_LOOP(index, n) {
+    const int i = start + index;
+    pointwise_store(pointwise_forward(prog, i, static_cast<M>(load(in, i)), inputs, load),
+        out + i);
+  }
+}
+
+// Two halves at a time, math in float
+__global__ void PointwiseForwardHalf2(const int n2, const PointwiseProgram prog,
+    const half2* in, half2* out) {
+  const PointwiseLoad<half> load;
+  float inputs[kMaxPointwiseOps];
+  CUDA_KERNEL_LOOP(index, n2) {
+    float2 v = __half22float2(in[index]);
+    v.x = pointwise_forward(prog, 2 * index, v.x, inputs, load);
+    v.y = pointwise_forward(prog, 2 * index + 1, v.y, inputs, load);
+    out[index] = float22half2_clip(v);
+  }
+}
+
+template <typename T>
+void pointwise_forward_gpu(const int n, const PointwiseProgram& prog, const T* in, T* out,
+    cudaStream_t stream) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  PointwiseForward<<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      0, n, prog, in, out);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template <>
+void pointwise_forward_gpu<half>(const int n, const PointwiseProgram& prog, const half* in,
+    half* out, cudaStream_t stream) {
+  int start = 0;
+  if (reinterpret_cast<std::uintptr_t>(in) % sizeof(half2) == 0 &&
+      reinterpret_cast<std::uintptr_t>(out) % sizeof(half2) == 0 && n >= 2) {
+    const int n2 = n / 2;
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    PointwiseForwardHalf2<<<CAFFE_GET_BLOCKS(n2), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        n2, prog, reinterpret_cast<const half2*>(in), reinterpret_cast<half2*>(out));
+    CUDA_POST_KERNEL_CHECK;
+    start = 2 * n2;
+  }
+  if (start < n) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    PointwiseForward<<<CAFFE_GET_BLOCKS(n - start), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        start, n - start, prog, in, out);
+    CUDA_POST_KERNEL_CHECK;
+  }
+}
+
+template <typename T>
+__global__ void PointwiseBackward(const int n, const PointwiseProgram prog,
+    const T* in, const T* top_diff, T* bottom_diff) {
+  typedef typename PointwiseMath<T>::type M;
+  const PointwiseLoad<T> load;
+  M grads[kMaxPointwiseOps];
+  CUDA_KERNEL_LOOP(i, n) {
+    const M g = pointwise_backward(prog, i, static_cast<M>(load(in, i)),
+        static_cast<M>(load(top_diff, i)), grads, load);
+    for (int k = 0; k < prog.num_ops; ++k) {
+      const PointwiseOp& op = prog.op[k];
+      if (op.operand_diff != nullptr) {
+        pointwise_store(grads[k], static_cast<T*>(op.operand_diff) + i);
+      } else if (op.blob_diff != nullptr) {
+        pointwise_store(grads[k], static_cast<T*>(op.blob_diff) + i);
+      }
+    }
+    if (bottom_diff != nullptr) {
+      pointwise_store(g, bottom_diff + i);
+    }
+  }
+}
+
+template <typename Ftype, typename Btype>
+void PointwiseLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  typedef typename PointwiseDevice<Ftype>::type T;
+  const int count = bottom[0]->count();
+  const Ftype* bottom_data = bottom[0]->gpu_data<Ftype>();
+  if (keeps_input(bottom, top)) {
+    caffe_copy(count, bottom_data, input_.mutable_gpu_data());
+  }
+  const PointwiseProgram prog = this->template Program<Ftype>(bottom, true, nullptr);
+  Ftype* top_data = top[0]->mutable_gpu_data<Ftype>();
+  cudaStream_t stream = Caffe::thread_stream();
+  pointwise_forward_gpu(count, prog, reinterpret_cast<const T*>(bottom_data),
+      reinterpret_cast<T*>(top_data), stream);
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template <typename Ftype, typename Btype>
+void PointwiseLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
+    const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  typedef typename PointwiseDevice<Btype>::type T;
+  const int count = bottom[0]->count();
+  const Btype* bottom_data = keeps_input(bottom, top) ?
+      input_.template gpu_data<Btype>() : bottom[0]->gpu_data<Btype>();
+  const Btype* top_diff = top[0]->gpu_diff<Btype>();
+  PointwiseProgram prog = this->template Program<Btype>(bottom, true, &propagate_down);
+  // Blob gradients per element first, summed up below
+  blob_grads_.resize(prog.num_ops);
+  for (int k = 0; k < prog.num_ops; ++k) {
+    if (op_blob_[k] >= 0 && this->param_propagate_down_[op_blob_[k]]) {
+      if (!blob_grads_[k]) {
+        blob_grads_[k] = make_shared<TBlob<Btype>>();
+      }
+      blob_grads_[k]->ReshapeLike(*bottom[0]);
+      prog.op[k].blob_diff = blob_grads_[k]->mutable_gpu_data();
+    }
+  }
+  Btype* bottom_diff = propagate_down[0] ? bottom[0]->mutable_gpu_diff<Btype>() : nullptr;
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  PointwiseBackward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      count, prog, reinterpret_cast<const T*>(bottom_data),
+      reinterpret_cast<const T*>(top_diff), reinterpret_cast<T*>(bottom_diff));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+  for (int k = 0; k < prog.num_ops; ++k) {
+    if (prog.op[k].blob_diff == nullptr) {
+      continue;
+    }
+    const int dim = prog.op[k].dim;
+    const int inner = prog.op[k].inner;
+    const int outer = count / (dim * inner);
+    const int multiplier_count = std::max(inner, outer);
+    if (sum_multiplier_.count() < multiplier_count) {
+      sum_multiplier_.Reshape(vector<int>(1, multiplier_count));
+      caffe_gpu_set(sum_multiplier_.count(), Btype(1), sum_multiplier_.mutable_gpu_data());
+    }
+    const Btype* ones = sum_multiplier_.gpu_data();
+    sum_result_.Reshape(vector<int>(1, outer * dim));
+    Btype* sum_result = sum_result_.mutable_gpu_data();
+    caffe_gpu_gemv<Btype>(CblasNoTrans, outer * dim, inner, Btype(1),
+        blob_grads_[k]->gpu_data(), ones, Btype(0), sum_result);
+    // Blob diffs accumulate
+    caffe_gpu_gemv<Btype>(CblasTrans, outer, dim, Btype(1), sum_result, ones, Btype(1),
+        this->blobs_[op_blob_[k]]->template mutable_gpu_diff<Btype>());
+  }
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS_FB(PointwiseLayer);
+
+}  // namespace caffe
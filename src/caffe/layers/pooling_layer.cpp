@@ -3,6 +3,7 @@
 #include <vector>
 
 #include "caffe/layers/pooling_layer.hpp"
+#include "caffe/util/cpu_parallel.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -148,9 +149,13 @@ void PoolingLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
       caffe_set(top_count, -1, mask);
     }
     caffe_set(top_count, -max_dtype<Ftype>(), top_data);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
+    // The main loop, over independent (n, c) planes
+    CpuParallel::For(bottom[0]->num() * channels_, 1, [&](int begin, int end) {
+      for (int plane = begin; plane < end; ++plane) {
+        const Ftype* bottom_plane = bottom_data + plane * bottom[0]->offset(0, 1);
+        Ftype* top_plane = top_data + plane * top[0]->offset(0, 1);
+        Ftype* top_mask_plane = use_top_mask ? top_mask + plane * top[0]->offset(0, 1) : NULL;
+        int* mask_plane = use_top_mask ? NULL : mask + plane * top[0]->offset(0, 1);
         for (int ph = 0; ph < pooled_height_; ++ph) {
           for (int pw = 0; pw < pooled_width_; ++pw) {
             int hstart = ph * stride_h_ - pad_h_;
@@ -163,36 +168,30 @@ void PoolingLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
             for (int h = hstart; h < hend; ++h) {
               for (int w = wstart; w < wend; ++w) {
                 const int index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
+                if (bottom_plane[index] > top_plane[pool_index]) {
+                  top_plane[pool_index] = bottom_plane[index];
                   if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Ftype>(index);
+                    top_mask_plane[pool_index] = static_cast<Ftype>(index);
                   } else {
-                    mask[pool_index] = index;
+                    mask_plane[pool_index] = index;
                   }
                 }
               }
             }
           }
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
       }
-    }
+    });
     break;
   case PoolingParameter_PoolMethod_AVE:
     for (int i = 0; i < top_count; ++i) {
       top_data[i] = 0;
     }
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
+    // The main loop, over independent (n, c) planes
+    CpuParallel::For(bottom[0]->num() * channels_, 1, [&](int begin, int end) {
+      for (int plane = begin; plane < end; ++plane) {
+        const Ftype* bottom_plane = bottom_data + plane * bottom[0]->offset(0, 1);
+        Ftype* top_plane = top_data + plane * top[0]->offset(0, 1);
         for (int ph = 0; ph < pooled_height_; ++ph) {
           for (int pw = 0; pw < pooled_width_; ++pw) {
             int hstart = ph * stride_h_ - pad_h_;
@@ -206,18 +205,15 @@ void PoolingLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
             wend = min(wend, width_);
             for (int h = hstart; h < hend; ++h) {
               for (int w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
+                top_plane[ph * pooled_width_ + pw] +=
+                    bottom_plane[h * width_ + w];
               }
             }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
+            top_plane[ph * pooled_width_ + pw] /= pool_size;
           }
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
       }
-    }
+    });
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
     NOT_IMPLEMENTED;
@@ -308,6 +304,26 @@ void PoolingLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
   }
 }
 
+// Every output visits its window, max pooling routes its diff to one input only
+template <typename Ftype, typename Btype>
+void PoolingLayer<Ftype, Btype>::Cost(const vector<Blob*>& bottom,
+    const vector<Blob*>& top, LayerCost* cost) const {
+  const double outputs = top[0]->count();
+  cost->forward_flops = static_cast<double>(kernel_h_) * kernel_w_ * outputs;
+  cost->backward_flops = is_max_pooling_ ? outputs : cost->forward_flops;
+  if (is_max_pooling_ && top.size() == 1) {
+    // The argmax mask, written forward, read backward and kept in between
+    double mask = sizeof(int) * outputs;
+#ifndef CPU_ONLY
+    if (Caffe::mode() == Caffe::GPU) {
+      mask = max_idx_gpu_bytes() * outputs;
+    }
+#endif
+    cost->forward_bytes += mask;
+    cost->backward_bytes += mask;
+    cost->activation_bytes += static_cast<size_t>(mask);
+  }
+}
 
 #ifdef CPU_ONLY
 STUB_GPU(PoolingLayer);
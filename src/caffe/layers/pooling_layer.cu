@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <cfloat>
+#include <cstdint>
 #include <vector>
 
 #include "caffe/layers/pooling_layer.hpp"
@@ -7,6 +8,9 @@
 
 namespace caffe {
 
+// Masks narrower than int hold the argmax as an offset within the (unclamped) window,
+// the first element of the clamped window if nothing beats the initial value.
+// int masks and top masks hold the index into the bottom plane, or -1.
 template <typename Ftype, typename Itype>
 __global__ void MaxPoolForward(const int nthreads,
     const Ftype* bottom_data, const int num, const int channels,
@@ -14,19 +18,20 @@ __global__ void MaxPoolForward(const int nthreads,
     const int pooled_width, const int kernel_h, const int kernel_w,
     const int stride_h, const int stride_w, const int pad_h, const int pad_w,
     Ftype* top_data, Itype* mask, Ftype* top_mask) {
+  const bool compact = sizeof(Itype) < sizeof(int);
   CUDA_KERNEL_LOOP(index, nthreads) {
     const int pw = index % pooled_width;
     const int ph = (index / pooled_width) % pooled_height;
     const int c = (index / pooled_width / pooled_height) % channels;
     const int n = index / pooled_width / pooled_height / channels;
-    int hstart = ph * stride_h - pad_h;
-    int wstart = pw * stride_w - pad_w;
-    const int hend = min(hstart + kernel_h, height);
-    const int wend = min(wstart + kernel_w, width);
-    hstart = max(hstart, 0);
-    wstart = max(wstart, 0);
+    const int window_h = ph * stride_h - pad_h;
+    const int window_w = pw * stride_w - pad_w;
+    const int hend = min(window_h + kernel_h, height);
+    const int wend = min(window_w + kernel_w, width);
+    const int hstart = max(window_h, 0);
+    const int wstart = max(window_w, 0);
     float maxval = -static_cast<float>(max_dtype<Ftype>());  // TODO Ftype?
-    int maxidx = -1;
+    int maxidx = compact ? hstart * width + wstart : -1;
     const Ftype* const bottom_slice =
         bottom_data + (n * channels + c) * height * width;
     for (int h = hstart; h < hend; ++h) {
@@ -39,7 +44,10 @@ __global__ void MaxPoolForward(const int nthreads,
       }
     }
     top_data[index] = maxval;
-    if (mask) {
+    if (mask && compact) {
+      mask[index] = static_cast<Itype>(
+          (maxidx / width - window_h) * kernel_w + maxidx % width - window_w);
+    } else if (mask) {
       mask[index] = maxidx;
     } else {
       top_mask[index] = maxidx;
@@ -171,14 +179,34 @@ void PoolingLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
     if (use_top_mask) {
       top_mask = top[1]->mutable_gpu_data<Ftype>();
     } else {
-      mask = max_idx_.mutable_gpu_data();
+      max_idx_gpu_.reserve(static_cast<size_t>(count) * max_idx_gpu_bytes());
+    }
+    switch (use_top_mask ? 0 : max_idx_gpu_bytes()) {
+    case 1:
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      MaxPoolForward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+          count, bottom_data, bottom[0]->num(), channels_,
+          height_, width_, pooled_height_, pooled_width_, kernel_h_,
+          kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_, top[0]->mutable_gpu_data<Ftype>(),
+          static_cast<uint8_t*>(max_idx_gpu_.data()), top_mask);
+      break;
+    case 2:
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      MaxPoolForward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+          count, bottom_data, bottom[0]->num(), channels_,
+          height_, width_, pooled_height_, pooled_width_, kernel_h_,
+          kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_, top[0]->mutable_gpu_data<Ftype>(),
+          static_cast<uint16_t*>(max_idx_gpu_.data()), top_mask);
+      break;
+    default:
+      mask = use_top_mask ? NULL : static_cast<int*>(max_idx_gpu_.data());
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      MaxPoolForward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+          count, bottom_data, bottom[0]->num(), channels_,
+          height_, width_, pooled_height_, pooled_width_, kernel_h_,
+          kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_, top[0]->mutable_gpu_data<Ftype>(),
+          mask, top_mask);
     }
-    // NOLINT_NEXT_LINE(whitespace/operators)
-    MaxPoolForward<Ftype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
-        count, bottom_data, bottom[0]->num(), channels_,
-        height_, width_, pooled_height_, pooled_width_, kernel_h_,
-        kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_, top[0]->mutable_gpu_data<Ftype>(),
-        mask, top_mask);
     break;
   case PoolingParameter_PoolMethod_AVE:
     // NOLINT_NEXT_LINE(whitespace/operators)
@@ -212,7 +240,7 @@ void PoolingLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
     LOG(FATAL) << "Unknown pooling method.";
   }
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 
@@ -223,6 +251,7 @@ __global__ void MaxPoolBackward(const int nthreads, const Btype* top_diff,
     const int pooled_height, const int pooled_width, const int kernel_h,
     const int kernel_w, const int stride_h, const int stride_w, const int pad_h,
     const int pad_w, Btype* bottom_diff) {
+  const bool compact = sizeof(Itype) < sizeof(int);
   CUDA_KERNEL_LOOP(index, nthreads) {
     // find out the local index
     // find out the local offset
@@ -240,11 +269,14 @@ __global__ void MaxPoolBackward(const int nthreads, const Btype* top_diff,
     const int offset = (n * channels + c) * pooled_height * pooled_width;
     const Btype* const top_diff_slice = top_diff + offset;
     if (mask) {
-      const int* const mask_slice = mask + offset;
+      const Itype* const mask_slice = mask + offset;
       for (int ph = phstart; ph < phend; ++ph) {
         for (int pw = pwstart; pw < pwend; ++pw) {
           int idx = ph * pooled_width + pw;
-          if (mask_slice[idx] == h * width + w) {
+          // this element's index in the mask's terms
+          const int self = compact ? (h + pad_h - ph * stride_h) * kernel_w +
+              w + pad_w - pw * stride_w : h * width + w;
+          if (static_cast<int>(mask_slice[idx]) == self) {
             gradient += static_cast<float>(top_diff_slice[idx]);
           }
         }
@@ -356,12 +388,26 @@ void PoolingLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
   case PoolingParameter_PoolMethod_MAX:
     if (use_top_mask) {
       top_mask = top[1]->gpu_data<Btype>();
-    } else {
-      mask = max_idx_.gpu_data();
     }
-    {
+    switch (use_top_mask ? 0 : max_idx_gpu_bytes()) {
+    case 1:
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      MaxPoolBackward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+          count, top_diff, static_cast<const uint8_t*>(max_idx_gpu_.data()), top_mask,
+          top[0]->num(), channels_, height_, width_, pooled_height_, pooled_width_,
+          kernel_h_, kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_, bottom_diff);
+      break;
+    case 2:
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      MaxPoolBackward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+          count, top_diff, static_cast<const uint16_t*>(max_idx_gpu_.data()), top_mask,
+          top[0]->num(), channels_, height_, width_, pooled_height_, pooled_width_,
+          kernel_h_, kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_, bottom_diff);
+      break;
+    default:
+      mask = use_top_mask ? NULL : static_cast<const int*>(max_idx_gpu_.data());
       // NOLINT_NEXT_LINE(whitespace/operators)
-      MaxPoolBackward<Btype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      MaxPoolBackward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
           count, top_diff, mask, top_mask, top[0]->num(), channels_,
           height_, width_, pooled_height_, pooled_width_,
           kernel_h_, kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_,
@@ -387,7 +433,7 @@ void PoolingLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     LOG(FATAL) << "Unknown pooling method.";
   }
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(PoolingLayer);
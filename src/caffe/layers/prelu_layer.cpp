@@ -5,6 +5,7 @@
 
 #include "caffe/layers/neuron_layer.hpp"
 #include "caffe/layers/prelu_layer.hpp"
+#include "caffe/util/cpu_parallel.hpp"
 
 namespace caffe {
 
@@ -81,11 +82,13 @@ void PReLULayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
   // if channel_shared, channel index in the following computation becomes
   // always zero.
   const int div_factor = channel_shared_ ? channels : 1;
-  for (int i = 0; i < count; ++i) {
-    int c = (i / dim) % channels / div_factor;
-    top_data[i] = std::max(bottom_data[i], Ftype(0))
-        + slope_data[c] * std::min(bottom_data[i], Ftype(0));
-  }
+  CpuParallel::For(count, CpuParallel::GRAIN, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      int c = (i / dim) % channels / div_factor;
+      top_data[i] = std::max(bottom_data[i], Ftype(0))
+          + slope_data[c] * std::min(bottom_data[i], Ftype(0));
+    }
+  });
 }
 
 template <typename Ftype, typename Btype>
@@ -1,9 +1,12 @@
 #ifdef WITH_PYTHON_LAYER
+#include <string>
+#include <thread>
+
 #include "caffe/layers/python_layer.hpp"
 
 namespace caffe {
 
-void PyErrReportAndForward() {
+std::string PyErrFetchString() {
   PyObject *type_ptr = nullptr, *value_ptr = nullptr, *traceback_ptr = nullptr;
   PyErr_Fetch(&type_ptr, &value_ptr, &traceback_ptr);
   std::string err("Unknown Python error");
@@ -41,11 +44,82 @@ void PyErrReportAndForward() {
       err += std::string(": Unparseable Python traceback");
     }
   }
-  LOG(ERROR) << "Python Error: " << err;
+  return err;
+}
+
+void PyErrReportAndForward() {
+  PyErrForward(PyErrFetchString());
+}
+
+void PyErrForward(const std::string& error) {
+  LOG(ERROR) << "Python Error: " << error;
 //  PyErr_Restore(type_ptr, value_ptr, traceback_ptr);
-  PyErr_SetString(PyExc_RuntimeError, err.c_str());  // TODO support other types?
+  {
+    PyGILAquire gil;
+    PyErr_SetString(PyExc_RuntimeError, error.c_str());  // TODO support other types?
+  }
   bp::throw_error_already_set();
 }
 
+PythonExecutor& PythonExecutor::Get() {
+  // Never destroyed, its thread may outlive Python
+  static PythonExecutor* executor = new PythonExecutor();
+  return *executor;
+}
+
+PythonExecutor::PythonExecutor() {
+  std::thread(&PythonExecutor::Loop, this).detach();
+}
+
+void PythonExecutor::Run(const std::function<void()>& call, std::string* error) {
+  Task task{&call, error, false};
+#if PY_VERSION_HEX >= 0x03040000
+  const bool holds_gil = PyGILState_Check();
+#else
+  const bool holds_gil = true;  // as PYTHON_CALL_BEGIN assumes
+#endif
+  // The executor needs it
+  PyThreadState* state = holds_gil ? PyEval_SaveThread() : nullptr;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    queue_.push_back(&task);
+    queued_.notify_one();
+    done_.wait(lock, [&task]() { return task.done; });
+  }
+  if (state != nullptr) {
+    PyEval_RestoreThread(state);
+  }
+}
+
+void PythonExecutor::Loop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    queued_.wait(lock, [this]() { return !queue_.empty(); });
+    lock.unlock();
+    {
+      // Handed over once per batch of calls rather than once per call
+      PyGILAquire gil;
+      lock.lock();
+      while (!queue_.empty()) {
+        Task* task = queue_.front();
+        queue_.pop_front();
+        lock.unlock();
+        try {
+          (*task->call)();
+        } catch (const bp::error_already_set&) {
+          *task->error = PyErrFetchString();
+        } catch (...) {
+          *task->error = "Unknown exception in a Python call";
+        }
+        lock.lock();
+        task->done = true;
+        done_.notify_all();
+      }
+      lock.unlock();
+    }
+    lock.lock();
+  }
+}
+
 }
 #endif
@@ -1,51 +1,93 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layers/reduction_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/welford.cuh"
 
 namespace caffe {
 
-template <typename Ftype, typename Btype>
-void ReductionLayer<Ftype, Btype>::Forward_gpu(
-    const vector<Blob*>& bottom, const vector<Blob*>& top) {
-  const Ftype* bottom_data = bottom[0]->gpu_data<Ftype>();
-  const Ftype* mult_data = NULL;
-  if (sum_multiplier_.count() > 0) {
-    mult_data = sum_multiplier_.template gpu_data<Ftype>();
+#define REDUCTION_THREADS 256
+
+// One block per row of dim values, all rows in one launch: coeff * reduction of the row
+template <typename T, typename A>
+__global__ void ReductionForwardGPU(const int num, const int dim, const T* x,
+    const ReductionParameter_ReductionOp op, const A coeff, T* y) {
+  for (int row = blockIdx.x; row < num; row += gridDim.x) {
+    const size_t offset = static_cast<size_t>(row) * dim;
+    A sum = A(0);
+    for (int i = threadIdx.x; i < dim; i += blockDim.x) {
+      const A v = mt_load<A, T>(x[offset + i]);
+      switch (op) {
+      case ReductionParameter_ReductionOp_ASUM:
+        sum += abs(v);
+        break;
+      case ReductionParameter_ReductionOp_SUMSQ:
+        sum += v * v;
+        break;
+      default:
+        sum += v;
+      }
+    }
+    sum = block_sum<A, REDUCTION_THREADS>(sum);
+    if (threadIdx.x == 0) {
+      y[row] = mt_store<T, A>(sum * coeff);
+    }
   }
-  Ftype* top_data = top[0]->mutable_cpu_data<Ftype>();
-  for (int i = 0; i < num_; ++i) {
-    switch (op_) {
-    case ReductionParameter_ReductionOp_SUM:
-    case ReductionParameter_ReductionOp_MEAN:
-      caffe_gpu_dot(dim_, mult_data, bottom_data, top_data);
-      break;
-    case ReductionParameter_ReductionOp_ASUM:
-      caffe_gpu_asum(dim_, bottom_data, top_data);
+}
+
+template <typename T, typename A>
+__global__ void ReductionBackwardGPU(const int count, const int dim, const T* x, const T* dy,
+    const ReductionParameter_ReductionOp op, const A coeff, T* dx) {
+  CUDA_KERNEL_LOOP(i, count) {
+    const A d = mt_load<A, T>(dy[i / dim]) * coeff;
+    switch (op) {
+    case ReductionParameter_ReductionOp_ASUM: {
+      const A v = mt_load<A, T>(x[i]);
+      dx[i] = mt_store<T, A>(v > A(0) ? d : v < A(0) ? -d : A(0));
       break;
+    }
     case ReductionParameter_ReductionOp_SUMSQ:
-      caffe_gpu_dot(dim_, bottom_data, bottom_data, top_data);
+      dx[i] = mt_store<T, A>(A(2) * d * mt_load<A, T>(x[i]));
       break;
     default:
-      LOG(FATAL) << "Unknown reduction op: "
-          << ReductionParameter_ReductionOp_Name(op_);
+      dx[i] = mt_store<T, A>(d);
     }
-    bottom_data += dim_;
-    ++top_data;
   }
-  if (coeff_ != 1.F) {
-    // Reset the top_data pointer.
-    top_data = top[0]->mutable_gpu_data<Ftype>();
-    caffe_gpu_scal(num_, Ftype(coeff_), top_data);
+}
+
+template <typename Ftype, typename Btype>
+void ReductionLayer<Ftype, Btype>::Forward_gpu(
+    const vector<Blob*>& bottom, const vector<Blob*>& top) {
+  typedef typename MultiTensorType<Ftype>::type T;
+  typedef typename MultiTensorAcc<Ftype>::type A;
+  switch (op_) {
+  case ReductionParameter_ReductionOp_SUM:
+  case ReductionParameter_ReductionOp_MEAN:
+  case ReductionParameter_ReductionOp_ASUM:
+  case ReductionParameter_ReductionOp_SUMSQ:
+    break;
+  default:
+    LOG(FATAL) << "Unknown reduction op: "
+        << ReductionParameter_ReductionOp_Name(op_);
   }
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  ReductionForwardGPU<T, A><<<std::min(num_, 65535), REDUCTION_THREADS, 0, stream>>>(
+      num_, dim_, reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>()), op_, A(coeff_),
+      reinterpret_cast<T*>(top[0]->mutable_gpu_data<Ftype>()));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template <typename Ftype, typename Btype>
 void ReductionLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
   if (!propagate_down[0]) { return; }
+  typedef typename MultiTensorType<Btype>::type T;
+  typedef typename MultiTensorAcc<Btype>::type A;
   // Get bottom_data, if needed.
-  const Btype* bottom_data = NULL;
+  const T* bottom_data = NULL;
   switch (op_) {
   // Operations that don't need bottom_data
   case ReductionParameter_ReductionOp_SUM:
@@ -54,36 +96,20 @@ void ReductionLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
   // Operations that need bottom_data
   case ReductionParameter_ReductionOp_ASUM:
   case ReductionParameter_ReductionOp_SUMSQ:
-    bottom_data = bottom[0]->gpu_data<Btype>();
+    bottom_data = reinterpret_cast<const T*>(bottom[0]->gpu_data<Btype>());
     break;
   default:
     LOG(FATAL) << "Unknown reduction op: "
         << ReductionParameter_ReductionOp_Name(op_);
   }
-  const Btype* top_diff = top[0]->cpu_diff<Btype>();
-  Btype* bottom_diff = bottom[0]->mutable_gpu_diff<Btype>();
-  for (int i = 0; i < num_; ++i) {
-    const Btype bottom_coeff = (*top_diff) * coeff_;
-    switch (op_) {
-    case ReductionParameter_ReductionOp_SUM:
-    case ReductionParameter_ReductionOp_MEAN:
-      caffe_gpu_set(dim_, bottom_coeff, bottom_diff);
-      break;
-    case ReductionParameter_ReductionOp_ASUM:
-      caffe_gpu_sign(dim_, bottom_data, bottom_diff);
-      caffe_gpu_scal(dim_, bottom_coeff, bottom_diff);
-      break;
-    case ReductionParameter_ReductionOp_SUMSQ:
-      caffe_gpu_scale(dim_, Btype(2. * bottom_coeff), bottom_data, bottom_diff);
-      break;
-    default:
-      LOG(FATAL) << "Unknown reduction op: "
-          << ReductionParameter_ReductionOp_Name(op_);
-    }
-    bottom_data += dim_;
-    bottom_diff += dim_;
-    ++top_diff;
-  }
+  const int count = bottom[0]->count();
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  ReductionBackwardGPU<T, A><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      count, dim_, bottom_data, reinterpret_cast<const T*>(top[0]->gpu_diff<Btype>()), op_,
+      A(coeff_), reinterpret_cast<T*>(bottom[0]->mutable_gpu_diff<Btype>()));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(ReductionLayer);
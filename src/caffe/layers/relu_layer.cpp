@@ -2,6 +2,7 @@
 #include <vector>
 
 #include "caffe/layers/relu_layer.hpp"
+#include "caffe/util/cpu_parallel.hpp"
 
 namespace caffe {
 
@@ -12,10 +13,12 @@ void ReLULayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
   Ftype* top_data = top[0]->mutable_cpu_data<Ftype>();
   const int count = bottom[0]->count();
   float negative_slope = this->layer_param_.relu_param().negative_slope();
-  for (int i = 0; i < count; ++i) {
-    top_data[i] = std::max(bottom_data[i], Ftype(0))
-        + negative_slope * std::min(bottom_data[i], Ftype(0));
-  }
+  CpuParallel::For(count, CpuParallel::GRAIN, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      top_data[i] = std::max(bottom_data[i], Ftype(0))
+          + negative_slope * std::min(bottom_data[i], Ftype(0));
+    }
+  });
 }
 
 template <typename Ftype, typename Btype>
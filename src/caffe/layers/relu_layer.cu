@@ -25,7 +25,7 @@ void ReLULayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
   ReLUForward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, Caffe::thread_stream()>>>(
       count, bottom_data, top_data, negative_slope);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template <typename Dtype>
@@ -51,7 +51,7 @@ void ReLULayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     ReLUBackward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, Caffe::thread_stream()>>>(
         count, top_diff, bottom_data, bottom_diff, negative_slope);
     CUDA_POST_KERNEL_CHECK;
-    CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+    CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
   }
 }
 
@@ -0,0 +1,91 @@
+#include <vector>
+
+#include "caffe/layers/remote_data_layer.hpp"
+
+namespace caffe {
+
+template<typename Ftype, typename Btype>
+RemoteDataLayer<Ftype, Btype>::RemoteDataLayer(const LayerParameter& param)
+    : BaseDataLayer<Ftype, Btype>(param, 1UL),
+      InternalThread(Caffe::current_device(), this->solver_rank_, 1U, false),
+      stopping_(false) {}
+
+template<typename Ftype, typename Btype>
+RemoteDataLayer<Ftype, Btype>::~RemoteDataLayer() {
+  stopping_ = true;
+  if (client_) {
+    client_->Shutdown();
+  }
+  StopInternalThread();
+}
+
+template<typename Ftype, typename Btype>
+void RemoteDataLayer<Ftype, Btype>::DataLayerSetUp(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  const RemoteDataParameter& remote_param = this->layer_param_.remote_data_param();
+  CHECK(!remote_param.server().empty()) << this->name() << ": remote_data_param.server is "
+      "not set";
+  CHECK_GT(remote_param.queue_depth(), 0U);
+  // The worker sets up the Data layer this one stands for
+  LayerParameter param(this->layer_param_);
+  param.set_type("Data");
+  param.clear_remote_data_param();
+  param.set_forward_type(tp<Ftype>());
+  param.set_forward_math(tp<Ftype>());
+  client_.reset(new DataServiceClient(remote_param.server(),
+      remote_param.connect_timeout_sec()));
+  client_->Request(param, this->solver_rank_, Caffe::solver_count());
+  for (size_t i = 0; i < remote_param.queue_depth(); ++i) {
+    shared_ptr<Tops> tops = make_shared<Tops>();
+    for (int j = 0; j < top.size(); ++j) {
+      tops->blobs.push_back(Blob::create<Ftype>());
+    }
+    free_.push(tops);
+  }
+  // First batch shapes the tops
+  shared_ptr<Tops> first = free_.pop();
+  CHECK(client_->Receive(first->blobs)) << "Data service " << remote_param.server()
+      << " closed the stream";
+  for (int j = 0; j < top.size(); ++j) {
+    top[j]->Reshape(first->blobs[j]->shape());
+  }
+  full_.push(first);
+  LOG_IF(INFO, Caffe::root_solver()) << this->print_current_device() << " " << this->name()
+      << ": receiving batches of " << top[0]->shape_string() << " from data service "
+      << remote_param.server();
+  this->rank_ = this->solver_rank_;
+  StartInternalThread(false, Caffe::next_seed());
+}
+
+template<typename Ftype, typename Btype>
+void RemoteDataLayer<Ftype, Btype>::InternalThreadEntry() {
+  while (!must_stop(0)) {
+    shared_ptr<Tops> tops = free_.pop();
+    if (!client_->Receive(tops->blobs)) {
+      LOG_IF(FATAL, !stopping_) << this->name() << ": data service "
+          << this->layer_param_.remote_data_param().server() << " closed the stream";
+      return;
+    }
+    full_.push(tops);
+  }
+}
+
+template<typename Ftype, typename Btype>
+void RemoteDataLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  shared_ptr<Tops> tops = full_.pop("Waiting for data service");
+  for (int j = 0; j < top.size(); ++j) {
+    Blob* blob = tops->blobs[j].get();
+    if (top[j]->data_type() == blob->data_type() && top[j]->shape() == blob->shape()) {
+      top[j]->Swap(*blob);
+    } else {
+      top[j]->CopyDataFrom(*blob, true);
+    }
+  }
+  free_.push(tops);
+}
+
+INSTANTIATE_CLASS_FB(RemoteDataLayer);
+REGISTER_LAYER_CLASS(RemoteData);
+
+}  // namespace caffe
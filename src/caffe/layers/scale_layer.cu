@@ -53,7 +53,7 @@ void ScaleLayer<Ftype, Btype>::Forward_gpu(
         <<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
         count, bottom_data, scale_data, scale_dim_, inner_dim_, top_data);
   }
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template <typename Ftype, typename Btype>
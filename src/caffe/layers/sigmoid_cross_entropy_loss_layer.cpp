@@ -68,7 +68,7 @@ void SigmoidCrossEntropyLossLayer<Ftype, Btype>::Backward_cpu(
 }
 
 #ifdef CPU_ONLY
-STUB_GPU_BACKWARD(SigmoidCrossEntropyLossLayer, Backward);
+STUB_GPU(SigmoidCrossEntropyLossLayer);
 #endif
 
 INSTANTIATE_CLASS_FB(SigmoidCrossEntropyLossLayer);
@@ -1,10 +1,55 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layers/sigmoid_cross_entropy_loss_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/welford.cuh"
 
 namespace caffe {
 
+// Partial sums of the stable cross-entropy of the scores, one per block
+template <typename T, typename A>
+__global__ void SigmoidCrossEntropyLossForwardGPU(const int count, const T* input,
+    const T* target, float* partials) {
+  A sum = A(0);
+  for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < count; i += blockDim.x * gridDim.x) {
+    const A x = mt_load<A, T>(input[i]);
+    const A pos = x >= A(0) ? A(1) : A(0);
+    sum -= x * (mt_load<A, T>(target[i]) - pos) - log(A(1) + exp(x - A(2) * x * pos));
+  }
+  sum = block_sum<A, CAFFE_CUDA_NUM_THREADS>(sum);
+  if (threadIdx.x == 0) {
+    partials[blockIdx.x] = static_cast<float>(sum);
+  }
+}
+
+// diff = scale * (sigmoid(x) - target)
+template <typename T, typename A>
+__global__ void SigmoidCrossEntropyLossBackwardGPU(const int count, const T* input,
+    const T* target, const A scale, T* diff) {
+  CUDA_KERNEL_LOOP(i, count) {
+    const A p = A(1) / (A(1) + exp(-mt_load<A, T>(input[i])));
+    diff[i] = mt_store<T, A>((p - mt_load<A, T>(target[i])) * scale);
+  }
+}
+
+template <typename Ftype, typename Btype>
+void SigmoidCrossEntropyLossLayer<Ftype, Btype>::Forward_gpu(
+    const vector<Blob*>& bottom, const vector<Blob*>& top) {
+  typedef typename MultiTensorType<Ftype>::type T;
+  typedef typename MultiTensorAcc<Ftype>::type A;
+  const int count = bottom[0]->count();
+  const int blocks = std::min(CAFFE_GET_BLOCKS(count), kLOSS_BLOCKS);
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  SigmoidCrossEntropyLossForwardGPU<T, A><<<blocks, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      count, reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>()),
+      reinterpret_cast<const T*>(bottom[1]->gpu_data<Ftype>()), this->loss_partials(blocks));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+  top[0]->mutable_cpu_data<Ftype>()[0] = this->loss_partials_sum() / bottom[0]->num();
+}
+
 template <typename Ftype, typename Btype>
 void SigmoidCrossEntropyLossLayer<Ftype, Btype>::Backward_gpu(
     const vector<Blob*>& top, const vector<bool>& propagate_down,
@@ -14,20 +59,23 @@ void SigmoidCrossEntropyLossLayer<Ftype, Btype>::Backward_gpu(
                << " Layer cannot backpropagate to label inputs.";
   }
   if (propagate_down[0]) {
-    // First, compute the diff
+    typedef typename MultiTensorType<Btype>::type T;
+    typedef typename MultiTensorAcc<Btype>::type A;
     const int count = bottom[0]->count();
     const int num = bottom[0]->num();
-    const Btype* sigmoid_output_data = sigmoid_output_->gpu_data();
-    const Btype* target = bottom[1]->gpu_data<Btype>();
-    Btype* bottom_diff = bottom[0]->mutable_gpu_diff<Btype>();
-    caffe_copy(count, sigmoid_output_data, bottom_diff);
-    caffe_gpu_axpy(count, Btype(-1), target, bottom_diff);
-    // Scale down gradient
-    const Btype loss_weight = top[0]->cpu_diff<Btype>()[0];
-    caffe_gpu_scal(count, Btype(loss_weight / num), bottom_diff);
+    const float loss_weight = top[0]->cpu_diff<Btype>()[0];
+    cudaStream_t stream = Caffe::thread_stream();
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    SigmoidCrossEntropyLossBackwardGPU<T, A><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS, 0, stream>>>(count,
+        reinterpret_cast<const T*>(bottom[0]->gpu_data<Btype>()),
+        reinterpret_cast<const T*>(bottom[1]->gpu_data<Btype>()), A(loss_weight / num),
+        reinterpret_cast<T*>(bottom[0]->mutable_gpu_diff<Btype>()));
+    CUDA_POST_KERNEL_CHECK;
+    CUDA_CHECK(caffe_gpu_sync(stream));
   }
 }
 
-INSTANTIATE_LAYER_GPU_BACKWARD_ONLY_FB(SigmoidCrossEntropyLossLayer);
+INSTANTIATE_LAYER_GPU_FUNCS_FB(SigmoidCrossEntropyLossLayer);
 
 }  // namespace caffe
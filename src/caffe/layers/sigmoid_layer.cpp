@@ -2,6 +2,7 @@
 #include <vector>
 
 #include "caffe/layers/sigmoid_layer.hpp"
+#include "caffe/util/cpu_parallel.hpp"
 
 namespace caffe {
 
@@ -16,9 +17,11 @@ void SigmoidLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
   const Ftype* bottom_data = bottom[0]->cpu_data<Ftype>();
   Ftype* top_data = top[0]->mutable_cpu_data<Ftype>();
   const int count = bottom[0]->count();
-  for (int i = 0; i < count; ++i) {
-    top_data[i] = sigmoid(bottom_data[i]);
-  }
+  CpuParallel::For(count, CpuParallel::GRAIN, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      top_data[i] = sigmoid(bottom_data[i]);
+    }
+  });
 }
 
 template <typename Ftype, typename Btype>
@@ -2,6 +2,7 @@
 #include <vector>
 
 #include "caffe/layers/slice_layer.hpp"
+#include "caffe/util/blob_views.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -34,6 +35,17 @@ void SliceLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
   } else {
     slice_axis_ = bottom[0]->CanonicalAxisIndex(slice_param.axis());
   }
+  if ((data_views_ || diff_views_) && bottom[0]->shape() != views_shape_) {
+    // The bottom's memory may have moved, tops get their own
+    const bool gpu = Caffe::mode() == Caffe::GPU;
+    if (data_views_) {
+      unbind_views(bottom[0], top, true, false, gpu);
+    }
+    if (diff_views_) {
+      unbind_views(bottom[0], top, false, false, gpu);
+    }
+    data_views_ = diff_views_ = false;
+  }
   vector<int> top_shape = bottom[0]->shape();
   const int bottom_slice_axis = bottom[0]->shape(slice_axis_);
   num_slices_ = bottom[0]->count(0, slice_axis_);
@@ -72,10 +84,56 @@ void SliceLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
   }
 }
 
+template <typename Ftype, typename Btype>
+bool SliceLayer<Ftype, Btype>::ForwardViews(const vector<Blob*>& bottom,
+      const vector<Blob*>& top) {
+  if (!data_views_) {
+    return false;
+  }
+  const bool gpu = Caffe::mode() == Caffe::GPU;
+  if (!views_bound(bottom[0], top, true, gpu)) {
+    unbind_views(bottom[0], top, true, false, gpu);
+    data_views_ = false;
+    return false;
+  }
+  for (int i = 0; i < top.size(); ++i) {
+    top[i]->current_mutable_data_memory(gpu);
+  }
+  return true;
+}
+
+template <typename Ftype, typename Btype>
+bool SliceLayer<Ftype, Btype>::BackwardViews(const vector<Blob*>& top,
+      const vector<Blob*>& bottom) {
+  const bool gpu = Caffe::mode() == Caffe::GPU;
+  if (!diff_views_ || !views_bound(bottom[0], top, false, gpu)) {
+    return false;
+  }
+  bottom[0]->current_mutable_diff_memory(gpu);
+  return true;
+}
+
+template <typename Ftype, typename Btype>
+void SliceLayer<Ftype, Btype>::BindViews(const vector<Blob*>& bottom,
+      const vector<Blob*>& top, bool data) {
+  if (!share_storage_ || num_slices_ != 1) {
+    return;
+  }
+  const bool gpu = Caffe::mode() == Caffe::GPU;
+  bool& views = data ? data_views_ : diff_views_;
+  const bool bound = bind_views(bottom[0], top, data, gpu);
+  if (views && !bound) {
+    // Parts still in the shared memory must not outlive it
+    unbind_views(bottom[0], top, data, true, gpu);
+  }
+  views = bound;
+  views_shape_ = bottom[0]->shape();
+}
+
 template <typename Ftype, typename Btype>
 void SliceLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
       const vector<Blob*>& top) {
-  if (top.size() == 1) { return; }
+  if (top.size() == 1 || ForwardViews(bottom, top)) { return; }
   int offset_slice_axis = 0;
   const Ftype* bottom_data = bottom[0]->cpu_data<Ftype>();
   const int bottom_slice_axis = bottom[0]->shape(slice_axis_);
@@ -91,12 +149,13 @@ void SliceLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
     }
     offset_slice_axis += top_slice_axis;
   }
+  BindViews(bottom, top, true);
 }
 
 template <typename Ftype, typename Btype>
 void SliceLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
       const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
-  if (!propagate_down[0] || top.size() == 1) { return; }
+  if (!propagate_down[0] || top.size() == 1 || BackwardViews(top, bottom)) { return; }
   int offset_slice_axis = 0;
   Btype* bottom_diff = bottom[0]->mutable_cpu_diff<Btype>();
   const int bottom_slice_axis = bottom[0]->shape(slice_axis_);
@@ -112,6 +171,7 @@ void SliceLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
     }
     offset_slice_axis += top_slice_axis;
   }
+  BindViews(bottom, top, false);
 }
 
 #ifdef CPU_ONLY
@@ -2,6 +2,7 @@
 #include <device_launch_parameters.h>
 
 #include "caffe/layers/softmax_layer.hpp"
+#include "caffe/util/warp_softmax.cuh"
 
 namespace caffe {
 
@@ -82,11 +83,18 @@ __global__ void kernel_channel_dot(const int num, const int channels,
 template <typename Ftype, typename Btype>
 void SoftmaxLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
     const vector<Blob*>& top) {
+  typedef typename MultiTensorType<Ftype>::type T;
+  typedef typename MultiTensorAcc<Ftype>::type A;
   const Ftype* bottom_data = bottom[0]->gpu_data<Ftype>();
   Ftype* top_data = top[0]->mutable_gpu_data<Ftype>();
+  int channels = top[0]->shape(softmax_axis_);
+  // Contiguous rows short enough for registers: one row per warp or group of lanes
+  if (inner_num_ == 1 && warp_softmax_forward<T, A>(outer_num_, channels,
+      reinterpret_cast<const T*>(bottom_data), reinterpret_cast<T*>(top_data))) {
+    return;
+  }
   Ftype* scale_data = scale_.template mutable_gpu_data<Ftype>();
   int count = bottom[0]->count();
-  int channels = top[0]->shape(softmax_axis_);
   caffe_copy(count, bottom_data, top_data);
   cudaStream_t stream = Caffe::thread_stream();
   // We need to subtract the max to avoid numerical issues, compute the exp,
@@ -115,18 +123,25 @@ void SoftmaxLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
   kernel_channel_div<<<CAFFE_GET_BLOCKS(count),
       CAFFE_CUDA_NUM_THREADS, 0, stream>>>(count, outer_num_, channels, inner_num_,
       scale_data, top_data);
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template <typename Ftype, typename Btype>
 void SoftmaxLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     const vector<bool>& propagate_down, const vector<Blob*>& bottom) {
+  typedef typename MultiTensorType<Btype>::type T;
+  typedef typename MultiTensorAcc<Btype>::type A;
   const Btype* top_diff = top[0]->gpu_diff<Btype>();
   const Btype* top_data = top[0]->gpu_data<Btype>();
   Btype* bottom_diff = bottom[0]->mutable_gpu_diff<Btype>();
+  int channels = top[0]->shape(softmax_axis_);
+  if (inner_num_ == 1 && warp_softmax_backward<T, A>(outer_num_, channels,
+      reinterpret_cast<const T*>(top_data), reinterpret_cast<const T*>(top_diff),
+      reinterpret_cast<T*>(bottom_diff))) {
+    return;
+  }
   Btype* scale_data = scale_.template mutable_gpu_data<Btype>();
   int count = top[0]->count();
-  int channels = top[0]->shape(softmax_axis_);
   caffe_copy(count, top_diff, bottom_diff);
   cudaStream_t stream = Caffe::thread_stream();
   // Compute inner1d(top_diff, top_data) and subtract them from the bottom diff.
@@ -138,7 +153,7 @@ void SoftmaxLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
   kernel_channel_subtract<<<CAFFE_GET_BLOCKS(count),
       CAFFE_CUDA_NUM_THREADS, 0, stream>>>(count, outer_num_, channels, inner_num_,
       scale_data, bottom_diff);
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
   // elementwise multiplication
   caffe_gpu_mul(top[0]->count(), bottom_diff, top_data, bottom_diff);
 }
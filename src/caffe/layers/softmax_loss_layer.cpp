@@ -59,6 +59,8 @@ void SoftmaxWithLossLayer<Ftype, Btype>::Reshape(
     // softmax output
     top[1]->ReshapeLike(*bottom[0]);
   }
+  row_buffer_.Reshape(vector<int>(1, outer_num_ * inner_num_));
+  row_counts_.Reshape(vector<int>(1, outer_num_ * inner_num_));
 }
 
 template <typename Ftype, typename Btype>
@@ -97,13 +99,13 @@ void SoftmaxWithLossLayer<Ftype, Btype>::Forward_cpu(
   // The forward pass computes the softmax prob values.
   softmax_layer_->Forward(softmax_bottom_vec_, softmax_top_vec_);
   const Ftype* prob_data = prob_->template cpu_data<Ftype>();
-  const Ftype* label = bottom[1]->cpu_data<Ftype>();
+  const LabelReader<Ftype> label(*bottom[1]);
   int dim = prob_->count() / outer_num_;
   int count = 0;
   float loss = 0.F;
   for (int i = 0; i < outer_num_; ++i) {
     for (int j = 0; j < inner_num_; j++) {
-      const int label_value = static_cast<int>(label[i * inner_num_ + j]);
+      const int label_value = label[i * inner_num_ + j];
       if (has_ignore_label_ && label_value == ignore_label_) {
         continue;
       }
@@ -130,12 +132,12 @@ void SoftmaxWithLossLayer<Ftype, Btype>::Backward_cpu(const vector<Blob*>& top,
     Btype* bottom_diff = bottom[0]->mutable_cpu_diff<Btype>();
     const Btype* prob_data = prob_->template cpu_data<Btype>();
     caffe_copy(prob_->count(), prob_data, bottom_diff);
-    const Btype* label = bottom[1]->cpu_data<Btype>();
+    const LabelReader<Btype> label(*bottom[1]);
     int dim = prob_->count() / outer_num_;
     int count = 0;
     for (int i = 0; i < outer_num_; ++i) {
       for (int j = 0; j < inner_num_; ++j) {
-        const int label_value = static_cast<int>(label[i * inner_num_ + j]);
+        const int label_value = label[i * inner_num_ + j];
         if (has_ignore_label_ && label_value == ignore_label_) {
           for (int c = 0; c < bottom[0]->shape(softmax_axis_); ++c) {
             bottom_diff[i * dim + c * inner_num_ + j] = 0.F;
@@ -1,8 +1,11 @@
 #include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <device_launch_parameters.h>
 
 #include "caffe/layers/softmax_loss_layer.hpp"
 #include "caffe/util/gpu_math_functions.cuh"
+#include "caffe/util/multi_tensor_apply.cuh"
 #include "caffe/net.hpp"
 
 namespace caffe {
@@ -50,9 +53,153 @@ __global__ void SoftmaxLossForwardGPU<half>(const int nthreads,
   }
 }
 
+#define SOFTMAX_LOSS_ROW_THREADS 256
+
+// Online log-sum-exp: m is the running maximum and sum the sum of exp(x - m)
+template <typename A>
+__device__ __forceinline__ void lse_add(A x, A& m, A& sum) {
+  if (x > m) {
+    sum = sum * exp(m - x) + A(1);
+    m = x;
+  } else {
+    sum += exp(x - m);
+  }
+}
+
+template <typename A>
+__device__ __forceinline__ void lse_merge(A m2, A sum2, A& m, A& sum) {
+  const A mx = max(m, m2);
+  sum = sum * exp(m - mx) + sum2 * exp(m2 - mx);
+  m = mx;
+}
+
+// x points at the row's first class, loss is -log(p) clipped as min_dtype clips p.
+// Labels L are of the data type T or INT, see DataParameter::label_type.
+template <typename T, typename A, typename L>
+__device__ __forceinline__ void lse_row_loss(int row, const T* x, int inner_num, A m, A sum,
+    const L* label, bool has_ignore_label, int ignore_label, float max_loss, float* lse,
+    float* loss, float* counts) {
+  const A row_lse = m + log(sum);
+  lse[row] = static_cast<float>(row_lse);
+  const int label_value = static_cast<int>(mt_load<float, L>(label[row]));
+  if (has_ignore_label && label_value == ignore_label) {
+    loss[row] = 0.F;
+    counts[row] = 0.F;
+  } else {
+    const float l = static_cast<float>(row_lse - mt_load<A, T>(x[label_value * inner_num]));
+    loss[row] = min(l, max_loss);
+    counts[row] = 1.F;
+  }
+}
+
+// One thread per row, classes inner_num apart: adjacent threads read adjacent values
+template <typename T, typename A, typename L>
+__global__ void SoftmaxLossFusedForwardGPU(const int rows, const T* data, const L* label,
+    const int channels, const int inner_num, const bool has_ignore_label,
+    const int ignore_label, const float max_loss, float* lse, float* loss, float* counts) {
+  CUDA_KERNEL_LOOP(index, rows) {
+    const int n = index / inner_num;
+    const int s = index % inner_num;
+    const T* x = data + n * channels * inner_num + s;
+    A m = -FLT_MAX, sum = A(0);
+    for (int c = 0; c < channels; ++c) {
+      lse_add<A>(mt_load<A, T>(x[c * inner_num]), m, sum);
+    }
+    lse_row_loss<T, A, L>(index, x, inner_num, m, sum, label, has_ignore_label, ignore_label,
+        max_loss, lse, loss, counts);
+  }
+}
+
+// One block per contiguous row (inner_num == 1), for large class counts
+template <typename T, typename A, typename L>
+__global__ void SoftmaxLossFusedRowForwardGPU(const int rows, const T* data, const L* label,
+    const int channels, const bool has_ignore_label, const int ignore_label,
+    const float max_loss, float* lse, float* loss, float* counts) {
+  __shared__ A max_buf[SOFTMAX_LOSS_ROW_THREADS];
+  __shared__ A sum_buf[SOFTMAX_LOSS_ROW_THREADS];
+  for (int row = blockIdx.x; row < rows; row += gridDim.x) {
+    const T* x = data + row * channels;
+    A m = -FLT_MAX, sum = A(0);
+    for (int c = threadIdx.x; c < channels; c += blockDim.x) {
+      lse_add<A>(mt_load<A, T>(x[c]), m, sum);
+    }
+    max_buf[threadIdx.x] = m;
+    sum_buf[threadIdx.x] = sum;
+    __syncthreads();
+    for (int stride = blockDim.x / 2; stride > 0; stride /= 2) {
+      if (threadIdx.x < stride) {
+        lse_merge<A>(max_buf[threadIdx.x + stride], sum_buf[threadIdx.x + stride],
+            max_buf[threadIdx.x], sum_buf[threadIdx.x]);
+      }
+      __syncthreads();
+    }
+    if (threadIdx.x == 0) {
+      lse_row_loss<T, A, L>(row, x, 1, max_buf[0], sum_buf[0], label, has_ignore_label,
+          ignore_label, max_loss, lse, loss, counts);
+    }
+    __syncthreads();
+  }
+}
+
+// diff = scale * (softmax(x) - onehot(label)), softmax from the forward log-sum-exp
+template <typename T, typename A, typename L>
+__global__ void SoftmaxLossFusedBackwardGPU(const int count, const T* data, const L* label,
+    const float* lse, const int channels, const int inner_num, const bool has_ignore_label,
+    const int ignore_label, const A scale, T* diff) {
+  CUDA_KERNEL_LOOP(index, count) {
+    const int s = index % inner_num;
+    const int c = (index / inner_num) % channels;
+    const int row = index / (channels * inner_num) * inner_num + s;
+    const int label_value = static_cast<int>(mt_load<float, L>(label[row]));
+    if (has_ignore_label && label_value == ignore_label) {
+      diff[index] = mt_store<T, A>(A(0));
+    } else {
+      const A p = exp(mt_load<A, T>(data[index]) - A(lse[row]));
+      diff[index] = mt_store<T, A>((c == label_value ? p - A(1) : p) * scale);
+    }
+  }
+}
+
+template <typename T, typename A, typename L>
+void softmax_loss_fused_forward(const int rows, const T* data, const L* label,
+    const int channels, const int inner_num, const bool has_ignore_label,
+    const int ignore_label, const float max_loss, float* lse, float* loss, float* counts) {
+  cudaStream_t stream = Caffe::thread_stream();
+  if (inner_num == 1) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    SoftmaxLossFusedRowForwardGPU<T, A, L><<<std::min(rows, 65535), SOFTMAX_LOSS_ROW_THREADS,
+        0, stream>>>(rows, data, label, channels, has_ignore_label, ignore_label, max_loss,
+        lse, loss, counts);
+  } else {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    SoftmaxLossFusedForwardGPU<T, A, L><<<CAFFE_GET_BLOCKS(rows), CAFFE_CUDA_NUM_THREADS,
+        0, stream>>>(rows, data, label, channels, inner_num, has_ignore_label,
+        ignore_label, max_loss, lse, loss, counts);
+  }
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template <typename T, typename A, typename L>
+void softmax_loss_fused_backward(const int count, const T* data, const L* label,
+    const float* lse, const int channels, const int inner_num, const bool has_ignore_label,
+    const int ignore_label, const A scale, T* diff) {
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  SoftmaxLossFusedBackwardGPU<T, A, L><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS,
+      0, stream>>>(count, data, label, lse, channels, inner_num, has_ignore_label,
+      ignore_label, scale, diff);
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
 template <typename Ftype, typename Btype>
 void SoftmaxWithLossLayer<Ftype, Btype>::Forward_gpu(
     const vector<Blob*>& bottom, const vector<Blob*>& top) {
+  if (top.size() == 1) {
+    ForwardFused_gpu(bottom, top);
+    return;
+  }
   softmax_layer_->Forward(softmax_bottom_vec_, softmax_top_vec_);
   const Ftype* prob_data = prob_->template gpu_data<Ftype>();
   const Ftype* label = bottom[1]->gpu_data<Ftype>();
@@ -78,7 +225,7 @@ void SoftmaxWithLossLayer<Ftype, Btype>::Forward_gpu(
         CAFFE_CUDA_NUM_THREADS, 0, stream>>> (nthreads, prob_data, label, loss_data,
         outer_num_, dim, inner_num_, has_ignore_label_, ignore_label_, counts);
   }
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
   Ftype loss;
   caffe_gpu_asum(nthreads, loss_data, &loss);
   Ftype valid_count = -1;
@@ -92,6 +239,68 @@ void SoftmaxWithLossLayer<Ftype, Btype>::Forward_gpu(
   }
 }
 
+// Probabilities are never written: the loss comes from each row's log-sum-exp
+template <typename Ftype, typename Btype>
+void SoftmaxWithLossLayer<Ftype, Btype>::ForwardFused_gpu(
+    const vector<Blob*>& bottom, const vector<Blob*>& top) {
+  typedef typename MultiTensorType<Ftype>::type T;
+  typedef typename MultiTensorAcc<Ftype>::type A;
+  const T* data = reinterpret_cast<const T*>(bottom[0]->gpu_data<Ftype>());
+  const int channels = bottom[0]->shape(softmax_axis_);
+  const int rows = outer_num_ * inner_num_;
+  const float max_loss = -std::log(static_cast<float>(min_dtype<Ftype>()));
+  float* lse = row_buffer_.mutable_gpu_data();
+  float* loss_data = row_buffer_.mutable_gpu_diff();
+  float* counts = row_counts_.mutable_gpu_data();
+  if (bottom[1]->data_type() == INT) {
+    softmax_loss_fused_forward<T, A>(rows, data, bottom[1]->gpu_data<int>(), channels,
+        inner_num_, has_ignore_label_, ignore_label_, max_loss, lse, loss_data, counts);
+  } else {
+    softmax_loss_fused_forward<T, A>(rows, data,
+        reinterpret_cast<const T*>(bottom[1]->gpu_data<Ftype>()), channels, inner_num_,
+        has_ignore_label_, ignore_label_, max_loss, lse, loss_data, counts);
+  }
+  float loss;
+  caffe_gpu_asum(rows, loss_data, &loss);
+  float valid_count = -1.F;
+  if (normalization_ == LossParameter_NormalizationMode_VALID && has_ignore_label_) {
+    caffe_gpu_asum(rows, counts, &valid_count);
+  }
+  top[0]->mutable_cpu_data<Ftype>()[0] =
+      Ftype(loss / get_normalizer(normalization_, static_cast<int>(valid_count)));
+}
+
+template <typename Ftype, typename Btype>
+void SoftmaxWithLossLayer<Ftype, Btype>::BackwardFused_gpu(const vector<Blob*>& top,
+    const vector<Blob*>& bottom) {
+  typedef typename MultiTensorType<Btype>::type T;
+  typedef typename MultiTensorAcc<Btype>::type A;
+  const T* data = reinterpret_cast<const T*>(bottom[0]->gpu_data<Btype>());
+  T* diff = reinterpret_cast<T*>(bottom[0]->mutable_gpu_diff<Btype>());
+  const int channels = bottom[0]->shape(softmax_axis_);
+  const int count = bottom[0]->count();
+  int valid_count = -1;
+  if (normalization_ == LossParameter_NormalizationMode_VALID && has_ignore_label_) {
+    float float_count;
+    caffe_gpu_asum(outer_num_ * inner_num_, row_counts_.gpu_data(), &float_count);
+    valid_count = static_cast<int>(float_count);
+  }
+  float loss_weight = static_cast<float>(top[0]->cpu_diff<Btype>()[0]) /
+      get_normalizer(normalization_, valid_count);
+  if (this->parent_net() != NULL) {
+    loss_weight *= this->parent_net()->global_grad_scale();
+  }
+  if (bottom[1]->data_type() == INT) {
+    softmax_loss_fused_backward<T, A>(count, data, bottom[1]->gpu_data<int>(),
+        row_buffer_.gpu_data(), channels, inner_num_, has_ignore_label_, ignore_label_,
+        A(loss_weight), diff);
+  } else {
+    softmax_loss_fused_backward<T, A>(count, data,
+        reinterpret_cast<const T*>(bottom[1]->gpu_data<Btype>()), row_buffer_.gpu_data(),
+        channels, inner_num_, has_ignore_label_, ignore_label_, A(loss_weight), diff);
+  }
+}
+
 template <typename Dtype>
 __global__ void SoftmaxLossBackwardGPU(const int nthreads, const Dtype* top,
           const Dtype* label, Dtype* bottom_diff, const int num, const int dim,
@@ -149,7 +358,9 @@ void SoftmaxWithLossLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     LOG(FATAL) << this->type()
                << " Layer cannot backpropagate to label inputs.";
   }
-  if (propagate_down[0]) {
+  if (propagate_down[0] && top.size() == 1) {
+    BackwardFused_gpu(top, bottom);
+  } else if (propagate_down[0]) {
     Btype* bottom_diff = bottom[0]->mutable_gpu_diff<Btype>();
     const Btype* prob_data = prob_->template gpu_data<Btype>();
     const Btype* top_data = top[0]->gpu_data<Btype>();
@@ -164,7 +375,7 @@ void SoftmaxWithLossLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     SoftmaxLossBackwardGPU<<<CAFFE_GET_BLOCKS(nthreads),
         CAFFE_CUDA_NUM_THREADS, 0, Caffe::thread_stream()>>>(nthreads, top_data, label, bottom_diff,
         outer_num_, dim, inner_num_, has_ignore_label_, ignore_label_, counts);
-    CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+    CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
     int valid_count = -1;
     // Only launch another CUDA kernel if we actually need the count of valid
     // outputs.
@@ -0,0 +1,44 @@
+#include <vector>
+
+#include "caffe/layers/stripe_layer.hpp"
+
+namespace caffe {
+
+template <typename Ftype, typename Btype>
+void StripeLayer<Ftype, Btype>::LayerSetUp(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  stripes_ = this->layer_param_.spatial_param().stripes();
+  CHECK_GE(stripes_, 1);
+}
+
+template <typename Ftype, typename Btype>
+void StripeLayer<Ftype, Btype>::Reshape(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  CHECK_NE(top[0], bottom[0]) << this->type() << " Layer does not "
+      "allow in-place computation.";
+  vector<int> shape = bottom[0]->shape();
+  rows_ = 0;
+  if (shape.size() >= 3 && shape[2] >= stripes_) {
+    CHECK_EQ(shape[2] % stripes_, 0) << this->name() << ": " << shape[2]
+        << " rows can't be split in " << stripes_ << " equal stripes";
+    CHECK_EQ(NCHW, bottom[0]->packing()) << this->name() << ": stripes are rows of NCHW";
+    rows_ = shape[2] / stripes_;
+    shape[2] = rows_;
+  }
+  top[0]->Reshape(shape);
+}
+
+template <typename Ftype, typename Btype>
+void StripeLayer<Ftype, Btype>::Forward_cpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  LOG(FATAL) << this->name() << ": spatial stripes need GPU mode";
+}
+
+#ifdef CPU_ONLY
+STUB_GPU_FORWARD(StripeLayer, Forward);
+#endif
+
+INSTANTIATE_CLASS_FB(StripeLayer);
+REGISTER_LAYER_CLASS(Stripe);
+
+}  // namespace caffe
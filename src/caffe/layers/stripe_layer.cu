@@ -0,0 +1,37 @@
+#include <vector>
+
+#include "caffe/layers/stripe_layer.hpp"
+#include "caffe/solver.hpp"
+
+namespace caffe {
+
+template <typename Ftype, typename Btype>
+void StripeLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  const Solver* psolver = this->parent_solver();
+  CHECK(psolver != nullptr && psolver->callback() != nullptr) << this->name()
+      << ": spatial stripes need a multi-GPU run";
+  Solver::Callback* callback = psolver->callback();
+  cudaStream_t stream = Caffe::thread_stream();
+  Ftype* bottom_data = bottom[0]->mutable_gpu_data<Ftype>();
+  callback->stripe_broadcast(bottom_data, bottom[0]->count() * sizeof(Ftype), stripes_,
+      stream);
+  Ftype* top_data = top[0]->mutable_gpu_data<Ftype>();
+  if (rows_ == 0) {
+    CUDA_CHECK(cudaMemcpyAsync(top_data, bottom_data, top[0]->count() * sizeof(Ftype),
+        cudaMemcpyDeviceToDevice, stream));
+  } else {
+    // Rows of the stripe in every plane of axes 0 and 1
+    const size_t plane = bottom[0]->count(2) * sizeof(Ftype);
+    const size_t stripe = top[0]->count(2) * sizeof(Ftype);
+    const int index = callback->stripe_index(stripes_);
+    CUDA_CHECK(cudaMemcpy2DAsync(top_data, stripe,
+        reinterpret_cast<const char*>(bottom_data) + index * stripe, plane, stripe,
+        bottom[0]->count(0, 2), cudaMemcpyDeviceToDevice, stream));
+  }
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+INSTANTIATE_LAYER_GPU_FORWARD_ONLY_FB(StripeLayer);
+
+}  // namespace caffe
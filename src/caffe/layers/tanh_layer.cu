@@ -25,7 +25,7 @@ void TanHLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
   TanHForward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
       count, bottom_data, top_data);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template <typename Dtype>
@@ -51,7 +51,7 @@ void TanHLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
     TanHBackward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
         count, top_diff, top_data, bottom_diff);
     CUDA_POST_KERNEL_CHECK;
-    CUDA_CHECK(cudaStreamSynchronize(stream));
+    CUDA_CHECK(caffe_gpu_sync(stream));
   }
 }
 
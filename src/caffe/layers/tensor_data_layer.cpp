@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/tensor_data_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_profile.hpp"
+
+namespace caffe {
+
+namespace {
+
+template <typename Ftype>
+void convert_records(bool use_gpu, Type type, size_t n, const void* src, Ftype* dst) {
+  switch (type) {
+    case FLOAT16:
+      caffe_convert(use_gpu, n, static_cast<const float16*>(src), dst);
+      break;
+    case FLOAT:
+      caffe_convert(use_gpu, n, static_cast<const float*>(src), dst);
+      break;
+    case DOUBLE:
+      caffe_convert(use_gpu, n, static_cast<const double*>(src), dst);
+      break;
+    default:
+      LOG(FATAL) << "Tensor files of " << Type_Name(type) << " values aren't supported";
+  }
+}
+
+}  // namespace
+
+template <typename Ftype, typename Btype>
+TensorDataLayer<Ftype, Btype>::~TensorDataLayer() {
+  if (layer_inititialized_flag_.is_set()) {
+    this->StopInternalThread();
+  }
+}
+
+template <typename Ftype, typename Btype>
+void TensorDataLayer<Ftype, Btype>::DataLayerSetUp(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  const TensorDataParameter& tensor_data_param = this->layer_param_.tensor_data_param();
+  const int batch_size = tensor_data_param.batch_size();
+  CHECK_GT(batch_size, 0) << "Positive batch size required";
+  LOG(INFO) << "Opening tensor file " << tensor_data_param.source();
+  file_.reset(new TensorFile(tensor_data_param.source()));
+  CHECK_GE(file_->records(), batch_size) << tensor_data_param.source()
+      << " has fewer records than a batch";
+  direct_ = tensor_data_param.direct_io() && Caffe::mode() == Caffe::GPU && file_->direct();
+  LOG(INFO) << "A total of " << file_->records() << " records of "
+      << Type_Name(file_->type()) << ", read " << (direct_ ? "by cuFile" : "to host memory");
+
+  top_shape_ = file_->record_shape();
+  top_shape_.insert(top_shape_.begin(), batch_size);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_->Reshape(top_shape_);
+  }
+  top[0]->Reshape(top_shape_);
+  LOG(INFO) << "output data size: " << top[0]->shape_string();
+  if (this->output_labels_) {
+    vector<int> label_shape(1, batch_size);
+    top[1]->Reshape(label_shape);
+    for (int i = 0; i < this->prefetch_.size(); ++i) {
+      this->prefetch_[i]->label_->Reshape(label_shape);
+    }
+  }
+  host_.resize(this->transf_num_);
+#ifndef CPU_ONLY
+  for (size_t i = 0; i < this->transf_num_; ++i) {
+    staging_.emplace_back(make_shared<GPUMemory::Workspace>());
+  }
+#endif
+  layer_inititialized_flag_.set();
+}
+
+template <typename Ftype, typename Btype>
+uint64_t TensorDataLayer<Ftype, Btype>::first_record(size_t batch_id) const {
+  const size_t ranks = this->phase_ == TRAIN ? Caffe::solver_count() : 1UL;
+  const size_t rank = ranks > 1UL ? this->solver_rank_ : 0UL;
+  const size_t threads = this->threads_num();
+  const uint64_t file_batch = (batch_id / threads * ranks + rank) * threads + batch_id % threads;
+  return file_batch * this->layer_param_.tensor_data_param().batch_size() % file_->records();
+}
+
+// This function is called on prefetch thread
+template <typename Ftype, typename Btype>
+void TensorDataLayer<Ftype, Btype>::load_batch(Batch* batch, int thread_id, size_t queue_id) {
+  const int batch_size = this->layer_param_.tensor_data_param().batch_size();
+  const size_t id = this->batch_id(thread_id);
+  const uint64_t first = first_record(id);
+  const uint64_t records = file_->records();
+  const bool same_type = file_->type() == tp<Ftype>();
+  batch->data_->Reshape(top_shape_);
+  const size_t record_values = batch->data_->count(1);
+  // The last batch of the file goes on from its first record
+  const size_t head = std::min<uint64_t>(batch_size, records - first);
+  const size_t counts[2] = { head, batch_size - head };
+  const uint64_t firsts[2] = { first, 0UL };
+  {
+    ThreadProfile::Scope read(ThreadProfile::READ);
+    if (direct_) {
+#if defined(USE_CUFILE) && !defined(CPU_ONLY)
+      Ftype* dst = batch->data_->template mutable_gpu_data_c<Ftype>(false);
+      cudaStream_t stream = Caffe::thread_stream();
+      for (int i = 0; i < 2 && counts[i] > 0UL; ++i) {
+        const void* src = file_->ReadDevice(firsts[i], counts[i], same_type ? dst : nullptr,
+            staging_[thread_id].get());
+        if (same_type && src != dst) {
+          CUDA_CHECK(cudaMemcpyAsync(dst, src, counts[i] * file_->record_bytes(),
+              cudaMemcpyDeviceToDevice, stream));
+        } else if (!same_type) {
+          convert_records(true, file_->type(), counts[i] * record_values, src, dst);
+        }
+        dst += counts[i] * record_values;
+      }
+      CUDA_CHECK(cudaStreamSynchronize(stream));
+#endif
+    } else {
+      Ftype* dst = batch->data_->template mutable_cpu_data_c<Ftype>(false);
+      vector<char>& host = host_[thread_id];
+      for (int i = 0; i < 2 && counts[i] > 0UL; ++i) {
+        if (same_type) {
+          file_->Read(firsts[i], counts[i], dst);
+        } else {
+          host.resize(counts[i] * file_->record_bytes());
+          file_->Read(firsts[i], counts[i], host.data());
+          convert_records(false, file_->type(), counts[i] * record_values, host.data(), dst);
+        }
+        dst += counts[i] * record_values;
+      }
+    }
+  }
+  if (this->output_labels_) {
+    batch->label_->Reshape(vector<int>(1, batch_size));
+    Ftype* top_label = batch->label_->template mutable_cpu_data_c<Ftype>(false);
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      top_label[item_id] = file_->label((first + item_id) % records);
+    }
+  }
+  batch->set_data_packing(this->transform_param_.forward_packing());
+  batch->set_id(id);
+}
+
+INSTANTIATE_CLASS_FB(TensorDataLayer);
+REGISTER_LAYER_CLASS(TensorData);
+
+}  // namespace caffe
@@ -23,7 +23,7 @@ void ThresholdLayer<Ftype, Btype>::Forward_gpu(const vector<Blob*>& bottom,
   ThresholdForward<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
       count, threshold_, bottom_data, top_data);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 INSTANTIATE_LAYER_GPU_FORWARD_ONLY_FB(ThresholdLayer);
@@ -5,31 +5,16 @@
 
 namespace caffe {
 
-template <typename Dtype>
-__global__ void Tile(const int nthreads, const Dtype* bottom_data,
-    const int tile_size, const int num_tiles, const int bottom_tile_axis,
-    Dtype* top_data) {
-  CUDA_KERNEL_LOOP(index, nthreads) {
-    const int d = index % tile_size;
-    const int b = (index / tile_size / num_tiles) % bottom_tile_axis;
-    const int n = index / tile_size / num_tiles / bottom_tile_axis;
-    const int bottom_index = (n * bottom_tile_axis + b) * tile_size + d;
-    top_data[index] = bottom_data[bottom_index];
-  }
-}
-
+// The bottom broadcast along a tiles axis of stride 0
 template <typename Ftype, typename Btype>
 void TileLayer<Ftype, Btype>::Forward_gpu(
     const vector<Blob*>& bottom, const vector<Blob*>& top) {
-  const Ftype* bottom_data = bottom[0]->gpu_data<Ftype>();
-  Ftype* top_data = top[0]->mutable_gpu_data<Ftype>();
-  const int bottom_tile_axis = bottom[0]->shape(axis_);
-  const int nthreads = top[0]->count();
+  const int outer = outer_dim_, tiles = tiles_, inner = inner_dim_;
   cudaStream_t stream = Caffe::thread_stream();
-  Tile  // NOLINT_NEXT_LINE(whitespace/operators)
-      <<<CAFFE_GET_BLOCKS(nthreads), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
-      nthreads, bottom_data, inner_dim_, tiles_, bottom_tile_axis, top_data);
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  caffe_gpu_strided_copy(tp<Ftype>(), vector<int>{outer, tiles, inner},
+      bottom[0]->gpu_data<Ftype>(), vector<int>{inner, 0, 1},
+      top[0]->mutable_gpu_data<Ftype>(), vector<int>{tiles * inner, inner, 1}, stream);
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template <typename Dtype>
@@ -62,7 +47,7 @@ void TileLayer<Ftype, Btype>::Backward_gpu(const vector<Blob*>& top,
   TileBackward  // NOLINT_NEXT_LINE(whitespace/operators)
       <<<CAFFE_GET_BLOCKS(nthreads), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
       nthreads, top_diff, tile_size, tiles_, bottom_tile_axis, bottom_diff);
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 INSTANTIATE_LAYER_GPU_FUNCS_FB(TileLayer);
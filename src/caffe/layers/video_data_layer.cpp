@@ -0,0 +1,174 @@
+#if defined(USE_NVDEC) && !defined(CPU_ONLY)
+#include <algorithm>
+#include <chrono>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/layers/video_data_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
+#include "caffe/util/thread_profile.hpp"
+
+namespace caffe {
+
+template <typename Ftype, typename Btype>
+VideoDataLayer<Ftype, Btype>::~VideoDataLayer() {
+  if (layer_inititialized_flag_.is_set()) {
+    this->StopInternalThread();
+  }
+}
+
+template <typename Ftype, typename Btype>
+void VideoDataLayer<Ftype, Btype>::DataLayerSetUp(const vector<Blob*>& bottom,
+    const vector<Blob*>& top) {
+  const VideoDataParameter& video_data_param = this->layer_param_.video_data_param();
+  CHECK(Caffe::mode() == Caffe::GPU) << "VideoData layers decode on the GPU";
+  CHECK_EQ(this->transform_param_.forward_packing(), NCHW)
+      << "VideoData layers write NCHW frames";
+  const int batch_size = video_data_param.batch_size();
+  const int frames = video_data_param.frames();
+  CHECK_GT(batch_size, 0) << "Positive batch size required";
+  CHECK_GT(frames, 0) << "Positive number of frames required";
+  CHECK_GT(video_data_param.frame_stride(), 0) << "Positive frame stride required";
+  // Read the file with clips and labels
+  const string& source = video_data_param.source();
+  LOG(INFO) << "Opening file " << source;
+  std::ifstream infile(source.c_str());
+  string filename;
+  int label;
+  while (infile >> filename >> label) {
+    lines_.push_back(std::make_pair(filename, label));
+  }
+  CHECK(!lines_.empty()) << "No clips in " << source;
+  if (video_data_param.shuffle()) {
+    LOG(INFO) << "Shuffling data";
+    prefetch_rng_.reset(new Caffe::RNG(caffe_rng_rand()));
+    ShuffleClips();
+  }
+  LOG(INFO) << "A total of " << lines_.size() << " clips.";
+
+  // Read the first clip's size to initialize the top blob
+  NvDecVideoReader reader(video_data_param.new_height(), video_data_param.new_width());
+  reader.Open(video_data_param.root_folder() + lines_[0].first);
+  DataTransformer transformer(this->transform_param_, this->phase_);
+  AugmentSample sample;
+  const vector<int> frame_shape = transformer.SampleAugment(reader.rows(), reader.cols(), 3,
+      &sample);
+  vector<int> top_shape { batch_size, frames, frame_shape[0], frame_shape[1], frame_shape[2] };
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_->Reshape(top_shape);
+  }
+  top[0]->Reshape(top_shape);
+  LOG(INFO) << "output data size: " << top[0]->shape_string();
+  vector<int> label_shape(1, batch_size);
+  top[1]->Reshape(label_shape);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->label_->Reshape(label_shape);
+  }
+  for (size_t i = 0; i < this->transf_num_; ++i) {
+    clips_.emplace_back(make_shared<ClipBuffers>());
+  }
+  layer_inititialized_flag_.set();
+}
+
+template <typename Ftype, typename Btype>
+void VideoDataLayer<Ftype, Btype>::ShuffleClips() {
+  caffe::rng_t* prefetch_rng = static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  shuffle(lines_.begin(), lines_.end(), prefetch_rng);
+}
+
+template <typename Ftype, typename Btype>
+std::pair<std::string, int> VideoDataLayer<Ftype, Btype>::next_clip(uint64_t* record_id) {
+  std::lock_guard<std::mutex> lock(lines_mutex_);
+  std::pair<std::string, int> line = lines_[lines_id_];
+  *record_id = clips_read_++;
+  if (++lines_id_ >= lines_.size()) {
+    // We have reached the end. Restart from the first.
+    DLOG(INFO) << this->print_current_device() << "Restarting data prefetching from start.";
+    lines_id_ = 0UL;
+    if (this->layer_param_.video_data_param().shuffle()) {
+      ShuffleClips();
+    }
+  }
+  return line;
+}
+
+// This function is called on prefetch thread
+template <typename Ftype, typename Btype>
+void VideoDataLayer<Ftype, Btype>::load_batch(Batch* batch, int thread_id, size_t queue_id) {
+  const VideoDataParameter& video_data_param = this->layer_param_.video_data_param();
+  const int batch_size = video_data_param.batch_size();
+  const int frames = video_data_param.frames();
+  const int stride = video_data_param.frame_stride();
+  ClipBuffers& buffers = *clips_[thread_id];
+  if (!buffers.reader) {
+    buffers.reader.reset(new NvDecVideoReader(video_data_param.new_height(),
+        video_data_param.new_width()));
+  }
+  DataTransformer* transformer = this->dt(thread_id);
+  cudaStream_t stream = Caffe::thread_stream();
+  batch->label_->Reshape(vector<int>(1, batch_size));
+  Ftype* top_label = batch->label_->template mutable_cpu_data<Ftype>();
+  Ftype* top_data = nullptr;
+  vector<int> frame_shape;
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    uint64_t record_id = 0UL;
+    const std::pair<std::string, int> line = next_clip(&record_id);
+    const std::string path = video_data_param.root_folder() + line.first;
+    int clip_frames = 0;
+    {
+      ThreadProfile::Scope read(ThreadProfile::READ);
+      clip_frames = buffers.reader->Open(path);
+    }
+    // Frame range: random start in TRAIN, centered in TEST
+    const int range = std::max(0, clip_frames - ((frames - 1) * stride + 1));
+    const int first = this->phase_ == TRAIN ? caffe_rng_rand() % (range + 1) : range / 2;
+    const int rows = buffers.reader->rows(), cols = buffers.reader->cols();
+    const size_t frame_bytes = static_cast<size_t>(rows) * cols * 3;
+    buffers.frames.safe_reserve(frames * frame_bytes);
+    {
+      ThreadProfile::Scope decode(ThreadProfile::DECODE);
+      const auto start = std::chrono::steady_clock::now();
+      buffers.reader->Read(first, frames, stride, static_cast<uint8_t*>(buffers.frames.data()),
+          stream);
+      transformer->add_decode_us(std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start).count());
+    }
+    // Resize, crop, mirror and jitter drawn once for all frames of the clip
+    AugmentSample sample;
+    transformer->set_sample(record_id, 0U);
+    const vector<int> shape = transformer->SampleAugment(rows, cols, 3, &sample);
+    sample.planar = 0;
+    if (item_id == 0) {
+      frame_shape = shape;
+      batch->data_->Reshape(vector<int>{batch_size, frames, shape[0], shape[1], shape[2]});
+      top_data = batch->data_->template mutable_gpu_data_c<Ftype>(false);
+    }
+    CHECK(shape == frame_shape) << "Frames can't vary in channels or in size after resize "
+        "and crop in the same batch";
+    buffers.samples.assign(frames, sample);
+    for (int t = 0; t < frames; ++t) {
+      buffers.samples[t].image_offset = t * frame_bytes;
+    }
+    buffers.samples_gpu.safe_reserve(frames * sizeof(AugmentSample));
+    CUDA_CHECK(cudaMemcpyAsync(buffers.samples_gpu.data(), buffers.samples.data(),
+        frames * sizeof(AugmentSample), cudaMemcpyHostToDevice, stream));
+    transformer->AugmentGPU(frames, shape[0], shape[1], shape[2],
+        static_cast<const AugmentSample*>(buffers.samples_gpu.data()),
+        static_cast<const uint8_t*>(buffers.frames.data()),
+        top_data + item_id * batch->data_->count(1), NCHW);
+    // Frames of the next clip are decoded to the same buffer
+    CUDA_CHECK(cudaStreamSynchronize(stream));
+    top_label[item_id] = line.second;
+  }
+  batch->set_data_packing(NCHW);
+  batch->set_id(this->batch_id(thread_id));
+}
+
+INSTANTIATE_CLASS_FB(VideoDataLayer);
+REGISTER_LAYER_CLASS(VideoData);
+
+}  // namespace caffe
+#endif  // USE_NVDEC && !CPU_ONLY
@@ -1,5 +1,7 @@
 #include <algorithm>
+#include <future>
 #include <map>
+#include <memory>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -9,8 +11,10 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/layers/window_data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/image_cache.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_profile.hpp"
 
 // caffe.proto > LayerParameter > WindowDataParameter
 //   'source' field specifies the window_file
@@ -56,14 +60,23 @@ void WindowDataLayer<Ftype, Btype>::DataLayerSetUp(const vector<Blob*>& bottom,
   cache_images_ = this->layer_param_.window_data_param().cache_images();
   string root_folder = this->layer_param_.window_data_param().root_folder();
 
-  const bool prefetch_needs_rand =
-      this->transform_param_.mirror() ||
-      this->transform_param_.crop_size();
-  if (prefetch_needs_rand) {
-    prefetch_rng_.reset(new Caffe::RNG(Caffe::next_seed()));
-  } else {
-    prefetch_rng_.reset();
+  // Batch samples depend on this seed and their id only
+  sample_seed_ = Caffe::next_seed();
+  const WindowDataParameter& window_param = this->layer_param_.window_data_param();
+  if (cache_images_) {
+    ImageCache::instance().reserve(static_cast<size_t>(window_param.cache_mb()) << 20);
+  }
+  if (window_param.read_threads() > 0) {
+    read_pool_.reset(new ThreadPool(window_param.read_threads()));
   }
+#ifndef CPU_ONLY
+  images_gpu_.resize(this->threads_num());
+  warps_gpu_.resize(this->threads_num());
+  for (size_t i = 0; i < this->threads_num(); ++i) {
+    images_gpu_[i] = make_shared<GPUMemory::Workspace>();
+    warps_gpu_[i] = make_shared<GPUMemory::Workspace>();
+  }
+#endif
 
   std::ifstream infile(this->layer_param_.window_data_param().source().c_str());
   CHECK(infile.good()) << "Failed to open window file "
@@ -88,15 +101,6 @@ void WindowDataLayer<Ftype, Btype>::DataLayerSetUp(const vector<Blob*>& bottom,
     infile >> image_size[0] >> image_size[1] >> image_size[2];
     channels = image_size[0];
     image_database_.push_back(std::make_pair(image_path, image_size));
-
-    if (cache_images_) {
-      Datum datum;
-      if (!ReadFileToDatum(image_path, &datum)) {
-        LOG(ERROR) << "Could not open or find file " << image_path;
-        return;
-      }
-      image_database_cache_.push_back(std::make_pair(image_path, datum));
-    }
     // read each box
     int num_windows;
     infile >> num_windows;
@@ -203,15 +207,189 @@ void WindowDataLayer<Ftype, Btype>::DataLayerSetUp(const vector<Blob*>& bottom,
         mean_values_.push_back(mean_values_[0]);
       }
     }
+    mean_values_blob_.Reshape(vector<int>(1, mean_values_.size()));
+    std::copy(mean_values_.begin(), mean_values_.end(), mean_values_blob_.mutable_cpu_data());
   }
 }
 
 template <typename Ftype, typename Btype>
-unsigned int WindowDataLayer<Ftype, Btype>::PrefetchRand() {
-  CHECK(prefetch_rng_);
-  caffe::rng_t* prefetch_rng =
-      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
-  return (*prefetch_rng)();
+cv::Mat WindowDataLayer<Ftype, Btype>::ReadImage(int index) const {
+  const std::string& filename = image_database_[index].first;
+  cv::Mat cv_img;
+  const std::string key = filename + ":color";
+  if (cache_images_ && ImageCache::instance().get(key, &cv_img)) {
+    return cv_img;
+  }
+  cv_img = cv::imread(filename, CV_LOAD_IMAGE_COLOR);
+  CHECK(cv_img.data) << "Could not open or find file " << filename;
+  if (cache_images_) {
+    ImageCache::instance().put(key, cv_img);
+  }
+  return cv_img;
+}
+
+template <typename Ftype, typename Btype>
+WindowWarp WindowDataLayer<Ftype, Btype>::GetWarp(const vector<float>& window,
+    const cv::Mat& cv_img, bool do_mirror) const {
+  const int context_pad = this->layer_param_.window_data_param().context_pad();
+  const int crop_size = this->transform_param_.crop_size();
+  const bool use_square = this->layer_param_.window_data_param().crop_mode() == "square";
+  cv::Size cv_crop_size(crop_size, crop_size);
+
+  // crop window out of image and warp it
+  int x1 = window[WindowDataLayer<Ftype, Btype>::X1];
+  int y1 = window[WindowDataLayer<Ftype, Btype>::Y1];
+  int x2 = window[WindowDataLayer<Ftype, Btype>::X2];
+  int y2 = window[WindowDataLayer<Ftype, Btype>::Y2];
+
+  int pad_w = 0;
+  int pad_h = 0;
+  if (context_pad > 0 || use_square) {
+    // scale factor by which to expand the original region
+    // such that after warping the expanded region to crop_size x crop_size
+    // there's exactly context_pad amount of padding on each side
+    float context_scale = static_cast<float>(crop_size) /
+        static_cast<float>(crop_size - 2*context_pad);
+
+    // compute the expanded region
+    float half_height = static_cast<float>(y2-y1+1)/2.0;
+    float half_width = static_cast<float>(x2-x1+1)/2.0;
+    float center_x = static_cast<float>(x1) + half_width;
+    float center_y = static_cast<float>(y1) + half_height;
+    if (use_square) {
+      if (half_height > half_width) {
+        half_width = half_height;
+      } else {
+        half_height = half_width;
+      }
+    }
+    x1 = static_cast<int>(round(center_x - half_width*context_scale));
+    x2 = static_cast<int>(round(center_x + half_width*context_scale));
+    y1 = static_cast<int>(round(center_y - half_height*context_scale));
+    y2 = static_cast<int>(round(center_y + half_height*context_scale));
+
+    // the expanded region may go outside of the image
+    // so we compute the clipped (expanded) region and keep track of
+    // the extent beyond the image
+    int unclipped_height = y2-y1+1;
+    int unclipped_width = x2-x1+1;
+    int pad_x1 = std::max(0, -x1);
+    int pad_y1 = std::max(0, -y1);
+    int pad_x2 = std::max(0, x2 - cv_img.cols + 1);
+    int pad_y2 = std::max(0, y2 - cv_img.rows + 1);
+    // clip bounds
+    x1 = x1 + pad_x1;
+    x2 = x2 - pad_x2;
+    y1 = y1 + pad_y1;
+    y2 = y2 - pad_y2;
+    CHECK_GT(x1, -1);
+    CHECK_GT(y1, -1);
+    CHECK_LT(x2, cv_img.cols);
+    CHECK_LT(y2, cv_img.rows);
+
+    int clipped_height = y2-y1+1;
+    int clipped_width = x2-x1+1;
+
+    // scale factors that would be used to warp the unclipped
+    // expanded region
+    float scale_x =
+        static_cast<float>(crop_size)/static_cast<float>(unclipped_width);
+    float scale_y =
+        static_cast<float>(crop_size)/static_cast<float>(unclipped_height);
+
+    // size to warp the clipped expanded region to
+    cv_crop_size.width =
+        static_cast<int>(round(static_cast<float>(clipped_width)*scale_x));
+    cv_crop_size.height =
+        static_cast<int>(round(static_cast<float>(clipped_height)*scale_y));
+    pad_x1 = static_cast<int>(round(static_cast<float>(pad_x1)*scale_x));
+    pad_x2 = static_cast<int>(round(static_cast<float>(pad_x2)*scale_x));
+    pad_y1 = static_cast<int>(round(static_cast<float>(pad_y1)*scale_y));
+    pad_y2 = static_cast<int>(round(static_cast<float>(pad_y2)*scale_y));
+
+    pad_h = pad_y1;
+    // if we're mirroring, we mirror the padding too (to be pedantic)
+    if (do_mirror) {
+      pad_w = pad_x2;
+    } else {
+      pad_w = pad_x1;
+    }
+
+    // ensure that the warped, clipped region plus the padding fits in the
+    // crop_size x crop_size image (it might not due to rounding)
+    if (pad_h + cv_crop_size.height > crop_size) {
+      cv_crop_size.height = crop_size - pad_h;
+    }
+    if (pad_w + cv_crop_size.width > crop_size) {
+      cv_crop_size.width = crop_size - pad_w;
+    }
+  }
+
+  WindowWarp warp;
+  warp.image_offset = 0UL;
+  warp.image_cols = cv_img.cols;
+  warp.roi_x = x1;
+  warp.roi_y = y1;
+  warp.roi_w = x2 - x1 + 1;
+  warp.roi_h = y2 - y1 + 1;
+  warp.pad_w = pad_w;
+  warp.pad_h = pad_h;
+  warp.out_w = cv_crop_size.width;
+  warp.out_h = cv_crop_size.height;
+  warp.mirror = do_mirror;
+  return warp;
+}
+
+template <typename Ftype, typename Btype>
+void WindowDataLayer<Ftype, Btype>::WarpCPU(const cv::Mat& cv_img, const WindowWarp& warp,
+    Ftype* out) const {
+  const float scale = this->layer_param_.window_data_param().scale();
+  const int crop_size = this->transform_param_.crop_size();
+  const int channels = cv_img.channels();
+  const float* mean = nullptr;
+  int mean_off = 0;
+  int mean_width = 0;
+  int mean_height = 0;
+  if (this->has_mean_file_) {
+    mean = this->data_mean_.cpu_data();
+    mean_off = (this->data_mean_.width() - crop_size) / 2;
+    mean_width = this->data_mean_.width();
+    mean_height = this->data_mean_.height();
+  }
+
+  cv::Rect roi(warp.roi_x, warp.roi_y, warp.roi_w, warp.roi_h);
+  cv::Mat cv_cropped_img = cv_img(roi);
+  cv::resize(cv_cropped_img, cv_cropped_img,
+      cv::Size(warp.out_w, warp.out_h), 0, 0, cv::INTER_LINEAR);
+
+  // horizontal flip at random
+  if (warp.mirror) {
+    cv::flip(cv_cropped_img, cv_cropped_img, 1);
+  }
+
+  // copy the warped window into out, padding is zero
+  std::fill(out, out + channels * crop_size * crop_size, Ftype(0));
+  for (int h = 0; h < cv_cropped_img.rows; ++h) {
+    const uchar* ptr = cv_cropped_img.ptr<uchar>(h);
+    int img_index = 0;
+    for (int w = 0; w < cv_cropped_img.cols; ++w) {
+      for (int c = 0; c < channels; ++c) {
+        int top_index = (c * crop_size + h + warp.pad_h) * crop_size + w + warp.pad_w;
+        float pixel = static_cast<float>(ptr[img_index++]);
+        if (this->has_mean_file_) {
+          int mean_index = (c * mean_height + h + mean_off + warp.pad_h)
+                       * mean_width + w + mean_off + warp.pad_w;
+          out[top_index] = (pixel - mean[mean_index]) * scale;
+        } else {
+          if (this->has_mean_values_) {
+            out[top_index] = (pixel - this->mean_values_[c]) * scale;
+          } else {
+            out[top_index] = pixel * scale;
+          }
+        }
+      }
+    }
+  }
 }
 
 // This function is called on prefetch thread
@@ -227,238 +405,135 @@ void WindowDataLayer<Ftype, Btype>::load_batch(Batch* batch,
   CPUTimer timer;
   batch->data_->Reshape(data_shape_);
   batch->label_->Reshape(label_shape_);
-  Ftype* top_data = batch->data_->mutable_cpu_data<Ftype>();
   Ftype* top_label = batch->label_->mutable_cpu_data<Ftype>();
-  const Ftype scale = this->layer_param_.window_data_param().scale();
   const int batch_size = this->layer_param_.window_data_param().batch_size();
-  const int context_pad = this->layer_param_.window_data_param().context_pad();
   const int crop_size = this->transform_param_.crop_size();
   const bool mirror = this->transform_param_.mirror();
   const float fg_fraction =
       this->layer_param_.window_data_param().fg_fraction();
-  Ftype* mean = NULL;
-  int mean_off = 0;
-  int mean_width = 0;
-  int mean_height = 0;
-  if (this->has_mean_file_) {
-    mean = this->data_mean_.mutable_cpu_data();
-    mean_off = (this->data_mean_.width() - crop_size) / 2;
-    mean_width = this->data_mean_.width();
-    mean_height = this->data_mean_.height();
-  }
-  cv::Size cv_crop_size(crop_size, crop_size);
-  const string& crop_mode = this->layer_param_.window_data_param().crop_mode();
-
-  bool use_square = (crop_mode == "square") ? true : false;
-
-  // zero out batch
-  caffe_set(batch->data_->count(), Ftype(0), top_data);
+  const size_t batch_id = this->batch_id(thread_id);
+  caffe::rng_t rng(sample_seed_ + batch_id);
 
   const int num_fg = static_cast<int>(static_cast<float>(batch_size)
       * fg_fraction);
   const int num_samples[2] = { batch_size - num_fg, num_fg };
 
-  int item_id = 0;
   // sample from bg set then fg set
+  vector<const vector<float>*> windows;
+  vector<bool> mirrors;
   for (int is_fg = 0; is_fg < 2; ++is_fg) {
     for (int dummy = 0; dummy < num_samples[is_fg]; ++dummy) {
-      // sample a window
-      timer.Start();
-      const unsigned int rand_index = PrefetchRand();
-      vector<float> window = (is_fg) ?
-          fg_windows_[rand_index % fg_windows_.size()] :
-          bg_windows_[rand_index % bg_windows_.size()];
-
-      bool do_mirror = mirror && PrefetchRand() % 2;
-
-      // load the image containing the window
-      pair<std::string, vector<int> > image =
-          image_database_[window[WindowDataLayer<Ftype, Btype>::IMAGE_INDEX]];
-
-      cv::Mat cv_img;
-      if (this->cache_images_) {
-        pair<std::string, Datum> image_cached =
-          image_database_cache_[window[WindowDataLayer<Ftype, Btype>::IMAGE_INDEX]];
-        DecodeDatumToCVMat(image_cached.second, true, cv_img, false);
-      } else {
-        cv_img = cv::imread(image.first, CV_LOAD_IMAGE_COLOR);
-        if (!cv_img.data) {
-          LOG(ERROR) << "Could not open or find file " << image.first;
-          return;
-        }
-      }
-      read_time += timer.MicroSeconds();
-      timer.Start();
-      const int channels = cv_img.channels();
-
-      // crop window out of image and warp it
-      int x1 = window[WindowDataLayer<Ftype, Btype>::X1];
-      int y1 = window[WindowDataLayer<Ftype, Btype>::Y1];
-      int x2 = window[WindowDataLayer<Ftype, Btype>::X2];
-      int y2 = window[WindowDataLayer<Ftype, Btype>::Y2];
-
-      int pad_w = 0;
-      int pad_h = 0;
-      if (context_pad > 0 || use_square) {
-        // scale factor by which to expand the original region
-        // such that after warping the expanded region to crop_size x crop_size
-        // there's exactly context_pad amount of padding on each side
-        Ftype context_scale = static_cast<Ftype>(crop_size) /
-            static_cast<Ftype>(crop_size - 2*context_pad);
-
-        // compute the expanded region
-        Ftype half_height = static_cast<Ftype>(y2-y1+1)/2.0;
-        Ftype half_width = static_cast<Ftype>(x2-x1+1)/2.0;
-        Ftype center_x = static_cast<Ftype>(x1) + half_width;
-        Ftype center_y = static_cast<Ftype>(y1) + half_height;
-        if (use_square) {
-          if (half_height > half_width) {
-            half_width = half_height;
-          } else {
-            half_height = half_width;
-          }
-        }
-        x1 = static_cast<int>(round(center_x - half_width*context_scale));
-        x2 = static_cast<int>(round(center_x + half_width*context_scale));
-        y1 = static_cast<int>(round(center_y - half_height*context_scale));
-        y2 = static_cast<int>(round(center_y + half_height*context_scale));
-
-        // the expanded region may go outside of the image
-        // so we compute the clipped (expanded) region and keep track of
-        // the extent beyond the image
-        int unclipped_height = y2-y1+1;
-        int unclipped_width = x2-x1+1;
-        int pad_x1 = std::max(0, -x1);
-        int pad_y1 = std::max(0, -y1);
-        int pad_x2 = std::max(0, x2 - cv_img.cols + 1);
-        int pad_y2 = std::max(0, y2 - cv_img.rows + 1);
-        // clip bounds
-        x1 = x1 + pad_x1;
-        x2 = x2 - pad_x2;
-        y1 = y1 + pad_y1;
-        y2 = y2 - pad_y2;
-        CHECK_GT(x1, -1);
-        CHECK_GT(y1, -1);
-        CHECK_LT(x2, cv_img.cols);
-        CHECK_LT(y2, cv_img.rows);
-
-        int clipped_height = y2-y1+1;
-        int clipped_width = x2-x1+1;
-
-        // scale factors that would be used to warp the unclipped
-        // expanded region
-        Ftype scale_x =
-            static_cast<Ftype>(crop_size)/static_cast<Ftype>(unclipped_width);
-        Ftype scale_y =
-            static_cast<Ftype>(crop_size)/static_cast<Ftype>(unclipped_height);
-
-        // size to warp the clipped expanded region to
-        cv_crop_size.width =
-            static_cast<int>(round(static_cast<Ftype>(clipped_width)*scale_x));
-        cv_crop_size.height =
-            static_cast<int>(round(static_cast<Ftype>(clipped_height)*scale_y));
-        pad_x1 = static_cast<int>(round(static_cast<Ftype>(pad_x1)*scale_x));
-        pad_x2 = static_cast<int>(round(static_cast<Ftype>(pad_x2)*scale_x));
-        pad_y1 = static_cast<int>(round(static_cast<Ftype>(pad_y1)*scale_y));
-        pad_y2 = static_cast<int>(round(static_cast<Ftype>(pad_y2)*scale_y));
-
-        pad_h = pad_y1;
-        // if we're mirroring, we mirror the padding too (to be pedantic)
-        if (do_mirror) {
-          pad_w = pad_x2;
-        } else {
-          pad_w = pad_x1;
-        }
-
-        // ensure that the warped, clipped region plus the padding fits in the
-        // crop_size x crop_size image (it might not due to rounding)
-        if (pad_h + cv_crop_size.height > crop_size) {
-          cv_crop_size.height = crop_size - pad_h;
-        }
-        if (pad_w + cv_crop_size.width > crop_size) {
-          cv_crop_size.width = crop_size - pad_w;
-        }
-      }
-
-      cv::Rect roi(x1, y1, x2-x1+1, y2-y1+1);
-      cv::Mat cv_cropped_img = cv_img(roi);
-      cv::resize(cv_cropped_img, cv_cropped_img,
-          cv_crop_size, 0, 0, cv::INTER_LINEAR);
-
-      // horizontal flip at random
-      if (do_mirror) {
-        cv::flip(cv_cropped_img, cv_cropped_img, 1);
-      }
+      const unsigned int rand_index = rng();
+      windows.push_back((is_fg) ?
+          &fg_windows_[rand_index % fg_windows_.size()] :
+          &bg_windows_[rand_index % bg_windows_.size()]);
+      mirrors.push_back(mirror && rng() % 2);
+    }
+  }
 
-      // copy the warped window into top_data
-      for (int h = 0; h < cv_cropped_img.rows; ++h) {
-        const uchar* ptr = cv_cropped_img.ptr<uchar>(h);
-        int img_index = 0;
-        for (int w = 0; w < cv_cropped_img.cols; ++w) {
-          for (int c = 0; c < channels; ++c) {
-            int top_index = ((item_id * channels + c) * crop_size + h + pad_h)
-                     * crop_size + w + pad_w;
-            // int top_index = (c * height + h) * width + w;
-            Ftype pixel = static_cast<Ftype>(ptr[img_index++]);
-            if (this->has_mean_file_) {
-              int mean_index = (c * mean_height + h + mean_off + pad_h)
-                           * mean_width + w + mean_off + pad_w;
-              top_data[top_index] = (pixel - mean[mean_index]) * scale;
-            } else {
-              if (this->has_mean_values_) {
-                top_data[top_index] = (pixel - this->mean_values_[c]) * scale;
-              } else {
-                top_data[top_index] = pixel * scale;
-              }
-            }
-          }
-        }
-      }
-      trans_time += timer.MicroSeconds();
+  // Every image of the batch is decoded once whatever number of its windows
+  timer.Start();
+  std::map<int, std::shared_future<cv::Mat>> images;
+  for (const vector<float>* window : windows) {
+    const int index = (*window)[WindowDataLayer<Ftype, Btype>::IMAGE_INDEX];
+    if (images.count(index) > 0) {
+      continue;
+    }
+    if (read_pool_) {
+      auto read = std::make_shared<std::packaged_task<cv::Mat()>>(
+          [this, index]() { return ReadImage(index); });
+      images[index] = read->get_future().share();
+      read_pool_->runTask([read]() { (*read)(); });
+    } else {
+      images[index] = std::async(std::launch::deferred,
+          [this, index]() { return ReadImage(index); }).share();
+    }
+  }
+  vector<WindowWarp> warps(windows.size());
+  {
+    ThreadProfile::Scope read(ThreadProfile::READ);
+    for (int item_id = 0; item_id < windows.size(); ++item_id) {
+      const vector<float>& window = *windows[item_id];
+      const cv::Mat& cv_img =
+          images[window[WindowDataLayer<Ftype, Btype>::IMAGE_INDEX]].get();
+      warps[item_id] = GetWarp(window, cv_img, mirrors[item_id]);
       // get window label
       top_label[item_id] = window[WindowDataLayer<Ftype, Btype>::LABEL];
-
-      #if 0
-      // useful debugging code for dumping transformed windows to disk
-      string file_id;
-      std::stringstream ss;
-      ss << PrefetchRand();
-      ss >> file_id;
-      std::ofstream inf((string("dump/") + file_id +
-          string("_info.txt")).c_str(), std::ofstream::out);
-      inf << image.first << std::endl
-          << window[WindowDataLayer<Ftype, Btype>::X1]+1 << std::endl
-          << window[WindowDataLayer<Ftype, Btype>::Y1]+1 << std::endl
-          << window[WindowDataLayer<Ftype, Btype>::X2]+1 << std::endl
-          << window[WindowDataLayer<Ftype, Btype>::Y2]+1 << std::endl
-          << do_mirror << std::endl
-          << top_label[item_id] << std::endl
-          << is_fg << std::endl;
-      inf.close();
-      std::ofstream top_data_file((string("dump/") + file_id +
-          string("_data.txt")).c_str(),
-          std::ofstream::out | std::ofstream::binary);
-      for (int c = 0; c < channels; ++c) {
-        for (int h = 0; h < crop_size; ++h) {
-          for (int w = 0; w < crop_size; ++w) {
-            top_data_file.write(reinterpret_cast<char*>(
-                &top_data[((item_id * channels + c) * crop_size + h)
-                          * crop_size + w]),
-                sizeof(Ftype));
-          }
-        }
+    }
+  }
+  read_time += timer.MicroSeconds();
+  timer.Start();
+
+  if (this->is_gpu_transform()) {
+#ifndef CPU_ONLY
+    // Images go up once, every window is warped from its device copy
+    std::map<int, size_t> offsets;
+    size_t images_size = 0UL;
+    for (const auto& image : images) {
+      offsets[image.first] = images_size;
+      const cv::Mat& cv_img = image.second.get();
+      images_size += cv_img.total() * cv_img.elemSize();
+    }
+    images_gpu_[thread_id]->safe_reserve(images_size);
+    warps_gpu_[thread_id]->safe_reserve(warps.size() * sizeof(WindowWarp));
+    cudaStream_t stream = Caffe::thread_stream();
+    uint8_t* images_gpu = static_cast<uint8_t*>(images_gpu_[thread_id]->data());
+    for (const auto& image : images) {
+      const cv::Mat& cv_img = image.second.get();
+      CHECK(cv_img.isContinuous());
+      CUDA_CHECK(cudaMemcpyAsync(images_gpu + offsets[image.first], cv_img.data,
+          cv_img.total() * cv_img.elemSize(), cudaMemcpyHostToDevice, stream));
+    }
+    for (int item_id = 0; item_id < windows.size(); ++item_id) {
+      warps[item_id].image_offset =
+          offsets[(*windows[item_id])[WindowDataLayer<Ftype, Btype>::IMAGE_INDEX]];
+    }
+    CUDA_CHECK(cudaMemcpyAsync(warps_gpu_[thread_id]->data(), warps.data(),
+        warps.size() * sizeof(WindowWarp), cudaMemcpyHostToDevice, stream));
+    int mean_off = 0;
+    if (this->has_mean_file_) {
+      mean_off = (this->data_mean_.width() - crop_size) / 2;
+    }
+    window_warp_gpu(batch_size, data_shape_[1], crop_size,
+        static_cast<const WindowWarp*>(warps_gpu_[thread_id]->data()), images_gpu,
+        this->has_mean_file_ ? this->data_mean_.gpu_data() : nullptr,
+        this->data_mean_.height(), this->data_mean_.width(), mean_off,
+        this->has_mean_values_ ? this->mean_values_blob_.gpu_data() : nullptr,
+        this->layer_param_.window_data_param().scale(),
+        batch->data_->template mutable_gpu_data_c<Ftype>(false));
+#else
+    NO_GPU;
+#endif
+  } else {
+    Ftype* top_data = batch->data_->mutable_cpu_data<Ftype>();
+    const size_t item_size = batch->data_->offset(1);
+    vector<std::future<void>> warped(windows.size());
+    for (int item_id = 0; item_id < windows.size(); ++item_id) {
+      std::shared_future<cv::Mat> image =
+          images[(*windows[item_id])[WindowDataLayer<Ftype, Btype>::IMAGE_INDEX]];
+      const WindowWarp& warp = warps[item_id];
+      Ftype* out = top_data + item_id * item_size;
+      if (read_pool_) {
+        auto task = std::make_shared<std::packaged_task<void()>>(
+            [this, image, &warp, out]() { WarpCPU(image.get(), warp, out); });
+        warped[item_id] = task->get_future();
+        read_pool_->runTask([task]() { (*task)(); });
+      } else {
+        WarpCPU(image.get(), warp, out);
+      }
+    }
+    for (std::future<void>& done : warped) {
+      if (done.valid()) {
+        done.get();
       }
-      top_data_file.close();
-      #endif
-
-      item_id++;
     }
   }
+  trans_time += timer.MicroSeconds();
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
-  batch->set_id(this->batch_id(thread_id));
+  batch->set_id(batch_id);
 }
 
 INSTANTIATE_CLASS_CPU_FB(WindowDataLayer);
@@ -0,0 +1,102 @@
+#include <device_launch_parameters.h>
+
+#include "caffe/layers/window_data_layer.hpp"
+#include "caffe/util/gpu_math_functions.cuh"
+
+namespace caffe {
+
+__device__ __inline__ void store_warped(float v, float* out) {
+  *out = v;
+}
+
+__device__ __inline__ void store_warped(float v, double* out) {
+  *out = v;
+}
+
+__device__ __inline__ void store_warped(float v, __half* out) {
+  *out = float2half_clip(v);
+}
+
+// Bilinear interpolation with pixel centers at half integers, as cv::INTER_LINEAR
+__device__ __inline__ void source_coordinate(int dst, int dst_size, int src_size,
+    int* i0, int* i1, float* frac) {
+  float f = (dst + 0.5F) * src_size / dst_size - 0.5F;
+  f = fmaxf(f, 0.F);
+  int i = min(static_cast<int>(f), src_size - 1);
+  *i0 = i;
+  *i1 = min(i + 1, src_size - 1);
+  *frac = f - i;
+}
+
+// Device type written for Dtype
+template <typename Dtype>
+struct WarpOut {
+  typedef Dtype type;
+};
+
+template <>
+struct WarpOut<float16> {
+  typedef __half type;
+};
+
+template <typename T>
+__global__ void window_warp_kernel(int n, int channels, int crop_size,
+    const WindowWarp* warps, const uint8_t* images, const float* mean, int mean_height,
+    int mean_width, int mean_off, const float* mean_values, float scale, T* out) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const int w = index % crop_size;
+    const int h = (index / crop_size) % crop_size;
+    const int c = (index / (crop_size * crop_size)) % channels;
+    const WindowWarp& warp = warps[index / (crop_size * crop_size * channels)];
+    float value = 0.F;
+    const int y = h - warp.pad_h;
+    int x = w - warp.pad_w;
+    if (y >= 0 && y < warp.out_h && x >= 0 && x < warp.out_w) {
+      if (warp.mirror) {
+        x = warp.out_w - 1 - x;
+      }
+      int y0, y1, x0, x1;
+      float dy, dx;
+      source_coordinate(y, warp.out_h, warp.roi_h, &y0, &y1, &dy);
+      source_coordinate(x, warp.out_w, warp.roi_w, &x0, &x1, &dx);
+      const int stride = warp.image_cols * channels;
+      const uint8_t* roi = images + warp.image_offset + warp.roi_y * stride +
+          warp.roi_x * channels + c;
+      const float top = (1.F - dx) * roi[y0 * stride + x0 * channels] +
+          dx * roi[y0 * stride + x1 * channels];
+      const float bottom = (1.F - dx) * roi[y1 * stride + x0 * channels] +
+          dx * roi[y1 * stride + x1 * channels];
+      value = (1.F - dy) * top + dy * bottom;
+      if (mean != nullptr) {
+        value -= mean[(c * mean_height + h + mean_off) * mean_width + w + mean_off];
+      } else if (mean_values != nullptr) {
+        value -= mean_values[c];
+      }
+      value *= scale;
+    }
+    store_warped(value, out + index);
+  }
+}
+
+template <typename Dtype>
+void window_warp_gpu(int num, int channels, int crop_size, const WindowWarp* warps,
+    const uint8_t* images, const float* mean, int mean_height, int mean_width, int mean_off,
+    const float* mean_values, float scale, Dtype* out) {
+  const int n = num * channels * crop_size * crop_size;
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  window_warp_kernel<<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n,
+      channels, crop_size, warps, images, mean, mean_height, mean_width, mean_off,
+      mean_values, scale, reinterpret_cast<typename WarpOut<Dtype>::type*>(out));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+}
+
+template void window_warp_gpu<float>(int, int, int, const WindowWarp*, const uint8_t*,
+    const float*, int, int, int, const float*, float, float*);
+template void window_warp_gpu<double>(int, int, int, const WindowWarp*, const uint8_t*,
+    const float*, int, int, int, const float*, float, double*);
+template void window_warp_gpu<float16>(int, int, int, const WindowWarp*, const uint8_t*,
+    const float*, int, int, int, const float*, float, float16*);
+
+}  // namespace caffe
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "caffe/model_repository.hpp"
+#include "caffe/util/weight_file.hpp"
+
+namespace caffe {
+
+uint32_t WeightDeduplicator::Checksum(const Blob& blob) {
+  const int type = blob.data_type();
+  uint32_t crc = WeightFile::Checksum(&type, sizeof(type));
+  const vector<int>& shape = blob.shape();
+  if (!shape.empty()) {
+    crc = WeightFile::Checksum(&shape[0], shape.size() * sizeof(int), crc);
+  }
+  return WeightFile::Checksum(blob.current_data_memory(false),
+      blob.count() * tsize(blob.data_type()), crc);
+}
+
+bool WeightDeduplicator::Equal(const Blob& a, const Blob& b) {
+  return a.data_type() == b.data_type() && a.shape() == b.shape() &&
+      std::memcmp(a.current_data_memory(false), b.current_data_memory(false),
+          a.count() * tsize(a.data_type())) == 0;
+}
+
+size_t WeightDeduplicator::Deduplicate(const Net& net) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = blobs_.begin(); it != blobs_.end();) {
+    it = it->second.expired() ? blobs_.erase(it) : std::next(it);
+  }
+  size_t saved = 0UL;
+  for (const shared_ptr<Blob>& blob : net.learnable_params()) {
+    if (blob->count() == 0) {
+      continue;
+    }
+    const uint32_t crc = Checksum(*blob);
+    bool found = false;
+    auto range = blobs_.equal_range(crc);
+    for (auto it = range.first; it != range.second && !found; ++it) {
+      shared_ptr<Blob> seen = it->second.lock();
+      if (seen && seen != blob && Equal(*seen, *blob)) {
+        if (!blob->shares_data_with(*seen)) {
+          saved += blob->count() * tsize(blob->data_type());
+        }
+        blob->ShareData(*seen);
+        found = true;
+      }
+    }
+    // Still found when the net that loaded it first is gone
+    blobs_.emplace(crc, blob);
+  }
+  shared_bytes_ += saved;
+  LOG_IF(INFO, saved > 0UL) << "Weights of " << net.name() << " share " << saved
+      << " bytes with other nets";
+  return saved;
+}
+
+ModelRepository::ModelRepository(int device, size_t weight_budget)
+    : mode_(Caffe::mode()), device_(device), weight_budget_(weight_budget), uses_(0UL) {
+#ifndef CPU_ONLY
+  if (mode_ == Caffe::GPU && device_ < 0) {
+    device_ = Caffe::current_device();
+  }
+#endif
+  sharing_.weights = &weights_;
+}
+
+ModelRepository::~ModelRepository() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] {
+    for (const auto& entry : models_) {
+      if (entry.second.in_flight > 0) {
+        return false;
+      }
+    }
+    return true;
+  });
+  std::map<string, Model> models;
+  models.swap(models_);
+  lock.unlock();
+}
+
+void ModelRepository::Load(const string& name, const NetParameter& param,
+    const string& weights_file, int contexts, const vector<int>& batch_sizes) {
+  EngineSharing sharing;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const int slots = contexts * std::max<int>(1, batch_sizes.size());
+    while (sharing_.slots.size() < slots) {
+      shared_ptr<EngineSharing::Slot> slot = make_shared<EngineSharing::Slot>();
+#ifndef CPU_ONLY
+      if (mode_ == Caffe::GPU) {
+        const int current = Caffe::current_device();
+        CUDA_CHECK(cudaSetDevice(device_));
+        slot->workspace = make_shared<GPUMemory::Workspace>();
+        CUDA_CHECK(cudaSetDevice(current));
+      }
+#endif
+      sharing_.slots.push_back(slot);
+    }
+    sharing = sharing_;
+  }
+  shared_ptr<InferenceEngine> engine = make_shared<InferenceEngine>(param, weights_file,
+      contexts, device_, batch_sizes, sharing);
+  Unload(name);
+  std::lock_guard<std::mutex> lock(mutex_);
+  Model& model = models_[name];
+  model.engine = engine;
+  model.resident = true;
+  model.in_flight = 0;
+  model.last_use = 0UL;
+  // Weights are uploaded on demand
+  if (weight_budget_ > 0UL) {
+    Evict(name, &model);
+  }
+  LOG(INFO) << "ModelRepository: loaded " << name << ", " << models_.size() << " models, "
+      << sharing_.slots.size() << " workspace slots";
+}
+
+void ModelRepository::Unload(const string& name) {
+  shared_ptr<InferenceEngine> engine;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = models_.find(name);
+    if (it == models_.end()) {
+      return;
+    }
+    idle_.wait(lock, [this, &name] {
+      auto it = models_.find(name);
+      return it == models_.end() || it->second.in_flight == 0;
+    });
+    it = models_.find(name);
+    if (it == models_.end()) {
+      return;
+    }
+    engine = it->second.engine;
+    models_.erase(it);
+  }
+  // Joins the contexts outside the lock
+  engine.reset();
+}
+
+void ModelRepository::Infer(const string& name, const vector<Blob*>& inputs,
+    const vector<Blob*>& outputs) {
+  std::promise<void> done;
+  std::future<void> finished = done.get_future();
+  InferAsync(name, inputs, outputs, [&done]() { done.set_value(); });
+  finished.wait();
+}
+
+void ModelRepository::InferAsync(const string& name, const vector<Blob*>& inputs,
+    const vector<Blob*>& outputs, const std::function<void()>& done) {
+  shared_ptr<InferenceEngine> engine;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = models_.find(name);
+    CHECK(it != models_.end()) << "No model " << name;
+    Model& model = it->second;
+    MakeResident(name, &model);
+    ++model.in_flight;
+    engine = model.engine;
+  }
+  engine->InferAsync(inputs, outputs, [this, name, done]() {
+    done();
+    std::lock_guard<std::mutex> lock(mutex_);
+    --models_[name].in_flight;
+    idle_.notify_all();
+  });
+}
+
+vector<string> ModelRepository::models() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  vector<string> names;
+  for (const auto& entry : models_) {
+    names.push_back(entry.first);
+  }
+  return names;
+}
+
+const InferenceEngine& ModelRepository::engine(const string& name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = models_.find(name);
+  CHECK(it != models_.end()) << "No model " << name;
+  return *it->second.engine;
+}
+
+bool ModelRepository::resident(const string& name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = models_.find(name);
+  return it != models_.end() && it->second.resident;
+}
+
+size_t ModelRepository::resident_bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t bytes = 0UL;
+  for (const auto& weight : ResidentWeights()) {
+    bytes += weight.second;
+  }
+  return bytes;
+}
+
+std::map<const void*, size_t> ModelRepository::ResidentWeights() const {
+  std::map<const void*, size_t> weights;
+  for (const auto& entry : models_) {
+    if (!entry.second.resident) {
+      continue;
+    }
+    for (const shared_ptr<Blob>& blob : entry.second.engine->weights()) {
+      weights.emplace(blob->current_data_memory(false),
+          blob->count() * tsize(blob->data_type()));
+    }
+  }
+  return weights;
+}
+
+void ModelRepository::MakeResident(const string& name, Model* model) {
+  model->last_use = ++uses_;
+  if (model->resident) {
+    return;
+  }
+  model->resident = true;
+  if (mode_ != Caffe::GPU) {
+    return;
+  }
+#ifndef CPU_ONLY
+  if (weight_budget_ > 0UL) {
+    while (true) {
+      size_t bytes = 0UL;
+      for (const auto& weight : ResidentWeights()) {
+        bytes += weight.second;
+      }
+      if (bytes <= weight_budget_) {
+        break;
+      }
+      // Least recently used idle one
+      auto victim = models_.end();
+      for (auto it = models_.begin(); it != models_.end(); ++it) {
+        const Model& m = it->second;
+        if (&m != model && m.resident && m.in_flight == 0 &&
+            (victim == models_.end() || m.last_use < victim->second.last_use)) {
+          victim = it;
+        }
+      }
+      if (victim == models_.end()) {
+        LOG(WARNING) << "ModelRepository: " << bytes << " bytes of weights on the device "
+            << "are over the budget of " << weight_budget_ << ", all models are busy";
+        break;
+      }
+      Evict(victim->first, &victim->second);
+    }
+  }
+  // Idle, thus no context touches the weights
+  const int current = Caffe::current_device();
+  CUDA_CHECK(cudaSetDevice(device_));
+  for (const shared_ptr<Blob>& blob : model->engine->weights()) {
+    blob->current_data_memory(true);
+  }
+  CUDA_CHECK(cudaSetDevice(current));
+  DLOG(INFO) << "ModelRepository: " << name << " is resident";
+#endif
+}
+
+void ModelRepository::Evict(const string& name, Model* model) {
+  model->resident = false;
+  if (mode_ != Caffe::GPU) {
+    return;
+  }
+#ifndef CPU_ONLY
+  const std::map<const void*, size_t> keep = ResidentWeights();
+  const int current = Caffe::current_device();
+  CUDA_CHECK(cudaSetDevice(device_));
+  for (const shared_ptr<Blob>& blob : model->engine->weights()) {
+    // Syncs the host copy
+    if (keep.count(blob->current_data_memory(false)) == 0UL) {
+      blob->release_gpu_data();
+    }
+  }
+  CUDA_CHECK(cudaSetDevice(current));
+  DLOG(INFO) << "ModelRepository: weights of " << name << " left the device";
+#endif
+}
+
+}  // namespace caffe
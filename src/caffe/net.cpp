@@ -1,6 +1,18 @@
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <limits>
 #include <map>
+#include <mutex>
+#include <numeric>
 #include <set>
+#include <thread>
 #include <boost/thread.hpp>
 #include <caffe/util/signal_handler.h>
 #include <hdf5.h>
@@ -8,16 +20,33 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
+#include "caffe/layers/pointwise_layer.hpp"
 #include "caffe/parallel.hpp"
+#include "caffe/util/blob_monitor.hpp"
+#include "caffe/util/bucket_tuner.hpp"
 #include "caffe/util/hdf5.hpp"
+#include "caffe/util/host_memory_pool.hpp"
 #include "caffe/util/insert_splits.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/ipc_weights.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/nvtx.hpp"
+#include "caffe/util/proto_cache.hpp"
+#include "caffe/util/task_scheduler.hpp"
+#include "caffe/util/tensorrt_engine.hpp"
+#include "caffe/util/thread_profile.hpp"
 #include "caffe/util/upgrade_proto.hpp"
+#include "caffe/util/weight_file.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
 namespace caffe {
 
+static double now_us() {
+  return std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 constexpr int Net::END_OF_ITERATION;
 constexpr int Net::END_OF_TRAIN;
 
@@ -25,8 +54,10 @@ Net::Net(const NetParameter& param,
     size_t solver_rank,
     Flag* solver_init_flag,
     Flag* solver_iter0_flag,
-    const Net* root_net)
+    const Net* root_net,
+    const Net* trained_net)
     : root_net_(root_net),
+      trained_net_(trained_net),
       solver_(nullptr),
       solver_rank_(solver_rank),
       solver_init_flag_(solver_init_flag),
@@ -41,6 +72,7 @@ Net::Net(const string& param_file,
     Flag* solver_iter0_flag,
     const Net* root_net)
     : root_net_(root_net),
+      trained_net_(nullptr),
       solver_(nullptr),
       solver_rank_(solver_rank),
       solver_init_flag_(solver_init_flag),
@@ -53,8 +85,42 @@ Net::Net(const string& param_file,
 
 Net::~Net() {
 #ifndef CPU_ONLY
+  GPUMemory::RemoveOOMReport(this);
   learnable_space_[0].release();
   learnable_space_[1].release();
+  for (cudaEvent_t event : offload_events_) {
+    if (event != nullptr) {
+      cudaEventDestroy(event);
+    }
+  }
+  for (cudaEvent_t event : backward_events_) {
+    if (event != nullptr) {
+      cudaEventDestroy(event);
+    }
+  }
+  if (stream_ready_) {
+    // The host copies go before the blobs pointing at them
+    cudaStreamSynchronize(Caffe::th_stream_aux(Caffe::STREAM_ID_ASYNC_PUSH));
+    for (int k = 0; k < stream_buffers_; ++k) {
+      cudaEventDestroy(stream_loaded_[k]);
+      cudaEventDestroy(stream_freed_[k]);
+    }
+    for (StreamedLayer& sl : streamed_) {
+      for (Blob* blob : sl.blobs) {
+        blob->release_data();
+      }
+    }
+    if (stream_host_ != nullptr) {
+      cudaFreeHost(stream_host_);
+    }
+  }
+  for (int type_id = 0; type_id < 2; ++type_id) {
+    for (GradLayer& gl : grad_layers_[type_id]) {
+      cudaEventDestroy(gl.ready);
+      cudaEventDestroy(gl.updated);
+    }
+  }
+  ReleaseGraphs();
 #endif
 }
 
@@ -63,10 +129,22 @@ void Net::Init(const NetParameter& in_param) {
       << "root_net_ needs to be set for all non-root solvers";
   // Set phase from the state.
   phase_ = in_param.state().phase();
+  if (in_param.deterministic()) {
+    Caffe::set_deterministic(true);
+    if (!Caffe::root_seed_set()) {
+      Caffe::set_root_seed(Caffe::DETERMINISTIC_SEED);
+    }
+  }
   // Filter layers based on their include/exclude rules and
   // the current NetState.
   NetParameter filtered_param;
-  FilterNet(in_param, &filtered_param);
+  ProtoCache::Transform("FilterNet", in_param, &filtered_param, FilterNet);
+  FoldBatchNorm(&filtered_param);
+  FuseInnerProductActivation(&filtered_param);
+  FusePointwise(&filtered_param);
+  ApplyInt8Calibration(&filtered_param);
+  ApplyLayout(&filtered_param);
+  PartitionSpatially(&filtered_param);
   net_param_ = filtered_param;
   batch_per_solver_ = caffe::P2PSync::divide_batch_size(&filtered_param);
   LOG_IF(INFO, Caffe::root_solver())
@@ -75,12 +153,17 @@ void Net::Init(const NetParameter& in_param) {
   infer_count_ = 0UL;
   // Create a copy of filtered_param with splits added where necessary.
   NetParameter param;
-  InsertSplits(filtered_param, &param);
+  ProtoCache::Transform("InsertSplits", filtered_param, &param, InsertSplits);
+  MarkStorageViews(&param);
   // Basically, build all the layers and set up their connections.
   name_ = param.name();
   map<string, int> blob_name_to_idx;
   set<string> available_blobs;
 #ifndef CPU_ONLY
+  InitPipeline(param);
+  // Latest version of every blob and the stage writing it, see ConnectStage
+  vector<Blob*> stage_holder;
+  vector<int> stage_holder_stage;
   gpu_top_memory_data_use_ = gpu_top_memory_diff_use_ = 0UL;
   gpu_btm_memory_data_use_ = gpu_btm_memory_diff_use_ = 0UL;
   gpu_shr_memory_data_use_ = gpu_shr_memory_diff_use_ = 0UL;
@@ -115,9 +198,106 @@ void Net::Init(const NetParameter& in_param) {
     global_grad_scale_ = in_param.global_grad_scale();
   }
 
+  // NetParameter::setup_threads, serial with pipeline stages
+  unsigned int setup_threads = in_param.setup_threads();
+#ifndef CPU_ONLY
+  if (!stage_of_.empty()) {
+    setup_threads = 1U;
+  }
+#endif
+  // For non-root solvers, whether each layer is shared from root_net_.
+  vector<bool> share_from_root(param.layer_size(), false);
+  bool share_trained = trained_net_ != nullptr && FoldsLike(*trained_net_);
+#ifndef CPU_ONLY
+  share_trained = share_trained && stage_of_.empty();
+#endif
+  // After a layer is connected, set it up
+  auto setup_layer = [&](int layer_id) {
+    const LayerParameter& layer_param = param.layer(layer_id);
+    if (share_from_root[layer_id]) {
+      // Set up size of top blobs using root_net_
+      const vector<Blob*>& base_top = root_net_->top_vecs_[layer_id];
+      const vector<Blob*>& this_top = this->top_vecs_[layer_id];
+      for (int top_id = 0; top_id < base_top.size(); ++top_id) {
+        this_top[top_id]->ReshapeLike(*base_top[top_id]);
+        LOG(INFO) << "Created top blob " << top_id << " (shape: "
+            << this_top[top_id]->shape_string() <<  ") for shared layer "
+            << layer_param.name();
+      }
+#ifndef CPU_ONLY
+    } else if (!stage_of_.empty()) {
+      ConnectStage(layer_id, &stage_holder, &stage_holder_stage);
+      RunOnStage(stage_of_[layer_id], [&]() {
+        layers_[layer_id]->SetUp(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+      });
+#endif
+    } else {
+      if (share_trained) {
+        TakeTrainedBlobs(layer_id);
+      }
+      layers_[layer_id]->SetUp(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+    }
+    // Memory order of 4D tops, see NetParameter::layout. Splits pass theirs on.
+    if (layer_param.has_layout_param() || layer_param.type() == "Split") {
+      const Packing packing = layer_param.type() == "Split" ?
+          bottom_vecs_[layer_id][0]->packing() : layer_param.layout_param().packing();
+      for (Blob* top : top_vecs_[layer_id]) {
+        if (top->num_axes() == 4) {
+          top->set_packing(packing);
+        }
+      }
+    }
+  };
+  // Once set up, register its params and backward needs, in layer order
+  auto finish_layer = [&](int layer_id, bool need_backward) {
+    const LayerParameter& layer_param = param.layer(layer_id);
+    LayerBase* layer = layers_[layer_id].get();
+    LOG_IF(INFO, Caffe::root_solver())
+        << "Setting up " << layer_names_[layer_id];
+    for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
+      if (blob_loss_weights_.size() <= top_id_vecs_[layer_id][top_id]) {
+        blob_loss_weights_.resize(top_id_vecs_[layer_id][top_id] + 1, 0.F);
+      }
+      blob_loss_weights_[top_id_vecs_[layer_id][top_id]] = layer->loss(top_id);
+      LOG_IF(INFO, Caffe::root_solver())
+          << Phase_Name(phase_) << " Top shape for layer " << layer_id << " '"
+          << layer_names_[layer_id] << "' " <<  top_vecs_[layer_id][top_id]->shape_string();
+      if (layer->loss(top_id) != 0.F) {
+        LOG_IF(INFO, Caffe::root_solver())
+          << "    with loss weight " << layer->loss(top_id);
+      }
+#ifndef CPU_ONLY
+      gpu_top_memory_data_use_ += top_vecs_[layer_id][top_id]->gpu_memory_data_use();
+      gpu_top_memory_diff_use_ += top_vecs_[layer_id][top_id]->gpu_memory_diff_use();
+#endif
+    }
+    const int param_size = layer_param.param_size();
+    const int num_param_blobs = layers_[layer_id]->blobs().size();
+    CHECK_LE(param_size, num_param_blobs)
+        << "Too many params specified for layer " << layer_param.name();
+    ParamSpec default_param_spec;
+    for (int param_id = 0; param_id < num_param_blobs; ++param_id) {
+      const ParamSpec* param_spec = (param_id < param_size) ?
+          &layer_param.param(param_id) : &default_param_spec;
+      const bool param_need_backward = param_spec->lr_mult() != 0;
+      need_backward |= param_need_backward;
+      layers_[layer_id]->set_param_propagate_down(param_id,
+                                                  param_need_backward);
+    }
+    for (int param_id = 0; param_id < num_param_blobs; ++param_id) {
+      AppendParam(param, layer_id, param_id);
+    }
+    // Finally, set the backward flag
+    layer_need_backward_.push_back(need_backward);
+    if (need_backward) {
+      for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+        blob_need_backward_[top_id_vecs_[layer_id][top_id]] = true;
+      }
+    }
+  };
+
   for (int layer_id = 0; layer_id < param.layer_size(); ++layer_id) {
-    // For non-root solvers, whether this layer is shared from root_net_.
-    bool share_from_root = !Caffe::root_solver()
+    share_from_root[layer_id] = !Caffe::root_solver()
         && root_net_->layers_[layer_id]->ShareInParallel();
 
     const LayerParameter& layer_param = param.layer(layer_id);
@@ -168,6 +348,31 @@ void Net::Init(const NetParameter& in_param) {
       mutable_layer_param->mutable_convolution_param()->
           set_conv_algos_override(param.default_conv_algos_override());
     }
+    if (param.has_default_cudnn_algo_cache_file() && layer_param.has_convolution_param() &&
+        !layer_param.convolution_param().has_cudnn_algo_cache_file()) {
+      mutable_layer_param->mutable_convolution_param()->
+          set_cudnn_algo_cache_file(param.default_cudnn_algo_cache_file());
+    }
+    if (param.has_default_cudnn_algo_cache_file() && !layer_param.has_engine_cache_file() &&
+        ((layer_param.has_convolution_param() &&
+          layer_param.convolution_param().engine() == ConvolutionParameter_Engine_AUTO) ||
+         (layer_param.has_pooling_param() &&
+          layer_param.pooling_param().engine() == PoolingParameter_Engine_AUTO) ||
+         (layer_param.has_lrn_param() &&
+          layer_param.lrn_param().engine() == LRNParameter_Engine_AUTO))) {
+      mutable_layer_param->set_engine_cache_file(param.default_cudnn_algo_cache_file());
+    }
+    if (param.has_default_cudnn_workspace_arbitration() &&
+        layer_param.has_convolution_param() &&
+        !layer_param.convolution_param().has_cudnn_workspace_arbitration()) {
+      mutable_layer_param->mutable_convolution_param()->
+          set_cudnn_workspace_arbitration(param.default_cudnn_workspace_arbitration());
+    }
+    if (param.has_default_pad_channels() && layer_param.has_convolution_param() &&
+        !layer_param.convolution_param().has_pad_channels()) {
+      mutable_layer_param->mutable_convolution_param()->
+          set_pad_channels(param.default_pad_channels());
+    }
 
     // cuDNN math
     if (param.has_default_cudnn_math_override() &&
@@ -182,7 +387,7 @@ void Net::Init(const NetParameter& in_param) {
           << "propagate_down param must be specified "
           << "either 0 or bottom_size times ";
     }
-    if (share_from_root) {
+    if (share_from_root[layer_id]) {
       LOG(INFO) << "Sharing layer " << layer_param.name() << " from root net";
       layers_.push_back(root_net_->layers_[layer_id]);
       layers_[layer_id]->SetShared(true);
@@ -237,61 +442,29 @@ void Net::Init(const NetParameter& in_param) {
       layer_inititialized_flags_.push_back(layer_inititialized_flag);
     }
 
-    // After this layer is connected, set it up.
-    if (share_from_root) {
-      // Set up size of top blobs using root_net_
-      const vector<Blob*>& base_top = root_net_->top_vecs_[layer_id];
-      const vector<Blob*>& this_top = this->top_vecs_[layer_id];
-      for (int top_id = 0; top_id < base_top.size(); ++top_id) {
-        this_top[top_id]->ReshapeLike(*base_top[top_id]);
-        LOG(INFO) << "Created top blob " << top_id << " (shape: "
-            << this_top[top_id]->shape_string() <<  ") for shared layer "
-            << layer_param.name();
-      }
-    } else {
-      layers_[layer_id]->SetUp(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+    if (setup_threads > 1) {
+      continue;  // set up below, once all layers are connected
     }
-    LOG_IF(INFO, Caffe::root_solver())
-        << "Setting up " << layer_names_[layer_id];
-    for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
-      if (blob_loss_weights_.size() <= top_id_vecs_[layer_id][top_id]) {
-        blob_loss_weights_.resize(top_id_vecs_[layer_id][top_id] + 1, 0.F);
-      }
-      blob_loss_weights_[top_id_vecs_[layer_id][top_id]] = layer->loss(top_id);
-      LOG_IF(INFO, Caffe::root_solver())
-          << Phase_Name(phase_) << " Top shape for layer " << layer_id << " '"
-          << layer_names_[layer_id] << "' " <<  top_vecs_[layer_id][top_id]->shape_string();
-      if (layer->loss(top_id) != 0.F) {
-        LOG_IF(INFO, Caffe::root_solver())
-          << "    with loss weight " << layer->loss(top_id);
-      }
+    setup_layer(layer_id);
+    finish_layer(layer_id, need_backward);
+  }
+  if (setup_threads > 1) {
+    SetUpLayersConcurrently(setup_threads, share_from_root, setup_layer);
+    for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+      // Bottoms were connected before the layers producing them were set up
+      const LayerParameter& layer_param = param.layer(layer_id);
+      bool need_backward = false;
+      for (int bottom_id = 0; bottom_id < bottom_id_vecs_[layer_id].size(); ++bottom_id) {
+        const int blob_id = bottom_id_vecs_[layer_id][bottom_id];
+        need_backward |= blob_need_backward_[blob_id];
+        bottom_need_backward_[layer_id][bottom_id] = layer_param.propagate_down_size() > 0 ?
+            layer_param.propagate_down(bottom_id) : blob_need_backward_[blob_id];
 #ifndef CPU_ONLY
-      gpu_top_memory_data_use_ += top_vecs_[layer_id][top_id]->gpu_memory_data_use();
-      gpu_top_memory_diff_use_ += top_vecs_[layer_id][top_id]->gpu_memory_diff_use();
+        gpu_btm_memory_data_use_ += bottom_vecs_[layer_id][bottom_id]->gpu_memory_data_use();
+        gpu_btm_memory_diff_use_ += bottom_vecs_[layer_id][bottom_id]->gpu_memory_diff_use();
 #endif
-    }
-    const int param_size = layer_param.param_size();
-    const int num_param_blobs = layers_[layer_id]->blobs().size();
-    CHECK_LE(param_size, num_param_blobs)
-        << "Too many params specified for layer " << layer_param.name();
-    ParamSpec default_param_spec;
-    for (int param_id = 0; param_id < num_param_blobs; ++param_id) {
-      const ParamSpec* param_spec = (param_id < param_size) ?
-          &layer_param.param(param_id) : &default_param_spec;
-      const bool param_need_backward = param_spec->lr_mult() != 0;
-      need_backward |= param_need_backward;
-      layers_[layer_id]->set_param_propagate_down(param_id,
-                                                  param_need_backward);
-    }
-    for (int param_id = 0; param_id < num_param_blobs; ++param_id) {
-      AppendParam(param, layer_id, param_id);
-    }
-    // Finally, set the backward flag
-    layer_need_backward_.push_back(need_backward);
-    if (need_backward) {
-      for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
-        blob_need_backward_[top_id_vecs_[layer_id][top_id]] = true;
       }
+      finish_layer(layer_id, need_backward);
     }
   }
   // Go through the net backwards to determine which blobs contribute to the
@@ -364,57 +537,2504 @@ void Net::Init(const NetParameter& in_param) {
             blob_need_backward_[bottom_id_vecs_[layer_id][bottom_id]] ||
             bottom_need_backward_[layer_id][bottom_id];
       }
-      for (int param_id = 0; param_id < layers_[layer_id]->blobs().size();
-           ++param_id) {
-        layers_[layer_id]->set_param_propagate_down(param_id, true);
+      for (int param_id = 0; param_id < layers_[layer_id]->blobs().size();
+           ++param_id) {
+        layers_[layer_id]->set_param_propagate_down(param_id, true);
+      }
+    }
+  }
+  PruneBackward();
+  // In the end, all remaining blobs are considered output blobs.
+  for (set<string>::iterator it = available_blobs.begin();
+      it != available_blobs.end(); ++it) {
+    LOG_IF(INFO, Caffe::root_solver())
+        << "This network produces output " << *it;
+    net_output_blobs_.push_back(blobs_[blob_name_to_idx[*it]].get());
+    net_output_blob_indices_.push_back(blob_name_to_idx[*it]);
+  }
+  for (int blob_id = 0; blob_id < blob_names_.size(); ++blob_id) {
+    blob_names_index_[blob_names_[blob_id]] = blob_id;
+  }
+  for (int layer_id = 0; layer_id < layer_names_.size(); ++layer_id) {
+    layer_names_index_[layer_names_[layer_id]] = layer_id;
+  }
+  ShareWeights();
+
+  // invert param_layer_indices_ to give map of
+  // (level_id, local param_id) -> global param_id
+  for (int i = 0; i < param_layer_indices_.size(); ++i) {
+    layer_index_params_[param_layer_indices_[i]] = i;
+  }
+  // Gradients of shared params come from several layers
+  vector<int> param_users(learnable_params_.size(), 0);
+  for (int learnable_param_id : learnable_param_ids_) {
+    ++param_users[learnable_param_id];
+  }
+  sparse_rows_.assign(learnable_params_.size(), nullptr);
+  for (int i = 0; i < params_.size(); ++i) {
+    const int learnable_param_id = learnable_param_ids_[i];
+    if (param_owners_[i] < 0 && param_users[learnable_param_id] == 1) {
+      sparse_rows_[learnable_param_id] = layers_[param_layer_indices_[i].first]->sparse_rows(
+          param_layer_indices_[i].second);
+    }
+  }
+#ifndef CPU_ONLY
+  if (!stage_of_.empty()) {
+    FinishPipeline(stage_holder);
+  }
+#endif
+
+#ifndef CPU_ONLY
+  learnable_space_size_[0] = 0UL;
+  learnable_space_size_[1] = 0UL;
+  reduce_buckets_ = (size_t) in_param.reduce_buckets();
+  // Tuned bucket sizes would change how NCCL splits the reductions
+  reduce_buckets_tune_iters_ = Caffe::deterministic() ? 0 : in_param.reduce_buckets_tune_iters();
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Top memory (" << Phase_Name(phase_) << ") required for data: "
+      << gpu_top_memory_data_use_ << " diff: " << gpu_top_memory_diff_use_;
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Bottom memory (" << Phase_Name(phase_) << ") required for data: "
+      << gpu_btm_memory_data_use_ << " diff: " << gpu_btm_memory_diff_use_;
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Shared (in-place) memory (" << Phase_Name(phase_) << ") by data: "
+      << gpu_shr_memory_data_use_ << " diff: " << gpu_shr_memory_diff_use_;
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Parameters memory (" << Phase_Name(phase_) << ") required for data: "
+      << gpu_prm_memory_data_use_ << " diff: " << gpu_prm_memory_diff_use_;
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Parameters shared memory (" << Phase_Name(phase_) << ") by data: "
+          << gpu_shp_memory_data_use_ << " diff: " << gpu_shp_memory_diff_use_;
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Host memory in use by blob mirrors: " << SyncedMemory::total_host_memory_use();
+#ifndef CPU_ONLY
+  LOG_IF(INFO, Caffe::root_solver() && Caffe::mode() == Caffe::GPU)
+      << HostMemoryPool::stats_string();
+#endif
+  if (Caffe::mode() == Caffe::GPU) {
+    GPUMemory::AddOOMReport(this, Caffe::current_device(), [this]() {
+      return MemoryReportString();
+    });
+  }
+  if (param.plan_activation_memory()) {
+    PlanActivationMemory();
+  }
+  InitOffload(param);
+  InitStreamWeights(param);
+#endif
+  InitRecomputation(param);
+#ifndef CPU_ONLY
+  InitCudaGraph(param);
+  InitBranches(param);
+  InitBlobMonitor(param);
+  InitTensorRT(param);
+#endif
+  InitOverwriteParamDiffs();
+  debug_info_ = param.debug_info();
+  trained_layers_shared_ = false;
+  if (share_trained) {
+    // Layers which made their own blobs anyway
+    ShareTrainedLayersWith(trained_net_);
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << "Network initialization done.";
+}
+
+void Net::InitOverwriteParamDiffs() {
+  overwrite_layers_.clear();
+  all_param_diffs_overwritten_ = false;
+  // Pipeline stages keep their gradients apart and accumulate micro-batches themselves
+  if (phase_ != TRAIN || !stage_of_.empty()) {
+    return;
+  }
+  vector<int> users(params_.size(), 0);
+  for (int i = 0; i < params_.size(); ++i) {
+    ++users[param_owners_[i] < 0 ? i : param_owners_[i]];
+  }
+  int overwritten = 0;
+  for (int i = 0; i < layers_.size(); ++i) {
+    const int num_blobs = layers_[i]->blobs().size();
+    if (num_blobs == 0 || !layer_need_backward_[i] ||
+        !layers_[i]->can_overwrite_param_diffs()) {
+      continue;
+    }
+    bool sole_user = true;
+    for (int j = 0; j < num_blobs; ++j) {
+      const int param_id = layer_index_params_[make_pair(i, j)];
+      sole_user = sole_user && param_owners_[param_id] < 0 && users[param_id] == 1;
+    }
+    if (!sole_user) {
+      continue;
+    }
+    overwrite_layers_.push_back(i);
+    for (int j = 0; j < num_blobs; ++j) {
+      if (layers_[i]->param_propagate_down(j)) {
+        ++overwritten;
+      }
+    }
+  }
+  all_param_diffs_overwritten_ = overwritten == learnable_params_.size();
+  LOG_IF(INFO, Caffe::root_solver() && !overwrite_layers_.empty())
+      << overwrite_layers_.size() << " layers write " << overwritten << " of "
+      << learnable_params_.size() << " param gradients on the first micro-batch";
+}
+
+void Net::PruneBackward() {
+  const int num_layers = layers_.size();
+  backward_end_ = num_layers;
+  // Diffs are read as top gradients and loss weights, written as bottom gradients
+  std::set<Blob*> diff_used, diff_unused;
+  for (int i = 0; i < num_layers; ++i) {
+    if (layer_need_backward_[i]) {
+      backward_end_ = std::min(backward_end_, i);
+    }
+    for (int j = 0; j < top_vecs_[i].size(); ++j) {
+      if (layer_need_backward_[i] || layers_[i]->loss(j) != 0.F) {
+        diff_used.insert(top_vecs_[i][j]);
+      } else {
+        diff_unused.insert(top_vecs_[i][j]);
+      }
+    }
+    for (int j = 0; j < bottom_vecs_[i].size(); ++j) {
+      if (layer_need_backward_[i] && bottom_need_backward_[i][j]) {
+        diff_used.insert(bottom_vecs_[i][j]);
+      } else {
+        diff_unused.insert(bottom_vecs_[i][j]);
+      }
+    }
+  }
+  size_t unused_bytes = 0UL;
+  int unused_blobs = 0;
+  for (Blob* blob : diff_unused) {
+    if (diff_used.count(blob) > 0 || std::any_of(diff_used.begin(), diff_used.end(),
+        [blob](const Blob* used) { return blob->shares_diff_with(*used); })) {
+      continue;
+    }
+    // Layers may have set it up, no pass touches it again
+    if (!blob->is_diff_empty()) {
+      blob->release_diff();
+    }
+    unused_bytes += blob->count() * tsize(blob->diff_type());
+    ++unused_blobs;
+  }
+  if (phase_ == TRAIN && backward_end_ > 0) {
+    LOG_IF(INFO, Caffe::root_solver()) << "Backward stops at layer " << backward_end_
+        << (backward_end_ < num_layers ? " (" + layer_names_[backward_end_] + ")" : "")
+        << ", " << backward_end_ << " frozen layers skipped, diffs of " << unused_blobs
+        << " blobs (" << unused_bytes << " bytes) not allocated";
+  }
+}
+
+void Net::ActivationLifetimes(vector<int>* group, vector<int>* first, vector<int>* last,
+    vector<bool>* pinned) const {
+  const int num_blobs = blobs_.size();
+  // Blobs sharing data (split, flatten, reshape etc.) make one buffer
+  // owned by the first of them
+  group->resize(num_blobs);
+  for (int i = 0; i < num_blobs; ++i) {
+    (*group)[i] = i;
+    for (int j = 0; j < i; ++j) {
+      if (blobs_[i]->shares_data_with(*blobs_[j])) {
+        (*group)[i] = (*group)[j];
+        break;
+      }
+    }
+  }
+  // Lifetime of a buffer is the range of layers reading or writing it
+  first->assign(num_blobs, INT_MAX);
+  last->assign(num_blobs, -1);
+  pinned->assign(num_blobs, false);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    // Data layers swap their tops with prefetched batches
+    const bool source = bottom_vecs_[layer_id].empty();
+    for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+      const int g = (*group)[top_id_vecs_[layer_id][top_id]];
+      (*first)[g] = std::min((*first)[g], layer_id);
+      (*last)[g] = std::max((*last)[g], layer_id);
+      if (source || layers_[layer_id]->loss(top_id) != 0.F) {
+        (*pinned)[g] = true;
+      }
+    }
+    for (int bottom_id : bottom_id_vecs_[layer_id]) {
+      const int g = (*group)[bottom_id];
+      (*first)[g] = std::min((*first)[g], layer_id);
+      (*last)[g] = std::max((*last)[g], layer_id);
+    }
+  }
+  // Storage of sharing Concat and Slice layers is one block, see MarkStorageViews
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const LayerParameter& param = layers_[layer_id]->layer_param();
+    if (param.concat_param().share_storage() || param.slice_param().share_storage()) {
+      for (int blob_id : bottom_id_vecs_[layer_id]) {
+        (*pinned)[(*group)[blob_id]] = true;
+      }
+      for (int blob_id : top_id_vecs_[layer_id]) {
+        (*pinned)[(*group)[blob_id]] = true;
+      }
+    }
+  }
+  for (int blob_id : net_input_blob_indices_) {
+    (*pinned)[(*group)[blob_id]] = true;
+  }
+  for (int blob_id : net_output_blob_indices_) {
+    (*pinned)[(*group)[blob_id]] = true;
+  }
+}
+
+void Net::InitRecomputation(const NetParameter& param) {
+  recompute_ = param.recompute_activations() && phase_ == TRAIN;
+  if (!recompute_) {
+    return;
+  }
+  const int num_layers = layers_.size();
+  const int num_blobs = blobs_.size();
+  segment_of_.resize(num_layers);
+  bool marked = false;
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    marked = marked || param.layer(layer_id).checkpoint();
+  }
+  const int auto_segments = std::max(1, (int) std::lround(std::sqrt(num_layers)));
+  const int seg_len = (num_layers + auto_segments - 1) / auto_segments;
+  for (int layer_id = 0, segment = 0; layer_id < num_layers; ++layer_id) {
+    segment_of_[layer_id] = marked ? segment : layer_id / seg_len;
+    if (param.layer(layer_id).checkpoint()) {
+      ++segment;
+    }
+  }
+  const int segments = segment_of_.back() + 1;
+  segment_first_.assign(segments, INT_MAX);
+  segment_last_.assign(segments, -1);
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    const int s = segment_of_[layer_id];
+    segment_first_[s] = std::min(segment_first_[s], layer_id);
+    segment_last_[s] = std::max(segment_last_[s], layer_id);
+  }
+  vector<int> group, first, last;
+  vector<bool> pinned;
+  ActivationLifetimes(&group, &first, &last, &pinned);
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    // Recomputed random masks wouldn't match the first pass
+    if (strcmp(layers_[layer_id]->type(), "Dropout") == 0) {
+      for (int blob_id : top_id_vecs_[layer_id]) {
+        pinned[group[blob_id]] = true;
+      }
+    }
+  }
+  // Buffers not crossing segment borders are released, except the last segment's
+  // since its backward follows at once
+  vector<bool> released(num_blobs, false);
+  segment_blobs_.assign(segments, vector<int>());
+  segment_layers_.assign(segments, vector<int>());
+  segment_released_.assign(segments, false);
+  size_t total_bytes = 0UL, released_bytes = 0UL, peak_segment_bytes = 0UL;
+  vector<size_t> segment_bytes(segments, 0UL);
+  for (int g = 0; g < num_blobs; ++g) {
+    if (group[g] != g || last[g] < 0) {
+      continue;
+    }
+    total_bytes += blobs_[g]->sizeof_data();
+    const int s = segment_of_[first[g]];
+    if (pinned[g] || s != segment_of_[last[g]] || s == segments - 1) {
+      continue;
+    }
+    released[g] = true;
+    segment_blobs_[s].push_back(g);
+    segment_bytes[s] += blobs_[g]->sizeof_data();
+    released_bytes += blobs_[g]->sizeof_data();
+    peak_segment_bytes = std::max(peak_segment_bytes, segment_bytes[s]);
+  }
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    for (int blob_id : top_id_vecs_[layer_id]) {
+      if (released[group[blob_id]]) {
+        segment_layers_[segment_of_[layer_id]].push_back(layer_id);
+        break;
+      }
+    }
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << "Activation recomputation in " << segments
+      << " segments" << (marked ? " ending at checkpoints" : "") << ": " << released_bytes
+      << " of " << total_bytes << " activation bytes are released after forward, "
+      << "largest segment recomputes " << peak_segment_bytes;
+}
+
+void Net::ReleaseSegment(int segment) {
+  for (int g : segment_blobs_[segment]) {
+    blobs_[g]->release_data();
+  }
+  segment_released_[segment] = !segment_blobs_[segment].empty();
+}
+
+void Net::RecomputeSegment(int segment) {
+  Reforward(segment_layers_[segment]);
+  segment_released_[segment] = false;
+}
+
+void Net::Reforward(const vector<int>& layer_ids) {
+  // Forward of some layers (like BatchNorm) updates their non-learnable blobs,
+  // the second pass must not update them again
+  vector<shared_ptr<TBlob<float>>> saved;
+  for (int layer_id : layer_ids) {
+    const vector<shared_ptr<Blob>>& layer_blobs = layers_[layer_id]->blobs();
+    for (int j = 0; j < layer_blobs.size(); ++j) {
+      if (!layers_[layer_id]->param_propagate_down(j)) {
+        saved.push_back(make_shared<TBlob<float>>());
+        saved.back()->CopyFrom(*layer_blobs[j], false, true);
+      }
+    }
+  }
+  for (int layer_id : layer_ids) {
+    layers_[layer_id]->Forward(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+  }
+  size_t k = 0UL;
+  for (int layer_id : layer_ids) {
+    const vector<shared_ptr<Blob>>& layer_blobs = layers_[layer_id]->blobs();
+    for (int j = 0; j < layer_blobs.size(); ++j) {
+      if (!layers_[layer_id]->param_propagate_down(j)) {
+        layer_blobs[j]->CopyFrom(*saved[k++]);
+      }
+    }
+  }
+}
+
+#ifndef CPU_ONLY
+void Net::SetUpLayersConcurrently(unsigned int threads, const vector<bool>& share_from_root,
+    const std::function<void(int)>& setup_layer) {
+  const int num_layers = layers_.size();
+  vector<vector<int>> deps(num_layers);
+  vector<bool> caller_only(num_layers, false);
+  // Last layer writing every blob, as in InitBranches
+  vector<int> writer(blobs_.size(), -1);
+  for (int i = 0; i < num_layers; ++i) {
+    std::set<int> layer_deps;
+    for (int blob_id : bottom_id_vecs_[i]) {
+      if (writer[blob_id] >= 0) {
+        layer_deps.insert(writer[blob_id]);
+      }
+    }
+    for (int blob_id : top_id_vecs_[i]) {
+      writer[blob_id] = i;
+    }
+    deps[i].assign(layer_deps.begin(), layer_deps.end());
+    // Data layers start their threads from the solver thread's context
+    caller_only[i] = bottom_id_vecs_[i].empty() || share_from_root[i] ||
+        strcmp(layers_[i]->type(), "Python") == 0;
+  }
+  // Fillers draw from a stream per layer, seeded in layer order, as long as a seed is set
+  const bool seeded = Caffe::root_seed_set();
+  vector<uint64_t> seeds(num_layers + 1, Caffe::SEED_NOT_SET);
+  if (seeded) {
+    for (uint64_t& seed : seeds) {
+      seed = Caffe::next_seed();
+    }
+  }
+  const Caffe::Brew mode = Caffe::mode();
+  const int device = Caffe::current_device();
+  const int solver_count = Caffe::solver_count();
+  const bool root_solver = Caffe::root_solver();
+  const double start = now_us();
+  {
+    DagExecutor executor(threads - 1, [mode, device, solver_count, root_solver]() {
+#ifndef CPU_ONLY
+      if (mode == Caffe::GPU) {
+        CUDA_CHECK(cudaSetDevice(device));
+        GPUMemory::own_thread_workspace();
+      }
+#endif
+      Caffe::set_mode(mode);
+      Caffe::set_solver_count(solver_count);
+      Caffe::set_root_solver(root_solver);
+    });
+    executor.Run(deps, caller_only, [&](int i) {
+      if (seeded) {
+        Caffe::set_random_seed(seeds[i]);
+      }
+      setup_layer(i);
+#ifndef CPU_ONLY
+      if (Caffe::mode() == Caffe::GPU) {
+        // Helpers' fills and copies are done before other threads read the blobs
+        CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+      }
+#endif
+    });
+  }
+  if (seeded) {
+    Caffe::set_random_seed(seeds[num_layers]);
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << "Set up " << num_layers << " layers on up to "
+      << threads << " threads in " << (now_us() - start) * 1e-6 << " s";
+}
+
+void Net::InitBranches(const NetParameter& param) {
+  branch_streams_ = Caffe::mode() == Caffe::GPU ? param.branch_streams() : 0U;
+  branch_backward_ = false;
+  branch_executor_.reset();
+  if (branch_streams_ < 2U) {
+    branch_streams_ = 0U;
+    return;
+  }
+  if (cuda_graph_ || offload_ || recompute_ || param.plan_activation_memory() ||
+      GPUMemory::managed()) {
+    LOG(WARNING) << "branch_streams can't be combined with CUDA graphs, activation offload, "
+                 << "recomputation, activation memory planning or managed memory, ignored";
+    branch_streams_ = 0U;
+    return;
+  }
+  const int num_layers = layers_.size();
+  forward_deps_.assign(num_layers, vector<int>());
+  backward_deps_.assign(num_layers, vector<int>());
+  branch_caller_only_.assign(num_layers, false);
+  // Last layer writing every blob
+  vector<int> writer(blobs_.size(), -1);
+  int independent = 0;
+  for (int i = 0; i < num_layers; ++i) {
+    std::set<int> deps;
+    for (int blob_id : bottom_id_vecs_[i]) {
+      if (writer[blob_id] >= 0) {
+        deps.insert(writer[blob_id]);
+      }
+    }
+    for (int blob_id : top_id_vecs_[i]) {
+      writer[blob_id] = i;
+    }
+    forward_deps_[i].assign(deps.begin(), deps.end());
+    for (int dep : deps) {
+      backward_deps_[dep].push_back(i);
+    }
+    // Data and Python layers keep the solver thread's context, Python ones making their
+    // calls on the PythonParameter::executor needn't
+    branch_caller_only_[i] = bottom_id_vecs_[i].empty() || layers_[i]->ShareInParallel() ||
+        (strcmp(layers_[i]->type(), "Python") == 0 &&
+         !layers_[i]->layer_param().python_param().executor());
+    if (i > 0 && deps.count(i - 1) == 0 && !branch_caller_only_[i]) {
+      ++independent;
+    }
+  }
+  if (independent == 0) {
+    LOG_IF(INFO, Caffe::root_solver()) << "branch_streams: no independent branches, ignored";
+    branch_streams_ = 0U;
+    return;
+  }
+  // Layers sharing parameters would accumulate their gradients concurrently
+  branch_backward_ = std::all_of(param_owners_.begin(), param_owners_.end(),
+      [](int owner) { return owner < 0; });
+  LOG_IF(INFO, Caffe::root_solver()) << "branch_streams: " << independent
+      << " layers start a branch, running them on up to " << branch_streams_ << " streams"
+      << (branch_backward_ ? "" : ", backward stays serial because of shared parameters");
+}
+
+bool Net::branches_ready() const {
+  return branch_streams_ > 1U && infer_count_ >= BRANCH_WARMUP_ITERS &&
+      Caffe::mode() == Caffe::GPU && !debug_info_;
+}
+
+DagExecutor* Net::branch_executor() {
+  if (!branch_executor_) {
+    const int device = Caffe::current_device();
+    const int solver_count = Caffe::solver_count();
+    branch_executor_ = make_shared<DagExecutor>(branch_streams_ - 1, [device, solver_count]() {
+      // Own Caffe context, thus own stream and handles
+      CUDA_CHECK(cudaSetDevice(device));
+      Caffe::set_mode(Caffe::GPU);
+      Caffe::set_solver_count(solver_count);
+      Caffe::set_root_solver(false);
+      GPUMemory::own_thread_workspace();
+    });
+  }
+  return branch_executor_.get();
+}
+
+// Layers synchronize their streams when done, so a layer finished on the host is
+// finished on the device, no events needed where branches join
+float Net::ForwardBranches() {
+  float loss = 0.F;
+  std::mutex loss_mutex;
+  branch_executor()->Run(forward_deps_, branch_caller_only_, [&](int i) {
+    const float layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i], loss_slot_);
+    if (layer_loss != 0.F) {
+      std::lock_guard<std::mutex> lock(loss_mutex);
+      loss += layer_loss;
+    }
+  });
+  return loss;
+}
+
+void Net::BackwardBranches(bool apply_update) {
+  branch_executor()->Run(backward_deps_, branch_caller_only_, [this, apply_update](int i) {
+    if (!layer_need_backward_[i]) {
+      return;
+    }
+    layers_[i]->Backward(top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+#ifndef CPU_ONLY
+    AccumulateGradients(i);
+#endif
+    if (apply_update) {
+      GradientsReady(i);
+    }
+  });
+  if (apply_update) {
+    for (int type_id = 0; type_id < learnable_types_.size(); ++type_id) {
+      reduction_queue_[type_id].push(END_OF_ITERATION);
+    }
+  }
+}
+
+void Net::InitBlobMonitor(const NetParameter& param) {
+  if (!param.has_blob_monitor() || param.blob_monitor().interval() == 0U ||
+      Caffe::mode() != Caffe::GPU || !stage_of_.empty()) {
+    return;
+  }
+  blob_monitor_ = make_shared<BlobMonitor>(param.blob_monitor());
+  // Planned, offloaded and recomputed tops hold something else by the end of the
+  // iteration
+  if (activation_offsets_.empty() && !offload_ && !recompute_) {
+    for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+      for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
+        const int blob_id = top_id_vecs_[layer_id][top_id];
+        if (std::find(bottom_id_vecs_[layer_id].begin(), bottom_id_vecs_[layer_id].end(),
+            blob_id) != bottom_id_vecs_[layer_id].end()) {
+          continue;  // in place, already watched as a top of the layer producing it
+        }
+        blob_monitor_->Add(blob_names_[blob_id], top_vecs_[layer_id][top_id], false);
+      }
+    }
+  }
+  for (int i = 0; i < params_.size(); ++i) {
+    if (param_owners_[i] >= 0) {
+      continue;
+    }
+    const Blob* blob = learnable_params_[learnable_param_ids_[i]].get();
+    blob_monitor_->Add(param_display_names_[i], blob, false);
+    blob_monitor_->Add(param_display_names_[i], blob, true);
+  }
+}
+
+void Net::InitPipeline(const NetParameter& param) {
+  stage_of_.clear();
+  stage_first_.clear();
+  stage_last_.clear();
+  boundaries_.clear();
+  stage_workers_.clear();
+  const int stages = param.pipeline_device_size();
+  if (stages < 2 || Caffe::mode() != Caffe::GPU) {
+    return;
+  }
+  CHECK_EQ(Caffe::solver_count(), 1) << "pipeline_device can't be combined with data parallelism";
+  CHECK(!param.cuda_graph() && param.branch_streams() < 2U && !param.offload_activations() &&
+      !param.recompute_activations() && !param.plan_activation_memory() &&
+      !GPUMemory::managed())
+      << "pipeline_device can't be combined with CUDA graphs, branch streams, activation "
+      << "offload, recomputation, activation memory planning or managed memory";
+  CHECK_EQ(param.pipeline_device(0), Caffe::current_device())
+      << "The first pipeline stage runs on the device the net is created on";
+  const int num_layers = param.layer_size();
+  bool marked = false;
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    marked = marked || param.layer(layer_id).pipeline_stage() >= 0;
+  }
+  if (marked) {
+    stage_of_.resize(num_layers);
+    for (int layer_id = 0, stage = 0; layer_id < num_layers; ++layer_id) {
+      const LayerParameter& layer_param = param.layer(layer_id);
+      if (layer_param.pipeline_stage() >= 0) {
+        CHECK_GE(layer_param.pipeline_stage(), stage) << "Layer " << layer_param.name()
+            << ": pipeline stages can't decrease";
+        CHECK_LT(layer_param.pipeline_stage(), stages) << "Layer " << layer_param.name()
+            << ": no pipeline_device for stage " << layer_param.pipeline_stage();
+        stage = layer_param.pipeline_stage();
+      }
+      stage_of_[layer_id] = stage;
+    }
+  } else {
+    CHECK(!param.pipeline_profile().empty())
+        << "pipeline_device needs layers marked by pipeline_stage or a pipeline_profile";
+    LayerProfile profile;
+    ReadProtoFromTextFileOrDie(param.pipeline_profile(), &profile);
+    stage_of_ = BalanceStages(param, profile);
+  }
+  stage_first_.assign(stages, -1);
+  stage_last_.assign(stages, -1);
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    const int stage = stage_of_[layer_id];
+    if (stage_first_[stage] < 0) {
+      stage_first_[stage] = layer_id;
+    }
+    stage_last_[stage] = layer_id;
+    // Data and Python layers keep the solver thread's context
+    const LayerParameter& layer_param = param.layer(layer_id);
+    CHECK(stage == 0 || (layer_param.bottom_size() > 0 && layer_param.type() != "Python"))
+        << "Layer " << layer_param.name() << " has to be in the first pipeline stage";
+  }
+  for (int stage = 0; stage < stages; ++stage) {
+    CHECK_GE(stage_first_[stage], 0) << "Pipeline stage " << stage << " has no layers";
+  }
+  pipeline_devices_.assign(param.pipeline_device().begin(), param.pipeline_device().end());
+  const vector<int> devices = pipeline_devices_;
+  auto enable_peers = [devices](int device) {
+    for (int peer : devices) {
+      int can_access = 0;
+      if (peer != device) {
+        CUDA_CHECK(cudaDeviceCanAccessPeer(&can_access, device, peer));
+      }
+      if (can_access && cudaDeviceEnablePeerAccess(peer, 0) != cudaSuccess) {
+        cudaGetLastError();  // already enabled
+      }
+    }
+  };
+  enable_peers(devices[0]);
+  const bool root_solver = Caffe::root_solver();
+  for (int stage = 1; stage < stages; ++stage) {
+    const int device = devices[stage];
+    stage_workers_.push_back(make_shared<DeviceWorker>([device, root_solver, enable_peers]() {
+      // Own Caffe context on the stage's device
+      CUDA_CHECK(cudaSetDevice(device));
+      Caffe::set_mode(Caffe::GPU);
+      Caffe::set_solver_count(1);
+      Caffe::set_root_solver(root_solver);
+      GPUMemory::own_thread_workspace();
+      enable_peers(device);
+    }));
+  }
+  for (int stage = 0; stage < stages; ++stage) {
+    LOG_IF(INFO, Caffe::root_solver()) << "Pipeline stage " << stage << " on device "
+        << devices[stage] << ": layers " << param.layer(stage_first_[stage]).name()
+        << " to " << param.layer(stage_last_[stage]).name();
+  }
+}
+
+vector<int> Net::BalanceStages(const NetParameter& param, const LayerProfile& profile) const {
+  std::map<string, double> layer_ms;
+  for (const LayerProfile::Entry& entry : profile.entry()) {
+    layer_ms[entry.layer()] = entry.forward_ms() + entry.backward_ms();
+  }
+  const int num_layers = param.layer_size();
+  const int stages = param.pipeline_device_size();
+  // Time of layers [0, i), layers before first_free stay in the first stage.
+  // Layers missing in the profile (like inserted splits) take no time.
+  vector<double> prefix(num_layers + 1, 0.);
+  int first_free = 1;
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    const LayerParameter& layer_param = param.layer(layer_id);
+    auto it = layer_ms.find(layer_param.name());
+    prefix[layer_id + 1] = prefix[layer_id] + (it == layer_ms.end() ? 0. : it->second);
+    if (layer_param.bottom_size() == 0 || layer_param.type() == "Python") {
+      first_free = layer_id + 1;
+    }
+  }
+  CHECK_LE(first_free + stages - 1, num_layers) << "Too few layers for "
+      << stages << " pipeline stages";
+  // slowest[s][i]: least time of the slowest stage putting layers [0, i) to
+  // stages [0, s], the last of them starting at start[s][i]
+  const double inf = std::numeric_limits<double>::infinity();
+  vector<vector<double>> slowest(stages, vector<double>(num_layers + 1, inf));
+  vector<vector<int>> start(stages, vector<int>(num_layers + 1, 0));
+  for (int i = first_free; i <= num_layers; ++i) {
+    slowest[0][i] = prefix[i];
+  }
+  for (int s = 1; s < stages; ++s) {
+    for (int i = s + 1; i <= num_layers; ++i) {
+      for (int j = s; j < i; ++j) {
+        const double t = std::max(slowest[s - 1][j], prefix[i] - prefix[j]);
+        if (t < slowest[s][i]) {
+          slowest[s][i] = t;
+          start[s][i] = j;
+        }
+      }
+    }
+  }
+  vector<int> stage_of(num_layers);
+  for (int s = stages - 1, end = num_layers; s >= 0; --s) {
+    const int begin = s > 0 ? start[s][end] : 0;
+    std::fill(stage_of.begin() + begin, stage_of.begin() + end, s);
+    end = begin;
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << "pipeline_profile: " << prefix[num_layers]
+      << " ms per batch, " << slowest[stages - 1][num_layers] << " ms in the slowest stage";
+  return stage_of;
+}
+
+void Net::ConnectStage(int layer_id, vector<Blob*>* holder, vector<int>* holder_stage) {
+  const int stage = stage_of_[layer_id];
+  for (int blob_id = holder->size(); blob_id < blobs_.size(); ++blob_id) {
+    holder->push_back(blobs_[blob_id].get());
+    holder_stage->push_back(stage);
+  }
+  vector<Blob*>& bottoms = bottom_vecs_[layer_id];
+  for (int k = 0; k < bottoms.size(); ++k) {
+    const int blob_id = bottom_id_vecs_[layer_id][k];
+    Blob* src = (*holder)[blob_id];
+    if ((*holder_stage)[blob_id] == stage) {
+      bottoms[k] = src;
+      continue;
+    }
+    auto it = std::find_if(boundaries_.begin(), boundaries_.end(),
+        [src, stage](const StageBoundary& b) { return b.src == src && b.dst_stage == stage; });
+    if (it == boundaries_.end()) {
+      StageBoundary b;
+      b.blob_id = blob_id;
+      b.src = src;
+      b.dst = Blob::create(src->data_type(), src->diff_type());
+      b.dst->ReshapeLike(*src);
+      b.src_stage = (*holder_stage)[blob_id];
+      b.dst_stage = stage;
+      LOG_IF(INFO, Caffe::root_solver()) << "Pipeline stage " << b.src_stage << " -> "
+          << b.dst_stage << ": " << blob_names_[blob_id];
+      it = boundaries_.insert(boundaries_.end(), b);
+    }
+    bottoms[k] = it->dst.get();
+  }
+  for (int t = 0; t < top_vecs_[layer_id].size(); ++t) {
+    const int blob_id = top_id_vecs_[layer_id][t];
+    for (int k = 0; k < bottoms.size(); ++k) {
+      if (bottom_id_vecs_[layer_id][k] == blob_id) {
+        top_vecs_[layer_id][t] = bottoms[k];  // in place
+      }
+    }
+    (*holder)[blob_id] = top_vecs_[layer_id][t];
+    (*holder_stage)[blob_id] = stage;
+  }
+}
+
+void Net::FinishPipeline(const vector<Blob*>& holder) {
+  for (int i = 0; i < net_output_blobs_.size(); ++i) {
+    net_output_blobs_[i] = holder[net_output_blob_indices_[i]];
+  }
+  const int stages = stage_first_.size();
+  stage_inputs_.assign(stages, vector<Blob*>());
+  for (const StageBoundary& b : boundaries_) {
+    stage_inputs_[b.dst_stage].push_back(b.dst.get());
+  }
+  for (int i = stage_first_[0]; i <= stage_last_[0]; ++i) {
+    if (bottom_vecs_[i].empty()) {
+      stage_inputs_[0].insert(stage_inputs_[0].end(), top_vecs_[i].begin(), top_vecs_[i].end());
+    }
+  }
+  stage_saved_.assign(stages, vector<vector<shared_ptr<Blob>>>());
+  stage_params_.assign(stages, vector<int>());
+  for (int lip = 0; lip < param_layer_indices_.size(); ++lip) {
+    const int layer_id = param_layer_indices_[lip].first;
+    if (param_owners_[lip] >= 0) {
+      // Stages would accumulate to one diff at the same time
+      CHECK_EQ(stage_of_[param_layer_indices_[param_owners_[lip]].first], stage_of_[layer_id])
+          << "Layers sharing parameters have to be in one pipeline stage";
+    } else if (!layers_[layer_id]->skip_apply_update(param_layer_indices_[lip].second)) {
+      stage_params_[stage_of_[layer_id]].push_back(learnable_param_ids_[lip]);
+    }
+  }
+}
+
+void Net::RunOnStage(int stage, const std::function<void()>& f) {
+  if (stage == 0) {
+    f();
+  } else {
+    stage_workers_[stage - 1]->Run(f);
+  }
+}
+
+void Net::PullActivations(int stage) {
+  for (StageBoundary& b : boundaries_) {
+    if (b.dst_stage == stage) {
+      b.dst->CopyDataFrom(*b.src, true);
+    }
+  }
+}
+
+void Net::PullGradients(int stage) {
+  for (StageBoundary& b : boundaries_) {
+    if (b.src_stage == stage && blob_need_backward_[b.blob_id]) {
+      b.src->CopyDiffFrom(*b.dst);
+    }
+  }
+}
+
+float Net::ForwardStages(int start, int end) {
+  float loss = 0.F;
+  for (int s = stage_of_[start]; s <= stage_of_[end]; ++s) {
+    RunOnStage(s, [&]() {
+      PullActivations(s);
+      for (int i = std::max(start, stage_first_[s]); i <= std::min(end, stage_last_[s]); ++i) {
+        loss += layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+        if (debug_info_) { ForwardDebugInfo(i); }
+      }
+    });
+  }
+  ++infer_count_;
+  return loss;
+}
+
+void Net::BackwardStages(int start, int end, bool apply_update) {
+  for (int s = stage_of_[start]; end <= start && s >= stage_of_[end]; --s) {
+    RunOnStage(s, [&]() {
+      PullGradients(s);
+      for (int i = std::min(start, stage_last_[s]); i >= std::max(end, stage_first_[s]); --i) {
+        if (layer_need_backward_[i]) {
+          layers_[i]->Backward(top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+          if (debug_info_) { BackwardDebugInfo(i); }
+        }
+      }
+    });
+  }
+  if (apply_update) {
+    ApplyStageUpdates();
+  }
+}
+
+void Net::ApplyStageUpdates() {
+  CHECK_LT(solver_->param().clip_gradients(), 0.F)
+      << "clip_gradients can't be combined with pipeline_device";
+  CHECK(!solver_->param().dynamic_loss_scale())
+      << "dynamic_loss_scale can't be combined with pipeline_device";
+  CHECK_LE(solver_->param().weights_ema_decay(), 0.F)
+      << "weights_ema_decay can't be combined with pipeline_device";
+  const bool clear_grads = !solver_->param().snapshot_diff();
+  auto update = [this, clear_grads](int s) {
+    cublasHandle_t handle = Caffe::cublas_handle();
+    for (int param_id : stage_params_[s]) {
+      learnable_params_[param_id]->scale_diff(1.F / global_grad_scale_, handle);
+      solver_->ApplyUpdate(param_id, handle, clear_grads);
+    }
+    CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  };
+  for (int s = 1; s < stage_first_.size(); ++s) {
+    stage_workers_[s - 1]->Post([&update, s]() { update(s); });
+  }
+  update(0);
+  for (shared_ptr<DeviceWorker>& worker : stage_workers_) {
+    worker->Wait();
+  }
+  for (int type_id = 0; type_id < learnable_types_.size(); ++type_id) {
+    reduction_queue_[type_id].push(END_OF_ITERATION);
+  }
+}
+
+// Every stage runs the forward passes of all micro-batches, then their backward passes
+// in reverse order. Host counters tell when a stage may read its inputs (the producer is
+// done with the micro-batch) and overwrite its outputs (the consumer took the previous
+// one). Layers synchronize their streams and copies are synchronous, so counting on the
+// host is enough.
+float Net::ForwardBackwardPipelined(int micro_batches) {
+  CHECK_GT(micro_batches, 0);
+  CHECK_GT(pipeline_stages(), 1);
+  CHECK(solver_ != nullptr) << "Pipelined passes need a solver";
+  const double start_us = now_us();
+  const int stages = stage_first_.size();
+  const int num_boundaries = boundaries_.size();
+  ConvertLearnableParams();
+  std::mutex mutex;
+  std::condition_variable cv;
+  // Micro-batches done by every stage and carried by every boundary
+  vector<int> fwd_done(stages, 0), bwd_done(stages, 0);
+  vector<int> fwd_pulled(num_boundaries, 0), bwd_pulled(num_boundaries, 0);
+  vector<float> loss(stages, 0.F);
+  auto wait_until = [&](const std::function<bool()>& ready) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, ready);
+  };
+  auto count = [&](int* counter) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++*counter;
+    }
+    cv.notify_all();
+  };
+  auto run_stage = [&](int s) {
+    const vector<Blob*>& inputs = stage_inputs_[s];
+    vector<vector<shared_ptr<Blob>>>& saved = stage_saved_[s];
+    saved.resize(micro_batches);
+    auto save = [&](int m, Blob* input) {
+      const int k = std::find(inputs.begin(), inputs.end(), input) - inputs.begin();
+      if (k == inputs.size()) {
+        return;
+      }
+      if (saved[m].size() < inputs.size()) {
+        saved[m].resize(inputs.size());
+      }
+      if (!saved[m][k]) {
+        saved[m][k] = Blob::create(input->data_type(), input->diff_type());
+      }
+      saved[m][k]->CopyDataFrom(*input, true);
+    };
+    vector<int> reforward;
+    for (int i = stage_first_[s]; i <= stage_last_[s]; ++i) {
+      if (!bottom_vecs_[i].empty()) {
+        reforward.push_back(i);
+      }
+    }
+    for (int m = 0; m < micro_batches; ++m) {
+      wait_until([&]() {
+        for (int b = 0; b < num_boundaries; ++b) {
+          const StageBoundary& sb = boundaries_[b];
+          if ((sb.dst_stage == s && fwd_done[sb.src_stage] <= m) ||
+              (sb.src_stage == s && fwd_pulled[b] < m)) {
+            return false;
+          }
+        }
+        return true;
+      });
+      for (int b = 0; b < num_boundaries; ++b) {
+        if (boundaries_[b].dst_stage == s) {
+          boundaries_[b].dst->CopyDataFrom(*boundaries_[b].src, true);
+          save(m, boundaries_[b].dst.get());
+          count(&fwd_pulled[b]);
+        }
+      }
+      for (int i = stage_first_[s]; i <= stage_last_[s]; ++i) {
+        loss[s] += layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+        if (bottom_vecs_[i].empty()) {
+          for (Blob* top : top_vecs_[i]) {
+            save(m, top);  // before in place layers change it
+          }
+        }
+      }
+      count(&fwd_done[s]);
+    }
+    for (int m = micro_batches - 1; m >= 0; --m) {
+      const int step = micro_batches - 1 - m;
+      wait_until([&]() {
+        for (int b = 0; b < num_boundaries; ++b) {
+          const StageBoundary& sb = boundaries_[b];
+          if ((sb.src_stage == s && bwd_done[sb.dst_stage] <= step) ||
+              (sb.dst_stage == s && bwd_pulled[b] < step)) {
+            return false;
+          }
+        }
+        return true;
+      });
+      // The last micro-batch's activations are still in place
+      if (m + 1 < micro_batches) {
+        for (int k = 0; k < inputs.size(); ++k) {
+          inputs[k]->CopyDataFrom(*saved[m][k]);
+        }
+        Reforward(reforward);
+      }
+      for (int b = 0; b < num_boundaries; ++b) {
+        StageBoundary& sb = boundaries_[b];
+        if (sb.src_stage == s) {
+          if (blob_need_backward_[sb.blob_id]) {
+            sb.src->CopyDiffFrom(*sb.dst);
+          }
+          count(&bwd_pulled[b]);
+        }
+      }
+      for (int i = stage_last_[s]; i >= stage_first_[s]; --i) {
+        if (layer_need_backward_[i]) {
+          layers_[i]->Backward(top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+        }
+      }
+      count(&bwd_done[s]);
+    }
+  };
+  for (int s = 1; s < stages; ++s) {
+    stage_workers_[s - 1]->Post([&run_stage, s]() { run_stage(s); });
+  }
+  run_stage(0);
+  for (shared_ptr<DeviceWorker>& worker : stage_workers_) {
+    worker->Wait();
+  }
+  ApplyStageUpdates();
+  infer_count_ += micro_batches;
+  forward_us_ += static_cast<uint64_t>(now_us() - start_us);
+  return std::accumulate(loss.begin(), loss.end(), 0.F);
+}
+
+#else
+float Net::ForwardBackwardPipelined(int micro_batches) {
+  NO_GPU;
+  return 0.F;
+}
+#endif
+
+#ifndef CPU_ONLY
+void Net::InitCudaGraph(const NetParameter& param) {
+  cuda_graph_ = param.cuda_graph() && Caffe::mode() == Caffe::GPU;
+  graph_warmup_iters_ = std::max(1U, param.cuda_graph_warmup_iters());
+  graph_warmup_until_ = infer_count_ + graph_warmup_iters_;
+  ReleaseGraphs();
+  if (!cuda_graph_) {
+    return;
+  }
+#if CUDART_VERSION < 10000
+  LOG(WARNING) << "cuda_graph needs CUDA 10 or later, ignored";
+  cuda_graph_ = false;
+#endif
+  if (offload_ || recompute_ || GPUMemory::managed()) {
+    LOG(WARNING) << "cuda_graph can't be combined with activation offload, recomputation "
+                 << "or managed memory, ignored";
+    cuda_graph_ = false;
+  }
+}
+
+float Net::ForwardGraphed() {
+  const int num_layers = layers_.size();
+  const bool warm = infer_count_ >= graph_warmup_until_;
+  if (warm && graph_first_ < 0 && !SelectGraphLayers()) {
+    cuda_graph_ = false;
+  }
+  float loss = 0.F;
+  for (int i = 0; i < num_layers; ++i) {
+    if (warm && i == graph_first_ && ReplayGraph()) {
+      i = graph_last_;
+      continue;
+    }
+    loss += layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i], loss_slot_);
+  }
+  return loss;
+}
+
+bool Net::SelectGraphLayers() {
+  const int num_layers = layers_.size();
+  auto capturable = [this](int i) {
+    if (!layers_[i]->is_capturable()) {
+      return false;
+    }
+    // Losses are summed up on host
+    for (int top_id = 0; top_id < top_vecs_[i].size(); ++top_id) {
+      if (layers_[i]->loss(top_id) != 0.F) {
+        return false;
+      }
+    }
+    return true;
+  };
+  int first = -1, length = 0;
+  for (int i = 0; i < num_layers; ++i) {
+    int j = i;
+    while (j < num_layers && capturable(j)) {
+      ++j;
+    }
+    if (j - i > length) {
+      first = i;
+      length = j - i;
+    }
+    i = j;
+  }
+  if (length < 2) {
+    LOG(WARNING) << "cuda_graph: no two consecutive capturable layers, ignored";
+    return false;
+  }
+  graph_first_ = first;
+  graph_last_ = first + length - 1;
+  graph_inputs_.clear();
+  graph_outputs_.clear();
+  graph_input_shapes_.clear();
+  vector<bool> produced(blobs_.size(), false);
+  for (int i = graph_first_; i <= graph_last_; ++i) {
+    for (int blob_id : bottom_id_vecs_[i]) {
+      if (!produced[blob_id] && std::find(graph_inputs_.begin(), graph_inputs_.end(),
+          blob_id) == graph_inputs_.end()) {
+        graph_inputs_.push_back(blob_id);
+        graph_input_shapes_.push_back(blobs_[blob_id]->shape());
+      }
+    }
+    for (int blob_id : top_id_vecs_[i]) {
+      if (!produced[blob_id]) {
+        produced[blob_id] = true;
+        graph_outputs_.push_back(blob_id);
+      }
+    }
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << "cuda_graph: capturing " << length << " of "
+      << num_layers << " layers, " << layer_names_[graph_first_] << " to "
+      << layer_names_[graph_last_];
+  return true;
+}
+
+bool Net::ReplayGraph() {
+#if CUDART_VERSION >= 10000
+  cudaStream_t stream = Caffe::thread_stream();
+  // Buffers the graph reads, moved to device if needed
+  vector<const void*> inputs;
+  for (int k = 0; k < graph_inputs_.size(); ++k) {
+    const Blob* blob = blobs_[graph_inputs_[k]].get();
+    if (blob->shape() != graph_input_shapes_[k]) {
+      LOG_IF(INFO, Caffe::root_solver()) << "cuda_graph: " << blob_names_[graph_inputs_[k]]
+          << " reshaped to " << blob->shape_string() << ", capturing again after warm-up";
+      ReleaseGraphs();
+      graph_warmup_until_ = infer_count_ + 1UL + graph_warmup_iters_;
+      return false;
+    }
+    inputs.push_back(blob->current_data_memory(true));
+  }
+  shared_ptr<GPUMemory::Workspace> ws = GPUMemory::thread_workspace(Caffe::current_device());
+  inputs.push_back(ws ? ws->data() : nullptr);
+  // Blobs the graph writes have to be read from device afterwards
+  for (int blob_id : graph_outputs_) {
+    blobs_[blob_id]->current_mutable_data_memory(true);
+  }
+  for (const ForwardGraph& graph : graphs_) {
+    if (graph.inputs == inputs) {
+      CUDA_CHECK(cudaGraphLaunch(graph.exec, stream));
+      CUDA_CHECK(cudaStreamSynchronize(stream));
+      return true;
+    }
+  }
+  if (graphs_.size() >= MAX_FORWARD_GRAPHS) {
+    LOG_FIRST_N(WARNING, 1) << "cuda_graph: input buffers of " << layer_names_[graph_first_]
+        << " keep changing, running eagerly when they don't match any of "
+        << MAX_FORWARD_GRAPHS << " captured graphs";
+    return false;
+  }
+  // Nothing runs while being captured
+  CUDA_CHECK(cudaStreamBeginCapture(stream, cudaStreamCaptureModeThreadLocal));
+  for (int i = graph_first_; i <= graph_last_; ++i) {
+    layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+  }
+  cudaGraph_t captured = nullptr;
+  ForwardGraph graph;
+  graph.inputs = inputs;
+  cudaError_t error = cudaStreamEndCapture(stream, &captured);
+  if (error == cudaSuccess) {
+#if CUDART_VERSION >= 12000
+    error = cudaGraphInstantiate(&graph.exec, captured, 0ULL);
+#else
+    error = cudaGraphInstantiate(&graph.exec, captured, nullptr, nullptr, 0);
+#endif
+  }
+  if (captured != nullptr) {
+    CUDA_CHECK(cudaGraphDestroy(captured));
+  }
+  if (error != cudaSuccess) {
+    cudaGetLastError();
+    LOG(WARNING) << "cuda_graph: capture of " << layer_names_[graph_first_] << " to "
+                 << layer_names_[graph_last_] << " failed (" << cudaGetErrorString(error)
+                 << "), running eagerly";
+    ReleaseGraphs();
+    cuda_graph_ = false;
+    return false;
+  }
+  graphs_.push_back(graph);
+  LOG_IF(INFO, Caffe::root_solver()) << "cuda_graph: captured graph " << graphs_.size();
+  CUDA_CHECK(cudaGraphLaunch(graph.exec, stream));
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+  return true;
+#else
+  return false;
+#endif
+}
+
+void Net::ReleaseGraphs() {
+#if CUDART_VERSION >= 10000
+  for (ForwardGraph& graph : graphs_) {
+    cudaGraphExecDestroy(graph.exec);
+  }
+#endif
+  graphs_.clear();
+  graph_first_ = -1;
+  graph_last_ = -1;
+}
+
+void Net::InitTensorRT(const NetParameter& param) {
+  trt_segments_.clear();
+  trt_segment_at_.assign(layers_.size(), -1);
+  if (!param.has_tensorrt() || phase_ != TEST || Caffe::mode() != Caffe::GPU) {
+    return;
+  }
+#ifndef USE_TENSORRT
+  LOG(WARNING) << "tensorrt needs a build with USE_TENSORRT, ignored";
+#else
+  if (cuda_graph_ || branch_streams_ > 1U || !stage_of_.empty() || stream_weights_ ||
+      param.layout() != NCHW) {
+    LOG(WARNING) << "tensorrt can't be combined with CUDA graphs, branch streams, pipeline "
+                 << "stages, streamed weights or NHWC layout, ignored";
+    return;
+  }
+  const TensorRTParameter& trt = param.tensorrt();
+  const int num_layers = layers_.size();
+  auto convertible = [this](int i) {
+    if (!TensorRTSegment::Supported(layers_[i].get())) {
+      return false;
+    }
+    for (int top_id = 0; top_id < top_vecs_[i].size(); ++top_id) {
+      if (layers_[i]->loss(top_id) != 0.F) {
+        return false;
+      }
+    }
+    return true;
+  };
+  std::set<int> net_outputs(net_output_blob_indices_.begin(), net_output_blob_indices_.end());
+  int converted = 0;
+  for (int first = 0; first < num_layers; ++first) {
+    // Blobs the segment reads before writing them and those it writes
+    std::set<int> read, written;
+    vector<int> inputs;
+    int last = first - 1;
+    for (int i = first; i < num_layers && convertible(i); ++i) {
+      vector<int> layer_inputs;
+      for (int blob_id : bottom_id_vecs_[i]) {
+        if (written.count(blob_id) == 0 && read.insert(blob_id).second) {
+          layer_inputs.push_back(blob_id);
+        }
+      }
+      // Engines don't write their inputs, in-place layers on them run natively
+      bool in_place = false;
+      for (int blob_id : top_id_vecs_[i]) {
+        in_place = in_place || (written.count(blob_id) == 0 && read.count(blob_id) > 0);
+      }
+      if (in_place) {
+        break;
+      }
+      inputs.insert(inputs.end(), layer_inputs.begin(), layer_inputs.end());
+      written.insert(top_id_vecs_[i].begin(), top_id_vecs_[i].end());
+      last = i;
+    }
+    if (last - first + 1 < static_cast<int>(std::max(1U, trt.min_layers()))) {
+      continue;
+    }
+    vector<Blob*> in, out;
+    for (int blob_id : inputs) {
+      in.push_back(blobs_[blob_id].get());
+    }
+    for (int blob_id : written) {
+      bool read_later = net_outputs.count(blob_id) > 0;
+      for (int j = last + 1; j < num_layers && !read_later; ++j) {
+        const vector<int>& bottoms = bottom_id_vecs_[j];
+        read_later = std::find(bottoms.begin(), bottoms.end(), blob_id) != bottoms.end();
+      }
+      if (read_later) {
+        out.push_back(blobs_[blob_id].get());
+      }
+    }
+    trt_segment_at_[first] = trt_segments_.size();
+    trt_segments_.push_back(make_shared<TensorRTSegment>(*this, first, last, in, out, trt));
+    converted += last - first + 1;
+    first = last;
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << "TensorRT: " << converted << " of " << num_layers
+      << " layers in " << trt_segments_.size() << " engines, "
+      << TensorRTParameter_Precision_Name(trt.precision());
+#endif
+}
+
+// Same as the eager pass, engines standing for their layers
+float Net::ForwardTensorRT() {
+  float loss = 0.F;
+  for (int i = 0; i < layers_.size(); ++i) {
+#ifdef USE_TENSORRT
+    const int s = trt_segment_at_[i];
+    if (s >= 0 && trt_segments_[s]->Forward()) {
+      i = trt_segments_[s]->last();
+      continue;
+    }
+#endif
+    loss += layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i], loss_slot_);
+  }
+  return loss;
+}
+
+void Net::WeightsChanged() {
+  for (const shared_ptr<LayerBase>& layer : layers_) {
+    layer->WeightsChanged();
+  }
+#ifndef CPU_ONLY
+  ResetTensorRT();
+#endif
+}
+
+void Net::ResetTensorRT() {
+#ifdef USE_TENSORRT
+  for (const shared_ptr<TensorRTSegment>& segment : trt_segments_) {
+    segment->Reset();
+  }
+#endif
+}
+
+void Net::InitOffload(const NetParameter& param) {
+  offload_ = param.offload_activations() && phase_ == TRAIN && Caffe::mode() == Caffe::GPU;
+  if (!offload_) {
+    return;
+  }
+  CHECK(!param.recompute_activations())
+      << "offload_activations and recompute_activations are mutually exclusive";
+  const int num_layers = layers_.size();
+  const int num_blobs = blobs_.size();
+  const int distance = std::max(1U, param.offload_prefetch_distance());
+  const size_t min_bytes = param.offload_min_kb() * 1024UL;
+  vector<int> group, first, last;
+  vector<bool> pinned;
+  ActivationLifetimes(&group, &first, &last, &pinned);
+  offload_after_.assign(num_layers, vector<int>());
+  prefetch_at_.assign(num_layers, vector<int>());
+  wait_at_.assign(num_layers, vector<int>());
+  offload_state_.assign(num_blobs, OFFLOAD_RESIDENT);
+  offload_events_.assign(num_blobs, nullptr);
+  size_t total_bytes = 0UL, offload_bytes = 0UL;
+  int offloaded = 0;
+  for (int g = 0; g < num_blobs; ++g) {
+    if (group[g] != g || last[g] < 0) {
+      continue;
+    }
+    const size_t bytes = blobs_[g]->sizeof_data();
+    total_bytes += bytes;
+    // Buffers needed again right at the start of backward gain nothing
+    if (pinned[g] || bytes < min_bytes || last[g] + distance >= num_layers) {
+      continue;
+    }
+    offload_after_[last[g]].push_back(g);
+    prefetch_at_[last[g] + distance].push_back(g);
+    wait_at_[last[g]].push_back(g);
+    CUDA_CHECK(cudaEventCreateWithFlags(&offload_events_[g], cudaEventDisableTiming));
+    offload_bytes += bytes;
+    ++offloaded;
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << "Activation offload: " << offloaded << " buffers, "
+      << offload_bytes << " of " << total_bytes << " activation bytes go to host memory, "
+      << "prefetch distance " << distance << " layers";
+}
+
+void Net::OffloadAfter(int layer_id) {
+  if (!offload_after_[layer_id].empty()) {
+    cudaStream_t stream = Caffe::thread_stream();
+    cudaStream_t pull_stream = Caffe::th_stream_aux(Caffe::STREAM_ID_ASYNC_PULL);
+    for (int g : offload_after_[layer_id]) {
+      cudaEvent_t event = offload_events_[g];
+      // The copy starts once the layer is done with the buffer, compute goes on
+      CUDA_CHECK(cudaEventRecord(event, stream));
+      CUDA_CHECK(cudaStreamWaitEvent(pull_stream, event, 0));
+      if (!blobs_[g]->async_cpu_pull(pull_stream)) {
+        offload_state_[g] = OFFLOAD_RESIDENT;
+        continue;
+      }
+      CUDA_CHECK(cudaEventRecord(event, pull_stream));
+      offload_state_[g] = OFFLOAD_PULLING;
+      offload_pending_.push_back(g);
+    }
+  }
+  ReleaseOffloaded(false);
+}
+
+void Net::ReleaseOffloaded(bool wait) {
+  for (auto it = offload_pending_.begin(); it != offload_pending_.end();) {
+    const int g = *it;
+    if (wait) {
+      CUDA_CHECK(cudaEventSynchronize(offload_events_[g]));
+    } else {
+      cudaError_t status = cudaEventQuery(offload_events_[g]);
+      if (status == cudaErrorNotReady) {
+        ++it;
+        continue;
+      }
+      CUDA_CHECK(status);
+    }
+    blobs_[g]->release_gpu_data();
+    offload_state_[g] = OFFLOAD_ON_HOST;
+    it = offload_pending_.erase(it);
+  }
+}
+
+void Net::PrefetchBefore(int layer_id) {
+  for (int g : prefetch_at_[layer_id]) {
+    if (offload_state_[g] == OFFLOAD_ON_HOST) {
+      blobs_[g]->async_gpu_push();
+      CUDA_CHECK(cudaEventRecord(offload_events_[g],
+          Caffe::th_stream_aux(Caffe::STREAM_ID_ASYNC_PUSH)));
+      offload_state_[g] = OFFLOAD_PUSHING;
+    }
+  }
+  for (int g : wait_at_[layer_id]) {
+    if (offload_state_[g] == OFFLOAD_PUSHING) {
+      CUDA_CHECK(cudaStreamWaitEvent(Caffe::thread_stream(), offload_events_[g], 0));
+      offload_state_[g] = OFFLOAD_RESIDENT;
+    }
+  }
+}
+
+void Net::InitStreamWeights(const NetParameter& param) {
+  stream_weights_ = param.stream_weights() && phase_ == TEST && Caffe::mode() == Caffe::GPU;
+  stream_ready_ = false;
+  stream_buffers_ = std::max(1U, param.stream_weights_buffers());
+  stream_host_ = nullptr;
+  streamed_.clear();
+  streamed_index_.clear();
+  if (!stream_weights_) {
+    return;
+  }
+  if (param.cuda_graph() || param.branch_streams() > 1U || !stage_of_.empty() ||
+      GPUMemory::managed()) {
+    LOG(WARNING) << "stream_weights can't be combined with CUDA graphs, branch streams, "
+                 << "pipeline stages or managed memory, ignored";
+    stream_weights_ = false;
+  }
+}
+
+void Net::PrepareStreamedWeights() {
+  stream_ready_ = true;
+  if (trained_layers_shared_) {
+    LOG(WARNING) << "stream_weights is ignored by nets sharing trained layers";
+    stream_weights_ = false;
+    stream_ready_ = false;
+    return;
+  }
+  const int num_layers = layers_.size();
+  streamed_index_.assign(num_layers, -1);
+  size_t host_bytes = 0UL, total_bytes = 0UL;
+  stream_slot_bytes_ = 0UL;
+  for (int i = 0; i < num_layers; ++i) {
+    const vector<shared_ptr<Blob>>& blobs = layers_[i]->blobs();
+    bool shared = blobs.empty();
+    for (int j = 0; j < blobs.size() && !shared; ++j) {
+      const int param_id = param_id_vecs_[i][j];
+      shared = param_owners_[param_id] != -1 ||
+          std::count(param_owners_.begin(), param_owners_.end(), param_id) > 0;
+    }
+    if (shared) {
+      continue;
+    }
+    StreamedLayer sl;
+    sl.layer_id = i;
+    size_t offset = 0UL;
+    for (const shared_ptr<Blob>& blob : blobs) {
+      sl.blobs.push_back(blob.get());
+      sl.offsets.push_back(offset);
+      sl.bytes.push_back(blob->sizeof_data());
+      offset += align_up<8>(blob->sizeof_data());
+      if (stream_mapped_.count(blob.get()) == 0UL) {
+        host_bytes += align_up<8>(blob->sizeof_data());
+      }
+    }
+    stream_slot_bytes_ = std::max(stream_slot_bytes_, offset);
+    total_bytes += offset;
+    streamed_index_[i] = streamed_.size();
+    streamed_.push_back(sl);
+  }
+  if (host_bytes > 0UL) {
+    CUDA_CHECK(cudaMallocHost(&stream_host_, host_bytes));
+  }
+  // Host copies replace the blobs' own ones on both sides
+  char* host = static_cast<char*>(stream_host_);
+  for (StreamedLayer& sl : streamed_) {
+    for (Blob* blob : sl.blobs) {
+      void* data = const_cast<void*>(blob->current_data_memory(false));
+      if (stream_mapped_.count(blob) == 0UL) {
+        std::memcpy(host, data, blob->sizeof_data());
+        data = host;
+        host += align_up<8>(blob->sizeof_data());
+      }
+      blob->release_gpu_data();
+      blob->set_current_data_memory(data, false);
+      sl.host.push_back(data);
+    }
+  }
+  stream_buffers_ = std::min<int>(stream_buffers_, std::max<size_t>(1UL, streamed_.size()));
+  stream_ring_ = make_shared<GPUMemory::Workspace>(
+      std::max(1UL, stream_buffers_ * stream_slot_bytes_), Caffe::current_device());
+  stream_loaded_.resize(stream_buffers_);
+  stream_freed_.resize(stream_buffers_);
+  for (int k = 0; k < stream_buffers_; ++k) {
+    CUDA_CHECK(cudaEventCreateWithFlags(&stream_loaded_[k], cudaEventDisableTiming));
+    CUDA_CHECK(cudaEventCreateWithFlags(&stream_freed_[k], cudaEventDisableTiming));
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << "Weight streaming: " << streamed_.size()
+      << " layers, " << total_bytes << " bytes of weights (" << total_bytes - host_bytes
+      << " mapped from " << (stream_file_ ? "the weight file" : "nowhere") << ") through "
+      << stream_buffers_ << " device buffers of " << stream_slot_bytes_ << " bytes";
+}
+
+void Net::StreamWeights(int j) {
+  const StreamedLayer& sl = streamed_[j];
+  const int slot = j % stream_buffers_;
+  cudaStream_t push_stream = Caffe::th_stream_aux(Caffe::STREAM_ID_ASYNC_PUSH);
+  // Waits for the layer done with the buffer
+  CUDA_CHECK(cudaStreamWaitEvent(push_stream, stream_freed_[slot], 0));
+  char* buffer = static_cast<char*>(stream_ring_->data()) + slot * stream_slot_bytes_;
+  for (int b = 0; b < sl.blobs.size(); ++b) {
+    if (sl.bytes[b] > 0UL) {
+      CUDA_CHECK(cudaMemcpyAsync(buffer + sl.offsets[b], sl.host[b], sl.bytes[b],
+          cudaMemcpyHostToDevice, push_stream));
+    }
+  }
+  CUDA_CHECK(cudaEventRecord(stream_loaded_[slot], push_stream));
+}
+
+void Net::StreamWeightsBefore(int layer_id) {
+  const int j = streamed_index_[layer_id];
+  if (j < 0) {
+    return;
+  }
+  const StreamedLayer& sl = streamed_[j];
+  const int slot = j % stream_buffers_;
+  CUDA_CHECK(cudaStreamWaitEvent(Caffe::thread_stream(), stream_loaded_[slot], 0));
+  char* buffer = static_cast<char*>(stream_ring_->data()) + slot * stream_slot_bytes_;
+  for (int b = 0; b < sl.blobs.size(); ++b) {
+    sl.blobs[b]->set_current_data_memory(buffer + sl.offsets[b], true);
+  }
+}
+
+void Net::StreamWeightsAfter(int layer_id, int end) {
+  const int j = streamed_index_[layer_id];
+  if (j < 0) {
+    return;
+  }
+  const StreamedLayer& sl = streamed_[j];
+  for (int b = 0; b < sl.blobs.size(); ++b) {
+    sl.blobs[b]->set_current_data_memory(sl.host[b], false);
+  }
+  CUDA_CHECK(cudaEventRecord(stream_freed_[j % stream_buffers_], Caffe::thread_stream()));
+  const int next = j + stream_buffers_;
+  if (next < streamed_.size() && streamed_[next].layer_id <= end) {
+    StreamWeights(next);
+  }
+}
+
+void Net::PlanActivationMemory() {
+  if (phase_ != TEST || Caffe::mode() != Caffe::GPU) {
+    LOG_IF(INFO, Caffe::root_solver())
+        << "Activation memory plan is ignored: it needs TEST phase and GPU mode";
+    return;
+  }
+  const int num_blobs = blobs_.size();
+  vector<int> group, first, last;
+  vector<bool> pinned;
+  ActivationLifetimes(&group, &first, &last, &pinned);
+  vector<int> planned;
+  vector<size_t> size(num_blobs, 0UL), offset(num_blobs, 0UL);
+  size_t unplanned_bytes = 0UL;
+  for (int g = 0; g < num_blobs; ++g) {
+    if (group[g] != g || pinned[g] || last[g] < 0 || blobs_[g]->count() == 0) {
+      continue;
+    }
+    // SyncedMemory may hold one element more, see Tensor::Reshape
+    size[g] = align_up<8>(blobs_[g]->sizeof_data(true) + sizeof(double));
+    unplanned_bytes += size[g];
+    planned.push_back(g);
+  }
+  // Greedy interval coloring: the biggest buffers go first to the lowest offset
+  // not used by buffers alive at the same time
+  std::sort(planned.begin(), planned.end(), [&](int a, int b) {
+    return size[a] != size[b] ? size[a] > size[b] : a < b;
+  });
+  size_t arena_bytes = 0UL;
+  for (size_t i = 0; i < planned.size(); ++i) {
+    const int g = planned[i];
+    vector<pair<size_t, size_t>> busy;
+    for (size_t j = 0; j < i; ++j) {
+      const int h = planned[j];
+      if (first[h] <= last[g] && first[g] <= last[h]) {
+        busy.emplace_back(offset[h], offset[h] + size[h]);
+      }
+    }
+    std::sort(busy.begin(), busy.end());
+    size_t pos = 0UL;
+    for (const pair<size_t, size_t>& b : busy) {
+      if (pos + size[g] <= b.first) {
+        break;
+      }
+      pos = std::max(pos, b.second);
+    }
+    offset[g] = pos;
+    arena_bytes = std::max(arena_bytes, pos + size[g]);
+  }
+  if (planned.empty()) {
+    return;
+  }
+  activation_offsets_.clear();
+  for (int g : planned) {
+    activation_offsets_.emplace_back(g, offset[g]);
+  }
+  activation_bytes_ = arena_bytes;
+  BindActivations(make_shared<GPUMemory::Workspace>(arena_bytes));
+  LOG_IF(INFO, Caffe::root_solver()) << "Activation memory plan (" << Phase_Name(phase_)
+      << "): " << planned.size() << " buffers use " << arena_bytes << " bytes instead of "
+      << unplanned_bytes;
+}
+
+void Net::BindActivations(const shared_ptr<GPUMemory::Workspace>& arena) {
+  CHECK_GE(arena->size(), activation_bytes_);
+  char* base = static_cast<char*>(arena->data());
+  for (const pair<int, size_t>& planned : activation_offsets_) {
+    blobs_[planned.first]->set_gpu_data(base + planned.second);
+  }
+  // Graphs captured so far point to the old arena
+  ReleaseGraphs();
+  activations_ = arena;
+}
+#endif
+
+void Net::ShareActivationArena(const vector<shared_ptr<Net>>& nets) {
+#ifndef CPU_ONLY
+  size_t bytes = 0UL;
+  int planned = 0;
+  for (const shared_ptr<Net>& net : nets) {
+    if (net->activations_) {
+      bytes = std::max(bytes, net->activation_bytes_);
+      ++planned;
+    }
+  }
+  if (planned < 2) {
+    return;
+  }
+  shared_ptr<GPUMemory::Workspace> arena = make_shared<GPUMemory::Workspace>(bytes);
+  for (const shared_ptr<Net>& net : nets) {
+    if (net->activations_) {
+      net->BindActivations(arena);
+    }
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << planned << " nets share an activation arena of "
+      << bytes << " bytes";
+#endif
+}
+
+// Layers whose tops share data with their first bottom
+static bool shares_bottom_data(const LayerParameter& layer) {
+  const string& type = layer.type();
+  return layer.bottom_size() > 0 && (type == "Split" || type == "Flatten" ||
+      type == "Reshape" || (type == "Concat" && layer.bottom_size() == 1) ||
+      (type == "Slice" && layer.top_size() == 1));
+}
+
+void Net::MarkStorageViews(NetParameter* param) const {
+  if (!param->concat_views()) {
+    return;
+  }
+  if ((param->recompute_activations() && phase_ == TRAIN) ||
+      param->pipeline_device_size() > 1) {
+    LOG_IF(INFO, Caffe::root_solver())
+        << "concat_views is ignored with activation recomputation and pipelines";
+    return;
+  }
+  // Blobs sharing data make one group, named after its first blob
+  map<string, string> group;
+  auto group_of = [&](const string& blob) {
+    auto it = group.find(blob);
+    return it == group.end() ? blob : it->second;
+  };
+  const int num_layers = param->layer_size();
+  for (int i = 0; i < num_layers; ++i) {
+    const LayerParameter& layer = param->layer(i);
+    if (shares_bottom_data(layer)) {
+      for (int j = 0; j < layer.top_size(); ++j) {
+        group[layer.top(j)] = group_of(layer.bottom(0));
+      }
+    }
+  }
+  // Groups written by data layers, which swap in prefetched batches
+  set<string> sourced;
+  for (int i = 0; i < num_layers; ++i) {
+    const LayerParameter& layer = param->layer(i);
+    for (int j = 0; j < layer.top_size() && layer.bottom_size() == 0; ++j) {
+      sourced.insert(group_of(layer.top(j)));
+    }
+  }
+  // Whether a group is written in place after layer i
+  auto written_after = [&](const string& g, int i) {
+    for (int l = i + 1; l < num_layers; ++l) {
+      const LayerParameter& layer = param->layer(l);
+      for (int j = 0; j < layer.top_size(); ++j) {
+        for (int k = 0; k < layer.bottom_size(); ++k) {
+          if (layer.bottom(k) == layer.top(j) && group_of(layer.top(j)) == g) {
+            return true;
+          }
+        }
+      }
+    }
+    return false;
+  };
+  set<string> taken;
+  int marked = 0;
+  for (int i = 0; i < num_layers; ++i) {
+    LayerParameter* layer = param->mutable_layer(i);
+    const bool concat = layer->type() == "Concat" && layer->bottom_size() > 1 &&
+        layer->top_size() == 1;
+    const bool slice = layer->type() == "Slice" && layer->bottom_size() == 1 &&
+        layer->top_size() > 1;
+    if (!concat && !slice) {
+      continue;
+    }
+    // Parts are regions of the whole one
+    const auto& parts = concat ? layer->bottom() : layer->top();
+    const string whole = group_of(concat ? layer->top(0) : layer->bottom(0));
+    set<string> groups{whole};
+    bool safe = (concat || sourced.count(whole) == 0) && !written_after(whole, i);
+    for (const string& part : parts) {
+      const string g = group_of(part);
+      safe = safe && groups.insert(g).second && !written_after(g, i) &&
+          (!concat || sourced.count(g) == 0);
+    }
+    for (const string& g : groups) {
+      safe = safe && taken.count(g) == 0;
+    }
+    if (!safe) {
+      continue;
+    }
+    taken.insert(groups.begin(), groups.end());
+    if (concat) {
+      layer->mutable_concat_param()->set_share_storage(true);
+    } else {
+      layer->mutable_slice_param()->set_share_storage(true);
+    }
+    ++marked;
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << marked << " Concat and Slice layers share storage";
+}
+
+// Number of layer bottoms reading blob
+static int blob_readers(const NetParameter& param, const string& blob) {
+  int readers = 0;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    for (int j = 0; j < param.layer(i).bottom_size(); ++j) {
+      if (param.layer(i).bottom(j) == blob) {
+        ++readers;
+      }
+    }
+  }
+  return readers;
+}
+
+// Whether layer of the given type only transforms blob which nothing else reads
+static bool foldable(const NetParameter& param, const LayerParameter& layer,
+    const string& type, const string& blob) {
+  return layer.type() == type && layer.bottom_size() == 1 && layer.top_size() == 1 &&
+      layer.bottom(0) == blob && (layer.top(0) == blob || blob_readers(param, blob) == 1);
+}
+
+void Net::FoldBatchNorm(NetParameter* param) {
+  folded_bn_.clear();
+  if (!param->fold_batch_norm() || phase_ != TEST) {
+    return;
+  }
+  vector<bool> removed(param->layer_size(), false);
+  int bn_count = 0, scale_count = 0;
+  for (int i = 0; i + 1 < param->layer_size(); ++i) {
+    LayerParameter* layer = param->mutable_layer(i);
+    const bool conv = layer->type() == "Convolution";
+    const bool ip = layer->type() == "InnerProduct" &&
+        !layer->inner_product_param().transpose() && layer->inner_product_param().axis() == 1;
+    if ((!conv && !ip) || layer->top_size() != 1 || removed[i]) {
+      continue;
+    }
+    const LayerParameter& bn = param->layer(i + 1);
+    if (!foldable(*param, bn, "BatchNorm", layer->top(0))) {
+      continue;
+    }
+    FoldedBN fold;
+    fold.bn = bn.name();
+    fold.eps = std::max(bn.batch_norm_param().eps(), 1e-5F);
+    fold.scale_bias = false;
+    fold.bias_added = false;
+    string top = bn.top(0);
+    removed[i + 1] = true;
+    ++bn_count;
+    if (i + 2 < param->layer_size()) {
+      const LayerParameter& scale = param->layer(i + 2);
+      if (foldable(*param, scale, "Scale", top) && scale.scale_param().axis() == 1 &&
+          scale.scale_param().num_axes() == 1) {
+        fold.scale = scale.name();
+        fold.scale_bias = scale.scale_param().bias_term();
+        top = scale.top(0);
+        removed[i + 2] = true;
+        ++scale_count;
+      }
+    }
+    layer->set_top(0, top);
+    if (conv && !layer->convolution_param().bias_term()) {
+      layer->mutable_convolution_param()->set_bias_term(true);
+      fold.bias_added = true;
+    } else if (ip && !layer->inner_product_param().bias_term()) {
+      layer->mutable_inner_product_param()->set_bias_term(true);
+      fold.bias_added = true;
+    }
+    folded_bn_[layer->name()] = fold;
+  }
+  if (folded_bn_.empty()) {
+    return;
+  }
+  NetParameter folded;
+  for (int i = 0; i < param->layer_size(); ++i) {
+    if (!removed[i]) {
+      folded.add_layer()->Swap(param->mutable_layer(i));
+    }
+  }
+  param->mutable_layer()->Swap(folded.mutable_layer());
+  LOG_IF(INFO, Caffe::root_solver()) << "Folded " << bn_count << " BatchNorm and "
+      << scale_count << " Scale layers into " << folded_bn_.size() << " preceding layers";
+}
+
+// Whether the layer is a pointwise op of blob PointwiseLayer evaluates, the op is set
+// then, and the other bottom of an Eltwise layer
+static bool pointwise_op(const LayerParameter& layer, const string& blob,
+    PointwiseParameter::Op* op, string* operand) {
+  if (layer.top_size() != 1 || layer.loss_weight_size() > 0 ||
+      layer.propagate_down_size() > 0) {
+    return false;
+  }
+  const string& type = layer.type();
+  operand->clear();
+  op->Clear();
+  op->set_layer(layer.name());
+  if (type == "Eltwise") {
+    const EltwiseParameter& param = layer.eltwise_param();
+    if (layer.bottom_size() != 2 || (layer.bottom(0) == blob) == (layer.bottom(1) == blob)) {
+      return false;
+    }
+    const bool first = layer.bottom(0) == blob;
+    *operand = layer.bottom(first ? 1 : 0);
+    switch (param.operation()) {
+      case EltwiseParameter::SUM:
+        if (param.coeff_size() == 2) {
+          op->set_coeff(param.coeff(first ? 0 : 1));
+          op->set_operand_coeff(param.coeff(first ? 1 : 0));
+        } else if (param.coeff_size() != 0) {
+          return false;
+        }
+        op->set_type(PointwiseParameter::Op::SUM);
+        break;
+      case EltwiseParameter::PROD:
+        op->set_type(PointwiseParameter::Op::PROD);
+        break;
+      case EltwiseParameter::MAX:
+        op->set_type(PointwiseParameter::Op::MAX);
+        op->set_operand_first(!first);
+        break;
+    }
+    return true;
+  }
+  if (layer.bottom_size() != 1 || layer.bottom(0) != blob) {
+    return false;
+  }
+  if (type == "Scale") {
+    const ScaleParameter& param = layer.scale_param();
+    op->set_type(PointwiseParameter::Op::SCALE);
+    op->set_axis(param.axis());
+    op->set_num_axes(param.num_axes());
+    if (param.has_filler()) {
+      op->mutable_filler()->CopyFrom(param.filler());
+    }
+    op->set_bias_term(param.bias_term());
+    op->mutable_bias_filler()->CopyFrom(param.bias_filler());
+  } else if (type == "Bias") {
+    const BiasParameter& param = layer.bias_param();
+    op->set_type(PointwiseParameter::Op::BIAS);
+    op->set_axis(param.axis());
+    op->set_num_axes(param.num_axes());
+    op->mutable_filler()->CopyFrom(param.filler());
+  } else if (type == "ReLU") {
+    op->set_type(PointwiseParameter::Op::RELU);
+    op->set_alpha(layer.relu_param().negative_slope());
+  } else if (type == "ELU") {
+    op->set_type(PointwiseParameter::Op::ELU);
+    op->set_alpha(layer.elu_param().alpha());
+  } else if (type == "Sigmoid") {
+    op->set_type(PointwiseParameter::Op::SIGMOID);
+  } else if (type == "TanH") {
+    op->set_type(PointwiseParameter::Op::TANH);
+  } else if (type == "Power") {
+    op->set_type(PointwiseParameter::Op::POWER);
+    op->set_power(layer.power_param().power());
+    op->set_scale(layer.power_param().scale());
+    op->set_shift(layer.power_param().shift());
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Number of layer bottoms after layer reading blob
+static int blob_readers_after(const NetParameter& param, const string& blob, int layer) {
+  int readers = 0;
+  for (int i = layer + 1; i < param.layer_size(); ++i) {
+    for (int j = 0; j < param.layer(i).bottom_size(); ++j) {
+      if (param.layer(i).bottom(j) == blob) {
+        ++readers;
+      }
+    }
+  }
+  return readers;
+}
+
+// Whether both layers run with the same types and in the same stage
+static bool same_setup(const LayerParameter& a, const LayerParameter& b) {
+  return a.forward_type() == b.forward_type() && a.backward_type() == b.backward_type() &&
+      a.forward_math() == b.forward_math() && a.backward_math() == b.backward_math() &&
+      a.pipeline_stage() == b.pipeline_stage() && a.phase() == b.phase();
+}
+
+void Net::FuseInnerProductActivation(NetParameter* param) const {
+  if (!param->fuse_inner_product_activation()) {
+    return;
+  }
+  NetParameter fused;
+  int merged = 0;
+  for (int i = 0; i < param->layer_size(); ++i) {
+    LayerParameter* layer = fused.add_layer();
+    layer->CopyFrom(param->layer(i));
+    if (i + 1 == param->layer_size() || layer->type() != "InnerProduct" ||
+        layer->top_size() != 1 || layer->loss_weight_size() > 0 ||
+        layer->inner_product_param().activation() != InnerProductParameter::NONE) {
+      continue;
+    }
+    const LayerParameter& relu = param->layer(i + 1);
+    const string& blob = layer->top(0);
+    if (relu.type() != "ReLU" || relu.bottom_size() != 1 || relu.bottom(0) != blob ||
+        relu.top_size() != 1 || relu.loss_weight_size() > 0 || relu.propagate_down_size() > 0 ||
+        relu.relu_param().negative_slope() != 0.F || !same_setup(*layer, relu) ||
+        (relu.top(0) != blob && blob_readers_after(*param, blob, i + 1) > 0)) {
+      continue;
+    }
+    layer->mutable_inner_product_param()->set_activation(InnerProductParameter::RELU);
+    layer->set_top(0, relu.top(0));
+    ++merged;
+    ++i;
+  }
+  if (merged == 0) {
+    return;
+  }
+  param->mutable_layer()->Swap(fused.mutable_layer());
+  LOG_IF(INFO, Caffe::root_solver()) << "Fused " << merged
+      << " ReLU layers into the InnerProduct layers they follow";
+}
+
+void Net::FusePointwise(NetParameter* param) {
+  fused_pointwise_.clear();
+  if (!param->fuse_pointwise()) {
+    return;
+  }
+  NetParameter fused;
+  int merged = 0;
+  for (int i = 0; i < param->layer_size();) {
+    const LayerParameter& first = param->layer(i);
+    LayerParameter pointwise;
+    PointwiseParameter* pointwise_param = pointwise.mutable_pointwise_param();
+    string blob = first.bottom_size() > 0 ? first.bottom(0) : string();
+    int ops = 0, end = i;
+    bool params = false;
+    for (; end < param->layer_size() && !blob.empty(); ++end) {
+      const LayerParameter& layer = param->layer(end);
+      PointwiseParameter::Op op;
+      string operand;
+      if (!same_setup(first, layer) || !pointwise_op(layer, blob, &op, &operand)) {
+        break;
+      }
+      const bool scale_bias = op.type() == PointwiseParameter::Op::SCALE && op.bias_term();
+      // The previous result goes nowhere else, unless this one rewrites it
+      if (ops + (scale_bias ? 2 : 1) > kMaxPointwiseOps || (end > i &&
+          layer.top(0) != blob && blob_readers_after(*param, blob, end) > 0)) {
+        break;
+      }
+      ops += scale_bias ? 2 : 1;
+      if (end == i) {
+        pointwise.add_bottom(blob);
+      }
+      if (!operand.empty()) {
+        op.set_operand(pointwise.bottom_size());
+        pointwise.add_bottom(operand);
+      }
+      // Learned blobs in op order, their specs padded to the blob count
+      const int blobs = op.type() == PointwiseParameter::Op::SCALE ? (scale_bias ? 2 : 1) :
+          op.type() == PointwiseParameter::Op::BIAS ? 1 : 0;
+      for (int j = 0; j < blobs; ++j) {
+        params = params || j < layer.param_size();
+        pointwise.add_param()->CopyFrom(j < layer.param_size() ? layer.param(j) : ParamSpec());
+      }
+      pointwise_param->add_op()->Swap(&op);
+      pointwise.set_name(end == i ? layer.name() : pointwise.name() + "+" + layer.name());
+      blob = layer.top(0);
+    }
+    if (end - i < 2) {
+      fused.add_layer()->CopyFrom(first);
+      ++i;
+      continue;
+    }
+    pointwise.set_type("Pointwise");
+    pointwise.add_top(blob);
+    if (!params) {
+      pointwise.clear_param();
+    }
+    if (first.has_forward_type()) {
+      pointwise.set_forward_type(first.forward_type());
+    }
+    if (first.has_backward_type()) {
+      pointwise.set_backward_type(first.backward_type());
+    }
+    if (first.has_forward_math()) {
+      pointwise.set_forward_math(first.forward_math());
+    }
+    if (first.has_backward_math()) {
+      pointwise.set_backward_math(first.backward_math());
+    }
+    if (first.has_pipeline_stage()) {
+      pointwise.set_pipeline_stage(first.pipeline_stage());
+    }
+    if (first.has_phase()) {
+      pointwise.set_phase(first.phase());
+    }
+    fused_pointwise_.push_back(pointwise.name());
+    fused.add_layer()->Swap(&pointwise);
+    merged += end - i;
+    i = end;
+  }
+  if (fused_pointwise_.empty()) {
+    return;
+  }
+  param->mutable_layer()->Swap(fused.mutable_layer());
+  LOG_IF(INFO, Caffe::root_solver()) << "Fused " << merged << " pointwise layers into "
+      << fused_pointwise_.size() << " Pointwise layers";
+}
+
+static bool pointwise(const LayerParameter& layer) {
+  const string& type = layer.type();
+  return type == "ReLU" || type == "Sigmoid" || type == "TanH" || type == "ELU" ||
+      type == "Dropout" || type == "Power" || type == "AbsVal" || type == "BNLL" ||
+      type == "Eltwise";
+}
+
+// Whether the layer reads and writes NHWC blobs: cuDNN layers set up their descriptors
+// from the bottom's packing, pointwise ones don't care about the order
+static bool reads_nhwc(const LayerParameter& layer) {
+  const string& type = layer.type();
+  if (type == "Convolution") {
+    const ConvolutionParameter& conv_param = layer.convolution_param();
+    for (int i = 0; i < conv_param.dilation_size(); ++i) {
+      if (conv_param.dilation(i) > 1) {
+        return false;
+      }
+    }
+    return (conv_param.engine() == ConvolutionParameter_Engine_DEFAULT ||
+        conv_param.engine() == ConvolutionParameter_Engine_CUDNN) &&
+        !layer.has_quantization_param() && layer.bottom_size() == 1 &&
+        conv_param.kernel_size_size() <= 2 && conv_param.axis() == 1;
+  }
+  if (type == "Pooling") {
+    return layer.pooling_param().engine() != PoolingParameter_Engine_CAFFE &&
+        layer.top_size() == 1;
+  }
+  if (type == "BatchNorm") {
+    return layer.batch_norm_param().engine() != BatchNormParameter_Engine_CAFFE &&
+        !layer.batch_norm_param().fused_relu();
+  }
+  return pointwise(layer);
+}
+
+// CPU mode: ONEDNN layers (DEFAULT picks them for float) take the bottom's packing, but
+// for averages oneDNN pools unlike PoolingLayer
+static bool reads_nhwc_onednn(const LayerParameter& layer, Type default_type) {
+  const Type ftype = layer.has_forward_type() ? layer.forward_type() : default_type;
+  if (ftype != FLOAT) {
+    return false;
+  }
+  const string& type = layer.type();
+  if (type == "Convolution") {
+    const ConvolutionParameter& conv_param = layer.convolution_param();
+    return (conv_param.engine() == ConvolutionParameter_Engine_DEFAULT ||
+        conv_param.engine() == ConvolutionParameter_Engine_ONEDNN) &&
+        layer.bottom_size() == 1 && conv_param.kernel_size_size() <= 2 &&
+        conv_param.axis() == 1;
+  }
+  if (type == "Pooling") {
+    const PoolingParameter& pool_param = layer.pooling_param();
+    const bool padded = pool_param.pad() > 0 || pool_param.pad_h() > 0 ||
+        pool_param.pad_w() > 0;
+    return (pool_param.engine() == PoolingParameter_Engine_DEFAULT ||
+        pool_param.engine() == PoolingParameter_Engine_ONEDNN) && layer.top_size() == 1 &&
+        (pool_param.pool() == PoolingParameter_PoolMethod_MAX ||
+        (pool_param.pool() == PoolingParameter_PoolMethod_AVE && !padded));
+  }
+  if (type == "BatchNorm") {
+    const BatchNormParameter& bn_param = layer.batch_norm_param();
+    return (bn_param.engine() == BatchNormParameter_Engine_DEFAULT ||
+        bn_param.engine() == BatchNormParameter_Engine_ONEDNN) && !bn_param.fused_relu() &&
+        bn_param.virtual_batch() == 1 && !bn_param.sync_stats();
+  }
+  if (type == "LRN") {
+    const LRNParameter& lrn_param = layer.lrn_param();
+    return (lrn_param.engine() == LRNParameter_Engine_DEFAULT ||
+        lrn_param.engine() == LRNParameter_Engine_ONEDNN) &&
+        lrn_param.norm_region() == LRNParameter_NormRegion_ACROSS_CHANNELS;
+  }
+  return pointwise(layer);
+}
+
+void Net::ApplyLayout(NetParameter* param) const {
+  if (param->layout() != NHWC) {
+    return;
+  }
+  // CPU mode: oneDNN layers of TEST nets pass NHWC on, Convolution layers switching to it
+  bool onednn = false;
+  if (Caffe::mode() != Caffe::GPU) {
+#ifdef USE_ONEDNN
+    onednn = phase_ == TEST;
+#endif
+    if (!onednn) {
+      LOG_IF(WARNING, Caffe::root_solver()) << "NHWC layout is for GPU mode and oneDNN "
+          << "TEST nets, using NCHW";
+      return;
+    }
+  }
+  NetParameter laid_out;
+  set<string> nhwc;  // blobs holding NHWC data
+  map<string, string> converted;  // NHWC blob -> its NCHW copy
+  map<string, string> alias;  // blob renamed by an in-place layer reading a copy
+  int marked = 0, conversions = 0;
+  for (int i = 0; i < param->layer_size(); ++i) {
+    LayerParameter layer = param->layer(i);
+    for (int j = 0; j < layer.bottom_size(); ++j) {
+      auto it = alias.find(layer.bottom(j));
+      if (it != alias.end()) {
+        if (j < layer.top_size() && layer.top(j) == layer.bottom(j)) {
+          layer.set_top(j, it->second);
+        }
+        layer.set_bottom(j, it->second);
+      }
+    }
+    bool all_nhwc = layer.bottom_size() > 0;
+    for (int j = 0; j < layer.bottom_size(); ++j) {
+      all_nhwc = all_nhwc && nhwc.count(layer.bottom(j)) > 0;
+    }
+    const bool data_layer = layer.type() == "Data" || layer.type() == "ImageData" ||
+        layer.type() == "WindowData";
+    bool writes_nhwc;
+    if (onednn) {
+      writes_nhwc = reads_nhwc_onednn(layer, param->default_forward_type()) &&
+          (all_nhwc || layer.type() == "Convolution");
+    } else {
+      writes_nhwc = data_layer ? !layer.transform_param().has_forward_packing() ||
+          layer.transform_param().forward_packing() == NHWC : all_nhwc && reads_nhwc(layer);
+    }
+    if (!writes_nhwc) {
+      // Mixed or NCHW only readers get NCHW copies, one per blob version
+      for (int j = 0; j < layer.bottom_size(); ++j) {
+        const string blob = layer.bottom(j);
+        if (nhwc.count(blob) == 0) {
+          continue;
+        }
+        if (converted.count(blob) == 0) {
+          LayerParameter* layout = laid_out.add_layer();
+          layout->set_name(blob + "_nchw");
+          layout->set_type("Layout");
+          layout->add_bottom(blob);
+          layout->add_top(blob + "_nchw");
+          layout->mutable_layout_param()->set_packing(NCHW);
+          if (layer.has_forward_type()) {
+            layout->set_forward_type(layer.forward_type());
+          }
+          if (layer.has_backward_type()) {
+            layout->set_backward_type(layer.backward_type());
+          }
+          if (layer.has_pipeline_stage()) {
+            layout->set_pipeline_stage(layer.pipeline_stage());
+          }
+          converted[blob] = layout->top(0);
+          ++conversions;
+        }
+        if (j < layer.top_size() && layer.top(j) == blob) {
+          layer.set_top(j, converted[blob]);
+          alias[blob] = converted[blob];
+        }
+        layer.set_bottom(j, converted[blob]);
+      }
+    }
+    // New versions of the tops replace older ones and their copies
+    for (int j = 0; j < layer.top_size(); ++j) {
+      converted.erase(layer.top(j));
+      if (writes_nhwc && (!data_layer || j == 0)) {
+        nhwc.insert(layer.top(j));
+      } else {
+        nhwc.erase(layer.top(j));
+      }
+    }
+    if (writes_nhwc) {
+      if (data_layer) {
+        layer.mutable_transform_param()->set_forward_packing(NHWC);
+      }
+      layer.mutable_layout_param()->set_packing(NHWC);
+      ++marked;
+    }
+    laid_out.add_layer()->Swap(&layer);
+  }
+  param->mutable_layer()->Swap(laid_out.mutable_layer());
+  LOG_IF(INFO, Caffe::root_solver()) << "NHWC layout: " << marked << " layers, "
+      << conversions << " conversions to NCHW";
+}
+
+// Extent, stride and padding along axis 2 of Convolution and Pooling windows
+struct RowWindow {
+  int extent, stride, pad;
+};
+
+static RowWindow row_window(const LayerParameter& layer) {
+  RowWindow w;
+  if (layer.type() == "Convolution") {
+    const ConvolutionParameter& conv_param = layer.convolution_param();
+    const int kernel = conv_param.has_kernel_h() ? conv_param.kernel_h() :
+        conv_param.kernel_size(0);
+    const int dilation = conv_param.dilation_size() > 0 ? conv_param.dilation(0) : 1;
+    w.extent = dilation * (kernel - 1) + 1;
+    w.stride = conv_param.has_stride_h() ? conv_param.stride_h() :
+        conv_param.stride_size() > 0 ? conv_param.stride(0) : 1;
+    w.pad = conv_param.has_pad_h() ? conv_param.pad_h() :
+        conv_param.pad_size() > 0 ? conv_param.pad(0) : 0;
+  } else {
+    const PoolingParameter& pool_param = layer.pooling_param();
+    w.extent = pool_param.has_kernel_h() ? pool_param.kernel_h() : pool_param.kernel_size();
+    w.stride = pool_param.has_stride_h() ? pool_param.stride_h() : pool_param.stride();
+    w.pad = pool_param.has_pad_h() ? pool_param.pad_h() : pool_param.pad();
+  }
+  return w;
+}
+
+// Layers whose outputs mix rows, which stripes can't feed
+static bool mixes_rows(const LayerParameter& layer) {
+  const string& type = layer.type();
+  return type == "InnerProduct" || type == "Flatten" || type == "Reshape" ||
+      type == "Deconvolution" || type == "Crop" || type == "Im2col" || type == "SPP" ||
+      (type == "Pooling" && layer.pooling_param().global_pooling()) ||
+      (type == "LRN" &&
+      layer.lrn_param().norm_region() == LRNParameter_NormRegion_WITHIN_CHANNEL);
+}
+
+void Net::PartitionSpatially(NetParameter* param) const {
+  const int stripes = param->spatial_stripes();
+  if (stripes <= 1) {
+    return;
+  }
+  if (phase_ != TRAIN) {
+    LOG_IF(INFO, Caffe::root_solver()) << "Spatial stripes are for TRAIN nets, "
+        << param->name() << " runs whole";
+    return;
+  }
+#if defined(CPU_ONLY) || !defined(USE_NCCL)
+  LOG(FATAL) << "NetParameter::spatial_stripes needs a GPU build with NCCL";
+#endif
+  CHECK_EQ(Caffe::solver_count() % stripes, 0) << "spatial_stripes " << stripes
+      << " doesn't divide the " << Caffe::solver_count() << " solvers in groups";
+  CHECK_NE(param->layout(), NHWC) << "Spatial stripes are rows of NCHW blobs";
+  NetParameter striped;
+  set<string> stripe_blobs;  // blobs holding stripes
+  map<string, string> alias;  // blob of a data layer -> its stripe
+  int halos = 0, synced = 0;
+  for (int i = 0; i < param->layer_size(); ++i) {
+    LayerParameter layer = param->layer(i);
+    bool reads_stripes = false;
+    for (int j = 0; j < layer.bottom_size(); ++j) {
+      auto it = alias.find(layer.bottom(j));
+      if (it != alias.end()) {
+        if (j < layer.top_size() && layer.top(j) == layer.bottom(j)) {
+          layer.set_top(j, it->second);
+        }
+        layer.set_bottom(j, it->second);
+      }
+      reads_stripes = reads_stripes || stripe_blobs.count(layer.bottom(j)) > 0;
+    }
+    if (reads_stripes) {
+      CHECK(!mixes_rows(layer)) << layer.type() << " layer " << layer.name()
+          << " mixes rows, it can't take spatial stripes";
+      if (layer.type() == "Convolution" || layer.type() == "Pooling") {
+        const RowWindow w = row_window(layer);
+        const bool same = layer.type() == "Convolution" && w.extent - 1 == 2 * w.pad;
+        CHECK(same || (w.pad == 0 && (w.extent == w.stride ||
+            (layer.type() == "Convolution" && w.extent < w.stride))))
+            << layer.name() << ": spatial stripes take convolutions padding half their "
+            << "window along axis 2, or windows not overlapping without padding";
+        if (w.pad > 0) {
+          // The halo replaces the padding, zeros at the edges of the sample
+          ConvolutionParameter* conv_param = layer.mutable_convolution_param();
+          if (conv_param->has_pad_h()) {
+            conv_param->set_pad_h(0);
+          } else if (conv_param->pad_size() == 1) {
+            conv_param->set_pad_w(conv_param->pad(0));
+            conv_param->set_pad_h(0);
+            conv_param->clear_pad();
+          } else {
+            conv_param->set_pad(0, 0);
+          }
+          for (int j = 0; j < layer.bottom_size(); ++j) {
+            LayerParameter* halo = striped.add_layer();
+            halo->set_name(layer.name() + "_halo" + (j > 0 ? std::to_string(j) : ""));
+            halo->set_type("Halo");
+            halo->add_bottom(layer.bottom(j));
+            halo->add_top(halo->name());
+            halo->mutable_spatial_param()->set_stripes(stripes);
+            halo->mutable_spatial_param()->set_halo(w.pad);
+            if (layer.has_forward_type()) {
+              halo->set_forward_type(layer.forward_type());
+            }
+            if (layer.has_backward_type()) {
+              halo->set_backward_type(layer.backward_type());
+            }
+            if (layer.has_pipeline_stage()) {
+              halo->set_pipeline_stage(layer.pipeline_stage());
+            }
+            layer.set_bottom(j, halo->top(0));
+            ++halos;
+          }
+        }
+      } else if (layer.type() == "BatchNorm") {
+        layer.mutable_batch_norm_param()->set_sync_stats(true);
+        ++synced;
+      }
+    }
+    for (int j = 0; j < layer.top_size(); ++j) {
+      alias.erase(layer.top(j));
+      if (reads_stripes) {
+        stripe_blobs.insert(layer.top(j));
+      } else {
+        stripe_blobs.erase(layer.top(j));
+      }
+    }
+    const bool data_layer = layer.bottom_size() == 0;
+    LayerParameter* added = striped.add_layer();
+    added->Swap(&layer);
+    if (!data_layer) {
+      continue;
+    }
+    // Data layers: every top becomes the stripe of the group's first solver batch
+    for (int j = 0; j < added->top_size(); ++j) {
+      const string& blob = added->top(j);
+      LayerParameter* stripe = striped.add_layer();
+      stripe->set_name(blob + "_stripe");
+      stripe->set_type("Stripe");
+      stripe->add_bottom(blob);
+      stripe->add_top(stripe->name());
+      stripe->mutable_spatial_param()->set_stripes(stripes);
+      if (added->has_pipeline_stage()) {
+        stripe->set_pipeline_stage(added->pipeline_stage());
       }
+      alias[blob] = stripe->top(0);
+      stripe_blobs.insert(stripe->top(0));
     }
   }
-  // In the end, all remaining blobs are considered output blobs.
-  for (set<string>::iterator it = available_blobs.begin();
-      it != available_blobs.end(); ++it) {
-    LOG_IF(INFO, Caffe::root_solver())
-        << "This network produces output " << *it;
-    net_output_blobs_.push_back(blobs_[blob_name_to_idx[*it]].get());
-    net_output_blob_indices_.push_back(blob_name_to_idx[*it]);
+  param->mutable_layer()->Swap(striped.mutable_layer());
+  LOG_IF(INFO, Caffe::root_solver()) << "Spatial stripes: " << stripes << " per sample, "
+      << halos << " halo exchanges, " << synced << " BatchNorm layers synchronized";
+}
+
+void Net::FusePointwiseWeights(const NetParameter& param) {
+  if (fused_pointwise_.empty()) {
+    return;
   }
-  for (int blob_id = 0; blob_id < blob_names_.size(); ++blob_id) {
-    blob_names_index_[blob_names_[blob_id]] = blob_id;
+  map<string, const LayerParameter*> source;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    source[param.layer(i).name()] = &param.layer(i);
   }
-  for (int layer_id = 0; layer_id < layer_names_.size(); ++layer_id) {
-    layer_names_index_[layer_names_[layer_id]] = layer_id;
+  for (const string& name : fused_pointwise_) {
+    LayerBase* layer = layers_[layer_names_index_[name]].get();
+    vector<shared_ptr<Blob>>& target_blobs = layer->blobs();
+    int blob = 0;
+    for (const PointwiseParameter::Op& op : layer->layer_param().pointwise_param().op()) {
+      const int blobs = op.type() == PointwiseParameter::Op::SCALE ? (op.bias_term() ? 2 : 1)
+          : op.type() == PointwiseParameter::Op::BIAS ? 1 : 0;
+      auto it = source.find(op.layer());
+      if (blobs > 0 && it != source.end()) {
+        const LayerParameter& source_layer = *it->second;
+        CHECK_EQ(source_layer.blobs_size(), blobs)
+            << "Incompatible number of blobs for layer " << op.layer();
+        for (int j = 0; j < blobs; ++j) {
+          CHECK(target_blobs[blob + j]->ShapeEquals(source_layer.blobs(j)))
+              << "Cannot copy param " << j << " weights from layer '" << op.layer()
+              << "' into " << name << "; shape mismatch";
+          target_blobs[blob + j]->FromProto(source_layer.blobs(j), false);
+        }
+        LOG(INFO) << "Copying source layer " << op.layer() << " into " << name;
+      }
+      blob += blobs;
+    }
   }
-  ShareWeights();
+}
 
-  // invert param_layer_indices_ to give map of
-  // (level_id, local param_id) -> global param_id
-  for (int i = 0; i < param_layer_indices_.size(); ++i) {
-    layer_index_params_[param_layer_indices_[i]] = i;
+// Values of a trained blob as float, whatever type it was stored in
+static vector<float> blob_values(const BlobProto& proto) {
+  TBlob<float> blob;
+  blob.FromProto(proto, true);
+  return vector<float>(blob.cpu_data(), blob.cpu_data() + blob.count());
+}
+
+void Net::ApplyInt8Calibration(NetParameter* param) const {
+  if (param->int8_calibration().empty() || phase_ != TEST) {
+    return;
+  }
+  QuantizationTable table;
+  ReadProtoFromTextFileOrDie(param->int8_calibration(), &table);
+  std::map<string, float> scales;
+  for (const QuantizationTable::Entry& entry : table.entry()) {
+    scales[entry.layer()] = entry.input_scale();
   }
+  int quantized = 0;
+  for (int i = 0; i < param->layer_size(); ++i) {
+    LayerParameter* layer = param->mutable_layer(i);
+    auto it = scales.find(layer->name());
+    if (it == scales.end() || layer->has_quantization_param()) {
+      continue;
+    }
+    CHECK(layer->type() == "Convolution" || layer->type() == "InnerProduct")
+        << "Can't quantize layer " << layer->name() << " of type " << layer->type();
+    layer->mutable_quantization_param()->set_input_scale(it->second);
+    ++quantized;
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << "INT8 layers: " << quantized << " calibrated in "
+      << param->int8_calibration();
+}
 
-#ifndef CPU_ONLY
-  learnable_space_size_[0] = 0UL;
-  learnable_space_size_[1] = 0UL;
-  reduce_buckets_ = (size_t) in_param.reduce_buckets();
-  LOG_IF(INFO, Caffe::root_solver())
-      << "Top memory (" << Phase_Name(phase_) << ") required for data: "
-      << gpu_top_memory_data_use_ << " diff: " << gpu_top_memory_diff_use_;
-  LOG_IF(INFO, Caffe::root_solver())
-      << "Bottom memory (" << Phase_Name(phase_) << ") required for data: "
-      << gpu_btm_memory_data_use_ << " diff: " << gpu_btm_memory_diff_use_;
-  LOG_IF(INFO, Caffe::root_solver())
-      << "Shared (in-place) memory (" << Phase_Name(phase_) << ") by data: "
-      << gpu_shr_memory_data_use_ << " diff: " << gpu_shr_memory_diff_use_;
-  LOG_IF(INFO, Caffe::root_solver())
-      << "Parameters memory (" << Phase_Name(phase_) << ") required for data: "
-      << gpu_prm_memory_data_use_ << " diff: " << gpu_prm_memory_diff_use_;
-  LOG_IF(INFO, Caffe::root_solver())
-      << "Parameters shared memory (" << Phase_Name(phase_) << ") by data: "
-          << gpu_shp_memory_data_use_ << " diff: " << gpu_shp_memory_diff_use_;
-#endif
-  debug_info_ = param.debug_info();
-  trained_layers_shared_ = false;
-  LOG_IF(INFO, Caffe::root_solver()) << "Network initialization done.";
+void Net::FoldBatchNormWeights(const NetParameter& param) {
+  if (folded_bn_.empty()) {
+    return;
+  }
+  map<string, const LayerParameter*> source;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    source[param.layer(i).name()] = &param.layer(i);
+  }
+  for (const auto& f : folded_bn_) {
+    const FoldedBN& fold = f.second;
+    auto bn_it = source.find(fold.bn);
+    CHECK(bn_it != source.end()) << "BatchNorm layer " << fold.bn << " folded into "
+        << f.first << " is missing in the trained net";
+    vector<shared_ptr<Blob>>& target_blobs = layers_[layer_names_index_[f.first]]->blobs();
+    CHECK_EQ(target_blobs.size(), 2);
+    const int channels = target_blobs[0]->shape(0);
+    const LayerParameter& bn = *bn_it->second;
+    CHECK_GE(bn.blobs_size(), 3) << "BatchNorm layer " << fold.bn << " has no statistics";
+    vector<vector<float>> bn_blobs;
+    for (int j = 0; j < bn.blobs_size(); ++j) {
+      bn_blobs.push_back(blob_values(bn.blobs(j)));
+    }
+    // See BatchNormLayer for the blob layout, legacy DIGITS format as in
+    // CopyTrainedLayersFrom
+    int mean_id = 0, var_id = 1, scale_id = 3, bias_id = 4;
+    if (bn_blobs.size() == 5 && bn_blobs[4].size() == 1) {
+      scale_id = 0;
+      bias_id = 1;
+      mean_id = 2;
+      var_id = 3;
+    }
+    const vector<float>& mean = bn_blobs[mean_id];
+    const vector<float>& var = bn_blobs[var_id];
+    CHECK_EQ(mean.size(), channels) << fold.bn << " doesn't match " << f.first;
+    CHECK_EQ(var.size(), channels) << fold.bn << " doesn't match " << f.first;
+    vector<float> gamma(channels, 1.F), beta(channels, 0.F);
+    if (bn_blobs.size() == 5) {
+      gamma = bn_blobs[scale_id];
+      beta = bn_blobs[bias_id];
+      CHECK_EQ(gamma.size(), channels) << fold.bn << " doesn't match " << f.first;
+      CHECK_EQ(beta.size(), channels) << fold.bn << " doesn't match " << f.first;
+    }
+    if (!fold.scale.empty()) {
+      auto scale_it = source.find(fold.scale);
+      CHECK(scale_it != source.end()) << "Scale layer " << fold.scale << " folded into "
+          << f.first << " is missing in the trained net";
+      const LayerParameter& scale = *scale_it->second;
+      CHECK_GE(scale.blobs_size(), fold.scale_bias ? 2 : 1);
+      const vector<float> s = blob_values(scale.blobs(0));
+      const vector<float> b = fold.scale_bias ? blob_values(scale.blobs(1)) : vector<float>();
+      CHECK_EQ(s.size(), channels) << fold.scale << " doesn't match " << f.first;
+      for (int c = 0; c < channels; ++c) {
+        gamma[c] *= s[c];
+        beta[c] = beta[c] * s[c] + (b.empty() ? 0.F : b[c]);
+      }
+    }
+    // y = gamma * (W x + b - mean) / sqrt(var + eps) + beta
+    TBlob<float> weights, bias;
+    weights.CopyDataFrom(*target_blobs[0], true);
+    bias.CopyDataFrom(*target_blobs[1], true);
+    CHECK_EQ(bias.count(), channels);
+    float* w = weights.mutable_cpu_data();
+    float* b = bias.mutable_cpu_data();
+    const int inner = weights.count() / channels;
+    for (int c = 0; c < channels; ++c) {
+      const float a = gamma[c] / std::sqrt(var[c] + fold.eps);
+      for (int k = 0; k < inner; ++k) {
+        w[c * inner + k] *= a;
+      }
+      b[c] = (b[c] - mean[c]) * a + beta[c];
+    }
+    target_blobs[0]->CopyDataFrom(weights);
+    target_blobs[1]->CopyDataFrom(bias);
+    LOG(INFO) << "Folded " << fold.bn << (fold.scale.empty() ? "" : " and ") << fold.scale
+              << " into " << f.first;
+  }
 }
 
 void Net::FilterNet(const NetParameter& param, NetParameter* param_filtered) {
@@ -619,7 +3239,9 @@ void Net::AppendParam(const NetParameter& param, const int layer_id, const int p
     has_params_lr_.push_back(param_spec->has_lr_mult());
     has_params_decay_.push_back(param_spec->has_decay_mult());
     params_lr_.push_back(param_spec->lr_mult());
+    params_lr_group_.push_back(param_spec->lr_group());
     params_weight_decay_.push_back(param_spec->decay_mult());
+    params_sparse_2_4_.push_back(param_spec->sparse_2_4());
   } else {
     // Named param blob with name we've seen before: share params
     const int owner_net_param_id = param_names_index_[param_name];
@@ -665,6 +3287,17 @@ void Net::AppendParam(const NetParameter& param, const int layer_id, const int p
         params_lr_[learnable_param_id] = param_spec->lr_mult();
       }
     }
+    if (param_spec->has_lr_group()) {
+      if (!params_lr_group_[learnable_param_id].empty()) {
+        CHECK_EQ(param_spec->lr_group(), params_lr_group_[learnable_param_id])
+            << "Shared param '" << param_name << "' has mismatched lr_group.";
+      } else {
+        params_lr_group_[learnable_param_id] = param_spec->lr_group();
+      }
+    }
+    if (param_spec->sparse_2_4()) {
+      params_sparse_2_4_[learnable_param_id] = true;
+    }
     if (param_spec->has_decay_mult()) {
       if (has_params_decay_[learnable_param_id]) {
         CHECK_EQ(param_spec->decay_mult(),
@@ -682,14 +3315,100 @@ float Net::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
   CHECK_LT(end, layers_.size());
   float loss = 0;
+#ifndef CPU_ONLY
+  if (offload_) {
+    // Prefetches left behind by a partial backward must land before we overwrite
+    for (int g = 0; g < offload_state_.size(); ++g) {
+      if (offload_state_[g] == OFFLOAD_PUSHING) {
+        CUDA_CHECK(cudaStreamWaitEvent(Caffe::thread_stream(), offload_events_[g], 0));
+        offload_state_[g] = OFFLOAD_RESIDENT;
+      }
+    }
+  }
+  const bool prefetch = GPUMemory::managed() && Caffe::mode() == Caffe::GPU;
+#endif
+  if (start == 0 && Caffe::mode() == Caffe::GPU) {
+#ifndef CPU_ONLY
+    if (forward_gated_) {
+      WaitUpdated(0);  // gates every converted param, see BuildForwardGates
+    }
+#endif
+    ConvertLearnableParams();
+  }
+#ifndef CPU_ONLY
+  if (stream_weights_) {
+    if (!stream_ready_) {
+      PrepareStreamedWeights();
+    }
+    // The ring's first layers of the range, the others follow as buffers free up
+    int queued = 0;
+    for (int j = 0; j < streamed_.size() && queued < stream_buffers_; ++j) {
+      if (streamed_[j].layer_id >= start && streamed_[j].layer_id <= end) {
+        StreamWeights(j);
+        ++queued;
+      }
+    }
+  }
+  if (!stage_of_.empty()) {
+    return ForwardStages(start, end);
+  }
+  if (!trt_segments_.empty() && start == 0 && end + 1 == layers_.size() &&
+      !trained_layers_shared_) {
+    loss = ForwardTensorRT();
+    ++infer_count_;
+    return loss;
+  }
+  // Gated forward runs layer by layer
+  if (cuda_graph_ && start == 0 && end + 1 == layers_.size() && Caffe::mode() == Caffe::GPU &&
+      !debug_info_ && !forward_gated_) {
+    loss = ForwardGraphed();
+    ++infer_count_;
+    return loss;
+  }
+  if (start == 0 && end + 1 == layers_.size() && branches_ready() && !forward_gated_) {
+    loss = ForwardBranches();
+    ++infer_count_;
+    return loss;
+  }
+#endif
   for (int i = start; i <= end; ++i) {
+#ifndef CPU_ONLY
+    if (forward_gated_) {
+      WaitUpdated(i);
+    }
+    if (prefetch) {
+      // Next layer's pages migrate while this one computes
+      PrefetchManaged(i + 1, false);
+    }
+    if (stream_weights_) {
+      StreamWeightsBefore(i);
+    }
+#endif
     // LOG(INFO) << " ****** [Forward] (" << i << ") Layer '" << layer_names_[i];
     // << "' FT " << Type_Name(layers_[i]->forward_type())
     // << " BT " << Type_Name(layers_[i]->backward_type());
-    float layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+    float layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i], loss_slot_);
+#ifndef CPU_ONLY
+    if (stream_weights_) {
+      StreamWeightsAfter(i, end);
+    }
+#endif
     loss += layer_loss;
     if (debug_info_) { ForwardDebugInfo(i); }
+    if (recompute_ && i == segment_last_[segment_of_[i]]) {
+      ReleaseSegment(segment_of_[i]);
+    }
+#ifndef CPU_ONLY
+    if (offload_) {
+      OffloadAfter(i);
+    }
+#endif
+  }
+#ifndef CPU_ONLY
+  if (offload_) {
+    ReleaseOffloaded(true);
   }
+#endif
   ++infer_count_;
   return loss;
 }
@@ -721,13 +3440,197 @@ const vector<Blob*>& Net::Forward(const vector<Blob*>& bottom, float* loss) {
   return Forward(loss);
 }
 
-float Net::ForwardBackward(bool apply_update) {
+float Net::ForwardBackward(bool apply_update, bool first_micro_batch) {
   float loss;
-  Forward(&loss);
+  const double start_us = now_us();
+#ifndef CPU_ONLY
+  // SolverParameter::comm_delay_probe_interval: backward of the last micro-batch, the one
+  // reductions overlap, is timed on the GPU
+  const bool time_backward = apply_update && solver_ != nullptr &&
+      Caffe::mode() == Caffe::GPU && solver_->param().comm_delay_probe_interval() > 0;
+  if (time_backward) {
+    ReadBackwardTime();
+    for (cudaEvent_t& event : backward_events_) {
+      if (event == nullptr) {
+        CUDA_CHECK(cudaEventCreate(&event));
+      }
+    }
+  }
+#endif
+  if (forward_done_ahead_) {
+    loss = ahead_loss_;
+    forward_done_ahead_ = false;
+  } else {
+    Forward(&loss);
+  }
+  const double forward_us = now_us();
+  if (first_micro_batch) {
+    for (int layer_id : overwrite_layers_) {
+      layers_[layer_id]->set_overwrite_param_diffs(true);
+    }
+  }
+#ifndef CPU_ONLY
+  first_micro_batch_ = first_micro_batch;
+  if (time_backward) {
+    CUDA_CHECK(cudaEventRecord(backward_events_[0], Caffe::thread_stream()));
+  }
+#endif
   Backward(apply_update);
+#ifndef CPU_ONLY
+  if (time_backward) {
+    CUDA_CHECK(cudaEventRecord(backward_events_[1], Caffe::thread_stream()));
+    backward_timed_ = comm_probe_iter(solver_->iter()) ? 1 : 0;
+  }
+#endif
+  if (first_micro_batch) {
+    for (int layer_id : overwrite_layers_) {
+      layers_[layer_id]->set_overwrite_param_diffs(false);
+    }
+  }
+#ifndef CPU_ONLY
+  if (apply_update && blob_monitor_) {
+    blob_monitor_->Tick(Caffe::thread_stream());
+  }
+#endif
+  forward_us_ += static_cast<uint64_t>(forward_us - start_us);
+  backward_us_ += static_cast<uint64_t>(now_us() - forward_us);
   return loss;
 }
 
+void Net::ForwardAhead() {
+  CHECK(!forward_done_ahead_);
+  const double start_us = now_us();
+#ifndef CPU_ONLY
+  if (forward_gates_.empty()) {
+    BuildForwardGates();
+  }
+#endif
+  forward_gated_ = true;
+  Forward(&ahead_loss_);
+  forward_gated_ = false;
+  forward_done_ahead_ = true;
+  forward_us_ += static_cast<uint64_t>(now_us() - start_us);
+}
+
+bool Net::forward_ahead() const {
+#ifndef CPU_ONLY
+  // Pipeline stages and offloading keep their own schedules, local SGD averages params
+  // after the updates
+  return solver_ != nullptr && solver_->param().overlap_next_forward() &&
+      Caffe::mode() == Caffe::GPU && stage_of_.empty() && !offload_ &&
+      !(Caffe::solver_count() > 1 && solver_->param().local_sgd_iters() > 1);
+#else
+  return false;
+#endif
+}
+
+Net::Timing Net::timing() const {
+  Timing timing{forward_us_, backward_us_, reduce_us_, reduce_bytes_, 0UL};
+  for (const shared_ptr<LayerBase>& layer : layers_) {
+    timing.data_wait_us += layer->prefetch_wait_us();
+  }
+  return timing;
+}
+
+LayerCost Net::cost() const {
+  LayerCost total = LayerCost();
+  for (int i = 0; i < layers_.size(); ++i) {
+    const LayerCost cost = layer_cost(layers_[i].get(), bottom_vecs_[i], top_vecs_[i]);
+    total.forward_flops += cost.forward_flops;
+    total.backward_flops += cost.backward_flops;
+    total.forward_bytes += cost.forward_bytes;
+    total.backward_bytes += cost.backward_bytes;
+    total.activation_bytes += cost.activation_bytes;
+  }
+  return total;
+}
+
+vector<Net::MemoryUse> Net::MemoryReport() const {
+  vector<MemoryUse> rows;
+#ifndef CPU_ONLY
+  std::set<const Blob*> seen;
+  auto add = [&](int layer_id, const Blob* blob, const string& name, const char* kind) {
+    if (!seen.insert(blob).second) {
+      return;
+    }
+    rows.push_back(MemoryUse{layer_names_[layer_id], name, kind, blob->data_type(),
+        blob->diff_type(), blob->gpu_memory_data_use(), blob->gpu_memory_diff_use()});
+  };
+  for (int i = 0; i < layers_.size(); ++i) {
+    for (int j = 0; j < top_vecs_[i].size(); ++j) {
+      add(i, top_vecs_[i][j], blob_names_[top_id_vecs_[i][j]], "top");
+    }
+    const vector<shared_ptr<Blob>>& params = layers_[i]->blobs();
+    for (int j = 0; j < params.size(); ++j) {
+      add(i, params[j].get(), layer_names_[i] + "[" + std::to_string(j) + "]", "param");
+    }
+    const size_t workspace = layers_[i]->workspace_bytes();
+    if (workspace > 0UL) {
+      const Type type = layers_[i]->layer_param().forward_type();
+      rows.push_back(MemoryUse{layer_names_[i], string(), "workspace", type, type,
+          workspace, 0UL});
+    }
+  }
+#endif
+  return rows;
+}
+
+string Net::MemoryReportString() const {
+  const vector<MemoryUse> rows = MemoryReport();
+  std::ostringstream os;
+  os << "Device memory of net " << name_ << " (" << Phase_Name(phase_) << "), bytes:";
+  size_t data[2] = {0UL, 0UL}, diff[2] = {0UL, 0UL}, workspace = 0UL;
+  for (const MemoryUse& row : rows) {
+    const bool workspace_row = row.blob.empty();
+    os << "\n  " << std::left << std::setw(24) << row.layer << " " << std::setw(24)
+       << (workspace_row ? string("-") : row.blob) << " " << std::setw(9) << row.kind
+       << std::right << " data " << std::setw(8) << Type_Name(row.data_type) << " "
+       << std::setw(12) << row.data_bytes;
+    if (workspace_row) {
+      workspace = std::max(workspace, row.data_bytes);
+      continue;
+    }
+    os << " diff " << std::setw(8) << Type_Name(row.diff_type) << " " << std::setw(12)
+       << row.diff_bytes;
+    const int k = row.kind == "param" ? 1 : 0;
+    data[k] += row.data_bytes;
+    diff[k] += row.diff_bytes;
+  }
+  os << "\n  Tops: data " << data[0] << ", diff " << diff[0]
+     << ". Params: data " << data[1] << ", diff " << diff[1]
+     << ". Largest workspace (shared by layers): " << workspace;
+#ifndef CPU_ONLY
+  if (activations_) {
+    os << ". Planned activation arena: " << activation_bytes_;
+  }
+  if (Caffe::mode() == Caffe::GPU) {
+    size_t in_use = 0UL, peak = 0UL;
+    GPUMemory::GetUsage(&in_use, &peak);
+    os << "\n  Allocator: in use " << in_use << ", peak " << peak
+       << ", cached and free " << GPUMemory::cached_free_bytes();
+  }
+#endif
+  return os.str();
+}
+
+#ifndef CPU_ONLY
+size_t Net::RelocateBlobs(std::unordered_set<const Tensor*>* visited) {
+  size_t moved = 0UL;
+  // Params live longest: they go lowest
+  for (const shared_ptr<Blob>& param : params_) {
+    moved += param->relocate_gpu(visited);
+  }
+  for (const shared_ptr<Blob>& blob : blobs_) {
+    moved += blob->relocate_gpu(visited);
+  }
+  if (moved > 0UL) {
+    // Captured with the old addresses
+    ReleaseGraphs();
+  }
+  return moved;
+}
+#endif
+
 void Net::BackwardFromTo(int start, int end) {
   BackwardFromToAu(start, end, true);
 }
@@ -735,7 +3638,45 @@ void Net::BackwardFromTo(int start, int end) {
 void Net::BackwardFromToAu(int start, int end, bool apply_update) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
-  for (int i = start; i >= end; --i) {
+  // Layers below backward_end_ are frozen
+  int stop = std::max(end, backward_end_);
+#ifndef CPU_ONLY
+  if (offload_) {
+    stop = end;  // prefetches of offloaded buffers run down to the first layer
+  }
+  if (!stage_of_.empty()) {
+    BackwardStages(start, stop, apply_update);
+    return;
+  }
+  if (offload_) {
+    // Prefetches scheduled above the starting layer
+    for (int i = layers_.size() - 1; i > start; --i) {
+      PrefetchBefore(i);
+    }
+  }
+  const bool prefetch = GPUMemory::managed() && Caffe::mode() == Caffe::GPU;
+  if (start + 1 == layers_.size() && end == 0 && branch_backward_ && branches_ready()) {
+    BackwardBranches(apply_update);
+    return;
+  }
+#endif
+  for (int i = start; i >= stop; --i) {
+#ifndef CPU_ONLY
+    if (offload_) {
+      PrefetchBefore(i);
+    }
+    if (prefetch) {
+      PrefetchManaged(i - 1, true);
+    }
+#endif
+    if (recompute_) {
+      if (i + 1 < layers_.size() && segment_of_[i + 1] != segment_of_[i]) {
+        ReleaseSegment(segment_of_[i + 1]);  // its backward is done
+      }
+      if (segment_released_[segment_of_[i]]) {
+        RecomputeSegment(segment_of_[i]);
+      }
+    }
     if (!layer_need_backward_[i]) {
       continue;
     }
@@ -745,24 +3686,11 @@ void Net::BackwardFromToAu(int start, int end, bool apply_update) {
     if (debug_info_) {
       BackwardDebugInfo(i);
     }
-    if (!apply_update) {
-      continue;
-    }
-    for (int j = 0; j < layers_[i]->blobs().size(); ++j) {
-      if (layers_[i]->skip_apply_update(j)) {
-        continue;
-      }
-      const int param_id = layer_index_params_[make_pair(i, j)];
-      if (param_owners_[param_id] < 0) {
-        const int lparam_id = learnable_param_ids_[param_id];
-        int t = (int)learnable_params_[lparam_id]->diff_type();
-        for (int type_id = 0; type_id < learnable_types_.size(); ++type_id) {
-          if (t == learnable_types_[type_id]) {
-            reduction_queue_[type_id].push(lparam_id);
-            break;
-          }
-        }
-      }  // leave it to the owner otherwise
+#ifndef CPU_ONLY
+    AccumulateGradients(i);
+#endif
+    if (apply_update) {
+      GradientsReady(i);
     }
   }
   if (apply_update) {
@@ -772,143 +3700,272 @@ void Net::BackwardFromToAu(int start, int end, bool apply_update) {
   }
 }
 
-void Net::Finalize() {
+void Net::GradientsReady(int layer_id) {
+  // One event and one wakeup per layer owning learnable params, shared ones are
+  // left to the owner
   for (int type_id = 0; type_id < learnable_types_.size(); ++type_id) {
-    reduction_queue_[type_id].push(END_OF_TRAIN);
-  }
-}
-
-#ifndef CPU_ONLY
-size_t Net::received_contiguous_count(int type_id, const std::set<int>& au_ids, int& id_from_ret) {
-  if (learnable_params_.empty() || au_ids.empty() || param_id_vecs_.empty()) {
-    return 0;
-  }
-  size_t cnt_ret = 0UL, cnt = 0UL;
-  const int bottom = *au_ids.begin();
-  const int top = *au_ids.rbegin();
-  id_from_ret = -1;
-  const std::map<size_t, std::set<int>>& ltop = ltop_[type_id];
-  for (auto lit = ltop.rbegin(); lit != ltop.rend(); ++lit) { //size_t layer_id = top_layer_id; layer_id > 0UL; --layer_id) {
-    if (lit->second.empty() || *lit->second.begin() > top) {
+    const vector<int>& slots = grad_layer_slot_[type_id];
+    const int slot = layer_id < slots.size() ? slots[layer_id] : -1;
+    if (slot < 0) {
       continue;
     }
-    bool layer_complete = true;
-    for (auto p = lit->second.begin(); p != lit->second.end(); ++p) {
-      int param_id = *p;
-      if (param_id < bottom || au_ids.find(param_id) == au_ids.end()) {
-        layer_complete = false;
-        break;
-      }
-      cnt += lp_aligned_count(param_id);
+#ifndef CPU_ONLY
+    GradLayer& gl = grad_layers_[type_id][slot];
+    if (Caffe::mode() == Caffe::GPU) {
+      CUDA_CHECK(cudaEventRecord(gl.ready, Caffe::thread_stream()));
     }
-    if (layer_complete) {
-      id_from_ret = *lit->second.begin();
-      cnt_ret = cnt;
-    } else {
-      break;
+    if (reduce_buckets_tune_iters_ > 0) {
+      gl.ready_us = now_us();
     }
+#endif
+    reduction_queue_[type_id].push(slot);
+  }
+}
+
+void Net::Finalize() {
+  for (int type_id = 0; type_id < learnable_types_.size(); ++type_id) {
+    reduction_queue_[type_id].push(END_OF_TRAIN);
   }
-  return cnt_ret;
 }
-#endif
 
 void Net::ReduceAndUpdate(int type_id) {
 #ifndef CPU_ONLY
   shared_ptr<CuBLASHandle> cublas_phandle = Caffe::cublas_phandle();
   cublasHandle_t handle = cublas_phandle->get();
+  // SolverParameter::local_sgd_iters: no reduction, parameters are averaged instead
+  const int local_sgd_iters = solver_->param().local_sgd_iters();
+  const bool local_sgd = Caffe::solver_count() > 1 && local_sgd_iters > 1;
+  const bool reduce = Caffe::solver_count() > 1 && !local_sgd;
+  // SolverParameter::shard_solver_state
+  const bool shard = reduce && solver_->sharded();
   size_t bucket_size = 0UL;
   CHECK_GE(reduce_buckets_, 0);
-  if (Caffe::solver_count() > 1 && reduce_buckets_ > 0) {
+  if (reduce && reduce_buckets_ > 0) {
     bucket_size = align_up<6>(learnable_space_size_[type_id] / reduce_buckets_);
   }
-  std::set<int> au_ids;
+  // Layers received since the last reduction. Backward completes them top to bottom,
+  // so the bucket grows down the learnable space from bucket_ids.back().
+  vector<int> bucket_ids;
+  size_t bucket_count = 0UL;
+  cudaEvent_t bucket_ready = nullptr;
+  // The first iteration is not measured
+  unique_ptr<BucketTuner> tuner;
+  int iterations_seen = 0;
+  const bool tune = bucket_size > 0UL && reduce_buckets_tune_iters_ > 0 && !shard;
+  // SolverParameter::comm_delay_probe_interval
+  bool probe = comm_probe_iter(solver_->iter());
+  // SolverParameter::overlap_next_forward
+  const bool gate_updates = forward_ahead();
 #else
   void* handle = nullptr;
+  const bool reduce = Caffe::solver_count() > 1;
 #endif
 
   const bool clear_grads = !solver_->param().snapshot_diff();
+  // Updates deferred to the end of iteration, see SolverParameter::multi_tensor_update
+  // (local_lr_auto and master_weights imply it). Clipping and dynamic loss scaling need the
+  // norm of all gradients first, buckets are still reduced as they come.
+  const bool multi_tensor = solver_->param().multi_tensor_update()
+      || solver_->param().local_lr_auto() || solver_->param().master_weights();
+  const bool defer_all = solver_->param().clip_gradients() >= 0.F
+      || solver_->param().dynamic_loss_scale();
+  vector<int> pending_ids;
+#ifndef CPU_ONLY
+  auto reduce_bucket = [&]() {
+    if (bucket_ids.empty()) {
+      return;
+    }
+    const int id_from = bucket_ids.front();
+    const Type bucket_type = learnable_params_[id_from]->diff_type();
+    CHECK_EQ((int) bucket_type, learnable_types_[type_id]);
+    const double reduce_start_us = now_us();
+    if (shard) {
+      ShardedUpdate(type_id, bucket_ids, bucket_count, bucket_ready, clear_grads);
+      reduce_us_ += static_cast<uint64_t>(now_us() - reduce_start_us);
+      reduce_bytes_ += bucket_count * lp_size(id_from);
+      bucket_ids.clear();
+      bucket_count = 0UL;
+      return;
+    }
+    {
+      // Buckets are named after their top parameter
+      NVTX_RANGE(NVTX_REDUCE, "ReduceBucket " + std::to_string(id_from) + ", " +
+          std::to_string(bucket_count * lp_size(id_from)) + " bytes");
+      void* bucket = learnable_params_ptrs_[type_id][id_from];
+      ReduceBucket(type_id, bucket_count, reduce_type(type_id),
+          grad_accum_space_[type_id].empty() ? bucket : grad_sum(type_id, bucket), bucket_ready);
+    }
+    const double reduce_us = now_us() - reduce_start_us;
+    reduce_us_ += static_cast<uint64_t>(reduce_us);
+    reduce_bytes_ += bucket_count * tsize(reduce_type(type_id));
+    if (tuner) {
+      tuner->bucket_reduced(bucket_count * lp_size(id_from), reduce_us);
+    }
+    if (defer_all) {
+      pending_ids.insert(pending_ids.end(), bucket_ids.begin(), bucket_ids.end());
+    } else if (multi_tensor) {
+      solver_->ApplyUpdates(bucket_ids, handle, clear_grads, 1.F);
+    } else {
+      for (int i : bucket_ids) {
+        solver_->ApplyUpdate(i, handle, clear_grads);
+      }
+    }
+    if (gate_updates && !defer_all) {
+      UpdatesIssued(type_id, bucket_ids);
+    }
+    bucket_ids.clear();
+    bucket_count = 0UL;
+  };
+#endif
   while (true) {
-    const int param_id = reduction_queue_[type_id].pop();
+    int slot;
+    {
+      // Until backward completes a layer
+      ThreadProfile::Scope blocked(ThreadProfile::BLOCKED);
+      slot = reduction_queue_[type_id].pop();
+    }
     SolverAction::Enum request = solver_->GetRequestedAction();
     if (SolverAction::STOP == request) {
       solver_->request_early_exit();
       break;
     }
-    if (param_id == END_OF_TRAIN) {
+    if (slot == END_OF_TRAIN) {
       break;
     }
-    if (param_id != END_OF_ITERATION) {
-      if (Caffe::solver_count() > 1) {
+    if (slot != END_OF_ITERATION) {
+      const GradLayer& gl = grad_layers_[type_id][slot];
 #ifndef CPU_ONLY
-        if (reduce_buckets_ == 0) {  // no bucketing
-          Reduce(type_id, param_id);
-          solver_->ApplyUpdate(param_id, handle, clear_grads);
-          continue;
-        }
-#else
-        NO_GPU;
-#endif
-      } else {
-        this->learnable_params()[param_id]->scale_diff(1.F / global_grad_scale_, handle);
-        solver_->ApplyUpdate(param_id, handle, clear_grads);
-        continue;
+      if (Caffe::mode() == Caffe::GPU) {
+        // Updates are issued on this thread's stream
+        CUDA_CHECK(cudaStreamWaitEvent(Caffe::thread_stream(), gl.ready, 0));
       }
-    }
+      if (!grad_accum_space_[type_id].empty() && !(reduce && reduce_buckets_ > 0)) {
+        // Reduced (if at all) and updated as FLOAT16, buckets store theirs once reduced
+        StoreGradients(type_id, grad_sum(type_id, learnable_params_ptrs_[type_id][
+            gl.param_ids.front()]), gl.count, 1.F);
+      }
+#endif
+      if (reduce) {
 #ifndef CPU_ONLY
-    if (!learnable_params_.empty() && Caffe::solver_count() > 1) {
-      int id_from = -1;
-      // Is bucket big enough? Done with iteration?
-      const size_t received_count = received_contiguous_count(type_id, au_ids, id_from);
-      if (id_from >= 0) {
-        const size_t received_size = received_count * lp_size(id_from);
-        if (received_size >= bucket_size || param_id == END_OF_ITERATION) {
-#ifdef DEBUG
-          {
-            size_t c = 0UL;
-            for (int i : au_ids) {
-              if (i < id_from) {
-                continue;
+        const bool sparse = !shard && std::any_of(gl.param_ids.begin(), gl.param_ids.end(),
+            [&](int param_id) { return sparse_rows_[param_id] != nullptr; });
+        if (sparse) {
+          reduce_bucket();  // buckets are dense
+          for (int param_id : gl.param_ids) {
+            if (sparse_rows_[param_id] != nullptr) {
+              ReduceRows(type_id, param_id, gl.ready);
+              const float grad_scale = 1.F / (Caffe::solver_count() * global_grad_scale_);
+              if (defer_all) {
+                learnable_params_[param_id]->scale_diff(grad_scale, handle);
+                pending_ids.push_back(param_id);
+              } else {
+                solver_->ApplyUpdates(vector<int>(1, param_id), handle, clear_grads,
+                    grad_scale);
               }
-              c += lp_aligned_count(i);
+            } else {
+              Reduce(type_id, param_id, gl.ready);
+              if (defer_all) {
+                pending_ids.push_back(param_id);
+              } else {
+                solver_->ApplyUpdate(param_id, handle, clear_grads);
+              }
+            }
+          }
+          continue;
+        }
+        if (reduce_buckets_ == 0 && !shard) {  // no bucketing
+          for (int param_id : gl.param_ids) {
+            Reduce(type_id, param_id, gl.ready);
+            if (defer_all) {
+              pending_ids.push_back(param_id);
+            } else {
+              solver_->ApplyUpdate(param_id, handle, clear_grads);
             }
-            CHECK_EQ(c, received_count);
           }
+          continue;
+        }
+        const int layer_from = gl.param_ids.front();
+        const size_t layer_size = gl.count * lp_size(layer_from);
+        if (!bucket_ids.empty() &&
+            static_cast<char*>(learnable_params_ptrs_[type_id][layer_from]) + layer_size !=
+            learnable_params_ptrs_[type_id][bucket_ids.front()]) {
+          reduce_bucket();  // not adjacent, e.g. a layer in between needs no backward
+        }
+        bucket_ids.insert(bucket_ids.begin(), gl.param_ids.begin(), gl.param_ids.end());
+        bucket_count += gl.count;
+        bucket_ready = gl.ready;
+        if (tuner) {
+          tuner->param_ready(layer_size, gl.ready_us);
+        }
+        // Is bucket big enough? Probed iterations reduce once backward is done.
+        if (!probe && bucket_count * lp_size(layer_from) >= bucket_size) {
+          reduce_bucket();
+        }
+#else
+        NO_GPU;
 #endif
-          CHECK_EQ((int) learnable_params_[id_from]->diff_type(), learnable_types_[type_id]);
-          ReduceBucket(type_id, received_count, learnable_params_[id_from]->diff_type(),
-              learnable_params_ptrs_[type_id][id_from]);
-
-          for (int i : au_ids) {
-            solver_->ApplyUpdate(i, handle, clear_grads);
+      } else if (multi_tensor || defer_all) {
+        pending_ids.insert(pending_ids.end(), gl.param_ids.begin(), gl.param_ids.end());
+      } else {
+        for (int param_id : gl.param_ids) {
+          if (sparse_rows_[param_id] != nullptr) {
+            solver_->ApplyUpdates(vector<int>(1, param_id), handle, clear_grads,
+                1.F / global_grad_scale_);
+            continue;
           }
-          au_ids.erase(au_ids.find(id_from), au_ids.end());
+          this->learnable_params()[param_id]->scale_diff(1.F / global_grad_scale_, handle);
+          solver_->ApplyUpdate(param_id, handle, clear_grads);
         }
       }
-      if (param_id != END_OF_ITERATION) {
-        au_ids.emplace(param_id);
-      }
+      continue;
+    }
+    // END_OF_ITERATION
+#ifndef CPU_ONLY
+    if (reduce) {
+      reduce_bucket();
     }
-    if (param_id == END_OF_ITERATION) {
-      CHECK(au_ids.empty());
-      solver_->iteration_complete_signal(type_id);
+    CHECK(bucket_ids.empty());
+#endif
+    if (!pending_ids.empty()) {
+      // Reduced gradients are already scaled
+      solver_->ApplyUpdates(pending_ids, handle, clear_grads,
+          reduce ? 1.F : 1.F / global_grad_scale_);
+      pending_ids.clear();
     }
-#else
-    if (param_id == END_OF_ITERATION) {
-      solver_->iteration_complete_signal(type_id);
+#ifndef CPU_ONLY
+    // iter() is incremented once all reduction threads are done
+    if (local_sgd && (solver_->iter() + 1) % local_sgd_iters == 0) {
+      AverageParams(type_id);
+    }
+    if (tune) {
+      TuneBuckets(type_id, ++iterations_seen, tuner, bucket_size);
+    }
+    probe = comm_probe_iter(solver_->iter() + 1);
+    if (gate_updates) {
+      AllUpdatesIssued(type_id, solver_->iter() + 1);
     }
 #endif
+    solver_->iteration_complete_signal(type_id);
+  }
+#ifndef CPU_ONLY
+  if (gate_updates) {
+    AllUpdatesIssued(type_id, INT_MAX);  // a forward run ahead must not wait for us
   }
+#endif
   DLOG(INFO) << "[" << Caffe::current_device() << "] Leaving ReduceAndUpdate thread";
 }
 
 #ifndef CPU_ONLY
-void Net::Reduce(int type_id, int param_id) {
+void Net::Reduce(int type_id, int param_id, cudaEvent_t ready) {
+  ThreadProfile::Scope profile(ThreadProfile::REDUCE);
+  const double start_us = now_us();
   Solver::Callback* cb = solver_->callback();
+  CUDA_CHECK(cudaStreamWaitEvent(cb->comm_stream(type_id), ready, 0));
   cb->reduce_barrier(type_id);
   {
-    unique_ptr<unique_lock<shared_mutex>> lock;
+    unique_ptr<GPUMemory::CollectiveScope> collective;
     if (solver_->is_root()) {
-      lock.reset(new unique_lock<shared_mutex>(GPUMemory::read_write_mutex()));
+      collective.reset(new GPUMemory::CollectiveScope);
     }
     cb->reduce_barrier(type_id);
     cb->allreduce(type_id, param_id);
@@ -916,26 +3973,377 @@ void Net::Reduce(int type_id, int param_id) {
   }
   this->learnable_params()[param_id]->scale_diff(1.F / (Caffe::solver_count() * global_grad_scale_),
       Caffe::cublas_handle());
+  reduce_us_ += static_cast<uint64_t>(now_us() - start_us);
+  reduce_bytes_ += lp_size(param_id) * this->learnable_params()[param_id]->count();
   // Also need to barrier to make sure lock isn't undone
   // until all have completed, but the current nature of
   // NCCL makes this unnecessary.
   // solver_->callback()->reduce_barrier();
 }
 
-void Net::ReduceBucket(int type_id, size_t count, Type bucket_type, void* bucket) {
+void Net::ReduceRows(int type_id, int param_id, cudaEvent_t ready) {
+  ThreadProfile::Scope profile(ThreadProfile::REDUCE);
+  // Bytes vary with the rows, only the time is accounted
+  const double start_us = now_us();
+  Solver::Callback* cb = solver_->callback();
+  CUDA_CHECK(cudaStreamWaitEvent(cb->comm_stream(type_id), ready, 0));
+  cb->reduce_barrier(type_id);
+  {
+    unique_ptr<GPUMemory::CollectiveScope> collective;
+    if (solver_->is_root()) {
+      collective.reset(new GPUMemory::CollectiveScope);
+    }
+    cb->reduce_barrier(type_id);
+    cb->allreduce_rows(type_id, param_id, sparse_rows_[param_id]);
+    cb->reduce_barrier(type_id);
+  }
+  reduce_us_ += static_cast<uint64_t>(now_us() - start_us);
+}
+
+void Net::ShardedUpdate(int type_id, const vector<int>& param_ids, size_t count,
+    cudaEvent_t ready, bool clear_grads) {
+  ThreadProfile::Scope profile(ThreadProfile::REDUCE);
+  Solver::Callback* cb = solver_->callback();
+  cublasHandle_t handle = Caffe::cublas_handle();
+  CUDA_CHECK(cudaStreamWaitEvent(cb->comm_stream(type_id), ready, 0));
+  cb->reduce_barrier(type_id);
+  {
+    unique_ptr<GPUMemory::CollectiveScope> collective;
+    if (solver_->is_root()) {
+      collective.reset(new GPUMemory::CollectiveScope);
+    }
+    cb->reduce_barrier(type_id);
+    cb->reduce_to_owners(type_id, param_ids);
+    cb->reduce_barrier(type_id);
+  }
+  vector<int> owned;
+  for (int param_id : param_ids) {
+    if (solver_->owns_param(param_id)) {
+      owned.push_back(param_id);
+    }
+  }
+  solver_->ApplyUpdates(owned, handle, clear_grads,
+      1.F / (Caffe::solver_count() * global_grad_scale_));
+  if (clear_grads) {
+    // Partial sums of params owned by others. Synchronous, so are the updates.
+    caffe_gpu_memset(count * lp_size(param_ids.front()), 0,
+        learnable_params_ptrs_[type_id][param_ids.front()]);
+  } else {
+    CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  }
+  cb->reduce_barrier(type_id);
+  {
+    unique_ptr<GPUMemory::CollectiveScope> collective;
+    if (solver_->is_root()) {
+      collective.reset(new GPUMemory::CollectiveScope);
+    }
+    cb->reduce_barrier(type_id);
+    cb->broadcast_from_owners(type_id, param_ids);
+    cb->reduce_barrier(type_id);
+  }
+}
+
+void Net::AverageParams(int type_id) {
+  Solver::Callback* cb = solver_->callback();
+  const bool history = solver_->param().local_sgd_average_history();
+  const float alpha = 1.F / Caffe::solver_count();
+  cublasHandle_t handle = Caffe::cublas_handle();
+  // Updates were issued on this thread's stream, NCCL runs on the comm one
+  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  cb->reduce_barrier(type_id);
+  {
+    unique_ptr<GPUMemory::CollectiveScope> collective;
+    if (solver_->is_root()) {
+      collective.reset(new GPUMemory::CollectiveScope);
+    }
+    cb->reduce_barrier(type_id);
+    for (const GradLayer& gl : grad_layers_[type_id]) {
+      for (int param_id : gl.param_ids) {
+        vector<Blob*> blobs(1, learnable_params_[param_id].get());
+        if (history) {
+          vector<Blob*> h = solver_->history_blobs(param_id);
+          blobs.insert(blobs.end(), h.begin(), h.end());
+        }
+        for (Blob* blob : blobs) {
+          const size_t count = even(blob->count());
+          void* data = blob->current_mutable_data_memory(true);
+          cb->allreduce_bucket(type_id, count, data, blob->data_type());
+          Tensor::gpu_scal(count, blob->data_type(), data, alpha, handle);
+        }
+      }
+    }
+    cb->reduce_barrier(type_id);
+  }
+}
+
+void Net::TuneBuckets(int type_id, int iterations_seen, unique_ptr<BucketTuner>& tuner,
+    size_t& bucket_size) {
+  if (iterations_seen == 1) {
+    tuner.reset(new BucketTuner(learnable_space_size_[type_id], MAX_TUNED_BUCKETS));
+    return;
+  }
+  if (!tuner) {
+    return;  // done already
+  }
+  tuner->end_iteration();
+  if (iterations_seen <= reduce_buckets_tune_iters_) {
+    return;
+  }
+  // Every solver counts the same iterations: all of them take the largest count picked
+  const int buckets = static_cast<int>(solver_->callback()->allreduce_max(type_id,
+      static_cast<float>(tuner->best_buckets())));
+  bucket_size = tuner->bucket_size(buckets);
+  LOG_IF(INFO, Caffe::root_solver()) << print_current_device() << " Reduction of "
+      << Type_Name((Type) learnable_types_[type_id]) << " gradients tuned: "
+      << tuner->plan(buckets);
+  tuner.reset();
+}
+
+void Net::ReduceBucket(int type_id, size_t count, Type bucket_type, void* bucket,
+    cudaEvent_t ready) {
+  ThreadProfile::Scope profile(ThreadProfile::REDUCE);
   Solver::Callback* cb = solver_->callback();
+  // SolverParameter::comm_priority_fraction: the first layers sit at the start of the
+  // learnable space
+  const size_t offset = static_cast<char*>(bucket) -
+      static_cast<char*>(reduce_space(type_id));
+  cb->set_comm_urgent(type_id, offset < solver_->param().comm_priority_fraction() *
+      reduce_space_size(type_id));
+  // Later layers of the bucket completed before the one recording ready
+  CUDA_CHECK(cudaStreamWaitEvent(cb->comm_stream(type_id), ready, 0));
   cb->reduce_barrier(type_id);
   {
-    unique_ptr<unique_lock<shared_mutex>> lock;
+    unique_ptr<GPUMemory::CollectiveScope> collective;
     if (solver_->is_root()) {
-      lock.reset(new unique_lock<shared_mutex>(GPUMemory::read_write_mutex()));
+      collective.reset(new GPUMemory::CollectiveScope);
     }
     cb->reduce_barrier(type_id);
+    if (compressed_reduce(bucket_type)) {
+      const float scale = CompressBucket(type_id, count, bucket_type, bucket);
+      cb->allreduce_bucket(type_id, count, fp16_bucket(type_id, bucket_type, bucket), FLOAT16);
+      cb->reduce_barrier(type_id);
+      DecompressBucket(type_id, count, bucket_type, bucket,
+          1.F / (scale * Caffe::solver_count() * global_grad_scale_));
+      if (!grad_accum_space_[type_id].empty()) {
+        StoreGradients(type_id, bucket, count, 1.F);
+      }
+      return;
+    }
     cb->allreduce_bucket(type_id, count, bucket, bucket_type);
     cb->reduce_barrier(type_id);
   }
-  Tensor::gpu_scal(count, bucket_type, bucket, 1.F / (Caffe::solver_count() * global_grad_scale_),
-      Caffe::cublas_handle());
+  const float alpha = 1.F / (Caffe::solver_count() * global_grad_scale_);
+  if (!grad_accum_space_[type_id].empty()) {
+    // Scaled on the way back to the FLOAT16 gradients the update reads
+    StoreGradients(type_id, bucket, count, alpha);
+    return;
+  }
+  Tensor::gpu_scal(count, bucket_type, bucket, alpha, Caffe::cublas_handle());
+}
+
+void Net::UpdatesIssued(int type_id, const vector<int>& param_ids) {
+  bool any = false;
+  for (int param_id : param_ids) {
+    const int slot = param_slot_[type_id][param_id];
+    if (slot >= 0 && --grad_layers_[type_id][slot].pending == 0UL) {
+      GradLayer& gl = grad_layers_[type_id][slot];
+      CUDA_CHECK(cudaEventRecord(gl.updated, Caffe::thread_stream()));
+      std::lock_guard<std::mutex> lock(updated_mutex_);
+      // iter() is incremented once all reduction threads are done
+      gl.updated_iter = solver_->iter() + 1;
+      any = true;
+    }
+  }
+  if (any) {
+    updated_cv_.notify_all();
+  }
+}
+
+void Net::AllUpdatesIssued(int type_id, int iter) {
+  {
+    std::lock_guard<std::mutex> lock(updated_mutex_);
+    for (GradLayer& gl : grad_layers_[type_id]) {
+      if (gl.updated_iter < iter) {
+        // Frozen layers, deferred and sparse updates, sharded or local updates
+        CUDA_CHECK(cudaEventRecord(gl.updated, Caffe::thread_stream()));
+        gl.updated_iter = iter;
+      }
+      gl.pending = gl.param_ids.size();
+    }
+  }
+  updated_cv_.notify_all();
+}
+
+void Net::BuildForwardGates() {
+  forward_gates_.assign(layers_.size(), vector<std::pair<int, int>>());
+  bool converted = false;
+  for (int i = 0; i < layers_.size(); ++i) {
+    const Type ftype = layers_[i]->layer_param().forward_type();
+    for (int j = 0; j < layers_[i]->blobs().size(); ++j) {
+      const int param_id = learnable_param_ids_[layer_index_params_[make_pair(i, j)]];
+      for (int type_id = 0; type_id < learnable_types_.size(); ++type_id) {
+        const int slot = param_slot_[type_id][param_id];
+        const std::pair<int, int> gate(type_id, slot);
+        vector<std::pair<int, int>>& gates = forward_gates_[i];
+        if (slot < 0) {
+          continue;
+        }
+        if (std::find(gates.begin(), gates.end(), gate) == gates.end()) {
+          gates.push_back(gate);
+        }
+        converted = converted || layers_[i]->blobs()[j]->data_type() != ftype;
+      }
+    }
+  }
+  if (converted) {
+    // ConvertLearnableParams reads all of them before the first layer
+    for (int i = 1; i < layers_.size(); ++i) {
+      forward_gates_[0].insert(forward_gates_[0].end(), forward_gates_[i].begin(),
+          forward_gates_[i].end());
+      forward_gates_[i].clear();
+    }
+  }
+}
+
+void Net::WaitUpdated(int layer_id) {
+  // ForwardAhead runs before iter() is incremented
+  const int iter = solver_->iter() + 1;
+  for (const std::pair<int, int>& gate : forward_gates_[layer_id]) {
+    const GradLayer& gl = grad_layers_[gate.first][gate.second];
+    {
+      ThreadProfile::Scope blocked(ThreadProfile::BLOCKED);
+      std::unique_lock<std::mutex> lock(updated_mutex_);
+      updated_cv_.wait(lock, [&gl, iter] { return gl.updated_iter >= iter; });
+    }
+    CUDA_CHECK(cudaStreamWaitEvent(Caffe::thread_stream(), gl.updated, 0));
+  }
+}
+
+bool Net::comm_probe_iter(int iter) const {
+  const int interval = solver_->param().comm_delay_probe_interval();
+  // Not while buckets are tuned, those iterations are measured. Deterministic runs keep
+  // their buckets.
+  return interval > 0 && !Caffe::deterministic() && iter % interval == 0 &&
+      iter > reduce_buckets_tune_iters_ + 1 && Caffe::solver_count() > 1 &&
+      reduce_buckets_ > 0 && !solver_->sharded() && solver_->param().local_sgd_iters() <= 1;
+}
+
+void Net::ReadBackwardTime() {
+  if (backward_timed_ < 0) {
+    return;
+  }
+  CUDA_CHECK(cudaEventSynchronize(backward_events_[1]));
+  float ms = 0.F;
+  CUDA_CHECK(cudaEventElapsedTime(&ms, backward_events_[0], backward_events_[1]));
+  if (backward_timed_ == 0) {
+    overlapped_backward_ms_ += ms;
+    ++overlapped_backwards_;
+  } else if (overlapped_backwards_ > 0) {
+    const double overlapped_ms = overlapped_backward_ms_ / overlapped_backwards_;
+    LOG_IF(INFO, Caffe::root_solver()) << "Backward GPU time " << overlapped_ms
+        << " ms with reductions overlapped (mean of " << overlapped_backwards_
+        << " iterations), " << ms << " ms without: communication delays it by "
+        << overlapped_ms - ms << " ms";
+    overlapped_backward_ms_ = 0.;
+    overlapped_backwards_ = 0;
+  }
+  backward_timed_ = -1;
+}
+
+bool Net::compressed_reduce(Type bucket_type) const {
+  return solver_->param().reduce_compression() == SolverParameter_ReduceCompression_FP16 &&
+      bucket_type != FLOAT16 && !solver_->sharded();
+}
+
+void* Net::fp16_bucket(int type_id, Type bucket_type, void* bucket) const {
+  const size_t offset = static_cast<char*>(bucket) -
+      static_cast<char*>(reduce_space(type_id));
+  return static_cast<char*>(reduce_fp16_space_[type_id].data()) +
+      offset / tsize(bucket_type) * tsize(FLOAT16);
+}
+
+float Net::CompressBucket(int type_id, size_t count, Type bucket_type, void* bucket) {
+  float amax = 0.F;
+  if (is_type<float>(bucket_type)) {
+    caffe_gpu_amax(count, static_cast<const float*>(bucket), &amax);
+  } else {
+    caffe_gpu_amax(count, static_cast<const double*>(bucket), &amax);
+  }
+  amax = solver_->callback()->allreduce_max(type_id, amax);
+  // Power of two keeping the sum over all solvers within half of FLOAT16 range.
+  // The margin covers residuals added back.
+  float scale = 1.F;
+  if (amax > 0.F && std::isfinite(amax)) {
+    scale = std::exp2(std::floor(std::log2(32768.F / (amax * Caffe::solver_count()))));
+  }
+  void* residual = nullptr;
+  if (solver_->param().reduce_error_feedback()) {
+    residual = static_cast<char*>(reduce_residual_space_[type_id].data()) +
+        (static_cast<char*>(bucket) - static_cast<char*>(reduce_space(type_id)));
+  }
+  float16* out = static_cast<float16*>(fp16_bucket(type_id, bucket_type, bucket));
+  if (is_type<float>(bucket_type)) {
+    caffe_gpu_compress_fp16(count, static_cast<const float*>(bucket),
+        static_cast<float*>(residual), out, scale);
+  } else {
+    caffe_gpu_compress_fp16(count, static_cast<const double*>(bucket),
+        static_cast<double*>(residual), out, scale);
+  }
+  return scale;
+}
+
+void Net::DecompressBucket(int type_id, size_t count, Type bucket_type, void* bucket,
+    float alpha) {
+  const float16* in = static_cast<const float16*>(fp16_bucket(type_id, bucket_type, bucket));
+  if (is_type<float>(bucket_type)) {
+    caffe_gpu_decompress_fp16(count, in, static_cast<float*>(bucket), alpha);
+  } else {
+    caffe_gpu_decompress_fp16(count, in, static_cast<double*>(bucket), alpha);
+  }
+}
+
+void Net::AccumulateGradients(int layer_id) {
+  for (int type_id = 0; type_id < learnable_types_.size(); ++type_id) {
+    const vector<int>& slots = grad_layer_slot_[type_id];
+    const int slot = layer_id < slots.size() ? slots[layer_id] : -1;
+    if (slot < 0 || grad_accum_space_[type_id].empty()) {
+      continue;
+    }
+    // Params of the layer are contiguous, shared ones were added to them by now
+    const GradLayer& gl = grad_layers_[type_id][slot];
+    void* diff = learnable_params_ptrs_[type_id][gl.param_ids.front()];
+    caffe_gpu_accumulate_fp16(gl.count, static_cast<float16*>(diff),
+        static_cast<float*>(grad_sum(type_id, diff)), first_micro_batch_);
+  }
+}
+
+void Net::StoreGradients(int type_id, const void* sum, size_t count, float alpha) {
+  const size_t offset = static_cast<const char*>(sum) -
+      static_cast<const char*>(grad_accum_space_[type_id].data());
+  float16* diff = reinterpret_cast<float16*>(static_cast<char*>(learnable_space_[type_id].data())
+      + offset / tsize(FLOAT) * tsize(FLOAT16));
+  caffe_gpu_compress_fp16(count, static_cast<const float*>(sum), nullptr, diff, alpha);
+}
+
+void* Net::reduce_space(int type_id) const {
+  return grad_accum_space_[type_id].empty() ? learnable_space_[type_id].data() :
+      grad_accum_space_[type_id].data();
+}
+
+size_t Net::reduce_space_size(int type_id) const {
+  return grad_accum_space_[type_id].empty() ? learnable_space_size_[type_id] :
+      grad_accum_space_[type_id].size();
+}
+
+Type Net::reduce_type(int type_id) const {
+  return grad_accum_space_[type_id].empty() ? (Type) learnable_types_[type_id] : FLOAT;
+}
+
+void* Net::grad_sum(int type_id, void* diff) const {
+  const size_t offset = static_cast<char*>(diff) -
+      static_cast<char*>(learnable_space_[type_id].data());
+  return static_cast<char*>(grad_accum_space_[type_id].data()) +
+      offset / tsize(FLOAT16) * tsize(FLOAT);
 }
 #endif
 
@@ -1015,7 +4423,37 @@ void Net::UpdateDebugInfo(const int param_id) {
   }
 }
 
-void Net::ShareTrainedLayersWith(const Net* other) {
+bool Net::FoldsLike(const Net& other) const {
+  // Folded weights only fit a net folding the same layers
+  bool same_folding = folded_bn_.size() == other.folded_bn_.size();
+  for (const auto& folded : folded_bn_) {
+    same_folding = same_folding && other.folded_bn_.count(folded.first) > 0;
+  }
+  return same_folding && fused_pointwise_ == other.fused_pointwise_;
+}
+
+void Net::TakeTrainedBlobs(int layer_id) {
+  const LayerParameter& lp = layers_[layer_id]->layer_param();
+  if (!trained_net_->has_layer(lp.name()) || !layers_[layer_id]->blobs().empty()) {
+    return;
+  }
+  const shared_ptr<LayerBase> source = trained_net_->layer_by_name(lp.name());
+  const LayerParameter& sp = source->layer_param();
+  // Blobs of other types would be converted under the trained net
+  if (sp.type() != lp.type() || sp.forward_type() != lp.forward_type() ||
+      sp.backward_type() != lp.backward_type() || sp.forward_math() != lp.forward_math() ||
+      sp.backward_math() != lp.backward_math()) {
+    return;
+  }
+  // Layers skip initialization of the blobs they are given
+  layers_[layer_id]->blobs() = source->blobs();
+}
+
+void Net::ShareTrainedLayersWith(const Net* other, bool copy,
+    const vector<Blob*>* learnable) {
+  CHECK(FoldsLike(*other)) << "fold_batch_norm and fuse_pointwise nets can only share "
+      << "weights with nets folding and fusing the same layers, copy them from a trained "
+      << "net instead";
   int num_source_layers = other->layers().size();
   for (int i = 0; i < num_source_layers; ++i) {
     LayerBase* source_layer = other->layers()[i].get();
@@ -1041,10 +4479,23 @@ void Net::ShareTrainedLayersWith(const Net* other) {
           << source_layer_name << "'; shape mismatch.  Source param shape is "
           << source_blob->shape_string() << "; target param shape is "
           << target_blobs[j]->shape_string();
-      target_blobs[j]->ShareData(*source_blob);
+      if (copy) {
+        if (learnable != nullptr) {
+          source_blob = learnable->at(other->learnable_param_ids_[other->param_id_vecs_[i][j]]);
+        }
+        target_blobs[j]->CopyDataFrom(*source_blob);
+      } else if (target_blobs[j].get() != source_blob) {
+        target_blobs[j]->ShareData(*source_blob);
+      }
     }
   }
-  trained_layers_shared_ = true;
+  if (!copy) {
+    trained_layers_shared_ = true;
+#ifndef CPU_ONLY
+    ipc_weights_ = other->ipc_weights_;
+#endif
+  }
+  WeightsChanged();
 }
 
 void Net::BackwardFrom(int start) {
@@ -1073,13 +4524,45 @@ void Net::Backward(bool apply_update) {
   }
 }
 
+bool Net::SetInputShape(int batch_size, int crop_size) {
+  bool taken = false;
+  for (int i = 0; i < layers_.size(); ++i) {
+    taken = layers_[i]->set_input_shape(batch_size, crop_size) || taken;
+  }
+  if (taken) {
+    for (int i = 0; i < layers_.size(); ++i) {
+      layers_[i]->retune_for_shapes();
+    }
+  }
+  return taken;
+}
+
+// Layers declaring reshape_invariant skip it unless their shapes changed
 void Net::Reshape() {
+#ifndef CPU_ONLY
+  if (!stage_of_.empty()) {
+    for (int s = 0; s < stage_first_.size(); ++s) {
+      RunOnStage(s, [&]() {
+        for (StageBoundary& b : boundaries_) {
+          if (b.dst_stage == s) {
+            b.dst->ReshapeLike(*b.src);
+          }
+        }
+        for (int i = stage_first_[s]; i <= stage_last_[s]; ++i) {
+          layers_[i]->ReshapeIfChanged(bottom_vecs_[i], top_vecs_[i]);
+        }
+      });
+    }
+    return;
+  }
+#endif
   for (int i = 0; i < layers_.size(); ++i) {
-    layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
+    layers_[i]->ReshapeIfChanged(bottom_vecs_[i], top_vecs_[i]);
   }
 }
 
 void Net::CopyTrainedLayersFrom(const NetParameter& param) {
+  WeightsChanged();
   int num_source_layers = param.layer_size();
   for (int i = 0; i < num_source_layers; ++i) {
     const LayerParameter& source_layer = param.layer(i);
@@ -1097,8 +4580,16 @@ void Net::CopyTrainedLayersFrom(const NetParameter& param) {
     DLOG(INFO) << "Copying source layer " << source_layer_name;
     vector<shared_ptr<Blob> >& target_blobs =
         layers_[target_layer_id]->blobs();
-    CHECK_EQ(target_blobs.size(), source_layer.blobs_size())
-        << "Incompatible number of blobs for layer " << source_layer_name;
+    // Folding BatchNorm might have added a bias, it starts at zero
+    auto fold_it = folded_bn_.find(source_layer_name);
+    const bool bias_added = fold_it != folded_bn_.end() && fold_it->second.bias_added &&
+        target_blobs.size() == source_layer.blobs_size() + 1;
+    if (bias_added) {
+      target_blobs[1]->set_data(0.F);
+    } else {
+      CHECK_EQ(target_blobs.size(), source_layer.blobs_size())
+          << "Incompatible number of blobs for layer " << source_layer_name;
+    }
     LOG(INFO) << "Copying source layer " << source_layer_name << " Type:"
               << source_layer_type << " #blobs=" << source_layer.blobs_size();
     // check if BN is in legacy DIGITS format?
@@ -1123,7 +4614,7 @@ void Net::CopyTrainedLayersFrom(const NetParameter& param) {
         DLOG(INFO) << target_blobs[j]->count();
       }
     } else {
-      for (int j = 0; j < target_blobs.size(); ++j) {
+      for (int j = 0; j < source_layer.blobs_size(); ++j) {
         if (!target_blobs[j]->ShapeEquals(source_layer.blobs(j))) {
           shared_ptr<Blob> source_blob = Blob::create(target_blobs[j]->data_type(),
               target_blobs[j]->diff_type());
@@ -1141,10 +4632,20 @@ void Net::CopyTrainedLayersFrom(const NetParameter& param) {
       }
     }
   }
+  FoldBatchNormWeights(param);
+  FusePointwiseWeights(param);
 }
 
 void Net::CopyTrainedLayersFrom(const string trained_filename) {
-  if (trained_filename.size() >= 3 &&
+#ifndef CPU_ONLY
+  if (IpcWeights::IsHandle(trained_filename)) {
+    CopyTrainedLayersFromIpc(trained_filename);
+    return;
+  }
+#endif
+  if (WeightFile::Is(trained_filename)) {
+    CopyTrainedLayersFromWeightFile(trained_filename);
+  } else if (trained_filename.size() >= 3 &&
       trained_filename.compare(trained_filename.size() - 3, 3, ".h5") == 0) {
     CopyTrainedLayersFromHDF5(trained_filename);
   } else {
@@ -1160,6 +4661,8 @@ void Net::CopyTrainedLayersFromBinaryProto(
 }
 
 void Net::CopyTrainedLayersFromHDF5(const string trained_filename) {
+  WeightsChanged();
+  CHECK(folded_bn_.empty()) << "fold_batch_norm needs weights in binary proto format";
   hid_t file_hid = H5Fopen(trained_filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
   CHECK_GE(file_hid, 0) << "Couldn't open " << trained_filename;
   hid_t data_hid = H5Gopen2(file_hid, "data", H5P_DEFAULT);
@@ -1207,6 +4710,231 @@ void Net::CopyTrainedLayersFromHDF5(const string trained_filename) {
   H5Fclose(file_hid);
 }
 
+namespace {
+
+struct WeightCopy {
+  const void* src;
+  void* dst;
+  size_t bytes;
+};
+
+// Copies taken from copies[*next] on, on the current device if to_gpu
+void CopyWeights(const vector<WeightCopy>& copies, std::atomic<size_t>* next, bool to_gpu,
+    int device) {
+#ifndef CPU_ONLY
+  // Two pinned chunks: one is filled from the mapping while the other is uploaded
+  const size_t CHUNK = 4UL << 20;
+  cudaStream_t stream = nullptr;
+  void* chunks[2] = {nullptr, nullptr};
+  cudaEvent_t uploaded[2];
+  if (to_gpu) {
+    CUDA_CHECK(cudaSetDevice(device));
+    CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+    for (int c = 0; c < 2; ++c) {
+      chunks[c] = HostMemoryPool::Allocate(CHUNK);
+      CUDA_CHECK(cudaEventCreateWithFlags(&uploaded[c], cudaEventDisableTiming));
+      CUDA_CHECK(cudaEventRecord(uploaded[c], stream));
+    }
+  }
+  int c = 0;
+#endif
+  for (size_t i = next->fetch_add(1UL); i < copies.size(); i = next->fetch_add(1UL)) {
+    const WeightCopy& copy = copies[i];
+    if (!to_gpu) {
+      std::memcpy(copy.dst, copy.src, copy.bytes);
+      continue;
+    }
+#ifndef CPU_ONLY
+    for (size_t offset = 0UL; offset < copy.bytes; offset += CHUNK, c ^= 1) {
+      const size_t bytes = std::min(CHUNK, copy.bytes - offset);
+      CUDA_CHECK(cudaEventSynchronize(uploaded[c]));
+      std::memcpy(chunks[c], static_cast<const char*>(copy.src) + offset, bytes);
+      CUDA_CHECK(cudaMemcpyAsync(static_cast<char*>(copy.dst) + offset, chunks[c], bytes,
+          cudaMemcpyHostToDevice, stream));
+      CUDA_CHECK(cudaEventRecord(uploaded[c], stream));
+    }
+#endif
+  }
+#ifndef CPU_ONLY
+  if (to_gpu) {
+    CUDA_CHECK(cudaStreamSynchronize(stream));
+    for (int k = 0; k < 2; ++k) {
+      CUDA_CHECK(cudaEventDestroy(uploaded[k]));
+      HostMemoryPool::Free(chunks[k], CHUNK);
+    }
+    CUDA_CHECK(cudaStreamDestroy(stream));
+  }
+#endif
+}
+
+}  // namespace
+
+void Net::CopyTrainedLayersFromWeightFile(const string trained_filename) {
+  WeightsChanged();
+  CHECK(folded_bn_.empty()) << "fold_batch_norm needs weights in binary proto format";
+  const double start = std::chrono::duration<double>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  shared_ptr<WeightFile> mapped = make_shared<WeightFile>(trained_filename);
+  const WeightFile& file = *mapped;
+#ifndef CPU_ONLY
+  // Streamed weights are read in place, or staged on host
+  const bool stream = stream_weights_ && !stream_ready_;
+#else
+  const bool stream = false;
+#endif
+  const bool to_gpu = Caffe::mode() == Caffe::GPU && !stream;
+  vector<WeightCopy> copies;
+  size_t total_bytes = 0UL;
+  for (const WeightIndex::Tensor& tensor : file.index().tensor()) {
+    if (!layer_names_index_.count(tensor.layer())) {
+      LOG(INFO) << "Ignoring source layer " << tensor.layer();
+      continue;
+    }
+    const int target_layer_id = layer_names_index_[tensor.layer()];
+    vector<shared_ptr<Blob>>& target_blobs = layers_[target_layer_id]->blobs();
+    CHECK_LT(tensor.blob_id(), target_blobs.size())
+        << "Incompatible number of blobs for layer " << tensor.layer();
+    if (param_owners_[param_id_vecs_[target_layer_id][tensor.blob_id()]] != -1) {
+      continue;  // weight-shared, the owner gets it
+    }
+    Blob* target = target_blobs[tensor.blob_id()].get();
+    if (target->shape() != vector<int>(tensor.shape().dim().begin(),
+        tensor.shape().dim().end())) {
+      LOG(FATAL) << "Cannot copy param " << tensor.blob_id() << " weights from layer '"
+          << tensor.layer() << "'; shape mismatch.  Source param shape is "
+          << tensor.shape().ShortDebugString() << "; target param shape is "
+          << target->shape_string() << ". "
+          << "To learn this layer's parameters from scratch rather than "
+          << "copying from a saved net, rename the layer.";
+    }
+    CHECK_EQ(tensor.bytes(),
+        WeightFile::StoredBytes(target->count(), tensor.type(), tensor.sparse_2_4()))
+        << "Corrupted tensor of layer " << tensor.layer() << " in " << trained_filename;
+    total_bytes += tensor.bytes();
+    if (target->count() == 0) {
+      continue;
+    }
+    if (tensor.type() != target->data_type() || tensor.sparse_2_4()) {
+      // Rare, converted or decompressed here rather than by the workers
+      shared_ptr<Blob> source = Blob::create(tensor.type(), tensor.type());
+      source->Reshape(target->shape());
+      file.Read(tensor, source->current_mutable_data_memory(false));
+      target->CopyDataFrom(*source, true);
+      continue;
+    }
+#ifndef CPU_ONLY
+    if (stream && tensor.type() ==
+        layers_[target_layer_id]->layer_param().forward_type()) {
+      target->set_current_data_memory(const_cast<void*>(file.data(tensor)), false);
+      stream_mapped_.insert(target);
+      stream_file_ = mapped;
+      continue;
+    }
+#endif
+    // Allocated here, the workers only copy
+    copies.push_back({file.data(tensor), target->current_mutable_data_memory(to_gpu),
+        static_cast<size_t>(tensor.bytes())});
+  }
+#ifndef CPU_ONLY
+  if (to_gpu) {
+    // Allocations may have zeroed memory on this thread's stream
+    CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  }
+#endif
+  const size_t workers = std::min<size_t>(copies.size(),
+      std::max(1U, std::min(8U, std::thread::hardware_concurrency())));
+  std::atomic<size_t> next(0UL);
+  const int device = Caffe::current_device();
+  {
+    // Helper tasks take copies off the same counter, the group waits for them
+    TaskGroup helpers(static_cast<int>(std::max<size_t>(workers, 2UL) - 1UL),
+        TaskScheduler::NORMAL);
+    for (size_t w = 1UL; w < workers; ++w) {
+      helpers.Submit([&copies, &next, to_gpu, device]() {
+        CopyWeights(copies, &next, to_gpu, device);
+      });
+    }
+    CopyWeights(copies, &next, to_gpu, device);
+  }
+  const double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now().time_since_epoch()).count() - start;
+  LOG(INFO) << "Loaded " << total_bytes / 1048576.0 << " MB of weights from "
+      << trained_filename << " in " << seconds << " s, " << std::max<size_t>(workers, 1UL)
+      << " threads";
+}
+
+#ifndef CPU_ONLY
+void Net::CopyTrainedLayersFromIpc(const string& handle_file) {
+  WeightsChanged();
+  CHECK(folded_bn_.empty()) << "fold_batch_norm needs weights in binary proto format";
+  CHECK_EQ(Caffe::mode(), Caffe::GPU) << "IPC weights are attached in GPU mode";
+  shared_ptr<IpcWeights> weights = make_shared<IpcWeights>(handle_file);
+  for (const WeightIndex::Tensor& tensor : weights->index().tensor()) {
+    if (!layer_names_index_.count(tensor.layer())) {
+      LOG(INFO) << "Ignoring source layer " << tensor.layer();
+      continue;
+    }
+    const int target_layer_id = layer_names_index_[tensor.layer()];
+    vector<shared_ptr<Blob>>& target_blobs = layers_[target_layer_id]->blobs();
+    CHECK_LT(tensor.blob_id(), target_blobs.size())
+        << "Incompatible number of blobs for layer " << tensor.layer();
+    if (param_owners_[param_id_vecs_[target_layer_id][tensor.blob_id()]] != -1) {
+      continue;  // weight-shared, the owner gets it
+    }
+    Blob* target = target_blobs[tensor.blob_id()].get();
+    CHECK(target->shape() == vector<int>(tensor.shape().dim().begin(),
+        tensor.shape().dim().end()))
+        << "Cannot attach param " << tensor.blob_id() << " weights of layer '"
+        << tensor.layer() << "'; shape mismatch.  Source param shape is "
+        << tensor.shape().ShortDebugString() << "; target param shape is "
+        << target->shape_string();
+    // Zero-copy, so no conversion
+    CHECK_EQ(tensor.type(), target->data_type()) << "Cannot attach param "
+        << tensor.blob_id() << " weights of layer '" << tensor.layer() << "' exported as "
+        << Type_Name(tensor.type()) << ", the net holds them as "
+        << Type_Name(target->data_type());
+    if (target->count() > 0) {
+      target->set_gpu_data(weights->data(tensor));
+    }
+  }
+  ipc_weights_ = weights;
+}
+
+shared_ptr<IpcWeights> Net::ToIpcWeights(const string& handle_file) const {
+  size_t bytes = 0UL;
+  for (int i = 0; i < layers_.size(); ++i) {
+    const vector<shared_ptr<Blob>>& blobs = layers_[i]->blobs();
+    for (int j = 0; j < blobs.size(); ++j) {
+      if (param_owners_[param_id_vecs_[i][j]] == -1) {
+        bytes += IpcWeights::AlignedBytes(*blobs[j]);
+      }
+    }
+  }
+  shared_ptr<IpcWeights> weights = make_shared<IpcWeights>(bytes);
+  for (int i = 0; i < layers_.size(); ++i) {
+    const vector<shared_ptr<Blob>>& blobs = layers_[i]->blobs();
+    for (int j = 0; j < blobs.size(); ++j) {
+      if (param_owners_[param_id_vecs_[i][j]] == -1) {
+        weights->Add(layer_names_[i], j, *blobs[j]);
+      }
+    }
+  }
+  weights->Publish(handle_file);
+  return weights;
+}
+#endif
+
+void Net::ToWeightFile(const string& filename) const {
+  WeightFileWriter writer(filename);
+  for (int i = 0; i < layers_.size(); ++i) {
+    const vector<shared_ptr<Blob>>& blobs = layers_[i]->blobs();
+    for (int j = 0; j < blobs.size(); ++j) {
+      writer.Add(layer_names_[i], j, *blobs[j]);
+    }
+  }
+  writer.Close();
+}
+
 void Net::ToProto(NetParameter* param, bool write_diff) const {
   param->Clear();
   param->set_name(name_);
@@ -1219,6 +4947,12 @@ void Net::ToProto(NetParameter* param, bool write_diff) const {
 }
 
 void Net::ToHDF5(const string& filename, bool write_diff) const {
+  ToHDF5(filename, write_diff, params_);
+}
+
+void Net::ToHDF5(const string& filename, bool write_diff,
+    const vector<shared_ptr<Blob>>& params) const {
+  CHECK_EQ(params.size(), params_.size());
   hid_t file_hid = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
       H5P_DEFAULT);
   CHECK_GE(file_hid, 0)
@@ -1254,12 +4988,12 @@ void Net::ToHDF5(const string& filename, bool write_diff) const {
       if (param_owners_[net_param_id] == -1) {
         // Only save params that own themselves
         hdf5_save_nd_dataset(layer_data_hid, dataset_name.str(),
-            *params_[net_param_id]);
+            *params[net_param_id]);
       }
       if (write_diff) {
         // Write diffs regardless of weight-sharing
         hdf5_save_nd_dataset(layer_diff_hid, dataset_name.str(),
-            *params_[net_param_id], true);
+            *params[net_param_id], true);
       }
     }
     H5Gclose(layer_data_hid);
@@ -1283,6 +5017,17 @@ void Net::Update() {
 void Net::ClearParamDiffs() {
   if (Caffe::mode() == Caffe::GPU) {
 #ifndef CPU_ONLY
+    if (!stage_of_.empty()) {
+      // Not in the learnable space, see InitializeLearnableDiffSpace
+      for (int s = 0; s < stage_params_.size(); ++s) {
+        RunOnStage(s, [&]() {
+          for (int param_id : stage_params_[s]) {
+            learnable_params_[param_id]->set_diff(0.F);
+          }
+        });
+      }
+      return;
+    }
     caffe_gpu_memset(learnable_space_[0].size(), 0, learnable_space_[0].data());
     caffe_gpu_memset(learnable_space_[1].size(), 0, learnable_space_[1].data());
 #else
@@ -1351,6 +5096,30 @@ void Net::set_solver(Solver* s) {
   }
 }
 
+void Net::ConvertLearnableParams() {
+  if (learnable_params_.empty()) {
+    return;
+  }
+  std::set<const Blob*> learnable;
+  for (const shared_ptr<Blob>& lp : learnable_params_) {
+    learnable.insert(lp.get());
+  }
+  vector<vector<Blob*>> by_type(Type_ARRAYSIZE);
+  for (int i = 0; i < layers_.size(); ++i) {
+    const Type ftype = layers_[i]->layer_param().forward_type();
+    for (const shared_ptr<Blob>& blob : layers_[i]->blobs()) {
+      if (blob->data_type() != ftype && learnable.count(blob.get()) > 0) {
+        by_type[ftype].push_back(blob.get());
+      }
+    }
+  }
+  for (int t = 0; t < Type_ARRAYSIZE; ++t) {
+    if (!by_type[t].empty()) {
+      Blob::convert_data_batch(by_type[t], (Type) t);
+    }
+  }
+}
+
 #ifndef CPU_ONLY
 void Net::InitializeLearnableDiffSpace(int type_id) {
   CHECK_GE(type_id, 0);
@@ -1358,6 +5127,14 @@ void Net::InitializeLearnableDiffSpace(int type_id) {
   const Type t = (Type) learnable_types_[type_id];
   learnable_space_size_[type_id] = 0UL;
   learnable_params_ptrs_[type_id].resize(learnable_params_.size(), nullptr);
+  if (!stage_of_.empty()) {
+    // Gradients stay on their stages' devices and are applied there, see
+    // ApplyStageUpdates
+    grad_layers_[type_id].clear();
+    grad_layer_slot_[type_id].assign(layers_.size(), -1);
+    param_slot_[type_id].assign(learnable_params_.size(), -1);
+    return;
+  }
   for (int i = 0; i < layers_.size(); ++i) {
     for (int j = 0; j < layers_[i]->blobs().size(); ++j) {
       if (!layers_[i]->skip_apply_update(j)) {
@@ -1382,7 +5159,19 @@ void Net::InitializeLearnableDiffSpace(int type_id) {
   learnable_space_[type_id].reserve(learnable_space_size_[type_id]);
   unsigned char* ptr = reinterpret_cast<unsigned char*>(learnable_space_[type_id].data());
   caffe_gpu_memset(learnable_space_size_[type_id], 0, ptr);
+  for (GradLayer& gl : grad_layers_[type_id]) {
+    CUDA_CHECK(cudaEventDestroy(gl.ready));
+    CUDA_CHECK(cudaEventDestroy(gl.updated));
+  }
+  grad_layers_[type_id].clear();
+  grad_layer_slot_[type_id].assign(layers_.size(), -1);
+  param_slot_[type_id].assign(learnable_params_.size(), -1);
+  forward_gates_.clear();
   for (int i = 0; i < layers_.size(); ++i) {
+    GradLayer gl;
+    gl.layer_id = i;
+    gl.count = 0UL;
+    gl.ready_us = 0.;
     for (int j = 0; j < layers_[i]->blobs().size(); ++j) {
       if (!layers_[i]->skip_apply_update(j)) {
         const int lip = layer_index_params_[make_pair(i, j)];
@@ -1396,9 +5185,11 @@ void Net::InitializeLearnableDiffSpace(int type_id) {
             learnable_params_[param_id]->freeze_diff();
 #endif
             learnable_params_mapped_.push_back(learnable_params_[param_id]);
-            ltop_[type_id][i].insert(param_id);
+            gl.param_ids.push_back(param_id);
+            gl.count += lp_aligned_count(param_id);
             void *p = learnable_params_[param_id]->current_mutable_data_memory(true);
             (void) p;
+            learnable_params_[param_id]->advise_on_device(false);
           }
         }
       } else {
@@ -1407,6 +5198,58 @@ void Net::InitializeLearnableDiffSpace(int type_id) {
             << " of type " << layers_[i]->type();
       }
     }
+    if (!gl.param_ids.empty()) {
+      CUDA_CHECK(cudaEventCreateWithFlags(&gl.ready, cudaEventDisableTiming));
+      CUDA_CHECK(cudaEventCreateWithFlags(&gl.updated, cudaEventDisableTiming));
+      gl.updated_iter = 0;
+      gl.pending = gl.param_ids.size();
+      for (int param_id : gl.param_ids) {
+        param_slot_[type_id][param_id] = grad_layers_[type_id].size();
+      }
+      grad_layer_slot_[type_id][i] = grad_layers_[type_id].size();
+      grad_layers_[type_id].push_back(gl);
+    }
+  }
+  // Managed memory: parameters stay on device, activations migrate
+  GPUMemory::advise_on_device(learnable_space_[type_id].data(), learnable_space_size_[type_id]);
+  grad_accum_space_[type_id].release();
+  if (solver_ != nullptr && solver_->param().fp32_grad_accumulation() && t == FLOAT16) {
+    const bool sparse = std::any_of(sparse_rows_.begin(), sparse_rows_.end(),
+        [](const vector<int>* rows) { return rows != nullptr; });
+    if (solver_->sharded() || pipeline_stages() > 1 || sparse) {
+      LOG_IF(WARNING, Caffe::root_solver()) << "fp32_grad_accumulation is ignored with "
+          "shard_solver_state, pipeline stages and sparse gradients";
+    } else {
+      const size_t bytes = learnable_space_size_[type_id] / tsize(FLOAT16) * tsize(FLOAT);
+      grad_accum_space_[type_id].reserve(bytes);
+      caffe_gpu_memset(bytes, 0, grad_accum_space_[type_id].data());
+      LOG(INFO) << print_current_device() << " FLOAT16 gradients are accumulated as FLOAT";
+    }
+  }
+  const Type rt = reduce_type(type_id);
+  if (Caffe::solver_count() > 1 && solver_ != nullptr && compressed_reduce(rt)) {
+    reduce_fp16_space_[type_id].reserve(
+        even(learnable_space_size_[type_id] / tsize(t) + 1UL) * tsize(FLOAT16));
+    if (solver_->param().reduce_error_feedback()) {
+      reduce_residual_space_[type_id].reserve(reduce_space_size(type_id));
+      caffe_gpu_memset(reduce_space_size(type_id), 0, reduce_residual_space_[type_id].data());
+    }
+    LOG(INFO) << print_current_device() << " Gradients of type " << Type_Name(rt)
+              << " are reduced as FLOAT16"
+              << (solver_->param().reduce_error_feedback() ? " with error feedback" : "");
+  }
+}
+
+void Net::PrefetchManaged(int layer_id, bool with_diff) {
+  if (layer_id < 0 || layer_id >= layers_.size()) {
+    return;
+  }
+  cudaStream_t stream = Caffe::th_stream_aux(Caffe::STREAM_ID_ASYNC_PUSH);
+  for (Blob* blob : bottom_vecs_[layer_id]) {
+    blob->prefetch_gpu(with_diff, stream);
+  }
+  for (Blob* blob : top_vecs_[layer_id]) {
+    blob->prefetch_gpu(with_diff, stream);
   }
 }
 
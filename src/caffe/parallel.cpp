@@ -2,11 +2,18 @@
 #include <cuda_runtime.h>
 #endif
 #include <glog/logging.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <utility>
 #include <boost/thread.hpp>
 #include <boost/thread/latch.hpp>
 
 #include "caffe/caffe.hpp"
 #include "caffe/parallel.hpp"
+#include "caffe/util/nvtx.hpp"
 
 #ifdef USE_NCCL
 #include "caffe/util/nccl.hpp"
@@ -14,38 +21,73 @@
 
 namespace caffe {
 
-unique_ptr<boost::barrier> P2PManager::dl_bar(new boost::barrier(1));
-unique_ptr<boost::barrier> P2PManager::bar;
-unique_ptr<boost::barrier> P2PManager::rbar0;
-unique_ptr<boost::barrier> P2PManager::rbar1;
+unique_ptr<SpinBarrier> P2PManager::dl_bar(new SpinBarrier(1));
+unique_ptr<SpinBarrier> P2PManager::bar;
+unique_ptr<SpinBarrier> P2PManager::rbar0;
+unique_ptr<SpinBarrier> P2PManager::rbar1;
 
 P2PManager::P2PManager(shared_ptr<Solver> root_solver,
-    int nranks, const SolverParameter& solver_param) :
+    int nranks, const SolverParameter& solver_param, const std::string& master) :
       nranks_(nranks),
       syncs_(nranks),
       root_solver_(root_solver) {
 #ifndef USE_NCCL
   LOG(FATAL) << "USE_NCCL must be specified for multi-GPU mode";
 #endif
-  dl_bar.reset(new boost::barrier(nranks_));
-  bar.reset(new boost::barrier(nranks_));
-  rbar0.reset(new boost::barrier(nranks_));
-  rbar1.reset(new boost::barrier(nranks_));
+  dl_bar.reset(new SpinBarrier(nranks_));
+  bar.reset(new SpinBarrier(nranks_));
+  rbar0.reset(new SpinBarrier(nranks_));
+  rbar1.reset(new SpinBarrier(nranks_));
+  if (solver_param.nccl_max_channels() > 0) {
+    // Read by NCCL when communicators are created, the environment wins
+    setenv("NCCL_MAX_NCHANNELS", std::to_string(solver_param.nccl_max_channels()).c_str(), 0);
+  }
+  if (solver_param.deterministic() || Caffe::deterministic()) {
+    // Same algorithm and protocol for every size: sums are added up in the same order
+    setenv("NCCL_ALGO", "Ring", 0);
+    setenv("NCCL_PROTO", "Simple", 0);
+  }
+  if (Caffe::node_count() > 1) {
+    CHECK(!master.empty()) << "Master endpoint is required for multi-node training";
+    rendezvous_.reset(new Rendezvous(Caffe::node_count(), Caffe::node_rank(), master));
+    // Global ranks are laid out as node_rank * nranks + local rank
+    int root_nranks = static_cast<int>(nranks_);
+    rendezvous_->Broadcast(&root_nranks, sizeof(root_nranks));
+    CHECK_EQ(root_nranks, nranks_) << "Every node must use the same number of GPUs";
+  }
 }
 
 void P2PManager::Run(const vector<int>& gpus) {
+  start_ = std::chrono::steady_clock::now();
 #ifndef CPU_ONLY
 #ifdef USE_NCCL
   CHECK_EQ(nranks_, gpus.size());
-  CHECK_EQ(nranks_, Caffe::solver_count());
-  NCCL_CHECK(ncclGetUniqueId(&nccl_id_[0]));
-  NCCL_CHECK(ncclGetUniqueId(&nccl_id_[1]));
+  CHECK_EQ(nranks_ * Caffe::node_count(), Caffe::solver_count());
+  if (Caffe::root_node()) {
+    NCCL_CHECK(ncclGetUniqueId(&nccl_id_[0]));
+    NCCL_CHECK(ncclGetUniqueId(&nccl_id_[1]));
+    NCCL_CHECK(ncclGetUniqueId(&nccl_stats_id_));
+  }
+  if (rendezvous_) {
+    rendezvous_->Broadcast(nccl_id_, sizeof(nccl_id_));
+    rendezvous_->Broadcast(&nccl_stats_id_, sizeof(nccl_stats_id_));
+    if (root_solver_->param().hierarchical_allreduce()) {
+      NCCL_CHECK(ncclGetUniqueId(&nccl_local_id_[0]));
+      NCCL_CHECK(ncclGetUniqueId(&nccl_local_id_[1]));
+      nccl_node_ids_.resize(2UL * nranks_);
+      if (Caffe::root_node()) {
+        for (ncclUniqueId& id : nccl_node_ids_) {
+          NCCL_CHECK(ncclGetUniqueId(&id));
+        }
+      }
+      rendezvous_->Broadcast(nccl_node_ids_.data(), nccl_node_ids_.size() * sizeof(ncclUniqueId));
+    }
+  }
 #else
   LOG(FATAL) << "Multi-GPU execution not available - rebuild with USE_NCCL";
 #endif  // USE_NCCL
 #endif  // CPU_ONLY
   SolverParameter param = root_solver_->param();
-  this->shared_ = make_shared<SharedScores<float>>(nranks_);
   for (int i = 0; i < gpus.size(); ++i) {
     param.set_device_id(gpus[i]);
     syncs_[i].reset(new P2PSync(this, root_solver_, i, gpus.size(), param));
@@ -57,7 +99,6 @@ void P2PManager::Run(const vector<int>& gpus) {
     LOG(FATAL) << "Multi-GPU execution not available - rebuild with USE_NCCL";
 #endif  // USE_NCCL
 #endif  // CPU_ONLY
-    syncs_[i]->shared_ = this->shared_;
   }
 
   LOG(INFO)<< "Starting Optimization";
@@ -79,9 +120,41 @@ void P2PManager::Run(const vector<int>& gpus) {
     total_perf += syncs_[i]->solver_->perf_report(os, syncs_[i]->target_device_, 5 /* "Root " */);
     LOG(INFO) << os.str();
   }
+  report_barriers();
   if (syncs_.size() > 1) {
     LOG(INFO) << "Overall multi-GPU performance: " << total_perf << " img/sec";
   }
+  if (rendezvous_) {
+    float nodes_perf = total_perf;
+    rendezvous_->AllReduceSum(&nodes_perf, 1UL);
+    LOG_IF(INFO, Caffe::root_node()) << "Overall performance of " << Caffe::node_count()
+        << " nodes: " << nodes_perf << " img/sec";
+  }
+}
+
+void P2PManager::report_barriers() {
+  const std::pair<const char*, SpinBarrier*> barriers[] = {
+      {"Data layer", dl_bar.get()}, {"Soft", bar.get()},
+      {"Reduce 0", rbar0.get()}, {"Reduce 1", rbar1.get()}};
+  for (const auto& b : barriers) {
+    if (b.second == nullptr) {
+      continue;
+    }
+    const string report = b.second->report();
+    LOG_IF(INFO, !report.empty()) << b.first << " barrier: " << report;
+  }
+}
+
+void P2PManager::report_startup() const {
+  std::ostringstream os;
+  os.precision(3);
+  os << std::fixed;
+  for (const unique_ptr<P2PSync>& sync : syncs_) {
+    os << " [" << sync->global_rank_ << " - " << sync->target_device_ << "] solver "
+       << sync->solver_ready_s_ << "s, NCCL " << sync->comms_ready_s_ << "s;";
+  }
+  LOG(INFO) << "Startup timeline since Run:" << os.str() << " all ready at " << elapsed_s()
+      << "s";
 }
 
 void P2PManager::EarlyCancel(P2PSync* killed) {
@@ -102,16 +175,23 @@ P2PSync::P2PSync(P2PManager* mgr, shared_ptr<Solver> root_solver,
       mgr_(mgr),
       rank_(rank),
       nranks_(nranks),
+      global_rank_(Caffe::solver_rank_offset() + rank),
+      hierarchical_(solver_param.hierarchical_allreduce() && Caffe::node_count() > 1),
       initial_iter_(root_solver->iter()),
       solver_(),
       root_solver_(root_solver),
-      solver_param_(solver_param) {
+      solver_param_(solver_param),
+      solver_ready_s_(0.),
+      comms_ready_s_(0.) {
 #ifndef USE_NCCL
   LOG(FATAL) << "USE_NCCL := 1 must be specified for multi-GPU";
 #endif
 #ifndef CPU_ONLY
   LOG(INFO) << "[" << rank << " - " << this->target_device_ << "] P2pSync adding callback";
   cublas_handle_ = nullptr;
+#ifdef USE_NCCL
+  stats_comm_init_ = false;
+#endif
 #else
   NO_GPU;
 #endif
@@ -122,6 +202,19 @@ P2PSync::~P2PSync() {
 #ifdef USE_NCCL
   ncclCommDestroy(nccl_comm_[0]);
   ncclCommDestroy(nccl_comm_[1]);
+  if (stats_comm_init_) {
+    ncclCommDestroy(stats_comm_);
+  }
+  if (hierarchical_) {
+    for (int type_id = 0; type_id < 2; ++type_id) {
+      ncclCommDestroy(local_comm_[type_id]);
+      ncclCommDestroy(node_comm_[type_id]);
+      for (size_t i = 0; i < scattered_[type_id].size(); ++i) {
+        cudaEventDestroy(scattered_[type_id][i]);
+        cudaEventDestroy(reduced_[type_id][i]);
+      }
+    }
+  }
 #endif
 #endif
 }
@@ -130,34 +223,56 @@ void P2PSync::InternalThreadEntry() {
   if (rank_ == 0) {
     Caffe::set_root_solver(true);
     solver_ = root_solver_;
-    solver_->root_add_callback(this);
   } else {
     Caffe::set_root_solver(false);
     solver_.reset(caffe::SolverRegistry::CreateSolver(solver_param_, root_solver_.get(), rank_));
+    const string& state_file = root_solver_->restored_state_file();
+    if (!state_file.empty() && (solver_->sharded() || Solver::IsShardedSnapshot(state_file))) {
+      solver_->Restore(state_file.c_str());  // own shard
+    }
   }
   solver_->set_callback(this);
 
-  CHECK_EQ(nranks_, Caffe::solver_count());
+  CHECK_EQ(nranks_ * Caffe::node_count(), Caffe::solver_count());
 
 #ifndef CPU_ONLY
 #ifdef USE_NCCL
   ncclUniqueId* nccl_id[2];
   nccl_id[0] = reinterpret_cast<ncclUniqueId*>(this->aux_[0]);
   nccl_id[1] = reinterpret_cast<ncclUniqueId*>(this->aux_[1]);
+  solver_ready_s_ = mgr_->elapsed_s();
   soft_barrier();
-  NCCL_CHECK(ncclCommInitRank(&nccl_comm_[0], nranks_, *nccl_id[0], rank_));
-  NCCL_CHECK(ncclCommInitRank(&nccl_comm_[1], nranks_, *nccl_id[1], rank_));
+  // Grouped: every communicator of this rank is set up in one pass instead of
+  // one bootstrap after another
+  NCCL_CHECK(ncclGroupStart());
+  NCCL_CHECK(ncclCommInitRank(&nccl_comm_[0], Caffe::solver_count(), *nccl_id[0], global_rank_));
+  NCCL_CHECK(ncclCommInitRank(&nccl_comm_[1], Caffe::solver_count(), *nccl_id[1], global_rank_));
+  if (hierarchical_) {
+    for (int type_id = 0; type_id < 2; ++type_id) {
+      NCCL_CHECK(ncclCommInitRank(&local_comm_[type_id], nranks_,
+          mgr_->nccl_local_id_[type_id], rank_));
+      NCCL_CHECK(ncclCommInitRank(&node_comm_[type_id], Caffe::node_count(),
+          mgr_->nccl_node_ids_[type_id * nranks_ + rank_], Caffe::node_rank()));
+    }
+  }
+  NCCL_CHECK(ncclGroupEnd());
+  LOG_IF(INFO, hierarchical_ && global_rank_ == 0) << "Hierarchical allreduce: " << nranks_
+      << " GPUs per node, " << Caffe::node_count() << " nodes";
+  comms_ready_s_ = mgr_->elapsed_s();
   soft_barrier();
+  if (rank_ == 0) {
+    mgr_->report_startup();
+  }
 #endif
 #endif
 
-  LOG(INFO) << "[" << rank_ << " - " << target_device_ << "] P2pSync adding callback";
+  LOG(INFO) << "[" << global_rank_ << " - " << target_device_ << "] P2pSync adding callback";
   // See if there is a defined seed and reset random state if so
   if (solver_->param().random_seed() >= 0) {
     // Fetch random seed and modulate by device ID to make sure
     // everyone doesn't have the same seed.  We seem to have some
     // solver instability if we have everyone with the same seed
-    Caffe::set_random_seed(solver_->param().random_seed() + static_cast<uint64_t>(rank_));
+    Caffe::set_random_seed(solver_->param().random_seed() + static_cast<uint64_t>(global_rank_));
   } else {
     // Or system generated one
     Caffe::set_random_seed(Caffe::SEED_NOT_SET);
@@ -166,6 +281,13 @@ void P2PSync::InternalThreadEntry() {
 #ifndef CPU_ONLY
   comm_stream_[0] = CudaStream::create(true);
   comm_stream_[1] = CudaStream::create(true);
+  normal_stream_[0] = CudaStream::create(false);
+  normal_stream_[1] = CudaStream::create(false);
+  urgent_[0] = urgent_[1] = true;
+  if (hierarchical_) {
+    node_stream_[0] = CudaStream::create(true);
+    node_stream_[1] = CudaStream::create(true);
+  }
   stream_ = Caffe::thread_pstream();
   cublas_handle_ = Caffe::cublas_phandle();
   // sanity check
@@ -181,14 +303,16 @@ void P2PSync::InternalThreadEntry() {
 
 void P2PSync::soft_barrier() {
 #ifndef CPU_ONLY
+  NVTX_RANGE(NVTX_WAIT, "P2PSync barrier");
   // CPU barrier to avoid busy-polling on the GPU.
-  P2PManager::bar_wait();
+  P2PManager::bar_wait(rank_);
 #endif
 }
 
 void P2PSync::reduce_barrier(int type_id) {
 #ifndef CPU_ONLY
-  P2PManager::rbar_wait(type_id);
+  NVTX_RANGE(NVTX_WAIT, "P2PSync reduce barrier");
+  P2PManager::rbar_wait(type_id, rank_);
 #endif
 }
 
@@ -197,17 +321,56 @@ void P2PSync::on_start(const vector<shared_ptr<Blob>>& net) {
 #ifdef USE_NCCL
   int count = 0;
   NCCL_CHECK(ncclCommCount(nccl_comm_[0], &count));
-  CHECK_EQ(count, nranks_);
-  for (int i = 0; i < net.size(); ++i) {
-    const shared_ptr<Blob>& param = net[i];
-    NCCL_CHECK(ncclBcast(param->current_mutable_data_memory(true),
-        even(param->count()),
-        nccl::nccl_type(param->data_type()),
-        0,
-        nccl_comm_[0],
-        comm_stream_[0]->get()));
+  CHECK_EQ(count, Caffe::solver_count());
+  // Blobs are packed back to back into the gradient space of the net, unused yet, and
+  // broadcast in few large pieces. Rounds of them if they don't fit. Memory can't be
+  // allocated here: the root solver holds GPUMemory::CollectiveScope.
+  const size_t piece = 16UL * 1024UL * 1024UL;
+  cudaStream_t stream = comm_stream_[0]->get();
+  size_t space_size = 0UL;
+  char* space = static_cast<char*>(solver_->net()->largest_learnable_space(&space_size));
+  auto blob_bytes = [&](int i) {
+    return even(net[i]->count()) * tsize(net[i]->data_type());
+  };
+  size_t bcasts = 0UL;
+  for (int i = 0, end = 0; i < net.size(); i = end) {
+    size_t bytes = 0UL;
+    for (end = i; end < net.size() && bytes + blob_bytes(end) <= space_size; ++end) {
+      bytes += blob_bytes(end);
+    }
+    if (end == i) {
+      // Larger than the space
+      NCCL_CHECK(ncclBcast(net[i]->current_mutable_data_memory(true), even(net[i]->count()),
+          nccl::nccl_type(net[i]->data_type()), 0, nccl_comm_[0], stream));
+      ++bcasts;
+      ++end;
+      continue;
+    }
+    if (global_rank_ == 0) {
+      size_t offset = 0UL;
+      for (int j = i; j < end; offset += blob_bytes(j++)) {
+        CUDA_CHECK(cudaMemcpyAsync(space + offset, net[j]->current_data_memory(true),
+            blob_bytes(j), cudaMemcpyDeviceToDevice, stream));
+      }
+    }
+    for (size_t offset = 0UL; offset < bytes; offset += piece, ++bcasts) {
+      NCCL_CHECK(ncclBcast(space + offset, std::min(piece, bytes - offset), ncclChar, 0,
+          nccl_comm_[0], stream));
+    }
+    if (global_rank_ != 0) {
+      size_t offset = 0UL;
+      for (int j = i; j < end; offset += blob_bytes(j++)) {
+        CUDA_CHECK(cudaMemcpyAsync(net[j]->current_mutable_data_memory(true),
+            space + offset, blob_bytes(j), cudaMemcpyDeviceToDevice, stream));
+      }
+    }
+  }
+  if (space != nullptr) {
+    CUDA_CHECK(cudaMemsetAsync(space, 0, space_size, stream));
   }
-  CUDA_CHECK(cudaStreamSynchronize(comm_stream_[0]->get()));
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+  LOG_IF(INFO, global_rank_ == 0) << net.size() << " blobs broadcast in " << bcasts
+      << " pieces";
 #endif  // USE_NCCL
 #endif
 }
@@ -222,8 +385,8 @@ void P2PSync::allreduce(int type_id, int param_id) {
       nccl::nccl_type(param->diff_type()),
       ncclSum,
       nccl_comm_[type_id],
-      comm_stream_[type_id]->get()));
-  CUDA_CHECK(cudaStreamSynchronize(comm_stream_[type_id]->get()));
+      comm_stream(type_id)));
+  CUDA_CHECK(cudaStreamSynchronize(comm_stream(type_id)));
 #endif  // USE_NCCL
 #endif  // CPU_ONLY
 }
@@ -231,43 +394,252 @@ void P2PSync::allreduce(int type_id, int param_id) {
 void P2PSync::allreduce_bucket(int type_id, size_t count, void* bucket, Type type) {
 #ifndef CPU_ONLY
 #ifdef USE_NCCL
+  NVTX_RANGE(NVTX_REDUCE, "P2PSync allreduce " + std::to_string(count * tsize(type)) + " bytes");
   CHECK(bucket);
+  if (hierarchical_) {
+    hierarchical_allreduce(type_id, count, bucket, type);
+    return;
+  }
   NCCL_CHECK_ARG2(ncclAllReduce(bucket, bucket, count, nccl::nccl_type(type),
-                  ncclSum, nccl_comm_[type_id], comm_stream_[type_id]->get()),
-                  Caffe::current_device(), comm_stream_[type_id]->get());
-  CUDA_CHECK(cudaStreamSynchronize(comm_stream_[type_id]->get()));
+                  ncclSum, nccl_comm_[type_id], comm_stream(type_id)),
+                  Caffe::current_device(), comm_stream(type_id));
+  CUDA_CHECK(cudaStreamSynchronize(comm_stream(type_id)));
 #endif  // USE_NCCL
 #endif  // CPU_ONLY
 }
 
-// master thread gets aggregate of results for output
-void P2PSync::aggregateTestResults(float* loss, vector<float>* scores) {
-  // only run on master thread
-  if (this->rank_ == 0) {
-    // initialize results
-    *loss = 0.F;
-    for (size_t i = 0; i < scores->size(); ++i) {
-      (*scores)[i] = 0.F;
+void P2PSync::allreduce_rows(int type_id, int param_id, vector<int>* rows) {
+#ifndef CPU_ONLY
+#ifdef USE_NCCL
+  const shared_ptr<Blob>& param = solver_->net()->learnable_params()[param_id];
+  cudaStream_t stream = comm_stream(type_id);
+  // Everyone's rows, lists padded to the longest one
+  const int max_rows =
+      static_cast<int>(allreduce_max(type_id, static_cast<float>(rows->size())));
+  if (max_rows == 0) {
+    return;
+  }
+  const int nranks = Caffe::solver_count();
+  vector<int> all_rows(static_cast<size_t>(nranks) * max_rows, -1);
+  std::copy(rows->begin(), rows->end(), all_rows.begin() + global_rank_ * max_rows);
+  rows_[type_id].reserve(all_rows.size() * sizeof(int));
+  int* rows_buf = static_cast<int*>(rows_[type_id].data());
+  CUDA_CHECK(cudaMemcpyAsync(rows_buf + global_rank_ * max_rows,
+      all_rows.data() + global_rank_ * max_rows, max_rows * sizeof(int),
+      cudaMemcpyHostToDevice, stream));
+  NCCL_CHECK(ncclAllGather(rows_buf + global_rank_ * max_rows, rows_buf, max_rows, ncclInt,
+      nccl_comm_[type_id], stream));
+  CUDA_CHECK(cudaMemcpyAsync(all_rows.data(), rows_buf, all_rows.size() * sizeof(int),
+      cudaMemcpyDeviceToHost, stream));
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+  rows->clear();
+  for (int row : all_rows) {
+    if (row >= 0) {
+      rows->push_back(row);
     }
-    // all test threads
-    for (size_t i = 0; i < nranks_; ++i) {
-      vector<float>& shared_scr = shared_->rank_scores(this->rank_);
-      *loss += shared_scr[0];
-      // all scores within each test thread
-      for (size_t j = 0; j < scores->size(); ++j) {
-        (*scores)[j] += shared_scr[j+1];
-      }
+  }
+  std::sort(rows->begin(), rows->end());
+  rows->erase(std::unique(rows->begin(), rows->end()), rows->end());
+  // Their gradients are packed, summed and put back
+  const int n = rows->size();
+  const int width = param->count() / param->shape(0);
+  const Type type = param->diff_type();
+  packed_rows_[type_id].reserve(static_cast<size_t>(n) * width * tsize(type));
+  void* packed = packed_rows_[type_id].data();
+  void* diff = param->current_mutable_diff_memory(true);
+  CUDA_CHECK(cudaMemcpyAsync(rows_buf, rows->data(), n * sizeof(int),
+      cudaMemcpyHostToDevice, stream));
+  caffe_gpu_gather_rows(type, n, width, rows_buf, diff, packed, stream);
+  NCCL_CHECK(ncclAllReduce(packed, packed, static_cast<size_t>(n) * width,
+      nccl::nccl_type(type), ncclSum, nccl_comm_[type_id], stream));
+  caffe_gpu_scatter_rows(type, n, width, rows_buf, packed, diff, stream);
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+#endif  // USE_NCCL
+#endif  // CPU_ONLY
+}
+
+void P2PSync::reduce_to_owners(int type_id, const vector<int>& param_ids) {
+#ifndef CPU_ONLY
+#ifdef USE_NCCL
+  const vector<shared_ptr<Blob>>& params = solver_->net()->learnable_params();
+  cudaStream_t stream = comm_stream(type_id);
+  for (int param_id : param_ids) {
+    const shared_ptr<Blob>& param = params[param_id];
+    NCCL_CHECK(ncclReduce(param->current_diff_memory(true),
+        param->current_mutable_diff_memory(true),
+        even(param->count()),
+        nccl::nccl_type(param->diff_type()),
+        ncclSum,
+        solver_->shard_owner(param_id),
+        nccl_comm_[type_id],
+        stream));
+  }
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+#endif  // USE_NCCL
+#endif  // CPU_ONLY
+}
+
+void P2PSync::broadcast_from_owners(int type_id, const vector<int>& param_ids) {
+#ifndef CPU_ONLY
+#ifdef USE_NCCL
+  const vector<shared_ptr<Blob>>& params = solver_->net()->learnable_params();
+  cudaStream_t stream = comm_stream(type_id);
+  for (int param_id : param_ids) {
+    const shared_ptr<Blob>& param = params[param_id];
+    NCCL_CHECK(ncclBcast(param->current_mutable_data_memory(true),
+        even(param->count()),
+        nccl::nccl_type(param->data_type()),
+        solver_->shard_owner(param_id),
+        nccl_comm_[type_id],
+        stream));
+  }
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+#endif  // USE_NCCL
+#endif  // CPU_ONLY
+}
+
+float P2PSync::allreduce_max(int type_id, float value) {
+#ifndef CPU_ONLY
+#ifdef USE_NCCL
+  cudaStream_t stream = comm_stream(type_id);
+  if (scalar_[type_id].empty()) {
+    scalar_[type_id].reserve(sizeof(float));
+  }
+  float* buf = static_cast<float*>(scalar_[type_id].data());
+  CUDA_CHECK(cudaMemcpyAsync(buf, &value, sizeof(float), cudaMemcpyHostToDevice, stream));
+  NCCL_CHECK(ncclAllReduce(buf, buf, 1, ncclFloat, ncclMax, nccl_comm_[type_id], stream));
+  CUDA_CHECK(cudaMemcpyAsync(&value, buf, sizeof(float), cudaMemcpyDeviceToHost, stream));
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+#endif  // USE_NCCL
+#endif  // CPU_ONLY
+  return value;
+}
+
+#ifndef CPU_ONLY
+// Runs on the caller's stream: what follows needs the sums right away, and comm streams
+// may be busy with gradients of the previous layers. The host doesn't wait, so it goes
+// on queueing the next layers.
+void P2PSync::allreduce_stats(void* x, size_t count, Type type, cudaStream_t stream) {
+#ifdef USE_NCCL
+  NCCL_CHECK_ARG2(ncclAllReduce(x, x, count, nccl::nccl_type(type), ncclSum, stats_comm(),
+      stream), Caffe::current_device(), stream);
+#endif  // USE_NCCL
+}
+
+// Point to point within the group of stripes, on the caller's stream as allreduce_stats
+void P2PSync::stripe_broadcast(void* x, size_t bytes, int stripes, cudaStream_t stream) {
+#ifdef USE_NCCL
+#if NCCL_VERSION_CODE >= NCCL_VERSION(2, 7, 0)
+  const int first = global_rank_ - global_rank_ % stripes;
+  ncclComm_t comm = stats_comm();
+  NCCL_CHECK(ncclGroupStart());
+  if (global_rank_ == first) {
+    for (int r = first + 1; r < first + stripes; ++r) {
+      NCCL_CHECK(ncclSend(x, bytes, ncclChar, r, comm, stream));
     }
+  } else {
+    NCCL_CHECK(ncclRecv(x, bytes, ncclChar, first, comm, stream));
+  }
+  NCCL_CHECK(ncclGroupEnd());
+#else
+  LOG(FATAL) << "NetParameter::spatial_stripes needs NCCL 2.7 or later";
+#endif
+#endif  // USE_NCCL
+}
+
+void P2PSync::halo_exchange(const void* up, const void* down, void* from_up,
+    void* from_down, size_t bytes, int stripes, cudaStream_t stream) {
+#ifdef USE_NCCL
+#if NCCL_VERSION_CODE >= NCCL_VERSION(2, 7, 0)
+  const int index = global_rank_ % stripes;
+  ncclComm_t comm = stats_comm();
+  NCCL_CHECK(ncclGroupStart());
+  if (index > 0) {
+    NCCL_CHECK(ncclSend(up, bytes, ncclChar, global_rank_ - 1, comm, stream));
+    NCCL_CHECK(ncclRecv(from_up, bytes, ncclChar, global_rank_ - 1, comm, stream));
   }
+  if (index + 1 < stripes) {
+    NCCL_CHECK(ncclSend(down, bytes, ncclChar, global_rank_ + 1, comm, stream));
+    NCCL_CHECK(ncclRecv(from_down, bytes, ncclChar, global_rank_ + 1, comm, stream));
+  }
+  NCCL_CHECK(ncclGroupEnd());
+#else
+  LOG(FATAL) << "NetParameter::spatial_stripes needs NCCL 2.7 or later";
+#endif
+#endif  // USE_NCCL
 }
 
-void P2PSync::saveTestResults(float loss, const vector<float>& scores) {
-  vector<float>& shared_scr = shared_->rank_scores(this->rank_);
-  CHECK_GE(shared_scr.size(), scores.size() + 1);
-  shared_scr[0] = loss;
-  for (size_t i = 0; i < scores.size(); ++i) {
-    shared_scr[i+1] = scores[i];
+#ifdef USE_NCCL
+ncclComm_t P2PSync::stats_comm() {
+  if (!stats_comm_init_) {
+    NCCL_CHECK(ncclCommInitRank(&stats_comm_, Caffe::solver_count(), mgr_->nccl_stats_id_,
+        global_rank_));
+    stats_comm_init_ = true;
   }
+  return stats_comm_;
+}
+#endif
+
+#ifdef USE_NCCL
+// Bucket is split into pieces of nranks_ equal shards. For every piece: reduce-scatter
+// between local GPUs, allreduce of this GPU's shard between nodes, allgather between
+// local GPUs. Inter-node allreduce of a piece runs on its own stream, overlapped with
+// local reduce-scatters of the next pieces and allgathers of the previous ones.
+void P2PSync::hierarchical_allreduce(int type_id, size_t count, void* bucket, Type type) {
+  const ncclDataType_t dtype = nccl::nccl_type(type);
+  const size_t elem_size = tsize(type);
+  cudaStream_t local_stream = comm_stream_[type_id]->get();
+  cudaStream_t node_stream = node_stream_[type_id]->get();
+  char* base = static_cast<char*>(bucket);
+  const size_t even_count = count / nranks_ * nranks_;
+  size_t piece = even_count;
+  if (solver_param_.inter_node_bucket_mb() > 0U) {
+    const size_t shard = std::max(1UL,
+        (static_cast<size_t>(solver_param_.inter_node_bucket_mb()) << 20) / elem_size);
+    piece = std::min(piece, shard * nranks_);
+  }
+  const size_t pieces = piece > 0UL ? (even_count + piece - 1UL) / piece : 0UL;
+  vector<cudaEvent_t>& scattered = scattered_[type_id];
+  vector<cudaEvent_t>& reduced = reduced_[type_id];
+  while (scattered.size() < pieces) {
+    cudaEvent_t e1, e2;
+    CUDA_CHECK(cudaEventCreateWithFlags(&e1, cudaEventDisableTiming));
+    CUDA_CHECK(cudaEventCreateWithFlags(&e2, cudaEventDisableTiming));
+    scattered.push_back(e1);
+    reduced.push_back(e2);
+  }
+  for (size_t p = 0UL; p < pieces; ++p) {
+    const size_t offset = p * piece;
+    const size_t shard = std::min(piece, even_count - offset) / nranks_;
+    char* my_shard = base + (offset + rank_ * shard) * elem_size;
+    NCCL_CHECK(ncclReduceScatter(base + offset * elem_size, my_shard, shard, dtype,
+        ncclSum, local_comm_[type_id], local_stream));
+    CUDA_CHECK(cudaEventRecord(scattered[p], local_stream));
+    CUDA_CHECK(cudaStreamWaitEvent(node_stream, scattered[p], 0));
+    NCCL_CHECK(ncclAllReduce(my_shard, my_shard, shard, dtype,
+        ncclSum, node_comm_[type_id], node_stream));
+    CUDA_CHECK(cudaEventRecord(reduced[p], node_stream));
+  }
+  for (size_t p = 0UL; p < pieces; ++p) {
+    const size_t offset = p * piece;
+    const size_t shard = std::min(piece, even_count - offset) / nranks_;
+    CUDA_CHECK(cudaStreamWaitEvent(local_stream, reduced[p], 0));
+    NCCL_CHECK(ncclAllGather(base + (offset + rank_ * shard) * elem_size,
+        base + offset * elem_size, shard, dtype, local_comm_[type_id], local_stream));
+  }
+  if (count > even_count) {
+    // Less than one element per local GPU left
+    NCCL_CHECK(ncclAllReduce(base + even_count * elem_size, base + even_count * elem_size,
+        count - even_count, dtype, ncclSum, nccl_comm_[type_id], local_stream));
+  }
+  CUDA_CHECK(cudaStreamSynchronize(local_stream));
+}
+#endif  // USE_NCCL
+#endif  // CPU_ONLY
+
+bool P2PSync::any_node_stop(bool local_stop) {
+  Rendezvous* rendezvous = mgr_->rendezvous();
+  return rendezvous != nullptr ? rendezvous->AnyTrue(local_stop) : local_stop;
 }
 
 uint32_t batch_per_gpu(uint32_t total) {
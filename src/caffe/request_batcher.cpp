@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/request_batcher.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+constexpr size_t RequestBatcher::LATENCY_WINDOW;
+
+RequestBatcher::RequestBatcher(InferenceEngine* engine, int max_batch, int max_latency_us)
+    : engine_(engine), max_batch_(max_batch), max_latency_(max_latency_us), in_flight_(0),
+      stop_(false), start_(Clock::now()), requests_(0UL), batches_(0UL), next_latency_(0UL) {
+  CHECK_NOTNULL(engine_);
+  CHECK_GT(max_batch, 0);
+  CHECK_GE(max_latency_us, 0);
+  batcher_ = std::thread(&RequestBatcher::BatcherEntry, this);
+}
+
+RequestBatcher::~RequestBatcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  batcher_.join();
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_cv_.wait(lock, [this] { return in_flight_ == 0; });
+  for (Batch* batch : free_batches_) {
+    delete batch;
+  }
+}
+
+void RequestBatcher::Infer(const vector<Blob*>& inputs, const vector<Blob*>& outputs) {
+  CHECK_EQ(inputs.size(), engine_->input_names().size()) << "Wrong number of inputs";
+  CHECK_EQ(outputs.size(), engine_->output_names().size()) << "Wrong number of outputs";
+  for (const Blob* input : inputs) {
+    CHECK(input->num_axes() > 0 && input->shape(0) == 1)
+        << "Batched requests must have batch size 1, got " << input->shape_string();
+  }
+  Request request;
+  request.inputs = &inputs;
+  request.outputs = &outputs;
+  request.arrival = Clock::now();
+  std::future<void> done = request.done.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CHECK(!stop_) << "RequestBatcher is being destroyed";
+    pending_.push_back(&request);
+  }
+  cv_.notify_one();
+  done.wait();
+}
+
+void RequestBatcher::BatcherEntry() {
+  vector<Request*> requests;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+    if (pending_.empty()) {
+      break;
+    }
+    const Clock::time_point deadline = pending_.front()->arrival + max_latency_;
+    while (!stop_ && pending_.size() < max_batch_ && Clock::now() < deadline) {
+      cv_.wait_until(lock, deadline);
+    }
+    const size_t n = std::min(pending_.size(), max_batch_);
+    requests.assign(pending_.begin(), pending_.begin() + n);
+    pending_.erase(pending_.begin(), pending_.begin() + n);
+    ++in_flight_;
+    lock.unlock();
+    Dispatch(&requests);
+    lock.lock();
+  }
+}
+
+int RequestBatcher::batch_size(int requests) const {
+  for (int b : engine_->batch_sizes()) {
+    if (b >= requests) {
+      return b;
+    }
+  }
+  return requests;
+}
+
+void RequestBatcher::Dispatch(vector<Request*>* requests) {
+  Batch* batch = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_batches_.empty()) {
+      batch = free_batches_.back();
+      free_batches_.pop_back();
+    }
+  }
+  if (batch == nullptr) {
+    batch = new Batch;
+    for (size_t i = 0; i < engine_->input_names().size(); ++i) {
+      batch->inputs.push_back(make_shared<TBlob<float>>());
+    }
+    for (size_t i = 0; i < engine_->output_names().size(); ++i) {
+      batch->outputs.push_back(make_shared<TBlob<float>>());
+    }
+  }
+  batch->requests.swap(*requests);
+  const int n = batch->requests.size();
+  const int batch_num = batch_size(n);
+  // Gather, padding unused samples with zeros
+  vector<Blob*> inputs, outputs;
+  for (int i = 0; i < batch->inputs.size(); ++i) {
+    TBlob<float>* input = batch->inputs[i].get();
+    vector<int> shape = (*batch->requests[0]->inputs)[i]->shape();
+    shape[0] = batch_num;
+    input->Reshape(shape);
+    const int sample = input->count() / batch_num;
+    float* dst = input->mutable_cpu_data();
+    for (int k = 0; k < n; ++k) {
+      const Blob* source = (*batch->requests[k]->inputs)[i];
+      CHECK_EQ(sample, source->count()) << "Batched requests must have the same shapes";
+      caffe_copy(sample, source->cpu_data<float>(), dst + k * sample);
+    }
+    caffe_set((batch_num - n) * sample, 0.F, dst + n * sample);
+    inputs.push_back(input);
+  }
+  for (const shared_ptr<TBlob<float>>& output : batch->outputs) {
+    outputs.push_back(output.get());
+  }
+  engine_->InferAsync(inputs, outputs, [this, batch]() { Scatter(batch); });
+}
+
+void RequestBatcher::Scatter(Batch* batch) {
+  const int n = batch->requests.size();
+  for (int i = 0; i < batch->outputs.size(); ++i) {
+    const TBlob<float>& output = *batch->outputs[i];
+    CHECK(output.num_axes() > 0 && output.shape(0) >= n)
+        << "Output " << engine_->output_names()[i] << " isn't batched";
+    vector<int> shape = output.shape();
+    const int sample = output.count() / shape[0];
+    shape[0] = 1;
+    for (int k = 0; k < n; ++k) {
+      Blob* dst = (*batch->requests[k]->outputs)[i];
+      dst->Reshape(shape);
+      caffe_copy(sample, output.cpu_data() + k * sample, dst->mutable_cpu_data<float>());
+    }
+  }
+  const Clock::time_point now = Clock::now();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Request* request : batch->requests) {
+      const float latency_us =
+          std::chrono::duration<float, std::micro>(now - request->arrival).count();
+      if (latencies_us_.size() < LATENCY_WINDOW) {
+        latencies_us_.push_back(latency_us);
+      } else {
+        latencies_us_[next_latency_] = latency_us;
+      }
+      next_latency_ = (next_latency_ + 1UL) % LATENCY_WINDOW;
+    }
+    requests_ += n;
+    ++batches_;
+  }
+  // Requests are gone once their callers wake up
+  for (Request* request : batch->requests) {
+    request->done.set_value();
+  }
+  batch->requests.clear();
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_batches_.push_back(batch);
+  --in_flight_;
+  idle_cv_.notify_all();
+}
+
+RequestBatcher::Stats RequestBatcher::stats() const {
+  Stats stats;
+  vector<float> latencies;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const double seconds = std::chrono::duration<double>(Clock::now() - start_).count();
+    stats.requests = requests_;
+    stats.batches = batches_;
+    stats.requests_per_second = seconds > 0. ? requests_ / seconds : 0.;
+    stats.mean_batch = batches_ > 0UL ? static_cast<double>(requests_) / batches_ : 0.;
+    latencies = latencies_us_;
+  }
+  stats.p50_latency_us = 0.;
+  stats.p99_latency_us = 0.;
+  if (!latencies.empty()) {
+    auto percentile = [&latencies](double p) {
+      const size_t k = std::min(latencies.size() - 1UL,
+          static_cast<size_t>(p * latencies.size()));
+      std::nth_element(latencies.begin(), latencies.begin() + k, latencies.end());
+      return static_cast<double>(latencies[k]);
+    };
+    stats.p50_latency_us = percentile(0.5);
+    stats.p99_latency_us = percentile(0.99);
+  }
+  return stats;
+}
+
+}  // namespace caffe
@@ -1,6 +1,10 @@
+#include <sys/stat.h>
+
+#include <algorithm>
 #include <cstdio>
 
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #include <boost/thread.hpp>
@@ -9,6 +13,7 @@
 #include "caffe/util/gpu_memory.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/thread_profile.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
@@ -29,7 +34,8 @@ Solver::Solver(const SolverParameter& param, size_t rank, const Solver* root_sol
     : param_(param), data_type_(param_.solver_data_type()), iter_(0), id_(0), net_(),
       callback_(nullptr), root_solver_(root_solver), rank_(rank), requested_early_exit_(false),
       iteration_timer_(make_shared<Timer>()), test_timer_(make_shared<Timer>()),
-      iterations_last_(0), iterations_restored_(0) {
+      iterations_last_(0), iterations_restored_(0), async_test_iter_(-1),
+      input_shape_step_(-1), grads_overflow_(false), loss_scale_clean_iters_(0) {
   Init();
 }
 
@@ -47,16 +53,70 @@ void Solver::Init() {
 
   CHECK_GE(param_.average_loss(), 1) << "average_loss should be non-negative.";
   CheckSnapshotWritePermissions();
+  snapshot_writer_.reset(new SnapshotWriter(param_.snapshot_async(), param_.snapshot_keep()));
+  if (param_.deterministic()) {
+    Caffe::set_deterministic(true);
+    if (param_.random_seed() < 0) {
+      param_.set_random_seed(static_cast<int64_t>(Caffe::DETERMINISTIC_SEED));
+      LOG_IF(INFO, Caffe::root_solver()) << "Deterministic run, random_seed set to "
+          << param_.random_seed();
+    }
+  }
   if (Caffe::root_solver()) {  // P2PSync does other solvers if they exist
     Caffe::set_root_seed(static_cast<uint64_t>(param_.random_seed()));
   }
   // Scaffolding code
   InitTrainNet();
   InitTestNets();
+  InitShards();
   LOG(INFO) << "Solver scaffolding done.";
   iter_ = 0;
   total_lapse_ = 0.F;
   current_step_ = 0;
+  sample_metrics_ = param_.metrics_interval() > 0 && Caffe::root_solver();
+  last_metrics_ = MetricsSample();
+  if (sample_metrics_ && (!param_.metrics_file().empty() || param_.metrics_port() > 0)) {
+    metrics_.reset(new MetricsExporter(param_.metrics_file(), param_.metrics_port()));
+  }
+}
+
+void Solver::InitShards() {
+  shard_owners_.clear();
+  if (!param_.shard_solver_state() || Caffe::solver_count() < 2) {
+    return;
+  }
+  CHECK_LE(param_.local_sgd_iters(), 1) << "shard_solver_state requires synchronous training";
+  CHECK_LT(param_.clip_gradients(), 0.F)
+      << "clip_gradients needs all gradients, they aren't reduced with shard_solver_state";
+  CHECK(!param_.dynamic_loss_scale())
+      << "dynamic_loss_scale needs all gradients, they aren't reduced with shard_solver_state";
+  // Largest first to the least loaded solver. Same on every solver.
+  const vector<shared_ptr<Blob>>& params = net_->learnable_params();
+  vector<int> order(params.size());
+  for (int i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&params](int a, int b) {
+    return params[a]->count() > params[b]->count();
+  });
+  vector<size_t> load(Caffe::solver_count(), 0UL);
+  shard_owners_.resize(params.size());
+  size_t total = 0UL;
+  for (int param_id : order) {
+    const int owner = std::min_element(load.begin(), load.end()) - load.begin();
+    shard_owners_[param_id] = owner;
+    load[owner] += params[param_id]->count();
+    total += params[param_id]->count();
+  }
+  LOG(INFO) << "Solver " << global_rank() << " owns the state of " << load[global_rank()]
+            << " of " << total << " learnable elements";
+}
+
+string Solver::ShardFilename(const string& filename) const {
+  if (!sharded() || global_rank() == 0) {
+    return filename;
+  }
+  return filename + ".shard" + caffe::format_int(global_rank());
 }
 
 void Solver::InitTrainNet() {
@@ -96,10 +156,31 @@ void Solver::InitTrainNet() {
   net_state.MergeFrom(net_param.state());
   net_state.MergeFrom(param_.train_state());
   net_param.mutable_state()->CopyFrom(net_state);
+  // SolverParameter::input_shape_schedule: the net is set up with the shapes of the first
+  // iteration, those of its parameter being the ones before the first step
+  for (int i = 1; i < param_.input_shape_schedule_size(); ++i) {
+    CHECK_GT(param_.input_shape_schedule(i).iter(), param_.input_shape_schedule(i - 1).iter())
+        << "input_shape_schedule steps must be in increasing iter order";
+  }
+  input_shape_step_ = input_shape_step(0);
+  if (input_shape_step_ >= 0) {
+    const InputShapeStep& step = param_.input_shape_schedule(input_shape_step_);
+    for (LayerParameter& layer : *net_param.mutable_layer()) {
+      if (layer.type() != "Data") {
+        continue;
+      }
+      if (step.batch_size() > 0U) {
+        layer.mutable_data_param()->set_batch_size(step.batch_size());
+      }
+      if (step.has_crop_size()) {
+        layer.mutable_transform_param()->set_crop_size(step.crop_size());
+      }
+    }
+  }
   if (Caffe::root_solver()) {
-    net_.reset(new Net(net_param, rank_, &init_flag_, &iter0_flag_));
+    net_.reset(new Net(net_param, global_rank(), &init_flag_, &iter0_flag_));
   } else {
-    net_.reset(new Net(net_param, rank_, &init_flag_, &iter0_flag_,
+    net_.reset(new Net(net_param, global_rank(), &init_flag_, &iter0_flag_,
         root_solver_->net_.get()));
   }
 }
@@ -160,6 +241,9 @@ void Solver::InitTestNets() {
     }
   }
   test_nets_.resize(num_test_net_instances);
+  // Nets sharing the trained weights from the start, unless they get copies of them
+  const Net* trained_net = param_.async_test() || param_.weights_ema_decay() > 0.F ?
+      nullptr : net_.get();
   for (int i = 0; i < num_test_net_instances; ++i) {
     // Set the correct NetState.  We start with the solver defaults (lowest
     // precedence); then, merge in any NetState specified by the net_param
@@ -175,13 +259,16 @@ void Solver::InitTestNets() {
     LOG(INFO)
         << "Creating test net (#" << i << ") specified by " << sources[i];
     if (Caffe::root_solver()) {
-      test_nets_[i].reset(new Net(net_params[i], rank_, &init_flag_, &iter0_flag_));
+      test_nets_[i].reset(new Net(net_params[i], global_rank(), &init_flag_, &iter0_flag_,
+          nullptr, trained_net));
     } else {
-      test_nets_[i].reset(new Net(net_params[i], rank_, &init_flag_, &iter0_flag_,
-          root_solver_->test_nets_[i].get()));
+      test_nets_[i].reset(new Net(net_params[i], global_rank(), &init_flag_, &iter0_flag_,
+          root_solver_->test_nets_[i].get(), trained_net));
     }
     test_nets_[i]->set_debug_info(param_.debug_info());
   }
+  // They run one after another
+  Net::ShareActivationArena(test_nets_);
 }
 
 void Solver::Step(int iters) {
@@ -193,6 +280,13 @@ void Solver::Step(int iters) {
   const Caffe::Brew mode = Caffe::mode();
   const int solver_count = Caffe::solver_count();
   const bool root_solver = this->is_root();
+  const bool device_loss = this->device_loss();
+#ifndef CPU_ONLY
+  if (device_loss) {
+    loss_ring_.reserve((average_loss + 1) * sizeof(float));
+    loss_slot_iter_ = -1;
+  }
+#endif
 
   net_->set_solver(this);
 
@@ -214,9 +308,9 @@ void Solver::Step(int iters) {
     // called in on_start.
     callback_soft_barrier();
     {
-      unique_ptr<unique_lock<shared_mutex>> lock;
+      unique_ptr<GPUMemory::CollectiveScope> collective;
       if (root_solver) {
-        lock.reset(new unique_lock<shared_mutex>(GPUMemory::read_write_mutex()));
+        collective.reset(new GPUMemory::CollectiveScope);
       }
       callback_soft_barrier();
       callback_->on_start(net_->learnable_params_mapped());
@@ -244,19 +338,32 @@ void Solver::Step(int iters) {
   }
 #endif
 
+  if (sample_metrics_) {
+    ResetMetricsWindow();
+  }
+  // SolverParameter::overlap_next_forward
+  const bool forward_ahead = net_->forward_ahead();
   while (iter_ < stop_iter) {
-    if (param_.snapshot_diff()) {
+    if (param_.snapshot_diff() && !net_->all_param_diffs_overwritten()) {
       net_->ClearParamDiffs();
     }  // we clean them in ApplyUpdate otherwise
 
     // Just started or restored?
     const bool first_loop = iter_ == 0 || iterations_last_ < 0;
+    bool tested = false;
     if (iter_ == 0) {
       if (TestAll(1, use_multi_gpu_testing)) {
         break;
       }
       callback_soft_barrier();
       LOG_IF(INFO, Caffe::root_solver()) << mgpu_str << "Initial Test completed";
+    } else if (param_.test_interval()
+        && iter_ % param_.test_interval() == 0
+        && iterations_last_ >= 0
+        && param_.async_test()) {
+      if (Caffe::root_solver()) {
+        TestAllAsync();
+      }
     } else if (param_.test_interval()
         && iter_ % param_.test_interval() == 0
         && iterations_last_ >= 0) {
@@ -268,11 +375,18 @@ void Solver::Step(int iters) {
       float lapse = iteration_timer_->Seconds();
       LOG_IF(INFO, Caffe::root_solver()) << mgpu_str << "Tests completed in "
                                          << lapse << "s";
+      tested = true;
     }
     if (requested_early_exit_) {
       // Break out of the while loop because stop was requested while testing.
       break;
     }
+#ifndef CPU_ONLY
+    if (param_.gpu_mem_defrag_interval() > 0 && !param_.async_test() && !first_loop &&
+        mode == Caffe::GPU && (tested || iter_ % param_.gpu_mem_defrag_interval() == 0)) {
+      Defragment();
+    }
+#endif
 
     const bool display = this->display();
     net_->set_debug_info(display && param_.debug_info());
@@ -286,6 +400,11 @@ void Solver::Step(int iters) {
     if (rel_iter == 0) {
       iteration_timer_->Start();
     }
+    UpdateSchedule();
+    UpdateInputShape();
+    if (device_loss && loss_slot_iter_ != iter_) {  // unless selected for ForwardAhead
+      SelectLossSlot(start_iter, iter_);
+    }
 
 #ifndef CPU_ONLY
     for (int type_id = 0; type_id < ltypes.size(); ++type_id) {
@@ -294,18 +413,37 @@ void Solver::Step(int iters) {
 #else
     iteration_start_signal(0);
 #endif
-    for (int i = 0; i < param_.iter_size(); ++i) {
+    if (net_->pipeline_stages() > 1 && !first_loop) {
+      // iter_size micro-batches flow through the stages, see NetParameter::pipeline_device.
+      // The first iteration runs them one by one like below: data layers wait for it to
+      // finish before they prefetch more than one batch.
+      loss += net_->ForwardBackwardPipelined(param_.iter_size());
+    } else {
+      for (int i = 0; i < param_.iter_size(); ++i) {
 
-      loss += net_->ForwardBackward(i + 1 == param_.iter_size());
+        loss += net_->ForwardBackward(i + 1 == param_.iter_size(), i == 0);
 
-      if (i == 0) {
-        if (first_loop) {
-          iter0_flag_.set();
-          net_->wait_layers_init();
+        if (i == 0) {
+          if (first_loop) {
+            iter0_flag_.set();
+            net_->wait_layers_init();
+          }
         }
       }
     }
     loss /= param_.iter_size();
+    // Train net outputs are shown below, they must stay this iteration's
+    const bool show_outputs = this->param_display() &&
+        (display || rel_iter <= 2 || iter_ + 1 >= stop_iter);
+    const bool pretune = first_loop && param_.input_shape_pretune() &&
+        param_.input_shape_schedule_size() > 0 && iter_ + 1 < stop_iter;
+    if (forward_ahead && !show_outputs && !pretune && iter_ + 1 < stop_iter &&
+        !requested_early_exit_) {
+      if (device_loss) {
+        SelectLossSlot(start_iter, iter_ + 1);
+      }
+      net_->ForwardAhead();
+    }
 #ifndef CPU_ONLY
     for (int type_id = 0; type_id < ltypes.size(); ++type_id) {
       iteration_wait(type_id);
@@ -319,9 +457,25 @@ void Solver::Step(int iters) {
       break;
     }
 
+    UpdateLossScale();
+    if (pretune) {
+      PretuneInputShapes();
+    }
+    const bool record_metrics = sample_metrics_ && (iter_ + 1) % param_.metrics_interval() == 0;
     // average the loss across iterations for smoothed reporting
-    UpdateSmoothedLoss(loss, start_iter, average_loss);
-    if (this->param_display() && (display || rel_iter <= 2 || iter_ + 1 >= stop_iter)) {
+    if (!device_loss) {
+      UpdateSmoothedLoss(loss, start_iter, average_loss);
+    } else if (show_outputs || record_metrics) {
+      ReadLosses(start_iter, iter_);
+    }
+    if (record_metrics) {
+      RecordMetrics();
+    }
+    if (param_.thread_profile_interval() > 0 && Caffe::root_solver() &&
+        (iter_ + 1) % param_.thread_profile_interval() == 0) {
+      LOG(INFO) << ThreadProfile::Summary();
+    }
+    if (show_outputs) {
       float lapse = iteration_timer_->Seconds();
       iteration_timer_->Start();
       if (rel_iter > 2) {  // we skip 0,1,2 for correct benchmarking
@@ -335,6 +489,10 @@ void Solver::Step(int iters) {
         LOG_IF(INFO, Caffe::root_solver()) << "Iteration " << iter_
                                            << " (" << lapse << " s), loss = " << smoothed_loss_;
       }
+      if (param_.debug_info()) {
+        LOG_IF(INFO, Caffe::root_solver()) << Tensor::conversion_report();
+        Tensor::reset_conversion_stats();
+      }
       const vector<Blob*>& result = net_->output_blobs();
       int score_index = 0;
       for (int j = 0; j < result.size(); ++j) {
@@ -365,21 +523,163 @@ void Solver::Step(int iters) {
     // Save a snapshot if needed.
     if ((param_.snapshot()
          && iter_ % param_.snapshot() == 0
-         && Caffe::root_solver()) ||
+         && (Caffe::root_solver() || sharded() || snapshot_sharded())) ||
          (request == SolverAction::SNAPSHOT)) {
       Snapshot();
     }
-    if (SolverAction::STOP == request) {
+    bool stop = SolverAction::STOP == request;
+    if (Caffe::node_count() > 1 && Caffe::root_solver() && callback_ != nullptr) {
+      // All nodes stop at the same iteration, otherwise the rest would hang in reduction
+      stop = callback_->any_node_stop(stop);
+    }
+    if (stop) {
       requested_early_exit_ = true;
       total_lapse_ += iteration_timer_->Seconds();
       // Break out of training loop.
       break;
     }
   }
+  if (device_loss) {
+    // Solve displays the loss of one more forward smoothed with these
+    ReadLosses(start_iter, iter_ - 1);
+    net_->set_loss_slot(nullptr);
+  }
   Finalize();
 }
 
+int Solver::input_shape_step(int iter) const {
+  int step = -1;
+  while (step + 1 < param_.input_shape_schedule_size() &&
+         param_.input_shape_schedule(step + 1).iter() <= iter) {
+    ++step;
+  }
+  return step;
+}
+
+#ifndef CPU_ONLY
+void Solver::Defragment() {
+  Timer timer;
+  timer.Start();
+  const int device = Caffe::current_device();
+  GPUMemory::BeginDefragment(device);
+  std::unordered_set<const Tensor*> visited;
+  size_t moved = net_->RelocateBlobs(&visited);
+  for (const shared_ptr<Net>& test_net : test_nets_) {
+    moved += test_net->RelocateBlobs(&visited);
+  }
+  const size_t released = GPUMemory::EndDefragment(device);
+  LOG_IF(INFO, Caffe::root_solver()) << "Iteration " << iter_ << ", device memory "
+      << "defragmented in " << timer.MilliSeconds() << " ms: " << moved << " bytes moved, "
+      << released << " bytes given back";
+}
+#endif
+
+void Solver::UpdateInputShape() {
+  const int step = input_shape_step(iter_);
+  if (step != input_shape_step_) {
+    LOG_IF(INFO, Caffe::root_solver()) << "Iteration " << iter_ << ", input shape step "
+        << step;
+    SetInputShape(step);
+  }
+}
+
+void Solver::SetInputShape(int step) {
+  int batch_size = -1, crop_size = -1;
+  if (step >= 0) {
+    const InputShapeStep& s = param_.input_shape_schedule(step);
+    batch_size = s.batch_size() > 0U ? s.batch_size() : -1;
+    crop_size = s.has_crop_size() ? s.crop_size() : -1;
+  }
+  LOG_IF(WARNING, !net_->SetInputShape(batch_size, crop_size) && Caffe::root_solver())
+      << "input_shape_schedule: no Data layer in the train net takes new shapes";
+  input_shape_step_ = step;
+}
+
+// The last step first: blocks of the largest shapes stay in the memory pool for the rest.
+// Backward passes don't update, diffs and the params conversions touch are put back.
+void Solver::PretuneInputShapes() {
+  // cuDNN convolutions seek their algorithms in the second pass at a new shape
+  static constexpr int PASSES = 3;
+  const int current = input_shape_step_;
+  const int steps = param_.input_shape_schedule_size();
+  Timer timer;
+  timer.Start();
+  LOG_IF(INFO, Caffe::root_solver()) << "Pre-tuning " << steps << " input shape steps";
+  const vector<shared_ptr<Blob>>& params = net_->params();
+  vector<shared_ptr<Blob>> saved(params.size());
+  for (size_t i = 0; i < params.size(); ++i) {
+    saved[i] = Blob::create(params[i]->data_type(), params[i]->data_type());
+    saved[i]->CopyDataFrom(*params[i], true);
+  }
+#ifndef CPU_ONLY
+  // Losses of these passes are nobody's
+  net_->set_loss_slot(nullptr);
+  loss_slot_iter_ = -1;
+#endif
+  for (int step = steps - 1; step >= 0; --step) {
+    SetInputShape(step);
+    for (int pass = 0; pass < PASSES; ++pass) {
+      net_->ForwardBackward(false, true);
+    }
+  }
+  SetInputShape(current);
+  net_->ClearParamDiffs();
+  for (size_t i = 0; i < params.size(); ++i) {
+    params[i]->CopyDataFrom(*saved[i]);
+  }
+  LOG_IF(INFO, Caffe::root_solver()) << "Input shapes pre-tuned in " << timer.Seconds()
+      << " s";
+}
+
+void Solver::ResetMetricsWindow() {
+  metrics_timing_ = net_->timing();
+  metrics_iter_ = iter_;
+  metrics_timer_.Start();
+}
+
+// Counters are host side only, nothing here waits for the device
+void Solver::RecordMetrics() {
+  const Net::Timing timing = net_->timing();
+  const Net::Timing& last = metrics_timing_;
+  // Updates of iter_ are complete
+  const int iters = std::max(iter_ + 1 - metrics_iter_, 1);
+  const double reduce_s = 1.e-6 * (timing.reduce_us - last.reduce_us);
+  const double reduce_bytes = static_cast<double>(timing.reduce_bytes - last.reduce_bytes);
+  MetricsSample sample;
+  sample.iter = iter_ + 1;
+  sample.device = Caffe::mode() == Caffe::GPU ? Caffe::current_device() : -1;
+  sample.iteration_s = metrics_timer_.Seconds() / iters;
+  sample.forward_s = 1.e-6 * (timing.forward_us - last.forward_us) / iters;
+  sample.backward_s = 1.e-6 * (timing.backward_us - last.backward_us) / iters;
+  sample.reduce_s = reduce_s / iters;
+  sample.data_wait_s = 1.e-6 * (timing.data_wait_us - last.data_wait_us) / iters;
+  sample.allreduce_bytes = reduce_bytes / iters;
+  sample.allreduce_bytes_per_s = reduce_s > 0. ? reduce_bytes / reduce_s : 0.;
+  const LayerCost cost = net_->cost();
+  sample.forward_tflops = sample.forward_s > 0. ?
+      1.e-12 * cost.forward_flops / sample.forward_s : 0.;
+  sample.backward_tflops = sample.backward_s > 0. ?
+      1.e-12 * cost.backward_flops / sample.backward_s : 0.;
+  sample.gpu_mem_in_use = sample.gpu_mem_peak = 0UL;
+#ifndef CPU_ONLY
+  if (Caffe::mode() == Caffe::GPU) {
+    GPUMemory::GetUsage(&sample.gpu_mem_in_use, &sample.gpu_mem_peak);
+  }
+#endif
+  sample.learning_rate = learning_rate();
+  sample.loss = smoothed_loss_;
+  last_metrics_ = sample;
+  if (metrics_) {
+    metrics_->Record(sample);
+  }
+  metrics_timing_ = timing;
+  metrics_iter_ = iter_ + 1;
+  metrics_timer_.Start();
+}
+
 void Solver::Finalize() {
+  WaitAsyncTest();
+  snapshot_writer_->Wait();
   net_->Finalize();
   if (reduce_thread0_) {
     reduce_thread0_->join();
@@ -404,9 +704,24 @@ void Solver::Reduce(Callback* callback, int device, Caffe::Brew mode, uint64_t r
   Caffe::set_random_seed(random_seed);
   Caffe::set_solver_count(solver_count);
   Caffe::set_root_solver(root_solver);
+  ThreadProfile profile("reduce " + std::to_string(type_id) + " device " +
+      std::to_string(device));
+  profile.attach();
+  // Anything but reductions and waits is spent on updates
+  ThreadProfile::Scope update(ThreadProfile::UPDATE);
   net_->ReduceAndUpdate(type_id);
 }
 
+void Solver::ApplyUpdates(const vector<int>& param_ids, void* handle, bool clear_grads,
+    float grad_scale) {
+  for (int param_id : param_ids) {
+    if (grad_scale != 1.F) {
+      net_->learnable_params()[param_id]->scale_diff(grad_scale, handle);
+    }
+    ApplyUpdate(param_id, handle, clear_grads);
+  }
+}
+
 bool Solver::Solve(const char* resume_file) {
   LOG(INFO) << "Solving " << net_->name();
   LOG(INFO) << "Learning Rate Policy: " << param_.lr_policy();
@@ -432,10 +747,11 @@ bool Solver::Solve(const char* resume_file) {
   // overridden by setting snapshot_after_train := false
   if (param_.snapshot_after_train()
       && (!param_.snapshot() || iter_ % param_.snapshot() != 0)) {
-    if (Caffe::root_solver()) {
+    if (Caffe::root_solver() || snapshot_sharded()) {
       Snapshot();
     }
   }
+  snapshot_writer_->Wait();
   Caffe::set_restored_iter(-1);
   iterations_restored_ = 0;
   iterations_last_ = 0;
@@ -478,11 +794,58 @@ bool Solver::TestAll(const int iters, bool use_multi_gpu) {
   return false;
 }
 
+void Solver::TestAllAsync() {
+  WaitAsyncTest();
+  // The trained net is idle between iterations
+  const vector<Blob*> ema = weights_ema();
+  for (const shared_ptr<Net>& test_net : test_nets_) {
+    test_net->ShareTrainedLayersWith(net_.get(), true, ema.empty() ? nullptr : &ema);
+  }
+  async_test_iter_ = iter_;
+  test_thread_.reset(new boost::thread(&Solver::AsyncTestEntry, this,
+      Caffe::current_device(), Caffe::mode()));
+}
+
+void Solver::WaitAsyncTest() {
+  if (test_thread_) {
+    test_thread_->join();
+    test_thread_.reset();
+    async_test_iter_ = -1;
+  }
+}
+
+void Solver::AsyncTestEntry(int device, Caffe::Brew mode) {
+#ifndef CPU_ONLY
+  if (mode == Caffe::GPU) {
+    CUDA_CHECK(cudaSetDevice(device));
+    // Convolutions run alongside the training ones
+    GPUMemory::own_thread_workspace();
+  }
+#endif
+  // Own Caffe context, thus own stream and handles. Scores are those of this solver only.
+  Caffe::set_mode(mode);
+  Caffe::set_root_solver(true);
+  Caffe::set_solver_count(1);
+  for (int test_net_id = 0; test_net_id < test_nets_.size(); ++test_net_id) {
+    Test(test_net_id);
+  }
+}
+
 bool Solver::Test(const int test_net_id, const int iters, bool use_multi_gpu) {
-  LOG_IF(INFO, Caffe::root_solver()) << "Iteration " << iter_
-            << ", Testing net (#" << test_net_id << ")";
-  if (!test_nets_[test_net_id]->trained_layers_shared()) {
+  const bool async = async_test_iter_ >= 0;
+  LOG_IF(INFO, Caffe::root_solver()) << "Iteration " << (async ? async_test_iter_ : iter_)
+            << ", Testing net (#" << test_net_id << ")" << (async ? " asynchronously" : "");
+  const vector<Blob*> ema = async ? vector<Blob*>() : weights_ema();
+  if (param_.async_test() || !ema.empty()) {
+    if (!async) {  // TestAllAsync copies them otherwise
+      CHECK_NOTNULL(test_nets_[test_net_id].get())->ShareTrainedLayersWith(net_.get(), true,
+          ema.empty() ? nullptr : &ema);
+    }
+  } else if (!test_nets_[test_net_id]->trained_layers_shared()) {
     CHECK_NOTNULL(test_nets_[test_net_id].get())->ShareTrainedLayersWith(net_.get());
+  } else {
+    // Trained since the last test
+    test_nets_[test_net_id]->WeightsChanged();
   }
   vector<float> test_score;
   vector<int> test_score_output_id;
@@ -490,9 +853,27 @@ bool Solver::Test(const int test_net_id, const int iters, bool use_multi_gpu) {
   test_net->set_solver(this);
   float loss = 0.F;
   const int test_iterations = iters > 0 ? iters : param_.test_iter(test_net_id);
+  // SolverParameter::device_loss: the loss, then every output's elements, summed up on the
+  // device and read at the end
+  bool device_sums = false;
+#ifndef CPU_ONLY
+  unique_ptr<GPUMemory::Workspace> sums;
+  if (param_.device_loss() && Caffe::mode() == Caffe::GPU && test_net->pipeline_stages() == 1) {
+    device_sums = true;
+    const vector<Blob*>& outputs = test_net->output_blobs();
+    for (int j = 0; j < outputs.size(); ++j) {
+      test_score.resize(test_score.size() + outputs[j]->count(), 0.F);
+      test_score_output_id.resize(test_score.size(), j);
+    }
+    sums.reset(new GPUMemory::Workspace((test_score.size() + 1UL) * sizeof(float)));
+    CUDA_CHECK(cudaMemsetAsync(sums->data(), 0, sums->size(), Caffe::thread_stream()));
+    test_net->set_loss_slot(static_cast<float*>(sums->data()));
+  }
+#endif
   for (int i = 0; i < test_iterations; ++i) {
-    SolverAction::Enum request = GetRequestedAction();
     // Check to see if stoppage of testing/training has been requested.
+    // Left to the training loop when testing asynchronously.
+    SolverAction::Enum request = async ? SolverAction::NONE : GetRequestedAction();
     while (request != SolverAction::NONE) {
         if (SolverAction::SNAPSHOT == request) {
           Snapshot();
@@ -503,6 +884,7 @@ bool Solver::Test(const int test_net_id, const int iters, bool use_multi_gpu) {
     }
     if (requested_early_exit_) {
       LOG(INFO) << "Test interrupted.";
+      test_net->set_loss_slot(nullptr);
       Finalize();
       return true;
     }
@@ -512,6 +894,17 @@ bool Solver::Test(const int test_net_id, const int iters, bool use_multi_gpu) {
     if (param_.test_compute_loss()) {
       loss += iter_loss;
     }
+#ifndef CPU_ONLY
+    if (device_sums) {
+      float* scores = static_cast<float*>(sums->data()) + 1;
+      for (Blob* blob : result) {
+        caffe_gpu_add_to(blob->data_type(), blob->count(), blob->current_data_memory(true),
+            scores, Caffe::thread_stream());
+        scores += blob->count();
+      }
+      continue;
+    }
+#endif
     if (i == 0) {
       for (int j = 0; j < result.size(); ++j) {
         for (int k = 0; k < result[j]->count(); ++k) {
@@ -529,28 +922,37 @@ bool Solver::Test(const int test_net_id, const int iters, bool use_multi_gpu) {
     }
   }
 
-  if (use_multi_gpu) {
-    callback_soft_barrier();
-    // now we've done, transfer results
-    for (int i = 0; i < root_callbacks_.size(); ++i) {
-      root_callbacks_[i]->saveTestResults(loss, test_score);
-    }
-    callback_soft_barrier();
-    float global_loss = 0.F;
-    vector<float> global_scores(test_score.size());
-    // aggregate test results from all solvers
-    for (int i = 0; i < root_callbacks_.size(); ++i) {
-      root_callbacks_[i]->aggregateTestResults(&global_loss, &global_scores);
+#ifndef CPU_ONLY
+  if (device_sums || use_multi_gpu) {
+    test_net->set_loss_slot(nullptr);
+    vector<float> host_sums(test_score.size() + 1UL);
+    cudaStream_t stream = Caffe::thread_stream();
+    if (use_multi_gpu) {
+      if (!device_sums) {
+        // Summed up on the host this time, they go to the device for the allreduce
+        host_sums[0] = loss;
+        std::copy(test_score.begin(), test_score.end(), host_sums.begin() + 1);
+        sums.reset(new GPUMemory::Workspace(host_sums.size() * sizeof(float)));
+        CUDA_CHECK(cudaMemcpyAsync(sums->data(), host_sums.data(), sums->size(),
+            cudaMemcpyHostToDevice, stream));
+      }
+      // Loss and every score of every solver of every node in one collective
+      callback_->allreduce_stats(sums->data(), host_sums.size(), tp<float>(), stream);
     }
-    callback_soft_barrier();
-    loss = global_loss;
-    for (int i = 0; i < test_score.size(); ++i) {
-      test_score[i] = global_scores[i];
+    CUDA_CHECK(cudaMemcpyAsync(host_sums.data(), sums->data(), sums->size(),
+        cudaMemcpyDeviceToHost, stream));
+    CUDA_CHECK(cudaStreamSynchronize(stream));
+    if (param_.test_compute_loss()) {
+      loss = host_sums[0];
     }
+    std::copy(host_sums.begin() + 1, host_sums.end(), test_score.begin());
   }
+#else
+  CHECK(!use_multi_gpu) << "Multi-GPU testing is not available in CPU_ONLY build";
+#endif
 
   if (param_.test_compute_loss()) {
-    loss /= param_.test_iter(test_net_id);
+    loss /= param_.test_iter(test_net_id) * Caffe::solver_count();
     LOG(INFO) << "Test loss: " << loss;
   }
   for (int i = 0; i < test_score.size(); ++i) {
@@ -571,7 +973,24 @@ bool Solver::Test(const int test_net_id, const int iters, bool use_multi_gpu) {
 }
 
 void Solver::Snapshot() {
-  CHECK(Caffe::root_solver());
+  CHECK(Caffe::root_solver() || sharded() || snapshot_sharded());
+  // One snapshot's copies at a time
+  snapshot_writer_->Wait();
+  if (snapshot_sharded()) {
+    // Every solver writes its part of the weights too
+    PublishMasterWeights();
+    SnapshotSolverState(string());
+    snapshot_writer_->Commit();
+    return;
+  }
+  if (!Caffe::root_solver() || !Caffe::root_node()) {
+    if (sharded()) {
+      SnapshotSolverState(string());  // own shard only, weights are the same everywhere
+      snapshot_writer_->Commit();
+    }
+    return;
+  }
+  PublishMasterWeights();
   string model_filename;
   switch (param_.snapshot_format()) {
   case caffe::SolverParameter_SnapshotFormat_BINARYPROTO:
@@ -583,7 +1002,12 @@ void Solver::Snapshot() {
   default:
     LOG(FATAL) << "Unsupported snapshot format.";
   }
+  const vector<Blob*> ema = weights_ema();
+  if (!ema.empty()) {
+    SnapshotWeightsEma(ema);
+  }
   SnapshotSolverState(model_filename);
+  snapshot_writer_->Commit();
 }
 
 void Solver::CheckSnapshotWritePermissions() {
@@ -607,33 +1031,127 @@ string Solver::SnapshotFilename(const string extension) {
   return param_.snapshot_prefix() + "_iter_" + caffe::format_int(iter_) + extension;
 }
 
-string Solver::SnapshotToBinaryProto() {
-  string model_filename = SnapshotFilename(".caffemodel");
+string Solver::SnapshotToBinaryProto(const string& tag) {
+  string model_filename = SnapshotFilename(tag + ".caffemodel");
   LOG(INFO) << "Snapshotting to binary proto file " << model_filename;
-  NetParameter net_param;
-  net_->ToProto(&net_param, param_.snapshot_diff());
-  WriteProtoToBinaryFile(net_param, model_filename);
+  shared_ptr<NetParameter> net_param = make_shared<NetParameter>();
+  net_->ToProto(net_param.get(), param_.snapshot_diff());
+  snapshot_writer_->Write(model_filename, [net_param](const string& path) {
+    WriteProtoToBinaryFile(*net_param, path);
+  });
   return model_filename;
 }
 
-string Solver::SnapshotToHDF5() {
-  string model_filename = SnapshotFilename(".caffemodel.h5");
+string Solver::SnapshotToHDF5(const string& tag) {
+  string model_filename = SnapshotFilename(tag + ".caffemodel.h5");
   LOG(INFO) << "Snapshotting to HDF5 file " << model_filename;
-  net_->ToHDF5(model_filename, param_.snapshot_diff());
+  const bool write_diff = param_.snapshot_diff();
+  vector<shared_ptr<Blob>> params = net_->params();
+  if (snapshot_writer_->async()) {
+    for (shared_ptr<Blob>& param : params) {
+      param = SnapshotWriter::HostCopy(*param, write_diff);
+    }
+  }
+  shared_ptr<Net> net = net_;
+  snapshot_writer_->Write(model_filename, [net, write_diff, params](const string& path) {
+    net->ToHDF5(path, write_diff, params);
+  });
   return model_filename;
 }
 
+void Solver::SnapshotWeightsEma(const vector<Blob*>& ema) {
+  // Owners only, layers sharing them share their data
+  const vector<shared_ptr<Blob>>& params = net_->learnable_params();
+  vector<shared_ptr<Blob>> weights(params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    if (ema[i] == params[i].get()) {
+      continue;
+    }
+    weights[i] = Blob::create(params[i]->data_type(), params[i]->data_type());
+    weights[i]->CopyDataFrom(*params[i], true);
+    params[i]->CopyDataFrom(*ema[i]);
+  }
+  // Serialized or copied to the host before these return
+  if (param_.snapshot_format() == caffe::SolverParameter_SnapshotFormat_HDF5) {
+    SnapshotToHDF5(".ema");
+  } else {
+    SnapshotToBinaryProto(".ema");
+  }
+  for (int i = 0; i < params.size(); ++i) {
+    if (weights[i]) {
+      params[i]->CopyDataFrom(*weights[i]);
+    }
+  }
+}
+
+bool Solver::snapshot_sharded() const {
+  return param_.snapshot_format() == caffe::SolverParameter_SnapshotFormat_SHARDED;
+}
+
+bool Solver::IsShardedSnapshot(const string& path) {
+  struct stat st;
+  return stat((path + "/manifest").c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
 void Solver::Restore(const char* state_file) {
-  CHECK(Caffe::root_solver());
+  restored_state_file_ = state_file;
   string state_filename(state_file);
+  // Whatever the snapshot_format, every solver reads what it needs from the shards
+  if (IsShardedSnapshot(state_filename)) {
+    RestoreSolverStateFromShards(state_filename);
+    return;
+  }
+  CHECK(Caffe::root_solver() || sharded());
   if (state_filename.size() >= 3 &&
       state_filename.compare(state_filename.size() - 3, 3, ".h5") == 0) {
-    RestoreSolverStateFromHDF5(state_filename);
+    RestoreSolverStateFromHDF5(ShardFilename(state_filename));
   } else {
-    RestoreSolverStateFromBinaryProto(state_filename);
+    RestoreSolverStateFromBinaryProto(ShardFilename(state_filename));
   }
 }
 
+bool Solver::device_loss() const {
+#ifndef CPU_ONLY
+  return param_.device_loss() && Caffe::mode() == Caffe::GPU && net_->pipeline_stages() == 1;
+#else
+  return false;
+#endif
+}
+
+void Solver::SelectLossSlot(int start_iter, int iter) {
+#ifndef CPU_ONLY
+  float* slot = static_cast<float*>(loss_ring_.data()) +
+      (iter - start_iter) % (param_.average_loss() + 1);
+  CUDA_CHECK(cudaMemsetAsync(slot, 0, sizeof(float), Caffe::thread_stream()));
+  net_->set_loss_slot(slot);
+  loss_slot_iter_ = iter;
+#endif
+}
+
+// Same losses_ and smoothed_loss_ as UpdateSmoothedLoss would have, up to rounding
+void Solver::ReadLosses(int start_iter, int last_iter) {
+#ifndef CPU_ONLY
+  const int average_loss = param_.average_loss();
+  const int seen = std::min(last_iter - start_iter + 1, average_loss);
+  if (seen <= 0) {
+    return;
+  }
+  vector<float> ring(average_loss + 1);
+  cudaStream_t stream = Caffe::thread_stream();
+  CUDA_CHECK(cudaMemcpyAsync(ring.data(), loss_ring_.data(), ring.size() * sizeof(float),
+      cudaMemcpyDeviceToHost, stream));
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+  losses_.assign(seen, 0.F);
+  smoothed_loss_ = 0.F;
+  for (int iter = last_iter - seen + 1; iter <= last_iter; ++iter) {
+    const float loss = ring[(iter - start_iter) % (average_loss + 1)] / param_.iter_size();
+    losses_[(iter - start_iter) % average_loss] = loss;
+    smoothed_loss_ += loss;
+  }
+  smoothed_loss_ /= seen;
+#endif
+}
+
 void Solver::UpdateSmoothedLoss(float loss, int start_iter,
     int average_loss) {
   if (losses_.size() < average_loss) {
@@ -647,6 +1165,25 @@ void Solver::UpdateSmoothedLoss(float loss, int start_iter,
   }
 }
 
+void Solver::UpdateLossScale() {
+  if (!param_.dynamic_loss_scale()) {
+    return;
+  }
+  const float scale = net_->global_grad_scale();
+  if (grads_overflow_.exchange(false)) {
+    loss_scale_clean_iters_ = 0;
+    const float lowered = std::max(param_.min_loss_scale(), scale / param_.loss_scale_factor());
+    net_->set_global_grad_scale(lowered);
+    LOG_IF(INFO, Caffe::root_solver()) << "Iteration " << iter_
+        << ": gradient overflow, update skipped, loss scale " << scale << " -> " << lowered;
+  } else if (++loss_scale_clean_iters_ >= param_.loss_scale_window()) {
+    loss_scale_clean_iters_ = 0;
+    net_->set_global_grad_scale(scale * param_.loss_scale_factor());
+    DLOG_IF(INFO, Caffe::root_solver()) << "Iteration " << iter_ << ": loss scale "
+        << scale << " -> " << net_->global_grad_scale();
+  }
+}
+
 float Solver::perf_report(std::ostream& os, int device, int align) const {
   std::string al(align, ' ');
   float perf_ratio = total_lapse() > 0. ?
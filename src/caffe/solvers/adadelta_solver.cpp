@@ -13,15 +13,38 @@ void AdaDeltaSolver<Dtype>::AdaDeltaPreSolve() {
   for (int i = 0; i < net_params.size(); ++i) {
     this->history_.emplace_back(boost::make_shared<TBlob<Dtype>>(net_params[i]->shape()));
   }
+  this->HalfHistoryPreSolve();
 }
 
 #ifndef CPU_ONLY
-template<typename Gtype, typename Wtype>
+template<typename Gtype, typename Wtype, typename Htype>
 void
 adadelta_reg_update_and_clear_gpu(int N,
-    Gtype* g, Wtype* w, Wtype* h, Wtype* h2,
+    Gtype* g, Wtype* w, Htype* h, Htype* h2,
     float momentum, float delta, float local_rate, const std::string& regularization_type,
     float local_decay, void* handle, bool clear_grads);
+
+namespace {
+
+// h and h2 are FLOAT16 blobs with history_data_type, Wtype ones otherwise
+template<typename Gtype, typename Wtype>
+void adadelta_update_gpu(Blob* param, Blob* h, Blob* h2,
+    float momentum, float delta, float local_rate, const std::string& regularization_type,
+    float local_decay, void* handle, bool clear_grads) {
+  if (h->data_type() == tp<Wtype>()) {
+    adadelta_reg_update_and_clear_gpu(param->count(),
+        param->mutable_gpu_diff<Gtype>(), param->mutable_gpu_data<Wtype>(),
+        h->mutable_gpu_data<Wtype>(), h2->mutable_gpu_data<Wtype>(),
+        momentum, delta, local_rate, regularization_type, local_decay, handle, clear_grads);
+  } else {
+    adadelta_reg_update_and_clear_gpu(param->count(),
+        param->mutable_gpu_diff<Gtype>(), param->mutable_gpu_data<Wtype>(),
+        h->mutable_gpu_data<float16>(), h2->mutable_gpu_data<float16>(),
+        momentum, delta, local_rate, regularization_type, local_decay, handle, clear_grads);
+  }
+}
+
+}  // namespace
 #endif
 
 template <typename Dtype>
@@ -29,15 +52,16 @@ void AdaDeltaSolver<Dtype>::ComputeUpdateValue(int param_id, void* handle, float
     bool clear_grads) {
   const vector<shared_ptr<Blob>>& net_params = this->net_->learnable_params();
   shared_ptr<Blob> param = net_params[param_id];
-  shared_ptr<TBlob<Dtype>> history = this->history_[param_id];
-  shared_ptr<TBlob<Dtype>> update = this->update_[param_id];
-  shared_ptr<TBlob<Dtype>> temp = this->temp_[param_id];
   const vector<float>& net_params_lr = this->net_->params_lr();
   float delta =  std::max(this->param_.delta(), 0.001F);
   float momentum = this->param_.momentum();
   float local_rate = rate * net_params_lr[param_id];
   size_t update_history_offset = net_params.size();
   if (Caffe::mode() == Caffe::CPU) {
+    shared_ptr<TBlob<Dtype>> history = this->history_[param_id];
+    shared_ptr<TBlob<Dtype>> update = this->update_[param_id];
+    shared_ptr<TBlob<Dtype>> temp = this->temp_[param_id];
+
     // compute square of gradient in update
     caffe_powx<Dtype>(param->count(), param->cpu_diff<Dtype>(), Dtype(2.F),
         update->mutable_cpu_data());
@@ -86,27 +110,17 @@ void AdaDeltaSolver<Dtype>::ComputeUpdateValue(int param_id, void* handle, float
 #ifndef CPU_ONLY
     const std::string& regularization_type = this->param_.regularization_type();
     const float decay = this->local_decay(param_id);
+    Blob* h = this->history_blob(param_id);
+    Blob* h2 = this->history_blob(update_history_offset + param_id);
     const Type gtype = param->diff_type();
     if (gtype == tp<float16>()) {
-      adadelta_reg_update_and_clear_gpu<float16, Dtype>(param->count(),
-          param->mutable_gpu_diff<float16>(),
-          param->mutable_gpu_data<Dtype>(),
-          history->mutable_gpu_data(),
-          this->history_[update_history_offset + param_id]->mutable_gpu_data(),
+      adadelta_update_gpu<float16, Dtype>(param.get(), h, h2,
           momentum, delta, local_rate, regularization_type, decay, handle, clear_grads);
     } else if (gtype == tp<float>()) {
-      adadelta_reg_update_and_clear_gpu<float, Dtype>(param->count(),
-          param->mutable_gpu_diff<float>(),
-          param->mutable_gpu_data<Dtype>(),
-          history->mutable_gpu_data(),
-          this->history_[update_history_offset + param_id]->mutable_gpu_data(),
-          momentum, delta, local_rate, regularization_type, decay,  handle, clear_grads);
+      adadelta_update_gpu<float, Dtype>(param.get(), h, h2,
+          momentum, delta, local_rate, regularization_type, decay, handle, clear_grads);
     } else if (gtype == tp<double>()) {
-      adadelta_reg_update_and_clear_gpu<double, Dtype>(param->count(),
-          param->mutable_gpu_diff<double>(),
-          param->mutable_gpu_data<Dtype>(),
-          history->mutable_gpu_data(),
-          this->history_[update_history_offset + param_id]->mutable_gpu_data(),
+      adadelta_update_gpu<double, Dtype>(param.get(), h, h2,
           momentum, delta, local_rate, regularization_type, decay, handle, clear_grads);
     } else {
       LOG(FATAL) << "Gradient type " << Type_Name(gtype) << " is not supported";
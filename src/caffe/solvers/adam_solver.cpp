@@ -13,15 +13,129 @@ void AdamSolver<Dtype>::AdamPreSolve() {
   for (int i = 0; i < net_params.size(); ++i) {
     this->history_.emplace_back(boost::make_shared<TBlob<Dtype>>(net_params[i]->shape()));
   }
+  this->HalfHistoryPreSolve();
 }
 
 #ifndef CPU_ONLY
-template<typename Gtype, typename Wtype>
+template<typename Gtype, typename Wtype, typename Htype>
 void adam_reg_update_and_clear_gpu(int N,
-    Gtype* g, Wtype* w, Wtype* m, Wtype* v,
+    Gtype* g, Wtype* w, Htype* m, Htype* v,
     float beta1, float beta2,  float eps_hat, float corrected_local_rate,
     const std::string& regularization_type, float local_decay,  void* handle, bool clear_grads);
+
+template<typename Gtype, typename Wtype, typename Htype>
+void adam_reg_update_multi_gpu(int num, const int* n, Gtype* const* g, Wtype* const* w,
+    float16* const* model, Htype* const* m, Htype* const* v, const float* local_rates,
+    const float* local_decays, float beta1, float beta2, float eps_hat, float grad_scale,
+    const float* clip_scale, const std::string& reg_type, void* handle, bool clear_grads);
+
+namespace {
+
+// m and v are FLOAT16 blobs with history_data_type, Wtype ones otherwise
+template<typename Gtype, typename Wtype>
+void adam_update_gpu(Blob* param, Blob* m, Blob* v,
+    float beta1, float beta2, float eps_hat, float corrected_local_rate,
+    const std::string& regularization_type, float local_decay, void* handle, bool clear_grads) {
+  if (m->data_type() == tp<Wtype>()) {
+    adam_reg_update_and_clear_gpu(param->count(),
+        param->mutable_gpu_diff<Gtype>(), param->mutable_gpu_data<Wtype>(),
+        m->mutable_gpu_data<Wtype>(), v->mutable_gpu_data<Wtype>(),
+        beta1, beta2, eps_hat, corrected_local_rate, regularization_type, local_decay,
+        handle, clear_grads);
+  } else {
+    adam_reg_update_and_clear_gpu(param->count(),
+        param->mutable_gpu_diff<Gtype>(), param->mutable_gpu_data<Wtype>(),
+        m->mutable_gpu_data<float16>(), v->mutable_gpu_data<float16>(),
+        beta1, beta2, eps_hat, corrected_local_rate, regularization_type, local_decay,
+        handle, clear_grads);
+  }
+}
+
+template<typename Gtype, typename Dtype>
+void adam_multi_update(const vector<shared_ptr<Blob>>& net_params,
+    const vector<shared_ptr<TBlob<Dtype>>>& history,
+    const vector<shared_ptr<Blob>>& history_half, const vector<int>& ids,
+    const vector<float>& rates, const vector<float>& decays, float beta1, float beta2,
+    float eps_hat, float grad_scale, const float* clip_scale,
+    const std::string& regularization_type, void* handle, bool clear_grads,
+    const vector<Dtype*>* master) {
+  vector<int> n;
+  vector<Gtype*> g;
+  vector<Dtype*> w;
+  vector<float16*> model;
+  multi_tensor_params(net_params, ids, &n, &g, &w, master, &model);
+  float16* const* model_data = master != nullptr ? model.data() : nullptr;
+  if (history_half.empty()) {
+    vector<Dtype*> m, v;
+    multi_tensor_history(history, ids, 0UL, &m);
+    multi_tensor_history(history, ids, net_params.size(), &v);
+    adam_reg_update_multi_gpu(ids.size(), n.data(), g.data(), w.data(), model_data, m.data(),
+        v.data(), rates.data(), decays.data(), beta1, beta2, eps_hat, grad_scale, clip_scale,
+        regularization_type, handle, clear_grads);
+  } else {
+    vector<float16*> m, v;
+    multi_tensor_history(history_half, ids, 0UL, &m);
+    multi_tensor_history(history_half, ids, net_params.size(), &v);
+    adam_reg_update_multi_gpu(ids.size(), n.data(), g.data(), w.data(), model_data, m.data(),
+        v.data(), rates.data(), decays.data(), beta1, beta2, eps_hat, grad_scale, clip_scale,
+        regularization_type, handle, clear_grads);
+  }
+}
+
+}  // namespace
+#endif
+
+template<typename Dtype>
+bool AdamSolver<Dtype>::MultiTensorUpdate(const vector<int>& param_ids, void* handle,
+    float rate, float grad_scale, const float* clip_scale, bool clear_grads) {
+#ifndef CPU_ONLY
+  const vector<shared_ptr<Blob>>& net_params = this->net_->learnable_params();
+  const vector<float>& net_params_lr = this->net_->params_lr();
+  const float beta1 = this->param_.momentum();
+  const float beta2 = this->param_.momentum2();
+  const int t = this->iter_ + 1;
+  const float correction = std::sqrt(1.F - pow(beta2, float(t))) / (1.F - pow(beta1, float(t)));
+  const float eps_hat = std::max(this->param_.delta(), 0.0001F);
+  const std::string& reg_type = this->param_.regularization_type();
+  // Grouped by gradient type as in ComputeUpdateValue
+  vector<int> ids[3];
+  vector<float> rates[3], decays[3];
+  for (int param_id : param_ids) {
+    const Type gtype = net_params[param_id]->diff_type();
+    int k = 0;
+    if (gtype == tp<float16>()) {
+      k = 0;
+    } else if (gtype == tp<float>()) {
+      k = 1;
+    } else if (gtype == tp<double>()) {
+      k = 2;
+    } else {
+      LOG(FATAL) << "Gradient type " << Type_Name(gtype) << " is not supported";
+    }
+    ids[k].push_back(param_id);
+    rates[k].push_back(this->GroupRate(param_id, rate) * net_params_lr[param_id] * correction);
+    decays[k].push_back(this->local_decay(param_id));
+  }
+  if (!ids[0].empty()) {
+    adam_multi_update<float16>(net_params, this->history_, this->history_half_, ids[0],
+        rates[0], decays[0], beta1, beta2, eps_hat, grad_scale, clip_scale, reg_type, handle,
+        clear_grads, this->master_weights());
+  }
+  if (!ids[1].empty()) {
+    adam_multi_update<float>(net_params, this->history_, this->history_half_, ids[1],
+        rates[1], decays[1], beta1, beta2, eps_hat, grad_scale, clip_scale, reg_type, handle,
+        clear_grads, this->master_weights());
+  }
+  if (!ids[2].empty()) {
+    adam_multi_update<double>(net_params, this->history_, this->history_half_, ids[2],
+        rates[2], decays[2], beta1, beta2, eps_hat, grad_scale, clip_scale, reg_type, handle,
+        clear_grads, this->master_weights());
+  }
+  return true;
+#else
+  return false;
 #endif
+}
 
 template <typename Dtype>
 void AdamSolver<Dtype>::ComputeUpdateValue(int param_id, void* handle, float rate,
@@ -33,18 +147,18 @@ void AdamSolver<Dtype>::ComputeUpdateValue(int param_id, void* handle, float rat
   const float beta1 = this->param_.momentum();
   const float beta2 = this->param_.momentum2();
 
-  // we create aliases for convenience
   size_t update_history_offset = net_params.size();
-  TBlob<Dtype>* val_m = this->history_[param_id].get();
-  TBlob<Dtype>* val_v = this->history_[param_id + update_history_offset].get();
-  TBlob<Dtype>* val_t = this->temp_[param_id].get();
-
   const int t = this->iter_ + 1;
   const float correction = std::sqrt(1.F - pow(beta2, float(t))) / (1.F - pow(beta1, float(t)));
   const int N = param->count();
   const float eps_hat = std::max(this->param_.delta(), 0.0001F);
 
   if (Caffe::mode() == Caffe::CPU) {
+    // we create aliases for convenience
+    TBlob<Dtype>* val_m = this->history_[param_id].get();
+    TBlob<Dtype>* val_v = this->history_[param_id + update_history_offset].get();
+    TBlob<Dtype>* val_t = this->temp_[param_id].get();
+
     // update m <- \beta_1 m_{t-1} + (1-\beta_1)g_t
     caffe_cpu_axpby<Dtype>(N, Dtype(1.F - beta1), param->cpu_diff<Dtype>(), beta1,
         val_m->mutable_cpu_data());
@@ -71,31 +185,18 @@ void AdamSolver<Dtype>::ComputeUpdateValue(int param_id, void* handle, float rat
 #ifndef CPU_ONLY
     const std::string& regularization_type = this->param_.regularization_type();
     float decay = this->local_decay(param_id);
+    Blob* val_m = this->history_blob(param_id);
+    Blob* val_v = this->history_blob(param_id + update_history_offset);
     const Type gtype = param->diff_type();
     if (gtype == tp<float16>()) {
-      adam_reg_update_and_clear_gpu<float16, Dtype>(N,
-        param->mutable_gpu_diff<float16>(),
-        param->mutable_gpu_data<Dtype>(),
-          val_m->mutable_gpu_data(),
-          val_v->mutable_gpu_data(),
-          beta1, beta2, eps_hat, local_rate * correction, regularization_type,
-          decay, handle, clear_grads);
+      adam_update_gpu<float16, Dtype>(param.get(), val_m, val_v, beta1, beta2, eps_hat,
+          local_rate * correction, regularization_type, decay, handle, clear_grads);
     } else if (gtype == tp<float>()) {
-      adam_reg_update_and_clear_gpu<float, Dtype>(N,
-        param->mutable_gpu_diff<float>(),
-          param->mutable_gpu_data<Dtype>(),
-          val_m->mutable_gpu_data(),
-          val_v->mutable_gpu_data(),
-          beta1, beta2, eps_hat, local_rate * correction, regularization_type,
-          decay, handle, clear_grads);
+      adam_update_gpu<float, Dtype>(param.get(), val_m, val_v, beta1, beta2, eps_hat,
+          local_rate * correction, regularization_type, decay, handle, clear_grads);
     } else if (gtype == tp<double>()) {
-      adam_reg_update_and_clear_gpu<double, Dtype>(N,
-        param->mutable_gpu_diff<double>(),
-        param->mutable_gpu_data<Dtype>(),
-        val_m->mutable_gpu_data(),
-          val_v->mutable_gpu_data(),
-          beta1, beta2, eps_hat, local_rate * correction, regularization_type,
-          decay, handle, clear_grads);
+      adam_update_gpu<double, Dtype>(param.get(), val_m, val_v, beta1, beta2, eps_hat,
+          local_rate * correction, regularization_type, decay, handle, clear_grads);
     } else {
       LOG(FATAL) << "Gradient type " << Type_Name(gtype) << " is not supported";
     }
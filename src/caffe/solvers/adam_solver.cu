@@ -2,30 +2,36 @@
 
 #include "caffe/util/gpu_math_functions.cuh"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "CannotResolve"
 namespace caffe {
 
-template<typename Gtype, typename Wtype>
+// Math in float, double for double weights. History (m, v) may be kept in its own type.
+template<typename Gtype, typename Wtype, typename Htype>
 __global__ void AdamRegUpdateAllAndClear(int N,
-  Gtype* g, Wtype *w, Wtype* m, Wtype* v,
+  Gtype* g, Wtype *w, Htype* m, Htype* v,
     float beta1, float beta2, float eps_hat, float local_rate,  float local_decay,
     bool reg_L2,  bool clear_grads) {
+  typedef typename MultiTensorAcc<Wtype>::type A;
   CUDA_KERNEL_LOOP(i, N) {
-    Wtype reg = reg_L2 ? w[i] : Wtype((Wtype(0) < w[i]) - (w[i] < Wtype(0)));
-    Wtype gr = Wtype(g[i]) + reg * local_decay;
-    Wtype mi = m[i] = m[i] * beta1 + gr * (Wtype(1.) - beta1);
-    Wtype vi = v[i] = v[i] * beta2 + gr * gr * (Wtype(1.) - beta2);
+    const A wa = mt_load<A>(w[i]);
+    const A reg = reg_L2 ? wa : A((A(0) < wa) - (wa < A(0)));
+    A gr = mt_load<A>(g[i]) + reg * local_decay;
+    const A mi = mt_load<A>(m[i]) * beta1 + gr * (A(1) - beta1);
+    const A vi = mt_load<A>(v[i]) * beta2 + gr * gr * (A(1) - beta2);
     gr = local_rate * mi / (sqrt(vi) + eps_hat);
-    w[i] -= gr;
-    g[i] = clear_grads ? Gtype(0) : Gtype(gr);
+    m[i] = mt_store<Htype>(mi);
+    v[i] = mt_store<Htype>(vi);
+    w[i] = mt_store<Wtype>(wa - gr);
+    g[i] = clear_grads ? mt_store<Gtype>(A(0)) : mt_store<Gtype>(gr);
   }
 }
 #pragma clang diagnostic pop
 
 template<>
-__global__ void AdamRegUpdateAllAndClear<half, half>(int N,
+__global__ void AdamRegUpdateAllAndClear<half, half, half>(int N,
   half* g, half *w, half* m, half* v,
     float beta1, float beta2, float eps_hat, float local_rate, float local_decay,
     bool reg_L2,  bool clear_grads) {
@@ -50,56 +56,105 @@ __global__ void AdamRegUpdateAllAndClear<half, half>(int N,
   }
 }
 
-template<typename Gtype, typename Wtype>
+template<typename Gtype, typename Wtype, typename Htype>
 void adam_reg_update_and_clear_gpu(int N,
-  Gtype* g,  Wtype *w, Wtype* m, Wtype* v,
+  Gtype* g,  Wtype *w, Htype* m, Htype* v,
   float beta1,  float beta2, float eps_hat, float local_rate,
     const std::string& reg_type, float local_decay, void *handle, bool clear_grads) {
+  typedef typename MultiTensorType<Gtype>::type G;
+  typedef typename MultiTensorType<Wtype>::type W;
+  typedef typename MultiTensorType<Htype>::type H;
   cublasHandle_t cublas_handle =
       handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
   cudaStream_t stream;
   CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
   AdamRegUpdateAllAndClear  // NOLINT_NEXT_LINE(whitespace/operators)
       <<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N,
-      g, w, m, v,
+      reinterpret_cast<G*>(g), reinterpret_cast<W*>(w),
+      reinterpret_cast<H*>(m), reinterpret_cast<H*>(v),
       beta1, beta2, eps_hat, local_rate, local_decay, reg_type == "L2",  clear_grads);
   CUDA_POST_KERNEL_CHECK;
   CUDA_CHECK(cudaStreamSynchronize(stream));
 }
 
-template<>
-void adam_reg_update_and_clear_gpu<float16, float16>(int N,
-    float16 *g, float16 *w, float16 *m, float16 *v,
-  float beta1,  float beta2, float eps_hat, float local_rate,
-  const std::string& reg_type, float local_decay, void *handle, bool clear_grads) {
+#define INSTANTIATE_ADAM_UPDATE(Gtype, Wtype, Htype) \
+template void adam_reg_update_and_clear_gpu<Gtype, Wtype, Htype>(int, Gtype*, Wtype*, \
+    Htype*, Htype*, float, float, float, float, const std::string&, float, void*, bool)
+
+INSTANTIATE_ADAM_UPDATE(float16, float, float);
+INSTANTIATE_ADAM_UPDATE(float16, double, double);
+INSTANTIATE_ADAM_UPDATE(float16, float16, float16);
+INSTANTIATE_ADAM_UPDATE(float, float, float);
+INSTANTIATE_ADAM_UPDATE(float, double, double);
+INSTANTIATE_ADAM_UPDATE(float, float16, float16);
+INSTANTIATE_ADAM_UPDATE(double, float, float);
+INSTANTIATE_ADAM_UPDATE(double, double, double);
+INSTANTIATE_ADAM_UPDATE(double, float16, float16);
+// SolverParameter::history_data_type FLOAT16
+INSTANTIATE_ADAM_UPDATE(float16, float, float16);
+INSTANTIATE_ADAM_UPDATE(float16, double, float16);
+INSTANTIATE_ADAM_UPDATE(float, float, float16);
+INSTANTIATE_ADAM_UPDATE(float, double, float16);
+INSTANTIATE_ADAM_UPDATE(double, float, float16);
+INSTANTIATE_ADAM_UPDATE(double, double, float16);
+
+struct AdamMultiOp {
+  float beta1, beta2, eps_hat, grad_scale;
+  const float* clip_scale;
+  bool reg_L2, clear_grads;
+
+  template<typename Gtype, typename Wtype, typename Htype>
+  __device__ void operator()(Gtype& g, Wtype& w, Htype& m, Htype& v, float local_rate,
+      float local_decay) const {
+    typedef typename MultiTensorAcc<Wtype>::type A;
+    const A wa = mt_load<A>(w);
+    const A reg = reg_L2 ? wa : A((A(0) < wa) - (wa < A(0)));
+    const float gs = clip_scale == nullptr ? grad_scale : grad_scale * *clip_scale;
+    A gr = mt_load<A>(g) * gs + reg * local_decay;
+    const A mi = mt_load<A>(m) * beta1 + gr * (A(1) - beta1);
+    const A vi = mt_load<A>(v) * beta2 + gr * gr * (A(1) - beta2);
+    gr = local_rate * mi / (sqrt(vi) + eps_hat);
+    m = mt_store<Htype>(mi);
+    v = mt_store<Htype>(vi);
+    w = mt_store<Wtype>(wa - gr);
+    g = clear_grads ? mt_store<Gtype>(A(0)) : mt_store<Gtype>(gr);
+  }
+};
+
+// local_rates include the bias correction
+template<typename Gtype, typename Wtype, typename Htype>
+void adam_reg_update_multi_gpu(int num, const int* n, Gtype* const* g, Wtype* const* w,
+    float16* const* model, Htype* const* m, Htype* const* v, const float* local_rates,
+    const float* local_decays, float beta1, float beta2, float eps_hat, float grad_scale,
+    const float* clip_scale, const std::string& reg_type, void* handle, bool clear_grads) {
   cublasHandle_t cublas_handle =
-        handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
+      handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
   cudaStream_t stream;
   CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
-  AdamRegUpdateAllAndClear  // NOLINT_NEXT_LINE(whitespace/operators)
-      <<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N,
-      reinterpret_cast<half*>(g), reinterpret_cast<half*>(w),
-      reinterpret_cast<half*>(m), reinterpret_cast<half*>(v),
-      beta1, beta2, eps_hat, local_rate, local_decay, reg_type == "L2",  clear_grads);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  const AdamMultiOp op{beta1, beta2, eps_hat, grad_scale, clip_scale, reg_type == "L2",
+      clear_grads};
+  multi_tensor_apply(num, n, g, w, m, v, local_rates, local_decays, op, stream, nullptr, model);
 }
 
+#define INSTANTIATE_ADAM_MULTI(Gtype, Wtype, Htype) \
+template void adam_reg_update_multi_gpu<Gtype, Wtype, Htype>(int, const int*, Gtype* const*, \
+    Wtype* const*, float16* const*, Htype* const*, Htype* const*, const float*, const float*, \
+    float, float, float, float, const float*, const std::string&, void*, bool)
+
+INSTANTIATE_ADAM_MULTI(float16, float, float);
+INSTANTIATE_ADAM_MULTI(float16, double, double);
+INSTANTIATE_ADAM_MULTI(float16, float16, float16);
+INSTANTIATE_ADAM_MULTI(float, float, float);
+INSTANTIATE_ADAM_MULTI(float, double, double);
+INSTANTIATE_ADAM_MULTI(float, float16, float16);
+INSTANTIATE_ADAM_MULTI(double, float, float);
+INSTANTIATE_ADAM_MULTI(double, double, double);
+INSTANTIATE_ADAM_MULTI(double, float16, float16);
+INSTANTIATE_ADAM_MULTI(float16, float, float16);
+INSTANTIATE_ADAM_MULTI(float16, double, float16);
+INSTANTIATE_ADAM_MULTI(float, float, float16);
+INSTANTIATE_ADAM_MULTI(float, double, float16);
+INSTANTIATE_ADAM_MULTI(double, float, float16);
+INSTANTIATE_ADAM_MULTI(double, double, float16);
 
-template void adam_reg_update_and_clear_gpu<float16, float>(int, float16*, float*, float*,
-    float*, float, float, float, float, const std::string&, float, void*, bool);
-template void adam_reg_update_and_clear_gpu<float16, double>(int, float16*, double*, double*,
-    double*, float, float, float, float, const std::string&, float, void*, bool);
-template void adam_reg_update_and_clear_gpu<float, float>(int, float*, float*, float*,
-    float*, float, float, float, float, const std::string&, float,  void*, bool);
-template void adam_reg_update_and_clear_gpu<float, double>(int, float*, double*, double*,
-    double*, float, float, float, float, const std::string&, float, void*, bool);
-template void adam_reg_update_and_clear_gpu<float, float16>(int, float*, float16*, float16*,
-    float16*, float, float, float, float, const std::string&, float, void*, bool);
-template void adam_reg_update_and_clear_gpu<double, float>(int, double*, float*, float*,
-    float*, float, float, float, float, const std::string&, float, void*, bool);
-template void adam_reg_update_and_clear_gpu<double, double>(int, double*, double*, double*,
-    double*, float, float, float, float, const std::string&, float, void*, bool);
-template void adam_reg_update_and_clear_gpu<double, float16>(int, double*, float16*, float16*,
-    float16*, float, float, float, float, const std::string&, float, void*, bool);
 }  // namespace caffe
@@ -10,8 +10,80 @@ void nesterov_reg_update_and_clear_gpu(int N,
     Gtype* g, Wtype *w, Wtype* h,
     float momentum, float local_rate, const std::string& reg_type, float local_decay,
     void *handle, bool clear_grads);
+
+template<typename Gtype, typename Wtype>
+void nesterov_reg_update_multi_gpu(int num, const int* n, Gtype* const* g, Wtype* const* w,
+    float16* const* model, Wtype* const* h, const float* local_rates, const float* local_decays,
+    float momentum, float grad_scale, const float* clip_scale, const std::string& reg_type,
+    void* handle, bool clear_grads);
+
+namespace {
+
+template<typename Gtype, typename Dtype>
+void nesterov_multi_update(const vector<shared_ptr<Blob>>& net_params,
+    const vector<shared_ptr<TBlob<Dtype>>>& history, const vector<int>& ids,
+    const vector<float>& rates, const vector<float>& decays, float momentum, float grad_scale,
+    const float* clip_scale, const std::string& regularization_type, void* handle,
+    bool clear_grads, const vector<Dtype*>* master) {
+  vector<int> n;
+  vector<Gtype*> g;
+  vector<Dtype*> w, h;
+  vector<float16*> model;
+  multi_tensor_params(net_params, ids, &n, &g, &w, master, &model);
+  multi_tensor_history(history, ids, 0UL, &h);
+  nesterov_reg_update_multi_gpu(ids.size(), n.data(), g.data(), w.data(),
+      master != nullptr ? model.data() : nullptr, h.data(), rates.data(), decays.data(),
+      momentum, grad_scale, clip_scale, regularization_type, handle, clear_grads);
+}
+
+}  // namespace
 #endif
 
+template<typename Dtype>
+bool NesterovSolver<Dtype>::MultiTensorUpdate(const vector<int>& param_ids, void* handle,
+    float rate, float grad_scale, const float* clip_scale, bool clear_grads) {
+#ifndef CPU_ONLY
+  const vector<shared_ptr<Blob>>& net_params = this->net_->learnable_params();
+  const vector<float>& net_params_lr = this->net_->params_lr();
+  const float momentum = this->param_.momentum();
+  const std::string& reg_type = this->param_.regularization_type();
+  // Grouped by gradient type as in ComputeUpdateValue
+  vector<int> ids[3];
+  vector<float> rates[3], decays[3];
+  for (int param_id : param_ids) {
+    const Type gtype = net_params[param_id]->diff_type();
+    int k = 0;
+    if (gtype == tp<float16>()) {
+      k = 0;
+    } else if (gtype == tp<float>()) {
+      k = 1;
+    } else if (gtype == tp<double>()) {
+      k = 2;
+    } else {
+      LOG(FATAL) << "Gradient type " << Type_Name(gtype) << " is not supported";
+    }
+    ids[k].push_back(param_id);
+    rates[k].push_back(this->GroupRate(param_id, rate) * net_params_lr[param_id]);
+    decays[k].push_back(this->local_decay(param_id));
+  }
+  if (!ids[0].empty()) {
+    nesterov_multi_update<float16>(net_params, this->history_, ids[0], rates[0], decays[0],
+        momentum, grad_scale, clip_scale, reg_type, handle, clear_grads, this->master_weights());
+  }
+  if (!ids[1].empty()) {
+    nesterov_multi_update<float>(net_params, this->history_, ids[1], rates[1], decays[1],
+        momentum, grad_scale, clip_scale, reg_type, handle, clear_grads, this->master_weights());
+  }
+  if (!ids[2].empty()) {
+    nesterov_multi_update<double>(net_params, this->history_, ids[2], rates[2], decays[2],
+        momentum, grad_scale, clip_scale, reg_type, handle, clear_grads, this->master_weights());
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
 template<typename Dtype>
 void NesterovSolver<Dtype>::ComputeUpdateValue(int param_id, void *handle, float rate,
     bool clear_grads) {
@@ -2,6 +2,7 @@
 
 #include "caffe/util/gpu_math_functions.cuh"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
 
 namespace caffe {
 
@@ -105,4 +106,56 @@ template void nesterov_reg_update_and_clear_gpu<double, double>(int, double*, do
 template void nesterov_reg_update_and_clear_gpu<double, float16>(int, double*, float16*, float16*,
   float, float, const std::string&, float, void*, bool);
 
+
+struct NesterovMultiOp {
+  float momentum, grad_scale;
+  const float* clip_scale;
+  bool reg_L2, clear_grads;
+
+  template<typename Gtype, typename Wtype>
+  __device__ void operator()(Gtype& g, Wtype& w, Wtype& h, Wtype&, float local_rate,
+      float local_decay) const {
+    typedef typename MultiTensorAcc<Wtype>::type A;
+    const A wa = mt_load<A>(w);
+    const A reg = reg_L2 ? wa : A((A(0) < wa) - (wa < A(0)));
+    const float gs = clip_scale == nullptr ? grad_scale : grad_scale * *clip_scale;
+    A gr = mt_load<A>(g) * gs + reg * local_decay;
+    const A hi = mt_load<A>(h);
+    const A hi_new = momentum * hi + local_rate * gr;
+    gr = (A(1) + momentum) * hi_new - momentum * hi;
+    h = mt_store<Wtype>(hi_new);
+    w = mt_store<Wtype>(wa - gr);
+    g = clear_grads ? mt_store<Gtype>(A(0)) : mt_store<Gtype>(gr);
+  }
+};
+
+template<typename Gtype, typename Wtype>
+void nesterov_reg_update_multi_gpu(int num, const int* n, Gtype* const* g, Wtype* const* w,
+    float16* const* model, Wtype* const* h, const float* local_rates, const float* local_decays,
+    float momentum, float grad_scale, const float* clip_scale, const std::string& reg_type,
+    void* handle, bool clear_grads) {
+  cublasHandle_t cublas_handle =
+      handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
+  cudaStream_t stream;
+  CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
+  const NesterovMultiOp op{momentum, grad_scale, clip_scale, reg_type == "L2", clear_grads};
+  multi_tensor_apply(num, n, g, w, h, static_cast<Wtype* const*>(nullptr), local_rates,
+      local_decays, op, stream, nullptr, model);
+}
+
+#define INSTANTIATE_NESTEROV_MULTI(Gtype, Wtype) \
+template void nesterov_reg_update_multi_gpu<Gtype, Wtype>(int, const int*, Gtype* const*, \
+    Wtype* const*, float16* const*, Wtype* const*, const float*, const float*, float, float, \
+    const float*, const std::string&, void*, bool)
+
+INSTANTIATE_NESTEROV_MULTI(float16, float);
+INSTANTIATE_NESTEROV_MULTI(float16, double);
+INSTANTIATE_NESTEROV_MULTI(float16, float16);
+INSTANTIATE_NESTEROV_MULTI(float, float);
+INSTANTIATE_NESTEROV_MULTI(float, double);
+INSTANTIATE_NESTEROV_MULTI(float, float16);
+INSTANTIATE_NESTEROV_MULTI(double, float);
+INSTANTIATE_NESTEROV_MULTI(double, double);
+INSTANTIATE_NESTEROV_MULTI(double, float16);
+
 }  // namespace caffe
@@ -6,19 +6,39 @@
 namespace caffe {
 
 #ifndef CPU_ONLY
-template<typename Gtype, typename Wtype>
+template<typename Gtype, typename Wtype, typename Htype>
 void rmsprop_reg_update_and_clear_gpu(int N,
-    Gtype* g, Wtype* w, Wtype* h,
+    Gtype* g, Wtype* w, Htype* h,
     float rms_decay, float delta,  float local_rate, const std::string& regularization_type,
     float local_decay, void* handle, bool clear_grads);
+
+namespace {
+
+// history is a FLOAT16 blob with history_data_type, a Wtype one otherwise
+template<typename Gtype, typename Wtype>
+void rmsprop_update_gpu(Blob* param, Blob* history,
+    float rms_decay, float delta, float local_rate, const std::string& regularization_type,
+    float local_decay, void* handle, bool clear_grads) {
+  if (history->data_type() == tp<Wtype>()) {
+    rmsprop_reg_update_and_clear_gpu(param->count(),
+        param->mutable_gpu_diff<Gtype>(), param->mutable_gpu_data<Wtype>(),
+        history->mutable_gpu_data<Wtype>(),
+        rms_decay, delta, local_rate, regularization_type, local_decay, handle, clear_grads);
+  } else {
+    rmsprop_reg_update_and_clear_gpu(param->count(),
+        param->mutable_gpu_diff<Gtype>(), param->mutable_gpu_data<Wtype>(),
+        history->mutable_gpu_data<float16>(),
+        rms_decay, delta, local_rate, regularization_type, local_decay, handle, clear_grads);
+  }
+}
+
+}  // namespace
 #endif
 
 template<typename Dtype>
 void RMSPropSolver<Dtype>::ComputeUpdateValue(int param_id, void *handle, float rate,
     bool clear_grads) {
   shared_ptr<Blob> param = this->net_->learnable_params()[param_id];
-  shared_ptr<TBlob<Dtype>> history = this->history_[param_id];
-  shared_ptr<TBlob<Dtype>> update = this->update_[param_id];
   const vector<float>& net_params_lr = this->net_->params_lr();
 
   // get the learning rate
@@ -27,6 +47,9 @@ void RMSPropSolver<Dtype>::ComputeUpdateValue(int param_id, void *handle, float
   float local_rate = rate * net_params_lr[param_id];
 
   if (Caffe::mode() == Caffe::CPU) {
+    shared_ptr<TBlob<Dtype>> history = this->history_[param_id];
+    shared_ptr<TBlob<Dtype>> update = this->update_[param_id];
+
     // compute square of gradient in update
     caffe_powx<Dtype>(param->count(), param->cpu_diff<Dtype>(), Dtype(2.F),
         update->mutable_cpu_data());
@@ -55,24 +78,16 @@ void RMSPropSolver<Dtype>::ComputeUpdateValue(int param_id, void *handle, float
 #ifndef CPU_ONLY
     const std::string& regularization_type = this->param_.regularization_type();
     float decay = this->local_decay(param_id);
+    Blob* history = this->history_blob(param_id);
     const Type gtype = param->diff_type();
     if (gtype == tp<float16>()) {
-      rmsprop_reg_update_and_clear_gpu<float16, Dtype>(param->count(),
-          param->mutable_gpu_diff<float16>(),
-          param->mutable_gpu_data<Dtype>(),
-          history->mutable_gpu_data(),
+      rmsprop_update_gpu<float16, Dtype>(param.get(), history,
           rms_decay, delta, local_rate, regularization_type, decay, handle, clear_grads);
     } else if (gtype == tp<float>()) {
-      rmsprop_reg_update_and_clear_gpu<float, Dtype>(param->count(),
-          param->mutable_gpu_diff<float>(),
-          param->mutable_gpu_data<Dtype>(),
-          history->mutable_gpu_data(),
+      rmsprop_update_gpu<float, Dtype>(param.get(), history,
           rms_decay, delta, local_rate, regularization_type, decay, handle, clear_grads);
     } else if (gtype == tp<double>()) {
-      rmsprop_reg_update_and_clear_gpu<double, Dtype>(param->count(),
-          param->mutable_gpu_diff<double>(),
-          param->mutable_gpu_data<Dtype>(),
-          history->mutable_gpu_data(),
+      rmsprop_update_gpu<double, Dtype>(param.get(), history,
           rms_decay, delta, local_rate, regularization_type, decay, handle, clear_grads);
     } else {
       LOG(FATAL) << "Gradient type " << Type_Name(gtype) << " is not supported";
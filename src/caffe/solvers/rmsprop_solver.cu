@@ -3,29 +3,34 @@
 
 #include "caffe/util/gpu_math_functions.cuh"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
 
 namespace caffe {
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "CannotResolve"
-template<typename Gtype, typename Wtype>
+// Math in float, double for double weights. History may be kept in its own type.
+template<typename Gtype, typename Wtype, typename Htype>
 __global__ void RMSPropRegUpdateAllAndClear(int N,
-    Gtype* g, Wtype *w, Wtype* h,
+    Gtype* g, Wtype *w, Htype* h,
     float rms_decay, float delta, float local_rate, float local_decay, bool reg_L2,
     bool clear_grads) {
+  typedef typename MultiTensorAcc<Wtype>::type A;
   CUDA_KERNEL_LOOP(i, N) {
-    Wtype reg = reg_L2 ? w[i] : Wtype((Wtype(0) < w[i]) - (w[i] < Wtype(0)));
-    Wtype gr = Wtype(g[i]) + reg * local_decay;
-    Wtype hi = h[i] = rms_decay * h[i] + (1.F - rms_decay) * gr*gr;
+    const A wa = mt_load<A>(w[i]);
+    const A reg = reg_L2 ? wa : A((A(0) < wa) - (wa < A(0)));
+    A gr = mt_load<A>(g[i]) + reg * local_decay;
+    const A hi = rms_decay * mt_load<A>(h[i]) + (1.F - rms_decay) * gr * gr;
     gr = local_rate * gr / (sqrt(hi) + delta);
-    w[i] -= gr;
-    g[i] = clear_grads ? Gtype(0) : Gtype(gr);
+    h[i] = mt_store<Htype>(hi);
+    w[i] = mt_store<Wtype>(wa - gr);
+    g[i] = clear_grads ? mt_store<Gtype>(A(0)) : mt_store<Gtype>(gr);
   }
 }
 #pragma clang diagnostic pop
 
 template<>
-__global__ void RMSPropRegUpdateAllAndClear<half, half>(int N,
+__global__ void RMSPropRegUpdateAllAndClear<half, half, half>(int N,
     half* g, half* w, half* h,
     float rms_decay, float delta, float local_rate, float local_decay, bool reg_L2,
     bool clear_grads) {
@@ -48,57 +53,45 @@ __global__ void RMSPropRegUpdateAllAndClear<half, half>(int N,
 }
 
 
-template<typename Gtype, typename Wtype>
+template<typename Gtype, typename Wtype, typename Htype>
 void rmsprop_reg_update_and_clear_gpu(int N,
-  Gtype* g, Wtype* w, Wtype* h,
+  Gtype* g, Wtype* w, Htype* h,
   float rms_decay, float delta, float local_rate, const std::string& reg_type,
   float local_decay, void* handle, bool clear_grads) {
+  typedef typename MultiTensorType<Gtype>::type G;
+  typedef typename MultiTensorType<Wtype>::type W;
+  typedef typename MultiTensorType<Htype>::type H;
   cublasHandle_t cublas_handle =
       handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
   cudaStream_t stream;
   CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
   RMSPropRegUpdateAllAndClear  // NOLINT_NEXT_LINE(whitespace/operators)
       <<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N,
-      g, w, h,
+      reinterpret_cast<G*>(g), reinterpret_cast<W*>(w), reinterpret_cast<H*>(h),
       rms_decay, delta, local_rate, local_decay, reg_type == "L2", clear_grads);
   CUDA_POST_KERNEL_CHECK;
   CUDA_CHECK(cudaStreamSynchronize(stream));
 }
 
-template<>
-void rmsprop_reg_update_and_clear_gpu<float16, float16>(int N,
-  float16* g, float16* w, float16* h,
-  float rms_decay, float delta, float local_rate, const std::string& reg_type,
-  float local_decay, void* handle, bool clear_grads) {
-  cublasHandle_t cublas_handle =
-      handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
-  cudaStream_t stream;
-  CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
-  RMSPropRegUpdateAllAndClear  // NOLINT_NEXT_LINE(whitespace/operators)
-      <<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N,
-        reinterpret_cast<half*>(g), reinterpret_cast<half*>(w), reinterpret_cast<half*>(h),
-        rms_decay, delta, local_rate, local_decay, reg_type == "L2", clear_grads);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
-}
-
-template void rmsprop_reg_update_and_clear_gpu<float16, float>(int, float16*, float*, float*,
-    float, float, float, const std::string&, float, void*, bool);
-template void rmsprop_reg_update_and_clear_gpu<float16, double>(int, float16*, double*, double*,
-    float, float, float, const std::string&, float, void*, bool);
-
-template void rmsprop_reg_update_and_clear_gpu<float, float>(int, float*, float*, float*,
-    float, float, float, const std::string&, float, void*, bool);
-template void rmsprop_reg_update_and_clear_gpu<float, double>(int, float*, double*, double*,
-    float, float, float, const std::string&, float, void*, bool);
-template void rmsprop_reg_update_and_clear_gpu<float, float16>(int, float*, float16*, float16*,
-    float, float, float, const std::string&, float, void*, bool);
+#define INSTANTIATE_RMSPROP_UPDATE(Gtype, Wtype, Htype) \
+template void rmsprop_reg_update_and_clear_gpu<Gtype, Wtype, Htype>(int, Gtype*, Wtype*, \
+    Htype*, float, float, float, const std::string&, float, void*, bool)
 
-template void rmsprop_reg_update_and_clear_gpu<double, float>(int, double*, float*, float*,
-    float, float, float, const std::string&, float, void*, bool);
-template void rmsprop_reg_update_and_clear_gpu<double, double>(int, double*, double*, double*,
-    float, float, float, const std::string&, float, void*, bool);
-template void rmsprop_reg_update_and_clear_gpu<double, float16>(int, double*, float16*, float16*,
-    float, float, float, const std::string&, float, void*, bool);
+INSTANTIATE_RMSPROP_UPDATE(float16, float, float);
+INSTANTIATE_RMSPROP_UPDATE(float16, double, double);
+INSTANTIATE_RMSPROP_UPDATE(float16, float16, float16);
+INSTANTIATE_RMSPROP_UPDATE(float, float, float);
+INSTANTIATE_RMSPROP_UPDATE(float, double, double);
+INSTANTIATE_RMSPROP_UPDATE(float, float16, float16);
+INSTANTIATE_RMSPROP_UPDATE(double, float, float);
+INSTANTIATE_RMSPROP_UPDATE(double, double, double);
+INSTANTIATE_RMSPROP_UPDATE(double, float16, float16);
+// SolverParameter::history_data_type FLOAT16
+INSTANTIATE_RMSPROP_UPDATE(float16, float, float16);
+INSTANTIATE_RMSPROP_UPDATE(float16, double, float16);
+INSTANTIATE_RMSPROP_UPDATE(float, float, float16);
+INSTANTIATE_RMSPROP_UPDATE(float, double, float16);
+INSTANTIATE_RMSPROP_UPDATE(double, float, float16);
+INSTANTIATE_RMSPROP_UPDATE(double, double, float16);
 
 }  // namespace caffe
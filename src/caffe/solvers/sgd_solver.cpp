@@ -1,12 +1,27 @@
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
 #include "caffe/sgd_solvers.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/nvtx.hpp"
+#include "caffe/util/sparse_2_4.hpp"
 #include "caffe/util/upgrade_proto.hpp"
+#include "caffe/util/weight_file.hpp"
 
 namespace caffe {
 
-// Return the current learning rate. The currently implemented learning rate
-// policies are as follows:
+// Return the learning rate of schedule p at iteration iter. The currently
+// implemented learning rate policies are as follows:
 //    - fixed: always return base_lr.
 //    - step: return base_lr * gamma ^ (floor(iter / step))
 //    - exp: return base_lr * gamma ^ iter
@@ -17,80 +32,119 @@ namespace caffe {
 //      zero by the max_iter. return base_lr (1 - iter/max_iter) ^ (power)
 //    - sigmoid: the effective learning rate follows a sigmod decay
 //      return base_lr ( 1/(1 + exp(-gamma * (iter - stepsize))))
+//    - cosine: return min_lr + (base_lr - min_lr) (1 + cos(pi * t)) / 2, t going
+//      from 0 at the end of the rampup to 1 at max_iter
 //
 // where base_lr, max_iter, gamma, step, stepvalue and power are defined
 // in the solver parameter protocol buffer, and iter is the current iteration.
-template<typename Dtype>
-float SGDSolver<Dtype>::GetLearningRate() {
+// step is the current step of step and multistep policies, kept between calls.
+static float ScheduledRate(const SolverParameter& p, int iter, int* step) {
   float rate;
-  const string& lr_policy = this->param_.lr_policy();
-  if (this->iter_ < this->param_.rampup_interval()) {
-    float alpha = float(this->iter_) / this->param_.rampup_interval();
-    float rampup_lr = 0.;
-    if (this->param_.has_rampup_lr()) {
-      rampup_lr = this->param_.rampup_lr();
-    }
-    rate = rampup_lr + (this->param_.base_lr() - rampup_lr) * alpha * alpha;
+  const string& lr_policy = p.lr_policy();
+  if (iter < p.rampup_interval()) {
+    float alpha = float(iter) / p.rampup_interval();
+    const string& rampup_policy = p.rampup_policy();
+    if (rampup_policy == "quadratic") {
+      alpha *= alpha;
+    } else if (rampup_policy != "linear") {
+      LOG(FATAL) << "Unknown rampup policy: " << rampup_policy;
+    }
+    rate = p.rampup_lr() + (p.base_lr() - p.rampup_lr()) * alpha;
   } else if (lr_policy == "fixed") {
-    rate = this->param_.base_lr();
+    rate = p.base_lr();
   } else if (lr_policy == "step") {
-    this->current_step_ = this->iter_ / this->param_.stepsize();
-    rate = this->param_.base_lr() * pow(this->param_.gamma(), this->current_step_);
+    *step = iter / p.stepsize();
+    rate = p.base_lr() * pow(p.gamma(), *step);
   } else if (lr_policy == "exp") {
-    rate = this->param_.base_lr() * pow(this->param_.gamma(), this->iter_);
+    rate = p.base_lr() * pow(p.gamma(), iter);
   } else if (lr_policy == "inv") {
-    rate = this->param_.base_lr() *
-           pow(1.F + this->param_.gamma() * float(this->iter_), -this->param_.power());
+    rate = p.base_lr() * pow(1.F + p.gamma() * float(iter), -p.power());
   } else if (lr_policy == "multistep") {
-    if (this->current_step_ < this->param_.stepvalue_size() &&
-        this->iter_ >= this->param_.stepvalue(this->current_step_)) {
-      this->current_step_++;
-      LOG(INFO) << "MultiStep Status: Iteration " << this->iter_ << ", step = "
-                << this->current_step_;
+    while (*step < p.stepvalue_size() && iter >= p.stepvalue(*step)) {
+      ++*step;
+      LOG(INFO) << "MultiStep Status: Iteration " << iter << ", step = " << *step;
     }
-    rate = this->param_.base_lr() * pow(this->param_.gamma(), this->current_step_);
+    rate = p.base_lr() * pow(p.gamma(), *step);
   } else if (lr_policy == "poly") {
-    float base_lr = this->param_.base_lr();
-    float power = this->param_.power();
-    float maxiter = this->param_.max_iter() > 0 ? float(this->param_.max_iter()) : 1.F;
-    rate = base_lr * pow(1.F - (float(this->iter_) / maxiter), power);
+    float maxiter = p.max_iter() > 0 ? float(p.max_iter()) : 1.F;
+    rate = p.base_lr() * pow(1.F - (float(iter) / maxiter), p.power());
   } else if (lr_policy == "sigmoid") {
-    rate = this->param_.base_lr() / (1.F +
-        exp(-this->param_.gamma() * (double(this->iter_ - this->param_.stepsize()))));
+    rate = p.base_lr() / (1.F + exp(-p.gamma() * (double(iter - p.stepsize()))));
+  } else if (lr_policy == "cosine") {
+    const int span = std::max(p.max_iter() - p.rampup_interval(), 1);
+    const float t = std::min(float(iter - p.rampup_interval()) / span, 1.F);
+    rate = p.min_lr() + (p.base_lr() - p.min_lr()) * 0.5F * (1.F + std::cos(float(M_PI) * t));
   } else {
     LOG(FATAL) << "Unknown learning rate policy: " << lr_policy;
   }
-  float min_lr = this->param_.min_lr();
+  float min_lr = p.min_lr();
   if (rate < min_lr) {
     rate = min_lr;
   }
   return rate;
 }
 
+// Schedule of lr_group g as a SolverParameter, fields g doesn't set are param's
+static SolverParameter GroupSchedule(const SolverParameter& param, const LRGroupParameter& g) {
+  SolverParameter p;
+  p.set_max_iter(param.max_iter());
+  p.set_lr_policy(g.has_lr_policy() ? g.lr_policy() : param.lr_policy());
+  p.set_base_lr(g.has_base_lr() ? g.base_lr() : param.base_lr());
+  p.set_gamma(g.has_gamma() ? g.gamma() : param.gamma());
+  p.set_power(g.has_power() ? g.power() : param.power());
+  p.set_stepsize(g.has_stepsize() ? g.stepsize() : param.stepsize());
+  *p.mutable_stepvalue() = g.stepvalue_size() > 0 ? g.stepvalue() : param.stepvalue();
+  p.set_min_lr(g.has_min_lr() ? g.min_lr() : param.min_lr());
+  p.set_rampup_interval(g.has_rampup_interval() ? g.rampup_interval()
+                                                : param.rampup_interval());
+  p.set_rampup_lr(g.has_rampup_lr() ? g.rampup_lr() : param.rampup_lr());
+  p.set_rampup_policy(g.has_rampup_policy() ? g.rampup_policy() : param.rampup_policy());
+  return p;
+}
+
+// Evaluates the schedules for the current iteration. Solver::Step does it before the
+// iteration starts, so reduction threads only read the results.
 template<typename Dtype>
-float SGDSolver<Dtype>::GetMomentum() {
-  float moment;
+void SGDSolver<Dtype>::UpdateSchedule() {
+  rate_ = ScheduledRate(this->param_, this->iter_, &this->current_step_);
+  for (int g = 0; g < groups_.size(); ++g) {
+    group_rates_[g] = ScheduledRate(groups_[g], this->iter_, &group_steps_[g]);
+  }
   float base_momentum = this->param_.momentum();
   const string& momentum_policy = this->param_.momentum_policy();
-
   if (momentum_policy == "fixed") {
-     moment = base_momentum;
+    momentum_ = base_momentum;
   } else if (momentum_policy == "poly") {
     float max_momentum  = this->param_.max_momentum();
     float power = this->param_.momentum_power();
-    moment = base_momentum + (max_momentum - base_momentum) *
+    momentum_ = base_momentum + (max_momentum - base_momentum) *
            pow((float(this->iter_) / float(this->param_.max_iter())), power);
   } else if (momentum_policy == "opt") {
-    float lr = GetLearningRate();
-    moment = (1. - 0.5*std::sqrt(lr)) * (1. - 0.5*std::sqrt(lr));
+    momentum_ = (1. - 0.5*std::sqrt(rate_)) * (1. - 0.5*std::sqrt(rate_));
     if (this->param_.has_max_momentum()) {
       float max_momentum  = this->param_.max_momentum();
-      moment = std::min(max_momentum, moment);
+      momentum_ = std::min(max_momentum, momentum_);
     }
   } else {
     LOG(FATAL) << "Unknown momentum policy: " << momentum_policy;
   }
-  return moment;
+  schedule_iter_ = this->iter_;
+}
+
+template<typename Dtype>
+float SGDSolver<Dtype>::GetLearningRate() {
+  if (schedule_iter_ != this->iter_) {
+    UpdateSchedule();
+  }
+  return rate_;
+}
+
+template<typename Dtype>
+float SGDSolver<Dtype>::GetMomentum() {
+  if (schedule_iter_ != this->iter_) {
+    UpdateSchedule();
+  }
+  return momentum_;
 }
 
 template<typename Dtype>
@@ -98,6 +152,7 @@ void SGDSolver<Dtype>::PreSolve() {
   // Initialize the history
   const vector<shared_ptr<Blob>>& net_params = this->net_->learnable_params();
   history_.clear();
+  history_half_.clear();
   update_.clear();
   temp_.clear();
 
@@ -107,26 +162,425 @@ void SGDSolver<Dtype>::PreSolve() {
     update_.emplace_back(boost::make_shared<TBlob<Dtype>>(shape));
     temp_.emplace_back(boost::make_shared<TBlob<Dtype>>(shape));
   }
+  sparse_rows_.assign(net_params.size(), shared_ptr<TBlob<int>>());
+  for (int i = 0; i < net_params.size(); ++i) {
+    if (this->net_->sparse_rows(i) != nullptr) {
+      sparse_rows_[i] = boost::make_shared<TBlob<int>>();
+    }
+  }
+#ifndef CPU_ONLY
+  std::fill(sumsq_ready_, sumsq_ready_ + 2, nullptr);
+#endif
+  if (this->param_.local_lr_auto()) {
+    // One per MultiTensorUpdate type group, so reduction threads never share one
+    for (int k = 0; k < 4; ++k) {
+      lars_.emplace_back(boost::make_shared<TBlob<float>>());
+    }
+  }
+  master_.clear();
+  master_ready_.clear();
+  if (this->param_.master_weights() && Caffe::mode() == Caffe::GPU) {
+    CHECK(!this->param_.shard_solver_state() || Caffe::solver_count() < 2)
+        << "master_weights: owners' updates of sharded state would bypass other masters";
+    CHECK_LE(this->param_.local_sgd_iters(), 1)
+        << "master_weights: local SGD averages the weights, not their master copies";
+    // FLOAT16 params, in the type layers use them, except those given to SparseUpdate
+    size_t count = 0UL;
+    vector<size_t> offsets(net_params.size(), 0UL);
+    vector<bool> has_master(net_params.size(), false);
+    for (int i = 0; i < net_params.size(); ++i) {
+      if (net_params[i]->data_type() == tp<float16>() && !is_type<Dtype>(FLOAT16)
+          && this->net_->sparse_rows(i) == nullptr) {
+        has_master[i] = true;
+        offsets[i] = count;
+        count += align_up<6>((size_t) net_params[i]->count());
+      }
+    }
+    if (count > 0UL) {
+      master_data_ = boost::make_shared<TBlob<Dtype>>(vector<int>(1, (int) count));
+      Dtype* base = master_data_->mutable_gpu_data();
+      master_.assign(net_params.size(), nullptr);
+      for (int i = 0; i < net_params.size(); ++i) {
+        if (has_master[i]) {
+          master_[i] = base + offsets[i];
+        }
+      }
+      master_ready_.assign(net_params.size(), 0);
+      LOG(INFO) << "Master weights: " << count << " " << Type_Name(tp<Dtype>())
+                << " elements for FLOAT16 params";
+    }
+  }
+  ema_.clear();
+  ema_ready_.clear();
+  if (this->param_.weights_ema_decay() > 0.F && this->is_root()) {
+    CHECK_LT(this->param_.weights_ema_decay(), 1.F)
+        << "weights_ema_decay should lie between 0 and 1";
+    CHECK(!this->param_.shard_solver_state() || Caffe::solver_count() < 2)
+        << "weights_ema_decay: the root solver only updates its own shard";
+    for (int i = 0; i < net_params.size(); ++i) {
+      ema_.emplace_back(boost::make_shared<TBlob<Dtype>>(net_params[i]->shape()));
+    }
+    ema_ready_.assign(net_params.size(), 0);
+  }
+  sparse_masks_.clear();
+  sparse_mask_iter_.clear();
+  const vector<bool>& sparse_2_4 = this->net_->params_sparse_2_4();
+  if (std::find(sparse_2_4.begin(), sparse_2_4.end(), true) != sparse_2_4.end()) {
+    sparse_masks_.resize(net_params.size());
+    sparse_mask_iter_.assign(net_params.size(), -1);
+    int pruned = 0;
+    for (int i = 0; i < net_params.size(); ++i) {
+      if (!sparse_2_4[i]) {
+        continue;
+      }
+      CHECK(sparse_2_4_shape(net_params[i]->shape())) << "sparse_2_4: param " << i
+          << " of shape " << net_params[i]->shape_string() << " has no rows of 4k values";
+      sparse_masks_[i] = boost::make_shared<TBlob<unsigned int>>(
+          vector<int>(1, sparse_2_4_mask_words(net_params[i]->count())));
+      ++pruned;
+    }
+    LOG(INFO) << pruned << " params pruned to 2:4 sparsity from iteration "
+              << this->param_.prune_start_iter();
+  }
+  groups_.clear();
+  param_groups_.assign(net_params.size(), -1);
+  std::map<string, int> group_ids;
+  for (const LRGroupParameter& g : this->param_.lr_group()) {
+    CHECK(!g.name().empty() && group_ids.count(g.name()) == 0)
+        << "lr_group needs a unique name";
+    group_ids[g.name()] = groups_.size();
+    groups_.push_back(GroupSchedule(this->param_, g));
+  }
+  group_steps_.assign(groups_.size(), 0);
+  group_rates_.assign(groups_.size(), 0.F);
+  const vector<string>& params_lr_group = this->net_->params_lr_group();
+  for (int i = 0; i < net_params.size(); ++i) {
+    if (!params_lr_group[i].empty()) {
+      auto it = group_ids.find(params_lr_group[i]);
+      CHECK(it != group_ids.end()) << "Param " << i << " has lr_group '"
+          << params_lr_group[i] << "' not defined by the solver";
+      param_groups_[i] = it->second;
+    }
+  }
+  CHECK(groups_.empty() || !this->param_.local_lr_auto())
+      << "lr_group: local_lr_auto rates take one solver rate";
+  schedule_iter_ = -1;
+  if (this->param_.clip_gradients() >= 0.F || this->param_.dynamic_loss_scale()) {
+    // Set up here, reduction threads only use them
+    sumsq_types_ = this->net_->learnable_types();
+    grad_sumsq_ = boost::make_shared<TBlob<float>>(vector<int>(1, 8));
+    if (sumsq_types_.size() > 1) {
+      types_barrier_.reset(new boost::barrier(sumsq_types_.size()));
+    }
+#ifndef CPU_ONLY
+    if (Caffe::mode() == Caffe::GPU) {
+      grad_sumsq_->mutable_gpu_data();
+      for (int i = 0; i < sumsq_types_.size(); ++i) {
+        CUDA_CHECK(cudaEventCreateWithFlags(&sumsq_ready_[i], cudaEventDisableTiming));
+      }
+    }
+#endif
+  }
 }
 
 template<typename Dtype>
-void SGDSolver<Dtype>::ClipGradients(void* handle) {
-  const float clip_gradients = this->param_.clip_gradients();
-  if (clip_gradients < 0) { return; }
+SGDSolver<Dtype>::~SGDSolver() {
+#ifndef CPU_ONLY
+  for (int i = 0; i < 2; ++i) {
+    if (sumsq_ready_[i] != nullptr) {
+      cudaEventDestroy(sumsq_ready_[i]);
+    }
+  }
+#endif
+}
+
+template<typename Dtype>
+void SGDSolver<Dtype>::InitMasterWeights(const vector<int>& param_ids) {
+  const vector<shared_ptr<Blob>>& net_params = this->net_->learnable_params();
+  for (int param_id : param_ids) {
+    if (master_[param_id] == nullptr || master_ready_[param_id]) {
+      continue;
+    }
+    // Converted once, the FLOAT16 copy is left current for the layers
+    shared_ptr<Blob> param = net_params[param_id];
+    caffe_copy(param->count(), param->template gpu_data<Dtype>(), master_[param_id]);
+    param->template gpu_data<float16>();
+    master_ready_[param_id] = 1;
+  }
+}
+
+template<typename Dtype>
+void SGDSolver<Dtype>::PublishMasterWeights() {
+  const vector<shared_ptr<Blob>>& net_params = this->net_->learnable_params();
+  for (int i = 0; i < master_.size(); ++i) {
+    if (master_[i] != nullptr && master_ready_[i]) {
+      caffe_copy(net_params[i]->count(), master_[i],
+          net_params[i]->template mutable_gpu_data<Dtype>());
+    }
+  }
+}
+
+template<typename Dtype>
+void SGDSolver<Dtype>::HalfHistoryPreSolve() {
+  if (!this->param_.has_history_data_type()) {
+    return;
+  }
+  const Type htype = this->param_.history_data_type();
+  CHECK(htype == FLOAT16 || htype == tp<Dtype>())
+      << "history_data_type " << Type_Name(htype) << " is not supported by "
+      << Type_Name(tp<Dtype>()) << " solvers";
+  if (htype == tp<Dtype>()) {
+    return;
+  }
+  if (Caffe::mode() != Caffe::GPU) {
+    LOG(WARNING) << "history_data_type FLOAT16 is ignored in CPU mode";
+    return;
+  }
+  // Only reshaped so far, no memory is allocated until first use
+  for (const shared_ptr<TBlob<Dtype>>& h : history_) {
+    history_half_.emplace_back(Blob::create(FLOAT16, FLOAT16));
+    history_half_.back()->Reshape(h->shape());
+  }
+  history_.clear();
+  LOG(INFO) << this->type() << " history stored in FLOAT16";
+}
+
+#ifndef CPU_ONLY
+template<typename Dtype>
+void weights_ema_multi_gpu(int num, const int* n, Dtype* const* w, Dtype* const* ema,
+    float decay, void* handle);
+#endif
+
+template<typename Dtype>
+void SGDSolver<Dtype>::UpdateWeightsEma(const vector<int>& param_ids, void* handle) {
+  const vector<shared_ptr<Blob>>& net_params = this->net_->learnable_params();
+  const float decay = this->param_.weights_ema_decay();
+  if (Caffe::mode() == Caffe::CPU) {
+    for (int param_id : param_ids) {
+      const int N = net_params[param_id]->count();
+      const Dtype* w = net_params[param_id]->cpu_data<Dtype>();
+      Dtype* ema = ema_[param_id]->mutable_cpu_data();
+      if (ema_ready_[param_id]) {
+        caffe_cpu_axpby<Dtype>(N, Dtype(1.F - decay), w, Dtype(decay), ema);
+      } else {
+        caffe_copy(N, w, ema);
+        ema_ready_[param_id] = 1;
+      }
+    }
+    return;
+  }
+#ifndef CPU_ONLY
+  vector<int> n;
+  vector<Dtype*> w, ema;
+  for (int param_id : param_ids) {
+    // The master copy is the one updated
+    Dtype* wi = !master_.empty() && master_[param_id] != nullptr ? master_[param_id] :
+        net_params[param_id]->template mutable_gpu_data<Dtype>();
+    if (!ema_ready_[param_id]) {
+      caffe_copy(net_params[param_id]->count(), wi, ema_[param_id]->mutable_gpu_data());
+      ema_ready_[param_id] = 1;
+      continue;
+    }
+    n.push_back(net_params[param_id]->count());
+    w.push_back(wi);
+    ema.push_back(ema_[param_id]->mutable_gpu_data());
+  }
+  if (!n.empty()) {
+    weights_ema_multi_gpu(n.size(), n.data(), w.data(), ema.data(), decay, handle);
+  }
+#else
+  NO_GPU;
+#endif
+}
+
+template<typename Dtype>
+vector<Blob*> SGDSolver<Dtype>::weights_ema() {
+  const vector<shared_ptr<Blob>>& net_params = this->net_->learnable_params();
+  vector<Blob*> blobs;
+  for (int i = 0; i < ema_.size(); ++i) {
+    blobs.push_back(ema_ready_[i] ? ema_[i].get() : net_params[i].get());
+  }
+  return blobs;
+}
+
+template<typename Dtype>
+bool SGDSolver<Dtype>::owns_history(int history_id) const {
+  return this->owns_param(history_id % this->net_->learnable_params().size());
+}
+
+template<typename Dtype>
+vector<Blob*> SGDSolver<Dtype>::history_blobs(int param_id) {
+  // Solvers keeping more than one entry per parameter append them (see AdamPreSolve)
+  const size_t params = this->net_->learnable_params().size();
+  vector<Blob*> blobs;
+  for (size_t i = param_id; i < history_size(); i += params) {
+    blobs.push_back(history_blob(i));
+  }
+  return blobs;
+}
+
+#ifndef CPU_ONLY
+template<typename Gtype>
+void multi_tensor_sumsq_gpu(int num, const int* n, const Gtype* const* g, float* sumsq,
+    bool per_tensor, void* handle);
+
+template<typename Gtype>
+void multi_tensor_scale_gpu(int num, const int* n, Gtype* const* g, const float* scale,
+    void* handle);
+
+void clip_gradients_scale_gpu(const float* sumsq, int parts, float grad_scale,
+    float clip_gradients, float* scale, void* handle);
+
+namespace {
+
+// Gradients of parameters sharing one diff type
+template<typename Gtype>
+void multi_tensor_diffs(const vector<shared_ptr<Blob>>& params, const vector<int>& param_ids,
+    vector<int>* n, vector<Gtype*>* g) {
+  for (int param_id : param_ids) {
+    n->push_back(params[param_id]->count());
+    g->push_back(params[param_id]->template mutable_gpu_diff<Gtype>());
+  }
+}
+
+template<typename Gtype>
+void sumsq_diffs(const vector<shared_ptr<Blob>>& params, const vector<int>& param_ids,
+    float* sumsq, void* handle) {
+  vector<int> n;
+  vector<Gtype*> g;
+  multi_tensor_diffs(params, param_ids, &n, &g);
+  multi_tensor_sumsq_gpu<Gtype>(param_ids.size(), n.data(), g.data(), sumsq, false, handle);
+}
+
+template<typename Gtype>
+void scale_diffs(const vector<shared_ptr<Blob>>& params, const vector<int>& param_ids,
+    const float* scale, void* handle) {
+  vector<int> n;
+  vector<Gtype*> g;
+  multi_tensor_diffs(params, param_ids, &n, &g);
+  multi_tensor_scale_gpu<Gtype>(param_ids.size(), n.data(), g.data(), scale, handle);
+}
+
+}  // namespace
+#endif
+
+template<typename Dtype>
+float* SGDSolver<Dtype>::GradientsSumsq(const vector<int>& param_ids, void* handle,
+    int* type_id) {
+#ifndef CPU_ONLY
+  const vector<shared_ptr<Blob>>& net_params = this->net_->learnable_params();
+  // Each reduction thread passes the gradients of its own type
+  const Type gtype = net_params[param_ids.front()]->diff_type();
+  *type_id = std::find(sumsq_types_.begin(), sumsq_types_.end(), (int) gtype)
+      - sumsq_types_.begin();
+  const int types = sumsq_types_.size();
+  CHECK_LT(*type_id, types);
+  cublasHandle_t cublas_handle =
+      handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
+  cudaStream_t stream;
+  CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
+  // Alternating halves: the other thread may still read ours of the previous iteration,
+  // but not of the one before, its stream is behind our last wait
+  float* sumsq = grad_sumsq_->mutable_gpu_data() + (this->iter_ & 1) * 4;
+  CUDA_CHECK(cudaMemsetAsync(sumsq + *type_id, 0, sizeof(float), stream));
+  if (gtype == tp<float16>()) {
+    sumsq_diffs<float16>(net_params, param_ids, sumsq + *type_id, cublas_handle);
+  } else if (gtype == tp<float>()) {
+    sumsq_diffs<float>(net_params, param_ids, sumsq + *type_id, cublas_handle);
+  } else if (gtype == tp<double>()) {
+    sumsq_diffs<double>(net_params, param_ids, sumsq + *type_id, cublas_handle);
+  } else {
+    LOG(FATAL) << "Gradient type " << Type_Name(gtype) << " is not supported";
+  }
+  if (types > 1) {
+    CUDA_CHECK(cudaEventRecord(sumsq_ready_[*type_id], stream));
+    types_barrier_->wait();
+    CUDA_CHECK(cudaStreamWaitEvent(stream, sumsq_ready_[1 - *type_id], 0));
+  }
+  return sumsq;
+#else
+  NO_GPU;
+  return nullptr;
+#endif
+}
+
+template<typename Dtype>
+bool SGDSolver<Dtype>::GradientsOverflow(const vector<int>& param_ids, const float* sumsq,
+    void* handle) {
   const vector<shared_ptr<Blob>>& net_params = this->net_->learnable_params();
   float sumsq_diff = 0.F;
-  for (int i = 0; i < net_params.size(); ++i) {
-    sumsq_diff += net_params[i]->sumsq_diff();
+  if (Caffe::mode() == Caffe::CPU) {
+    for (int param_id : param_ids) {
+      sumsq_diff += net_params[param_id]->sumsq_diff();
+    }
+  } else {
+#ifndef CPU_ONLY
+    // The one read back per iteration, both types are in
+    cublasHandle_t cublas_handle =
+        handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
+    cudaStream_t stream;
+    CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
+    float host[2] = {0.F, 0.F};
+    CUDA_CHECK(cudaMemcpyAsync(host, sumsq, sumsq_types_.size() * sizeof(float),
+        cudaMemcpyDeviceToHost, stream));
+    CUDA_CHECK(cudaStreamSynchronize(stream));
+    sumsq_diff = host[0] + host[1];
+#else
+    NO_GPU;
+#endif
   }
-  const float l2norm_diff = std::sqrt(sumsq_diff);
-  if (l2norm_diff > clip_gradients) {
-    float scale_factor = clip_gradients / l2norm_diff;
-    LOG(INFO) << "Gradient clipping: scaling down gradients (L2 norm " << l2norm_diff << " > "
-              << clip_gradients << ") " << "by scale factor " << scale_factor;
-    for (int i = 0; i < net_params.size(); ++i) {
-      net_params[i]->scale_diff(scale_factor, handle);
+  return !std::isfinite(sumsq_diff);
+}
+
+template<typename Dtype>
+const float* SGDSolver<Dtype>::ClipGradients(const vector<int>& param_ids, float grad_scale,
+    float* sumsq, int type_id, void* handle) {
+  const float clip_gradients = this->param_.clip_gradients();
+  if (clip_gradients < 0.F || param_ids.empty()) {
+    return nullptr;
+  }
+  const vector<shared_ptr<Blob>>& net_params = this->net_->learnable_params();
+  if (Caffe::mode() == Caffe::CPU) {
+    float sumsq_diff = 0.F;
+    for (int param_id : param_ids) {
+      sumsq_diff += net_params[param_id]->sumsq_diff();
+    }
+    const float l2norm_diff = grad_scale * std::sqrt(sumsq_diff);
+    if (l2norm_diff > clip_gradients) {
+      const float scale_factor = clip_gradients / l2norm_diff;
+      LOG(INFO) << "Gradient clipping: scaling down gradients (L2 norm " << l2norm_diff << " > "
+                << clip_gradients << ") " << "by scale factor " << scale_factor;
+      for (int param_id : param_ids) {
+        net_params[param_id]->scale_diff(scale_factor, handle);
+      }
     }
+    return nullptr;
   }
+#ifndef CPU_ONLY
+  float* scale = sumsq + 2 + type_id;
+  clip_gradients_scale_gpu(sumsq, sumsq_types_.size(), grad_scale, clip_gradients, scale,
+      handle);
+  if (type_id == 0 && Caffe::root_solver() && this->display()) {
+    // Read back once per display interval
+    cublasHandle_t cublas_handle =
+        handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
+    cudaStream_t stream;
+    CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
+    float scale_factor = 1.F;
+    CUDA_CHECK(cudaMemcpyAsync(&scale_factor, scale, sizeof(float), cudaMemcpyDeviceToHost,
+        stream));
+    CUDA_CHECK(cudaStreamSynchronize(stream));
+    if (scale_factor < 1.F) {
+      LOG(INFO) << "Gradient clipping: scaling down gradients (L2 norm "
+                << clip_gradients / scale_factor << " > " << clip_gradients << ") "
+                << "by scale factor " << scale_factor;
+    }
+  }
+  return scale;
+#else
+  NO_GPU;
+  return nullptr;
+#endif
 }
 
 template<typename Dtype>
@@ -143,8 +597,8 @@ void SGDSolver<Dtype>::PrintRate(float rate) {
 // Note: this is asynchronous call
 template<typename Dtype>
 void SGDSolver<Dtype>::ApplyUpdate(int param_id, void* handle, bool clear_grads) {
-  float rate = GetLearningRate();  // TODO take it out
-  ClipGradients(handle);
+  NVTX_RANGE(NVTX_SOLVER, "ApplyUpdate " + std::to_string(param_id));
+  float rate = GroupRate(param_id, GetLearningRate());
   Normalize(param_id, handle);
   Regularize(param_id, handle);
   ComputeUpdateValue(param_id, handle, rate, clear_grads);
@@ -199,7 +653,352 @@ void sgd_reg_update_all_and_clear_gpu(int N,
     Gtype* g, Wtype* w, Htype* h,
     float momentum, float local_rate, const std::string& regularization_type, float local_decay,
     void* handle, bool clear_grads);
+
+template<typename Gtype, typename Wtype, typename Htype>
+void sgd_reg_update_multi_gpu(int num, const int* n, Gtype* const* g, Wtype* const* w,
+    float16* const* model, Htype* const* h, const float* local_rates, const float* local_decays,
+    const float* local_rates_gpu, float momentum, float grad_scale, const float* clip_scale,
+    const std::string& regularization_type, void* handle, bool clear_grads);
+
+void sgd_lars_prepare_gpu(int num, const float* lr_mults, float* lars, void* handle);
+
+void sgd_lars_rates_gpu(int num, float* lars, float rate, float gw_ratio, float grad_scale,
+    const float* clip_scale, float* lars_host, void* handle);
+
+template<typename Gtype, typename Wtype, typename Htype>
+void sgd_sparse_update_gpu(int rows, int width, const int* row_ids, Gtype* g, Wtype* w,
+    Htype* h, float momentum, float local_rate, float grad_scale,
+    const std::string& regularization_type, float local_decay, void* handle, bool clear_grads);
+
+namespace {
+
+template<typename Gtype, typename Wtype, typename Htype>
+void sgd_multi_update(const vector<shared_ptr<Blob>>& net_params,
+    const vector<shared_ptr<TBlob<Htype>>>& history, const vector<int>& ids,
+    const vector<float>& rates, const vector<float>& decays, float momentum, float grad_scale,
+    const float* clip_scale, const std::string& regularization_type, void* handle,
+    bool clear_grads, TBlob<float>* lars, float rate, float gw_ratio, vector<float>* lars_host,
+    const vector<Wtype*>* master) {
+  vector<int> n;
+  vector<Gtype*> g;
+  vector<Wtype*> w;
+  vector<float16*> model;
+  vector<Htype*> h;
+  multi_tensor_params(net_params, ids, &n, &g, &w, master, &model);
+  multi_tensor_history(history, ids, 0UL, &h);
+  const int num = ids.size();
+  const float* lars_rates = nullptr;
+  if (lars != nullptr) {
+    // rates hold lr_mult here, the local rates are made on the device
+    lars->Reshape(vector<int>{4, num});
+    float* buf = lars->mutable_gpu_data();
+    if (lars_host != nullptr) {
+      lars_host->resize(4 * num);
+    }
+    sgd_lars_prepare_gpu(num, rates.data(), buf, handle);
+    multi_tensor_sumsq_gpu<Wtype>(num, n.data(), w.data(), buf + num, true, handle);
+    multi_tensor_sumsq_gpu<Gtype>(num, n.data(), g.data(), buf + 2 * num, true, handle);
+    sgd_lars_rates_gpu(num, buf, rate, gw_ratio, grad_scale, clip_scale,
+        lars_host != nullptr ? lars_host->data() : nullptr, handle);
+    lars_rates = buf + 3 * num;
+  }
+  sgd_reg_update_multi_gpu(num, n.data(), g.data(), w.data(),
+      master != nullptr ? model.data() : nullptr, h.data(), rates.data(), decays.data(),
+      lars_rates, momentum, grad_scale, clip_scale, regularization_type, handle, clear_grads);
+}
+
+}  // namespace
+#endif
+
+template<typename Dtype>
+void SGDSolver<Dtype>::ApplyUpdates(const vector<int>& param_ids, void* handle,
+    bool clear_grads, float grad_scale) {
+  NVTX_RANGE(NVTX_SOLVER, "ApplyUpdates " + std::to_string(param_ids.size()) + " params");
+  // local_lr_auto is always batched on GPU, norms per param would block. So are master
+  // weights, per param updates would step the FLOAT16 copies.
+  const bool fused = ((this->param_.multi_tensor_update() || this->param_.local_lr_auto())
+      && Caffe::mode() == Caffe::GPU && !this->param_.debug_info()) || !master_.empty();
+  // Lazy updates don't see the whole gradient, so they need the same conditions
+  const bool sparse = this->param_.clip_gradients() < 0.F && !this->param_.dynamic_loss_scale()
+      && !this->param_.local_lr_auto() && !this->param_.debug_info() && !this->sharded();
+  vector<int> dense_ids;
+  dense_ids.reserve(param_ids.size());
+  for (int param_id : param_ids) {
+    vector<int>* rows = this->net_->sparse_rows(param_id);
+    if (rows != nullptr) {
+      if (sparse && SparseUpdate(param_id, rows, handle,
+          GroupRate(param_id, GetLearningRate()),
+          grad_scale / this->param_.iter_size(), clear_grads)) {
+        continue;
+      }
+      rows->clear();
+    }
+    dense_ids.push_back(param_id);
+  }
+  // With clip_gradients or dynamic_loss_scale these are all the gradients of this type
+  // (see Net::ReduceAndUpdate), one sum of squares serves both
+  const bool clip = this->param_.clip_gradients() >= 0.F;
+  const bool dynamic = this->param_.dynamic_loss_scale();
+  float* sumsq = nullptr;
+  int type_id = 0;
+  if ((clip || dynamic) && !dense_ids.empty() && Caffe::mode() == Caffe::GPU) {
+    sumsq = GradientsSumsq(dense_ids, handle, &type_id);
+  }
+  if (dynamic && !dense_ids.empty() && GradientsOverflow(dense_ids, sumsq, handle)) {
+    // Skipped, the loss scale goes down in Solver::UpdateLossScale
+    this->grads_overflow_ = true;
+    if (clear_grads) {
+      for (int param_id : dense_ids) {
+        this->net_->learnable_params()[param_id]->set_diff(0.F);
+      }
+    }
+    return;
+  }
+  const float* clip_scale = ClipGradients(dense_ids, grad_scale, sumsq, type_id, handle);
+  if (!master_.empty()) {
+    InitMasterWeights(dense_ids);
+  }
+  // Normalize() is folded into the gradient scale
+  if (!fused || dense_ids.empty() || !MultiTensorUpdate(dense_ids, handle,
+      GetLearningRate(), grad_scale / this->param_.iter_size(), clip_scale, clear_grads)) {
+    CHECK(master_.empty() || dense_ids.empty())
+        << "master_weights: " << this->type() << " solver has no fused update";
+#ifndef CPU_ONLY
+    if (clip_scale != nullptr) {
+      const vector<shared_ptr<Blob>>& net_params = this->net_->learnable_params();
+      const Type gtype = net_params[dense_ids.front()]->diff_type();
+      if (gtype == tp<float16>()) {
+        scale_diffs<float16>(net_params, dense_ids, clip_scale, handle);
+      } else if (gtype == tp<float>()) {
+        scale_diffs<float>(net_params, dense_ids, clip_scale, handle);
+      } else {
+        scale_diffs<double>(net_params, dense_ids, clip_scale, handle);
+      }
+    }
+#endif
+    Solver::ApplyUpdates(dense_ids, handle, clear_grads, grad_scale);
+  }
+  if (!sparse_masks_.empty()) {
+    Prune(param_ids, handle);
+  }
+  if (!ema_.empty()) {
+    UpdateWeightsEma(param_ids, handle);
+  }
+}
+
+namespace {
+
+// Chooses the mask from the weights if choose, then zeroes the weights it drops
+template<typename T>
+void sparse_2_4_prune(int count, T* w, bool choose, TBlob<unsigned int>* mask,
+    void* handle) {
+  if (Caffe::mode() == Caffe::GPU) {
+#ifndef CPU_ONLY
+    if (choose) {
+      sparse_2_4_mask_gpu(count, w, mask->mutable_gpu_data(), handle);
+    }
+    sparse_2_4_apply_gpu(count, mask->gpu_data(), w, handle);
+#else
+    NO_GPU;
 #endif
+  } else {
+    if (choose) {
+      sparse_2_4_mask_cpu(count, w, mask->mutable_cpu_data());
+    }
+    sparse_2_4_apply_cpu(count, mask->cpu_data(), w);
+  }
+}
+
+template<typename T>
+void sparse_2_4_prune(Blob* param, bool choose, TBlob<unsigned int>* mask, void* handle) {
+  T* w = Caffe::mode() == Caffe::GPU ? param->template mutable_gpu_data<T>() :
+      param->template mutable_cpu_data<T>();
+  sparse_2_4_prune(param->count(), w, choose, mask, handle);
+}
+
+}  // namespace
+
+template<typename Dtype>
+void SGDSolver<Dtype>::Prune(const vector<int>& param_ids, void* handle) {
+  const int iter = this->iter_;
+  const int interval = this->param_.prune_interval();
+  if (iter < this->param_.prune_start_iter()) {
+    return;
+  }
+  const vector<shared_ptr<Blob>>& net_params = this->net_->learnable_params();
+  for (int param_id : param_ids) {
+    TBlob<unsigned int>* mask = sparse_masks_[param_id].get();
+    if (mask == nullptr) {
+      continue;
+    }
+    const int chosen = sparse_mask_iter_[param_id];
+    const bool choose = chosen < 0 || (interval > 0 && iter - chosen >= interval);
+    if (choose) {
+      sparse_mask_iter_[param_id] = iter;
+    }
+    Blob* param = net_params[param_id].get();
+    if (!master_.empty() && master_[param_id] != nullptr) {
+      // The master copy is the one updated, the FLOAT16 weights follow it
+      sparse_2_4_prune(param->count(), master_[param_id], choose, mask, handle);
+      sparse_2_4_prune<float16>(param, false, mask, handle);
+    } else if (param->data_type() == FLOAT16) {
+      sparse_2_4_prune<float16>(param, choose, mask, handle);
+    } else if (param->data_type() == FLOAT) {
+      sparse_2_4_prune<float>(param, choose, mask, handle);
+    } else {
+      sparse_2_4_prune<double>(param, choose, mask, handle);
+    }
+  }
+}
+
+template<typename Dtype>
+bool SGDSolver<Dtype>::SparseUpdate(int param_id, vector<int>* rows, void* handle,
+    float rate, float grad_scale, bool clear_grads) {
+  shared_ptr<Blob> param = this->net_->learnable_params()[param_id];
+  shared_ptr<TBlob<Dtype>> history = history_[param_id];
+  const int width = param->count(1);
+  const int n_rows = rows->size();
+  const float momentum = GetMomentum();
+  const float local_rate = std::min(rate, GetLocalRate(param_id));
+  const float decay = local_decay(param_id);
+  const std::string& reg_type = this->param_.regularization_type();
+  if (n_rows == 0) {
+    return true;
+  }
+  if (Caffe::mode() == Caffe::CPU) {
+    typedef typename std::conditional<std::is_same<Dtype, double>::value, double, float>::type A;
+    const bool reg_L2 = reg_type == "L2" || reg_type == "L2_unitary";
+    Dtype* g = param->mutable_cpu_diff<Dtype>();
+    Dtype* w = param->mutable_cpu_data<Dtype>();
+    Dtype* h = history->mutable_cpu_data();
+    for (int r = 0; r < n_rows; ++r) {
+      const int offset = (*rows)[r] * width;
+      for (int i = offset; i < offset + width; ++i) {
+        const A wa = w[i];
+        const A reg = reg_L2 ? wa : A((A(0) < wa) - (wa < A(0)));
+        const A gr = momentum * A(h[i]) + local_rate * (A(g[i]) * grad_scale + reg * decay);
+        h[i] = gr;
+        w[i] = wa - gr;
+        g[i] = clear_grads ? Dtype(0) : Dtype(gr);
+      }
+    }
+  } else if (Caffe::mode() == Caffe::GPU) {
+#ifndef CPU_ONLY
+    TBlob<int>* row_ids = sparse_rows_[param_id].get();
+    row_ids->Reshape(vector<int>(1, n_rows));
+    std::copy(rows->begin(), rows->end(), row_ids->mutable_cpu_data());
+    const int* rows_gpu = row_ids->gpu_data();
+    const Type wtype = param->data_type();
+    const Type gtype = param->diff_type();
+    if (gtype == tp<float16>()) {
+      sgd_sparse_update_gpu<float16, Dtype, Dtype>(n_rows, width, rows_gpu,
+          param->mutable_gpu_diff<float16>(), param->mutable_gpu_data<Dtype>(),
+          history->mutable_gpu_data(), momentum, local_rate, grad_scale, reg_type, decay,
+          handle, clear_grads);
+    } else if (gtype == tp<float>()) {
+      if (wtype == tp<float>()) {
+        sgd_sparse_update_gpu<float, float, Dtype>(n_rows, width, rows_gpu,
+            param->mutable_gpu_diff<float>(), param->mutable_gpu_data<float>(),
+            history->mutable_gpu_data(), momentum, local_rate, grad_scale, reg_type, decay,
+            handle, clear_grads);
+      } else {
+        sgd_sparse_update_gpu<float, Dtype, Dtype>(n_rows, width, rows_gpu,
+            param->mutable_gpu_diff<float>(), param->mutable_gpu_data<Dtype>(),
+            history->mutable_gpu_data(), momentum, local_rate, grad_scale, reg_type, decay,
+            handle, clear_grads);
+      }
+    } else if (gtype == tp<double>()) {
+      sgd_sparse_update_gpu<double, Dtype, Dtype>(n_rows, width, rows_gpu,
+          param->mutable_gpu_diff<double>(), param->mutable_gpu_data<Dtype>(),
+          history->mutable_gpu_data(), momentum, local_rate, grad_scale, reg_type, decay,
+          handle, clear_grads);
+    } else {
+      LOG(FATAL) << "Gradient type " << Type_Name(gtype) << " is not supported";
+    }
+#else
+    NO_GPU;
+#endif
+  } else {
+    LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+  }
+  rows->clear();
+  return true;
+}
+
+template<typename Dtype>
+bool SGDSolver<Dtype>::MultiTensorUpdate(const vector<int>& param_ids, void* handle,
+    float rate, float grad_scale, const float* clip_scale, bool clear_grads) {
+#ifndef CPU_ONLY
+  const vector<shared_ptr<Blob>>& net_params = this->net_->learnable_params();
+  const float momentum = GetMomentum();
+  const std::string& reg_type = this->param_.regularization_type();
+  const bool lars = this->param_.local_lr_auto();
+  // Same type dispatch as ComputeUpdateValue
+  vector<int> ids[4];
+  vector<float> rates[4], decays[4];
+  for (int param_id : param_ids) {
+    const Type wtype = net_params[param_id]->data_type();
+    const Type gtype = net_params[param_id]->diff_type();
+    int k = 0;
+    if (gtype == tp<float16>()) {
+      k = 0;
+    } else if (gtype == tp<float>()) {
+      k = wtype == tp<float>() ? 1 : 2;
+    } else if (gtype == tp<double>()) {
+      k = 3;
+    } else {
+      LOG(FATAL) << "Gradient type " << Type_Name(gtype) << " is not supported";
+    }
+    ids[k].push_back(param_id);
+    // local_lr_auto: lr_mult, the rates are computed on the device
+    rates[k].push_back(lars ? this->net_->params_lr()[param_id]
+                            : std::min(GroupRate(param_id, rate), GetLocalRate(param_id)));
+    decays[k].push_back(local_decay(param_id));
+  }
+  const float gw_ratio = this->param_.local_gw_ratio();
+  // Logged at display iterations from the copy made after the rates
+  const bool lars_log = lars && Caffe::root_solver() && this->display();
+  vector<float> lars_host[4];
+  if (!ids[0].empty()) {
+    sgd_multi_update<float16, Dtype, Dtype>(net_params, history_, ids[0], rates[0], decays[0],
+        momentum, grad_scale, clip_scale, reg_type, handle, clear_grads,
+        lars ? lars_[0].get() : nullptr, rate, gw_ratio, lars_log ? &lars_host[0] : nullptr,
+        master_weights());
+  }
+  if (!ids[1].empty()) {
+    sgd_multi_update<float, float, Dtype>(net_params, history_, ids[1], rates[1], decays[1],
+        momentum, grad_scale, clip_scale, reg_type, handle, clear_grads,
+        lars ? lars_[1].get() : nullptr, rate, gw_ratio, lars_log ? &lars_host[1] : nullptr,
+        nullptr);
+  }
+  if (!ids[2].empty()) {
+    sgd_multi_update<float, Dtype, Dtype>(net_params, history_, ids[2], rates[2], decays[2],
+        momentum, grad_scale, clip_scale, reg_type, handle, clear_grads,
+        lars ? lars_[2].get() : nullptr, rate, gw_ratio, lars_log ? &lars_host[2] : nullptr,
+        master_weights());
+  }
+  if (!ids[3].empty()) {
+    sgd_multi_update<double, Dtype, Dtype>(net_params, history_, ids[3], rates[3], decays[3],
+        momentum, grad_scale, clip_scale, reg_type, handle, clear_grads,
+        lars ? lars_[3].get() : nullptr, rate, gw_ratio, lars_log ? &lars_host[3] : nullptr,
+        master_weights());
+  }
+  // multi_tensor_apply synchronized the stream
+  for (int k = 0; lars_log && k < 4; ++k) {
+    const int num = ids[k].size();
+    for (int i = 0; i < num; ++i) {
+      const int layer_id = this->net_->param_layer_indices(ids[k][i]).first;
+      const int blob_id = this->net_->param_layer_indices(ids[k][i]).second;
+      LOG(INFO) << this->net_->layer_names()[layer_id] << "." << blob_id << " local lr="
+                << lars_host[k][3 * num + i] << " \t  w=" << std::sqrt(lars_host[k][num + i])
+                << "\t dw=" << std::sqrt(lars_host[k][2 * num + i]) * grad_scale;
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
+}
 
 
 template<typename Dtype>
@@ -340,6 +1139,9 @@ void SGDSolver<Dtype>::SnapshotSolverState(const string& model_filename) {
     case caffe::SolverParameter_SnapshotFormat_HDF5:
       SnapshotSolverStateToHDF5(model_filename);
       break;
+    case caffe::SolverParameter_SnapshotFormat_SHARDED:
+      SnapshotSolverStateSharded();
+      break;
     default:
       LOG(FATAL) << "Unsupported snapshot format.";
   }
@@ -347,41 +1149,286 @@ void SGDSolver<Dtype>::SnapshotSolverState(const string& model_filename) {
 
 template<typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverStateToBinaryProto(const string& model_filename) {
-  SolverState state;
-  state.set_iter(this->iter_);
-  state.set_learned_net(model_filename);
-  state.set_current_step(this->current_step_);
-  state.clear_history();
-  for (int i = 0; i < history_.size(); ++i) {
+  shared_ptr<SolverState> state = make_shared<SolverState>();
+  state->set_iter(this->iter_);
+  if (!model_filename.empty()) {
+    state->set_learned_net(model_filename);
+  }
+  state->set_current_step(this->current_step_);
+  if (this->param_.dynamic_loss_scale()) {
+    state->set_loss_scale(this->net_->global_grad_scale());
+    state->set_loss_scale_clean_iters(this->loss_scale_clean_iters_);
+  }
+  state->clear_history();
+  for (int i = 0; i < history_size(); ++i) {
     // Add history
-    BlobProto* history_blob = state.add_history();
+    BlobProto* history_proto = state->add_history();
+    if (!owns_history(i)) {
+      continue;  // left empty, another shard has it
+    }
     TBlob<Dtype> history;
-    history.CopyDataFrom(*history_[i], true);
-    history.ToProto(history_blob, param().store_blobs_in_old_format());
+    history.CopyDataFrom(*history_blob(i), true);
+    history.ToProto(history_proto, param().store_blobs_in_old_format());
   }
-  string snapshot_filename = Solver::SnapshotFilename(".solverstate");
+  for (int i = 0; i < ema_.size(); ++i) {
+    BlobProto* ema_proto = state->add_weights_ema();
+    if (ema_ready_[i]) {
+      ema_[i]->ToProto(ema_proto, param().store_blobs_in_old_format());
+    }
+  }
+  string snapshot_filename = this->ShardFilename(Solver::SnapshotFilename(".solverstate"));
   LOG(INFO) << "Snapshotting solver state to binary proto file " << snapshot_filename;
-  WriteProtoToBinaryFile(state, snapshot_filename.c_str());
+  this->snapshot_writer_->Write(snapshot_filename, [state](const string& path) {
+    WriteProtoToBinaryFile(*state, path.c_str());
+  });
 }
 
 template<typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverStateToHDF5(const string& model_filename) {
-  string snapshot_filename = Solver::SnapshotFilename(".solverstate.h5");
+  string snapshot_filename =
+      this->ShardFilename(Solver::SnapshotFilename(".solverstate.h5"));
   LOG(INFO) << "Snapshotting solver state to HDF5 file " << snapshot_filename;
-  hid_t file_hid = H5Fcreate(snapshot_filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
-  CHECK_GE(file_hid, 0) << "Couldn't open " << snapshot_filename << " to save solver state.";
-  hdf5_save_int(file_hid, "iter", this->iter_);
-  hdf5_save_string(file_hid, "learned_net", model_filename);
-  hdf5_save_int(file_hid, "current_step", this->current_step_);
-  hid_t history_hid = H5Gcreate2(file_hid, "history", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
-  CHECK_GE(history_hid, 0) << "Error saving solver state to " << snapshot_filename << ".";
-  for (int i = 0; i < history_.size(); ++i) {
-    ostringstream oss;
-    oss << i;
-    hdf5_save_nd_dataset(history_hid, oss.str(), *history_[i]);
+  // Empty where another shard owns it
+  vector<shared_ptr<Blob>> history(history_size());
+  for (int i = 0; i < history_size(); ++i) {
+    if (owns_history(i)) {
+      if (this->snapshot_writer_->async()) {
+        history[i] = SnapshotWriter::HostCopy(*history_blob(i), false);
+      } else if (half_history()) {
+        history[i] = history_half_[i];
+      } else {
+        history[i] = history_[i];
+      }
+    }
   }
-  H5Gclose(history_hid);
-  H5Fclose(file_hid);
+  const int iter = this->iter_, current_step = this->current_step_;
+  // Not started ones are left out
+  vector<shared_ptr<Blob>> ema(ema_.size());
+  for (int i = 0; i < ema_.size(); ++i) {
+    if (ema_ready_[i]) {
+      ema[i] = this->snapshot_writer_->async() ?
+          SnapshotWriter::HostCopy(*ema_[i], false) : ema_[i];
+    }
+  }
+  // Negative without dynamic_loss_scale
+  const float loss_scale =
+      this->param_.dynamic_loss_scale() ? this->net_->global_grad_scale() : -1.F;
+  const int clean_iters = this->loss_scale_clean_iters_;
+  this->snapshot_writer_->Write(snapshot_filename, [history, ema, iter, current_step,
+      loss_scale, clean_iters, model_filename](const string& path) {
+    hid_t file_hid = H5Fcreate(path.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    CHECK_GE(file_hid, 0) << "Couldn't open " << path << " to save solver state.";
+    hdf5_save_int(file_hid, "iter", iter);
+    if (!model_filename.empty()) {
+      hdf5_save_string(file_hid, "learned_net", model_filename);
+    }
+    hdf5_save_int(file_hid, "current_step", current_step);
+    if (loss_scale > 0.F) {
+      const hsize_t dims[1] = {1};
+      CHECK_GE(H5LTmake_dataset_float(file_hid, "loss_scale", 1, dims, &loss_scale), 0)
+          << "Failed to save loss_scale to " << path;
+      hdf5_save_int(file_hid, "loss_scale_clean_iters", clean_iters);
+    }
+    hid_t history_hid = H5Gcreate2(file_hid, "history", H5P_DEFAULT, H5P_DEFAULT,
+        H5P_DEFAULT);
+    CHECK_GE(history_hid, 0) << "Error saving solver state to " << path << ".";
+    for (int i = 0; i < history.size(); ++i) {
+      if (!history[i]) {
+        continue;
+      }
+      ostringstream oss;
+      oss << i;
+      hdf5_save_nd_dataset(history_hid, oss.str(), *history[i]);
+    }
+    H5Gclose(history_hid);
+    if (!ema.empty()) {
+      hid_t ema_hid = H5Gcreate2(file_hid, "weights_ema", H5P_DEFAULT, H5P_DEFAULT,
+          H5P_DEFAULT);
+      CHECK_GE(ema_hid, 0) << "Error saving solver state to " << path << ".";
+      for (int i = 0; i < ema.size(); ++i) {
+        if (ema[i]) {
+          hdf5_save_nd_dataset(ema_hid, std::to_string(i), *ema[i]);
+        }
+      }
+      H5Gclose(ema_hid);
+    }
+    H5Fclose(file_hid);
+  });
+}
+
+template<typename Dtype>
+int SGDSolver<Dtype>::snapshot_shard(int param_id) const {
+  // Weights are the same everywhere, unsharded solvers take turns
+  return this->sharded() ? this->shard_owner(param_id) : param_id % Caffe::solver_count();
+}
+
+template<typename Dtype>
+void SGDSolver<Dtype>::SnapshotSolverStateSharded() {
+  const string dir = Solver::SnapshotFilename(".snapshot");
+  if (mkdir(dir.c_str(), 0755) != 0) {
+    CHECK_EQ(errno, EEXIST) << "Failed to create " << dir << ": " << std::strerror(errno);
+  }
+  const int rank = this->global_rank();
+  const bool async = this->snapshot_writer_->async();
+  const vector<shared_ptr<Blob>>& params = this->net_->learnable_params();
+  // The root solver describes every tensor, the others only write theirs
+  shared_ptr<SnapshotManifest> manifest;
+  if (rank == 0) {
+    manifest = make_shared<SnapshotManifest>();
+    manifest->set_iter(this->iter_);
+    manifest->set_current_step(this->current_step_);
+    if (this->param_.dynamic_loss_scale()) {
+      manifest->set_loss_scale(this->net_->global_grad_scale());
+      manifest->set_loss_scale_clean_iters(this->loss_scale_clean_iters_);
+    }
+    manifest->set_shards(Caffe::solver_count());
+  }
+  vector<std::tuple<string, int, shared_ptr<Blob>>> tensors;
+  auto add = [&](const string& kind, int id, const vector<int>& shape, Type type, int shard,
+      const shared_ptr<Blob>& blob) {
+    if (manifest) {
+      SnapshotManifest::Entry* entry = manifest->add_entry();
+      entry->set_kind(kind);
+      entry->set_id(id);
+      for (int dim : shape) {
+        entry->mutable_shape()->add_dim(dim);
+      }
+      entry->set_type(type);
+      entry->set_shard(shard);
+    }
+    if (shard == rank) {
+      tensors.emplace_back(kind, id, async ? SnapshotWriter::HostCopy(*blob, false) : blob);
+    }
+  };
+  for (int i = 0; i < params.size(); ++i) {
+    add("param", i, params[i]->shape(), params[i]->data_type(), snapshot_shard(i), params[i]);
+  }
+  // Shaped as their params, not allocated where not owned
+  const Type htype = half_history() ? FLOAT16 : tp<Dtype>();
+  for (int i = 0; i < history_size(); ++i) {
+    const int param_id = i % params.size();
+    shared_ptr<Blob> history;
+    if (half_history()) {
+      history = history_half_[i];
+    } else {
+      history = history_[i];
+    }
+    add("history", i, params[param_id]->shape(), htype, snapshot_shard(param_id), history);
+  }
+  for (int i = 0; i < ema_.size(); ++i) {
+    if (ema_ready_[i]) {
+      add("ema", i, ema_[i]->shape(), ema_[i]->data_type(), 0, ema_[i]);
+    }
+  }
+  const string shard_filename = dir + "/shard" + std::to_string(rank);
+  LOG(INFO) << "Snapshotting " << tensors.size() << " tensors to " << shard_filename;
+  this->snapshot_writer_->Write(shard_filename, [tensors](const string& path) {
+    WeightFileWriter writer(path, true);
+    for (const std::tuple<string, int, shared_ptr<Blob>>& t : tensors) {
+      writer.Add(std::get<0>(t), std::get<1>(t), *std::get<2>(t));
+    }
+    writer.Close();
+  });
+  if (manifest) {
+    this->snapshot_writer_->Write(dir + "/manifest", [manifest](const string& path) {
+      WriteProtoToBinaryFile(*manifest, path.c_str());
+    });
+  }
+  this->snapshot_writer_->AddDirectory(dir);
+}
+
+template<typename Dtype>
+void SGDSolver<Dtype>::RestoreSolverStateFromShards(const string& dir) {
+  SnapshotManifest manifest;
+  ReadProtoFromBinaryFile(dir + "/manifest", &manifest);
+  this->iter_ = manifest.iter();
+  Caffe::set_restored_iter(this->iter_);
+  std::fill(master_ready_.begin(), master_ready_.end(), 0);
+  std::fill(sparse_mask_iter_.begin(), sparse_mask_iter_.end(), -1);
+  this->current_step_ = manifest.current_step();
+  if (manifest.has_loss_scale() && this->param_.dynamic_loss_scale()) {
+    this->net_->set_global_grad_scale(manifest.loss_scale());
+    this->loss_scale_clean_iters_ = manifest.loss_scale_clean_iters();
+  }
+  const vector<shared_ptr<Blob>>& params = this->net_->learnable_params();
+  // Weights go to the root solver only, the others get them from it
+  const bool root = Caffe::root_solver();
+  // Shards are mapped when first needed, whichever solver wrote them
+  struct Shard {
+    shared_ptr<WeightFile> file;
+    std::map<std::pair<string, int>, int> tensors;
+  };
+  std::map<int, Shard> shards;
+  auto load = [&](const SnapshotManifest::Entry& entry, Blob* blob) {
+    CHECK_LT(entry.shard(), manifest.shards()) << "Corrupted manifest in " << dir;
+    Shard& shard = shards[entry.shard()];
+    const string filename = dir + "/shard" + std::to_string(entry.shard());
+    if (!shard.file) {
+      shard.file = make_shared<WeightFile>(filename);
+      for (int i = 0; i < shard.file->index().tensor_size(); ++i) {
+        const WeightIndex::Tensor& t = shard.file->index().tensor(i);
+        shard.tensors[std::make_pair(t.layer(), t.blob_id())] = i;
+      }
+    }
+    auto it = shard.tensors.find(std::make_pair(entry.kind(), entry.id()));
+    CHECK(it != shard.tensors.end()) << entry.kind() << " " << entry.id()
+        << " is missing from " << filename;
+    const WeightIndex::Tensor& tensor = shard.file->index().tensor(it->second);
+    const vector<int> shape(tensor.shape().dim().begin(), tensor.shape().dim().end());
+    CHECK(shape == blob->shape()) << "Cannot restore " << entry.kind() << " " << entry.id()
+        << ", shape mismatch: " << tensor.shape().ShortDebugString() << " in " << filename
+        << ", " << blob->shape_string() << " expected";
+    CHECK_EQ(tensor.bytes(),
+        WeightFile::StoredBytes(blob->count(), tensor.type(), tensor.sparse_2_4()))
+        << "Corrupted " << entry.kind() << " " << entry.id() << " in " << filename;
+    CHECK(shard.file->Verify(tensor)) << "Checksum mismatch of " << entry.kind() << " "
+        << entry.id() << " in " << filename;
+    if (blob->count() == 0) {
+      return;
+    }
+    if (tensor.type() != blob->data_type() || tensor.sparse_2_4()) {
+      shared_ptr<Blob> source = Blob::create(tensor.type(), tensor.type());
+      source->Reshape(shape);
+      shard.file->Read(tensor, source->current_mutable_data_memory(false));
+      blob->CopyDataFrom(*source, true);
+      return;
+    }
+#ifndef CPU_ONLY
+    if (Caffe::mode() == Caffe::GPU) {
+      caffe_gpu_upload(tensor.bytes(), shard.file->data(tensor),
+          blob->current_mutable_data_memory(true));
+      return;
+    }
+#endif
+    caffe_parallel_memcpy(tensor.bytes(), shard.file->data(tensor),
+        blob->current_mutable_data_memory(false));
+  };
+  std::fill(ema_ready_.begin(), ema_ready_.end(), 0);
+  int history_entries = 0;
+  for (const SnapshotManifest::Entry& entry : manifest.entry()) {
+    const int id = entry.id();
+    if (entry.kind() == "param") {
+      CHECK_LT(id, params.size()) << "Incompatible number of params in " << dir;
+      if (root) {
+        load(entry, params[id].get());
+      }
+    } else if (entry.kind() == "history") {
+      CHECK_LT(id, history_size()) << "Incorrect length of history blobs in " << dir;
+      ++history_entries;
+      // Own history as sharded now, which needn't be as when written
+      if (owns_history(id)) {
+        load(entry, history_blob(id));
+      }
+    } else if (entry.kind() == "ema") {
+      if (id < ema_.size()) {
+        load(entry, ema_[id].get());
+        ema_ready_[id] = 1;
+      }
+    }
+  }
+  CHECK_EQ(history_entries, history_size()) << "Incorrect length of history blobs in " << dir;
+  LOG(INFO) << "Restored " << (root ? "weights and " : "") << "solver state from "
+      << shards.size() << " of " << manifest.shards() << " shards in " << dir;
 }
 
 template<typename Dtype>
@@ -395,11 +1442,26 @@ void SGDSolver<Dtype>::RestoreSolverStateFromBinaryProto(const string& state_fil
     ReadNetParamsFromBinaryFileOrDie(state.learned_net().c_str(), &net_param);
     this->net_->CopyTrainedLayersFrom(net_param);
   }
+  std::fill(master_ready_.begin(), master_ready_.end(), 0);
+  std::fill(sparse_mask_iter_.begin(), sparse_mask_iter_.end(), -1);
   this->current_step_ = state.current_step();
-  CHECK_EQ(state.history_size(), history_.size()) << "Incorrect length of history blobs.";
+  if (state.has_loss_scale() && this->param_.dynamic_loss_scale()) {
+    this->net_->set_global_grad_scale(state.loss_scale());
+    this->loss_scale_clean_iters_ = state.loss_scale_clean_iters();
+  }
+  CHECK_EQ(state.history_size(), history_size()) << "Incorrect length of history blobs.";
   LOG(INFO) << "SGDSolver: restoring history";
-  for (int i = 0; i < history_.size(); ++i) {
-    history_[i]->FromProto(state.history(i));
+  for (int i = 0; i < history_size(); ++i) {
+    if (owns_history(i)) {
+      history_blob(i)->FromProto(state.history(i));
+    }
+  }
+  // Started again from the weights if the state has none
+  for (int i = 0; i < ema_.size(); ++i) {
+    ema_ready_[i] = i < state.weights_ema_size() && state.weights_ema(i).has_shape();
+    if (ema_ready_[i]) {
+      ema_[i]->FromProto(state.weights_ema(i));
+    }
   }
 }
 
@@ -413,17 +1475,44 @@ void SGDSolver<Dtype>::RestoreSolverStateFromHDF5(const string& state_file) {
     string learned_net = hdf5_load_string(file_hid, "learned_net");
     this->net_->CopyTrainedLayersFrom(learned_net);
   }
+  std::fill(master_ready_.begin(), master_ready_.end(), 0);
+  std::fill(sparse_mask_iter_.begin(), sparse_mask_iter_.end(), -1);
   this->current_step_ = hdf5_load_int(file_hid, "current_step");
+  if (H5LTfind_dataset(file_hid, "loss_scale") && this->param_.dynamic_loss_scale()) {
+    float loss_scale = 0.F;
+    CHECK_GE(H5LTread_dataset_float(file_hid, "loss_scale", &loss_scale), 0)
+        << "Failed to read loss_scale from " << state_file;
+    this->net_->set_global_grad_scale(loss_scale);
+    this->loss_scale_clean_iters_ = hdf5_load_int(file_hid, "loss_scale_clean_iters");
+  }
   hid_t history_hid = H5Gopen2(file_hid, "history", H5P_DEFAULT);
   CHECK_GE(history_hid, 0) << "Error reading history from " << state_file;
   int state_history_size = hdf5_get_num_links(history_hid);
-  CHECK_EQ(state_history_size, history_.size()) << "Incorrect length of history blobs.";
-  for (int i = 0; i < history_.size(); ++i) {
+  if (!this->sharded()) {
+    CHECK_EQ(state_history_size, history_size()) << "Incorrect length of history blobs.";
+  }
+  for (int i = 0; i < history_size(); ++i) {
+    if (!owns_history(i)) {
+      continue;
+    }
     ostringstream oss;
     oss << i;
-    hdf5_load_nd_dataset(history_hid, oss.str().c_str(), 0, kMaxBlobAxes, history_[i].get());
+    hdf5_load_nd_dataset(history_hid, oss.str().c_str(), 0, kMaxBlobAxes, history_blob(i));
   }
   H5Gclose(history_hid);
+  std::fill(ema_ready_.begin(), ema_ready_.end(), 0);
+  if (!ema_.empty() && H5Lexists(file_hid, "weights_ema", H5P_DEFAULT)) {
+    hid_t ema_hid = H5Gopen2(file_hid, "weights_ema", H5P_DEFAULT);
+    CHECK_GE(ema_hid, 0) << "Error reading weights_ema from " << state_file;
+    for (int i = 0; i < ema_.size(); ++i) {
+      const string name = std::to_string(i);
+      if (H5Lexists(ema_hid, name.c_str(), H5P_DEFAULT)) {
+        hdf5_load_nd_dataset(ema_hid, name.c_str(), 0, kMaxBlobAxes, ema_[i].get());
+        ema_ready_[i] = 1;
+      }
+    }
+    H5Gclose(ema_hid);
+  }
   H5Fclose(file_hid);
 }
 
@@ -1,8 +1,10 @@
 #include <string>
+#include <vector>
 #include <device_launch_parameters.h>
 
 #include "caffe/util/gpu_math_functions.cuh"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
 
 namespace caffe {
 
@@ -75,6 +77,244 @@ __global__ void SGDRegUpdateAllAndClear<half, float, float>(int N,
   }
 }
 
+struct SGDMultiOp {
+  float momentum, grad_scale;
+  const float* clip_scale;
+  bool reg_L2, clear_grads;
+
+  template<typename Gtype, typename Wtype, typename Htype>
+  __device__ void operator()(Gtype& g, Wtype& w, Htype& h, Htype&, float local_rate,
+      float local_decay) const {
+    typedef typename MultiTensorAcc<Wtype>::type A;
+    const A wa = mt_load<A>(w);
+    const A reg = reg_L2 ? wa : A((A(0) < wa) - (wa < A(0)));
+    const float gs = clip_scale == nullptr ? grad_scale : grad_scale * *clip_scale;
+    A gr = mt_load<A>(g) * gs + reg * local_decay;
+    gr = momentum * mt_load<A>(h) + local_rate * gr;
+    h = mt_store<Htype>(gr);
+    w = mt_store<Wtype>(wa - gr);
+    g = clear_grads ? mt_store<Gtype>(A(0)) : mt_store<Gtype>(gr);
+  }
+};
+
+template<typename Gtype, typename Wtype, typename Htype>
+void sgd_reg_update_multi_gpu(int num, const int* n, Gtype* const* g, Wtype* const* w,
+    float16* const* model, Htype* const* h, const float* local_rates, const float* local_decays,
+    const float* local_rates_gpu, float momentum, float grad_scale, const float* clip_scale,
+    const std::string& reg_type, void* handle, bool clear_grads) {
+  cublasHandle_t cublas_handle =
+      handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
+  cudaStream_t stream;
+  CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
+  const SGDMultiOp op{momentum, grad_scale, clip_scale,
+      (reg_type == "L2") || (reg_type == "L2_unitary"), clear_grads};
+  multi_tensor_apply(num, n, g, w, h, static_cast<Htype* const*>(nullptr), local_rates,
+      local_decays, op, stream, local_rates_gpu, model);
+}
+
+#define INSTANTIATE_SGD_MULTI(Gtype, Wtype, Htype) \
+template void sgd_reg_update_multi_gpu<Gtype, Wtype, Htype>(int, const int*, \
+    Gtype* const*, Wtype* const*, float16* const*, Htype* const*, const float*, const float*, \
+    const float*, float, float, const float*, const std::string&, void*, bool)
+
+INSTANTIATE_SGD_MULTI(float16, float, float);
+INSTANTIATE_SGD_MULTI(float16, double, double);
+INSTANTIATE_SGD_MULTI(float16, float16, float16);
+INSTANTIATE_SGD_MULTI(float, float, float);
+INSTANTIATE_SGD_MULTI(float, float, double);
+INSTANTIATE_SGD_MULTI(float, float, float16);
+INSTANTIATE_SGD_MULTI(float, double, double);
+INSTANTIATE_SGD_MULTI(float, float16, float16);
+INSTANTIATE_SGD_MULTI(double, float, float);
+INSTANTIATE_SGD_MULTI(double, double, double);
+INSTANTIATE_SGD_MULTI(double, float16, float16);
+
+template<typename Gtype>
+void multi_tensor_sumsq_gpu(int num, const int* n, const Gtype* const* g, float* sumsq,
+    bool per_tensor, void* handle) {
+  cublasHandle_t cublas_handle =
+      handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
+  cudaStream_t stream;
+  CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
+  multi_tensor_sumsq(num, n, g, sumsq, stream, per_tensor);
+}
+
+template<typename Gtype>
+void multi_tensor_scale_gpu(int num, const int* n, Gtype* const* g, const float* scale,
+    void* handle) {
+  cublasHandle_t cublas_handle =
+      handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
+  cudaStream_t stream;
+  CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
+  multi_tensor_scale(num, n, g, scale, stream);
+}
+
+template void multi_tensor_sumsq_gpu<float16>(int, const int*, const float16* const*, float*,
+    bool, void*);
+template void multi_tensor_sumsq_gpu<float>(int, const int*, const float* const*, float*, bool,
+    void*);
+template void multi_tensor_sumsq_gpu<double>(int, const int*, const double* const*, float*,
+    bool, void*);
+template void multi_tensor_scale_gpu<float16>(int, const int*, float16* const*, const float*,
+    void*);
+template void multi_tensor_scale_gpu<float>(int, const int*, float* const*, const float*, void*);
+template void multi_tensor_scale_gpu<double>(int, const int*, double* const*, const float*,
+    void*);
+
+// SolverParameter::weights_ema_decay: blends w into h, g is w and left alone
+struct WeightsEmaOp {
+  float decay;
+
+  template<typename Gtype, typename Wtype, typename Htype>
+  __device__ void operator()(Gtype&, Wtype& w, Htype& h, Htype&, float, float) const {
+    typedef typename MultiTensorAcc<Wtype>::type A;
+    h = mt_store<Htype>(mt_load<A>(h) * decay + mt_load<A>(w) * (A(1) - decay));
+  }
+};
+
+template<typename Dtype>
+void weights_ema_multi_gpu(int num, const int* n, Dtype* const* w, Dtype* const* ema,
+    float decay, void* handle) {
+  cublasHandle_t cublas_handle =
+      handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
+  cudaStream_t stream;
+  CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
+  const std::vector<float> unused(num, 0.F);
+  multi_tensor_apply(num, n, w, w, ema, static_cast<Dtype* const*>(nullptr), unused.data(),
+      unused.data(), WeightsEmaOp{decay}, stream);
+}
+
+template void weights_ema_multi_gpu<float16>(int, const int*, float16* const*,
+    float16* const*, float, void*);
+template void weights_ema_multi_gpu<float>(int, const int*, float* const*, float* const*, float,
+    void*);
+template void weights_ema_multi_gpu<double>(int, const int*, double* const*, double* const*,
+    float, void*);
+
+// SolverParameter::local_lr_auto. The rows of lars are lr_mult, sum of squares of weights
+// and of gradients, then the local rates, one column per param.
+void sgd_lars_prepare_gpu(int num, const float* lr_mults, float* lars, void* handle) {
+  cublasHandle_t cublas_handle =
+      handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
+  cudaStream_t stream;
+  CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
+  CUDA_CHECK(cudaMemcpyAsync(lars, lr_mults, num * sizeof(float), cudaMemcpyHostToDevice,
+      stream));
+  CUDA_CHECK(cudaMemsetAsync(lars + num, 0, 2 * num * sizeof(float), stream));
+}
+
+__global__ void SGDLarsRates(int num, float* lars, float rate, float gw_ratio,
+    float grad_scale, const float* clip_scale) {
+  CUDA_KERNEL_LOOP(t, num) {
+    const float w_norm = sqrtf(lars[num + t]);
+    float wgrad_norm = sqrtf(lars[2 * num + t]) * grad_scale;
+    if (clip_scale != nullptr) {
+      wgrad_norm *= *clip_scale;
+    }
+    const float lr_mult = lars[t];
+    float local_lr = 1.F;
+    if (w_norm > 0.F && wgrad_norm > 0.F) {
+      local_lr = gw_ratio * w_norm / wgrad_norm;
+    }
+    lars[3 * num + t] = fminf(rate, lr_mult > 0.F ? local_lr : lr_mult);
+  }
+}
+
+// lars_host, if not nullptr, receives a copy once the stream gets there
+void sgd_lars_rates_gpu(int num, float* lars, float rate, float gw_ratio, float grad_scale,
+    const float* clip_scale, float* lars_host, void* handle) {
+  cublasHandle_t cublas_handle =
+      handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
+  cudaStream_t stream;
+  CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  SGDLarsRates<<<CAFFE_GET_BLOCKS(num), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(num, lars, rate,
+      gw_ratio, grad_scale, clip_scale);
+  CUDA_POST_KERNEL_CHECK;
+  if (lars_host != nullptr) {
+    CUDA_CHECK(cudaMemcpyAsync(lars_host, lars, 4 * num * sizeof(float), cudaMemcpyDeviceToHost,
+        stream));
+  }
+}
+
+// Single thread: sums of squares of all learnable types to the clipping factor
+__global__ void ClipGradientsScale(const float* sumsq, int parts, float grad_scale,
+    float clip_gradients, float* scale) {
+  float s = 0.F;
+  for (int i = 0; i < parts; ++i) {
+    s += sumsq[i];
+  }
+  const float l2norm = grad_scale * sqrtf(s);
+  *scale = l2norm > clip_gradients ? clip_gradients / l2norm : 1.F;
+}
+
+void clip_gradients_scale_gpu(const float* sumsq, int parts, float grad_scale,
+    float clip_gradients, float* scale, void* handle) {
+  cublasHandle_t cublas_handle =
+      handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
+  cudaStream_t stream;
+  CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  ClipGradientsScale<<<1, 1, 0, stream>>>(sumsq, parts, grad_scale, clip_gradients, scale);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template<typename Gtype, typename Wtype, typename Htype>
+__global__ void SGDSparseRowsUpdate(int N, int width, const int* rows, Gtype* g, Wtype* w,
+    Htype* h, float momentum, float local_rate, float grad_scale, float local_decay,
+    bool reg_L2, bool clear_grads) {
+  typedef typename MultiTensorType<Gtype>::type G;
+  typedef typename MultiTensorType<Wtype>::type W;
+  typedef typename MultiTensorType<Htype>::type H;
+  typedef typename MultiTensorAcc<W>::type A;
+  G* gm = reinterpret_cast<G*>(g);
+  W* wm = reinterpret_cast<W*>(w);
+  H* hm = reinterpret_cast<H*>(h);
+  CUDA_KERNEL_LOOP(k, N) {
+    const int i = rows[k / width] * width + k % width;
+    const A wa = mt_load<A>(wm[i]);
+    const A reg = reg_L2 ? wa : A((A(0) < wa) - (wa < A(0)));
+    A gr = mt_load<A>(gm[i]) * grad_scale + reg * local_decay;
+    gr = momentum * mt_load<A>(hm[i]) + local_rate * gr;
+    hm[i] = mt_store<H>(gr);
+    wm[i] = mt_store<W>(wa - gr);
+    gm[i] = clear_grads ? mt_store<G>(A(0)) : mt_store<G>(gr);
+  }
+}
+
+template<typename Gtype, typename Wtype, typename Htype>
+void sgd_sparse_update_gpu(int rows, int width, const int* row_ids, Gtype* g, Wtype* w,
+    Htype* h, float momentum, float local_rate, float grad_scale,
+    const std::string& reg_type, float local_decay, void* handle, bool clear_grads) {
+  cublasHandle_t cublas_handle =
+      handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
+  cudaStream_t stream;
+  CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
+  const int N = rows * width;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  SGDSparseRowsUpdate<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, width,
+      row_ids, g, w, h, momentum, local_rate, grad_scale, local_decay,
+      (reg_type == "L2") || (reg_type == "L2_unitary"), clear_grads);
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+}
+
+#define INSTANTIATE_SGD_SPARSE(Gtype, Wtype, Htype) \
+template void sgd_sparse_update_gpu<Gtype, Wtype, Htype>(int, int, const int*, \
+    Gtype*, Wtype*, Htype*, float, float, float, const std::string&, float, void*, bool)
+
+INSTANTIATE_SGD_SPARSE(float16, float, float);
+INSTANTIATE_SGD_SPARSE(float16, double, double);
+INSTANTIATE_SGD_SPARSE(float16, float16, float16);
+INSTANTIATE_SGD_SPARSE(float, float, float);
+INSTANTIATE_SGD_SPARSE(float, float, double);
+INSTANTIATE_SGD_SPARSE(float, float, float16);
+INSTANTIATE_SGD_SPARSE(float, double, double);
+INSTANTIATE_SGD_SPARSE(float, float16, float16);
+INSTANTIATE_SGD_SPARSE(double, float, float);
+INSTANTIATE_SGD_SPARSE(double, double, double);
+INSTANTIATE_SGD_SPARSE(double, float16, float16);
+
 template<typename Gtype, typename Wtype, typename Htype>
 void sgd_reg_update_all_and_clear_gpu(int N,
   Gtype* g, Wtype* w, Htype* h,
@@ -2,22 +2,28 @@
 #include "caffe/syncedmem.hpp"
 #include "caffe/type.hpp"
 #include "caffe/util/gpu_memory.hpp"
+#include "caffe/util/host_memory_pool.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #define MAX_ELEM_TO_SHOW 20UL
 
 namespace caffe {
 
+std::atomic<size_t> SyncedMemory::host_memory_use_(0UL);
+bool SyncedMemory::release_host_mirrors_ = getenv("CAFFE_RELEASE_HOST_MIRRORS") != nullptr;
+
 // If CUDA is available and in GPU mode, host memory will be allocated pinned,
 // using cudaMallocHost. It avoids dynamic pinning for transfers (DMA).
 // The improvement in performance seems negligible in the single GPU case,
 // but might be more significant for parallel training. Most importantly,
 // it improved stability for large models on many GPUs.
+// Pinned buffers come from HostMemoryPool, mirrors are allocated on first CPU access.
 void SyncedMemory::MallocHost(void** ptr, size_t size, bool* use_cuda) {
+  host_memory_use_ += size;
 #ifndef CPU_ONLY
   if (Caffe::mode() == Caffe::GPU) {
-    shared_lock<shared_mutex> lock(GPUMemory::read_write_mutex());
-    CUDA_CHECK(cudaMallocHost(ptr, size));
+    // Calls the driver only when the pool misses
+    *ptr = HostMemoryPool::Allocate(size);
     *use_cuda = true;
     return;
   }
@@ -27,10 +33,11 @@ void SyncedMemory::MallocHost(void** ptr, size_t size, bool* use_cuda) {
   CHECK(*ptr) << "host allocation of size " << size << " failed";
 }
 
-void SyncedMemory::FreeHost(void* ptr, bool use_cuda) {
+void SyncedMemory::FreeHost(void* ptr, size_t size, bool use_cuda) {
+  host_memory_use_ -= size;
 #ifndef CPU_ONLY
   if (use_cuda) {
-    CUDA_CHECK(cudaFreeHost(ptr));
+    HostMemoryPool::Free(ptr, size);
     return;
   }
 #endif
@@ -39,10 +46,7 @@ void SyncedMemory::FreeHost(void* ptr, bool use_cuda) {
 
 SyncedMemory::~SyncedMemory() {
   if (cpu_ptr_ && own_cpu_data_) {
-#ifndef CPU_ONLY
-    shared_lock<shared_mutex> lock(GPUMemory::read_write_mutex());
-#endif
-    FreeHost(cpu_ptr_, cpu_malloc_use_cuda_);
+    FreeHost(cpu_ptr_, size_, cpu_malloc_use_cuda_);
   }
 #ifndef CPU_ONLY
   if (gpu_ptr_ && own_gpu_data_) {
@@ -129,7 +133,7 @@ const void* SyncedMemory::cpu_data() {
 void SyncedMemory::set_cpu_data(void* data) {
   CHECK(data);
   if (own_cpu_data_) {
-    FreeHost(cpu_ptr_, cpu_malloc_use_cuda_);
+    FreeHost(cpu_ptr_, size_, cpu_malloc_use_cuda_);
   }
   cpu_ptr_ = data;
   head_ = HEAD_AT_CPU;
@@ -170,6 +174,12 @@ void* SyncedMemory::mutable_gpu_data(bool copy_from_cpu) {
 #ifndef CPU_ONLY
   to_gpu(copy_from_cpu);
   head_ = HEAD_AT_GPU;
+  if (release_host_mirrors_ && cpu_ptr_ && own_cpu_data_ && !pushed_async_) {
+    // The mirror is stale now and most blobs are never read on host again
+    FreeHost(cpu_ptr_, size_, cpu_malloc_use_cuda_);
+    cpu_ptr_ = nullptr;
+    own_cpu_data_ = false;
+  }
   return gpu_ptr_;
 #else
   NO_GPU;
@@ -185,6 +195,7 @@ void SyncedMemory::async_gpu_push() {
     own_gpu_data_ = true;
   }
   CHECK_EQ(Caffe::current_device(), device_);
+  pushed_async_ = true;
   const cudaMemcpyKind put = cudaMemcpyHostToDevice;
   CUDA_CHECK(cudaMemcpyAsync(gpu_ptr_, cpu_ptr_, size_, put,
       Caffe::th_stream_aux(Caffe::STREAM_ID_ASYNC_PUSH)));
@@ -192,6 +203,50 @@ void SyncedMemory::async_gpu_push() {
   validate();
   head_ = SYNCED;
 }
+
+bool SyncedMemory::async_cpu_pull(cudaStream_t stream) {
+  if (head_ != HEAD_AT_GPU && head_ != SYNCED) {
+    return false;
+  }
+  if (cpu_ptr_ == NULL) {
+    MallocHost(&cpu_ptr_, size_, &cpu_malloc_use_cuda_);
+    own_cpu_data_ = true;
+  }
+  CHECK_EQ(Caffe::current_device(), device_);
+  pushed_async_ = true;
+  CUDA_CHECK(cudaMemcpyAsync(cpu_ptr_, gpu_ptr_, size_, cudaMemcpyDeviceToHost, stream));
+  head_ = SYNCED;
+  return true;
+}
+
+void SyncedMemory::advise_on_device() {
+  if (gpu_ptr_ && own_gpu_data_) {
+    GPUMemory::advise_on_device(gpu_ptr_, size_, device_);
+  }
+}
+
+void SyncedMemory::prefetch_gpu(cudaStream_t stream) {
+  if (gpu_ptr_ && own_gpu_data_ && (head_ == HEAD_AT_GPU || head_ == SYNCED)) {
+    GPUMemory::prefetch(gpu_ptr_, size_, stream, device_);
+  }
+}
+
+bool SyncedMemory::relocate_gpu() {
+  if (!gpu_ptr_ || !own_gpu_data_ || device_ != GPUMemory::current_device()) {
+    return false;
+  }
+  return GPUMemory::relocate(&gpu_ptr_, pstream_, device_);
+}
+
+void SyncedMemory::release_gpu() {
+  CHECK(head_ == SYNCED || head_ == HEAD_AT_CPU);
+  if (gpu_ptr_ && own_gpu_data_) {
+    GPUMemory::deallocate(gpu_ptr_, device_);
+    gpu_ptr_ = NULL;
+    own_gpu_data_ = false;
+  }
+  head_ = HEAD_AT_CPU;
+}
 #endif
 
 std::string SyncedMemory::to_string(int indent, Type type) {  // debug helper
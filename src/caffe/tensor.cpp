@@ -1,10 +1,17 @@
+#include <cstdlib>
 #include <memory>
+#include <sstream>
 #include <vector>
 
 #include "caffe/tensor.hpp"
 
 namespace caffe {
 
+std::atomic<uint64_t> Tensor::conversions_[Type_ARRAYSIZE][Type_ARRAYSIZE];
+std::atomic<uint64_t> Tensor::conversion_bytes_[Type_ARRAYSIZE][Type_ARRAYSIZE];
+std::atomic<uint64_t> Tensor::batched_conversions_(0UL);
+std::atomic<uint64_t> Tensor::batch_launches_(0UL);
+
 Tensor::Tensor(Type dtype)
     : type_(dtype),
       synced_arrays_(make_shared<vector<shared_ptr<SyncedMemory>>>(Type_ARRAYSIZE)),
@@ -54,6 +61,13 @@ void Tensor::Reshape(int count, bool safe_reshape) {
   count_ = count;
 }
 
+void Tensor::release() {
+  for (size_t i = 0; i < synced_arrays_->size(); ++i) {
+    synced_arrays_->at(i).reset();
+  }
+  synced_arrays_->at(type_) = make_shared<SyncedMemory>(even(alloc_count_) * tsize(type_));
+}
+
 void Tensor::convert(Type new_type) {
   if (new_type == type_) {
     return;
@@ -77,12 +91,148 @@ void Tensor::convert(Type new_type) {
           type_,
           data_gpu ? new_mem->mutable_gpu_data(false) : new_mem->mutable_cpu_data(false),
           new_type);
+      count_conversion(type_, new_type, count_, false);
     }
   } // we just trust its current status otherwise
   type_ = new_type;
   new_mem->validate();
 }
 
+#ifndef CPU_ONLY
+namespace {
+
+template<typename T, typename TR>
+void gpu_convert_batch_typed(const vector<const void*>& in, const vector<void*>& out,
+    const vector<unsigned int>& counts) {
+  caffe_gpu_convert_batch(in.size(), reinterpret_cast<const T* const*>(in.data()),
+      reinterpret_cast<TR* const*>(out.data()), counts.data());
+}
+
+bool is_batched_type(Type type) {
+  return is_type<float>(type) || is_type<float16>(type) || is_type<double>(type);
+}
+
+template<typename T>
+void gpu_convert_batch_to(Type dst_type, const vector<const void*>& in,
+    const vector<void*>& out, const vector<unsigned int>& counts) {
+  if (is_type<float>(dst_type)) {
+    gpu_convert_batch_typed<T, float>(in, out, counts);
+  } else if (is_type<float16>(dst_type)) {
+    gpu_convert_batch_typed<T, float16>(in, out, counts);
+  } else {
+    gpu_convert_batch_typed<T, double>(in, out, counts);
+  }
+}
+
+// Types differ and both pass is_batched_type()
+void gpu_convert_batch(Type src_type, Type dst_type, const vector<const void*>& in,
+    const vector<void*>& out, const vector<unsigned int>& counts) {
+  if (is_type<float>(src_type)) {
+    gpu_convert_batch_to<float>(dst_type, in, out, counts);
+  } else if (is_type<float16>(src_type)) {
+    gpu_convert_batch_to<float16>(dst_type, in, out, counts);
+  } else {
+    gpu_convert_batch_to<double>(dst_type, in, out, counts);
+  }
+}
+
+}  // namespace
+#endif
+
+void Tensor::convert_batch(const vector<Tensor*>& tensors, Type new_type) {
+#ifndef CPU_ONLY
+  if (Caffe::mode() == Caffe::GPU && is_batched_type(new_type)) {
+    // Tensors needing an actual conversion, grouped by their current type
+    vector<vector<Tensor*>> pending(Type_ARRAYSIZE);
+    for (Tensor* t : tensors) {
+      if (t->type_ == new_type) {
+        continue;
+      }
+      const shared_ptr<SyncedMemory>& mem = t->synced_arrays_->at(new_type);
+      if ((!mem || !mem->is_valid()) && is_batched_type(t->type_) && !t->is_empty()
+          && t->is_current_valid()) {
+        pending[t->type_].push_back(t);
+      }
+    }
+    for (int src = 0; src < Type_ARRAYSIZE; ++src) {
+      for (size_t begin = 0UL; begin < pending[src].size(); begin += CAFFE_CONVERT_BATCH) {
+        const size_t end = std::min(pending[src].size(), begin + CAFFE_CONVERT_BATCH);
+        vector<const void*> in;
+        vector<void*> out;
+        vector<unsigned int> counts;
+        for (size_t i = begin; i < end; ++i) {
+          Tensor* t = pending[src][i];
+#ifdef DEBUG
+          CHECK(!t->frozen_);
+#endif
+          shared_ptr<SyncedMemory>& new_mem = t->synced_arrays_->at(new_type);
+          const std::size_t new_cap = even(t->count_) * tsize(new_type);
+          if (!new_mem || new_mem->size() < new_cap) {
+            new_mem = make_shared<SyncedMemory>(new_cap);
+          }
+          in.push_back(t->synced_mem()->gpu_data());
+          out.push_back(new_mem->mutable_gpu_data(false));
+          counts.push_back(t->count_);
+        }
+        gpu_convert_batch((Type) src, new_type, in, out, counts);
+        ++batch_launches_;
+        for (size_t i = begin; i < end; ++i) {
+          Tensor* t = pending[src][i];
+          count_conversion(t->type_, new_type, t->count_, true);
+          t->type_ = new_type;
+          t->synced_arrays_->at(new_type)->validate();
+        }
+      }
+    }
+  }
+#endif
+  // Already converted, empty or not batched types
+  for (Tensor* t : tensors) {
+    t->convert(new_type);
+  }
+}
+
+void Tensor::count_conversion(Type src_type, Type dst_type, int count, bool batched) {
+  ++conversions_[src_type][dst_type];
+  conversion_bytes_[src_type][dst_type] += tsize(dst_type) * count;
+  if (batched) {
+    ++batched_conversions_;
+  }
+}
+
+std::string Tensor::conversion_report() {
+  std::ostringstream os;
+  uint64_t total = 0UL, total_bytes = 0UL;
+  for (int src = 0; src < Type_ARRAYSIZE; ++src) {
+    for (int dst = 0; dst < Type_ARRAYSIZE; ++dst) {
+      const uint64_t n = conversions_[src][dst].load();
+      if (n > 0UL) {
+        const uint64_t bytes = conversion_bytes_[src][dst].load();
+        os << " " << Type_Name((Type) src) << "->" << Type_Name((Type) dst) << ": " << n
+           << " (" << bytes << " bytes)";
+        total += n;
+        total_bytes += bytes;
+      }
+    }
+  }
+  std::ostringstream report;
+  report << "Tensor conversions: " << total << " (" << total_bytes << " bytes), "
+         << batched_conversions_.load() << " of them in " << batch_launches_.load()
+         << " batched launches." << os.str();
+  return report.str();
+}
+
+void Tensor::reset_conversion_stats() {
+  for (int src = 0; src < Type_ARRAYSIZE; ++src) {
+    for (int dst = 0; dst < Type_ARRAYSIZE; ++dst) {
+      conversions_[src][dst] = 0UL;
+      conversion_bytes_[src][dst] = 0UL;
+    }
+  }
+  batched_conversions_ = 0UL;
+  batch_launches_ = 0UL;
+}
+
 void Tensor::copy_helper(bool use_gpu, int count, const void* p_src, Type src_type,
     void* p_dst, Type dst_type) {
   bool failed = false;
@@ -100,6 +250,9 @@ void Tensor::copy_helper(bool use_gpu, int count, const void* p_src, Type src_ty
     else if (is_type<double>(dst_type)) {  // FP32 -> FP64
       caffe_convert(use_gpu, count, static_cast<const float*>(p_src),
           static_cast<double*>(p_dst));
+    } else if (is_type<int>(dst_type)) {  // FP32 -> INT
+      caffe_convert(use_gpu, count, static_cast<const float*>(p_src),
+          static_cast<int*>(p_dst));
     } else {
       failed = true;
     }
@@ -115,6 +268,9 @@ void Tensor::copy_helper(bool use_gpu, int count, const void* p_src, Type src_ty
     } else if (is_type<double>(dst_type)) {  // FP16 -> FP64
       caffe_convert(use_gpu, count, static_cast<const float16*>(p_src),
           static_cast<double*>(p_dst));
+    } else if (is_type<int>(dst_type)) {  // FP16 -> INT
+      caffe_convert(use_gpu, count, static_cast<const float16*>(p_src),
+          static_cast<int*>(p_dst));
     } else {
       failed = true;
     }
@@ -134,13 +290,34 @@ void Tensor::copy_helper(bool use_gpu, int count, const void* p_src, Type src_ty
     else if (is_type<double>(dst_type)) {  // FP64 -> FP64
       caffe_copy(count, static_cast<const double*>(p_src),
           static_cast<double*>(p_dst));
+    } else if (is_type<int>(dst_type)) {  // FP64 -> INT
+      caffe_convert(use_gpu, count, static_cast<const double*>(p_src),
+          static_cast<int*>(p_dst));
+    } else {
+      failed = true;
+    }
+  } else if (is_type<int>(src_type)) {
+    // Labels, see DataParameter::label_type, for layers reading them as math types
+    if (is_type<int>(dst_type)) {  // INT -> INT
+      caffe_copy(count, static_cast<const int*>(p_src), static_cast<int*>(p_dst));
+    } else if (is_type<float>(dst_type)) {  // INT -> FP32
+      caffe_convert(use_gpu, count, static_cast<const int*>(p_src),
+          static_cast<float*>(p_dst));
+    }
+#ifndef CPU_ONLY
+    else if (is_type<float16>(dst_type)) {  // INT -> FP16
+      caffe_convert(use_gpu, count, static_cast<const int*>(p_src),
+          static_cast<float16*>(p_dst));
+    }
+#endif
+    else if (is_type<double>(dst_type)) {  // INT -> FP64
+      caffe_convert(use_gpu, count, static_cast<const int*>(p_src),
+          static_cast<double*>(p_dst));
     } else {
       failed = true;
     }
   } else if (is_type<unsigned int>(src_type) && is_type<unsigned int>(dst_type)) {
     caffe_copy(count, static_cast<const unsigned int*>(p_src), static_cast<unsigned int*>(p_dst));
-  } else if (is_type<int>(src_type) && is_type<int>(dst_type)) {
-    caffe_copy(count, static_cast<const int*>(p_src), static_cast<int*>(p_dst));
   } else {
     failed = true;
   }
@@ -204,6 +381,13 @@ float Tensor::asum() const {
   if (!mem || count_ <= 0) {
     return asum;
   }
+  if (is_type<int>(type_)) {  // labels are few, summed on host
+    const int* data = static_cast<const int*>(mem->cpu_data());
+    for (int i = 0; i < count_; ++i) {
+      asum += static_cast<float>(std::abs(data[i]));
+    }
+    return asum;
+  }
   if (Caffe::mode() == Caffe::GPU) {
 #ifndef CPU_ONLY
     if (is_type<float>(type_)) {
@@ -270,6 +454,17 @@ size_t Tensor::gpu_memory_use(bool own_only) const {
   }
   return ret;
 }
+
+size_t Tensor::relocate_gpu() const {
+  size_t ret = 0ULL;
+  for (size_t i = 0; i < synced_arrays_->size(); ++i) {
+    const shared_ptr<SyncedMemory>& mem = synced_arrays_->at(i);
+    if (mem && mem->relocate_gpu()) {
+      ret += mem->size();
+    }
+  }
+  return ret;
+}
 #endif
 
 std::string Tensor::to_string(int indent) const {  // debug helper
@@ -340,3 +340,28 @@ TYPED_TEST(AccuracyLayerTest, TestForwardCPUPerClassWithIgnoreLabel) {
 }
 
 }  // namespace caffe
+
+#ifndef CPU_ONLY
+TYPED_TEST(AccuracyLayerTest, TestForwardGPUMatchesCPU) {
+  LayerParameter layer_param;
+  const TypeParam kIgnoreLabelValue = -1;
+  layer_param.mutable_accuracy_param()->set_ignore_label(kIgnoreLabelValue);
+  layer_param.mutable_accuracy_param()->set_top_k(this->top_k_);
+  this->blob_bottom_label_->mutable_cpu_data()[7] = kIgnoreLabelValue;
+  this->blob_bottom_label_->mutable_cpu_data()[41] = kIgnoreLabelValue;
+  AccuracyLayer<TypeParam, TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_per_class_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_per_class_vec_);
+  const float accuracy = this->blob_top_->data_at(0, 0, 0, 0);
+  vector<float> per_class(this->blob_top_per_class_->count());
+  for (int i = 0; i < per_class.size(); ++i) {
+    per_class[i] = this->blob_top_per_class_->cpu_data()[i];
+  }
+  Caffe::set_mode(Caffe::GPU);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_per_class_vec_);
+  EXPECT_FLOAT_EQ(accuracy, this->blob_top_->data_at(0, 0, 0, 0));
+  for (int i = 0; i < per_class.size(); ++i) {
+    EXPECT_FLOAT_EQ(per_class[i], this->blob_top_per_class_->cpu_data()[i]);
+  }
+}
+#endif
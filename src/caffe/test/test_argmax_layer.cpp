@@ -340,4 +340,33 @@ TYPED_TEST(ArgMaxLayerTest, TestCPUAxisMaxValTopK) {
   }
 }
 
+#ifndef CPU_ONLY
+TYPED_TEST(ArgMaxLayerTest, TestGPU) {
+  // Long rows take a block each, short ones a thread each
+  const int axes[] = {-5, 1, -1};  // -5: no axis
+  for (int axis : axes) {
+    for (int out_max_val = 0; out_max_val < 2; ++out_max_val) {
+      LayerParameter layer_param;
+      ArgMaxParameter* argmax_param = layer_param.mutable_argmax_param();
+      if (axis != -5) {
+        argmax_param->set_axis(axis);
+      }
+      argmax_param->set_top_k(this->top_k_);
+      argmax_param->set_out_max_val(out_max_val);
+      ArgMaxLayer<TypeParam, TypeParam> layer(layer_param);
+      Caffe::set_mode(Caffe::CPU);
+      layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      vector<TypeParam> expected(this->blob_top_->cpu_data(),
+          this->blob_top_->cpu_data() + this->blob_top_->count());
+      Caffe::set_mode(Caffe::GPU);
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      for (int i = 0; i < expected.size(); ++i) {
+        EXPECT_EQ(expected[i], this->blob_top_->cpu_data()[i]) << "axis " << axis << " at " << i;
+      }
+    }
+  }
+}
+#endif
+
 }  // namespace caffe
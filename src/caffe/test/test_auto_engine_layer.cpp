@@ -0,0 +1,139 @@
+#ifdef USE_CUDNN
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/auto_engine_layer.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/util/cudnn_algo_cache.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class AutoEngineLayerTest : public GPUDeviceTest<Dtype> {
+ protected:
+  AutoEngineLayerTest()
+      : blob_bottom_(new TBlob<Dtype>(2, 3, 12, 10)),
+        blob_top_(new TBlob<Dtype>()),
+        blob_top_ref_(new TBlob<Dtype>()) {}
+
+  virtual void SetUp() {
+    Caffe::set_random_seed(1701);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    blob_top_ref_vec_.push_back(blob_top_ref_);
+    MakeTempFilename(&cache_file_);
+  }
+
+  virtual ~AutoEngineLayerTest() {
+    CuDNNAlgoCache::Reset(cache_file_);
+    std::remove(cache_file_.c_str());
+    delete blob_bottom_;
+    delete blob_top_;
+    delete blob_top_ref_;
+  }
+
+  LayerParameter layer_param(const std::string& type) const {
+    LayerParameter param;
+    param.set_type(type);
+    param.set_forward_type(tp<Dtype>());
+    param.set_backward_type(tp<Dtype>());
+    param.set_forward_math(tp<Dtype>());
+    param.set_backward_math(tp<Dtype>());
+    param.set_engine_cache_file(cache_file_);
+    return param;
+  }
+
+  // Forward and backward passes until the trials are over
+  void RunTrials(AutoEngineLayer<Dtype, Dtype>* layer) {
+    const vector<bool> propagate_down(1, true);
+    for (int pass = 0; pass <= 2 * (AutoEngineLayer<Dtype, Dtype>::kTrialPasses + 1);
+         ++pass) {
+      layer->Forward(blob_bottom_vec_, blob_top_vec_);
+      caffe_gpu_set(blob_top_->count(), Dtype(1), blob_top_->mutable_gpu_diff());
+      layer->Backward(blob_top_vec_, propagate_down, blob_bottom_vec_);
+    }
+  }
+
+  TBlob<Dtype>* const blob_bottom_;
+  TBlob<Dtype>* const blob_top_;
+  TBlob<Dtype>* const blob_top_ref_;
+  vector<Blob*> blob_bottom_vec_;
+  vector<Blob*> blob_top_vec_;
+  vector<Blob*> blob_top_ref_vec_;
+  std::string cache_file_;
+};
+
+TYPED_TEST_CASE(AutoEngineLayerTest, TestDtypes);
+
+TYPED_TEST(AutoEngineLayerTest, TestConvolutionMatchesCaffe) {
+  typedef TypeParam Dtype;
+  LayerParameter param = this->layer_param("Convolution");
+  ConvolutionParameter* conv_param = param.mutable_convolution_param();
+  conv_param->add_kernel_size(3);
+  conv_param->add_stride(2);
+  conv_param->set_num_output(4);
+  conv_param->set_engine(ConvolutionParameter_Engine_AUTO);
+  conv_param->mutable_weight_filler()->set_type("gaussian");
+  conv_param->mutable_bias_filler()->set_type("gaussian");
+  AutoEngineLayer<Dtype, Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_LT(layer.winner(), 0);
+  ConvolutionLayer<Dtype, Dtype> reference(param);
+  reference.SetUp(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+  ASSERT_EQ(layer.blobs().size(), reference.blobs().size());
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    reference.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  reference.Forward(this->blob_bottom_vec_, this->blob_top_ref_vec_);
+  // Every pass of either engine gives the same output
+  const Dtype epsilon = tol<Dtype>(1.e-4, 2.e-2);
+  for (int pass = 0; pass < 2 * (AutoEngineLayer<Dtype, Dtype>::kTrialPasses + 2); ++pass) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    ASSERT_EQ(this->blob_top_->count(), this->blob_top_ref_->count());
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(this->blob_top_->cpu_data()[i], this->blob_top_ref_->cpu_data()[i],
+          epsilon);
+    }
+  }
+  EXPECT_GE(layer.winner(), 0);
+}
+
+TYPED_TEST(AutoEngineLayerTest, TestPickIsCached) {
+  typedef TypeParam Dtype;
+  LayerParameter param = this->layer_param("Pooling");
+  PoolingParameter* pooling_param = param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_AVE);
+  pooling_param->set_engine(PoolingParameter_Engine_AUTO);
+  AutoEngineLayer<Dtype, Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  this->RunTrials(&layer);
+  ASSERT_GE(layer.winner(), 0);
+
+  param.set_name("other");
+  AutoEngineLayer<Dtype, Dtype> cached(param);
+  cached.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(layer.winner(), cached.winner());
+
+  // Other shapes run the trials again
+  this->blob_bottom_->Reshape(2, 3, 8, 8);
+  AutoEngineLayer<Dtype, Dtype> reshaped(param);
+  reshaped.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_LT(reshaped.winner(), 0);
+}
+
+}  // namespace caffe
+#endif  // USE_CUDNN
@@ -146,6 +146,114 @@ namespace caffe {
         this->blob_top_vec_);
   }
 
+  TYPED_TEST(BatchNormLayerTest, TestFusedReluInplace) {
+    typedef typename TypeParam::Dtype Dtype;
+    const float slope = 0.1F;
+    LayerParameter layer_param;
+    BatchNormParameter* bn_param = layer_param.mutable_batch_norm_param();
+    bn_param->mutable_scale_filler()->set_value(1.5);
+    bn_param->mutable_bias_filler()->set_value(0.5);
+    // Reference: BatchNorm, then ReLU
+    BatchNormLayer<Dtype, Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    TBlob<Dtype> blob_inplace(5, 2, 3, 4);
+    blob_inplace.CopyFrom(*this->blob_bottom_);
+    vector<Blob*> blob_inplace_vec(1, &blob_inplace);
+    bn_param->set_fused_relu(true);
+    bn_param->set_relu_negative_slope(slope);
+    BatchNormLayer<Dtype, Dtype> fused_layer(layer_param);
+    fused_layer.SetUp(blob_inplace_vec, blob_inplace_vec);
+    fused_layer.Forward(blob_inplace_vec, blob_inplace_vec);
+    const int count = blob_inplace.count();
+    const float kErrorBound = tol<Dtype>(1e-4F, 2e-2F);
+    for (int i = 0; i < count; ++i) {
+      const float z = this->blob_top_->cpu_data()[i];
+      EXPECT_NEAR(z > 0.F ? z : z * slope, blob_inplace.cpu_data()[i], kErrorBound);
+    }
+    // Backward recovers what the reference kept
+    TBlob<Dtype> top_diff(5, 2, 3, 4);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&top_diff);
+    for (int i = 0; i < count; ++i) {
+      const float z = this->blob_top_->cpu_data()[i];
+      const float dy = top_diff.cpu_data()[i];
+      blob_inplace.mutable_cpu_diff()[i] = top_diff.cpu_data()[i];
+      this->blob_top_->mutable_cpu_diff()[i] = Dtype(z > 0.F ? dy : dy * slope);
+    }
+    const vector<bool> propagate_down(1, true);
+    layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+    fused_layer.Backward(blob_inplace_vec, propagate_down, blob_inplace_vec);
+    for (int i = 0; i < count; ++i) {
+      EXPECT_NEAR(this->blob_bottom_->cpu_diff()[i], blob_inplace.cpu_diff()[i],
+          tol<Dtype>(1e-3F, 5e-2F));
+    }
+    for (int b = 3; b < 5; ++b) {
+      for (int c = 0; c < 2; ++c) {
+        EXPECT_NEAR(layer.blobs()[b]->template cpu_diff<float>()[c],
+            fused_layer.blobs()[b]->template cpu_diff<float>()[c], tol<Dtype>(1e-3F, 2e-1F));
+      }
+    }
+  }
+
+  TYPED_TEST(BatchNormLayerTest, TestFusedReluGradient) {
+    typedef typename TypeParam::Dtype Dtype;
+    LayerParameter layer_param;
+    BatchNormParameter* bn_param = layer_param.mutable_batch_norm_param();
+    bn_param->mutable_scale_filler()->set_value(1);
+    bn_param->mutable_bias_filler()->set_value(0);
+    bn_param->set_fused_relu(true);
+    BatchNormLayer<Dtype, Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(tol<Dtype>(1e-2, 1e-1), tol<Dtype>(1e-3, 1e-1), 1701,
+        0., 0.01);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+
+  TYPED_TEST(BatchNormLayerTest, TestVirtualBatch) {
+    typedef typename TypeParam::Dtype Dtype;
+    // Reference: the whole batch at once
+    TBlob<Dtype> blob_batch(6, 2, 3, 4);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&blob_batch);
+    vector<Blob*> blob_batch_vec(1, &blob_batch);
+    TBlob<Dtype> blob_batch_top;
+    vector<Blob*> blob_batch_top_vec(1, &blob_batch_top);
+    LayerParameter layer_param;
+    BatchNormLayer<Dtype, Dtype> layer(layer_param);
+    layer.SetUp(blob_batch_vec, blob_batch_top_vec);
+    layer.Forward(blob_batch_vec, blob_batch_top_vec);
+    // The same batch in two micro-batches of 3
+    layer_param.mutable_batch_norm_param()->set_virtual_batch(2);
+    BatchNormLayer<Dtype, Dtype> virtual_layer(layer_param);
+    TBlob<Dtype> blob_micro(3, 2, 3, 4);
+    vector<Blob*> blob_micro_vec(1, &blob_micro);
+    const int count = blob_micro.count();
+    virtual_layer.SetUp(blob_micro_vec, this->blob_top_vec_);
+    for (int k = 0; k < 2; ++k) {
+      for (int i = 0; i < count; ++i) {
+        blob_micro.mutable_cpu_data()[i] = blob_batch.cpu_data()[k * count + i];
+      }
+      virtual_layer.Forward(blob_micro_vec, this->blob_top_vec_);
+      // Global statistics only change at the end of the virtual batch
+      EXPECT_EQ(k == 0, virtual_layer.blobs()[0]->asum_data() == 0.F);
+    }
+    // The last micro-batch is normalized with statistics of the whole batch
+    const float kErrorBound = tol<Dtype>(1e-4F, 2e-2F);
+    for (int i = 0; i < count; ++i) {
+      EXPECT_NEAR(blob_batch_top.cpu_data()[count + i], this->blob_top_->cpu_data()[i],
+          kErrorBound);
+    }
+    for (int b = 0; b < 2; ++b) {
+      for (int c = 0; c < 2; ++c) {
+        EXPECT_NEAR(layer.blobs()[b]->template cpu_data<float>()[c],
+            virtual_layer.blobs()[b]->template cpu_data<float>()[c], kErrorBound);
+      }
+    }
+  }
+
 #ifdef USE_CUDNN
 template <typename Dtype>
 class CuDNNBatchNormLayerTest : public GPUDeviceTest<Dtype> {
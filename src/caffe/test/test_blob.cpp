@@ -332,6 +332,44 @@ TYPED_TEST(BlobMathTest, TestScaleData) {
       this->epsilon_ * expected_diff_asum);
 }
 
+TYPED_TEST(BlobMathTest, TestConvertDataBatch) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Type new_type = is_type<float>(tp<Dtype>()) ? tp<double>() : tp<float>();
+  FillerParameter filler_param;
+  filler_param.set_min(-3);
+  filler_param.set_max(3);
+  UniformFiller<Dtype> filler(filler_param);
+  vector<shared_ptr<Blob>> blobs;
+  vector<Blob*> blob_ptrs;
+  vector<vector<float>> expected;
+  for (int i = 0; i < 3; ++i) {
+    blobs.push_back(Blob::create<Dtype>(vector<int>(1, 10 + i)));
+    blob_ptrs.push_back(blobs.back().get());
+    filler.Fill(blobs.back().get());
+    const Dtype* data = blobs.back()->template cpu_data<Dtype>();
+    expected.emplace_back(data, data + blobs.back()->count());
+#ifndef CPU_ONLY
+    if (TypeParam::device == Caffe::GPU) {
+      blobs.back()->template gpu_data<Dtype>();
+    }
+#endif
+  }
+  Tensor::reset_conversion_stats();
+  Blob::convert_data_batch(blob_ptrs, new_type);
+  const std::string report = Tensor::conversion_report();
+  EXPECT_EQ(report.find("Tensor conversions: 3 "), 0UL) << report;
+  for (int i = 0; i < blobs.size(); ++i) {
+    EXPECT_EQ(blobs[i]->data_type(), new_type);
+    for (int j = 0; j < blobs[i]->count(); ++j) {
+      EXPECT_NEAR(expected[i][j], blobs[i]->data_at(j), this->epsilon_);
+    }
+  }
+  // Views are current: nothing is converted again
+  Blob::convert_data_batch(blob_ptrs, new_type);
+  Blob::convert_data_batch(blob_ptrs, tp<Dtype>());
+  EXPECT_EQ(report, Tensor::conversion_report());
+}
+
 template <typename Dtype>
 class BlobSerializationTest : public ::testing::Test {
  protected:
@@ -379,4 +417,34 @@ TYPED_TEST(BlobSerializationTest, TestSerialization) {
   EXPECT_GT(str.find("ASUM: 7260"), 0UL);
 }
 
+#ifndef CPU_ONLY
+TEST(BlobStagedSerializationTest, TestLargeRawGPU) {
+  Caffe::set_mode(Caffe::GPU);
+  // Past one staging chunk
+  const int n = (5 << 20) + 3;
+  TBlob<float> src(vector<int>{n});
+  float* psrc = src.mutable_cpu_data();
+  for (int i = 0; i < n; ++i) {
+    psrc[i] = static_cast<float>(i % 1000 - 500);
+  }
+  // Downloaded from the device head
+  src.mutable_gpu_data();
+  BlobProto proto;
+  src.ToProto(&proto, false, false);
+  ASSERT_EQ(n * sizeof(float), proto.raw_data().size());
+
+  TBlob<float> dst;
+  dst.FromProto(proto, true);
+  TBlob<float16> dst16;
+  dst16.FromProto(proto, true);
+  const float* pdst = dst.cpu_data();
+  const float16* pdst16 = dst16.cpu_data();
+  psrc = src.mutable_cpu_data();
+  for (int i = 0; i < n; ++i) {
+    ASSERT_EQ(psrc[i], pdst[i]) << " at i=" << i;
+    ASSERT_EQ(psrc[i], static_cast<float>(pdst16[i])) << " at i=" << i;
+  }
+}
+#endif
+
 }  // namespace caffe
@@ -0,0 +1,85 @@
+#ifndef CPU_ONLY
+
+#include <limits>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/blob_monitor.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class BlobMonitorTest : public GPUDeviceTest<float> {
+ protected:
+  BlobMonitorTest()
+      : data_(vector<int>{3, 1000}),
+        half_(vector<int>{7}) {
+    float* data = data_.mutable_cpu_data();
+    for (int i = 0; i < data_.count(); ++i) {
+      data[i] = i % 2 == 0 ? 1.F : -3.F;
+    }
+    data[1234] = -10.F;
+    float* diff = data_.mutable_cpu_diff();
+    for (int i = 0; i < data_.count(); ++i) {
+      diff[i] = 0.5F;
+    }
+    diff[5] = std::numeric_limits<float>::quiet_NaN();
+    diff[6] = std::numeric_limits<float>::infinity();
+    float16* half = half_.mutable_cpu_data();
+    for (int i = 0; i < half_.count(); ++i) {
+      half[i] = float16(-2.F);
+    }
+  }
+
+  TBlob<float> data_;
+  TBlob<float16> half_;
+};
+
+TEST_F(BlobMonitorTest, TestStats) {
+  BlobMonitorParameter param;
+  param.set_interval(2);
+  param.set_alert_on_nonfinite(false);
+  BlobMonitor monitor(param);
+  monitor.Add("blob", &data_, false);
+  monitor.Add("blob", &data_, true);
+  monitor.Add("half", &half_, false);
+  for (int i = 0; i < 3; ++i) {
+    monitor.Tick(Caffe::thread_stream());
+  }
+  monitor.Flush();
+  // Ticks 0 and 2
+  EXPECT_EQ(2, monitor.samples());
+  EXPECT_EQ(0, monitor.alerts());
+  EXPECT_NEAR((1499.F + 10.F + 1500.F * 3.F) / 3000.F, monitor.stats(0).abs_mean, 1e-4);
+  EXPECT_EQ(10.F, monitor.stats(0).max_abs);
+  EXPECT_EQ(0U, monitor.stats(0).nonfinite);
+  // NaN and Inf are counted, not summed
+  EXPECT_NEAR(2998.F * 0.5F / 3000.F, monitor.stats(1).abs_mean, 1e-4);
+  EXPECT_EQ(0.5F, monitor.stats(1).max_abs);
+  EXPECT_EQ(2U, monitor.stats(1).nonfinite);
+  EXPECT_EQ(2.F, monitor.stats(2).abs_mean);
+  EXPECT_EQ(2.F, monitor.stats(2).max_abs);
+}
+
+TEST_F(BlobMonitorTest, TestAlerts) {
+  BlobMonitorParameter param;
+  param.set_interval(1);
+  param.set_max_abs(5.F);
+  BlobMonitor monitor(param);
+  monitor.Add("blob", &data_, false);
+  monitor.Add("blob", &data_, true);
+  monitor.Add("half", &half_, false);
+  monitor.Tick(Caffe::thread_stream());
+  monitor.Flush();
+  // Max of the data, NaN/Inf of the diff
+  EXPECT_EQ(1, monitor.samples());
+  EXPECT_EQ(2, monitor.alerts());
+}
+
+}  // namespace caffe
+
+#endif  // CPU_ONLY
@@ -0,0 +1,79 @@
+#include <boost/thread.hpp>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/blocking_queue.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Parameter is ring capacity, 0 stands for mutex guarded queue
+class BlockingQueueTest : public ::testing::TestWithParam<size_t> {};
+
+TEST_P(BlockingQueueTest, TestFIFO) {
+  BlockingQueue<int> q(GetParam());
+  EXPECT_EQ(GetParam() > 0UL, q.lock_free());
+  int v = -1;
+  EXPECT_FALSE(q.try_pop(&v));
+  EXPECT_FALSE(q.try_peek(&v));
+  for (int i = 0; i < 3; ++i) {
+    q.push(i);
+  }
+  EXPECT_EQ(3UL, q.size());
+  EXPECT_EQ(0, q.peek());
+  EXPECT_EQ(0, q.pop());
+  EXPECT_TRUE(q.try_peek(&v));
+  EXPECT_EQ(1, v);
+  EXPECT_EQ(1, q.pop("waiting"));
+  EXPECT_TRUE(q.try_pop(&v));
+  EXPECT_EQ(2, v);
+  size_t size = 1UL;
+  EXPECT_TRUE(q.nonblocking_size(&size));
+  EXPECT_EQ(0UL, size);
+}
+
+TEST_P(BlockingQueueTest, TestProducersConsumers) {
+  const int producers = 3, consumers = 2, count = 20000;
+  BlockingQueue<int> q(GetParam());
+  vector<long long> sums(consumers, 0LL);
+  boost::thread_group threads;
+  for (int p = 0; p < producers; ++p) {
+    threads.create_thread([&q, count]() {
+      for (int i = 1; i <= count; ++i) {
+        q.push(i);
+      }
+    });
+  }
+  for (int c = 0; c < consumers; ++c) {
+    threads.create_thread([&q, &sums, c, producers, consumers, count]() {
+      for (int i = 0; i < producers * count / consumers; ++i) {
+        sums[c] += q.pop("waiting");
+      }
+    });
+  }
+  threads.join_all();
+  long long total = 0LL;
+  for (long long s : sums) {
+    total += s;
+  }
+  EXPECT_EQ(producers * (count * (count + 1LL) / 2LL), total);
+  EXPECT_EQ(0UL, q.size());
+}
+
+TEST_P(BlockingQueueTest, TestBlockedPopWakesUp) {
+  BlockingQueue<int> q(GetParam());
+  int v = 0;
+  boost::thread consumer([&q, &v]() { v = q.pop(); });
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+  q.push(7);
+  consumer.join();
+  EXPECT_EQ(7, v);
+}
+
+INSTANTIATE_TEST_CASE_P(BlockingQueueModes, BlockingQueueTest,
+    ::testing::Values(0UL, 4UL));
+
+}  // namespace caffe
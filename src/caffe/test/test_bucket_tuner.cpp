@@ -0,0 +1,60 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/bucket_tuner.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class BucketTunerTest : public ::testing::Test {
+ protected:
+  static constexpr size_t MB = 1UL << 20;
+
+  // Four 1MB gradients arriving 1ms apart, reductions cost latency + 1us per KB
+  void Measure(BucketTuner* tuner, double latency_us, int iterations) {
+    for (int it = 0; it < iterations; ++it) {
+      for (int i = 0; i < 4; ++i) {
+        tuner->param_ready(MB, 5000. * it + 1000. * i);
+      }
+      tuner->end_iteration();
+    }
+    for (size_t bytes : {MB, 2UL * MB, 4UL * MB}) {
+      tuner->bucket_reduced(bytes, latency_us + bytes / 1024.);
+    }
+  }
+};
+
+constexpr size_t BucketTunerTest::MB;
+
+TEST_F(BucketTunerTest, TestBandwidthBound) {
+  BucketTuner tuner(4UL * MB, 32);
+  Measure(&tuner, 100., 3);
+  EXPECT_EQ(3, tuner.iterations());
+  EXPECT_EQ(MB, tuner.bucket_size(4));
+  EXPECT_NEAR(3000. + 100. + 4096., tuner.simulate(1), 1.);
+  // Reductions take longer than gradients arrive: they queue up
+  EXPECT_NEAR(4. * (100. + 1024.), tuner.simulate(4), 1.);
+  // One bucket per gradient overlaps best, smaller buckets change nothing
+  EXPECT_EQ(4, tuner.best_buckets());
+}
+
+TEST_F(BucketTunerTest, TestLatencyBound) {
+  BucketTuner tuner(4UL * MB, 32);
+  Measure(&tuner, 10000., 2);
+  EXPECT_EQ(1, tuner.best_buckets());
+}
+
+TEST_F(BucketTunerTest, TestChangedArrivalOrderIgnored) {
+  BucketTuner tuner(4UL * MB, 32);
+  Measure(&tuner, 100., 1);
+  tuner.param_ready(2UL * MB, 0.);
+  tuner.param_ready(2UL * MB, 100.);
+  tuner.end_iteration();
+  EXPECT_EQ(1, tuner.iterations());
+  EXPECT_EQ(4, tuner.best_buckets());
+}
+
+}  // namespace caffe
@@ -0,0 +1,128 @@
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layers/cluster_detections_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class ClusterDetectionsLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  ClusterDetectionsLayerTest()
+      : blob_bottom_coverage_(new TBlob<Dtype>(1, 1, 4, 4)),
+        blob_bottom_bbox_(new TBlob<Dtype>(1, 4, 4, 4)),
+        blob_top_(new TBlob<Dtype>()) {
+    blob_bottom_vec_.push_back(blob_bottom_coverage_);
+    blob_bottom_vec_.push_back(blob_bottom_bbox_);
+    blob_top_vec_.push_back(blob_top_);
+    caffe_set(blob_bottom_coverage_->count(), Dtype(0),
+        blob_bottom_coverage_->mutable_cpu_data());
+    caffe_set(blob_bottom_bbox_->count(), Dtype(0), blob_bottom_bbox_->mutable_cpu_data());
+    // Four gridboxes around an object, one alone
+    SetProposal(0, 0, 4, 4, 40, 36);
+    SetProposal(1, 0, 5, 4, 41, 36);
+    SetProposal(0, 1, 4, 5, 40, 37);
+    SetProposal(1, 1, 3, 3, 39, 35);
+    SetProposal(3, 3, 50, 50, 60, 60);
+  }
+  virtual ~ClusterDetectionsLayerTest() {
+    delete blob_bottom_coverage_;
+    delete blob_bottom_bbox_;
+    delete blob_top_;
+  }
+
+  // Image coordinates of the box proposed at gridbox (x, y), stride 16
+  void SetProposal(int x, int y, float x0, float y0, float x1, float y1) {
+    blob_bottom_coverage_->mutable_cpu_data()[blob_bottom_coverage_->offset(0, 0, y, x)] =
+        Dtype(1);
+    Dtype* bbox = blob_bottom_bbox_->mutable_cpu_data();
+    bbox[blob_bottom_bbox_->offset(0, 0, y, x)] = Dtype(x0 - x * 16);
+    bbox[blob_bottom_bbox_->offset(0, 1, y, x)] = Dtype(y0 - y * 16);
+    bbox[blob_bottom_bbox_->offset(0, 2, y, x)] = Dtype(x1 - x * 16);
+    bbox[blob_bottom_bbox_->offset(0, 3, y, x)] = Dtype(y1 - y * 16);
+  }
+
+  void CheckBox(int b, float x0, float y0, float x1, float y1, float confidence) {
+    const Dtype* box = blob_top_->cpu_data() + 5 * b;
+    const float error = tol<Dtype>(1e-4, 2e-2);
+    EXPECT_NEAR(x0, box[0], error);
+    EXPECT_NEAR(y0, box[1], error);
+    EXPECT_NEAR(x1, box[2], error);
+    EXPECT_NEAR(y1, box[3], error);
+    EXPECT_NEAR(confidence, box[4], error);
+  }
+
+  LayerParameter LayerParam(bool groundtruth) {
+    LayerParameter layer_param;
+    ClusterDetectionsParameter* param = layer_param.mutable_cluster_detections_param();
+    param->set_image_size_x(64);
+    param->set_image_size_y(64);
+    param->set_stride(16);
+    param->set_coverage_threshold(0.5);
+    param->set_rect_threshold(3);
+    param->set_rect_eps(0.1);
+    param->set_min_height(22);
+    param->set_max_boxes(3);
+    param->set_groundtruth(groundtruth);
+    return layer_param;
+  }
+
+  TBlob<Dtype>* const blob_bottom_coverage_;
+  TBlob<Dtype>* const blob_bottom_bbox_;
+  TBlob<Dtype>* const blob_top_;
+  vector<Blob*> blob_bottom_vec_;
+  vector<Blob*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(ClusterDetectionsLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(ClusterDetectionsLayerTest, TestSetup) {
+  typedef typename TypeParam::Dtype Dtype;
+  ClusterDetectionsLayer<Dtype, Dtype> layer(this->LayerParam(false));
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_->shape(), (vector<int>{1, 3, 5}));
+}
+
+TYPED_TEST(ClusterDetectionsLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  ClusterDetectionsLayer<Dtype, Dtype> layer(this->LayerParam(false));
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // The mean of the four, the lone proposal is too small a cluster
+  this->CheckBox(0, 4, 4, 40, 36, std::log(4.F));
+  this->CheckBox(1, 0, 0, 0, 0, 0);
+  this->CheckBox(2, 0, 0, 0, 0, 0);
+}
+
+TYPED_TEST(ClusterDetectionsLayerTest, TestForwardMinHeight) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param = this->LayerParam(false);
+  layer_param.mutable_cluster_detections_param()->set_min_height(33);
+  ClusterDetectionsLayer<Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  this->CheckBox(0, 0, 0, 0, 0, 0);
+}
+
+TYPED_TEST(ClusterDetectionsLayerTest, TestForwardGroundtruth) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->SetProposal(1, 0, 4, 4, 40, 36);
+  this->SetProposal(0, 1, 4, 4, 40, 36);
+  ClusterDetectionsLayer<Dtype, Dtype> layer(this->LayerParam(true));
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Distinct boxes in gridbox order
+  this->CheckBox(0, 4, 4, 40, 36, 0);
+  this->CheckBox(1, 3, 3, 39, 35, 0);
+  this->CheckBox(2, 50, 50, 60, 60, 0);
+}
+
+}  // namespace caffe
@@ -1,3 +1,8 @@
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
 #include "gtest/gtest.h"
 
 #include "caffe/common.hpp"
@@ -8,6 +13,8 @@
 
 #ifndef CPU_ONLY
 #include "cub/util_allocator.cuh"
+#include "caffe/util/gpu_slab_allocator.hpp"
+#include "caffe/util/host_memory_pool.hpp"
 #endif
 
 namespace caffe {
@@ -22,6 +29,21 @@ TEST_F(CommonTest, TestCublasHandlerGPU) {
   EXPECT_TRUE(Caffe::cublas_handle());
 }
 
+TEST_F(CommonTest, TestContextPoolGPU) {
+  const int device = Caffe::current_device();
+  GPUContextPool::Prewarm(device);
+  const size_t available = GPUContextPool::available(device);
+  cudaStream_t stream = nullptr;
+  std::thread([&stream]() {
+    stream = Caffe::thread_stream();
+    EXPECT_TRUE(Caffe::cublas_handle());
+  }).join();
+  EXPECT_TRUE(stream != nullptr);
+  // The thread gave its context back on exit
+  EXPECT_GE(GPUContextPool::available(device), available);
+  EXPECT_GT(GPUContextPool::available(device), 0UL);
+}
+
 TEST_F(CommonTest, TestDeviceQuery) {
   std::string dq = Caffe::DeviceQuery();
   EXPECT_TRUE(dq.find("No") == 0UL || dq.find("Dev") == 0UL);
@@ -96,6 +118,103 @@ TEST_F(CommonTest, TestCUBNearestPowerOf2) {
   }
 }
 
+TEST_F(CommonTest, TestSlabSizeClass) {
+  EXPECT_EQ(512UL, SlabAllocator::size_class(1UL));
+  EXPECT_EQ(512UL, SlabAllocator::size_class(512UL));
+  EXPECT_EQ(640UL, SlabAllocator::size_class(513UL));
+  EXPECT_EQ(1024UL, SlabAllocator::size_class(1000UL));
+  EXPECT_EQ(1280UL, SlabAllocator::size_class(1025UL));
+  EXPECT_EQ(pow2(20) + pow2(18), SlabAllocator::size_class(pow2(20) + 1UL));
+}
+
+TEST_F(CommonTest, TestSlabAllocator) {
+  const int device = Caffe::current_device();
+  cudaStream_t stream = Caffe::thread_stream();
+  SlabAllocator allocator(pow2(21), false);
+  size_t allocated, deallocated;
+  void *a, *b, *c;
+  ASSERT_EQ(cudaSuccess, allocator.DeviceAllocate(device, &a, 1000UL, stream, allocated));
+  EXPECT_EQ(pow2(21), allocated);
+  ASSERT_EQ(cudaSuccess, allocator.DeviceAllocate(device, &b, 1000UL, stream, allocated));
+  EXPECT_EQ(0UL, allocated);  // same arena
+  EXPECT_EQ(static_cast<char*>(a) + 1024, b);
+  EXPECT_EQ(pow2(21) - 2048UL, allocator.free_bytes(device));
+  ASSERT_EQ(cudaSuccess, allocator.DeviceFree(device, a, deallocated));
+  ASSERT_EQ(cudaSuccess, allocator.DeviceFree(device, b, deallocated));
+  EXPECT_EQ(0UL, deallocated);
+  // coalesced back to the whole arena
+  ASSERT_EQ(cudaSuccess, allocator.DeviceAllocate(device, &c, pow2(21), stream, allocated));
+  EXPECT_EQ(0UL, allocated);
+  EXPECT_EQ(a, c);
+  ASSERT_EQ(cudaSuccess, allocator.DeviceFree(device, c, deallocated));
+  EXPECT_EQ(pow2(21), allocator.ReleaseFreeArenas(device));
+  EXPECT_EQ(0UL, allocator.free_bytes(device));
+}
+
+TEST_F(CommonTest, TestSlabRelocate) {
+  const int device = Caffe::current_device();
+  cudaStream_t stream = Caffe::thread_stream();
+  SlabAllocator allocator(pow2(21), false);
+  size_t allocated, deallocated;
+  void *a, *b;
+  ASSERT_EQ(cudaSuccess, allocator.DeviceAllocate(device, &a, 1000UL, stream, allocated));
+  ASSERT_EQ(cudaSuccess, allocator.DeviceAllocate(device, &b, 1000UL, stream, allocated));
+  vector<char> host(1024UL, 7), back(1024UL, 0);
+  CUDA_CHECK(cudaMemcpy(b, host.data(), host.size(), cudaMemcpyHostToDevice));
+  ASSERT_EQ(cudaSuccess, allocator.DeviceFree(device, a, deallocated));
+  // b moves down to the hole left by a, then has nothing ahead
+  void* moved = allocator.Relocate(device, b, stream);
+  EXPECT_EQ(a, moved);
+  EXPECT_EQ(moved, allocator.Relocate(device, moved, stream));
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(cudaMemcpy(back.data(), moved, back.size(), cudaMemcpyDeviceToHost));
+  EXPECT_EQ(host, back);
+  EXPECT_EQ(pow2(21) - 1024UL, allocator.free_bytes(device));
+  ASSERT_EQ(cudaSuccess, allocator.DeviceFree(device, moved, deallocated));
+  allocator.Coalesce(device);
+  EXPECT_EQ(pow2(21), allocator.ReleaseFreeArenas(device));
+}
+
+// Allocations served by pools don't wait for collectives in flight
+TEST_F(CommonTest, TestPoolHitsDuringCollective) {
+  const int device = Caffe::current_device();
+  cudaStream_t stream = Caffe::thread_stream();
+  SlabAllocator allocator(pow2(21), false);
+  size_t allocated, deallocated;
+  void* a;
+  ASSERT_EQ(cudaSuccess, allocator.DeviceAllocate(device, &a, 1000UL, stream, allocated));
+  ASSERT_EQ(cudaSuccess, allocator.DeviceFree(device, a, deallocated));
+  HostMemoryPool::Free(HostMemoryPool::Allocate(1000UL), 1000UL);
+  std::future<void> hits;
+  {
+    GPUMemory::CollectiveScope collective;
+    hits = std::async(std::launch::async, [&]() {
+      void* d;
+      CUDA_CHECK(allocator.DeviceAllocate(device, &d, 1000UL, stream, allocated));
+      CUDA_CHECK(allocator.DeviceFree(device, d, deallocated));
+      HostMemoryPool::Free(HostMemoryPool::Allocate(1000UL), 1000UL);
+    });
+    EXPECT_EQ(std::future_status::ready, hits.wait_for(std::chrono::seconds(10)));
+  }
+  hits.get();
+  EXPECT_EQ(0UL, allocated);
+}
+
+// Pinned buffers freed are handed out again, by the node of the thread asking
+TEST_F(CommonTest, TestHostPoolReuse) {
+  HostMemoryPool::Free(HostMemoryPool::Allocate(5000UL), 5000UL);
+  const HostMemoryPool::Stats before = HostMemoryPool::stats();
+  for (size_t i = 0UL; i < 10UL; ++i) {
+    // One size class
+    HostMemoryPool::Free(HostMemoryPool::Allocate(5000UL + i), 5000UL + i);
+  }
+  const HostMemoryPool::Stats after = HostMemoryPool::stats();
+  EXPECT_EQ(before.misses, after.misses);
+  EXPECT_EQ(before.hits + 10UL, after.hits);
+  EXPECT_EQ(before.used_bytes, after.used_bytes);
+  EXPECT_EQ(before.cached_bytes, after.cached_bytes);
+}
+
 #endif
 
 }  // namespace caffe
@@ -6,6 +6,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/concat_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -183,6 +184,62 @@ TYPED_TEST(ConcatLayerTest, TestGradientNum) {
   checker.CheckGradient(&layer, this->blob_bottom_vec_1_, this->blob_top_vec_);
 }
 
+TYPED_TEST(ConcatLayerTest, TestShareStorage) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_concat_param()->set_axis(0);
+  layer_param.mutable_concat_param()->set_share_storage(true);
+  ConcatLayer<Dtype, Dtype> layer(layer_param);
+  vector<Blob*>& bottom = this->blob_bottom_vec_1_;
+  layer.SetUp(bottom, this->blob_top_vec_);
+  layer.Forward(bottom, this->blob_top_vec_);
+  // Bottoms are regions of the top now
+  const bool gpu = Caffe::mode() == Caffe::GPU;
+  const int count_0 = this->blob_bottom_0_->count();
+  const int count_2 = this->blob_bottom_2_->count();
+  const char* top_data = static_cast<const char*>(this->blob_top_->current_data_memory(gpu));
+  EXPECT_EQ(top_data, this->blob_bottom_0_->current_data_memory(gpu));
+  EXPECT_EQ(top_data + count_0 * sizeof(Dtype),
+      this->blob_bottom_2_->current_data_memory(gpu));
+  // New bottom values show through without copying
+  caffe_set(count_2, Dtype(4.), this->blob_bottom_2_->mutable_cpu_data());
+  layer.Forward(bottom, this->blob_top_vec_);
+  for (int i = 0; i < count_0; ++i) {
+    EXPECT_EQ(1., static_cast<float>(this->blob_top_->cpu_data()[i]));
+  }
+  for (int i = 0; i < count_2; ++i) {
+    EXPECT_EQ(4., static_cast<float>(this->blob_top_->cpu_data()[count_0 + i]));
+  }
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    this->blob_top_->mutable_cpu_diff()[i] = Dtype(static_cast<float>(i % 7));
+  }
+  vector<bool> propagate_down(bottom.size(), true);
+  for (int pass = 0; pass < 2; ++pass) {
+    layer.Backward(this->blob_top_vec_, propagate_down, bottom);
+    for (int i = 0; i < count_0; ++i) {
+      EXPECT_EQ(static_cast<float>(this->blob_top_->cpu_diff()[i]),
+          static_cast<float>(this->blob_bottom_0_->cpu_diff()[i]));
+    }
+    for (int i = 0; i < count_2; ++i) {
+      EXPECT_EQ(static_cast<float>(this->blob_top_->cpu_diff()[count_0 + i]),
+          static_cast<float>(this->blob_bottom_2_->cpu_diff()[i]));
+    }
+    caffe_set(this->blob_top_->count(), Dtype(5.), this->blob_top_->mutable_cpu_diff());
+  }
+  // A new shape gives bottoms their own memory back and copies again
+  this->blob_bottom_2_->Reshape(6, 3, 6, 5);
+  caffe_set(this->blob_bottom_2_->count(), Dtype(6.), this->blob_bottom_2_->mutable_cpu_data());
+  layer.Reshape(bottom, this->blob_top_vec_);
+  layer.Forward(bottom, this->blob_top_vec_);
+  for (int i = 0; i < count_0; ++i) {
+    EXPECT_EQ(1., static_cast<float>(this->blob_top_->cpu_data()[i]));
+    EXPECT_EQ(1., static_cast<float>(this->blob_bottom_0_->cpu_data()[i]));
+  }
+  for (int i = 0; i < this->blob_bottom_2_->count(); ++i) {
+    EXPECT_EQ(6., static_cast<float>(this->blob_top_->cpu_data()[count_0 + i]));
+  }
+}
+
 TYPED_TEST(ConcatLayerTest, TestGradientChannels) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
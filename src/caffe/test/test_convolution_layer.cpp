@@ -842,6 +842,66 @@ TYPED_TEST(ConvolutionLayerTest, TestGradientGroup) {
   checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestGemmBatchMatchesPerImage) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(5, 3, 6, 4);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  vector<Blob*> top_2_vec(1, this->blob_top_2_);
+  const vector<bool> propagate_down(1, true);
+  for (int group : {1, 3}) {
+    LayerParameter layer_param;
+    layer_param.set_forward_type(tp<Dtype>());
+    layer_param.set_backward_type(tp<Dtype>());
+    layer_param.set_forward_math(tp<Dtype>());
+    layer_param.set_backward_math(tp<Dtype>());
+    ConvolutionParameter* convolution_param = layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_stride(2);
+    convolution_param->add_pad(1);
+    convolution_param->set_num_output(6);
+    convolution_param->set_group(group);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    ConvolutionLayer<Dtype, Dtype> batched(layer_param);
+    convolution_param->set_gemm_batch_mb(0U);
+    ConvolutionLayer<Dtype, Dtype> per_image(layer_param);
+    batched.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    per_image.SetUp(this->blob_bottom_vec_, top_2_vec);
+    for (int i = 0; i < batched.blobs().size(); ++i) {
+      per_image.blobs()[i]->CopyFrom(*batched.blobs()[i]);
+      batched.blobs()[i]->set_diff(0.F);
+      per_image.blobs()[i]->set_diff(0.F);
+    }
+    batched.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    per_image.Forward(this->blob_bottom_vec_, top_2_vec);
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(this->blob_top_->cpu_data()[i], this->blob_top_2_->cpu_data()[i],
+          tol<Dtype>(1e-4, 1e-2));
+    }
+    TBlob<Dtype> top_diff;
+    top_diff.ReshapeLike(*this->blob_top_);
+    filler.Fill(&top_diff);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(), this->blob_top_->mutable_cpu_diff());
+    this->blob_top_2_->CopyDiffFrom(*this->blob_top_);
+    batched.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+    TBlob<Dtype> bottom_diff;
+    bottom_diff.CopyFrom(*this->blob_bottom_, true, true);
+    per_image.Backward(top_2_vec, propagate_down, this->blob_bottom_vec_);
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_NEAR(bottom_diff.cpu_diff()[i], this->blob_bottom_->cpu_diff()[i],
+          tol<Dtype>(1e-4, 1e-2));
+    }
+    for (int b = 0; b < batched.blobs().size(); ++b) {
+      for (int i = 0; i < batched.blobs()[b]->count(); ++i) {
+        EXPECT_NEAR(batched.blobs()[b]->template cpu_diff<Dtype>()[i],
+            per_image.blobs()[b]->template cpu_diff<Dtype>()[i], tol<Dtype>(1e-3, 5e-2));
+      }
+    }
+  }
+}
+
 #ifdef USE_CUDNN
 
 template<typename Dtype>
@@ -1132,6 +1192,111 @@ TYPED_TEST(CuDNNConvolutionLayerTest, TestGradientGroupCuDNN) {
   checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
 }
 
+
+TYPED_TEST(CuDNNConvolutionLayerTest, TestGroupedDirectCuDNN) {
+  LayerParameter layer_param;
+  layer_param.set_forward_type(tp<TypeParam>());
+  layer_param.set_backward_type(tp<TypeParam>());
+  layer_param.set_forward_math(tp<TypeParam>());
+  layer_param.set_backward_math(tp<TypeParam>());
+  ConvolutionParameter* convolution_param = layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(3);
+  convolution_param->set_grouped_algo(ConvolutionParameter_GroupedAlgo_GROUPED_DIRECT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  shared_ptr<Layer<TypeParam, TypeParam>> layer(
+      new CuDNNConvolutionLayer<TypeParam, TypeParam>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  const TypeParam* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], tol<TypeParam>(1e-4, 1e-2))
+              << i << " of " << this->blob_top_->count();
+  }
+  CuDNNConvolutionLayer<TypeParam, TypeParam> grad_layer(layer_param);
+  GradientChecker<TypeParam> checker(tol<TypeParam>(5e-2, 1e-1), tol<TypeParam>(1e-2, 5e-1));
+  checker.CheckGradientExhaustive(&grad_layer, this->blob_bottom_vec_, this->blob_top_vec_);
+}
+
+TYPED_TEST(CuDNNConvolutionLayerTest, TestGroupedGemmCuDNN) {
+  // 3 channels per group, which cuDNN grouping doesn't cover
+  TBlob<TypeParam> bottom(2, 6, 6, 4);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(&bottom);
+  this->blob_bottom_vec_[0] = &bottom;
+  LayerParameter layer_param;
+  layer_param.set_forward_type(tp<TypeParam>());
+  layer_param.set_backward_type(tp<TypeParam>());
+  layer_param.set_forward_math(tp<TypeParam>());
+  layer_param.set_backward_math(tp<TypeParam>());
+  ConvolutionParameter* convolution_param = layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->set_group(2);
+  convolution_param->set_grouped_algo(ConvolutionParameter_GroupedAlgo_GROUPED_GEMM);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  shared_ptr<Layer<TypeParam, TypeParam>> layer(
+      new CuDNNConvolutionLayer<TypeParam, TypeParam>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_conv(&bottom, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  const TypeParam* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], tol<TypeParam>(1e-4, 1e-2))
+              << i << " of " << this->blob_top_->count();
+  }
+  CuDNNConvolutionLayer<TypeParam, TypeParam> grad_layer(layer_param);
+  GradientChecker<TypeParam> checker(tol<TypeParam>(5e-2, 1e-1), tol<TypeParam>(1e-2, 5e-1));
+  checker.CheckGradientExhaustive(&grad_layer, this->blob_bottom_vec_, this->blob_top_vec_);
+}
+
+TYPED_TEST(CuDNNConvolutionLayerTest, TestPadChannelsCuDNN) {
+  // Padding applies to FLOAT16, other types run unpadded and must agree all the same
+  LayerParameter layer_param;
+  layer_param.set_forward_type(tp<TypeParam>());
+  layer_param.set_backward_type(tp<TypeParam>());
+  layer_param.set_forward_math(tp<TypeParam>());
+  layer_param.set_backward_math(tp<TypeParam>());
+  ConvolutionParameter* convolution_param = layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(5);
+  convolution_param->set_pad_channels(8);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  shared_ptr<Layer<TypeParam, TypeParam>> layer(
+      new CuDNNConvolutionLayer<TypeParam, TypeParam>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(5, this->blob_top_->channels());
+  EXPECT_EQ(5, layer->blobs()[0]->shape(0));
+  EXPECT_EQ(3, layer->blobs()[0]->shape(1));
+  EXPECT_EQ(5, layer->blobs()[1]->count());
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  const TypeParam* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], tol<TypeParam>(1e-4, 2e-2))
+              << i << " of " << this->blob_top_->count();
+  }
+  CuDNNConvolutionLayer<TypeParam, TypeParam> grad_layer(layer_param);
+  GradientChecker<TypeParam> checker(tol<TypeParam>(5e-2, 1e-1), tol<TypeParam>(1e-2, 5e-1));
+  checker.CheckGradientExhaustive(&grad_layer, this->blob_bottom_vec_, this->blob_top_vec_);
+}
+
 #endif
 
 }  // namespace caffe
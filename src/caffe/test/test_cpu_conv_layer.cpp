@@ -0,0 +1,110 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/cpu_conv_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class CPUConvolutionLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  CPUConvolutionLayerTest()
+      : blob_bottom_(new TBlob<Dtype>(2, 4, 9, 11)), blob_top_(new TBlob<Dtype>()),
+        blob_top_cpu_(new TBlob<Dtype>()) {
+    FillerParameter filler_param;
+    filler_param.set_min(-1.F);
+    filler_param.set_max(1.F);
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    blob_top_cpu_vec_.push_back(blob_top_cpu_);
+  }
+
+  virtual ~CPUConvolutionLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete blob_top_cpu_;
+  }
+
+  LayerParameter MakeParam(int kernel, int stride, int pad, int num_output, int group) {
+    LayerParameter layer_param;
+    layer_param.set_forward_type(tp<Dtype>());
+    layer_param.set_backward_type(tp<Dtype>());
+    layer_param.set_forward_math(tp<Dtype>());
+    layer_param.set_backward_math(tp<Dtype>());
+    ConvolutionParameter* conv_param = layer_param.mutable_convolution_param();
+    conv_param->add_kernel_size(kernel);
+    conv_param->add_stride(stride);
+    conv_param->add_pad(pad);
+    conv_param->set_num_output(num_output);
+    conv_param->set_group(group);
+    conv_param->mutable_weight_filler()->set_type("gaussian");
+    conv_param->mutable_bias_filler()->set_type("gaussian");
+    return layer_param;
+  }
+
+  // Runs both engines on the same weights and compares their outputs
+  void CheckAgainstCaffe(LayerParameter layer_param,
+      typename CPUConvolutionLayer<Dtype, Dtype>::Algo algo, int tile) {
+    ConvolutionLayer<Dtype, Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer_param.mutable_convolution_param()->set_engine(ConvolutionParameter_Engine_CPU);
+    CPUConvolutionLayer<Dtype, Dtype> cpu_layer(layer_param);
+    cpu_layer.blobs() = layer.blobs();
+    cpu_layer.SetUp(this->blob_bottom_vec_, this->blob_top_cpu_vec_);
+    EXPECT_EQ(algo, cpu_layer.algo());
+    EXPECT_EQ(tile, cpu_layer.winograd_tile());
+    cpu_layer.Forward(this->blob_bottom_vec_, this->blob_top_cpu_vec_);
+    ASSERT_EQ(blob_top_->shape(), blob_top_cpu_->shape());
+    for (int i = 0; i < blob_top_->count(); ++i) {
+      EXPECT_NEAR(blob_top_->cpu_data()[i], blob_top_cpu_->cpu_data()[i], 1e-3);
+    }
+  }
+
+  TBlob<Dtype>* const blob_bottom_;
+  TBlob<Dtype>* const blob_top_;
+  TBlob<Dtype>* const blob_top_cpu_;
+  vector<Blob*> blob_bottom_vec_;
+  vector<Blob*> blob_top_vec_;
+  vector<Blob*> blob_top_cpu_vec_;
+};
+
+TYPED_TEST_CASE(CPUConvolutionLayerTest, TestDtypesNoFP16);
+
+TYPED_TEST(CPUConvolutionLayerTest, TestWinograd2x2) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param = this->MakeParam(3, 1, 1, 5, 1);
+  layer_param.mutable_convolution_param()->set_winograd_tile(2);
+  // 9 x 11 outputs leave partial tiles
+  this->CheckAgainstCaffe(layer_param, CPUConvolutionLayer<Dtype, Dtype>::WINOGRAD, 2);
+}
+
+TYPED_TEST(CPUConvolutionLayerTest, TestWinograd4x4) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param = this->MakeParam(3, 1, 0, 5, 1);
+  this->CheckAgainstCaffe(layer_param, CPUConvolutionLayer<Dtype, Dtype>::WINOGRAD, 4);
+}
+
+TYPED_TEST(CPUConvolutionLayerTest, TestDepthwise) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param = this->MakeParam(3, 2, 1, 4, 4);
+  layer_param.mutable_convolution_param()->add_dilation(2);
+  this->CheckAgainstCaffe(layer_param, CPUConvolutionLayer<Dtype, Dtype>::DEPTHWISE, 0);
+}
+
+TYPED_TEST(CPUConvolutionLayerTest, TestIm2colFallback) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param = this->MakeParam(3, 2, 1, 6, 2);
+  this->CheckAgainstCaffe(layer_param, CPUConvolutionLayer<Dtype, Dtype>::IM2COL, 0);
+}
+
+}  // namespace caffe
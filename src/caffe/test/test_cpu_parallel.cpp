@@ -0,0 +1,63 @@
+#include <atomic>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/cpu_parallel.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class CpuParallelTest : public ::testing::Test {
+ protected:
+  CpuParallelTest() : threads_(CpuParallel::num_threads()) {}
+  virtual ~CpuParallelTest() {
+    CpuParallel::set_num_threads(threads_);
+  }
+
+  // Counts the times each of [0, n) is visited
+  vector<int> Visit(int n, int grain) {
+    vector<std::atomic<int>> visits(n);
+    for (std::atomic<int>& v : visits) {
+      v.store(0);
+    }
+    CpuParallel::For(n, grain, [&](int begin, int end) {
+      EXPECT_LT(begin, end);
+      for (int i = begin; i < end; ++i) {
+        visits[i].fetch_add(1);
+      }
+    });
+    return vector<int>(visits.begin(), visits.end());
+  }
+
+  const int threads_;
+};
+
+TEST_F(CpuParallelTest, TestCoversRange) {
+  for (int threads : {1, 3, 8}) {
+    CpuParallel::set_num_threads(threads);
+    for (int n : {0, 1, 7, 1000}) {
+      for (int grain : {1, 64}) {
+        EXPECT_EQ(vector<int>(n, 1), Visit(n, grain)) << threads << " " << n << " " << grain;
+      }
+    }
+  }
+}
+
+TEST_F(CpuParallelTest, TestNested) {
+  CpuParallel::set_num_threads(4);
+  std::atomic<int> total(0);
+  CpuParallel::For(16, 1, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      // Runs serially on the worker
+      CpuParallel::For(10, 1, [&](int b, int e) {
+        total.fetch_add(e - b);
+      });
+    }
+  });
+  EXPECT_EQ(160, total.load());
+}
+
+}  // namespace caffe
@@ -0,0 +1,92 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/cudnn_algo_cache.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class CuDNNAlgoCacheTest : public ::testing::Test {
+ protected:
+  CuDNNAlgoCacheTest() {
+    MakeTempFilename(&file_);
+  }
+  virtual ~CuDNNAlgoCacheTest() {
+    CuDNNAlgoCache::Reset(file_);
+    std::remove(file_.c_str());
+  }
+
+  CuDNNAlgoCache::Entry sample_entry() const {
+    CuDNNAlgoCache::Entry e;
+    e.fwd_algo = 7;
+    e.bwd_data_algo = 5;
+    e.bwd_filter_algo = 3;
+    e.fwd_cudnn_math = 1;
+    e.bwd_data_cudnn_math = 0;
+    e.bwd_filter_cudnn_math = 1;
+    e.forward_math = FLOAT;
+    e.backward_data_math = FLOAT16;
+    e.backward_filter_math = FLOAT16;
+    e.fwd_ws_size = 123456789UL;
+    e.bwd_data_ws_size = 0UL;
+    e.bwd_filter_ws_size = 42UL;
+    return e;
+  }
+
+  static void ExpectEq(const CuDNNAlgoCache::Entry& a, const CuDNNAlgoCache::Entry& b) {
+    EXPECT_EQ(a.to_string(), b.to_string());
+    EXPECT_EQ(a.fwd_algo, b.fwd_algo);
+    EXPECT_EQ(a.bwd_filter_algo, b.bwd_filter_algo);
+    EXPECT_EQ(a.backward_data_math, b.backward_data_math);
+    EXPECT_EQ(a.fwd_ws_size, b.fwd_ws_size);
+  }
+
+  string file_;
+};
+
+TEST_F(CuDNNAlgoCacheTest, TestEntryRoundTrip) {
+  CuDNNAlgoCache::Entry e = sample_entry(), r;
+  EXPECT_TRUE(r.from_string(e.to_string()));
+  ExpectEq(e, r);
+  EXPECT_FALSE(r.from_string("1 2 3"));
+  EXPECT_FALSE(r.from_string("1 2 3 0 0 0 99 1 1 0 0 0"));
+}
+
+TEST_F(CuDNNAlgoCacheTest, TestLookupMiss) {
+  CuDNNAlgoCache::Entry r;
+  EXPECT_FALSE(CuDNNAlgoCache::Lookup(file_, "no such key", &r));
+}
+
+TEST_F(CuDNNAlgoCacheTest, TestPersistence) {
+  const string key = "Some GPU,cudnn 7000,FINDEX 1024,TRAIN BD";
+  CuDNNAlgoCache::Insert(file_, key, sample_entry());
+  // Forget in-memory copy, the entry must be read back from the file
+  CuDNNAlgoCache::Reset(file_);
+  CuDNNAlgoCache::Entry r;
+  EXPECT_TRUE(CuDNNAlgoCache::Lookup(file_, key, &r));
+  ExpectEq(sample_entry(), r);
+}
+
+TEST_F(CuDNNAlgoCacheTest, TestLatestWins) {
+  const string key = "key";
+  CuDNNAlgoCache::Entry e = sample_entry();
+  CuDNNAlgoCache::Insert(file_, key, e);
+  e.fwd_algo = 1;
+  CuDNNAlgoCache::Insert(file_, key, e);
+  {
+    std::ofstream ofs(file_.c_str(), std::ios::out | std::ios::app);
+    ofs << "garbage line\n";
+  }
+  CuDNNAlgoCache::Reset(file_);
+  CuDNNAlgoCache::Entry r;
+  EXPECT_TRUE(CuDNNAlgoCache::Lookup(file_, key, &r));
+  EXPECT_EQ(1, r.fwd_algo);
+}
+
+}  // namespace caffe
@@ -0,0 +1,73 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/cudnn_workspace_arbiter.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+typedef CuDNNWorkspaceArbiter::Candidate Candidate;
+
+class CuDNNWorkspaceArbiterTest : public ::testing::Test {
+ protected:
+  // Two layers: the first one is much faster with a big workspace,
+  // the second one gains almost nothing from it
+  vector<vector<Candidate>> sample_slots() const {
+    vector<vector<Candidate>> slots(2);
+    slots[0].push_back(Candidate{1, 0, 1.F, 1000UL});
+    slots[0].push_back(Candidate{0, 0, 5.F, 10UL});
+    slots[1].push_back(Candidate{2, 0, 4.99F, 5000UL});
+    slots[1].push_back(Candidate{0, 0, 5.F, 20UL});
+    return slots;
+  }
+};
+
+TEST_F(CuDNNWorkspaceArbiterTest, TestSolveTradesNegligibleGain) {
+  vector<int> choices;
+  const size_t workspace = CuDNNWorkspaceArbiter::Solve(sample_slots(), 10000UL, &choices);
+  // 5000 bytes would save 0.01 of 6 units of time
+  EXPECT_EQ(1000UL, workspace);
+  ASSERT_EQ(2, choices.size());
+  EXPECT_EQ(0, choices[0]);
+  EXPECT_EQ(1, choices[1]);
+}
+
+TEST_F(CuDNNWorkspaceArbiterTest, TestSolveRespectsBudget) {
+  vector<int> choices;
+  EXPECT_EQ(20UL, CuDNNWorkspaceArbiter::Solve(sample_slots(), 999UL, &choices));
+  EXPECT_EQ(1, choices[0]);
+  EXPECT_EQ(1, choices[1]);
+  // Nothing fits: smallest requirements
+  EXPECT_EQ(20UL, CuDNNWorkspaceArbiter::Solve(sample_slots(), 5UL, &choices));
+  EXPECT_EQ(1, choices[0]);
+  EXPECT_EQ(1, choices[1]);
+}
+
+TEST_F(CuDNNWorkspaceArbiterTest, TestDecision) {
+  const int device = 1000;  // not a real one
+  int layer1, layer2;
+  vector<vector<Candidate>> slots = sample_slots();
+  CuDNNWorkspaceArbiter::Submit(device, &layer1, 0, slots[0]);
+  CuDNNWorkspaceArbiter::Submit(device, &layer2, 2, slots[1]);
+  Candidate choice;
+  size_t workspace = 0UL;
+  EXPECT_FALSE(CuDNNWorkspaceArbiter::Decision(device, &layer1, 1, 10000UL, &choice));
+  ASSERT_TRUE(CuDNNWorkspaceArbiter::Decision(device, &layer2, 2, 10000UL, &choice,
+      &workspace));
+  EXPECT_EQ(0, choice.algo);
+  EXPECT_EQ(1000UL, workspace);
+  // Solved once, the budget of later calls doesn't matter
+  ASSERT_TRUE(CuDNNWorkspaceArbiter::Decision(device, &layer1, 0, 0UL, &choice));
+  EXPECT_EQ(1, choice.algo);
+  CuDNNWorkspaceArbiter::Withdraw(device, &layer2);
+  ASSERT_TRUE(CuDNNWorkspaceArbiter::Decision(device, &layer1, 0, 100UL, &choice, &workspace));
+  EXPECT_EQ(0, choice.algo);
+  EXPECT_EQ(10UL, workspace);
+  CuDNNWorkspaceArbiter::Withdraw(device, &layer1);
+  EXPECT_FALSE(CuDNNWorkspaceArbiter::Decision(device, &layer1, 0, 100UL, &choice));
+}
+
+}  // namespace caffe
@@ -0,0 +1,88 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/dag_executor.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class DagExecutorTest : public ::testing::Test {
+ protected:
+  // Diamond with a tail: 0 -> {1, 2} -> 3 -> 4
+  DagExecutorTest() : deps_{{}, {0}, {0}, {1, 2}, {3}} {}
+
+  // Runs the graph, records the order nodes finished in
+  vector<int> Run(DagExecutor* executor, const vector<bool>& caller_only,
+      vector<std::thread::id>* threads = nullptr) {
+    vector<int> order;
+    std::mutex mutex;
+    if (threads != nullptr) {
+      threads->assign(deps_.size(), std::thread::id());
+    }
+    executor->Run(deps_, caller_only, [&](int node) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(node == 1 ? 20 : 1));
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(node);
+      if (threads != nullptr) {
+        (*threads)[node] = std::this_thread::get_id();
+      }
+    });
+    return order;
+  }
+
+  // Position of every node in order
+  static vector<int> Positions(const vector<int>& order) {
+    vector<int> pos(order.size(), -1);
+    for (int i = 0; i < order.size(); ++i) {
+      pos[order[i]] = i;
+    }
+    return pos;
+  }
+
+  vector<vector<int>> deps_;
+};
+
+TEST_F(DagExecutorTest, TestDependenciesRespected) {
+  std::atomic<int> initialized(0);
+  {
+    DagExecutor executor(2, [&initialized]() { ++initialized; });
+    for (int pass = 0; pass < 3; ++pass) {
+      const vector<int> order = Run(&executor, vector<bool>());
+      ASSERT_EQ(deps_.size(), order.size());
+      const vector<int> pos = Positions(order);
+      for (int node = 0; node < deps_.size(); ++node) {
+        ASSERT_GE(pos[node], 0);
+        for (int dep : deps_[node]) {
+          EXPECT_LT(pos[dep], pos[node]);
+        }
+      }
+      // 2 doesn't wait for the slow 1
+      EXPECT_LT(pos[2], pos[1]);
+    }
+  }
+  EXPECT_EQ(2, initialized.load());
+}
+
+TEST_F(DagExecutorTest, TestCallerOnly) {
+  DagExecutor executor(2, std::function<void()>());
+  vector<std::thread::id> threads;
+  const vector<bool> caller_only = {true, false, false, false, true};
+  Run(&executor, caller_only, &threads);
+  EXPECT_EQ(std::this_thread::get_id(), threads[0]);
+  EXPECT_EQ(std::this_thread::get_id(), threads[4]);
+}
+
+TEST_F(DagExecutorTest, TestNoHelpersRunsInOrder) {
+  DagExecutor executor(0, std::function<void()>());
+  const vector<int> order = Run(&executor, vector<bool>());
+  EXPECT_EQ(vector<int>({0, 1, 2, 3, 4}), order);
+}
+
+}  // namespace caffe
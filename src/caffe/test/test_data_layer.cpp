@@ -1,3 +1,6 @@
+#include <boost/thread.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
 #include <memory>
 #include <string>
 #include <vector>
@@ -7,11 +10,14 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/data_service.hpp"
 #include "caffe/layers/data_layer.hpp"
+#include "caffe/layers/remote_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/type.hpp"
 #include "caffe/util/db.hpp"
+#include "caffe/util/format.hpp"
 #include "caffe/util/io.hpp"
 
 
@@ -67,7 +73,70 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     db->Close();
   }
 
-  void TestRead(bool use_gpu_transform = false) {
+  // Fill the DB with encoded 3x4 gray images, each one filled by its label
+  void FillEncoded(DataParameter_DB backend) {
+    backend_ = backend;
+    unique_ptr<db::DB> db(db::GetDB(backend));
+    db->Open(*filename_, db::NEW);
+    unique_ptr<db::Transaction> txn(db->NewTransaction());
+    for (int i = 0; i < 5; ++i) {
+      cv::Mat img(3, 4, CV_8UC1, cv::Scalar(i));
+      vector<uchar> buf;
+      CHECK(cv::imencode(".png", img, buf));
+      Datum datum;
+      datum.set_label(i);
+      datum.set_encoded(true);
+      datum.set_data(string(buf.begin(), buf.end()));
+      string out;
+      CHECK(datum.SerializeToString(&out));
+      txn->Put(std::to_string(i), out);
+    }
+    txn->Commit();
+    db->Close();
+  }
+
+  void TestReadEncoded(bool zero_copy, bool use_gpu_transform = false,
+      TransformationParameter_DecodeEngine engine = TransformationParameter_DecodeEngine_DEFAULT,
+      unsigned int cache_decoded_mb = 0U, unsigned int echo_factor = 1U) {
+    const Dtype scale = 3;
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_zero_copy(zero_copy);
+    if (cache_decoded_mb > 0U) {
+      data_param->set_cache(true);
+      data_param->set_cache_decoded_mb(cache_decoded_mb);
+    }
+    data_param->set_echo_factor(echo_factor);
+    data_param->set_echo_auto(false);
+    TransformationParameter* transform_param = param.mutable_transform_param();
+    transform_param->set_scale(scale);
+    transform_param->set_use_gpu_transform(use_gpu_transform);
+    transform_param->set_decode_engine(engine);
+
+    DataLayer<Dtype, Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    EXPECT_EQ(blob_top_data_->num(), 5);
+    EXPECT_EQ(blob_top_data_->channels(), 1);
+    EXPECT_EQ(blob_top_data_->height(), 3);
+    EXPECT_EQ(blob_top_data_->width(), 4);
+    for (int iter = 0; iter < 20; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(i, static_cast<int>(blob_top_label_->cpu_data()[i]));
+        for (int j = 0; j < 12; ++j) {
+          EXPECT_EQ(scale * i, blob_top_data_->cpu_data()[i * 12 + j])
+                    << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+  }
+
+  void TestRead(bool use_gpu_transform = false, unsigned int read_ahead = 0U,
+      bool auto_tune = false, bool cache_compress = false, unsigned int echo_factor = 1U) {
     const Dtype scale = 3;
     LayerParameter param;
     param.set_phase(TRAIN);
@@ -76,6 +145,19 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
     data_param->set_threads(data_param->backend() == DataParameter_DB_LEVELDB ? 1 : 3);
+    data_param->set_read_ahead(read_ahead);
+    if (auto_tune) {
+      // Forward costs nothing here: the net keeps waiting and threads get added
+      data_param->set_auto_tune(true);
+      data_param->set_auto_tune_interval(5U);
+      data_param->set_auto_tune_cpu_budget(6U);
+    }
+    if (cache_compress) {
+      data_param->set_cache(true);
+      data_param->set_cache_compress(true);
+    }
+    data_param->set_echo_factor(echo_factor);
+    data_param->set_echo_auto(false);
 
     TransformationParameter* transform_param = param.mutable_transform_param();
     transform_param->set_scale(scale);
@@ -104,6 +186,16 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
         }
       }
     }
+    if (cache_compress) {
+      DataPipeStats stats;
+      ASSERT_TRUE(layer.data_pipe_stats(&stats));
+      EXPECT_GT(stats.cache_hits, stats.cache_misses);
+    }
+    if (echo_factor > 1U) {
+      DataPipeStats stats;
+      ASSERT_TRUE(layer.data_pipe_stats(&stats));
+      EXPECT_LT(stats.unique_samples, stats.samples);
+    }
   }
 
   void TestReshape(DataParameter_DB backend) {
@@ -171,6 +263,56 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  void TestBucketByShape(DataParameter_DB backend) {
+    const int num_inputs = 6;
+    // Heights alternate, thus records 0, 2, 4 and 1, 3, 5 share shapes
+    unique_ptr<db::DB> db(db::GetDB(backend));
+    db->Open(*filename_, db::NEW);
+    unique_ptr<db::Transaction> txn(db->NewTransaction());
+    for (int i = 0; i < num_inputs; ++i) {
+      Datum datum;
+      datum.set_label(i);
+      datum.set_channels(1);
+      datum.set_height(i % 2 + 1);
+      datum.set_width(3);
+      datum.mutable_data()->assign(datum.height() * datum.width(), static_cast<char>(i));
+      string out;
+      CHECK(datum.SerializeToString(&out));
+      txn->Put(format_int(i, 2), out);
+    }
+    txn->Commit();
+    db->Close();
+
+    LayerParameter param;
+    param.set_phase(TEST);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(2);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend);
+    data_param->set_bucket_by_shape(true);
+
+    DataLayer<Dtype, Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    // Buckets fill up in turns, records wrap around the end
+    const int heights[] = {1, 2, 1, 2};
+    const int labels[][2] = {{0, 2}, {1, 3}, {4, 0}, {5, 1}};
+    for (int iter = 0; iter < 4; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      EXPECT_EQ(2, blob_top_data_->num());
+      EXPECT_EQ(heights[iter], blob_top_data_->height()) << "debug: iter " << iter;
+      EXPECT_EQ(3, blob_top_data_->width());
+      for (int i = 0; i < 2; ++i) {
+        EXPECT_EQ(labels[iter][i], static_cast<int>(blob_top_label_->cpu_data()[i]))
+            << "debug: iter " << iter << " i " << i;
+        const int size = blob_top_data_->offset(1);
+        for (int j = 0; j < size; ++j) {
+          EXPECT_EQ(labels[iter][i], static_cast<int>(blob_top_data_->cpu_data()[i * size + j]))
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+  }
+
   void TestReadCrop(Phase phase, bool use_gpu_transform = false) {
     const Dtype scale = 3;
     LayerParameter param;
@@ -365,6 +507,10 @@ TYPED_TEST(DataLayerTest, TestReshapeLevelDB) {
   this->TestReshape(DataParameter_DB_LEVELDB);
 }
 
+TYPED_TEST(DataLayerTest, TestBucketByShapeLevelDB) {
+  this->TestBucketByShape(DataParameter_DB_LEVELDB);
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTrainLevelDB) {
   const bool unique_pixels = true;  // all images the same; pixels different
   this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
@@ -436,10 +582,182 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestRemoteReadLMDB) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->Fill(false, DataParameter_DB_LMDB);
+  DataServiceWorker worker(0);
+  boost::thread serving([&worker]() { worker.Serve(); });
+  const Dtype scale = 3;
+  LayerParameter param;
+  param.set_phase(TRAIN);
+  DataParameter* data_param = param.mutable_data_param();
+  data_param->set_batch_size(5);
+  data_param->set_source(this->filename_->c_str());
+  data_param->set_backend(DataParameter_DB_LMDB);
+  data_param->set_threads(2);
+  data_param->set_parser_threads(1);
+  param.mutable_transform_param()->set_scale(scale);
+  param.mutable_remote_data_param()->set_server("127.0.0.1:" + std::to_string(worker.port()));
+  param.mutable_remote_data_param()->set_queue_depth(2U);
+  {
+    RemoteDataLayer<Dtype, Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_EQ(this->blob_top_data_->num(), 5);
+    EXPECT_EQ(this->blob_top_data_->channels(), 2);
+    EXPECT_EQ(this->blob_top_label_->num(), 5);
+    // Records come in the order of a local Data layer
+    for (int iter = 0; iter < 20; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(i, static_cast<int>(this->blob_top_label_->cpu_data()[i]));
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(scale * i, this->blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+  }
+  worker.Stop();
+  serving.join();
+}
+
+TYPED_TEST(DataLayerTest, TestDataPipeStatsLMDB) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->Fill(false, DataParameter_DB_LMDB);
+  LayerParameter param;
+  param.set_phase(TRAIN);
+  DataParameter* data_param = param.mutable_data_param();
+  data_param->set_batch_size(5);
+  data_param->set_source(this->filename_->c_str());
+  data_param->set_backend(DataParameter_DB_LMDB);
+  data_param->set_threads(2);
+  data_param->set_parser_threads(1);
+  DataLayer<Dtype, Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int iter = 0; iter < 10; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  }
+  DataPipeStats stats;
+  ASSERT_TRUE(layer.data_pipe_stats(&stats));
+  // Prefetch threads may be ahead of the net
+  EXPECT_GE(stats.batches, 10UL);
+  EXPECT_GE(stats.samples, 50UL);
+  EXPECT_EQ(2UL, stats.transformer_threads);
+  EXPECT_EQ(1UL, stats.parser_threads);
+  EXPECT_LE(stats.batches_queued, stats.batches_capacity);
+  EXPECT_LE(stats.datums_queued, stats.datums_capacity);
+  EXPECT_GT(stats.batch_bytes, 0UL);
+}
+
+// Order of records is the same when they're requested ahead
+TYPED_TEST(DataLayerTest, TestReadLMDBReadAhead) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(false, 7U);
+}
+
+// Records keep coming in order while threads are added at runtime
+TYPED_TEST(DataLayerTest, TestReadLMDBAutoTune) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(false, 0U, true);
+}
+
+// Echoed batches are transformed again from kept copies of the records
+TYPED_TEST(DataLayerTest, TestReadLMDBEcho) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(false, 0U, false, false, 3U);
+}
+
+// SolverParameter::input_shape_schedule: batches of the new shapes continue the records
+TYPED_TEST(DataLayerTest, TestSetInputShapeLMDB) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->Fill(false, DataParameter_DB_LMDB);
+  LayerParameter param;
+  param.set_phase(TRAIN);
+  DataParameter* data_param = param.mutable_data_param();
+  data_param->set_batch_size(5);
+  data_param->set_source(this->filename_->c_str());
+  data_param->set_backend(DataParameter_DB_LMDB);
+  data_param->set_threads(3);
+  DataLayer<Dtype, Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  int record = 0;
+  auto check = [&](int batch_size, int height, int width) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_EQ(batch_size, this->blob_top_data_->num());
+    EXPECT_EQ(2, this->blob_top_data_->channels());
+    EXPECT_EQ(height, this->blob_top_data_->height());
+    EXPECT_EQ(width, this->blob_top_data_->width());
+    const int dim = 2 * height * width;
+    for (int i = 0; i < batch_size; ++i, ++record) {
+      EXPECT_EQ(record % 5, static_cast<int>(this->blob_top_label_->cpu_data()[i]));
+      // All pixels of a record are its label, whatever the crop
+      EXPECT_EQ(record % 5, static_cast<int>(this->blob_top_data_->cpu_data()[i * dim]));
+    }
+  };
+  check(5, 3, 4);
+  check(5, 3, 4);
+  ASSERT_TRUE(layer.set_input_shape(3, 2));
+  for (int iter = 0; iter < 4; ++iter) {
+    check(3, 2, 2);
+  }
+  // Back to the shapes of the parameter
+  ASSERT_TRUE(layer.set_input_shape(-1, -1));
+  for (int iter = 0; iter < 4; ++iter) {
+    check(5, 3, 4);
+  }
+}
+
+// Later epochs come from the compressed cache, in the same order
+TYPED_TEST(DataLayerTest, TestReadLMDBCacheCompressed) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(false, 0U, false, true);
+}
+
+TYPED_TEST(DataLayerTest, TestReadEncodedLMDB) {
+  this->FillEncoded(DataParameter_DB_LMDB);
+  this->TestReadEncoded(false);
+}
+
+TYPED_TEST(DataLayerTest, TestReadEncodedZeroCopyLMDB) {
+  this->FillEncoded(DataParameter_DB_LMDB);
+  this->TestReadEncoded(true);
+}
+
+// Records are decoded once while cached, later epochs read raw pixels
+TYPED_TEST(DataLayerTest, TestReadEncodedCacheDecodedLMDB) {
+  this->FillEncoded(DataParameter_DB_LMDB);
+  this->TestReadEncoded(false, false, TransformationParameter_DecodeEngine_DEFAULT, 1U);
+}
+
+// Zero-copy records are kept decoded for echoing
+TYPED_TEST(DataLayerTest, TestReadEncodedZeroCopyLMDBEcho) {
+  this->FillEncoded(DataParameter_DB_LMDB);
+  this->TestReadEncoded(true, false, TransformationParameter_DecodeEngine_DEFAULT, 0U, 2U);
+}
+
+TYPED_TEST(DataLayerTest, TestReadEncodedLMDBGPUTransform) {
+  this->FillEncoded(DataParameter_DB_LMDB);
+  this->TestReadEncoded(true, true);
+}
+
+// Non-JPEG images are decoded on CPU even if NVJPEG engine is requested
+TYPED_TEST(DataLayerTest, TestReadEncodedLMDBNvJpegFallback) {
+  this->FillEncoded(DataParameter_DB_LMDB);
+  this->TestReadEncoded(true, true, TransformationParameter_DecodeEngine_NVJPEG);
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLMDB) {
   this->TestReshape(DataParameter_DB_LMDB);
 }
 
+TYPED_TEST(DataLayerTest, TestBucketByShapeLMDB) {
+  this->TestBucketByShape(DataParameter_DB_LMDB);
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTrainLMDB) {
   const bool unique_pixels = true;  // all images the same; pixels different
   this->Fill(unique_pixels, DataParameter_DB_LMDB);
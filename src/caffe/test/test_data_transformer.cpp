@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <string>
 #include <vector>
 
@@ -8,6 +10,7 @@
 #include "caffe/data_transformer.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/gpu_memory.hpp"
 #include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -340,6 +343,40 @@ TYPED_TEST(DataTransformTest, TestMeanFile) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestSampleKeyed) {
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(4);
+  transform_param.set_mirror(true);
+  Datum datum;
+  FillDatum(0, 3, 10, 12, true, &datum);
+  // Transformers of different threads, records transformed in different orders
+  Caffe::set_random_seed(this->seed_);
+  DataTransformer first(transform_param, TRAIN), second(transform_param, TRAIN);
+  first.set_sample_seed(this->seed_);
+  second.set_sample_seed(this->seed_);
+  const int records = 20;
+  vector<vector<TypeParam>> crops(records);
+  TBlob<TypeParam> blob(1, 3, 4, 4);
+  for (int r = 0; r < records; ++r) {
+    first.set_sample(r, 0U);
+    first.Transform(datum, &blob);
+    crops[r].assign(blob.cpu_data(), blob.cpu_data() + blob.count());
+  }
+  int echo_matches = 0;
+  for (int r = records - 1; r >= 0; --r) {
+    second.set_sample(r, 0U);
+    second.Transform(datum, &blob);
+    for (int j = 0; j < blob.count(); ++j) {
+      EXPECT_EQ(crops[r][j], blob.cpu_data()[j]);
+    }
+    // Echoes draw anew
+    second.set_sample(r, 1U);
+    second.Transform(datum, &blob);
+    echo_matches += std::equal(crops[r].begin(), crops[r].end(), blob.cpu_data());
+  }
+  EXPECT_LT(echo_matches, records);
+}
+
 template <typename Dtype>
 class VarSzTransformsTest : public ::testing::Test {
  protected:
@@ -397,6 +434,69 @@ TYPED_TEST(VarSzTransformsTest, TestVarSzImgCenterCrop) {
   this->Run(transform_param, 3, 3);
 }
 
+template <typename Dtype>
+class FusedJpegDecodeTest : public ::testing::Test {
+ protected:
+  FusedJpegDecodeTest() : seed_(1701) {}
+
+  // Transforms encoded 480x360 image, returns output shape
+  vector<int> Run(TransformationParameter transform_param, Phase phase, vector<Dtype>* out) {
+    Datum datum;
+    CHECK(ReadFileToDatum(EXAMPLES_SOURCE_DIR "images/cat.jpg", &datum));
+    DataTransformer transformer(transform_param, phase);
+    Caffe::set_random_seed(seed_);
+    transformer.InitRand();
+    out->assign(3 * 480 * 360, Dtype(0));
+    Packing packing;
+    return transformer.Transform(&datum, out->data(), out->size(), packing);
+  }
+
+  int seed_;
+};
+
+TYPED_TEST_CASE(FusedJpegDecodeTest, TestDtypesNoFP16);
+
+TYPED_TEST(FusedJpegDecodeTest, TestCropMatchesDefault) {
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(227);
+  transform_param.set_mirror(true);
+  transform_param.set_scale(0.5F);
+  transform_param.add_mean_value(104.F);
+  transform_param.add_mean_value(117.F);
+  transform_param.add_mean_value(123.F);
+  vector<TypeParam> expected, actual;
+  const vector<int> expected_shape = this->Run(transform_param, TRAIN, &expected);
+  transform_param.set_fused_jpeg_decode(true);
+  // No resize: the same pixels must be cropped
+  const vector<int> shape = this->Run(transform_param, TRAIN, &actual);
+  EXPECT_EQ(expected_shape, shape);
+  for (int i = 0; i < 3 * 227 * 227; ++i) {
+    EXPECT_EQ(expected[i], actual[i]) << i;
+  }
+}
+
+TYPED_TEST(FusedJpegDecodeTest, TestScaledDecode) {
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(160);
+  // Shorter side 360 -> 180, i.e. decoded at 1/2 scale
+  transform_param.set_img_rand_resize_lower(180);
+  transform_param.set_img_rand_resize_upper(180);
+  vector<TypeParam> expected, actual;
+  this->Run(transform_param, TEST, &expected);
+  transform_param.set_fused_jpeg_decode(true);
+  const vector<int> shape = this->Run(transform_param, TEST, &actual);
+  EXPECT_EQ(3, shape[1]);
+  EXPECT_EQ(160, shape[2]);
+  EXPECT_EQ(160, shape[3]);
+  // Resampling differs but average intensity is preserved
+  double expected_sum = 0., actual_sum = 0.;
+  for (int i = 0; i < 3 * 160 * 160; ++i) {
+    expected_sum += expected[i];
+    actual_sum += actual[i];
+  }
+  EXPECT_NEAR(expected_sum / (3 * 160 * 160), actual_sum / (3 * 160 * 160), 3.);
+}
+
 #ifndef CPU_ONLY
 // GPU-based transform tests
 template <typename Dtype>
@@ -672,6 +772,84 @@ TYPED_TEST(GPUDataTransformTest, TestMeanFile) {
     EXPECT_EQ(blob.cpu_data()[j], 0);
   }
 }
+
+// Augments the raw datum as Data layers do with random resize or color jitter
+template <typename Dtype>
+void AugmentDatum(DataTransformer* transformer, const Datum& datum, TBlob<Dtype>* blob) {
+  AugmentSample sample;
+  sample.image_offset = 0UL;
+  sample.planar = 1;
+  const vector<int> shape = transformer->SampleAugment(datum.height(), datum.width(),
+      datum.channels(), &sample);
+  blob->Reshape(vector<int>{1, shape[0], shape[1], shape[2]});
+  GPUMemory::Workspace images(datum.data().size()), samples(sizeof(AugmentSample));
+  CUDA_CHECK(cudaMemcpy(images.data(), datum.data().data(), datum.data().size(),
+      cudaMemcpyHostToDevice));
+  CUDA_CHECK(cudaMemcpy(samples.data(), &sample, sizeof(AugmentSample),
+      cudaMemcpyHostToDevice));
+  transformer->AugmentGPU(1, shape[0], shape[1], shape[2],
+      static_cast<const AugmentSample*>(samples.data()),
+      static_cast<const uint8_t*>(images.data()), blob->mutable_gpu_data(), NCHW);
+}
+
+TYPED_TEST(GPUDataTransformTest, TestAugmentCropMatchesTransform) {
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(4);
+  transform_param.add_mean_value(10.F);
+  transform_param.set_scale(0.5F);
+  transform_param.set_brightness(0.5F);  // TRAIN phase only
+  Datum datum;
+  FillDatum(0, 3, 6, 7, true, &datum);
+  DataTransformer transformer(transform_param, TEST);
+  transformer.InitRand();
+  TBlob<TypeParam> blob(1, 3, 4, 4), augmented;
+  transformer.Transform(datum, &blob);
+  AugmentDatum(&transformer, datum, &augmented);
+  ASSERT_EQ(blob.shape(), augmented.shape());
+  for (int j = 0; j < blob.count(); ++j) {
+    EXPECT_NEAR(blob.cpu_data()[j], augmented.cpu_data()[j], 1e-4);
+  }
+}
+
+TYPED_TEST(GPUDataTransformTest, TestAugmentRandomResize) {
+  TransformationParameter transform_param;
+  transform_param.set_img_rand_resize_lower(3);
+  transform_param.set_img_rand_resize_upper(3);
+  Datum datum;
+  FillDatum(50, 3, 6, 8, false, &datum);
+  DataTransformer transformer(transform_param, TRAIN);
+  transformer.InitRand();
+  TBlob<TypeParam> augmented;
+  AugmentDatum(&transformer, datum, &augmented);
+  EXPECT_EQ((vector<int>{1, 3, 3, 4}), augmented.shape());
+  for (int j = 0; j < augmented.count(); ++j) {
+    EXPECT_NEAR(50, augmented.cpu_data()[j], 1e-4);
+  }
+}
+
+TYPED_TEST(GPUDataTransformTest, TestAugmentColorJitter) {
+  TransformationParameter transform_param;
+  transform_param.set_brightness(0.5F);
+  transform_param.set_contrast(0.5F);
+  transform_param.set_saturation(0.5F);
+  transform_param.set_hue(0.3F);
+  DataTransformer transformer(transform_param, TRAIN);
+  transformer.InitRand();
+  // Saturation and hue keep grays, brightness and contrast change all pixels alike
+  Datum datum;
+  FillDatum(80, 3, 4, 5, false, &datum);
+  TBlob<TypeParam> augmented;
+  bool changed = false;
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    AugmentDatum(&transformer, datum, &augmented);
+    const TypeParam first = augmented.cpu_data()[0];
+    changed = changed || std::fabs(first - 80) > 1;
+    for (int j = 0; j < augmented.count(); ++j) {
+      EXPECT_NEAR(first, augmented.cpu_data()[j], 0.5);
+    }
+  }
+  EXPECT_TRUE(changed);
+}
 #endif
 
 }  // namespace caffe
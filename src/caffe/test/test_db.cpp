@@ -7,6 +7,7 @@
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/db_rank_shards.hpp"
 #include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -93,6 +94,22 @@ TYPED_TEST(DBTest, TestSeekToFirst) {
   EXPECT_EQ(datum.width(), 480);
 }
 
+TYPED_TEST(DBTest, TestSeekToKey) {
+  unique_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  unique_ptr<db::Cursor> cursor(db->NewCursor());
+  EXPECT_TRUE(cursor->SeekToKey("fish-bike.jpg"));
+  EXPECT_EQ(cursor->key(), "fish-bike.jpg");
+  Datum datum;
+  EXPECT_TRUE(cursor->parse(&datum));
+  EXPECT_EQ(datum.height(), 323);
+  cursor->Next();
+  EXPECT_FALSE(cursor->valid());
+  EXPECT_TRUE(cursor->SeekToKey("cat.jpg"));
+  EXPECT_EQ(cursor->key(), "cat.jpg");
+  EXPECT_FALSE(cursor->SeekToKey("dog.jpg"));
+}
+
 TYPED_TEST(DBTest, TestKeyValue) {
   unique_ptr<db::DB> db(db::GetDB(TypeParam::backend));
   db->Open(this->source_, db::READ);
@@ -132,6 +149,69 @@ TYPED_TEST(DBTest, TestWrite) {
   txn->Commit();
 }
 
+TYPED_TEST(DBTest, TestConcurrentReaders) {
+  DataParameter param;
+  param.set_leveldb_cache_mb(8U);
+  param.set_leveldb_fill_cache(false);
+  unique_ptr<db::DB> db0(db::GetDB(TypeParam::backend));
+  unique_ptr<db::DB> db1(db::GetDB(TypeParam::backend));
+  db0->Configure(param);
+  db1->Configure(param);
+  db0->Open(this->source_, db::READ);
+  db1->Open(this->source_, db::READ);
+  unique_ptr<db::Cursor> cursor0(db0->NewCursor());
+  unique_ptr<db::Cursor> cursor1(db1->NewCursor());
+  cursor1->Next();
+  EXPECT_EQ(cursor0->key(), "cat.jpg");
+  EXPECT_EQ(cursor1->key(), "fish-bike.jpg");
+  // The first reader closing leaves the other one's handle open
+  cursor0.reset();
+  db0->Close();
+  cursor1->SeekToFirst();
+  EXPECT_EQ(cursor1->key(), "cat.jpg");
+  cursor1->Next();
+  cursor1->Next();
+  EXPECT_FALSE(cursor1->valid());
+}
+
+TYPED_TEST(DBTest, TestRankShards) {
+  string source;
+  MakeTempDir(&source);
+  source += "/shards";
+  EXPECT_EQ(db::RankShardsDB::Count(this->source_), 0UL);
+  {
+    db::RankShardsDB db(TypeParam::backend);
+    db.set_shards(2UL);
+    db.Open(source, db::NEW);
+    unique_ptr<db::Transaction> txn(db.NewTransaction());
+    for (int i = 0; i < 5; ++i) {
+      txn->Put(format_int(i, 8), format_int(i));
+    }
+    txn->Commit();
+  }
+  EXPECT_EQ(db::RankShardsDB::Count(source), 2UL);
+  // Whole source reads in the order written
+  db::RankShardsDB all(TypeParam::backend);
+  all.Open(source, db::READ);
+  unique_ptr<db::Cursor> cursor(all.NewCursor());
+  for (int i = 0; i < 5; ++i) {
+    ASSERT_TRUE(cursor->valid());
+    EXPECT_EQ(cursor->value(), format_int(i));
+    cursor->Next();
+  }
+  EXPECT_FALSE(cursor->valid());
+  // Shard 1 holds every other record
+  db::RankShardsDB one(TypeParam::backend);
+  one.select(vector<size_t>(1, 1UL));
+  one.Open(source, db::READ);
+  cursor.reset(one.NewCursor());
+  EXPECT_EQ(cursor->value(), "1");
+  cursor->Next();
+  EXPECT_EQ(cursor->value(), "3");
+  cursor->Next();
+  EXPECT_FALSE(cursor->valid());
+}
+
 }  // namespace caffe
 
 #endif  // USE_LEVELDB, USE_LMDB
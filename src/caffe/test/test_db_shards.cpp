@@ -0,0 +1,127 @@
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db_shards.hpp"
+#include "caffe/util/format.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+using std::unique_ptr;
+
+class DBShardsTest : public ::testing::Test {
+ protected:
+  DBShardsTest() : count_(50) {}
+
+  virtual void SetUp() {
+    MakeTempDir(&source_);
+    source_ += "/shards";
+    db::ShardsDB db;
+    // Few records per shard
+    db.set_shard_size(200UL);
+    db.Open(source_, db::NEW);
+    unique_ptr<db::Transaction> txn(db.NewTransaction());
+    for (int i = 0; i < count_; ++i) {
+      Datum datum;
+      datum.set_label(i);
+      datum.set_data(string(i, 'x'));
+      string out;
+      CHECK(datum.SerializeToString(&out));
+      txn->Put(format_int(i, 4), out);
+    }
+    txn->Commit();
+  }
+
+  // Reads one pass, returns labels
+  vector<int> ReadAll(db::Cursor* cursor) {
+    vector<int> labels;
+    for (; cursor->valid(); cursor->Next()) {
+      Datum datum;
+      EXPECT_TRUE(cursor->parse(&datum));
+      EXPECT_EQ(format_int(datum.label(), 4), cursor->key());
+      EXPECT_EQ(datum.label(), datum.data().size());
+      labels.push_back(datum.label());
+    }
+    return labels;
+  }
+
+  const int count_;
+  string source_;
+};
+
+TEST_F(DBShardsTest, TestGetDB) {
+  unique_ptr<db::DB> db(db::GetDB(DataParameter_DB_SHARDS));
+  EXPECT_NE(nullptr, dynamic_cast<db::ShardsDB*>(db.get()));
+  db.reset(db::GetDB("shards"));
+  EXPECT_NE(nullptr, dynamic_cast<db::ShardsDB*>(db.get()));
+}
+
+TEST_F(DBShardsTest, TestSequential) {
+  unique_ptr<db::DB> db(db::GetDB(DataParameter_DB_SHARDS));
+  DataParameter param;
+  param.set_shard_window_mb(0U);  // smallest window: every record refills it
+  db->Configure(param);
+  db->Open(source_, db::READ);
+  unique_ptr<db::Cursor> cursor(db->NewCursor());
+  vector<int> labels = ReadAll(cursor.get());
+  ASSERT_EQ(count_, labels.size());
+  for (int i = 0; i < count_; ++i) {
+    EXPECT_EQ(i, labels[i]);
+  }
+  cursor->SeekToFirst();
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ("0000", cursor->key());
+}
+
+TEST_F(DBShardsTest, TestShuffle) {
+  DataParameter param;
+  param.set_shuffle(true);
+  param.set_shard_shuffle_buffer(8U);
+  unique_ptr<db::DB> db(db::GetDB(DataParameter_DB_SHARDS));
+  db->Configure(param);
+  db->Open(source_, db::READ);
+  unique_ptr<db::Cursor> cursor1(db->NewCursor());
+  unique_ptr<db::Cursor> cursor2(db->NewCursor());
+  const vector<int> labels1 = ReadAll(cursor1.get());
+  const vector<int> labels2 = ReadAll(cursor2.get());
+  // Every cursor of the source yields the same permutation
+  EXPECT_EQ(labels1, labels2);
+  EXPECT_EQ(count_, std::set<int>(labels1.begin(), labels1.end()).size());
+  vector<int> sorted(labels1);
+  std::sort(sorted.begin(), sorted.end());
+  EXPECT_NE(sorted, labels1);
+  // Next epoch is shuffled differently
+  cursor1->SeekToFirst();
+  const vector<int> labels3 = ReadAll(cursor1.get());
+  EXPECT_EQ(count_, labels3.size());
+  EXPECT_NE(labels1, labels3);
+}
+
+TEST_F(DBShardsTest, TestAppend) {
+  {
+    db::ShardsDB db;
+    db.Open(source_, db::WRITE);
+    unique_ptr<db::Transaction> txn(db.NewTransaction());
+    Datum datum;
+    datum.set_label(count_);
+    datum.set_data(string(count_, 'x'));
+    string out;
+    CHECK(datum.SerializeToString(&out));
+    txn->Put(format_int(count_, 4), out);
+    txn->Commit();
+  }
+  unique_ptr<db::DB> db(db::GetDB(DataParameter_DB_SHARDS));
+  db->Open(source_, db::READ);
+  unique_ptr<db::Cursor> cursor(db->NewCursor());
+  EXPECT_EQ(count_ + 1, ReadAll(cursor.get()).size());
+}
+
+}  // namespace caffe
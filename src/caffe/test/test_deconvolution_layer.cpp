@@ -5,6 +5,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/layers/cudnn_deconv_layer.hpp"
 #include "caffe/layers/deconv_layer.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -292,4 +293,128 @@ TYPED_TEST(DeconvolutionLayerTest, TestGradient3D) {
   checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
 }
 
+#ifdef USE_CUDNN
+
+template <typename Dtype>
+class CuDNNDeconvolutionLayerTest : public GPUDeviceTest<Dtype> {
+ protected:
+  CuDNNDeconvolutionLayerTest() : blob_bottom_(new TBlob<Dtype>(2, 3, 6, 4)),
+                                  blob_top_(new TBlob<Dtype>()),
+                                  ref_blob_bottom_(new TBlob<Dtype>()),
+                                  ref_blob_top_(new TBlob<Dtype>()) {}
+
+  virtual void SetUp() {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    ref_blob_bottom_->CopyFrom(*blob_bottom_, false, true);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    ref_blob_bottom_vec_.push_back(ref_blob_bottom_);
+    ref_blob_top_vec_.push_back(ref_blob_top_);
+  }
+
+  virtual ~CuDNNDeconvolutionLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete ref_blob_bottom_;
+    delete ref_blob_top_;
+  }
+
+  // Forward and backward of both engines on the same weights and top diff
+  void CheckMatchesCaffe(const LayerParameter& layer_param) {
+    CuDNNDeconvolutionLayer<Dtype, Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    DeconvolutionLayer<Dtype, Dtype> reference(layer_param);
+    reference.SetUp(this->ref_blob_bottom_vec_, this->ref_blob_top_vec_);
+    ASSERT_EQ(layer.blobs().size(), reference.blobs().size());
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      reference.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+    }
+    const Dtype epsilon = tol<Dtype>(1.e-4, 2.e-2);
+    // Passes after the first run settled algorithms
+    for (int pass = 0; pass < 4; ++pass) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      reference.Forward(this->ref_blob_bottom_vec_, this->ref_blob_top_vec_);
+      ASSERT_EQ(this->blob_top_->count(), this->ref_blob_top_->count());
+      for (int i = 0; i < this->blob_top_->count(); ++i) {
+        EXPECT_NEAR(this->blob_top_->cpu_data()[i], this->ref_blob_top_->cpu_data()[i],
+            epsilon);
+      }
+      FillerParameter filler_param;
+      GaussianFiller<Dtype> filler(filler_param);
+      filler.Fill(this->ref_blob_top_);
+      caffe_copy(this->ref_blob_top_->count(), this->ref_blob_top_->cpu_data(),
+          this->blob_top_->mutable_cpu_diff());
+      caffe_copy(this->ref_blob_top_->count(), this->ref_blob_top_->cpu_data(),
+          this->ref_blob_top_->mutable_cpu_diff());
+      for (int i = 0; i < layer.blobs().size(); ++i) {
+        layer.blobs()[i]->set_diff(0.F);
+        reference.blobs()[i]->set_diff(0.F);
+      }
+      const vector<bool> propagate_down(1, true);
+      layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+      reference.Backward(this->ref_blob_top_vec_, propagate_down, this->ref_blob_bottom_vec_);
+      for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+        EXPECT_NEAR(this->blob_bottom_->cpu_diff()[i], this->ref_blob_bottom_->cpu_diff()[i],
+            epsilon);
+      }
+      for (int b = 0; b < layer.blobs().size(); ++b) {
+        const TBlob<Dtype>* blob = static_cast<TBlob<Dtype>*>(layer.blobs()[b].get());
+        const TBlob<Dtype>* ref = static_cast<TBlob<Dtype>*>(reference.blobs()[b].get());
+        for (int i = 0; i < blob->count(); ++i) {
+          EXPECT_NEAR(blob->cpu_diff()[i], ref->cpu_diff()[i], 10 * epsilon);
+        }
+      }
+    }
+  }
+
+  TBlob<Dtype>* const blob_bottom_;
+  TBlob<Dtype>* const blob_top_;
+  TBlob<Dtype>* const ref_blob_bottom_;
+  TBlob<Dtype>* const ref_blob_top_;
+  vector<Blob*> blob_bottom_vec_;
+  vector<Blob*> blob_top_vec_;
+  vector<Blob*> ref_blob_bottom_vec_;
+  vector<Blob*> ref_blob_top_vec_;
+};
+
+TYPED_TEST_CASE(CuDNNDeconvolutionLayerTest, TestDtypes);
+
+TYPED_TEST(CuDNNDeconvolutionLayerTest, TestMatchesCaffeCuDNN) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  layer_param.set_forward_type(tp<Dtype>());
+  layer_param.set_backward_type(tp<Dtype>());
+  layer_param.set_forward_math(tp<Dtype>());
+  layer_param.set_backward_math(tp<Dtype>());
+  ConvolutionParameter* convolution_param = layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckMatchesCaffe(layer_param);
+}
+
+TYPED_TEST(CuDNNDeconvolutionLayerTest, TestGroupMatchesCaffeCuDNN) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  layer_param.set_forward_type(tp<Dtype>());
+  layer_param.set_backward_type(tp<Dtype>());
+  layer_param.set_forward_math(tp<Dtype>());
+  layer_param.set_backward_math(tp<Dtype>());
+  ConvolutionParameter* convolution_param = layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CheckMatchesCaffe(layer_param);
+}
+
+#endif
+
 }  // namespace caffe
@@ -6,6 +6,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/detectnet_transform_layer.hpp"
+#include "caffe/util/detectnet_coverage.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -404,4 +405,48 @@ TYPED_TEST(DetectNetTransformationLayerTest, TestCrop) {
   // nothing to test
 }
 
+TYPED_TEST(DetectNetTransformationLayerTest, TestLabels) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (is_type<Dtype>(DOUBLE)) {
+    return;  // FIXME
+  }
+  // a second box overlapping the first one, listed after it
+  this->blob_bottom_label_->Reshape(1, 1, 3, 16);
+  Dtype* label_data = this->blob_bottom_label_->mutable_cpu_data();
+  const int d = 16;
+  label_data[0*d+0] = 2;  // num rows
+  for (int i = 0; i < d; ++i) {
+    label_data[2*d+i] = 0;
+  }
+  label_data[2*d+0] = 10;  // bbox topleft x
+  label_data[2*d+1] = 6;  // bbox topleft y
+  label_data[2*d+2] = 14;  // bbox width
+  label_data[2*d+3] = 20;  // bbox height
+  label_data[2*d+5] = 1;  // class number
+  LayerParameter layer_param = this->layerParamNoAug();
+  layer_param.mutable_detectnet_groundtruth_param()->set_min_cvg_len(4);
+  DetectNetTransformationLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // labels match the host coverage generator's
+  vector<BboxLabel_<Dtype> > bboxes(2);
+  for (int i = 0; i < 2; ++i) {
+    const Dtype* row = label_data + (i + 1) * d;
+    bboxes[i].bbox = cv::Rect_<Dtype>(row[0], row[1], row[2], row[3]);
+    bboxes[i].classNumber = row[5];
+    bboxes[i].truncated = 0;
+  }
+  shared_ptr<CoverageGenerator<Dtype> > coverage(CoverageGenerator<Dtype>::create(
+      layer_param.detectnet_groundtruth_param()));
+  TBlob<Dtype> expected;
+  expected.ReshapeLike(*this->blob_top_label_);
+  coverage->generate(expected.mutable_cpu_data(), bboxes);
+  bool covered = false;
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_NEAR(expected.cpu_data()[i], this->blob_top_label_->cpu_data()[i], 1e-5);
+    covered = covered || expected.cpu_data()[i] != 0;
+  }
+  EXPECT_TRUE(covered);
+}
+
 }  // namespace caffe
@@ -182,4 +182,54 @@ TYPED_TEST(EmbedLayerTest, TestGradientWithBias) {
       this->blob_top_vec_, -2);
 }
 
+TYPED_TEST(EmbedLayerTest, TestSparseRows) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  EmbedParameter* embed_param = layer_param.mutable_embed_param();
+  const int kNumOutput = 10;
+  const int kInputDim = 5;
+  embed_param->set_num_output(kNumOutput);
+  embed_param->set_input_dim(kInputDim);
+  embed_param->set_bias_term(false);
+  embed_param->set_sparse_gradient(true);
+  embed_param->mutable_weight_filler()->set_type("uniform");
+  EmbedLayer<Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_TRUE(layer.sparse_rows(1) == nullptr);
+  vector<int>* rows = layer.sparse_rows(0);
+  ASSERT_TRUE(rows != nullptr);
+  EXPECT_TRUE(rows->empty());
+  // Two backward passes accumulate, as with iter_size > 1
+  vector<bool> touched(kInputDim, false);
+  layer.blobs()[0]->set_diff(0.F);
+  for (int pass = 0; pass < 2; ++pass) {
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      const int index = caffe_rng_rand() % kInputDim;
+      this->blob_bottom_->mutable_cpu_data()[i] = index;
+      touched[index] = true;
+    }
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    this->blob_top_->set_diff(1.F);
+    layer.Backward(this->blob_top_vec_, vector<bool>(1, false), this->blob_bottom_vec_);
+  }
+  vector<int> expected;
+  for (int k = 0; k < kInputDim; ++k) {
+    if (touched[k]) {
+      expected.push_back(k);
+    }
+  }
+  EXPECT_TRUE(expected == *rows);
+  // Rows outside the list have no gradient
+  const Dtype* weight_diff = layer.blobs()[0]->template cpu_diff<Dtype>();
+  for (int k = 0; k < kInputDim; ++k) {
+    for (int j = 0; j < kNumOutput; ++j) {
+      if (touched[k]) {
+        EXPECT_GT(weight_diff[k * kNumOutput + j], 0.F);
+      } else {
+        EXPECT_EQ(0.F, weight_diff[k * kNumOutput + j]);
+      }
+    }
+  }
+}
+
 }  // namespace caffe
@@ -74,6 +74,33 @@ TYPED_TEST(EuclideanLossLayerTest, TestForward) {
   this->TestForward();
 }
 
+// More values than the fused forward kernel has threads, gradients to both bottoms
+TYPED_TEST(EuclideanLossLayerTest, TestForwardBackwardLarge) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int num = 64, dim = 3000;
+  TBlob<Dtype> a(vector<int>{num, dim}), b(vector<int>{num, dim}), loss;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&a);
+  filler.Fill(&b);
+  vector<Blob*> bottom{&a, &b}, top{&loss};
+  LayerParameter layer_param;
+  EuclideanLossLayer<Dtype, Dtype> layer(layer_param);
+  layer.SetUp(bottom, top);
+  layer.Forward(bottom, top);
+  loss.mutable_cpu_diff()[0] = Dtype(2.);
+  layer.Backward(top, vector<bool>{true, true}, bottom);
+  double expected_loss = 0.;
+  for (int i = 0; i < a.count(); ++i) {
+    const double d = static_cast<double>(a.cpu_data()[i]) - static_cast<double>(b.cpu_data()[i]);
+    expected_loss += d * d;
+    EXPECT_NEAR(2. * d / num, a.cpu_diff()[i], tol<Dtype>(1e-6, 1e-3));
+    EXPECT_NEAR(-2. * d / num, b.cpu_diff()[i], tol<Dtype>(1e-6, 1e-3));
+  }
+  expected_loss /= 2. * num;
+  EXPECT_NEAR(expected_loss, loss.cpu_data()[0], tol<Dtype>(1e-4, 1e-2) * expected_loss);
+}
+
 TYPED_TEST(EuclideanLossLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   if (!is_precise<Dtype>()) {
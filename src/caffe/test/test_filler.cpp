@@ -519,4 +519,62 @@ TYPED_TEST(MSRAStaticFillerTest, TestFillAverage) {
   this->test_params(FillerParameter_VarianceNorm_AVERAGE, n);
 }
 
+#ifndef CPU_ONLY
+template <typename Dtype>
+class GPUFillerTest : public ::testing::Test {
+ protected:
+  GPUFillerTest() {
+    Caffe::set_mode(Caffe::GPU);
+    // Odd, thus normals go through a workspace
+    blob_shape_ = {3, 5, 7};
+  }
+
+  // Fills a new blob after seeding
+  shared_ptr<TBlob<Dtype>> Fill(const FillerParameter& param, int seed) {
+    Caffe::set_random_seed(seed);
+    shared_ptr<TBlob<Dtype>> blob(new TBlob<Dtype>(blob_shape_));
+    shared_ptr<Filler<Dtype>> filler(GetFiller<Dtype>(param));
+    filler->Fill(blob.get());
+    return blob;
+  }
+
+  vector<int> blob_shape_;
+};
+
+TYPED_TEST_CASE(GPUFillerTest, TestDtypes);
+
+TYPED_TEST(GPUFillerTest, TestGaussianSeeded) {
+  FillerParameter param;
+  param.set_type("gaussian");
+  param.set_mean(10.);
+  param.set_std(0.1);
+  shared_ptr<TBlob<TypeParam>> a = this->Fill(param, 1701);
+  shared_ptr<TBlob<TypeParam>> b = this->Fill(param, 1701);
+  shared_ptr<TBlob<TypeParam>> c = this->Fill(param, 1702);
+  int differ = 0;
+  for (int i = 0; i < a->count(); ++i) {
+    EXPECT_EQ(a->cpu_data()[i], b->cpu_data()[i]);
+    EXPECT_NEAR(10., a->cpu_data()[i], 1.);
+    differ += a->cpu_data()[i] != c->cpu_data()[i];
+  }
+  EXPECT_GT(differ, 0);
+}
+
+TYPED_TEST(GPUFillerTest, TestUniformAndConstant) {
+  FillerParameter param;
+  param.set_type("uniform");
+  param.set_min(1.);
+  param.set_max(2.);
+  shared_ptr<TBlob<TypeParam>> uniform = this->Fill(param, 1701);
+  param.set_type("constant");
+  param.set_value(3.);
+  shared_ptr<TBlob<TypeParam>> constant = this->Fill(param, 1701);
+  for (int i = 0; i < uniform->count(); ++i) {
+    EXPECT_GE(uniform->cpu_data()[i], 1.);
+    EXPECT_LE(uniform->cpu_data()[i], 2.);
+    EXPECT_EQ(3., constant->cpu_data()[i]);
+  }
+}
+#endif
+
 }  // namespace caffe
@@ -0,0 +1,74 @@
+#include <cstdlib>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/gpu_topology.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class GpuTopologyTest : public ::testing::Test {
+ protected:
+  // Devices in pairs behind PCIe switches: {0, 2} and {1, 3}
+  static vector<vector<int>> SwitchPairs() {
+    vector<vector<int>> cost(4, vector<int>(4, 30));
+    for (int i = 0; i < 4; ++i) {
+      cost[i][i] = 0;
+    }
+    cost[0][2] = cost[2][0] = 10;
+    cost[1][3] = cost[3][1] = 10;
+    return cost;
+  }
+};
+
+TEST_F(GpuTopologyTest, TestSmallRingUnchanged) {
+  vector<vector<int>> cost(3, vector<int>(3, 10));
+  EXPECT_EQ(vector<int>({0, 1, 2}), ring_order(cost));
+}
+
+TEST_F(GpuTopologyTest, TestSwitchPairsAdjacent) {
+  // Listed as 0, 1, 2, 3 the ring would cross switches four times, twice is enough
+  const vector<vector<int>> cost = SwitchPairs();
+  const vector<int> ring = ring_order(cost);
+  EXPECT_EQ(0, ring[0]);
+  int crossings = 0;
+  for (int i = 0; i < 4; ++i) {
+    crossings += cost[ring[i]][ring[(i + 1) % 4]] > 10;
+  }
+  EXPECT_EQ(2, crossings);
+}
+
+TEST_F(GpuTopologyTest, TestSlowestLinkAvoided) {
+  // Ring 0-1-2-3 is cheapest in sum but crosses the link without peer access
+  vector<vector<int>> cost = SwitchPairs();
+  cost[0][1] = cost[1][0] = 0;
+  cost[2][3] = cost[3][2] = 0;
+  cost[1][2] = cost[2][1] = 130;
+  cost[0][3] = cost[3][0] = 130;
+  const vector<int> ring = ring_order(cost);
+  EXPECT_EQ(0, ring[0]);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_LT(cost[ring[i]][ring[(i + 1) % 4]], 100);
+  }
+}
+
+TEST_F(GpuTopologyTest, TestGreedyLine) {
+  // Ten devices on a line, listed out of order: the ring walks along it
+  const vector<int> pos = {0, 5, 1, 6, 2, 7, 3, 8, 4, 9};
+  vector<vector<int>> cost(10, vector<int>(10));
+  for (int i = 0; i < 10; ++i) {
+    for (int j = 0; j < 10; ++j) {
+      cost[i][j] = std::abs(pos[i] - pos[j]);
+    }
+  }
+  const vector<int> ring = ring_order(cost);
+  ASSERT_EQ(10, ring.size());
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(i, pos[ring[i]]);
+  }
+}
+
+}  // namespace caffe
@@ -26,7 +26,8 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
  protected:
   GradientBasedSolverTest() :
       seed_(1701), num_(4), channels_(3), height_(10), width_(10),
-      share_(false) {
+      share_(false), multi_tensor_update_(false), overlap_next_forward_(false),
+      sharded_snapshot_(false) {
         input_file_ = new string(
         CMAKE_SOURCE_DIR "caffe/test/test_data/solver_data_list.txt" CMAKE_EXT);
       }
@@ -41,6 +42,9 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
   // TODO this is brittle and the hdf5 file should be checked instead.
   int num_, channels_, height_, width_;
   bool share_;
+  bool multi_tensor_update_;
+  bool overlap_next_forward_;
+  bool sharded_snapshot_;
   float delta_;  // Stability constant for RMSProp, AdaGrad, AdaDelta and Adam
 
   // Test data: check out generate_sample_data.py in the same directory.
@@ -181,11 +185,20 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     if (momentum != 0) {
       proto << "momentum: " << momentum << " ";
     }
+    if (multi_tensor_update_) {
+      proto << "multi_tensor_update: true ";
+    }
+    if (overlap_next_forward_) {
+      proto << "overlap_next_forward: true ";
+    }
     MakeTempDir(&snapshot_prefix_);
     proto << "snapshot_prefix: '" << snapshot_prefix_ << "/' ";
     if (snapshot) {
       proto << "snapshot: " << num_iters << " ";
     }
+    if (sharded_snapshot_) {
+      proto << "snapshot_format: SHARDED ";
+    }
     Caffe::set_random_seed(this->seed_);
     this->InitSolverFromProtoString(proto.str());
     if (from_snapshot != NULL) {
@@ -214,7 +227,7 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     if (snapshot) {
       ostringstream resume_file;
       resume_file << snapshot_prefix_ << "/_iter_" << num_iters
-                  << ".solverstate";
+                  << (sharded_snapshot_ ? ".snapshot" : ".solverstate");
       string resume_filename = resume_file.str();
       return resume_filename;
     }
@@ -669,6 +682,28 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingShare) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingMultiTensor) {
+  const float kLearningRate = 0.01;
+  const float kWeightDecay = 0.5;
+  const float kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->multi_tensor_update_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingOverlapForward) {
+  const float kLearningRate = 0.01;
+  const float kWeightDecay = 0.5;
+  const float kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->overlap_next_forward_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingAccum) {
   const float kLearningRate = 0.01;
   const float kWeightDecay = 0.5;
@@ -700,6 +735,17 @@ TYPED_TEST(SGDSolverTest, TestSnapshot) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestSnapshotSharded) {
+  const float kLearningRate = 0.01;
+  const float kWeightDecay = 0.5;
+  const float kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->sharded_snapshot_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(SGDSolverTest, TestSnapshotShare) {
   const float kLearningRate = 0.01;
   const float kWeightDecay = 0.5;
@@ -891,6 +937,17 @@ TYPED_TEST(NesterovSolverTest,
   }
 }
 
+TYPED_TEST(NesterovSolverTest, TestNesterovLeastSquaresUpdateWithEverythingMultiTensor) {
+  const float kLearningRate = 0.01;
+  const float kWeightDecay = 0.5;
+  const float kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->multi_tensor_update_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(NesterovSolverTest, TestLeastSquaresUpdateWithEverythingAccum) {
   const float kLearningRate = 0.01;
   const float kWeightDecay = 0.5;
@@ -1097,6 +1154,17 @@ TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdateWithEverythingMultiTensor) {
+  const float kLearningRate = 0.01;
+  const float kWeightDecay = 0.5;
+  const float kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->multi_tensor_update_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdateWithEverythingShare) {
   const float kLearningRate = 0.01;
   const float kWeightDecay = 0.5;
@@ -118,4 +118,57 @@ TYPED_TEST(HDF5OutputLayerTest, TestForward) {
       this->output_file_name_;
 }
 
+TYPED_TEST(HDF5OutputLayerTest, TestForwardAsync) {
+  typedef typename TypeParam::Dtype Dtype;
+  hid_t file_id = H5Fopen(this->input_file_name_.c_str(), H5F_ACC_RDONLY,
+                          H5P_DEFAULT);
+  ASSERT_GE(file_id, 0) << "Failed to open HDF5 file" << this->input_file_name_;
+  hdf5_load_nd_dataset(file_id, HDF5_DATA_DATASET_NAME, 0, 4, this->blob_data_);
+  hdf5_load_nd_dataset(file_id, HDF5_DATA_LABEL_NAME, 0, 4, this->blob_label_);
+  EXPECT_GE(H5Fclose(file_id), 0);
+  this->blob_bottom_vec_.push_back(this->blob_data_);
+  this->blob_bottom_vec_.push_back(this->blob_label_);
+
+  LayerParameter param;
+  HDF5OutputParameter* output_param = param.mutable_hdf5_output_param();
+  output_param->set_file_name(this->output_file_name_ + ".h5");
+  output_param->set_async(true);
+  output_param->set_async_buffers(2);
+  output_param->set_chunk_rows(3);
+  output_param->set_compression(1);
+  output_param->set_file_count(2);
+  // Batches 0 and 2 go to the first file, 1 to the second
+  const int batches = 3;
+  {
+    HDF5OutputLayer<Dtype, Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int b = 0; b < batches; ++b) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    }
+  }
+  const int num = this->blob_data_->num();
+  for (int k = 0; k < 2; ++k) {
+    const string name = this->output_file_name_ + "_" + std::to_string(k) + ".h5";
+    file_id = H5Fopen(name.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    ASSERT_GE(file_id, 0) << "Failed to open HDF5 file" << name;
+    TBlob<Dtype> blob_data, blob_label;
+    hdf5_load_nd_dataset(file_id, HDF5_DATA_DATASET_NAME, 0, 4, &blob_data);
+    hdf5_load_nd_dataset(file_id, HDF5_DATA_LABEL_NAME, 0, 4, &blob_label);
+    EXPECT_GE(H5Fclose(file_id), 0);
+    const int rows = k == 0 ? 2 : 1;
+    ASSERT_EQ(rows * num, blob_data.num());
+    ASSERT_EQ(rows * num, blob_label.num());
+    ASSERT_EQ(rows * this->blob_data_->count(), blob_data.count());
+    ASSERT_EQ(rows * this->blob_label_->count(), blob_label.count());
+    for (int i = 0; i < blob_data.count(); ++i) {
+      EXPECT_EQ(this->blob_data_->cpu_data()[i % this->blob_data_->count()],
+          blob_data.cpu_data()[i]);
+    }
+    for (int i = 0; i < blob_label.count(); ++i) {
+      EXPECT_EQ(this->blob_label_->cpu_data()[i % this->blob_label_->count()],
+          blob_label.cpu_data()[i]);
+    }
+  }
+}
+
 }  // namespace caffe
@@ -139,4 +139,63 @@ TYPED_TEST(HDF5DataLayerTest, TestRead) {
   }
 }
 
+TYPED_TEST(HDF5DataLayerTest, TestReadChunked) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Chunks not dividing the files nor the batches keep rows in order.
+  LayerParameter param;
+  param.add_top("data");
+  param.add_top("label");
+  param.add_top("label2");
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  const int batch_size = 4;
+  hdf5_data_param->set_batch_size(batch_size);
+  hdf5_data_param->set_chunk_rows(3);
+  hdf5_data_param->set_prefetch_chunks(2);
+  hdf5_data_param->set_source(*(this->filename));
+  HDF5DataLayer<Dtype, Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Two files of 10 rows, three epochs
+  for (int iter = 0; iter < 15; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < batch_size; ++i) {
+      const int row = (iter * batch_size + i) % 20;
+      EXPECT_EQ(1 + row % 10, static_cast<int>(this->blob_top_label_->cpu_data()[i]))
+          << "iter " << iter << " i " << i;
+      EXPECT_EQ(2 + row % 10, static_cast<int>(this->blob_top_label2_->cpu_data()[i]));
+    }
+  }
+}
+
+TYPED_TEST(HDF5DataLayerTest, TestShuffleBuffer) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Shuffled rows stay whole: labels and data of every top come from one row.
+  LayerParameter param;
+  param.add_top("data");
+  param.add_top("label");
+  param.add_top("label2");
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  const int batch_size = 5;
+  hdf5_data_param->set_batch_size(batch_size);
+  hdf5_data_param->set_chunk_rows(4);
+  hdf5_data_param->set_shuffle(true);
+  hdf5_data_param->set_shuffle_buffer(7);
+  hdf5_data_param->set_source(*(this->filename));
+  HDF5DataLayer<Dtype, Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int data_size = 8 * 6 * 5;
+  for (int iter = 0; iter < 12; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < batch_size; ++i) {
+      const int label = static_cast<int>(this->blob_top_label_->cpu_data()[i]);
+      EXPECT_GE(label, 1);
+      EXPECT_LE(label, 10);
+      EXPECT_EQ(label + 1, static_cast<int>(this->blob_top_label2_->cpu_data()[i]));
+      // The last value of a row tells its file exactly, even in half precision
+      const float last = this->blob_top_data_->cpu_data()[(i + 1) * data_size - 1];
+      const int offset = last < 2400.F ? 0 : 2400;
+      EXPECT_NEAR(offset + label * data_size - 1, last, 2.F);
+    }
+  }
+}
+
 }  // namespace caffe
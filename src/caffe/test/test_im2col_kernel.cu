@@ -214,4 +214,42 @@ TYPED_TEST(Im2colKernelTest, TestND) {
   }
 }
 
+// im2col_gpu and col2im_gpu of the geometries with specialized kernels
+TYPED_TEST(Im2colKernelTest, TestSpecialized) {
+  typedef TypeParam Dtype;
+  const int geometries[][3] = { {1, 1, 0}, {1, 2, 0}, {3, 1, 1}, {3, 2, 1} };
+  const int channels = 3;
+  const int height = 17;
+  const int width = 37;
+  TBlob<Dtype> im(1, channels, height, width);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&im);
+  for (const auto& g : geometries) {
+    const int kernel = g[0], stride = g[1], pad = g[2];
+    const int height_col = (height + 2 * pad - kernel) / stride + 1;
+    const int width_col = (width + 2 * pad - kernel) / stride + 1;
+    TBlob<Dtype> col(1, channels * kernel * kernel, height_col, width_col);
+    TBlob<Dtype> col_cpu(col.shape());
+    im2col_cpu(im.cpu_data(), channels, height, width, kernel, kernel, pad, pad,
+        stride, stride, 1, 1, col_cpu.mutable_cpu_data());
+    im2col_gpu(im.gpu_data(), channels, height, width, kernel, kernel, pad, pad,
+        stride, stride, 1, 1, col.mutable_gpu_data());
+    for (int i = 0; i < col.count(); ++i) {
+      EXPECT_EQ(col_cpu.cpu_data()[i], col.cpu_data()[i]) << "kernel " << kernel
+          << " stride " << stride << " at " << i;
+    }
+    TBlob<Dtype> back(im.shape());
+    TBlob<Dtype> back_cpu(im.shape());
+    col2im_cpu(col_cpu.cpu_data(), channels, height, width, kernel, kernel, pad, pad,
+        stride, stride, 1, 1, back_cpu.mutable_cpu_data());
+    col2im_gpu(col.gpu_data(), channels, height, width, kernel, kernel, pad, pad,
+        stride, stride, 1, 1, back.mutable_gpu_data());
+    for (int i = 0; i < back.count(); ++i) {
+      EXPECT_NEAR(back_cpu.cpu_data()[i], back.cpu_data()[i], tol<Dtype>(1e-5, 1e-2))
+          << "kernel " << kernel << " stride " << stride << " at " << i;
+    }
+  }
+}
+
 }  // namespace caffe
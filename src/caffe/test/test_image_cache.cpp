@@ -0,0 +1,64 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/image_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ImageCacheTest : public ::testing::Test {
+ protected:
+  ImageCacheTest() : cache_(ImageCache::instance()) {
+    cache_.clear();
+  }
+  virtual ~ImageCacheTest() {
+    cache_.clear();
+  }
+
+  static cv::Mat Image(int bytes, uchar value) {
+    return cv::Mat(1, bytes, CV_8U, cv::Scalar(value));
+  }
+
+  ImageCache& cache_;
+};
+
+TEST_F(ImageCacheTest, TestGetPut) {
+  cache_.reserve(100);
+  cv::Mat mat;
+  EXPECT_FALSE(cache_.get("a", &mat));
+  cache_.put("a", Image(10, 1));
+  ASSERT_TRUE(cache_.get("a", &mat));
+  EXPECT_EQ(10, mat.cols);
+  EXPECT_EQ(1, mat.at<uchar>(0, 5));
+  EXPECT_EQ(10, cache_.bytes());
+  // Too large to ever fit
+  cache_.put("b", Image(101, 2));
+  EXPECT_FALSE(cache_.get("b", &mat));
+}
+
+TEST_F(ImageCacheTest, TestEvictLeastRecentlyUsed) {
+  cache_.reserve(30);
+  cache_.put("a", Image(10, 1));
+  cache_.put("b", Image(10, 2));
+  cache_.put("c", Image(10, 3));
+  cv::Mat mat;
+  // Used last, "a" stays when "d" comes in
+  EXPECT_TRUE(cache_.get("a", &mat));
+  cache_.put("d", Image(10, 4));
+  EXPECT_TRUE(cache_.get("a", &mat));
+  EXPECT_FALSE(cache_.get("b", &mat));
+  EXPECT_TRUE(cache_.get("c", &mat));
+  EXPECT_TRUE(cache_.get("d", &mat));
+  EXPECT_EQ(30, cache_.bytes());
+}
+
+TEST_F(ImageCacheTest, TestBudgetGrowsOnly) {
+  cache_.reserve(50);
+  cache_.reserve(20);
+  EXPECT_EQ(50, cache_.budget());
+}
+
+}  // namespace caffe
@@ -9,6 +9,7 @@
 #include "caffe/filler.hpp"
 #include "caffe/layers/image_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/image_cache.hpp"
 #include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -176,4 +177,40 @@ TYPED_TEST(ImageDataLayerTest, TestShuffle) {
   }
 }
 
+TYPED_TEST(ImageDataLayerTest, TestCache) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Cached file contents and decoded images give what reading the files does
+  TBlob<Dtype> expected;
+  for (int mode = 0; mode < 3; ++mode) {
+    ImageCache::instance().clear();
+    LayerParameter param;
+    ImageDataParameter* image_data_param = param.mutable_image_data_param();
+    image_data_param->set_batch_size(5);
+    image_data_param->set_source(this->filename_.c_str());
+    image_data_param->set_new_height(64);
+    image_data_param->set_new_width(64);
+    image_data_param->set_read_threads(mode == 0 ? 0 : 3);
+    image_data_param->set_cache_images(mode > 0);
+    image_data_param->set_cache_decoded(mode == 2);
+    ImageDataLayer<Dtype, Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int iter = 0; iter < 2; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(i, static_cast<int>(this->blob_top_label_->cpu_data()[i]));
+      }
+      if (mode == 0 && iter == 0) {
+        expected.CopyFrom(*this->blob_top_data_, false, true);
+      }
+      for (int i = 0; i < expected.count(); ++i) {
+        EXPECT_EQ(expected.cpu_data()[i], this->blob_top_data_->cpu_data()[i])
+            << "mode " << mode;
+      }
+    }
+    // All five lines are the same file
+    EXPECT_EQ(mode > 0, ImageCache::instance().bytes() > 0);
+  }
+  ImageCache::instance().clear();
+}
+
 }  // namespace caffe
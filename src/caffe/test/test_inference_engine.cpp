@@ -0,0 +1,160 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <google/protobuf/text_format.h>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/inference_engine.hpp"
+#include "caffe/model_repository.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class InferenceEngineTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  InferenceEngineTest() {
+    const string proto =
+        "name: 'EngineNet' "
+        "layer { name: 'data' type: 'Input' top: 'data' "
+        "  input_param { shape { dim: 2 dim: 3 } } } "
+        "layer { name: 'ip' type: 'InnerProduct' bottom: 'data' top: 'ip' "
+        "  inner_product_param { num_output: 4 "
+        "    weight_filler { type: 'gaussian' std: 1 } "
+        "    bias_filler { type: 'gaussian' std: 1 } } } "
+        "layer { name: 'relu' type: 'ReLU' bottom: 'ip' top: 'ip' } ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param_));
+    param_.set_default_forward_type(tp<Dtype>());
+    param_.set_default_backward_type(tp<Dtype>());
+    param_.set_default_forward_math(tp<Dtype>());
+    param_.set_default_backward_math(tp<Dtype>());
+    param_.mutable_state()->set_phase(TEST);
+    reference_.reset(new Net(param_));
+    NetParameter weights;
+    reference_->ToProto(&weights, false);
+    MakeTempFilename(&weights_file_);
+    WriteProtoToBinaryFile(weights, weights_file_);
+  }
+
+  // Random input of the given batch size and the reference net's output for it
+  void MakeSample(int num, TBlob<Dtype>* input, TBlob<Dtype>* expected) {
+    input->Reshape(vector<int>{num, 3});
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(input);
+    reference_->input_blobs()[0]->CopyDataFrom(*input, true);
+    reference_->Reshape();
+    expected->CopyDataFrom(*reference_->Forward()[0], true);
+  }
+
+  void ExpectEqual(const TBlob<Dtype>& expected, const TBlob<Dtype>& output) {
+    ASSERT_EQ(expected.shape(), output.shape());
+    for (int i = 0; i < expected.count(); ++i) {
+      EXPECT_NEAR(expected.cpu_data()[i], output.cpu_data()[i], 1e-4);
+    }
+  }
+
+  NetParameter param_;
+  shared_ptr<Net> reference_;
+  string weights_file_;
+};
+
+TYPED_TEST_CASE(InferenceEngineTest, TestDtypesAndDevicesNoFP16);
+
+TYPED_TEST(InferenceEngineTest, TestConcurrentInfer) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int kThreads = 4;
+  const int kIters = 5;
+  vector<TBlob<Dtype>> inputs(kThreads), expected(kThreads), outputs(kThreads);
+  for (int t = 0; t < kThreads; ++t) {
+    this->MakeSample(2, &inputs[t], &expected[t]);
+  }
+  InferenceEngine engine(this->param_, this->weights_file_, 2);
+  EXPECT_EQ(2, engine.contexts());
+  EXPECT_EQ(vector<string>{"data"}, engine.input_names());
+  EXPECT_EQ(vector<string>{"ip"}, engine.output_names());
+  // One copy of the weights
+  EXPECT_TRUE(engine.net(0).params()[0]->shares_data_with(*engine.net(1).params()[0]));
+  vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (int it = 0; it < kIters; ++it) {
+        engine.Infer({&inputs[t]}, {&outputs[t]});
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (int t = 0; t < kThreads; ++t) {
+    this->ExpectEqual(expected[t], outputs[t]);
+  }
+}
+
+TYPED_TEST(InferenceEngineTest, TestInferReshapes) {
+  typedef typename TypeParam::Dtype Dtype;
+  TBlob<Dtype> input, expected, output;
+  this->MakeSample(5, &input, &expected);
+  InferenceEngine engine(this->param_, this->weights_file_, 1);
+  engine.Infer({&input}, {&output});
+  EXPECT_EQ((vector<int>{5, 4}), output.shape());
+  this->ExpectEqual(expected, output);
+}
+
+TYPED_TEST(InferenceEngineTest, TestModelRepository) {
+  typedef typename TypeParam::Dtype Dtype;
+  TBlob<Dtype> input, expected, output;
+  this->MakeSample(2, &input, &expected);
+  // Other random weights
+  Net other(this->param_);
+  NetParameter weights;
+  other.ToProto(&weights, false);
+  string other_file;
+  MakeTempFilename(&other_file);
+  WriteProtoToBinaryFile(weights, other_file);
+  size_t model_bytes = 0UL;
+  for (const shared_ptr<Blob>& blob : other.learnable_params()) {
+    model_bytes += blob->count() * tsize(blob->data_type());
+  }
+  // Weights of one model fit on the device
+  ModelRepository repository(-1, model_bytes);
+  repository.Load("a", this->param_, this->weights_file_, 2);
+  repository.Load("b", this->param_, this->weights_file_, 1);
+  repository.Load("other", this->param_, other_file, 1);
+  EXPECT_EQ(3U, repository.models().size());
+  EXPECT_EQ(model_bytes, repository.shared_bytes());
+  EXPECT_TRUE(repository.engine("a").weights()[0]->shares_data_with(
+      *repository.engine("b").weights()[0]));
+  EXPECT_FALSE(repository.engine("a").weights()[0]->shares_data_with(
+      *repository.engine("other").weights()[0]));
+  repository.Infer("a", {&input}, {&output});
+  this->ExpectEqual(expected, output);
+  // Shares all weights with the resident one
+  repository.Infer("b", {&input}, {&output});
+  this->ExpectEqual(expected, output);
+  repository.Infer("other", {&input}, {&output});
+  if (Caffe::mode() == Caffe::GPU) {
+    EXPECT_FALSE(repository.resident("a"));
+    EXPECT_FALSE(repository.resident("b"));
+    EXPECT_TRUE(repository.resident("other"));
+    EXPECT_EQ(model_bytes, repository.resident_bytes());
+  }
+  // Uploaded back
+  repository.Infer("a", {&input}, {&output});
+  this->ExpectEqual(expected, output);
+  EXPECT_TRUE(repository.resident("a"));
+  repository.Unload("other");
+  EXPECT_EQ(2U, repository.models().size());
+}
+
+}  // namespace caffe
@@ -53,7 +53,7 @@ class InfogainLossLayerTest : public MultiDeviceTest<TypeParam> {
   vector<Blob*> blob_top_vec_;
 };
 
-TYPED_TEST_CASE(InfogainLossLayerTest, TestDtypesAndCPUOnly);
+TYPED_TEST_CASE(InfogainLossLayerTest, TestDtypesAndDevicesNoFP16);
 
 TYPED_TEST(InfogainLossLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -5,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/layers/cublaslt_inner_product_layer.hpp"
 #include "caffe/layers/inner_product_layer.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -249,6 +251,53 @@ TYPED_TEST(InnerProductLayerTest, TestGradient) {
   checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
 }
 
+TYPED_TEST(InnerProductLayerTest, TestForwardReLU) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  LayerParameter layer_param;
+  layer_param.set_forward_type(tp<Dtype>());
+  layer_param.set_backward_type(tp<Dtype>());
+  layer_param.set_forward_math(tp<Dtype>());
+  layer_param.set_backward_math(tp<Dtype>());
+  InnerProductParameter* inner_product_param = layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<Dtype, Dtype> plain(layer_param);
+  plain.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  plain.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  TBlob<Dtype> expected;
+  expected.CopyFrom(*this->blob_top_, false, true);
+  inner_product_param->set_activation(InnerProductParameter::RELU);
+  InnerProductLayer<Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    layer.blobs()[i]->CopyFrom(*plain.blobs()[i]);
+  }
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(std::max(expected.cpu_data()[i], Dtype(0)), this->blob_top_->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestGradientGELU) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  LayerParameter layer_param;
+  layer_param.set_forward_type(tp<Dtype>());
+  layer_param.set_backward_type(tp<Dtype>());
+  layer_param.set_forward_math(tp<Dtype>());
+  layer_param.set_backward_math(tp<Dtype>());
+  InnerProductParameter* inner_product_param = layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->set_activation(InnerProductParameter::GELU);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<Dtype, Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(tol<Dtype>(1e-2, 5e-1), tol<Dtype>(1e-3, 5e-2));
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+}
+
 TYPED_TEST(InnerProductLayerTest, TestGradientTranspose) {
   typedef typename TypeParam::Dtype Dtype;
   this->blob_bottom_vec_.push_back(this->blob_bottom_);
@@ -355,4 +404,114 @@ TYPED_TEST(InnerProductLayerTest, TestBackwardTranspose) {
   }
 }
 
+#ifdef CAFFE_CUBLASLT
+
+template <typename Dtype>
+class CuBLASLtInnerProductLayerTest : public GPUDeviceTest<Dtype> {
+ protected:
+  CuBLASLtInnerProductLayerTest() : blob_bottom_(new TBlob<Dtype>(16, 3, 4, 4)),
+                                    blob_top_(new TBlob<Dtype>()),
+                                    ref_blob_bottom_(new TBlob<Dtype>()),
+                                    ref_blob_top_(new TBlob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    ref_blob_bottom_->CopyFrom(*blob_bottom_, false, true);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    ref_blob_bottom_vec_.push_back(ref_blob_bottom_);
+    ref_blob_top_vec_.push_back(ref_blob_top_);
+  }
+
+  virtual ~CuBLASLtInnerProductLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete ref_blob_bottom_;
+    delete ref_blob_top_;
+  }
+
+  // Output and gradients of both engines on the same weights and top diff, written
+  // (fused bias gradient) or added to
+  void CheckMatchesCaffe(InnerProductParameter::Activation activation, bool transpose,
+      bool overwrite) {
+    LayerParameter layer_param;
+    layer_param.set_forward_type(tp<Dtype>());
+    layer_param.set_backward_type(tp<Dtype>());
+    layer_param.set_forward_math(tp<Dtype>());
+    layer_param.set_backward_math(tp<Dtype>());
+    InnerProductParameter* inner_product_param = layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(24);
+    inner_product_param->set_transpose(transpose);
+    inner_product_param->set_activation(activation);
+    inner_product_param->mutable_weight_filler()->set_type("gaussian");
+    inner_product_param->mutable_bias_filler()->set_type("gaussian");
+    CuBLASLtInnerProductLayer<Dtype, Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    InnerProductLayer<Dtype, Dtype> reference(layer_param);
+    reference.SetUp(this->ref_blob_bottom_vec_, this->ref_blob_top_vec_);
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      reference.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+      layer.blobs()[i]->set_diff(1.F);
+      reference.blobs()[i]->set_diff(1.F);
+    }
+    layer.set_overwrite_param_diffs(overwrite);
+    reference.set_overwrite_param_diffs(overwrite);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    reference.Forward(this->ref_blob_bottom_vec_, this->ref_blob_top_vec_);
+    const Dtype epsilon = tol<Dtype>(1.e-4, 2.e-2);
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(this->blob_top_->cpu_data()[i], this->ref_blob_top_->cpu_data()[i], epsilon);
+    }
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    TBlob<Dtype> top_diff;
+    top_diff.ReshapeLike(*this->blob_top_);
+    filler.Fill(&top_diff);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(), this->blob_top_->mutable_cpu_diff());
+    caffe_copy(top_diff.count(), top_diff.cpu_data(), this->ref_blob_top_->mutable_cpu_diff());
+    const vector<bool> propagate_down(1, true);
+    layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+    reference.Backward(this->ref_blob_top_vec_, propagate_down, this->ref_blob_bottom_vec_);
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_NEAR(this->blob_bottom_->cpu_diff()[i], this->ref_blob_bottom_->cpu_diff()[i],
+          epsilon);
+    }
+    for (int b = 0; b < layer.blobs().size(); ++b) {
+      const TBlob<Dtype>* blob = static_cast<TBlob<Dtype>*>(layer.blobs()[b].get());
+      const TBlob<Dtype>* ref = static_cast<TBlob<Dtype>*>(reference.blobs()[b].get());
+      for (int i = 0; i < blob->count(); ++i) {
+        EXPECT_NEAR(blob->cpu_diff()[i], ref->cpu_diff()[i], 10 * epsilon);
+      }
+    }
+  }
+
+  TBlob<Dtype>* const blob_bottom_;
+  TBlob<Dtype>* const blob_top_;
+  TBlob<Dtype>* const ref_blob_bottom_;
+  TBlob<Dtype>* const ref_blob_top_;
+  vector<Blob*> blob_bottom_vec_;
+  vector<Blob*> blob_top_vec_;
+  vector<Blob*> ref_blob_bottom_vec_;
+  vector<Blob*> ref_blob_top_vec_;
+};
+
+TYPED_TEST_CASE(CuBLASLtInnerProductLayerTest, TestDtypes);
+
+TYPED_TEST(CuBLASLtInnerProductLayerTest, TestMatchesCaffe) {
+  this->CheckMatchesCaffe(InnerProductParameter::NONE, false, false);
+  this->CheckMatchesCaffe(InnerProductParameter::NONE, true, true);
+}
+
+TYPED_TEST(CuBLASLtInnerProductLayerTest, TestReLUMatchesCaffe) {
+  this->CheckMatchesCaffe(InnerProductParameter::RELU, false, true);
+  this->CheckMatchesCaffe(InnerProductParameter::RELU, true, false);
+}
+
+TYPED_TEST(CuBLASLtInnerProductLayerTest, TestGELUMatchesCaffe) {
+  this->CheckMatchesCaffe(InnerProductParameter::GELU, false, true);
+  this->CheckMatchesCaffe(InnerProductParameter::GELU, true, false);
+}
+
+#endif
+
 }  // namespace caffe
@@ -0,0 +1,129 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layers/batch_norm_layer.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/eltwise_layer.hpp"
+#include "caffe/layers/inner_product_layer.hpp"
+#include "caffe/layers/pooling_layer.hpp"
+#include "caffe/layers/relu_layer.hpp"
+#include "caffe/util/layer_cost.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class LayerCostTest : public ::testing::Test {
+ protected:
+  LayerCostTest()
+      : blob_bottom_(new TBlob<float>(2, 3, 6, 4)), blob_top_(new TBlob<float>()) {
+    Caffe::set_mode(Caffe::CPU);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~LayerCostTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+  }
+
+  TBlob<float>* const blob_bottom_;
+  TBlob<float>* const blob_top_;
+  vector<Blob*> blob_bottom_vec_;
+  vector<Blob*> blob_top_vec_;
+};
+
+TEST_F(LayerCostTest, TestConvolution) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param = layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(1);
+  convolution_param->set_num_output(4);
+  ConvolutionLayer<float, float> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const LayerCost cost = layer_cost(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+  // 2 x 4 x 4 x 2 outputs of 3 x 3 x 3 multiply-adds
+  const double flops = 2. * (2 * 4 * 4 * 2) * (3 * 3 * 3);
+  EXPECT_DOUBLE_EQ(flops, cost.forward_flops);
+  EXPECT_DOUBLE_EQ(2. * flops, cost.backward_flops);
+  const double params = 4. * (4 * 3 * 3 * 3 + 4);
+  EXPECT_DOUBLE_EQ(4. * 144 + 4. * 64 + params, cost.forward_bytes);
+  EXPECT_DOUBLE_EQ(4. * 64 + 4. * 144 * 2 + 2. * params, cost.backward_bytes);
+  EXPECT_EQ(4UL * 64, cost.activation_bytes);
+}
+
+TEST_F(LayerCostTest, TestInnerProduct) {
+  LayerParameter layer_param;
+  layer_param.mutable_inner_product_param()->set_num_output(10);
+  InnerProductLayer<float, float> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const LayerCost cost = layer_cost(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_DOUBLE_EQ(2. * (2 * 10) * 72, cost.forward_flops);
+  EXPECT_EQ(4UL * 20, cost.activation_bytes);
+}
+
+TEST_F(LayerCostTest, TestElementwise) {
+  LayerParameter layer_param;
+  ReLULayer<float, float> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const LayerCost cost = layer_cost(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_DOUBLE_EQ(144., cost.forward_flops);
+  EXPECT_DOUBLE_EQ(144., cost.backward_flops);
+  EXPECT_DOUBLE_EQ(4. * 144 * 2, cost.forward_bytes);
+  EXPECT_DOUBLE_EQ(4. * 144 * 3, cost.backward_bytes);
+}
+
+TEST_F(LayerCostTest, TestMaxPooling) {
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(2);
+  pooling_param->set_stride(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  PoolingLayer<float, float> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const LayerCost cost = layer_cost(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+  // 2 x 3 x 3 x 2 outputs of 2 x 2 windows
+  EXPECT_DOUBLE_EQ(36. * 4, cost.forward_flops);
+  EXPECT_DOUBLE_EQ(36., cost.backward_flops);
+  // The int argmax mask is kept for backward
+  EXPECT_EQ(4UL * 36 + 4UL * 36, cost.activation_bytes);
+#ifndef CPU_ONLY
+  // A byte per output on the GPU
+  Caffe::set_mode(Caffe::GPU);
+  const LayerCost gpu_cost = layer_cost(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(4UL * 36 + 36UL, gpu_cost.activation_bytes);
+  EXPECT_DOUBLE_EQ(cost.forward_bytes - 3. * 36, gpu_cost.forward_bytes);
+#endif
+}
+
+TEST_F(LayerCostTest, TestEltwiseSum) {
+  LayerParameter layer_param;
+  EltwiseParameter* eltwise_param = layer_param.mutable_eltwise_param();
+  eltwise_param->set_operation(EltwiseParameter_EltwiseOp_SUM);
+  eltwise_param->add_coeff(1.F);
+  eltwise_param->add_coeff(-1.F);
+  EltwiseLayer<float, float> layer(layer_param);
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const LayerCost cost = layer_cost(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+  // One addition and two multiplications per output
+  EXPECT_DOUBLE_EQ(3. * 144, cost.forward_flops);
+  EXPECT_DOUBLE_EQ(2. * 144, cost.backward_flops);
+}
+
+TEST_F(LayerCostTest, TestBatchNorm) {
+  LayerParameter layer_param;
+  layer_param.set_phase(TRAIN);
+  BatchNormLayer<float, float> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const LayerCost cost = layer_cost(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+  // Mean, variance and the variance correction
+  const double params = 4. * (3 + 3 + 1);
+  EXPECT_DOUBLE_EQ(6. * 144, cost.forward_flops);
+  // Statistics read the input once more
+  EXPECT_DOUBLE_EQ(4. * 144 * 3 + params, cost.forward_bytes);
+}
+
+}  // namespace caffe
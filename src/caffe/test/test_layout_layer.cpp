@@ -0,0 +1,88 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/layout_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class LayoutLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+ protected:
+  LayoutLayerTest()
+      : blob_bottom_(new TBlob<Dtype>(2, 3, 4, 5)),
+        blob_top_(new TBlob<Dtype>()) {
+    Caffe::set_random_seed(1701);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~LayoutLayerTest() { delete blob_bottom_; delete blob_top_; }
+  TBlob<Dtype>* const blob_bottom_;
+  TBlob<Dtype>* const blob_top_;
+  vector<Blob*> blob_bottom_vec_;
+  vector<Blob*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(LayoutLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(LayoutLayerTest, TestForwardToNHWC) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_layout_param()->set_packing(NHWC);
+  LayoutLayer<Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_->shape(), this->blob_bottom_->shape());
+  EXPECT_EQ(NHWC, this->blob_top_->packing());
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  for (int n = 0; n < 2; ++n) {
+    for (int c = 0; c < 3; ++c) {
+      for (int h = 0; h < 4; ++h) {
+        for (int w = 0; w < 5; ++w) {
+          EXPECT_EQ(this->blob_bottom_->data_at(n, c, h, w),
+              static_cast<float>(top_data[((n * 4 + h) * 5 + w) * 3 + c]));
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(LayoutLayerTest, TestRoundTrip) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter to_nhwc_param, to_nchw_param;
+  to_nhwc_param.mutable_layout_param()->set_packing(NHWC);
+  to_nchw_param.mutable_layout_param()->set_packing(NCHW);
+  LayoutLayer<Dtype, Dtype> to_nhwc(to_nhwc_param), to_nchw(to_nchw_param);
+  TBlob<Dtype> back;
+  vector<Blob*> back_vec(1, &back);
+  to_nhwc.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  to_nchw.SetUp(this->blob_top_vec_, back_vec);
+  to_nhwc.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  to_nchw.Forward(this->blob_top_vec_, back_vec);
+  EXPECT_EQ(NCHW, back.packing());
+  for (int i = 0; i < back.count(); ++i) {
+    EXPECT_EQ(static_cast<float>(this->blob_bottom_->cpu_data()[i]),
+        static_cast<float>(back.cpu_data()[i]));
+  }
+}
+
+TYPED_TEST(LayoutLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_layout_param()->set_packing(NHWC);
+  LayoutLayer<Dtype, Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(tol<Dtype>(1e-2, 1e-1), tol<Dtype>(1e-3, 1e-2));
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+}
+
+}  // namespace caffe
@@ -3,6 +3,7 @@
 #include <climits>
 #include <cmath>  // for std::fabs
 #include <cstdlib>  // for rand_r
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -328,6 +329,47 @@ TYPED_TEST(GPUMathFunctionsTest, TestScaleInPlace) {
   }
 }
 
+// Odd lengths and offsets: peeled heads and tails, and pointers that can't be
+// vectorized together
+TYPED_TEST(GPUMathFunctionsTest, TestAddUnaligned) {
+  const int n = this->blob_bottom_->count() - 8;
+  for (int a_offset : {0, 1, 3}) {
+    for (int y_offset : {0, 1, 5}) {
+      const TypeParam* a = this->blob_bottom_->gpu_data() + a_offset;
+      const TypeParam* b = this->blob_top_->gpu_data() + a_offset;
+      caffe_gpu_add<TypeParam>(n - y_offset, a, b,
+          this->blob_bottom_->mutable_gpu_diff() + y_offset);
+      const TypeParam* sum = this->blob_bottom_->cpu_diff() + y_offset;
+      a = this->blob_bottom_->cpu_data() + a_offset;
+      b = this->blob_top_->cpu_data() + a_offset;
+      for (int i = 0; i < n - y_offset; ++i) {
+        EXPECT_NEAR(static_cast<float>(sum[i]), static_cast<float>(a[i] + b[i]),
+            tol<TypeParam>(1e-6, 1e-2));
+      }
+    }
+  }
+}
+
+// Transposed gather of rows 2 and 0 of a 3 x 5 matrix into a 5 x 2 one
+TYPED_TEST(GPUMathFunctionsTest, TestStridedCopyGather) {
+  const int rows[] = {2, 0};
+  TBlob<int> gather(vector<int>{2});
+  gather.mutable_cpu_data()[0] = rows[0];
+  gather.mutable_cpu_data()[1] = rows[1];
+  const TypeParam* x = this->blob_bottom_->gpu_data();
+  caffe_gpu_strided_copy(tp<TypeParam>(), vector<int>{2, 5}, x, vector<int>{5, 1},
+      this->blob_top_->mutable_gpu_data(), vector<int>{1, 2}, Caffe::thread_stream(),
+      gather.gpu_data(), 0);
+  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  const TypeParam* y = this->blob_top_->cpu_data();
+  x = this->blob_bottom_->cpu_data();
+  for (int j = 0; j < 5; ++j) {
+    for (int i = 0; i < 2; ++i) {
+      EXPECT_EQ(x[rows[i] * 5 + j], y[j * 2 + i]);
+    }
+  }
+}
+
 TYPED_TEST(GPUMathFunctionsTest, TestCopy) {
   const int n = this->blob_bottom_->count();
   const TypeParam* bottom_data = this->blob_bottom_->gpu_data();
@@ -340,6 +382,34 @@ TYPED_TEST(GPUMathFunctionsTest, TestCopy) {
   }
 }
 
+TYPED_TEST(GPUMathFunctionsTest, TestDotAddAndAddTo) {
+  const int n = this->blob_bottom_->count();
+  const TypeParam* x = this->blob_bottom_->cpu_data();
+  const TypeParam* y = this->blob_top_->cpu_data();
+  double std_dot = 0., std_abs = 0.;
+  for (int i = 0; i < n; ++i) {
+    const double xy = static_cast<double>(x[i]) * static_cast<double>(y[i]);
+    std_dot += xy;
+    std_abs += std::fabs(xy);
+  }
+  TBlob<float> sums;
+  sums.Reshape(vector<int>(1, n + 1));
+  float* out = sums.mutable_gpu_data();
+  caffe_gpu_set(n + 1, 0.F, out);
+  cudaStream_t stream = Caffe::thread_stream();
+  for (int k = 0; k < 2; ++k) {
+    caffe_gpu_dot_add(tp<TypeParam>(), n, this->blob_bottom_->gpu_data(),
+        this->blob_top_->gpu_data(), out, stream);
+    caffe_gpu_add_to(tp<TypeParam>(), n, this->blob_bottom_->gpu_data(), out + 1, stream);
+  }
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+  const float* result = sums.cpu_data();
+  EXPECT_NEAR(2. * std_dot, result[0], 2.e-3 * std_abs);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_FLOAT_EQ(2.F * static_cast<float>(x[i]), result[i + 1]);
+  }
+}
+
 TYPED_TEST(GPUMathFunctionsTest, TestConvertToAndFrom16) {
   const int n = this->blob_bottom_->count();
   TypeParam* bottom_data_cpu = this->blob_bottom_->mutable_cpu_data();
@@ -373,6 +443,127 @@ TYPED_TEST(GPUMathFunctionsTest, TestConvertToAndFrom16) {
         static_cast<float>(top_data_cpu[i]), 2.e-3) << " at i=" << i;
   }
 }
+
+TEST(GPUMathFunctionsFP16Test, TestCompressWithErrorFeedback) {
+  const int n = 1000;
+  TBlob<float> g(1, 1, 1, n), residual(1, 1, 1, n), y(1, 1, 1, n);
+  TBlob<float16> h(1, 1, 1, n);
+  float* g_cpu = g.mutable_cpu_data();
+  for (int i = 0; i < n; ++i) {
+    g_cpu[i] = 1.e-3F * (i - n / 2) + 1.e-7F;
+  }
+  caffe_gpu_set(n, 0.F, residual.mutable_gpu_data());
+  const float scale = 1024.F;
+  caffe_gpu_compress_fp16(n, g.gpu_data(), residual.mutable_gpu_data(), h.mutable_gpu_data(),
+      scale);
+  caffe_gpu_decompress_fp16(n, h.gpu_data(), y.mutable_gpu_data(), 1.F / scale);
+  const float* y_cpu = y.cpu_data();
+  const float* r_cpu = residual.cpu_data();
+  for (int i = 0; i < n; ++i) {
+    // Nothing is lost: what didn't make it to FLOAT16 is in the residual
+    EXPECT_NEAR(g_cpu[i], y_cpu[i] + r_cpu[i], 1.e-7F) << " at i=" << i;
+    EXPECT_LE(std::fabs(r_cpu[i]), std::fabs(g_cpu[i]) * 1.e-3F + 1.e-7F) << " at i=" << i;
+  }
+  // Zero gradients next time: the residual is sent
+  caffe_gpu_set(n, 0.F, g.mutable_gpu_data());
+  caffe_gpu_compress_fp16(n, g.gpu_data(), residual.mutable_gpu_data(), h.mutable_gpu_data(),
+      scale);
+  caffe_gpu_decompress_fp16(n, h.gpu_data(), y.mutable_gpu_data(), 1.F / scale);
+  y_cpu = y.cpu_data();
+  r_cpu = residual.cpu_data();
+  float sent = 0.F, left = 0.F;
+  for (int i = 0; i < n; ++i) {
+    sent += std::fabs(y_cpu[i]);
+    left += std::fabs(r_cpu[i]);
+  }
+  EXPECT_GT(sent, 0.F);
+  EXPECT_LT(left, sent);
+}
+
+TEST(GPUMathFunctionsFP16Test, TestAccumulate) {
+  const int n = 100;
+  TBlob<float16> g(1, 1, 1, n);
+  TBlob<float> acc(1, 1, 1, n);
+  caffe_gpu_set(n, 3.F, acc.mutable_gpu_data());
+  // 2048 + 1 is 2048 in FLOAT16
+  caffe_gpu_set(n, float16(2048.F), g.mutable_gpu_data());
+  caffe_gpu_accumulate_fp16(n, g.mutable_gpu_data(), acc.mutable_gpu_data(), true);
+  for (int k = 0; k < 3; ++k) {
+    caffe_gpu_set(n, float16(1.F), g.mutable_gpu_data());
+    caffe_gpu_accumulate_fp16(n, g.mutable_gpu_data(), acc.mutable_gpu_data(), false);
+  }
+  const float* acc_cpu = acc.cpu_data();
+  const float16* g_cpu = g.cpu_data();
+  for (int i = 0; i < n; ++i) {
+    EXPECT_EQ(2051.F, acc_cpu[i]) << " at i=" << i;
+    EXPECT_EQ(0.F, static_cast<float>(g_cpu[i])) << " at i=" << i;
+  }
+}
+
+TEST(GPUMathFunctionsFP16Test, TestCPUGemmAndGemv) {
+  // K spans several panels
+  const int M = 5, N = 7, K = 600;
+  vector<float> a(M * K), b(K * N), c(M * N, 1.F), x(K), y(M, 1.F);
+  vector<float16> a16(M * K), b16(K * N), c16(M * N), x16(K), y16(M);
+  for (int i = 0; i < a.size(); ++i) {
+    a16[i] = float16(0.01F * ((i * 7) % 50 - 25));
+    a[i] = a16[i];
+  }
+  for (int i = 0; i < b.size(); ++i) {
+    b16[i] = float16(0.01F * ((i * 11) % 40 - 20));
+    b[i] = b16[i];
+  }
+  for (int i = 0; i < x.size(); ++i) {
+    x16[i] = float16(0.01F * (i % 30 - 15));
+    x[i] = x16[i];
+  }
+  caffe_cpu_convert(c.size(), &c.front(), &c16.front());
+  caffe_cpu_convert(y.size(), &y.front(), &y16.front());
+  caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, M, N, K, 0.5F, &a.front(), &b.front(),
+      2.F, &c.front());
+  caffe_cpu_gemm<float16>(CblasNoTrans, CblasNoTrans, M, N, K, float16(0.5F), &a16.front(),
+      &b16.front(), float16(2.F), &c16.front());
+  for (int i = 0; i < c.size(); ++i) {
+    EXPECT_NEAR(c[i], static_cast<float>(c16[i]), 1.e-2F + 1.e-3F * std::fabs(c[i]));
+  }
+  caffe_cpu_gemv<float>(CblasNoTrans, M, K, 0.5F, &a.front(), &x.front(), 2.F, &y.front());
+  caffe_cpu_gemv<float16>(CblasNoTrans, M, K, float16(0.5F), &a16.front(), &x16.front(),
+      float16(2.F), &y16.front());
+  for (int i = 0; i < y.size(); ++i) {
+    EXPECT_NEAR(y[i], static_cast<float>(y16[i]), 1.e-2F + 1.e-3F * std::fabs(y[i]));
+  }
+}
+
+TEST(GPUMathFunctionsFP16Test, TestCPUConvert) {
+  // Every FLOAT16 bit pattern, enough times for CpuParallel threads and a SIMD tail
+  const int n = (1 << 16) * 9 + 13;
+  vector<float16> h(n), h2(n);
+  vector<float> f(n);
+  vector<double> d(n);
+  for (int i = 0; i < n; ++i) {
+    h[i].setx(static_cast<unsigned short>(i & 0xffff));
+  }
+  caffe_cpu_convert(n, &h.front(), &f.front());
+  caffe_cpu_convert(n, &f.front(), &h2.front());
+  for (int i = 0; i < n; ++i) {
+    const float expected = static_cast<float>(h[i]);
+    if (std::isnan(expected)) {
+      EXPECT_TRUE(std::isnan(f[i])) << " at i=" << i;
+      continue;
+    }
+    EXPECT_EQ(expected, f[i]) << " at i=" << i;
+    // Exactly representable: no rounding
+    EXPECT_EQ(h[i].getx(), h2[i].getx()) << " at i=" << i;
+  }
+  caffe_cpu_convert(n, &h.front(), &d.front());
+  caffe_cpu_convert(n, &d.front(), &h2.front());
+  for (int i = 0; i < (1 << 16); ++i) {
+    if (!std::isnan(f[i])) {
+      EXPECT_EQ(static_cast<double>(f[i]), d[i]) << " at i=" << i;
+      EXPECT_EQ(h[i].getx(), h2[i].getx()) << " at i=" << i;
+    }
+  }
+}
 #endif
 
 }  // namespace caffe
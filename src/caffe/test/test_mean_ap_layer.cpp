@@ -0,0 +1,94 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layers/mean_ap_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class MeanAPLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  MeanAPLayerTest()
+      : blob_bottom_truth_(new TBlob<Dtype>(vector<int>{2, 3, 5})),
+        blob_bottom_detections_(new TBlob<Dtype>(vector<int>{2, 3, 5})),
+        blob_top_map_(new TBlob<Dtype>()),
+        blob_top_precision_(new TBlob<Dtype>()),
+        blob_top_recall_(new TBlob<Dtype>()) {
+    blob_bottom_vec_.push_back(blob_bottom_truth_);
+    blob_bottom_vec_.push_back(blob_bottom_detections_);
+    blob_top_vec_.push_back(blob_top_map_);
+    blob_top_vec_.push_back(blob_top_precision_);
+    blob_top_vec_.push_back(blob_top_recall_);
+    caffe_set(blob_bottom_truth_->count(), Dtype(0), blob_bottom_truth_->mutable_cpu_data());
+    caffe_set(blob_bottom_detections_->count(), Dtype(0),
+        blob_bottom_detections_->mutable_cpu_data());
+    // Image 0: one box found, one missed, one false positive
+    SetBox(blob_bottom_truth_, 0, 0, 0, 0, 10, 10);
+    SetBox(blob_bottom_truth_, 0, 1, 20, 20, 30, 30);
+    SetBox(blob_bottom_detections_, 0, 0, 0, 0, 10, 10);
+    SetBox(blob_bottom_detections_, 0, 1, 50, 50, 60, 60);
+    // Image 1: IoU 0.9
+    SetBox(blob_bottom_truth_, 1, 0, 0, 0, 10, 10);
+    SetBox(blob_bottom_detections_, 1, 0, 1, 0, 10, 10);
+  }
+  virtual ~MeanAPLayerTest() {
+    delete blob_bottom_truth_;
+    delete blob_bottom_detections_;
+    delete blob_top_map_;
+    delete blob_top_precision_;
+    delete blob_top_recall_;
+  }
+
+  void SetBox(TBlob<Dtype>* blob, int n, int b, float x0, float y0, float x1, float y1) {
+    Dtype* box = blob->mutable_cpu_data() + (n * blob->shape(1) + b) * 5;
+    box[0] = Dtype(x0);
+    box[1] = Dtype(y0);
+    box[2] = Dtype(x1);
+    box[3] = Dtype(y1);
+  }
+
+  TBlob<Dtype>* const blob_bottom_truth_;
+  TBlob<Dtype>* const blob_bottom_detections_;
+  TBlob<Dtype>* const blob_top_map_;
+  TBlob<Dtype>* const blob_top_precision_;
+  TBlob<Dtype>* const blob_top_recall_;
+  vector<Blob*> blob_bottom_vec_;
+  vector<Blob*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(MeanAPLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(MeanAPLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  MeanAPLayer<Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const float error = tol<Dtype>(1e-3, 1e-1);
+  EXPECT_NEAR(200.F / 3.F, this->blob_top_precision_->cpu_data()[0], error);
+  EXPECT_NEAR(200.F / 3.F, this->blob_top_recall_->cpu_data()[0], error);
+  EXPECT_NEAR(400.F / 9.F, this->blob_top_map_->cpu_data()[0], error);
+}
+
+TYPED_TEST(MeanAPLayerTest, TestForwardIoUThreshold) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_mean_ap_param()->set_iou_threshold(0.95);
+  MeanAPLayer<Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Image 1's detection no longer counts
+  const float error = tol<Dtype>(1e-3, 1e-1);
+  EXPECT_NEAR(100.F / 3.F, this->blob_top_precision_->cpu_data()[0], error);
+  EXPECT_NEAR(100.F / 3.F, this->blob_top_recall_->cpu_data()[0], error);
+  EXPECT_NEAR(100.F / 9.F, this->blob_top_map_->cpu_data()[0], error);
+}
+
+}  // namespace caffe
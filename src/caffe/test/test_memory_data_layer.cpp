@@ -113,6 +113,42 @@ TYPED_TEST(MemoryDataLayerTest, TestForward) {
   }
 }
 
+#ifndef CPU_ONLY
+// device memory input is wrapped by tops without host staging
+TYPED_TEST(MemoryDataLayerTest, TestForwardGpuInput) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::GPU) {
+    return;
+  }
+  LayerParameter layer_param;
+  MemoryDataParameter* md_param = layer_param.mutable_memory_data_param();
+  md_param->set_batch_size(this->batch_size_);
+  md_param->set_channels(this->channels_);
+  md_param->set_height(this->height_);
+  md_param->set_width(this->width_);
+  shared_ptr<MemoryDataLayer<Dtype, Dtype> > layer(
+      new MemoryDataLayer<Dtype, Dtype>(layer_param));
+  layer->DataLayerSetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->ResetGpu(this->data_->mutable_gpu_data(),
+      this->labels_->mutable_gpu_data(), this->data_->num(), Caffe::thread_stream());
+  for (int i = 0; i < this->batches_ * 2; ++i) {
+    int batch_num = i % this->batches_;
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_EQ(this->data_blob_->gpu_data(), this->data_->gpu_data() +
+        this->data_->offset(1) * this->batch_size_ * batch_num);
+    for (int j = 0; j < this->data_blob_->count(); ++j) {
+      EXPECT_EQ(this->data_blob_->cpu_data()[j],
+          this->data_->cpu_data()[
+              this->data_->offset(1) * this->batch_size_ * batch_num + j]);
+    }
+    for (int j = 0; j < this->label_blob_->count(); ++j) {
+      EXPECT_EQ(this->label_blob_->cpu_data()[j],
+          this->labels_->cpu_data()[this->batch_size_ * batch_num + j]);
+    }
+  }
+}
+#endif
+
 TYPED_TEST(MemoryDataLayerTest, AddDatumVectorDefaultTransform) {
   typedef typename TypeParam::Dtype Dtype;
 
@@ -0,0 +1,79 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/metrics_exporter.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class MetricsExporterTest : public ::testing::Test {
+ protected:
+  MetricsExporterTest() {
+    sample_.iter = 100;
+    sample_.device = 1;
+    sample_.iteration_s = 0.25;
+    sample_.forward_s = 0.125;
+    sample_.backward_s = 0.0625;
+    sample_.reduce_s = 0.03125;
+    sample_.data_wait_s = 0.;
+    sample_.allreduce_bytes = 4096.;
+    sample_.allreduce_bytes_per_s = 131072.;
+    sample_.forward_tflops = 1.5;
+    sample_.backward_tflops = 3.;
+    sample_.gpu_mem_in_use = 1024UL;
+    sample_.gpu_mem_peak = 2048UL;
+    sample_.learning_rate = 0.5F;
+    sample_.loss = 2.F;
+  }
+
+  MetricsSample sample_;
+};
+
+TEST_F(MetricsExporterTest, TestJsonLine) {
+  const std::string line = MetricsExporter::JsonLine(sample_);
+  EXPECT_EQ('{', line.front());
+  EXPECT_EQ('}', line.back());
+  EXPECT_EQ(std::string::npos, line.find('\n'));
+  EXPECT_NE(std::string::npos, line.find("\"iter\": 100,"));
+  EXPECT_NE(std::string::npos, line.find("\"forward_s\": 0.125,"));
+  EXPECT_NE(std::string::npos, line.find("\"forward_tflops\": 1.5,"));
+  EXPECT_NE(std::string::npos, line.find("\"gpu_mem_peak\": 2048,"));
+  EXPECT_NE(std::string::npos, line.find("\"loss\": 2}"));
+}
+
+TEST_F(MetricsExporterTest, TestPrometheusText) {
+  const std::string text = MetricsExporter::PrometheusText(sample_);
+  EXPECT_NE(std::string::npos, text.find("# TYPE caffe_iteration_seconds gauge\n"));
+  EXPECT_NE(std::string::npos, text.find("\ncaffe_iteration_seconds{device=\"1\"} 0.25\n"));
+  EXPECT_NE(std::string::npos, text.find("\ncaffe_allreduce_bytes{device=\"1\"} 4096\n"));
+  EXPECT_NE(std::string::npos, text.find("\ncaffe_backward_tflops{device=\"1\"} 3\n"));
+  EXPECT_NE(std::string::npos, text.find("\ncaffe_learning_rate{device=\"1\"} 0.5\n"));
+  EXPECT_EQ('\n', text.back());
+}
+
+TEST_F(MetricsExporterTest, TestFileAppends) {
+  std::string file;
+  MakeTempFilename(&file);
+  {
+    MetricsExporter exporter(file, 0);
+    exporter.Record(sample_);
+    sample_.iter = 200;
+    exporter.Record(sample_);
+  }
+  std::ifstream in(file);
+  std::string line;
+  ASSERT_TRUE(static_cast<bool>(std::getline(in, line)));
+  EXPECT_NE(std::string::npos, line.find("\"iter\": 100,"));
+  ASSERT_TRUE(static_cast<bool>(std::getline(in, line)));
+  EXPECT_NE(std::string::npos, line.find("\"iter\": 200,"));
+  EXPECT_FALSE(static_cast<bool>(std::getline(in, line)));
+  std::remove(file.c_str());
+}
+
+}  // namespace caffe
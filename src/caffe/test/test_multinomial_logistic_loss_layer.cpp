@@ -55,4 +55,26 @@ TYPED_TEST(MultinomialLogisticLossLayerTest, TestGradientCPU) {
       this->blob_top_vec_, 0);
 }
 
+#ifndef CPU_ONLY
+TYPED_TEST(MultinomialLogisticLossLayerTest, TestForwardGPU) {
+  LayerParameter layer_param;
+  MultinomialLogisticLossLayer<TypeParam, TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const float loss = layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Caffe::set_mode(Caffe::GPU);
+  EXPECT_NEAR(loss, layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_),
+      tol<TypeParam>(1e-5, 1e-2) * loss);
+}
+
+TYPED_TEST(MultinomialLogisticLossLayerTest, TestGradientGPU) {
+  Caffe::set_mode(Caffe::GPU);
+  LayerParameter layer_param;
+  MultinomialLogisticLossLayer<TypeParam, TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  GradientChecker<TypeParam> checker(1e-2, 1e-1, 1701, 0, 0.05);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+}
+#endif
+
 }  // namespace caffe
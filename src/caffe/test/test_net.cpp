@@ -1,3 +1,5 @@
+#include <cstring>
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
@@ -10,6 +12,7 @@
 #include "caffe/filler.hpp"
 #include "caffe/net.hpp"
 #include "caffe/type.hpp"
+#include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -630,8 +633,9 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
-  virtual void InitReshapableNet() {
-    string proto =
+  virtual void InitReshapableNet(bool plan_activation_memory = false) {
+    string proto = plan_activation_memory ? "plan_activation_memory: true " : "";
+    proto +=
         "name: 'ReshapableNetwork' "
         "layer { "
         "  name: 'data' "
@@ -704,6 +708,30 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  // Chain of InnerProducts with in-place ReLUs, checkpoint after ip2
+  virtual void InitChainNet(const string& net_options) {
+    string proto =
+        "name: 'ChainNetwork' "
+        "layer { name: 'data' type: 'DummyData' top: 'data' top: 'label' "
+        "  dummy_data_param { "
+        "    shape { dim: 5 dim: 8 } data_filler { type: 'gaussian' std: 1 } "
+        "    shape { dim: 5 } data_filler { type: 'constant' value: 1 } } } "
+        "layer { name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+        "  inner_product_param { num_output: 8 weight_filler { type: 'gaussian' std: 0.5 } } } "
+        "layer { name: 'relu1' type: 'ReLU' bottom: 'ip1' top: 'ip1' } "
+        "layer { name: 'ip2' type: 'InnerProduct' bottom: 'ip1' top: 'ip2' checkpoint: true "
+        "  inner_product_param { num_output: 8 weight_filler { type: 'gaussian' std: 0.5 } } } "
+        "layer { name: 'ip3' type: 'InnerProduct' bottom: 'ip2' top: 'ip3' "
+        "  inner_product_param { num_output: 8 weight_filler { type: 'gaussian' std: 0.5 } } } "
+        "layer { name: 'relu3' type: 'ReLU' bottom: 'ip3' top: 'ip3' } "
+        "layer { name: 'ip4' type: 'InnerProduct' bottom: 'ip3' top: 'ip4' "
+        "  inner_product_param { num_output: 3 weight_filler { type: 'gaussian' std: 0.5 } } } "
+        "layer { name: 'loss' type: 'SoftmaxWithLoss' bottom: 'ip4' bottom: 'label' "
+        "  top: 'loss' } "
+        "state { phase: TRAIN } ";
+    InitNetFromProtoString(proto + net_options);
+  }
+
   virtual void InitSkipPropNet(bool test_skip_true) {
     string proto =
       "name: 'SkipPropTestNetwork' "
@@ -2529,6 +2557,135 @@ TYPED_TEST(NetTest, TestReshape) {
   EXPECT_FALSE(same_spatial_shape);
 }
 
+TYPED_TEST(NetTest, TestReshapeIfChanged) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  Caffe::set_mode(TypeParam::device);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  this->InitReshapableNet();
+  Blob* input_blob = this->net_->input_blobs()[0];
+  Blob* output_blob = this->net_->output_blobs()[0];
+  filler.Fill(input_blob);
+  this->net_->Forward();
+  const vector<int> output_shape = output_blob->shape();
+  TBlob<Dtype> output;
+  output.CopyFrom(*output_blob, false, true);
+  // Same shapes: invariant layers skip Reshape, results don't change
+  this->net_->Forward();
+  EXPECT_EQ(output_shape, output_blob->shape());
+  // A top reshaped behind the layer's back gets reshaped again
+  output_blob->Reshape(vector<int>{1, 1, 1, 1});
+  this->net_->Forward();
+  ASSERT_EQ(output_shape, output_blob->shape());
+  for (int i = 0; i < output.count(); ++i) {
+    EXPECT_NEAR(output.cpu_data()[i], output_blob->cpu_data<Dtype>()[i],
+        tol<Dtype>(1e-4, 1e-2));
+  }
+}
+
+TYPED_TEST(NetTest, TestActivationMemoryPlan) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (TypeParam::device != Caffe::GPU) {
+    return;
+  }
+  Caffe::set_mode(TypeParam::device);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  TBlob<Dtype> input(1, 3, 100, 100);
+  filler.Fill(&input);
+  vector<shared_ptr<TBlob<Dtype>>> outputs(2);
+  for (int plan = 0; plan < 2; ++plan) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitReshapableNet(plan == 1);
+    Blob* input_blob = this->net_->input_blobs()[0];
+    caffe_copy<Dtype>(input.count(), input.cpu_data(), input_blob->mutable_cpu_data<Dtype>());
+    this->net_->Forward();
+    outputs[plan] = make_shared<TBlob<Dtype>>();
+    outputs[plan]->CopyFrom(*this->net_->output_blobs()[0], false, true);
+  }
+  // conv1 dies before norm1 is born
+  EXPECT_EQ(this->net_->blob_by_name("conv1")->current_data_memory(true),
+      this->net_->blob_by_name("norm1")->current_data_memory(true));
+  ASSERT_EQ(outputs[0]->count(), outputs[1]->count());
+  for (int i = 0; i < outputs[0]->count(); ++i) {
+    EXPECT_EQ(outputs[0]->cpu_data()[i], outputs[1]->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestRecomputeActivations) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<shared_ptr<TBlob<Dtype>>> grads(2);
+  for (int recompute = 0; recompute < 2; ++recompute) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitChainNet(recompute ? "recompute_activations: true " : "");
+    this->net_->Forward();
+    this->net_->Backward();
+    grads[recompute] = make_shared<TBlob<Dtype>>();
+    grads[recompute]->CopyFrom(*this->net_->layer_by_name("ip1")->blobs()[0], true, true);
+  }
+  // ip1 output was released after forward and recomputed for backward
+  ASSERT_EQ(grads[0]->count(), grads[1]->count());
+  for (int i = 0; i < grads[0]->count(); ++i) {
+    EXPECT_EQ(grads[0]->cpu_diff()[i], grads[1]->cpu_diff()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestOffloadActivations) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (TypeParam::device != Caffe::GPU) {
+    return;
+  }
+  Caffe::set_mode(TypeParam::device);
+  vector<shared_ptr<TBlob<Dtype>>> grads(2);
+  for (int offload = 0; offload < 2; ++offload) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitChainNet(offload ? "offload_activations: true offload_min_kb: 0 "
+        "offload_prefetch_distance: 1 " : "");
+    for (int iter = 0; iter < 2; ++iter) {
+      this->net_->Forward();
+      this->net_->Backward();
+    }
+    grads[offload] = make_shared<TBlob<Dtype>>();
+    grads[offload]->CopyFrom(*this->net_->layer_by_name("ip1")->blobs()[0], true, true);
+  }
+  ASSERT_EQ(grads[0]->count(), grads[1]->count());
+  for (int i = 0; i < grads[0]->count(); ++i) {
+    EXPECT_EQ(grads[0]->cpu_diff()[i], grads[1]->cpu_diff()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestStreamWeights) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (TypeParam::device != Caffe::GPU) {
+    return;
+  }
+  Caffe::set_mode(TypeParam::device);
+  vector<shared_ptr<TBlob<Dtype>>> outputs(2), weights(2);
+  for (int stream = 0; stream < 2; ++stream) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitChainNet(string(stream ? "stream_weights: true " : "") + "state { phase: TEST } ");
+    // The second pass reuses the ring
+    for (int iter = 0; iter < 2; ++iter) {
+      this->net_->Forward();
+    }
+    outputs[stream] = make_shared<TBlob<Dtype>>();
+    outputs[stream]->CopyFrom(*this->net_->blob_by_name("ip4"), false, true);
+    weights[stream] = make_shared<TBlob<Dtype>>();
+    weights[stream]->CopyFrom(*this->net_->layer_by_name("ip3")->blobs()[0], false, true);
+  }
+  // Four layers through two buffers, host copies intact
+  ASSERT_EQ(outputs[0]->count(), outputs[1]->count());
+  for (int i = 0; i < outputs[0]->count(); ++i) {
+    EXPECT_EQ(outputs[0]->cpu_data()[i], outputs[1]->cpu_data()[i]);
+  }
+  for (int i = 0; i < weights[0]->count(); ++i) {
+    EXPECT_EQ(weights[0]->cpu_data()[i], weights[1]->cpu_data()[i]);
+  }
+}
+
 TYPED_TEST(NetTest, TestSkipPropagateDown) {
   // check bottom_need_backward if propagate_down is true
   this->InitSkipPropNet(false);
@@ -2624,4 +2781,459 @@ TYPED_TEST(NetTest, TestForcePropagateDown) {
   }
 }
 
+TYPED_TEST(NetTest, TestFrozenPrefix) {
+  const string proto =
+      "name: 'FrozenNetwork' "
+      "layer { name: 'data' type: 'DummyData' top: 'data' top: 'label' "
+      "  dummy_data_param { "
+      "    shape { dim: 5 dim: 8 } data_filler { type: 'gaussian' std: 1 } "
+      "    shape { dim: 5 } data_filler { type: 'constant' value: 1 } } } "
+      "layer { name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+      "  param { lr_mult: 0 } param { lr_mult: 0 } "
+      "  inner_product_param { num_output: 8 weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'ip1' top: 'ip1' } "
+      "layer { name: 'ip2' type: 'InnerProduct' bottom: 'ip1' top: 'ip2' "
+      "  inner_product_param { num_output: 3 weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'loss' type: 'SoftmaxWithLoss' bottom: 'ip2' bottom: 'label' "
+      "  top: 'loss' } "
+      "state { phase: TRAIN } ";
+  this->InitNetFromProtoString(proto);
+  this->net_->Forward();
+  this->net_->Backward(false);
+  // Backward starts and ends with ip2, nothing below it gets a diff
+  EXPECT_TRUE(this->net_->blob_by_name("data")->is_diff_empty());
+  EXPECT_TRUE(this->net_->blob_by_name("ip1")->is_diff_empty());
+  EXPECT_FALSE(this->net_->blob_by_name("ip2")->is_diff_empty());
+  EXPECT_FALSE(this->net_->layer_by_name("ip2")->blobs()[0]->is_diff_empty());
+}
+
+TYPED_TEST(NetTest, TestFoldBatchNorm) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'FoldNetwork' "
+      "layer { name: 'data' type: 'Input' top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 5 dim: 5 } } } "
+      "layer { name: 'conv1' type: 'Convolution' bottom: 'data' top: 'conv1' "
+      "  convolution_param { num_output: 4 kernel_size: 3 bias_term: false "
+      "    weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'bn1' type: 'BatchNorm' bottom: 'conv1' top: 'conv1' "
+      "  batch_norm_param { use_global_stats: true "
+      "    scale_filler { type: 'gaussian' std: 1 } "
+      "    bias_filler { type: 'gaussian' std: 1 } } } "
+      "layer { name: 'scale1' type: 'Scale' bottom: 'conv1' top: 'conv1' "
+      "  scale_param { bias_term: true filler { type: 'gaussian' std: 1 } "
+      "    bias_filler { type: 'gaussian' std: 1 } } } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'conv1' } "
+      "state { phase: TEST } ";
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  // Trained statistics, variance has to be positive
+  vector<shared_ptr<Blob>>& bn_blobs = this->net_->layer_by_name("bn1")->blobs();
+  FillerParameter filler_param;
+  filler_param.set_min(0.5);
+  filler_param.set_max(2.);
+  UniformFiller<Dtype> filler(filler_param);
+  filler.Fill(bn_blobs[0].get());
+  filler.Fill(bn_blobs[1].get());
+  TBlob<Dtype> input(2, 3, 5, 5);
+  filler.Fill(&input);
+  vector<shared_ptr<TBlob<Dtype>>> outputs(2);
+  NetParameter trained;
+  for (int fold = 0; fold < 2; ++fold) {
+    if (fold) {
+      this->InitNetFromProtoString(proto + "fold_batch_norm: true ");
+      this->net_->CopyTrainedLayersFrom(trained);
+      EXPECT_FALSE(this->net_->has_layer("bn1"));
+      EXPECT_FALSE(this->net_->has_layer("scale1"));
+    } else {
+      this->net_->ToProto(&trained);
+    }
+    Blob* input_blob = this->net_->input_blobs()[0];
+    caffe_copy<Dtype>(input.count(), input.cpu_data(), input_blob->mutable_cpu_data<Dtype>());
+    this->net_->Forward();
+    outputs[fold] = make_shared<TBlob<Dtype>>();
+    outputs[fold]->CopyFrom(*this->net_->blob_by_name("conv1"), false, true);
+  }
+  ASSERT_EQ(outputs[0]->count(), outputs[1]->count());
+  const float tol = is_type<Dtype>(FLOAT16) ? 1e-1 : 1e-4;
+  for (int i = 0; i < outputs[0]->count(); ++i) {
+    EXPECT_NEAR(outputs[0]->cpu_data()[i], outputs[1]->cpu_data()[i],
+        tol * (1. + std::fabs(outputs[0]->cpu_data()[i])));
+  }
+}
+
+TYPED_TEST(NetTest, TestFusePointwise) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'FuseNetwork' "
+      "layer { name: 'data' type: 'Input' top: 'data' top: 'shortcut' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 4 dim: 4 } "
+      "    shape { dim: 2 dim: 3 dim: 4 dim: 4 } } } "
+      "layer { name: 'scale1' type: 'Scale' bottom: 'data' top: 'scale1' "
+      "  scale_param { bias_term: true filler { type: 'gaussian' std: 1 } "
+      "    bias_filler { type: 'gaussian' std: 1 } } } "
+      "layer { name: 'res1' type: 'Eltwise' bottom: 'shortcut' bottom: 'scale1' "
+      "  top: 'res1' eltwise_param { coeff: 0.5 coeff: 2 } } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'res1' top: 'res1' } "
+      "state { phase: TEST } ";
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  FillerParameter filler_param;
+  filler_param.set_std(1.);
+  GaussianFiller<Dtype> filler(filler_param);
+  TBlob<Dtype> data(2, 3, 4, 4), shortcut(2, 3, 4, 4);
+  filler.Fill(&data);
+  filler.Fill(&shortcut);
+  vector<shared_ptr<TBlob<Dtype>>> outputs(2);
+  NetParameter trained;
+  for (int fuse = 0; fuse < 2; ++fuse) {
+    if (fuse) {
+      this->InitNetFromProtoString(proto + "fuse_pointwise: true ");
+      this->net_->CopyTrainedLayersFrom(trained);
+      EXPECT_FALSE(this->net_->has_layer("scale1"));
+      EXPECT_FALSE(this->net_->has_layer("relu1"));
+      ASSERT_TRUE(this->net_->has_layer("scale1+res1+relu1"));
+      EXPECT_EQ(2, this->net_->layers().size());
+    } else {
+      this->net_->ToProto(&trained);
+    }
+    caffe_copy<Dtype>(data.count(), data.cpu_data(),
+        this->net_->input_blobs()[0]->template mutable_cpu_data<Dtype>());
+    caffe_copy<Dtype>(shortcut.count(), shortcut.cpu_data(),
+        this->net_->input_blobs()[1]->template mutable_cpu_data<Dtype>());
+    this->net_->Forward();
+    outputs[fuse] = make_shared<TBlob<Dtype>>();
+    outputs[fuse]->CopyFrom(*this->net_->blob_by_name("res1"), false, true);
+  }
+  ASSERT_EQ(outputs[0]->count(), outputs[1]->count());
+  const float tol = is_type<Dtype>(FLOAT16) ? 1e-2 : 1e-5;
+  for (int i = 0; i < outputs[0]->count(); ++i) {
+    EXPECT_NEAR(outputs[0]->cpu_data()[i], outputs[1]->cpu_data()[i],
+        tol * (1. + std::fabs(outputs[0]->cpu_data()[i])));
+  }
+}
+
+TYPED_TEST(NetTest, TestFuseInnerProductActivation) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'FuseNetwork' "
+      "layer { name: 'data' type: 'Input' top: 'data' "
+      "  input_param { shape { dim: 4 dim: 6 } } } "
+      "layer { name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+      "  inner_product_param { num_output: 8 weight_filler { type: 'gaussian' std: 1 } "
+      "    bias_filler { type: 'gaussian' std: 1 } } } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'ip1' top: 'relu1' } "
+      "layer { name: 'ip2' type: 'InnerProduct' bottom: 'relu1' top: 'ip2' "
+      "  inner_product_param { num_output: 5 weight_filler { type: 'gaussian' std: 1 } } } "
+      "layer { name: 'relu2' type: 'ReLU' bottom: 'ip2' top: 'ip2' } "
+      "state { phase: TEST } ";
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  FillerParameter filler_param;
+  filler_param.set_std(1.);
+  GaussianFiller<Dtype> filler(filler_param);
+  TBlob<Dtype> data(4, 6, 1, 1);
+  filler.Fill(&data);
+  vector<shared_ptr<TBlob<Dtype>>> outputs(2);
+  NetParameter trained;
+  for (int fuse = 0; fuse < 2; ++fuse) {
+    if (fuse) {
+      this->InitNetFromProtoString(proto + "fuse_inner_product_activation: true ");
+      this->net_->CopyTrainedLayersFrom(trained);
+      EXPECT_FALSE(this->net_->has_layer("relu1"));
+      EXPECT_FALSE(this->net_->has_layer("relu2"));
+      EXPECT_FALSE(this->net_->has_blob("ip1"));
+      EXPECT_EQ(3, this->net_->layers().size());
+    } else {
+      this->net_->ToProto(&trained);
+    }
+    caffe_copy<Dtype>(data.count(), data.cpu_data(),
+        this->net_->input_blobs()[0]->template mutable_cpu_data<Dtype>());
+    this->net_->Forward();
+    outputs[fuse] = make_shared<TBlob<Dtype>>();
+    outputs[fuse]->CopyFrom(*this->net_->blob_by_name("ip2"), false, true);
+  }
+  ASSERT_EQ(outputs[0]->count(), outputs[1]->count());
+  const float tol = is_type<Dtype>(FLOAT16) ? 1e-2 : 1e-5;
+  for (int i = 0; i < outputs[0]->count(); ++i) {
+    EXPECT_NEAR(outputs[0]->cpu_data()[i], outputs[1]->cpu_data()[i],
+        tol * (1. + std::fabs(outputs[0]->cpu_data()[i])));
+  }
+}
+
+#if !defined(CPU_ONLY) && defined(USE_NCCL)
+TYPED_TEST(NetTest, TestSpatialStripes) {
+  const string proto =
+      "name: 'StripeNetwork' "
+      "spatial_stripes: 2 "
+      "layer { name: 'data' type: 'Input' top: 'data' top: 'label' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 8 dim: 6 } shape { dim: 2 } } } "
+      "layer { name: 'conv1' type: 'Convolution' bottom: 'data' top: 'conv1' "
+      "  convolution_param { num_output: 4 kernel_size: 3 pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 1 } } } "
+      "layer { name: 'bn1' type: 'BatchNorm' bottom: 'conv1' top: 'conv1' } "
+      "layer { name: 'pool1' type: 'Pooling' bottom: 'conv1' top: 'pool1' "
+      "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } } "
+      "layer { name: 'conv2' type: 'Convolution' bottom: 'pool1' top: 'conv2' "
+      "  convolution_param { num_output: 2 kernel_h: 5 kernel_w: 1 pad_h: 2 "
+      "    weight_filler { type: 'gaussian' std: 1 } } } "
+      "state { phase: TRAIN } ";
+  Caffe::set_solver_count(2);
+  this->InitNetFromProtoString(proto);
+  Caffe::set_solver_count(1);
+  EXPECT_TRUE(this->net_->has_layer("data_stripe"));
+  EXPECT_TRUE(this->net_->has_layer("label_stripe"));
+  EXPECT_TRUE(this->net_->has_layer("conv1_halo"));
+  EXPECT_TRUE(this->net_->has_layer("conv2_halo"));
+  EXPECT_FALSE(this->net_->has_layer("pool1_halo"));
+  EXPECT_TRUE(this->net_->layer_by_name("bn1")->layer_param().batch_norm_param().sync_stats());
+  // Half the rows, one more above and below for conv1 and two for conv2
+  EXPECT_EQ(vector<int>({2, 3, 4, 6}), this->net_->blob_by_name("data_stripe")->shape());
+  EXPECT_EQ(vector<int>({2}), this->net_->blob_by_name("label_stripe")->shape());
+  EXPECT_EQ(vector<int>({2, 3, 6, 6}), this->net_->blob_by_name("conv1_halo")->shape());
+  EXPECT_EQ(vector<int>({2, 4, 4, 6}), this->net_->blob_by_name("conv1")->shape());
+  EXPECT_EQ(vector<int>({2, 4, 2, 3}), this->net_->blob_by_name("pool1")->shape());
+  EXPECT_EQ(vector<int>({2, 4, 6, 3}), this->net_->blob_by_name("conv2_halo")->shape());
+  EXPECT_EQ(vector<int>({2, 2, 2, 3}), this->net_->blob_by_name("conv2")->shape());
+}
+#endif
+
+TYPED_TEST(NetTest, TestCudaGraph) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (TypeParam::device != Caffe::GPU) {
+    return;
+  }
+  Caffe::set_mode(TypeParam::device);
+  const string proto =
+      "name: 'GraphNetwork' "
+      "layer { name: 'data' type: 'Input' top: 'data' "
+      "  input_param { shape { dim: 2 dim: 8 } } } "
+      "layer { name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+      "  inner_product_param { num_output: 8 weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'ip1' top: 'ip1' } "
+      "layer { name: 'ip2' type: 'InnerProduct' bottom: 'ip1' top: 'ip2' "
+      "  inner_product_param { num_output: 3 weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "state { phase: TEST } ";
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  TBlob<Dtype> input(2, 8, 1, 1);
+  vector<shared_ptr<TBlob<Dtype>>> outputs(2);
+  for (int graph = 0; graph < 2; ++graph) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitNetFromProtoString(proto + (graph ? "cuda_graph: true cuda_graph_warmup_iters: 1 "
+        : ""));
+    Caffe::set_random_seed(this->seed_);
+    // Past warm-up, the last passes replay the captured graph with new input values
+    for (int iter = 0; iter < 4; ++iter) {
+      filler.Fill(&input);
+      Blob* input_blob = this->net_->input_blobs()[0];
+      caffe_copy<Dtype>(input.count(), input.cpu_data(), input_blob->mutable_cpu_data<Dtype>());
+      this->net_->Forward();
+    }
+    outputs[graph] = make_shared<TBlob<Dtype>>();
+    outputs[graph]->CopyFrom(*this->net_->output_blobs()[0], false, true);
+  }
+  ASSERT_EQ(outputs[0]->count(), outputs[1]->count());
+  for (int i = 0; i < outputs[0]->count(); ++i) {
+    EXPECT_EQ(outputs[0]->cpu_data()[i], outputs[1]->cpu_data()[i]);
+  }
+}
+
+// Without USE_TENSORRT both nets run natively
+TYPED_TEST(NetTest, TestTensorRT) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (TypeParam::device != Caffe::GPU) {
+    return;
+  }
+  Caffe::set_mode(TypeParam::device);
+  const string proto =
+      "name: 'TensorRTNetwork' "
+      "layer { name: 'data' type: 'Input' top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 8 dim: 8 } } } "
+      "layer { name: 'conv1' type: 'Convolution' bottom: 'data' top: 'conv1' "
+      "  convolution_param { num_output: 4 kernel_size: 3 pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'conv1' } "
+      "layer { name: 'pool1' type: 'Pooling' bottom: 'conv1' top: 'pool1' "
+      "  pooling_param { pool: MAX kernel_size: 3 stride: 2 } } "
+      "layer { name: 'ip1' type: 'InnerProduct' bottom: 'pool1' top: 'ip1' "
+      "  inner_product_param { num_output: 5 weight_filler { type: 'gaussian' std: 0.5 } } } "
+      "layer { name: 'prob' type: 'Softmax' bottom: 'ip1' top: 'prob' } "
+      "state { phase: TEST } ";
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  FillerParameter filler_param;
+  filler_param.set_std(1.);
+  GaussianFiller<Dtype> filler(filler_param);
+  TBlob<Dtype> data(2, 3, 8, 8);
+  filler.Fill(&data);
+  vector<shared_ptr<TBlob<Dtype>>> outputs(2);
+  NetParameter trained;
+  this->net_->ToProto(&trained);
+  for (int trt = 0; trt < 2; ++trt) {
+    if (trt) {
+      this->InitNetFromProtoString(proto + "tensorrt { precision: FP32 min_layers: 2 } ");
+      this->net_->CopyTrainedLayersFrom(trained);
+    }
+    // The second pass runs the engine built by the first one
+    for (int iter = 0; iter < 2; ++iter) {
+      caffe_copy<Dtype>(data.count(), data.cpu_data(),
+          this->net_->input_blobs()[0]->template mutable_cpu_data<Dtype>());
+      this->net_->Forward();
+    }
+    outputs[trt] = make_shared<TBlob<Dtype>>();
+    outputs[trt]->CopyFrom(*this->net_->output_blobs()[0], false, true);
+  }
+  ASSERT_EQ(outputs[0]->count(), outputs[1]->count());
+  const float tol = is_type<Dtype>(FLOAT16) ? 1e-2 : 1e-4;
+  for (int i = 0; i < outputs[0]->count(); ++i) {
+    EXPECT_NEAR(outputs[0]->cpu_data()[i], outputs[1]->cpu_data()[i],
+        tol * (1. + std::fabs(outputs[0]->cpu_data()[i])));
+  }
+}
+
+TYPED_TEST(NetTest, TestPipelineStages) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (TypeParam::device != Caffe::GPU) {
+    return;
+  }
+  Caffe::set_mode(TypeParam::device);
+  // Both stages on one device: stage workers and copies work the same way
+  LayerProfile profile;
+  for (const char* name : {"ip1", "ip2", "ip3", "ip4"}) {
+    LayerProfile::Entry* entry = profile.add_entry();
+    entry->set_layer(name);
+    entry->set_forward_ms(1.F);
+    entry->set_backward_ms(2.F);
+  }
+  string profile_file;
+  MakeTempFilename(&profile_file);
+  WriteProtoToTextFile(profile, profile_file);
+  std::ostringstream options;
+  options << "pipeline_device: " << Caffe::current_device() << " pipeline_device: "
+      << Caffe::current_device() << " pipeline_profile: '" << profile_file << "' ";
+  vector<shared_ptr<TBlob<Dtype>>> grads(2);
+  vector<float> losses(2);
+  for (int pipelined = 0; pipelined < 2; ++pipelined) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitChainNet(pipelined ? options.str() : "");
+    this->net_->Forward(&losses[pipelined]);
+    this->net_->Backward(false);
+    grads[pipelined] = make_shared<TBlob<Dtype>>();
+    grads[pipelined]->CopyFrom(*this->net_->layer_by_name("ip1")->blobs()[0], true, true);
+  }
+  // Halves of equal time, the label crosses to the loss in the second stage
+  EXPECT_EQ(2, this->net_->pipeline_stages());
+  const vector<string>& names = this->net_->layer_names();
+  for (int i = 0; i < names.size(); ++i) {
+    const bool second = names[i] == "ip3" || names[i] == "relu3" || names[i] == "ip4" ||
+        names[i] == "loss";
+    EXPECT_EQ(second ? 1 : 0, this->net_->pipeline_stage(i)) << names[i];
+  }
+  EXPECT_EQ(losses[0], losses[1]);
+  ASSERT_EQ(grads[0]->count(), grads[1]->count());
+  for (int i = 0; i < grads[0]->count(); ++i) {
+    EXPECT_EQ(grads[0]->cpu_diff()[i], grads[1]->cpu_diff()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestSetUpThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet("");
+  const vector<bool> need_backward = this->net_->layer_need_backward();
+  vector<vector<int>> shapes;
+  for (const shared_ptr<Blob>& blob : this->net_->blobs()) {
+    shapes.push_back(blob->shape());
+  }
+  vector<shared_ptr<TBlob<Dtype>>> weights(2);
+  for (int run = 0; run < 2; ++run) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitChainNet("setup_threads: 4 ");
+    EXPECT_EQ(need_backward, this->net_->layer_need_backward());
+    ASSERT_EQ(shapes.size(), this->net_->blobs().size());
+    for (int i = 0; i < shapes.size(); ++i) {
+      EXPECT_EQ(shapes[i], this->net_->blobs()[i]->shape());
+    }
+    EXPECT_EQ(4, this->net_->learnable_params().size() / 2);
+    weights[run] = make_shared<TBlob<Dtype>>();
+    weights[run]->CopyFrom(*this->net_->layer_by_name("ip3")->blobs()[0], false, true);
+  }
+  // Same seed, same weights whichever thread filled them
+  ASSERT_EQ(weights[0]->count(), weights[1]->count());
+  for (int i = 0; i < weights[0]->count(); ++i) {
+    EXPECT_EQ(weights[0]->cpu_data()[i], weights[1]->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestTrainedNetShared) {
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet("");
+  shared_ptr<Net> train = this->net_;
+  NetParameter param;
+  train->ToProto(&param, false);
+  for (int i = 0; i < param.layer_size(); ++i) {
+    param.mutable_layer(i)->clear_blobs();
+  }
+  param.mutable_state()->set_phase(TEST);
+  Net test(param, 0U, nullptr, nullptr, nullptr, train.get());
+  EXPECT_TRUE(test.trained_layers_shared());
+  for (const string& name : {"ip1", "ip2", "ip3", "ip4"}) {
+    const vector<shared_ptr<Blob>>& blobs = test.layer_by_name(name)->blobs();
+    ASSERT_EQ(2, blobs.size());
+    // The very same blobs: nothing allocated or filled for the test net
+    EXPECT_EQ(train->layer_by_name(name)->blobs()[0].get(), blobs[0].get());
+    EXPECT_EQ(train->layer_by_name(name)->blobs()[1].get(), blobs[1].get());
+  }
+}
+
+TYPED_TEST(NetTest, TestDeterministicRepeats) {
+  // A root seed keeps Net::Init from seeding on its own
+  Caffe::set_root_seed(this->seed_);
+  float loss[2];
+  vector<float> diffs[2];
+  for (int run = 0; run < 2; ++run) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitChainNet("deterministic: true ");
+    EXPECT_TRUE(Caffe::deterministic());
+    loss[run] = this->net_->ForwardBackward();
+    for (const shared_ptr<Blob>& param : this->net_->learnable_params()) {
+      const float* diff = param->cpu_diff<float>();
+      diffs[run].insert(diffs[run].end(), diff, diff + param->count());
+    }
+  }
+  Caffe::set_deterministic(false);
+  // Bit for bit
+  EXPECT_EQ(loss[0], loss[1]);
+  ASSERT_EQ(diffs[0].size(), diffs[1].size());
+  EXPECT_EQ(0, memcmp(diffs[0].data(), diffs[1].data(), diffs[0].size() * sizeof(float)));
+}
+
+TYPED_TEST(NetTest, TestMemoryReport) {
+  this->InitTinyNet();
+  this->net_->ForwardBackward();
+  const vector<Net::MemoryUse> rows = this->net_->MemoryReport();
+  if (Caffe::mode() != Caffe::GPU) {
+    EXPECT_TRUE(rows.empty());
+    return;
+  }
+  int tops = 0, params = 0;
+  for (const Net::MemoryUse& row : rows) {
+    if (row.kind == "top") {
+      ++tops;
+      EXPECT_GE(row.data_bytes,
+          this->net_->blob_by_name(row.blob)->count() * tsize(row.data_type));
+    } else if (row.kind == "param") {
+      ++params;
+      EXPECT_EQ("innerproduct", row.layer);
+      EXPECT_GT(row.data_bytes, 0UL);
+      EXPECT_GT(row.diff_bytes, 0UL);
+    }
+  }
+  EXPECT_EQ(4, tops);  // data, label, innerproduct, top_loss
+  EXPECT_EQ(2, params);
+  EXPECT_NE(string::npos, this->net_->MemoryReportString().find("innerproduct[0]"));
+}
+
 }  // namespace caffe
@@ -602,6 +602,66 @@ TYPED_TEST(NeuronLayerTest, TestDropoutGradientTest) {
   checker.CheckGradientEltwise(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
 }
 
+TYPED_TEST(NeuronLayerTest, TestDropoutRegenerateMask) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.set_phase(TRAIN);
+  layer_param.mutable_dropout_param()->set_random_seed(1701);
+  DropoutLayer<Dtype, Dtype> layer(layer_param);
+  layer_param.mutable_dropout_param()->set_regenerate_mask(true);
+  DropoutLayer<Dtype, Dtype> regenerating_layer(layer_param);
+  TBlob<Dtype> top, bottom;
+  bottom.ReshapeLike(*this->blob_bottom_);
+  vector<Blob*> top_vec{&top}, bottom_vec{&bottom};
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  regenerating_layer.SetUp(bottom_vec, top_vec);
+  const int count = this->blob_bottom_->count();
+  vector<Dtype> first_top;
+  for (int iter = 0; iter < 2; ++iter) {
+    bottom.CopyFrom(*this->blob_bottom_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    regenerating_layer.Forward(bottom_vec, top_vec);
+    for (int i = 0; i < count; ++i) {
+      EXPECT_EQ(this->blob_top_->cpu_data()[i], top.cpu_data()[i]);
+    }
+    TBlob<Dtype> top_diff;
+    top_diff.ReshapeLike(top);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&top_diff);
+    caffe_copy(count, top_diff.cpu_data(), this->blob_top_->mutable_cpu_diff());
+    caffe_copy(count, top_diff.cpu_data(), top.mutable_cpu_diff());
+    vector<bool> propagate_down(1, true);
+    layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+    regenerating_layer.Backward(top_vec, propagate_down, bottom_vec);
+    for (int i = 0; i < count; ++i) {
+      EXPECT_EQ(this->blob_bottom_->cpu_diff()[i], bottom.cpu_diff()[i]);
+    }
+    // Each iteration draws its own mask
+    int differing = 0;
+    for (int i = 0; i < count; ++i) {
+      if (iter == 0) {
+        first_top.push_back(this->blob_top_->cpu_data()[i]);
+      } else if ((first_top[i] == Dtype(0)) != (this->blob_top_->cpu_data()[i] == Dtype(0))) {
+        ++differing;
+      }
+    }
+    if (iter == 1) {
+      EXPECT_GT(differing, 0);
+    }
+  }
+}
+
+TYPED_TEST(NeuronLayerTest, TestDropoutGradientRegenerateMask) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.set_phase(TRAIN);
+  layer_param.mutable_dropout_param()->set_regenerate_mask(true);
+  DropoutLayer<Dtype, Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(tol<Dtype>(1e-2, 1e-1), tol<Dtype>(1e-3, 1e-1));
+  checker.CheckGradientEltwise(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+}
+
 TYPED_TEST(NeuronLayerTest, TestBNLL) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
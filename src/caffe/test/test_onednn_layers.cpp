@@ -0,0 +1,229 @@
+#ifdef USE_ONEDNN
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/batch_norm_layer.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/inner_product_layer.hpp"
+#include "caffe/layers/lrn_layer.hpp"
+#include "caffe/layers/onednn_batch_norm_layer.hpp"
+#include "caffe/layers/onednn_conv_layer.hpp"
+#include "caffe/layers/onednn_inner_product_layer.hpp"
+#include "caffe/layers/onednn_lrn_layer.hpp"
+#include "caffe/layers/onednn_pooling_layer.hpp"
+#include "caffe/layers/pooling_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/quantization.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class OneDNNLayerTest : public CPUDeviceTest<float> {
+ protected:
+  OneDNNLayerTest()
+      : blob_bottom_(new TBlob<float>(2, 8, 9, 11)), blob_top_(new TBlob<float>()),
+        blob_top_onednn_(new TBlob<float>()) {
+    FillerParameter filler_param;
+    filler_param.set_min(-1.F);
+    filler_param.set_max(1.F);
+    UniformFiller<float> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    blob_top_onednn_vec_.push_back(blob_top_onednn_);
+  }
+
+  virtual ~OneDNNLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete blob_top_onednn_;
+  }
+
+  LayerParameter MakeParam() {
+    LayerParameter layer_param;
+    layer_param.set_phase(TEST);
+    layer_param.set_forward_type(FLOAT);
+    layer_param.set_backward_type(FLOAT);
+    layer_param.set_forward_math(FLOAT);
+    layer_param.set_backward_math(FLOAT);
+    return layer_param;
+  }
+
+  LayerParameter MakeConvParam() {
+    LayerParameter layer_param = MakeParam();
+    ConvolutionParameter* conv_param = layer_param.mutable_convolution_param();
+    conv_param->add_kernel_size(3);
+    conv_param->add_stride(2);
+    conv_param->add_pad(1);
+    conv_param->set_num_output(6);
+    conv_param->set_group(2);
+    conv_param->mutable_weight_filler()->set_type("gaussian");
+    conv_param->mutable_bias_filler()->set_type("gaussian");
+    return layer_param;
+  }
+
+  LayerParameter MakeInnerProductParam() {
+    LayerParameter layer_param = MakeParam();
+    InnerProductParameter* ip_param = layer_param.mutable_inner_product_param();
+    ip_param->set_num_output(10);
+    ip_param->mutable_weight_filler()->set_type("gaussian");
+    ip_param->mutable_bias_filler()->set_type("gaussian");
+    return layer_param;
+  }
+
+  // Runs the Caffe layer, then the oneDNN one on its weights, on the same bottom
+  void Run(Layer<float, float>* layer, Layer<float, float>* onednn_layer) {
+    layer->SetUp(blob_bottom_vec_, blob_top_vec_);
+    layer->Forward(blob_bottom_vec_, blob_top_vec_);
+    onednn_layer->blobs() = layer->blobs();
+    onednn_layer->SetUp(blob_bottom_vec_, blob_top_onednn_vec_);
+    onednn_layer->Forward(blob_bottom_vec_, blob_top_onednn_vec_);
+  }
+
+  void ExpectClose(float tolerance) {
+    ASSERT_EQ(blob_top_->shape(), blob_top_onednn_->shape());
+    for (int i = 0; i < blob_top_->count(); ++i) {
+      EXPECT_NEAR(blob_top_->cpu_data()[i], blob_top_onednn_->cpu_data()[i], tolerance);
+    }
+  }
+
+  TBlob<float>* const blob_bottom_;
+  TBlob<float>* const blob_top_;
+  TBlob<float>* const blob_top_onednn_;
+  vector<Blob*> blob_bottom_vec_;
+  vector<Blob*> blob_top_vec_;
+  vector<Blob*> blob_top_onednn_vec_;
+};
+
+TEST_F(OneDNNLayerTest, TestConvolution) {
+  LayerParameter layer_param = MakeConvParam();
+  ConvolutionLayer<float, float> layer(layer_param);
+  OneDNNConvolutionLayer<float, float> onednn_layer(layer_param);
+  Run(&layer, &onednn_layer);
+  ExpectClose(1e-4);
+  // Cached weights are dropped when changed from outside
+  caffe_scal(layer.blobs()[0]->count(), 2.F, layer.blobs()[0]->mutable_cpu_data<float>());
+  layer.Forward(blob_bottom_vec_, blob_top_vec_);
+  onednn_layer.WeightsChanged();
+  onednn_layer.Forward(blob_bottom_vec_, blob_top_onednn_vec_);
+  ExpectClose(1e-4);
+}
+
+TEST_F(OneDNNLayerTest, TestConvolutionNHWC) {
+  LayerParameter layer_param = MakeConvParam();
+  ConvolutionLayer<float, float> layer(layer_param);
+  layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+  layer.Forward(blob_bottom_vec_, blob_top_vec_);
+  // The same bottom in NHWC gives the same top in NHWC
+  TBlob<float> bottom_nhwc(blob_bottom_->shape());
+  const int N = blob_bottom_->shape(0), C = blob_bottom_->shape(1);
+  const int HW = blob_bottom_->count(2);
+  for (int n = 0; n < N; ++n) {
+    for (int c = 0; c < C; ++c) {
+      for (int i = 0; i < HW; ++i) {
+        bottom_nhwc.mutable_cpu_data()[(n * HW + i) * C + c] =
+            blob_bottom_->cpu_data()[(n * C + c) * HW + i];
+      }
+    }
+  }
+  bottom_nhwc.set_packing(NHWC);
+  blob_top_onednn_->set_packing(NHWC);
+  vector<Blob*> bottom_nhwc_vec(1, &bottom_nhwc);
+  OneDNNConvolutionLayer<float, float> onednn_layer(layer_param);
+  onednn_layer.blobs() = layer.blobs();
+  onednn_layer.SetUp(bottom_nhwc_vec, blob_top_onednn_vec_);
+  onednn_layer.Forward(bottom_nhwc_vec, blob_top_onednn_vec_);
+  ASSERT_EQ(blob_top_->shape(), blob_top_onednn_->shape());
+  const int K = blob_top_->shape(1), PQ = blob_top_->count(2);
+  for (int n = 0; n < N; ++n) {
+    for (int k = 0; k < K; ++k) {
+      for (int i = 0; i < PQ; ++i) {
+        EXPECT_NEAR(blob_top_->cpu_data()[(n * K + k) * PQ + i],
+            blob_top_onednn_->cpu_data()[(n * PQ + i) * K + k], 1e-4);
+      }
+    }
+  }
+}
+
+TEST_F(OneDNNLayerTest, TestQuantizedConvolution) {
+  LayerParameter layer_param = MakeConvParam();
+  // Inputs are within [-1, 1]
+  layer_param.mutable_quantization_param()->set_input_scale(1.F / Int8Gemm::LEVELS);
+  ConvolutionLayer<float, float> layer(layer_param);
+  OneDNNConvolutionLayer<float, float> onednn_layer(layer_param);
+  Run(&layer, &onednn_layer);
+  // Same INT8 operands, so the same products
+  ExpectClose(1e-3);
+}
+
+TEST_F(OneDNNLayerTest, TestInnerProduct) {
+  LayerParameter layer_param = MakeInnerProductParam();
+  InnerProductLayer<float, float> layer(layer_param);
+  OneDNNInnerProductLayer<float, float> onednn_layer(layer_param);
+  Run(&layer, &onednn_layer);
+  ExpectClose(1e-4);
+}
+
+TEST_F(OneDNNLayerTest, TestQuantizedInnerProduct) {
+  LayerParameter layer_param = MakeInnerProductParam();
+  layer_param.mutable_inner_product_param()->set_transpose(true);
+  layer_param.mutable_quantization_param()->set_input_scale(1.F / Int8Gemm::LEVELS);
+  InnerProductLayer<float, float> layer(layer_param);
+  OneDNNInnerProductLayer<float, float> onednn_layer(layer_param);
+  Run(&layer, &onednn_layer);
+  ExpectClose(1e-3);
+}
+
+TEST_F(OneDNNLayerTest, TestPooling) {
+  for (int pool = 0; pool < 2; ++pool) {
+    LayerParameter layer_param = MakeParam();
+    PoolingParameter* pool_param = layer_param.mutable_pooling_param();
+    pool_param->set_pool(pool == 0 ? PoolingParameter_PoolMethod_MAX :
+        PoolingParameter_PoolMethod_AVE);
+    pool_param->set_kernel_size(3);
+    pool_param->set_stride(2);
+    PoolingLayer<float, float> layer(layer_param);
+    OneDNNPoolingLayer<float, float> onednn_layer(layer_param);
+    Run(&layer, &onednn_layer);
+    ExpectClose(1e-5);
+  }
+}
+
+TEST_F(OneDNNLayerTest, TestBatchNorm) {
+  LayerParameter layer_param = MakeParam();
+  BatchNormParameter* bn_param = layer_param.mutable_batch_norm_param();
+  bn_param->set_use_global_stats(true);
+  bn_param->mutable_scale_filler()->set_type("gaussian");
+  bn_param->mutable_bias_filler()->set_type("gaussian");
+  BatchNormLayer<float, float> layer(layer_param);
+  layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+  FillerParameter filler_param;
+  filler_param.set_min(0.5F);
+  filler_param.set_max(1.5F);
+  UniformFiller<float> filler(filler_param);
+  filler.Fill(layer.blobs()[0].get());
+  filler.Fill(layer.blobs()[1].get());
+  layer.Forward(blob_bottom_vec_, blob_top_vec_);
+  OneDNNBatchNormLayer<float, float> onednn_layer(layer_param);
+  onednn_layer.blobs() = layer.blobs();
+  onednn_layer.SetUp(blob_bottom_vec_, blob_top_onednn_vec_);
+  onednn_layer.Forward(blob_bottom_vec_, blob_top_onednn_vec_);
+  ExpectClose(1e-4);
+}
+
+TEST_F(OneDNNLayerTest, TestLRN) {
+  LayerParameter layer_param = MakeParam();
+  layer_param.mutable_lrn_param()->set_local_size(5);
+  LRNLayer<float, float> layer(layer_param);
+  OneDNNLRNLayer<float, float> onednn_layer(layer_param);
+  Run(&layer, &onednn_layer);
+  ExpectClose(1e-4);
+}
+
+}  // namespace caffe
+#endif  // USE_ONEDNN
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/pointwise_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class PointwiseLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  PointwiseLayerTest()
+      : blob_bottom_(new TBlob<Dtype>(2, 3, 4, 5)),
+        blob_bottom_operand_(new TBlob<Dtype>(2, 3, 4, 5)),
+        blob_top_(new TBlob<Dtype>()) {
+    Caffe::set_random_seed(1701);
+    FillerParameter filler_param;
+    filler_param.set_min(-1);
+    filler_param.set_max(1);
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    filler.Fill(this->blob_bottom_operand_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_operand_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~PointwiseLayerTest() {
+    delete blob_bottom_;
+    delete blob_bottom_operand_;
+    delete blob_top_;
+  }
+
+  // Scale with bias along the channels, then SUM with the operand and ReLU
+  static void ResidualParam(LayerParameter* layer_param) {
+    PointwiseParameter* param = layer_param->mutable_pointwise_param();
+    PointwiseParameter::Op* scale = param->add_op();
+    scale->set_type(PointwiseParameter::Op::SCALE);
+    scale->set_bias_term(true);
+    scale->mutable_filler()->set_type("gaussian");
+    scale->mutable_bias_filler()->set_type("gaussian");
+    PointwiseParameter::Op* sum = param->add_op();
+    sum->set_type(PointwiseParameter::Op::SUM);
+    sum->set_operand(1);
+    sum->set_operand_coeff(0.5);
+    param->add_op()->set_type(PointwiseParameter::Op::RELU);
+  }
+
+  TBlob<Dtype>* const blob_bottom_;
+  TBlob<Dtype>* const blob_bottom_operand_;
+  TBlob<Dtype>* const blob_top_;
+  vector<Blob*> blob_bottom_vec_;
+  vector<Blob*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(PointwiseLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(PointwiseLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->ResidualParam(&layer_param);
+  PointwiseLayer<Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  ASSERT_EQ(2, layer.blobs().size());
+  ASSERT_EQ(vector<int>(1, 3), layer.blobs()[0]->shape());
+  ASSERT_EQ(this->blob_bottom_->shape(), this->blob_top_->shape());
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype* scale = layer.blobs()[0]->template cpu_data<Dtype>();
+  const Dtype* bias = layer.blobs()[1]->template cpu_data<Dtype>();
+  const Dtype* in = this->blob_bottom_->cpu_data();
+  const Dtype* operand = this->blob_bottom_operand_->cpu_data();
+  const Dtype* out = this->blob_top_->cpu_data();
+  const float eps = tol<Dtype>(1e-5, 1e-2);
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    const int c = (i / 20) % 3;
+    const float expected = std::max(0.F, static_cast<float>(in[i]) *
+        static_cast<float>(scale[c]) + static_cast<float>(bias[c]) +
+        0.5F * static_cast<float>(operand[i]));
+    EXPECT_NEAR(expected, static_cast<float>(out[i]), eps * (1.F + std::fabs(expected)));
+  }
+}
+
+TYPED_TEST(PointwiseLayerTest, TestForwardInPlace) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->ResidualParam(&layer_param);
+  Caffe::set_random_seed(1701);
+  PointwiseLayer<Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  TBlob<Dtype> in_place;
+  in_place.CopyFrom(*this->blob_bottom_, false, true);
+  vector<Blob*> bottom{&in_place, this->blob_bottom_operand_};
+  vector<Blob*> top{&in_place};
+  Caffe::set_random_seed(1701);
+  PointwiseLayer<Dtype, Dtype> layer_in_place(layer_param);
+  layer_in_place.SetUp(bottom, top);
+  layer_in_place.Forward(bottom, top);
+  for (int i = 0; i < in_place.count(); ++i) {
+    EXPECT_EQ(this->blob_top_->cpu_data()[i], in_place.cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(PointwiseLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  PointwiseParameter* param = layer_param.mutable_pointwise_param();
+  PointwiseParameter::Op* scale = param->add_op();
+  scale->set_type(PointwiseParameter::Op::SCALE);
+  scale->set_axis(2);
+  scale->set_num_axes(2);
+  scale->mutable_filler()->set_type("gaussian");
+  PointwiseParameter::Op* prod = param->add_op();
+  prod->set_type(PointwiseParameter::Op::PROD);
+  prod->set_operand(1);
+  PointwiseParameter::Op* bias = param->add_op();
+  bias->set_type(PointwiseParameter::Op::BIAS);
+  bias->mutable_filler()->set_type("gaussian");
+  PointwiseParameter::Op* elu = param->add_op();
+  elu->set_type(PointwiseParameter::Op::ELU);
+  elu->set_alpha(0.5);
+  PointwiseParameter::Op* power = param->add_op();
+  power->set_type(PointwiseParameter::Op::POWER);
+  power->set_power(2);
+  power->set_scale(0.5);
+  power->set_shift(1);
+  param->add_op()->set_type(PointwiseParameter::Op::SIGMOID);
+  PointwiseLayer<Dtype, Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(tol<Dtype>(1e-2, 1e-1), tol<Dtype>(1e-3, 5e-2));
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+}
+
+TYPED_TEST(PointwiseLayerTest, TestGradientResidual) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->ResidualParam(&layer_param);
+  // No kinks for the checker
+  layer_param.mutable_pointwise_param()->mutable_op(2)->set_type(
+      PointwiseParameter::Op::TANH);
+  PointwiseLayer<Dtype, Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(tol<Dtype>(1e-2, 1e-1), tol<Dtype>(1e-3, 5e-2));
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+}
+
+}  // namespace caffe
@@ -0,0 +1,80 @@
+#include <boost/filesystem.hpp>
+#include <cstdlib>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/insert_splits.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/proto_cache.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ProtoCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ProtoCache::Clear();
+    MakeTempFilename(&filename_);
+    std::ofstream file(filename_);
+    // V1 layers, upgraded on read
+    file << "name: 'cached' "
+        "input: 'data' input_dim: 1 input_dim: 2 input_dim: 3 input_dim: 3 "
+        "layers { name: 'relu' type: RELU bottom: 'data' top: 'relu' } "
+        "layers { name: 'loss' type: EUCLIDEAN_LOSS bottom: 'relu' bottom: 'data' "
+        "top: 'loss' } ";
+  }
+
+  void TearDown() override {
+    unsetenv("CAFFE_PROTO_CACHE_DIR");
+    ProtoCache::Clear();
+  }
+
+  string filename_;
+};
+
+TEST_F(ProtoCacheTest, TestReadUpgraded) {
+  NetParameter first, second;
+  ReadNetParamsFromTextFileOrDie(filename_, &first);
+  EXPECT_FALSE(NetNeedsUpgrade(first));
+  EXPECT_EQ(3, first.layer_size());
+  ReadNetParamsFromTextFileOrDie(filename_, &second);
+  EXPECT_EQ(first.SerializeAsString(), second.SerializeAsString());
+}
+
+TEST_F(ProtoCacheTest, TestCacheDir) {
+  string dir;
+  MakeTempDir(&dir);
+  setenv("CAFFE_PROTO_CACHE_DIR", dir.c_str(), 1);
+  NetParameter parsed, cached;
+  ReadNetParamsFromTextFileOrDie(filename_, &parsed);
+  int files = 0;
+  for (boost::filesystem::directory_iterator it(dir), end; it != end; ++it) {
+    EXPECT_EQ(".binaryproto", it->path().extension().string());
+    ++files;
+  }
+  EXPECT_EQ(1, files);
+  ProtoCache::Clear();
+  ReadNetParamsFromTextFileOrDie(filename_, &cached);
+  EXPECT_EQ(parsed.SerializeAsString(), cached.SerializeAsString());
+  boost::filesystem::remove_all(dir);
+}
+
+TEST_F(ProtoCacheTest, TestTransform) {
+  NetParameter param, split, again;
+  ReadNetParamsFromTextFileOrDie(filename_, &param);
+  ProtoCache::Transform("InsertSplits", param, &split, InsertSplits);
+  NetParameter expected;
+  InsertSplits(param, &expected);
+  EXPECT_EQ(expected.SerializeAsString(), split.SerializeAsString());
+  EXPECT_EQ(4, split.layer_size());  // 'data' feeds two layers
+  ProtoCache::Transform("InsertSplits", param, &again, InsertSplits);
+  EXPECT_EQ(split.SerializeAsString(), again.SerializeAsString());
+}
+
+}  // namespace caffe
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/inner_product_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/quantization.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+TEST(QuantizationTest, TestKLDivergenceThreshold) {
+  // Exponentially decaying magnitudes, empty past bin 690, and a lone outlier
+  vector<double> hist(2048);
+  for (int i = 0; i < hist.size(); ++i) {
+    hist[i] = std::floor(1000. * std::exp(-i / 100.));
+  }
+  hist[2000] += 1.;
+  const float threshold = kl_divergence_threshold(hist, 0.5F);
+  EXPECT_GT(threshold, 300.F * 0.5F);
+  EXPECT_LT(threshold, 1500.F * 0.5F);
+  // Too few bins to saturate anything
+  EXPECT_FLOAT_EQ(64.F, kl_divergence_threshold(vector<double>(128, 1.), 0.5F));
+}
+
+TEST(QuantizationTest, TestPercentileThreshold) {
+  vector<double> hist(2048, 1.);
+  EXPECT_FLOAT_EQ(1024.F * 0.25F, percentile_threshold(hist, 0.25F, 0.5));
+  EXPECT_FLOAT_EQ(2048.F * 0.25F, percentile_threshold(hist, 0.25F, 1.));
+}
+
+TEST(QuantizationTest, TestInt8GemmCPU) {
+  // K isn't a multiple of 4, so padding is exercised
+  const int M = 3, N = 5, K = 7;
+  TBlob<float> x(vector<int>{M, K}), w(vector<int>{N, K}), bias(vector<int>{N});
+  FillerParameter filler_param;
+  filler_param.set_min(-1.F);
+  filler_param.set_max(1.F);
+  UniformFiller<float> filler(filler_param);
+  filler.Fill(&x);
+  filler.Fill(&w);
+  filler.Fill(&bias);
+  // Transposed copies
+  TBlob<float> xt(vector<int>{K, M}), wt(vector<int>{K, N});
+  for (int k = 0; k < K; ++k) {
+    for (int m = 0; m < M; ++m) {
+      xt.mutable_cpu_data()[k * M + m] = x.cpu_data()[m * K + k];
+    }
+    for (int n = 0; n < N; ++n) {
+      wt.mutable_cpu_data()[k * N + n] = w.cpu_data()[n * K + k];
+    }
+  }
+  vector<float> expected(M * N);
+  caffe_cpu_gemm<float>(CblasNoTrans, CblasTrans, M, N, K, 1.F, x.cpu_data(), w.cpu_data(),
+      0.F, expected.data());
+  Int8Gemm gemm, gemm_t;
+  EXPECT_FALSE(gemm.initialized());
+  gemm.SetWeights(N, K, w.cpu_data(), false, 1.F / Int8Gemm::LEVELS);
+  gemm_t.SetWeights(N, K, wt.cpu_data(), true, 1.F / Int8Gemm::LEVELS);
+  EXPECT_TRUE(gemm.initialized());
+  vector<float> y(M * N), yt(M * N);
+  gemm.Forward_cpu(M, x.cpu_data(), false, bias.cpu_data(), y.data(), false);
+  gemm_t.Forward_cpu(M, xt.cpu_data(), true, bias.cpu_data(), yt.data(), true);
+  for (int m = 0; m < M; ++m) {
+    for (int n = 0; n < N; ++n) {
+      // Each of K products is off by at most about 1/127
+      EXPECT_NEAR(expected[m * N + n] + bias.cpu_data()[n], y[m * N + n], 0.1F);
+      EXPECT_FLOAT_EQ(y[m * N + n], yt[n * M + m]);
+    }
+  }
+}
+
+template <typename TypeParam>
+class QuantizedLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  QuantizedLayerTest()
+      : blob_bottom_(new TBlob<Dtype>(2, 4, 5, 5)), blob_top_(new TBlob<Dtype>()),
+        blob_top_int8_(new TBlob<Dtype>()) {
+    FillerParameter filler_param;
+    filler_param.set_min(-1.F);
+    filler_param.set_max(1.F);
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    blob_top_int8_vec_.push_back(blob_top_int8_);
+  }
+
+  virtual ~QuantizedLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete blob_top_int8_;
+  }
+
+  LayerParameter MakeParam() {
+    LayerParameter layer_param;
+    layer_param.set_phase(TEST);
+    layer_param.set_forward_type(tp<Dtype>());
+    layer_param.set_backward_type(tp<Dtype>());
+    layer_param.set_forward_math(tp<Dtype>());
+    layer_param.set_backward_math(tp<Dtype>());
+    return layer_param;
+  }
+
+  // Relative to the largest output
+  void ExpectClose(float tolerance) {
+    ASSERT_EQ(blob_top_->shape(), blob_top_int8_->shape());
+    float max_abs = 0.F;
+    for (int i = 0; i < blob_top_->count(); ++i) {
+      max_abs = std::max(max_abs, std::fabs(static_cast<float>(blob_top_->cpu_data()[i])));
+    }
+    for (int i = 0; i < blob_top_->count(); ++i) {
+      EXPECT_NEAR(blob_top_->cpu_data()[i], blob_top_int8_->cpu_data()[i],
+          tolerance * max_abs);
+    }
+  }
+
+  TBlob<Dtype>* const blob_bottom_;
+  TBlob<Dtype>* const blob_top_;
+  TBlob<Dtype>* const blob_top_int8_;
+  vector<Blob*> blob_bottom_vec_;
+  vector<Blob*> blob_top_vec_;
+  vector<Blob*> blob_top_int8_vec_;
+};
+
+TYPED_TEST_CASE(QuantizedLayerTest, TestDtypesAndDevicesNoFP16);
+
+TYPED_TEST(QuantizedLayerTest, TestInnerProduct) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param = this->MakeParam();
+  InnerProductParameter* ip_param = layer_param.mutable_inner_product_param();
+  ip_param->set_num_output(10);
+  ip_param->mutable_weight_filler()->set_type("gaussian");
+  ip_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Inputs are within [-1, 1]
+  layer_param.mutable_quantization_param()->set_input_scale(1.F / Int8Gemm::LEVELS);
+  InnerProductLayer<Dtype, Dtype> int8_layer(layer_param);
+  int8_layer.blobs() = layer.blobs();
+  int8_layer.SetUp(this->blob_bottom_vec_, this->blob_top_int8_vec_);
+  int8_layer.Forward(this->blob_bottom_vec_, this->blob_top_int8_vec_);
+  this->ExpectClose(0.05F);
+}
+
+TYPED_TEST(QuantizedLayerTest, TestGroupConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param = this->MakeParam();
+  ConvolutionParameter* conv_param = layer_param.mutable_convolution_param();
+  conv_param->add_kernel_size(3);
+  conv_param->add_pad(1);
+  conv_param->set_num_output(6);
+  conv_param->set_group(2);
+  conv_param->mutable_weight_filler()->set_type("gaussian");
+  conv_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer_param.mutable_quantization_param()->set_input_scale(1.F / Int8Gemm::LEVELS);
+  ConvolutionLayer<Dtype, Dtype> int8_layer(layer_param);
+  int8_layer.blobs() = layer.blobs();
+  int8_layer.SetUp(this->blob_bottom_vec_, this->blob_top_int8_vec_);
+  int8_layer.Forward(this->blob_bottom_vec_, this->blob_top_int8_vec_);
+  this->ExpectClose(0.05F);
+}
+
+}  // namespace caffe
@@ -1,4 +1,5 @@
 #include <cmath>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -7,6 +8,7 @@
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/type.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 
 
 namespace caffe {
@@ -545,4 +547,29 @@ TYPED_TEST(RandomNumberGeneratorTest, TestRngUniformTimesUniformGPU) {
 
 #endif
 
+TEST(PermutedIndexTest, TestBijection) {
+  for (size_t n : {1UL, 2UL, 5UL, 64UL, 1000UL}) {
+    for (uint64_t key = 0ULL; key < 3ULL; ++key) {
+      std::vector<bool> seen(n, false);
+      for (size_t i = 0; i < n; ++i) {
+        const size_t j = permuted_index(i, n, key);
+        ASSERT_LT(j, n);
+        EXPECT_FALSE(seen[j]) << "n " << n << " key " << key << " i " << i;
+        seen[j] = true;
+      }
+    }
+  }
+}
+
+TEST(PermutedIndexTest, TestKeys) {
+  const size_t n = 1000UL;
+  size_t same = 0UL, fixed = 0UL;
+  for (size_t i = 0; i < n; ++i) {
+    same += permuted_index(i, n, 1ULL) == permuted_index(i, n, 2ULL) ? 1UL : 0UL;
+    fixed += permuted_index(i, n, 1ULL) == i ? 1UL : 0UL;
+  }
+  EXPECT_LT(same, n / 10UL);
+  EXPECT_LT(fixed, n / 10UL);
+}
+
 }  // namespace caffe
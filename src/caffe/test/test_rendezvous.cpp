@@ -0,0 +1,65 @@
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/rendezvous.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class RendezvousTest : public ::testing::Test {
+ protected:
+  RendezvousTest()
+      : master_("127.0.0.1:" + std::to_string(29500 + getpid() % 1000)) {}
+
+  // Runs body on every node, each node in its own thread
+  template<typename F>
+  void Run(int nodes, F body) {
+    vector<std::thread> threads;
+    for (int r = 0; r < nodes; ++r) {
+      threads.emplace_back([this, nodes, r, &body]() {
+        Rendezvous rendezvous(nodes, r, master_, 30);
+        body(&rendezvous);
+      });
+    }
+    for (std::thread& t : threads) {
+      t.join();
+    }
+  }
+
+  const std::string master_;
+};
+
+TEST_F(RendezvousTest, TestBroadcast) {
+  Run(3, [](Rendezvous* rendezvous) {
+    int data[2] = {-1, -1};
+    if (rendezvous->node_rank() == 0) {
+      data[0] = 7;
+      data[1] = 11;
+    }
+    rendezvous->Broadcast(data, sizeof(data));
+    EXPECT_EQ(7, data[0]);
+    EXPECT_EQ(11, data[1]);
+  });
+}
+
+TEST_F(RendezvousTest, TestAllReduceSum) {
+  Run(3, [](Rendezvous* rendezvous) {
+    const float r = rendezvous->node_rank();
+    vector<float> data = {r, 2.F * r, 1.F};
+    rendezvous->AllReduceSum(data.data(), data.size());
+    EXPECT_FLOAT_EQ(3.F, data[0]);
+    EXPECT_FLOAT_EQ(6.F, data[1]);
+    EXPECT_FLOAT_EQ(3.F, data[2]);
+    EXPECT_TRUE(rendezvous->AnyTrue(rendezvous->node_rank() == 2));
+    EXPECT_FALSE(rendezvous->AnyTrue(false));
+  });
+}
+
+}  // namespace caffe
@@ -0,0 +1,111 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <google/protobuf/text_format.h>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/inference_engine.hpp"
+#include "caffe/net.hpp"
+#include "caffe/request_batcher.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class RequestBatcherTest : public MultiDeviceTest<TypeParam> {
+ protected:
+  RequestBatcherTest() {
+    const string proto =
+        "name: 'BatcherNet' "
+        "layer { name: 'data' type: 'Input' top: 'data' "
+        "  input_param { shape { dim: 1 dim: 3 } } } "
+        "layer { name: 'ip' type: 'InnerProduct' bottom: 'data' top: 'ip' "
+        "  inner_product_param { num_output: 4 "
+        "    weight_filler { type: 'gaussian' std: 1 } "
+        "    bias_filler { type: 'gaussian' std: 1 } } } ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param_));
+    param_.mutable_state()->set_phase(TEST);
+    reference_.reset(new Net(param_));
+    NetParameter weights;
+    reference_->ToProto(&weights, false);
+    MakeTempFilename(&weights_file_);
+    WriteProtoToBinaryFile(weights, weights_file_);
+  }
+
+  // Random single sample and the reference net's output for it
+  void MakeSample(TBlob<float>* input, TBlob<float>* expected) {
+    input->Reshape(vector<int>{1, 3});
+    FillerParameter filler_param;
+    GaussianFiller<float> filler(filler_param);
+    filler.Fill(input);
+    reference_->input_blobs()[0]->CopyDataFrom(*input);
+    expected->CopyDataFrom(*reference_->Forward()[0], true);
+  }
+
+  NetParameter param_;
+  shared_ptr<Net> reference_;
+  string weights_file_;
+};
+
+TYPED_TEST_CASE(RequestBatcherTest, TestDtypesAndDevicesNoFP16);
+
+TYPED_TEST(RequestBatcherTest, TestScatterBack) {
+  const int kThreads = 6;
+  const int kIters = 4;
+  vector<TBlob<float>> inputs(kThreads), expected(kThreads), outputs(kThreads);
+  for (int t = 0; t < kThreads; ++t) {
+    this->MakeSample(&inputs[t], &expected[t]);
+  }
+  InferenceEngine engine(this->param_, this->weights_file_, 1, -1, {4, 1});
+  EXPECT_EQ((vector<int>{1, 4}), engine.batch_sizes());
+  EXPECT_EQ(2, engine.contexts());
+  EXPECT_EQ((vector<int>{4, 3}), engine.net(1).input_blobs()[0]->shape());
+  RequestBatcher batcher(&engine, 4, 2000);
+  vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (int it = 0; it < kIters; ++it) {
+        batcher.Infer({&inputs[t]}, {&outputs[t]});
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (int t = 0; t < kThreads; ++t) {
+    ASSERT_EQ((vector<int>{1, 4}), outputs[t].shape());
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_NEAR(expected[t].cpu_data()[i], outputs[t].cpu_data()[i], 1e-4);
+    }
+  }
+  const RequestBatcher::Stats stats = batcher.stats();
+  EXPECT_EQ(kThreads * kIters, static_cast<int>(stats.requests));
+  EXPECT_LE(stats.batches, stats.requests);
+  EXPECT_GE(stats.mean_batch, 1.);
+  EXPECT_LE(stats.mean_batch, 4.);
+  EXPECT_GT(stats.p99_latency_us, 0.);
+  EXPECT_LE(stats.p50_latency_us, stats.p99_latency_us);
+}
+
+TYPED_TEST(RequestBatcherTest, TestDeadline) {
+  TBlob<float> input, expected, output;
+  this->MakeSample(&input, &expected);
+  InferenceEngine engine(this->param_, this->weights_file_, 1, -1, {1, 4});
+  RequestBatcher batcher(&engine, 4, 1000);
+  // Alone, it's dispatched once its deadline passes
+  batcher.Infer({&input}, {&output});
+  const RequestBatcher::Stats stats = batcher.stats();
+  EXPECT_EQ(1UL, stats.requests);
+  EXPECT_EQ(1UL, stats.batches);
+  EXPECT_GE(stats.p50_latency_us, 1000.);
+  EXPECT_NEAR(expected.cpu_data()[0], output.cpu_data()[0], 1e-4);
+}
+
+}  // namespace caffe
@@ -0,0 +1,167 @@
+#ifdef USE_CUDNN
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/cudnn_rnn_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class CuDNNRNNLayerTest : public GPUDeviceTest<Dtype> {
+ protected:
+  CuDNNRNNLayerTest()
+      : blob_bottom_(new TBlob<Dtype>(vector<int>{3, 2, 4})),
+        blob_bottom_hx_(new TBlob<Dtype>(vector<int>{1, 2, 5})),
+        blob_bottom_cx_(new TBlob<Dtype>(vector<int>{1, 2, 5})),
+        blob_top_(new TBlob<Dtype>()), blob_top_hy_(new TBlob<Dtype>()),
+        blob_top_cy_(new TBlob<Dtype>()) {
+    Caffe::set_random_seed(1701);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    filler.Fill(blob_bottom_hx_);
+    filler.Fill(blob_bottom_cx_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~CuDNNRNNLayerTest() {
+    delete blob_bottom_;
+    delete blob_bottom_hx_;
+    delete blob_bottom_cx_;
+    delete blob_top_;
+    delete blob_top_hy_;
+    delete blob_top_cy_;
+  }
+
+  LayerParameter MakeParam(RNNParameter_Mode mode) {
+    LayerParameter layer_param;
+    RNNParameter* rnn_param = layer_param.mutable_rnn_param();
+    rnn_param->set_mode(mode);
+    rnn_param->set_num_output(5);
+    rnn_param->mutable_bias_filler()->set_type("gaussian");
+    return layer_param;
+  }
+
+  TBlob<Dtype>* const blob_bottom_;
+  TBlob<Dtype>* const blob_bottom_hx_;
+  TBlob<Dtype>* const blob_bottom_cx_;
+  TBlob<Dtype>* const blob_top_;
+  TBlob<Dtype>* const blob_top_hy_;
+  TBlob<Dtype>* const blob_top_cy_;
+  vector<Blob*> blob_bottom_vec_;
+  vector<Blob*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(CuDNNRNNLayerTest, TestDtypesNoFP16);
+
+TYPED_TEST(CuDNNRNNLayerTest, TestSetUp) {
+  LayerParameter layer_param = this->MakeParam(RNNParameter_Mode_LSTM);
+  layer_param.mutable_rnn_param()->set_num_layers(2);
+  layer_param.mutable_rnn_param()->set_bidirectional(true);
+  CuDNNRNNLayer<TypeParam, TypeParam> layer(layer_param);
+  this->blob_top_vec_.push_back(this->blob_top_hy_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_TRUE(this->blob_top_->shape() == (vector<int>{3, 2, 10}));
+  EXPECT_TRUE(this->blob_top_hy_->shape() == (vector<int>{4, 2, 5}));
+  ASSERT_EQ(1, layer.blobs().size());
+  // 4 gates, input and recurrent matrices and biases; the second layer sees 2 x 5 inputs
+  const int first = 2 * 4 * (5 * 4 + 5 * 5 + 2 * 5);
+  const int second = 2 * 4 * (5 * 10 + 5 * 5 + 2 * 5);
+  EXPECT_EQ(first + second, layer.blobs()[0]->count());
+}
+
+TYPED_TEST(CuDNNRNNLayerTest, TestVariableLength) {
+  // Outputs don't depend on later steps, so a shorter sequence gives a prefix
+  LayerParameter layer_param = this->MakeParam(RNNParameter_Mode_GRU);
+  layer_param.set_phase(TEST);
+  CuDNNRNNLayer<TypeParam, TypeParam> layer(layer_param);
+  this->blob_top_vec_.push_back(this->blob_top_hy_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  TBlob<TypeParam> y3, hy3;
+  y3.CopyFrom(*this->blob_top_, false, true);
+  hy3.CopyFrom(*this->blob_top_hy_, false, true);
+  // The last step's output is the final hidden state
+  const int step = 2 * 5;
+  for (int i = 0; i < step; ++i) {
+    EXPECT_NEAR(y3.cpu_data()[2 * step + i], hy3.cpu_data()[i], 1e-5);
+  }
+  TBlob<TypeParam> x(vector<int>{5, 2, 4});
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(&x);
+  caffe_copy(this->blob_bottom_->count(), this->blob_bottom_->cpu_data(),
+      x.mutable_cpu_data());
+  vector<Blob*> bottom_vec{&x};
+  layer.Reshape(bottom_vec, this->blob_top_vec_);
+  EXPECT_TRUE(this->blob_top_->shape() == (vector<int>{5, 2, 5}));
+  layer.Forward(bottom_vec, this->blob_top_vec_);
+  for (int i = 0; i < y3.count(); ++i) {
+    EXPECT_NEAR(y3.cpu_data()[i], this->blob_top_->cpu_data()[i], 1e-5);
+  }
+}
+
+TYPED_TEST(CuDNNRNNLayerTest, TestInitialState) {
+  // Carrying the state over splits a sequence in two
+  LayerParameter layer_param = this->MakeParam(RNNParameter_Mode_LSTM);
+  layer_param.set_phase(TEST);
+  CuDNNRNNLayer<TypeParam, TypeParam> layer(layer_param);
+  TBlob<TypeParam> x(vector<int>{2, 2, 4}), x1(vector<int>{1, 2, 4}), x2(vector<int>{1, 2, 4});
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(&x);
+  const int step = x1.count();
+  caffe_copy(step, x.cpu_data(), x1.mutable_cpu_data());
+  caffe_copy(step, x.cpu_data() + step, x2.mutable_cpu_data());
+  TBlob<TypeParam> y, y2, hy, cy;
+  const vector<Blob*> top_vec{&y};
+  vector<Blob*> bottom_vec{&x};
+  layer.SetUp(bottom_vec, top_vec);
+  layer.Forward(bottom_vec, top_vec);
+  bottom_vec[0] = &x1;
+  const vector<Blob*> state_top_vec{&y2, &hy, &cy};
+  layer.Reshape(bottom_vec, state_top_vec);
+  layer.Forward(bottom_vec, state_top_vec);
+  const vector<Blob*> state_bottom_vec{&x2, &hy, &cy};
+  layer.Reshape(state_bottom_vec, top_vec);
+  layer.Forward(state_bottom_vec, top_vec);
+  TBlob<TypeParam> y_split;
+  y_split.CopyFrom(y, false, true);
+  bottom_vec[0] = &x;
+  layer.Reshape(bottom_vec, top_vec);
+  layer.Forward(bottom_vec, top_vec);
+  for (int i = 0; i < y_split.count(); ++i) {
+    EXPECT_NEAR(y.cpu_data()[step / 4 * 5 + i], y_split.cpu_data()[i], 1e-5);
+  }
+}
+
+TYPED_TEST(CuDNNRNNLayerTest, TestGradientLSTM) {
+  LayerParameter layer_param = this->MakeParam(RNNParameter_Mode_LSTM);
+  CuDNNRNNLayer<TypeParam, TypeParam> layer(layer_param);
+  this->blob_bottom_vec_.push_back(this->blob_bottom_hx_);
+  this->blob_bottom_vec_.push_back(this->blob_bottom_cx_);
+  this->blob_top_vec_.push_back(this->blob_top_hy_);
+  this->blob_top_vec_.push_back(this->blob_top_cy_);
+  GradientChecker<TypeParam> checker(tol<TypeParam>(1e-2, 1e-2), tol<TypeParam>(1e-3, 1e-2));
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+}
+
+TYPED_TEST(CuDNNRNNLayerTest, TestGradientBidirectionalGRU) {
+  LayerParameter layer_param = this->MakeParam(RNNParameter_Mode_GRU);
+  layer_param.mutable_rnn_param()->set_num_layers(2);
+  layer_param.mutable_rnn_param()->set_bidirectional(true);
+  CuDNNRNNLayer<TypeParam, TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(tol<TypeParam>(1e-2, 1e-2), tol<TypeParam>(1e-3, 1e-2));
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+}
+
+}  // namespace caffe
+#endif  // USE_CUDNN
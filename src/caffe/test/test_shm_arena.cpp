@@ -0,0 +1,72 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/shm_arena.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ShmArenaTest : public ::testing::Test {
+ protected:
+  ShmArenaTest()
+      : name_(ShmArena::segment_name("caffe_shm_arena_test_" +
+            std::to_string(reinterpret_cast<size_t>(this)))) {}
+
+  const std::string name_;
+};
+
+TEST_F(ShmArenaTest, TestSegmentName) {
+  EXPECT_EQ('/', name_[0]);
+  EXPECT_EQ(std::string::npos, name_.find('/', 1));
+  EXPECT_EQ(ShmArena::segment_name("a"), ShmArena::segment_name("a"));
+  EXPECT_NE(ShmArena::segment_name("a"), ShmArena::segment_name("b"));
+}
+
+TEST_F(ShmArenaTest, TestAppendAndAttach) {
+  const vector<std::string> records = {"first", "", "third record", std::string(1000, 'x')};
+  ShmArena owner(name_, 4096UL);
+  EXPECT_TRUE(owner.owner());
+  EXPECT_EQ(ShmArena::BUILDING, owner.state());
+  for (const std::string& r : records) {
+    EXPECT_TRUE(owner.append(r.data(), r.size()));
+  }
+  owner.seal();
+  EXPECT_EQ(ShmArena::READY, owner.state());
+
+  ShmArena client(name_, 0UL);
+  EXPECT_FALSE(client.owner());
+  EXPECT_TRUE(client.wait_ready());
+  ASSERT_EQ(records.size(), client.count());
+  for (size_t i = 0; i < records.size(); ++i) {
+    size_t size = 0UL;
+    const char* data = client.record(i, &size);
+    EXPECT_EQ(records[i], std::string(data, size));
+  }
+  EXPECT_TRUE(owner.wait_ready());
+  EXPECT_EQ(records.size(), owner.count());
+}
+
+TEST_F(ShmArenaTest, TestOutOfCapacity) {
+  ShmArena owner(name_, 64UL);
+  const std::string r(100, 'y');
+  EXPECT_FALSE(owner.append(r.data(), r.size()));
+  EXPECT_EQ(ShmArena::FAILED, owner.state());
+  EXPECT_FALSE(owner.wait_ready());
+}
+
+TEST_F(ShmArenaTest, TestRecreateFailed) {
+  {
+    ShmArena owner(name_, 64UL);
+    owner.fail();
+    // Failed segment is replaced by a new one
+    ShmArena next(name_, 64UL);
+    EXPECT_TRUE(next.owner());
+    EXPECT_EQ(ShmArena::BUILDING, next.state());
+  }
+}
+
+}  // namespace caffe
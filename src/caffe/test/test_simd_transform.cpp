@@ -0,0 +1,74 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/simd_transform.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class SimdTransformTest : public ::testing::Test {
+ protected:
+  SimdTransformTest() : height_(5), width_(37), step_(3 * 40) {
+    // Padded rows like in image regions
+    src_.resize(step_ * height_);
+    for (size_t i = 0; i < src_.size(); ++i) {
+      src_[i] = static_cast<unsigned char>((i * 7919U) % 256U);
+    }
+  }
+
+  void Reference(float scale, const float* mean, bool mirror, vector<float>* dst) const {
+    dst->resize(3 * height_ * width_);
+    for (int c = 0; c < 3; ++c) {
+      for (int h = 0; h < height_; ++h) {
+        for (int w = 0; w < width_; ++w) {
+          const int sw = mirror ? width_ - 1 - w : w;
+          (*dst)[(c * height_ + h) * width_ + w] =
+              static_cast<float>(src_[h * step_ + sw * 3 + c]) * scale - mean[c];
+        }
+      }
+    }
+  }
+
+  void Run(float scale, bool mirror) {
+    const float mean[3] = {104.F * scale, 117.F * scale, 123.F * scale};
+    vector<float> expected, actual(3 * height_ * width_);
+    Reference(scale, mean, mirror, &expected);
+    if (!simd_hwc3_to_chw(src_.data(), step_, height_, width_, scale, mean, mirror,
+        actual.data())) {
+      EXPECT_EQ(std::string("none"), simd_transform_isa());
+      return;
+    }
+    for (size_t i = 0; i < expected.size(); ++i) {
+      EXPECT_NEAR(expected[i], actual[i], 1.e-4F) << i;
+    }
+  }
+
+  const int height_, width_;
+  const size_t step_;
+  vector<unsigned char> src_;
+};
+
+TEST_F(SimdTransformTest, TestConvert) {
+  this->Run(1.F, false);
+}
+
+TEST_F(SimdTransformTest, TestConvertScaled) {
+  this->Run(0.00390625F, false);
+}
+
+TEST_F(SimdTransformTest, TestConvertMirrored) {
+  this->Run(0.5F, true);
+}
+
+TEST_F(SimdTransformTest, TestNoKernelForDouble) {
+  const float mean[3] = {0.F, 0.F, 0.F};
+  vector<double> dst(3 * height_ * width_);
+  EXPECT_FALSE(simd_hwc3_to_chw(src_.data(), step_, height_, width_, 1.F, mean, false,
+      dst.data()));
+}
+
+}  // namespace caffe
@@ -6,6 +6,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/slice_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -173,6 +174,52 @@ TYPED_TEST(SliceLayerTest, TestSliceAcrossChannels) {
   }
 }
 
+TYPED_TEST(SliceLayerTest, TestShareStorage) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_slice_param()->set_axis(0);
+  layer_param.mutable_slice_param()->set_share_storage(true);
+  SliceLayer<Dtype, Dtype> layer(layer_param);
+  vector<Blob*>& top = this->blob_top_vec_0_;
+  layer.SetUp(this->blob_bottom_vec_, top);
+  layer.Forward(this->blob_bottom_vec_, top);
+  // Tops are regions of the bottom now
+  const bool gpu = Caffe::mode() == Caffe::GPU;
+  const int top_count = this->blob_top_0_->count();
+  const char* bottom_data =
+      static_cast<const char*>(this->blob_bottom_->current_data_memory(gpu));
+  EXPECT_EQ(bottom_data, this->blob_top_0_->current_data_memory(gpu));
+  EXPECT_EQ(bottom_data + top_count * sizeof(Dtype),
+      this->blob_top_1_->current_data_memory(gpu));
+  caffe_set(this->blob_bottom_->count(), Dtype(2.), this->blob_bottom_->mutable_cpu_data());
+  layer.Forward(this->blob_bottom_vec_, top);
+  for (int i = 0; i < top_count; ++i) {
+    EXPECT_EQ(2., static_cast<float>(this->blob_top_0_->cpu_data()[i]));
+    EXPECT_EQ(2., static_cast<float>(this->blob_top_1_->cpu_data()[i]));
+  }
+  vector<bool> propagate_down(1, true);
+  for (int pass = 0; pass < 2; ++pass) {
+    caffe_set(top_count, Dtype(static_cast<float>(pass)), this->blob_top_0_->mutable_cpu_diff());
+    caffe_set(top_count, Dtype(3.), this->blob_top_1_->mutable_cpu_diff());
+    layer.Backward(top, propagate_down, this->blob_bottom_vec_);
+    for (int i = 0; i < top_count; ++i) {
+      EXPECT_EQ(pass, static_cast<float>(this->blob_bottom_->cpu_diff()[i]));
+      EXPECT_EQ(3., static_cast<float>(this->blob_bottom_->cpu_diff()[top_count + i]));
+    }
+  }
+  // A new bottom shape gives tops their own memory
+  this->ReduceBottomBlobSize();
+  layer.Reshape(this->blob_bottom_vec_, top);
+  layer.Forward(this->blob_bottom_vec_, top);
+  const int new_count = this->blob_top_0_->count();
+  for (int i = 0; i < new_count; ++i) {
+    EXPECT_EQ(static_cast<float>(this->blob_bottom_->cpu_data()[i]),
+        static_cast<float>(this->blob_top_0_->cpu_data()[i]));
+    EXPECT_EQ(static_cast<float>(this->blob_bottom_->cpu_data()[new_count + i]),
+        static_cast<float>(this->blob_top_1_->cpu_data()[i]));
+  }
+}
+
 TYPED_TEST(SliceLayerTest, TestGradientTrivial) {
   // Test the trivial (single output) "slice" operation --
   // should be the identity.
@@ -0,0 +1,85 @@
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/snapshot_writer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class SnapshotWriterTest : public ::testing::Test {
+ protected:
+  SnapshotWriterTest() {
+    MakeTempDir(&dir_);
+  }
+
+  static bool exists(const std::string& filename) {
+    return std::ifstream(filename.c_str()).good();
+  }
+
+  static void WriteText(SnapshotWriter* writer, const std::string& filename,
+      const std::string& text) {
+    writer->Write(filename, [text](const std::string& path) {
+      std::ofstream file(path.c_str());
+      file << text;
+    });
+  }
+
+  std::string dir_;
+};
+
+TEST_F(SnapshotWriterTest, TestRenamedWhenWritten) {
+  for (bool async : {false, true}) {
+    const std::string filename = dir_ + (async ? "/async" : "/sync");
+    SnapshotWriter writer(async, 0);
+    WriteText(&writer, filename, "weights");
+    writer.Commit();
+    writer.Wait();
+    EXPECT_TRUE(exists(filename));
+    EXPECT_FALSE(exists(filename + ".tmp"));
+    std::ifstream file(filename.c_str());
+    std::string text;
+    file >> text;
+    EXPECT_EQ("weights", text);
+  }
+}
+
+TEST_F(SnapshotWriterTest, TestKeep) {
+  SnapshotWriter writer(true, 2);
+  for (int i = 0; i < 4; ++i) {
+    WriteText(&writer, dir_ + "/model_" + std::to_string(i), "model");
+    WriteText(&writer, dir_ + "/state_" + std::to_string(i), "state");
+    writer.Commit();
+  }
+  writer.Wait();
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(i >= 2, exists(dir_ + "/model_" + std::to_string(i))) << i;
+    EXPECT_EQ(i >= 2, exists(dir_ + "/state_" + std::to_string(i))) << i;
+  }
+}
+
+TEST_F(SnapshotWriterTest, TestHostCopy) {
+  TBlob<float> blob(2, 3, 1, 1);
+  float* data = blob.mutable_cpu_data();
+  float* diff = blob.mutable_cpu_diff();
+  for (int i = 0; i < blob.count(); ++i) {
+    data[i] = i;
+    diff[i] = -i;
+  }
+  shared_ptr<Blob> copy = SnapshotWriter::HostCopy(blob, true);
+  // Later changes don't show in the copy
+  data[0] = 100.F;
+  ASSERT_EQ(blob.shape(), copy->shape());
+  for (int i = 0; i < blob.count(); ++i) {
+    EXPECT_EQ(static_cast<float>(i), copy->cpu_data<float>()[i]);
+    EXPECT_EQ(static_cast<float>(-i), copy->cpu_diff<float>()[i]);
+  }
+}
+
+}  // namespace caffe
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cfloat>
 #include <cmath>
 #include <vector>
 
@@ -93,6 +95,59 @@ TYPED_TEST(SoftmaxLayerTest, TestGradient) {
   checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
 }
 
+// Contiguous rows (inner dimension 1) of lengths taking every warp kernel shape
+TYPED_TEST(SoftmaxLayerTest, TestForwardRows) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int lengths[] = {1, 2, 5, 37, 100, 700};
+  for (int channels : lengths) {
+    this->blob_bottom_->Reshape(vector<int>{9, channels});
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    LayerParameter layer_param;
+    layer_param.set_forward_type(tp<Dtype>());
+    layer_param.set_backward_type(tp<Dtype>());
+    layer_param.set_forward_math(tp<Dtype>());
+    layer_param.set_backward_math(tp<Dtype>());
+    SoftmaxLayer<Dtype, Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    const Dtype* x = this->blob_bottom_->cpu_data();
+    const Dtype* y = this->blob_top_->cpu_data();
+    for (int i = 0; i < 9; ++i) {
+      float m = -FLT_MAX;
+      for (int j = 0; j < channels; ++j) {
+        m = std::max(m, static_cast<float>(x[i * channels + j]));
+      }
+      float scale = 0.F;
+      for (int j = 0; j < channels; ++j) {
+        scale += std::exp(static_cast<float>(x[i * channels + j]) - m);
+      }
+      for (int j = 0; j < channels; ++j) {
+        EXPECT_NEAR(std::exp(static_cast<float>(x[i * channels + j]) - m) / scale,
+            static_cast<float>(y[i * channels + j]), tol<Dtype>(1e-5, 2e-3))
+            << "debug: " << channels << " " << i << " " << j;
+      }
+    }
+  }
+}
+
+TYPED_TEST(SoftmaxLayerTest, TestGradientRows) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(vector<int>{4, 37});
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  layer_param.set_forward_type(tp<Dtype>());
+  layer_param.set_backward_type(tp<Dtype>());
+  layer_param.set_forward_math(tp<Dtype>());
+  layer_param.set_backward_math(tp<Dtype>());
+  SoftmaxLayer<Dtype, Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(tol<Dtype>(1e-2, 1e-1), tol<Dtype>(1e-3, 1e-1));
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_, this->blob_top_vec_);
+}
+
 #ifdef USE_CUDNN
 
 template<typename Dtype>
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <memory>
 #include <vector>
@@ -64,6 +65,46 @@ TYPED_TEST(SoftmaxWithLossLayerTest, TestGradient) {
       this->blob_top_vec_, 0);
 }
 
+// Many classes along a contiguous axis, as in large vocabulary heads
+TYPED_TEST(SoftmaxWithLossLayerTest, TestForwardBackwardManyClasses) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int num = 3, channels = 3000;
+  TBlob<Dtype> data(vector<int>{num, channels}), label(vector<int>{num}), loss;
+  FillerParameter filler_param;
+  filler_param.set_std(3.);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&data);
+  for (int n = 0; n < num; ++n) {
+    label.mutable_cpu_data()[n] = caffe_rng_rand() % channels;
+  }
+  vector<Blob*> bottom{&data, &label}, top{&loss};
+  LayerParameter layer_param;
+  SoftmaxWithLossLayer<Dtype, Dtype> layer(layer_param);
+  layer.SetUp(bottom, top);
+  layer.Forward(bottom, top);
+  loss.mutable_cpu_diff()[0] = Dtype(1.);
+  layer.Backward(top, vector<bool>{true, false}, bottom);
+  double expected_loss = 0.;
+  for (int n = 0; n < num; ++n) {
+    const Dtype* x = data.cpu_data() + n * channels;
+    double m = static_cast<double>(x[0]), sum = 0.;
+    for (int c = 1; c < channels; ++c) {
+      m = std::max(m, static_cast<double>(x[c]));
+    }
+    for (int c = 0; c < channels; ++c) {
+      sum += std::exp(static_cast<double>(x[c]) - m);
+    }
+    const int l = static_cast<int>(label.cpu_data()[n]);
+    expected_loss += m + std::log(sum) - static_cast<double>(x[l]);
+    for (int c = 0; c < channels; ++c) {
+      const double p = std::exp(static_cast<double>(x[c]) - m) / sum;
+      EXPECT_NEAR((p - (c == l ? 1. : 0.)) / num, data.cpu_diff()[n * channels + c],
+          tol<Dtype>(1e-5, 1e-3));
+    }
+  }
+  EXPECT_NEAR(expected_loss / num, loss.cpu_data()[0], tol<Dtype>(1e-4, 5e-2));
+}
+
 TYPED_TEST(SoftmaxWithLossLayerTest, TestForwardIgnoreLabel) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -87,6 +128,36 @@ TYPED_TEST(SoftmaxWithLossLayerTest, TestForwardIgnoreLabel) {
   EXPECT_NEAR(4. * full_loss, accum_loss, tol<Dtype>(1e-4, 1e-1));
 }
 
+// Native INT labels (DataParameter::label_type) give what labels of the data type give
+TYPED_TEST(SoftmaxWithLossLayerTest, TestForwardBackwardIntLabels) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_loss_param()->set_ignore_label(0);
+  SoftmaxWithLossLayer<Dtype, Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  this->blob_top_loss_->mutable_cpu_diff()[0] = Dtype(1.);
+  layer.Backward(this->blob_top_vec_, vector<bool>{true, false}, this->blob_bottom_vec_);
+  const float loss = this->blob_top_loss_->cpu_data()[0];
+  TBlob<Dtype> diff;
+  diff.CopyFrom(*this->blob_bottom_data_, true, true);
+
+  TBlob<int> int_label(this->blob_bottom_label_->shape());
+  for (int i = 0; i < int_label.count(); ++i) {
+    int_label.mutable_cpu_data()[i] = static_cast<int>(this->blob_bottom_label_->cpu_data()[i]);
+  }
+  vector<Blob*> bottom{this->blob_bottom_data_, &int_label};
+  layer.Forward(bottom, this->blob_top_vec_);
+  this->blob_top_loss_->mutable_cpu_diff()[0] = Dtype(1.);
+  layer.Backward(this->blob_top_vec_, vector<bool>{true, false}, bottom);
+  EXPECT_EQ(INT, int_label.data_type());
+  EXPECT_NEAR(loss, this->blob_top_loss_->cpu_data()[0], tol<Dtype>(1e-6, 1e-3));
+  for (int i = 0; i < diff.count(); ++i) {
+    EXPECT_NEAR(diff.cpu_diff()[i], this->blob_bottom_data_->cpu_diff()[i],
+        tol<Dtype>(1e-6, 1e-3));
+  }
+}
+
 TYPED_TEST(SoftmaxWithLossLayerTest, TestGradientIgnoreLabel) {
   typedef typename TypeParam::Dtype Dtype;
   if (!is_precise<Dtype>()) {
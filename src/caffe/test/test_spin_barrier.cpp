@@ -0,0 +1,69 @@
+#include <boost/thread.hpp>
+#include <atomic>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/spin_barrier.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class SpinBarrierTest : public ::testing::Test {};
+
+TEST_F(SpinBarrierTest, TestRounds) {
+  const int threads_num = 4, rounds = 2000;
+  SpinBarrier barrier(threads_num);
+  std::atomic<int> arrived(0);
+  std::atomic<bool> overtaken(false);
+  boost::thread_group threads;
+  for (int t = 0; t < threads_num; ++t) {
+    threads.create_thread([&, t]() {
+      for (int r = 0; r < rounds; ++r) {
+        ++arrived;
+        barrier.wait(t);
+        // Everybody has arrived at this round and nobody at the next one yet
+        const int a = arrived.load();
+        if (a != (r + 1) * threads_num) {
+          overtaken = true;
+        }
+        barrier.wait(t);
+      }
+    });
+  }
+  threads.join_all();
+  EXPECT_FALSE(overtaken.load());
+  uint64_t waits = 0UL, last = 0UL;
+  for (size_t i = 0UL; i < SpinBarrier::BUCKETS; ++i) {
+    waits += barrier.histogram(i);
+  }
+  for (int t = 0; t < threads_num; ++t) {
+    last += barrier.last_arrivals(t);
+  }
+  EXPECT_EQ(2UL * rounds * threads_num, waits);
+  EXPECT_EQ(2UL * rounds, last);
+  EXPECT_FALSE(barrier.report().empty());
+}
+
+TEST_F(SpinBarrierTest, TestParkedStraggler) {
+  SpinBarrier barrier(2U);
+  boost::thread waiter([&barrier]() { barrier.wait(0); });
+  // Long enough for the waiter to run out of spins
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+  barrier.wait(1);
+  waiter.join();
+  EXPECT_EQ(1UL, barrier.parks());
+  EXPECT_EQ(0UL, barrier.last_arrivals(0));
+  EXPECT_EQ(1UL, barrier.last_arrivals(1));
+  // The waiter's 100 ms went to the 2^17 us bucket or above, the other one waited none
+  uint64_t long_waits = 0UL;
+  for (size_t i = 17UL; i < SpinBarrier::BUCKETS; ++i) {
+    long_waits += barrier.histogram(i);
+  }
+  EXPECT_EQ(1UL, long_waits);
+  EXPECT_EQ(1UL, barrier.histogram(0));
+}
+
+}  // namespace caffe
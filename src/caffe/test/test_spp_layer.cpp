@@ -18,7 +18,7 @@
 namespace caffe {
 
 template<typename TypeParam>
-class SPPLayerTest : public CPUDeviceTest<TypeParam> {
+class SPPLayerTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
 
  protected:
@@ -55,7 +55,7 @@ class SPPLayerTest : public CPUDeviceTest<TypeParam> {
   vector<Blob*> blob_top_vec_;
 };
 
-TYPED_TEST_CASE(SPPLayerTest, TestDtypesAndCPUOnly);
+TYPED_TEST_CASE(SPPLayerTest, TestDtypesAndDevicesNoFP16);
 
 TYPED_TEST(SPPLayerTest, TestSetup) {
   typedef typename TypeParam::Dtype Dtype;
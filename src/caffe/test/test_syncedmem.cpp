@@ -120,6 +120,34 @@ TEST_F(SyncedMemoryTest, TestGPUWrite) {
   EXPECT_EQ(mem.head(), SyncedMemory::SYNCED);
 }
 
+TEST_F(SyncedMemoryTest, TestReleaseHostMirror) {
+  const size_t host_before = SyncedMemory::total_host_memory_use();
+  SyncedMemory::set_release_host_mirrors(true);
+  SyncedMemory mem(10);
+  void* gpu_data = mem.mutable_gpu_data();
+  // No host mirror until the first CPU access
+  EXPECT_EQ(mem.host_memory_use(), 0UL);
+  EXPECT_EQ(SyncedMemory::total_host_memory_use(), host_before);
+  caffe_gpu_memset(mem.size(), 3, gpu_data);
+  const void* cpu_data = mem.cpu_data();
+  for (int i = 0; i < mem.size(); ++i) {
+    EXPECT_EQ((static_cast<const char*>(cpu_data))[i], 3);
+  }
+  EXPECT_EQ(mem.host_memory_use(), 10UL);
+  EXPECT_EQ(SyncedMemory::total_host_memory_use(), host_before + 10UL);
+  // GPU only again: the stale mirror goes back to the pool
+  gpu_data = mem.mutable_gpu_data();
+  EXPECT_EQ(mem.head(), SyncedMemory::HEAD_AT_GPU);
+  EXPECT_EQ(mem.host_memory_use(), 0UL);
+  EXPECT_EQ(SyncedMemory::total_host_memory_use(), host_before);
+  caffe_gpu_memset(mem.size(), 4, gpu_data);
+  cpu_data = mem.cpu_data();
+  for (int i = 0; i < mem.size(); ++i) {
+    EXPECT_EQ((static_cast<const char*>(cpu_data))[i], 4);
+  }
+  SyncedMemory::set_release_host_mirrors(false);
+}
+
 #endif
 
 }  // namespace caffe
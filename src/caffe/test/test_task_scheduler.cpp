@@ -0,0 +1,83 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/task_scheduler.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class TaskSchedulerTest : public ::testing::Test {};
+
+TEST_F(TaskSchedulerTest, TestGroupRunsAll) {
+  std::atomic<int> done(0);
+  TaskGroup group(4, TaskScheduler::NORMAL);
+  for (int i = 0; i < 1000; ++i) {
+    group.Submit([&done]() { done.fetch_add(1); });
+  }
+  group.Wait();
+  EXPECT_EQ(1000, done.load());
+}
+
+TEST_F(TaskSchedulerTest, TestGroupLimit) {
+  std::atomic<int> running(0), most(0);
+  {
+    TaskGroup group(2, TaskScheduler::HIGH);
+    for (int i = 0; i < 64; ++i) {
+      group.Submit([&running, &most]() {
+        const int now = running.fetch_add(1) + 1;
+        int seen = most.load();
+        while (now > seen && !most.compare_exchange_weak(seen, now)) {}
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        running.fetch_sub(1);
+      });
+    }
+  }  // waits
+  EXPECT_EQ(0, running.load());
+  EXPECT_LE(most.load(), 2);
+}
+
+TEST_F(TaskSchedulerTest, TestLimitOneKeepsOrder) {
+  std::mutex mutex;
+  vector<int> order;
+  TaskGroup group(1, TaskScheduler::LOW);
+  for (int i = 0; i < 100; ++i) {
+    group.Submit([&mutex, &order, i]() {
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(i);
+    });
+  }
+  group.Wait();
+  ASSERT_EQ(100, order.size());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(i, order[i]);
+  }
+}
+
+TEST_F(TaskSchedulerTest, TestNestedWait) {
+  // Every outer task waits on a group of its own from a worker thread
+  const int outer = 2 * TaskScheduler::num_threads();
+  std::atomic<int> done(0);
+  TaskGroup group(outer, TaskScheduler::NORMAL);
+  for (int i = 0; i < outer; ++i) {
+    group.Submit([&done]() {
+      EXPECT_TRUE(TaskScheduler::on_worker());
+      TaskGroup inner(2, TaskScheduler::NORMAL);
+      for (int j = 0; j < 10; ++j) {
+        inner.Submit([&done]() { done.fetch_add(1); });
+      }
+      inner.Wait();
+    });
+  }
+  group.Wait();
+  EXPECT_EQ(10 * outer, done.load());
+  EXPECT_FALSE(TaskScheduler::on_worker());
+}
+
+}  // namespace caffe
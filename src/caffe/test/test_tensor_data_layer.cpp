@@ -0,0 +1,93 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layers/tensor_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/tensor_file.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class TensorDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  TensorDataLayerTest()
+      : blob_top_data_(new TBlob<Dtype>()),
+        blob_top_label_(new TBlob<Dtype>()) {}
+  virtual void SetUp() {
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+    // 5 records of 2 x 3 half floats, value j of record r is 10 * r + j
+    MakeTempFilename(&filename_);
+    LOG(INFO) << "Using temporary file " << filename_;
+    TensorFileWriter writer(filename_, FLOAT16, vector<int>{2, 3});
+    for (int r = 0; r < 5; ++r) {
+      vector<float16> record(6);
+      for (int j = 0; j < 6; ++j) {
+        record[j] = static_cast<float16>(10 * r + j);
+      }
+      writer.Add(record.data(), 100 + r);
+    }
+  }
+
+  virtual ~TensorDataLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_label_;
+  }
+
+  string filename_;
+  TBlob<Dtype>* const blob_top_data_;
+  TBlob<Dtype>* const blob_top_label_;
+  vector<Blob*> blob_bottom_vec_;
+  vector<Blob*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(TensorDataLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(TensorDataLayerTest, TestTensorFile) {
+  EXPECT_TRUE(TensorFile::Is(this->filename_));
+  TensorFile file(this->filename_);
+  EXPECT_EQ(FLOAT16, file.type());
+  EXPECT_EQ(5UL, file.records());
+  EXPECT_EQ((vector<int>{2, 3}), file.record_shape());
+  EXPECT_EQ(6UL * sizeof(float16), file.record_bytes());
+  EXPECT_EQ(103, file.label(3));
+  vector<float16> records(12);
+  file.Read(3UL, 2UL, records.data());
+  for (int j = 0; j < 12; ++j) {
+    EXPECT_EQ(30 + j / 6 * 10 + j % 6, static_cast<float>(records[j]));
+  }
+}
+
+TYPED_TEST(TensorDataLayerTest, TestRead) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  TensorDataParameter* tensor_data_param = param.mutable_tensor_data_param();
+  tensor_data_param->set_batch_size(2);
+  tensor_data_param->set_source(this->filename_.c_str());
+  TensorDataLayer<Dtype, Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ((vector<int>{2, 2, 3}), this->blob_top_data_->shape());
+  EXPECT_EQ(2, this->blob_top_label_->num());
+  // Batches of consecutive records, the third one goes on from the start of the file
+  for (int iter = 0; iter < 4; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < 2; ++i) {
+      const int r = (2 * iter + i) % 5;
+      EXPECT_EQ(100 + r, static_cast<int>(this->blob_top_label_->cpu_data()[i]));
+      for (int j = 0; j < 6; ++j) {
+        EXPECT_EQ(10 * r + j, static_cast<float>(this->blob_top_data_->cpu_data()[i * 6 + j]));
+      }
+    }
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,54 @@
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/thread_profile.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+TEST(ThreadProfileTest, TestScopeRestoresState) {
+  EXPECT_EQ(nullptr, ThreadProfile::current());
+  {
+    // No profile attached, nothing to record
+    ThreadProfile::Scope scope(ThreadProfile::DECODE);
+  }
+  ThreadProfile profile("test");
+  profile.attach();
+  EXPECT_EQ(&profile, ThreadProfile::current());
+  {
+    ThreadProfile::Scope decode(ThreadProfile::DECODE);
+    {
+      ThreadProfile::Scope blocked(ThreadProfile::BLOCKED);
+      EXPECT_EQ(ThreadProfile::BLOCKED, profile.enter(ThreadProfile::BLOCKED));
+    }
+    EXPECT_EQ(ThreadProfile::DECODE, profile.enter(ThreadProfile::DECODE));
+  }
+  EXPECT_EQ(ThreadProfile::IDLE, profile.enter(ThreadProfile::IDLE));
+}
+
+TEST(ThreadProfileTest, TestSummary) {
+  std::thread worker([]() {
+    ThreadProfile profile("summary worker");
+    profile.attach();
+    ThreadProfile::Scope parse(ThreadProfile::PARSE);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const std::string summary = ThreadProfile::Summary();
+    const size_t line = summary.find("\n  summary worker: ");
+    ASSERT_NE(std::string::npos, line);
+    // The open interval counts, parsing dominates
+    const size_t parse_pos = summary.find("parse ", line);
+    ASSERT_NE(std::string::npos, parse_pos);
+    EXPECT_GT(std::stod(summary.substr(parse_pos + 6)), 50.);
+    EXPECT_NE(std::string::npos, summary.find("total thread seconds:"));
+  });
+  worker.join();
+  // Unregistered once gone
+  EXPECT_EQ(std::string::npos, ThreadProfile::Summary().find("summary worker"));
+}
+
+}  // namespace caffe
@@ -0,0 +1,156 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/sparse_2_4.hpp"
+#include "caffe/util/weight_file.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+TEST(WeightFileTest, TestWriteAndMap) {
+  string filename;
+  MakeTempFilename(&filename);
+  TBlob<float> a(vector<int>{2, 3, 4}), empty(vector<int>{0});
+  TBlob<double> b(vector<int>{5});
+  FillerParameter filler_param;
+  GaussianFiller<float>(filler_param).Fill(&a);
+  GaussianFiller<double>(filler_param).Fill(&b);
+  {
+    WeightFileWriter writer(filename);
+    writer.Add("a", 0, a);
+    writer.Add("a", 1, empty);
+    writer.Add("b", 0, b);
+  }
+  EXPECT_TRUE(WeightFile::Is(filename));
+  WeightFile file(filename);
+  ASSERT_EQ(3, file.index().tensor_size());
+  const WeightIndex::Tensor& ta = file.index().tensor(0);
+  EXPECT_EQ("a", ta.layer());
+  EXPECT_EQ(FLOAT, ta.type());
+  EXPECT_EQ(3, ta.shape().dim_size());
+  EXPECT_EQ(0UL, ta.offset() % (1UL << WeightFile::ALIGNMENT_POWER));
+  const float* da = static_cast<const float*>(file.data(ta));
+  for (int i = 0; i < a.count(); ++i) {
+    EXPECT_EQ(a.cpu_data()[i], da[i]);
+  }
+  EXPECT_EQ(1, file.index().tensor(1).blob_id());
+  EXPECT_EQ(0UL, file.index().tensor(1).bytes());
+  const WeightIndex::Tensor& tb = file.index().tensor(2);
+  EXPECT_EQ(DOUBLE, tb.type());
+  EXPECT_EQ(0UL, tb.offset() % (1UL << WeightFile::ALIGNMENT_POWER));
+  const double* db = static_cast<const double*>(file.data(tb));
+  for (int i = 0; i < b.count(); ++i) {
+    EXPECT_EQ(b.cpu_data()[i], db[i]);
+  }
+  // A caffemodel isn't one
+  NetParameter param;
+  string proto_filename;
+  MakeTempFilename(&proto_filename);
+  WriteProtoToBinaryFile(param, proto_filename);
+  EXPECT_FALSE(WeightFile::Is(proto_filename));
+}
+
+TEST(WeightFileTest, TestSparse24) {
+  string filename;
+  MakeTempFilename(&filename);
+  TBlob<float> a(vector<int>{3, 8});
+  FillerParameter filler_param;
+  GaussianFiller<float>(filler_param).Fill(&a);
+  float* w = a.mutable_cpu_data();
+  w[0] = 1.F, w[1] = -4.F, w[2] = 3.F, w[3] = 2.F;
+  // Fewer than 2 non-zero values
+  w[4] = 0.F, w[5] = 0.F, w[6] = 0.F, w[7] = 5.F;
+  vector<unsigned int> mask(sparse_2_4_mask_words(a.count()));
+  sparse_2_4_mask_cpu(a.count(), w, mask.data());
+  EXPECT_EQ(0x6U, mask[0] & 0xFU);
+  sparse_2_4_apply_cpu(a.count(), mask.data(), w);
+  EXPECT_EQ(0.F, w[0]);
+  EXPECT_EQ(-4.F, w[1]);
+  EXPECT_EQ(3.F, w[2]);
+  EXPECT_EQ(0.F, w[3]);
+  TBlob<float> dense(vector<int>{3, 8});
+  GaussianFiller<float>(filler_param).Fill(&dense);
+  {
+    WeightFileWriter writer(filename, true);
+    writer.Add("a", 0, a);
+    writer.Add("a", 1, dense);
+  }
+  WeightFile file(filename);
+  const WeightIndex::Tensor& ta = file.index().tensor(0);
+  EXPECT_TRUE(ta.sparse_2_4());
+  EXPECT_EQ(12UL * sizeof(float) + 6UL, ta.bytes());
+  EXPECT_TRUE(file.Verify(ta));
+  vector<float> values(a.count());
+  file.Read(ta, values.data());
+  for (int i = 0; i < a.count(); ++i) {
+    EXPECT_EQ(a.cpu_data()[i], values[i]);
+  }
+  EXPECT_FALSE(file.index().tensor(1).sparse_2_4());
+  file.Read(file.index().tensor(1), values.data());
+  for (int i = 0; i < dense.count(); ++i) {
+    EXPECT_EQ(dense.cpu_data()[i], values[i]);
+  }
+}
+
+template <typename TypeParam>
+class WeightFileNetTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  shared_ptr<Net> MakeNet(int seed) {
+    Caffe::set_random_seed(seed);
+    const string proto =
+        "name: 'WeightFileTestNetwork' "
+        "layer { name: 'data' type: 'DummyData' top: 'data' "
+        "  dummy_data_param { shape { dim: 2 dim: 3 dim: 4 dim: 4 } } } "
+        "layer { name: 'conv' type: 'Convolution' bottom: 'data' top: 'conv' "
+        "  convolution_param { num_output: 4 kernel_size: 3 "
+        "    weight_filler { type: 'gaussian' } bias_filler { type: 'gaussian' } } } "
+        "layer { name: 'ip' type: 'InnerProduct' bottom: 'conv' top: 'ip' "
+        "  inner_product_param { num_output: 10 "
+        "    weight_filler { type: 'gaussian' } bias_filler { type: 'gaussian' } } } ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    param.set_default_forward_type(tp<Dtype>());
+    param.set_default_backward_type(tp<Dtype>());
+    param.set_default_forward_math(tp<Dtype>());
+    param.set_default_backward_math(tp<Dtype>());
+    return shared_ptr<Net>(new Net(param));
+  }
+};
+
+TYPED_TEST_CASE(WeightFileNetTest, TestDtypesAndDevices);
+
+TYPED_TEST(WeightFileNetTest, TestCopyTrainedLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  shared_ptr<Net> source = this->MakeNet(1701);
+  shared_ptr<Net> target = this->MakeNet(1702);
+  string filename;
+  MakeTempFilename(&filename);
+  source->ToWeightFile(filename);
+  target->CopyTrainedLayersFrom(filename);
+  for (int i = 0; i < source->layers().size(); ++i) {
+    const vector<shared_ptr<Blob>>& expected = source->layers()[i]->blobs();
+    const vector<shared_ptr<Blob>>& actual = target->layers()[i]->blobs();
+    ASSERT_EQ(expected.size(), actual.size());
+    for (int j = 0; j < expected.size(); ++j) {
+      ASSERT_EQ(expected[j]->shape(), actual[j]->shape());
+      const Dtype* e = expected[j]->cpu_data<Dtype>();
+      const Dtype* a = actual[j]->cpu_data<Dtype>();
+      for (int k = 0; k < expected[j]->count(); ++k) {
+        EXPECT_EQ(static_cast<float>(e[k]), static_cast<float>(a[k]));
+      }
+    }
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,130 @@
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layers/window_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/image_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class WindowDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  WindowDataLayerTest()
+      : blob_top_data_(new TBlob<Dtype>()),
+        blob_top_label_(new TBlob<Dtype>()) {}
+  virtual void SetUp() {
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+    // Two images with foreground windows of classes 1 and 2, and background ones
+    MakeTempFilename(&filename_);
+    std::ofstream outfile(filename_.c_str(), std::ofstream::out);
+    outfile << "# 0\n" EXAMPLES_SOURCE_DIR "images/cat.jpg\n3 360 480\n3\n"
+            << "1 0.9 10 20 200 300\n"
+            << "2 0.8 100 50 470 350\n"
+            << "0 0.1 0 0 50 50\n";
+    outfile << "# 1\n" EXAMPLES_SOURCE_DIR "images/fish-bike.jpg\n3 323 481\n2\n"
+            << "1 0.7 5 5 400 300\n"
+            << "0 0.2 300 10 480 100\n";
+    outfile.close();
+  }
+
+  virtual ~WindowDataLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_label_;
+  }
+
+  void MakeParam(LayerParameter* param, bool cache) const {
+    WindowDataParameter* window_param = param->mutable_window_data_param();
+    window_param->set_source(filename_);
+    window_param->set_batch_size(8);
+    window_param->set_fg_fraction(0.5);
+    window_param->set_context_pad(4);
+    window_param->set_cache_images(cache);
+    param->mutable_transform_param()->set_crop_size(32);
+    param->mutable_transform_param()->set_mirror(true);
+    param->mutable_transform_param()->add_mean_value(100.);
+  }
+
+  // Data and labels of the first batches
+  vector<Dtype> Read(bool cache, int batches) {
+    LayerParameter param;
+    MakeParam(&param, cache);
+    Caffe::set_random_seed(1701);
+    WindowDataLayer<Dtype, Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    vector<Dtype> values;
+    for (int b = 0; b < batches; ++b) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      values.insert(values.end(), blob_top_label_->cpu_data(),
+          blob_top_label_->cpu_data() + blob_top_label_->count());
+      values.insert(values.end(), blob_top_data_->cpu_data(),
+          blob_top_data_->cpu_data() + blob_top_data_->count());
+    }
+    return values;
+  }
+
+  string filename_;
+  TBlob<Dtype>* const blob_top_data_;
+  TBlob<Dtype>* const blob_top_label_;
+  vector<Blob*> blob_bottom_vec_;
+  vector<Blob*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(WindowDataLayerTest, TestDtypesAndDevicesNoFP16);
+
+TYPED_TEST(WindowDataLayerTest, TestRead) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  this->MakeParam(&param, false);
+  WindowDataLayer<Dtype, Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(8, this->blob_top_data_->num());
+  EXPECT_EQ(3, this->blob_top_data_->channels());
+  EXPECT_EQ(32, this->blob_top_data_->height());
+  EXPECT_EQ(32, this->blob_top_data_->width());
+  EXPECT_EQ(8, this->blob_top_label_->count());
+  for (int iter = 0; iter < 3; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    // Background first, then foreground
+    for (int i = 0; i < 8; ++i) {
+      const int label = static_cast<int>(this->blob_top_label_->cpu_data()[i]);
+      if (i < 4) {
+        EXPECT_EQ(0, label);
+      } else {
+        EXPECT_TRUE(label == 1 || label == 2) << label;
+      }
+    }
+    for (int i = 0; i < this->blob_top_data_->count(); ++i) {
+      EXPECT_GE(this->blob_top_data_->cpu_data()[i], -100.);
+      EXPECT_LE(this->blob_top_data_->cpu_data()[i], 155.);
+    }
+  }
+}
+
+TYPED_TEST(WindowDataLayerTest, TestDeterministicAndCached) {
+  typedef typename TypeParam::Dtype Dtype;
+  ImageCache::instance().clear();
+  const vector<Dtype> first = this->Read(false, 3);
+  const vector<Dtype> again = this->Read(false, 3);
+  const vector<Dtype> cached = this->Read(true, 3);
+  ASSERT_EQ(first.size(), again.size());
+  ASSERT_EQ(first.size(), cached.size());
+  for (int i = 0; i < first.size(); ++i) {
+    EXPECT_EQ(first[i], again[i]);
+    EXPECT_EQ(first[i], cached[i]);
+  }
+  EXPECT_GT(ImageCache::instance().bytes(), 0);
+  ImageCache::instance().clear();
+}
+
+}  // namespace caffe
@@ -0,0 +1,110 @@
+#ifndef CPU_ONLY
+
+#include <cstring>
+#include <string>
+
+#include "caffe/util/blob_monitor.hpp"
+
+namespace caffe {
+
+BlobMonitor::BlobMonitor(const BlobMonitorParameter& param)
+    : param_(param),
+      host_buffer_(nullptr),
+      host_buffer_size_(0UL),
+      pending_(false),
+      device_(Caffe::current_device()),
+      ticks_(0U),
+      pending_tick_(0U),
+      samples_(0),
+      alerts_(0) {
+  CUDA_CHECK(cudaEventCreateWithFlags(&done_, cudaEventDisableTiming));
+}
+
+BlobMonitor::~BlobMonitor() {
+  if (pending_) {
+    cudaEventSynchronize(done_);
+  }
+  cudaEventDestroy(done_);
+  if (host_buffer_ != nullptr) {
+    cudaFreeHost(host_buffer_);
+  }
+}
+
+void BlobMonitor::Add(const std::string& name, const Blob* blob, bool diff) {
+  CHECK(!pending_) << "Blobs are added before monitoring starts";
+  entries_.push_back(Entry{name, blob, diff});
+  stats_.push_back(BlobStats{0.F, 0.F, 0U});
+}
+
+void BlobMonitor::Tick(cudaStream_t stream) {
+  const unsigned int tick = ticks_++;
+  if (pending_) {
+    cudaError_t status = cudaEventQuery(done_);
+    if (status != cudaErrorNotReady) {
+      CUDA_CHECK(status);
+      Check();
+    }
+  }
+  if (param_.interval() == 0U || entries_.empty() || tick % param_.interval() != 0U) {
+    return;
+  }
+  // The host buffer is reused
+  Flush();
+  Launch(stream);
+  pending_ = true;
+  pending_tick_ = tick;
+}
+
+void BlobMonitor::Flush() {
+  if (pending_) {
+    CUDA_CHECK(cudaEventSynchronize(done_));
+    Check();
+  }
+}
+
+void BlobMonitor::Check() {
+  pending_ = false;
+  ++samples_;
+  const size_t tensors_size = align_up<4>(sizeof(BlobMonitorTensor) * entries_.size());
+  const BlobMonitorSlot* slots = reinterpret_cast<const BlobMonitorSlot*>(
+      static_cast<const char*>(host_buffer_) + tensors_size);
+  for (int i = 0; i < entries_.size(); ++i) {
+    const Entry& e = entries_[i];
+    const int count = e.blob->count();
+    BlobStats& s = stats_[i];
+    float max_abs;
+    std::memcpy(&max_abs, &slots[i].max_abs_bits, sizeof(max_abs));
+    s.abs_mean = count > 0 ? slots[i].sum_abs / count : 0.F;
+    s.max_abs = max_abs;
+    s.nonfinite = slots[i].nonfinite;
+    LOG_IF(INFO, param_.log_stats() && Caffe::root_solver())
+        << "[Monitor] Tick " << pending_tick_ << ", " << (e.diff ? "diff" : "data")
+        << " of " << e.name << ", count: " << count << ", abs mean: " << s.abs_mean
+        << ", max abs: " << s.max_abs << ", NaN/Inf: " << s.nonfinite;
+
+    std::string alert;
+    if (param_.alert_on_nonfinite() && s.nonfinite > 0U) {
+      alert = std::to_string(s.nonfinite) + " NaN/Inf values";
+    } else if (param_.max_abs_mean() > 0.F && s.abs_mean > param_.max_abs_mean()) {
+      alert = "abs mean " + std::to_string(s.abs_mean) + " over "
+          + std::to_string(param_.max_abs_mean());
+    } else if (param_.max_abs() > 0.F && s.max_abs > param_.max_abs()) {
+      alert = "max abs " + std::to_string(s.max_abs) + " over "
+          + std::to_string(param_.max_abs());
+    }
+    if (alert.empty()) {
+      continue;
+    }
+    ++alerts_;
+    if (param_.fatal()) {
+      LOG(FATAL) << "[Monitor] Tick " << pending_tick_ << ", " << (e.diff ? "diff" : "data")
+          << " of " << e.name << ": " << alert;
+    }
+    LOG(WARNING) << "[Monitor] Tick " << pending_tick_ << ", " << (e.diff ? "diff" : "data")
+        << " of " << e.name << ": " << alert;
+  }
+}
+
+}  // namespace caffe
+
+#endif  // CPU_ONLY
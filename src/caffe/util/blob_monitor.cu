@@ -0,0 +1,106 @@
+#include <algorithm>
+
+#include "caffe/common.hpp"
+#include "caffe/util/blob_monitor.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
+
+namespace caffe {
+
+// Resident blocks per multiprocessor the grid of one tensor is sized for
+#define BLOB_MONITOR_BLOCKS_PER_SM 2
+
+template<typename T>
+__device__ __forceinline__ float blob_monitor_load(const void* ptr, int i) {
+  return mt_load<float>(static_cast<const typename MultiTensorType<T>::type*>(ptr)[i]);
+}
+
+// blockIdx.y is the tensor, its blocks stride over it and add their block's partial
+// results to its slot
+__global__ void BlobMonitorKernel(const BlobMonitorTensor* tensors, BlobMonitorSlot* slots) {
+  __shared__ float sum_abs[CAFFE_CUDA_NUM_THREADS];
+  __shared__ float max_abs[CAFFE_CUDA_NUM_THREADS];
+  __shared__ unsigned int nonfinite[CAFFE_CUDA_NUM_THREADS];
+  const BlobMonitorTensor t = tensors[blockIdx.y];
+  const int tid = threadIdx.x;
+  float s = 0.F, m = 0.F;
+  unsigned int nf = 0U;
+  for (int i = blockIdx.x * blockDim.x + tid; i < t.count; i += blockDim.x * gridDim.x) {
+    float v;
+    if (t.type == FLOAT16) {
+      v = blob_monitor_load<float16>(t.ptr, i);
+    } else if (t.type == DOUBLE) {
+      v = blob_monitor_load<double>(t.ptr, i);
+    } else {
+      v = blob_monitor_load<float>(t.ptr, i);
+    }
+    if (isfinite(v)) {
+      v = fabsf(v);
+      s += v;
+      m = fmaxf(m, v);
+    } else {
+      ++nf;
+    }
+  }
+  sum_abs[tid] = s;
+  max_abs[tid] = m;
+  nonfinite[tid] = nf;
+  __syncthreads();
+  for (int step = blockDim.x / 2; step > 0; step /= 2) {
+    if (tid < step) {
+      sum_abs[tid] += sum_abs[tid + step];
+      max_abs[tid] = fmaxf(max_abs[tid], max_abs[tid + step]);
+      nonfinite[tid] += nonfinite[tid + step];
+    }
+    __syncthreads();
+  }
+  if (tid == 0) {
+    BlobMonitorSlot* slot = slots + blockIdx.y;
+    atomicAdd(&slot->sum_abs, sum_abs[0]);
+    atomicMax(&slot->max_abs_bits, __float_as_uint(max_abs[0]));
+    atomicAdd(&slot->nonfinite, nonfinite[0]);
+  }
+}
+
+void BlobMonitor::Launch(cudaStream_t stream) {
+  const int num = entries_.size();
+  CHECK_LE(num, 65535) << "Too many blobs to monitor";
+  const size_t tensors_size = align_up<4>(sizeof(BlobMonitorTensor) * num);
+  const size_t bytes = tensors_size + sizeof(BlobMonitorSlot) * num;
+  if (host_buffer_size_ < bytes) {
+    if (host_buffer_ != nullptr) {
+      CUDA_CHECK(cudaFreeHost(host_buffer_));
+    }
+    CUDA_CHECK(cudaMallocHost(&host_buffer_, bytes));
+    host_buffer_size_ = bytes;
+  }
+  buffer_.reserve(bytes);
+  // Pointers are taken every time: reshapes and conversions move the memory
+  BlobMonitorTensor* tensors = static_cast<BlobMonitorTensor*>(host_buffer_);
+  int max_count = 1;
+  for (int i = 0; i < num; ++i) {
+    const Entry& e = entries_[i];
+    const int count = e.blob->count();
+    tensors[i].count = count;
+    tensors[i].ptr = count == 0 ? nullptr :
+        e.diff ? e.blob->current_diff_memory(true) : e.blob->current_data_memory(true);
+    tensors[i].type = e.diff ? e.blob->diff_type() : e.blob->data_type();
+    max_count = std::max(max_count, count);
+  }
+  char* gpu_buffer = static_cast<char*>(buffer_.data());
+  char* host_buffer = static_cast<char*>(host_buffer_);
+  CUDA_CHECK(cudaMemcpyAsync(gpu_buffer, host_buffer, tensors_size, cudaMemcpyHostToDevice,
+      stream));
+  CUDA_CHECK(cudaMemsetAsync(gpu_buffer + tensors_size, 0, bytes - tensors_size, stream));
+  const dim3 grid(std::min(CAFFE_GET_BLOCKS(max_count),
+      Caffe::multiprocessor_count(device_) * BLOB_MONITOR_BLOCKS_PER_SM), num);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  BlobMonitorKernel<<<grid, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      reinterpret_cast<const BlobMonitorTensor*>(gpu_buffer),
+      reinterpret_cast<BlobMonitorSlot*>(gpu_buffer + tensors_size));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(cudaMemcpyAsync(host_buffer + tensors_size, gpu_buffer + tensors_size,
+      bytes - tensors_size, cudaMemcpyDeviceToHost, stream));
+  CUDA_CHECK(cudaEventRecord(done_, stream));
+}
+
+}  // namespace caffe
@@ -0,0 +1,99 @@
+#include <cstring>
+#include <vector>
+
+#include "caffe/util/blob_views.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+namespace {
+
+Type memory_type(const Blob* blob, bool data) {
+  return data ? blob->data_type() : blob->diff_type();
+}
+
+const char* memory(const Blob* blob, bool data, bool is_gpu) {
+  return static_cast<const char*>(data ? blob->current_data_memory(is_gpu) :
+      blob->current_diff_memory(is_gpu));
+}
+
+}  // namespace
+
+bool views_bound(Blob* whole, const vector<Blob*>& parts, bool data, bool is_gpu) {
+  const Type type = memory_type(whole, data);
+  const char* base = memory(whole, data, is_gpu);
+  size_t offset = 0UL;
+  for (Blob* part : parts) {
+    if (memory_type(part, data) != type || part->count() == 0 ||
+        memory(part, data, is_gpu) != base + offset) {
+      return false;
+    }
+    offset += part->count() * tsize(type);
+  }
+  return offset == whole->count() * tsize(type);
+}
+
+bool bind_views(Blob* whole, const vector<Blob*>& parts, bool data, bool is_gpu) {
+  const Type type = memory_type(whole, data);
+  size_t total = 0UL;
+  for (Blob* part : parts) {
+    const size_t bytes = part->count() * tsize(type);
+    const size_t allocated = data ? part->current_data_memory_size() :
+        part->current_diff_memory_size();
+    if (memory_type(part, data) != type || part->count() == 0 || allocated != bytes) {
+      return false;
+    }
+    total += bytes;
+  }
+  if (total != whole->count() * tsize(type)) {
+    return false;
+  }
+  char* base = static_cast<char*>(data ? whole->current_mutable_data_memory(is_gpu) :
+      whole->current_mutable_diff_memory(is_gpu));
+  size_t offset = 0UL;
+  for (Blob* part : parts) {
+    if (data) {
+      part->set_current_data_memory(base + offset, is_gpu);
+    } else {
+      part->set_current_diff_memory(base + offset, is_gpu);
+    }
+    offset += part->count() * tsize(type);
+  }
+  return true;
+}
+
+void unbind_views(Blob* whole, const vector<Blob*>& parts, bool data, bool keep,
+    bool is_gpu) {
+  const char* base = keep ? memory(whole, data, is_gpu) : nullptr;
+  const size_t whole_bytes = whole->count() * tsize(memory_type(whole, data));
+  for (Blob* part : parts) {
+    const size_t bytes = part->count() * tsize(memory_type(part, data));
+    const char* src = keep ? memory(part, data, is_gpu) : nullptr;
+    if (keep && (src < base || src + bytes > base + whole_bytes)) {
+      // Has its own memory already
+      continue;
+    }
+    if (data) {
+      part->release_data();
+    } else {
+      part->release_diff();
+    }
+    if (!keep) {
+      continue;
+    }
+    // Whole's memory outlives the part's new one
+    void* dst = data ? part->current_mutable_data_memory(is_gpu) :
+        part->current_mutable_diff_memory(is_gpu);
+    if (is_gpu) {
+#ifndef CPU_ONLY
+      caffe_gpu_memcpy(bytes, src, dst);
+#else
+      NO_GPU;
+#endif
+    } else {
+      std::memcpy(dst, src, bytes);
+    }
+  }
+}
+
+}  // namespace caffe
@@ -9,13 +9,57 @@
 namespace caffe {
 
 template<typename T>
-BlockingQueue<T>::BlockingQueue() {}
+BlockingQueue<T>::BlockingQueue(size_t ring_capacity)
+    : ring_(ring_capacity > 0UL ? new LockFreeRing<T>(ring_capacity) : nullptr), parked_(0) {}
 
 template<typename T>
 BlockingQueue<T>::~BlockingQueue() {}
 
+template<typename T>
+template<typename Pred>
+void BlockingQueue<T>::ring_wait(const Pred& pred, const char* log_on_wait) {
+  for (int i = 0; i < SPIN_COUNT; ++i) {
+    if (pred()) {
+      return;
+    }
+    if (i >= SPIN_COUNT / 2) {
+      boost::this_thread::yield();
+    }
+  }
+  if (log_on_wait != nullptr) {
+    LOG_EVERY_N(INFO, 10000) << log_on_wait;
+  }
+  boost::mutex::scoped_lock lock(mutex_);
+  struct Parked {
+    explicit Parked(std::atomic<int>& p) : p_(p) { p_.fetch_add(1); }
+    ~Parked() { p_.fetch_sub(1); }
+    std::atomic<int>& p_;
+  } parked(parked_);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  while (!pred()) {
+    condition_.wait(lock);
+  }
+}
+
+template<typename T>
+void BlockingQueue<T>::ring_notify() {
+  // Pairs with the fence in ring_wait: either the waiter sees our change or we see it parked
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (parked_.load() > 0) {
+    { boost::mutex::scoped_lock lock(mutex_); }
+    condition_.notify_all();
+  }
+}
+
 template<typename T>
 void BlockingQueue<T>::push(const T& t) {
+  if (ring_) {
+    if (!ring_->try_push(t)) {
+      ring_wait([&]() { return ring_->try_push(t); }, nullptr);
+    }
+    ring_notify();
+    return;
+  }
   boost::mutex::scoped_lock lock(mutex_);
   queue_.push(t);
   lock.unlock();
@@ -24,6 +68,13 @@ void BlockingQueue<T>::push(const T& t) {
 
 template<typename T>
 bool BlockingQueue<T>::try_pop(T* t) {
+  if (ring_) {
+    if (!ring_->try_pop(t)) {
+      return false;
+    }
+    ring_notify();
+    return true;
+  }
   boost::mutex::scoped_lock lock(mutex_);
   if (queue_.empty()) {
     return false;
@@ -35,6 +86,14 @@ bool BlockingQueue<T>::try_pop(T* t) {
 
 template<typename T>
 T BlockingQueue<T>::pop(const char* log_on_wait) {
+  if (ring_) {
+    T t;
+    if (!ring_->try_pop(&t)) {
+      ring_wait([&]() { return ring_->try_pop(&t); }, log_on_wait);
+    }
+    ring_notify();
+    return t;
+  }
   boost::mutex::scoped_lock lock(mutex_);
   while (queue_.empty()) {
     LOG_EVERY_N(INFO, 10000) << log_on_wait;
@@ -47,6 +106,14 @@ T BlockingQueue<T>::pop(const char* log_on_wait) {
 
 template<typename T>
 T BlockingQueue<T>::pop() {
+  if (ring_) {
+    T t;
+    if (!ring_->try_pop(&t)) {
+      ring_wait([&]() { return ring_->try_pop(&t); }, nullptr);
+    }
+    ring_notify();
+    return t;
+  }
   boost::mutex::scoped_lock lock(mutex_);
   while (queue_.empty()) {
     condition_.wait(lock);
@@ -58,6 +125,9 @@ T BlockingQueue<T>::pop() {
 
 template<typename T>
 bool BlockingQueue<T>::try_peek(T* t) {
+  if (ring_) {
+    return ring_->try_peek(t);
+  }
   boost::mutex::scoped_lock lock(mutex_);
   if (queue_.empty()) {
     return false;
@@ -68,6 +138,13 @@ bool BlockingQueue<T>::try_peek(T* t) {
 
 template<typename T>
 T BlockingQueue<T>::peek() {
+  if (ring_) {
+    T t;
+    if (!ring_->try_peek(&t)) {
+      ring_wait([&]() { return ring_->try_peek(&t); }, nullptr);
+    }
+    return t;
+  }
   boost::mutex::scoped_lock lock(mutex_);
   while (queue_.empty()) {
     condition_.wait(lock);
@@ -77,12 +154,19 @@ T BlockingQueue<T>::peek() {
 
 template<typename T>
 size_t BlockingQueue<T>::size() const {
+  if (ring_) {
+    return ring_->size();
+  }
   boost::mutex::scoped_lock lock(mutex_);
   return queue_.size();
 }
 
 template<typename T>
 bool BlockingQueue<T>::nonblocking_size(size_t* size) const {
+  if (ring_) {
+    *size = ring_->size();
+    return true;
+  }
   boost::mutex::scoped_lock lock(mutex_, boost::try_to_lock);
   if (lock.owns_lock()) {
     *size = queue_.size();
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <sstream>
+
+#include "caffe/util/bucket_tuner.hpp"
+
+namespace caffe {
+
+BucketTuner::BucketTuner(size_t space_size, int max_buckets)
+    : space_size_(space_size), max_buckets_(std::max(1, max_buckets)), iterations_(0),
+      start_us_(0.) {}
+
+void BucketTuner::param_ready(size_t bytes, double time_us) {
+  if (ready_us_.empty()) {
+    ready_us_.push_back(0.);
+    bytes_.push_back(bytes);
+    start_us_ = time_us;
+    return;
+  }
+  bytes_.push_back(bytes);
+  ready_us_.push_back(time_us - start_us_);
+}
+
+void BucketTuner::bucket_reduced(size_t bytes, double time_us) {
+  reduced_bytes_.push_back(bytes);
+  reduced_us_.push_back(time_us);
+}
+
+void BucketTuner::end_iteration() {
+  if (!ready_us_.empty()) {
+    if (iterations_ == 0 || arrival_bytes_ == bytes_) {
+      arrival_bytes_ = bytes_;
+      sum_ready_us_.resize(ready_us_.size(), 0.);
+      for (size_t i = 0; i < ready_us_.size(); ++i) {
+        sum_ready_us_[i] += ready_us_[i];
+      }
+      ++iterations_;
+    }
+  }
+  bytes_.clear();
+  ready_us_.clear();
+}
+
+size_t BucketTuner::bucket_size(int buckets) const {
+  return align_up<6>(space_size_ / std::max(1, buckets));
+}
+
+void BucketTuner::fit(double* latency_us, double* us_per_byte) const {
+  *latency_us = 0.;
+  *us_per_byte = 0.;
+  const size_t n = reduced_us_.size();
+  if (n == 0UL) {
+    return;
+  }
+  double mx = 0., my = 0.;
+  for (size_t i = 0; i < n; ++i) {
+    mx += reduced_bytes_[i];
+    my += reduced_us_[i];
+  }
+  mx /= n;
+  my /= n;
+  double sxy = 0., sxx = 0.;
+  for (size_t i = 0; i < n; ++i) {
+    const double dx = reduced_bytes_[i] - mx;
+    sxy += dx * (reduced_us_[i] - my);
+    sxx += dx * dx;
+  }
+  if (sxx > 0. && sxy > 0.) {
+    *us_per_byte = sxy / sxx;
+    *latency_us = std::max(0., my - *us_per_byte * mx);
+  } else if (mx > 0.) {
+    // All buckets of the same size: no way to tell latency from bandwidth
+    *us_per_byte = my / mx;
+  }
+}
+
+double BucketTuner::simulate(int buckets) const {
+  if (iterations_ == 0) {
+    return 0.;
+  }
+  double latency_us, us_per_byte;
+  fit(&latency_us, &us_per_byte);
+  const size_t size = bucket_size(buckets);
+  double end_us = 0.;
+  size_t acc = 0UL;
+  for (size_t i = 0; i < arrival_bytes_.size(); ++i) {
+    acc += arrival_bytes_[i];
+    if (acc >= size || i + 1 == arrival_bytes_.size()) {
+      const double ready_us = sum_ready_us_[i] / iterations_;
+      end_us = std::max(end_us, ready_us) + latency_us + us_per_byte * acc;
+      acc = 0UL;
+    }
+  }
+  return end_us;
+}
+
+int BucketTuner::best_buckets() const {
+  int best = 1;
+  double best_us = simulate(1);
+  for (int k = 2; k <= max_buckets_; ++k) {
+    const double us = simulate(k);
+    // More buckets only if they're noticeably better
+    if (us < best_us * 0.99) {
+      best = k;
+      best_us = us;
+    }
+  }
+  return best;
+}
+
+std::string BucketTuner::plan(int buckets) const {
+  double latency_us, us_per_byte;
+  fit(&latency_us, &us_per_byte);
+  const double last_us = arrival_bytes_.empty() ? 0. : sum_ready_us_.back() / iterations_;
+  std::ostringstream os;
+  os.precision(4);
+  os << "reduce_buckets: " << buckets << " (bucket size " << bucket_size(buckets)
+     << " bytes), backward " << last_us << " us, estimated end of reduction "
+     << simulate(buckets) << " us, reduction latency " << latency_us << " us, bandwidth "
+     << (us_per_byte > 0. ? 1. / us_per_byte : 0.) << " MB/s, " << iterations_
+     << " iterations measured";
+  return os.str();
+}
+
+}  // namespace caffe
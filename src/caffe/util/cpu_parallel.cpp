@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include "caffe/util/cpu_parallel.hpp"
+
+namespace caffe {
+
+constexpr int CpuParallel::GRAIN;
+std::atomic<int> CpuParallel::threads_(0);
+thread_local bool CpuParallel::in_loop_ = false;
+
+CpuParallel::CpuParallel()
+    : stop_(false), generation_(0UL), pending_(0), task_(nullptr), n_(0), chunks_(0),
+      next_(0) {}
+
+CpuParallel::~CpuParallel() {
+  Resize(0);
+}
+
+CpuParallel& CpuParallel::instance() {
+  static CpuParallel pool;
+  return pool;
+}
+
+int CpuParallel::num_threads() {
+  int threads = threads_.load();
+  if (threads == 0) {
+    const char* env = std::getenv("CAFFE_CPU_THREADS");
+    threads = env != nullptr ? std::atoi(env) : 0;
+    if (threads <= 0) {
+      threads = std::max(1U, std::thread::hardware_concurrency());
+    }
+    threads_.store(threads);
+  }
+  return threads;
+}
+
+void CpuParallel::set_num_threads(int threads) {
+  CHECK_GT(threads, 0);
+  threads_.store(threads);
+}
+
+void CpuParallel::For(int n, int grain, const std::function<void(int, int)>& f) {
+  if (n <= 0) {
+    return;
+  }
+  const int chunks = std::min(num_threads(), (n + std::max(grain, 1) - 1) / std::max(grain, 1));
+  if (chunks <= 1 || in_loop_) {
+    f(0, n);
+    return;
+  }
+  CpuParallel& pool = instance();
+  std::unique_lock<std::mutex> run_lock(pool.run_mutex_, std::try_to_lock);
+  if (!run_lock.owns_lock()) {
+    // Another thread's loop has the pool, running alongside it would oversubscribe
+    f(0, n);
+    return;
+  }
+  pool.Run(n, chunks, f);
+}
+
+void CpuParallel::Run(int n, int chunks, const std::function<void(int, int)>& f) {
+  const int workers = num_threads() - 1;
+  if (workers != workers_.size()) {
+    Resize(workers);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = &f;
+    n_ = n;
+    chunks_ = chunks;
+    next_.store(0);
+    pending_ = workers_.size();
+    ++generation_;
+  }
+  cv_.notify_all();
+  in_loop_ = true;
+  Work();
+  in_loop_ = false;
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return pending_ == 0; });
+  task_ = nullptr;
+}
+
+void CpuParallel::Work() {
+  for (int c = next_.fetch_add(1); c < chunks_; c = next_.fetch_add(1)) {
+    const int begin = static_cast<int>(static_cast<int64_t>(n_) * c / chunks_);
+    const int end = static_cast<int>(static_cast<int64_t>(n_) * (c + 1) / chunks_);
+    (*task_)(begin, end);
+  }
+}
+
+void CpuParallel::Resize(int workers) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+  stop_ = false;
+  for (int i = 0; i < workers; ++i) {
+    workers_.emplace_back(&CpuParallel::WorkerEntry, this, generation_);
+  }
+}
+
+void CpuParallel::WorkerEntry(uint64_t seen) {
+  in_loop_ = true;  // nested loops run serially
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+    if (stop_) {
+      break;
+    }
+    seen = generation_;
+    lock.unlock();
+    Work();
+    lock.lock();
+    if (--pending_ == 0) {
+      done_cv_.notify_all();
+    }
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,104 @@
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "caffe/util/cudnn_algo_cache.hpp"
+
+namespace caffe {
+
+std::mutex CuDNNAlgoCache::mutex_;
+std::map<std::string, CuDNNAlgoCache::Cache> CuDNNAlgoCache::caches_;
+
+std::string CuDNNAlgoCache::Entry::to_string() const {
+  std::ostringstream os;
+  os << fwd_algo << " " << bwd_data_algo << " " << bwd_filter_algo << " "
+     << fwd_cudnn_math << " " << bwd_data_cudnn_math << " " << bwd_filter_cudnn_math << " "
+     << static_cast<int>(forward_math) << " "
+     << static_cast<int>(backward_data_math) << " "
+     << static_cast<int>(backward_filter_math) << " "
+     << fwd_ws_size << " " << bwd_data_ws_size << " " << bwd_filter_ws_size;
+  return os.str();
+}
+
+bool CuDNNAlgoCache::Entry::from_string(const std::string& str) {
+  std::istringstream is(str);
+  int fm = 0, bdm = 0, bfm = 0;
+  is >> fwd_algo >> bwd_data_algo >> bwd_filter_algo
+     >> fwd_cudnn_math >> bwd_data_cudnn_math >> bwd_filter_cudnn_math
+     >> fm >> bdm >> bfm
+     >> fwd_ws_size >> bwd_data_ws_size >> bwd_filter_ws_size;
+  if (is.fail() || !Type_IsValid(fm) || !Type_IsValid(bdm) || !Type_IsValid(bfm)) {
+    return false;
+  }
+  forward_math = static_cast<Type>(fm);
+  backward_data_math = static_cast<Type>(bdm);
+  backward_filter_math = static_cast<Type>(bfm);
+  return true;
+}
+
+CuDNNAlgoCache::Cache& CuDNNAlgoCache::cache(const std::string& file) {
+  auto it = caches_.find(file);
+  if (it != caches_.end()) {
+    return it->second;
+  }
+  Cache& c = caches_[file];
+  std::ifstream ifs(file.c_str());
+  if (!ifs.good()) {
+    LOG(INFO) << "cuDNN algorithm cache " << file << " not found, starting a new one";
+    return c;
+  }
+  std::string line;
+  int line_num = 0;
+  while (std::getline(ifs, line)) {
+    ++line_num;
+    const size_t tab = line.find('\t');
+    Entry entry;
+    if (tab == std::string::npos || !entry.from_string(line.substr(tab + 1))) {
+      LOG(WARNING) << "Skipping ill formatted line " << line_num
+                   << " of cuDNN algorithm cache " << file;
+      continue;
+    }
+    c[line.substr(0, tab)] = entry;
+  }
+  LOG(INFO) << "Loaded " << c.size() << " entries from cuDNN algorithm cache " << file;
+  return c;
+}
+
+bool CuDNNAlgoCache::Lookup(const std::string& file, const std::string& key, Entry* entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const Cache& c = cache(file);
+  auto it = c.find(key);
+  if (it == c.end()) {
+    return false;
+  }
+  *entry = it->second;
+  return true;
+}
+
+void CuDNNAlgoCache::Insert(const std::string& file, const std::string& key,
+    const Entry& entry) {
+  CHECK_EQ(key.find_first_of("\t\n"), std::string::npos) << "Bad cache key: " << key;
+  std::lock_guard<std::mutex> lock(mutex_);
+  Cache& c = cache(file);
+  const std::string value = entry.to_string();
+  auto it = c.find(key);
+  if (it != c.end() && it->second.to_string() == value) {
+    return;  // nothing new
+  }
+  c[key] = entry;
+  // Single short line per write keeps concurrent appends from interleaving
+  std::ofstream ofs(file.c_str(), std::ios::out | std::ios::app);
+  if (!ofs.good()) {
+    LOG(WARNING) << "Failed to open cuDNN algorithm cache " << file << " for writing";
+    return;
+  }
+  ofs << key + "\t" + value + "\n";
+  ofs.flush();
+}
+
+void CuDNNAlgoCache::Reset(const std::string& file) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  caches_.erase(file);
+}
+
+}  // namespace caffe
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "caffe/util/cudnn_workspace_arbiter.hpp"
+
+namespace caffe {
+
+constexpr float CuDNNWorkspaceArbiter::TIME_TOLERANCE;
+std::mutex CuDNNWorkspaceArbiter::mutex_;
+std::map<int, CuDNNWorkspaceArbiter::Problem> CuDNNWorkspaceArbiter::problems_;
+
+void CuDNNWorkspaceArbiter::Submit(int device, const void* owner, int slot,
+    const vector<Candidate>& cands) {
+  CHECK(!cands.empty());
+  std::lock_guard<std::mutex> lock(mutex_);
+  Problem& p = problems_[device];
+  p.slots_[Key(owner, slot)] = cands;
+  p.solved_ = false;
+}
+
+void CuDNNWorkspaceArbiter::Withdraw(int device, const void* owner) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto pit = problems_.find(device);
+  if (pit == problems_.end()) {
+    return;
+  }
+  Problem& p = pit->second;
+  for (auto it = p.slots_.begin(); it != p.slots_.end();) {
+    if (it->first.first == owner) {
+      it = p.slots_.erase(it);
+      p.solved_ = false;
+    } else {
+      ++it;
+    }
+  }
+  if (p.slots_.empty()) {
+    problems_.erase(pit);
+  }
+}
+
+bool CuDNNWorkspaceArbiter::Decision(int device, const void* owner, int slot, size_t budget,
+    Candidate* choice, size_t* workspace) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto pit = problems_.find(device);
+  if (pit == problems_.end()) {
+    return false;
+  }
+  Problem& p = pit->second;
+  auto sit = p.slots_.find(Key(owner, slot));
+  if (sit == p.slots_.end()) {
+    return false;
+  }
+  if (!p.solved_) {
+    vector<vector<Candidate>> slots;
+    vector<Key> keys;
+    for (const auto& s : p.slots_) {
+      keys.push_back(s.first);
+      slots.push_back(s.second);
+    }
+    vector<int> choices;
+    p.workspace_ = Solve(slots, budget, &choices);
+    p.choices_.clear();
+    float total_time = 0.F;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      p.choices_[keys[i]] = choices[i];
+      total_time += slots[i][choices[i]].time;
+    }
+    p.solved_ = true;
+    LOG(INFO) << "Device " << device << ": cuDNN workspace arbitration of " << slots.size()
+              << " algorithm slots within " << gb_round2(budget) << "G picked "
+              << gb_round2(p.workspace_) << "G of workspace, total time " << f_round2(total_time);
+  }
+  *choice = sit->second[p.choices_[sit->first]];
+  if (workspace != nullptr) {
+    *workspace = p.workspace_;
+  }
+  return true;
+}
+
+size_t CuDNNWorkspaceArbiter::Solve(const vector<vector<Candidate>>& slots, size_t budget,
+    vector<int>* choices) {
+  choices->assign(slots.size(), 0);
+  // Every distinct requirement fitting the budget is a possible workspace size
+  vector<size_t> sizes;
+  for (const vector<Candidate>& cands : slots) {
+    for (const Candidate& c : cands) {
+      if (c.memory <= budget) {
+        sizes.push_back(c.memory);
+      }
+    }
+  }
+  std::sort(sizes.begin(), sizes.end());
+  sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+  // Total time of every size, infinite if some slot doesn't fit
+  const float inf = std::numeric_limits<float>::infinity();
+  vector<float> totals(sizes.size(), 0.F);
+  for (size_t t = 0; t < sizes.size(); ++t) {
+    for (const vector<Candidate>& cands : slots) {
+      float best = inf;
+      for (const Candidate& c : cands) {
+        if (c.memory <= sizes[t]) {
+          best = std::min(best, c.time);
+        }
+      }
+      totals[t] += best;
+    }
+  }
+  size_t workspace = 0UL;
+  if (sizes.empty() || totals.back() == inf) {
+    // Nothing fits everywhere: the smallest requirement of every slot
+    for (size_t s = 0; s < slots.size(); ++s) {
+      const vector<Candidate>& cands = slots[s];
+      for (size_t k = 1; k < cands.size(); ++k) {
+        if (cands[k].memory < cands[(*choices)[s]].memory) {
+          (*choices)[s] = k;
+        }
+      }
+      workspace = std::max(workspace, cands[(*choices)[s]].memory);
+    }
+    return workspace;
+  }
+  const float limit = totals.back() * (1.F + TIME_TOLERANCE);
+  for (size_t t = 0; t < sizes.size(); ++t) {
+    if (totals[t] <= limit) {
+      workspace = sizes[t];
+      break;
+    }
+  }
+  size_t used = 0UL;
+  for (size_t s = 0; s < slots.size(); ++s) {
+    const vector<Candidate>& cands = slots[s];
+    float best = inf;
+    for (size_t k = 0; k < cands.size(); ++k) {
+      if (cands[k].memory <= workspace && cands[k].time < best) {
+        best = cands[k].time;
+        (*choices)[s] = k;
+      }
+    }
+    used = std::max(used, cands[(*choices)[s]].memory);
+  }
+  return used;
+}
+
+}  // namespace caffe
@@ -0,0 +1,103 @@
+#include "caffe/util/dag_executor.hpp"
+
+namespace caffe {
+
+DagExecutor::DagExecutor(int helpers, const std::function<void()>& thread_init)
+    : stop_(false), run_(nullptr), caller_only_(nullptr), remaining_(0) {
+  for (int i = 0; i < helpers; ++i) {
+    helpers_.emplace_back(&DagExecutor::HelperEntry, this, thread_init);
+  }
+}
+
+DagExecutor::~DagExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (std::thread& helper : helpers_) {
+    helper.join();
+  }
+}
+
+void DagExecutor::Run(const vector<vector<int>>& deps, const vector<bool>& caller_only,
+    const std::function<void(int)>& run) {
+  const int nodes = deps.size();
+  std::unique_lock<std::mutex> lock(mutex_);
+  CHECK(run_ == nullptr) << "DagExecutor::Run isn't reentrant";
+  successors_.assign(nodes, vector<int>());
+  pending_.assign(nodes, 0);
+  ready_.clear();
+  for (int i = 0; i < nodes; ++i) {
+    for (int dep : deps[i]) {
+      CHECK(dep >= 0 && dep < nodes && dep != i) << "Bad dependency " << dep << " of " << i;
+      successors_[dep].push_back(i);
+      ++pending_[i];
+    }
+  }
+  for (int i = 0; i < nodes; ++i) {
+    if (pending_[i] == 0) {
+      ready_.insert(i);
+    }
+  }
+  CHECK(nodes == 0 || !ready_.empty()) << "Dependency cycle";
+  run_ = &run;
+  caller_only_ = &caller_only;
+  remaining_ = nodes;
+  cv_.notify_all();
+  while (remaining_ > 0) {
+    const int node = Take(true);
+    if (node < 0) {
+      cv_.wait(lock);
+      continue;
+    }
+    lock.unlock();
+    run(node);
+    lock.lock();
+    Finish(node);
+  }
+  run_ = nullptr;
+  caller_only_ = nullptr;
+}
+
+void DagExecutor::HelperEntry(std::function<void()> thread_init) {
+  if (thread_init) {
+    thread_init();
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    const int node = run_ != nullptr ? Take(false) : -1;
+    if (node < 0) {
+      cv_.wait(lock);
+      continue;
+    }
+    const std::function<void(int)>& run = *run_;
+    lock.unlock();
+    run(node);
+    lock.lock();
+    Finish(node);
+  }
+}
+
+int DagExecutor::Take(bool caller) {
+  for (auto it = ready_.begin(); it != ready_.end(); ++it) {
+    const int node = *it;
+    if (caller || node >= caller_only_->size() || !(*caller_only_)[node]) {
+      ready_.erase(it);
+      return node;
+    }
+  }
+  return -1;
+}
+
+void DagExecutor::Finish(int node) {
+  for (int successor : successors_[node]) {
+    if (--pending_[successor] == 0) {
+      ready_.insert(successor);
+    }
+  }
+  --remaining_;
+  cv_.notify_all();
+}
+
+}  // namespace caffe
@@ -1,10 +1,22 @@
 #ifdef USE_LEVELDB
 #include "caffe/util/db_leveldb.hpp"
 
+#include <map>
+#include <mutex>
 #include <string>
 
 namespace caffe { namespace db {
 
+// Read handles by source
+static std::mutex handles_mutex_;
+static std::map<string, std::weak_ptr<LevelDBHandle>> handles_;
+
+void LevelDB::Configure(const DataParameter& param) {
+  cache_mb_ = param.leveldb_cache_mb();
+  fill_cache_ = param.leveldb_fill_cache();
+  snapshots_ = param.leveldb_snapshots();
+}
+
 void LevelDB::Open(const string& source, Mode mode) {
   leveldb::Options options;
   options.block_size = 65536;
@@ -12,10 +24,48 @@ void LevelDB::Open(const string& source, Mode mode) {
   options.max_open_files = 100;
   options.error_if_exists = mode == NEW;
   options.create_if_missing = mode != READ;
-  leveldb::Status status = leveldb::DB::Open(options, source, &db_);
+  if (mode != READ) {
+    leveldb::Status status = leveldb::DB::Open(options, source, &db_);
+    CHECK(status.ok()) << "Failed to open leveldb " << source
+                       << std::endl << status.ToString();
+    LOG(INFO) << "Opened leveldb " << source;
+    return;
+  }
+  std::lock_guard<std::mutex> lock(handles_mutex_);
+  handle_ = handles_[source].lock();
+  if (handle_) {
+    db_ = handle_->db;
+    DLOG(INFO) << "Sharing leveldb " << source;
+    return;
+  }
+  handle_ = std::make_shared<LevelDBHandle>();
+  // Table files stay open, readers of all threads hit one block cache
+  options.max_open_files = 1000;
+  if (cache_mb_ > 0U) {
+    handle_->cache = leveldb::NewLRUCache(static_cast<size_t>(cache_mb_) << 20);
+    options.block_cache = handle_->cache;
+  }
+  leveldb::Status status = leveldb::DB::Open(options, source, &handle_->db);
   CHECK(status.ok()) << "Failed to open leveldb " << source
                      << std::endl << status.ToString();
-  LOG(INFO) << "Opened leveldb " << source;
+  db_ = handle_->db;
+  handles_[source] = handle_;
+  LOG(INFO) << "Opened leveldb " << source << " for reading, block cache "
+            << (cache_mb_ > 0U ? std::to_string(cache_mb_) + " MB" : "default");
+}
+
+LevelDBCursor* LevelDB::NewCursor() {
+  leveldb::ReadOptions options;
+  options.fill_cache = fill_cache_;
+  if (!handle_) {
+    return new LevelDBCursor(db_->NewIterator(options));
+  }
+  // Records written meanwhile stay out of this cursor's pass
+  if (snapshots_) {
+    options.snapshot = db_->GetSnapshot();
+  }
+  // Keeps the shared handle open as long as the cursor
+  return new LevelDBCursor(db_->NewIterator(options), handle_, options.snapshot);
 }
 
 }  // namespace db
@@ -1,7 +1,9 @@
 #ifdef USE_LMDB
 #include "caffe/util/db_lmdb.hpp"
 
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <string>
 
@@ -24,6 +26,16 @@ void LMDB::Open(const string& source, Mode mode) {
   LOG(INFO) << "Opened lmdb " << source;
 }
 
+void LMDBCursor::prefetch() const {
+  if (!valid_ || mdb_value_.mv_size == 0UL) {
+    return;
+  }
+  static const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(mdb_value_.mv_data) & ~(page - 1UL);
+  const uintptr_t end = reinterpret_cast<uintptr_t>(mdb_value_.mv_data) + mdb_value_.mv_size;
+  madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+}
+
 LMDBCursor* LMDB::NewCursor() {
   MDB_txn* mdb_txn;
   MDB_cursor* mdb_cursor;
@@ -83,6 +95,15 @@ void LMDBTransaction::Commit() {
   }
 }
 
+void LMDB::reserve_map(size_t bytes) {
+  struct MDB_envinfo current_info;
+  MDB_CHECK(mdb_env_info(mdb_env_, &current_info));
+  if (bytes > current_info.me_mapsize) {
+    LOG(INFO) << "Setting LMDB map size to " << (bytes >> 20) << "MB";
+    MDB_CHECK(mdb_env_set_mapsize(mdb_env_, bytes));
+  }
+}
+
 void LMDBTransaction::DoubleMapSize() {
   struct MDB_envinfo current_info;
   MDB_CHECK(mdb_env_info(mdb_env_, &current_info));
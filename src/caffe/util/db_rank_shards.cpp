@@ -0,0 +1,130 @@
+#include "caffe/util/db_rank_shards.hpp"
+
+#include <sys/stat.h>
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <utility>
+
+#include "caffe/util/format.hpp"
+
+namespace caffe { namespace db {
+
+static const char* RANK_SHARDS_FILE = "/RANK_SHARDS";
+
+InterleavedCursor::InterleavedCursor(vector<unique_ptr<Cursor>>&& cursors)
+    : cursors_(std::move(cursors)), current_(0UL) {
+  CHECK(!cursors_.empty());
+  SeekToFirst();
+}
+
+void InterleavedCursor::SeekToFirst() {
+  for (unique_ptr<Cursor>& cursor : cursors_) {
+    cursor->SeekToFirst();
+  }
+  current_ = 0UL;
+}
+
+void InterleavedCursor::Next() {
+  cursors_[current_]->Next();
+  current_ = (current_ + 1UL) % cursors_.size();
+}
+
+RankShardsDB::RankShardsDB(DataParameter_DB backend)
+    : backend_(backend), shards_(0UL), puts_(0UL) {
+  CHECK(backend_ == DataParameter_DB_LMDB || backend_ == DataParameter_DB_LEVELDB)
+      << "Rank shards are LMDB or LevelDB databases";
+}
+
+void RankShardsDB::Configure(const DataParameter& param) {
+  param_ = param;
+}
+
+size_t RankShardsDB::Count(const string& source) {
+  std::ifstream file(source + RANK_SHARDS_FILE);
+  size_t shards = 0UL;
+  if (!(file >> shards)) {
+    return 0UL;
+  }
+  return shards;
+}
+
+string RankShardsDB::shard_path(const string& source, size_t shard_id) {
+  return source + "/rank-" + format_int(shard_id, 5);
+}
+
+void RankShardsDB::Open(const string& source, Mode mode) {
+  vector<size_t> ids;
+  if (mode == READ) {
+    shards_ = Count(source);
+    CHECK_GT(shards_, 0UL) << source << " is not split in rank shards";
+    ids = selected_;
+    if (ids.empty()) {
+      for (size_t i = 0; i < shards_; ++i) {
+        ids.push_back(i);
+      }
+    }
+  } else {
+    // Appending would break the interleaving
+    CHECK(mode == NEW) << "Rank shards are written once, as a new source";
+    CHECK_GT(shards_, 0UL) << "Number of rank shards to write is not set";
+    CHECK_EQ(mkdir(source.c_str(), 0744), 0) << "mkdir " << source << " failed";
+    for (size_t i = 0; i < shards_; ++i) {
+      ids.push_back(i);
+    }
+  }
+  dbs_.clear();
+  for (size_t id : ids) {
+    CHECK_LT(id, shards_) << "No rank shard " << id << " in " << source;
+    dbs_.emplace_back(GetDB(backend_));
+    dbs_.back()->Configure(param_);
+    dbs_.back()->Open(shard_path(source, id), mode);
+  }
+  if (mode != READ) {
+    // Written last, readers never see a partial layout
+    std::ofstream file(source + RANK_SHARDS_FILE);
+    file << shards_ << std::endl;
+    CHECK(file.good()) << "Failed to write " << source << RANK_SHARDS_FILE;
+    puts_ = 0UL;
+  }
+  LOG(INFO) << "Opened " << dbs_.size() << " of " << shards_ << " rank shards of " << source;
+}
+
+void RankShardsDB::Close() {
+  for (unique_ptr<DB>& db : dbs_) {
+    db->Close();
+  }
+  dbs_.clear();
+}
+
+Cursor* RankShardsDB::NewCursor() {
+  vector<unique_ptr<Cursor>> cursors;
+  for (unique_ptr<DB>& db : dbs_) {
+    cursors.emplace_back(db->NewCursor());
+  }
+  return new InterleavedCursor(std::move(cursors));
+}
+
+Transaction* RankShardsDB::NewTransaction() {
+  CHECK_EQ(dbs_.size(), shards_) << "Rank shards are written all together";
+  return new RankShardsTransaction(this);
+}
+
+RankShardsTransaction::RankShardsTransaction(RankShardsDB* db) : db_(CHECK_NOTNULL(db)) {
+  for (unique_ptr<DB>& shard : db_->dbs_) {
+    txns_.emplace_back(shard->NewTransaction());
+  }
+}
+
+void RankShardsTransaction::Put(const string& key, const string& value) {
+  txns_[db_->puts_++ % txns_.size()]->Put(key, value);
+}
+
+void RankShardsTransaction::Commit() {
+  for (unique_ptr<Transaction>& txn : txns_) {
+    txn->Commit();
+  }
+}
+
+}  // namespace db
+}  // namespace caffe
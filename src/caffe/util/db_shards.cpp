@@ -0,0 +1,303 @@
+#include "caffe/util/db_shards.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <string>
+
+namespace caffe { namespace db {
+
+constexpr const char* ShardsDB::MAGIC;
+constexpr size_t ShardsDB::MAGIC_SIZE;
+
+static constexpr size_t RECORD_HEADER_SIZE = 2UL * sizeof(uint32_t);
+
+ShardsCursor::ShardsCursor(const vector<string>& shards, size_t window, bool shuffle,
+    size_t shuffle_buffer, uint64_t seed)
+    : shards_(shards),
+      window_(std::max(window, RECORD_HEADER_SIZE)),
+      shuffle_(shuffle),
+      seed_(seed),
+      shard_idx_(0UL),
+      epoch_(0UL),
+      fd_(-1),
+      buf_(window_),
+      pos_(0UL),
+      end_(0UL),
+      file_offset_(0UL),
+      pool_(shuffle ? shuffle_buffer : 0UL),
+      filled_(0UL),
+      current_(0UL),
+      key_(nullptr),
+      key_size_(0U),
+      value_(nullptr),
+      value_size_(0U),
+      valid_(false) {
+  SeekToFirst();
+}
+
+ShardsCursor::~ShardsCursor() {
+  close_shard();
+}
+
+void ShardsCursor::SeekToFirst() {
+  close_shard();
+  order_.resize(shards_.size());
+  for (size_t i = 0; i < order_.size(); ++i) {
+    order_[i] = i;
+  }
+  if (shuffle_) {
+    rng_.seed(seed_ + epoch_);
+    std::shuffle(order_.begin(), order_.end(), rng_);
+  }
+  ++epoch_;
+  shard_idx_ = 0UL;
+  if (pool_.empty()) {
+    valid_ = read_next(&key_, &key_size_, &value_, &value_size_);
+    return;
+  }
+  for (filled_ = 0UL; filled_ < pool_.size(); ++filled_) {
+    if (!read_next(&pool_[filled_])) {
+      break;
+    }
+  }
+  valid_ = filled_ > 0UL;
+  if (valid_) {
+    current_ = rng_() % filled_;
+    point_to(pool_[current_]);
+  }
+}
+
+void ShardsCursor::Next() {
+  if (!valid_) {
+    return;
+  }
+  if (pool_.empty()) {
+    valid_ = read_next(&key_, &key_size_, &value_, &value_size_);
+    return;
+  }
+  // The slot just emitted gets the next record, or the last one when there is none
+  if (!read_next(&pool_[current_])) {
+    --filled_;
+    std::swap(pool_[current_], pool_[filled_]);
+  }
+  valid_ = filled_ > 0UL;
+  if (valid_) {
+    current_ = rng_() % filled_;
+    point_to(pool_[current_]);
+  }
+}
+
+void ShardsCursor::point_to(const Record& r) {
+  key_ = r.key.data();
+  key_size_ = static_cast<uint32_t>(r.key.size());
+  value_ = r.value.data();
+  value_size_ = static_cast<uint32_t>(r.value.size());
+}
+
+bool ShardsCursor::read_next(Record* record) {
+  const char* key;
+  const char* value;
+  uint32_t key_size, value_size;
+  if (!read_next(&key, &key_size, &value, &value_size)) {
+    return false;
+  }
+  record->key.assign(key, key_size);
+  record->value.assign(value, value_size);
+  return true;
+}
+
+bool ShardsCursor::read_next(const char** key, uint32_t* key_size, const char** value,
+    uint32_t* value_size) {
+  for (;;) {
+    if (fd_ < 0 && !open_next_shard()) {
+      return false;
+    }
+    if (!fill(RECORD_HEADER_SIZE)) {
+      CHECK_EQ(pos_, end_) << "Truncated record in " << shards_[order_[shard_idx_ - 1UL]];
+      close_shard();
+      continue;
+    }
+    std::memcpy(key_size, &buf_[pos_], sizeof(uint32_t));
+    std::memcpy(value_size, &buf_[pos_ + sizeof(uint32_t)], sizeof(uint32_t));
+    const size_t record_size = RECORD_HEADER_SIZE + *key_size + *value_size;
+    CHECK(fill(record_size)) << "Truncated record in " << shards_[order_[shard_idx_ - 1UL]];
+    *key = &buf_[pos_ + RECORD_HEADER_SIZE];
+    *value = *key + *key_size;
+    pos_ += record_size;
+    return true;
+  }
+}
+
+bool ShardsCursor::open_next_shard() {
+  if (shard_idx_ >= order_.size()) {
+    return false;
+  }
+  const string& path = shards_[order_[shard_idx_++]];
+  fd_ = open(path.c_str(), O_RDONLY);
+  CHECK_GE(fd_, 0) << "Failed to open " << path << ": " << std::strerror(errno);
+  posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+  pos_ = end_ = 0UL;
+  file_offset_ = 0UL;
+  CHECK(fill(ShardsDB::MAGIC_SIZE) && std::memcmp(&buf_[0], ShardsDB::MAGIC,
+      ShardsDB::MAGIC_SIZE) == 0) << "Not a record shard: " << path;
+  pos_ = ShardsDB::MAGIC_SIZE;
+  return true;
+}
+
+void ShardsCursor::close_shard() {
+  if (fd_ >= 0) {
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd_);
+    fd_ = -1;
+  }
+  pos_ = end_ = 0UL;
+}
+
+bool ShardsCursor::fill(size_t bytes) {
+  if (end_ - pos_ >= bytes) {
+    return true;
+  }
+  // Everything before pos_ has been consumed
+  std::memmove(&buf_[0], &buf_[pos_], end_ - pos_);
+  end_ -= pos_;
+  pos_ = 0UL;
+  if (buf_.size() < bytes) {
+    buf_.resize(bytes);
+  }
+  bool eof = false;
+  while (end_ < bytes && !eof) {
+    const ssize_t n = read(fd_, &buf_[end_], buf_.size() - end_);
+    if (n < 0) {
+      CHECK_EQ(errno, EINTR) << "Read failed: " << std::strerror(errno);
+      continue;
+    }
+    end_ += n;
+    file_offset_ += n;
+    eof = n == 0;
+  }
+  if (!eof) {
+    // Let the kernel fetch the next window while this one is being parsed
+    posix_fadvise(fd_, file_offset_, window_, POSIX_FADV_WILLNEED);
+  }
+  return end_ >= bytes;
+}
+
+ShardsDB::ShardsDB()
+    : window_(64UL << 20),
+      shuffle_(false),
+      shuffle_buffer_(0UL),
+      shard_size_(256UL << 20),
+      rec_(nullptr),
+      idx_(nullptr),
+      rec_offset_(0UL) {}
+
+void ShardsDB::Configure(const DataParameter& param) {
+  window_ = static_cast<size_t>(param.shard_window_mb()) << 20;
+  shuffle_ = param.shuffle() && !param.cache();
+  shuffle_buffer_ = param.shard_shuffle_buffer();
+}
+
+string ShardsDB::shard_path(const string& source, size_t shard_id, bool index) {
+  char name[32];
+  snprintf(name, sizeof(name), "shard-%05zu.%s", shard_id, index ? "idx" : "rec");
+  return source + "/" + name;
+}
+
+void ShardsDB::Open(const string& source, Mode mode) {
+  source_ = source;
+  if (mode == NEW) {
+    CHECK_EQ(mkdir(source.c_str(), 0744), 0) << "mkdir " << source << " failed";
+  } else if (mode == WRITE) {
+    mkdir(source.c_str(), 0744);
+  }
+  shards_.clear();
+  struct stat st;
+  while (stat(shard_path(source, shards_.size(), false).c_str(), &st) == 0) {
+    shards_.push_back(shard_path(source, shards_.size(), false));
+  }
+  if (mode != READ) {
+    LOG(INFO) << "Opened shards " << source << " for writing, " << shards_.size()
+              << " shards exist";
+    return;
+  }
+  CHECK(!shards_.empty()) << "No record shards found in " << source;
+  size_t records = 0UL;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    if (stat(shard_path(source, i, true).c_str(), &st) == 0) {
+      records += st.st_size / sizeof(uint64_t);
+    }
+  }
+  LOG(INFO) << "Opened shards " << source << ": " << shards_.size() << " shards, "
+            << records << " records";
+}
+
+void ShardsDB::Close() {
+  if (rec_ != nullptr) {
+    fclose(rec_);
+    rec_ = nullptr;
+  }
+  if (idx_ != nullptr) {
+    fclose(idx_);
+    idx_ = nullptr;
+  }
+}
+
+ShardsCursor* ShardsDB::NewCursor() {
+  return new ShardsCursor(shards_, window_, shuffle_, shuffle_buffer_,
+      std::hash<string>()(source_));
+}
+
+Transaction* ShardsDB::NewTransaction() {
+  return new ShardsTransaction(this);
+}
+
+void ShardsDB::start_shard() {
+  Close();
+  const string rec_path = shard_path(source_, shards_.size(), false);
+  const string idx_path = shard_path(source_, shards_.size(), true);
+  rec_ = fopen(rec_path.c_str(), "wb");
+  CHECK(rec_ != nullptr) << "Failed to create " << rec_path << ": " << std::strerror(errno);
+  idx_ = fopen(idx_path.c_str(), "wb");
+  CHECK(idx_ != nullptr) << "Failed to create " << idx_path << ": " << std::strerror(errno);
+  CHECK_EQ(fwrite(MAGIC, 1, MAGIC_SIZE, rec_), MAGIC_SIZE);
+  rec_offset_ = MAGIC_SIZE;
+  shards_.push_back(rec_path);
+}
+
+void ShardsDB::Append(const string& key, const string& value) {
+  if (rec_ == nullptr || rec_offset_ >= shard_size_) {
+    start_shard();
+  }
+  const uint32_t sizes[2] = {static_cast<uint32_t>(key.size()),
+      static_cast<uint32_t>(value.size())};
+  CHECK_EQ(fwrite(&rec_offset_, sizeof(rec_offset_), 1, idx_), 1UL);
+  CHECK_EQ(fwrite(sizes, sizeof(sizes), 1, rec_), 1UL);
+  CHECK_EQ(fwrite(key.data(), 1, key.size(), rec_), key.size());
+  CHECK_EQ(fwrite(value.data(), 1, value.size(), rec_), value.size());
+  rec_offset_ += sizeof(sizes) + key.size() + value.size();
+}
+
+void ShardsDB::Flush() {
+  if (rec_ != nullptr) {
+    CHECK_EQ(fflush(rec_), 0);
+    CHECK_EQ(fflush(idx_), 0);
+  }
+}
+
+void ShardsTransaction::Commit() {
+  for (size_t i = 0; i < keys_.size(); ++i) {
+    db_->Append(keys_[i], values_[i]);
+  }
+  db_->Flush();
+  keys_.clear();
+  values_.clear();
+}
+
+}  // namespace db
+}  // namespace caffe
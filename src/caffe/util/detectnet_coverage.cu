@@ -0,0 +1,113 @@
+#include <opencv2/core/core.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/detectnet_coverage.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// One thread per gridbox: the last box whose coverage region overlaps the
+//  gridbox labels it, as the sequential generate() leaves it.
+template <typename Dtype>
+__global__ void rasterize_coverage(
+    const int nthreads, const int grid_x, const int grid_y,
+    const int label_size, const Dtype stride,
+    const int* box_offsets, const CoverageBox_<Dtype>* boxes,
+    Dtype* labels
+) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int area = grid_x * grid_y;
+    const int n = index / area;
+    const int g_y = (index % area) / grid_x;
+    const int g_x = index % grid_x;
+    const Dtype box_x0 = g_x * stride;
+    const Dtype box_y0 = g_y * stride;
+
+    int found = -1;
+    for (int b = box_offsets[n + 1] - 1; b >= box_offsets[n] && found < 0; --b) {
+      const CoverageBox_<Dtype>& box = boxes[b];
+      if (g_x < box.g_x0 || g_x >= box.g_x1 || g_y < box.g_y0 || g_y >= box.g_y1) {
+        continue;
+      }
+      // the amount of the gridbox covered by the coverage region:
+      const Dtype w = min(box.cvg_x1, box_x0 + stride) - max(box.cvg_x0, box_x0);
+      const Dtype h = min(box.cvg_y1, box_y0 + stride) - max(box.cvg_y0, box_y0);
+      if (w > 0 && h > 0 && w * h / (stride * stride) > FLT_EPSILON) {
+        found = b;
+      }
+    }
+
+    Dtype* label = labels + n * label_size * area + g_y * grid_x + g_x;
+    if (found < 0) {
+      for (int z = 0; z < label_size; ++z) {
+        label[z * area] = 0;
+      }
+      continue;
+    }
+    const CoverageBox_<Dtype>& box = boxes[found];
+    // foreground:
+    label[0 * area] = 1;
+    // bbox relative to the gridbox:
+    label[1 * area] = box.x0 - box_x0;
+    label[2 * area] = box.y0 - box_y0;
+    label[3 * area] = box.x1 - box_x0;
+    label[4 * area] = box.y1 - box_y0;
+    // bbox dimensions:
+    label[5 * area] = 1 / (box.x1 - box.x0);
+    label[6 * area] = 1 / (box.y1 - box.y0);
+    // obj_norm:
+    label[7 * area] = box.obj_norm;
+    // coverage, one class:
+    const int first = CoverageGenerator<Dtype>::TRANSFORMED_LABEL_SIZE;
+    for (int z = first; z < label_size; ++z) {
+      label[z * area] = z - first == box.label ? 1 : 0;
+    }
+  }
+}
+
+
+template <typename Dtype>
+void CoverageGenerator<Dtype>::generate_gpu(
+    Dtype* transformedLabels,
+    const vector<vector<BboxLabel> >& bboxLists
+) {
+  const int num = bboxLists.size();
+  box_offsets_.assign(1, 0);
+  boxes_.clear();
+  for (int n = 0; n < num; ++n) {
+    this->coverageBoxes(bboxLists[n], &boxes_);
+    box_offsets_.push_back(boxes_.size());
+  }
+
+  // offsets then boxes, in one upload:
+  const size_t offsets_size =
+      align_up<4>(sizeof(int) * box_offsets_.size());
+  const size_t boxes_size = sizeof(CoverageBox) * boxes_.size();
+  gpu_boxes_.reserve(offsets_size + boxes_size);
+  char* gpu_boxes = reinterpret_cast<char*>(gpu_boxes_.data());
+  caffe_gpu_memcpy(sizeof(int) * box_offsets_.size(), &box_offsets_[0], gpu_boxes);
+  if (boxes_size > 0) {
+    caffe_gpu_memcpy(boxes_size, &boxes_[0], gpu_boxes + offsets_size);
+  }
+
+  const int nthreads = num * gridROI_.area();
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  rasterize_coverage<<<CAFFE_GET_BLOCKS(nthreads), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      nthreads, gridROI_.width, gridROI_.height, label_size_,
+      Dtype(param_.stride()),
+      reinterpret_cast<const int*>(gpu_boxes),
+      reinterpret_cast<const CoverageBox*>(gpu_boxes + offsets_size),
+      transformedLabels);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template void CoverageGenerator<float>::generate_gpu(float*,
+    const vector<vector<BboxLabel_<float> > >&);
+template void CoverageGenerator<double>::generate_gpu(double*,
+    const vector<vector<BboxLabel_<double> > >&);
+
+}  // namespace caffe
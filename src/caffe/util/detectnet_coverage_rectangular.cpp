@@ -360,6 +360,40 @@ void CoverageGenerator<Dtype>::generate(
 }
 
 
+template <typename Dtype>
+void CoverageGenerator<Dtype>::coverageBoxes(
+    const vector<BboxLabel>& _bboxList,
+    vector<CoverageBox>* boxes
+) const {
+  const vector<BboxLabel> bboxList(this->pruneBboxes(_bboxList));
+
+  foreach_(const BboxLabel& label, bboxList) {
+    const Rectv& bbox(label.bbox);
+    Rectv coverage(this->coverageBoundingBox(bbox));
+    unique_ptr<CoverageRegion> coverageRegion(
+        this->coverageRegion(coverage));
+    Rect g_coverage(this->imageRectToGridRect(coverage));
+
+    CoverageBox box;
+    box.x0 = bbox.tl().x;
+    box.y0 = bbox.tl().y;
+    box.x1 = bbox.br().x;
+    box.y1 = bbox.br().y;
+    box.cvg_x0 = coverage.tl().x;
+    box.cvg_y0 = coverage.tl().y;
+    box.cvg_x1 = coverage.br().x;
+    box.cvg_y1 = coverage.br().y;
+    box.g_x0 = g_coverage.tl().x;
+    box.g_y0 = g_coverage.tl().y;
+    box.g_x1 = g_coverage.br().x;
+    box.g_y1 = g_coverage.br().y;
+    box.label = labels_.at(size_t(label.classNumber));
+    box.obj_norm = std::max(this->minObjNorm_, objectNormValue(*coverageRegion));
+    boxes->push_back(box);
+  }
+}
+
+
 INSTANTIATE_CLASS_CPU(CoverageGenerator);
 INSTANTIATE_CLASS_CPU(RectangularCoverageGenerator);
 
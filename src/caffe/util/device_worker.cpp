@@ -0,0 +1,51 @@
+#include "caffe/util/device_worker.hpp"
+
+namespace caffe {
+
+DeviceWorker::DeviceWorker(const std::function<void()>& thread_init)
+    : busy_(false), stop_(false) {
+  thread_ = std::thread(&DeviceWorker::WorkerEntry, this, thread_init);
+}
+
+DeviceWorker::~DeviceWorker() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void DeviceWorker::Post(const std::function<void()>& task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(task);
+  }
+  cv_.notify_all();
+}
+
+void DeviceWorker::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_cv_.wait(lock, [this] { return tasks_.empty() && !busy_; });
+}
+
+void DeviceWorker::WorkerEntry(std::function<void()> thread_init) {
+  thread_init();
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+    if (tasks_.empty()) {
+      break;
+    }
+    std::function<void()> task = std::move(tasks_.front());
+    tasks_.pop_front();
+    busy_ = true;
+    lock.unlock();
+    task();
+    lock.lock();
+    busy_ = false;
+    idle_cv_.notify_all();
+  }
+}
+
+}  // namespace caffe
@@ -1,9 +1,12 @@
 #ifndef CPU_ONLY
 
 #include <algorithm>
+#include <chrono>
 #include <sstream>
+#include <thread>
 #include "caffe/common.hpp"
 #include "caffe/util/gpu_memory.hpp"
+#include "caffe/util/gpu_slab_allocator.hpp"
 
 #include "cub/util_allocator.cuh"
 
@@ -17,13 +20,17 @@ const unsigned int GPUMemory::Manager::MAX_BIN = 22;
 const size_t GPUMemory::Manager::MAX_CACHED_BYTES = (size_t) -1;
 const size_t GPUMemory::Manager::MAX_CACHED_SIZE = (1 << GPUMemory::Manager::MAX_BIN);  // 4M
 const size_t GPUMemory::Manager::INITIAL_PINNED_BYTES = 64;
+const size_t GPUMemory::Manager::DEFAULT_ARENA_MB = 256;
 shared_mutex GPUMemory::mutex_;
 mutex GPUMemory::ws_mutex_init_;
+mutex GPUMemory::oom_mutex_;
+std::map<const void*, std::pair<int, std::function<std::string()>>> GPUMemory::oom_reports_;
 
 GPUMemory::Manager GPUMemory::mgr_;
 
 vector<shared_ptr<GPUMemory::Workspace>> GPUMemory::workspace_;
 vector<shared_ptr<GPUMemory::Workspace>> GPUMemory::weights_workspace_;
+static thread_local shared_ptr<GPUMemory::Workspace> thread_workspace_;
 
 // To be called for every device
 void GPUMemory::Init() {
@@ -41,6 +48,27 @@ void GPUMemory::Init() {
   if (!weights_workspace_[device]) {
     weights_workspace_[device] = make_shared<Workspace>();
   }
+  GPUContextPool::Prewarm(device);
+}
+
+shared_ptr<GPUMemory::Workspace> GPUMemory::thread_workspace(int device) {
+  if (thread_workspace_ && thread_workspace_->device() == device) {
+    return thread_workspace_;
+  }
+  return workspace_[device];
+}
+
+void GPUMemory::own_thread_workspace() {
+  const int device = Caffe::current_device();
+  thread_workspace_ = make_shared<Workspace>();
+  std::lock_guard<std::mutex> lock(ws_mutex_init_);
+  if (device < workspace_.size() && workspace_[device] && workspace_[device]->size() > 0UL) {
+    thread_workspace_->reserve(workspace_[device]->size(), device);
+  }
+}
+
+void GPUMemory::set_thread_workspace(const shared_ptr<Workspace>& workspace) {
+  thread_workspace_ = workspace;
 }
 
 void GPUMemory::Finalize() {
@@ -65,6 +93,7 @@ bool GPUMemory::Workspace::safe_reserve(size_t size, int device) {
   size_t gpu_bytes_left, total_memory;
   GPUMemory::GetInfo(&gpu_bytes_left, &total_memory, true);
   if (size > size_ + align_down<7>(gpu_bytes_left)) {
+    LogOOMReports(device);
     LOG(FATAL) << "Out of memory in safe_reserve: "
         << size << " > " << size_ << " + " << align_down<7>(gpu_bytes_left)
         << " on device " << device;
@@ -91,7 +120,7 @@ bool GPUMemory::Workspace::try_reserve(size_t size, int device) {
   return status;
 }
 
-GPUMemory::Manager::Manager() : debug_(false), initialized_(false) {
+GPUMemory::Manager::Manager() : debug_(false), managed_(false), initialized_(false) {
   int count;
   CUDA_CHECK(cudaGetDeviceCount(&count));
   pinned_host_buffers_.resize(count);
@@ -99,6 +128,8 @@ GPUMemory::Manager::Manager() : debug_(false), initialized_(false) {
   pinned_buffer_sizes_.resize(count);
   dev_info_.resize(count);
   update_thresholds_.resize(count);
+  managed_bytes_.resize(count);
+  peak_bytes_.resize(count);
 }
 
 bool GPUMemory::Manager::resize_buffers(int device, int group) {
@@ -123,7 +154,7 @@ bool GPUMemory::Manager::resize_buffers(int device, int group) {
 void* GPUMemory::thread_pinned_buffer(size_t size, int group) {
   CHECK_GT(size, 0);
   auto host_buffer_cleaner = [&](void* buffer) {
-    shared_lock<shared_mutex> lock(GPUMemory::read_write_mutex());
+    DriverCallScope driver_call;
     CUDA_CHECK(cudaFreeHost(buffer));
   };
   auto device_buffer_cleaner = [&](void* buffer) {};
@@ -138,7 +169,10 @@ void* GPUMemory::thread_pinned_buffer(size_t size, int group) {
   if (size > sizes[group]) {
     void* hptr;
     void* dptr;
-    CUDA_CHECK(cudaHostAlloc(&hptr, size, cudaHostAllocMapped));
+    {
+      DriverCallScope driver_call;
+      CUDA_CHECK(cudaHostAlloc(&hptr, size, cudaHostAllocMapped));
+    }
     CUDA_CHECK(cudaHostGetDevicePointer(&dptr, hptr, 0));
     host_buffers.emplace(std::make_pair(group,
         unique_ptr<void, decltype(host_buffer_cleaner)>(hptr, host_buffer_cleaner)));
@@ -154,8 +188,7 @@ void* GPUMemory::Manager::pinned_buffer(size_t size, int device, int group) {
   size = std::max(size, INITIAL_PINNED_BYTES);
   size_t current_size = pinned_buffer_sizes_[device][group];
   if (size > current_size || resized) {
-    // wait for "writers" like NCCL and potentially others...
-    shared_lock<shared_mutex> lock(GPUMemory::read_write_mutex());
+    DriverCallScope driver_call;
     if (!resized) {
       cudaFreeHost(pinned_host_buffers_[device][group]);
     }
@@ -167,12 +200,35 @@ void* GPUMemory::Manager::pinned_buffer(size_t size, int device, int group) {
   return pinned_device_buffers_[device][group];
 }
 
-void GPUMemory::Manager::init(const vector<int>& gpus, bool debug) {
+void GPUMemory::Manager::init(const vector<int>& gpus, bool debug, const std::string& engine) {
   if (initialized_) {
     return;
   }
   bool debug_env = getenv("DEBUG_GPU_MEM") != 0;
   debug_ = debug || debug_env;
+  const char* engine_env = getenv("CAFFE_GPU_MEM_ENGINE");
+  const std::string mem_engine = !engine.empty() ? engine :
+      (engine_env != nullptr ? std::string(engine_env) : std::string("cub"));
+  CHECK(mem_engine == "cub" || mem_engine == "slab" || mem_engine == "managed")
+      << "Unknown GPU memory allocator engine " << mem_engine;
+  managed_ = mem_engine == "managed";
+  if (managed_) {
+    for (int i = 0; i < gpus.size(); ++i) {
+      int supported = 0;
+      CUDA_CHECK(cudaDeviceGetAttribute(&supported, cudaDevAttrConcurrentManagedAccess, gpus[i]));
+      CHECK(supported) << "Device " << gpus[i] << " doesn't support oversubscription "
+          "of managed memory";
+    }
+    LOG(INFO) << "Using managed GPU memory, device memory may be oversubscribed";
+  }
+  size_t arena_bytes = 0UL;
+  if (mem_engine == "slab") {
+    const char* arena_env = getenv("CAFFE_GPU_MEM_ARENA_MB");
+    const size_t arena_mb = arena_env != nullptr ? std::stoul(arena_env) : DEFAULT_ARENA_MB;
+    arena_bytes = arena_mb << 20;
+    slab_allocator_.reset(new SlabAllocator(arena_bytes, debug_));
+    LOG(INFO) << "Using slab GPU memory allocator, arenas of " << arena_mb << "MB";
+  }
   try {
     // Just in case someone installed 'no cleanup' arena before
     cub_allocator_.reset(new cub::CachingDeviceAllocator(BIN_GROWTH, MIN_BIN, MAX_BIN,
@@ -180,12 +236,39 @@ void GPUMemory::Manager::init(const vector<int>& gpus, bool debug) {
   } catch (...) {
   }
   CHECK(cub_allocator_);
-  for (int i = 0; i < gpus.size(); ++i) {
-    update_dev_info(gpus[i]);
-    update_thresholds_[gpus[i]] = dev_info_[gpus[i]].total_;
+  const int max_device = gpus.empty() ? -1 : *std::max_element(gpus.begin(), gpus.end());
+  if (max_device + 1 > dev_info_.size()) {
+    dev_info_.resize(max_device + 1);
+  }
+  if (max_device + 1 > update_thresholds_.size()) {
+    update_thresholds_.resize(max_device + 1);
+  }
+  // Context creation, the slab arena and the prewarmed streams and handles take a
+  // while per device, and devices don't depend on each other: one thread per device.
+  // Each one writes its own dev_info_ entry only.
+  const auto start = std::chrono::steady_clock::now();
+  vector<std::thread> threads;
+  threads.reserve(gpus.size());
+  for (int device : gpus) {
+    threads.emplace_back([this, device, arena_bytes] {
+      update_dev_info(device);
+      if (slab_allocator_) {
+        CUDA_CHECK(cudaSetDevice(device));
+        CUDA_CHECK(slab_allocator_->Reserve(device, arena_bytes));
+      }
+      GPUContextPool::Prewarm(device);
+    });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  for (int device : gpus) {
+    update_thresholds_[device] = dev_info_[device].total_;
   }
   initialized_ = true;
-  LOG(INFO) << "GPUMemory::Manager initialized";
+  LOG(INFO) << "GPUMemory::Manager initialized " << gpus.size() << " device(s) in "
+      << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+      << "s";
   for (int i = 0; i < gpus.size(); ++i) {
     LOG(INFO) << report_dev_info(gpus[i]);
   }
@@ -196,6 +279,8 @@ void GPUMemory::Manager::reset() {
     return;
   }
   cub_allocator_.reset();
+  slab_allocator_.reset();
+  managed_ = false;
   initialized_ = false;
 }
 
@@ -230,13 +315,36 @@ bool GPUMemory::Manager::try_allocate(void** ptr, shared_ptr<CudaStream>& pstrea
   CHECK_EQ(current_device(), device);
   cudaError_t status = cudaSuccess, last_err = cudaSuccess;
   {
-    // wait for "writers" like NCCL and potentially others
-    shared_lock<shared_mutex> lock(GPUMemory::read_write_mutex());
     pstream = Caffe::thread_pstream(group);
     size_t size_allocated = 0;
-    // Clean Cache & Retry logic is inside now
-    status = cub_allocator_->DeviceAllocate(device, ptr, size, pstream->get(), size_allocated);
+    if (managed_) {
+      // Pages migrate on demand, thus no caching and no device limit here
+      DriverCallScope driver_call;
+      status = cudaMallocManaged(ptr, size, cudaMemAttachGlobal);
+      if (status == cudaSuccess) {
+        std::lock_guard<std::mutex> lock(managed_mutex_);
+        managed_sizes_[*ptr] = size;
+        managed_bytes_[device] += size;
+        std::lock_guard<std::mutex> plock(peak_mutex_);
+        peak_bytes_[device] = std::max(peak_bytes_[device], managed_bytes_[device]);
+      }
+    } else if (slab_allocator_) {
+      // Calls the driver only to reserve an arena, see SlabAllocator::reserve
+      status = slab_allocator_->DeviceAllocate(device, ptr, size, pstream->get(),
+          size_allocated);
+    } else {
+      // Clean Cache & Retry logic is inside now. CUB doesn't tell a cache hit
+      // in advance, thus every call waits for collectives in flight.
+      DriverCallScope driver_call;
+      status = cub_allocator_->DeviceAllocate(device, ptr, size, pstream->get(),
+          size_allocated);
+    }
     if (status == cudaSuccess && device > INVALID_DEVICE) {
+      if (!managed_ && !slab_allocator_) {
+        std::lock_guard<std::mutex> plock(peak_mutex_);
+        peak_bytes_[device] = std::max(peak_bytes_[device],
+            cub_allocator_->cached_bytes[device].live);
+      }
       if (size_allocated > 0) {
         if (dev_info_[device].free_ < update_thresholds_[device]) {
           update_dev_info(device);
@@ -293,9 +401,24 @@ void GPUMemory::Manager::deallocate(void* ptr, int device) {
   // Preventing dead lock while Caffe shutting down.
   if (status != cudaErrorCudartUnloading) {
     size_t size_deallocated = 0;
-    // wait for "writers" like NCCL and potentially others...
-    shared_lock<shared_mutex> lock(GPUMemory::read_write_mutex());
-    CUDA_CHECK(cub_allocator_->DeviceFree(device, ptr, size_deallocated));
+    if (managed_) {
+      std::lock_guard<std::mutex> mlock(managed_mutex_);
+      auto it = managed_sizes_.find(ptr);
+      if (it != managed_sizes_.end()) {
+        managed_bytes_[device] -= it->second;
+        managed_sizes_.erase(it);
+        DriverCallScope driver_call;
+        CUDA_CHECK(cudaFree(ptr));
+        return;
+      }
+    }
+    if (slab_allocator_) {
+      // Blocks go back to their arenas, the driver is not called
+      CUDA_CHECK(slab_allocator_->DeviceFree(device, ptr, size_deallocated));
+    } else {
+      DriverCallScope driver_call;
+      CUDA_CHECK(cub_allocator_->DeviceFree(device, ptr, size_deallocated));
+    }
     if (size_deallocated > 0) {
       dev_info_[device].free_ += size_deallocated;
     }
@@ -321,13 +444,18 @@ void GPUMemory::Manager::update_dev_info(int device) {
 
 std::string GPUMemory::Manager::report_dev_info(int device) {
   cudaDeviceProp props;
-  shared_lock<shared_mutex> lock(GPUMemory::read_write_mutex());
   CUDA_CHECK(cudaGetDeviceProperties(&props, device));
   DevInfo dev_info;
   CUDA_CHECK(cudaMemGetInfo(&dev_info.free_, &dev_info.total_));
   std::ostringstream os;
   os << "Total memory: " << props.totalGlobalMem << ", Free: " << dev_info.free_ << ", dev_info["
      << device << "]: total=" << dev_info_[device].total_ << " free=" << dev_info_[device].free_;
+  if (slab_allocator_) {
+    os << ". " << slab_allocator_->report(device);
+  }
+  if (managed_ && device < managed_bytes_.size()) {
+    os << ". Managed memory in use: " << managed_bytes_[device];
+  }
   return os.str();
 }
 
@@ -340,12 +468,110 @@ void GPUMemory::Manager::GetInfo(size_t* free_mem, size_t* total_mem, bool with_
   }
   *total_mem = dev_info_[cur_device].total_;
   // Free memory is free GPU memory plus free cached memory in the pool.
-  *free_mem = dev_info_[cur_device].free_ + cub_allocator_->cached_bytes[cur_device].free;
+  *free_mem = dev_info_[cur_device].free_ + (slab_allocator_ ?
+      slab_allocator_->free_bytes(cur_device) : cub_allocator_->cached_bytes[cur_device].free);
   if (*free_mem > *total_mem) {  // sanity check
     *free_mem = *total_mem;
   }
 }
 
+size_t GPUMemory::Manager::cached_free_bytes(int device) {
+  if (slab_allocator_) {
+    return slab_allocator_->free_bytes(device);
+  }
+  return managed_ || !cub_allocator_ ? 0UL : cub_allocator_->cached_bytes[device].free;
+}
+
+void GPUMemory::Manager::begin_defragment(int device) {
+  if (!initialized_ || managed_) {
+    return;
+  }
+  CHECK_EQ(current_device(), device);
+  {
+    // Collectives in flight would never finish if their peers wait here
+    DriverCallScope driver_call;
+    CUDA_CHECK(cudaDeviceSynchronize());
+  }
+  if (slab_allocator_) {
+    // Events recorded on free have all completed: streams don't matter any more
+    slab_allocator_->Coalesce(device);
+  }
+}
+
+bool GPUMemory::Manager::relocate(void** ptr, shared_ptr<CudaStream>& pstream, int device) {
+  if (!initialized_ || !slab_allocator_ || *ptr == nullptr) {
+    return false;
+  }
+  CHECK_EQ(current_device(), device);
+  pstream = Caffe::thread_pstream();
+  void* moved = slab_allocator_->Relocate(device, *ptr, pstream->get());
+  if (moved == *ptr) {
+    return false;
+  }
+  *ptr = moved;
+  return true;
+}
+
+size_t GPUMemory::Manager::end_defragment(int device) {
+  if (!initialized_ || managed_) {
+    return 0UL;
+  }
+  CHECK_EQ(current_device(), device);
+  size_t released = 0UL;
+  if (slab_allocator_) {
+    {
+      DriverCallScope driver_call;
+      CUDA_CHECK(cudaDeviceSynchronize());
+    }
+    slab_allocator_->Coalesce(device);
+    released = slab_allocator_->ReleaseFreeArenas(device);
+  } else {
+    // CUB blocks can't move, but cached ones needn't stay: the driver gets them back to
+    // serve larger requests
+    DriverCallScope driver_call;
+    released = cub_allocator_->cached_bytes[device].free;
+    CUDA_CHECK(cub_allocator_->FreeAllCached());
+  }
+  update_dev_info(device);
+  return released;
+}
+
+void GPUMemory::AddOOMReport(const void* owner, int device,
+    const std::function<std::string()>& report) {
+  std::lock_guard<std::mutex> lock(oom_mutex_);
+  oom_reports_[owner] = std::make_pair(device, report);
+}
+
+void GPUMemory::RemoveOOMReport(const void* owner) {
+  std::lock_guard<std::mutex> lock(oom_mutex_);
+  oom_reports_.erase(owner);
+}
+
+void GPUMemory::LogOOMReports(int device) {
+  size_t in_use = 0UL, peak = 0UL;
+  GetUsage(&in_use, &peak, device);
+  LOG(ERROR) << "Out of memory on device " << device << ": " << in_use << " bytes in use, "
+             << peak << " at peak, " << cached_free_bytes(device)
+             << " cached by the allocator and free";
+  std::lock_guard<std::mutex> lock(oom_mutex_);
+  for (const auto& report : oom_reports_) {
+    if (report.second.first == device) {
+      LOG(ERROR) << report.second.second();
+    }
+  }
+}
+
+void GPUMemory::Manager::GetUsage(size_t* in_use, size_t* peak, int device) {
+  if (slab_allocator_) {
+    slab_allocator_->usage(device, in_use, peak);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(peak_mutex_);
+  *in_use = managed_ ? managed_bytes_[device] :
+      (cub_allocator_ ? cub_allocator_->cached_bytes[device].live : 0UL);
+  *peak = peak_bytes_[device];
+}
+
 }  // namespace caffe
 
 #endif  // CPU_ONLY
@@ -0,0 +1,339 @@
+#ifndef CPU_ONLY
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "caffe/util/gpu_memory.hpp"
+#include "caffe/util/gpu_slab_allocator.hpp"
+
+namespace caffe {
+
+constexpr size_t SlabAllocator::MIN_CLASS;
+constexpr size_t SlabAllocator::ARENA_ALIGN;
+
+SlabAllocator::Event::Event() {
+  CUDA_CHECK(cudaEventCreateWithFlags(&event_, cudaEventDisableTiming));
+}
+
+SlabAllocator::Event::~Event() {
+  cudaEventDestroy(event_);
+}
+
+SlabAllocator::SlabAllocator(size_t arena_bytes, bool debug)
+    : arena_bytes_(align_up<21>(std::max(arena_bytes, ARENA_ALIGN))), debug_(debug) {
+  int count;
+  CUDA_CHECK(cudaGetDeviceCount(&count));
+  pools_.resize(count);
+}
+
+SlabAllocator::~SlabAllocator() {
+  int initial_device;
+  if (cudaGetDevice(&initial_device) != cudaSuccess) {
+    return;  // shutting down
+  }
+  for (int device = 0; device < pools_.size(); ++device) {
+    Pool& p = pools_[device];
+    if (p.arenas_.empty()) {
+      continue;
+    }
+    cudaSetDevice(device);
+    for (Block* block : p.free_blocks_) {
+      delete block;
+    }
+    for (auto& used : p.used_blocks_) {
+      delete used.second;
+    }
+    for (Arena& arena : p.arenas_) {
+      cudaFree(arena.base_);
+    }
+  }
+  cudaSetDevice(initial_device);
+}
+
+size_t SlabAllocator::size_class(size_t size) {
+  if (size <= MIN_CLASS) {
+    return MIN_CLASS;
+  }
+  // Four classes per power of two: at most 25% is wasted
+  size_t pow2 = MIN_CLASS;
+  while (pow2 <= size / 2UL) {
+    pow2 *= 2UL;
+  }
+  const size_t step = pow2 / 4UL;
+  return (size + step - 1UL) / step * step;
+}
+
+SlabAllocator::Pool& SlabAllocator::pool(int device) {
+  CHECK_GE(device, 0);
+  if (device + 1 > pools_.size()) {
+    pools_.resize(device + 1);
+  }
+  return pools_[device];
+}
+
+cudaError_t SlabAllocator::Reserve(int device, size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return reserve(device, bytes);
+}
+
+cudaError_t SlabAllocator::reserve(int device, size_t bytes) {
+  Pool& p = pool(device);
+  const size_t arena_size = align_up<21>(std::max(bytes, arena_bytes_));
+  void* base = nullptr;
+  GPUMemory::DriverCallScope driver_call;
+  cudaError_t status = cudaMalloc(&base, arena_size);
+  if (status != cudaSuccess) {
+    return status;
+  }
+  p.arenas_.push_back(Arena{static_cast<char*>(base), arena_size});
+  p.free_blocks_.insert(new Block{static_cast<char*>(base), arena_size, nullptr,
+      shared_ptr<Event>(), true, nullptr, nullptr});
+  p.reserved_ += arena_size;
+  ++p.arena_mallocs_;
+  LOG_IF(INFO, debug_) << "Device " << device << " arena of " << (arena_size >> 20)
+      << "MB reserved, total " << (p.reserved_ >> 20) << "MB";
+  return cudaSuccess;
+}
+
+size_t SlabAllocator::ReleaseFreeArenas(int device) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return release_free_arenas(device);
+}
+
+size_t SlabAllocator::release_free_arenas(int device) {
+  Pool& p = pool(device);
+  size_t released = 0UL;
+  for (auto it = p.free_blocks_.begin(); it != p.free_blocks_.end();) {
+    Block* block = *it;
+    // Single free block spanning the whole arena
+    if (block->prev_ != nullptr || block->next_ != nullptr) {
+      ++it;
+      continue;
+    }
+    auto arena = std::find_if(p.arenas_.begin(), p.arenas_.end(),
+        [block](const Arena& a) { return a.base_ == block->ptr_; });
+    CHECK(arena != p.arenas_.end());
+    CHECK_EQ(arena->size_, block->size_);
+    {
+      GPUMemory::DriverCallScope driver_call;
+      CUDA_CHECK(cudaFree(block->ptr_));  // waits for pending work
+    }
+    p.reserved_ -= block->size_;
+    released += block->size_;
+    p.arenas_.erase(arena);
+    it = p.free_blocks_.erase(it);
+    delete block;
+  }
+  LOG_IF(INFO, debug_ && released > 0UL) << "Device " << device << ": "
+      << (released >> 20) << "MB of free arenas released";
+  return released;
+}
+
+cudaError_t SlabAllocator::DeviceAllocate(int device, void** ptr, size_t size,
+    cudaStream_t stream, size_t& size_allocated) {
+  size_allocated = 0UL;
+  const size_t bytes = size_class(size);
+  std::lock_guard<std::mutex> lock(mutex_);
+  Pool& p = pool(device);
+  Block key{nullptr, bytes, nullptr, shared_ptr<Event>(), true, nullptr, nullptr};
+  auto it = p.free_blocks_.lower_bound(&key);
+  if (it == p.free_blocks_.end()) {
+    cudaError_t status = reserve(device, bytes);
+    if (status != cudaSuccess) {
+      // Give unused arenas back and retry once
+      cudaGetLastError();
+      release_free_arenas(device);
+      status = reserve(device, bytes);
+      if (status != cudaSuccess) {
+        return status;
+      }
+    }
+    size_allocated = p.arenas_.back().size_;
+    it = p.free_blocks_.lower_bound(&key);
+    CHECK(it != p.free_blocks_.end());
+  }
+  Block* block = take(p, it, bytes, stream);
+  p.peak_in_use_ = std::max(p.peak_in_use_, p.in_use_);
+  ++p.allocs_;
+  *ptr = block->ptr_;
+  return cudaSuccess;
+}
+
+SlabAllocator::Block* SlabAllocator::take(Pool& p, std::set<Block*, BySize>::iterator it,
+    size_t bytes, cudaStream_t stream) {
+  Block* block = *it;
+  p.free_blocks_.erase(it);
+  const cudaStream_t freed_stream = block->stream_;
+  shared_ptr<Event> freed = block->freed_;
+  if (freed && freed_stream != stream) {
+    // Stream ordered reuse: wait on device for the last user of the block to finish
+    CUDA_CHECK(cudaStreamWaitEvent(stream, freed->event_, 0));
+  }
+  if (block->size_ - bytes >= MIN_CLASS) {
+    // The rest keeps its stream and event since nobody waited for them yet
+    Block* rest = new Block{block->ptr_ + bytes, block->size_ - bytes, freed_stream, freed,
+        true, block, block->next_};
+    if (block->next_ != nullptr) {
+      block->next_->prev_ = rest;
+    }
+    block->next_ = rest;
+    block->size_ = bytes;
+    p.free_blocks_.insert(rest);
+  }
+  block->stream_ = stream;
+  block->freed_.reset();
+  block->free_ = false;
+  p.used_blocks_.emplace(block->ptr_, block);
+  p.in_use_ += block->size_;
+  return block;
+}
+
+cudaError_t SlabAllocator::DeviceFree(int device, void* ptr, size_t& size_deallocated) {
+  size_deallocated = 0UL;
+  std::lock_guard<std::mutex> lock(mutex_);
+  Pool& p = pool(device);
+  auto it = p.used_blocks_.find(ptr);
+  if (it == p.used_blocks_.end()) {
+    return cudaErrorInvalidDevicePointer;
+  }
+  Block* block = it->second;
+  p.used_blocks_.erase(it);
+  give_back(p, block);
+  return cudaSuccess;
+}
+
+void SlabAllocator::give_back(Pool& p, Block* block) {
+  p.in_use_ -= block->size_;
+  block->freed_ = make_shared<Event>();
+  CUDA_CHECK(cudaEventRecord(block->freed_->event_, block->stream_));
+  block->free_ = true;
+  // Coalescing: the event just recorded covers earlier work of the same stream
+  Block* prev = block->prev_;
+  if (prev != nullptr && prev->free_ && prev->stream_ == block->stream_) {
+    p.free_blocks_.erase(prev);
+    prev->size_ += block->size_;
+    prev->next_ = block->next_;
+    if (block->next_ != nullptr) {
+      block->next_->prev_ = prev;
+    }
+    prev->freed_ = block->freed_;
+    delete block;
+    block = prev;
+  }
+  Block* next = block->next_;
+  if (next != nullptr && next->free_ && next->stream_ == block->stream_) {
+    p.free_blocks_.erase(next);
+    block->size_ += next->size_;
+    block->next_ = next->next_;
+    if (next->next_ != nullptr) {
+      next->next_->prev_ = block;
+    }
+    delete next;
+  }
+  p.free_blocks_.insert(block);
+}
+
+size_t SlabAllocator::Coalesce(int device) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Pool& p = pool(device);
+  // First free block of every run of free neighbours, the others are merged into it
+  vector<Block*> heads;
+  for (Block* block : p.free_blocks_) {
+    if ((block->prev_ == nullptr || !block->prev_->free_) &&
+        block->next_ != nullptr && block->next_->free_) {
+      heads.push_back(block);
+    }
+  }
+  size_t merged = 0UL;
+  for (Block* head : heads) {
+    p.free_blocks_.erase(head);
+    while (head->next_ != nullptr && head->next_->free_) {
+      Block* next = head->next_;
+      p.free_blocks_.erase(next);
+      head->size_ += next->size_;
+      head->next_ = next->next_;
+      if (next->next_ != nullptr) {
+        next->next_->prev_ = head;
+      }
+      delete next;
+      ++merged;
+    }
+    p.free_blocks_.insert(head);
+  }
+  return merged;
+}
+
+void* SlabAllocator::Relocate(int device, void* ptr, cudaStream_t stream) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Pool& p = pool(device);
+  auto used = p.used_blocks_.find(ptr);
+  CHECK(used != p.used_blocks_.end()) << "Unknown block " << ptr << " on device " << device;
+  Block* block = used->second;
+  const size_t bytes = block->size_;
+  // Lowest free space that fits: earlier arenas first, then lower addresses. Arenas
+  // reserved last are emptied that way and go back to the device.
+  std::pair<size_t, const char*> best_position(arena_index(p, block->ptr_), block->ptr_);
+  auto best = p.free_blocks_.end();
+  Block key{nullptr, bytes, nullptr, shared_ptr<Event>(), true, nullptr, nullptr};
+  for (auto it = p.free_blocks_.lower_bound(&key); it != p.free_blocks_.end(); ++it) {
+    const std::pair<size_t, const char*> position(arena_index(p, (*it)->ptr_), (*it)->ptr_);
+    if (position < best_position) {
+      best_position = position;
+      best = it;
+    }
+  }
+  if (best == p.free_blocks_.end()) {
+    return ptr;
+  }
+  Block* moved = take(p, best, bytes, stream);
+  CUDA_CHECK(cudaMemcpyAsync(moved->ptr_, block->ptr_, bytes, cudaMemcpyDeviceToDevice,
+      stream));
+  p.used_blocks_.erase(used);
+  // Freed after the copy
+  block->stream_ = stream;
+  give_back(p, block);
+  return moved->ptr_;
+}
+
+size_t SlabAllocator::arena_index(const Pool& p, const char* ptr) {
+  for (size_t i = 0; i < p.arenas_.size(); ++i) {
+    if (ptr >= p.arenas_[i].base_ && ptr < p.arenas_[i].base_ + p.arenas_[i].size_) {
+      return i;
+    }
+  }
+  LOG(FATAL) << "Pointer " << static_cast<const void*>(ptr) << " is in no arena";
+  return p.arenas_.size();
+}
+
+size_t SlabAllocator::free_bytes(int device) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const Pool& p = pool(device);
+  return p.reserved_ - p.in_use_;
+}
+
+void SlabAllocator::usage(int device, size_t* in_use, size_t* peak) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const Pool& p = pool(device);
+  *in_use = p.in_use_;
+  *peak = p.peak_in_use_;
+}
+
+std::string SlabAllocator::report(int device) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const Pool& p = pool(device);
+  const size_t free = p.reserved_ - p.in_use_;
+  const size_t largest = p.free_blocks_.empty() ? 0UL : (*p.free_blocks_.rbegin())->size_;
+  std::ostringstream os;
+  os << "Slab allocator: reserved=" << p.reserved_ << " in " << p.arenas_.size()
+     << " arenas, in use=" << p.in_use_ << " peak=" << p.peak_in_use_
+     << ", free blocks=" << p.free_blocks_.size() << " largest=" << largest
+     << " fragmentation=" << (free > 0UL ? 100. * (free - largest) / free : 0.) << "%"
+     << ", allocations=" << p.allocs_ << " arena mallocs=" << p.arena_mallocs_;
+  return os.str();
+}
+
+}  // namespace caffe
+
+#endif  // CPU_ONLY
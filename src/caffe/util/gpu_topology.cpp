@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <utility>
+
+#include "caffe/util/gpu_topology.hpp"
+
+namespace caffe {
+
+namespace {
+
+// Slowest link first, then all of them
+std::pair<int, long> ring_cost(const vector<vector<int>>& cost,  // NOLINT(runtime/int)
+    const vector<int>& ring) {
+  int slowest = std::numeric_limits<int>::min();
+  long sum = 0L;  // NOLINT(runtime/int)
+  for (size_t i = 0; i < ring.size(); ++i) {
+    const int c = cost[ring[i]][ring[(i + 1) % ring.size()]];
+    slowest = std::max(slowest, c);
+    sum += c;
+  }
+  return std::make_pair(slowest, sum);
+}
+
+}  // namespace
+
+vector<int> ring_order(const vector<vector<int>>& cost) {
+  const int n = cost.size();
+  vector<int> ring(n);
+  for (int i = 0; i < n; ++i) {
+    ring[i] = i;
+  }
+  if (n <= 3) {
+    return ring;  // every ring is the same one
+  }
+  if (n <= 9) {
+    vector<int> best = ring;
+    auto best_cost = ring_cost(cost, ring);
+    while (std::next_permutation(ring.begin() + 1, ring.end())) {
+      const auto c = ring_cost(cost, ring);
+      if (c < best_cost) {
+        best_cost = c;
+        best = ring;
+      }
+    }
+    return best;
+  }
+  vector<bool> used(n, false);
+  used[0] = true;
+  for (int i = 1; i < n; ++i) {
+    int next = -1;
+    for (int j = 0; j < n; ++j) {
+      if (!used[j] && (next < 0 || cost[ring[i - 1]][j] < cost[ring[i - 1]][next])) {
+        next = j;
+      }
+    }
+    ring[i] = next;
+    used[next] = true;
+  }
+  return ring;
+}
+
+#ifndef CPU_ONLY
+
+namespace {
+
+// No peer access: copies are staged through host memory
+constexpr int NO_PEER_COST = 100;
+// Below any NVML topology level (0 means same board)
+constexpr int UNKNOWN_LEVEL_COST = 60;
+
+std::string link_name(int cost) {
+  if (cost >= NO_PEER_COST) {
+    return "no peer access, " + link_name(cost - NO_PEER_COST);
+  }
+  if (cost < 0) {
+    return std::to_string(-cost) + " NVLink(s)";
+  }
+  switch (cost) {
+    case 0: return "same board";
+    case 10: return "single PCIe switch";
+    case 20: return "multiple PCIe switches";
+    case 30: return "PCIe host bridge";
+    case 40: return "same CPU socket";
+    case 50: return "across CPU sockets";
+    default: return "unknown";
+  }
+}
+
+// GB/s of device to device copies
+float copy_bandwidth(int from, int to, bool peer) {
+  const size_t size = 32UL << 20;
+  const int repeat = 4;
+  int current = 0;
+  CUDA_CHECK(cudaGetDevice(&current));
+  void* src = nullptr;
+  void* dst = nullptr;
+  CUDA_CHECK(cudaSetDevice(to));
+  CUDA_CHECK(cudaMalloc(&dst, size));
+  CUDA_CHECK(cudaSetDevice(from));
+  CUDA_CHECK(cudaMalloc(&src, size));
+  bool enabled = false;
+  if (peer) {
+    const cudaError_t status = cudaDeviceEnablePeerAccess(to, 0);
+    enabled = status == cudaSuccess;
+    if (!enabled) {
+      cudaGetLastError();  // already enabled
+    }
+  }
+  cudaStream_t stream;
+  cudaEvent_t start, stop;
+  CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+  CUDA_CHECK(cudaEventCreate(&start));
+  CUDA_CHECK(cudaEventCreate(&stop));
+  CUDA_CHECK(cudaMemcpyPeerAsync(dst, to, src, from, size, stream));  // warm up
+  CUDA_CHECK(cudaEventRecord(start, stream));
+  for (int i = 0; i < repeat; ++i) {
+    CUDA_CHECK(cudaMemcpyPeerAsync(dst, to, src, from, size, stream));
+  }
+  CUDA_CHECK(cudaEventRecord(stop, stream));
+  CUDA_CHECK(cudaEventSynchronize(stop));
+  float ms = 0.F;
+  CUDA_CHECK(cudaEventElapsedTime(&ms, start, stop));
+  CUDA_CHECK(cudaEventDestroy(start));
+  CUDA_CHECK(cudaEventDestroy(stop));
+  CUDA_CHECK(cudaStreamDestroy(stream));
+  if (enabled) {
+    CUDA_CHECK(cudaDeviceDisablePeerAccess(to));  // NCCL manages it later
+  }
+  CUDA_CHECK(cudaFree(src));
+  CUDA_CHECK(cudaSetDevice(to));
+  CUDA_CHECK(cudaFree(dst));
+  CUDA_CHECK(cudaSetDevice(current));
+  return ms > 0.F ? repeat * size / (ms * 1.e6F) : 0.F;
+}
+
+}  // namespace
+
+vector<vector<int>> gpu_link_costs(const vector<int>& gpus) {
+  const int n = gpus.size();
+  vector<vector<int>> cost(n, vector<int>(n, 0));
+#ifndef NO_NVML
+  const bool nvml = nvmlInit() == NVML_SUCCESS;
+  vector<nvmlDevice_t> devices(n, nullptr);
+  vector<nvmlPciInfo_t> pci(n);
+  for (int i = 0; nvml && i < n; ++i) {
+    char bus_id[32];
+    if (cudaDeviceGetPCIBusId(bus_id, sizeof(bus_id), gpus[i]) != cudaSuccess ||
+        nvmlDeviceGetHandleByPciBusId(bus_id, &devices[i]) != NVML_SUCCESS ||
+        nvmlDeviceGetPciInfo(devices[i], &pci[i]) != NVML_SUCCESS) {
+      devices[i] = nullptr;
+    }
+  }
+#endif
+  for (int i = 0; i < n; ++i) {
+    for (int j = i + 1; j < n; ++j) {
+      int c = UNKNOWN_LEVEL_COST;
+#ifndef NO_NVML
+      nvmlGpuTopologyLevel_t level;
+      if (devices[i] != nullptr && devices[j] != nullptr &&
+          nvmlDeviceGetTopologyCommonAncestor(devices[i], devices[j], &level) == NVML_SUCCESS) {
+        c = static_cast<int>(level);
+      }
+#ifdef NVML_NVLINK_MAX_LINKS
+      int links = 0;
+      for (unsigned int l = 0; devices[i] != nullptr && devices[j] != nullptr &&
+          l < NVML_NVLINK_MAX_LINKS; ++l) {
+        nvmlEnableState_t active;
+        nvmlPciInfo_t remote;
+        if (nvmlDeviceGetNvLinkState(devices[i], l, &active) == NVML_SUCCESS &&
+            active == NVML_FEATURE_ENABLED &&
+            nvmlDeviceGetNvLinkRemotePciInfo(devices[i], l, &remote) == NVML_SUCCESS &&
+            strncmp(remote.busId, pci[j].busId, sizeof(remote.busId)) == 0) {
+          ++links;
+        }
+      }
+      if (links > 0) {
+        c = -links;
+      }
+#endif
+#endif
+      int peer = 0;
+      CUDA_CHECK(cudaDeviceCanAccessPeer(&peer, gpus[i], gpus[j]));
+      if (peer == 0) {
+        c += NO_PEER_COST;
+      }
+      cost[i][j] = cost[j][i] = c;
+    }
+  }
+#ifndef NO_NVML
+  if (nvml) {
+    nvmlShutdown();
+  }
+#endif
+  return cost;
+}
+
+vector<int> order_gpu_ring(const vector<int>& gpus) {
+  const vector<vector<int>> cost = gpu_link_costs(gpus);
+  const vector<int> ring = ring_order(cost);
+  vector<int> ordered;
+  for (int i : ring) {
+    ordered.push_back(gpus[i]);
+  }
+  const int links = ring.size() > 2 ? ring.size() : ring.size() - 1;
+  for (int k = 0; k < links; ++k) {
+    const int a = ring[k], b = ring[(k + 1) % ring.size()];
+    const int c = cost[a][b];
+    LOG(INFO) << "GPU ring link " << gpus[a] << " -> " << gpus[b] << ": " << link_name(c)
+              << ", " << copy_bandwidth(gpus[a], gpus[b], c < NO_PEER_COST) << " GB/s";
+    LOG_IF(WARNING, c >= NO_PEER_COST) << "GPUs " << gpus[a] << " and " << gpus[b]
+        << " can't access each other's memory, their reduction goes through the host";
+  }
+  return ordered;
+}
+
+#endif  // CPU_ONLY
+
+}  // namespace caffe
@@ -0,0 +1,259 @@
+#include <device_launch_parameters.h>
+
+#include "caffe/util/grouped_conv.hpp"
+#include "caffe/util/im2col.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
+
+namespace caffe {
+
+// Threads of a backward filter block, each block reduces one weight
+#define GROUPED_CONV_FILTER_THREADS 256
+
+template <typename T, typename A>
+__global__ void GroupedConvForward(int count, GroupedConvShape s, const T* input,
+    const T* weight, const T* bias, T* output) {
+  const int cg = s.channels / s.group;
+  const int mg = s.num_output / s.group;
+  const int kernel_dim = cg * s.kernel_h * s.kernel_w;
+  CUDA_KERNEL_LOOP(index, count) {
+    const int ow = index % s.width_out;
+    int t = index / s.width_out;
+    const int oh = t % s.height_out;
+    t /= s.height_out;
+    const int m = t % s.num_output;
+    const int n = t / s.num_output;
+    const int g = m / mg;
+    A sum = bias == nullptr ? A(0) : mt_load<A>(bias[m]);
+    const T* w = weight + m * kernel_dim;
+    for (int c = 0; c < cg; ++c) {
+      const T* in = input + ((n * s.channels + g * cg + c) * s.height) * s.width;
+      for (int kh = 0; kh < s.kernel_h; ++kh) {
+        const int ih = oh * s.stride_h - s.pad_h + kh * s.dilation_h;
+        if (ih < 0 || ih >= s.height) {
+          continue;
+        }
+        for (int kw = 0; kw < s.kernel_w; ++kw) {
+          const int iw = ow * s.stride_w - s.pad_w + kw * s.dilation_w;
+          if (iw >= 0 && iw < s.width) {
+            sum += mt_load<A>(in[ih * s.width + iw]) *
+                mt_load<A>(w[(c * s.kernel_h + kh) * s.kernel_w + kw]);
+          }
+        }
+      }
+    }
+    output[index] = mt_store<T>(sum);
+  }
+}
+
+template <typename T, typename A>
+__global__ void GroupedConvBackwardData(int count, GroupedConvShape s, const T* output_diff,
+    const T* weight, T* input_diff) {
+  const int cg = s.channels / s.group;
+  const int mg = s.num_output / s.group;
+  const int out_dim = s.height_out * s.width_out;
+  CUDA_KERNEL_LOOP(index, count) {
+    const int iw = index % s.width;
+    int t = index / s.width;
+    const int ih = t % s.height;
+    t /= s.height;
+    const int c = t % s.channels;
+    const int n = t / s.channels;
+    const int g = c / cg;
+    A sum = A(0);
+    for (int j = 0; j < mg; ++j) {
+      const int m = g * mg + j;
+      const T* w = weight + (m * cg + c % cg) * s.kernel_h * s.kernel_w;
+      const T* out = output_diff + (n * s.num_output + m) * out_dim;
+      for (int kh = 0; kh < s.kernel_h; ++kh) {
+        const int th = ih + s.pad_h - kh * s.dilation_h;
+        if (th < 0 || th % s.stride_h != 0 || th / s.stride_h >= s.height_out) {
+          continue;
+        }
+        const int oh = th / s.stride_h;
+        for (int kw = 0; kw < s.kernel_w; ++kw) {
+          const int tw = iw + s.pad_w - kw * s.dilation_w;
+          if (tw >= 0 && tw % s.stride_w == 0 && tw / s.stride_w < s.width_out) {
+            sum += mt_load<A>(out[oh * s.width_out + tw / s.stride_w]) *
+                mt_load<A>(w[kh * s.kernel_w + kw]);
+          }
+        }
+      }
+    }
+    input_diff[index] = mt_store<T>(sum);
+  }
+}
+
+// One block per weight, reducing over images and output positions
+template <typename T, typename A>
+__global__ void GroupedConvBackwardFilter(GroupedConvShape s, const T* input,
+    const T* output_diff, T* weight_diff) {
+  __shared__ A partial[GROUPED_CONV_FILTER_THREADS];
+  const int cg = s.channels / s.group;
+  const int mg = s.num_output / s.group;
+  const int kw = blockIdx.x % s.kernel_w;
+  int t = blockIdx.x / s.kernel_w;
+  const int kh = t % s.kernel_h;
+  t /= s.kernel_h;
+  const int c = t % cg;
+  const int m = t / cg;
+  const int in_c = (m / mg) * cg + c;
+  const int out_dim = s.height_out * s.width_out;
+  A sum = A(0);
+  for (int k = threadIdx.x; k < s.num * out_dim; k += blockDim.x) {
+    const int n = k / out_dim;
+    const int oh = (k % out_dim) / s.width_out;
+    const int ow = k % s.width_out;
+    const int ih = oh * s.stride_h - s.pad_h + kh * s.dilation_h;
+    const int iw = ow * s.stride_w - s.pad_w + kw * s.dilation_w;
+    if (ih >= 0 && ih < s.height && iw >= 0 && iw < s.width) {
+      sum += mt_load<A>(input[((n * s.channels + in_c) * s.height + ih) * s.width + iw]) *
+          mt_load<A>(output_diff[(n * s.num_output + m) * out_dim + k % out_dim]);
+    }
+  }
+  partial[threadIdx.x] = sum;
+  __syncthreads();
+  for (int stride = blockDim.x / 2; stride > 0; stride /= 2) {
+    if (threadIdx.x < stride) {
+      partial[threadIdx.x] += partial[threadIdx.x + stride];
+    }
+    __syncthreads();
+  }
+  if (threadIdx.x == 0) {
+    weight_diff[blockIdx.x] = mt_store<T>(mt_load<A>(weight_diff[blockIdx.x]) + partial[0]);
+  }
+}
+
+template <typename T, typename A>
+__global__ void ConvBiasForward(int count, int spatial, int channels, const T* bias,
+    T* output) {
+  CUDA_KERNEL_LOOP(index, count) {
+    output[index] = mt_store<T>(mt_load<A>(output[index]) +
+        mt_load<A>(bias[(index / spatial) % channels]));
+  }
+}
+
+template <typename Dtype>
+void grouped_conv_forward_gpu(const GroupedConvShape& s, const Dtype* input,
+    const Dtype* weight, const Dtype* bias, Dtype* output) {
+  typedef typename MultiTensorType<Dtype>::type T;
+  typedef typename MultiTensorAcc<Dtype>::type A;
+  const int count = s.num * s.num_output * s.height_out * s.width_out;
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  GroupedConvForward<T, A><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      count, s, reinterpret_cast<const T*>(input), reinterpret_cast<const T*>(weight),
+      reinterpret_cast<const T*>(bias), reinterpret_cast<T*>(output));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template <typename Dtype>
+void grouped_conv_backward_data_gpu(const GroupedConvShape& s, const Dtype* output_diff,
+    const Dtype* weight, Dtype* input_diff) {
+  typedef typename MultiTensorType<Dtype>::type T;
+  typedef typename MultiTensorAcc<Dtype>::type A;
+  const int count = s.num * s.channels * s.height * s.width;
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  GroupedConvBackwardData<T, A><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0,
+      stream>>>(count, s, reinterpret_cast<const T*>(output_diff),
+      reinterpret_cast<const T*>(weight), reinterpret_cast<T*>(input_diff));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template <typename Dtype>
+void grouped_conv_backward_filter_gpu(const GroupedConvShape& s, const Dtype* input,
+    const Dtype* output_diff, Dtype* weight_diff) {
+  typedef typename MultiTensorType<Dtype>::type T;
+  typedef typename MultiTensorAcc<Dtype>::type A;
+  const int weights = s.num_output * (s.channels / s.group) * s.kernel_h * s.kernel_w;
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  GroupedConvBackwardFilter<T, A><<<weights, GROUPED_CONV_FILTER_THREADS, 0, stream>>>(
+      s, reinterpret_cast<const T*>(input), reinterpret_cast<const T*>(output_diff),
+      reinterpret_cast<T*>(weight_diff));
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template <typename Dtype>
+void grouped_gemm_conv_forward_gpu(const GroupedConvShape& s, const Dtype* input,
+    const Dtype* weight, const Dtype* bias, Dtype* output, Dtype* col) {
+  const int mg = s.num_output / s.group;
+  const int kernel_dim = s.channels / s.group * s.kernel_h * s.kernel_w;
+  const int out_dim = s.height_out * s.width_out;
+  for (int n = 0; n < s.num; ++n) {
+    im2col_gpu(input + n * s.channels * s.height * s.width, s.channels, s.height, s.width,
+        s.kernel_h, s.kernel_w, s.pad_h, s.pad_w, s.stride_h, s.stride_w, s.dilation_h,
+        s.dilation_w, col);
+    caffe_gpu_gemm_strided_batched<Dtype>(CblasNoTrans, CblasNoTrans, mg, out_dim,
+        kernel_dim, Dtype(1.F), weight, mg * kernel_dim, col, kernel_dim * out_dim, Dtype(0.F),
+        output + n * s.num_output * out_dim, mg * out_dim, s.group);
+  }
+  if (bias != nullptr) {
+    typedef typename MultiTensorType<Dtype>::type T;
+    typedef typename MultiTensorAcc<Dtype>::type A;
+    const int count = s.num * s.num_output * out_dim;
+    cudaStream_t stream = Caffe::thread_stream();
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    ConvBiasForward<T, A><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        count, out_dim, s.num_output, reinterpret_cast<const T*>(bias),
+        reinterpret_cast<T*>(output));
+    CUDA_POST_KERNEL_CHECK;
+    CUDA_CHECK(caffe_gpu_sync(stream));
+  }
+}
+
+template <typename Dtype>
+void grouped_gemm_conv_backward_data_gpu(const GroupedConvShape& s, const Dtype* output_diff,
+    const Dtype* weight, Dtype* input_diff, Dtype* col) {
+  const int mg = s.num_output / s.group;
+  const int kernel_dim = s.channels / s.group * s.kernel_h * s.kernel_w;
+  const int out_dim = s.height_out * s.width_out;
+  for (int n = 0; n < s.num; ++n) {
+    caffe_gpu_gemm_strided_batched<Dtype>(CblasTrans, CblasNoTrans, kernel_dim, out_dim, mg,
+        Dtype(1.F), weight, mg * kernel_dim, output_diff + n * s.num_output * out_dim,
+        mg * out_dim, Dtype(0.F), col, kernel_dim * out_dim, s.group);
+    col2im_gpu(col, s.channels, s.height, s.width, s.kernel_h, s.kernel_w, s.pad_h, s.pad_w,
+        s.stride_h, s.stride_w, s.dilation_h, s.dilation_w,
+        input_diff + n * s.channels * s.height * s.width);
+  }
+}
+
+template <typename Dtype>
+void grouped_gemm_conv_backward_filter_gpu(const GroupedConvShape& s, const Dtype* input,
+    const Dtype* output_diff, Dtype* weight_diff, Dtype* col) {
+  const int mg = s.num_output / s.group;
+  const int kernel_dim = s.channels / s.group * s.kernel_h * s.kernel_w;
+  const int out_dim = s.height_out * s.width_out;
+  for (int n = 0; n < s.num; ++n) {
+    im2col_gpu(input + n * s.channels * s.height * s.width, s.channels, s.height, s.width,
+        s.kernel_h, s.kernel_w, s.pad_h, s.pad_w, s.stride_h, s.stride_w, s.dilation_h,
+        s.dilation_w, col);
+    caffe_gpu_gemm_strided_batched<Dtype>(CblasNoTrans, CblasTrans, mg, kernel_dim, out_dim,
+        Dtype(1.F), output_diff + n * s.num_output * out_dim, mg * out_dim, col,
+        kernel_dim * out_dim, Dtype(1.F), weight_diff, mg * kernel_dim, s.group);
+  }
+}
+
+#define INSTANTIATE_GROUPED_CONV(Dtype) \
+template void grouped_conv_forward_gpu<Dtype>(const GroupedConvShape&, const Dtype*, \
+    const Dtype*, const Dtype*, Dtype*); \
+template void grouped_conv_backward_data_gpu<Dtype>(const GroupedConvShape&, \
+    const Dtype*, const Dtype*, Dtype*); \
+template void grouped_conv_backward_filter_gpu<Dtype>(const GroupedConvShape&, \
+    const Dtype*, const Dtype*, Dtype*); \
+template void grouped_gemm_conv_forward_gpu<Dtype>(const GroupedConvShape&, const Dtype*, \
+    const Dtype*, const Dtype*, Dtype*, Dtype*); \
+template void grouped_gemm_conv_backward_data_gpu<Dtype>(const GroupedConvShape&, \
+    const Dtype*, const Dtype*, Dtype*, Dtype*); \
+template void grouped_gemm_conv_backward_filter_gpu<Dtype>(const GroupedConvShape&, \
+    const Dtype*, const Dtype*, Dtype*, Dtype*)
+
+INSTANTIATE_GROUPED_CONV(float);
+INSTANTIATE_GROUPED_CONV(double);
+INSTANTIATE_GROUPED_CONV(float16);
+
+}  // namespace caffe
@@ -1,15 +1,14 @@
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/math_functions.hpp"
 
+#include <climits>
 #include <string>
 #include <vector>
 
 namespace caffe {
 
-// Verifies format of data stored in HDF5 file and reshapes blob accordingly.
-void hdf5_load_nd_dataset_helper(
-    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
-    Blob* blob) {
+std::vector<hsize_t> hdf5_get_nd_dataset_dims(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim) {
   // Verify that the dataset exists.
   CHECK(H5LTfind_dataset(file_id, dataset_name_))
       << "Failed to find HDF5 dataset " << dataset_name_;
@@ -55,7 +54,15 @@ void hdf5_load_nd_dataset_helper(
   default:
     LOG(FATAL) << "Datatype class unknown";
   }
+  return dims;
+}
 
+// Verifies format of data stored in HDF5 file and reshapes blob accordingly.
+void hdf5_load_nd_dataset_helper(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+    Blob* blob) {
+  std::vector<hsize_t> dims =
+      hdf5_get_nd_dataset_dims(file_id, dataset_name_, min_dim, max_dim);
   vector<int> blob_dims(dims.size());
   for (int i = 0; i < dims.size(); ++i) {
     blob_dims[i] = dims[i];
@@ -94,6 +101,53 @@ void hdf5_load_nd_dataset(hid_t file_id, const char* dataset_name_,
   CHECK_GE(status, 0) << "Failed to read dataset " << dataset_name_;
 }
 
+void hdf5_load_nd_dataset_rows(hid_t file_id, const char* dataset_name_,
+    hsize_t first, hsize_t rows, Blob* blob) {
+  std::vector<hsize_t> dims =
+      hdf5_get_nd_dataset_dims(file_id, dataset_name_, 1, INT_MAX);
+  CHECK_LE(first + rows, dims[0]) << "Rows out of range of " << dataset_name_;
+  std::vector<hsize_t> start(dims.size(), 0), count(dims);
+  start[0] = first;
+  count[0] = rows;
+  vector<int> blob_dims(count.begin(), count.end());
+  blob->Reshape(blob_dims);
+  hid_t dataset = H5Dopen2(file_id, dataset_name_, H5P_DEFAULT);
+  CHECK_GE(dataset, 0) << "Failed to open dataset " << dataset_name_;
+  hid_t file_space = H5Dget_space(dataset);
+  herr_t status = H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start.data(),
+      NULL, count.data(), NULL);
+  CHECK_GE(status, 0) << "Failed to select rows of " << dataset_name_;
+  hid_t mem_space = H5Screate_simple(count.size(), count.data(), NULL);
+  status = -1;
+  if (is_type<float>(blob->data_type())) {
+    status = H5Dread(dataset, H5T_NATIVE_FLOAT, mem_space, file_space,
+        H5P_DEFAULT, blob->mutable_cpu_data<float>());
+  } else if (is_type<double>(blob->data_type())) {
+    status = H5Dread(dataset, H5T_NATIVE_DOUBLE, mem_space, file_space,
+        H5P_DEFAULT, blob->mutable_cpu_data<double>());
+  }
+#ifndef CPU_ONLY
+  else if (is_type<float16>(blob->data_type())) {
+    const int count = blob->count();
+    std::vector<float> buf(count);
+    status = H5Dread(dataset, H5T_NATIVE_FLOAT, mem_space, file_space,
+        H5P_DEFAULT, &buf.front());
+    if (status >= 0) {
+      caffe_cpu_convert<float, float16>(count, &buf.front(),
+          blob->mutable_cpu_data<float16>());
+    }
+  }
+#endif
+  // NOLINT_NEXT_LINE(readability/braces)
+  else {
+    LOG(FATAL) << "Unsupported data type: " << Type_Name(blob->data_type());
+  }
+  CHECK_GE(status, 0) << "Failed to read rows of dataset " << dataset_name_;
+  H5Sclose(mem_space);
+  H5Sclose(file_space);
+  H5Dclose(dataset);
+}
+
 
 void hdf5_save_nd_dataset(hid_t file_id, const string& dataset_name,
     const Blob& blob, bool write_diff) {
@@ -135,6 +189,86 @@ void hdf5_save_nd_dataset(hid_t file_id, const string& dataset_name,
   CHECK_GE(status, 0) << "Failed to write dataset " << dataset_name;
 }
 
+void hdf5_append_nd_dataset(hid_t file_id, const string& dataset_name,
+    const Blob& blob, hsize_t chunk_rows, int compression) {
+  CHECK_GT(blob.num_axes(), 0) << "Can't append rows of a scalar to " << dataset_name;
+  CHECK_GT(chunk_rows, 0);
+  const int num_axes = blob.num_axes();
+  std::vector<hsize_t> dims(num_axes), rows(num_axes);
+  for (int i = 0; i < num_axes; ++i) {
+    rows[i] = blob.shape(i);
+  }
+  const void* data = nullptr;
+  std::vector<float> buf;
+  hid_t mem_type = H5T_NATIVE_FLOAT;
+  if (is_type<float>(blob.data_type())) {
+    data = blob.cpu_data<float>();
+  } else if (is_type<double>(blob.data_type())) {
+    data = blob.cpu_data<double>();
+    mem_type = H5T_NATIVE_DOUBLE;
+  }
+#ifndef CPU_ONLY
+  else if (is_type<float16>(blob.data_type())) {
+    buf.resize(blob.count());
+    caffe_cpu_convert(blob.count(), blob.cpu_data<float16>(), &buf.front());
+    data = &buf.front();
+  }
+#endif
+  // NOLINT_NEXT_LINE(readability/braces)
+  else {
+    LOG(FATAL) << "Unsupported data type: " << Type_Name(blob.data_type());
+  }
+  hid_t dataset;
+  if (!H5LTfind_dataset(file_id, dataset_name.c_str())) {
+    std::vector<hsize_t> max_dims(rows), chunk(rows);
+    dims = rows;
+    dims[0] = 0;
+    max_dims[0] = H5S_UNLIMITED;
+    chunk[0] = chunk_rows;
+    hid_t space = H5Screate_simple(num_axes, dims.data(), max_dims.data());
+    hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+    CHECK_GE(H5Pset_chunk(plist, num_axes, chunk.data()), 0);
+    if (compression > 0) {
+      CHECK_GE(H5Pset_deflate(plist, compression), 0);
+    }
+    dataset = H5Dcreate2(file_id, dataset_name.c_str(), mem_type, space,
+        H5P_DEFAULT, plist, H5P_DEFAULT);
+    H5Pclose(plist);
+    H5Sclose(space);
+  } else {
+    dataset = H5Dopen2(file_id, dataset_name.c_str(), H5P_DEFAULT);
+    hid_t space = H5Dget_space(dataset);
+    CHECK_EQ(H5Sget_simple_extent_ndims(space), num_axes)
+        << "Appending rows of another shape to " << dataset_name;
+    H5Sget_simple_extent_dims(space, dims.data(), NULL);
+    H5Sclose(space);
+    for (int i = 1; i < num_axes; ++i) {
+      CHECK_EQ(dims[i], rows[i]) << "Appending rows of another shape to " << dataset_name;
+    }
+  }
+  CHECK_GE(dataset, 0) << "Failed to open dataset " << dataset_name;
+  std::vector<hsize_t> start(num_axes, 0), extent(dims);
+  start[0] = dims[0];
+  extent[0] += rows[0];
+  herr_t status = H5Dset_extent(dataset, extent.data());
+  CHECK_GE(status, 0) << "Failed to extend dataset " << dataset_name;
+  hid_t file_space = H5Dget_space(dataset);
+  status = H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start.data(),
+      NULL, rows.data(), NULL);
+  CHECK_GE(status, 0) << "Failed to select rows of " << dataset_name;
+  hid_t mem_space = H5Screate_simple(num_axes, rows.data(), NULL);
+  status = H5Dwrite(dataset, mem_type, mem_space, file_space, H5P_DEFAULT, data);
+  CHECK_GE(status, 0) << "Failed to append rows to dataset " << dataset_name;
+  H5Sclose(mem_space);
+  H5Sclose(file_space);
+  H5Dclose(dataset);
+}
+
+std::mutex& hdf5_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
 string hdf5_load_string(hid_t loc_id, const string& dataset_name) {
   // Get size of dataset
   size_t size;
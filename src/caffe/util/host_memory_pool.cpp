@@ -0,0 +1,156 @@
+#ifndef CPU_ONLY
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "caffe/util/gpu_memory.hpp"
+#include "caffe/util/host_memory_pool.hpp"
+#include "caffe/util/task_scheduler.hpp"
+
+namespace caffe {
+
+constexpr size_t HostMemoryPool::MIN_CLASS;
+constexpr size_t HostMemoryPool::DEFAULT_LIMIT_MB;
+std::mutex HostMemoryPool::mutex_;
+std::map<std::pair<int, size_t>, std::vector<void*>> HostMemoryPool::free_;
+std::unordered_map<void*, int> HostMemoryPool::used_;
+HostMemoryPool::Stats HostMemoryPool::stats_ = {};
+
+size_t HostMemoryPool::size_class(size_t size) {
+  if (size <= MIN_CLASS) {
+    return MIN_CLASS;
+  }
+  size_t pow2 = MIN_CLASS;
+  while (pow2 <= size / 2UL) {
+    pow2 *= 2UL;
+  }
+  const size_t step = pow2 / 4UL;
+  return (size + step - 1UL) / step * step;
+}
+
+size_t HostMemoryPool::limit() {
+  static const size_t limit_bytes = [] {
+    const char* env = getenv("CAFFE_HOST_POOL_MB");
+    return (env != nullptr ? std::stoul(env) : DEFAULT_LIMIT_MB) << 20;
+  }();
+  return limit_bytes;
+}
+
+// Called under mutex_, nodes of CPUs are looked up once
+int HostMemoryPool::current_node() {
+#ifdef __linux__
+  static std::unordered_map<int, int> cpu_nodes;
+  const int cpu = sched_getcpu();
+  if (cpu < 0) {
+    return 0;
+  }
+  auto it = cpu_nodes.find(cpu);
+  if (it == cpu_nodes.end()) {
+    it = cpu_nodes.emplace(cpu, cpu_numa_node(cpu)).first;
+  }
+  return it->second;
+#else
+  return 0;
+#endif
+}
+
+void HostMemoryPool::Use(void* ptr, int node, size_t bytes) {
+  used_[ptr] = node;
+  stats_.used_bytes += bytes;
+  stats_.peak_used_bytes = std::max(stats_.peak_used_bytes, stats_.used_bytes);
+}
+
+void* HostMemoryPool::Allocate(size_t size) {
+  const size_t bytes = size_class(size);
+  int node;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    node = current_node();
+    auto it = free_.find(std::make_pair(node, bytes));
+    if (it != free_.end() && !it->second.empty()) {
+      void* ptr = it->second.back();
+      it->second.pop_back();
+      stats_.cached_bytes -= bytes;
+      ++stats_.hits;
+      Use(ptr, node, bytes);
+      return ptr;
+    }
+  }
+  void* ptr = nullptr;
+  cudaError_t status;
+  {
+    GPUMemory::DriverCallScope driver_call;
+    status = cudaMallocHost(&ptr, bytes);
+  }
+  if (status != cudaSuccess) {
+    // Cached buffers of other classes might be in the way
+    cudaGetLastError();
+    Trim();
+    GPUMemory::DriverCallScope driver_call;
+    CUDA_CHECK(cudaMallocHost(&ptr, bytes));
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++stats_.misses;
+  Use(ptr, node, bytes);
+  return ptr;
+}
+
+void HostMemoryPool::Free(void* ptr, size_t size) {
+  const size_t bytes = size_class(size);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = used_.find(ptr);
+    CHECK(it != used_.end()) << "Pinned buffer " << ptr << " is not the pool's";
+    const int node = it->second;
+    used_.erase(it);
+    stats_.used_bytes -= bytes;
+    if (stats_.cached_bytes + bytes <= limit()) {
+      free_[std::make_pair(node, bytes)].push_back(ptr);
+      stats_.cached_bytes += bytes;
+      return;
+    }
+  }
+  GPUMemory::DriverCallScope driver_call;
+  CUDA_CHECK(cudaFreeHost(ptr));
+}
+
+void HostMemoryPool::Trim() {
+  GPUMemory::DriverCallScope driver_call;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& bin : free_) {
+    for (void* ptr : bin.second) {
+      cudaFreeHost(ptr);
+    }
+  }
+  free_.clear();
+  stats_.cached_bytes = 0UL;
+}
+
+size_t HostMemoryPool::cached_bytes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_.cached_bytes;
+}
+
+HostMemoryPool::Stats HostMemoryPool::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+std::string HostMemoryPool::stats_string() {
+  const Stats s = stats();
+  std::ostringstream os;
+  os << "Pinned host buffers: " << s.hits << " reused, " << s.misses << " allocated, "
+     << s.used_bytes << " bytes in use (peak " << s.peak_used_bytes << "), "
+     << s.cached_bytes << " cached";
+  return os.str();
+}
+
+}  // namespace caffe
+
+#endif  // CPU_ONLY
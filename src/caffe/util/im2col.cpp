@@ -1,5 +1,6 @@
 #include <vector>
 
+#include "caffe/util/cpu_parallel.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
 
@@ -27,31 +28,37 @@ void im2col_cpu(const Dtype* data_im, const int channels,
   const int output_w = (width + 2 * pad_w -
     (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
   const int channel_size = height * width;
-  for (int channel = channels; channel--; data_im += channel_size) {
-    for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
-      for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
-        int input_row = -pad_h + kernel_row * dilation_h;
-        for (int output_rows = output_h; output_rows; output_rows--) {
-          if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
-            for (int output_cols = output_w; output_cols; output_cols--) {
-              *(data_col++) = 0;
-            }
-          } else {
-            int input_col = -pad_w + kernel_col * dilation_w;
-            for (int output_col = output_w; output_col; output_col--) {
-              if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
-                *(data_col++) = data_im[input_row * width + input_col];
-              } else {
-                *(data_col++) = 0;
+  const int col_channel_size = kernel_h * kernel_w * output_h * output_w;
+  // Channels are independent
+  CpuParallel::For(channels, 1, [&](int begin, int end) {
+    const Dtype* data_im_c = data_im + begin * channel_size;
+    Dtype* data_col_c = data_col + begin * col_channel_size;
+    for (int channel = begin; channel < end; ++channel, data_im_c += channel_size) {
+      for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
+        for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
+          int input_row = -pad_h + kernel_row * dilation_h;
+          for (int output_rows = output_h; output_rows; output_rows--) {
+            if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
+              for (int output_cols = output_w; output_cols; output_cols--) {
+                *(data_col_c++) = 0;
+              }
+            } else {
+              int input_col = -pad_w + kernel_col * dilation_w;
+              for (int output_col = output_w; output_col; output_col--) {
+                if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
+                  *(data_col_c++) = data_im_c[input_row * width + input_col];
+                } else {
+                  *(data_col_c++) = 0;
+                }
+                input_col += stride_w;
               }
-              input_col += stride_w;
             }
+            input_row += stride_h;
           }
-          input_row += stride_h;
         }
       }
     }
-  }
+  });
 }
 
 // Explicit instantiation
@@ -186,28 +193,33 @@ void col2im_cpu(const Dtype* data_col, const int channels,
   const int output_w = (width + 2 * pad_w -
     (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
   const int channel_size = height * width;
-  for (int channel = channels; channel--; data_im += channel_size) {
-    for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
-      for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
-        int input_row = -pad_h + kernel_row * dilation_h;
-        for (int output_rows = output_h; output_rows; output_rows--) {
-          if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
-            data_col += output_w;
-          } else {
-            int input_col = -pad_w + kernel_col * dilation_w;
-            for (int output_col = output_w; output_col; output_col--) {
-              if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
-                data_im[input_row * width + input_col] += *data_col;
+  const int col_channel_size = kernel_h * kernel_w * output_h * output_w;
+  CpuParallel::For(channels, 1, [&](int begin, int end) {
+    const Dtype* data_col_c = data_col + begin * col_channel_size;
+    Dtype* data_im_c = data_im + begin * channel_size;
+    for (int channel = begin; channel < end; ++channel, data_im_c += channel_size) {
+      for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
+        for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
+          int input_row = -pad_h + kernel_row * dilation_h;
+          for (int output_rows = output_h; output_rows; output_rows--) {
+            if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
+              data_col_c += output_w;
+            } else {
+              int input_col = -pad_w + kernel_col * dilation_w;
+              for (int output_col = output_w; output_col; output_col--) {
+                if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
+                  data_im_c[input_row * width + input_col] += *data_col_c;
+                }
+                data_col_c++;
+                input_col += stride_w;
               }
-              data_col++;
-              input_col += stride_w;
             }
+            input_row += stride_h;
           }
-          input_row += stride_h;
         }
       }
     }
-  }
+  });
 }
 
 // Explicit instantiation
@@ -2,6 +2,7 @@
 
 #include "caffe/common.hpp"
 #include "caffe/util/im2col.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
 
 namespace caffe {
 
@@ -38,6 +39,108 @@ __global__ void im2col_gpu_kernel(const int n, const Dtype* data_im,
   }
 }
 
+// Tile of columns of one channel per block in the kernels specialized for
+// kernel K x K, stride S x S and no dilation
+#define IM2COL_TILE_W 32
+#define IM2COL_TILE_H 8
+
+// The tile's image patch is read once to shared memory, where neighbouring
+// columns find the K x K values they share.
+template <typename T, int K, int S>
+__global__ void im2col_gpu_tiled_kernel(const T* data_im,
+    const int height, const int width, const int pad_h, const int pad_w,
+    const int height_col, const int width_col, T* data_col) {
+  constexpr int IN_H = (IM2COL_TILE_H - 1) * S + K;
+  constexpr int IN_W = (IM2COL_TILE_W - 1) * S + K;
+  // 1x1 kernels share nothing
+  __shared__ T tile[K > 1 ? IN_H * IN_W : 1];
+  const int c = blockIdx.z;
+  const int h_col = blockIdx.y * IM2COL_TILE_H + threadIdx.y;
+  const int w_col = blockIdx.x * IM2COL_TILE_W + threadIdx.x;
+  const T* data_im_ptr = data_im + static_cast<size_t>(c) * height * width;
+  const T zero = mt_store<T, float>(0.F);
+  T val[K * K];  // NOLINT(runtime/arrays)
+  if (K > 1) {
+    const int h_in = blockIdx.y * IM2COL_TILE_H * S - pad_h;
+    const int w_in = blockIdx.x * IM2COL_TILE_W * S - pad_w;
+    for (int i = threadIdx.y * IM2COL_TILE_W + threadIdx.x; i < IN_H * IN_W;
+        i += IM2COL_TILE_H * IM2COL_TILE_W) {
+      const int h_im = h_in + i / IN_W;
+      const int w_im = w_in + i % IN_W;
+      tile[i] = (h_im >= 0 && w_im >= 0 && h_im < height && w_im < width) ?
+          data_im_ptr[h_im * width + w_im] : zero;
+    }
+    __syncthreads();
+#pragma unroll
+    for (int i = 0; i < K; ++i) {
+#pragma unroll
+      for (int j = 0; j < K; ++j) {
+        val[i * K + j] = tile[(threadIdx.y * S + i) * IN_W + threadIdx.x * S + j];
+      }
+    }
+  } else {
+    const int h_im = h_col * S - pad_h;
+    const int w_im = w_col * S - pad_w;
+    val[0] = (h_im >= 0 && w_im >= 0 && h_im < height && w_im < width) ?
+        data_im_ptr[h_im * width + w_im] : zero;
+  }
+  if (h_col < height_col && w_col < width_col) {
+    const size_t plane = static_cast<size_t>(height_col) * width_col;
+    T* data_col_ptr = data_col + static_cast<size_t>(c) * K * K * plane +
+        h_col * width_col + w_col;
+#pragma unroll
+    for (int k = 0; k < K * K; ++k) {
+      data_col_ptr[k * plane] = val[k];
+    }
+  }
+}
+
+template <typename T, int K, int S>
+void im2col_gpu_tiled(const T* data_im, const int channels,
+    const int height, const int width, const int pad_h, const int pad_w,
+    const int height_col, const int width_col, T* data_col, cudaStream_t stream) {
+  const dim3 grid((width_col + IM2COL_TILE_W - 1) / IM2COL_TILE_W,
+      (height_col + IM2COL_TILE_H - 1) / IM2COL_TILE_H, channels);
+  const dim3 block(IM2COL_TILE_W, IM2COL_TILE_H);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  im2col_gpu_tiled_kernel<T, K, S><<<grid, block, 0, stream>>>(data_im,
+      height, width, pad_h, pad_w, height_col, width_col, data_col);
+}
+
+// Nearly every layer of the CAFFE engine is 1x1, 3x3 at stride 1 or 3x3 at
+// stride 2. False for other geometries, left to the generic kernel.
+template <typename Dtype>
+bool im2col_gpu_specialized(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int height_col, const int width_col, Dtype* data_col,
+    cudaStream_t stream) {
+  typedef typename MultiTensorType<Dtype>::type T;
+  if (kernel_h != kernel_w || stride_h != stride_w || dilation_h != 1 ||
+      dilation_w != 1 || channels > 65535) {
+    return false;
+  }
+  const T* im = reinterpret_cast<const T*>(data_im);
+  T* col = reinterpret_cast<T*>(data_col);
+  if (kernel_h == 1 && stride_h == 1) {
+    im2col_gpu_tiled<T, 1, 1>(im, channels, height, width, pad_h, pad_w,
+        height_col, width_col, col, stream);
+  } else if (kernel_h == 1 && stride_h == 2) {
+    im2col_gpu_tiled<T, 1, 2>(im, channels, height, width, pad_h, pad_w,
+        height_col, width_col, col, stream);
+  } else if (kernel_h == 3 && stride_h == 1) {
+    im2col_gpu_tiled<T, 3, 1>(im, channels, height, width, pad_h, pad_w,
+        height_col, width_col, col, stream);
+  } else if (kernel_h == 3 && stride_h == 2) {
+    im2col_gpu_tiled<T, 3, 2>(im, channels, height, width, pad_h, pad_w,
+        height_col, width_col, col, stream);
+  } else {
+    return false;
+  }
+  return true;
+}
+
 template <typename Dtype>
 void im2col_gpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
@@ -53,13 +156,17 @@ void im2col_gpu(const Dtype* data_im, const int channels,
       (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
   int num_kernels = channels * height_col * width_col;
   cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  im2col_gpu_kernel<Dtype><<<CAFFE_GET_BLOCKS(num_kernels), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
-      num_kernels, data_im, height, width, kernel_h, kernel_w, pad_h,
-      pad_w, stride_h, stride_w, dilation_h, dilation_w, height_col,
-      width_col, data_col);
+  if (!im2col_gpu_specialized(data_im, channels, height, width, kernel_h,
+      kernel_w, pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
+      height_col, width_col, data_col, stream)) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    im2col_gpu_kernel<Dtype><<<CAFFE_GET_BLOCKS(num_kernels), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        num_kernels, data_im, height, width, kernel_h, kernel_w, pad_h,
+        pad_w, stride_h, stride_w, dilation_h, dilation_w, height_col,
+        width_col, data_col);
+  }
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 // Explicit instantiation
@@ -236,7 +343,7 @@ void im2col_nd_gpu(const Dtype* data_im, const int num_spatial_axes,
                << num_spatial_axes << " spatial axes";
   }
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 // Explicit instantiation
@@ -297,6 +404,89 @@ __global__ void col2im_gpu_kernel(const int n, const Dtype* data_col,
   }
 }
 
+// One image pixel per thread, tiles of one channel per block: the sum of its
+// K x K columns, found without division by runtime values. Columns of
+// neighbouring pixels are neighbours in every plane, so reads coalesce
+// without shared memory.
+template <typename T, typename A, int K, int S>
+__global__ void col2im_gpu_tiled_kernel(const T* data_col,
+    const int height, const int width, const int pad_h, const int pad_w,
+    const int height_col, const int width_col, T* data_im) {
+  const int c = blockIdx.z;
+  const int h = blockIdx.y * IM2COL_TILE_H + threadIdx.y;
+  const int w = blockIdx.x * IM2COL_TILE_W + threadIdx.x;
+  if (h >= height || w >= width) {
+    return;
+  }
+  const int h_im = h + pad_h;
+  const int w_im = w + pad_w;
+  const size_t plane = static_cast<size_t>(height_col) * width_col;
+  const T* data_col_ptr = data_col + static_cast<size_t>(c) * K * K * plane;
+  A val = A(0);
+#pragma unroll
+  for (int i = 0; i < K; ++i) {
+    const int h_col = (h_im - i) / S;
+    if (h_im - i < 0 || (h_im - i) % S != 0 || h_col >= height_col) {
+      continue;
+    }
+#pragma unroll
+    for (int j = 0; j < K; ++j) {
+      const int w_col = (w_im - j) / S;
+      if (w_im - j < 0 || (w_im - j) % S != 0 || w_col >= width_col) {
+        continue;
+      }
+      val += mt_load<A, T>(data_col_ptr[(i * K + j) * plane + h_col * width_col + w_col]);
+    }
+  }
+  data_im[static_cast<size_t>(c) * height * width + h * width + w] = mt_store<T, A>(val);
+}
+
+template <typename T, typename A, int K, int S>
+void col2im_gpu_tiled(const T* data_col, const int channels,
+    const int height, const int width, const int pad_h, const int pad_w,
+    const int height_col, const int width_col, T* data_im, cudaStream_t stream) {
+  const dim3 grid((width + IM2COL_TILE_W - 1) / IM2COL_TILE_W,
+      (height + IM2COL_TILE_H - 1) / IM2COL_TILE_H, channels);
+  const dim3 block(IM2COL_TILE_W, IM2COL_TILE_H);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  col2im_gpu_tiled_kernel<T, A, K, S><<<grid, block, 0, stream>>>(data_col,
+      height, width, pad_h, pad_w, height_col, width_col, data_im);
+}
+
+// See im2col_gpu_specialized
+template <typename Dtype>
+bool col2im_gpu_specialized(const Dtype* data_col, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int height_col, const int width_col, Dtype* data_im,
+    cudaStream_t stream) {
+  typedef typename MultiTensorType<Dtype>::type T;
+  typedef typename MultiTensorAcc<Dtype>::type A;
+  if (kernel_h != kernel_w || stride_h != stride_w || dilation_h != 1 ||
+      dilation_w != 1 || channels > 65535) {
+    return false;
+  }
+  const T* col = reinterpret_cast<const T*>(data_col);
+  T* im = reinterpret_cast<T*>(data_im);
+  if (kernel_h == 1 && stride_h == 1) {
+    col2im_gpu_tiled<T, A, 1, 1>(col, channels, height, width, pad_h, pad_w,
+        height_col, width_col, im, stream);
+  } else if (kernel_h == 1 && stride_h == 2) {
+    col2im_gpu_tiled<T, A, 1, 2>(col, channels, height, width, pad_h, pad_w,
+        height_col, width_col, im, stream);
+  } else if (kernel_h == 3 && stride_h == 1) {
+    col2im_gpu_tiled<T, A, 3, 1>(col, channels, height, width, pad_h, pad_w,
+        height_col, width_col, im, stream);
+  } else if (kernel_h == 3 && stride_h == 2) {
+    col2im_gpu_tiled<T, A, 3, 2>(col, channels, height, width, pad_h, pad_w,
+        height_col, width_col, im, stream);
+  } else {
+    return false;
+  }
+  return true;
+}
+
 template <typename Dtype>
 void col2im_gpu(const Dtype* data_col, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
@@ -311,14 +501,18 @@ void col2im_gpu(const Dtype* data_col, const int channels,
   cudaStream_t stream = Caffe::thread_stream();
   // To avoid involving atomic operations, we will launch one kernel per
   // bottom dimension, and then in the kernel add up the top dimensions.
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  col2im_gpu_kernel<Dtype><<<CAFFE_GET_BLOCKS(num_kernels),
-                             CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
-      num_kernels, data_col, height, width, channels, kernel_h, kernel_w,
-      pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
-      height_col, width_col, data_im);
+  if (!col2im_gpu_specialized(data_col, channels, height, width, kernel_h,
+      kernel_w, pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
+      height_col, width_col, data_im, stream)) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    col2im_gpu_kernel<Dtype><<<CAFFE_GET_BLOCKS(num_kernels),
+                               CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        num_kernels, data_col, height, width, channels, kernel_h, kernel_w,
+        pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
+        height_col, width_col, data_im);
+  }
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 // Explicit instantiation
@@ -517,7 +711,7 @@ void col2im_nd_gpu(const Dtype* data_col, const int num_spatial_axes,
                << num_spatial_axes << " spatial axes";
   }
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 // Explicit instantiation
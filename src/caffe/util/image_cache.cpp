@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <string>
+
+#include "caffe/util/image_cache.hpp"
+
+namespace caffe {
+
+ImageCache& ImageCache::instance() {
+  static ImageCache cache;
+  return cache;
+}
+
+void ImageCache::reserve(size_t budget_bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  budget_ = std::max(budget_, budget_bytes);
+}
+
+bool ImageCache::get(const std::string& key, cv::Mat* mat) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    return false;
+  }
+  entries_.splice(entries_.begin(), entries_, it->second);
+  *mat = it->second->second;
+  return true;
+}
+
+void ImageCache::put(const std::string& key, const cv::Mat& mat) {
+  const size_t size = mat_bytes(mat);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (size > budget_ || index_.find(key) != index_.end()) {
+    return;
+  }
+  while (bytes_ + size > budget_) {
+    bytes_ -= mat_bytes(entries_.back().second);
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+  entries_.emplace_front(key, mat);
+  index_[key] = entries_.begin();
+  bytes_ += size;
+}
+
+size_t ImageCache::bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bytes_;
+}
+
+size_t ImageCache::budget() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return budget_;
+}
+
+void ImageCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  index_.clear();
+  bytes_ = 0UL;
+  budget_ = 0UL;
+}
+
+}  // namespace caffe
@@ -90,15 +90,19 @@ bool ReadFileToDatum(const string& filename, const int label, Datum* datum) {
 vector<int> DecodeDatumToCVMat(const Datum& datum, int color_mode, cv::Mat& cv_img,
     bool shape_only, bool accurate_jpeg) {
   CHECK(datum.encoded()) << "Datum not encoded";
-  const std::string& content = datum.data();
-  const size_t content_size = content.size();
+  return DecodeImageToCVMat(datum.data().data(), datum.data().size(), color_mode, cv_img,
+      shape_only, accurate_jpeg);
+}
+
+vector<int> DecodeImageToCVMat(const char* content, size_t content_size, int color_mode,
+    cv::Mat& cv_img, bool shape_only, bool accurate_jpeg) {
   int ch = 0;
 
   if (content_size > 1
       && static_cast<unsigned char>(content[0]) == 255
       && static_cast<unsigned char>(content[1]) == 216) {  // probably jpeg
     int width, height, subsamp;
-    auto *content_data = reinterpret_cast<unsigned char*>(const_cast<char*>(content.data()));
+    auto *content_data = reinterpret_cast<unsigned char*>(const_cast<char*>(content));
 
     tjhandle jpeg_decoder = tjInitDecompress();
     tjDecompressHeader2(jpeg_decoder, content_data, content_size, &width, &height, &subsamp);
@@ -117,10 +121,10 @@ vector<int> DecodeDatumToCVMat(const Datum& datum, int color_mode, cv::Mat& cv_i
     tjDestroy(jpeg_decoder);
   } else {
     // probably not jpeg...
-    std::vector<char> vec_data(content.c_str(), content.c_str() + content_size);
+    const cv::Mat raw(1, static_cast<int>(content_size), CV_8UC1, const_cast<char*>(content));
     const int flag = color_mode < 0 ? CV_LOAD_IMAGE_GRAYSCALE :
        (color_mode > 0 ? CV_LOAD_IMAGE_COLOR : CV_LOAD_IMAGE_ANYCOLOR);
-    cv_img = cv::imdecode(vec_data, flag);
+    cv_img = cv::imdecode(raw, flag);
     ch = cv_img.channels();
   }
   if (!cv_img.data) {
@@ -132,15 +136,19 @@ vector<int> DecodeDatumToCVMat(const Datum& datum, int color_mode, cv::Mat& cv_i
 void DecodeDatumToSignedBuf(const Datum& datum, int color_mode,
     char* buf, size_t buf_len, bool accurate_jpeg) {
   CHECK(datum.encoded()) << "Datum not encoded";
-  const std::string& content = datum.data();
-  const size_t content_size = content.size();
+  DecodeImageToSignedBuf(datum.data().data(), datum.data().size(), color_mode,
+      buf, buf_len, accurate_jpeg);
+}
+
+void DecodeImageToSignedBuf(const char* content, size_t content_size, int color_mode,
+    char* buf, size_t buf_len, bool accurate_jpeg) {
   int ch = 0;
 
   if (content_size > 1
       && static_cast<unsigned char>(content[0]) == 255
       && static_cast<unsigned char>(content[1]) == 216) {  // probably jpeg
     int width, height, subsamp;
-    auto *content_data = reinterpret_cast<unsigned char*>(const_cast<char*>(content.data()));
+    auto *content_data = reinterpret_cast<unsigned char*>(const_cast<char*>(content));
 
     tjhandle jpeg_decoder = tjInitDecompress();
     tjDecompressHeader2(jpeg_decoder, content_data, content_size, &width, &height, &subsamp);
@@ -156,10 +164,10 @@ void DecodeDatumToSignedBuf(const Datum& datum, int color_mode,
     tjDestroy(jpeg_decoder);
   } else {
     // probably not jpeg...
-    std::vector<char> vec_data(content.c_str(), content.c_str() + content_size);
+    const cv::Mat raw(1, static_cast<int>(content_size), CV_8UC1, const_cast<char*>(content));
     const int flag = color_mode < 0 ? CV_LOAD_IMAGE_GRAYSCALE :
                      (color_mode > 0 ? CV_LOAD_IMAGE_COLOR : CV_LOAD_IMAGE_ANYCOLOR);
-    cv::Mat cv_img = cv::imdecode(vec_data, flag);
+    cv::Mat cv_img = cv::imdecode(raw, flag);
     ch = cv_img.channels();
     if (!cv_img.data) {
       LOG(ERROR) << "Could not decode datum";
@@ -169,16 +177,9 @@ void DecodeDatumToSignedBuf(const Datum& datum, int color_mode,
   }
 }
 
-cv::Mat ReadImageToCVMat(const string& filename,
-    int height, int width, bool is_color, int min_height, int min_width) {
+static cv::Mat ResizeCVMat(const cv::Mat& cv_img_origin,
+    int height, int width, int min_height, int min_width) {
   cv::Mat cv_img;
-  int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
-    CV_LOAD_IMAGE_GRAYSCALE);
-  cv::Mat cv_img_origin = cv::imread(filename, cv_read_flag);
-  if (!cv_img_origin.data) {
-    LOG(ERROR) << "Could not open or find file " << filename;
-    return cv_img_origin;
-  }
   if (min_height > 0) {
     height = std::max(min_height, height);
   }
@@ -193,6 +194,41 @@ cv::Mat ReadImageToCVMat(const string& filename,
   return cv_img;
 }
 
+cv::Mat ReadImageToCVMat(const string& filename,
+    int height, int width, bool is_color, int min_height, int min_width) {
+  int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
+    CV_LOAD_IMAGE_GRAYSCALE);
+  cv::Mat cv_img_origin = cv::imread(filename, cv_read_flag);
+  if (!cv_img_origin.data) {
+    LOG(ERROR) << "Could not open or find file " << filename;
+    return cv_img_origin;
+  }
+  return ResizeCVMat(cv_img_origin, height, width, min_height, min_width);
+}
+
+bool ReadFileToCVMat(const string& filename, cv::Mat* content) {
+  fstream file(filename.c_str(), ios::in|ios::binary|ios::ate);
+  if (!file.is_open()) {
+    return false;
+  }
+  const std::streampos size = file.tellg();
+  content->create(1, static_cast<int>(size), CV_8U);
+  file.seekg(0, ios::beg);
+  file.read(reinterpret_cast<char*>(content->data), size);
+  return static_cast<bool>(file);
+}
+
+cv::Mat DecodeFileToCVMat(const cv::Mat& content, int height, int width, bool is_color) {
+  int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
+    CV_LOAD_IMAGE_GRAYSCALE);
+  cv::Mat cv_img_origin = cv::imdecode(content, cv_read_flag);
+  if (!cv_img_origin.data) {
+    LOG(ERROR) << "Could not decode file content";
+    return cv_img_origin;
+  }
+  return ResizeCVMat(cv_img_origin, height, width, 0, 0);
+}
+
 cv::Mat ReadImageToCVMat(const string& filename,
     const int height, const int width) {
   return ReadImageToCVMat(filename, height, width, true);
@@ -0,0 +1,102 @@
+#ifndef CPU_ONLY
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include "caffe/util/io.hpp"
+#include "caffe/util/ipc_weights.hpp"
+
+namespace caffe {
+
+constexpr const char* IpcWeights::SUFFIX;
+constexpr int IpcWeights::ALIGNMENT_POWER;
+
+IpcWeights::IpcWeights(size_t bytes)
+    : exporter_(true), device_(Caffe::current_device()), ptr_(nullptr), offset_(0UL) {
+  CUDA_CHECK(cudaMalloc(&ptr_, std::max<size_t>(bytes, 1UL)));
+  cudaIpcMemHandle_t mem_handle;
+  CUDA_CHECK(cudaIpcGetMemHandle(&mem_handle, ptr_));
+  char bus_id[32];
+  CUDA_CHECK(cudaDeviceGetPCIBusId(bus_id, sizeof(bus_id), device_));
+  handle_.set_mem_handle(&mem_handle, sizeof(mem_handle));
+  handle_.set_pci_bus_id(bus_id);
+  handle_.set_bytes(bytes);
+  handle_.set_pid(getpid());
+}
+
+IpcWeights::IpcWeights(const string& handle_file)
+    : exporter_(false), device_(-1), ptr_(nullptr), offset_(0UL) {
+  CHECK(ReadProtoFromBinaryFile(handle_file, &handle_))
+      << "Failed to read IPC weights handle " << handle_file;
+  cudaIpcMemHandle_t mem_handle;
+  CHECK_EQ(handle_.mem_handle().size(), sizeof(mem_handle))
+      << "Corrupted IPC weights handle " << handle_file;
+  handle_.mem_handle().copy(reinterpret_cast<char*>(&mem_handle), sizeof(mem_handle));
+  CUDA_CHECK(cudaDeviceGetByPCIBusId(&device_, handle_.pci_bus_id().c_str()));
+  CHECK_EQ(device_, Caffe::current_device()) << "IPC weights of " << handle_file
+      << " are on device " << device_ << " (" << handle_.pci_bus_id() << ")";
+  // Fails in the exporting process itself
+  CHECK_NE(handle_.pid(), getpid()) << "IPC weights are attached by other processes";
+  CUDA_CHECK(cudaIpcOpenMemHandle(&ptr_, mem_handle, cudaIpcMemLazyEnablePeerAccess));
+  LOG(INFO) << "Attached " << handle_.bytes() / 1048576.0 << " MB of weights exported by "
+      << "process " << handle_.pid() << " through " << handle_file;
+}
+
+IpcWeights::~IpcWeights() {
+  if (ptr_ == nullptr) {
+    return;
+  }
+  if (exporter_) {
+    cudaFree(ptr_);
+  } else {
+    cudaIpcCloseMemHandle(ptr_);
+  }
+}
+
+size_t IpcWeights::AlignedBytes(const Blob& blob) {
+  return align_up<ALIGNMENT_POWER>(blob.count() * tsize(blob.data_type()));
+}
+
+void IpcWeights::Add(const string& layer, int blob_id, const Blob& blob) {
+  CHECK(exporter_) << "Weights are added by the exporting process";
+  const size_t bytes = blob.count() * tsize(blob.data_type());
+  CHECK_LE(offset_ + bytes, handle_.bytes()) << "IPC weights allocation is too small";
+  WeightIndex::Tensor* tensor = handle_.mutable_index()->add_tensor();
+  tensor->set_layer(layer);
+  tensor->set_blob_id(blob_id);
+  for (int axis : blob.shape()) {
+    tensor->mutable_shape()->add_dim(axis);
+  }
+  tensor->set_type(blob.data_type());
+  tensor->set_offset(offset_);
+  tensor->set_bytes(bytes);
+  if (bytes > 0UL) {
+    CUDA_CHECK(cudaMemcpy(static_cast<char*>(ptr_) + offset_,
+        blob.current_data_memory(true), bytes, cudaMemcpyDeviceToDevice));
+  }
+  offset_ += AlignedBytes(blob);
+}
+
+void IpcWeights::Publish(const string& handle_file) {
+  CHECK(exporter_) << "Weights are published by the exporting process";
+  CHECK(IsHandle(handle_file)) << "IPC weights handle files end with " << SUFFIX;
+  // Workers never read a partial handle
+  const string tmp_file = handle_file + ".tmp";
+  WriteProtoToBinaryFile(handle_, tmp_file);
+  CHECK_EQ(std::rename(tmp_file.c_str(), handle_file.c_str()), 0)
+      << "Failed to write " << handle_file;
+  LOG(INFO) << "Exported " << offset_ / 1048576.0 << " MB of weights through " << handle_file;
+}
+
+bool IpcWeights::IsHandle(const string& filename) {
+  const string suffix(SUFFIX);
+  return filename.size() > suffix.size() &&
+      filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+}  // namespace caffe
+
+#endif  // CPU_ONLY
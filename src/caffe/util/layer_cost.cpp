@@ -0,0 +1,45 @@
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/layer_cost.hpp"
+
+namespace caffe {
+
+static double data_bytes(const Blob& blob) {
+  return static_cast<double>(blob.count()) * tsize(blob.data_type());
+}
+
+static double diff_bytes(const Blob& blob) {
+  return static_cast<double>(blob.count()) * tsize(blob.diff_type());
+}
+
+LayerCost layer_cost(LayerBase* layer, const vector<Blob*>& bottom, const vector<Blob*>& top) {
+  LayerCost cost;
+  double bottom_count = 0., top_count = 0.;
+  double bottom_data = 0., bottom_diff = 0., top_data = 0., top_diff = 0., params = 0.;
+  for (const Blob* blob : bottom) {
+    bottom_count += blob->count();
+    bottom_data += data_bytes(*blob);
+    bottom_diff += diff_bytes(*blob);
+  }
+  for (const Blob* blob : top) {
+    top_count += blob->count();
+    top_data += data_bytes(*blob);
+    top_diff += diff_bytes(*blob);
+  }
+  const vector<shared_ptr<Blob>>& blobs = layer->blobs();
+  for (const shared_ptr<Blob>& blob : blobs) {
+    params += data_bytes(*blob);
+  }
+
+  cost.forward_flops = top_count;
+  cost.backward_flops = bottom_count;
+  cost.forward_bytes = bottom_data + top_data + params;
+  // Reads top diff, bottom data and weights, writes bottom diff and weight diff
+  cost.backward_bytes = top_diff + bottom_data + bottom_diff + 2. * params;
+  cost.activation_bytes = static_cast<size_t>(top_data);
+  layer->Cost(bottom, top, &cost);
+  return cost;
+}
+
+}  // namespace caffe
@@ -2,15 +2,237 @@
 #include <boost/random.hpp>
 
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <limits>
 #include <vector>
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define CAFFE_F16C_X86
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CAFFE_F16C_NEON
+#endif
+
 #include "caffe/common.hpp"
+#include "caffe/util/cpu_parallel.hpp"
+#include "caffe/util/host_memory_pool.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
 
+#ifndef CPU_ONLY
+namespace {
+
+enum F16Isa {
+  F16_NONE = 0,
+  F16_F16C = 1,
+  F16_AVX512 = 2,
+  F16_NEON = 3
+};
+
+F16Isa f16_isa() {
+  static const F16Isa selected = [] {
+#if defined(CAFFE_F16C_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+      return F16_AVX512;
+    }
+    if (__builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c")) {
+      return F16_F16C;
+    }
+    return F16_NONE;
+#elif defined(CAFFE_F16C_NEON)
+    return F16_NEON;
+#else
+    return F16_NONE;
+#endif
+  }();
+  return selected;
+}
+
+// These return the number of leading elements done, the rest is left to the scalar tail
+#if defined(CAFFE_F16C_X86)
+__attribute__((target("avx,f16c")))
+int half_to_float_f16c(const int n, const uint16_t* in, float* out) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    _mm256_storeu_ps(out + i, _mm256_cvtph_ps(h));
+  }
+  return i;
+}
+
+__attribute__((target("avx,f16c")))
+int float_to_half_f16c(const int n, const float* in, uint16_t* out) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), h);
+  }
+  return i;
+}
+
+__attribute__((target("avx512f")))
+int half_to_float_avx512(const int n, const uint16_t* in, float* out) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    _mm512_storeu_ps(out + i, _mm512_cvtph_ps(h));
+  }
+  return i;
+}
+
+__attribute__((target("avx512f")))
+int float_to_half_avx512(const int n, const float* in, uint16_t* out) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256i h = _mm512_cvtps_ph(_mm512_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), h);
+  }
+  return i;
+}
+#elif defined(CAFFE_F16C_NEON)
+int half_to_float_neon(const int n, const uint16_t* in, float* out) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const float16x8_t h = vreinterpretq_f16_u16(vld1q_u16(in + i));
+    vst1q_f32(out + i, vcvt_f32_f16(vget_low_f16(h)));
+    vst1q_f32(out + i + 4, vcvt_high_f32_f16(h));
+  }
+  return i;
+}
+
+int float_to_half_neon(const int n, const float* in, uint16_t* out) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const float16x8_t h = vcvt_high_f16_f32(vcvt_f16_f32(vld1q_f32(in + i)),
+        vld1q_f32(in + i + 4));
+    vst1q_u16(out + i, vreinterpretq_u16_f16(h));
+  }
+  return i;
+}
+#endif
+
+void half_to_float(const int n, const float16* in, float* out) {
+  const uint16_t* h = reinterpret_cast<const uint16_t*>(in);
+  int i = 0;
+  switch (f16_isa()) {
+#if defined(CAFFE_F16C_X86)
+    case F16_AVX512:
+      i = half_to_float_avx512(n, h, out);
+      break;
+    case F16_F16C:
+      i = half_to_float_f16c(n, h, out);
+      break;
+#elif defined(CAFFE_F16C_NEON)
+    case F16_NEON:
+      i = half_to_float_neon(n, h, out);
+      break;
+#endif
+    default:
+      break;
+  }
+  for (; i < n; ++i) {
+    out[i] = static_cast<float>(in[i]);
+  }
+}
+
+void float_to_half(const int n, const float* in, float16* out) {
+  uint16_t* h = reinterpret_cast<uint16_t*>(out);
+  int i = 0;
+  switch (f16_isa()) {
+#if defined(CAFFE_F16C_X86)
+    case F16_AVX512:
+      i = float_to_half_avx512(n, in, h);
+      break;
+    case F16_F16C:
+      i = float_to_half_f16c(n, in, h);
+      break;
+#elif defined(CAFFE_F16C_NEON)
+    case F16_NEON:
+      i = float_to_half_neon(n, in, h);
+      break;
+#endif
+    default:
+      break;
+  }
+  for (; i < n; ++i) {
+    out[i] = static_cast<float16>(in[i]);
+  }
+}
+
+// Packed float copies used by the float16 gemm and gemv, they only grow
+float* fp16_scratch(int slot, size_t size) {
+  thread_local std::vector<float> buffers[3];
+  std::vector<float>& buffer = buffers[slot];
+  if (buffer.size() < size) {
+    buffer.resize(size);
+  }
+  return buffer.data();
+}
+
+// Elements converted per step by the level 1 helpers, on the stack
+constexpr int FP16_CHUNK = 512;
+// Conversions are memory bound: split among CpuParallel threads past this many elements
+constexpr int FP16_CONVERT_GRAIN = 1 << 18;
+// K is split into panels of this depth, so that packed A and B stay small
+constexpr int FP16_GEMM_KC = 256;
+// Elements of A converted per step by gemv
+constexpr int FP16_GEMV_BLOCK = 1 << 16;
+
+}  // namespace
+
+template <>
+void caffe_cpu_convert<float16, float>(const int n, const float16 *in, float *out) {
+  if (n < 2 * FP16_CONVERT_GRAIN) {
+    half_to_float(n, in, out);
+    return;
+  }
+  CpuParallel::For(n, FP16_CONVERT_GRAIN, [&](int begin, int end) {
+    half_to_float(end - begin, in + begin, out + begin);
+  });
+}
+
+template <>
+void caffe_cpu_convert<float, float16>(const int n, const float *in, float16 *out) {
+  if (n < 2 * FP16_CONVERT_GRAIN) {
+    float_to_half(n, in, out);
+    return;
+  }
+  CpuParallel::For(n, FP16_CONVERT_GRAIN, [&](int begin, int end) {
+    float_to_half(end - begin, in + begin, out + begin);
+  });
+}
+
+// Through float, FP16_CHUNK elements at a time
+template <>
+void caffe_cpu_convert<float16, double>(const int n, const float16 *in, double *out) {
+  float buf[FP16_CHUNK];
+  for (int i = 0; i < n; i += FP16_CHUNK) {
+    const int c = std::min(FP16_CHUNK, n - i);
+    half_to_float(c, in + i, buf);
+    for (int j = 0; j < c; ++j) {
+      out[i + j] = buf[j];
+    }
+  }
+}
+
+template <>
+void caffe_cpu_convert<double, float16>(const int n, const double *in, float16 *out) {
+  float buf[FP16_CHUNK];
+  for (int i = 0; i < n; i += FP16_CHUNK) {
+    const int c = std::min(FP16_CHUNK, n - i);
+    for (int j = 0; j < c; ++j) {
+      buf[j] = static_cast<float>(in[i + j]);
+    }
+    float_to_half(c, buf, out + i);
+  }
+}
+#endif
+
 template<>
 void caffe_cpu_gemm<float>(const CBLAS_TRANSPOSE TransA,
     const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
@@ -42,15 +264,37 @@ void caffe_cpu_gemm<float16>(const CBLAS_TRANSPOSE TransA,
   if (M <= 0 || N <= 0 || K <= 0) {
     return;
   }
-  std::vector<float> a(M*K), b(K*N), c(M*N);
-  caffe_cpu_convert(a.size(), A, &a.front());
-  caffe_cpu_convert(b.size(), B, &b.front());
-  caffe_cpu_convert(c.size(), C, &c.front());
-  const int lda = (TransA == CblasNoTrans) ? K : M;
-  const int ldb = (TransB == CblasNoTrans) ? N : K;
-  cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, static_cast<float>(alpha), &a.front(),
-      lda, &b.front(), ldb, static_cast<float>(beta), &c.front(), N);
-  caffe_cpu_convert(c.size(), &c.front(), C);
+  const float falpha = static_cast<float>(alpha);
+  const float fbeta = static_cast<float>(beta);
+  float* c = fp16_scratch(0, static_cast<size_t>(M) * N);
+  if (fbeta != 0.F) {
+    caffe_cpu_convert(M * N, C, c);
+  }
+  // Panels of op(A) columns and op(B) rows, packed in the layout they're stored in
+  for (int k0 = 0; k0 < K; k0 += FP16_GEMM_KC) {
+    const int kc = std::min(FP16_GEMM_KC, K - k0);
+    float* a = fp16_scratch(1, static_cast<size_t>(M) * kc);
+    float* b = fp16_scratch(2, static_cast<size_t>(kc) * N);
+    if (TransA == CblasNoTrans) {
+      for (int m = 0; m < M; ++m) {
+        caffe_cpu_convert(kc, A + static_cast<size_t>(m) * K + k0, a + m * kc);
+      }
+    } else {
+      caffe_cpu_convert(kc * M, A + static_cast<size_t>(k0) * M, a);
+    }
+    if (TransB == CblasNoTrans) {
+      caffe_cpu_convert(kc * N, B + static_cast<size_t>(k0) * N, b);
+    } else {
+      for (int n = 0; n < N; ++n) {
+        caffe_cpu_convert(kc, B + static_cast<size_t>(n) * K + k0, b + n * kc);
+      }
+    }
+    const int lda = (TransA == CblasNoTrans) ? kc : M;
+    const int ldb = (TransB == CblasNoTrans) ? N : kc;
+    cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, kc, falpha, a, lda, b, ldb,
+        k0 == 0 ? fbeta : 1.F, c, N);
+  }
+  caffe_cpu_convert(M * N, c, C);
 }
 #endif
 
@@ -78,13 +322,28 @@ void caffe_cpu_gemv<float16>(const CBLAS_TRANSPOSE TransA, const int M,
   }
   const int lx = (TransA == CblasNoTrans) ? N : M;
   const int ly = (TransA == CblasNoTrans) ? M : N;
-  std::vector<float> a(M*N), xv(lx), yv(ly);
-  caffe_cpu_convert(a.size(), A, &a.front());
-  caffe_cpu_convert(xv.size(), x, &xv.front());
-  caffe_cpu_convert(yv.size(), y, &yv.front());
-  cblas_sgemv(CblasRowMajor, TransA, M, N, static_cast<float>(alpha), &a.front(), N,
-      &xv.front(), 1, static_cast<float>(beta), &yv.front(), 1);
-  caffe_cpu_convert(yv.size(), &yv.front(), y);
+  const float falpha = static_cast<float>(alpha);
+  const float fbeta = static_cast<float>(beta);
+  float* xv = fp16_scratch(0, lx);
+  float* yv = fp16_scratch(1, ly);
+  caffe_cpu_convert(lx, x, xv);
+  if (fbeta != 0.F) {
+    caffe_cpu_convert(ly, y, yv);
+  }
+  // Blocks of A rows
+  const int rows = std::max(1, std::min(M, FP16_GEMV_BLOCK / N));
+  float* a = fp16_scratch(2, static_cast<size_t>(rows) * N);
+  for (int m0 = 0; m0 < M; m0 += rows) {
+    const int mc = std::min(rows, M - m0);
+    caffe_cpu_convert(mc * N, A + static_cast<size_t>(m0) * N, a);
+    if (TransA == CblasNoTrans) {
+      cblas_sgemv(CblasRowMajor, CblasNoTrans, mc, N, falpha, a, N, xv, 1, fbeta, yv + m0, 1);
+    } else {
+      cblas_sgemv(CblasRowMajor, CblasTrans, mc, N, falpha, a, N, xv + m0, 1,
+          m0 == 0 ? fbeta : 1.F, yv, 1);
+    }
+  }
+  caffe_cpu_convert(ly, yv, y);
 }
 #endif
 
@@ -100,8 +359,16 @@ void caffe_axpy<double>(const int N, const double alpha, const double* X,
 template<>
 void caffe_axpy<float16>(const int N, const float16 alpha, const float16* X,
     float16* Y) {
-  for (int i = 0; i < N; ++i) {
-    Y[i] = alpha * X[i] + Y[i];
+  const float a = static_cast<float>(alpha);
+  float x[FP16_CHUNK], y[FP16_CHUNK];
+  for (int i = 0; i < N; i += FP16_CHUNK) {
+    const int n = std::min(FP16_CHUNK, N - i);
+    caffe_cpu_convert(n, X + i, x);
+    caffe_cpu_convert(n, Y + i, y);
+    for (int j = 0; j < n; ++j) {
+      y[j] = a * x[j] + y[j];
+    }
+    caffe_cpu_convert(n, y, Y + i);
   }
 }
 #endif
@@ -173,6 +440,94 @@ template void caffe_copy<double>(const int N, const double* X, double* Y);
 template void caffe_copy<float16>(const int N, const float16* X, float16* Y);
 #endif
 
+// Bytes per CpuParallel range of caffe_parallel_memcpy
+constexpr size_t PARALLEL_MEMCPY_GRAIN = 2UL << 20;
+
+void caffe_parallel_memcpy(const size_t N, const void* X, void* Y) {
+  if (N < 2UL * PARALLEL_MEMCPY_GRAIN) {
+    memcpy(Y, X, N);  // NOLINT(caffe/alt_fn)
+    return;
+  }
+  // Ranges of blocks: N may not fit int
+  const int blocks = static_cast<int>((N + PARALLEL_MEMCPY_GRAIN - 1UL) / PARALLEL_MEMCPY_GRAIN);
+  CpuParallel::For(blocks, 1, [&](int begin, int end) {
+    const size_t from = begin * PARALLEL_MEMCPY_GRAIN;
+    const size_t to = std::min(N, end * PARALLEL_MEMCPY_GRAIN);
+    memcpy(static_cast<char*>(Y) + from,  // NOLINT(caffe/alt_fn)
+        static_cast<const char*>(X) + from, to - from);
+  });
+}
+
+#ifndef CPU_ONLY
+// Pinned chunks of the staged copies, two of them alternate
+constexpr size_t STAGING_CHUNK = 16UL << 20;
+
+void caffe_gpu_upload(const size_t N, const void* X, void* Y) {
+  cudaStream_t stream = Caffe::thread_stream();
+  if (N <= STAGING_CHUNK) {
+    CUDA_CHECK(cudaMemcpyAsync(Y, X, N, cudaMemcpyHostToDevice, stream));
+    CUDA_CHECK(caffe_gpu_sync(stream));
+    return;
+  }
+  void* chunks[2];
+  cudaEvent_t uploaded[2];
+  for (int c = 0; c < 2; ++c) {
+    chunks[c] = HostMemoryPool::Allocate(STAGING_CHUNK);
+    CUDA_CHECK(cudaEventCreateWithFlags(&uploaded[c], cudaEventDisableTiming));
+    CUDA_CHECK(cudaEventRecord(uploaded[c], stream));
+  }
+  int c = 0;
+  for (size_t offset = 0UL; offset < N; offset += STAGING_CHUNK, c ^= 1) {
+    const size_t bytes = std::min(STAGING_CHUNK, N - offset);
+    CUDA_CHECK(cudaEventSynchronize(uploaded[c]));
+    caffe_parallel_memcpy(bytes, static_cast<const char*>(X) + offset, chunks[c]);
+    CUDA_CHECK(cudaMemcpyAsync(static_cast<char*>(Y) + offset, chunks[c], bytes,
+        cudaMemcpyHostToDevice, stream));
+    CUDA_CHECK(cudaEventRecord(uploaded[c], stream));
+  }
+  CUDA_CHECK(caffe_gpu_sync(stream));
+  for (c = 0; c < 2; ++c) {
+    CUDA_CHECK(cudaEventDestroy(uploaded[c]));
+    HostMemoryPool::Free(chunks[c], STAGING_CHUNK);
+  }
+}
+
+void caffe_gpu_download(const size_t N, const void* X, void* Y) {
+  cudaStream_t stream = Caffe::thread_stream();
+  if (N <= STAGING_CHUNK) {
+    CUDA_CHECK(cudaMemcpyAsync(Y, X, N, cudaMemcpyDeviceToHost, stream));
+    CUDA_CHECK(caffe_gpu_sync(stream));
+    return;
+  }
+  void* chunks[2];
+  cudaEvent_t downloaded[2];
+  for (int c = 0; c < 2; ++c) {
+    chunks[c] = HostMemoryPool::Allocate(STAGING_CHUNK);
+    CUDA_CHECK(cudaEventCreateWithFlags(&downloaded[c], cudaEventDisableTiming));
+  }
+  // Chunk k is downloaded while chunk k - 1 is copied out
+  const size_t num = (N + STAGING_CHUNK - 1UL) / STAGING_CHUNK;
+  for (size_t k = 0UL; k <= num; ++k) {
+    if (k < num) {
+      const size_t offset = k * STAGING_CHUNK;
+      CUDA_CHECK(cudaMemcpyAsync(chunks[k % 2], static_cast<const char*>(X) + offset,
+          std::min(STAGING_CHUNK, N - offset), cudaMemcpyDeviceToHost, stream));
+      CUDA_CHECK(cudaEventRecord(downloaded[k % 2], stream));
+    }
+    if (k > 0UL) {
+      const size_t offset = (k - 1UL) * STAGING_CHUNK;
+      CUDA_CHECK(cudaEventSynchronize(downloaded[(k - 1UL) % 2]));
+      caffe_parallel_memcpy(std::min(STAGING_CHUNK, N - offset), chunks[(k - 1UL) % 2],
+          static_cast<char*>(Y) + offset);
+    }
+  }
+  for (int c = 0; c < 2; ++c) {
+    CUDA_CHECK(cudaEventDestroy(downloaded[c]));
+    HostMemoryPool::Free(chunks[c], STAGING_CHUNK);
+  }
+}
+#endif
+
 template <>
 void caffe_scal<float>(const int N, const float alpha, float *X) {
   cblas_sscal(N, alpha, X, 1);
@@ -186,9 +541,15 @@ void caffe_scal<double>(const int N, const double alpha, double *X) {
 #ifndef CPU_ONLY
 template <>
 void caffe_scal<float16>(const int N, const float16 alpha, float16 *X) {
-  // cblas_hscal(N, alpha, X, 1); ?
-  for (int i = 0; i < N; ++i) {
-    X[i] = alpha * X[i];
+  const float a = static_cast<float>(alpha);
+  float x[FP16_CHUNK];
+  for (int i = 0; i < N; i += FP16_CHUNK) {
+    const int n = std::min(FP16_CHUNK, N - i);
+    caffe_cpu_convert(n, X + i, x);
+    for (int j = 0; j < n; ++j) {
+      x[j] *= a;
+    }
+    caffe_cpu_convert(n, x, X + i);
   }
 }
 #endif
@@ -209,8 +570,16 @@ void caffe_cpu_axpby<double>(const int N, const double alpha, const double* X,
 template <>
 void caffe_cpu_axpby<float16>(const int N, const float16 alpha,
     const float16* X, const float16 beta, float16* Y) {
-  for (int i = 0; i < N; ++i) {
-    Y[i] = alpha * X[i] + beta * Y[i];
+  const float a = static_cast<float>(alpha), b = static_cast<float>(beta);
+  float x[FP16_CHUNK], y[FP16_CHUNK];
+  for (int i = 0; i < N; i += FP16_CHUNK) {
+    const int n = std::min(FP16_CHUNK, N - i);
+    caffe_cpu_convert(n, X + i, x);
+    caffe_cpu_convert(n, Y + i, y);
+    for (int j = 0; j < n; ++j) {
+      y[j] = a * x[j] + b * y[j];
+    }
+    caffe_cpu_convert(n, y, Y + i);
   }
 }
 #endif
@@ -544,6 +913,18 @@ template <>
 float16 caffe_cpu_strided_dot<float16>(const int n, const float16* x,
     const int incx, const float16 *y, const int incy) {
   float sum = 0.0f;
+  if (incx == 1 && incy == 1) {
+    float xv[FP16_CHUNK], yv[FP16_CHUNK];
+    for (int i = 0; i < n; i += FP16_CHUNK) {
+      const int m = std::min(FP16_CHUNK, n - i);
+      caffe_cpu_convert(m, x + i, xv);
+      caffe_cpu_convert(m, y + i, yv);
+      for (int j = 0; j < m; ++j) {
+        sum += xv[j] * yv[j];
+      }
+    }
+    return float16(sum);
+  }
   int idx_x, idx_y;
   for (int i = 0; i < n; ++i) {
     idx_x = i*incx;
@@ -637,8 +1018,13 @@ float caffe_cpu_asum<double>(const int n, const double* x) {
 template <>
 float caffe_cpu_asum<float16>(const int n, const float16 *x) {
   float sum = 0.0f;
-  for (int i = 0; i < n; ++i) {
-    sum += fabs(x[i]);
+  float xv[FP16_CHUNK];
+  for (int i = 0; i < n; i += FP16_CHUNK) {
+    const int m = std::min(FP16_CHUNK, n - i);
+    caffe_cpu_convert(m, x + i, xv);
+    for (int j = 0; j < m; ++j) {
+      sum += std::fabs(xv[j]);
+    }
   }
   return sum;
 }
@@ -660,10 +1046,17 @@ void caffe_cpu_scale<double>(const int n, const double alpha, const double *x,
 
 #ifndef CPU_ONLY
 template <>
-void caffe_cpu_scale<float16>(const int n, const float16 alpha,  // TODO
+void caffe_cpu_scale<float16>(const int n, const float16 alpha,
     const float16 *x, float16 *y) {
-  for (int i = 0; i < n; i++) {
-    y[i] = alpha * x[i];
+  const float a = static_cast<float>(alpha);
+  float v[FP16_CHUNK];
+  for (int i = 0; i < n; i += FP16_CHUNK) {
+    const int m = std::min(FP16_CHUNK, n - i);
+    caffe_cpu_convert(m, x + i, v);
+    for (int j = 0; j < m; ++j) {
+      v[j] *= a;
+    }
+    caffe_cpu_convert(m, v, y + i);
   }
 }
 #endif
@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <device_launch_parameters.h>
 
+#include "caffe/util/elementwise.cuh"
 #include "caffe/util/half.cuh"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/gpu_math_functions.cuh"
@@ -21,7 +22,7 @@ void caffe_gpu_gemm<float>(const CBLAS_TRANSPOSE TransA,
       (TransB == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
   CUBLAS_CHECK(cublasSgemm(Caffe::cublas_handle(), cuTransB, cuTransA,
       N, M, K, &alpha, B, ldb, A, lda, &beta, C, N));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template<>
@@ -38,7 +39,7 @@ void caffe_gpu_gemm<double>(const CBLAS_TRANSPOSE TransA,
       (TransB == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
   CUBLAS_CHECK(cublasDgemm(Caffe::cublas_handle(), cuTransB, cuTransA,
       N, M, K, &alpha, B, ldb, A, lda, &beta, C, N));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template<>
@@ -80,7 +81,59 @@ void caffe_gpu_gemm<float16>(const CBLAS_TRANSPOSE TransA,
         A->gethp<half>(), CAFFE_DATA_HALF, lda, &beta_fp32, C->gethp<half>(),
         CAFFE_DATA_HALF, N));
   }
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
+}
+
+template<>
+void caffe_gpu_gemm_strided_batched<float>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const float alpha, const float* A, long long stride_a, const float* B,
+    long long stride_b, const float beta, float* C, long long stride_c, int batch) {
+  const int lda = (TransA == CblasNoTrans) ? K : M;
+  const int ldb = (TransB == CblasNoTrans) ? N : K;
+  cublasOperation_t cuTransA = (TransA == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  cublasOperation_t cuTransB = (TransB == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  CUBLAS_CHECK(cublasSgemmStridedBatched(Caffe::cublas_handle(), cuTransB, cuTransA,
+      N, M, K, &alpha, B, ldb, stride_b, A, lda, stride_a, &beta, C, N, stride_c, batch));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
+}
+
+template<>
+void caffe_gpu_gemm_strided_batched<double>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const double alpha, const double* A, long long stride_a, const double* B,
+    long long stride_b, const double beta, double* C, long long stride_c, int batch) {
+  const int lda = (TransA == CblasNoTrans) ? K : M;
+  const int ldb = (TransB == CblasNoTrans) ? N : K;
+  cublasOperation_t cuTransA = (TransA == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  cublasOperation_t cuTransB = (TransB == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  CUBLAS_CHECK(cublasDgemmStridedBatched(Caffe::cublas_handle(), cuTransB, cuTransA,
+      N, M, K, &alpha, B, ldb, stride_b, A, lda, stride_a, &beta, C, N, stride_c, batch));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
+}
+
+template<>
+void caffe_gpu_gemm_strided_batched<float16>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const float16 alpha, const float16* A, long long stride_a, const float16* B,
+    long long stride_b, const float16 beta, float16* C, long long stride_c, int batch) {
+  if (Caffe::device_capability(Caffe::current_device()) < 503) {
+    // No native half arithmetic, caffe_gpu_gemm computes it in fp32
+    for (int i = 0; i < batch; ++i) {
+      caffe_gpu_gemm<float16>(TransA, TransB, M, N, K, alpha, A + i * stride_a,
+          B + i * stride_b, beta, C + i * stride_c);
+    }
+    return;
+  }
+  const int lda = (TransA == CblasNoTrans) ? K : M;
+  const int ldb = (TransB == CblasNoTrans) ? N : K;
+  cublasOperation_t cuTransA = (TransA == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  cublasOperation_t cuTransB = (TransB == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  CUBLAS_CHECK(cublasHgemmStridedBatched(Caffe::cublas_handle(), cuTransB, cuTransA,
+      N, M, K, alpha.gethp<half>(), B->gethp<half>(), ldb, stride_b,
+      A->gethp<half>(), lda, stride_a, beta.gethp<half>(), C->gethp<half>(), N, stride_c,
+      batch));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template<>
@@ -91,7 +144,7 @@ void caffe_gpu_gemv<float>(const CBLAS_TRANSPOSE TransA, const int M,
       (TransA == CblasNoTrans) ? CUBLAS_OP_T : CUBLAS_OP_N;
   CUBLAS_CHECK(cublasSgemv(Caffe::cublas_handle(), cuTransA, N, M, &alpha,
       A, N, x, 1, &beta, y, 1));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template<>
@@ -102,7 +155,7 @@ void caffe_gpu_gemv<double>(const CBLAS_TRANSPOSE TransA, const int M,
       (TransA == CblasNoTrans) ? CUBLAS_OP_T : CUBLAS_OP_N;
   CUBLAS_CHECK(cublasDgemv(Caffe::cublas_handle(), cuTransA, N, M, &alpha,
       A, N, x, 1, &beta, y, 1));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template<>
@@ -127,7 +180,7 @@ void caffe_gpu_gemv<float16>(const CBLAS_TRANSPOSE TransA, const int M,
         x, CAFFE_DATA_HALF, k, &beta_fp32,
         y, CAFFE_DATA_HALF, LDC));
   }
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template<>
@@ -138,7 +191,7 @@ void caffe_gpu_axpy<float>(const int N, const float alpha, const float* X,
   cudaStream_t stream;
   CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
   CUBLAS_CHECK(cublasSaxpy(cublas_handle, N, &alpha, X, 1, Y, 1));
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -149,7 +202,7 @@ void caffe_gpu_axpy<double>(const int N, const double alpha, const double* X,
   cudaStream_t stream;
   CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
   CUBLAS_CHECK(cublasDaxpy(cublas_handle, N, &alpha, X, 1, Y, 1));
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<typename Dtype, typename Mtype>
@@ -188,21 +241,166 @@ void caffe_gpu_axpy<float16>(const int N, const float16 alpha, const float16* x,
   axpy_kernel<<<CAFFE_GET_BLOCKS_HALF(N), CAFFE_CUDA_NUM_THREADS_HALF, 0, stream>>>
       (N, ha, reinterpret_cast<const half*>(x), reinterpret_cast<half*>(y));
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 void caffe_gpu_memcpy(const size_t N, const void* X, void* Y) {
   if (X != Y) {
     cudaStream_t stream = Caffe::thread_stream();
     CUDA_CHECK(cudaMemcpyAsync(Y, X, N, cudaMemcpyDefault, stream));
-    CUDA_CHECK(cudaStreamSynchronize(stream));
+    CUDA_CHECK(caffe_gpu_sync(stream));
   }
 }
 
-__global__
-void scale_in_place_kernel(const int n, const half alpha, half* x) {
-  CUDA_KERNEL_LOOP(idx, n) {
-    x[idx] = hmul(alpha, x[idx]);
+template <typename T>
+__global__ void gather_rows_kernel(const int count, const int width, const int* rows,
+    const T* x, T* y) {
+  CUDA_KERNEL_LOOP(i, count) {
+    y[i] = x[rows[i / width] * width + i % width];
+  }
+}
+
+template <typename T>
+__global__ void scatter_rows_kernel(const int count, const int width, const int* rows,
+    const T* x, T* y) {
+  CUDA_KERNEL_LOOP(i, count) {
+    y[rows[i / width] * width + i % width] = x[i];
+  }
+}
+
+// Copies only, so types of the same size are alike
+template <typename T>
+void copy_rows(bool gather, int n, int width, const int* rows, const void* X, void* Y,
+    cudaStream_t stream) {
+  const int count = n * width;
+  if (gather) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    gather_rows_kernel<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        count, width, rows, static_cast<const T*>(X), static_cast<T*>(Y));
+  } else {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    scatter_rows_kernel<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        count, width, rows, static_cast<const T*>(X), static_cast<T*>(Y));
+  }
+  CUDA_POST_KERNEL_CHECK;
+}
+
+void copy_rows(Type type, bool gather, int n, int width, const int* rows, const void* X,
+    void* Y, cudaStream_t stream) {
+  if (n == 0) {
+    return;
+  }
+  switch (tsize(type)) {
+    case 2:
+      copy_rows<unsigned short>(gather, n, width, rows, X, Y, stream);
+      break;
+    case 4:
+      copy_rows<unsigned int>(gather, n, width, rows, X, Y, stream);
+      break;
+    case 8:
+      copy_rows<unsigned long long>(gather, n, width, rows, X, Y, stream);
+      break;
+    default:
+      LOG(FATAL) << "Unsupported type " << Type_Name(type);
+  }
+}
+
+void caffe_gpu_gather_rows(Type type, int n, int width, const int* rows, const void* X,
+    void* Y, cudaStream_t stream) {
+  copy_rows(type, true, n, width, rows, X, Y, stream);
+}
+
+void caffe_gpu_scatter_rows(Type type, int n, int width, const int* rows, const void* X,
+    void* Y, cudaStream_t stream) {
+  copy_rows(type, false, n, width, rows, X, Y, stream);
+}
+
+#define STRIDED_COPY_MAX_AXES 8
+
+struct StridedCopyArgs {
+  int num_axes;
+  int gather_axis;
+  int shape[STRIDED_COPY_MAX_AXES];
+  int x_strides[STRIDED_COPY_MAX_AXES];
+  int y_strides[STRIDED_COPY_MAX_AXES];
+};
+
+// One thread per element in Y's order: with Y's innermost axis contiguous the stores
+// coalesce, and so do the loads where X's is too
+template <typename T>
+__global__ void strided_copy_kernel(const int count, const StridedCopyArgs args,
+    const int* gather, const T* x, T* y) {
+  CUDA_KERNEL_LOOP(index, count) {
+    int rest = index, xi = 0, yi = 0;
+    for (int k = args.num_axes - 1; k >= 0; --k) {
+      const int i = rest % args.shape[k];
+      rest /= args.shape[k];
+      xi += (gather != nullptr && k == args.gather_axis ? gather[i] : i) * args.x_strides[k];
+      yi += i * args.y_strides[k];
+    }
+    y[yi] = x[xi];
+  }
+}
+
+template <typename T>
+void strided_copy(int count, const StridedCopyArgs& args, const int* gather, const void* X,
+    void* Y, cudaStream_t stream) {
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  strided_copy_kernel<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      count, args, gather, static_cast<const T*>(X), static_cast<T*>(Y));
+  CUDA_POST_KERNEL_CHECK;
+}
+
+void caffe_gpu_strided_copy(Type type, const vector<int>& shape, const void* X,
+    const vector<int>& x_strides, void* Y, const vector<int>& y_strides,
+    cudaStream_t stream, const int* gather, int gather_axis) {
+  CHECK_EQ(shape.size(), x_strides.size());
+  CHECK_EQ(shape.size(), y_strides.size());
+  StridedCopyArgs args;
+  args.num_axes = 0;
+  args.gather_axis = -1;
+  int count = 1;
+  // Axes of size 1 are dropped, and an axis is merged into the previous one when
+  // both are contiguous in X and Y alike.
+  for (int k = 0; k < shape.size(); ++k) {
+    const bool gathered = gather != nullptr && k == gather_axis;
+    count *= shape[k];
+    if (shape[k] == 1 && !gathered) {
+      continue;
+    }
+    const int last = args.num_axes - 1;
+    if (last >= 0 && !gathered && last != args.gather_axis &&
+        args.x_strides[last] == shape[k] * x_strides[k] &&
+        args.y_strides[last] == shape[k] * y_strides[k]) {
+      args.shape[last] *= shape[k];
+      args.x_strides[last] = x_strides[k];
+      args.y_strides[last] = y_strides[k];
+      continue;
+    }
+    CHECK_LT(args.num_axes, STRIDED_COPY_MAX_AXES) << "Too many axes to copy";
+    if (gathered) {
+      args.gather_axis = args.num_axes;
+    }
+    args.shape[args.num_axes] = shape[k];
+    args.x_strides[args.num_axes] = x_strides[k];
+    args.y_strides[args.num_axes] = y_strides[k];
+    ++args.num_axes;
+  }
+  if (count == 0) {
+    return;
+  }
+  switch (tsize(type)) {
+    case 2:
+      strided_copy<unsigned short>(count, args, gather, X, Y, stream);
+      break;
+    case 4:
+      strided_copy<unsigned int>(count, args, gather, X, Y, stream);
+      break;
+    case 8:
+      strided_copy<unsigned long long>(count, args, gather, X, Y, stream);
+      break;
+    default:
+      LOG(FATAL) << "Unsupported type " << Type_Name(type);
   }
 }
 
@@ -212,7 +410,7 @@ void caffe_gpu_scal<float>(const int N, const float alpha, float* X, cublasHandl
   cudaStream_t stream;
   CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
   CUBLAS_CHECK(cublasSscal(cublas_handle, N, &alpha, X, 1));
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -222,7 +420,7 @@ void caffe_gpu_scal<double>(const int N, const double alpha, double* X,
   cudaStream_t stream;
   CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
   CUBLAS_CHECK(cublasDscal(cublas_handle, N, &alpha, X, 1));
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -231,13 +429,9 @@ void caffe_gpu_scal<float16>(const int n, const float16 alpha, float16* x,
   if (alpha.getx() == 0x3c00U) { return; }
   cudaStream_t stream;
   CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
-  half ha;
-  ha.setx(alpha.getx());
   // use cublasHscal when it will become available
-  scale_in_place_kernel <<<CAFFE_GET_BLOCKS_HALF(n), CAFFE_CUDA_NUM_THREADS_HALF, 0, stream>>>
-      (n, ha, reinterpret_cast<half*>(x));
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  caffe_gpu_elementwise(n, ScaleOp<float>(alpha), stream, x, x);
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -269,41 +463,31 @@ void caffe_gpu_axpby<double>(const int N, const double alpha, const double* X,
   caffe_gpu_axpy<double>(N, alpha, X, Y);
 }
 
-template<typename Dtype, typename Mtype>
-__global__
-void axpby_kernel(const int N, const Mtype alpha, const Dtype* X, const Mtype beta, Dtype* Y) {
-  CUDA_KERNEL_LOOP(idx, N) {
-    Y[idx] = alpha * X[idx] + beta * Y[idx];
-  }
-}
-
 template<>
 void caffe_gpu_axpby<float16>(const int N, const float16 alpha,
     const float16* X, const float16 beta, float16* Y) {
   cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  axpby_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, alpha, X, beta, Y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  caffe_gpu_elementwise(N, AxpbyOp<float>(alpha, beta), stream, Y, X, Y);
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
 void caffe_gpu_dot<float, float>(const int n, const float* x, const float* y, float* out) {
   CUBLAS_CHECK(cublasSdot(Caffe::cublas_handle(), n, x, 1, y, 1, out));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template<>
 void caffe_gpu_dot<double, double>(const int n, const double* x, const double* y, double* out) {
   CUBLAS_CHECK(cublasDdot(Caffe::cublas_handle(), n, x, 1, y, 1, out));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template<>
 void caffe_gpu_dot<double, float>(const int n, const double* x, const double* y, float* outf) {
   double out = 0.;
   CUBLAS_CHECK(cublasDdot(Caffe::cublas_handle(), n, x, 1, y, 1, &out));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
   *outf = static_cast<float>(out);
 }
 
@@ -334,7 +518,7 @@ caffe_gpu_dot<float16, float16>(const int n, const float16* x, const float16* y,
   // NOLINT_NEXT_LINE(whitespace/operators)
   gpu_dot_kernel<<<1, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n, x, y, res);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
   *out = static_cast<float16>(*res);
 }
 
@@ -345,33 +529,107 @@ void caffe_gpu_dot<float16, float>(const int n, const float16* x, const float16*
   // NOLINT_NEXT_LINE(whitespace/operators)
   gpu_dot_kernel<<<1, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n, x, y, res);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
   *out = *res;
 }
 
+template<typename Dtype>
+__global__
+void gpu_dot_add_kernel(const int N, const Dtype* x, const Dtype* y, float* out) {
+  __shared__
+  float cache[CAFFE_CUDA_NUM_THREADS];
+  const int tidx = threadIdx.x;
+  cache[tidx] = 0.F;
+  for (int i = tidx; i < N; i += blockDim.x) {
+    cache[tidx] += static_cast<float>(x[i]) * static_cast<float>(y[i]);
+  }
+  __syncthreads();
+  for (int s = CAFFE_CUDA_NUM_THREADS / 2; s > 0; s >>= 1) {
+    if (tidx < s) cache[tidx] += cache[tidx + s];
+    __syncthreads();
+  }
+  // Layers of concurrent branches may add to the same place
+  if (tidx == 0) atomicAdd(out, cache[tidx]);
+}
+
+template<typename Dtype>
+__global__
+void add_to_float_kernel(const int N, const Dtype* x, float* y) {
+  CUDA_KERNEL_LOOP(i, N) {
+    y[i] += static_cast<float>(x[i]);
+  }
+}
+
+void caffe_gpu_dot_add(Type type, const int n, const void* x, const void* y, float* out,
+    cudaStream_t stream) {
+  switch (type) {
+    case FLOAT:
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      gpu_dot_add_kernel<<<1, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n,
+          static_cast<const float*>(x), static_cast<const float*>(y), out);
+      break;
+    case FLOAT16:
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      gpu_dot_add_kernel<<<1, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n,
+          static_cast<const float16*>(x), static_cast<const float16*>(y), out);
+      break;
+    case DOUBLE:
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      gpu_dot_add_kernel<<<1, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n,
+          static_cast<const double*>(x), static_cast<const double*>(y), out);
+      break;
+    default:
+      LOG(FATAL) << "Unsupported type " << Type_Name(type);
+  }
+  CUDA_POST_KERNEL_CHECK;
+}
+
+void caffe_gpu_add_to(Type type, const int n, const void* x, float* y, cudaStream_t stream) {
+  switch (type) {
+    case FLOAT:
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      add_to_float_kernel<<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n,
+          static_cast<const float*>(x), y);
+      break;
+    case FLOAT16:
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      add_to_float_kernel<<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n,
+          static_cast<const float16*>(x), y);
+      break;
+    case DOUBLE:
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      add_to_float_kernel<<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n,
+          static_cast<const double*>(x), y);
+      break;
+    default:
+      LOG(FATAL) << "Unsupported type " << Type_Name(type);
+  }
+  CUDA_POST_KERNEL_CHECK;
+}
+
 template<>
 void caffe_gpu_asum<float, float>(const int n, const float* x, float* y) {
   CUBLAS_CHECK(cublasSasum(Caffe::cublas_handle(), n, x, 1, y));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template<>
 void caffe_gpu_asum<float, double>(const int n, const float* x, double* y) {
   float yf;
   CUBLAS_CHECK(cublasSasum(Caffe::cublas_handle(), n, x, 1, &yf));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
   *y = yf;
 }
 template<>
 void caffe_gpu_asum<double, double>(const int n, const double* x, double* y) {
   CUBLAS_CHECK(cublasDasum(Caffe::cublas_handle(), n, x, 1, y));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 template<>
 void caffe_gpu_asum<double, float>(const int n, const double* x, float* y) {
   double yd;
   CUBLAS_CHECK(cublasDasum(Caffe::cublas_handle(), n, x, 1, &yd));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
   *y = yd;
 }
 
@@ -380,7 +638,7 @@ void caffe_gpu_scale<double>(const int n, const double alpha, const double* x,
     double* y) {
   CUBLAS_CHECK(cublasDcopy(Caffe::cublas_handle(), n, x, 1, y, 1));
   CUBLAS_CHECK(cublasDscal(Caffe::cublas_handle(), n, &alpha, y, 1));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template<>
@@ -388,26 +646,14 @@ void caffe_gpu_scale<float>(const int n, const float alpha, const float* x,
     float* y) {
   CUBLAS_CHECK(cublasScopy(Caffe::cublas_handle(), n, x, 1, y, 1));
   CUBLAS_CHECK(cublasSscal(Caffe::cublas_handle(), n, &alpha, y, 1));
-  CUDA_CHECK(cudaStreamSynchronize(Caffe::thread_stream()));
-}
-
-__global__
-void scale_kernel(const int n, const half alpha, const half* x, half* y) {
-  CUDA_KERNEL_LOOP(idx, n) {
-    y[idx] = hmul(alpha, x[idx]);
-  }
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
 }
 
 template<>
 void caffe_gpu_scale<float16>(const int n, const float16 alpha, const float16* x, float16* y) {
   cudaStream_t stream = Caffe::thread_stream();
-  half ha;
-  ha.setx(alpha.getx());
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  scale_kernel <<<CAFFE_GET_BLOCKS_HALF(n), CAFFE_CUDA_NUM_THREADS_HALF, 0, stream>>>
-      (n, ha, reinterpret_cast<const half*>(x), reinterpret_cast<half*>(y));
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  caffe_gpu_elementwise(n, ScaleOp<float>(alpha), stream, y, x);
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<typename Dtype>
@@ -427,7 +673,7 @@ void caffe_gpu_set(const size_t N, const Dtype alpha, Dtype* Y) {
     set_kernel <<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, alpha, Y);
     CUDA_POST_KERNEL_CHECK;
   }
-  CUDA_CHECK_ARG2(cudaStreamSynchronize(stream), stream, Caffe::current_device());
+  CUDA_CHECK_ARG2(caffe_gpu_sync(stream), stream, Caffe::current_device());
 }
 
 template void
@@ -439,158 +685,109 @@ caffe_gpu_set<double>(const size_t N, const double alpha, double* Y);
 template void
 caffe_gpu_set<float16>(const size_t N, const float16 alpha, float16* Y);
 
-template<typename Dtype>
-__global__ void add_scalar_kernel(const int n, const Dtype alpha, Dtype* y) {
-  CUDA_KERNEL_LOOP(index, n) {
-    y[index] += alpha;
-  }
-}
+#define SCALED_SUM_THREADS 512
 
-template<>
-void caffe_gpu_add_scalar(const int N, const float alpha, float* Y) {
-  cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators
-  add_scalar_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, alpha, Y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+__device__ __inline__ void scaled_sum_store(float v, float* y) {
+  *y = v;
 }
 
-template<>
-void caffe_gpu_add_scalar(const int N, const double alpha, double* Y) {
-  cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  add_scalar_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, alpha, Y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+__device__ __inline__ void scaled_sum_store(float v, double* y) {
+  *y = v;
 }
 
-template<>
-void caffe_gpu_add_scalar(const int N, const float16 alpha, float16* Y) {
-  cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  add_scalar_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, alpha, Y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+__device__ __inline__ void scaled_sum_store(float v, half* y) {
+  *y = float2half_clip(v);
 }
 
 template<typename Dtype>
-__global__ void add_kernel(const int n, const Dtype* a, const Dtype* b, Dtype* y) {
-  CUDA_KERNEL_LOOP(index, n) {
-    y[index] = a[index] + b[index];
+__global__ void scaled_sum_kernel(const int n, const float* x, const float alpha, Dtype* y) {
+  __shared__ float partial[SCALED_SUM_THREADS];
+  float sum = 0.F;
+  for (int i = threadIdx.x; i < n; i += SCALED_SUM_THREADS) {
+    sum += x[i];
   }
-}
-
-template<>
-__global__ void add_kernel<half>(const int n, const half* a, const half* b, half* y) {
-  CUDA_KERNEL_LOOP(index, n) {
-    y[index] = hadd(a[index], b[index]);
+  partial[threadIdx.x] = sum;
+  __syncthreads();
+  for (int stride = SCALED_SUM_THREADS / 2; stride > 0; stride /= 2) {
+    if (threadIdx.x < stride) {
+      partial[threadIdx.x] += partial[threadIdx.x + stride];
+    }
+    __syncthreads();
+  }
+  if (threadIdx.x == 0) {
+    scaled_sum_store(alpha * partial[0], y);
   }
 }
 
-template<>
-void caffe_gpu_add<float>(const int N, const float* a, const float* b, float* y) {
+// One block: meant for per sample or per element loss terms
+template<typename Dtype>
+void caffe_gpu_scaled_sum(const int n, const float* x, const float alpha, Dtype* y) {
   cudaStream_t stream = Caffe::thread_stream();
   // NOLINT_NEXT_LINE(whitespace/operators)
-  add_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, a, b, y);
+  scaled_sum_kernel<<<1, SCALED_SUM_THREADS, 0, stream>>>(n, x, alpha, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
 }
 
 template<>
-void caffe_gpu_add<double>(const int N, const double* a, const double* b, double* y) {
+void caffe_gpu_scaled_sum<float16>(const int n, const float* x, const float alpha,
+    float16* y) {
   cudaStream_t stream = Caffe::thread_stream();
   // NOLINT_NEXT_LINE(whitespace/operators)
-  add_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, a, b, y);
+  scaled_sum_kernel<<<1, SCALED_SUM_THREADS, 0, stream>>>(n, x, alpha,
+      reinterpret_cast<half*>(y));
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
 }
 
-template<>
-void caffe_gpu_add<float16>(const int N, const float16* a, const float16* b, float16* y) {
-  cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  add_kernel<<<CAFFE_GET_BLOCKS_HALF(N), CAFFE_CUDA_NUM_THREADS_HALF, 0, stream>>>
-      (N, reinterpret_cast<const half*>(a), reinterpret_cast<const half*>(b),
-       reinterpret_cast<half*>(y));
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
-}
+template void
+caffe_gpu_scaled_sum<float>(const int n, const float* x, const float alpha, float* y);
+template void
+caffe_gpu_scaled_sum<double>(const int n, const float* x, const float alpha, double* y);
 
 template<typename Dtype>
-__global__ void incr_kernel(const int n, const Dtype* a, Dtype* b) {
-  CUDA_KERNEL_LOOP(index, n) {
-    b[index] += a[index];
-  }
-}
-
-template<>
-__global__ void incr_kernel<half>(const int n, const half* a, half* b) {
-  CUDA_KERNEL_LOOP(index, n) {
-    b[index] = hadd(a[index], b[index]);
-  }
-}
-
-template<>
-void caffe_gpu_incr<float>(const int N, const float* a, float* b) {
+void caffe_gpu_add_scalar(const int N, const Dtype alpha, Dtype* Y) {
+  typedef typename MultiTensorAcc<Dtype>::type A;
   cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  incr_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, a, b);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  caffe_gpu_elementwise(N, AddScalarOp<A>(alpha), stream, Y, Y);
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
-template<>
-void caffe_gpu_incr<double>(const int N, const double* a, double* b) {
-  cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  incr_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, a, b);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
-}
+template void caffe_gpu_add_scalar<float>(const int N, const float alpha, float* Y);
+template void caffe_gpu_add_scalar<double>(const int N, const double alpha, double* Y);
+template void caffe_gpu_add_scalar<float16>(const int N, const float16 alpha, float16* Y);
 
-template<>
-void caffe_gpu_incr<float16>(const int N, const float16* a, float16* b) {
+template<typename Dtype>
+void caffe_gpu_add(const int N, const Dtype* a, const Dtype* b, Dtype* y) {
   cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  incr_kernel<<<CAFFE_GET_BLOCKS_HALF(N), CAFFE_CUDA_NUM_THREADS_HALF, 0, stream>>>
-      (N, reinterpret_cast<const half*>(a), reinterpret_cast<half*>(b));
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  caffe_gpu_elementwise(N, AddOp(), stream, y, a, b);
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
-template<typename Dtype>
-__global__ void sub_kernel(const int n, const Dtype* a,
-    const Dtype* b, Dtype* y) {
-  CUDA_KERNEL_LOOP(index, n) {
-    y[index] = a[index] - b[index];
-  }
-}
+template void caffe_gpu_add<float>(const int N, const float* a, const float* b, float* y);
+template void caffe_gpu_add<double>(const int N, const double* a, const double* b, double* y);
+template void caffe_gpu_add<float16>(const int N, const float16* a, const float16* b,
+    float16* y);
 
-template<>
-void caffe_gpu_sub<float>(const int N, const float* a, const float* b, float* y) {
+template<typename Dtype>
+void caffe_gpu_incr(const int N, const Dtype* a, Dtype* b) {
   cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  sub_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, a, b, y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  caffe_gpu_elementwise(N, AddOp(), stream, b, a, b);
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
-template<>
-void caffe_gpu_sub<double>(const int N, const double* a, const double* b, double* y) {
-  cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  sub_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, a, b, y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
-}
+template void caffe_gpu_incr<float>(const int N, const float* a, float* b);
+template void caffe_gpu_incr<double>(const int N, const double* a, double* b);
+template void caffe_gpu_incr<float16>(const int N, const float16* a, float16* b);
 
-template<>
-void caffe_gpu_sub<float16>(const int N, const float16* a, const float16* b, float16* y) {
+template<typename Dtype>
+void caffe_gpu_sub(const int N, const Dtype* a, const Dtype* b, Dtype* y) {
   cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  sub_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, a, b, y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  caffe_gpu_elementwise(N, SubOp(), stream, y, a, b);
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
+template void caffe_gpu_sub<float>(const int N, const float* a, const float* b, float* y);
+template void caffe_gpu_sub<double>(const int N, const double* a, const double* b, double* y);
+template void caffe_gpu_sub<float16>(const int N, const float16* a, const float16* b,
+    float16* y);
+
 }  // namespace caffe
@@ -2,6 +2,7 @@
 #include <device_launch_parameters.h>
 
 #include "caffe/common.hpp"
+#include "caffe/util/elementwise.cuh"
 #include "caffe/util/gpu_math_functions.cuh"
 #include "caffe/util/math_functions.hpp"
 
@@ -9,109 +10,39 @@ namespace caffe {
 
 
 template<typename Dtype>
-__global__ void mul_kernel(const int n, const Dtype* a, const Dtype* b, Dtype* y) {
-  CUDA_KERNEL_LOOP(index, n) {
-    y[index] = a[index] * b[index];
-  }
-}
-
-template<>
-void caffe_gpu_mul<float>(const int N, const float* a, const float* b, float* y) {
+void caffe_gpu_mul(const int N, const Dtype* a, const Dtype* b, Dtype* y) {
   cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  mul_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, a, b, y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
-}
-
-template<>
-void caffe_gpu_mul<double>(const int N, const double* a, const double* b, double* y) {
-  cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  mul_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, a, b, y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
-}
-
-template<>
-void caffe_gpu_mul<float16>(const int N, const float16* a, const float16* b, float16* y) {
-  cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  mul_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, a, b, y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  caffe_gpu_elementwise(N, MulOp(), stream, y, a, b);
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
-
-
+template void caffe_gpu_mul<float>(const int N, const float* a, const float* b, float* y);
+template void caffe_gpu_mul<double>(const int N, const double* a, const double* b, double* y);
+template void caffe_gpu_mul<float16>(const int N, const float16* a, const float16* b,
+    float16* y);
 
 template<typename Dtype>
-__global__ void square_kernel(const int n, const Dtype* a, Dtype* y) {
-  CUDA_KERNEL_LOOP(index, n) {
-    y[index] = a[index] * a[index];
-  }
-}
-
-template<>
-void caffe_gpu_square<float>(const int N, const float* a, float* y) {
+void caffe_gpu_square(const int N, const Dtype* a, Dtype* y) {
   cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  square_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, a, y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  caffe_gpu_elementwise(N, SquareOp(), stream, y, a);
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
-template<>
-void caffe_gpu_square<double>(const int N, const double* a, double* y) {
-  cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  square_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, a, y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
-}
-
-template<>
-void caffe_gpu_square<float16>(const int N, const float16* a, float16* y) {
-  cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  square_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, a, y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
-}
+template void caffe_gpu_square<float>(const int N, const float* a, float* y);
+template void caffe_gpu_square<double>(const int N, const double* a, double* y);
+template void caffe_gpu_square<float16>(const int N, const float16* a, float16* y);
 
 template<typename Dtype>
-__global__ void div_kernel(const int n, const Dtype* a, const Dtype* b, Dtype* y) {
-  CUDA_KERNEL_LOOP(index, n) {
-    y[index] = a[index] / b[index];
-  }
-}
-
-template<>
-void caffe_gpu_div<float>(const int N, const float* a, const float* b, float* y) {
-  cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  div_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, a, b, y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
-}
-
-template<>
-void caffe_gpu_div<double>(const int N, const double* a, const double* b, double* y) {
+void caffe_gpu_div(const int N, const Dtype* a, const Dtype* b, Dtype* y) {
   cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  div_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, a, b, y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  caffe_gpu_elementwise(N, DivOp(), stream, y, a, b);
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
-template<>
-void caffe_gpu_div<float16>(const int N, const float16* a, const float16* b, float16* y) {
-  cudaStream_t stream = Caffe::thread_stream();
-  // NOLINT_NEXT_LINE(whitespace/operators)
-  div_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, a, b, y);
-  CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
-}
+template void caffe_gpu_div<float>(const int N, const float* a, const float* b, float* y);
+template void caffe_gpu_div<double>(const int N, const double* a, const double* b, double* y);
+template void caffe_gpu_div<float16>(const int N, const float16* a, const float16* b,
+    float16* y);
 
 template<typename Dtype>
 __global__ void abs_kernel(const int n, const Dtype* a, Dtype* y) {
@@ -126,7 +57,7 @@ void caffe_gpu_abs<float>(const int N, const float* a, float* y) {
   // NOLINT_NEXT_LINE(whitespace/operators)
   abs_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, a, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -135,7 +66,7 @@ void caffe_gpu_abs<double>(const int N, const double* a, double* y) {
   // NOLINT_NEXT_LINE(whitespace/operators)
   abs_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, a, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -144,7 +75,7 @@ void caffe_gpu_abs<float16>(const int N, const float16* a, float16* y) {
   // NOLINT_NEXT_LINE(whitespace/operators)
   abs_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, a, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<typename Dtype>
@@ -160,7 +91,7 @@ void caffe_gpu_exp<float>(const int N, const float* a, float* y) {
   // NOLINT_NEXT_LINE(whitespace/operators)
   exp_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, a, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -169,7 +100,7 @@ void caffe_gpu_exp<double>(const int N, const double* a, double* y) {
   // NOLINT_NEXT_LINE(whitespace/operators)
   exp_kernel<double> <<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, a, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -178,7 +109,7 @@ void caffe_gpu_exp<float16>(const int N, const float16* a, float16* y) {
   // NOLINT_NEXT_LINE(whitespace/operators)
   exp_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, a, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<typename Dtype>
@@ -193,7 +124,7 @@ void caffe_gpu_log<float>(const int N, const float* a, float* y) {
   cudaStream_t stream = Caffe::thread_stream();
   // NOLINT_NEXT_LINE(whitespace/operators)
   log_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, a, y);
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -201,7 +132,7 @@ void caffe_gpu_log<double>(const int N, const double* a, double* y) {
   cudaStream_t stream = Caffe::thread_stream();
   // NOLINT_NEXT_LINE(whitespace/operators)
   log_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, a, y);
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -209,7 +140,7 @@ void caffe_gpu_log<float16>(const int N, const float16* a, float16* y) {
   cudaStream_t stream = Caffe::thread_stream();
   // NOLINT_NEXT_LINE(whitespace/operators)
   log_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, a, y);
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<typename Dtype>
@@ -227,7 +158,7 @@ void caffe_gpu_powx<float>(const int N, const float* a,
   // NOLINT_NEXT_LINE(whitespace/operators)
   powx_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, a, alpha, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -237,7 +168,7 @@ void caffe_gpu_powx<double>(const int N, const double* a,
   // NOLINT_NEXT_LINE(whitespace/operators)
   powx_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, a, alpha, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -247,7 +178,7 @@ void caffe_gpu_powx<float16>(const int N, const float16* a,
   // NOLINT_NEXT_LINE(whitespace/operators)
   powx_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, a, alpha, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 DEFINE_AND_INSTANTIATE_GPU_UNARY_FUNC_AUX(sign,
@@ -305,7 +236,7 @@ void caffe_gpu_convert(const unsigned int N, const T* in, TR* out) {
   // NOLINT_NEXT_LINE(whitespace/operators)
   convert_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(N, in, out);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -317,7 +248,7 @@ void caffe_gpu_convert<float, float16>(const unsigned int n,
   convert_kernel<<<CAFFE_GET_BLOCKS_HALF(n2), CAFFE_CUDA_NUM_THREADS_HALF, 0, stream>>>
       (n2, reinterpret_cast<const float2*>(in), reinterpret_cast<half2*>(out));
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -329,7 +260,7 @@ void caffe_gpu_convert<float16, float>(const unsigned int n,
   convert_kernel<<<CAFFE_GET_BLOCKS_HALF(n2), CAFFE_CUDA_NUM_THREADS_HALF, 0, stream>>>
       (n2, reinterpret_cast<const half2*>(in), reinterpret_cast<float2*>(out));
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template void caffe_gpu_convert<double, float16>(const unsigned int n,
@@ -340,6 +271,19 @@ template void caffe_gpu_convert<double, float>(const unsigned int n,
     const double* in, float* out);
 template void caffe_gpu_convert<float, double>(const unsigned int n,
     const float* in, double* out);
+// Labels, see DataParameter::label_type
+template void caffe_gpu_convert<int, float>(const unsigned int n,
+    const int* in, float* out);
+template void caffe_gpu_convert<int, float16>(const unsigned int n,
+    const int* in, float16* out);
+template void caffe_gpu_convert<int, double>(const unsigned int n,
+    const int* in, double* out);
+template void caffe_gpu_convert<float, int>(const unsigned int n,
+    const float* in, int* out);
+template void caffe_gpu_convert<float16, int>(const unsigned int n,
+    const float16* in, int* out);
+template void caffe_gpu_convert<double, int>(const unsigned int n,
+    const double* in, int* out);
 template<>
 void caffe_gpu_convert<float, float>(const unsigned int n,
     const float* in, float* out) {
@@ -358,6 +302,133 @@ void caffe_gpu_convert<float16, float16>(const unsigned int n,
 }
 #endif
 
+// Passed by value: no device side pointer arrays to allocate and copy
+template<typename T, typename TR>
+struct ConvertBatchArgs {
+  const T* in[CAFFE_CONVERT_BATCH];
+  TR* out[CAFFE_CONVERT_BATCH];
+  unsigned int n[CAFFE_CONVERT_BATCH];
+};
+
+template<typename T, typename TR>
+__global__
+void convert_batch_kernel(const ConvertBatchArgs<T, TR> args) {
+  const T* in = args.in[blockIdx.y];
+  TR* out = args.out[blockIdx.y];
+  const unsigned int n = args.n[blockIdx.y];
+  for (unsigned int i = blockIdx.x * blockDim.x + threadIdx.x; i < n;
+       i += blockDim.x * gridDim.x) {
+    out[i] = in[i];
+  }
+}
+
+template<typename T, typename TR>
+void caffe_gpu_convert_batch(const int num, const T* const* in, TR* const* out,
+    const unsigned int* counts) {
+  CHECK_LE(num, CAFFE_CONVERT_BATCH);
+  ConvertBatchArgs<T, TR> args;
+  unsigned int max_n = 0U;
+  for (int i = 0; i < num; ++i) {
+    args.in[i] = in[i];
+    args.out[i] = out[i];
+    args.n[i] = counts[i];
+    max_n = std::max(max_n, counts[i]);
+  }
+  if (max_n == 0U) {
+    return;
+  }
+  cudaStream_t stream = Caffe::thread_stream();
+  const dim3 grid(CAFFE_GET_BLOCKS(max_n), num);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  convert_batch_kernel<<<grid, CAFFE_CUDA_NUM_THREADS, 0, stream>>>(args);
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template void caffe_gpu_convert_batch<float, float16>(const int num,
+    const float* const* in, float16* const* out, const unsigned int* counts);
+template void caffe_gpu_convert_batch<float16, float>(const int num,
+    const float16* const* in, float* const* out, const unsigned int* counts);
+template void caffe_gpu_convert_batch<double, float16>(const int num,
+    const double* const* in, float16* const* out, const unsigned int* counts);
+template void caffe_gpu_convert_batch<float16, double>(const int num,
+    const float16* const* in, double* const* out, const unsigned int* counts);
+template void caffe_gpu_convert_batch<double, float>(const int num,
+    const double* const* in, float* const* out, const unsigned int* counts);
+template void caffe_gpu_convert_batch<float, double>(const int num,
+    const float* const* in, double* const* out, const unsigned int* counts);
+
+template<typename Dtype>
+__global__
+void compress_fp16_kernel(const int n, const Dtype* g, Dtype* residual, half* out,
+    float scale) {
+  CUDA_KERNEL_LOOP(i, n) {
+    if (residual == nullptr) {
+      out[i] = float2half_clip(static_cast<float>(g[i]) * scale);
+    } else {
+      const float v = static_cast<float>(g[i]) + static_cast<float>(residual[i]);
+      const half h = float2half_clip(v * scale);
+      out[i] = h;
+      residual[i] = v - __half2float(h) / scale;
+    }
+  }
+}
+
+template<typename Dtype>
+__global__
+void decompress_fp16_kernel(const int n, const half* in, Dtype* g, float alpha) {
+  CUDA_KERNEL_LOOP(i, n) {
+    g[i] = __half2float(in[i]) * alpha;
+  }
+}
+
+template<typename Dtype>
+void caffe_gpu_compress_fp16(const int n, const Dtype* g, Dtype* residual, float16* out,
+    float scale) {
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  compress_fp16_kernel<<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>
+      (n, g, residual, reinterpret_cast<half*>(out), scale);
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template<typename Dtype>
+void caffe_gpu_decompress_fp16(const int n, const float16* in, Dtype* g, float alpha) {
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  decompress_fp16_kernel<<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>
+      (n, reinterpret_cast<const half*>(in), g, alpha);
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template void caffe_gpu_compress_fp16<float>(const int n, const float* g, float* residual,
+    float16* out, float scale);
+template void caffe_gpu_compress_fp16<double>(const int n, const double* g, double* residual,
+    float16* out, float scale);
+template void caffe_gpu_decompress_fp16<float>(const int n, const float16* in, float* g,
+    float alpha);
+template void caffe_gpu_decompress_fp16<double>(const int n, const float16* in, double* g,
+    float alpha);
+
+__global__
+void accumulate_fp16_kernel(const int n, half* g, float* acc, bool overwrite) {
+  CUDA_KERNEL_LOOP(i, n) {
+    const float v = __half2float(g[i]);
+    acc[i] = overwrite ? v : acc[i] + v;
+    g[i] = __float2half(0.F);
+  }
+}
+
+void caffe_gpu_accumulate_fp16(const int n, float16* g, float* acc, bool overwrite) {
+  cudaStream_t stream = Caffe::thread_stream();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  accumulate_fp16_kernel<<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>
+      (n, reinterpret_cast<half*>(g), acc, overwrite);
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
 
 void caffe_gpu_rng_uniform(const int n, unsigned int* r) {
   CURAND_CHECK(curandGenerate(Caffe::curand_generator(), r, n));
@@ -422,6 +493,107 @@ void caffe_gpu_rng_gaussian(const int n, const float16 mu, const float16 sigma,
   caffe_gpu_convert(n, rfp, r);
 }
 
+namespace {
+
+// Generator of one fill on the thread stream
+class SeededGenerator {
+ public:
+  explicit SeededGenerator(uint64_t seed) {
+    CURAND_CHECK(curandCreateGenerator(&generator_, CURAND_RNG_PSEUDO_PHILOX4_32_10));
+    CURAND_CHECK(curandSetPseudoRandomGeneratorSeed(generator_, seed));
+    CURAND_CHECK(curandSetStream(generator_, Caffe::thread_stream()));
+  }
+  ~SeededGenerator() {
+    curandDestroyGenerator(generator_);
+  }
+  curandGenerator_t get() const {
+    return generator_;
+  }
+
+ private:
+  curandGenerator_t generator_;
+  DISABLE_COPY_MOVE_AND_ASSIGN(SeededGenerator);
+};
+
+// Scaling and shifting run on other streams than the generator
+template<typename Dtype>
+void scale_uniform(const int n, const Dtype a, const Dtype b, Dtype* r) {
+  CUDA_CHECK(caffe_gpu_sync(Caffe::thread_stream()));
+  const Dtype range = b - a;
+  if (range != static_cast<Dtype>(1)) {
+    caffe_gpu_scal(n, range, r);
+  }
+  if (a != static_cast<Dtype>(0)) {
+    caffe_gpu_add_scalar(n, a, r);
+  }
+}
+
+}  // namespace
+
+template<>
+void caffe_gpu_rng_uniform<float>(const int n, const float a, const float b, float* r,
+    uint64_t seed) {
+  SeededGenerator generator(seed);
+  CURAND_CHECK(curandGenerateUniform(generator.get(), r, n));
+  scale_uniform(n, a, b, r);
+}
+
+template<>
+void caffe_gpu_rng_uniform<double>(const int n, const double a, const double b, double* r,
+    uint64_t seed) {
+  SeededGenerator generator(seed);
+  CURAND_CHECK(curandGenerateUniformDouble(generator.get(), r, n));
+  scale_uniform(n, a, b, r);
+}
+
+template<>
+void caffe_gpu_rng_uniform<float16>(const int n, const float16 a, const float16 b, float16* r,
+    uint64_t seed) {
+  GPUMemory::Workspace rf(n * sizeof(float));
+  float* rfp = static_cast<float*>(rf.data());
+  caffe_gpu_rng_uniform(n, static_cast<float>(a), static_cast<float>(b), rfp, seed);
+  caffe_gpu_convert(n, rfp, r);
+}
+
+// Normal pseudo-random generators draw pairs, odd counts go through a workspace
+template<>
+void caffe_gpu_rng_gaussian<float>(const int n, const float mu, const float sigma, float* r,
+    uint64_t seed) {
+  SeededGenerator generator(seed);
+  if (n % 2 == 0) {
+    CURAND_CHECK(curandGenerateNormal(generator.get(), r, n, mu, sigma));
+  } else {
+    GPUMemory::Workspace rf(even(n) * sizeof(float));
+    float* rfp = static_cast<float*>(rf.data());
+    CURAND_CHECK(curandGenerateNormal(generator.get(), rfp, even(n), mu, sigma));
+    caffe_gpu_memcpy(n * sizeof(float), rfp, r);
+  }
+}
+
+template<>
+void caffe_gpu_rng_gaussian<double>(const int n, const double mu, const double sigma, double* r,
+    uint64_t seed) {
+  SeededGenerator generator(seed);
+  if (n % 2 == 0) {
+    CURAND_CHECK(curandGenerateNormalDouble(generator.get(), r, n, mu, sigma));
+  } else {
+    GPUMemory::Workspace rf(even(n) * sizeof(double));
+    double* rfp = static_cast<double*>(rf.data());
+    CURAND_CHECK(curandGenerateNormalDouble(generator.get(), rfp, even(n), mu, sigma));
+    caffe_gpu_memcpy(n * sizeof(double), rfp, r);
+  }
+}
+
+template<>
+void caffe_gpu_rng_gaussian<float16>(const int n, const float16 mu, const float16 sigma,
+    float16* r, uint64_t seed) {
+  SeededGenerator generator(seed);
+  GPUMemory::Workspace rf(even(n) * sizeof(float));
+  float* rfp = static_cast<float*>(rf.data());
+  CURAND_CHECK(curandGenerateNormal(generator.get(), rfp, even(n), mu, sigma));
+  caffe_gpu_convert(n, rfp, r);
+}
+
 template<typename Dtype>
 __global__ void caffe_gpu_eltwise_max_kernel(const int N, const Dtype alpha, const Dtype* x,
     const Dtype beta, Dtype* y) {
@@ -438,7 +610,7 @@ void caffe_gpu_eltwise_max<float>(const int N, const float alpha, const float* x
   caffe_gpu_eltwise_max_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>
       (N, alpha, x, beta, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 template<>
@@ -449,7 +621,7 @@ void caffe_gpu_eltwise_max<double>(const int N,
   caffe_gpu_eltwise_max_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>
       (N, alpha, x, beta, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 
 #ifndef CPU_ONLY
@@ -461,7 +633,7 @@ void caffe_gpu_eltwise_max<float16>(const int N,
   caffe_gpu_eltwise_max_kernel<<<CAFFE_GET_BLOCKS(N), CAFFE_CUDA_NUM_THREADS, 0, stream>>>
       (N, alpha, x, beta, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 #endif
 
@@ -481,7 +653,7 @@ void caffe_gpu_eltwise_min<float>(const int N,
   caffe_gpu_eltwise_min_kernel<float> <<<CAFFE_GET_BLOCKS(N),
       CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, alpha, x, beta, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 template<>
 void caffe_gpu_eltwise_min<double>(const int N,
@@ -491,7 +663,7 @@ void caffe_gpu_eltwise_min<double>(const int N,
   caffe_gpu_eltwise_min_kernel<double> <<<CAFFE_GET_BLOCKS(N),
       CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, alpha, x, beta, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 #ifndef CPU_ONLY
 template<>
@@ -502,7 +674,7 @@ void caffe_gpu_eltwise_min<float16>(const int N,
   caffe_gpu_eltwise_min_kernel<float16> <<<CAFFE_GET_BLOCKS(N),
       CAFFE_CUDA_NUM_THREADS, 0, stream>>> (N, alpha, x, beta, y);
   CUDA_POST_KERNEL_CHECK;
-  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(caffe_gpu_sync(stream));
 }
 #endif
 
@@ -0,0 +1,141 @@
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include "caffe/util/metrics_exporter.hpp"
+
+namespace caffe {
+
+MetricsExporter::MetricsExporter(const std::string& file, int port)
+    : listen_fd_(-1), stop_(false) {
+  if (!file.empty()) {
+    file_.open(file, std::ios::out | std::ios::app);
+    CHECK(file_.is_open()) << "Failed to open metrics file " << file;
+  }
+  if (port > 0) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK_GE(listen_fd_, 0) << "Failed to create metrics socket: " << std::strerror(errno);
+    const int on = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    CHECK_EQ(bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0)
+        << "Failed to bind metrics port " << port << ": " << std::strerror(errno);
+    CHECK_EQ(listen(listen_fd_, 8), 0) << std::strerror(errno);
+    server_ = std::thread(&MetricsExporter::Serve, this);
+    LOG(INFO) << "Serving Prometheus metrics on port " << port;
+  }
+}
+
+MetricsExporter::~MetricsExporter() {
+  stop_ = true;
+  if (server_.joinable()) {
+    server_.join();
+  }
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+  }
+}
+
+void MetricsExporter::Record(const MetricsSample& sample) {
+  if (file_.is_open()) {
+    file_ << JsonLine(sample) << std::endl;
+  }
+  if (listen_fd_ >= 0) {
+    std::string text = PrometheusText(sample);
+    std::lock_guard<std::mutex> lock(mutex_);
+    text_.swap(text);
+  }
+}
+
+// One response per connection, whatever the request is
+void MetricsExporter::Serve() {
+  pollfd pfd;
+  pfd.fd = listen_fd_;
+  pfd.events = POLLIN;
+  char request[1024];
+  while (!stop_) {
+    if (poll(&pfd, 1, 200) <= 0 || !(pfd.revents & POLLIN)) {
+      continue;
+    }
+    const int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    pollfd cfd;
+    cfd.fd = fd;
+    cfd.events = POLLIN;
+    if (poll(&cfd, 1, 1000) > 0) {
+      (void) read(fd, request, sizeof(request));
+    }
+    std::string body;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      body = text_;
+    }
+    std::ostringstream os;
+    os << "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+       << "Content-Length: " << body.size() << "\r\nConnection: close\r\n\r\n" << body;
+    const std::string response = os.str();
+    size_t sent = 0UL;
+    while (sent < response.size()) {
+      const ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) {
+        break;
+      }
+      sent += n;
+    }
+    close(fd);
+  }
+}
+
+std::string MetricsExporter::JsonLine(const MetricsSample& s) {
+  std::ostringstream os;
+  os.precision(9);
+  os << "{\"iter\": " << s.iter << ", \"device\": " << s.device
+     << ", \"iteration_s\": " << s.iteration_s << ", \"forward_s\": " << s.forward_s
+     << ", \"backward_s\": " << s.backward_s << ", \"reduce_s\": " << s.reduce_s
+     << ", \"data_wait_s\": " << s.data_wait_s << ", \"allreduce_bytes\": " << s.allreduce_bytes
+     << ", \"allreduce_bytes_per_s\": " << s.allreduce_bytes_per_s
+     << ", \"forward_tflops\": " << s.forward_tflops
+     << ", \"backward_tflops\": " << s.backward_tflops
+     << ", \"gpu_mem_in_use\": " << s.gpu_mem_in_use << ", \"gpu_mem_peak\": " << s.gpu_mem_peak
+     << ", \"learning_rate\": " << s.learning_rate << ", \"loss\": " << s.loss << "}";
+  return os.str();
+}
+
+std::string MetricsExporter::PrometheusText(const MetricsSample& s) {
+  std::ostringstream os;
+  os.precision(9);
+  const std::string label = "{device=\"" + std::to_string(s.device) + "\"} ";
+  auto gauge = [&](const char* name, const char* help, double value) {
+    os << "# HELP caffe_" << name << " " << help << "\n# TYPE caffe_" << name << " gauge\n"
+       << "caffe_" << name << label << value << "\n";
+  };
+  gauge("iteration", "Last sampled iteration", s.iter);
+  gauge("iteration_seconds", "Wall time per iteration", s.iteration_s);
+  gauge("forward_seconds", "Forward wall time per iteration", s.forward_s);
+  gauge("backward_seconds", "Backward wall time per iteration", s.backward_s);
+  gauge("reduce_seconds", "Gradient reduction wall time per iteration", s.reduce_s);
+  gauge("data_wait_seconds", "Time waiting for prefetched batches per iteration",
+      s.data_wait_s);
+  gauge("allreduce_bytes", "Gradient bytes reduced per iteration", s.allreduce_bytes);
+  gauge("allreduce_bytes_per_second", "Reduced bytes over reduction time",
+      s.allreduce_bytes_per_s);
+  gauge("forward_tflops", "Achieved forward TFLOPS of the net", s.forward_tflops);
+  gauge("backward_tflops", "Achieved backward TFLOPS of the net", s.backward_tflops);
+  gauge("gpu_memory_in_use_bytes", "GPU memory handed out by the pool", s.gpu_mem_in_use);
+  gauge("gpu_memory_peak_bytes", "High-water mark of GPU memory in use", s.gpu_mem_peak);
+  gauge("learning_rate", "Current learning rate", s.learning_rate);
+  gauge("loss", "Smoothed training loss", s.loss);
+  return os.str();
+}
+
+}  // namespace caffe
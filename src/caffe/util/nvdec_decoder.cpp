@@ -0,0 +1,267 @@
+#if defined(USE_NVDEC) && !defined(CPU_ONLY)
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavcodec/bsf.h>
+#include <libavformat/avformat.h>
+}
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/util/nvdec_decoder.hpp"
+
+namespace caffe {
+
+NvDecVideoReader::NvDecVideoReader(int new_height, int new_width)
+    : new_height_(new_height), new_width_(new_width), device_(0), context_(nullptr),
+      lock_(nullptr), decoder_(nullptr), target_rows_(0), target_cols_(0), parser_(nullptr),
+      format_(nullptr), bsf_(nullptr), stream_(-1), rows_(0), cols_(0), frames_(0), fps_(0.),
+      time_base_(0.), start_pts_(0), first_(0), stride_(1), dst_(nullptr), cuda_stream_(nullptr) {
+  CHECK((new_height == 0 && new_width == 0) || (new_height > 0 && new_width > 0))
+      << "new_height and new_width must be set at the same time";
+  std::memset(&decoder_format_, 0, sizeof(decoder_format_));
+  CU_CHECK(cuInit(0));
+  CU_CHECK(cuDeviceGet(&device_, Caffe::current_device()));
+  // The runtime's context, the one device memory of Caffe is allocated in
+  CU_CHECK(cuDevicePrimaryCtxRetain(&context_, device_));
+  CU_CHECK(cuvidCtxLockCreate(&lock_, context_));
+}
+
+NvDecVideoReader::~NvDecVideoReader() {
+  Close();
+  if (decoder_ != nullptr) {
+    cuvidDestroyDecoder(decoder_);
+  }
+  cuvidCtxLockDestroy(lock_);
+  cuDevicePrimaryCtxRelease(device_);
+}
+
+void NvDecVideoReader::Close() {
+  if (bsf_ != nullptr) {
+    av_bsf_free(&bsf_);
+  }
+  if (format_ != nullptr) {
+    avformat_close_input(&format_);
+  }
+}
+
+int NvDecVideoReader::Open(const std::string& path) {
+  Close();
+  CHECK_EQ(avformat_open_input(&format_, path.c_str(), nullptr, nullptr), 0)
+      << "Could not open " << path;
+  CHECK_GE(avformat_find_stream_info(format_, nullptr), 0) << "Could not read " << path;
+  stream_ = av_find_best_stream(format_, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+  CHECK_GE(stream_, 0) << "No video stream in " << path;
+  const AVStream* stream = format_->streams[stream_];
+  const AVCodecParameters* par = stream->codecpar;
+  CHECK(par->codec_id == AV_CODEC_ID_H264 || par->codec_id == AV_CODEC_ID_HEVC)
+      << "NVDEC reads H.264 and HEVC video, not " << avcodec_get_name(par->codec_id)
+      << " of " << path;
+  // The parser takes Annex B start codes, MP4 and Matroska store lengths instead.
+  // Streams already in Annex B pass through.
+  const AVBitStreamFilter* filter = av_bsf_get_by_name(par->codec_id == AV_CODEC_ID_H264 ?
+      "h264_mp4toannexb" : "hevc_mp4toannexb");
+  CHECK(filter != nullptr) << "FFmpeg is built without the mp4toannexb filters";
+  CHECK_EQ(av_bsf_alloc(filter, &bsf_), 0);
+  CHECK_GE(avcodec_parameters_copy(bsf_->par_in, par), 0);
+  bsf_->time_base_in = stream->time_base;
+  CHECK_EQ(av_bsf_init(bsf_), 0);
+
+  const AVRational rate = stream->avg_frame_rate.num > 0 ? stream->avg_frame_rate :
+      stream->r_frame_rate;
+  CHECK_GT(rate.num, 0) << "Unknown frame rate of " << path;
+  fps_ = av_q2d(rate);
+  time_base_ = av_q2d(stream->time_base);
+  start_pts_ = stream->start_time == AV_NOPTS_VALUE ? 0 : stream->start_time;
+  if (stream->nb_frames > 0) {
+    frames_ = static_cast<int>(stream->nb_frames);
+  } else if (stream->duration != AV_NOPTS_VALUE) {
+    frames_ = static_cast<int>(std::llround(stream->duration * time_base_ * fps_));
+  } else {
+    frames_ = static_cast<int>(std::llround(format_->duration * fps_ / AV_TIME_BASE));
+  }
+  CHECK_GT(frames_, 0) << "No frames in " << path;
+  rows_ = new_height_ > 0 ? new_height_ : par->height;
+  cols_ = new_width_ > 0 ? new_width_ : par->width;
+  return frames_;
+}
+
+void NvDecVideoReader::Read(int first, int count, int stride, uint8_t* dst,
+    cudaStream_t stream) {
+  CHECK(format_ != nullptr) << "No video open";
+  CHECK_GE(first, 0);
+  CHECK_GT(count, 0);
+  CHECK_GT(stride, 0);
+  first_ = first;
+  stride_ = stride;
+  done_.assign(count, false);
+  dst_ = dst;
+  cuda_stream_ = stream;
+
+  CUVIDPARSERPARAMS params;
+  std::memset(&params, 0, sizeof(params));
+  params.CodecType = format_->streams[stream_]->codecpar->codec_id == AV_CODEC_ID_H264 ?
+      cudaVideoCodec_H264 : cudaVideoCodec_HEVC;
+  params.ulMaxNumDecodeSurfaces = 1;  // raised by the sequence callback
+  params.ulMaxDisplayDelay = 0;
+  params.pUserData = this;
+  params.pfnSequenceCallback = HandleSequence;
+  params.pfnDecodePicture = HandleDecode;
+  params.pfnDisplayPicture = HandleDisplay;
+  CU_CHECK(cuvidCreateVideoParser(&parser_, &params));
+
+  // Decoding starts at the key frame before the first frame
+  const int64_t target = start_pts_ + std::llround(first / fps_ / time_base_);
+  CHECK_GE(av_seek_frame(format_, stream_, target, AVSEEK_FLAG_BACKWARD), 0)
+      << "Could not seek to frame " << first;
+  av_bsf_flush(bsf_);
+  AVPacket* pkt = av_packet_alloc();
+  const size_t frame_bytes = static_cast<size_t>(rows_) * cols_ * 3;
+  while (std::find(done_.begin(), done_.end(), false) != done_.end() &&
+      av_read_frame(format_, pkt) >= 0) {
+    if (pkt->stream_index != stream_) {
+      av_packet_unref(pkt);
+      continue;
+    }
+    CHECK_EQ(av_bsf_send_packet(bsf_, pkt), 0);
+    while (av_bsf_receive_packet(bsf_, pkt) == 0) {
+      Parse(pkt);
+      av_packet_unref(pkt);
+    }
+  }
+  av_packet_free(&pkt);
+  Parse(nullptr);
+  CU_CHECK(cuvidDestroyVideoParser(parser_));
+  parser_ = nullptr;
+
+  // Frames past the end of the file, or missing, repeat the closest one before
+  const auto decoded = std::find(done_.begin(), done_.end(), true);
+  CHECK(decoded != done_.end()) << "No frame decoded from frame " << first;
+  int last = static_cast<int>(decoded - done_.begin());
+  for (int i = 0; i < count; ++i) {
+    if (done_[i]) {
+      last = i;
+    } else {
+      CUDA_CHECK(cudaMemcpyAsync(dst + i * frame_bytes, dst + last * frame_bytes, frame_bytes,
+          cudaMemcpyDeviceToDevice, stream));
+    }
+  }
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+}
+
+void NvDecVideoReader::Parse(const AVPacket* pkt) {
+  CUVIDSOURCEDATAPACKET packet;
+  std::memset(&packet, 0, sizeof(packet));
+  if (pkt != nullptr) {
+    packet.payload = pkt->data;
+    packet.payload_size = pkt->size;
+    packet.flags = CUVID_PKT_TIMESTAMP;
+    packet.timestamp = pkt->pts == AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+  } else {
+    packet.flags = CUVID_PKT_ENDOFSTREAM;
+  }
+  CU_CHECK(cuvidParseVideoData(parser_, &packet));
+}
+
+int CUDAAPI NvDecVideoReader::HandleSequence(void* reader, CUVIDEOFORMAT* format) {
+  return static_cast<NvDecVideoReader*>(reader)->Sequence(*format);
+}
+
+int CUDAAPI NvDecVideoReader::HandleDecode(void* reader, CUVIDPICPARAMS* pic) {
+  CU_CHECK(cuvidDecodePicture(static_cast<NvDecVideoReader*>(reader)->decoder_, pic));
+  return 1;
+}
+
+int CUDAAPI NvDecVideoReader::HandleDisplay(void* reader, CUVIDPARSERDISPINFO* disp) {
+  if (disp != nullptr) {
+    static_cast<NvDecVideoReader*>(reader)->Display(*disp);
+  }
+  return 1;
+}
+
+int NvDecVideoReader::Sequence(const CUVIDEOFORMAT& format) {
+  const CUVIDEOFORMAT& last = decoder_format_;
+  if (decoder_ != nullptr && format.codec == last.codec &&
+      format.coded_width == last.coded_width && format.coded_height == last.coded_height &&
+      format.chroma_format == last.chroma_format &&
+      format.bit_depth_luma_minus8 == last.bit_depth_luma_minus8 &&
+      std::memcmp(&format.display_area, &last.display_area, sizeof(format.display_area)) == 0 &&
+      format.min_num_decode_surfaces <= last.min_num_decode_surfaces &&
+      target_rows_ == rows_ && target_cols_ == cols_) {
+    return last.min_num_decode_surfaces;
+  }
+  CHECK_EQ(format.chroma_format, cudaVideoChromaFormat_420) << "NVDEC reads 4:2:0 video only";
+  CHECK_EQ(format.bit_depth_luma_minus8, 0) << "NVDEC reads 8-bit video only";
+  if (decoder_ != nullptr) {
+    CU_CHECK(cuvidDestroyDecoder(decoder_));
+    decoder_ = nullptr;
+  }
+  CUVIDDECODECREATEINFO info;
+  std::memset(&info, 0, sizeof(info));
+  info.CodecType = format.codec;
+  info.ChromaFormat = format.chroma_format;
+  info.OutputFormat = cudaVideoSurfaceFormat_NV12;
+  info.bitDepthMinus8 = format.bit_depth_luma_minus8;
+  info.DeinterlaceMode = format.progressive_sequence ? cudaVideoDeinterlaceMode_Weave :
+      cudaVideoDeinterlaceMode_Adaptive;
+  info.ulNumOutputSurfaces = 2;
+  info.ulCreationFlags = cudaVideoCreate_PreferCUVID;
+  info.ulNumDecodeSurfaces = format.min_num_decode_surfaces;
+  info.vidLock = lock_;
+  info.ulWidth = format.coded_width;
+  info.ulHeight = format.coded_height;
+  info.ulMaxWidth = format.coded_width;
+  info.ulMaxHeight = format.coded_height;
+  info.display_area.left = static_cast<short>(format.display_area.left);  // NOLINT
+  info.display_area.top = static_cast<short>(format.display_area.top);  // NOLINT
+  info.display_area.right = static_cast<short>(format.display_area.right);  // NOLINT
+  info.display_area.bottom = static_cast<short>(format.display_area.bottom);  // NOLINT
+  // Resized by the decoder
+  info.ulTargetWidth = cols_;
+  info.ulTargetHeight = rows_;
+  CU_CHECK(cuCtxPushCurrent(context_));
+  CU_CHECK(cuvidCreateDecoder(&decoder_, &info));
+  CU_CHECK(cuCtxPopCurrent(nullptr));
+  decoder_format_ = format;
+  target_rows_ = rows_;
+  target_cols_ = cols_;
+  return format.min_num_decode_surfaces;
+}
+
+void NvDecVideoReader::Display(const CUVIDPARSERDISPINFO& disp) {
+  const int index = static_cast<int>(std::llround((disp.timestamp - start_pts_) *
+      time_base_ * fps_));
+  const int step = index - first_;
+  if (step < 0 || step % stride_ != 0 || step / stride_ >= static_cast<int>(done_.size()) ||
+      done_[step / stride_]) {
+    return;
+  }
+  const int i = step / stride_;
+  CUVIDPROCPARAMS proc;
+  std::memset(&proc, 0, sizeof(proc));
+  proc.progressive_frame = disp.progressive_frame;
+  proc.second_field = disp.repeat_first_field + 1;
+  proc.top_field_first = disp.top_field_first;
+  proc.unpaired_field = disp.repeat_first_field < 0;
+  proc.output_stream = cuda_stream_;
+  unsigned long long frame = 0ULL;  // NOLINT(runtime/int)
+  unsigned int pitch = 0U;
+  CU_CHECK(cuvidMapVideoFrame(decoder_, disp.picture_index, &frame, &pitch, &proc));
+  // BT.709 is matrix 1 of ISO/IEC 23001-8, SD video defaults to BT.601
+  const bool bt709 = decoder_format_.video_signal_description.matrix_coefficients == 1 ||
+      (decoder_format_.video_signal_description.matrix_coefficients == 2 && rows_ >= 720);
+  nv12_to_bgr_gpu(reinterpret_cast<const uint8_t*>(frame), pitch, rows_, cols_, bt709,
+      dst_ + static_cast<size_t>(i) * rows_ * cols_ * 3, cuda_stream_);
+  // The surface is back to the decoder once converted
+  CUDA_CHECK(cudaStreamSynchronize(cuda_stream_));
+  CU_CHECK(cuvidUnmapVideoFrame(decoder_, frame));
+  done_[i] = true;
+}
+
+}  // namespace caffe
+
+#endif  // USE_NVDEC && !CPU_ONLY
@@ -0,0 +1,42 @@
+#if defined(USE_NVDEC)
+
+#include <cstdint>
+
+#include "caffe/common.hpp"
+#include "caffe/util/nvdec_decoder.hpp"
+
+namespace caffe {
+
+// Limited range YCbCr to BGR, chroma subsampled 2x2 and interleaved after luma rows
+__global__ void nv12_to_bgr_kernel(const int n, const uint8_t* nv12, const size_t pitch,
+    const int rows, const int cols, const bool bt709, uint8_t* bgr) {
+  const uint8_t* chroma = nv12 + pitch * ((rows + 1) & ~1);
+  CUDA_KERNEL_LOOP(index, n) {
+    const int y = index / cols;
+    const int x = index % cols;
+    const float c = 1.164F * (static_cast<float>(nv12[y * pitch + x]) - 16.F);
+    const uint8_t* uv = chroma + (y / 2) * pitch + (x & ~1);
+    const float d = static_cast<float>(uv[0]) - 128.F;
+    const float e = static_cast<float>(uv[1]) - 128.F;
+    const float r = bt709 ? c + 1.793F * e : c + 1.596F * e;
+    const float g = bt709 ? c - 0.213F * d - 0.533F * e : c - 0.392F * d - 0.813F * e;
+    const float b = bt709 ? c + 2.112F * d : c + 2.017F * d;
+    uint8_t* out = bgr + index * 3;
+    out[0] = static_cast<uint8_t>(fminf(fmaxf(rintf(b), 0.F), 255.F));
+    out[1] = static_cast<uint8_t>(fminf(fmaxf(rintf(g), 0.F), 255.F));
+    out[2] = static_cast<uint8_t>(fminf(fmaxf(rintf(r), 0.F), 255.F));
+  }
+}
+
+void nv12_to_bgr_gpu(const uint8_t* nv12, size_t pitch, int rows, int cols, bool bt709,
+    uint8_t* bgr, cudaStream_t stream) {
+  const int n = rows * cols;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  nv12_to_bgr_kernel<<<CAFFE_GET_BLOCKS(n), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(n, nv12,
+      pitch, rows, cols, bt709, bgr);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+}  // namespace caffe
+
+#endif  // USE_NVDEC
@@ -0,0 +1,84 @@
+#if defined(USE_NVJPEG) && !defined(CPU_ONLY)
+
+#include <cstring>
+#include <vector>
+
+#include "caffe/util/nvjpeg_decoder.hpp"
+
+namespace caffe {
+
+NvJpegDecoder::NvJpegDecoder()
+    : handle_(nullptr), state_(nullptr), batch_size_(0), format_(NVJPEG_OUTPUT_BGRI) {
+  NVJPEG_CHECK(nvjpegCreateSimple(&handle_));
+  NVJPEG_CHECK(nvjpegJpegStateCreate(handle_, &state_));
+}
+
+NvJpegDecoder::~NvJpegDecoder() {
+  nvjpegJpegStateDestroy(state_);
+  nvjpegDestroy(handle_);
+}
+
+void NvJpegDecoder::Init(int batch_size, nvjpegOutputFormat_t format) {
+  if (batch_size == batch_size_ && format == format_) {
+    return;
+  }
+  // Huffman decoding is done by the calling thread
+  NVJPEG_CHECK(nvjpegDecodeBatchedInitialize(handle_, state_, batch_size, 1, format));
+  batch_size_ = batch_size;
+  format_ = format;
+}
+
+void NvJpegDecoder::Add(const char* content, size_t size, bool persistent, void* dst) {
+  CHECK(is_jpeg(content, size)) << "Not a JPEG image";
+  if (persistent) {
+    data_.push_back(reinterpret_cast<const unsigned char*>(content));
+    offsets_.push_back(0UL);
+  } else {
+    // Pointers are resolved in Decode, staging buffer might be reallocated till then
+    const size_t offset = staging_.size();
+    staging_.resize(offset + size);
+    std::memcpy(staging_.data() + offset, content, size);
+    data_.push_back(nullptr);
+    offsets_.push_back(offset);
+  }
+  lengths_.push_back(size);
+  dst_.push_back(static_cast<unsigned char*>(dst));
+}
+
+void NvJpegDecoder::Decode(int height, int width, int channels, cudaStream_t stream) {
+  const int batch_size = static_cast<int>(queued());
+  if (batch_size == 0) {
+    return;
+  }
+  CHECK(channels == 1 || channels == 3) << "Unsupported number of channels " << channels;
+  vector<nvjpegImage_t> images(batch_size);
+  for (int i = 0; i < batch_size; ++i) {
+    if (data_[i] == nullptr) {
+      data_[i] = reinterpret_cast<const unsigned char*>(staging_.data() + offsets_[i]);
+    }
+    int components = 0;
+    nvjpegChromaSubsampling_t subsampling;
+    int widths[NVJPEG_MAX_COMPONENT], heights[NVJPEG_MAX_COMPONENT];
+    NVJPEG_CHECK(nvjpegGetImageInfo(handle_, data_[i], lengths_[i],
+        &components, &subsampling, widths, heights));
+    CHECK_EQ(height, heights[0]) << "Image height can't vary in the same batch";
+    CHECK_EQ(width, widths[0]) << "Image width can't vary in the same batch";
+    std::memset(&images[i], 0, sizeof(nvjpegImage_t));
+    images[i].channel[0] = dst_[i];
+    images[i].pitch[0] = width * channels;
+  }
+  Init(batch_size, channels == 3 ? NVJPEG_OUTPUT_BGRI : NVJPEG_OUTPUT_Y);
+  NVJPEG_CHECK(nvjpegDecodeBatched(handle_, state_, data_.data(), lengths_.data(),
+      images.data(), stream));
+  // Sources must outlive the decoding
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+  staging_.clear();
+  offsets_.clear();
+  data_.clear();
+  lengths_.clear();
+  dst_.clear();
+}
+
+}  // namespace caffe
+
+#endif  // USE_NVJPEG && !CPU_ONLY
@@ -0,0 +1,28 @@
+#ifdef USE_NVTX
+#include <nvToolsExt.h>
+#include <cstdlib>
+
+#include "caffe/util/nvtx.hpp"
+
+namespace caffe {
+
+const bool NvtxRange::enabled_ = std::getenv("CAFFE_NVTX") != nullptr;
+
+void NvtxRange::Push(NvtxColor color, const char* name) {
+  nvtxEventAttributes_t attr = {};
+  attr.version = NVTX_VERSION;
+  attr.size = NVTX_EVENT_ATTRIB_STRUCT_SIZE;
+  attr.colorType = NVTX_COLOR_ARGB;
+  attr.color = color;
+  attr.messageType = NVTX_MESSAGE_TYPE_ASCII;
+  attr.message.ascii = name;
+  nvtxRangePushEx(&attr);
+  pushed_ = true;
+}
+
+void NvtxRange::Pop() {
+  nvtxRangePop();
+}
+
+}  // namespace caffe
+#endif  // USE_NVTX
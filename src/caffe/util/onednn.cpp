@@ -0,0 +1,125 @@
+#ifdef USE_ONEDNN
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "caffe/util/cpu_parallel.hpp"
+#include "caffe/util/onednn.hpp"
+#include "caffe/util/quantization.hpp"
+
+namespace caffe {
+
+namespace onednn {
+
+using tag = dnnl::memory::format_tag;
+using dt = dnnl::memory::data_type;
+
+dnnl::engine& engine() {
+  static dnnl::engine cpu(dnnl::engine::kind::cpu, 0);
+  return cpu;
+}
+
+dnnl::stream& stream() {
+  static thread_local dnnl::stream thread_stream(engine());
+  return thread_stream;
+}
+
+dnnl::memory::dims dims(const vector<int>& shape) {
+  return dnnl::memory::dims(shape.begin(), shape.end());
+}
+
+dnnl::memory::desc desc(const vector<int>& shape, dnnl::memory::data_type type,
+    dnnl::memory::format_tag format) {
+  return dnnl::memory::desc(dims(shape), type, format);
+}
+
+dnnl::memory::desc desc(const Blob& blob) {
+  CHECK(blob.num_axes() == 4 || blob.num_axes() == 2) << "oneDNN layers take 2D and 4D "
+      "blobs, not " << blob.shape_string();
+  const tag format = blob.num_axes() == 2 ? tag::nc :
+      blob.packing() == NHWC ? tag::nhwc : tag::nchw;
+  return desc(blob.shape(), dt::f32, format);
+}
+
+string shapes(const vector<Blob*>& blobs) {
+  string key;
+  for (const Blob* blob : blobs) {
+    key += blob->shape_string() + (blob->packing() == NHWC ? "h " : "c ");
+  }
+  return key;
+}
+
+dnnl::primitive_attr math_attr(const LayerParameter& param) {
+  dnnl::primitive_attr attr;
+  if (param.forward_math() == FLOAT16) {
+    attr.set_fpmath_mode(dnnl::fpmath_mode::bf16);
+  }
+  return attr;
+}
+
+void Execute(const dnnl::primitive& primitive, const Args& args) {
+  primitive.execute(stream(), args);
+  stream().wait();
+}
+
+void Reorder(const dnnl::memory& src, const dnnl::memory& dst) {
+  Execute(dnnl::reorder(src, dst), {{DNNL_ARG_FROM, src}, {DNNL_ARG_TO, dst}});
+}
+
+static inline int8_t quantize(float v, float inv_scale) {
+  const float q = std::round(v * inv_scale);
+  return static_cast<int8_t>(std::max(-static_cast<float>(Int8Gemm::LEVELS),
+      std::min(static_cast<float>(Int8Gemm::LEVELS), q)));
+}
+
+void Quantize(int count, const float* x, float scale, int8_t* q) {
+  const float inv_scale = 1.F / scale;
+  CpuParallel::For(count, 4096, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      q[i] = quantize(x[i], inv_scale);
+    }
+  });
+}
+
+void QuantizeRows(int rows, int cols, const float* w, bool transposed, int8_t* q,
+    float* scales) {
+  CpuParallel::For(rows, 16, [&](int begin, int end) {
+    for (int r = begin; r < end; ++r) {
+      float max_abs = 0.F;
+      for (int c = 0; c < cols; ++c) {
+        max_abs = std::max(max_abs, std::fabs(transposed ? w[c * rows + r] : w[r * cols + c]));
+      }
+      scales[r] = max_abs > 0.F ? max_abs / Int8Gemm::LEVELS : 1.F;
+      for (int c = 0; c < cols; ++c) {
+        q[r * cols + c] = quantize(transposed ? w[c * rows + r] : w[r * cols + c],
+            1.F / scales[r]);
+      }
+    }
+  });
+}
+
+const dnnl::memory& Weights::Get(const dnnl::memory::desc& plain, const void* data,
+    const dnnl::memory::desc& picked, bool keep) {
+  dnnl::memory source(plain, engine(), const_cast<void*>(data));
+  if (picked == plain) {
+    memory_ = source;
+    ready_ = false;
+    return memory_;
+  }
+  if (!memory_ || memory_.get_desc() != picked) {
+    memory_ = dnnl::memory(picked, engine());
+    ready_ = false;
+  }
+  if (!ready_) {
+    Reorder(source, memory_);
+    ready_ = keep;
+  }
+  return memory_;
+}
+
+}  // namespace onednn
+
+}  // namespace caffe
+
+#endif  // USE_ONEDNN
@@ -0,0 +1,138 @@
+#include <google/protobuf/text_format.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>  // NOLINT(readability/streams)
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "caffe/util/io.hpp"
+#include "caffe/util/proto_cache.hpp"
+
+namespace caffe {
+
+namespace {
+
+struct Cache {
+  std::mutex mutex;
+  // Type name and text -> normalized message
+  std::unordered_map<string, shared_ptr<ProtoCache::Message>> files;
+  // Name and serialized input -> output
+  std::unordered_map<string, shared_ptr<ProtoCache::Message>> transforms;
+};
+
+Cache& cache() {
+  // Never destroyed: nets of static objects may be set up during exit
+  static Cache* c = new Cache;
+  return *c;
+}
+
+// 64-bit FNV-1a, stable from run to run
+uint64_t fnv1a(const string& s) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : s) {
+    hash = (hash ^ c) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+bool read_file(const string& filename, string* contents) {
+  std::ifstream file(filename, std::ios::in | std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::ostringstream os;
+  os << file.rdbuf();
+  *contents = os.str();
+  return true;
+}
+
+}  // namespace
+
+bool ProtoCache::ReadTextFile(const string& filename, Message* proto,
+    const Normalization& normalize) {
+  string text;
+  CHECK(read_file(filename, &text)) << "File not found: " << filename;
+  const string key = proto->GetTypeName() + '\0' + text;
+  Cache& c = cache();
+  // Held while parsing so that other ranks reading the same file wait for this copy
+  std::lock_guard<std::mutex> lock(c.mutex);
+  auto it = c.files.find(key);
+  if (it != c.files.end()) {
+    proto->CopyFrom(*it->second);
+    return true;
+  }
+  string cached;
+  const char* dir = std::getenv("CAFFE_PROTO_CACHE_DIR");
+  if (dir != nullptr && dir[0] != '\0') {
+    std::ostringstream os;
+    os << dir << "/" << std::hex << std::setw(16) << std::setfill('0')
+       << fnv1a(Caffe::caffe_version() + '\0' + key) << ".binaryproto";
+    cached = os.str();
+  }
+  proto->Clear();
+  bool done = false;
+  if (!cached.empty() && access(cached.c_str(), R_OK) == 0) {
+    done = ReadProtoFromBinaryFile(cached, proto);
+    if (done) {
+      LOG(INFO) << "Read " << filename << " from " << cached;
+    } else {
+      proto->Clear();
+    }
+  }
+  if (!done) {
+    if (!google::protobuf::TextFormat::ParseFromString(text, proto)) {
+      return false;
+    }
+    normalize(proto);
+    if (!cached.empty()) {
+      // Renamed into place: other processes may read it meanwhile
+      const string temp = cached + "." + std::to_string(getpid());
+      std::ofstream output(temp, std::ios::out | std::ios::trunc | std::ios::binary);
+      if (proto->SerializeToOstream(&output) && output.flush() &&
+          std::rename(temp.c_str(), cached.c_str()) == 0) {
+        DLOG(INFO) << "Cached " << filename << " as " << cached;
+      } else {
+        LOG(WARNING) << "Failed to cache " << filename << " in " << dir;
+        std::remove(temp.c_str());
+      }
+    }
+  }
+  shared_ptr<Message> copy(proto->New());
+  copy->CopyFrom(*proto);
+  c.files.emplace(key, copy);
+  return true;
+}
+
+void ProtoCache::Transform(const string& name, const Message& in, Message* out,
+    const Transformation& transform) {
+  string key = name + '\0';
+  CHECK(in.AppendToString(&key));
+  Cache& c = cache();
+  {
+    std::lock_guard<std::mutex> lock(c.mutex);
+    auto it = c.transforms.find(key);
+    if (it != c.transforms.end()) {
+      out->CopyFrom(*it->second);
+      return;
+    }
+  }
+  transform(in, out);
+  shared_ptr<Message> copy(out->New());
+  copy->CopyFrom(*out);
+  std::lock_guard<std::mutex> lock(c.mutex);
+  c.transforms.emplace(key, copy);
+}
+
+void ProtoCache::Clear() {
+  Cache& c = cache();
+  std::lock_guard<std::mutex> lock(c.mutex);
+  c.files.clear();
+  c.transforms.clear();
+}
+
+}  // namespace caffe
@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "caffe/util/quantization.hpp"
+
+namespace caffe {
+
+constexpr int Int8Gemm::LEVELS;
+
+float kl_divergence_threshold(const vector<double>& hist, float bin_width) {
+  const int bins = hist.size();
+  // Non-negative half of the int8 range
+  const int levels = Int8Gemm::LEVELS + 1;
+  if (bins <= levels) {
+    return bins * bin_width;
+  }
+  double tail = 0.;
+  for (int i = levels; i < bins; ++i) {
+    tail += hist[i];
+  }
+  int best = bins;
+  double best_kl = DBL_MAX;
+  vector<double> p, q;
+  for (int i = levels; i <= bins; ++i) {
+    // Reference: first i bins, saturated values clipped into the last one
+    p.assign(hist.begin(), hist.begin() + i);
+    p[i - 1] += tail;
+    // Candidate: the same i bins merged into levels, spread back over non-empty bins
+    q.assign(i, 0.);
+    for (int j = 0; j < levels; ++j) {
+      const int start = j * i / levels;
+      const int end = (j + 1) * i / levels;
+      double sum = 0.;
+      int nonzero = 0;
+      for (int k = start; k < end; ++k) {
+        sum += hist[k];
+        nonzero += hist[k] > 0. ? 1 : 0;
+      }
+      for (int k = start; k < end; ++k) {
+        if (hist[k] > 0.) {
+          q[k] = sum / nonzero;
+        }
+      }
+    }
+    double p_sum = 0., q_sum = 0.;
+    for (int k = 0; k < i; ++k) {
+      p_sum += p[k];
+      q_sum += q[k];
+    }
+    if (p_sum > 0. && q_sum > 0.) {
+      double kl = 0.;
+      for (int k = 0; k < i; ++k) {
+        if (p[k] > 0.) {
+          // Smoothed, so clipped outliers landing on an empty bin cost a lot but not all
+          const double qk = std::max(q[k] / q_sum, 1e-10);
+          kl += p[k] / p_sum * std::log(p[k] / p_sum / qk);
+        }
+      }
+      if (kl < best_kl) {
+        best_kl = kl;
+        best = i;
+      }
+    }
+    if (i < bins) {
+      tail -= hist[i];
+    }
+  }
+  return std::min(best + 0.5F, static_cast<float>(bins)) * bin_width;
+}
+
+float percentile_threshold(const vector<double>& hist, float bin_width, double fraction) {
+  double total = 0.;
+  for (double count : hist) {
+    total += count;
+  }
+  const double target = fraction * total;
+  double sum = 0.;
+  for (int i = 0; i < hist.size(); ++i) {
+    sum += hist[i];
+    if (sum >= target) {
+      return (i + 1) * bin_width;
+    }
+  }
+  return hist.size() * bin_width;
+}
+
+static inline int8_t quantize(float v, float inv_scale) {
+  const float q = std::round(v * inv_scale);
+  return static_cast<int8_t>(std::max(-static_cast<float>(Int8Gemm::LEVELS),
+      std::min(static_cast<float>(Int8Gemm::LEVELS), q)));
+}
+
+Int8Gemm::Int8Gemm() : N_(0), K_(0), Kp_(0), M_(0), input_scale_(1.F) {}
+
+template <typename Dtype>
+void Int8Gemm::SetWeights(int N, int K, const Dtype* w, bool transposed, float input_scale) {
+  CHECK_GT(N, 0);
+  CHECK_GT(K, 0);
+  CHECK_GT(input_scale, 0.F) << "Quantized layer is not calibrated";
+  N_ = N;
+  K_ = K;
+  Kp_ = align_up<2>(K);
+  M_ = 0;
+  input_scale_ = input_scale;
+  x_.reset();
+  acc_.reset();
+  weights_ = make_shared<SyncedMemory>(static_cast<size_t>(N_) * Kp_);
+  out_scales_ = make_shared<SyncedMemory>(N_ * sizeof(float));
+  int8_t* qw = static_cast<int8_t*>(weights_->mutable_cpu_data());
+  float* scales = static_cast<float*>(out_scales_->mutable_cpu_data());
+  for (int n = 0; n < N_; ++n) {
+    float max_abs = 0.F;
+    for (int k = 0; k < K_; ++k) {
+      const float v = static_cast<float>(transposed ? w[k * N_ + n] : w[n * K_ + k]);
+      max_abs = std::max(max_abs, std::fabs(v));
+    }
+    const float scale = max_abs > 0.F ? max_abs / LEVELS : 1.F;
+    for (int k = 0; k < Kp_; ++k) {
+      qw[n * Kp_ + k] = k < K_ ?
+          quantize(static_cast<float>(transposed ? w[k * N_ + n] : w[n * K_ + k]), 1.F / scale) :
+          0;
+    }
+    scales[n] = scale * input_scale_;
+  }
+}
+
+void Int8Gemm::Reserve(int M) {
+  if (M > M_) {
+    M_ = M;
+    x_ = make_shared<SyncedMemory>(static_cast<size_t>(M_) * Kp_);
+    acc_ = make_shared<SyncedMemory>(static_cast<size_t>(M_) * N_ * sizeof(int32_t));
+  }
+}
+
+template <typename Dtype>
+void Int8Gemm::Forward_cpu(int M, const Dtype* x, bool x_transposed, const Dtype* bias,
+    Dtype* y, bool y_transposed) {
+  CHECK(initialized());
+  Reserve(M);
+  const float inv_scale = 1.F / input_scale_;
+  int8_t* qx = static_cast<int8_t*>(x_->mutable_cpu_data());
+  for (int m = 0; m < M; ++m) {
+    for (int k = 0; k < Kp_; ++k) {
+      qx[m * Kp_ + k] = k < K_ ?
+          quantize(static_cast<float>(x_transposed ? x[k * M + m] : x[m * K_ + k]), inv_scale) :
+          0;
+    }
+  }
+  const int8_t* qw = static_cast<const int8_t*>(weights_->cpu_data());
+  const float* scales = static_cast<const float*>(out_scales_->cpu_data());
+  for (int m = 0; m < M; ++m) {
+    const int8_t* xr = qx + m * Kp_;
+    for (int n = 0; n < N_; ++n) {
+      const int8_t* wr = qw + n * Kp_;
+      int32_t acc = 0;
+      for (int k = 0; k < Kp_; ++k) {
+        acc += static_cast<int32_t>(xr[k]) * static_cast<int32_t>(wr[k]);
+      }
+      float v = acc * scales[n];
+      if (bias != nullptr) {
+        v += static_cast<float>(bias[n]);
+      }
+      y[y_transposed ? n * M + m : m * N_ + n] = static_cast<Dtype>(v);
+    }
+  }
+}
+
+template void Int8Gemm::SetWeights<float>(int N, int K, const float* w, bool transposed,
+    float input_scale);
+template void Int8Gemm::SetWeights<double>(int N, int K, const double* w, bool transposed,
+    float input_scale);
+template void Int8Gemm::Forward_cpu<float>(int M, const float* x, bool x_transposed,
+    const float* bias, float* y, bool y_transposed);
+template void Int8Gemm::Forward_cpu<double>(int M, const double* x, bool x_transposed,
+    const double* bias, double* y, bool y_transposed);
+#ifndef CPU_ONLY
+template void Int8Gemm::SetWeights<float16>(int N, int K, const float16* w, bool transposed,
+    float input_scale);
+template void Int8Gemm::Forward_cpu<float16>(int M, const float16* x, bool x_transposed,
+    const float16* bias, float16* y, bool y_transposed);
+#endif
+
+}  // namespace caffe
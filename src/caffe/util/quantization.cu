@@ -0,0 +1,116 @@
+#include <cstdint>
+
+#include "caffe/common.hpp"
+#include "caffe/util/quantization.hpp"
+
+namespace caffe {
+
+// Quantizes X into M x Kp rows, zero padded
+template <typename Dtype>
+__global__ void int8_quantize_kernel(const int n, const int M, const int K, const int Kp,
+    const Dtype* x, const bool x_transposed, const float inv_scale, int8_t* qx) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const int m = index / Kp;
+    const int k = index % Kp;
+    float q = 0.F;
+    if (k < K) {
+      const float v = static_cast<float>(x[x_transposed ? k * M + m : m * K + k]);
+      q = fminf(fmaxf(rintf(v * inv_scale), -127.F), 127.F);
+    }
+    qx[index] = static_cast<int8_t>(q);
+  }
+}
+
+// Fallback for devices and cuBLAS versions without INT8 GEMM, 4 products at a time
+__global__ void int8_gemm_kernel(const int n, const int N, const int Kp4,
+    const int* qw, const int* qx, int* acc) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const int* wr = qw + (index % N) * Kp4;
+    const int* xr = qx + (index / N) * Kp4;
+    int sum = 0;
+    for (int k = 0; k < Kp4; ++k) {
+#if __CUDA_ARCH__ >= 610
+      sum = __dp4a(wr[k], xr[k], sum);
+#else
+      const char4 a = reinterpret_cast<const char4&>(wr[k]);
+      const char4 b = reinterpret_cast<const char4&>(xr[k]);
+      sum += a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+#endif
+    }
+    acc[index] = sum;
+  }
+}
+
+template <typename Dtype>
+__global__ void int8_dequantize_kernel(const int n, const int M, const int N,
+    const int* acc, const float* scales, const Dtype* bias, Dtype* y,
+    const bool y_transposed) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const int m = index / N;
+    const int c = index % N;
+    float v = acc[index] * scales[c];
+    if (bias != nullptr) {
+      v += static_cast<float>(bias[c]);
+    }
+    y[y_transposed ? c * M + m : index] = Dtype(v);
+  }
+}
+
+template <typename Dtype>
+void Int8Gemm::Forward_gpu(int M, const Dtype* x, bool x_transposed, const Dtype* bias,
+    Dtype* y, bool y_transposed) {
+  CHECK(initialized());
+  Reserve(M);
+  cudaStream_t stream = Caffe::thread_stream();
+  int8_t* qx = static_cast<int8_t*>(x_->mutable_gpu_data());
+  const int8_t* qw = static_cast<const int8_t*>(weights_->gpu_data());
+  int* acc = static_cast<int*>(acc_->mutable_gpu_data());
+  const int x_count = M * Kp_;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  int8_quantize_kernel<<<CAFFE_GET_BLOCKS(x_count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      x_count, M, K_, Kp_, x, x_transposed, 1.F / input_scale_, qx);
+  CUDA_POST_KERNEL_CHECK;
+  const int y_count = M * N_;
+  bool done = false;
+#if CUDA_VERSION >= 8000
+  if (Caffe::device_capability(Caffe::current_device()) >= 601) {
+    // Column major: acc^T (N x M) = qw (Kp x N)^T * qx^T (Kp x M)
+    const int alpha = 1, beta = 0;
+    const cublasStatus_t status = cublasGemmEx(Caffe::cublas_handle(),
+        CUBLAS_OP_T, CUBLAS_OP_N, N_, M, Kp_, &alpha, qw, CUDA_R_8I, Kp_, qx, CUDA_R_8I, Kp_,
+        &beta, acc, CUDA_R_32I, N_,
+#if CUDA_VERSION >= 11000
+        CUBLAS_COMPUTE_32I,
+#else
+        CUDA_R_32I,
+#endif
+        CUBLAS_GEMM_DEFAULT);
+    if (status != CUBLAS_STATUS_NOT_SUPPORTED) {
+      CUBLAS_CHECK(status);
+      done = true;
+    }
+  }
+#endif
+  if (!done) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    int8_gemm_kernel<<<CAFFE_GET_BLOCKS(y_count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+        y_count, N_, Kp_ / 4, reinterpret_cast<const int*>(qw),
+        reinterpret_cast<const int*>(qx), acc);
+    CUDA_POST_KERNEL_CHECK;
+  }
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  int8_dequantize_kernel<<<CAFFE_GET_BLOCKS(y_count), CAFFE_CUDA_NUM_THREADS, 0, stream>>>(
+      y_count, M, N_, acc, static_cast<const float*>(out_scales_->gpu_data()), bias, y,
+      y_transposed);
+  CUDA_POST_KERNEL_CHECK;
+  CUDA_CHECK(caffe_gpu_sync(stream));
+}
+
+template void Int8Gemm::Forward_gpu<float>(int M, const float* x, bool x_transposed,
+    const float* bias, float* y, bool y_transposed);
+template void Int8Gemm::Forward_gpu<double>(int M, const double* x, bool x_transposed,
+    const double* bias, double* y, bool y_transposed);
+template void Int8Gemm::Forward_gpu<float16>(int M, const float16* x, bool x_transposed,
+    const float16* bias, float16* y, bool y_transposed);
+
+}  // namespace caffe
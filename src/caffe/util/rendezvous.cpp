@@ -0,0 +1,193 @@
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "caffe/util/rendezvous.hpp"
+
+namespace caffe {
+
+namespace {
+
+void set_nodelay(int fd) {
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+}  // namespace
+
+Rendezvous::Rendezvous(int nodes, int node_rank, const std::string& master, int timeout_sec)
+    : nodes_(nodes), node_rank_(node_rank) {
+  CHECK_GT(nodes_, 1);
+  CHECK_GE(node_rank_, 0);
+  CHECK_LT(node_rank_, nodes_);
+  const size_t colon = master.rfind(':');
+  CHECK(colon != std::string::npos && colon + 1 < master.size())
+      << "Master endpoint must be host:port, got '" << master << "'";
+  const std::string host = master.substr(0, colon);
+  const int port = std::stoi(master.substr(colon + 1));
+  CHECK_GT(port, 0) << "Invalid master port in '" << master << "'";
+  if (node_rank_ == 0) {
+    listen_and_accept(host, port, timeout_sec);
+  } else {
+    connect_to_master(host, port, timeout_sec);
+  }
+  LOG(INFO) << "Node " << node_rank_ << " of " << nodes_ << " joined rendezvous at " << master;
+}
+
+Rendezvous::~Rendezvous() {
+  for (int fd : peers_) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+void Rendezvous::listen_and_accept(const std::string& host, int port, int timeout_sec) {
+  // Host part only tells other nodes where to find us: listen on all interfaces
+  int lfd = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(lfd, 0) << "socket() failed: " << std::strerror(errno);
+  int one = 1;
+  setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  CHECK_EQ(bind(lfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0)
+      << "Failed to bind rendezvous port " << port << ": " << std::strerror(errno);
+  CHECK_EQ(listen(lfd, nodes_), 0) << "listen() failed: " << std::strerror(errno);
+  peers_.assign(nodes_ - 1, -1);
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout_sec);
+  for (int joined = 0; joined < nodes_ - 1;) {
+    const int left_ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now()).count());
+    CHECK_GT(left_ms, 0) << "Rendezvous timed out: " << joined << " of " << nodes_ - 1
+        << " nodes joined";
+    pollfd pfd{lfd, POLLIN, 0};
+    const int ready = poll(&pfd, 1, left_ms);
+    if (ready <= 0) {
+      CHECK(ready == 0 || errno == EINTR) << "poll() failed: " << std::strerror(errno);
+      continue;
+    }
+    int fd = accept(lfd, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    int32_t rank = -1;
+    recv_all(fd, &rank, sizeof(rank));
+    CHECK(rank > 0 && rank < nodes_ && peers_[rank - 1] < 0)
+        << "Unexpected or duplicate node rank " << rank;
+    set_nodelay(fd);
+    peers_[rank - 1] = fd;
+    ++joined;
+  }
+  close(lfd);
+}
+
+void Rendezvous::connect_to_master(const std::string& host, int port, int timeout_sec) {
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  const std::string service = std::to_string(port);
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout_sec);
+  int fd = -1;
+  while (fd < 0) {
+    CHECK(std::chrono::steady_clock::now() < deadline)
+        << "Node " << node_rank_ << " failed to reach master " << host << ":" << port;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &res) == 0) {
+      for (addrinfo* ai = res; ai != nullptr && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+          close(fd);
+          fd = -1;
+        }
+      }
+      freeaddrinfo(res);
+    }
+    if (fd < 0) {
+      // Master may not be listening yet
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+  }
+  set_nodelay(fd);
+  const int32_t rank = node_rank_;
+  send_all(fd, &rank, sizeof(rank));
+  peers_.assign(1, fd);
+}
+
+void Rendezvous::send_all(int fd, const void* data, size_t size) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0UL) {
+    const ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(n, 0) << "Rendezvous send failed: " << std::strerror(errno);
+    p += n;
+    size -= n;
+  }
+}
+
+void Rendezvous::recv_all(int fd, void* data, size_t size) {
+  char* p = static_cast<char*>(data);
+  while (size > 0UL) {
+    const ssize_t n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(n, 0) << "Rendezvous peer closed connection or failed: " << std::strerror(errno);
+    p += n;
+    size -= n;
+  }
+}
+
+void Rendezvous::Broadcast(void* data, size_t size) {
+  if (node_rank_ == 0) {
+    for (int fd : peers_) {
+      send_all(fd, data, size);
+    }
+  } else {
+    recv_all(peers_[0], data, size);
+  }
+}
+
+void Rendezvous::AllReduceSum(float* data, size_t count) {
+  const size_t size = count * sizeof(float);
+  if (node_rank_ == 0) {
+    // Fixed order of summation: same result on every run
+    vector<float> buf(count);
+    for (int fd : peers_) {
+      recv_all(fd, buf.data(), size);
+      for (size_t i = 0; i < count; ++i) {
+        data[i] += buf[i];
+      }
+    }
+  } else {
+    send_all(peers_[0], data, size);
+  }
+  Broadcast(data, size);
+}
+
+bool Rendezvous::AnyTrue(bool value) {
+  float flag = value ? 1.F : 0.F;
+  AllReduceSum(&flag, 1UL);
+  return flag > 0.F;
+}
+
+void Rendezvous::Barrier() {
+  AnyTrue(false);
+}
+
+}  // namespace caffe
@@ -0,0 +1,242 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
+#include "caffe/util/shm_arena.hpp"
+
+namespace caffe {
+
+constexpr uint64_t ShmArena::MAGIC;
+
+ShmArena::ShmArena(const std::string& name, size_t capacity)
+    : name_(name), owner_(false), fd_(-1), mapped_size_(0UL), header_(nullptr) {
+  CHECK_EQ(name_[0], '/') << "Shared memory segment name must start with '/': " << name_;
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    if (create(capacity) || attach()) {
+      break;
+    }
+    // Left by a crashed owner, or failed: let's start over
+    LOG(INFO) << "Removing stale shared memory segment " << name_;
+    shm_unlink(name_.c_str());
+  }
+  CHECK(header_ != nullptr) << "Failed to create or attach shared memory segment " << name_;
+}
+
+ShmArena::~ShmArena() {
+  if (header_ != nullptr) {
+    munmap(header_, mapped_size_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  if (owner_) {
+    // Processes still attached keep their mappings valid
+    shm_unlink(name_.c_str());
+  }
+}
+
+bool ShmArena::create(size_t capacity) {
+  fd_ = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd_ < 0) {
+    CHECK_EQ(errno, EEXIST) << "shm_open(" << name_ << ") failed: " << std::strerror(errno);
+    return false;
+  }
+  mapped_size_ = align_up<6>(sizeof(Header)) + align_up<3>(capacity);
+  if (ftruncate(fd_, mapped_size_) != 0) {
+    LOG(FATAL) << "Failed to reserve " << mapped_size_ << " bytes of shared memory for "
+               << name_ << ": " << std::strerror(errno);
+  }
+  void* ptr = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  CHECK(ptr != MAP_FAILED) << "mmap(" << name_ << ") failed: " << std::strerror(errno);
+  header_ = static_cast<Header*>(ptr);
+  header_->state.store(BUILDING);
+  header_->owner_pid = static_cast<int32_t>(getpid());
+  header_->capacity = align_up<3>(capacity);
+  header_->used = 0UL;
+  header_->count = 0UL;
+  // Attaching processes wait for this one
+  header_->magic.store(MAGIC);
+  owner_ = true;
+  return true;
+}
+
+bool ShmArena::attach() {
+  fd_ = shm_open(name_.c_str(), O_RDWR, 0600);
+  if (fd_ < 0) {
+    return false;  // gone already, try to create once again
+  }
+  struct stat st;
+  // Owner might be in the middle of creating it
+  for (int t = 0; t < 100; ++t) {
+    CHECK_EQ(fstat(fd_, &st), 0) << std::strerror(errno);
+    if (st.st_size >= align_up<6>(sizeof(Header))) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  bool ok = st.st_size >= align_up<6>(sizeof(Header));
+  if (ok) {
+    mapped_size_ = st.st_size;
+    void* ptr = mmap(nullptr, mapped_size_, PROT_READ, MAP_SHARED, fd_, 0);
+    CHECK(ptr != MAP_FAILED) << "mmap(" << name_ << ") failed: " << std::strerror(errno);
+    header_ = static_cast<Header*>(ptr);
+    for (int t = 0; t < 100 && header_->magic.load() != MAGIC; ++t) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ok = header_->magic.load() == MAGIC && state() != FAILED && !stale();
+  }
+  if (!ok) {
+    if (header_ != nullptr) {
+      munmap(header_, mapped_size_);
+      header_ = nullptr;
+    }
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  LOG(INFO) << "Attached to shared memory segment " << name_ << " owned by process "
+            << header_->owner_pid;
+  return true;
+}
+
+ShmArena::State ShmArena::state() const {
+  return static_cast<State>(header_->state.load());
+}
+
+bool ShmArena::stale() const {
+  return state() == BUILDING && kill(header_->owner_pid, 0) != 0 && errno == ESRCH;
+}
+
+bool ShmArena::append(const void* buf, size_t size) {
+  CHECK(owner_);
+  if (state() != BUILDING) {
+    return false;
+  }
+  const size_t req = sizeof(uint64_t) + align_up<3>(size);
+  if (header_->used + req > header_->capacity) {
+    LOG(WARNING) << "Shared memory segment " << name_ << " is out of its "
+                 << header_->capacity << " bytes after " << header_->count << " records";
+    fail();
+    return false;
+  }
+  char* ptr = data() + header_->used;
+  *reinterpret_cast<uint64_t*>(ptr) = size;
+  std::memcpy(ptr + sizeof(uint64_t), buf, size);
+  header_->used += req;
+  ++header_->count;
+  return true;
+}
+
+void ShmArena::seal() {
+  CHECK(owner_);
+  if (state() == BUILDING) {
+    header_->state.store(READY);
+    LOG(INFO) << "Shared memory segment " << name_ << " sealed with " << header_->count
+              << " records (" << header_->used << " bytes)";
+  }
+}
+
+void ShmArena::fail() {
+  CHECK(owner_);
+  header_->state.store(FAILED);
+}
+
+bool ShmArena::wait_ready() {
+  int polls = 0;
+  while (state() == BUILDING) {
+    if (stale()) {
+      LOG(WARNING) << "Owner " << header_->owner_pid << " of shared memory segment "
+                   << name_ << " is gone";
+      return false;
+    }
+    LOG_IF(INFO, polls++ % 600 == 0) << "Waiting for process " << header_->owner_pid
+        << " to fill shared memory segment " << name_;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  if (state() != READY) {
+    return false;
+  }
+  build_index();
+  return true;
+}
+
+void ShmArena::build_index() {
+  if (!index_.empty()) {
+    return;
+  }
+  const size_t count = header_->count;
+  index_.reserve(count);
+  size_t offset = 0UL;
+  for (size_t i = 0; i < count; ++i) {
+    index_.push_back(offset);
+    const uint64_t size = *reinterpret_cast<const uint64_t*>(data() + offset);
+    offset += sizeof(uint64_t) + align_up<3>(size);
+  }
+  CHECK_EQ(offset, header_->used) << "Corrupted shared memory segment " << name_;
+}
+
+const char* ShmArena::record(size_t i, size_t* size) const {
+  CHECK_LT(i, index_.size());
+  const char* ptr = data() + index_[i];
+  *size = *reinterpret_cast<const uint64_t*>(ptr);
+  return ptr + sizeof(uint64_t);
+}
+
+std::string ShmArena::segment_name(const std::string& source) {
+  namespace fs = boost::filesystem;
+  std::string id = source;
+  boost::system::error_code ec;
+  const fs::path path = fs::canonical(source, ec);
+  if (!ec) {
+    // Rebuild when the source changes. DB directories also have lock and log files
+    // touched by every reader, thus we watch the largest file only (data.mdb etc.)
+    fs::path data_path = path;
+    if (fs::is_directory(path, ec)) {
+      uintmax_t max_bytes = 0UL;
+      for (fs::directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+        boost::system::error_code fec;
+        const uintmax_t bytes = fs::is_regular_file(it->path(), fec) ?
+            fs::file_size(it->path(), fec) : 0UL;
+        if (!fec && bytes > max_bytes) {
+          max_bytes = bytes;
+          data_path = it->path();
+        }
+      }
+    }
+    id = data_path.string() + "@" + std::to_string(fs::last_write_time(data_path, ec))
+        + "#" + std::to_string(fs::is_regular_file(data_path, ec) ?
+        fs::file_size(data_path, ec) : 0UL);
+  }
+  return "/caffe_" + std::to_string(getuid()) + "_" + std::to_string(std::hash<std::string>()(id));
+}
+
+size_t ShmArena::path_bytes(const std::string& source) {
+  namespace fs = boost::filesystem;
+  boost::system::error_code ec;
+  if (!fs::is_directory(source, ec)) {
+    const uintmax_t bytes = fs::file_size(source, ec);
+    return ec ? 0UL : static_cast<size_t>(bytes);
+  }
+  size_t bytes = 0UL;
+  for (fs::directory_iterator it(source, ec), end; !ec && it != end; it.increment(ec)) {
+    boost::system::error_code fec;
+    if (fs::is_regular_file(it->path(), fec)) {
+      const uintmax_t fbytes = fs::file_size(it->path(), fec);
+      bytes += fec ? 0UL : static_cast<size_t>(fbytes);
+    }
+  }
+  return bytes;
+}
+
+}  // namespace caffe
@@ -0,0 +1,269 @@
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define CAFFE_SIMD_X86
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CAFFE_SIMD_NEON
+#endif
+
+#include "caffe/util/simd_transform.hpp"
+
+namespace caffe {
+
+namespace {
+
+enum SimdIsa {
+  ISA_NONE = 0,
+  ISA_AVX2 = 1,
+  ISA_AVX512 = 2,
+  ISA_NEON = 3
+};
+
+SimdIsa detect_isa() {
+#if defined(CAFFE_SIMD_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return ISA_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c")) {
+    return ISA_AVX2;
+  }
+  return ISA_NONE;
+#elif defined(CAFFE_SIMD_NEON)
+  return ISA_NEON;
+#else
+  return ISA_NONE;
+#endif
+}
+
+SimdIsa isa() {
+  static const SimdIsa selected = detect_isa();
+  return selected;
+}
+
+// Every kernel below converts 16 pixels per step and returns the number of
+// leading output columns done, the rest is left to the scalar tail.
+// Output pointers are the row starts in each of 3 planes.
+
+#if defined(CAFFE_SIMD_X86)
+
+// 48 bytes of BGRBGR... to 16 bytes per channel, reversed if mirror is set
+__attribute__((target("ssse3")))
+inline void deinterleave16(const unsigned char* p, bool mirror, __m128i* c0, __m128i* c1,
+    __m128i* c2) {
+  const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+  const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 32));
+  const __m128i a0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i b0 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+  const __m128i d0 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+  const __m128i a1 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+  const __m128i d1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+  const __m128i a2 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+  const __m128i d2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+  *c0 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, a0), _mm_shuffle_epi8(b, b0)),
+      _mm_shuffle_epi8(c, d0));
+  *c1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, a1), _mm_shuffle_epi8(b, b1)),
+      _mm_shuffle_epi8(c, d1));
+  *c2 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, a2), _mm_shuffle_epi8(b, b2)),
+      _mm_shuffle_epi8(c, d2));
+  if (mirror) {
+    const __m128i rev = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    *c0 = _mm_shuffle_epi8(*c0, rev);
+    *c1 = _mm_shuffle_epi8(*c1, rev);
+    *c2 = _mm_shuffle_epi8(*c2, rev);
+  }
+}
+
+__attribute__((target("avx2,f16c")))
+inline void cvt8_avx2(__m128i x, __m256 scale, __m256 mean, float* dst) {
+  const __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(x));
+  const __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(x, 8)));
+  _mm256_storeu_ps(dst, _mm256_sub_ps(_mm256_mul_ps(lo, scale), mean));
+  _mm256_storeu_ps(dst + 8, _mm256_sub_ps(_mm256_mul_ps(hi, scale), mean));
+}
+
+__attribute__((target("avx2,f16c")))
+inline void cvt8_avx2(__m128i x, __m256 scale, __m256 mean, uint16_t* dst) {
+  const __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(x));
+  const __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(x, 8)));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+      _mm256_cvtps_ph(_mm256_sub_ps(_mm256_mul_ps(lo, scale), mean), _MM_FROUND_TO_NEAREST_INT));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8),
+      _mm256_cvtps_ph(_mm256_sub_ps(_mm256_mul_ps(hi, scale), mean), _MM_FROUND_TO_NEAREST_INT));
+}
+
+template<typename T>
+__attribute__((target("avx2,f16c")))
+int row_avx2(const unsigned char* src, int width, float scale, const float* mean, bool mirror,
+    T* d0, T* d1, T* d2) {
+  const __m256 vs = _mm256_set1_ps(scale);
+  const __m256 m0 = _mm256_set1_ps(mean[0]);
+  const __m256 m1 = _mm256_set1_ps(mean[1]);
+  const __m256 m2 = _mm256_set1_ps(mean[2]);
+  int w = 0;
+  for (; w + 16 <= width; w += 16) {
+    const int s = mirror ? width - 16 - w : w;
+    __m128i c0, c1, c2;
+    deinterleave16(src + 3 * s, mirror, &c0, &c1, &c2);
+    cvt8_avx2(c0, vs, m0, d0 + w);
+    cvt8_avx2(c1, vs, m1, d1 + w);
+    cvt8_avx2(c2, vs, m2, d2 + w);
+  }
+  return w;
+}
+
+__attribute__((target("avx512f")))
+inline void cvt16_avx512(__m128i x, __m512 scale, __m512 mean, float* dst) {
+  const __m512 v = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(x));
+  _mm512_storeu_ps(dst, _mm512_sub_ps(_mm512_mul_ps(v, scale), mean));
+}
+
+__attribute__((target("avx512f")))
+inline void cvt16_avx512(__m128i x, __m512 scale, __m512 mean, uint16_t* dst) {
+  const __m512 v = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(x));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst),
+      _mm512_cvtps_ph(_mm512_sub_ps(_mm512_mul_ps(v, scale), mean), _MM_FROUND_TO_NEAREST_INT));
+}
+
+template<typename T>
+__attribute__((target("avx512f")))
+int row_avx512(const unsigned char* src, int width, float scale, const float* mean,
+    bool mirror, T* d0, T* d1, T* d2) {
+  const __m512 vs = _mm512_set1_ps(scale);
+  const __m512 m0 = _mm512_set1_ps(mean[0]);
+  const __m512 m1 = _mm512_set1_ps(mean[1]);
+  const __m512 m2 = _mm512_set1_ps(mean[2]);
+  int w = 0;
+  for (; w + 16 <= width; w += 16) {
+    const int s = mirror ? width - 16 - w : w;
+    __m128i c0, c1, c2;
+    deinterleave16(src + 3 * s, mirror, &c0, &c1, &c2);
+    cvt16_avx512(c0, vs, m0, d0 + w);
+    cvt16_avx512(c1, vs, m1, d1 + w);
+    cvt16_avx512(c2, vs, m2, d2 + w);
+  }
+  return w;
+}
+
+#elif defined(CAFFE_SIMD_NEON)
+
+inline void cvt16_neon(uint8x16_t x, float32x4_t scale, float32x4_t mean, float* dst) {
+  const uint16x8_t lo = vmovl_u8(vget_low_u8(x));
+  const uint16x8_t hi = vmovl_high_u8(x);
+  vst1q_f32(dst, vsubq_f32(vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))), scale), mean));
+  vst1q_f32(dst + 4, vsubq_f32(vmulq_f32(vcvtq_f32_u32(vmovl_high_u16(lo)), scale), mean));
+  vst1q_f32(dst + 8, vsubq_f32(vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))), scale),
+      mean));
+  vst1q_f32(dst + 12, vsubq_f32(vmulq_f32(vcvtq_f32_u32(vmovl_high_u16(hi)), scale), mean));
+}
+
+inline void cvt16_neon(uint8x16_t x, float32x4_t scale, float32x4_t mean, uint16_t* dst) {
+  float tmp[16];
+  cvt16_neon(x, scale, mean, tmp);
+  for (int i = 0; i < 16; i += 4) {
+    vst1_u16(dst + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(tmp + i))));
+  }
+}
+
+inline uint8x16_t reverse16_neon(uint8x16_t x) {
+  const uint8x16_t r = vrev64q_u8(x);
+  return vextq_u8(r, r, 8);
+}
+
+template<typename T>
+int row_neon(const unsigned char* src, int width, float scale, const float* mean, bool mirror,
+    T* d0, T* d1, T* d2) {
+  const float32x4_t vs = vdupq_n_f32(scale);
+  const float32x4_t m0 = vdupq_n_f32(mean[0]);
+  const float32x4_t m1 = vdupq_n_f32(mean[1]);
+  const float32x4_t m2 = vdupq_n_f32(mean[2]);
+  int w = 0;
+  for (; w + 16 <= width; w += 16) {
+    const int s = mirror ? width - 16 - w : w;
+    uint8x16x3_t px = vld3q_u8(src + 3 * s);
+    if (mirror) {
+      px.val[0] = reverse16_neon(px.val[0]);
+      px.val[1] = reverse16_neon(px.val[1]);
+      px.val[2] = reverse16_neon(px.val[2]);
+    }
+    cvt16_neon(px.val[0], vs, m0, d0 + w);
+    cvt16_neon(px.val[1], vs, m1, d1 + w);
+    cvt16_neon(px.val[2], vs, m2, d2 + w);
+  }
+  return w;
+}
+
+#endif
+
+// T is the raw vector output type, Dtype is what the scalar tail writes
+template<typename T, typename Dtype>
+bool hwc3_to_chw(const unsigned char* src, size_t src_step, int height, int width, float scale,
+    const float* mean, bool mirror, Dtype* dst) {
+  const SimdIsa selected = isa();
+  if (selected == ISA_NONE) {
+    return false;
+  }
+  const size_t plane = static_cast<size_t>(height) * width;
+  for (int h = 0; h < height; ++h) {
+    const unsigned char* src_row = src + h * src_step;
+    Dtype* d0 = dst + static_cast<size_t>(h) * width;
+    Dtype* d1 = d0 + plane;
+    Dtype* d2 = d1 + plane;
+    T* t0 = reinterpret_cast<T*>(d0);
+    T* t1 = reinterpret_cast<T*>(d1);
+    T* t2 = reinterpret_cast<T*>(d2);
+    int done = 0;
+#if defined(CAFFE_SIMD_X86)
+    if (selected == ISA_AVX512) {
+      done = row_avx512(src_row, width, scale, mean, mirror, t0, t1, t2);
+    } else {
+      done = row_avx2(src_row, width, scale, mean, mirror, t0, t1, t2);
+    }
+#elif defined(CAFFE_SIMD_NEON)
+    done = row_neon(src_row, width, scale, mean, mirror, t0, t1, t2);
+#endif
+    for (int w = done; w < width; ++w) {
+      const unsigned char* px = src_row + 3 * (mirror ? width - 1 - w : w);
+      d0[w] = static_cast<Dtype>(static_cast<float>(px[0]) * scale - mean[0]);
+      d1[w] = static_cast<Dtype>(static_cast<float>(px[1]) * scale - mean[1]);
+      d2[w] = static_cast<Dtype>(static_cast<float>(px[2]) * scale - mean[2]);
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool simd_hwc3_to_chw(const unsigned char* src, size_t src_step, int height, int width,
+    float scale, const float* mean, bool mirror, float* dst) {
+  return hwc3_to_chw<float>(src, src_step, height, width, scale, mean, mirror, dst);
+}
+
+#ifndef CPU_ONLY
+bool simd_hwc3_to_chw(const unsigned char* src, size_t src_step, int height, int width,
+    float scale, const float* mean, bool mirror, float16* dst) {
+  static_assert(sizeof(float16) == sizeof(uint16_t), "Unexpected float16 layout");
+  return hwc3_to_chw<uint16_t>(src, src_step, height, width, scale, mean, mirror, dst);
+}
+#endif
+
+const char* simd_transform_isa() {
+  switch (isa()) {
+    case ISA_AVX512:
+      return "avx512";
+    case ISA_AVX2:
+      return "avx2";
+    case ISA_NEON:
+      return "neon";
+    default:
+      return "none";
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,88 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/util/snapshot_writer.hpp"
+#include "caffe/util/thread_profile.hpp"
+
+namespace caffe {
+
+SnapshotWriter::SnapshotWriter(bool async, int keep)
+    : async_(async), keep_(keep) {
+  if (async_) {
+    jobs_.reset(new TaskGroup(1, TaskScheduler::LOW));
+  }
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  Wait();
+}
+
+void SnapshotWriter::Write(const std::string& filename, const WriteFunction& write) {
+  written_.push_back(filename);
+  Run([filename, write]() {
+    const std::string path = filename + ".tmp";
+    write(path);
+    CHECK_EQ(std::rename(path.c_str(), filename.c_str()), 0)
+        << "Failed to rename " << path << " to " << filename << ": " << std::strerror(errno);
+  });
+}
+
+void SnapshotWriter::AddDirectory(const std::string& dir) {
+  // remove() only takes empty directories
+  written_.push_back(dir);
+}
+
+void SnapshotWriter::Commit() {
+  std::vector<std::string> files;
+  files.swap(written_);
+  Run([this, files]() {
+    if (keep_ <= 0) {
+      return;
+    }
+    kept_.push_back(files);
+    while (kept_.size() > keep_) {
+      for (const std::string& file : kept_.front()) {
+        if (std::remove(file.c_str()) == 0) {
+          LOG(INFO) << "Removed old snapshot file " << file;
+        }
+      }
+      kept_.pop_front();
+    }
+  });
+}
+
+void SnapshotWriter::Wait() {
+  if (async_) {
+    jobs_->Wait();
+  }
+}
+
+void SnapshotWriter::Run(const std::function<void()>& job) {
+  if (!async_) {
+    job();
+    return;
+  }
+  jobs_->Submit([job]() {
+    ThreadProfile::Scope write(ThreadProfile::READ);
+    job();
+  });
+}
+
+shared_ptr<Blob> SnapshotWriter::HostCopy(const Blob& blob, bool with_diff) {
+  shared_ptr<Blob> copy = Blob::create(blob.data_type(), blob.diff_type());
+  copy->ReshapeLike(blob);
+  if (blob.count() == 0) {
+    return copy;
+  }
+  std::memcpy(copy->current_mutable_data_memory(false), blob.current_data_memory(false),
+      blob.current_data_memory_size());
+  if (with_diff) {
+    std::memcpy(copy->current_mutable_diff_memory(false), blob.current_diff_memory(false),
+        blob.current_diff_memory_size());
+  }
+  return copy;
+}
+
+}  // namespace caffe
@@ -0,0 +1,65 @@
+#include "caffe/common.hpp"
+#include "caffe/util/multi_tensor_apply.cuh"
+#include "caffe/util/sparse_2_4.hpp"
+
+namespace caffe {
+
+// Thread per mask word, thus per 8 groups
+template<typename T>
+__global__ void Sparse24MaskKernel(int count, const T* w, unsigned int* mask) {
+  const int groups = count / 4;
+  CUDA_KERNEL_LOOP(k, sparse_2_4_mask_words(count)) {
+    unsigned int word = 0U;
+    for (int g = k * 8; g < groups && g < k * 8 + 8; ++g) {
+      const float a[4] = {fabsf(mt_load<float>(w[4 * g])), fabsf(mt_load<float>(w[4 * g + 1])),
+          fabsf(mt_load<float>(w[4 * g + 2])), fabsf(mt_load<float>(w[4 * g + 3]))};
+      word |= sparse_2_4_group_mask(a) << (4 * (g - k * 8));
+    }
+    mask[k] = word;
+  }
+}
+
+template<typename T>
+__global__ void Sparse24ApplyKernel(int count, const unsigned int* mask, T* w) {
+  CUDA_KERNEL_LOOP(i, count) {
+    if (((mask[i / 32] >> (i % 32)) & 1U) == 0U) {
+      w[i] = mt_store<T>(0.F);
+    }
+  }
+}
+
+static cudaStream_t sparse_2_4_stream(void* handle) {
+  cublasHandle_t cublas_handle =
+      handle == nullptr ? Caffe::cublas_handle() : reinterpret_cast<cublasHandle_t>(handle);
+  cudaStream_t stream;
+  CUBLAS_CHECK(cublasGetStream(cublas_handle, &stream));
+  return stream;
+}
+
+template<typename Dtype>
+void sparse_2_4_mask_gpu(int count, const Dtype* w, unsigned int* mask, void* handle) {
+  typedef typename MultiTensorType<Dtype>::type T;
+  const int words = sparse_2_4_mask_words(count);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  Sparse24MaskKernel<<<CAFFE_GET_BLOCKS(words), CAFFE_CUDA_NUM_THREADS, 0,
+      sparse_2_4_stream(handle)>>>(count, reinterpret_cast<const T*>(w), mask);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template<typename Dtype>
+void sparse_2_4_apply_gpu(int count, const unsigned int* mask, Dtype* w, void* handle) {
+  typedef typename MultiTensorType<Dtype>::type T;
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  Sparse24ApplyKernel<<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS, 0,
+      sparse_2_4_stream(handle)>>>(count, mask, reinterpret_cast<T*>(w));
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template void sparse_2_4_mask_gpu<float16>(int, const float16*, unsigned int*, void*);
+template void sparse_2_4_mask_gpu<float>(int, const float*, unsigned int*, void*);
+template void sparse_2_4_mask_gpu<double>(int, const double*, unsigned int*, void*);
+template void sparse_2_4_apply_gpu<float16>(int, const unsigned int*, float16*, void*);
+template void sparse_2_4_apply_gpu<float>(int, const unsigned int*, float*, void*);
+template void sparse_2_4_apply_gpu<double>(int, const unsigned int*, double*, void*);
+
+}  // namespace caffe
@@ -0,0 +1,115 @@
+#include <chrono>
+#include <sstream>
+#include <string>
+
+#include "caffe/util/spin_barrier.hpp"
+
+namespace caffe {
+
+constexpr size_t SpinBarrier::BUCKETS;
+constexpr int SpinBarrier::SPIN_COUNT;
+
+SpinBarrier::SpinBarrier(unsigned int count)
+    : count_(count), arrived_(0U), generation_(0U), parked_(0),
+      last_arrivals_(new std::atomic<uint64_t>[count]), parks_(0UL) {
+  CHECK_GT(count_, 0U);
+  for (std::atomic<uint64_t>& h : histogram_) {
+    h.store(0UL, std::memory_order_relaxed);
+  }
+  for (unsigned int i = 0U; i < count_; ++i) {
+    last_arrivals_[i].store(0UL, std::memory_order_relaxed);
+  }
+}
+
+void SpinBarrier::wait(int rank) {
+  const auto start = std::chrono::steady_clock::now();
+  const unsigned int gen = generation_.load(std::memory_order_acquire);
+  if (arrived_.fetch_add(1U, std::memory_order_acq_rel) + 1U == count_) {
+    // Reset before the flip: nobody arrives at the next round before seeing it
+    arrived_.store(0U, std::memory_order_relaxed);
+    generation_.fetch_add(1U, std::memory_order_release);
+    // Pairs with the fence below: either the waiter sees the flip or we see it parked
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_.load() > 0) {
+      { boost::mutex::scoped_lock lock(mutex_); }
+      condition_.notify_all();
+    }
+    record(rank, 0UL, true);
+    return;
+  }
+  bool passed = false;
+  for (int i = 0; i < SPIN_COUNT; ++i) {
+    if (generation_.load(std::memory_order_acquire) != gen) {
+      passed = true;
+      break;
+    }
+    if (i >= SPIN_COUNT / 2) {
+      boost::this_thread::yield();
+    }
+  }
+  if (!passed) {
+    parks_.fetch_add(1UL, std::memory_order_relaxed);
+    boost::mutex::scoped_lock lock(mutex_);
+    struct Parked {
+      explicit Parked(std::atomic<int>& p) : p_(p) { ++p_; }
+      ~Parked() { --p_; }
+      std::atomic<int>& p_;
+    } parked(parked_);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (generation_.load(std::memory_order_acquire) == gen) {
+      condition_.wait(lock);
+    }
+  }
+  record(rank, std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count(), false);
+}
+
+void SpinBarrier::record(int rank, uint64_t wait_us, bool last) {
+  size_t bucket = 0UL;
+  while (wait_us > 0UL && bucket < BUCKETS - 1UL) {
+    wait_us >>= 1;
+    ++bucket;
+  }
+  histogram_[bucket].fetch_add(1UL, std::memory_order_relaxed);
+  if (last && rank >= 0 && rank < static_cast<int>(count_)) {
+    last_arrivals_[rank].fetch_add(1UL, std::memory_order_relaxed);
+  }
+}
+
+string SpinBarrier::report() const {
+  uint64_t waits = 0UL;
+  for (size_t i = 0UL; i < BUCKETS; ++i) {
+    waits += histogram(i);
+  }
+  if (waits == 0UL) {
+    return string();
+  }
+  // Upper bounds of the buckets holding the percentiles
+  uint64_t seen = 0UL, p50 = 0UL, p99 = 0UL;
+  for (size_t i = 0UL; i < BUCKETS; ++i) {
+    seen += histogram(i);
+    if (p50 == 0UL && seen * 2UL >= waits) {
+      p50 = 1UL << i;
+    }
+    if (p99 == 0UL && seen * 100UL >= waits * 99UL) {
+      p99 = 1UL << i;
+    }
+  }
+  std::ostringstream os;
+  os << waits << " waits, " << parks() << " parked, p50 < " << p50 << " us, p99 < "
+     << p99 << " us";
+  int straggler = -1;
+  uint64_t most = 0UL;
+  for (unsigned int r = 0U; r < count_; ++r) {
+    if (last_arrivals(r) > most) {
+      most = last_arrivals(r);
+      straggler = r;
+    }
+  }
+  if (straggler >= 0) {
+    os << ", rank " << straggler << " arrived last " << most << " times";
+  }
+  return os.str();
+}
+
+}  // namespace caffe
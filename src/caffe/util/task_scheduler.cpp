@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#include "caffe/util/task_scheduler.hpp"
+#include "caffe/util/thread_profile.hpp"
+
+namespace caffe {
+
+thread_local int TaskScheduler::worker_id_ = -1;
+
+int cpu_numa_node(int cpu) {
+#ifdef __linux__
+  const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/node";
+  for (int node = 0; node < 256; ++node) {
+    if (access((dir + std::to_string(node)).c_str(), F_OK) == 0) {
+      return node;
+    }
+  }
+#endif
+  return 0;
+}
+
+// CPUs the process may use by NUMA node, empty if unknown
+static std::map<int, std::vector<int>> node_cpus() {
+  std::map<int, std::vector<int>> nodes;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+        nodes[cpu_numa_node(cpu)].push_back(cpu);
+      }
+    }
+  }
+#endif
+  return nodes;
+}
+
+int TaskScheduler::num_threads() {
+  static const int threads = [] {
+    const char* env = std::getenv("CAFFE_TASK_THREADS");
+    const int n = env != nullptr ? std::atoi(env) : 0;
+    return n > 0 ? n : static_cast<int>(std::max(1U, std::thread::hardware_concurrency()));
+  }();
+  return threads;
+}
+
+TaskScheduler::TaskScheduler() : queued_(0), next_(0U) {
+  const int threads = num_threads();
+  std::map<int, std::vector<int>> nodes = node_cpus();
+  std::vector<int> worker_nodes(threads, 0);
+  std::vector<std::vector<int>> worker_cpus(threads);
+  if (!nodes.empty()) {
+    std::vector<int> node_ids;
+    for (const auto& node : nodes) {
+      node_ids.push_back(node.first);
+    }
+    for (int i = 0; i < threads; ++i) {
+      worker_nodes[i] = node_ids[i % node_ids.size()];
+      if (node_ids.size() > 1) {
+        worker_cpus[i] = nodes[worker_nodes[i]];
+      }
+    }
+  }
+  for (int i = 0; i < threads; ++i) {
+    workers_.emplace_back(new Worker);
+  }
+  for (int i = 0; i < threads; ++i) {
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int j = 1; j < threads; ++j) {
+        const int v = (i + j) % threads;
+        if ((worker_nodes[v] == worker_nodes[i]) == (pass == 0)) {
+          workers_[i]->victims.push_back(v);
+        }
+      }
+    }
+  }
+  for (int i = 0; i < threads; ++i) {
+    std::thread(&TaskScheduler::WorkerEntry, this, i, worker_cpus[i]).detach();
+  }
+  LOG(INFO) << "Task scheduler: " << threads << " workers on " << std::max<size_t>(1UL,
+      nodes.size()) << " NUMA node(s)";
+}
+
+TaskScheduler& TaskScheduler::instance() {
+  // Never destroyed: task groups of static objects may outlive it otherwise
+  static TaskScheduler* scheduler = new TaskScheduler;
+  return *scheduler;
+}
+
+void TaskScheduler::Submit(Task task, Priority priority) {
+  TaskScheduler& scheduler = instance();
+  const int worker_id = on_worker() ? worker_id_ :
+      static_cast<int>(scheduler.next_.fetch_add(1U) % scheduler.workers_.size());
+  Worker& worker = *scheduler.workers_[worker_id];
+  {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.tasks[priority].push_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(scheduler.idle_mutex_);
+    scheduler.queued_.fetch_add(1);
+  }
+  scheduler.idle_cv_.notify_one();
+}
+
+bool TaskScheduler::RunOne() {
+  if (!on_worker()) {
+    return false;
+  }
+  Task task;
+  if (!instance().Take(worker_id_, &task)) {
+    return false;
+  }
+  task();
+  return true;
+}
+
+bool TaskScheduler::Take(int worker_id, Task* task) {
+  Worker& own = *workers_[worker_id];
+  for (int p = 0; p < PRIORITIES; ++p) {
+    {
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks[p].empty()) {
+        *task = std::move(own.tasks[p].back());
+        own.tasks[p].pop_back();
+        queued_.fetch_sub(1);
+        return true;
+      }
+    }
+    for (int v : own.victims) {
+      Worker& victim = *workers_[v];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.tasks[p].empty()) {
+        *task = std::move(victim.tasks[p].front());
+        victim.tasks[p].pop_front();
+        queued_.fetch_sub(1);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void TaskScheduler::WorkerEntry(int worker_id, const std::vector<int>& cpus) {
+#ifdef __linux__
+  if (!cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+      CPU_SET(cpu, &set);
+    }
+    sched_setaffinity(0, sizeof(set), &set);  // best effort
+  }
+#endif
+  worker_id_ = worker_id;
+  ThreadProfile profile("task worker " + std::to_string(worker_id));
+  profile.attach();
+  while (true) {
+    Task task;
+    if (Take(worker_id, &task)) {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    idle_cv_.wait(lock, [this] { return queued_.load() > 0; });
+  }
+}
+
+TaskGroup::TaskGroup(int limit, TaskScheduler::Priority priority)
+    : limit_(limit), priority_(priority), running_(0) {
+  CHECK_GT(limit_, 0);
+}
+
+TaskGroup::~TaskGroup() {
+  Wait();
+}
+
+void TaskGroup::Submit(TaskScheduler::Task task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_ >= limit_) {
+      waiting_.push_back(std::move(task));
+      return;
+    }
+    ++running_;
+  }
+  Launch(std::move(task));
+}
+
+void TaskGroup::Launch(TaskScheduler::Task task) {
+  auto shared = std::make_shared<TaskScheduler::Task>(std::move(task));
+  TaskScheduler::Submit([this, shared]() {
+    (*shared)();
+    Done();
+  }, priority_);
+}
+
+void TaskGroup::Done() {
+  TaskScheduler::Task next;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (waiting_.empty()) {
+      if (--running_ == 0) {
+        done_cv_.notify_all();
+      }
+      return;
+    }
+    next = std::move(waiting_.front());
+    waiting_.pop_front();
+  }
+  Launch(std::move(next));
+}
+
+void TaskGroup::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (running_ > 0) {
+    if (TaskScheduler::on_worker()) {
+      // Blocking here could leave no worker to run what this waits for
+      lock.unlock();
+      if (!TaskScheduler::RunOne()) {
+        std::this_thread::yield();
+      }
+      lock.lock();
+    } else {
+      done_cv_.wait(lock);
+    }
+  }
+}
+
+}  // namespace caffe
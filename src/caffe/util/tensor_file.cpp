@@ -0,0 +1,224 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "caffe/util/tensor_file.hpp"
+
+namespace caffe {
+
+constexpr uint64_t TensorFile::MAGIC;
+constexpr uint32_t TensorFile::VERSION;
+constexpr int TensorFile::ALIGNMENT_POWER;
+
+TensorFileWriter::TensorFileWriter(const string& filename, Type type,
+    const vector<int>& record_shape)
+    : filename_(filename), type_(type), shape_(record_shape), record_bytes_(tsize(type)),
+      out_(filename, std::ios::binary | std::ios::trunc) {
+  CHECK(out_.is_open()) << "Failed to open " << filename_ << " for writing";
+  CHECK_LE(shape_.size(), 8UL) << "Records of up to 8 axes are supported";
+  for (int dim : shape_) {
+    CHECK_GT(dim, 0) << "Records can't be empty";
+    record_bytes_ *= dim;
+  }
+  // The header is written by Close once the number of records is known
+  const vector<char> header_page(1UL << TensorFile::ALIGNMENT_POWER, 0);
+  out_.write(header_page.data(), header_page.size());
+}
+
+TensorFileWriter::~TensorFileWriter() {
+  if (out_.is_open()) {
+    Close();
+  }
+}
+
+void TensorFileWriter::Add(const void* record, int label) {
+  out_.write(static_cast<const char*>(record), record_bytes_);
+  labels_.push_back(label);
+}
+
+void TensorFileWriter::Close() {
+  const uint64_t data_offset = 1UL << TensorFile::ALIGNMENT_POWER;
+  out_.write(reinterpret_cast<const char*>(labels_.data()), labels_.size() * sizeof(int32_t));
+  TensorFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = TensorFile::MAGIC;
+  header.version = TensorFile::VERSION;
+  header.type = type_;
+  header.records = labels_.size();
+  header.record_bytes = record_bytes_;
+  header.data_offset = data_offset;
+  header.labels_offset = data_offset + labels_.size() * record_bytes_;
+  header.num_axes = shape_.size();
+  for (size_t i = 0; i < shape_.size(); ++i) {
+    header.shape[i] = shape_[i];
+  }
+  out_.seekp(0);
+  out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out_.close();
+  CHECK(!out_.fail()) << "Failed to write " << filename_;
+}
+
+namespace {
+
+void pread_all(int fd, void* dst, size_t bytes, uint64_t offset, const string& filename) {
+  char* p = static_cast<char*>(dst);
+  while (bytes > 0UL) {
+    const ssize_t n = pread(fd, p, bytes, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(n, 0) << "Failed to read " << filename << " at " << offset << ": "
+        << (n < 0 ? std::strerror(errno) : "unexpected end of file");
+    p += n;
+    bytes -= n;
+    offset += n;
+  }
+}
+
+#if defined(USE_CUFILE) && !defined(CPU_ONLY)
+// The driver is opened once per process and stays open
+bool cufile_driver_open() {
+  static std::once_flag once;
+  static bool opened = false;
+  std::call_once(once, [] {
+    const CUfileError_t status = cuFileDriverOpen();
+    opened = status.err == CU_FILE_SUCCESS;
+    LOG_IF(WARNING, !opened) << "cuFile driver not available (error " << status.err
+        << "), tensor files are read through host memory";
+  });
+  return opened;
+}
+#endif
+
+}  // namespace
+
+TensorFile::TensorFile(const string& filename)
+    : filename_(filename), fd_(-1), type_(FLOAT), records_(0UL), record_bytes_(0UL),
+      data_offset_(0UL) {
+  fd_ = open(filename_.c_str(), O_RDONLY);
+  CHECK_GE(fd_, 0) << "Failed to open " << filename_ << ": " << std::strerror(errno);
+  struct stat st;
+  CHECK_EQ(fstat(fd_, &st), 0) << "Failed to stat " << filename_ << ": "
+      << std::strerror(errno);
+  const uint64_t size = st.st_size;
+  CHECK_GE(size, sizeof(TensorFileHeader)) << filename_ << " is too short";
+  TensorFileHeader header;
+  pread_all(fd_, &header, sizeof(header), 0UL, filename_);
+  CHECK_EQ(header.magic, MAGIC) << filename_ << " is not a tensor file";
+  CHECK_EQ(header.version, VERSION) << "Unsupported version of tensor file " << filename_;
+  CHECK_LE(header.num_axes, 8U) << filename_ << " is corrupted";
+  CHECK_GT(header.records, 0UL) << filename_ << " has no records";
+  type_ = static_cast<Type>(header.type);
+  CHECK(Type_IsValid(type_)) << filename_ << ": unknown type " << header.type;
+  shape_.assign(header.shape, header.shape + header.num_axes);
+  records_ = header.records;
+  record_bytes_ = header.record_bytes;
+  data_offset_ = header.data_offset;
+  uint64_t values = 1UL;
+  for (int dim : shape_) {
+    values *= dim;
+  }
+  CHECK_EQ(values * tsize(type_), record_bytes_) << filename_ << " is corrupted";
+  CHECK_EQ(header.labels_offset, data_offset_ + records_ * record_bytes_)
+      << filename_ << " is corrupted";
+  CHECK_LE(header.labels_offset + records_ * sizeof(int32_t), size)
+      << filename_ << " is truncated";
+  labels_.resize(records_);
+  pread_all(fd_, labels_.data(), records_ * sizeof(int32_t), header.labels_offset, filename_);
+  // Ranges of records are read once, front to back
+  posix_fadvise(fd_, data_offset_, records_ * record_bytes_, POSIX_FADV_SEQUENTIAL);
+#if defined(USE_CUFILE) && !defined(CPU_ONLY)
+  direct_fd_ = -1;
+  if (cufile_driver_open()) {
+    direct_fd_ = open(filename_.c_str(), O_RDONLY | O_DIRECT);
+    if (direct_fd_ >= 0) {
+      CUfileDescr_t descr;
+      std::memset(&descr, 0, sizeof(descr));
+      descr.handle.fd = direct_fd_;
+      descr.type = CU_FILE_HANDLE_TYPE_OPAQUE_FD;
+      const CUfileError_t status = cuFileHandleRegister(&handle_, &descr);
+      if (status.err != CU_FILE_SUCCESS) {
+        LOG(WARNING) << "cuFile can't read " << filename_ << " (error " << status.err
+            << "), it's read through host memory";
+        close(direct_fd_);
+        direct_fd_ = -1;
+      }
+    } else {
+      LOG(WARNING) << "No O_DIRECT reads of " << filename_ << ": " << std::strerror(errno)
+          << ", it's read through host memory";
+    }
+  }
+#endif
+}
+
+TensorFile::~TensorFile() {
+#if defined(USE_CUFILE) && !defined(CPU_ONLY)
+  if (direct_fd_ >= 0) {
+    cuFileHandleDeregister(handle_);
+    close(direct_fd_);
+  }
+#endif
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+void TensorFile::Read(uint64_t first, size_t count, void* dst) const {
+  CHECK_LE(first + count, records_) << filename_ << ": records out of range";
+  pread_all(fd_, dst, count * record_bytes_, data_offset_ + first * record_bytes_, filename_);
+}
+
+bool TensorFile::direct() const {
+#if defined(USE_CUFILE) && !defined(CPU_ONLY)
+  return direct_fd_ >= 0;
+#else
+  return false;
+#endif
+}
+
+#if defined(USE_CUFILE) && !defined(CPU_ONLY)
+const void* TensorFile::ReadDevice(uint64_t first, size_t count, void* dst,
+    GPUMemory::Workspace* staging) const {
+  CHECK(direct()) << filename_ << " can't be read by cuFile";
+  CHECK_LE(first + count, records_) << filename_ << ": records out of range";
+  const uint64_t begin = data_offset_ + first * record_bytes_;
+  const uint64_t end = begin + count * record_bytes_;
+  const uint64_t page_mask = (1UL << ALIGNMENT_POWER) - 1UL;
+  const uint64_t aligned_begin = begin & ~page_mask;
+  // Past the end of the file only the bytes there are read
+  const uint64_t aligned_end = align_up<ALIGNMENT_POWER>(end);
+  char* buffer = static_cast<char*>(dst);
+  if (dst == nullptr || aligned_begin != begin || aligned_end != end) {
+    staging->safe_reserve(aligned_end - aligned_begin);
+    buffer = static_cast<char*>(staging->data());
+  }
+  uint64_t offset = aligned_begin;
+  while (offset < end) {
+    const ssize_t n = cuFileRead(handle_, buffer, aligned_end - offset, offset,
+        offset - aligned_begin);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(n, 0) << "cuFile failed to read " << filename_ << " at " << offset << ": "
+        << (n == -1 ? std::strerror(errno) : n < 0 ? "cuFile error " + std::to_string(-n) :
+        "unexpected end of file");
+    offset += n;
+  }
+  return buffer + (begin - aligned_begin);
+}
+#endif
+
+bool TensorFile::Is(const string& filename) {
+  std::ifstream in(filename, std::ios::binary);
+  uint64_t magic = 0UL;
+  in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+  return in.good() && magic == MAGIC;
+}
+
+}  // namespace caffe
@@ -0,0 +1,547 @@
+#if defined(USE_TENSORRT) && !defined(CPU_ONLY)
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>  // NOLINT(readability/streams)
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/net.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/quantization.hpp"
+#include "caffe/util/tensorrt_engine.hpp"
+
+namespace caffe {
+
+using nvinfer1::DataType;
+using nvinfer1::Dims;
+using nvinfer1::DimsHW;
+using nvinfer1::ITensor;
+
+namespace {
+
+class Logger : public nvinfer1::ILogger {
+ public:
+  void log(Severity severity, const char* msg) noexcept override {
+    if (severity <= Severity::kERROR) {
+      LOG(ERROR) << "TensorRT: " << msg;
+    } else if (severity == Severity::kWARNING) {
+      LOG(WARNING) << "TensorRT: " << msg;
+    } else {
+      DLOG(INFO) << "TensorRT: " << msg;
+    }
+  }
+};
+
+Logger& logger() {
+  // Never destroyed: engines of static nets may be released during exit
+  static Logger* l = new Logger;
+  return *l;
+}
+
+// 64-bit FNV-1a, stable from run to run
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL) {
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ p[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+Dims dims(const vector<int>& shape) {
+  Dims d;
+  d.nbDims = shape.size();
+  for (int i = 0; i < d.nbDims; ++i) {
+    d.d[i] = shape[i];
+  }
+  return d;
+}
+
+bool same_shape(const Dims& d, const vector<int>& shape) {
+  if (d.nbDims != static_cast<int>(shape.size())) {
+    return false;
+  }
+  for (int i = 0; i < d.nbDims; ++i) {
+    if (d.d[i] != shape[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool supported_type(Type type) {
+  return type == FLOAT || type == FLOAT16;
+}
+
+DataType trt_type(Type type) {
+  return type == FLOAT16 ? DataType::kHALF : DataType::kFLOAT;
+}
+
+void* gpu_data(Blob* blob, bool writable) {
+  if (blob->data_type() == FLOAT16) {
+    return writable ? static_cast<void*>(blob->mutable_gpu_data<float16>())
+        : const_cast<float16*>(blob->gpu_data<float16>());
+  }
+  return writable ? static_cast<void*>(blob->mutable_gpu_data<float>())
+      : const_cast<float*>(blob->gpu_data<float>());
+}
+
+// Spatial values given once for both axes, once per axis, or not at all
+DimsHW hw(const google::protobuf::RepeatedField<uint32_t>& values, int value) {
+  if (values.size() == 1) {
+    return DimsHW(values.Get(0), values.Get(0));
+  }
+  if (values.size() == 2) {
+    return DimsHW(values.Get(0), values.Get(1));
+  }
+  return DimsHW(value, value);
+}
+
+int canonical_axis(int axis, int num_axes) {
+  return axis < 0 ? axis + num_axes : axis;
+}
+
+bool read_file(const string& filename, string* contents) {
+  std::ifstream file(filename, std::ios::in | std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::ostringstream os;
+  os << file.rdbuf();
+  *contents = os.str();
+  return true;
+}
+
+}  // namespace
+
+TensorRTSegment::TensorRTSegment(const Net& net, int first, int last,
+    const vector<Blob*>& inputs, const vector<Blob*>& outputs, const TensorRTParameter& param)
+    : net_(net), first_(first), last_(last), inputs_(inputs), outputs_(outputs), param_(param),
+      runtime_(nvinfer1::createInferRuntime(logger())) {
+  CHECK(runtime_ != nullptr) << "Failed to create the TensorRT runtime";
+}
+
+TensorRTSegment::~TensorRTSegment() {
+  Reset();
+  delete runtime_;
+}
+
+void TensorRTSegment::Reset() {
+  for (auto& e : engines_) {
+    delete e.second.context;
+    delete e.second.engine;
+  }
+  engines_.clear();
+}
+
+bool TensorRTSegment::Supported(LayerBase* layer) {
+  const LayerParameter& lp = layer->layer_param();
+  const string& type = lp.type();
+  if (type == "Convolution") {
+    return lp.convolution_param().axis() == 1;
+  }
+  if (type == "InnerProduct") {
+    const InnerProductParameter& ip = lp.inner_product_param();
+    return ip.axis() == 1 && !ip.transpose() &&
+        ip.activation() != InnerProductParameter_Activation_GELU;
+  }
+  if (type == "Pooling") {
+    const PoolingParameter::PoolMethod pool = lp.pooling_param().pool();
+    return pool == PoolingParameter_PoolMethod_MAX || pool == PoolingParameter_PoolMethod_AVE;
+  }
+  if (type == "Eltwise") {
+    for (float coeff : lp.eltwise_param().coeff()) {
+      if (coeff != 1.F) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (type == "BatchNorm") {
+    return lp.batch_norm_param().use_global_stats();
+  }
+  if (type == "Scale" || type == "Bias") {
+    return layer->blobs().size() > 0 && lp.bottom_size() == 1;
+  }
+  if (type == "LRN") {
+    return lp.lrn_param().norm_region() == LRNParameter_NormRegion_ACROSS_CHANNELS;
+  }
+  return type == "ReLU" || type == "Sigmoid" || type == "TanH" || type == "Softmax" ||
+      type == "Concat" || type == "Dropout" || type == "Split" || type == "Flatten" ||
+      type == "Reshape";
+}
+
+bool TensorRTSegment::Forward() {
+  std::ostringstream os;
+  for (Blob* blob : inputs_) {
+    os << Type_Name(blob->data_type()) << " " << blob->shape_string() << ";";
+  }
+  const string shapes = os.str();
+  if (shapes != last_shapes_) {
+    // Tops read after the segment take the new shapes
+    for (int i = first_; i <= last_; ++i) {
+      net_.layers()[i]->Reshape(net_.bottom_vecs()[i], net_.top_vecs()[i]);
+    }
+    last_shapes_ = shapes;
+  }
+  auto it = engines_.find(shapes);
+  if (it == engines_.end()) {
+    Engine engine{nullptr, nullptr};
+    if (!Build(shapes, &engine)) {
+      LOG(WARNING) << "TensorRT: layers " << net_.layer_names()[first_] << " to "
+                   << net_.layer_names()[last_] << " run natively for inputs " << shapes;
+    }
+    it = engines_.emplace(shapes, engine).first;
+  }
+  nvinfer1::IExecutionContext* context = it->second.context;
+  if (context == nullptr) {
+    return false;
+  }
+  for (size_t k = 0; k < inputs_.size(); ++k) {
+    context->setTensorAddress(("in" + std::to_string(k)).c_str(), gpu_data(inputs_[k], false));
+  }
+  for (size_t k = 0; k < outputs_.size(); ++k) {
+    context->setTensorAddress(("out" + std::to_string(k)).c_str(),
+        gpu_data(outputs_[k], true));
+  }
+  CHECK(context->enqueueV3(Caffe::thread_stream())) << "TensorRT: failed to run layers "
+      << net_.layer_names()[first_] << " to " << net_.layer_names()[last_];
+  return true;
+}
+
+bool TensorRTSegment::Build(const string& shapes, Engine* engine) {
+  for (const vector<Blob*>* blobs : {&inputs_, &outputs_}) {
+    for (Blob* blob : *blobs) {
+      if (!supported_type(blob->data_type())) {
+        return false;
+      }
+    }
+  }
+  string cached;
+  if (!param_.cache_dir().empty()) {
+    const string key = Fingerprint() + shapes;
+    std::ostringstream os;
+    os << param_.cache_dir() << "/" << std::hex << std::setw(16) << std::setfill('0')
+       << fnv1a(key.data(), key.size()) << ".engine";
+    cached = os.str();
+  }
+  string plan;
+  if (!cached.empty() && read_file(cached, &plan)) {
+    engine->engine = runtime_->deserializeCudaEngine(plan.data(), plan.size());
+    if (engine->engine != nullptr) {
+      LOG(INFO) << "TensorRT: layers " << net_.layer_names()[first_] << " to "
+                << net_.layer_names()[last_] << " read from " << cached;
+    }
+  }
+  if (engine->engine == nullptr) {
+    Timer timer;
+    timer.Start();
+    unique_ptr<nvinfer1::IBuilder> builder(nvinfer1::createInferBuilder(logger()));
+#if NV_TENSORRT_MAJOR >= 10
+    const uint32_t flags = 0U;  // explicit batch is the only mode
+#else
+    const uint32_t flags =
+        1U << static_cast<uint32_t>(nvinfer1::NetworkDefinitionCreationFlag::kEXPLICIT_BATCH);
+#endif
+    unique_ptr<nvinfer1::INetworkDefinition> network(builder->createNetworkV2(flags));
+    unique_ptr<nvinfer1::IBuilderConfig> config(builder->createBuilderConfig());
+    config->setMemoryPoolLimit(nvinfer1::MemoryPoolType::kWORKSPACE,
+        static_cast<size_t>(param_.workspace_mb()) << 20);
+    if (param_.precision() == TensorRTParameter_Precision_FP32) {
+      // As the native layers do
+      config->clearFlag(nvinfer1::BuilderFlag::kTF32);
+    } else {
+      config->setFlag(nvinfer1::BuilderFlag::kFP16);
+    }
+    if (param_.precision() == TensorRTParameter_Precision_INT8) {
+      config->setFlag(nvinfer1::BuilderFlag::kINT8);
+    }
+    const bool defined = Define(network.get());
+    unique_ptr<nvinfer1::IHostMemory> serialized(defined ?
+        builder->buildSerializedNetwork(*network, *config) : nullptr);
+    weights_.clear();
+    if (serialized == nullptr) {
+      return false;
+    }
+    plan.assign(static_cast<const char*>(serialized->data()), serialized->size());
+    engine->engine = runtime_->deserializeCudaEngine(plan.data(), plan.size());
+    if (engine->engine == nullptr) {
+      return false;
+    }
+    LOG(INFO) << "TensorRT: layers " << net_.layer_names()[first_] << " to "
+              << net_.layer_names()[last_] << " built in " << timer.Seconds() << " s";
+    if (!cached.empty()) {
+      // Renamed into place: other processes may read it meanwhile
+      const string temp = cached + "." + std::to_string(getpid());
+      std::ofstream output(temp, std::ios::out | std::ios::trunc | std::ios::binary);
+      if (!(output.write(plan.data(), plan.size()) && output.flush() &&
+          std::rename(temp.c_str(), cached.c_str()) == 0)) {
+        LOG(WARNING) << "TensorRT: failed to cache the engine in " << param_.cache_dir();
+        std::remove(temp.c_str());
+      }
+    }
+  }
+  engine->context = engine->engine->createExecutionContext();
+  if (engine->context == nullptr) {
+    delete engine->engine;
+    engine->engine = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool TensorRTSegment::Define(nvinfer1::INetworkDefinition* network) {
+  std::map<const Blob*, ITensor*> tensors;
+  for (size_t k = 0; k < inputs_.size(); ++k) {
+    tensors[inputs_[k]] = network->addInput(("in" + std::to_string(k)).c_str(),
+        trt_type(inputs_[k]->data_type()), dims(inputs_[k]->shape()));
+  }
+  for (int i = first_; i <= last_; ++i) {
+    const vector<Blob*>& bottom = net_.bottom_vecs()[i];
+    const vector<Blob*>& top = net_.top_vecs()[i];
+    vector<ITensor*> in, out;
+    for (Blob* blob : bottom) {
+      in.push_back(tensors.at(blob));
+    }
+    if (!AddLayer(network, i, in, &out) || out.size() != top.size()) {
+      LOG(WARNING) << "TensorRT can't express layer " << net_.layer_names()[i];
+      return false;
+    }
+    for (size_t t = 0; t < top.size(); ++t) {
+      if (!same_shape(out[t]->getDimensions(), top[t]->shape())) {
+        LOG(WARNING) << "TensorRT: layer " << net_.layer_names()[i] << " top " << t
+                     << " doesn't have the shape " << top[t]->shape_string();
+        return false;
+      }
+      tensors[top[t]] = out[t];
+    }
+  }
+  for (size_t k = 0; k < outputs_.size(); ++k) {
+    ITensor* tensor = tensors.at(outputs_[k]);
+    if (tensor->isNetworkInput() || tensor->isNetworkOutput()) {
+      tensor = network->addIdentity(*tensor)->getOutput(0);
+    }
+    tensor->setName(("out" + std::to_string(k)).c_str());
+    tensor->setType(trt_type(outputs_[k]->data_type()));
+    network->markOutput(*tensor);
+  }
+  return true;
+}
+
+bool TensorRTSegment::AddLayer(nvinfer1::INetworkDefinition* network, int layer_id,
+    const vector<ITensor*>& in, vector<ITensor*>* out) {
+  LayerBase& layer = *net_.layers()[layer_id];
+  const LayerParameter& lp = layer.layer_param();
+  const string& type = lp.type();
+  const vector<Blob*>& bottom = net_.bottom_vecs()[layer_id];
+  const vector<Blob*>& top = net_.top_vecs()[layer_id];
+  const nvinfer1::Weights none{DataType::kFLOAT, nullptr, 0};
+  nvinfer1::ILayer* added = nullptr;
+  if ((type == "Convolution" || type == "InnerProduct") &&
+      param_.precision() == TensorRTParameter_Precision_INT8 &&
+      lp.has_quantization_param()) {
+    const float range = lp.quantization_param().input_scale() * Int8Gemm::LEVELS;
+    in[0]->setDynamicRange(-range, range);
+  }
+  if (type == "Convolution") {
+    const ConvolutionParameter& cp = lp.convolution_param();
+    const Blob& w = *layer.blobs()[0];
+    if (bottom[0]->num_axes() != 4 || w.num_axes() != 4 ||
+        w.shape(1) * static_cast<int>(cp.group()) != bottom[0]->shape(1)) {
+      return false;
+    }
+    auto conv = network->addConvolutionNd(*in[0], w.shape(0), DimsHW(w.shape(2), w.shape(3)),
+        weights(w), cp.bias_term() ? weights(*layer.blobs()[1]) : none);
+    DimsHW stride = hw(cp.stride(), 1), pad = hw(cp.pad(), 0);
+    if (cp.has_stride_h()) {
+      stride = DimsHW(cp.stride_h(), cp.stride_w());
+    }
+    if (cp.has_pad_h()) {
+      pad = DimsHW(cp.pad_h(), cp.pad_w());
+    }
+    conv->setStrideNd(stride);
+    conv->setPaddingNd(pad);
+    conv->setDilationNd(hw(cp.dilation(), 1));
+    conv->setNbGroups(cp.group());
+    added = conv;
+  } else if (type == "InnerProduct") {
+    // A 1x1 convolution of the flattened input
+    const InnerProductParameter& ip = lp.inner_product_param();
+    const Blob& w = *layer.blobs()[0];
+    const int num = bottom[0]->shape(0), dim = bottom[0]->count(1);
+    if (w.count() != w.shape(0) * dim) {
+      return false;
+    }
+    auto flat = network->addShuffle(*in[0]);
+    flat->setReshapeDimensions(nvinfer1::Dims4(num, dim, 1, 1));
+    auto fc = network->addConvolutionNd(*flat->getOutput(0), w.shape(0), DimsHW(1, 1),
+        weights(w), ip.bias_term() ? weights(*layer.blobs()[1]) : none);
+    ITensor* result = fc->getOutput(0);
+    if (ip.activation() == InnerProductParameter_Activation_RELU) {
+      result = network->addActivation(*result,
+          nvinfer1::ActivationType::kRELU)->getOutput(0);
+    }
+    auto shuffle = network->addShuffle(*result);
+    shuffle->setReshapeDimensions(dims(top[0]->shape()));
+    added = shuffle;
+  } else if (type == "ReLU") {
+    const float slope = lp.relu_param().negative_slope();
+    auto relu = network->addActivation(*in[0], slope == 0.F ?
+        nvinfer1::ActivationType::kRELU : nvinfer1::ActivationType::kLEAKY_RELU);
+    relu->setAlpha(slope);
+    added = relu;
+  } else if (type == "Sigmoid") {
+    added = network->addActivation(*in[0], nvinfer1::ActivationType::kSIGMOID);
+  } else if (type == "TanH") {
+    added = network->addActivation(*in[0], nvinfer1::ActivationType::kTANH);
+  } else if (type == "Pooling") {
+    const PoolingParameter& pp = lp.pooling_param();
+    if (bottom[0]->num_axes() != 4) {
+      return false;
+    }
+    DimsHW kernel(bottom[0]->shape(2), bottom[0]->shape(3)), stride(1, 1), pad(0, 0);
+    if (!pp.global_pooling()) {
+      kernel = pp.has_kernel_h() ? DimsHW(pp.kernel_h(), pp.kernel_w())
+          : DimsHW(pp.kernel_size(), pp.kernel_size());
+      stride = pp.has_stride_h() ? DimsHW(pp.stride_h(), pp.stride_w())
+          : DimsHW(pp.stride(), pp.stride());
+      pad = pp.has_pad_h() ? DimsHW(pp.pad_h(), pp.pad_w()) : DimsHW(pp.pad(), pp.pad());
+    }
+    auto pool = network->addPoolingNd(*in[0], pp.pool() == PoolingParameter_PoolMethod_MAX ?
+        nvinfer1::PoolingType::kMAX : nvinfer1::PoolingType::kAVERAGE, kernel);
+    pool->setStrideNd(stride);
+    pool->setPaddingNd(pad);
+    // Caffe rounds output sizes up, FB pooling down; padding counts in averages
+    pool->setPaddingMode(pp.torch_pooling() ? nvinfer1::PaddingMode::kEXPLICIT_ROUND_DOWN
+        : nvinfer1::PaddingMode::kEXPLICIT_ROUND_UP);
+    pool->setAverageCountExcludesPadding(false);
+    added = pool;
+  } else if (type == "Softmax") {
+    auto softmax = network->addSoftMax(*in[0]);
+    softmax->setAxes(1U << canonical_axis(lp.softmax_param().axis(), bottom[0]->num_axes()));
+    added = softmax;
+  } else if (type == "Eltwise") {
+    const EltwiseParameter::EltwiseOp op = lp.eltwise_param().operation();
+    const nvinfer1::ElementWiseOperation trt_op =
+        op == EltwiseParameter_EltwiseOp_PROD ? nvinfer1::ElementWiseOperation::kPROD :
+        op == EltwiseParameter_EltwiseOp_MAX ? nvinfer1::ElementWiseOperation::kMAX :
+        nvinfer1::ElementWiseOperation::kSUM;
+    ITensor* result = in[0];
+    for (size_t j = 1; j < in.size(); ++j) {
+      added = network->addElementWise(*result, *in[j], trt_op);
+      result = added->getOutput(0);
+    }
+    if (added == nullptr) {
+      added = network->addIdentity(*result);
+    }
+  } else if (type == "Concat") {
+    const ConcatParameter& cp = lp.concat_param();
+    auto concat = network->addConcatenation(in.data(), in.size());
+    concat->setAxis(cp.has_concat_dim() ? static_cast<int>(cp.concat_dim())
+        : canonical_axis(cp.axis(), bottom[0]->num_axes()));
+    added = concat;
+  } else if (type == "BatchNorm") {
+    const BatchNormParameter& bp = lp.batch_norm_param();
+    const vector<shared_ptr<Blob>>& blobs = layer.blobs();
+    const int channels = blobs[0]->count();
+    if (bottom[0]->num_axes() < 2 || bottom[0]->shape(1) != channels) {
+      return false;
+    }
+    TBlob<float> mean, var, gamma, beta;
+    mean.CopyDataFrom(*blobs[0], true);
+    var.CopyDataFrom(*blobs[1], true);
+    const bool scale_bias = blobs.size() >= 5;
+    if (scale_bias) {
+      gamma.CopyDataFrom(*blobs[3], true);
+      beta.CopyDataFrom(*blobs[4], true);
+    }
+    // The layer's eps floor
+    const float eps = std::max<float>(bp.eps(), 0.00001F);
+    vector<float> scale(channels), shift(channels);
+    for (int c = 0; c < channels; ++c) {
+      scale[c] = (scale_bias ? gamma.cpu_data()[c] : 1.F) / std::sqrt(var.cpu_data()[c] + eps);
+      shift[c] = (scale_bias ? beta.cpu_data()[c] : 0.F) - mean.cpu_data()[c] * scale[c];
+    }
+    added = network->addScaleNd(*in[0], nvinfer1::ScaleMode::kCHANNEL,
+        weights(std::move(shift)), weights(std::move(scale)), none, 1);
+    if (bp.fused_relu()) {
+      const float slope = bp.relu_negative_slope();
+      auto relu = network->addActivation(*added->getOutput(0), slope == 0.F ?
+          nvinfer1::ActivationType::kRELU : nvinfer1::ActivationType::kLEAKY_RELU);
+      relu->setAlpha(slope);
+      added = relu;
+    }
+  } else if (type == "Scale" || type == "Bias") {
+    const int axis = canonical_axis(type == "Scale" ? lp.scale_param().axis()
+        : lp.bias_param().axis(), bottom[0]->num_axes());
+    const Blob& first = *layer.blobs()[0];
+    if (axis != 1 || first.count() != bottom[0]->shape(1)) {
+      return false;
+    }
+    const bool bias = type == "Bias" || lp.scale_param().bias_term();
+    const Blob* shift = type == "Bias" ? &first : bias ? layer.blobs()[1].get() : nullptr;
+    added = network->addScaleNd(*in[0], nvinfer1::ScaleMode::kCHANNEL,
+        shift != nullptr ? weights(*shift) : none, type == "Scale" ? weights(first) : none,
+        none, 1);
+  } else if (type == "LRN") {
+    const LRNParameter& lrn = lp.lrn_param();
+    added = network->addLRN(*in[0], lrn.local_size(), lrn.alpha(), lrn.beta(), lrn.k());
+  } else if (type == "Flatten" || type == "Reshape") {
+    auto shuffle = network->addShuffle(*in[0]);
+    shuffle->setReshapeDimensions(dims(top[0]->shape()));
+    added = shuffle;
+  } else if (type == "Dropout" || type == "Split") {
+    // Identities at TEST time
+    out->assign(top.size(), in[0]);
+    return true;
+  }
+  if (added == nullptr) {
+    return false;
+  }
+  added->setName(lp.name().c_str());
+  out->push_back(added->getOutput(0));
+  return true;
+}
+
+nvinfer1::Weights TensorRTSegment::weights(const Blob& blob) {
+  TBlob<float> copy;
+  copy.CopyDataFrom(blob, true);
+  return weights(vector<float>(copy.cpu_data(), copy.cpu_data() + copy.count()));
+}
+
+nvinfer1::Weights TensorRTSegment::weights(vector<float>&& values) {
+  weights_.push_back(std::move(values));
+  return nvinfer1::Weights{DataType::kFLOAT, weights_.back().data(),
+      static_cast<int64_t>(weights_.back().size())};
+}
+
+string TensorRTSegment::Fingerprint() const {
+  cudaDeviceProp props;
+  CUDA_CHECK(cudaGetDeviceProperties(&props, Caffe::current_device()));
+  std::ostringstream os;
+  os << "TensorRT " << nvinfer1::getInferLibVersion() << ";" << props.name << " "
+     << props.major << "." << props.minor << ";" << param_.SerializeAsString() << ";";
+  uint64_t hash = fnv1a(nullptr, 0UL);
+  for (int i = first_; i <= last_; ++i) {
+    LayerBase& layer = *net_.layers()[i];
+    const string lp = layer.layer_param().SerializeAsString();
+    hash = fnv1a(lp.data(), lp.size(), hash);
+    for (const shared_ptr<Blob>& blob : layer.blobs()) {
+      TBlob<float> copy;
+      copy.CopyDataFrom(*blob, true);
+      hash = fnv1a(copy.cpu_data(), copy.count() * sizeof(float), hash);
+    }
+  }
+  os << std::hex << hash << ";";
+  return os.str();
+}
+
+}  // namespace caffe
+
+#endif  // USE_TENSORRT && !CPU_ONLY
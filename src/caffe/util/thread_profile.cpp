@@ -0,0 +1,157 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/util/thread_profile.hpp"
+
+namespace caffe {
+
+static thread_local ThreadProfile* current_profile = nullptr;
+
+// Invariant TSC where available, it is what the kernel's steady clock reads anyway
+static inline uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static double steady_seconds() {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Calibrated against the steady clock over the process lifetime so far
+struct TickClock {
+  TickClock() : ticks0(ticks()), seconds0(steady_seconds()), last_summary(seconds0) {}
+
+  double seconds_per_tick() const {
+    const uint64_t dt = ticks() - ticks0;
+    return dt > 0UL ? (steady_seconds() - seconds0) / dt : 0.;
+  }
+
+  const uint64_t ticks0;
+  const double seconds0;
+  double last_summary;
+};
+
+static std::mutex& registry_mutex() {
+  static std::mutex m;
+  return m;
+}
+
+static std::vector<ThreadProfile*>& registry() {
+  static std::vector<ThreadProfile*> profiles;
+  return profiles;
+}
+
+static TickClock& tick_clock() {
+  static TickClock clock;
+  return clock;
+}
+
+ThreadProfile::ThreadProfile(const std::string& name)
+    : name_(name), state_(IDLE), since_(ticks()) {
+  for (int i = 0; i < STATES; ++i) {
+    ticks_[i].store(0UL);
+    reported_[i] = 0UL;
+  }
+  tick_clock();
+  std::lock_guard<std::mutex> lock(registry_mutex());
+  registry().push_back(this);
+}
+
+ThreadProfile::~ThreadProfile() {
+  if (current_profile == this) {
+    current_profile = nullptr;
+  }
+  std::lock_guard<std::mutex> lock(registry_mutex());
+  std::vector<ThreadProfile*>& profiles = registry();
+  profiles.erase(std::remove(profiles.begin(), profiles.end(), this), profiles.end());
+}
+
+void ThreadProfile::attach() {
+  current_profile = this;
+  enter(IDLE);
+}
+
+ThreadProfile::State ThreadProfile::enter(State state) {
+  const uint64_t now = ticks();
+  const State prev = static_cast<State>(state_.load(std::memory_order_relaxed));
+  ticks_[prev].fetch_add(now - since_.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  since_.store(now, std::memory_order_relaxed);
+  state_.store(state, std::memory_order_relaxed);
+  return prev;
+}
+
+void ThreadProfile::read(uint64_t* t) const {
+  for (int i = 0; i < STATES; ++i) {
+    t[i] = ticks_[i].load(std::memory_order_relaxed);
+  }
+  const int state = state_.load(std::memory_order_relaxed);
+  const uint64_t since = since_.load(std::memory_order_relaxed);
+  const uint64_t now = ticks();
+  if (now > since) {
+    t[state] += now - since;
+  }
+}
+
+ThreadProfile* ThreadProfile::current() {
+  return current_profile;
+}
+
+const char* ThreadProfile::state_name(State state) {
+  static const char* names[STATES] = {"idle", "read", "parse", "decode", "transform",
+      "reduce", "update", "blocked"};
+  return names[state];
+}
+
+std::string ThreadProfile::Summary() {
+  std::lock_guard<std::mutex> lock(registry_mutex());
+  TickClock& clock = tick_clock();
+  const double seconds_per_tick = clock.seconds_per_tick();
+  const double now = steady_seconds();
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(1);
+  os << "Thread profile over " << now - clock.last_summary << " s:";
+  clock.last_summary = now;
+  double totals[STATES] = {};
+  for (ThreadProfile* profile : registry()) {
+    uint64_t t[STATES];
+    profile->read(t);
+    double delta[STATES], sum = 0.;
+    for (int i = 0; i < STATES; ++i) {
+      // A read racing with a switch may count an interval twice, reported_ only grows
+      delta[i] = t[i] > profile->reported_[i] ?
+          (t[i] - profile->reported_[i]) * seconds_per_tick : 0.;
+      profile->reported_[i] = std::max(t[i], profile->reported_[i]);
+      totals[i] += delta[i];
+      sum += delta[i];
+    }
+    os << "\n  " << profile->name_ << ":";
+    for (int i = 0; i < STATES; ++i) {
+      if (delta[i] > 0.) {
+        os << " " << state_name(static_cast<State>(i)) << " "
+           << (sum > 0. ? 100. * delta[i] / sum : 0.) << "%";
+      }
+    }
+  }
+  os << "\n  total thread seconds:" << std::setprecision(3);
+  for (int i = 0; i < STATES; ++i) {
+    os << " " << state_name(static_cast<State>(i)) << " " << totals[i];
+  }
+  return os.str();
+}
+
+}  // namespace caffe
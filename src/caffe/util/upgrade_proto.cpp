@@ -8,6 +8,7 @@
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
+#include "caffe/util/proto_cache.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
@@ -76,9 +77,9 @@ bool UpgradeNetAsNeeded(const string& param_file, NetParameter* param) {
 
 void ReadNetParamsFromTextFileOrDie(const string& param_file,
                                     NetParameter* param) {
-  CHECK(ReadProtoFromTextFile(param_file, param))
-      << "Failed to parse NetParameter file: " << param_file;
-  UpgradeNetAsNeeded(param_file, param);
+  CHECK(ProtoCache::ReadTextFile(param_file, param, [&param_file](Message* proto) {
+    UpgradeNetAsNeeded(param_file, static_cast<NetParameter*>(proto));
+  })) << "Failed to parse NetParameter file: " << param_file;
 }
 
 void ReadNetParamsFromBinaryFileOrDie(const string& param_file,
@@ -1060,9 +1061,9 @@ bool UpgradeSolverAsNeeded(const string& param_file, SolverParameter* param) {
 // Read parameters from a file into a SolverParameter proto message.
 SolverParameter ReadSolverParamsFromTextFileOrDie(const string& param_file) {
   SolverParameter param;
-  CHECK(ReadProtoFromTextFile(param_file, &param))
-      << "Failed to parse SolverParameter file: " << param_file;
-  UpgradeSolverAsNeeded(param_file, &param);
+  CHECK(ProtoCache::ReadTextFile(param_file, &param, [&param_file](Message* proto) {
+    UpgradeSolverAsNeeded(param_file, static_cast<SolverParameter*>(proto));
+  })) << "Failed to parse SolverParameter file: " << param_file;
   return param;
 }
 
@@ -0,0 +1,287 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/util/sparse_2_4.hpp"
+#include "caffe/util/weight_file.hpp"
+
+namespace caffe {
+
+constexpr uint64_t WeightFile::MAGIC;
+constexpr uint32_t WeightFile::VERSION;
+constexpr int WeightFile::ALIGNMENT_POWER;
+
+namespace {
+
+template<typename T>
+bool is_sparse_2_4(int count, const void* data) {
+  const T* w = static_cast<const T*>(data);
+  for (int i = 0; i < count; i += 4) {
+    const int nonzero = (w[i] != T(0)) + (w[i + 1] != T(0)) + (w[i + 2] != T(0)) +
+        (w[i + 3] != T(0));
+    if (nonzero > 2) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool is_sparse_2_4(Type type, const vector<int>& shape, int count, const void* data) {
+  if (count == 0 || !sparse_2_4_shape(shape)) {
+    return false;
+  }
+  switch (type) {
+    case FLOAT16:
+      return is_sparse_2_4<float16>(count, data);
+    case FLOAT:
+      return is_sparse_2_4<float>(count, data);
+    case DOUBLE:
+      return is_sparse_2_4<double>(count, data);
+    default:
+      return false;
+  }
+}
+
+// Groups with less than 2 non-zero values keep zeros, see WeightIndex::Tensor::sparse_2_4
+template<typename T>
+void compress_2_4(int count, const void* data, vector<char>* out) {
+  const T* w = static_cast<const T*>(data);
+  out->assign(WeightFile::StoredBytes(count, tp<T>(), true), 0);
+  T* values = reinterpret_cast<T*>(out->data());
+  unsigned char* positions = reinterpret_cast<unsigned char*>(values + count / 2);
+  for (int g = 0; g < count / 4; ++g) {
+    int kept[2] = {-1, -1};
+    int n = 0;
+    for (int j = 0; j < 4 && n < 2; ++j) {
+      if (w[4 * g + j] != T(0)) {
+        kept[n++] = j;
+      }
+    }
+    // Padded with positions of zeros
+    for (int j = 0; j < 4 && n < 2; ++j) {
+      if (j != kept[0]) {
+        kept[n++] = j;
+      }
+    }
+    values[2 * g] = w[4 * g + kept[0]];
+    values[2 * g + 1] = w[4 * g + kept[1]];
+    positions[g] = static_cast<unsigned char>(kept[0] | (kept[1] << 2));
+  }
+}
+
+void compress_2_4(Type type, int count, const void* data, vector<char>* out) {
+  switch (type) {
+    case FLOAT16:
+      compress_2_4<float16>(count, data, out);
+      break;
+    case FLOAT:
+      compress_2_4<float>(count, data, out);
+      break;
+    default:
+      compress_2_4<double>(count, data, out);
+      break;
+  }
+}
+
+}  // namespace
+
+WeightFileWriter::WeightFileWriter(const string& filename, bool checksums)
+    : filename_(filename), checksums_(checksums),
+      out_(filename, std::ios::binary | std::ios::trunc), offset_(0UL) {
+  CHECK(out_.is_open()) << "Failed to open " << filename_ << " for writing";
+  // The header is written by Close once the index is known
+  WeightFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  offset_ = sizeof(header);
+  Pad();
+}
+
+WeightFileWriter::~WeightFileWriter() {
+  if (out_.is_open()) {
+    Close();
+  }
+}
+
+void WeightFileWriter::Pad() {
+  const uint64_t aligned = align_up<WeightFile::ALIGNMENT_POWER>(offset_);
+  const vector<char> zeros(aligned - offset_, 0);
+  out_.write(zeros.data(), zeros.size());
+  offset_ = aligned;
+}
+
+void WeightFileWriter::Add(const string& layer, int blob_id, const Blob& blob) {
+  const Type type = blob.data_type();
+  const void* data = blob.count() > 0 ? blob.current_data_memory(false) : nullptr;
+  // Pruned weights only take about half of their bytes
+  vector<char> compressed;
+  const bool sparse = is_sparse_2_4(type, blob.shape(), blob.count(), data);
+  if (sparse) {
+    compress_2_4(type, blob.count(), data, &compressed);
+    data = compressed.data();
+  }
+  const uint64_t bytes = WeightFile::StoredBytes(blob.count(), type, sparse);
+  WeightIndex::Tensor* tensor = index_.add_tensor();
+  tensor->set_layer(layer);
+  tensor->set_blob_id(blob_id);
+  for (int dim : blob.shape()) {
+    tensor->mutable_shape()->add_dim(dim);
+  }
+  tensor->set_type(type);
+  tensor->set_offset(offset_);
+  tensor->set_bytes(bytes);
+  if (sparse) {
+    tensor->set_sparse_2_4(true);
+  }
+  if (blob.count() > 0) {
+    if (checksums_) {
+      tensor->set_crc32(WeightFile::Checksum(data, bytes));
+    }
+    out_.write(static_cast<const char*>(data), bytes);
+  } else if (checksums_) {
+    tensor->set_crc32(0U);
+  }
+  offset_ += bytes;
+  Pad();
+}
+
+void WeightFileWriter::Close() {
+  string index;
+  CHECK(index_.SerializeToString(&index)) << "Failed to serialize the index of " << filename_;
+  out_.write(index.data(), index.size());
+  WeightFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = WeightFile::MAGIC;
+  header.version = WeightFile::VERSION;
+  header.index_offset = offset_;
+  header.index_bytes = index.size();
+  out_.seekp(0);
+  out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out_.close();
+  CHECK(!out_.fail()) << "Failed to write " << filename_;
+}
+
+WeightFile::WeightFile(const string& filename)
+    : filename_(filename), mapped_(nullptr), size_(0UL) {
+  const int fd = open(filename_.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Failed to open " << filename_ << ": " << std::strerror(errno);
+  struct stat st;
+  CHECK_EQ(fstat(fd, &st), 0) << "Failed to stat " << filename_ << ": " << std::strerror(errno);
+  size_ = st.st_size;
+  CHECK_GE(size_, sizeof(WeightFileHeader)) << filename_ << " is too short";
+  void* ptr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);  // the mapping stays
+  CHECK(ptr != MAP_FAILED) << "Failed to map " << filename_ << ": " << std::strerror(errno);
+  mapped_ = static_cast<const char*>(ptr);
+  // Tensors are read once from start to end, possibly by several threads at a time
+  madvise(ptr, size_, MADV_WILLNEED);
+  WeightFileHeader header;
+  std::memcpy(&header, mapped_, sizeof(header));
+  CHECK_EQ(header.magic, MAGIC) << filename_ << " is not a weight file";
+  CHECK_EQ(header.version, VERSION) << "Unsupported version of weight file " << filename_;
+  CHECK_LE(header.index_offset + header.index_bytes, size_) << filename_ << " is truncated";
+  CHECK(index_.ParseFromArray(mapped_ + header.index_offset, header.index_bytes))
+      << "Failed to parse the index of " << filename_;
+  for (const WeightIndex::Tensor& tensor : index_.tensor()) {
+    CHECK_LE(tensor.offset() + tensor.bytes(), header.index_offset)
+        << filename_ << ": tensor of layer " << tensor.layer() << " is out of range";
+  }
+}
+
+WeightFile::~WeightFile() {
+  if (mapped_ != nullptr) {
+    munmap(const_cast<char*>(mapped_), size_);
+  }
+}
+
+bool WeightFile::Verify(const WeightIndex::Tensor& tensor) const {
+  return !tensor.has_crc32() || Checksum(data(tensor), tensor.bytes()) == tensor.crc32();
+}
+
+void WeightFile::Read(const WeightIndex::Tensor& tensor, void* dst) const {
+  const char* src = static_cast<const char*>(data(tensor));
+  if (!tensor.sparse_2_4()) {
+    std::memcpy(dst, src, tensor.bytes());
+    return;
+  }
+  uint64_t count = 1UL;
+  for (int i = 0; i < tensor.shape().dim_size(); ++i) {
+    count *= tensor.shape().dim(i);
+  }
+  CHECK_EQ(tensor.bytes(), StoredBytes(count, tensor.type(), true))
+      << filename_ << ": corrupted sparse tensor of layer " << tensor.layer();
+  const size_t size = tsize(tensor.type());
+  const unsigned char* positions =
+      reinterpret_cast<const unsigned char*>(src + count / 2UL * size);
+  char* w = static_cast<char*>(dst);
+  std::memset(w, 0, count * size);
+  for (uint64_t g = 0UL; g < count / 4UL; ++g) {
+    std::memcpy(w + (4UL * g + (positions[g] & 3U)) * size, src + 2UL * g * size, size);
+    std::memcpy(w + (4UL * g + (positions[g] >> 2 & 3U)) * size, src + (2UL * g + 1UL) * size,
+        size);
+  }
+}
+
+uint64_t WeightFile::StoredBytes(uint64_t count, Type type, bool sparse_2_4) {
+  return sparse_2_4 ? count / 2UL * tsize(type) + count / 4UL : count * tsize(type);
+}
+
+namespace {
+
+// Slicing by 8: table k gives the CRC of a byte followed by k zero bytes
+struct Crc32Tables {
+  uint32_t t[8][256];
+
+  Crc32Tables() {
+    for (uint32_t i = 0U; i < 256U; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1U) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+      }
+      t[0][i] = c;
+    }
+    for (uint32_t i = 0U; i < 256U; ++i) {
+      for (int k = 1; k < 8; ++k) {
+        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFFU];
+      }
+    }
+  }
+};
+
+}  // namespace
+
+uint32_t WeightFile::Checksum(const void* data, size_t bytes, uint32_t crc) {
+  static const Crc32Tables tables;
+  const uint32_t (&t)[8][256] = tables.t;
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  crc = ~crc;
+  // Little endian words
+  for (; bytes >= 8UL; bytes -= 8UL, p += 8) {
+    uint32_t lo, hi;
+    std::memcpy(&lo, p, 4);
+    std::memcpy(&hi, p + 4, 4);
+    lo ^= crc;
+    crc = t[7][lo & 0xFFU] ^ t[6][(lo >> 8) & 0xFFU] ^ t[5][(lo >> 16) & 0xFFU] ^
+        t[4][lo >> 24] ^ t[3][hi & 0xFFU] ^ t[2][(hi >> 8) & 0xFFU] ^
+        t[1][(hi >> 16) & 0xFFU] ^ t[0][hi >> 24];
+  }
+  for (; bytes > 0UL; --bytes, ++p) {
+    crc = t[0][(crc ^ *p) & 0xFFU] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+bool WeightFile::Is(const string& filename) {
+  std::ifstream in(filename, std::ios::binary);
+  uint64_t magic = 0UL;
+  in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+  return in.good() && magic == MAGIC;
+}
+
+}  // namespace caffe
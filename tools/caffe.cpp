@@ -5,10 +5,26 @@ namespace bp = boost::python;
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <csignal>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <limits>
 #include <map>
+#include <set>
+#include <thread>
 #include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
 
 #include "caffe/caffe.hpp"
+#include "caffe/data_service.hpp"
+#include "caffe/util/cpu_parallel.hpp"
+#include "caffe/util/gpu_topology.hpp"
+#include "caffe/util/ipc_weights.hpp"
+#include "caffe/util/layer_cost.hpp"
 #include "caffe/util/signal_handler.h"
 
 
@@ -42,6 +58,69 @@ DEFINE_int32(iterations, 50,
 DEFINE_string(sigint_effect, "stop",
              "Optional; action to take when a SIGINT signal is received: "
               "snapshot, stop or none.");
+DEFINE_int32(nodes, 1,
+    "Optional; number of nodes (processes) training together, each one on its own GPUs.");
+DEFINE_int32(node_rank, 0,
+    "Optional; rank of this node in multi-node training, 0 to nodes-1.");
+DEFINE_string(master, "",
+    "Optional; host:port of node 0 for multi-node rendezvous.");
+DEFINE_bool(gpu_ring_order, true,
+    "Optional; train on more than two GPUs in the order forming the best ring "
+    "(NVLink, PCIe switches, CPU sockets) rather than the one given by --gpu.");
+DEFINE_int32(elastic_restarts, 0,
+    "Optional; train in a child process, restart it up to this many times after "
+    "it fails: on the GPUs of --gpu still healthy, from the latest snapshot.");
+DEFINE_string(calibration_method, "kl",
+    "Optional; calibrate: how INT8 saturation thresholds are chosen, kl or percentile.");
+DEFINE_double(calibration_percentile, 0.9999,
+    "Optional; calibrate: fraction of inputs kept unsaturated by the percentile method.");
+DEFINE_string(calibration_table, "",
+    "Optional; calibrate: table to write, <weights>.int8 by default.");
+DEFINE_string(layer_profile, "",
+    "Optional; time: LayerProfile to write the mean layer times to, "
+    "see NetParameter::pipeline_profile.");
+DEFINE_string(time_output, "",
+    "Optional; time: file to write per layer times, FLOPs, bytes, achieved TFLOPS and "
+    "GB/s, roofline efficiency, activation and workspace memory to, as CSV when it ends "
+    "with .csv, JSON otherwise.");
+DEFINE_string(time_types, "",
+    "Optional; time: default forward, backward, forward math and backward math types "
+    "of the net, e.g. FLOAT16,FLOAT16,FLOAT,FLOAT. Types set by layers are kept.");
+DEFINE_double(peak_tflops, 0.,
+    "Optional; time: peak TFLOPS of the device in the math types used. With "
+    "--peak_gbps, layers are also reported against the roofline.");
+DEFINE_double(peak_gbps, 0.,
+    "Optional; time: peak memory bandwidth of the device in GB/s, see --peak_tflops.");
+DEFINE_bool(time_reduce, false,
+    "Optional; time: with several GPUs in --gpu, also time data parallel training "
+    "including ReduceAndUpdate on all of them.");
+DEFINE_int32(datapipe_ranks, 1,
+    "Optional; datapipe: ranks simulated, each one reading its share of the data "
+    "with its own copies of the data layers.");
+DEFINE_string(plan_output, "",
+    "Optional; plan: net to write with the batch size found, <model>.plan.prototxt "
+    "by default.");
+DEFINE_double(plan_memory_fraction, 0.85,
+    "Optional; plan: fraction of the GPU memory activations, weights and solver "
+    "state may take, the rest is left to cuDNN workspaces.");
+DEFINE_int32(plan_probe, 0,
+    "Internal; plan: batch size a child process measures.");
+DEFINE_string(plan_probe_output, "",
+    "Internal; plan: file the child process writes its measurements to.");
+DEFINE_int32(cpu_threads, 0,
+    "Optional; threads running the loops of CPU layers, CAFFE_CPU_THREADS or "
+    "the number of cores by default.");
+DEFINE_string(ipc_handle, "",
+    "Optional; the share_weights handle file, the weights' one with "
+    "the .cudaipc suffix by default.");
+DEFINE_string(test_types, "",
+    "Optional; test: forward type and forward math type of the net scored, "
+    "e.g. FLOAT16,FLOAT16 for fp16 inference.");
+DEFINE_bool(no_diff, false,
+    "Optional; test: give weights' diffs back after loading them and fail if "
+    "any layer allocates a diff while scoring.");
+DEFINE_int32(data_service_port, 0,
+    "Optional; dataserve: port RemoteData layers connect to.");
 DEFINE_string(sighup_effect, "snapshot",
              "Optional; action to take when a SIGHUP signal is received: "
              "snapshot, stop or none.");
@@ -174,6 +253,10 @@ int train() {
   vector<int> gpus;
   get_gpus(&gpus);
 #ifndef CPU_ONLY
+  if (FLAGS_gpu_ring_order && gpus.size() > 2) {
+    // The first one stays first: it's the root solver's
+    gpus = caffe::order_gpu_ring(gpus);
+  }
   caffe::GPUMemory::Scope gpu_memory_scope(gpus);
 #endif
   // Set mode and device id[s]
@@ -205,6 +288,13 @@ int train() {
     Caffe::set_gpus(gpus);
     Caffe::set_solver_count(gpus.size());
     CHECK_EQ(gpus.size(), Caffe::solver_count());
+    if (FLAGS_nodes > 1) {
+      // Global solver ranks should be known before nets (and data readers) get created
+      Caffe::set_nodes(FLAGS_nodes, FLAGS_node_rank, gpus.size());
+      Caffe::set_solver_count(FLAGS_nodes * gpus.size());
+      LOG(INFO) << "Node " << FLAGS_node_rank << " of " << FLAGS_nodes << ", "
+                << Caffe::solver_count() << " solvers in total";
+    }
   }
 
   caffe::SignalHandler signal_handler(
@@ -221,8 +311,8 @@ int train() {
     CopyLayers(solver.get(), FLAGS_weights);
   }
 
-  if (gpus.size() > 1) {
-    caffe::P2PManager p2p_mgr(solver, gpus.size(), solver->param());
+  if (Caffe::solver_count() > 1) {
+    caffe::P2PManager p2p_mgr(solver, gpus.size(), solver->param(), FLAGS_master);
     p2p_mgr.Run(gpus);
   } else {
     LOG(INFO) << "Starting Optimization";
@@ -241,8 +331,186 @@ int train() {
 }
 RegisterBrewFunction(train);
 
+// Runs this tool again with the arguments given, returns its exit status
+static int run_child(const vector<string>& args) {
+  vector<char*> argv;
+  for (const string& arg : args) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+  const pid_t pid = fork();
+  CHECK_GE(pid, 0) << "fork failed";
+  if (pid == 0) {
+    execv("/proc/self/exe", argv.data());
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+  int status = 0;
+  CHECK_EQ(pid, waitpid(pid, &status, 0));
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Solver state of the highest iteration saved under the snapshot prefix, empty if none
+static string latest_snapshot(const caffe::SolverParameter& param) {
+  namespace fs = boost::filesystem;
+  const fs::path prefix(param.snapshot_prefix());
+  const fs::path dir = prefix.has_parent_path() ? prefix.parent_path() : fs::path(".");
+  const string start = prefix.filename().string() + "_iter_";
+  string latest;
+  long latest_iter = -1L;  // NOLINT(runtime/int)
+  boost::system::error_code ec;
+  for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+    const string name = it->path().filename().string();
+    if (name.compare(0, start.size(), start) != 0) {
+      continue;
+    }
+    size_t pos = start.size();
+    while (pos < name.size() && isdigit(name[pos])) {
+      ++pos;
+    }
+    const string ext = name.substr(pos);
+    if (pos == start.size() || (ext != ".solverstate" && ext != ".solverstate.h5")) {
+      continue;
+    }
+    const long iter = std::stol(name.substr(start.size(), pos - start.size()));  // NOLINT
+    if (iter > latest_iter) {
+      latest_iter = iter;
+      latest = it->path().string();
+    }
+  }
+  return latest;
+}
+
+// The supervising process never initializes CUDA: GPUs are probed and trained on
+// by children, so that a faulted device only takes a child down.
+static int elastic_train(const vector<string>& args) {
+  CHECK_GT(FLAGS_solver.size(), 0) << "Need a solver definition to train.";
+  CHECK_EQ(FLAGS_nodes, 1) << "elastic_restarts is supported on a single node only";
+  CHECK(FLAGS_gpu.size() && FLAGS_gpu != "all")
+      << "elastic_restarts needs the GPUs listed by --gpu";
+  const caffe::SolverParameter solver_param =
+      caffe::ReadSolverParamsFromTextFileOrDie(FLAGS_solver);
+  vector<string> gpus;
+  boost::split(gpus, FLAGS_gpu, boost::is_any_of(", "));
+  string snapshot = FLAGS_snapshot;
+  for (int restart = 0; ; ++restart) {
+    // Recovered GPUs join again on restart
+    vector<string> healthy;
+    for (const string& gpu : gpus) {
+      if (run_child({args[0], "device_query", "--gpu=" + gpu}) == 0) {
+        healthy.push_back(gpu);
+      } else {
+        LOG(WARNING) << "GPU " << gpu << " failed the probe, leaving it out";
+      }
+    }
+    CHECK(!healthy.empty()) << "No healthy GPU left";
+    vector<string> child(args);
+    child.push_back("--gpu=" + boost::join(healthy, ","));
+    child.push_back("--elastic_restarts=0");
+    if (!snapshot.empty()) {
+      child.push_back("--snapshot=" + snapshot);
+      child.push_back("--weights=");
+    }
+    const int status = run_child(child);
+    if (status == 0) {
+      return 0;
+    }
+    if (restart >= FLAGS_elastic_restarts) {
+      LOG(ERROR) << "Training failed with status " << status << ", no restarts left";
+      return status;
+    }
+    const string latest = latest_snapshot(solver_param);
+    if (!latest.empty()) {
+      snapshot = latest;
+    }
+    LOG(WARNING) << "Training failed with status " << status << ", restart " << (restart + 1)
+                 << " of " << FLAGS_elastic_restarts
+                 << (snapshot.empty() ? string(" from scratch") : " from " + snapshot);
+  }
+}
+
+
+// Scores of one test rank, see TestRank
+struct TestRankResult {
+  float loss = 0.F;
+  vector<float> scores;
+  vector<int> output_ids;
+  // Of every output blob
+  vector<string> output_names;
+  vector<float> loss_weights;
+};
+
+// --no_diff: weights' diffs are given back after loading, scoring must not take any
+static void CheckNoDiff(const Net& net) {
+  vector<string> offenders;
+  for (int i = 0; i < net.blobs().size(); ++i) {
+    if (!net.blobs()[i]->is_diff_empty()) {
+      offenders.push_back(net.blob_names()[i]);
+    }
+  }
+  for (int i = 0; i < net.layers().size(); ++i) {
+    for (const shared_ptr<Blob>& blob : net.layers()[i]->blobs()) {
+      if (!blob->is_diff_empty()) {
+        offenders.push_back(net.layer_names()[i] + " weights");
+        break;
+      }
+    }
+  }
+  CHECK(offenders.empty()) << "--no_diff: diffs allocated while scoring: "
+      << boost::algorithm::join(offenders, ", ");
+}
 
-// Test: score a model.
+// Rank of a data parallel test: own copy of the net on its own device, reading
+// its share of the data through the rank aware DataReader
+static void TestRank(const caffe::NetParameter& net_param, int rank, int ranks, int device,
+    int iterations, TestRankResult* result) {
+  Caffe::set_solver_count(ranks);
+  Caffe::set_root_solver(rank == 0);
+  if (device >= 0) {
+    Caffe::SetDevice(device);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    Caffe::set_mode(Caffe::CPU);
+  }
+  Net caffe_net(net_param, rank);
+  caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+  if (FLAGS_no_diff) {
+    for (const shared_ptr<LayerBase>& layer : caffe_net.layers()) {
+      for (const shared_ptr<Blob>& blob : layer->blobs()) {
+        blob->release_diff();
+      }
+    }
+  }
+  for (int index : caffe_net.output_blob_indices()) {
+    result->output_names.push_back(caffe_net.blob_names()[index]);
+    result->loss_weights.push_back(caffe_net.blob_loss_weights()[index]);
+  }
+  for (int i = 0; i < iterations; ++i) {
+    float iter_loss;
+    const vector<Blob*>& output = caffe_net.Forward(&iter_loss);
+    result->loss += iter_loss;
+    int idx = 0;
+    for (int j = 0; j < output.size(); ++j) {
+      const float* output_vec = output[j]->cpu_data<float>();
+      for (int k = 0; k < output[j]->count(); ++k, ++idx) {
+        const float score = output_vec[k];
+        if (i == 0) {
+          result->scores.push_back(score);
+          result->output_ids.push_back(j);
+        } else {
+          result->scores[idx] += score;
+        }
+        LOG(INFO) << "Batch " << i * ranks + rank << ", " << result->output_names[j]
+                  << " = " << score;
+      }
+    }
+  }
+  if (FLAGS_no_diff) {
+    CheckNoDiff(caffe_net);
+  }
+}
+
+// Test: score a model, data parallel on all the GPUs of --gpu.
 int test() {
   CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to score.";
   CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to score.";
@@ -250,11 +518,6 @@ int test() {
   // Read flags for list of GPUs
   vector<int> gpus;
   get_gpus(&gpus);
-  while (gpus.size() > 1) {
-    // Only use one GPU
-    LOG(INFO) << "Not using GPU #" << gpus.back() << " for single-GPU function";
-    gpus.pop_back();
-  }
 #ifndef CPU_ONLY
   if (gpus.size() > 0) {
     Caffe::SetDevice(gpus[0]);
@@ -264,11 +527,12 @@ int test() {
 
   // Set mode and device id
   if (gpus.size() != 0) {
-    LOG(INFO) << "Use GPU with device ID " << gpus[0];
 #ifndef CPU_ONLY
-    cudaDeviceProp device_prop;
-    cudaGetDeviceProperties(&device_prop, gpus[0]);
-    LOG(INFO) << "GPU device name: " << device_prop.name;
+    for (int gpu : gpus) {
+      cudaDeviceProp device_prop;
+      cudaGetDeviceProperties(&device_prop, gpu);
+      LOG(INFO) << "Use GPU with device ID " << gpu << ": " << device_prop.name;
+    }
 #endif
     Caffe::set_mode(Caffe::GPU);
   } else {
@@ -276,43 +540,56 @@ int test() {
     Caffe::set_mode(Caffe::CPU);
   }
 
-  // Instantiate the caffe net.
-  Net caffe_net(FLAGS_model, caffe::TEST, 0U);
-  caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
-  LOG(INFO) << "Running for " << FLAGS_iterations << " iterations.";
+  caffe::NetParameter net_param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &net_param);
+  net_param.mutable_state()->set_phase(caffe::TEST);
+  if (!FLAGS_test_types.empty()) {
+    vector<string> names;
+    boost::split(names, FLAGS_test_types, boost::is_any_of(", "), boost::token_compress_on);
+    CHECK_EQ(names.size(), 2) << "--test_types needs 2 types, e.g. FLOAT16,FLOAT16";
+    caffe::Type types[2];
+    for (int i = 0; i < 2; ++i) {
+      CHECK(caffe::Type_Parse(boost::to_upper_copy(names[i]), &types[i]))
+          << "Unknown type " << names[i];
+    }
+    net_param.set_default_forward_type(types[0]);
+    net_param.set_default_forward_math(types[1]);
+  }
 
-  vector<int> test_score_output_id;
-  vector<float> test_score;
-  float loss = 0;
-  for (int i = 0; i < FLAGS_iterations; ++i) {
-    float iter_loss;
-    const vector<Blob*>& result =
-        caffe_net.Forward(&iter_loss);
-    loss += iter_loss;
-    int idx = 0;
-    for (int j = 0; j < result.size(); ++j) {
-      const float* result_vec = result[j]->cpu_data<float>();
-      for (int k = 0; k < result[j]->count(); ++k, ++idx) {
-        const float score = result_vec[k];
-        if (i == 0) {
-          test_score.push_back(score);
-          test_score_output_id.push_back(j);
-        } else {
-          test_score[idx] += score;
-        }
-        const std::string& output_name = caffe_net.blob_names()[
-            caffe_net.output_blob_indices()[j]];
-        LOG(INFO) << "Batch " << i << ", " << output_name << " = " << score;
-      }
+  // --iterations batches in all, every GPU scoring its share of them
+  const int ranks = std::max<int>(gpus.size(), 1);
+  LOG(INFO) << "Running for " << FLAGS_iterations << " iterations"
+            << (ranks > 1 ? " on " + std::to_string(ranks) + " GPUs" : string()) << ".";
+  vector<TestRankResult> results(ranks);
+  if (ranks == 1) {
+    TestRank(net_param, 0, 1, gpus.empty() ? -1 : gpus[0], FLAGS_iterations, &results[0]);
+  } else {
+    vector<std::thread> threads;
+    for (int r = 0; r < ranks; ++r) {
+      const int iterations = FLAGS_iterations / ranks + (r < FLAGS_iterations % ranks ? 1 : 0);
+      threads.emplace_back(TestRank, std::cref(net_param), r, ranks, gpus[r], iterations,
+          &results[r]);
+    }
+    for (std::thread& t : threads) {
+      t.join();
     }
   }
-  loss /= FLAGS_iterations;
+
+  // Ranks' sums add up to those of one GPU scoring all the batches
+  TestRankResult& total = results[0];
+  for (int r = 1; r < ranks; ++r) {
+    total.loss += results[r].loss;
+    for (size_t i = 0; i < std::min(total.scores.size(), results[r].scores.size()); ++i) {
+      total.scores[i] += results[r].scores[i];
+    }
+  }
+  const vector<float>& test_score = total.scores;
+  const vector<int>& test_score_output_id = total.output_ids;
+  const float loss = total.loss / FLAGS_iterations;
   LOG(INFO) << "Loss: " << loss;
   for (int i = 0; i < test_score.size(); ++i) {
-    const std::string& output_name = caffe_net.blob_names()[
-        caffe_net.output_blob_indices()[test_score_output_id[i]]];
-    const float loss_weight = caffe_net.blob_loss_weights()[
-        caffe_net.output_blob_indices()[test_score_output_id[i]]];
+    const std::string& output_name = total.output_names[test_score_output_id[i]];
+    const float loss_weight = total.loss_weights[test_score_output_id[i]];
     std::ostringstream loss_msg_stream;
     const float mean_score = test_score[i] / FLAGS_iterations;
     if (loss_weight) {
@@ -325,22 +602,303 @@ int test() {
 }
 RegisterBrewFunction(test);
 
+// Calibrate: find the input scales for INT8 inference of a model.
+int calibrate() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to calibrate.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to calibrate.";
+  vector<int> gpus;
+  get_gpus(&gpus);
+#ifndef CPU_ONLY
+  if (gpus.size() > 0) {
+    Caffe::SetDevice(gpus[0]);
+  }
+  gpus.resize(std::min<size_t>(gpus.size(), 1UL));
+  caffe::GPUMemory::Scope gpu_memory_scope(gpus);
+#endif
+  if (gpus.size() != 0) {
+    LOG(INFO) << "Use GPU with device ID " << gpus[0];
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  Net caffe_net(FLAGS_model, caffe::TEST, 0U);
+  caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+  caffe::Int8Calibrator calibrator(&caffe_net, FLAGS_calibration_method,
+      FLAGS_calibration_percentile);
+  calibrator.Calibrate(FLAGS_iterations);
+  const string table = FLAGS_calibration_table.empty() ?
+      FLAGS_weights + ".int8" : FLAGS_calibration_table;
+  caffe::WriteProtoToTextFile(calibrator.table(), table);
+  LOG(INFO) << "Calibration table written to " << table
+            << ", set it as int8_calibration of the deployed net";
+  return 0;
+}
+RegisterBrewFunction(calibrate);
+
+// Share weights: holds a model's weights on a GPU for serving processes to attach
+// through CUDA IPC (their weights being the handle file) till SIGINT or SIGTERM.
+int share_weights() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to share weights of.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to share.";
+#ifndef CPU_ONLY
+  vector<int> gpus;
+  get_gpus(&gpus);
+  CHECK_EQ(gpus.size(), 1UL) << "Weights are shared on one GPU";
+  Caffe::SetDevice(gpus[0]);
+  caffe::GPUMemory::Scope gpu_memory_scope(gpus);
+  Caffe::set_mode(Caffe::GPU);
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  // Before any thread starts, they inherit it
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  const string handle = FLAGS_ipc_handle.empty() ?
+      FLAGS_weights + caffe::IpcWeights::SUFFIX : FLAGS_ipc_handle;
+  shared_ptr<caffe::IpcWeights> weights;
+  {
+    Net caffe_net(FLAGS_model, caffe::TEST, 0U);
+    caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+    weights = caffe_net.ToIpcWeights(handle);
+  }
+  LOG(INFO) << "Sharing weights of " << FLAGS_model << " through " << handle;
+  int signal = 0;
+  sigwait(&signals, &signal);
+  unlink(handle.c_str());
+  LOG(INFO) << "Stopped sharing weights on signal " << signal;
+#else
+  NO_GPU;
+#endif
+  return 0;
+}
+RegisterBrewFunction(share_weights);
+
+// Per layer times of forward or backward passes. On the GPU events are recorded on the
+// thread stream between layers, nothing waits for the device until a pass is read.
+class LayerTimeline {
+ public:
+  explicit LayerTimeline(int layers) : host_us_(layers + 1, 0.) {
+#ifndef CPU_ONLY
+    if (Caffe::mode() == Caffe::GPU) {
+      events_.resize(layers + 1);
+      for (cudaEvent_t& event : events_) {
+        CUDA_CHECK(cudaEventCreate(&event));
+      }
+    }
+#endif
+  }
+  ~LayerTimeline() {
+#ifndef CPU_ONLY
+    for (cudaEvent_t event : events_) {
+      cudaEventDestroy(event);
+    }
+#endif
+  }
+
+  // k-th mark of a pass: before its k-th layer, or after the last one
+  void Mark(int k) {
+#ifndef CPU_ONLY
+    if (!events_.empty()) {
+      CUDA_CHECK(cudaEventRecord(events_[k], Caffe::thread_stream()));
+      return;
+    }
+#endif
+    host_us_[k] = 1.e-3 * std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // Adds the pass's layer times in microseconds to us, the k-th layer of the pass
+  // being layer k or, backwards, the k-th from the end. Returns the pass time.
+  double Accumulate(bool backwards, vector<double>* us) {
+    const int layers = host_us_.size() - 1;
+#ifndef CPU_ONLY
+    if (!events_.empty()) {
+      CUDA_CHECK(cudaEventSynchronize(events_[layers]));
+    }
+#endif
+    double total = 0.;
+    for (int k = 0; k < layers; ++k) {
+      double t;
+#ifndef CPU_ONLY
+      if (!events_.empty()) {
+        float ms = 0.F;
+        CUDA_CHECK(cudaEventElapsedTime(&ms, events_[k], events_[k + 1]));
+        t = 1000. * ms;
+      } else
+#endif
+      {
+        t = host_us_[k + 1] - host_us_[k];
+      }
+      (*us)[backwards ? layers - 1 - k : k] += t;
+      total += t;
+    }
+    return total;
+  }
+
+ private:
+  vector<double> host_us_;
+#ifndef CPU_ONLY
+  vector<cudaEvent_t> events_;
+#endif
+
+  DISABLE_COPY_MOVE_AND_ASSIGN(LayerTimeline);
+};
+
+// time: mean per layer results
+struct LayerTime {
+  string name, type, forward_type, backward_type;
+  double forward_ms, backward_ms;
+  caffe::LayerCost cost;
+  size_t workspace_bytes;
+};
+
+static double per_second(double amount, double ms) {
+  return ms > 0. ? amount * 1000. / ms : 0.;
+}
+
+// Achieved over attainable FLOPS, the lower of the peak and what the bandwidth feeds at
+// the pass's FLOPs per byte. 0 without --peak_tflops and --peak_gbps.
+static double roofline(double flops, double bytes, double ms) {
+  if (FLAGS_peak_tflops <= 0. || FLAGS_peak_gbps <= 0. || bytes <= 0.) {
+    return 0.;
+  }
+  const double attainable = std::min(1.e12 * FLAGS_peak_tflops,
+      flops / bytes * 1.e9 * FLAGS_peak_gbps);
+  return attainable > 0. ? per_second(flops, ms) / attainable : 0.;
+}
+
+// Whether the pass's FLOPs per byte are below the ridge point of the device
+static const char* bound(double flops, double bytes) {
+  if (FLAGS_peak_tflops <= 0. || FLAGS_peak_gbps <= 0.) {
+    return "";
+  }
+  return flops * 1.e9 * FLAGS_peak_gbps < bytes * 1.e12 * FLAGS_peak_tflops ?
+      "memory" : "compute";
+}
+
+// CSV for files ending with .csv, JSON otherwise. The last row is the whole net.
+static void WriteLayerTimes(const string& file, const vector<LayerTime>& rows) {
+  std::ofstream out(file.c_str());
+  CHECK(out.good()) << "Can't write " << file;
+  out.precision(6);
+  const bool csv = boost::algorithm::ends_with(file, ".csv");
+  if (csv) {
+    out << "layer,type,forward_type,backward_type,forward_ms,backward_ms,"
+        << "forward_gflop,backward_gflop,forward_tflops,backward_tflops,"
+        << "forward_gbps,backward_gbps,forward_roofline,backward_roofline,"
+        << "forward_bound,backward_bound,activation_bytes,workspace_bytes\n";
+  } else {
+    out << "{\"layers\": [\n";
+  }
+  for (size_t i = 0; i < rows.size(); ++i) {
+    const LayerTime& r = rows[i];
+    const double fwd_tflops = 1.e-12 * per_second(r.cost.forward_flops, r.forward_ms);
+    const double bwd_tflops = 1.e-12 * per_second(r.cost.backward_flops, r.backward_ms);
+    const double fwd_gbps = 1.e-9 * per_second(r.cost.forward_bytes, r.forward_ms);
+    const double bwd_gbps = 1.e-9 * per_second(r.cost.backward_bytes, r.backward_ms);
+    const double fwd_roofline = roofline(r.cost.forward_flops, r.cost.forward_bytes,
+        r.forward_ms);
+    const double bwd_roofline = roofline(r.cost.backward_flops, r.cost.backward_bytes,
+        r.backward_ms);
+    const char* fwd_bound = bound(r.cost.forward_flops, r.cost.forward_bytes);
+    const char* bwd_bound = bound(r.cost.backward_flops, r.cost.backward_bytes);
+    if (csv) {
+      out << r.name << "," << r.type << "," << r.forward_type << "," << r.backward_type << ","
+          << r.forward_ms << "," << r.backward_ms << ","
+          << 1.e-9 * r.cost.forward_flops << "," << 1.e-9 * r.cost.backward_flops << ","
+          << fwd_tflops << "," << bwd_tflops << "," << fwd_gbps << "," << bwd_gbps << ","
+          << fwd_roofline << "," << bwd_roofline << "," << fwd_bound << "," << bwd_bound << ","
+          << r.cost.activation_bytes << "," << r.workspace_bytes << "\n";
+    } else {
+      out << "  {\"layer\": \"" << r.name << "\", \"type\": \"" << r.type
+          << "\", \"forward_type\": \"" << r.forward_type
+          << "\", \"backward_type\": \"" << r.backward_type
+          << "\", \"forward_ms\": " << r.forward_ms << ", \"backward_ms\": " << r.backward_ms
+          << ", \"forward_gflop\": " << 1.e-9 * r.cost.forward_flops
+          << ", \"backward_gflop\": " << 1.e-9 * r.cost.backward_flops
+          << ", \"forward_tflops\": " << fwd_tflops << ", \"backward_tflops\": " << bwd_tflops
+          << ", \"forward_gbps\": " << fwd_gbps << ", \"backward_gbps\": " << bwd_gbps
+          << ", \"forward_roofline\": " << fwd_roofline
+          << ", \"backward_roofline\": " << bwd_roofline
+          << ", \"forward_bound\": \"" << fwd_bound
+          << "\", \"backward_bound\": \"" << bwd_bound << "\""
+          << ", \"activation_bytes\": " << r.cost.activation_bytes
+          << ", \"workspace_bytes\": " << r.workspace_bytes << "}"
+          << (i + 1 < rows.size() ? ",\n" : "\n");
+    }
+  }
+  if (!csv) {
+    out << "]}\n";
+  }
+  LOG(INFO) << "Layer times written to " << file;
+}
+
+// --time_types: forward, backward, forward math and backward math types of the net
+static void SetTimeTypes(caffe::NetParameter* net_param) {
+  vector<string> names;
+  boost::split(names, FLAGS_time_types, boost::is_any_of(", "), boost::token_compress_on);
+  CHECK_EQ(names.size(), 4) << "--time_types needs 4 types, e.g. FLOAT16,FLOAT16,FLOAT,FLOAT";
+  caffe::Type types[4];
+  for (int i = 0; i < 4; ++i) {
+    CHECK(caffe::Type_Parse(boost::to_upper_copy(names[i]), &types[i]))
+        << "Unknown type " << names[i];
+  }
+  net_param->set_default_forward_type(types[0]);
+  net_param->set_default_backward_type(types[1]);
+  net_param->set_default_forward_math(types[2]);
+  net_param->set_default_backward_math(types[3]);
+}
+
+// --time_reduce: mean iteration, forward, backward and gradient reduction times of
+// data parallel training on all the GPUs, measured over the second window of
+// --iterations iterations.
+static void TimeReduce(const caffe::SolverParameter& param, const vector<int>& gpus) {
+  caffe::SolverParameter solver_param(param);
+  solver_param.set_max_iter(2 * FLAGS_iterations);
+  solver_param.set_metrics_interval(FLAGS_iterations);
+  solver_param.clear_metrics_file();
+  solver_param.clear_metrics_port();
+  solver_param.set_device_id(gpus[0]);
+  Caffe::SetDevice(gpus[0]);
+  Caffe::set_gpus(gpus);
+  Caffe::set_solver_count(gpus.size());
+  LOG(INFO) << "*** Reduce benchmark on " << gpus.size() << " GPUs begins ***";
+  shared_ptr<Solver> solver(caffe::SolverRegistry::CreateSolver(solver_param, nullptr, 0));
+  caffe::P2PManager p2p_mgr(solver, gpus.size(), solver->param());
+  p2p_mgr.Run(gpus);
+  const caffe::MetricsSample& m = solver->last_metrics();
+  LOG(INFO) << "Average iteration: " << 1000. * m.iteration_s << " ms.";
+  LOG(INFO) << "Average Forward pass: " << 1000. * m.forward_s << " ms.";
+  LOG(INFO) << "Average Backward pass: " << 1000. * m.backward_s << " ms.";
+  LOG(INFO) << "Average ReduceAndUpdate: " << 1000. * m.reduce_s << " ms, "
+            << m.allreduce_bytes << " bytes at " << 1.e-9 * m.allreduce_bytes_per_s
+            << " GB/s.";
+  LOG(INFO) << "GPU " << gpus[0] << " memory peak: " << m.gpu_mem_peak << " bytes.";
+  LOG(INFO) << "*** Reduce benchmark ends ***";
+}
+
 // Time: benchmark the execution time of a model.
 int time() {
   CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to time.";
   vector<int> gpus;
+  vector<int> all_gpus;
 #ifndef CPU_ONLY
   // Read flags for list of GPUs
   get_gpus(&gpus);
+  all_gpus = gpus;
+  if (!FLAGS_time_reduce) {
+    all_gpus.resize(std::min<size_t>(all_gpus.size(), 1UL));
+  }
   while (gpus.size() > 1) {
-    // Only use one GPU
-    LOG(INFO) << "Not using GPU #" << gpus.back() << " for single-GPU function";
+    // Layers are timed on one GPU
+    LOG(INFO) << "Not timing layers on GPU #" << gpus.back();
     gpus.pop_back();
   }
   if (gpus.size() > 0) {
     Caffe::SetDevice(gpus[0]);
   }
-  caffe::GPUMemory::Scope gpu_memory_scope(gpus);
+  caffe::GPUMemory::Scope gpu_memory_scope(all_gpus);
 #endif
   // Set mode and device_id
   if (gpus.size() != 0) {
@@ -359,6 +917,11 @@ int time() {
 
   caffe::SolverParameter solver_param;
   caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, solver_param.mutable_net_param());
+  if (!FLAGS_time_types.empty()) {
+    SetTimeTypes(solver_param.mutable_net_param());
+  }
+  // Layers are timed on one device
+  solver_param.mutable_net_param()->clear_pipeline_device();
   solver_param.set_max_iter(kInitIterations);
   solver_param.set_lr_policy("fixed");
   solver_param.set_snapshot_after_train(false);
@@ -373,10 +936,6 @@ int time() {
   // so that memory allocation are done,
   // and future iterations will be more stable.
   Timer init_timer;
-  Timer forward_timer;
-  Timer backward_timer;
-  double forward_time = 0.0;
-  double backward_time = 0.0;
   LOG(INFO) << "Initialization for " << kInitIterations << " iterations.";
   // Note that for the speed benchmark, we will assume that the network does
   // not take any input blobs.
@@ -396,55 +955,559 @@ int time() {
   LOG(INFO) << "Testing for " << FLAGS_iterations << " iterations.";
   Timer total_timer;
   total_timer.Start();
-  Timer timer;
+  LayerTimeline forward_timeline(layers.size());
+  LayerTimeline backward_timeline(layers.size());
   std::vector<double> forward_time_per_layer(layers.size(), 0.0);
   std::vector<double> backward_time_per_layer(layers.size(), 0.0);
-  forward_time = 0.0;
-  backward_time = 0.0;
+  double forward_time = 0.0;
+  double backward_time = 0.0;
   for (int j = 0; j < FLAGS_iterations; ++j) {
-    Timer iter_timer;
-    iter_timer.Start();
-    forward_timer.Start();
     for (int i = 0; i < layers.size(); ++i) {
-      timer.Start();
+      forward_timeline.Mark(i);
       layers[i]->Forward(bottom_vecs[i], top_vecs[i]);
-      forward_time_per_layer[i] += timer.MicroSeconds();
     }
-    forward_time += forward_timer.MicroSeconds();
-    backward_timer.Start();
+    forward_timeline.Mark(layers.size());
     for (int i = layers.size() - 1; i >= 0; --i) {
-      timer.Start();
+      backward_timeline.Mark(layers.size() - 1 - i);
       layers[i]->Backward(top_vecs[i], bottom_need_backward[i],
                           bottom_vecs[i]);
-      backward_time_per_layer[i] += timer.MicroSeconds();
     }
-    backward_time += backward_timer.MicroSeconds();
+    backward_timeline.Mark(layers.size());
+    const double forward_us = forward_timeline.Accumulate(false, &forward_time_per_layer);
+    const double backward_us = backward_timeline.Accumulate(true, &backward_time_per_layer);
+    forward_time += forward_us;
+    backward_time += backward_us;
     LOG(INFO) << "Iteration: " << j + 1 << " forward-backward time: "
-      << iter_timer.MilliSeconds() << " ms.";
+      << (forward_us + backward_us) / 1000 << " ms.";
   }
   LOG(INFO) << "Average time per layer: ";
+  caffe::LayerProfile profile;
+  vector<LayerTime> rows(layers.size() + 1);
+  LayerTime& net_row = rows.back();
+  net_row.name = caffe_net->name();
+  net_row.type = "Net";
+  net_row.forward_ms = forward_time / 1000 / FLAGS_iterations;
+  net_row.backward_ms = backward_time / 1000 / FLAGS_iterations;
+  net_row.cost = caffe_net->cost();
+  net_row.workspace_bytes = 0UL;
   for (int i = 0; i < layers.size(); ++i) {
     const caffe::string& layername = layers[i]->layer_param().name();
+    caffe::LayerProfile::Entry* entry = profile.add_entry();
+    entry->set_layer(layername);
+    entry->set_forward_ms(forward_time_per_layer[i] / 1000 / FLAGS_iterations);
+    entry->set_backward_ms(backward_time_per_layer[i] / 1000 / FLAGS_iterations);
+    LayerTime& row = rows[i];
+    row.name = layername;
+    row.type = layers[i]->type();
+    row.forward_type = caffe::Type_Name(layers[i]->layer_param().forward_type());
+    row.backward_type = caffe::Type_Name(layers[i]->layer_param().backward_type());
+    row.forward_ms = entry->forward_ms();
+    row.backward_ms = entry->backward_ms();
+    row.cost = caffe::layer_cost(layers[i].get(), bottom_vecs[i], top_vecs[i]);
+    row.workspace_bytes = layers[i]->workspace_bytes();
+    net_row.workspace_bytes = std::max(net_row.workspace_bytes, row.workspace_bytes);
     LOG(INFO) << std::setfill(' ') << std::setw(10) << layername <<
-      "\tforward: " << forward_time_per_layer[i] / 1000 /
-      FLAGS_iterations << " ms.";
+      "\tforward: " << row.forward_ms << " ms, " <<
+      1.e-12 * per_second(row.cost.forward_flops, row.forward_ms) << " TFLOPS.";
     LOG(INFO) << std::setfill(' ') << std::setw(10) << layername  <<
-      "\tbackward: " << backward_time_per_layer[i] / 1000 /
-      FLAGS_iterations << " ms.";
+      "\tbackward: " << row.backward_ms << " ms, " <<
+      1.e-12 * per_second(row.cost.backward_flops, row.backward_ms) << " TFLOPS.";
   }
   total_timer.Stop();
-  LOG(INFO) << "Average Forward pass: " << forward_time / 1000 /
-    FLAGS_iterations << " ms.";
-  LOG(INFO) << "Average Backward pass: " << backward_time / 1000 /
-    FLAGS_iterations << " ms.";
+  LOG(INFO) << "Average Forward pass: " << net_row.forward_ms << " ms.";
+  LOG(INFO) << "Average Backward pass: " << net_row.backward_ms << " ms.";
   LOG(INFO) << "Average Forward-Backward: " << total_timer.MilliSeconds() /
     FLAGS_iterations << " ms.";
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() << " ms.";
+  LOG(INFO) << "Activations: " << net_row.cost.activation_bytes
+            << " bytes, largest workspace: " << net_row.workspace_bytes << " bytes.";
+  if (FLAGS_peak_tflops > 0. && FLAGS_peak_gbps > 0.) {
+    LOG(INFO) << "Roofline efficiency, forward: " << 100. * roofline(net_row.cost.forward_flops,
+        net_row.cost.forward_bytes, net_row.forward_ms) << "%, backward: "
+        << 100. * roofline(net_row.cost.backward_flops, net_row.cost.backward_bytes,
+        net_row.backward_ms) << "%.";
+  }
+#ifndef CPU_ONLY
+  if (gpus.size() > 0) {
+    size_t in_use, peak;
+    caffe::GPUMemory::GetUsage(&in_use, &peak, gpus[0]);
+    LOG(INFO) << "GPU " << gpus[0] << " memory in use: " << in_use
+              << " bytes, peak: " << peak << " bytes.";
+  }
+#endif
   LOG(INFO) << "*** Benchmark ends ***";
+  if (!FLAGS_layer_profile.empty()) {
+    caffe::WriteProtoToTextFile(profile, FLAGS_layer_profile);
+    LOG(INFO) << "Layer profile written to " << FLAGS_layer_profile;
+  }
+  if (!FLAGS_time_output.empty()) {
+    WriteLayerTimes(FLAGS_time_output, rows);
+  }
+  if (all_gpus.size() > 1) {
+    caffe_net.reset();
+    solver.reset();
+    TimeReduce(solver_param, all_gpus);
+  }
   return 0;
 }
 RegisterBrewFunction(time);
 
+// Datapipe: input pipeline throughput of a model's data layers, no net.
+// Every simulated rank drains its own copies of the layers as fast as it can.
+struct DataPipeRank {
+  double seconds;
+  vector<size_t> consumed;  // samples per layer
+  vector<caffe::DataPipeStats> start, end;
+  // Sums of queue fill ratios sampled after every batch
+  vector<double> datums_fill, batches_fill;
+};
+
+static void DrainDataLayers(const vector<caffe::LayerParameter>& params, int rank, int ranks,
+    int device, boost::barrier* barrier, DataPipeRank* result) {
+  Caffe::set_solver_count(ranks);
+  Caffe::set_root_solver(rank == 0);
+  if (device >= 0) {
+    Caffe::SetDevice(device);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    Caffe::set_mode(Caffe::CPU);
+  }
+  const int kInitBatches = 5;
+  const size_t n = params.size();
+  vector<shared_ptr<LayerBase>> layers(n);
+  vector<vector<shared_ptr<Blob>>> tops(n);
+  vector<vector<Blob*>> top_vecs(n);
+  const vector<Blob*> bottom_vec;
+  for (size_t i = 0; i < n; ++i) {
+    layers[i] = caffe::LayerRegistry::CreateLayer(params[i]);
+    layers[i]->set_solver_rank(rank);
+    for (int j = 0; j < params[i].top_size(); ++j) {
+      tops[i].push_back(Blob::create<float>());
+      top_vecs[i].push_back(tops[i].back().get());
+    }
+    layers[i]->SetUp(bottom_vec, top_vecs[i]);
+  }
+  for (int k = 0; k < kInitBatches; ++k) {
+    for (size_t i = 0; i < n; ++i) {
+      layers[i]->Forward(bottom_vec, top_vecs[i]);
+    }
+  }
+  barrier->wait();
+  result->consumed.assign(n, 0UL);
+  result->start.resize(n);
+  result->end.resize(n);
+  result->datums_fill.assign(n, 0.);
+  result->batches_fill.assign(n, 0.);
+  for (size_t i = 0; i < n; ++i) {
+    layers[i]->data_pipe_stats(&result->start[i]);
+  }
+  Timer timer;
+  timer.Start();
+  caffe::DataPipeStats stats;
+  for (int k = 0; k < FLAGS_iterations; ++k) {
+    for (size_t i = 0; i < n; ++i) {
+      layers[i]->Forward(bottom_vec, top_vecs[i]);
+      result->consumed[i] += top_vecs[i][0]->num_axes() > 0 ? top_vecs[i][0]->shape(0) : 0;
+      layers[i]->data_pipe_stats(&stats);
+      result->datums_fill[i] += stats.datums_capacity > 0UL ?
+          static_cast<double>(stats.datums_queued) / stats.datums_capacity : 0.;
+      result->batches_fill[i] += stats.batches_capacity > 0UL ?
+          static_cast<double>(stats.batches_queued) / stats.batches_capacity : 0.;
+    }
+  }
+  result->seconds = timer.Seconds();
+  for (size_t i = 0; i < n; ++i) {
+    layers[i]->data_pipe_stats(&result->end[i]);
+  }
+  // Every rank measured before any rank stops its threads
+  barrier->wait();
+}
+
+// Samples per second a stage keeps up with: its threads' busy time per sample
+static double stage_rate(uint64_t busy_us, uint64_t samples, size_t threads) {
+  return busy_us > 0UL ? 1.e6 * samples * threads / busy_us : 0.;
+}
+
+int datapipe() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to take data layers from.";
+  CHECK_GT(FLAGS_datapipe_ranks, 0);
+  vector<int> gpus;
+  int device = -1;
+#ifndef CPU_ONLY
+  get_gpus(&gpus);
+  gpus.resize(std::min<size_t>(gpus.size(), 1UL));
+  caffe::GPUMemory::Scope gpu_memory_scope(gpus);
+  if (gpus.size() > 0) {
+    device = gpus[0];
+    Caffe::SetDevice(device);
+    Caffe::set_mode(Caffe::GPU);
+  }
+#endif
+  LOG(INFO) << (device >= 0 ? "Data pipeline feeding GPU " + std::to_string(device) :
+      string("Data pipeline on CPU")) << ", " << FLAGS_datapipe_ranks << " rank(s)";
+
+  caffe::NetParameter param, net_param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &param);
+  param.mutable_state()->set_phase(caffe::TRAIN);
+  Net::FilterNet(param, &net_param);
+  vector<caffe::LayerParameter> params;
+  for (const caffe::LayerParameter& lp : net_param.layer()) {
+    if (lp.bottom_size() > 0 || !lp.has_data_param()) {
+      continue;
+    }
+    caffe::LayerParameter p(lp);
+    p.set_phase(caffe::TRAIN);
+    // Types the net would give data layers
+    if (!p.has_forward_type()) {
+      p.set_forward_type(net_param.default_forward_type());
+    }
+    if (!p.has_backward_type()) {
+      p.set_backward_type(caffe::FLOAT);
+    }
+    if (!p.has_forward_math()) {
+      p.set_forward_math(p.forward_type());
+    }
+    if (!p.has_backward_math()) {
+      p.set_backward_math(p.backward_type());
+    }
+    caffe::DataParameter* dp = p.mutable_data_param();
+    if (!dp->has_threads() && !dp->has_parser_threads()) {
+      // Auto mode sizes them from the memory the net leaves, up to these
+      LOG(INFO) << p.name() << ": threads and parser_threads are not set, timing 4 and 2";
+      dp->set_threads(4U);
+      dp->set_parser_threads(2U);
+    }
+    params.push_back(p);
+  }
+  CHECK(!params.empty()) << "No data layers (with data_param and no bottoms) in "
+      << FLAGS_model;
+
+  const int ranks = FLAGS_datapipe_ranks;
+  boost::barrier barrier(ranks);
+  vector<DataPipeRank> results(ranks);
+  vector<std::thread> threads;
+  for (int r = 0; r < ranks; ++r) {
+    threads.emplace_back(DrainDataLayers, std::cref(params), r, ranks, device, &barrier,
+        &results[r]);
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+
+  LOG(INFO) << "*** Data pipeline, " << FLAGS_iterations << " batches per rank ***";
+  for (size_t i = 0; i < params.size(); ++i) {
+    double consumed = 0., seconds = 0., datums_fill = 0., batches_fill = 0.;
+    double read = 0., parse = 0., decode = 0., transform = 0.;
+    size_t batch_bytes = 0UL;
+    uint64_t cache_hits = 0UL, cache_misses = 0UL, samples_loaded = 0UL, unique = 0UL;
+    for (const DataPipeRank& r : results) {
+      const caffe::DataPipeStats& s0 = r.start[i];
+      const caffe::DataPipeStats& s1 = r.end[i];
+      const uint64_t samples = s1.samples - s0.samples;
+      consumed += r.consumed[i];
+      seconds = std::max(seconds, r.seconds);
+      datums_fill += r.datums_fill[i] / FLAGS_iterations / ranks;
+      batches_fill += r.batches_fill[i] / FLAGS_iterations / ranks;
+      read += stage_rate(s1.read_us - s0.read_us, samples, s1.parser_threads);
+      parse += stage_rate(s1.parse_us - s0.parse_us, samples, s1.parser_threads);
+      decode += stage_rate(s1.decode_us - s0.decode_us, samples, s1.transformer_threads);
+      transform += stage_rate(s1.transform_us - s0.transform_us, samples,
+          s1.transformer_threads);
+      batch_bytes = s1.batch_bytes;
+      cache_hits += s1.cache_hits - s0.cache_hits;
+      cache_misses += s1.cache_misses - s0.cache_misses;
+      samples_loaded += samples;
+      unique += s1.unique_samples - s0.unique_samples;
+    }
+    LOG(INFO) << params[i].name() << ": " << consumed / std::max(seconds, 1.e-9)
+              << " samples/s delivered by " << ranks << " rank(s)";
+    LOG(INFO) << params[i].name() << " stage capacity, samples/s: read " << read
+              << ", parse " << parse << ", decode " << decode << ", transform " << transform
+              << (decode == 0. ? " (images are not encoded or decoded on the GPU)" : "");
+#ifndef CPU_ONLY
+    if (device >= 0 && batch_bytes > 0UL) {
+      // The transformer threads push batches from pinned memory
+      void* host = nullptr;
+      CUDA_CHECK(cudaMallocHost(&host, batch_bytes));
+      caffe::GPUMemory::Workspace dst(batch_bytes, device);
+      cudaStream_t stream = Caffe::thread_stream();
+      const int kCopies = 10;
+      CUDA_CHECK(cudaMemcpyAsync(dst.data(), host, batch_bytes, cudaMemcpyHostToDevice,
+          stream));
+      CUDA_CHECK(cudaStreamSynchronize(stream));
+      caffe::CPUTimer copy_timer;
+      copy_timer.Start();
+      for (int k = 0; k < kCopies; ++k) {
+        CUDA_CHECK(cudaMemcpyAsync(dst.data(), host, batch_bytes, cudaMemcpyHostToDevice,
+            stream));
+      }
+      CUDA_CHECK(cudaStreamSynchronize(stream));
+      const double copy_s = copy_timer.Seconds() / kCopies;
+      const int batch_size = params[i].data_param().batch_size();
+      CUDA_CHECK(cudaFreeHost(host));
+      LOG(INFO) << params[i].name() << " H2D: " << batch_size / copy_s << " samples/s, "
+                << 1.e-9 * batch_bytes / copy_s << " GB/s for " << batch_bytes
+                << " byte batches";
+    }
+#endif
+    LOG(INFO) << params[i].name() << " queue occupancy: parsed datums "
+              << std::lround(100. * datums_fill) << "%, prefetched batches "
+              << std::lround(100. * batches_fill) << "%";
+    if (cache_hits + cache_misses > 0UL) {
+      LOG(INFO) << params[i].name() << " cache hit rate "
+                << std::lround(100. * cache_hits / (cache_hits + cache_misses)) << "% of "
+                << cache_hits + cache_misses << " records";
+    }
+    if (unique < samples_loaded) {
+      LOG(INFO) << params[i].name() << " data echoing: "
+                << std::lround(100. * unique / samples_loaded) << "% of samples are unique, "
+                << unique / std::max(seconds, 1.e-9) << " unique samples/s";
+    }
+  }
+  return 0;
+}
+RegisterBrewFunction(datapipe);
+
+// Data service worker: runs the Data layers of RemoteData layers connecting to
+// --data_service_port on this host's CPUs till killed, see DataServiceWorker.
+int dataserve() {
+  CHECK_GT(FLAGS_data_service_port, 0) << "Need --data_service_port to listen on.";
+  Caffe::set_mode(Caffe::CPU);
+  caffe::DataServiceWorker worker(FLAGS_data_service_port);
+  worker.Serve();
+  return 0;
+}
+RegisterBrewFunction(dataserve);
+
+// plan: TRAIN data layers of the model, the ones whose batch size is searched
+static vector<int> plan_data_layers(const caffe::NetParameter& param) {
+  caffe::NetParameter train_param, filtered;
+  train_param.CopyFrom(param);
+  train_param.mutable_state()->set_phase(caffe::TRAIN);
+  Net::FilterNet(train_param, &filtered);
+  std::set<string> names;
+  for (const caffe::LayerParameter& lp : filtered.layer()) {
+    if (lp.bottom_size() == 0 && lp.has_data_param()) {
+      names.insert(lp.name());
+    }
+  }
+  vector<int> ids;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    if (names.count(param.layer(i).name()) > 0) {
+      ids.push_back(i);
+    }
+  }
+  CHECK(!ids.empty()) << "No TRAIN data layers (with data_param and no bottoms) in "
+      << FLAGS_model;
+  return ids;
+}
+
+// The first data layer gets batch, others keep their ratio to it
+static void set_plan_batch(caffe::NetParameter* param, int batch) {
+  const vector<int> ids = plan_data_layers(*param);
+  const double scale = static_cast<double>(batch) /
+      param->layer(ids[0]).data_param().batch_size();
+  for (int id : ids) {
+    caffe::DataParameter* dp = param->mutable_layer(id)->mutable_data_param();
+    dp->set_batch_size(std::max(1U, static_cast<unsigned int>(std::lround(
+        scale * dp->batch_size()))));
+  }
+}
+
+// plan: one batch size measured in a child process, see plan_batch.
+// Writes the peak memory less the largest workspace, the device's memory, the
+// iteration time and the data threads auto mode picked by data layer.
+int plan() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to plan.";
+  CHECK_GT(FLAGS_plan_probe, 0) << "plan runs its probes itself, see plan_batch";
+  CHECK_GT(FLAGS_plan_probe_output.size(), 0);
+#ifndef CPU_ONLY
+  vector<int> gpus;
+  get_gpus(&gpus);
+  CHECK(!gpus.empty()) << "plan needs a GPU";
+  gpus.resize(1);
+  Caffe::SetDevice(gpus[0]);
+  caffe::GPUMemory::Scope gpu_memory_scope(gpus);
+  Caffe::set_mode(Caffe::GPU);
+  const int kInitIterations = 5;
+
+  caffe::SolverParameter solver_param;
+  caffe::NetParameter* net_param = solver_param.mutable_net_param();
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, net_param);
+  if (!FLAGS_time_types.empty()) {
+    SetTimeTypes(net_param);
+  }
+  set_plan_batch(net_param, FLAGS_plan_probe);
+  net_param->clear_pipeline_device();
+  net_param->set_default_cudnn_workspace_arbitration(true);
+  solver_param.set_max_iter(kInitIterations + FLAGS_iterations);
+  solver_param.set_lr_policy("fixed");
+  solver_param.set_snapshot_after_train(false);
+  solver_param.set_base_lr(0.01F);
+  solver_param.set_random_seed(1371LL);
+  solver_param.set_test_interval(kInitIterations + FLAGS_iterations + 1);
+  solver_param.set_display(0);
+  shared_ptr<Solver> solver(caffe::SolverRegistry::CreateSolver(solver_param));
+  solver->Step(kInitIterations);
+  Timer timer;
+  timer.Start();
+  solver->Step(FLAGS_iterations);
+  const double ms = timer.MilliSeconds() / FLAGS_iterations;
+
+  const vector<shared_ptr<LayerBase>>& layers = solver->net()->layers();
+  size_t workspace = 0UL;
+  for (const shared_ptr<LayerBase>& layer : layers) {
+    workspace = std::max(workspace, layer->workspace_bytes());
+  }
+  size_t in_use, peak, free_mem, total_mem;
+  caffe::GPUMemory::GetUsage(&in_use, &peak, gpus[0]);
+  CUDA_CHECK(cudaMemGetInfo(&free_mem, &total_mem));
+  std::ofstream out(FLAGS_plan_probe_output.c_str());
+  CHECK(out.good()) << "Can't write " << FLAGS_plan_probe_output;
+  out << (peak > workspace ? peak - workspace : 0UL) << " " << total_mem << " " << ms << "\n";
+  caffe::DataPipeStats stats;
+  for (const shared_ptr<LayerBase>& layer : layers) {
+    if (layer->data_pipe_stats(&stats)) {
+      out << layer->name() << " " << stats.transformer_threads << " "
+          << stats.parser_threads << "\n";
+    }
+  }
+  CHECK(out.good()) << "Can't write " << FLAGS_plan_probe_output;
+#else
+  NO_GPU;
+#endif
+  return 0;
+}
+RegisterBrewFunction(plan);
+
+struct PlanProbe {
+  int batch;
+  double need_bytes, total_bytes, ms;
+  std::map<string, std::pair<unsigned int, unsigned int>> threads;  // by data layer
+};
+
+// False if the child failed, out of memory most likely
+static bool run_plan_probe(const vector<string>& args, int batch, PlanProbe* probe) {
+  namespace fs = boost::filesystem;
+  const string file = (fs::temp_directory_path() /
+      fs::unique_path("caffe_plan_%%%%%%%%.txt")).string();
+  vector<string> child(args);
+  child.push_back("--plan_probe=" + std::to_string(batch));
+  child.push_back("--plan_probe_output=" + file);
+  const int status = run_child(child);
+  std::ifstream in(file.c_str());
+  probe->batch = batch;
+  const bool fits = status == 0 &&
+      static_cast<bool>(in >> probe->need_bytes >> probe->total_bytes >> probe->ms);
+  string name;
+  unsigned int threads, parser_threads;
+  while (fits && in >> name >> threads >> parser_threads) {
+    probe->threads[name] = std::make_pair(threads, parser_threads);
+  }
+  in.close();
+  boost::system::error_code ec;
+  fs::remove(file, ec);
+  LOG(INFO) << "Batch size " << batch << (fits ? ": " + std::to_string(probe->need_bytes) +
+      " bytes without workspaces, " + std::to_string(batch * 1000. / probe->ms) +
+      " samples/s" : string(": failed with status ") + std::to_string(status));
+  return fits;
+}
+
+// Largest batch whose fitted memory need stays within the budget. Need is taken
+// as affine in the batch size, proportional while a single probe fits.
+static int predict_plan_batch(const vector<PlanProbe>& fits) {
+  const PlanProbe& last = fits.back();
+  const double budget = FLAGS_plan_memory_fraction * last.total_bytes;
+  double fixed = 0., per_sample = last.need_bytes / last.batch;
+  if (fits.size() > 1) {
+    double n = 0., sx = 0., sy = 0., sxx = 0., sxy = 0.;
+    for (const PlanProbe& p : fits) {
+      n += 1.;
+      sx += p.batch;
+      sy += p.need_bytes;
+      sxx += static_cast<double>(p.batch) * p.batch;
+      sxy += p.batch * p.need_bytes;
+    }
+    const double var = n * sxx - sx * sx;
+    if (var > 0. && n * sxy - sx * sy > 0.) {
+      per_sample = (n * sxy - sx * sy) / var;
+      fixed = (sy - per_sample * sx) / n;
+    }
+  }
+  int batch = per_sample > 0. ? static_cast<int>((budget - fixed) / per_sample) : 0;
+  if (batch >= 16) {
+    batch -= batch % 8;  // tensor core friendly
+  }
+  return batch;
+}
+
+// plan: the supervising process never initializes CUDA. Every batch size is tried by
+// a child (see plan), so that running out of memory only takes the child down. The
+// first probe is the model's batch size, halved until one fits. Larger ones follow
+// the fit of the memory measured, bisecting between the largest one fitting and the
+// smallest one failing once a prediction fails.
+static int plan_batch(const vector<string>& args) {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to plan.";
+  CHECK_GT(FLAGS_gpu.size(), 0) << "plan needs a GPU, see --gpu";
+  CHECK_GT(FLAGS_plan_memory_fraction, 0.);
+  CHECK_LE(FLAGS_plan_memory_fraction, 1.);
+  caffe::NetParameter net_param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &net_param);
+  const vector<int> ids = plan_data_layers(net_param);
+  const int kMaxProbes = 8;
+  vector<PlanProbe> fits;
+  int lo = 0, hi = std::numeric_limits<int>::max();
+  int batch = net_param.layer(ids[0]).data_param().batch_size();
+  for (int k = 0; k < kMaxProbes && batch > lo && batch < hi; ++k) {
+    PlanProbe probe;
+    if (run_plan_probe(args, batch, &probe)) {
+      lo = batch;
+      fits.push_back(probe);
+    } else {
+      hi = batch;
+    }
+    if (fits.empty()) {
+      CHECK_GT(batch, 1) << "Batch size 1 doesn't fit";
+      batch /= 2;
+      continue;
+    }
+    batch = predict_plan_batch(fits);
+    if (batch >= hi) {
+      batch = lo + (hi - lo) / 2;
+    }
+  }
+  CHECK(!fits.empty()) << "No batch size fits in " << kMaxProbes << " probes";
+  const PlanProbe& best = *std::max_element(fits.begin(), fits.end(),
+      [](const PlanProbe& a, const PlanProbe& b) { return a.batch < b.batch; });
+
+  set_plan_batch(&net_param, best.batch);
+  net_param.set_default_cudnn_workspace_arbitration(true);
+  for (int id : ids) {
+    caffe::LayerParameter* lp = net_param.mutable_layer(id);
+    caffe::DataParameter* dp = lp->mutable_data_param();
+    auto it = best.threads.find(lp->name());
+    if (it != best.threads.end() && !dp->has_threads() && !dp->has_parser_threads()) {
+      dp->set_threads(it->second.first);
+      dp->set_parser_threads(it->second.second);
+    }
+  }
+  string output = FLAGS_plan_output;
+  if (output.empty()) {
+    output = FLAGS_model;
+    if (boost::algorithm::ends_with(output, ".prototxt")) {
+      output.resize(output.size() - 9);
+    }
+    output += ".plan.prototxt";
+  }
+  caffe::WriteProtoToTextFile(net_param, output);
+  LOG(INFO) << "Plan: batch size " << best.batch << " per GPU, "
+            << best.batch * 1000. / best.ms << " samples/s per GPU predicted, "
+            << best.need_bytes << " of " << best.total_bytes
+            << " bytes taken without workspaces";
+  LOG(INFO) << "Net with the plan written to " << output;
+  return 0;
+}
+
 int main(int argc, char** argv) {
   // Print output to stderr (while still logging).
   FLAGS_alsologtostderr = 1;
@@ -457,9 +1520,21 @@ int main(int argc, char** argv) {
       "  train           train or finetune a model\n"
       "  test            score a model\n"
       "  device_query    show GPU diagnostic information\n"
-      "  time            benchmark model execution time");
+      "  time            benchmark model execution time\n"
+      "  datapipe        benchmark the input pipeline of a model alone\n"
+      "  dataserve       read and transform batches for RemoteData layers\n"
+      "  plan            find the largest batch size a GPU fits\n"
+      "  calibrate       find input scales for INT8 inference\n"
+      "  share_weights   hold weights on a GPU for other processes to attach");
+  const vector<string> args(argv, argv + argc);
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  if (argc == 2 && string(argv[1]) == "train" && FLAGS_elastic_restarts > 0) {
+    return elastic_train(args);
+  }
+  if (argc == 2 && string(argv[1]) == "plan" && FLAGS_plan_probe == 0) {
+    return plan_batch(args);
+  }
 
   vector<int> gpus;
   get_gpus(&gpus);
@@ -468,6 +1543,9 @@ int main(int argc, char** argv) {
     Caffe::SetDevice(gpus[0]);
   }
 #endif
+  if (FLAGS_cpu_threads > 0) {
+    caffe::CpuParallel::set_num_threads(FLAGS_cpu_threads);
+  }
 
   LOG(INFO) << "This is NVCaffe " << Caffe::caffe_version()
             << " started at " << Caffe::start_time();
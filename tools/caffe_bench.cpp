@@ -0,0 +1,477 @@
+// Microbenchmarks of core kernels and data pipeline stages, results as JSON.
+// usage: caffe_bench [--gpu=0] [--iterations=100] [--filter=im2col] [--db=path/to/lmdb]
+//                    [--model=train_val.prototxt] [--nccl_gpus=0,1] [--output=bench.json]
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+
+#include "caffe/caffe.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/db.hpp"
+#include "caffe/util/im2col.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#ifdef USE_NCCL
+#include "caffe/util/nccl.hpp"
+#endif
+
+using caffe::Caffe;
+using caffe::CPUTimer;
+using caffe::TBlob;
+using caffe::string;
+using caffe::vector;
+#ifndef CPU_ONLY
+using caffe::float16;
+#endif
+
+DEFINE_int32(gpu, 0,
+    "Device the GPU benchmarks run on.");
+DEFINE_int32(iterations, 100,
+    "Timed runs of every benchmark, after one untimed warm-up run.");
+DEFINE_string(filter, "",
+    "Optional; only run benchmarks whose name contains this.");
+DEFINE_string(db, "",
+    "Optional; LMDB read by the lmdb_cursor benchmark, it is skipped without it.");
+DEFINE_string(model, "",
+    "Optional; net whose gradient reduction buckets (NetParameter::reduce_buckets) "
+    "nccl_allreduce times. Fixed sizes from 256KB to 64MB otherwise.");
+DEFINE_string(nccl_gpus, "",
+    "Optional; devices separated by ',' the nccl_allreduce benchmark reduces over.");
+DEFINE_string(output, "",
+    "Optional; JSON file to write the results to, they are logged either way.");
+
+// One measurement: mean time of a run and the bytes or items a run processes
+struct BenchResult {
+  string name, config;
+  int iterations;
+  double seconds;  // per run
+  double bytes, items;
+};
+
+static vector<BenchResult> results;
+
+static void Report(const string& name, const string& config, double seconds, double bytes,
+    double items) {
+  BenchResult r{name, config, FLAGS_iterations, seconds, bytes, items};
+  LOG(INFO) << name << " " << config << ": " << 1.e6 * seconds << " us"
+            << (bytes > 0. ? ", " + std::to_string(1.e-9 * bytes / seconds) + " GB/s" : "")
+            << (items > 0. ? ", " + std::to_string(items / seconds) + " items/s" : "");
+  results.push_back(r);
+}
+
+// Mean seconds of a run, the GPU queue drained before and after the timed runs
+static double Time(const std::function<void()>& run) {
+  const bool gpu = Caffe::mode() == Caffe::GPU;
+  run();
+#ifndef CPU_ONLY
+  if (gpu) {
+    CUDA_CHECK(caffe::caffe_gpu_sync(Caffe::thread_stream()));
+  }
+#endif
+  CPUTimer timer;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    run();
+  }
+#ifndef CPU_ONLY
+  if (gpu) {
+    CUDA_CHECK(caffe::caffe_gpu_sync(Caffe::thread_stream()));
+  }
+#endif
+  return timer.Seconds() / FLAGS_iterations;
+}
+
+static string Config(const std::initializer_list<std::pair<const char*, string>>& values) {
+  std::ostringstream os;
+  for (const auto& v : values) {
+    os << (os.tellp() > 0 ? " " : "") << v.first << "=" << v.second;
+  }
+  return os.str();
+}
+
+template <typename Dtype>
+static string type_name() {
+  return caffe::Type_Name(caffe::tp<Dtype>());
+}
+
+#ifndef CPU_ONLY
+// Blob data written as FLOAT then read as FLOAT16: one conversion per run
+static void BenchConvert() {
+  for (int count : {1 << 16, 1 << 22}) {
+    caffe::shared_ptr<caffe::Blob> blob = caffe::Blob::create<float>(vector<int>{count});
+    caffe::caffe_gpu_set(count, 1.F, blob->mutable_gpu_data_c<float>(false));
+    const double seconds = Time([&]() {
+      blob->mutable_gpu_data_c<float>(false);
+      blob->gpu_data<float16>();
+    });
+    Report("tensor_convert", Config({{"from", "FLOAT"}, {"to", "FLOAT16"},
+        {"count", std::to_string(count)}}), seconds, 6. * count, count);
+  }
+}
+
+template <typename Dtype>
+static void BenchMath() {
+  const int n = 1 << 22;
+  TBlob<Dtype> x(vector<int>{n}), y(vector<int>{n});
+  caffe::caffe_gpu_set(n, Dtype(1.F), x.mutable_gpu_data());
+  caffe::caffe_gpu_set(n, Dtype(0.F), y.mutable_gpu_data());
+  const string count = std::to_string(n);
+  double seconds = Time([&]() {
+    caffe::caffe_gpu_axpy(n, Dtype(0.5F), x.gpu_data(), y.mutable_gpu_data());
+  });
+  Report("caffe_gpu_axpy", Config({{"type", type_name<Dtype>()}, {"count", count}}),
+      seconds, 3. * n * sizeof(Dtype), n);
+  seconds = Time([&]() {
+    caffe::caffe_gpu_scal(n, Dtype(0.5F), y.mutable_gpu_data());
+  });
+  Report("caffe_gpu_scal", Config({{"type", type_name<Dtype>()}, {"count", count}}),
+      seconds, 2. * n * sizeof(Dtype), n);
+  float asum = 0.F;
+  seconds = Time([&]() {
+    caffe::caffe_gpu_asum(n, x.gpu_data(), &asum);
+  });
+  Report("caffe_gpu_asum", Config({{"type", type_name<Dtype>()}, {"count", count}}),
+      seconds, 1. * n * sizeof(Dtype), n);
+
+  for (int m : {256, 1024, 4096}) {
+    TBlob<Dtype> a(vector<int>{m, m}), b(vector<int>{m, m}), c(vector<int>{m, m});
+    caffe::caffe_gpu_set(m * m, Dtype(0.01F), a.mutable_gpu_data());
+    caffe::caffe_gpu_set(m * m, Dtype(0.01F), b.mutable_gpu_data());
+    seconds = Time([&]() {
+      caffe::caffe_gpu_gemm(CblasNoTrans, CblasNoTrans, m, m, m, Dtype(1.F), a.gpu_data(),
+          b.gpu_data(), Dtype(0.F), c.mutable_gpu_data());
+    });
+    // items are FLOPs
+    Report("caffe_gpu_gemm", Config({{"type", type_name<Dtype>()},
+        {"m", std::to_string(m)}, {"n", std::to_string(m)}, {"k", std::to_string(m)}}),
+        seconds, 3. * m * m * sizeof(Dtype), 2. * m * m * m);
+  }
+}
+
+// Elementwise ops at the vectorized and the unaligned (scalar) offsets, bytes are
+// every operand read or written once
+template <typename Dtype>
+static void BenchElementwise() {
+  const int n = 1 << 24;
+  TBlob<Dtype> a(vector<int>{n + 1}), b(vector<int>{n + 1}), y(vector<int>{n + 1});
+  caffe::caffe_gpu_set(n + 1, Dtype(1.F), a.mutable_gpu_data());
+  caffe::caffe_gpu_set(n + 1, Dtype(2.F), b.mutable_gpu_data());
+  caffe::caffe_gpu_set(n + 1, Dtype(0.F), y.mutable_gpu_data());
+  typedef std::function<void(const Dtype*, const Dtype*, Dtype*)> Op;
+  const vector<std::tuple<string, int, Op>> ops{
+      std::make_tuple("caffe_gpu_add", 3, [](const Dtype* a, const Dtype* b, Dtype* y) {
+        caffe::caffe_gpu_add(n, a, b, y);
+      }),
+      std::make_tuple("caffe_gpu_sub", 3, [](const Dtype* a, const Dtype* b, Dtype* y) {
+        caffe::caffe_gpu_sub(n, a, b, y);
+      }),
+      std::make_tuple("caffe_gpu_mul", 3, [](const Dtype* a, const Dtype* b, Dtype* y) {
+        caffe::caffe_gpu_mul(n, a, b, y);
+      }),
+      std::make_tuple("caffe_gpu_div", 3, [](const Dtype* a, const Dtype* b, Dtype* y) {
+        caffe::caffe_gpu_div(n, a, b, y);
+      }),
+      std::make_tuple("caffe_gpu_incr", 3, [](const Dtype* a, const Dtype*, Dtype* y) {
+        caffe::caffe_gpu_incr(n, a, y);
+      }),
+      std::make_tuple("caffe_gpu_square", 2, [](const Dtype* a, const Dtype*, Dtype* y) {
+        caffe::caffe_gpu_square(n, a, y);
+      }),
+      std::make_tuple("caffe_gpu_add_scalar", 2, [](const Dtype*, const Dtype*, Dtype* y) {
+        caffe::caffe_gpu_add_scalar(n, Dtype(0.F), y);
+      }),
+  };
+  for (const auto& op : ops) {
+    for (int offset : {0, 1}) {
+      const double seconds = Time([&]() {
+        std::get<2>(op)(a.gpu_data(), b.gpu_data(), y.mutable_gpu_data() + offset);
+      });
+      Report(std::get<0>(op), Config({{"type", type_name<Dtype>()},
+          {"count", std::to_string(n)}, {"offset", std::to_string(offset)}}),
+          seconds, 1. * std::get<1>(op) * n * sizeof(Dtype), n);
+    }
+  }
+}
+
+template <typename Dtype>
+static void BenchIm2col() {
+  struct Shape { int channels, size, kernel, stride; };
+  for (const Shape& s : {Shape{64, 56, 3, 1}, Shape{256, 14, 3, 1}, Shape{3, 224, 7, 2}}) {
+    const int out = (s.size + 2 * (s.kernel / 2) - s.kernel) / s.stride + 1;
+    TBlob<Dtype> im(vector<int>{s.channels, s.size, s.size});
+    TBlob<Dtype> col(vector<int>{s.channels * s.kernel * s.kernel, out, out});
+    caffe::caffe_gpu_set(im.count(), Dtype(1.F), im.mutable_gpu_data());
+    const double seconds = Time([&]() {
+      caffe::im2col_gpu(im.gpu_data(), s.channels, s.size, s.size, s.kernel, s.kernel,
+          s.kernel / 2, s.kernel / 2, s.stride, s.stride, 1, 1, col.mutable_gpu_data());
+    });
+    Report("im2col_gpu", Config({{"type", type_name<Dtype>()},
+        {"channels", std::to_string(s.channels)}, {"size", std::to_string(s.size)},
+        {"kernel", std::to_string(s.kernel)}, {"stride", std::to_string(s.stride)}}),
+        seconds, 1. * (im.count() + col.count()) * sizeof(Dtype), col.count());
+  }
+}
+
+// Batch of uint8 images cropped, mirrored and mean subtracted into Dtype
+template <typename Dtype>
+static void BenchTransformGPU() {
+  const int n = 64, c = 3, h = 256, w = 256, crop = 224;
+  caffe::TransformationParameter param;
+  param.set_crop_size(crop);
+  param.set_mirror(true);
+  for (int i = 0; i < c; ++i) {
+    param.add_mean_value(112.F);
+  }
+  caffe::DataTransformer transformer(param, caffe::TRAIN);
+  transformer.InitRand();
+  caffe::GPUMemory::Workspace in(static_cast<size_t>(n) * c * h * w);
+  CUDA_CHECK(cudaMemset(in.data(), 7, in.size()));
+  caffe::GPUMemory::Workspace rands(sizeof(unsigned int) * n * 3);
+  CUDA_CHECK(cudaMemset(rands.data(), 0, rands.size()));
+  TBlob<Dtype> out(vector<int>{n, c, crop, crop});
+  const double seconds = Time([&]() {
+    transformer.TransformGPU(n, c, h, w, sizeof(uint8_t), in.data(), out.mutable_gpu_data(),
+        static_cast<const unsigned int*>(rands.data()), false);
+  });
+  Report("transform_gpu", Config({{"type", type_name<Dtype>()}, {"batch", std::to_string(n)},
+      {"size", std::to_string(h)}, {"crop", std::to_string(crop)}}),
+      seconds, 1. * in.size() + 1. * out.count() * sizeof(Dtype), n);
+}
+#endif
+
+static void BenchDecode() {
+  // OpenCV's default generator state makes the images the same every time
+  for (int size : {64, 256, 512}) {
+    cv::Mat image(size, size, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+    vector<uchar> jpeg;
+    cv::imencode(".jpg", image, jpeg);
+    caffe::Datum datum;
+    datum.set_data(jpeg.data(), jpeg.size());
+    datum.set_encoded(true);
+    const double seconds = Time([&]() {
+      caffe::DecodeDatumToCVMat(datum, true);
+    });
+    Report("decode_datum", Config({{"format", "jpeg"}, {"size", std::to_string(size)}}),
+        seconds, 3. * size * size, 1.);
+  }
+}
+
+static void BenchLMDB() {
+  if (FLAGS_db.empty()) {
+    LOG(INFO) << "lmdb_cursor skipped, it needs --db";
+    return;
+  }
+  std::unique_ptr<caffe::db::DB> db(caffe::db::GetDB("lmdb"));
+  db->Open(FLAGS_db, caffe::db::READ);
+  std::unique_ptr<caffe::db::Cursor> cursor(db->NewCursor());
+  // Every run reads up to 1000 records, starting over at the end
+  const int records = 1000;
+  double bytes = 0.;
+  const double seconds = Time([&]() {
+    for (int i = 0; i < records; ++i) {
+      if (!cursor->valid()) {
+        cursor->SeekToFirst();
+      }
+      bytes += cursor->size();
+      cursor->Next();
+    }
+  });
+  bytes /= FLAGS_iterations + 1;
+  Report("lmdb_cursor", Config({{"records", std::to_string(records)}}), seconds, bytes,
+      records);
+}
+
+// One producer and one consumer thread, pop() blocking and lock-free modes
+static void BenchBlockingQueue() {
+  const int items = 100000;
+  for (size_t ring : {0UL, 1024UL}) {
+    caffe::BlockingQueue<int> queue(ring);
+    const double seconds = Time([&]() {
+      std::thread producer([&]() {
+        for (int i = 0; i < items; ++i) {
+          queue.push(i);
+        }
+      });
+      for (int i = 0; i < items; ++i) {
+        queue.pop();
+      }
+      producer.join();
+    });
+    Report("blocking_queue", Config({{"ring_capacity", std::to_string(ring)},
+        {"items", std::to_string(items)}}), seconds, 0., items);
+  }
+}
+
+#if !defined(CPU_ONLY) && defined(USE_NCCL)
+// Bucket sizes in bytes of the model's gradient reduction, or fixed ones
+static vector<size_t> BucketSizes() {
+  if (FLAGS_model.empty()) {
+    return {1UL << 18, 1UL << 22, 1UL << 24, 1UL << 26};
+  }
+  caffe::NetParameter net_param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &net_param);
+  net_param.mutable_state()->set_phase(caffe::TRAIN);
+  caffe::Net net(net_param);
+  size_t space = 0UL;
+  for (const caffe::shared_ptr<caffe::Blob>& param : net.learnable_params()) {
+    space += caffe::align_up<6>(static_cast<size_t>(param->count())) *
+        caffe::tsize(param->diff_type());
+  }
+  const int buckets = net_param.reduce_buckets();
+  vector<size_t> sizes;
+  if (buckets > 0) {
+    sizes.push_back(caffe::align_up<6>(space / buckets));
+  }
+  sizes.push_back(space);
+  return sizes;
+}
+
+// Single process, one communicator and stream per device
+static void BenchNCCL() {
+  vector<int> gpus;
+  vector<string> names;
+  boost::split(names, FLAGS_nccl_gpus, boost::is_any_of(", "), boost::token_compress_on);
+  for (const string& name : names) {
+    if (!name.empty()) {
+      gpus.push_back(boost::lexical_cast<int>(name));
+    }
+  }
+  if (gpus.size() < 2) {
+    LOG(INFO) << "nccl_allreduce skipped, it needs 2 or more --nccl_gpus";
+    return;
+  }
+  const int n = gpus.size();
+  vector<ncclComm_t> comms(n);
+  NCCL_CHECK(ncclCommInitAll(comms.data(), n, gpus.data()));
+  vector<cudaStream_t> streams(n);
+  for (const size_t bytes : BucketSizes()) {
+    const size_t count = bytes / sizeof(float);
+    vector<void*> buffers(n);
+    for (int i = 0; i < n; ++i) {
+      CUDA_CHECK(cudaSetDevice(gpus[i]));
+      CUDA_CHECK(cudaStreamCreateWithFlags(&streams[i], cudaStreamNonBlocking));
+      CUDA_CHECK(cudaMalloc(&buffers[i], count * sizeof(float)));
+      CUDA_CHECK(cudaMemset(buffers[i], 0, count * sizeof(float)));
+    }
+    auto run = [&]() {
+      NCCL_CHECK(ncclGroupStart());
+      for (int i = 0; i < n; ++i) {
+        NCCL_CHECK(ncclAllReduce(buffers[i], buffers[i], count, ncclFloat, ncclSum,
+            comms[i], streams[i]));
+      }
+      NCCL_CHECK(ncclGroupEnd());
+      for (int i = 0; i < n; ++i) {
+        CUDA_CHECK(cudaSetDevice(gpus[i]));
+        CUDA_CHECK(cudaStreamSynchronize(streams[i]));
+      }
+    };
+    const double seconds = Time(run);
+    // Bus bandwidth: a ring moves 2(n-1)/n of the buffer through every link
+    Report("nccl_allreduce", Config({{"type", "FLOAT"}, {"gpus", std::to_string(n)},
+        {"bytes", std::to_string(count * sizeof(float))}}),
+        seconds, 2. * (n - 1) / n * count * sizeof(float), 1.);
+    for (int i = 0; i < n; ++i) {
+      CUDA_CHECK(cudaSetDevice(gpus[i]));
+      CUDA_CHECK(cudaFree(buffers[i]));
+      CUDA_CHECK(cudaStreamDestroy(streams[i]));
+    }
+  }
+  for (ncclComm_t comm : comms) {
+    ncclCommDestroy(comm);
+  }
+  CUDA_CHECK(cudaSetDevice(FLAGS_gpu));
+}
+#endif
+
+static void WriteJSON(std::ostream& out) {
+  out.precision(9);
+  out << "{\"iterations\": " << FLAGS_iterations << ", \"results\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult& r = results[i];
+    out << "  {\"name\": \"" << r.name << "\", \"config\": \"" << r.config
+        << "\", \"seconds\": " << r.seconds << ", \"bytes\": " << r.bytes
+        << ", \"items\": " << r.items
+        << ", \"gb_per_s\": " << (r.seconds > 0. ? 1.e-9 * r.bytes / r.seconds : 0.)
+        << ", \"items_per_s\": " << (r.seconds > 0. ? r.items / r.seconds : 0.) << "}"
+        << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  out << "]}\n";
+}
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Microbenchmarks of kernels and data pipeline stages\n"
+      "usage: caffe_bench [FLAGS]");
+  caffe::GlobalInit(&argc, &argv);
+  Caffe::set_random_seed(1701);
+
+  vector<std::pair<string, std::function<void()>>> benches;
+#ifndef CPU_ONLY
+  vector<int> gpus(1, FLAGS_gpu);
+  caffe::GPUMemory::Scope gpu_memory_scope(gpus);
+  Caffe::SetDevice(FLAGS_gpu);
+  Caffe::set_mode(Caffe::GPU);
+  benches.emplace_back("tensor_convert", BenchConvert);
+  benches.emplace_back("caffe_gpu_math", BenchMath<float>);
+  benches.emplace_back("caffe_gpu_math", BenchMath<float16>);
+  benches.emplace_back("caffe_gpu_elementwise", BenchElementwise<float>);
+  benches.emplace_back("caffe_gpu_elementwise", BenchElementwise<float16>);
+  benches.emplace_back("im2col_gpu", BenchIm2col<float>);
+  benches.emplace_back("im2col_gpu", BenchIm2col<float16>);
+  benches.emplace_back("transform_gpu", BenchTransformGPU<float>);
+  benches.emplace_back("transform_gpu", BenchTransformGPU<float16>);
+#endif
+  benches.emplace_back("decode_datum", [] {
+    Caffe::Brew mode = Caffe::mode();
+    Caffe::set_mode(Caffe::CPU);
+    BenchDecode();
+    Caffe::set_mode(mode);
+  });
+  benches.emplace_back("lmdb_cursor", [] {
+    Caffe::Brew mode = Caffe::mode();
+    Caffe::set_mode(Caffe::CPU);
+    BenchLMDB();
+    Caffe::set_mode(mode);
+  });
+  benches.emplace_back("blocking_queue", [] {
+    Caffe::Brew mode = Caffe::mode();
+    Caffe::set_mode(Caffe::CPU);
+    BenchBlockingQueue();
+    Caffe::set_mode(mode);
+  });
+#if !defined(CPU_ONLY) && defined(USE_NCCL)
+  benches.emplace_back("nccl_allreduce", BenchNCCL);
+#endif
+
+  for (const auto& bench : benches) {
+    if (FLAGS_filter.empty() || bench.first.find(FLAGS_filter) != string::npos) {
+      bench.second();
+    }
+  }
+  std::ostringstream json;
+  WriteJSON(json);
+  if (FLAGS_output.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream out(FLAGS_output.c_str());
+    CHECK(out.good()) << "Can't write " << FLAGS_output;
+    out << json.str();
+    LOG(INFO) << "Results written to " << FLAGS_output;
+  }
+  return 0;
+}
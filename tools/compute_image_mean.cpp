@@ -1,7 +1,9 @@
 #include <stdint.h>
 #include <algorithm>
+#include <cmath>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -20,6 +22,71 @@ using std::unique_ptr;
 
 DEFINE_string(backend, "lmdb",
         "The backend {leveldb, lmdb} containing the images");
+DEFINE_int32(threads, 0,
+    "Threads reading the DB, each one takes every n-th record. 0 means one per core");
+DEFINE_bool(stddev, false,
+    "When this option is on, per-channel standard deviation is reported too");
+
+// Per thread sums of pixel values and of their squares
+struct Accumulator {
+  explicit Accumulator(size_t size)
+      : sum(size, 0.), sum_sq(size, 0.), sum8(size, 0U), sum_sq8(size, 0U), pending8(0U),
+        count(0) {}
+
+  void add(const Datum& datum, bool stddev) {
+    const std::string& data = datum.data();
+    if (data.size() != 0) {
+      // Integer sums vectorize well, they are flushed before they may overflow
+      const uint8_t* src = reinterpret_cast<const uint8_t*>(data.data());
+      const size_t size = sum8.size();
+      uint32_t* dst = sum8.data();
+      for (size_t i = 0; i < size; ++i) {
+        dst[i] += src[i];
+      }
+      if (stddev) {
+        uint32_t* dst_sq = sum_sq8.data();
+        for (size_t i = 0; i < size; ++i) {
+          dst_sq[i] += static_cast<uint32_t>(src[i]) * src[i];
+        }
+      }
+      if (++pending8 == kFlush) {
+        flush();
+      }
+    } else {
+      for (int i = 0; i < datum.float_data_size(); ++i) {
+        const double v = datum.float_data(i);
+        sum[i] += v;
+        sum_sq[i] += v * v;
+      }
+    }
+    ++count;
+  }
+
+  void flush() {
+    for (size_t i = 0; i < sum.size(); ++i) {
+      sum[i] += sum8[i];
+      sum_sq[i] += sum_sq8[i];
+    }
+    std::fill(sum8.begin(), sum8.end(), 0U);
+    std::fill(sum_sq8.begin(), sum_sq8.end(), 0U);
+    pending8 = 0U;
+  }
+
+  void merge(const Accumulator& other) {
+    for (size_t i = 0; i < sum.size(); ++i) {
+      sum[i] += other.sum[i];
+      sum_sq[i] += other.sum_sq[i];
+    }
+    count += other.count;
+  }
+
+  // 255^2 * 65536 fits to uint32
+  static constexpr unsigned int kFlush = 65536U;
+  std::vector<double> sum, sum_sq;
+  std::vector<uint32_t> sum8, sum_sq8;
+  unsigned int pending8;
+  int count;
+};
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -45,10 +112,10 @@ int main(int argc, char** argv) {
   unique_ptr<db::Cursor> cursor(db->NewCursor());
 
   BlobProto sum_blob;
-  int count = 0;
   // load first datum
   Datum datum;
   cursor->parse(&datum);
+  cursor.reset();
 
   if (DecodeDatumNative(&datum)) {
     LOG(INFO) << "Decoding Datum";
@@ -64,41 +131,57 @@ int main(int argc, char** argv) {
   for (int i = 0; i < size_in_datum; ++i) {
     sum_blob.add_data(0.);
   }
-  LOG(INFO) << "Starting Iteration";
-  while (cursor->valid()) {
-    Datum datum;
-    cursor->parse(&datum);
-    DecodeDatumNative(&datum);
-
-    const std::string& data = datum.data();
-    size_in_datum = std::max<int>(datum.data().size(),
-        datum.float_data_size());
-    CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-        size_in_datum;
-    if (data.size() != 0) {
-      CHECK_EQ(data.size(), size_in_datum);
-      for (int i = 0; i < size_in_datum; ++i) {
-        sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
+  const int threads = FLAGS_threads > 0 ? FLAGS_threads :
+      std::max(1U, std::thread::hardware_concurrency());
+  LOG(INFO) << "Starting Iteration, threads: " << threads;
+  std::vector<unique_ptr<Accumulator>> acc(threads);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    acc[t].reset(new Accumulator(size_in_datum));
+    workers.emplace_back([&, t]() {
+      unique_ptr<db::Cursor> cursor(db->NewCursor());
+      Accumulator& a = *acc[t];
+      Datum datum;
+      for (int k = 0; k < t && cursor->valid(); ++k) {
+        cursor->Next();
       }
-    } else {
-      CHECK_EQ(datum.float_data_size(), size_in_datum);
-      for (int i = 0; i < size_in_datum; ++i) {
-        sum_blob.set_data(i, sum_blob.data(i) +
-            static_cast<float>(datum.float_data(i)));
+      while (cursor->valid()) {
+        cursor->parse(&datum);
+        DecodeDatumNative(&datum);
+        const int size = std::max<int>(datum.data().size(), datum.float_data_size());
+        CHECK_EQ(size, data_size) << "Incorrect data field size " << size;
+        a.add(datum, FLAGS_stddev);
+        if (a.count % 10000 == 0) {
+          LOG(INFO) << "Thread " << t << " processed " << a.count << " files.";
+        }
+        for (int k = 0; k < threads && cursor->valid(); ++k) {
+          cursor->Next();
+        }
       }
+      a.flush();
+    });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  // Tree reduction: pairs of accumulators are merged in parallel
+  for (int step = 1; step < threads; step *= 2) {
+    workers.clear();
+    for (int t = 0; t + step < threads; t += 2 * step) {
+      workers.emplace_back([&, t, step]() {
+        acc[t]->merge(*acc[t + step]);
+      });
     }
-    ++count;
-    if (count % 10000 == 0) {
-      LOG(INFO) << "Processed " << count << " files.";
+    for (std::thread& worker : workers) {
+      worker.join();
     }
-    cursor->Next();
-  }
-
-  if (count % 10000 != 0) {
-    LOG(INFO) << "Processed " << count << " files.";
   }
+  const Accumulator& total = *acc[0];
+  const int count = total.count;
+  LOG(INFO) << "Processed " << count << " files.";
+  CHECK_GT(count, 0);
   for (int i = 0; i < sum_blob.data_size(); ++i) {
-    sum_blob.set_data(i, sum_blob.data(i) / count);
+    sum_blob.set_data(i, total.sum[i] / count);
   }
   // Write to disk
   if (argc == 3) {
@@ -107,13 +190,20 @@ int main(int argc, char** argv) {
   }
   const int channels = sum_blob.channels();
   const int dim = sum_blob.height() * sum_blob.width();
-  std::vector<float> mean_values(channels, 0.0);
   LOG(INFO) << "Number of channels: " << channels;
   for (int c = 0; c < channels; ++c) {
+    double mean = 0., mean_sq = 0.;
     for (int i = 0; i < dim; ++i) {
-      mean_values[c] += sum_blob.data(dim * c + i);
+      mean += total.sum[dim * c + i];
+      mean_sq += total.sum_sq[dim * c + i];
+    }
+    mean /= static_cast<double>(dim) * count;
+    mean_sq /= static_cast<double>(dim) * count;
+    LOG(INFO) << "mean_value channel [" << c << "]:" << mean;
+    if (FLAGS_stddev) {
+      LOG(INFO) << "stddev channel [" << c << "]:"
+          << std::sqrt(std::max(0., mean_sq - mean * mean));
     }
-    LOG(INFO) << "mean_value channel [" << c << "]:" << mean_values[c] / dim;
   }
   return 0;
 }
@@ -1,5 +1,6 @@
-// This program converts a set of images to a lmdb/leveldb by storing them
-// as Datum proto buffers.
+// This program converts a set of images to a lmdb/leveldb/record shards by storing them
+// as Datum proto buffers. With --rank_shards lmdb/leveldb output is split in databases
+// holding every N-th record (see caffe::db::RankShardsDB).
 // Usage:
 //   convert_imageset [FLAGS] ROOTFOLDER/ LISTFILE DB_NAME
 //
@@ -9,9 +10,13 @@
 //   ....
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>  // NOLINT(readability/streams)
+#include <future>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -20,6 +25,9 @@
 
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/db_lmdb.hpp"
+#include "caffe/util/db_rank_shards.hpp"
+#include "caffe/util/db_shards.hpp"
 #include "caffe/util/format.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/rng.hpp"
@@ -33,7 +41,13 @@ DEFINE_bool(gray, false,
 DEFINE_bool(shuffle, false,
     "Randomly shuffle the order of images and their labels");
 DEFINE_string(backend, "lmdb",
-        "The backend {lmdb, leveldb} for storing the result");
+        "The backend {lmdb, leveldb, shards} for storing the result");
+DEFINE_int32(shard_size_mb, 256,
+    "The size a shard is closed at when the backend is 'shards'");
+DEFINE_int32(rank_shards, 0,
+    "Optional: split lmdb/leveldb output in this many databases, record i going to "
+    "the i % rank_shards one. Data readers give every parser thread its own shards "
+    "when their number is a multiple of solvers x parser threads.");
 DEFINE_int32(resize_width, 0, "Width images are resized to");
 DEFINE_int32(resize_height, 0, "Height images are resized to");
 DEFINE_bool(check_size, false,
@@ -42,6 +56,25 @@ DEFINE_bool(encoded, false,
     "When this option is on, the encoded image will be save in datum");
 DEFINE_string(encode_type, "",
     "Optional: What type should we encode the image as ('png','jpg', ...).");
+DEFINE_int32(threads, 0,
+    "Threads reading, resizing and encoding images. 0 means one per core");
+DEFINE_int32(commit_size, 4096,
+    "Records written to the DB by one transaction");
+
+// Encoding of the image file given, or the one requested
+static string encoding(const string& fn, const string& encode_type) {
+  if (encode_type.size()) {
+    return encode_type;
+  }
+  size_t p = fn.rfind('.');
+  if (p == fn.npos) {
+    LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
+    return string();
+  }
+  string enc = fn.substr(p);
+  std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+  return enc;
+}
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -91,62 +124,123 @@ int main(int argc, char** argv) {
   int resize_width = std::max<int>(0, FLAGS_resize_width);
 
   // Create new DB
-  unique_ptr<db::DB> db(db::GetDB(FLAGS_backend));
+  unique_ptr<db::DB> db;
+  db::RankShardsDB* rank_shards = nullptr;
+  if (FLAGS_rank_shards > 0) {
+    CHECK(FLAGS_backend == "lmdb" || FLAGS_backend == "leveldb")
+        << "rank_shards needs lmdb or leveldb backend";
+    rank_shards = new db::RankShardsDB(FLAGS_backend == "lmdb" ?
+        DataParameter_DB_LMDB : DataParameter_DB_LEVELDB);
+    rank_shards->set_shards(FLAGS_rank_shards);
+    db.reset(rank_shards);
+  } else {
+    db.reset(db::GetDB(FLAGS_backend));
+  }
+  if (FLAGS_backend == "shards") {
+    static_cast<db::ShardsDB*>(db.get())->set_shard_size(
+        static_cast<size_t>(std::max(1, FLAGS_shard_size_mb)) << 20);
+  }
   db->Open(argv[3], db::NEW);
   unique_ptr<db::Transaction> txn(db->NewTransaction());
 
-  // Storing to db
-  std::string root_folder(argv[1]);
-  Datum datum;
-  int count = 0;
+  // Workers read, resize and encode one window of records while the previous
+  // one is being written. Records are written in the list order.
+  const std::string root_folder(argv[1]);
+  const size_t threads = FLAGS_threads > 0 ? FLAGS_threads :
+      std::max(1U, std::thread::hardware_concurrency());
+  const size_t window = std::max(1, FLAGS_commit_size);
+  LOG(INFO) << "Encoding threads: " << threads << ", records per commit: " << window;
+  std::vector<std::string> out[2];  // serialized records, empty if the image failed
+  out[0].resize(window);
+  out[1].resize(window);
+  std::future<void> writer;
+  size_t count = 0UL, bytes = 0UL;
   int data_size = 0;
   bool data_size_initialized = false;
-
-  for (int line_id = 0; line_id < lines.size(); ++line_id) {
-    bool status;
-    std::string enc = encode_type;
-    if (encoded && !enc.size()) {
-      // Guess the encoding type from the file name
-      string fn = lines[line_id].first;
-      size_t p = fn.rfind('.');
-      if ( p == fn.npos )
-        LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
-      enc = fn.substr(p);
-      std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+  const auto start = std::chrono::steady_clock::now();
+
+  auto write = [&](size_t begin, size_t end, std::vector<std::string>* records) {
+#ifdef USE_LMDB
+    if (count == 0UL && FLAGS_backend == "lmdb") {
+      // Average record of the first window predicts the whole DB. The map is
+      // sparse, thus it's safe to over-reserve.
+      size_t window_bytes = 0UL;
+      for (size_t i = 0; i < end - begin; ++i) {
+        window_bytes += (*records)[i].size();
+      }
+      const size_t shards = rank_shards != nullptr ? rank_shards->shards() : 1UL;
+      const size_t estimate = window_bytes / (end - begin) * lines.size() / shards;
+      for (size_t i = 0; i < shards; ++i) {
+        db::DB* lmdb = rank_shards != nullptr ? rank_shards->shard(i) : db.get();
+        static_cast<db::LMDB*>(lmdb)->reserve_map(estimate + estimate / 2UL + (64UL << 20));
+      }
     }
-    status = ReadImageToDatum(root_folder + lines[line_id].first,
-        lines[line_id].second, resize_height, resize_width, is_color,
-        enc, &datum);
-    if (status == false) continue;
-    if (check_size) {
-      if (!data_size_initialized) {
-        data_size = datum.channels() * datum.height() * datum.width();
-        data_size_initialized = true;
-      } else {
-        const std::string& data = datum.data();
-        CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
-            << data.size();
+#endif
+    for (size_t line_id = begin; line_id < end; ++line_id) {
+      std::string& record = (*records)[line_id - begin];
+      if (record.empty()) {
+        continue;
       }
+      if (check_size) {
+        Datum datum;
+        CHECK(datum.ParseFromString(record));
+        if (!data_size_initialized) {
+          data_size = datum.channels() * datum.height() * datum.width();
+          data_size_initialized = true;
+        } else {
+          const std::string& data = datum.data();
+          CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
+              << data.size();
+        }
+      }
+      // sequential
+      string key_str = caffe::format_int(line_id, 8) + "_" + lines[line_id].first;
+      bytes += record.size();
+      txn->Put(key_str, record);
+      ++count;
     }
-    // sequential
-    string key_str = caffe::format_int(line_id, 8) + "_" + lines[line_id].first;
-
-    // Put in db
-    string out;
-    CHECK(datum.SerializeToString(&out));
-    txn->Put(key_str, out);
-
-    if (++count % 1000 == 0) {
-      // Commit db
-      txn->Commit();
-      txn.reset(db->NewTransaction());
-      LOG(INFO) << "Processed " << count << " files.";
+    txn->Commit();
+    txn.reset(db->NewTransaction());
+    const double sec = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    LOG(INFO) << "Processed " << end << " of " << lines.size() << " files, "
+        << static_cast<size_t>(end / sec) << " files/s, "
+        << static_cast<size_t>((bytes >> 20) / sec) << " MB/s, ETA "
+        << static_cast<size_t>((lines.size() - end) * sec / end) << "s";
+  };
+
+  for (size_t begin = 0UL, w = 0UL; begin < lines.size(); begin += window, w ^= 1UL) {
+    const size_t end = std::min(lines.size(), begin + window);
+    std::vector<std::string>& records = out[w];
+    std::atomic<size_t> next(begin);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+      workers.emplace_back([&]() {
+        Datum datum;
+        for (size_t line_id = next++; line_id < end; line_id = next++) {
+          std::string& record = records[line_id - begin];
+          record.clear();
+          const std::string enc = encoded ?
+              encoding(lines[line_id].first, encode_type) : encode_type;
+          if (ReadImageToDatum(root_folder + lines[line_id].first,
+              lines[line_id].second, resize_height, resize_width, is_color,
+              enc, &datum)) {
+            CHECK(datum.SerializeToString(&record));
+          }
+        }
+      });
     }
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+    if (writer.valid()) {
+      writer.get();
+    }
+    writer = std::async(std::launch::async, write, begin, end, &records);
   }
-  // write the last batch
-  if (count % 1000 != 0) {
-    txn->Commit();
-    LOG(INFO) << "Processed " << count << " files.";
+  if (writer.valid()) {
+    writer.get();
   }
+  LOG(INFO) << "Stored " << count << " records, " << (bytes >> 20) << "MB";
   return 0;
 }
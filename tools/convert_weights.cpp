@@ -0,0 +1,54 @@
+// This is a script to convert a caffemodel to a weight file, which nets load
+// from a memory mapping (see caffe/util/weight_file.hpp).
+// Usage:
+//    convert_weights caffemodel_in weight_file_out
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+#include "caffe/util/weight_file.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3) {
+    LOG(ERROR) << "Usage: "
+        << "convert_weights caffemodel_in weight_file_out";
+    return 1;
+  }
+
+  NetParameter net_param;
+  string input_filename(argv[1]);
+  if (!ReadProtoFromBinaryFile(input_filename, &net_param)) {
+    LOG(ERROR) << "Failed to parse input binary file as NetParameter: "
+               << input_filename;
+    return 2;
+  }
+  if (NetNeedsUpgrade(net_param) && !UpgradeNetAsNeeded(input_filename, &net_param)) {
+    LOG(ERROR) << "Encountered error(s) while upgrading " << input_filename;
+    return 2;
+  }
+
+  WeightFileWriter writer(argv[2]);
+  int tensors = 0;
+  for (const LayerParameter& layer : net_param.layer()) {
+    for (int j = 0; j < layer.blobs_size(); ++j) {
+      const BlobProto& proto = layer.blobs(j);
+      // Stored in the type it was saved in
+      const Type type = proto.has_raw_data_type() ? proto.raw_data_type() :
+          (proto.double_data_size() > 0 ? DOUBLE : FLOAT);
+      shared_ptr<Blob> blob = Blob::create(type, type);
+      blob->FromProto(proto, true);
+      writer.Add(layer.name(), j, *blob);
+      ++tensors;
+    }
+  }
+  writer.Close();
+
+  LOG(INFO) << "Wrote " << tensors << " tensors to " << argv[2];
+  return 0;
+}
@@ -1,34 +1,407 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <google/protobuf/text_format.h>
 #include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
 #include "caffe/util/format.hpp"
+#include "caffe/util/gpu_memory.hpp"
+#include "caffe/util/hdf5.hpp"
 #include "caffe/util/io.hpp"
 
-using caffe::TBlob;
 using caffe::Blob;
+using caffe::BlockingQueue;
 using caffe::Caffe;
 using caffe::Datum;
 using caffe::Net;
+using caffe::shared_ptr;
+using caffe::vector;
 using std::string;
 namespace db = caffe::db;
+#ifndef CPU_ONLY
+using caffe::float16;
+using caffe::GPUMemory;
+#endif
+
+// Records per DB transaction
+static const int kCommitRecords = 1000;
+// Buffers per feature and replica: one is written out while the next batch fills the other
+static const int kSlotsPerFeature = 2;
+
+// One feature blob of one batch on its way from a net replica to its writer
+struct FeatureSlot {
+  size_t first;  // index of the batch's first sample
+  int num, channels, height, width;
+  vector<int> shape;
+  size_t dim, bytes, capacity;
+  void* host;  // pinned in GPU mode
+#ifndef CPU_ONLY
+  shared_ptr<GPUMemory::Workspace> staging;
+  cudaEvent_t staged, copied;
+#endif
+  BlockingQueue<int>* free;  // the slot goes back there once written
+};
+
+struct Options {
+  string pretrained, proto, format;
+  vector<string> blob_names;
+  int num_mini_batches;
+  vector<int> gpus;  // CPU if empty
+};
+
+// Drains the slots of one output, in arrival order. LMDB and LevelDB records are
+// keyed by sample index, the flat and HDF5 outputs are written at the sample's offset.
+class FeatureWriter {
+ public:
+  FeatureWriter(const string& blob_name, const string& path, bool gpu)
+      : blob_name_(blob_name), path_(path), samples_(0UL), gpu_(gpu), written_(0UL) {}
+  virtual ~FeatureWriter() {}
+
+  void Start(vector<FeatureSlot>* slots) {
+    thread_ = std::thread(&FeatureWriter::Run, this, slots);
+  }
+  void Push(int slot_id) {
+    queue_.push(slot_id);
+  }
+  // After all replicas are done
+  void Finish() {
+    queue_.push(-1);
+    thread_.join();
+    Close();
+    LOG(INFO) << "Extracted features of " << written_ << " query images for feature blob "
+              << blob_name_ << " to " << path_;
+  }
+
+ protected:
+  virtual void Write(const FeatureSlot& slot) = 0;
+  virtual void Close() {}
+
+  const string blob_name_, path_;
+  size_t samples_;  // one past the last sample written
+
+ private:
+  void Run(vector<FeatureSlot>* slots) {
+    while (true) {
+      const int slot_id = queue_.pop();
+      if (slot_id < 0) {
+        break;
+      }
+      FeatureSlot& slot = (*slots)[slot_id];
+#ifndef CPU_ONLY
+      if (gpu_) {
+        CUDA_CHECK(cudaEventSynchronize(slot.copied));
+      }
+#endif
+      Write(slot);
+      written_ += slot.num;
+      samples_ = std::max(samples_, slot.first + slot.num);
+      slot.free->push(slot_id);
+    }
+  }
+
+  const bool gpu_;
+  size_t written_;
+  BlockingQueue<int> queue_;
+  std::thread thread_;
+};
+
+class DbFeatureWriter : public FeatureWriter {
+ public:
+  DbFeatureWriter(const string& blob_name, const string& path, bool gpu,
+      const string& db_type)
+      : FeatureWriter(blob_name, path, gpu), db_(db::GetDB(db_type)), puts_(0) {
+    LOG(INFO) << "Opening dataset " << path;
+    db_->Open(path, db::NEW);
+    txn_.reset(db_->NewTransaction());
+  }
+
+ protected:
+  void Write(const FeatureSlot& slot) override {
+    const float* data = static_cast<const float*>(slot.host);
+    for (int n = 0; n < slot.num; ++n) {
+      datum_.set_height(slot.height);
+      datum_.set_width(slot.width);
+      datum_.set_channels(slot.channels);
+      datum_.clear_data();
+      datum_.clear_float_data();
+      for (size_t d = 0; d < slot.dim; ++d) {
+        datum_.add_float_data(data[n * slot.dim + d]);
+      }
+      CHECK(datum_.SerializeToString(&out_));
+      txn_->Put(caffe::format_int(slot.first + n, 10), out_);
+      if (++puts_ % kCommitRecords == 0) {
+        txn_->Commit();
+        txn_.reset(db_->NewTransaction());
+      }
+    }
+  }
+
+  void Close() override {
+    if (puts_ % kCommitRecords != 0) {
+      txn_->Commit();
+    }
+    txn_.reset();
+    db_->Close();
+  }
+
+ private:
+  shared_ptr<db::DB> db_;
+  shared_ptr<db::Transaction> txn_;
+  Datum datum_;
+  string out_;
+  size_t puts_;
+};
+
+// Raw float16 rows of dim values, shape written to <path>.shape as "N C H W"
+class Fp16FeatureWriter : public FeatureWriter {
+ public:
+  Fp16FeatureWriter(const string& blob_name, const string& path, bool gpu)
+      : FeatureWriter(blob_name, path, gpu), channels_(0), height_(0), width_(0) {
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK_GE(fd_, 0) << "Failed to open " << path << ": " << std::strerror(errno);
+  }
+
+ protected:
+  void Write(const FeatureSlot& slot) override {
+    const off_t offset = static_cast<off_t>(slot.first * slot.dim * 2UL);
+    CHECK_EQ(pwrite(fd_, slot.host, slot.bytes, offset), static_cast<ssize_t>(slot.bytes))
+        << "Failed to write " << path_ << ": " << std::strerror(errno);
+    channels_ = slot.channels;
+    height_ = slot.height;
+    width_ = slot.width;
+  }
+
+  void Close() override {
+    CHECK_EQ(close(fd_), 0) << std::strerror(errno);
+    std::ofstream shape(path_ + ".shape");
+    shape << samples_ << " " << channels_ << " " << height_ << " " << width_ << "\n";
+    CHECK(shape.good()) << "Failed to write " << path_ << ".shape";
+  }
+
+ private:
+  int fd_;
+  int channels_, height_, width_;
+};
+
+// A float dataset named after the blob, chunked by batch and extended as batches arrive
+class Hdf5FeatureWriter : public FeatureWriter {
+ public:
+  Hdf5FeatureWriter(const string& blob_name, const string& path, bool gpu)
+      : FeatureWriter(blob_name, path, gpu), file_(-1), dataset_(-1), extent_(0UL) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_ = H5Fcreate(path.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    CHECK_GE(file_, 0) << "Failed to create HDF5 file " << path;
+  }
+
+ protected:
+  void Write(const FeatureSlot& slot) override {
+    // The library is not built thread safe
+    std::lock_guard<std::mutex> lock(mutex_);
+    vector<hsize_t> start(slot.shape.size(), 0), count(slot.shape.begin(), slot.shape.end());
+    const size_t end = slot.first + slot.num;
+    if (dataset_ < 0) {
+      vector<hsize_t> dims(count), max_dims(count);
+      dims[0] = end;
+      max_dims[0] = H5S_UNLIMITED;
+      const hid_t space = H5Screate_simple(dims.size(), dims.data(), max_dims.data());
+      const hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+      CHECK_GE(H5Pset_chunk(plist, count.size(), count.data()), 0);
+      dataset_ = H5Dcreate2(file_, blob_name_.c_str(), H5T_NATIVE_FLOAT, space,
+          H5P_DEFAULT, plist, H5P_DEFAULT);
+      CHECK_GE(dataset_, 0) << "Failed to create dataset " << blob_name_ << " in " << path_;
+      H5Pclose(plist);
+      H5Sclose(space);
+      extent_ = end;
+    } else if (end > extent_) {
+      vector<hsize_t> dims(count);
+      dims[0] = end;
+      CHECK_GE(H5Dset_extent(dataset_, dims.data()), 0) << "Failed to extend " << blob_name_;
+      extent_ = end;
+    }
+    start[0] = slot.first;
+    const hid_t file_space = H5Dget_space(dataset_);
+    CHECK_GE(H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start.data(), nullptr,
+        count.data(), nullptr), 0);
+    const hid_t mem_space = H5Screate_simple(count.size(), count.data(), nullptr);
+    CHECK_GE(H5Dwrite(dataset_, H5T_NATIVE_FLOAT, mem_space, file_space, H5P_DEFAULT,
+        slot.host), 0) << "Failed to write " << path_;
+    H5Sclose(mem_space);
+    H5Sclose(file_space);
+  }
+
+  void Close() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (dataset_ >= 0) {
+      H5Dclose(dataset_);
+    }
+    H5Fclose(file_);
+  }
+
+ private:
+  static std::mutex mutex_;
+  hid_t file_, dataset_;
+  size_t extent_;
+};
+
+std::mutex Hdf5FeatureWriter::mutex_;
+
+static int slot_id(int rank, size_t feature, int k, size_t num_features) {
+  return (rank * num_features + feature) * kSlotsPerFeature + k;
+}
+
+static void reserve_slot(FeatureSlot* slot, size_t bytes, bool gpu) {
+  if (bytes <= slot->capacity) {
+    return;
+  }
+#ifndef CPU_ONLY
+  if (gpu) {
+    if (slot->host != nullptr) {
+      CUDA_CHECK(cudaFreeHost(slot->host));
+    }
+    CUDA_CHECK(cudaMallocHost(&slot->host, bytes));
+    slot->staging.reset(new GPUMemory::Workspace(bytes));
+    slot->capacity = bytes;
+    return;
+  }
+#endif
+  free(slot->host);
+  slot->host = malloc(bytes);
+  CHECK_NOTNULL(slot->host);
+  slot->capacity = bytes;
+}
+
+// One net replica per GPU. Rank r runs batches r, r + ranks, ... which is the share its
+// data layers read. Blobs are staged on the device so the next Forward can overwrite
+// them while the copy to the host runs on a separate stream.
+static void ExtractOnReplica(const Options& opt, int rank, vector<FeatureSlot>* slots,
+    const vector<shared_ptr<FeatureWriter>>& writers) {
+  const bool gpu = !opt.gpus.empty();
+  const int ranks = gpu ? opt.gpus.size() : 1;
+  if (gpu) {
+    Caffe::SetDevice(opt.gpus[rank]);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    Caffe::set_mode(Caffe::CPU);
+  }
+  Caffe::set_solver_count(ranks);
+  Caffe::set_root_solver(rank == 0);
+  Net net(opt.proto, caffe::TEST, rank);
+  net.CopyTrainedLayersFrom(opt.pretrained);
+  const size_t num_features = opt.blob_names.size();
+  const bool fp16 = opt.format == "fp16";
+
+  vector<shared_ptr<BlockingQueue<int>>> free_slots(num_features);
+  for (size_t i = 0; i < num_features; ++i) {
+    CHECK(net.has_blob(opt.blob_names[i])) << "Unknown feature blob name "
+        << opt.blob_names[i] << " in the network " << opt.proto;
+    free_slots[i] = caffe::make_shared<BlockingQueue<int>>();
+    for (int k = 0; k < kSlotsPerFeature; ++k) {
+      const int id = slot_id(rank, i, k, num_features);
+      FeatureSlot& slot = (*slots)[id];
+      slot.host = nullptr;
+      slot.capacity = 0UL;
+      slot.free = free_slots[i].get();
+#ifndef CPU_ONLY
+      if (gpu) {
+        CUDA_CHECK(cudaEventCreateWithFlags(&slot.staged, cudaEventDisableTiming));
+        CUDA_CHECK(cudaEventCreateWithFlags(&slot.copied, cudaEventDisableTiming));
+      }
+#endif
+      free_slots[i]->push(id);
+    }
+  }
+#ifndef CPU_ONLY
+  cudaStream_t copy_stream = nullptr;
+  if (gpu) {
+    CUDA_CHECK(cudaStreamCreateWithFlags(&copy_stream, cudaStreamNonBlocking));
+  }
+#endif
+
+  for (int batch_index = rank; batch_index < opt.num_mini_batches; batch_index += ranks) {
+    net.Forward();
+    for (size_t i = 0; i < num_features; ++i) {
+      const shared_ptr<Blob> blob = net.blob_by_name(opt.blob_names[i]);
+      // Waits for the writer while both buffers are in flight
+      const int id = free_slots[i]->pop();
+      FeatureSlot& slot = (*slots)[id];
+      slot.num = blob->num();
+      slot.channels = blob->channels();
+      slot.height = blob->height();
+      slot.width = blob->width();
+      slot.shape = blob->shape();
+      slot.first = static_cast<size_t>(batch_index) * slot.num;
+      slot.dim = blob->count() / slot.num;
+      slot.bytes = blob->count() * (fp16 ? 2UL : sizeof(float));
+      reserve_slot(&slot, slot.bytes, gpu);
+#ifndef CPU_ONLY
+      if (gpu) {
+        cudaStream_t stream = Caffe::thread_stream();
+        const void* src = fp16 ? static_cast<const void*>(blob->gpu_data<float16>()) :
+            static_cast<const void*>(blob->gpu_data<float>());
+        CUDA_CHECK(cudaMemcpyAsync(slot.staging->data(), src, slot.bytes,
+            cudaMemcpyDeviceToDevice, stream));
+        CUDA_CHECK(cudaEventRecord(slot.staged, stream));
+        CUDA_CHECK(cudaStreamWaitEvent(copy_stream, slot.staged, 0));
+        CUDA_CHECK(cudaMemcpyAsync(slot.host, slot.staging->data(), slot.bytes,
+            cudaMemcpyDeviceToHost, copy_stream));
+        CUDA_CHECK(cudaEventRecord(slot.copied, copy_stream));
+      } else {
+        std::memcpy(slot.host, blob->cpu_data<float>(), slot.bytes);
+      }
+#else
+      std::memcpy(slot.host, blob->cpu_data<float>(), slot.bytes);
+#endif
+      writers[i]->Push(id);
+    }
+  }
+
+  // Every slot comes back once written
+  for (size_t i = 0; i < num_features; ++i) {
+    for (int k = 0; k < kSlotsPerFeature; ++k) {
+      FeatureSlot& slot = (*slots)[free_slots[i]->pop()];
+#ifndef CPU_ONLY
+      if (gpu) {
+        if (slot.host != nullptr) {
+          CUDA_CHECK(cudaFreeHost(slot.host));
+        }
+        slot.staging.reset();
+        CUDA_CHECK(cudaEventDestroy(slot.staged));
+        CUDA_CHECK(cudaEventDestroy(slot.copied));
+        continue;
+      }
+#endif
+      free(slot.host);
+    }
+  }
+#ifndef CPU_ONLY
+  if (gpu) {
+    CUDA_CHECK(cudaStreamDestroy(copy_stream));
+  }
+#endif
+}
 
-template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv);
 
 int main(int argc, char** argv) {
-  return feature_extraction_pipeline<float>(argc, argv);
-//  return feature_extraction_pipeline<double>(argc, argv);
+  return feature_extraction_pipeline(argc, argv);
 }
 
-template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
   const int num_required_args = 7;
@@ -39,32 +412,39 @@ int feature_extraction_pipeline(int argc, char** argv) {
     "Usage: extract_features  pretrained_net_param"
     "  feature_extraction_proto_file  extract_feature_blob_name1[,name2, ...]"
     "  save_feature_dataset_name1[,name2, ...]  num_mini_batches  db_type"
-    "  [CPU/GPU] [DEVICE_ID=0]\n"
+    "  [CPU/GPU] [DEVICE_ID=0[,DEVICE_ID, ...]]\n"
     "Note: you can extract multiple features in one pass by specifying"
     " multiple feature blob names and dataset names separated by ', '."
     " The names cannot contain white space characters and the number of blobs"
-    " and datasets must be equal.";
+    " and datasets must be equal.\n"
+    "db_type is lmdb or leveldb for Datums keyed by image index, fp16 for flat"
+    " float16 rows (shape in <dataset>.shape) or hdf5 for a float dataset named"
+    " after the blob. With several devices every one runs its own replica of the"
+    " net on its share of the batches.";
     return 1;
   }
+  Options opt;
   int arg_pos = num_required_args;
-
-  arg_pos = num_required_args;
   if (argc > arg_pos && strcmp(argv[arg_pos], "GPU") == 0) {
     LOG(ERROR)<< "Using GPU";
-    int device_id = 0;
+    vector<string> ids{"0"};
     if (argc > arg_pos + 1) {
-      device_id = atoi(argv[arg_pos + 1]);
-      CHECK_GE(device_id, 0);
+      boost::split(ids, argv[arg_pos + 1], boost::is_any_of(","));
+    }
+    for (const string& id : ids) {
+      opt.gpus.push_back(boost::lexical_cast<int>(id));
+      CHECK_GE(opt.gpus.back(), 0);
+      LOG(ERROR) << "Using Device_id=" << opt.gpus.back();
     }
-    LOG(ERROR) << "Using Device_id=" << device_id;
-    Caffe::set_mode(Caffe::GPU);
   } else {
     LOG(ERROR) << "Using CPU";
-    Caffe::set_mode(Caffe::CPU);
   }
+#ifdef CPU_ONLY
+  CHECK(opt.gpus.empty()) << "Built with CPU_ONLY";
+#endif
 
   arg_pos = 0;  // the name of the executable
-  std::string pretrained_binary_proto(argv[++arg_pos]);
+  opt.pretrained = argv[++arg_pos];
 
   // Expected prototxt contains at least one data layer such as
   //  the layer data_layer_name and one feature blob such as the
@@ -93,89 +473,61 @@ int feature_extraction_pipeline(int argc, char** argv) {
      top: "fc7"
    }
    */
-  std::string feature_extraction_proto(argv[++arg_pos]);
-  boost::shared_ptr<Net> feature_extraction_net(
-      new Net(feature_extraction_proto, caffe::TEST));
-  feature_extraction_net->CopyTrainedLayersFrom(pretrained_binary_proto);
+  opt.proto = argv[++arg_pos];
 
   std::string extract_feature_blob_names(argv[++arg_pos]);
-  std::vector<std::string> blob_names;
-  boost::split(blob_names, extract_feature_blob_names, boost::is_any_of(", "));
+  boost::split(opt.blob_names, extract_feature_blob_names, boost::is_any_of(", "));
 
   std::string save_feature_dataset_names(argv[++arg_pos]);
   std::vector<std::string> dataset_names;
   boost::split(dataset_names, save_feature_dataset_names,
                boost::is_any_of(", "));
-  CHECK_EQ(blob_names.size(), dataset_names.size()) <<
+  CHECK_EQ(opt.blob_names.size(), dataset_names.size()) <<
       " the number of blob names and dataset names must be equal";
-  size_t num_features = blob_names.size();
-
-  for (size_t i = 0; i < num_features; i++) {
-    CHECK(feature_extraction_net->has_blob(blob_names[i]))
-        << "Unknown feature blob name " << blob_names[i]
-        << " in the network " << feature_extraction_proto;
-  }
+  const size_t num_features = opt.blob_names.size();
 
-  int num_mini_batches = atoi(argv[++arg_pos]);
+  opt.num_mini_batches = atoi(argv[++arg_pos]);
+  opt.format = argv[++arg_pos];
+#ifdef CPU_ONLY
+  CHECK_NE(opt.format, "fp16") << "fp16 output needs a GPU build";
+#else
+  CHECK(opt.format != "fp16" || !opt.gpus.empty()) << "fp16 output needs GPU mode";
+#endif
 
-  std::vector<boost::shared_ptr<db::DB> > feature_dbs;
-  std::vector<boost::shared_ptr<db::Transaction> > txns;
-  const char* db_type = argv[++arg_pos];
+  const bool gpu = !opt.gpus.empty();
+  vector<shared_ptr<FeatureWriter>> writers(num_features);
   for (size_t i = 0; i < num_features; ++i) {
-    LOG(INFO)<< "Opening dataset " << dataset_names[i];
-    boost::shared_ptr<db::DB> db(db::GetDB(db_type));
-    db->Open(dataset_names.at(i), db::NEW);
-    feature_dbs.push_back(db);
-    boost::shared_ptr<db::Transaction> txn(db->NewTransaction());
-    txns.push_back(txn);
+    if (opt.format == "fp16") {
+      writers[i].reset(new Fp16FeatureWriter(opt.blob_names[i], dataset_names[i], gpu));
+    } else if (opt.format == "hdf5") {
+      writers[i].reset(new Hdf5FeatureWriter(opt.blob_names[i], dataset_names[i], gpu));
+    } else {
+      writers[i].reset(new DbFeatureWriter(opt.blob_names[i], dataset_names[i], gpu,
+          opt.format));
+    }
   }
 
   LOG(ERROR)<< "Extacting Features";
-
-  Datum datum;
-  std::vector<int> image_indices(num_features, 0);
-  for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index) {
-    feature_extraction_net->Forward();
-    for (int i = 0; i < num_features; ++i) {
-      const boost::shared_ptr<Blob> feature_blob =
-        feature_extraction_net->blob_by_name(blob_names[i]);
-      int batch_size = feature_blob->num();
-      int dim_features = feature_blob->count() / batch_size;
-      const Dtype* feature_blob_data;
-      for (int n = 0; n < batch_size; ++n) {
-        datum.set_height(feature_blob->height());
-        datum.set_width(feature_blob->width());
-        datum.set_channels(feature_blob->channels());
-        datum.clear_data();
-        datum.clear_float_data();
-        feature_blob_data = feature_blob->cpu_data<Dtype>() +
-            feature_blob->offset(n);
-        for (int d = 0; d < dim_features; ++d) {
-          datum.add_float_data(feature_blob_data[d]);
-        }
-        string key_str = caffe::format_int(image_indices[i], 10);
-
-        string out;
-        CHECK(datum.SerializeToString(&out));
-        txns.at(i)->Put(key_str, out);
-        ++image_indices[i];
-        if (image_indices[i] % 1000 == 0) {
-          txns.at(i)->Commit();
-          txns.at(i).reset(feature_dbs.at(i)->NewTransaction());
-          LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-              " query images for feature blob " << blob_names[i];
-        }
-      }  // for (int n = 0; n < batch_size; ++n)
-    }  // for (int i = 0; i < num_features; ++i)
-  }  // for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index)
-  // write the last batch
-  for (int i = 0; i < num_features; ++i) {
-    if (image_indices[i] % 1000 != 0) {
-      txns.at(i)->Commit();
+  const int ranks = gpu ? opt.gpus.size() : 1;
+  vector<FeatureSlot> slots(ranks * num_features * kSlotsPerFeature);
+  for (const shared_ptr<FeatureWriter>& writer : writers) {
+    writer->Start(&slots);
+  }
+  {
+#ifndef CPU_ONLY
+    GPUMemory::Scope gpu_memory_scope(opt.gpus);
+#endif
+    vector<std::thread> replicas;
+    for (int rank = 0; rank < ranks; ++rank) {
+      replicas.emplace_back(ExtractOnReplica, std::cref(opt), rank, &slots,
+          std::cref(writers));
     }
-    LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-        " query images for feature blob " << blob_names[i];
-    feature_dbs.at(i)->Close();
+    for (std::thread& replica : replicas) {
+      replica.join();
+    }
+  }
+  for (const shared_ptr<FeatureWriter>& writer : writers) {
+    writer->Finish();
   }
 
   LOG(ERROR)<< "Successfully extracted the features!";
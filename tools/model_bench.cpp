@@ -0,0 +1,379 @@
+// Model zoo throughput benchmarks on synthetic data, results as JSON for comparison
+// between builds.
+// usage: model_bench [--models=models/resnet50/solver.prototxt,...] [--modes=train,inference]
+//                    [--types=FLOAT,FLOAT16] [--batch_sizes=32,64] [--gpu_counts=1,8]
+//                    [--gpu=0,1,...] [--iterations=50] [--warmup=10] [--label=<commit>]
+//                    [--output=models.json]
+//
+// Every configuration runs in a child process of its own, so that its startup time
+// includes CUDA initialization, its peak memory is its own, and running out of memory
+// only fails that configuration. The parent never initializes CUDA.
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+
+#include "caffe/caffe.hpp"
+#include "caffe/parallel.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using caffe::Caffe;
+using caffe::CPUTimer;
+using caffe::string;
+using caffe::vector;
+
+DEFINE_string(models, "models/resnet50/solver.prototxt,models/resnet18/solver.prototxt,"
+    "models/inception_v3/solver.prototxt,models/alexnet_bn/solver.prototxt,"
+    "models/bvlc_googlenet/solver.prototxt",
+    "Solvers of the models to run, separated by ','. Their nets' data layers are "
+    "replaced by DummyData.");
+DEFINE_string(modes, "train",
+    "Separated by ',': train (solver iterations, data parallel over the GPUs) and/or "
+    "inference (TEST phase forward passes on one GPU).");
+DEFINE_string(types, "FLOAT,FLOAT16",
+    "NetParameter default_forward_type and default_backward_type to run with, "
+    "separated by ','. Math types are left as the model has them.");
+DEFINE_string(batch_sizes, "64",
+    "Batch sizes per GPU, separated by ','.");
+DEFINE_string(gpu_counts, "1",
+    "Numbers of GPUs training runs on, separated by ','. Inference runs on one.");
+DEFINE_string(gpu, "",
+    "Optional; devices separated by ',', the first ones are used. 0, 1, ... otherwise.");
+DEFINE_string(input_shape, "3,224,224",
+    "Channels, height and width of synthetic images; the data layer's crop_size "
+    "replaces height and width when set.");
+DEFINE_int32(iterations, 50,
+    "Timed iterations of every configuration.");
+DEFINE_int32(warmup, 10,
+    "Iterations run before the timed ones, the first one included in startup time.");
+DEFINE_string(label, "",
+    "Optional; build identifier written to the report, e.g. a commit hash.");
+DEFINE_string(output, "",
+    "Optional; JSON file to write the report to, stdout otherwise.");
+// Internal: one configuration, run by a child process
+DEFINE_bool(run, false, "");
+DEFINE_string(model, "", "");
+DEFINE_string(mode, "", "");
+DEFINE_string(type, "", "");
+DEFINE_int32(batch_size, 0, "");
+DEFINE_int32(gpu_count, 0, "");
+DEFINE_string(result, "", "");
+
+static vector<string> split(const string& list) {
+  vector<string> items;
+  boost::split(items, list, boost::is_any_of(", "), boost::token_compress_on);
+  items.erase(std::remove(items.begin(), items.end(), string()), items.end());
+  return items;
+}
+
+static vector<int> split_ints(const string& list) {
+  vector<int> values;
+  for (const string& item : split(list)) {
+    values.push_back(std::stoi(item));
+  }
+  return values;
+}
+
+static bool is_data_layer(const caffe::LayerParameter& layer) {
+  const string& type = layer.type();
+  return type.size() > 4 && type.compare(type.size() - 4, 4, "Data") == 0 &&
+      type != "DummyData";
+}
+
+// Data layers become DummyData layers of the same tops and phase rules: images of
+// --input_shape (or crop_size) and labels, constant so that nothing is refilled.
+static void SubstituteDummyData(caffe::NetParameter* net_param, int batch_size) {
+  const vector<int> input_shape = split_ints(FLAGS_input_shape);
+  CHECK_EQ(input_shape.size(), 3UL) << "--input_shape needs channels, height and width";
+  for (int i = 0; i < net_param->layer_size(); ++i) {
+    caffe::LayerParameter* layer = net_param->mutable_layer(i);
+    if (!is_data_layer(*layer)) {
+      continue;
+    }
+    caffe::LayerParameter dummy;
+    dummy.set_name(layer->name());
+    dummy.set_type("DummyData");
+    dummy.mutable_top()->CopyFrom(layer->top());
+    dummy.mutable_include()->CopyFrom(layer->include());
+    dummy.mutable_exclude()->CopyFrom(layer->exclude());
+    const int crop = layer->transform_param().crop_size();
+    caffe::DummyDataParameter* param = dummy.mutable_dummy_data_param();
+    for (int t = 0; t < layer->top_size(); ++t) {
+      caffe::BlobShape* shape = param->add_shape();
+      shape->add_dim(batch_size);
+      if (t == 0) {
+        shape->add_dim(input_shape[0]);
+        shape->add_dim(crop > 0 ? crop : input_shape[1]);
+        shape->add_dim(crop > 0 ? crop : input_shape[2]);
+      }
+    }
+    layer->Swap(&dummy);
+  }
+}
+
+static void Percentiles(vector<double> seconds, std::ostream& out) {
+  CHECK(!seconds.empty());
+  std::sort(seconds.begin(), seconds.end());
+  auto at = [&](double p) {
+    const size_t rank = static_cast<size_t>(p * seconds.size() + 0.5);
+    return 1000. * seconds[std::min(std::max(rank, size_t(1)), seconds.size()) - 1];
+  };
+  const double mean = std::accumulate(seconds.begin(), seconds.end(), 0.) / seconds.size();
+  out << "\"latency_ms\": {\"mean\": " << 1000. * mean << ", \"p50\": " << at(0.5)
+      << ", \"p90\": " << at(0.9) << ", \"p99\": " << at(0.99) << ", \"max\": "
+      << 1000. * seconds.back() << "}";
+}
+
+#ifndef CPU_ONLY
+static size_t PeakMemory(const vector<int>& gpus) {
+  size_t peak = 0UL;
+  for (int gpu : gpus) {
+    size_t in_use, gpu_peak;
+    caffe::GPUMemory::GetUsage(&in_use, &gpu_peak, gpu);
+    peak = std::max(peak, gpu_peak);
+  }
+  return peak;
+}
+
+// Solver iterations on all the GPUs. Iteration times are those the root solver
+// samples every iteration (SolverParameter::metrics_interval).
+static void RunTrain(caffe::SolverParameter solver_param, const vector<int>& gpus,
+    std::ostream& out) {
+  const string metrics_file = FLAGS_result + ".metrics";
+  std::remove(metrics_file.c_str());
+  solver_param.set_max_iter(FLAGS_warmup + FLAGS_iterations);
+  solver_param.clear_test_iter();
+  solver_param.set_test_interval(0);
+  solver_param.set_test_initialization(false);
+  solver_param.set_display(0);
+  solver_param.set_snapshot(0);
+  solver_param.set_snapshot_after_train(false);
+  solver_param.set_metrics_interval(1);
+  solver_param.set_metrics_file(metrics_file);
+  solver_param.clear_metrics_port();
+  solver_param.set_device_id(gpus[0]);
+  solver_param.set_solver_mode(caffe::SolverParameter_SolverMode_GPU);
+  solver_param.set_random_seed(1371LL);
+  Caffe::SetDevice(gpus[0]);
+  Caffe::set_mode(Caffe::GPU);
+  Caffe::set_gpus(gpus);
+  Caffe::set_solver_count(gpus.size());
+  CPUTimer timer;
+  timer.Start();
+  caffe::shared_ptr<caffe::Solver> solver(
+      caffe::SolverRegistry::CreateSolver(solver_param, nullptr, 0));
+  const double setup_s = timer.Seconds();
+  if (gpus.size() > 1) {
+    caffe::P2PManager p2p_mgr(solver, gpus.size(), solver->param());
+    p2p_mgr.Run(gpus);
+  } else {
+    solver->Solve();
+  }
+  vector<double> seconds;
+  std::ifstream metrics(metrics_file.c_str());
+  const string key = "\"iteration_s\": ";
+  for (string line; std::getline(metrics, line); ) {
+    const size_t pos = line.find(key);
+    if (pos != string::npos) {
+      seconds.push_back(std::stod(line.substr(pos + key.size())));
+    }
+  }
+  std::remove(metrics_file.c_str());
+  CHECK_EQ(seconds.size(), static_cast<size_t>(FLAGS_warmup + FLAGS_iterations))
+      << "Iterations missing in " << metrics_file;
+  const double startup_s = setup_s + seconds[0];
+  seconds.erase(seconds.begin(), seconds.begin() + FLAGS_warmup);
+  const double mean = std::accumulate(seconds.begin(), seconds.end(), 0.) / seconds.size();
+  out << "\"images_per_s\": " << FLAGS_batch_size * gpus.size() / mean << ", ";
+  Percentiles(seconds, out);
+  out << ", \"peak_memory_bytes\": " << PeakMemory(gpus) << ", \"startup_s\": " << startup_s;
+}
+
+// TEST phase forward passes, each waited for
+static void RunInference(caffe::NetParameter net_param, int gpu, std::ostream& out) {
+  net_param.mutable_state()->set_phase(caffe::TEST);
+  Caffe::SetDevice(gpu);
+  Caffe::set_mode(Caffe::GPU);
+  CPUTimer timer;
+  timer.Start();
+  caffe::Net net(net_param);
+  net.Forward();
+  CUDA_CHECK(cudaDeviceSynchronize());
+  const double startup_s = timer.Seconds();
+  for (int i = 1; i < FLAGS_warmup; ++i) {
+    net.Forward();
+  }
+  CUDA_CHECK(cudaDeviceSynchronize());
+  vector<double> seconds;
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    timer.Start();
+    net.Forward();
+    CUDA_CHECK(cudaDeviceSynchronize());
+    seconds.push_back(timer.Seconds());
+  }
+  const double mean = std::accumulate(seconds.begin(), seconds.end(), 0.) / seconds.size();
+  out << "\"images_per_s\": " << FLAGS_batch_size / mean << ", ";
+  Percentiles(seconds, out);
+  out << ", \"peak_memory_bytes\": " << PeakMemory(vector<int>(1, gpu))
+      << ", \"startup_s\": " << startup_s;
+}
+#endif
+
+// --run: the configuration given by --model, --mode, --type, --batch_size and
+// --gpu_count, measurements written to --result
+static int RunOne() {
+#ifndef CPU_ONLY
+  CHECK_GT(FLAGS_iterations, 0);
+  CHECK_GT(FLAGS_warmup, 0) << "The first iteration is startup, at least one is needed";
+  caffe::SolverParameter solver_param = caffe::ReadSolverParamsFromTextFileOrDie(FLAGS_model);
+  caffe::NetParameter net_param;
+  if (solver_param.has_net_param()) {
+    net_param = solver_param.net_param();
+  } else if (solver_param.has_train_net_param()) {
+    net_param = solver_param.train_net_param();
+  } else {
+    const string& file = solver_param.has_net() ? solver_param.net() : solver_param.train_net();
+    CHECK(!file.empty()) << FLAGS_model << " has no net";
+    caffe::ReadNetParamsFromTextFileOrDie(file, &net_param);
+  }
+  SubstituteDummyData(&net_param, FLAGS_batch_size);
+  caffe::Type type;
+  CHECK(caffe::Type_Parse(boost::to_upper_copy(FLAGS_type), &type)) << "Unknown type "
+      << FLAGS_type;
+  net_param.set_default_forward_type(type);
+  net_param.set_default_backward_type(type);
+  solver_param.clear_net();
+  solver_param.clear_train_net();
+  solver_param.clear_train_net_param();
+  solver_param.clear_test_net();
+  solver_param.clear_test_net_param();
+  solver_param.clear_test_state();
+  *solver_param.mutable_net_param() = net_param;
+
+  vector<int> gpus = split_ints(FLAGS_gpu);
+  if (gpus.empty()) {
+    for (int i = 0; i < FLAGS_gpu_count; ++i) {
+      gpus.push_back(i);
+    }
+  }
+  CHECK_GE(gpus.size(), static_cast<size_t>(FLAGS_gpu_count)) << "Fewer GPUs than --gpu_count";
+  gpus.resize(FLAGS_gpu_count);
+  caffe::GPUMemory::Scope gpu_memory_scope(gpus);
+  std::ostringstream out;
+  out.precision(6);
+  if (FLAGS_mode == "train") {
+    RunTrain(solver_param, gpus, out);
+  } else {
+    CHECK_EQ(FLAGS_mode, "inference") << "Unknown mode";
+    RunInference(net_param, gpus[0], out);
+  }
+  std::ofstream result(FLAGS_result.c_str());
+  result << out.str();
+  CHECK(result.good()) << "Can't write " << FLAGS_result;
+  return 0;
+#else
+  LOG(FATAL) << "model_bench needs GPUs";
+  return 1;
+#endif
+}
+
+// Runs this tool again with the arguments given, returns its exit status
+static int RunChild(const vector<string>& args) {
+  vector<char*> argv;
+  for (const string& arg : args) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+  const pid_t pid = fork();
+  CHECK_GE(pid, 0) << "fork failed";
+  if (pid == 0) {
+    execv("/proc/self/exe", argv.data());
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+  int status = 0;
+  CHECK_EQ(pid, waitpid(pid, &status, 0));
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;
+  gflags::SetUsageMessage("Model zoo throughput on synthetic data\n"
+      "usage: model_bench [FLAGS]");
+  const string self = argv[0];
+  caffe::GlobalInit(&argc, &argv);
+  if (FLAGS_run) {
+    return RunOne();
+  }
+
+  char result_template[] = "/tmp/model_bench.XXXXXX";
+  const int fd = mkstemp(result_template);
+  CHECK_GE(fd, 0) << "Can't create a temporary file";
+  close(fd);
+  const string result_file = result_template;
+  std::ostringstream json;
+  json << "{\"label\": \"" << FLAGS_label << "\", \"iterations\": " << FLAGS_iterations
+       << ", \"warmup\": " << FLAGS_warmup << ", \"results\": [";
+  int runs = 0, failures = 0;
+  for (const string& model : split(FLAGS_models)) {
+    for (const string& mode : split(FLAGS_modes)) {
+      for (const string& type : split(FLAGS_types)) {
+        for (int batch_size : split_ints(FLAGS_batch_sizes)) {
+          for (int gpu_count : split_ints(FLAGS_gpu_counts)) {
+            if (mode == "inference" && gpu_count != 1) {
+              continue;
+            }
+            std::ostringstream config;
+            config << "\"model\": \"" << model << "\", \"mode\": \"" << mode
+                   << "\", \"type\": \"" << type << "\", \"batch_per_gpu\": " << batch_size
+                   << ", \"gpus\": " << gpu_count;
+            LOG(INFO) << "Running " << config.str();
+            std::ofstream(result_file.c_str(), std::ios::trunc);
+            const int status = RunChild({self, "--run", "--model=" + model, "--mode=" + mode,
+                "--type=" + type, "--batch_size=" + std::to_string(batch_size),
+                "--gpu_count=" + std::to_string(gpu_count), "--gpu=" + FLAGS_gpu,
+                "--input_shape=" + FLAGS_input_shape,
+                "--iterations=" + std::to_string(FLAGS_iterations),
+                "--warmup=" + std::to_string(FLAGS_warmup), "--result=" + result_file});
+            std::ifstream in(result_file.c_str());
+            const string result((std::istreambuf_iterator<char>(in)),
+                std::istreambuf_iterator<char>());
+            json << (runs++ > 0 ? ",\n" : "\n") << "  {" << config.str() << ", \"status\": "
+                 << status;
+            if (status == 0 && !result.empty()) {
+              json << ", " << result;
+            } else {
+              ++failures;
+              LOG(ERROR) << "Failed with status " << status << ": " << config.str();
+            }
+            json << "}";
+          }
+        }
+      }
+    }
+  }
+  json << "\n]}\n";
+  std::remove(result_file.c_str());
+  if (FLAGS_output.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream out(FLAGS_output.c_str());
+    CHECK(out.good()) << "Can't write " << FLAGS_output;
+    out << json.str();
+    LOG(INFO) << "Report written to " << FLAGS_output;
+  }
+  LOG_IF(WARNING, failures > 0) << failures << " of " << runs << " configurations failed";
+  return failures > 0 ? 1 : 0;
+}